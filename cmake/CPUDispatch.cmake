@@ -0,0 +1,40 @@
+# Runtime CPU dispatch for distance kernels.
+#
+# Each enabled ISA gets its own object library (see the top-level
+# CMakeLists.txt); these definitions tell the dispatcher which tables
+# were compiled in so it can pick the best one at startup. Only the
+# target architecture's kernels are built: the x86 options are forced
+# off on AArch64 and the ARM ones elsewhere, and an AArch64 build whose
+# baseline is still the x86 default gets armv8-a.
+function(configure_cpu_dispatch)
+    if(CMAKE_SYSTEM_PROCESSOR MATCHES "^(aarch64|arm64|ARM64)$")
+        foreach(isa AVX2 AVX512 AMX)
+            set(WOVED_CPU_${isa} OFF)
+            set(WOVED_CPU_${isa} OFF PARENT_SCOPE)
+        endforeach()
+        if(WOVED_CPU_BASELINE STREQUAL "x86-64-v3")
+            set(WOVED_CPU_BASELINE armv8-a PARENT_SCOPE)
+        endif()
+    else()
+        foreach(isa NEON SVE)
+            set(WOVED_CPU_${isa} OFF)
+            set(WOVED_CPU_${isa} OFF PARENT_SCOPE)
+        endforeach()
+    endif()
+
+    if(WOVED_CPU_AVX2)
+        add_compile_definitions(WOVED_KERNELS_AVX2)
+    endif()
+    if(WOVED_CPU_AVX512)
+        add_compile_definitions(WOVED_KERNELS_AVX512)
+    endif()
+    if(WOVED_CPU_AVX512 AND WOVED_CPU_AMX)
+        add_compile_definitions(WOVED_KERNELS_AMX)
+    endif()
+    if(WOVED_CPU_NEON)
+        add_compile_definitions(WOVED_KERNELS_NEON)
+    endif()
+    if(WOVED_CPU_SVE)
+        add_compile_definitions(WOVED_KERNELS_SVE)
+    endif()
+endfunction()
@@ -0,0 +1,48 @@
+# Profile-guided optimization (WOVED_ENABLE_PGO).
+#
+# Two stages in the same build directory, driven by scripts/build.sh --pgo:
+#   generate  instrumented build; running pgo-train (tests/cpp/bench)
+#             writes raw profiles to WOVED_PGO_DIR
+#   use       optimized build from those profiles. Clang needs them merged
+#             into ${WOVED_PGO_DIR}/woved.profdata by llvm-profdata first;
+#             GCC reads the .gcda files as written, matched by object path,
+#             which is why both stages share one build directory.
+# Code the workload never reached is still optimized, just without counts.
+set(WOVED_PGO_STAGE "use" CACHE STRING "PGO stage: generate or use")
+set_property(CACHE WOVED_PGO_STAGE PROPERTY STRINGS generate use)
+set(WOVED_PGO_DIR "${CMAKE_BINARY_DIR}/pgo" CACHE PATH "PGO profile directory")
+
+function(configure_pgo)
+    if(NOT WOVED_PGO_STAGE MATCHES "^(generate|use)$")
+        message(FATAL_ERROR "WOVED_PGO_STAGE must be generate or use, not '${WOVED_PGO_STAGE}'")
+    endif()
+
+    if(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+        if(WOVED_PGO_STAGE STREQUAL "generate")
+            set(flags -fprofile-generate=${WOVED_PGO_DIR})
+        else()
+            set(profile ${WOVED_PGO_DIR}/woved.profdata)
+            if(NOT EXISTS ${profile})
+                message(FATAL_ERROR "PGO: ${profile} not found; run the generate stage and llvm-profdata merge")
+            endif()
+            set(flags -fprofile-use=${profile} -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date)
+        endif()
+    elseif(CMAKE_CXX_COMPILER_ID STREQUAL "GNU")
+        if(WOVED_PGO_STAGE STREQUAL "generate")
+            # Atomic counters: the workload is multithreaded
+            set(flags -fprofile-generate=${WOVED_PGO_DIR} -fprofile-update=atomic)
+        else()
+            if(NOT EXISTS ${WOVED_PGO_DIR})
+                message(FATAL_ERROR "PGO: ${WOVED_PGO_DIR} not found; run the generate stage first")
+            endif()
+            set(flags -fprofile-use=${WOVED_PGO_DIR} -fprofile-partial-training -Wno-missing-profile)
+        endif()
+    else()
+        message(WARNING "PGO: not supported with ${CMAKE_CXX_COMPILER_ID}; building without")
+        return()
+    endif()
+
+    add_compile_options(${flags})
+    add_link_options(${flags})
+    message(STATUS "PGO: ${WOVED_PGO_STAGE} stage, profiles in ${WOVED_PGO_DIR}")
+endfunction()
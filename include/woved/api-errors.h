@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <string_view>
+
+namespace woved {
+
+// Status codes surfaced to clients by the gRPC and HTTP front ends
+enum class ErrorCode {
+    OK = 0,
+    INVALID_ARGUMENT,
+    NOT_FOUND,
+    OVERLOADED,         // Retryable; carries a retry-after hint
+    DEADLINE_EXCEEDED,
+    INTERNAL
+};
+
+// Response metadata key carrying the retry hint (milliseconds) on OVERLOADED
+inline constexpr std::string_view RETRY_AFTER_MS_KEY = "woved-retry-after-ms";
+
+inline constexpr std::string_view errorCodeName(ErrorCode code) {
+    switch (code) {
+        case ErrorCode::OK: return "OK";
+        case ErrorCode::INVALID_ARGUMENT: return "INVALID_ARGUMENT";
+        case ErrorCode::NOT_FOUND: return "NOT_FOUND";
+        case ErrorCode::OVERLOADED: return "OVERLOADED";
+        case ErrorCode::DEADLINE_EXCEEDED: return "DEADLINE_EXCEEDED";
+        case ErrorCode::INTERNAL: return "INTERNAL";
+    }
+    return "UNKNOWN";
+}
+
+} // namespace woved
@@ -9,16 +9,30 @@
 #include <optional>
 #include <span>
 #include <atomic>
+#include <compare>
+#include <limits>
 
 namespace woved {
 
 // Core type definitions
 using VectorId = std::string;
 using VectorIdHash = uint64_t;
+
+// Fixed-width id for uuidv7 collections. Halves are big-endian, so ordering
+// matches the canonical string form and, for UUIDv7, creation time.
+struct VectorUuid {
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+    
+    bool isNil() const { return hi == 0 && lo == 0; }
+    auto operator<=>(const VectorUuid&) const = default;
+};
 using Dimension = uint32_t;
 using Score = float;
 using Timestamp = std::chrono::microseconds;
 using Epoch = uint64_t;
+// A read epoch that sees every write (no snapshot)
+inline constexpr Epoch kLatestEpoch = std::numeric_limits<Epoch>::max();
 
 // Vector data types
 using Vector = std::vector<float>;
@@ -29,6 +43,9 @@ using TenantId = std::string;
 using TenantHash = uint64_t;
 using NamespaceId = std::string;
 using NamespaceHash = uint64_t;
+// Interned tenant / namespace (util::InternTable); 0 is unset
+using TenantOrdinal = uint32_t;
+using NamespaceOrdinal = uint32_t;
 using TagId = uint32_t;
 using TagSet = std::vector<TagId>;
 
@@ -41,6 +58,15 @@ enum class Metric {
     COSINE
 };
 
+// Storage type of vector components, fixed per collection. Vectors are
+// always fp32 at the API; narrower types are encoded at ingest.
+enum class ElementType : uint8_t {
+    FP32,
+    FP16,
+    BF16,
+    INT8  // Symmetric, with a per-vector scale
+};
+
 enum class OperationType {
     INSERT,
     UPSERT,
@@ -49,13 +75,12 @@ enum class OperationType {
 
 // Core vector entry structure
 struct VectorEntry {
-    VectorId id;
+    VectorId id;            // Empty when the id is binary (uuid)
+    VectorUuid uuid;        // Binary id for uuidv7 collections, nil otherwise
     VectorIdHash id_hash;
     Vector vector;
-    TenantId tenant;
-    TenantHash tenant_hash;
-    NamespaceId namespace_id;
-    NamespaceHash namespace_hash;
+    TenantOrdinal tenant = 0;
+    NamespaceOrdinal namespace_id = 0;
     TagSet tags;
     Timestamp created_at;
     Timestamp updated_at;
@@ -72,6 +97,21 @@ struct QueryRequest {
     std::vector<std::string> tags_any;
     std::optional<uint32_t> nprobe;
     std::optional<float> sample_p;
+    std::optional<uint32_t> latency_budget_ms;  // Deadline; unset: query.latency_budget_ms
+};
+
+// Queries executed together under one filter: centroid probing, posting-
+// list loads and bitmap filters are shared, and every scanned vector is
+// scored against all queries at once (LimitsConfig::max_query_batch)
+struct BatchQueryRequest {
+    std::vector<Vector> queries;
+    uint32_t top_k = 10;
+    TenantId tenant;
+    NamespaceId namespace_id;
+    std::vector<std::string> tags_any;
+    std::optional<uint32_t> nprobe;
+    std::optional<float> sample_p;
+    std::optional<uint32_t> latency_budget_ms;  // Deadline; unset: query.latency_budget_ms
 };
 
 struct QueryResult {
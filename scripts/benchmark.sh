@@ -0,0 +1,189 @@
+set -euo pipefail
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(cd "${SCRIPT_DIR}/.." && pwd)"
+BUILD_DIR="${BUILD_DIR:-${PROJECT_ROOT}/build}"
+
+# Benchmark configuration
+BENCH="${BENCH:-kernel-bench}"
+BENCH_FILTER="${BENCH_FILTER:-.}"
+BENCH_MIN_TIME="${BENCH_MIN_TIME:-0.2}"
+BENCH_REPETITIONS="${BENCH_REPETITIONS:-3}"
+OUTPUT="${OUTPUT:-${BUILD_DIR}/${BENCH}.json}"
+BASELINE="${BASELINE:-}"
+# Fail when a benchmark's median GFLOP/s drops by more than this fraction
+MAX_REGRESSION="${MAX_REGRESSION:-0.05}"
+
+# Soak run (--soak): soak-bench against wovedd. Without SOAK_HOST a server
+# is started on SOAK_CONFIG with a fresh SOAK_DATA_DIR and stopped after.
+SOAK="${SOAK:-OFF}"
+SOAK_HOST="${SOAK_HOST:-}"
+SOAK_PORT="${SOAK_PORT:-8080}"
+SOAK_METRICS_PORT="${SOAK_METRICS_PORT:-9091}"
+SOAK_CONFIG="${SOAK_CONFIG:-${PROJECT_ROOT}/configs/woved-bench.yaml}"
+SOAK_DATA_DIR="${SOAK_DATA_DIR:-/tmp/woved-soak}"
+SOAK_DURATION_S="${SOAK_DURATION_S:-600}"
+SOAK_INTERVAL_MS="${SOAK_INTERVAL_MS:-1000}"
+SOAK_DIM="${SOAK_DIM:-768}"
+SOAK_QUERY_THREADS="${SOAK_QUERY_THREADS:-8}"
+SOAK_QUERY_QPS="${SOAK_QUERY_QPS:-0}"
+SOAK_UPSERT_THREADS="${SOAK_UPSERT_THREADS:-4}"
+SOAK_UPSERT_QPS="${SOAK_UPSERT_QPS:-0}"
+SOAK_BATCH="${SOAK_BATCH:-100}"
+SOAK_OUTPUT="${SOAK_OUTPUT:-${BUILD_DIR}/soak.jsonl}"
+
+# Colors
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+log_info() {
+    echo -e "${GREEN}[INFO]${NC} $1"
+}
+
+log_warn() {
+    echo -e "${YELLOW}[WARN]${NC} $1"
+}
+
+log_error() {
+    echo -e "${RED}[ERROR]${NC} $1"
+}
+
+# Parse arguments
+while [[ $# -gt 0 ]]; do
+    case $1 in
+        --bench)
+            BENCH="$2"
+            shift 2
+            ;;
+        --filter)
+            BENCH_FILTER="$2"
+            shift 2
+            ;;
+        --baseline)
+            BASELINE="$2"
+            shift 2
+            ;;
+        --output)
+            OUTPUT="$2"
+            SOAK_OUTPUT="$2"
+            shift 2
+            ;;
+        --max-regression)
+            MAX_REGRESSION="$2"
+            shift 2
+            ;;
+        --soak)
+            SOAK="ON"
+            shift
+            ;;
+        --duration)
+            SOAK_DURATION_S="$2"
+            shift 2
+            ;;
+        *)
+            log_error "Unknown option: $1"
+            exit 1
+            ;;
+    esac
+done
+
+# Soak: one JSON line per interval to SOAK_OUTPUT, no baseline comparison
+run_soak() {
+    local binary="${BUILD_DIR}/tests/cpp/bench/soak-bench"
+    if [[ ! -x "${binary}" ]]; then
+        log_error "${binary} not built (configure with -DWOVED_BUILD_BENCH=ON)"
+        exit 1
+    fi
+
+    local host="${SOAK_HOST}"
+    if [[ -z "${host}" ]]; then
+        host="127.0.0.1"
+        rm -rf "${SOAK_DATA_DIR}"
+        mkdir -p "${SOAK_DATA_DIR}"
+        log_info "Starting wovedd on ${SOAK_CONFIG}..."
+        WOVED_DATA_DIR="${SOAK_DATA_DIR}" "${BUILD_DIR}/wovedd" --config "${SOAK_CONFIG}" &
+        WOVED_PID=$!
+        trap 'kill ${WOVED_PID} 2>/dev/null || true; wait ${WOVED_PID} 2>/dev/null || true' EXIT
+        for _ in $(seq 1 60); do
+            curl -sf "http://${host}:${SOAK_PORT}/health" >/dev/null && break
+            sleep 1
+        done
+    fi
+
+    log_info "Soaking ${host}:${SOAK_PORT} for ${SOAK_DURATION_S}s..."
+    "${binary}" \
+        --host="${host}" \
+        --port="${SOAK_PORT}" \
+        --metrics_port="${SOAK_METRICS_PORT}" \
+        --dim="${SOAK_DIM}" \
+        --query_threads="${SOAK_QUERY_THREADS}" \
+        --query_qps="${SOAK_QUERY_QPS}" \
+        --upsert_threads="${SOAK_UPSERT_THREADS}" \
+        --upsert_qps="${SOAK_UPSERT_QPS}" \
+        --batch="${SOAK_BATCH}" \
+        --duration_s="${SOAK_DURATION_S}" \
+        --interval_ms="${SOAK_INTERVAL_MS}" \
+        --out="${SOAK_OUTPUT}"
+    log_info "Time series in ${SOAK_OUTPUT}"
+}
+
+if [[ "${SOAK}" == "ON" ]]; then
+    run_soak
+    exit 0
+fi
+
+BINARY="${BUILD_DIR}/tests/cpp/bench/${BENCH}"
+if [[ ! -x "${BINARY}" ]]; then
+    log_error "${BINARY} not built (configure with -DWOVED_BUILD_BENCH=ON)"
+    exit 1
+fi
+
+log_info "Running ${BENCH} (filter: ${BENCH_FILTER})..."
+"${BINARY}" \
+    --benchmark_filter="${BENCH_FILTER}" \
+    --benchmark_min_time="${BENCH_MIN_TIME}" \
+    --benchmark_repetitions="${BENCH_REPETITIONS}" \
+    --benchmark_report_aggregates_only=true \
+    --benchmark_out="${OUTPUT}" \
+    --benchmark_out_format=json
+
+if [[ -z "${BASELINE}" ]]; then
+    log_info "Results in ${OUTPUT}; no baseline to compare against"
+    exit 0
+fi
+if [[ ! -f "${BASELINE}" ]]; then
+    log_warn "Baseline ${BASELINE} not found; skipping comparison"
+    exit 0
+fi
+
+# Compare medians: GFLOP/s where the benchmark reports it, else real time
+log_info "Comparing against ${BASELINE} (max regression ${MAX_REGRESSION})..."
+python3 - "${BASELINE}" "${OUTPUT}" "${MAX_REGRESSION}" <<'PY'
+import json
+import sys
+
+def medians(path):
+    with open(path) as f:
+        runs = json.load(f)["benchmarks"]
+    return {r["run_name"]: r for r in runs if r.get("aggregate_name") == "median"}
+
+base, new, limit = medians(sys.argv[1]), medians(sys.argv[2]), float(sys.argv[3])
+regressions = 0
+for name, run in sorted(new.items()):
+    old = base.get(name)
+    if old is None:
+        continue
+    if "GFLOP/s" in run and old.get("GFLOP/s"):
+        change = run["GFLOP/s"] / old["GFLOP/s"] - 1
+    else:
+        change = old["real_time"] / run["real_time"] - 1
+    if change < -limit:
+        regressions += 1
+        print(f"REGRESSION {name}: {change:+.1%}")
+print(f"{len(new)} benchmarks, {regressions} regressed by more than {limit:.0%}")
+sys.exit(1 if regressions else 0)
+PY
+
+log_info "Benchmarks completed!"
@@ -93,7 +93,8 @@ Options:
     --pmem              Enable persistent memory support
     --no-tests          Disable building tests
     --no-bench          Disable building benchmarks
-    --pgo               Enable profile-guided optimization
+    --pgo               Profile-guided optimization: instrumented build,
+                        pgo-train run, optimized build (PGO_TRAIN_ARGS)
     --prefix PATH       Installation prefix (default: /opt/woved)
     --jobs N, -j N      Number of parallel build jobs (default: nproc)
     --help              Show this help message
@@ -199,6 +200,35 @@ if [ "${BUILD_TYPE}" == "Release" ] || [ "${BUILD_TYPE}" == "RelWithDebInfo" ];
     )
 fi
 
+# Profile-guided optimization: an instrumented pgo-train run first, then
+# the real build from its profiles, both in this build directory
+if [ "${ENABLE_PGO}" == "ON" ]; then
+    PGO_DIR="${BUILD_DIR}/pgo"
+    log_info "PGO stage 1: instrumented build of pgo-train..."
+    cmake "${cmake_args[@]}" -DWOVED_BUILD_BENCH=ON -DWOVED_PGO_STAGE=generate \
+        -DWOVED_PGO_DIR="${PGO_DIR}" "${PROJECT_ROOT}"
+    ninja -j "${PARALLEL_JOBS}" pgo-train
+
+    log_info "PGO: running the training workload..."
+    rm -rf "${PGO_DIR}"
+    # PGO_TRAIN_ARGS: e.g. "--rows=1000000 --ingest_s=120"
+    (cd "${PROJECT_ROOT}" && "${BUILD_DIR}/tests/cpp/bench/pgo-train" \
+        --config=configs/woved-bench.yaml ${PGO_TRAIN_ARGS:-})
+
+    if "${CXX}" --version | grep -q clang; then
+        CLANG_MAJOR=$("${CXX}" --version | grep -oP 'version \K[0-9]+' | head -1)
+        PROFDATA="llvm-profdata"
+        if command -v "llvm-profdata-${CLANG_MAJOR}" &> /dev/null; then
+            PROFDATA="llvm-profdata-${CLANG_MAJOR}"
+        fi
+        check_command "${PROFDATA}"
+        "${PROFDATA}" merge -o "${PGO_DIR}/woved.profdata" "${PGO_DIR}"/*.profraw
+    fi
+
+    log_info "PGO stage 2: optimized build..."
+    cmake_args+=(-DWOVED_PGO_STAGE=use -DWOVED_PGO_DIR="${PGO_DIR}")
+fi
+
 cmake "${cmake_args[@]}" "${PROJECT_ROOT}"
 
 # Build
@@ -9,25 +9,79 @@ DATA_DIR="/tmp/woved_test"
 KILL_POINTS=("wal_append" "segment_flush" "compaction_merge" "buffer_drain")
 ITERATIONS="${ITERATIONS:-10}"
 
+# Recovery benchmark (--bench): per data size and kill point, the time
+# from restarting wovedd to its first answered query and to full query
+# throughput (FULL_FRACTION of the rate before the kill), checked
+# against recovery.max_recovery_time_s of BENCH_CONFIG.
+BENCH="OFF"
+BENCH_CONFIG="${BENCH_CONFIG:-${PROJECT_ROOT}/configs/woved-bench.yaml}"
+BENCH_SIZES="${BENCH_SIZES:-10000000,100000000}"
+BENCH_DIM="${BENCH_DIM:-128}"
+BENCH_PORT="${BENCH_PORT:-8080}"
+BENCH_METRICS_PORT="${BENCH_METRICS_PORT:-9091}"
+BENCH_QUERY_THREADS="${BENCH_QUERY_THREADS:-8}"
+BENCH_LOAD_THREADS="${BENCH_LOAD_THREADS:-8}"
+BENCH_BATCH="${BENCH_BATCH:-1000}"
+BENCH_BASELINE_S="${BENCH_BASELINE_S:-30}"    # Query run measuring full throughput
+BENCH_KILL_WAIT_S="${BENCH_KILL_WAIT_S:-60}"  # For the armed point; then SIGKILL anyway
+BENCH_WATCH_S="${BENCH_WATCH_S:-300}"         # Longest wait for first query and full throughput
+BENCH_OUTPUT="${BENCH_OUTPUT:-${BUILD_DIR}/recovery-bench.jsonl}"
+FULL_FRACTION="${FULL_FRACTION:-0.9}"
+MAX_RECOVERY_TIME_S="${MAX_RECOVERY_TIME_S:-$(awk '/^recovery:/ {r = 1; next} /^[^ #]/ {r = 0}
+    r && $1 == "max_recovery_time_s:" {print $2; exit}' "${BENCH_CONFIG}" 2>/dev/null)}"
+MAX_RECOVERY_TIME_S="${MAX_RECOVERY_TIME_S:-30}"
+
 log_info() {
     echo "[INFO] $1"
 }
 
+log_warn() {
+    echo "[WARN] $1"
+}
+
 log_error() {
     echo "[ERROR] $1"
 }
 
+# Parse arguments
+while [[ $# -gt 0 ]]; do
+    case $1 in
+        --bench)
+            BENCH="ON"
+            shift
+            ;;
+        --sizes)
+            BENCH_SIZES="$2"
+            shift 2
+            ;;
+        --iterations)
+            ITERATIONS="$2"
+            shift 2
+            ;;
+        --output)
+            BENCH_OUTPUT="$2"
+            shift 2
+            ;;
+        *)
+            log_error "Unknown option: $1"
+            exit 1
+            ;;
+    esac
+done
+
 # Setup test environment
 setup_test() {
+    local kill_point=$1
     rm -rf "${DATA_DIR}"
     mkdir -p "${DATA_DIR}"
-    
+
     # Start wovedd with fault injection enabled
     WOVED_FAULT_INJECTION=1 \
+    WOVED_KILL_AT="${kill_point}" \
     WOVED_DATA_DIR="${DATA_DIR}" \
     "${BUILD_DIR}/wovedd" \
         --config "${PROJECT_ROOT}/configs/woved-dev.yaml" &
-    
+
     WOVED_PID=$!
     sleep 2
 }
@@ -36,28 +90,28 @@ setup_test() {
 inject_fault() {
     local kill_point=$1
     log_info "Injecting fault at: ${kill_point}"
-    
-    # Send signal to trigger fault
+
+    # Arm the kill point (util/fault-point.h)
     kill -USR1 ${WOVED_PID} 2>/dev/null || true
-    
+
     # Force kill
     sleep 0.5
     kill -9 ${WOVED_PID} 2>/dev/null || true
-    
+
     wait ${WOVED_PID} 2>/dev/null || true
 }
 
 # Verify recovery
 verify_recovery() {
     log_info "Verifying recovery..."
-    
+
     # Start server again
     WOVED_RECOVERY_CHECK=1 \
     WOVED_DATA_DIR="${DATA_DIR}" \
     timeout 30 "${BUILD_DIR}/wovedd" \
         --config "${PROJECT_ROOT}/configs/woved-dev.yaml" \
         --recovery-only
-    
+
     if [[ $? -eq 0 ]]; then
         log_info "Recovery successful!"
         return 0
@@ -67,27 +121,240 @@ verify_recovery() {
     fi
 }
 
+now_ms() {
+    date +%s%3N
+}
+
+# wovedd on BENCH_CONFIG over $1; extra VAR=value environment after it
+start_server() {
+    local data_dir=$1
+    shift
+    env "$@" WOVED_DATA_DIR="${data_dir}" "${BUILD_DIR}/wovedd" --config "${BENCH_CONFIG}" &
+    WOVED_PID=$!
+}
+
+stop_server() {
+    kill ${WOVED_PID} 2>/dev/null || true
+    wait ${WOVED_PID} 2>/dev/null || true
+}
+
+wait_healthy() {
+    for _ in $(seq 1 "${BENCH_WATCH_S}"); do
+        curl -sf "http://127.0.0.1:${BENCH_PORT}/health" >/dev/null && return 0
+        sleep 1
+    done
+    return 1
+}
+
+soak() {
+    "${BUILD_DIR}/tests/cpp/bench/soak-bench" \
+        --port="${BENCH_PORT}" \
+        --metrics_port="${BENCH_METRICS_PORT}" \
+        --dim="${BENCH_DIM}" \
+        --batch="${BENCH_BATCH}" \
+        "$@"
+}
+
+# Milliseconds from $1 (now_ms) to the first search answered 200, or
+# empty after BENCH_WATCH_S
+first_query_ms() {
+    local t0=$1
+    local deadline=$((t0 + BENCH_WATCH_S * 1000))
+    while [[ $(now_ms) -lt ${deadline} ]]; do
+        local code
+        code=$(curl -s -o /dev/null -w '%{http_code}' --max-time 1 \
+            -H 'Content-Type: application/octet-stream' --data-binary @"${QUERY_FILE}" \
+            "http://127.0.0.1:${BENCH_PORT}/v1/search?top_k=10" || true)
+        if [[ "${code}" == "200" ]]; then
+            echo $(( $(now_ms) - t0 ))
+            return 0
+        fi
+        sleep 0.01
+    done
+}
+
+# Answered queries per second of a soak-bench summary
+summary_qps() {
+    python3 -c '
+import json, sys
+for line in open(sys.argv[1]):
+    row = json.loads(line)
+    if row.get("summary"):
+        print(row["query_ok_qps"])
+' "$1"
+}
+
+# Milliseconds into soak-bench output $1 at the end of the first interval
+# at FULL_FRACTION of $2 queries per second, or empty
+full_throughput_ms() {
+    python3 -c '
+import json, sys
+target = float(sys.argv[2]) * float(sys.argv[3])
+for line in open(sys.argv[1]):
+    row = json.loads(line)
+    if not row.get("summary") and "t_s" in row and row["query_ok_qps"] >= target:
+        print(int(row["t_s"] * 1000))
+        break
+' "$1" "$2" "${FULL_FRACTION}"
+}
+
+# Loads `size` rows into a template data directory and measures the query
+# rate over it; each run starts from a copy
+prepare_size() {
+    local size=$1
+    TEMPLATE_DIR="${DATA_DIR}-template-${size}"
+    rm -rf "${TEMPLATE_DIR}"
+    mkdir -p "${TEMPLATE_DIR}"
+    log_info "Loading ${size} rows of dim ${BENCH_DIM}..."
+    start_server "${TEMPLATE_DIR}"
+    wait_healthy || { log_error "wovedd did not come up"; exit 1; }
+    soak --load="${size}" --upsert_threads="${BENCH_LOAD_THREADS}" --query_threads=0 --duration_s=0 \
+        --out="${WORK_DIR}/load-${size}.jsonl"
+    soak --query_threads="${BENCH_QUERY_THREADS}" --upsert_threads=0 --duration_s="${BENCH_BASELINE_S}" \
+        --out="${WORK_DIR}/baseline-${size}.jsonl"
+    BASELINE_QPS=$(summary_qps "${WORK_DIR}/baseline-${size}.jsonl")
+    stop_server
+    log_info "Full throughput at ${size} rows: ${BASELINE_QPS} queries/s"
+}
+
+# One kill and restart; appends a JSON line to BENCH_OUTPUT
+bench_once() {
+    local size=$1 kill_point=$2 iteration=$3
+    rm -rf "${DATA_DIR}"
+    cp -a "${TEMPLATE_DIR}" "${DATA_DIR}"
+
+    # Writes keep every kill point busy while armed
+    start_server "${DATA_DIR}" WOVED_FAULT_INJECTION=1 WOVED_KILL_AT="${kill_point}"
+    wait_healthy || { log_error "wovedd did not come up"; exit 1; }
+    soak --keys="${size}" --upsert_threads=4 --query_threads=0 --duration_s="${BENCH_WATCH_S}" \
+        --out=/dev/null 2>/dev/null &
+    local soak_pid=$!
+    sleep $((RANDOM % 3 + 1))
+    kill -USR1 ${WOVED_PID} 2>/dev/null || true
+    local forced=false
+    local waited=0
+    while kill -0 ${WOVED_PID} 2>/dev/null && [[ ${waited} -lt $((BENCH_KILL_WAIT_S * 10)) ]]; do
+        sleep 0.1
+        waited=$((waited + 1))
+    done
+    if kill -0 ${WOVED_PID} 2>/dev/null; then
+        # The point was not reached in time (e.g. no compaction ran)
+        forced=true
+        kill -9 ${WOVED_PID} 2>/dev/null || true
+    fi
+    wait ${WOVED_PID} 2>/dev/null || true
+    kill ${soak_pid} 2>/dev/null || true
+    wait ${soak_pid} 2>/dev/null || true
+
+    local t0
+    t0=$(now_ms)
+    start_server "${DATA_DIR}"
+    local first_ms
+    first_ms=$(first_query_ms "${t0}")
+    local full_ms=""
+    if [[ -n "${first_ms}" ]]; then
+        local series="${WORK_DIR}/restart-${size}-${kill_point}-${iteration}.jsonl"
+        local soak_start=$(( $(now_ms) - t0 ))
+        soak --query_threads="${BENCH_QUERY_THREADS}" --upsert_threads=0 --interval_ms=250 \
+            --duration_s="${BENCH_WATCH_S}" --out="${series}" || true
+        local offset
+        offset=$(full_throughput_ms "${series}" "${BASELINE_QPS}")
+        [[ -n "${offset}" ]] && full_ms=$((soak_start + offset))
+    fi
+    stop_server
+
+    python3 -c '
+import json, sys
+size, point, iteration, forced, first, full, slo, baseline = sys.argv[1:]
+first_s = int(first) / 1000 if first else None
+full_s = int(full) / 1000 if full else None
+print(json.dumps({
+    "rows": int(size), "kill_point": point, "iteration": int(iteration), "forced_kill": forced == "true",
+    "first_query_s": first_s, "full_throughput_s": full_s, "baseline_qps": float(baseline),
+    "max_recovery_time_s": float(slo),
+    "ok": first_s is not None and full_s is not None and full_s <= float(slo),
+}))
+' "${size}" "${kill_point}" "${iteration}" "${forced}" "${first_ms}" "${full_ms}" \
+        "${MAX_RECOVERY_TIME_S}" "${BASELINE_QPS}" >> "${BENCH_OUTPUT}"
+    log_info "${kill_point} #${iteration}: first query ${first_ms:-none} ms, full throughput ${full_ms:-none} ms"
+}
+
+run_bench() {
+    if [[ ! -x "${BUILD_DIR}/tests/cpp/bench/soak-bench" ]]; then
+        log_error "soak-bench not built (configure with -DWOVED_BUILD_BENCH=ON)"
+        exit 1
+    fi
+    WORK_DIR="$(mktemp -d)"
+    QUERY_FILE="${WORK_DIR}/query.f32"
+    python3 -c 'import struct, sys; d = int(sys.argv[1]); sys.stdout.buffer.write(struct.pack("<%df" % d, *([1.0] * d)))' \
+        "${BENCH_DIM}" > "${QUERY_FILE}"
+    trap 'kill ${WOVED_PID:-} 2>/dev/null || true; rm -rf "${WORK_DIR}"' EXIT
+    : > "${BENCH_OUTPUT}"
+
+    IFS=',' read -r -a sizes <<< "${BENCH_SIZES}"
+    for size in "${sizes[@]}"; do
+        prepare_size "${size}"
+        for kill_point in "${KILL_POINTS[@]}"; do
+            for i in $(seq 1 "${ITERATIONS}"); do
+                bench_once "${size}" "${kill_point}" "${i}"
+            done
+        done
+        rm -rf "${TEMPLATE_DIR}"
+    done
+
+    # Worst case per size and kill point against the SLO
+    python3 -c '
+import json, sys
+worst = {}
+for line in open(sys.argv[1]):
+    row = json.loads(line)
+    key = (row["rows"], row["kill_point"])
+    w = worst.setdefault(key, {"first": 0.0, "full": 0.0, "ok": True, "forced": 0})
+    w["first"] = max(w["first"], row["first_query_s"] if row["first_query_s"] is not None else float("inf"))
+    w["full"] = max(w["full"], row["full_throughput_s"] if row["full_throughput_s"] is not None else float("inf"))
+    w["ok"] = w["ok"] and row["ok"]
+    w["forced"] += row["forced_kill"]
+slo = float(sys.argv[2])
+failed = False
+print("%12s %-18s %14s %18s %7s  %s" % ("rows", "kill point", "first query s", "full throughput s", "forced", ""))
+for (rows, point), w in sorted(worst.items()):
+    print("%12d %-18s %14.2f %18.2f %7d  %s" % (rows, point, w["first"], w["full"], w["forced"],
+                                               "ok" if w["ok"] else "OVER %gs" % slo))
+    failed = failed or not w["ok"]
+sys.exit(1 if failed else 0)
+' "${BENCH_OUTPUT}" "${MAX_RECOVERY_TIME_S}"
+}
+
+if [[ "${BENCH}" == "ON" ]]; then
+    if run_bench; then
+        log_info "Recovery within ${MAX_RECOVERY_TIME_S}s everywhere; results in ${BENCH_OUTPUT}"
+        exit 0
+    fi
+    log_error "Recovery over ${MAX_RECOVERY_TIME_S}s; results in ${BENCH_OUTPUT}"
+    exit 1
+fi
+
 # Run fault injection tests
 for kill_point in "${KILL_POINTS[@]}"; do
     for i in $(seq 1 ${ITERATIONS}); do
         log_info "Test iteration ${i}/${ITERATIONS} for ${kill_point}"
-        
-        setup_test
-        
+
+        setup_test "${kill_point}"
+
         # Insert some data
         "${BUILD_DIR}/tools/woved-bench/woved-bench" \
             --mode insert \
             --count 1000 \
             --batch 100 &
-        
+
         BENCH_PID=$!
-        
+
         # Wait random time then inject fault
         sleep $((RANDOM % 3 + 1))
         inject_fault "${kill_point}"
-        
+
         kill ${BENCH_PID} 2>/dev/null || true
-        
+
         # Verify recovery
         if ! verify_recovery; then
             log_error "Recovery failed at ${kill_point}, iteration ${i}"
@@ -96,4 +363,4 @@ for kill_point in "${KILL_POINTS[@]}"; do
     done
 done
 
-log_info "All fault injection tests passed!"
\ No newline at end of file
+log_info "All fault injection tests passed!"
@@ -0,0 +1,575 @@
+#include "coordinator.h"
+#include "core/config.h"
+#include "proto/woved.grpc.pb.h"
+#include "util/cancellation.h"
+#include "util/exceptions.h"
+#include "util/intern-table.h"
+#include "util/logging.h"
+#include "util/uuid-v7.h"
+#include <grpcpp/grpcpp.h>
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <mutex>
+#include <numeric>
+
+namespace woved::api {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Recent call latencies kept per shard for its hedge delay, which is
+// recomputed every kHedgeRefresh calls
+constexpr size_t kLatencyRing = 256;
+constexpr size_t kHedgeRefresh = 32;
+// Until a shard has that many samples
+constexpr auto kDefaultHedge = std::chrono::milliseconds(20);
+// How often a wait looks at the request's cancellation token
+constexpr auto kCancelPoll = std::chrono::milliseconds(5);
+
+// Jump consistent hash (Lamping and Veach)
+size_t jumpHash(uint64_t key, size_t buckets) {
+    int64_t b = -1;
+    int64_t j = 0;
+    while (j < static_cast<int64_t>(buckets)) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = static_cast<int64_t>(static_cast<double>(b + 1) *
+                                 (static_cast<double>(int64_t{1} << 31) / static_cast<double>((key >> 33) + 1)));
+    }
+    return static_cast<size_t>(b);
+}
+
+std::vector<std::string> splitAddresses(const std::string& list) {
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (start <= list.size()) {
+        const size_t comma = std::min(list.find(',', start), list.size());
+        std::string address = list.substr(start, comma - start);
+        std::erase_if(address, [](char c) { return c == ' ' || c == '\t'; });
+        if (!address.empty()) out.push_back(std::move(address));
+        start = comma + 1;
+    }
+    return out;
+}
+
+std::chrono::system_clock::time_point wallDeadline(Clock::time_point deadline) {
+    return std::chrono::system_clock::now() +
+           std::chrono::duration_cast<std::chrono::system_clock::duration>(deadline - Clock::now());
+}
+
+HandlerStatus toHandlerStatus(size_t shard, const grpc::Status& status, std::chrono::milliseconds retry_after) {
+    std::string message = "shard " + std::to_string(shard) + ": " + status.error_message();
+    switch (status.error_code()) {
+        case grpc::StatusCode::OK:
+            return {};
+        case grpc::StatusCode::INVALID_ARGUMENT:
+            return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, std::move(message));
+        case grpc::StatusCode::NOT_FOUND:
+            return HandlerStatus::error(ErrorCode::NOT_FOUND, std::move(message));
+        case grpc::StatusCode::RESOURCE_EXHAUSTED:
+            return {ErrorCode::OVERLOADED, std::move(message), retry_after};
+        case grpc::StatusCode::DEADLINE_EXCEEDED:
+            return HandlerStatus::error(ErrorCode::DEADLINE_EXCEEDED, std::move(message));
+        default:
+            return HandlerStatus::error(ErrorCode::INTERNAL, std::move(message));
+    }
+}
+
+void toRecord(const VectorEntry& entry, bool uuid_ids, v1::Record& record) {
+    record.set_id(uuid_ids ? util::uuid_to_string(entry.uuid) : entry.id);
+    record.mutable_vector()->Add(entry.vector.begin(), entry.vector.end());
+    record.set_tenant(util::InternTable::tenants().name(entry.tenant));
+    record.set_namespace_(util::InternTable::namespaces().name(entry.namespace_id));
+    for (TagId tag : entry.tags) record.add_tags(util::InternTable::tags().name(tag));
+}
+
+// Shard hits merged best first, top k
+std::vector<QueryResult> mergeHits(std::vector<QueryResult> hits, size_t k) {
+    const auto better = [](const QueryResult& a, const QueryResult& b) { return a.score > b.score; };
+    if (hits.size() > k) {
+        std::nth_element(hits.begin(), hits.begin() + static_cast<std::ptrdiff_t>(k), hits.end(), better);
+        hits.resize(k);
+    }
+    std::sort(hits.begin(), hits.end(), better);
+    return hits;
+}
+
+void appendHits(const v1::SearchResponse& response, std::vector<QueryResult>& hits) {
+    for (const auto& hit : response.hits()) hits.push_back({hit.id(), hit.score(), {}, hit.segment_id()});
+}
+
+} // namespace
+
+struct Coordinator::Replica {
+    std::string address;
+    std::unique_ptr<v1::VectorService::Stub> stub;
+    std::atomic<int64_t> ewma_us{0};  // 0 until it has answered
+};
+
+struct Coordinator::Shard {
+    std::vector<std::unique_ptr<Replica>> replicas;
+    std::mutex mutex;
+    std::array<uint32_t, kLatencyRing> latency_us{};
+    size_t samples = 0;
+    std::atomic<int64_t> hedge_after_us{std::chrono::microseconds(kDefaultHedge).count()};
+
+    // Replicas fastest first; one that has not answered yet counts as fastest
+    std::vector<size_t> order() const {
+        std::vector<size_t> out(replicas.size());
+        std::iota(out.begin(), out.end(), size_t{0});
+        std::stable_sort(out.begin(), out.end(), [&](size_t a, size_t b) {
+            return replicas[a]->ewma_us.load(std::memory_order_relaxed) <
+                   replicas[b]->ewma_us.load(std::memory_order_relaxed);
+        });
+        return out;
+    }
+
+    void record(Replica& replica, std::chrono::microseconds took, bool ok, double quantile) {
+        const int64_t us = took.count();
+        const int64_t old = replica.ewma_us.load(std::memory_order_relaxed);
+        // A failure counts as a slow answer, so the replica drops down the order
+        const int64_t sample = ok ? us : std::max<int64_t>(4 * std::max(old, us), 100000);
+        replica.ewma_us.store(old == 0 ? sample : (7 * old + sample) / 8, std::memory_order_relaxed);
+        if (!ok) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        latency_us[samples % kLatencyRing] = static_cast<uint32_t>(std::min<int64_t>(us, UINT32_MAX));
+        if (++samples % kHedgeRefresh != 0) return;
+        std::vector<uint32_t> window(latency_us.begin(), latency_us.begin() + std::min(samples, kLatencyRing));
+        const auto at = static_cast<size_t>(quantile * static_cast<double>(window.size() - 1));
+        std::nth_element(window.begin(), window.begin() + static_cast<std::ptrdiff_t>(at), window.end());
+        hedge_after_us.store(std::max<int64_t>(window[at], 500), std::memory_order_relaxed);
+    }
+};
+
+template <typename Response>
+struct Coordinator::Outcome {
+    grpc::Status status{grpc::StatusCode::DEADLINE_EXCEEDED, "no answer before the deadline"};
+    Response response;
+    std::chrono::milliseconds retry_after{0};
+};
+
+Coordinator::Options Coordinator::Options::fromConfig(const Config& config) {
+    Options options;
+    for (size_t i = 0; i < config.cluster.shards.size(); ++i) {
+        auto nodes = splitAddresses(config.cluster.shards[i]);
+        if (nodes.empty()) throw util::ConfigException("cluster.shards[" + std::to_string(i) + "] lists no nodes");
+        options.shards.push_back(std::move(nodes));
+    }
+    if (options.shards.empty()) throw util::ConfigException("coordinator mode needs cluster.shards");
+    options.uuid_ids = config.collection.id_type == "uuidv7";
+    options.timeout = std::chrono::milliseconds(config.query.timeout_ms);
+    options.write_timeout = std::chrono::milliseconds(config.cluster.write_timeout_ms);
+    options.hedge_after = std::chrono::milliseconds(config.cluster.hedge_after_ms);
+    options.hedge_quantile = std::clamp<double>(config.cluster.hedge_quantile, 0.5, 0.999);
+    options.allow_partial = config.cluster.allow_partial;
+    options.max_message_bytes = config.limits.max_request_size_bytes;
+    return options;
+}
+
+Coordinator::Coordinator(const Options& options) : options_(options) {
+    if (options_.shards.empty()) throw util::ConfigException("coordinator without shards");
+    grpc::ChannelArguments args;
+    const int max_message = static_cast<int>(std::min<uint64_t>(options_.max_message_bytes, INT32_MAX));
+    args.SetMaxSendMessageSize(max_message);
+    args.SetMaxReceiveMessageSize(max_message);
+    for (const auto& nodes : options_.shards) {
+        if (nodes.empty()) throw util::ConfigException("coordinator shard without nodes");
+        auto shard = std::make_unique<Shard>();
+        for (const auto& address : nodes) {
+            auto replica = std::make_unique<Replica>();
+            replica->address = address;
+            replica->stub = v1::VectorService::NewStub(
+                grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(), args));
+            shard->replicas.push_back(std::move(replica));
+        }
+        shards_.push_back(std::move(shard));
+    }
+    LOG_INFO("coordinator: {} shards", shards_.size());
+}
+
+Coordinator::~Coordinator() = default;
+
+VecHandler::Backend Coordinator::backend() {
+    VecHandler::Backend backend;
+    backend.upsert = [this](std::vector<VectorEntry>& entries) { return upsert(entries); };
+    backend.remove = [this](std::vector<VectorEntry>& entries) { return remove(entries); };
+    backend.get = [this](const VectorEntry& key) { return get(key); };
+    backend.search = [this](const QueryRequest& request, const util::CancellationToken& cancel) {
+        return search(request, cancel);
+    };
+    backend.search_batch = [this](const BatchQueryRequest& request, const util::CancellationToken& cancel) {
+        return searchBatch(request, cancel);
+    };
+    return backend;
+}
+
+size_t Coordinator::shardOf(VectorIdHash id_hash) const {
+    return jumpHash(id_hash, shards_.size());
+}
+
+template <typename Request, typename Response, typename Prepare>
+std::vector<Coordinator::Outcome<Response>> Coordinator::scatter(Prepare prepare, const std::vector<size_t>& targets,
+                                                                 const std::vector<const Request*>& requests,
+                                                                 Clock::time_point deadline, bool read,
+                                                                 const util::CancellationToken* cancel) {
+    struct Attempt {
+        size_t target;
+        Replica* replica;
+        bool hedge;
+        Clock::time_point sent;
+        grpc::ClientContext context;
+        Response response;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> reader;
+        bool finished = false;
+    };
+    struct Target {
+        std::vector<size_t> order;
+        size_t next = 0;       // In `order`
+        size_t in_flight = 0;
+        bool done = false;
+        Clock::time_point hedge_at = Clock::time_point::max();
+    };
+
+    std::vector<Outcome<Response>> outcomes(targets.size());
+    std::vector<Target> state(targets.size());
+    std::vector<std::unique_ptr<Attempt>> attempts;
+    grpc::CompletionQueue cq;
+    const auto wall_deadline = wallDeadline(deadline);
+
+    auto send = [&](size_t t, bool hedge) {
+        Target& target = state[t];
+        Shard& shard = *shards_[targets[t]];
+        auto attempt = std::make_unique<Attempt>();
+        attempt->target = t;
+        attempt->replica = shard.replicas[target.order[target.next++]].get();
+        attempt->hedge = hedge;
+        attempt->sent = Clock::now();
+        attempt->context.set_deadline(wall_deadline);
+        attempt->reader = (attempt->replica->stub.get()->*prepare)(&attempt->context, *requests[t], &cq);
+        attempt->reader->StartCall();
+        attempt->reader->Finish(&attempt->response, &attempt->status, attempt.get());
+        target.in_flight++;
+        const auto after = options_.hedge_after.count() > 0
+                               ? std::chrono::duration_cast<Clock::duration>(options_.hedge_after)
+                               : std::chrono::duration_cast<Clock::duration>(std::chrono::microseconds(
+                                     shard.hedge_after_us.load(std::memory_order_relaxed)));
+        target.hedge_at = read && target.next < target.order.size() ? attempt->sent + after : Clock::time_point::max();
+        calls_.fetch_add(1, std::memory_order_relaxed);
+        if (hedge) hedges_.fetch_add(1, std::memory_order_relaxed);
+        attempts.push_back(std::move(attempt));
+    };
+
+    for (size_t t = 0; t < targets.size(); ++t) {
+        // Writes only go to the shard's write node
+        state[t].order = read ? shards_[targets[t]]->order() : std::vector<size_t>{0};
+        send(t, false);
+    }
+
+    size_t open = targets.size();
+    while (open > 0) {
+        auto wake = deadline;
+        for (const Target& target : state) {
+            if (!target.done) wake = std::min(wake, target.hedge_at);
+        }
+        if (cancel) wake = std::min(wake, Clock::now() + kCancelPoll);
+
+        void* tag = nullptr;
+        bool ok = false;
+        const auto next = cq.AsyncNext(&tag, &ok, wallDeadline(wake));
+        if (next == grpc::CompletionQueue::SHUTDOWN) break;
+        if (next == grpc::CompletionQueue::TIMEOUT) {
+            const auto now = Clock::now();
+            if (now >= deadline || (cancel && cancel->cancelled())) break;
+            for (size_t t = 0; t < state.size(); ++t) {
+                if (!state[t].done && state[t].hedge_at <= now) send(t, true);
+            }
+            continue;
+        }
+
+        auto* attempt = static_cast<Attempt*>(tag);
+        attempt->finished = true;
+        Target& target = state[attempt->target];
+        Shard& shard = *shards_[targets[attempt->target]];
+        target.in_flight--;
+        const auto took = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - attempt->sent);
+        const bool cancelled = attempt->status.error_code() == grpc::StatusCode::CANCELLED;
+        if (!cancelled) shard.record(*attempt->replica, took, attempt->status.ok(), options_.hedge_quantile);
+        if (target.done) continue;  // The loser of a hedge
+
+        if (attempt->status.ok()) {
+            Outcome<Response>& outcome = outcomes[attempt->target];
+            outcome.status = grpc::Status::OK;
+            outcome.response = std::move(attempt->response);
+            target.done = true;
+            open--;
+            if (attempt->hedge) hedge_wins_.fetch_add(1, std::memory_order_relaxed);
+            for (auto& other : attempts) {
+                if (other->target == attempt->target && !other->finished) other->context.TryCancel();
+            }
+            continue;
+        }
+
+        if (!cancelled) failures_.fetch_add(1, std::memory_order_relaxed);
+        const auto code = attempt->status.error_code();
+        const bool retryable = code == grpc::StatusCode::UNAVAILABLE || code == grpc::StatusCode::RESOURCE_EXHAUSTED ||
+                               code == grpc::StatusCode::INTERNAL;
+        if (read && retryable && target.next < target.order.size()) {
+            send(attempt->target, true);
+            continue;
+        }
+        if (target.in_flight > 0) continue;  // A hedge may still answer
+        Outcome<Response>& outcome = outcomes[attempt->target];
+        outcome.status = attempt->status;
+        const auto& trailers = attempt->context.GetServerTrailingMetadata();
+        if (auto it = trailers.find(grpc::string_ref(RETRY_AFTER_MS_KEY.data(), RETRY_AFTER_MS_KEY.size()));
+            it != trailers.end()) {
+            outcome.retry_after = std::chrono::milliseconds(std::atoll(std::string(it->second.data(), it->second.size()).c_str()));
+        }
+        target.done = true;
+        open--;
+    }
+
+    // Cancel what is left and wait for every call to let go of its buffers
+    for (auto& attempt : attempts) {
+        if (!attempt->finished) attempt->context.TryCancel();
+    }
+    cq.Shutdown();
+    void* tag = nullptr;
+    bool ok = false;
+    while (cq.Next(&tag, &ok)) {
+    }
+    if (cancel && cancel->cancelled()) {
+        for (size_t t = 0; t < state.size(); ++t) {
+            if (!state[t].done) outcomes[t].status = grpc::Status(grpc::StatusCode::CANCELLED, "request cancelled");
+        }
+    }
+    return outcomes;
+}
+
+VecHandler::WriteResult Coordinator::upsert(std::vector<VectorEntry>& entries) {
+    return write(entries, false);
+}
+
+VecHandler::WriteResult Coordinator::remove(std::vector<VectorEntry>& entries) {
+    return write(entries, true);
+}
+
+VecHandler::WriteResult Coordinator::write(std::vector<VectorEntry>& entries, bool remove) {
+    // One request per shard holding any of the entries, in entry order
+    std::vector<int> request_of(shards_.size(), -1);
+    std::vector<size_t> targets;
+    std::vector<v1::UpsertRequest> upserts;
+    std::vector<v1::DeleteRequest> deletes;
+    for (const VectorEntry& entry : entries) {
+        const size_t shard = shardOf(entry.id_hash);
+        if (request_of[shard] < 0) {
+            request_of[shard] = static_cast<int>(targets.size());
+            targets.push_back(shard);
+            if (remove) {
+                deletes.emplace_back();
+            } else {
+                upserts.emplace_back();
+            }
+        }
+        const auto r = static_cast<size_t>(request_of[shard]);
+        if (remove) {
+            deletes[r].add_ids(options_.uuid_ids ? util::uuid_to_string(entry.uuid) : entry.id);
+        } else {
+            toRecord(entry, options_.uuid_ids, *upserts[r].add_records());
+        }
+    }
+
+    const auto deadline = Clock::now() + options_.write_timeout;
+    VecHandler::WriteResult result;
+    auto collect = [&](const auto& outcomes) {
+        for (size_t t = 0; t < outcomes.size(); ++t) {
+            const auto& outcome = outcomes[t];
+            if (!outcome.status.ok()) {
+                // An overloaded shard takes precedence: the client backs off and retries
+                if (result.status.ok() || outcome.status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED) {
+                    result.status = toHandlerStatus(targets[t], outcome.status, outcome.retry_after);
+                }
+                continue;
+            }
+            result.epoch = std::max<Epoch>(result.epoch, outcome.response.epoch());
+        }
+    };
+    if (remove) {
+        std::vector<const v1::DeleteRequest*> requests;
+        for (const auto& r : deletes) requests.push_back(&r);
+        collect(scatter<v1::DeleteRequest, v1::DeleteResponse>(&v1::VectorService::Stub::PrepareAsyncDelete, targets,
+                                                               requests, deadline, false, nullptr));
+    } else {
+        std::vector<const v1::UpsertRequest*> requests;
+        for (const auto& r : upserts) requests.push_back(&r);
+        collect(scatter<v1::UpsertRequest, v1::UpsertResponse>(&v1::VectorService::Stub::PrepareAsyncUpsert, targets,
+                                                               requests, deadline, false, nullptr));
+    }
+    return result;
+}
+
+std::optional<VectorEntry> Coordinator::get(const VectorEntry& key) {
+    const size_t shard = shardOf(key.id_hash);
+    v1::GetRequest request;
+    request.set_id(options_.uuid_ids ? util::uuid_to_string(key.uuid) : key.id);
+    request.set_include_vector(true);
+    auto outcomes = scatter<v1::GetRequest, v1::GetResponse>(&v1::VectorService::Stub::PrepareAsyncGet, {shard},
+                                                             {&request}, Clock::now() + options_.timeout, true,
+                                                             nullptr);
+    const auto& outcome = outcomes[0];
+    if (!outcome.status.ok()) {
+        throw util::IOException("shard " + std::to_string(shard) + ": " + outcome.status.error_message());
+    }
+    if (!outcome.response.found()) return std::nullopt;
+    const v1::Record& record = outcome.response.record();
+    VectorEntry entry;
+    entry.id = key.id;
+    entry.uuid = key.uuid;
+    entry.id_hash = key.id_hash;
+    entry.vector.assign(record.vector().begin(), record.vector().end());
+    entry.tenant = util::InternTable::tenants().intern(record.tenant());
+    entry.namespace_id = util::InternTable::namespaces().intern(record.namespace_());
+    for (const auto& tag : record.tags()) entry.tags.push_back(util::InternTable::tags().intern(tag));
+    return entry;
+}
+
+Clock::time_point Coordinator::readDeadline(std::optional<uint32_t> budget_ms,
+                                            const util::CancellationToken& cancel) const {
+    auto deadline = Clock::now() + (budget_ms ? std::chrono::milliseconds(*budget_ms) : options_.timeout);
+    if (cancel.hasDeadline()) deadline = std::min(deadline, cancel.deadline());
+    return deadline;
+}
+
+VecHandler::SearchResult Coordinator::search(const QueryRequest& request, const util::CancellationToken& cancel) {
+    const auto deadline = readDeadline(request.latency_budget_ms, cancel);
+    v1::SearchRequest shard_request;
+    shard_request.mutable_vector()->Add(request.query.begin(), request.query.end());
+    shard_request.set_top_k(request.top_k);
+    shard_request.set_tenant(request.tenant);
+    shard_request.set_namespace_(request.namespace_id);
+    for (const auto& tag : request.tags_any) shard_request.add_tags_any(tag);
+    if (request.nprobe) shard_request.set_nprobe(*request.nprobe);
+    if (request.sample_p) shard_request.set_sample_p(*request.sample_p);
+    const auto budget = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+    shard_request.set_latency_budget_ms(static_cast<uint32_t>(std::max<int64_t>(budget, 1)));
+
+    std::vector<size_t> targets(shards_.size());
+    std::iota(targets.begin(), targets.end(), size_t{0});
+    const std::vector<const v1::SearchRequest*> requests(targets.size(), &shard_request);
+    auto outcomes = scatter<v1::SearchRequest, v1::SearchResponse>(&v1::VectorService::Stub::PrepareAsyncSearch,
+                                                                   targets, requests, deadline, true, &cancel);
+
+    VecHandler::SearchResult result;
+    std::vector<QueryResult> hits;
+    for (size_t t = 0; t < outcomes.size(); ++t) {
+        const auto& outcome = outcomes[t];
+        if (!outcome.status.ok()) {
+            if (!options_.allow_partial) {
+                throw util::IOException("shard " + std::to_string(t) + ": " + outcome.status.error_message());
+            }
+            result.partial = true;
+            continue;
+        }
+        result.partial |= outcome.response.partial();
+        appendHits(outcome.response, hits);
+    }
+    if (result.partial) partial_.fetch_add(1, std::memory_order_relaxed);
+    result.hits = mergeHits(std::move(hits), request.top_k);
+    return result;
+}
+
+std::vector<VecHandler::SearchResult> Coordinator::searchBatch(const BatchQueryRequest& request,
+                                                               const util::CancellationToken& cancel) {
+    const auto deadline = readDeadline(request.latency_budget_ms, cancel);
+    v1::SearchBatchRequest shard_request;
+    for (const auto& query : request.queries) {
+        shard_request.add_queries()->mutable_vector()->Add(query.begin(), query.end());
+    }
+    shard_request.set_top_k(request.top_k);
+    shard_request.set_tenant(request.tenant);
+    shard_request.set_namespace_(request.namespace_id);
+    for (const auto& tag : request.tags_any) shard_request.add_tags_any(tag);
+    if (request.nprobe) shard_request.set_nprobe(*request.nprobe);
+    if (request.sample_p) shard_request.set_sample_p(*request.sample_p);
+    const auto budget = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+    shard_request.set_latency_budget_ms(static_cast<uint32_t>(std::max<int64_t>(budget, 1)));
+
+    std::vector<size_t> targets(shards_.size());
+    std::iota(targets.begin(), targets.end(), size_t{0});
+    const std::vector<const v1::SearchBatchRequest*> requests(targets.size(), &shard_request);
+    auto outcomes = scatter<v1::SearchBatchRequest, v1::SearchBatchResponse>(
+        &v1::VectorService::Stub::PrepareAsyncSearchBatch, targets, requests, deadline, true, &cancel);
+
+    const size_t n = request.queries.size();
+    std::vector<VecHandler::SearchResult> results(n);
+    std::vector<std::vector<QueryResult>> hits(n);
+    bool partial = false;
+    for (size_t t = 0; t < outcomes.size(); ++t) {
+        const auto& outcome = outcomes[t];
+        const bool answered = outcome.status.ok() && static_cast<size_t>(outcome.response.results_size()) == n;
+        if (!answered) {
+            if (!options_.allow_partial) {
+                throw util::IOException("shard " + std::to_string(t) + ": " +
+                                        (outcome.status.ok() ? std::string("short batch answer")
+                                                             : outcome.status.error_message()));
+            }
+            partial = true;
+            continue;
+        }
+        for (size_t q = 0; q < n; ++q) {
+            results[q].partial |= outcome.response.results(static_cast<int>(q)).partial();
+            appendHits(outcome.response.results(static_cast<int>(q)), hits[q]);
+        }
+    }
+    if (partial) partial_.fetch_add(1, std::memory_order_relaxed);
+    for (size_t q = 0; q < n; ++q) {
+        results[q].partial |= partial;
+        results[q].hits = mergeHits(std::move(hits[q]), request.top_k);
+    }
+    return results;
+}
+
+Coordinator::Stats Coordinator::getStats() const {
+    Stats stats;
+    stats.calls = calls_.load(std::memory_order_relaxed);
+    stats.hedges = hedges_.load(std::memory_order_relaxed);
+    stats.hedge_wins = hedge_wins_.load(std::memory_order_relaxed);
+    stats.failures = failures_.load(std::memory_order_relaxed);
+    stats.partial = partial_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<std::pair<std::string_view, double>> Coordinator::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_coordinator_shard_calls", static_cast<double>(stats.calls)},
+        {"woved_coordinator_hedges", static_cast<double>(stats.hedges)},
+        {"woved_coordinator_hedge_wins", static_cast<double>(stats.hedge_wins)},
+        {"woved_coordinator_shard_failures", static_cast<double>(stats.failures)},
+        {"woved_coordinator_partial_searches", static_cast<double>(stats.partial)},
+    };
+}
+
+std::vector<Metrics::LabelledGauge> Coordinator::labelledMetrics() const {
+    std::vector<Metrics::LabelledGauge> gauges;
+    for (size_t s = 0; s < shards_.size(); ++s) {
+        const Shard& shard = *shards_[s];
+        const std::string label = std::to_string(s);
+        const auto hedge_us = options_.hedge_after.count() > 0
+                                  ? std::chrono::microseconds(options_.hedge_after).count()
+                                  : shard.hedge_after_us.load(std::memory_order_relaxed);
+        gauges.push_back({"woved_coordinator_hedge_after_ms", {{"shard", label}}, static_cast<double>(hedge_us) / 1e3});
+        for (const auto& replica : shard.replicas) {
+            gauges.push_back({"woved_coordinator_replica_latency_ms",
+                              {{"shard", label}, {"replica", replica->address}},
+                              static_cast<double>(replica->ewma_us.load(std::memory_order_relaxed)) / 1e3});
+        }
+    }
+    return gauges;
+}
+
+} // namespace woved::api
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "api/handlers/vec.h"
+#include "core/metrics.h"
+#include "include/woved/types.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::api {
+
+// Coordinator mode (cluster.mode coordinator): this node holds no data
+// and serves woved.v1.VectorService from shard nodes, each a plain wovedd
+// holding its part of the collection. backend() binds a VecHandler to it,
+// so both front ends run unchanged on top.
+//
+// Ids are hash-partitioned: an id lives on shard jump_hash(id_hash, n), so
+// growing from n to n + 1 shards moves only 1 / (n + 1) of the ids. Upserts
+// and deletes are split by shard and sent to each shard's first node at
+// once; the call succeeds when every shard has its part durable. If a
+// shard fails, the others keep theirs and the client retries the whole
+// batch, which applies the same versions again. Shards keep their own
+// epochs; the epoch returned is the largest, and only orders writes
+// within one shard.
+//
+// A search goes to every shard with the full top_k (a shard's top k holds
+// every hit of the global top k that lives there), the client's nprobe and
+// sample_p, and what is left of the latency budget; the shards' hits are
+// merged best first. A get goes to its id's shard. Reads pick the replica
+// of a shard that has answered fastest lately. If it has not answered
+// after hedge_after, or by default after the shard's hedge_quantile
+// latency over its recent calls, the call also goes to the next replica;
+// the first answer wins and the other call is cancelled. A replica that
+// fails is skipped for the next at once. With allow_partial, a search
+// answers without the shards that failed or ran out of time, marked
+// partial; otherwise it fails.
+//
+// BulkImport reads files on the server's own filesystem, so it is left
+// unbound: import into each shard node directly.
+class Coordinator {
+public:
+    struct Options {
+        // Per shard, its nodes' gRPC addresses, the write node first (cluster.shards)
+        std::vector<std::vector<std::string>> shards;
+        bool uuid_ids = true;                             // collection.id_type uuidv7
+        std::chrono::milliseconds timeout{5000};          // query.timeout_ms
+        std::chrono::milliseconds write_timeout{30000};
+        std::chrono::milliseconds hedge_after{0};         // 0: per shard, from hedge_quantile
+        double hedge_quantile = 0.95;
+        bool allow_partial = true;
+        uint64_t max_message_bytes = 104857600;           // limits.max_request_size_bytes
+
+        // Throws util::ConfigException without shards or for a shard without nodes
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        uint64_t calls = 0;        // Shard calls sent, hedges included
+        uint64_t hedges = 0;
+        uint64_t hedge_wins = 0;   // Answered by the hedge first
+        uint64_t failures = 0;     // Shard calls failed, cancelled losers aside
+        uint64_t partial = 0;      // Searches answered without some shard
+    };
+
+    // Channels are created here and connect on first use
+    explicit Coordinator(const Options& options);
+    ~Coordinator();
+
+    Coordinator(const Coordinator&) = delete;
+    Coordinator& operator=(const Coordinator&) = delete;
+
+    // Callbacks for VecHandler; the coordinator must outlive the handler
+    VecHandler::Backend backend();
+
+    size_t shards() const { return shards_.size(); }
+    // The shard holding `id_hash`
+    size_t shardOf(VectorIdHash id_hash) const;
+
+    VecHandler::WriteResult upsert(std::vector<VectorEntry>& entries);
+    VecHandler::WriteResult remove(std::vector<VectorEntry>& entries);
+    // Throws util::IOException if the id's shard does not answer
+    std::optional<VectorEntry> get(const VectorEntry& key);
+    // Throws util::IOException if a shard fails without allow_partial
+    VecHandler::SearchResult search(const QueryRequest& request, const util::CancellationToken& cancel);
+    std::vector<VecHandler::SearchResult> searchBatch(const BatchQueryRequest& request,
+                                                      const util::CancellationToken& cancel);
+
+    Stats getStats() const;
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+    // woved_coordinator_hedge_after_ms{shard} and
+    // woved_coordinator_replica_latency_ms{shard,replica}
+    std::vector<Metrics::LabelledGauge> labelledMetrics() const;
+
+private:
+    struct Replica;
+    struct Shard;
+    template <typename Response>
+    struct Outcome;
+
+    Options options_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    std::atomic<uint64_t> calls_{0};
+    std::atomic<uint64_t> hedges_{0};
+    std::atomic<uint64_t> hedge_wins_{0};
+    std::atomic<uint64_t> failures_{0};
+    std::atomic<uint64_t> partial_{0};
+
+    // Sends requests[i] to shard targets[i] and waits for every answer or
+    // the deadline. Reads are hedged over the replicas; writes go to the
+    // first node only.
+    template <typename Request, typename Response, typename Prepare>
+    std::vector<Outcome<Response>> scatter(Prepare prepare, const std::vector<size_t>& targets,
+                                           const std::vector<const Request*>& requests,
+                                           std::chrono::steady_clock::time_point deadline, bool read,
+                                           const util::CancellationToken* cancel);
+
+    VecHandler::WriteResult write(std::vector<VectorEntry>& entries, bool remove);
+    std::chrono::steady_clock::time_point readDeadline(std::optional<uint32_t> budget_ms,
+                                                       const util::CancellationToken& cancel) const;
+};
+
+} // namespace woved::api
@@ -0,0 +1,631 @@
+#include "grpc-server.h"
+#include "api/handlers/vec.h"
+#include "core/config.h"
+#include "proto/woved.grpc.pb.h"
+#include "util/cancellation.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include "util/numa-aware.h"
+#include "util/thread-pool.h"
+#include <google/protobuf/arena.h>
+#include <grpcpp/alarm.h>
+#include <grpcpp/grpcpp.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace woved::api {
+
+namespace {
+
+using Service = v1::VectorService::AsyncService;
+using Clock = std::chrono::steady_clock;
+
+grpc::Status toStatus(const HandlerStatus& status, grpc::ServerContext& context) {
+    switch (status.code) {
+        case ErrorCode::OK:
+            return grpc::Status::OK;
+        case ErrorCode::INVALID_ARGUMENT:
+            return {grpc::StatusCode::INVALID_ARGUMENT, status.message};
+        case ErrorCode::NOT_FOUND:
+            return {grpc::StatusCode::NOT_FOUND, status.message};
+        case ErrorCode::OVERLOADED:
+            context.AddTrailingMetadata(std::string(RETRY_AFTER_MS_KEY), std::to_string(status.retry_after.count()));
+            return {grpc::StatusCode::RESOURCE_EXHAUSTED, status.message};
+        case ErrorCode::DEADLINE_EXCEEDED:
+            return {grpc::StatusCode::DEADLINE_EXCEEDED, status.message};
+        case ErrorCode::INTERNAL:
+            break;
+    }
+    return {grpc::StatusCode::INTERNAL, status.message};
+}
+
+// CPUs for `count` pollers, taking one CPU of each node in turn
+std::vector<int> pollerCpus(size_t count) {
+    std::vector<std::vector<int>> nodes;
+    for (size_t node = 0; node < util::numa_node_count(); ++node) {
+        nodes.push_back(util::numa_node_cpus(static_cast<int>(node)));
+    }
+    std::vector<int> cpus;
+    for (size_t round = 0; cpus.size() < count; ++round) {
+        bool any = false;
+        for (const auto& node : nodes) {
+            if (round < node.size() && cpus.size() < count) {
+                cpus.push_back(node[round]);
+                any = true;
+            }
+        }
+        if (!any) break;
+    }
+    return cpus;
+}
+
+} // namespace
+
+struct GrpcServer::Impl {
+    struct Stats {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> inline_calls{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> cancelled{0};
+        std::atomic<uint64_t> stream_windows{0};
+        std::atomic<uint64_t> stream_backoffs{0};
+    };
+
+    class Call;
+    struct Queue;
+
+    // Completion queue tag: a call's own event or its done notification
+    struct Tag {
+        Call* call;
+        bool done;
+    };
+
+    // One posted call of one method, reused request after request. Its
+    // events arrive on its queue's poller.
+    class Call {
+    public:
+        Call(Impl& server, Queue& queue) : server_(server), queue_(queue) {}
+        virtual ~Call() = default;
+
+        // Ask the service for the next request of this method
+        virtual void post() = 0;
+        virtual void onEvent(bool ok, bool done) = 0;
+
+    protected:
+        Impl& server_;
+        Queue& queue_;
+        std::optional<grpc::ServerContext> context_;
+        Tag event_tag_{this, false};
+        Tag done_tag_{this, true};
+    };
+
+    // A unary call: only the handler may run on a pool thread, and it
+    // touches nothing the events do but state_.
+    class UnaryCall : public Call {
+    public:
+        enum State : uint8_t { kWaiting, kHandling, kFinishing, kStopped };
+
+        using Call::Call;
+
+        void post() override {
+            finished_ = false;
+            done_ = false;
+            state_.store(kWaiting, std::memory_order_relaxed);
+            reset();
+            context_.emplace();
+            context_->AsyncNotifyWhenDone(&done_tag_);
+            request();
+        }
+
+        void onEvent(bool ok, bool done) override {
+            if (done) {
+                done_ = true;
+                if (context_->IsCancelled()) {
+                    if (cancel_) cancel_->cancel();
+                    server_.stats.cancelled.fetch_add(1, std::memory_order_relaxed);
+                }
+                if (finished_) recycle();
+                return;
+            }
+            switch (state_.load(std::memory_order_acquire)) {
+                case kWaiting:
+                    // Not started, so there is no done notification to wait for
+                    if (!ok) {
+                        state_.store(kStopped, std::memory_order_relaxed);
+                        return;
+                    }
+                    start();
+                    break;
+                case kFinishing:
+                    finished_ = true;
+                    if (done_) recycle();
+                    break;
+                default:
+                    break;
+            }
+        }
+
+    protected:
+        std::optional<util::CancellationToken> cancel_;
+
+        // Drop the previous request's responder and messages
+        virtual void reset() = 0;
+        virtual void request() = 0;
+        virtual bool cheap() const = 0;
+        virtual HandlerStatus handle() = 0;
+        virtual void respond(const HandlerStatus& status) = 0;
+
+    private:
+        std::atomic<State> state_{kWaiting};
+        bool finished_ = false;  // Poller only
+        bool done_ = false;
+
+        void start() {
+            server_.stats.calls.fetch_add(1, std::memory_order_relaxed);
+            auto deadline = Clock::now() + std::chrono::milliseconds(server_.options.timeout_ms);
+            const auto client = context_->deadline();
+            if (client != std::chrono::system_clock::time_point::max()) {
+                deadline = std::min(deadline, Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                                                 client - std::chrono::system_clock::now()));
+            }
+            cancel_.emplace(deadline);
+            state_.store(kHandling, std::memory_order_relaxed);
+            if (cheap()) {
+                server_.stats.inline_calls.fetch_add(1, std::memory_order_relaxed);
+                run();
+                return;
+            }
+            server_.handling.fetch_add(1, std::memory_order_relaxed);
+            server_.pool.submit([this] {
+                run();
+                server_.handlerDone();
+            }, util::ThreadPool::Priority::Foreground);
+        }
+
+        void run() {
+            HandlerStatus status;
+            try {
+                status = handle();
+            } catch (const util::InvalidArgumentException& e) {
+                status = HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, e.what());
+            } catch (const std::exception& e) {
+                LOG_ERROR("gRPC handler failed: {}", e.what());
+                status = HandlerStatus::error(ErrorCode::INTERNAL, e.what());
+            }
+            if (!status.ok()) server_.stats.errors.fetch_add(1, std::memory_order_relaxed);
+            // Before respond(): its completion may reach the poller at once
+            state_.store(kFinishing, std::memory_order_release);
+            respond(status);
+        }
+
+        void recycle() {
+            if (server_.stopping.load(std::memory_order_acquire)) {
+                state_.store(kStopped, std::memory_order_relaxed);
+                return;
+            }
+            post();
+        }
+    };
+
+    // A Call of one method: its messages live on an arena whose first block
+    // is kept across requests
+    template <typename Request, typename Response>
+    class MethodCall final : public UnaryCall {
+    public:
+        using RequestFn = void (Service::*)(grpc::ServerContext*, Request*, grpc::ServerAsyncResponseWriter<Response>*,
+                                            grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*);
+        using HandleFn = HandlerStatus (*)(const VecHandler&, const Request&, Response&,
+                                           const util::CancellationToken&);
+
+        MethodCall(Impl& server, Queue& queue, RequestFn request_fn, HandleFn handle_fn, bool cheap)
+            : UnaryCall(server, queue),
+              request_fn_(request_fn),
+              handle_fn_(handle_fn),
+              cheap_(cheap),
+              block_(std::make_unique<char[]>(server.options.arena_block_bytes)),
+              arena_(block_.get(), server.options.arena_block_bytes) {}
+
+    private:
+        RequestFn request_fn_;
+        HandleFn handle_fn_;
+        bool cheap_;
+        std::unique_ptr<char[]> block_;
+        google::protobuf::Arena arena_;
+        std::optional<grpc::ServerAsyncResponseWriter<Response>> responder_;
+        Request* request_ = nullptr;
+        Response* response_ = nullptr;
+
+        void reset() override {
+            responder_.reset();
+            this->context_.reset();
+            this->cancel_.reset();
+            arena_.Reset();
+            request_ = google::protobuf::Arena::CreateMessage<Request>(&arena_);
+            response_ = google::protobuf::Arena::CreateMessage<Response>(&arena_);
+        }
+
+        void request() override {
+            responder_.emplace(&*this->context_);
+            (this->server_.service.*request_fn_)(&*this->context_, request_, &*responder_, this->queue_.cq.get(),
+                                                  this->queue_.cq.get(), &this->event_tag_);
+        }
+
+        bool cheap() const override { return cheap_; }
+
+        HandlerStatus handle() override {
+            return handle_fn_(this->server_.handler, *request_, *response_, *this->cancel_);
+        }
+
+        void respond(const HandlerStatus& status) override {
+            if (status.ok()) {
+                responder_->Finish(*response_, grpc::Status::OK, &this->event_tag_);
+            } else {
+                responder_->FinishWithError(toStatus(status, *this->context_), &this->event_tag_);
+            }
+        }
+    };
+
+    // UpsertStream: read a window, apply it on the pool, acknowledge it,
+    // then read the next. One operation is outstanding at a time, so every
+    // event but the done notification completes the one state_ names. A
+    // window the buffer turns away waits out its retry hint on alarm_ and
+    // is applied again; the stream is not read meanwhile. The window and
+    // its ack live on an arena reset after each window.
+    class UpsertStreamCall final : public Call {
+    public:
+        enum State : uint8_t { kWaiting, kReading, kHandling, kBackoff, kWriting, kFinishing, kStopped };
+
+        UpsertStreamCall(Impl& server, Queue& queue)
+            : Call(server, queue),
+              block_(std::make_unique<char[]>(server.options.arena_block_bytes)),
+              arena_(block_.get(), server.options.arena_block_bytes) {}
+
+        void post() override {
+            finished_ = false;
+            done_ = false;
+            index_ = 0;
+            state_.store(kWaiting, std::memory_order_relaxed);
+            stream_.reset();
+            context_.reset();
+            resetWindow();
+            context_.emplace();
+            context_->AsyncNotifyWhenDone(&done_tag_);
+            stream_.emplace(&*context_);
+            server_.service.RequestUpsertStream(&*context_, &*stream_, queue_.cq.get(), queue_.cq.get(), &event_tag_);
+        }
+
+        void onEvent(bool ok, bool done) override {
+            if (done) {
+                done_ = true;
+                if (context_->IsCancelled()) {
+                    server_.stats.cancelled.fetch_add(1, std::memory_order_relaxed);
+                    std::lock_guard<std::mutex> lock(alarm_mutex_);
+                    if (state_.load(std::memory_order_relaxed) == kBackoff) alarm_.Cancel();
+                }
+                if (finished_) recycle();
+                return;
+            }
+            switch (state_.load(std::memory_order_acquire)) {
+                case kWaiting:
+                    if (!ok) {
+                        state_.store(kStopped, std::memory_order_relaxed);
+                        return;
+                    }
+                    server_.stats.calls.fetch_add(1, std::memory_order_relaxed);
+                    read();
+                    break;
+                case kReading:
+                    // The client closed its side after the last window
+                    if (!ok) {
+                        finish(grpc::Status::OK);
+                        return;
+                    }
+                    submit(true);
+                    break;
+                case kBackoff:
+                    if (!ok || context_->IsCancelled()) {
+                        finish({grpc::StatusCode::CANCELLED, "stream cancelled"});
+                    } else if (server_.stopping.load(std::memory_order_acquire)) {
+                        finish({grpc::StatusCode::UNAVAILABLE, "server shutting down"});
+                    } else {
+                        submit(false);
+                    }
+                    break;
+                case kWriting:
+                    if (!ok) {
+                        finish({grpc::StatusCode::CANCELLED, "stream closed by the client"});
+                        return;
+                    }
+                    ++index_;
+                    resetWindow();
+                    read();
+                    break;
+                case kFinishing:
+                    finished_ = true;
+                    if (done_) recycle();
+                    break;
+                default:
+                    break;
+            }
+        }
+
+    private:
+        std::unique_ptr<char[]> block_;
+        google::protobuf::Arena arena_;
+        std::optional<grpc::ServerAsyncReaderWriter<v1::UpsertAck, v1::UpsertWindow>> stream_;
+        v1::UpsertWindow* window_ = nullptr;
+        v1::UpsertAck* ack_ = nullptr;
+        std::vector<VectorEntry> entries_;  // The window being applied
+        uint64_t index_ = 0;
+        grpc::Alarm alarm_;
+        std::mutex alarm_mutex_;            // Orders alarm_.Set() against Cancel()
+        std::atomic<State> state_{kWaiting};
+        bool finished_ = false;             // Poller only
+        bool done_ = false;
+
+        void resetWindow() {
+            entries_.clear();
+            arena_.Reset();
+            window_ = google::protobuf::Arena::CreateMessage<v1::UpsertWindow>(&arena_);
+            ack_ = google::protobuf::Arena::CreateMessage<v1::UpsertAck>(&arena_);
+        }
+
+        void read() {
+            state_.store(kReading, std::memory_order_release);
+            stream_->Read(window_, &event_tag_);
+        }
+
+        void finish(const grpc::Status& status) {
+            state_.store(kFinishing, std::memory_order_release);
+            stream_->Finish(status, &event_tag_);
+        }
+
+        // Prepare (first attempt only) and apply the window on the pool
+        void submit(bool prepare) {
+            state_.store(kHandling, std::memory_order_relaxed);
+            server_.handling.fetch_add(1, std::memory_order_relaxed);
+            server_.pool.submit([this, prepare] {
+                run(prepare);
+                server_.handlerDone();
+            }, util::ThreadPool::Priority::Foreground);
+        }
+
+        void run(bool prepare) {
+            HandlerStatus status;
+            try {
+                if (prepare) {
+                    server_.stats.stream_windows.fetch_add(1, std::memory_order_relaxed);
+                    status = server_.handler.prepareWindow(*window_, entries_);
+                }
+                if (status.ok()) status = server_.handler.applyWindow(entries_, *ack_);
+            } catch (const util::InvalidArgumentException& e) {
+                status = HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, e.what());
+            } catch (const std::exception& e) {
+                LOG_ERROR("gRPC stream handler failed: {}", e.what());
+                status = HandlerStatus::error(ErrorCode::INTERNAL, e.what());
+            }
+            if (status.code == ErrorCode::OVERLOADED && !server_.stopping.load(std::memory_order_acquire)) {
+                server_.stats.stream_backoffs.fetch_add(1, std::memory_order_relaxed);
+                ack_->Clear();
+                std::lock_guard<std::mutex> lock(alarm_mutex_);
+                state_.store(kBackoff, std::memory_order_release);
+                alarm_.Set(queue_.cq.get(), std::chrono::system_clock::now() + status.retry_after, &event_tag_);
+                return;
+            }
+            if (!status.ok()) {
+                server_.stats.errors.fetch_add(1, std::memory_order_relaxed);
+                finish(toStatus(status, *context_));
+                return;
+            }
+            ack_->set_window(index_);
+            state_.store(kWriting, std::memory_order_release);
+            stream_->Write(*ack_, &event_tag_);
+        }
+
+        void recycle() {
+            if (server_.stopping.load(std::memory_order_acquire)) {
+                state_.store(kStopped, std::memory_order_relaxed);
+                return;
+            }
+            post();
+        }
+    };
+
+    struct Queue {
+        std::unique_ptr<grpc::ServerCompletionQueue> cq;
+        std::vector<std::unique_ptr<Call>> calls;
+        std::thread poller;
+        int cpu = -1;
+    };
+
+    Impl(const Options& options, const VecHandler& handler, util::ThreadPool& pool)
+        : options(options), handler(handler), pool(pool) {}
+
+    const Options& options;
+    const VecHandler& handler;
+    util::ThreadPool& pool;
+    Service service;
+    std::unique_ptr<grpc::Server> server;
+    std::vector<Queue> queues;
+    size_t calls_per_queue = 0;
+    Stats stats;
+    std::atomic<bool> stopping{false};
+
+    // Handlers running on the pool; shutdown waits them out before closing
+    // the queues their responses complete on
+    std::atomic<size_t> handling{0};
+    std::mutex handling_mutex;
+    std::condition_variable handling_cv;
+
+    void handlerDone() {
+        if (handling.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(handling_mutex);
+            handling_cv.notify_all();
+        }
+    }
+
+    // Runs on the queue's own thread, so its calls are allocated on its node
+    void poll(Queue& queue) {
+        if (queue.cpu >= 0) util::bind_thread_to_cpu(queue.cpu);
+        for (size_t i = 0; i < calls_per_queue; ++i) {
+            addCall<v1::UpsertRequest, v1::UpsertResponse>(
+                queue, &Service::RequestUpsert,
+                [](const VecHandler& h, const v1::UpsertRequest& req, v1::UpsertResponse& resp,
+                   const util::CancellationToken&) { return h.upsert(req, resp); },
+                false);
+            if (!stopping.load(std::memory_order_acquire)) {
+                auto stream = std::make_unique<UpsertStreamCall>(*this, queue);
+                stream->post();
+                queue.calls.push_back(std::move(stream));
+            }
+            addCall<v1::DeleteRequest, v1::DeleteResponse>(
+                queue, &Service::RequestDelete,
+                [](const VecHandler& h, const v1::DeleteRequest& req, v1::DeleteResponse& resp,
+                   const util::CancellationToken&) { return h.remove(req, resp); },
+                false);
+            addCall<v1::GetRequest, v1::GetResponse>(
+                queue, &Service::RequestGet,
+                [](const VecHandler& h, const v1::GetRequest& req, v1::GetResponse& resp,
+                   const util::CancellationToken&) { return h.get(req, resp); },
+                true);
+            addCall<v1::SearchRequest, v1::SearchResponse>(
+                queue, &Service::RequestSearch,
+                [](const VecHandler& h, const v1::SearchRequest& req, v1::SearchResponse& resp,
+                   const util::CancellationToken& cancel) { return h.search(req, resp, cancel); },
+                false);
+            addCall<v1::SearchBatchRequest, v1::SearchBatchResponse>(
+                queue, &Service::RequestSearchBatch,
+                [](const VecHandler& h, const v1::SearchBatchRequest& req, v1::SearchBatchResponse& resp,
+                   const util::CancellationToken& cancel) { return h.searchBatch(req, resp, cancel); },
+                false);
+            addCall<v1::BulkImportRequest, v1::BulkImportResponse>(
+                queue, &Service::RequestBulkImport,
+                [](const VecHandler& h, const v1::BulkImportRequest& req, v1::BulkImportResponse& resp,
+                   const util::CancellationToken&) { return h.bulkImport(req, resp); },
+                false);
+        }
+
+        void* tag = nullptr;
+        bool ok = false;
+        while (queue.cq->Next(&tag, &ok)) {
+            auto* t = static_cast<Tag*>(tag);
+            t->call->onEvent(ok, t->done);
+        }
+    }
+
+    template <typename Request, typename Response>
+    void addCall(Queue& queue, typename MethodCall<Request, Response>::RequestFn request_fn,
+                 typename MethodCall<Request, Response>::HandleFn handle_fn, bool cheap) {
+        auto call = std::make_unique<MethodCall<Request, Response>>(*this, queue, request_fn, handle_fn, cheap);
+        if (stopping.load(std::memory_order_acquire)) return;
+        call->post();
+        queue.calls.push_back(std::move(call));
+    }
+};
+
+GrpcServer::Options GrpcServer::Options::fromConfig(const Config& config) {
+    Options options;
+    options.address = config.server.bind_address + ":" + std::to_string(config.server.grpc_port);
+    options.max_connections = config.server.max_connections;
+    options.queues = config.server.grpc_queues;
+    options.numa = config.numa.enabled && config.numa.bind_threads;
+    options.timeout_ms = config.query.timeout_ms;
+    options.max_message_bytes = config.limits.max_request_size_bytes;
+    return options;
+}
+
+GrpcServer::GrpcServer(const Options& options, const VecHandler& handler, util::ThreadPool& pool)
+    : options_(options), impl_(std::make_unique<Impl>(options_, handler, pool)) {
+    if (options_.queues == 0) options_.queues = std::max<size_t>(1, util::cpu_count());
+    options_.max_connections = std::max(options_.max_connections, 1u);
+    options_.arena_block_bytes = std::max<size_t>(options_.arena_block_bytes, 256);
+}
+
+GrpcServer::~GrpcServer() {
+    shutdown(0);
+}
+
+void GrpcServer::start() {
+    if (running()) return;
+    Impl& impl = *impl_;
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(options_.address, grpc::InsecureServerCredentials(), &port_);
+    builder.RegisterService(&impl.service);
+    const int max_message = static_cast<int>(std::min<uint64_t>(options_.max_message_bytes, INT_MAX));
+    builder.SetMaxReceiveMessageSize(max_message);
+    builder.SetMaxSendMessageSize(max_message);
+
+    impl.queues.resize(options_.queues);
+    for (auto& queue : impl.queues) queue.cq = builder.AddCompletionQueue();
+    impl.server = builder.BuildAndStart();
+    if (!impl.server || port_ == 0) {
+        impl.server.reset();
+        impl.queues.clear();
+        throw util::IOException("cannot serve gRPC on " + options_.address);
+    }
+
+    impl.calls_per_queue = options_.calls_per_queue
+                               ? options_.calls_per_queue
+                               : std::max<size_t>(4, (options_.max_connections + options_.queues - 1) / options_.queues);
+    std::vector<int> cpus;
+    if (options_.numa) cpus = pollerCpus(options_.queues);
+    for (size_t i = 0; i < impl.queues.size(); ++i) {
+        Impl::Queue& queue = impl.queues[i];
+        queue.cpu = i < cpus.size() ? cpus[i] : -1;
+        queue.poller = std::thread([&impl, &queue] { impl.poll(queue); });
+    }
+    running_.store(true, std::memory_order_release);
+
+    util::numa_note_placement(
+        "grpc server", std::to_string(impl.queues.size()) + " completion queues, " +
+                           std::to_string(impl.calls_per_queue) + " calls per method each" +
+                           (cpus.empty() ? std::string() : ", pollers bound to " + std::to_string(cpus.size()) +
+                                                               " CPUs across " +
+                                                               std::to_string(util::numa_node_count()) + " nodes"));
+    LOG_INFO("gRPC server listening on {} (port {}): {} completion queues", options_.address, port_,
+             impl.queues.size());
+}
+
+void GrpcServer::shutdown(uint32_t grace_ms) {
+    Impl& impl = *impl_;
+    if (!impl.server) return;
+    impl.stopping.store(true, std::memory_order_release);
+    impl.server->Shutdown(std::chrono::system_clock::now() + std::chrono::milliseconds(grace_ms));
+    {
+        std::unique_lock<std::mutex> lock(impl.handling_mutex);
+        impl.handling_cv.wait(lock, [&] { return impl.handling.load(std::memory_order_acquire) == 0; });
+    }
+    for (auto& queue : impl.queues) queue.cq->Shutdown();
+    for (auto& queue : impl.queues) {
+        if (queue.poller.joinable()) queue.poller.join();
+    }
+    impl.queues.clear();
+    impl.server.reset();
+    running_.store(false, std::memory_order_release);
+    LOG_INFO("gRPC server on {} stopped", options_.address);
+}
+
+size_t GrpcServer::queues() const {
+    return impl_->queues.size();
+}
+
+std::vector<std::pair<std::string_view, double>> GrpcServer::metrics() const {
+    const Impl::Stats& stats = impl_->stats;
+    return {
+        {"woved_grpc_calls_total", static_cast<double>(stats.calls.load(std::memory_order_relaxed))},
+        {"woved_grpc_inline_calls_total", static_cast<double>(stats.inline_calls.load(std::memory_order_relaxed))},
+        {"woved_grpc_errors_total", static_cast<double>(stats.errors.load(std::memory_order_relaxed))},
+        {"woved_grpc_cancelled_total", static_cast<double>(stats.cancelled.load(std::memory_order_relaxed))},
+        {"woved_grpc_stream_windows_total", static_cast<double>(stats.stream_windows.load(std::memory_order_relaxed))},
+        {"woved_grpc_stream_backoffs_total", static_cast<double>(stats.stream_backoffs.load(std::memory_order_relaxed))},
+        {"woved_grpc_handlers_running", static_cast<double>(impl_->handling.load(std::memory_order_relaxed))},
+    };
+}
+
+} // namespace woved::api
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::util {
+class ThreadPool;
+}
+
+namespace woved::api {
+
+class VecHandler;
+
+// woved.v1.VectorService on the gRPC async completion-queue API.
+//
+// The server runs one completion queue per core, each drained by its own
+// polling thread. On NUMA hosts the pollers are bound one per CPU and
+// spread over the nodes, so a call is received, handled and answered on
+// one core and its memory stays on that node. Each queue posts a fixed
+// set of calls per method; a call is reused for the next request once it
+// finishes, with its request and response on a protobuf arena that is
+// reset between requests, so steady-state traffic does not allocate
+// messages. max_connections sets how many calls of each method can be in
+// flight across the queues; past that, requests wait inside gRPC rather
+// than in a thread.
+//
+// Gets are cheap, so they run inline on the polling thread. Searches go to
+// the worker pool's foreground lane, which answers them itself. Writes go
+// there as well, because they wait for the WAL group commit. A search's
+// CancellationToken trips at the client's deadline (or query.timeout_ms,
+// whichever is first) and when the client cancels.
+//
+// UpsertStream windows are applied on the pool as well, one at a time per
+// stream, and acknowledged with their WAL epoch before the next window is
+// read. A window the message buffer refuses is retried after its retry
+// hint instead of failing the stream, and the stream is not read while it
+// waits, so HTTP/2 flow control slows the client to what the buffer
+// admits.
+//
+// BulkImport holds its pool worker until the import is installed; the
+// import's own reads and segment writes run in the background lane.
+//
+// Status mapping: INVALID_ARGUMENT, NOT_FOUND, DEADLINE_EXCEEDED and
+// INTERNAL map to the gRPC codes of those names; OVERLOADED is
+// RESOURCE_EXHAUSTED with the retry hint in the woved-retry-after-ms
+// trailer.
+class GrpcServer {
+public:
+    struct Options {
+        std::string address = "0.0.0.0:9090";  // server.bind_address:grpc_port
+        uint32_t max_connections = 1000;        // server.max_connections
+        size_t queues = 0;                      // server.grpc_queues; 0: one per core
+        bool numa = true;                       // Bind pollers to CPUs across nodes
+        // Calls posted per method and queue; 0: max_connections spread over the queues
+        size_t calls_per_queue = 0;
+        size_t arena_block_bytes = 4096;        // First arena block of each call, kept across requests
+        uint32_t timeout_ms = 5000;             // query.timeout_ms
+        uint64_t max_message_bytes = 104857600; // limits.max_request_size_bytes
+
+        static Options fromConfig(const Config& config);
+    };
+
+    // `handler` and `pool` must outlive the server
+    GrpcServer(const Options& options, const VecHandler& handler, util::ThreadPool& pool);
+    ~GrpcServer();
+
+    GrpcServer(const GrpcServer&) = delete;
+    GrpcServer& operator=(const GrpcServer&) = delete;
+
+    // Bind and start polling; throws util::IOException if the address
+    // cannot be bound
+    void start();
+    // Stop accepting calls, give running ones `grace_ms` to finish, then
+    // cancel the rest and join the pollers. Idempotent.
+    void shutdown(uint32_t grace_ms = 1000);
+
+    bool running() const { return running_.load(std::memory_order_acquire); }
+    int port() const { return port_; }
+    size_t queues() const;
+
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct Impl;
+
+    Options options_;
+    std::unique_ptr<Impl> impl_;
+    std::atomic<bool> running_{false};
+    int port_ = 0;
+};
+
+} // namespace woved::api
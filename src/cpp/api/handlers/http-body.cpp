@@ -0,0 +1,642 @@
+#include "http-body.h"
+#include "util/intern-table.h"
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <type_traits>
+
+namespace woved::api {
+
+namespace {
+
+bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c; };
+        if (lower(a[i]) != lower(b[i])) return false;
+    }
+    return true;
+}
+
+HandlerStatus invalid(std::string message) {
+    return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, std::move(message));
+}
+
+void appendUtf8(uint32_t cp, std::string& out) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// Pull parser over a JSON text: values are read in place by the caller as
+// it walks the document, so nothing but escaped strings is copied
+class JsonReader {
+public:
+    explicit JsonReader(std::string_view text) : begin_(text.data()), p_(text.data()), end_(text.data() + text.size()) {}
+
+    HandlerStatus status() const {
+        return invalid("JSON at byte " + std::to_string(error_at_ - begin_) + ": " + error_);
+    }
+
+    bool fail(const char* what) {
+        if (error_.empty()) {
+            error_ = what;
+            error_at_ = p_;
+        }
+        return false;
+    }
+
+    // Only whitespace left
+    bool end() {
+        ws();
+        return p_ == end_ || fail("trailing characters");
+    }
+
+    // Calls field(key) for each member, which must read the value; null
+    // members are skipped
+    template <typename Field>
+    bool object(Field&& field) {
+        if (!consume('{')) return fail("expected an object");
+        if (consume('}')) return true;
+        std::string scratch;
+        do {
+            std::string_view key;
+            if (!string(key, scratch) || !consume(':')) return fail("expected a member name");
+            if (literal("null")) continue;
+            if (!field(key)) return false;
+        } while (consume(','));
+        return consume('}') || fail("expected ',' or '}'");
+    }
+
+    // Calls element() for each element, which must read it
+    template <typename Element>
+    bool array(Element&& element) {
+        if (!consume('[')) return fail("expected an array");
+        if (consume(']')) return true;
+        do {
+            if (!element()) return false;
+        } while (consume(','));
+        return consume(']') || fail("expected ',' or ']'");
+    }
+
+    // A string, as a view of the text; one with escapes is unescaped into `scratch`
+    bool string(std::string_view& out, std::string& scratch) {
+        if (!consume('"')) return fail("expected a string");
+        const char* start = p_;
+        while (p_ < end_ && *p_ != '"' && *p_ != '\\') ++p_;
+        if (p_ == end_) return fail("unterminated string");
+        if (*p_ == '"') {
+            out = std::string_view(start, p_ - start);
+            ++p_;
+            return true;
+        }
+        scratch.assign(start, p_);
+        while (p_ < end_ && *p_ != '"') {
+            if (*p_ != '\\') {
+                scratch += *p_++;
+                continue;
+            }
+            if (++p_ == end_) break;
+            switch (*p_++) {
+                case '"': scratch += '"'; break;
+                case '\\': scratch += '\\'; break;
+                case '/': scratch += '/'; break;
+                case 'b': scratch += '\b'; break;
+                case 'f': scratch += '\f'; break;
+                case 'n': scratch += '\n'; break;
+                case 'r': scratch += '\r'; break;
+                case 't': scratch += '\t'; break;
+                case 'u': {
+                    uint32_t cp = 0;
+                    if (!hex4(cp)) return false;
+                    if (cp >= 0xD800 && cp < 0xDC00) {
+                        uint32_t low = 0;
+                        if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') return fail("unpaired surrogate");
+                        p_ += 2;
+                        if (!hex4(low) || low < 0xDC00 || low >= 0xE000) return fail("unpaired surrogate");
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(cp, scratch);
+                    break;
+                }
+                default:
+                    --p_;
+                    return fail("invalid escape");
+            }
+        }
+        if (p_ == end_) return fail("unterminated string");
+        ++p_;
+        out = scratch;
+        return true;
+    }
+
+    bool string(std::string& out) {
+        std::string_view view;
+        if (!string(view, out)) return false;
+        if (view.data() != out.data()) out.assign(view);
+        return true;
+    }
+
+    template <typename T>
+    bool number(T& out) {
+        ws();
+        auto [next, ec] = std::from_chars(p_, end_, out);
+        if (ec != std::errc() || next == p_) return fail("expected a number");
+        p_ = next;
+        return true;
+    }
+
+    bool boolean(bool& out) {
+        if (literal("true")) {
+            out = true;
+            return true;
+        }
+        if (literal("false")) {
+            out = false;
+            return true;
+        }
+        return fail("expected true or false");
+    }
+
+    // Any value, read and dropped
+    bool skip(int depth = 0) {
+        if (depth > 64) return fail("nested too deeply");
+        ws();
+        if (p_ == end_) return fail("expected a value");
+        switch (*p_) {
+            case '{':
+                return object([&](std::string_view) { return skip(depth + 1); });
+            case '[':
+                return array([&] { return skip(depth + 1); });
+            case '"': {
+                std::string_view ignored;
+                std::string scratch;
+                return string(ignored, scratch);
+            }
+            case 't':
+            case 'f': {
+                bool ignored;
+                return boolean(ignored);
+            }
+            case 'n':
+                return literal("null") || fail("expected a value");
+            default: {
+                double ignored;
+                return number(ignored);
+            }
+        }
+    }
+
+private:
+    const char* begin_;
+    const char* p_;
+    const char* end_;
+    const char* error_at_ = nullptr;
+    std::string error_;
+
+    void ws() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) ++p_;
+    }
+
+    bool consume(char c) {
+        ws();
+        if (p_ < end_ && *p_ == c) {
+            ++p_;
+            return true;
+        }
+        return false;
+    }
+
+    bool literal(std::string_view word) {
+        ws();
+        if (static_cast<size_t>(end_ - p_) < word.size() || std::string_view(p_, word.size()) != word) return false;
+        p_ += word.size();
+        return true;
+    }
+
+    bool hex4(uint32_t& out) {
+        if (end_ - p_ < 4) return fail("short \\u escape");
+        auto [next, ec] = std::from_chars(p_, p_ + 4, out, 16);
+        if (ec != std::errc() || next != p_ + 4) return fail("invalid \\u escape");
+        p_ = next;
+        return true;
+    }
+};
+
+// A JSON array of floats onto the end of `out` (Vector or RepeatedField)
+template <typename Container>
+bool floats(JsonReader& json, Container& out) {
+    return json.array([&] {
+        float value;
+        if (!json.number(value)) return false;
+        if constexpr (std::is_same_v<Container, Vector>) {
+            out.push_back(value);
+        } else {
+            out.Add(value);
+        }
+        return true;
+    });
+}
+
+bool strings(JsonReader& json, google::protobuf::RepeatedPtrField<std::string>& out) {
+    return json.array([&] { return json.string(*out.Add()); });
+}
+
+// Packed little-endian float32 into `out`
+void copyFloats(const char* data, size_t count, float* out) {
+    std::memcpy(out, data, count * sizeof(float));
+    if constexpr (std::endian::native == std::endian::big) {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = std::bit_cast<float>(__builtin_bswap32(std::bit_cast<uint32_t>(out[i])));
+        }
+    }
+}
+
+// Whole vectors of `dim` floats in `body`, or an error
+HandlerStatus countVectors(std::string_view body, uint32_t dim, size_t& count) {
+    const size_t vector_bytes = size_t{dim} * sizeof(float);
+    if (body.empty()) return invalid("empty body");
+    if (vector_bytes == 0 || body.size() % vector_bytes != 0) {
+        return invalid("body of " + std::to_string(body.size()) + " bytes is not a whole number of " +
+                       std::to_string(dim) + "-dimension float32 vectors");
+    }
+    count = body.size() / vector_bytes;
+    return {};
+}
+
+template <typename F>
+void splitCommas(std::string_view text, F&& fn) {
+    while (true) {
+        const size_t comma = text.find(',');
+        fn(text.substr(0, comma));
+        if (comma == std::string_view::npos) return;
+        text.remove_prefix(comma + 1);
+    }
+}
+
+// The fields SearchRequest and SearchBatchRequest share, by JSON member name
+template <typename Message>
+bool searchField(JsonReader& json, std::string_view key, Message& out, bool& handled) {
+    handled = true;
+    if (key == "top_k") {
+        uint32_t top_k;
+        if (!json.number(top_k)) return false;
+        out.set_top_k(top_k);
+    } else if (key == "tenant") {
+        return json.string(*out.mutable_tenant());
+    } else if (key == "namespace") {
+        return json.string(*out.mutable_namespace_());
+    } else if (key == "tags_any") {
+        return strings(json, *out.mutable_tags_any());
+    } else if (key == "nprobe") {
+        uint32_t nprobe;
+        if (!json.number(nprobe)) return false;
+        out.set_nprobe(nprobe);
+    } else if (key == "sample_p") {
+        float sample_p;
+        if (!json.number(sample_p)) return false;
+        out.set_sample_p(sample_p);
+    } else if (key == "latency_budget_ms") {
+        uint32_t budget;
+        if (!json.number(budget)) return false;
+        out.set_latency_budget_ms(budget);
+    } else {
+        handled = false;
+    }
+    return true;
+}
+
+template <typename Message>
+HandlerStatus searchParams(const QueryParams& params, Message& out) {
+    auto uint = [&](std::string_view key, auto set) -> bool {
+        auto text = params.get(key);
+        if (!text) return true;
+        uint32_t value;
+        auto [next, ec] = std::from_chars(text->data(), text->data() + text->size(), value);
+        if (ec != std::errc() || next != text->data() + text->size()) return false;
+        set(value);
+        return true;
+    };
+    if (!uint("top_k", [&](uint32_t v) { out.set_top_k(v); })) return invalid("top_k is not a number");
+    if (!uint("nprobe", [&](uint32_t v) { out.set_nprobe(v); })) return invalid("nprobe is not a number");
+    if (!uint("latency_budget_ms", [&](uint32_t v) { out.set_latency_budget_ms(v); })) {
+        return invalid("latency_budget_ms is not a number");
+    }
+    if (auto text = params.get("sample_p")) {
+        float value;
+        auto [next, ec] = std::from_chars(text->data(), text->data() + text->size(), value);
+        if (ec != std::errc() || next != text->data() + text->size()) return invalid("sample_p is not a number");
+        out.set_sample_p(value);
+    }
+    if (auto tenant = params.get("tenant")) out.set_tenant(std::string(*tenant));
+    if (auto ns = params.get("namespace")) out.set_namespace_(std::string(*ns));
+    if (auto tags = params.get("tags_any"); tags && !tags->empty()) {
+        splitCommas(*tags, [&](std::string_view tag) { out.add_tags_any(std::string(tag)); });
+    }
+    return {};
+}
+
+void appendString(std::string_view text, std::string& out) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    out += '"';
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += kHex[(c >> 4) & 0xF];
+                    out += kHex[c & 0xF];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+template <typename T>
+void appendNumber(T value, std::string& out) {
+    char buf[32];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, end);
+}
+
+void appendStrings(const google::protobuf::RepeatedPtrField<std::string>& values, std::string& out) {
+    out += '[';
+    for (int i = 0; i < values.size(); ++i) {
+        if (i) out += ',';
+        appendString(values[i], out);
+    }
+    out += ']';
+}
+
+void appendHits(const v1::SearchResponse& response, std::string& out) {
+    out += "{\"hits\":[";
+    for (int i = 0; i < response.hits_size(); ++i) {
+        const auto& hit = response.hits(i);
+        if (i) out += ',';
+        out += "{\"id\":";
+        appendString(hit.id(), out);
+        out += ",\"score\":";
+        appendNumber(hit.score(), out);
+        out += ",\"segment_id\":";
+        appendString(hit.segment_id(), out);
+        out += '}';
+    }
+    out += "],\"partial\":";
+    out += response.partial() ? "true" : "false";
+    out += '}';
+}
+
+} // namespace
+
+std::optional<BodyFormat> body_format(std::string_view content_type) {
+    const size_t semicolon = content_type.find(';');
+    std::string_view type = content_type.substr(0, semicolon);
+    while (!type.empty() && type.back() == ' ') type.remove_suffix(1);
+    if (type.empty() || iequals(type, "application/json")) return BodyFormat::kJson;
+    if (iequals(type, "application/octet-stream")) return BodyFormat::kBinary;
+    return std::nullopt;
+}
+
+QueryParams::QueryParams(std::string_view query) {
+    auto decode = [](std::string_view text) {
+        std::string out;
+        out.reserve(text.size());
+        for (size_t i = 0; i < text.size(); ++i) {
+            uint8_t byte;
+            if (text[i] == '+') {
+                out += ' ';
+            } else if (text[i] == '%' && i + 2 < text.size() &&
+                       std::from_chars(text.data() + i + 1, text.data() + i + 3, byte, 16).ptr == text.data() + i + 3) {
+                out += static_cast<char>(byte);
+                i += 2;
+            } else {
+                out += text[i];
+            }
+        }
+        return out;
+    };
+    while (!query.empty()) {
+        const size_t amp = query.find('&');
+        std::string_view pair = query.substr(0, amp);
+        if (!pair.empty()) {
+            const size_t eq = pair.find('=');
+            params_.emplace_back(decode(pair.substr(0, eq)),
+                                 eq == std::string_view::npos ? std::string() : decode(pair.substr(eq + 1)));
+        }
+        if (amp == std::string_view::npos) break;
+        query.remove_prefix(amp + 1);
+    }
+}
+
+std::optional<std::string_view> QueryParams::get(std::string_view key) const {
+    for (const auto& [name, value] : params_) {
+        if (name == key) return std::string_view(value);
+    }
+    return std::nullopt;
+}
+
+HandlerStatus decode_upsert_json(std::string_view body, uint32_t dim, UpsertBody& out) {
+    JsonReader json(body);
+    std::string scratch;
+    auto intern = [&](util::InternTable& table, util::InternTable::Ordinal& ordinal) {
+        std::string_view name;
+        if (!json.string(name, scratch)) return false;
+        ordinal = table.intern(name);
+        return true;
+    };
+    auto record = [&] {
+        VectorEntry& entry = out.entries.emplace_back();
+        std::string_view& id = out.ids.emplace_back();
+        entry.vector.reserve(dim);
+        return json.object([&](std::string_view key) {
+            if (key == "id") {
+                if (!json.string(id, scratch)) return false;
+                if (id.data() == scratch.data()) id = out.unescaped.emplace_back(scratch);
+                return true;
+            }
+            if (key == "vector") return floats(json, entry.vector);
+            if (key == "tenant") return intern(util::InternTable::tenants(), entry.tenant);
+            if (key == "namespace") return intern(util::InternTable::namespaces(), entry.namespace_id);
+            if (key == "tags") {
+                return json.array([&] {
+                    std::string_view name;
+                    if (!json.string(name, scratch)) return false;
+                    if (!name.empty()) entry.tags.push_back(util::InternTable::tags().intern(name));
+                    return true;
+                });
+            }
+            return json.skip();
+        });
+    };
+    const bool ok = json.object([&](std::string_view key) {
+        if (key == "records") return json.array(record);
+        return json.skip();
+    }) && json.end();
+    return ok ? HandlerStatus{} : json.status();
+}
+
+HandlerStatus decode_upsert_binary(std::string_view body, uint32_t dim, const QueryParams& params, UpsertBody& out) {
+    size_t n = 0;
+    auto status = countVectors(body, dim, n);
+    if (!status.ok()) return status;
+
+    out.ids.assign(n, std::string_view());
+    if (auto ids = params.get("ids")) {
+        size_t i = 0;
+        splitCommas(*ids, [&](std::string_view id) {
+            if (i < n) out.ids[i] = id;
+            ++i;
+        });
+        if (i != n) return invalid(std::to_string(i) + " ids for " + std::to_string(n) + " vectors");
+    }
+    const TenantOrdinal tenant = util::InternTable::tenants().intern(params.get("tenant").value_or(""));
+    const NamespaceOrdinal ns = util::InternTable::namespaces().intern(params.get("namespace").value_or(""));
+    TagSet tags;
+    if (auto names = params.get("tags"); names && !names->empty()) {
+        splitCommas(*names, [&](std::string_view name) {
+            if (!name.empty()) tags.push_back(util::InternTable::tags().intern(name));
+        });
+    }
+
+    out.entries.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        VectorEntry& entry = out.entries[i];
+        entry.vector.resize(dim);
+        copyFloats(body.data() + i * dim * sizeof(float), dim, entry.vector.data());
+        entry.tenant = tenant;
+        entry.namespace_id = ns;
+        entry.tags = tags;
+    }
+    return {};
+}
+
+HandlerStatus decode_search_json(std::string_view body, v1::SearchRequest& out) {
+    JsonReader json(body);
+    const bool ok = json.object([&](std::string_view key) {
+        if (key == "vector") return floats(json, *out.mutable_vector());
+        bool handled = false;
+        if (!searchField(json, key, out, handled)) return false;
+        return handled || json.skip();
+    }) && json.end();
+    return ok ? HandlerStatus{} : json.status();
+}
+
+HandlerStatus decode_search_batch_json(std::string_view body, v1::SearchBatchRequest& out) {
+    JsonReader json(body);
+    const bool ok = json.object([&](std::string_view key) {
+        if (key == "vectors") {
+            return json.array([&] { return floats(json, *out.add_queries()->mutable_vector()); });
+        }
+        bool handled = false;
+        if (!searchField(json, key, out, handled)) return false;
+        return handled || json.skip();
+    }) && json.end();
+    return ok ? HandlerStatus{} : json.status();
+}
+
+HandlerStatus decode_search_binary(std::string_view body, uint32_t dim, const QueryParams& params,
+                                   v1::SearchRequest& out) {
+    size_t n = 0;
+    auto status = countVectors(body, dim, n);
+    if (!status.ok()) return status;
+    if (n != 1) return invalid("search body holds " + std::to_string(n) + " vectors; use /v1/search/batch");
+    out.mutable_vector()->Resize(static_cast<int>(dim), 0.0f);
+    copyFloats(body.data(), dim, out.mutable_vector()->mutable_data());
+    return searchParams(params, out);
+}
+
+HandlerStatus decode_search_batch_binary(std::string_view body, uint32_t dim, const QueryParams& params,
+                                         v1::SearchBatchRequest& out) {
+    size_t n = 0;
+    auto status = countVectors(body, dim, n);
+    if (!status.ok()) return status;
+    out.mutable_queries()->Reserve(static_cast<int>(n));
+    for (size_t i = 0; i < n; ++i) {
+        auto* vector = out.add_queries()->mutable_vector();
+        vector->Resize(static_cast<int>(dim), 0.0f);
+        copyFloats(body.data() + i * dim * sizeof(float), dim, vector->mutable_data());
+    }
+    return searchParams(params, out);
+}
+
+void encode_json(const v1::UpsertResponse& response, std::string& out) {
+    out += "{\"epoch\":";
+    appendNumber(response.epoch(), out);
+    out += ",\"ids\":";
+    appendStrings(response.ids(), out);
+    out += '}';
+}
+
+void encode_json(const v1::DeleteResponse& response, std::string& out) {
+    out += "{\"epoch\":";
+    appendNumber(response.epoch(), out);
+    out += '}';
+}
+
+void encode_json(const v1::GetResponse& response, std::string& out) {
+    out += "{\"found\":";
+    out += response.found() ? "true" : "false";
+    if (response.found()) {
+        const auto& record = response.record();
+        out += ",\"record\":{\"id\":";
+        appendString(record.id(), out);
+        if (record.vector_size() > 0) {
+            out += ",\"vector\":[";
+            for (int i = 0; i < record.vector_size(); ++i) {
+                if (i) out += ',';
+                appendNumber(record.vector(i), out);
+            }
+            out += ']';
+        }
+        out += ",\"tenant\":";
+        appendString(record.tenant(), out);
+        out += ",\"namespace\":";
+        appendString(record.namespace_(), out);
+        out += ",\"tags\":";
+        appendStrings(record.tags(), out);
+        out += '}';
+    }
+    out += '}';
+}
+
+void encode_json(const v1::SearchResponse& response, std::string& out) {
+    appendHits(response, out);
+}
+
+void encode_json(const v1::SearchBatchResponse& response, std::string& out) {
+    out += "{\"results\":[";
+    for (int i = 0; i < response.results_size(); ++i) {
+        if (i) out += ',';
+        appendHits(response.results(i), out);
+    }
+    out += "]}";
+}
+
+void encode_error_json(ErrorCode code, std::string_view message, std::string& out) {
+    out += "{\"error\":{\"code\":";
+    appendString(errorCodeName(code), out);
+    out += ",\"message\":";
+    appendString(message, out);
+    out += "}}";
+}
+
+} // namespace woved::api
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "api/handlers/vec.h"
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved::api {
+
+// Request bodies of the HTTP API and the JSON it answers with.
+//
+// Bodies are decoded in one pass straight into handler inputs: JSON
+// vectors are parsed float by float into the entries' own vectors, and
+// application/octet-stream bodies (packed little-endian float32, record
+// after record) are copied into them once. Nothing builds a document
+// tree or an intermediate message.
+
+enum class BodyFormat : uint8_t { kJson, kBinary };
+
+// Format of a Content-Type; std::nullopt if the API does not take it
+std::optional<BodyFormat> body_format(std::string_view content_type);
+
+// Decoded query string; keys and values are percent-decoded
+class QueryParams {
+public:
+    explicit QueryParams(std::string_view query);
+
+    std::optional<std::string_view> get(std::string_view key) const;
+
+private:
+    std::vector<std::pair<std::string, std::string>> params_;
+};
+
+// Upsert records for VecHandler::upsertDecoded(). ids point into the body
+// or the query parameters (or into unescaped, for ids that had JSON
+// escapes), so those must outlive the struct.
+struct UpsertBody {
+    std::vector<std::string_view> ids;
+    std::vector<VectorEntry> entries;
+    std::deque<std::string> unescaped;
+};
+
+// {"records": [{"id", "vector", "tenant", "namespace", "tags"}, ...]}
+HandlerStatus decode_upsert_json(std::string_view body, uint32_t dim, UpsertBody& out);
+// dim floats per record; the records share the tenant, namespace and tags
+// parameters, and take their ids from the comma-separated ids parameter
+// (absent: server-assigned)
+HandlerStatus decode_upsert_binary(std::string_view body, uint32_t dim, const QueryParams& params, UpsertBody& out);
+
+// {"vector": [...], "top_k", "tenant", "namespace", "tags_any", "nprobe",
+// "sample_p", "latency_budget_ms"}
+HandlerStatus decode_search_json(std::string_view body, v1::SearchRequest& out);
+// {"vectors": [[...], ...]} and the same fields as a search
+HandlerStatus decode_search_batch_json(std::string_view body, v1::SearchBatchRequest& out);
+// The query's dim floats; the other fields are query parameters of the
+// same names (tags_any comma-separated)
+HandlerStatus decode_search_binary(std::string_view body, uint32_t dim, const QueryParams& params,
+                                   v1::SearchRequest& out);
+// dim floats per query
+HandlerStatus decode_search_batch_binary(std::string_view body, uint32_t dim, const QueryParams& params,
+                                         v1::SearchBatchRequest& out);
+
+void encode_json(const v1::UpsertResponse& response, std::string& out);
+void encode_json(const v1::DeleteResponse& response, std::string& out);
+void encode_json(const v1::GetResponse& response, std::string& out);
+void encode_json(const v1::SearchResponse& response, std::string& out);
+void encode_json(const v1::SearchBatchResponse& response, std::string& out);
+// {"error": {"code": "INVALID_ARGUMENT", "message": "..."}}
+void encode_error_json(ErrorCode code, std::string_view message, std::string& out);
+
+} // namespace woved::api
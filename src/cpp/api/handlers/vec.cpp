@@ -0,0 +1,403 @@
+#include "vec.h"
+#include "core/config.h"
+#include "index/centroids-manager.h"
+#include "util/cancellation.h"
+#include "util/exceptions.h"
+#include "util/hash.h"
+#include "util/intern-table.h"
+#include "util/uuid-v7.h"
+#include "util/vector-codec.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace woved::api {
+
+namespace {
+
+Timestamp now() {
+    return std::chrono::duration_cast<Timestamp>(std::chrono::system_clock::now().time_since_epoch());
+}
+
+HandlerStatus unbound(const char* call) {
+    return HandlerStatus::error(ErrorCode::INTERNAL, std::string(call) + " is not available");
+}
+
+TagSet internTags(const google::protobuf::RepeatedPtrField<std::string>& names) {
+    TagSet tags;
+    tags.reserve(names.size());
+    for (const auto& name : names) {
+        if (!name.empty()) tags.push_back(util::InternTable::tags().intern(name));
+    }
+    return tags;
+}
+
+} // namespace
+
+VecHandler::Options VecHandler::Options::fromConfig(const Config& config) {
+    Options options;
+    options.dim = config.collection.dim;
+    options.uuid_ids = config.collection.id_type == "uuidv7";
+    options.default_top_k = config.query.default_top_k;
+    options.max_top_k = config.query.max_top_k;
+    options.max_upsert_batch = config.limits.max_upsert_batch;
+    options.max_query_batch = config.limits.max_query_batch;
+    options.normalize = util::parse_metric(config.collection.metric) == Metric::INNER_PRODUCT;
+    return options;
+}
+
+VecHandler::VecHandler(const Options& options, Backend backend, const index::CentroidsManager* centroids)
+    : options_(options), backend_(std::move(backend)), centroids_(centroids) {
+    options_.max_top_k = std::max(options_.max_top_k, 1u);
+    options_.default_top_k = std::clamp(options_.default_top_k, 1u, options_.max_top_k);
+}
+
+HandlerStatus VecHandler::upsert(const v1::UpsertRequest& request, v1::UpsertResponse& response) const {
+    if (!backend_.upsert) return unbound("upsert");
+    std::vector<VectorEntry> entries;
+    auto status = buildEntries(request.records(), nullptr, entries);
+    if (!status.ok()) return status;
+    status = prepareVectors(entries);
+    if (!status.ok()) return status;
+    uint64_t epoch = 0;
+    status = apply(entries, epoch, *response.mutable_ids());
+    response.set_epoch(epoch);
+    return status;
+}
+
+HandlerStatus VecHandler::prepareWindow(const v1::UpsertWindow& window, std::vector<VectorEntry>& entries) const {
+    auto status = buildEntries(window.records(), window.vectors().empty() ? nullptr : &window.vectors(), entries);
+    if (!status.ok()) return status;
+    return prepareVectors(entries);
+}
+
+HandlerStatus VecHandler::applyWindow(std::vector<VectorEntry>& entries, v1::UpsertAck& ack) const {
+    if (!backend_.upsert) return unbound("upsert");
+    uint64_t epoch = 0;
+    auto status = apply(entries, epoch, *ack.mutable_ids());
+    ack.set_epoch(epoch);
+    return status;
+}
+
+HandlerStatus VecHandler::upsertDecoded(const std::vector<std::string_view>& ids, std::vector<VectorEntry>& entries,
+                                        v1::UpsertResponse& response) const {
+    const size_t n = entries.size();
+    if (n == 0) return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "upsert without records");
+    if (n > options_.max_upsert_batch) {
+        return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT,
+                                    "upsert of " + std::to_string(n) + " records, limit " +
+                                        std::to_string(options_.max_upsert_batch));
+    }
+    if (ids.size() != n) {
+        return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, std::to_string(ids.size()) + " ids for " +
+                                                                     std::to_string(n) + " records");
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (entries[i].vector.size() != options_.dim) {
+            return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT,
+                                        "record " + std::to_string(i) + " has " +
+                                            std::to_string(entries[i].vector.size()) +
+                                            " dimensions, collection has " + std::to_string(options_.dim));
+        }
+    }
+    if (!backend_.upsert) return unbound("upsert");
+    auto status = resolveIds(ids, entries, true);
+    if (!status.ok()) return status;
+
+    status = prepareVectors(entries);
+    if (!status.ok()) return status;
+
+    const Timestamp at = now();
+    for (auto& entry : entries) entry.created_at = entry.updated_at = at;
+    uint64_t epoch = 0;
+    status = apply(entries, epoch, *response.mutable_ids());
+    response.set_epoch(epoch);
+    return status;
+}
+
+HandlerStatus VecHandler::remove(const v1::DeleteRequest& request, v1::DeleteResponse& response) const {
+    const int n = request.ids_size();
+    if (n == 0) return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "delete without ids");
+    if (static_cast<uint32_t>(n) > options_.max_upsert_batch) {
+        return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT,
+                                    "delete of " + std::to_string(n) + " ids, limit " +
+                                        std::to_string(options_.max_upsert_batch));
+    }
+    if (!backend_.remove) return unbound("delete");
+
+    std::vector<std::string_view> ids(n);
+    for (int i = 0; i < n; ++i) ids[i] = request.ids(i);
+    std::vector<VectorEntry> entries(n);
+    auto status = resolveIds(ids, entries, false);
+    if (!status.ok()) return status;
+
+    const Timestamp at = now();
+    for (auto& entry : entries) {
+        entry.deleted = true;
+        entry.created_at = entry.updated_at = at;
+    }
+    auto result = backend_.remove(entries);
+    if (!result.status.ok()) return result.status;
+    response.set_epoch(result.epoch);
+    return {};
+}
+
+HandlerStatus VecHandler::get(const v1::GetRequest& request, v1::GetResponse& response) const {
+    if (!backend_.get) return unbound("get");
+    std::vector<VectorEntry> keys(1);
+    auto status = resolveIds({request.id()}, keys, false);
+    if (!status.ok()) return status;
+
+    auto entry = backend_.get(keys[0]);
+    response.set_found(entry.has_value());
+    if (!entry) return {};
+    v1::Record* record = response.mutable_record();
+    record->set_id(options_.uuid_ids ? util::uuid_to_string(entry->uuid) : entry->id);
+    if (request.include_vector()) {
+        record->mutable_vector()->Add(entry->vector.begin(), entry->vector.end());
+    }
+    record->set_tenant(util::InternTable::tenants().name(entry->tenant));
+    record->set_namespace_(util::InternTable::namespaces().name(entry->namespace_id));
+    for (TagId tag : entry->tags) record->add_tags(util::InternTable::tags().name(tag));
+    return {};
+}
+
+HandlerStatus VecHandler::search(const v1::SearchRequest& request, v1::SearchResponse& response,
+                                 const util::CancellationToken& cancel) const {
+    auto status = checkVector(request.vector(), "query", -1);
+    if (!status.ok()) return status;
+    QueryRequest query;
+    status = checkTopK(request.top_k(), query.top_k);
+    if (!status.ok()) return status;
+    if (!backend_.search) return unbound("search");
+
+    query.query.assign(request.vector().begin(), request.vector().end());
+    query.tenant = request.tenant();
+    query.namespace_id = request.namespace_();
+    query.tags_any.assign(request.tags_any().begin(), request.tags_any().end());
+    if (request.has_nprobe()) query.nprobe = request.nprobe();
+    if (request.has_sample_p()) query.sample_p = request.sample_p();
+    if (request.has_latency_budget_ms()) query.latency_budget_ms = request.latency_budget_ms();
+
+    fillHits(backend_.search(query, cancel), response);
+    return {};
+}
+
+HandlerStatus VecHandler::searchBatch(const v1::SearchBatchRequest& request, v1::SearchBatchResponse& response,
+                                      const util::CancellationToken& cancel) const {
+    const int n = request.queries_size();
+    if (n == 0) return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "batch without queries");
+    if (static_cast<uint32_t>(n) > options_.max_query_batch) {
+        return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT,
+                                    "batch of " + std::to_string(n) + " queries, limit " +
+                                        std::to_string(options_.max_query_batch));
+    }
+    BatchQueryRequest batch;
+    auto status = checkTopK(request.top_k(), batch.top_k);
+    if (!status.ok()) return status;
+    for (int i = 0; i < n; ++i) {
+        status = checkVector(request.queries(i).vector(), "query", i);
+        if (!status.ok()) return status;
+    }
+    if (!backend_.search_batch) return unbound("batch search");
+
+    batch.queries.resize(n);
+    for (int i = 0; i < n; ++i) {
+        const auto& vector = request.queries(i).vector();
+        batch.queries[i].assign(vector.begin(), vector.end());
+    }
+    batch.tenant = request.tenant();
+    batch.namespace_id = request.namespace_();
+    batch.tags_any.assign(request.tags_any().begin(), request.tags_any().end());
+    if (request.has_nprobe()) batch.nprobe = request.nprobe();
+    if (request.has_sample_p()) batch.sample_p = request.sample_p();
+    if (request.has_latency_budget_ms()) batch.latency_budget_ms = request.latency_budget_ms();
+
+    auto results = backend_.search_batch(batch, cancel);
+    if (results.size() != static_cast<size_t>(n)) {
+        return HandlerStatus::error(ErrorCode::INTERNAL, "batch search returned " + std::to_string(results.size()) +
+                                                             " results for " + std::to_string(n) + " queries");
+    }
+    response.mutable_results()->Reserve(n);
+    for (const auto& result : results) fillHits(result, *response.add_results());
+    return {};
+}
+
+HandlerStatus VecHandler::bulkImport(const v1::BulkImportRequest& request, v1::BulkImportResponse& response) const {
+    if (request.files_size() == 0) return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "import without files");
+    for (const auto& file : request.files()) {
+        if (file.empty()) return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "empty import file name");
+    }
+    if (!options_.uuid_ids && request.ids_file().empty()) {
+        return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "import into a custom-id collection without ids_file");
+    }
+    if (!backend_.bulk_import) return unbound("bulk import");
+
+    ImportResult result = backend_.bulk_import(request);
+    response.set_rows(result.rows);
+    response.set_epoch(result.epoch);
+    for (auto& id : result.segment_ids) *response.add_segment_ids() = std::move(id);
+    response.set_trained_centroids(result.trained);
+    response.set_elapsed_s(result.elapsed_s);
+    return {};
+}
+
+HandlerStatus VecHandler::buildEntries(const google::protobuf::RepeatedPtrField<v1::Record>& records,
+                                       const std::string* packed, std::vector<VectorEntry>& entries) const {
+    const int n = records.size();
+    if (n == 0) return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "upsert without records");
+    if (static_cast<uint32_t>(n) > options_.max_upsert_batch) {
+        return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT,
+                                    "upsert of " + std::to_string(n) + " records, limit " +
+                                        std::to_string(options_.max_upsert_batch));
+    }
+    const size_t vector_bytes = size_t{options_.dim} * sizeof(float);
+    if (packed && packed->size() != n * vector_bytes) {
+        return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT,
+                                    "packed vectors hold " + std::to_string(packed->size()) + " bytes, " +
+                                        std::to_string(n) + " records of " + std::to_string(options_.dim) +
+                                        " dimensions need " + std::to_string(n * vector_bytes));
+    }
+
+    std::vector<std::string_view> ids(n);
+    for (int i = 0; i < n; ++i) {
+        if (!packed) {
+            auto status = checkVector(records[i].vector(), "record", i);
+            if (!status.ok()) return status;
+        }
+        ids[i] = records[i].id();
+    }
+    entries.assign(n, VectorEntry{});
+    auto status = resolveIds(ids, entries, true);
+    if (!status.ok()) return status;
+
+    const Timestamp at = now();
+    for (int i = 0; i < n; ++i) {
+        const auto& record = records[i];
+        VectorEntry& entry = entries[i];
+        if (packed) {
+            entry.vector.resize(options_.dim);
+            std::memcpy(entry.vector.data(), packed->data() + i * vector_bytes, vector_bytes);
+            if constexpr (std::endian::native == std::endian::big) {
+                for (float& v : entry.vector) v = std::bit_cast<float>(__builtin_bswap32(std::bit_cast<uint32_t>(v)));
+            }
+        } else {
+            entry.vector.assign(record.vector().begin(), record.vector().end());
+        }
+        entry.tenant = util::InternTable::tenants().intern(record.tenant());
+        entry.namespace_id = util::InternTable::namespaces().intern(record.namespace_());
+        entry.tags = internTags(record.tags());
+        entry.created_at = entry.updated_at = at;
+    }
+    return {};
+}
+
+HandlerStatus VecHandler::prepareVectors(std::vector<VectorEntry>& entries) const {
+    if (!centroids_ || entries.empty()) return {};
+    const size_t dim = options_.dim;
+    std::vector<const float*> rows(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) rows[i] = entries[i].vector.data();
+    std::vector<float> staging(entries.size() * dim);
+    std::vector<CentroidId> ids(entries.size());
+    try {
+        centroids_->assignBatch(rows, options_.dim, options_.normalize, staging.data(), ids.data());
+    } catch (const util::InvalidArgumentException& e) {
+        // Request vectors were checked against collection.dim: the centroids disagree with it
+        return HandlerStatus::error(ErrorCode::INTERNAL, e.what());
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        std::copy_n(staging.data() + i * dim, dim, entries[i].vector.data());
+        entries[i].centroid_id = ids[i];
+    }
+    return {};
+}
+
+HandlerStatus VecHandler::apply(std::vector<VectorEntry>& entries, uint64_t& epoch,
+                                google::protobuf::RepeatedPtrField<std::string>& ids) const {
+    auto result = backend_.upsert(entries);
+    if (!result.status.ok()) return result.status;
+    epoch = result.epoch;
+    ids.Reserve(static_cast<int>(entries.size()));
+    for (const auto& entry : entries) {
+        *ids.Add() = options_.uuid_ids ? util::uuid_to_string(entry.uuid) : entry.id;
+    }
+    return {};
+}
+
+HandlerStatus VecHandler::resolveIds(const std::vector<std::string_view>& ids, std::vector<VectorEntry>& entries,
+                                     bool assign_missing) const {
+    const size_t n = ids.size();
+    std::vector<VectorIdHash> hashes(n);
+    if (options_.uuid_ids) {
+        std::vector<VectorUuid> uuids(n);
+        std::vector<size_t> missing;
+        for (size_t i = 0; i < n; ++i) {
+            if (ids[i].empty()) {
+                if (!assign_missing) return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "empty id");
+                missing.push_back(i);
+                continue;
+            }
+            auto uuid = util::parse_uuid(ids[i]);
+            if (!uuid) {
+                return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT,
+                                            "'" + std::string(ids[i]) + "' is not a UUID");
+            }
+            uuids[i] = *uuid;
+        }
+        if (!missing.empty()) {
+            std::vector<VectorUuid> fresh(missing.size());
+            util::UuidV7Generator::local().generateBatch(fresh);
+            for (size_t j = 0; j < missing.size(); ++j) uuids[missing[j]] = fresh[j];
+        }
+        util::hash_uuids(uuids, hashes);
+        for (size_t i = 0; i < n; ++i) {
+            entries[i].uuid = uuids[i];
+            entries[i].id_hash = hashes[i];
+        }
+        return {};
+    }
+
+    std::vector<VectorId> keys(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (ids[i].empty()) return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "empty id");
+        keys[i] = ids[i];
+    }
+    util::hash_ids(keys, hashes);
+    for (size_t i = 0; i < n; ++i) {
+        entries[i].id = std::move(keys[i]);
+        entries[i].id_hash = hashes[i];
+    }
+    return {};
+}
+
+HandlerStatus VecHandler::checkVector(const google::protobuf::RepeatedField<float>& vector, const char* what,
+                                      int index) const {
+    if (static_cast<uint32_t>(vector.size()) == options_.dim) return {};
+    std::string name = what;
+    if (index >= 0) name += " " + std::to_string(index);
+    return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT,
+                                name + " has " + std::to_string(vector.size()) + " dimensions, collection has " +
+                                    std::to_string(options_.dim));
+}
+
+HandlerStatus VecHandler::checkTopK(uint32_t requested, uint32_t& top_k) const {
+    if (requested > options_.max_top_k) {
+        return HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, "top_k " + std::to_string(requested) +
+                                                                     " exceeds " + std::to_string(options_.max_top_k));
+    }
+    top_k = requested == 0 ? options_.default_top_k : requested;
+    return {};
+}
+
+void VecHandler::fillHits(const SearchResult& result, v1::SearchResponse& response) const {
+    response.set_partial(result.partial);
+    response.mutable_hits()->Reserve(static_cast<int>(result.hits.size()));
+    for (const auto& hit : result.hits) {
+        v1::SearchHit* out = response.add_hits();
+        out->set_id(hit.id);
+        out->set_score(hit.score);
+        out->set_segment_id(hit.segment_id);
+    }
+}
+
+} // namespace woved::api
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "include/woved/api-errors.h"
+#include "include/woved/types.h"
+#include "proto/woved.pb.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::index {
+class CentroidsManager;
+}
+
+namespace woved::util {
+class CancellationToken;
+}
+
+namespace woved::api {
+
+// Outcome of a handler; the front end maps it to its own status
+struct HandlerStatus {
+    ErrorCode code = ErrorCode::OK;
+    std::string message;
+    std::chrono::milliseconds retry_after{0};  // OVERLOADED only
+
+    bool ok() const { return code == ErrorCode::OK; }
+    static HandlerStatus error(ErrorCode code, std::string message) {
+        return {code, std::move(message), std::chrono::milliseconds(0)};
+    }
+};
+
+// The woved.v1.VectorService calls: validates requests against the
+// collection, resolves ids, id hashes, tenants, namespaces and tags, and
+// turns results back into messages.
+//
+// The engine is reached through callbacks the owner binds to the WAL,
+// message buffer, id map and query engine, so the front ends do not
+// depend on how those are put together. An unbound callback fails its
+// calls as INTERNAL.
+//
+// In uuidv7 collections an upserted record without an id gets one from
+// UuidV7Generator, and ids are hashed in batches (util::hash_uuids,
+// util::hash_ids). Handlers keep no per-call state and may run on any
+// thread.
+//
+// Given a CentroidsManager, upserted vectors are normalized (inner_product
+// collections) and assigned their centroid in one batch before they reach
+// the backend (CentroidsManager::assignBatch), so the WAL and the buffer
+// take them as prepared. Without one (coordinator mode) entries pass
+// through raw and the shard nodes prepare them.
+class VecHandler {
+public:
+    struct Options {
+        uint32_t dim = 768;                 // collection.dim
+        bool uuid_ids = true;               // collection.id_type uuidv7
+        uint32_t default_top_k = 10;        // query.default_top_k
+        uint32_t max_top_k = 100;           // query.max_top_k
+        uint32_t max_upsert_batch = 10000;  // limits.max_upsert_batch
+        uint32_t max_query_batch = 100;     // limits.max_query_batch
+        bool normalize = true;              // collection.metric inner_product
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct WriteResult {
+        HandlerStatus status;
+        Epoch epoch = 0;                    // Of the last entry applied
+    };
+
+    struct SearchResult {
+        std::vector<QueryResult> hits;      // Best first
+        bool partial = false;
+    };
+
+    struct ImportResult {
+        uint64_t rows = 0;
+        Epoch epoch = 0;                    // Carried by every imported row
+        std::vector<std::string> segment_ids;
+        bool trained = false;               // Centroids were trained
+        double elapsed_s = 0;
+    };
+
+    struct Backend {
+        // Log and buffer the entries, in order; return once they are durable
+        // (in the WAL, or in the buffer alone when MessageBuffer::durableAck())
+        std::function<WriteResult(std::vector<VectorEntry>& entries)> upsert;
+        // Tombstone the entries' ids (deleted set, no vectors)
+        std::function<WriteResult(std::vector<VectorEntry>& entries)> remove;
+        // Latest live version of the id in `key` (id or uuid, and id_hash)
+        std::function<std::optional<VectorEntry>(const VectorEntry& key)> get;
+        std::function<SearchResult(const QueryRequest& request, const util::CancellationToken& cancel)> search;
+        std::function<std::vector<SearchResult>(const BatchQueryRequest& request,
+                                                const util::CancellationToken& cancel)> search_batch;
+        // Build segments straight from the files (storage::BulkLoader);
+        // return once the import is installed. Throws
+        // util::InvalidArgumentException for unusable inputs.
+        std::function<ImportResult(const v1::BulkImportRequest& request)> bulk_import;
+    };
+
+    // `centroids`, when set, must outlive the handler
+    VecHandler(const Options& options, Backend backend, const index::CentroidsManager* centroids = nullptr);
+
+    VecHandler(const VecHandler&) = delete;
+    VecHandler& operator=(const VecHandler&) = delete;
+
+    HandlerStatus upsert(const v1::UpsertRequest& request, v1::UpsertResponse& response) const;
+    // UpsertStream, one window at a time. prepareWindow() resolves the
+    // window's records once; applyWindow() hands them to the engine and
+    // may be repeated with the same entries while it returns OVERLOADED.
+    HandlerStatus prepareWindow(const v1::UpsertWindow& window, std::vector<VectorEntry>& entries) const;
+    HandlerStatus applyWindow(std::vector<VectorEntry>& entries, v1::UpsertAck& ack) const;
+    // Records a front end decoded itself, vectors already in place: each
+    // entry's vector, tenant, namespace_id and tags are set, and ids[i] is
+    // its id (empty: server-assigned in uuidv7 collections)
+    HandlerStatus upsertDecoded(const std::vector<std::string_view>& ids, std::vector<VectorEntry>& entries,
+                                v1::UpsertResponse& response) const;
+    HandlerStatus remove(const v1::DeleteRequest& request, v1::DeleteResponse& response) const;
+    HandlerStatus get(const v1::GetRequest& request, v1::GetResponse& response) const;
+    HandlerStatus search(const v1::SearchRequest& request, v1::SearchResponse& response,
+                         const util::CancellationToken& cancel) const;
+    HandlerStatus searchBatch(const v1::SearchBatchRequest& request, v1::SearchBatchResponse& response,
+                              const util::CancellationToken& cancel) const;
+    HandlerStatus bulkImport(const v1::BulkImportRequest& request, v1::BulkImportResponse& response) const;
+
+    const Options& options() const { return options_; }
+
+private:
+    Options options_;
+    Backend backend_;
+    const index::CentroidsManager* centroids_;
+
+    // Entries for `records`, their vectors from `packed` when set
+    HandlerStatus buildEntries(const google::protobuf::RepeatedPtrField<v1::Record>& records,
+                               const std::string* packed, std::vector<VectorEntry>& entries) const;
+    // Normalize and assign centroids to resolved entries, once per batch
+    HandlerStatus prepareVectors(std::vector<VectorEntry>& entries) const;
+    // Hand resolved entries to the engine; the epoch and ids go to the response
+    HandlerStatus apply(std::vector<VectorEntry>& entries, uint64_t& epoch,
+                        google::protobuf::RepeatedPtrField<std::string>& ids) const;
+    // Resolve `ids` into entries: parsed or checked ids and their hashes
+    HandlerStatus resolveIds(const std::vector<std::string_view>& ids, std::vector<VectorEntry>& entries,
+                             bool assign_missing) const;
+    HandlerStatus checkVector(const google::protobuf::RepeatedField<float>& vector, const char* what,
+                              int index) const;
+    HandlerStatus checkTopK(uint32_t requested, uint32_t& top_k) const;
+    void fillHits(const SearchResult& result, v1::SearchResponse& response) const;
+};
+
+} // namespace woved::api
@@ -0,0 +1,789 @@
+#include "http-server.h"
+#include "api/handlers/http-body.h"
+#include "api/handlers/vec.h"
+#include "core/config.h"
+#include "util/cancellation.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include "util/numa-aware.h"
+#include "util/thread-pool.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace woved::api {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kInitialBuffer = 4096;
+constexpr size_t kKeptBuffer = 1 << 20;  // A connection's buffer past this shrinks once drained
+
+int httpStatus(ErrorCode code) {
+    switch (code) {
+        case ErrorCode::OK: return 200;
+        case ErrorCode::INVALID_ARGUMENT: return 400;
+        case ErrorCode::NOT_FOUND: return 404;
+        case ErrorCode::OVERLOADED: return 429;
+        case ErrorCode::DEADLINE_EXCEEDED: return 504;
+        case ErrorCode::INTERNAL: break;
+    }
+    return 500;
+}
+
+const char* reason(int status) {
+    switch (status) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Content Too Large";
+        case 415: return "Unsupported Media Type";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 501: return "Not Implemented";
+        case 504: return "Gateway Timeout";
+        case 505: return "HTTP Version Not Supported";
+    }
+    return status < 500 ? "Bad Request" : "Internal Server Error";
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return (x >= 'A' && x <= 'Z' ? x - 'A' + 'a' : x) == (y >= 'A' && y <= 'Z' ? y - 'A' + 'a' : y);
+    });
+}
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+    return text;
+}
+
+std::string decodePath(std::string_view text) {
+    std::string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        uint8_t byte;
+        if (text[i] == '%' && i + 2 < text.size() &&
+            std::from_chars(text.data() + i + 1, text.data() + i + 3, byte, 16).ptr == text.data() + i + 3) {
+            out += static_cast<char>(byte);
+            i += 2;
+        } else {
+            out += text[i];
+        }
+    }
+    return out;
+}
+
+// A request whose header and body are in the connection's buffer; the
+// views point into it
+struct Request {
+    std::string_view method;
+    std::string_view path;
+    std::string_view query;
+    std::string_view content_type;
+    std::string_view body;
+    size_t size = 0;  // Header and body bytes
+    bool keep_alive = true;
+};
+
+struct Response {
+    int status = 200;
+    std::string body;
+    int64_t retry_after_ms = 0;
+};
+
+Response errorResponse(int status, ErrorCode code, std::string_view message) {
+    Response response;
+    response.status = status;
+    encode_error_json(code, message, response.body);
+    return response;
+}
+
+// All of `iov` to a non-blocking socket, waiting up to `timeout_ms` for
+// each stall
+bool writeAll(int fd, iovec* iov, int count, uint32_t timeout_ms) {
+    while (count > 0) {
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = static_cast<size_t>(count);
+        const ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            pollfd pfd{fd, POLLOUT, 0};
+            if (::poll(&pfd, 1, static_cast<int>(timeout_ms)) <= 0) return false;
+            continue;
+        }
+        auto left = static_cast<size_t>(n);
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+struct HttpServer::Impl {
+    struct Stats {
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> accepted{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> body_bytes{0};
+    };
+
+    struct Loop;
+
+    struct Connection {
+        Connection(Loop& loop, int fd) : loop(loop), fd(fd) {}
+
+        Loop& loop;
+        const int fd;
+        std::unique_ptr<char[]> buffer;
+        size_t capacity = 0;
+        size_t used = 0;
+        bool continued = false;    // 100 Continue sent for the request being received
+        bool busy = false;         // With the pool; loop.mutex
+        Clock::time_point active;  // Last read or re-arm
+    };
+
+    struct Loop {
+        int epoll = -1;
+        int listener = -1;
+        int wake = -1;
+        std::thread thread;
+        std::mutex mutex;
+        std::unordered_map<Connection*, std::unique_ptr<Connection>> connections;
+    };
+
+    enum class Parse : uint8_t { kComplete, kNeedMore, kRejected };
+    enum class Receive : uint8_t { kData, kBlocked, kClosed };
+
+    Impl(const Options& options, const VecHandler& handler, util::ThreadPool& pool)
+        : options(options), handler(handler), pool(pool) {}
+
+    const Options& options;
+    const VecHandler& handler;
+    util::ThreadPool& pool;
+    std::vector<std::unique_ptr<Loop>> loops;
+    Stats stats;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> open{0};
+
+    // Requests running on the pool; shutdown waits them out before closing
+    // the connections they answer on
+    std::atomic<size_t> handling{0};
+    std::mutex handling_mutex;
+    std::condition_variable handling_cv;
+
+    void handlerDone() {
+        if (handling.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(handling_mutex);
+            handling_cv.notify_all();
+        }
+    }
+
+    void run(Loop& loop) {
+        epoll_event events[64];
+        auto sweep_at = Clock::now() + std::chrono::seconds(1);
+        while (!stopping.load(std::memory_order_acquire)) {
+            const int n = ::epoll_wait(loop.epoll, events, 64, 1000);
+            if (n < 0 && errno != EINTR) {
+                LOG_ERROR("HTTP event loop failed: {}", std::strerror(errno));
+                return;
+            }
+            for (int i = 0; i < n; ++i) {
+                void* ptr = events[i].data.ptr;
+                if (ptr == &loop.listener) {
+                    accept(loop);
+                } else if (ptr != &loop.wake) {
+                    serve(*static_cast<Connection*>(ptr), false);
+                }
+            }
+            if (Clock::now() >= sweep_at) {
+                sweep(loop);
+                sweep_at = Clock::now() + std::chrono::seconds(1);
+            }
+        }
+    }
+
+    void accept(Loop& loop) {
+        while (true) {
+            const int fd = ::accept4(loop.listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) LOG_WARN("HTTP accept failed: {}", std::strerror(errno));
+                return;
+            }
+            if (open.load(std::memory_order_relaxed) >= options.max_connections) {
+                stats.rejected.fetch_add(1, std::memory_order_relaxed);
+                ::close(fd);
+                continue;
+            }
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            auto owned = std::make_unique<Connection>(loop, fd);
+            Connection& connection = *owned;
+            connection.active = Clock::now();
+            {
+                std::lock_guard<std::mutex> lock(loop.mutex);
+                loop.connections.emplace(&connection, std::move(owned));
+            }
+            open.fetch_add(1, std::memory_order_relaxed);
+            stats.accepted.fetch_add(1, std::memory_order_relaxed);
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLONESHOT;
+            event.data.ptr = &connection;
+            if (::epoll_ctl(loop.epoll, EPOLL_CTL_ADD, fd, &event) != 0) close(connection);
+        }
+    }
+
+    // Serve `connection` from the calling thread, which owns it, until it
+    // would block (re-armed), closes, or hands a request to the pool
+    void serve(Connection& connection, bool on_pool) {
+        while (true) {
+            Request request;
+            switch (parse(connection, request)) {
+                case Parse::kRejected:
+                    close(connection);
+                    return;
+                case Parse::kNeedMore:
+                    switch (receive(connection)) {
+                        case Receive::kData:
+                            continue;
+                        case Receive::kBlocked:
+                            rearm(connection);
+                            return;
+                        case Receive::kClosed:
+                            close(connection);
+                            return;
+                    }
+                    return;
+                case Parse::kComplete:
+                    break;
+            }
+            if (!on_pool && request.method != "GET") {
+                {
+                    std::lock_guard<std::mutex> lock(connection.loop.mutex);
+                    connection.busy = true;
+                }
+                handling.fetch_add(1, std::memory_order_relaxed);
+                pool.submit([this, &connection, request] {
+                    if (answer(connection, request)) {
+                        serve(connection, true);
+                    } else {
+                        close(connection);
+                    }
+                    handlerDone();
+                }, util::ThreadPool::Priority::Foreground);
+                return;
+            }
+            if (!answer(connection, request)) {
+                close(connection);
+                return;
+            }
+        }
+    }
+
+    Parse parse(Connection& connection, Request& request) {
+        const std::string_view data(connection.buffer.get(), connection.used);
+        const size_t header_end = data.find("\r\n\r\n");
+        if (header_end == std::string_view::npos) {
+            if (connection.used < options.max_header_bytes) return Parse::kNeedMore;
+            return reject(connection, 431, "request header exceeds " + std::to_string(options.max_header_bytes) +
+                                               " bytes");
+        }
+        const size_t header_bytes = header_end + 4;
+        std::string_view lines = data.substr(0, header_end);
+
+        size_t eol = lines.find("\r\n");
+        const std::string_view start = lines.substr(0, eol);
+        lines = eol == std::string_view::npos ? std::string_view() : lines.substr(eol + 2);
+        const size_t sp1 = start.find(' ');
+        const size_t sp2 = start.rfind(' ');
+        if (sp1 == std::string_view::npos || sp2 == sp1) return reject(connection, 400, "malformed request line");
+        request.method = start.substr(0, sp1);
+        const std::string_view target = start.substr(sp1 + 1, sp2 - sp1 - 1);
+        const std::string_view version = start.substr(sp2 + 1);
+        if (version == "HTTP/1.0") {
+            request.keep_alive = false;
+        } else if (version != "HTTP/1.1") {
+            return reject(connection, 505, "unsupported protocol version");
+        }
+        const size_t question = target.find('?');
+        request.path = target.substr(0, question);
+        if (question != std::string_view::npos) request.query = target.substr(question + 1);
+
+        size_t content_length = 0;
+        bool expect_continue = false;
+        while (!lines.empty()) {
+            eol = lines.find("\r\n");
+            const std::string_view line = lines.substr(0, eol);
+            lines = eol == std::string_view::npos ? std::string_view() : lines.substr(eol + 2);
+            const size_t colon = line.find(':');
+            if (colon == std::string_view::npos) return reject(connection, 400, "malformed header line");
+            const std::string_view name = line.substr(0, colon);
+            const std::string_view value = trim(line.substr(colon + 1));
+            if (iequals(name, "content-length")) {
+                auto [next, ec] = std::from_chars(value.data(), value.data() + value.size(), content_length);
+                if (ec != std::errc() || next != value.data() + value.size()) {
+                    return reject(connection, 400, "invalid Content-Length");
+                }
+            } else if (iequals(name, "transfer-encoding")) {
+                return reject(connection, 501, "chunked request bodies are not supported; send Content-Length");
+            } else if (iequals(name, "content-type")) {
+                request.content_type = value;
+            } else if (iequals(name, "connection")) {
+                if (iequals(value, "close")) request.keep_alive = false;
+                if (iequals(value, "keep-alive")) request.keep_alive = true;
+            } else if (iequals(name, "expect")) {
+                expect_continue = iequals(value, "100-continue");
+            }
+        }
+        if (content_length > options.max_body_bytes) {
+            return reject(connection, 413, "body of " + std::to_string(content_length) + " bytes exceeds " +
+                                               std::to_string(options.max_body_bytes));
+        }
+
+        // The whole request lands in one buffer, so the body is decoded in place
+        const size_t size = header_bytes + content_length;
+        if (size > connection.capacity) resize(connection, size);
+        if (connection.used < size) {
+            if (expect_continue && !connection.continued) {
+                connection.continued = true;
+                static constexpr std::string_view kContinue = "HTTP/1.1 100 Continue\r\n\r\n";
+                iovec iov{const_cast<char*>(kContinue.data()), kContinue.size()};
+                if (!writeAll(connection.fd, &iov, 1, options.timeout_ms)) return Parse::kRejected;
+            }
+            return Parse::kNeedMore;
+        }
+        request.size = size;
+        request.body = std::string_view(connection.buffer.get() + header_bytes, content_length);
+        return Parse::kComplete;
+    }
+
+    Receive receive(Connection& connection) {
+        if (connection.used == connection.capacity) {
+            resize(connection, std::max(kInitialBuffer, connection.capacity * 2));
+        }
+        while (true) {
+            const ssize_t n = ::recv(connection.fd, connection.buffer.get() + connection.used,
+                                     connection.capacity - connection.used, 0);
+            if (n > 0) {
+                connection.used += static_cast<size_t>(n);
+                connection.active = Clock::now();
+                return Receive::kData;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return Receive::kBlocked;
+            return Receive::kClosed;
+        }
+    }
+
+    static void resize(Connection& connection, size_t capacity) {
+        auto buffer = std::make_unique_for_overwrite<char[]>(capacity);
+        if (connection.used > 0) std::memcpy(buffer.get(), connection.buffer.get(), connection.used);
+        connection.buffer = std::move(buffer);
+        connection.capacity = capacity;
+    }
+
+    // Answer and drop the request; whether the connection stays open
+    bool answer(Connection& connection, const Request& request) {
+        Response response = route(request);
+        stats.requests.fetch_add(1, std::memory_order_relaxed);
+        stats.body_bytes.fetch_add(request.body.size(), std::memory_order_relaxed);
+        if (response.status >= 400) stats.errors.fetch_add(1, std::memory_order_relaxed);
+        const bool keep_alive = request.keep_alive && !stopping.load(std::memory_order_acquire);
+        const bool sent = send(connection, response, keep_alive);
+
+        connection.used -= request.size;
+        if (connection.used > 0) {
+            std::memmove(connection.buffer.get(), connection.buffer.get() + request.size, connection.used);
+        }
+        if (connection.capacity > kKeptBuffer && connection.used <= kInitialBuffer) {
+            resize(connection, kInitialBuffer);
+        }
+        connection.continued = false;
+        return sent && keep_alive;
+    }
+
+    // Answer a request the parser refused, then have the connection closed
+    Parse reject(Connection& connection, int status, const std::string& message) {
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+        send(connection, errorResponse(status, ErrorCode::INVALID_ARGUMENT, message), false);
+        return Parse::kRejected;
+    }
+
+    bool send(Connection& connection, const Response& response, bool keep_alive) {
+        std::string head;
+        head.reserve(192);
+        head += "HTTP/1.1 ";
+        head += std::to_string(response.status);
+        head += ' ';
+        head += reason(response.status);
+        head += "\r\nContent-Type: application/json\r\nContent-Length: ";
+        head += std::to_string(response.body.size());
+        head += "\r\n";
+        if (!keep_alive) head += "Connection: close\r\n";
+        if (response.retry_after_ms > 0) {
+            head += "Retry-After: ";
+            head += std::to_string((response.retry_after_ms + 999) / 1000);
+            head += "\r\n";
+            head += RETRY_AFTER_MS_KEY;
+            head += ": ";
+            head += std::to_string(response.retry_after_ms);
+            head += "\r\n";
+        }
+        head += "\r\n";
+        iovec iov[2] = {{head.data(), head.size()}, {const_cast<char*>(response.body.data()), response.body.size()}};
+        return writeAll(connection.fd, iov, response.body.empty() ? 1 : 2, options.timeout_ms);
+    }
+
+    Response route(const Request& request) {
+        Response response;
+        HandlerStatus status;
+        try {
+            if (request.path == "/health") {
+                if (request.method != "GET") return methodNotAllowed();
+                response.body = "{\"status\":\"ok\"}";
+                return response;
+            }
+            if (request.path == "/admin/config/reload") {
+                if (request.method != "POST") return methodNotAllowed();
+                return configReload();
+            }
+            if (request.path == "/v1/vectors") {
+                if (request.method != "POST") return methodNotAllowed();
+                auto format = body_format(request.content_type);
+                if (!format) return unsupported(request.content_type);
+                status = upsert(request, *format, response.body);
+            } else if (request.path.starts_with("/v1/vectors/")) {
+                const std::string id = decodePath(request.path.substr(std::string_view("/v1/vectors/").size()));
+                if (request.method == "GET") {
+                    status = get(request, id, response);
+                } else if (request.method == "DELETE") {
+                    status = remove(id, response.body);
+                } else {
+                    return methodNotAllowed();
+                }
+            } else if (request.path == "/v1/search" || request.path == "/v1/search/batch") {
+                if (request.method != "POST") return methodNotAllowed();
+                auto format = body_format(request.content_type);
+                if (!format) return unsupported(request.content_type);
+                status = request.path == "/v1/search" ? search(request, *format, response.body)
+                                                      : searchBatch(request, *format, response.body);
+            } else {
+                return errorResponse(404, ErrorCode::NOT_FOUND, "no route for " + std::string(request.path));
+            }
+        } catch (const util::InvalidArgumentException& e) {
+            status = HandlerStatus::error(ErrorCode::INVALID_ARGUMENT, e.what());
+        } catch (const std::exception& e) {
+            LOG_ERROR("HTTP handler failed: {}", e.what());
+            status = HandlerStatus::error(ErrorCode::INTERNAL, e.what());
+        }
+        if (status.ok()) return response;
+        response = errorResponse(httpStatus(status.code), status.code, status.message);
+        if (status.code == ErrorCode::OVERLOADED) response.retry_after_ms = status.retry_after.count();
+        return response;
+    }
+
+    // Field and section names need no JSON escaping
+    static Response configReload() {
+        const ConfigReload result = reloadConfig();
+        if (!result.ok) return errorResponse(400, ErrorCode::INVALID_ARGUMENT, result.error);
+        auto list = [](const std::vector<std::string>& names) {
+            std::string out = "[";
+            for (const auto& name : names) {
+                if (out.size() > 1) out += ',';
+                out += '"';
+                out += name;
+                out += '"';
+            }
+            return out + "]";
+        };
+        Response response;
+        response.body = "{\"generation\":" + std::to_string(result.generation) + ",\"changed\":" +
+                        list(result.changed) + ",\"restart\":" + list(result.restart) + "}";
+        return response;
+    }
+
+    static Response methodNotAllowed() {
+        return errorResponse(405, ErrorCode::INVALID_ARGUMENT, "method not allowed");
+    }
+
+    static Response unsupported(std::string_view content_type) {
+        return errorResponse(415, ErrorCode::INVALID_ARGUMENT,
+                             "unsupported Content-Type '" + std::string(content_type) +
+                                 "'; send application/json or application/octet-stream");
+    }
+
+    HandlerStatus upsert(const Request& request, BodyFormat format, std::string& out) {
+        const QueryParams params(request.query);
+        UpsertBody body;
+        const uint32_t dim = handler.options().dim;
+        auto status = format == BodyFormat::kJson ? decode_upsert_json(request.body, dim, body)
+                                                  : decode_upsert_binary(request.body, dim, params, body);
+        if (!status.ok()) return status;
+        v1::UpsertResponse response;
+        status = handler.upsertDecoded(body.ids, body.entries, response);
+        if (status.ok()) encode_json(response, out);
+        return status;
+    }
+
+    HandlerStatus get(const Request& request, const std::string& id, Response& out) {
+        const QueryParams params(request.query);
+        v1::GetRequest get;
+        get.set_id(id);
+        const auto include = params.get("include_vector");
+        get.set_include_vector(include && (*include == "true" || *include == "1"));
+        v1::GetResponse response;
+        auto status = handler.get(get, response);
+        if (!status.ok()) return status;
+        if (!response.found()) out.status = 404;
+        encode_json(response, out.body);
+        return status;
+    }
+
+    HandlerStatus remove(const std::string& id, std::string& out) {
+        v1::DeleteRequest request;
+        request.add_ids(id);
+        v1::DeleteResponse response;
+        auto status = handler.remove(request, response);
+        if (status.ok()) encode_json(response, out);
+        return status;
+    }
+
+    HandlerStatus search(const Request& request, BodyFormat format, std::string& out) {
+        v1::SearchRequest search;
+        auto status = format == BodyFormat::kJson
+                          ? decode_search_json(request.body, search)
+                          : decode_search_binary(request.body, handler.options().dim, QueryParams(request.query),
+                                                 search);
+        if (!status.ok()) return status;
+        util::CancellationToken cancel(Clock::now() + std::chrono::milliseconds(options.timeout_ms));
+        v1::SearchResponse response;
+        status = handler.search(search, response, cancel);
+        if (status.ok()) encode_json(response, out);
+        return status;
+    }
+
+    HandlerStatus searchBatch(const Request& request, BodyFormat format, std::string& out) {
+        v1::SearchBatchRequest batch;
+        auto status = format == BodyFormat::kJson
+                          ? decode_search_batch_json(request.body, batch)
+                          : decode_search_batch_binary(request.body, handler.options().dim,
+                                                       QueryParams(request.query), batch);
+        if (!status.ok()) return status;
+        util::CancellationToken cancel(Clock::now() + std::chrono::milliseconds(options.timeout_ms));
+        v1::SearchBatchResponse response;
+        status = handler.searchBatch(batch, response, cancel);
+        if (status.ok()) encode_json(response, out);
+        return status;
+    }
+
+    // Back to its loop; the connection's thread gives it up here
+    void rearm(Connection& connection) {
+        Loop& loop = connection.loop;
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        connection.busy = false;
+        connection.active = Clock::now();
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = &connection;
+        ::epoll_ctl(loop.epoll, EPOLL_CTL_MOD, connection.fd, &event);
+    }
+
+    void close(Connection& connection) {
+        Loop& loop = connection.loop;
+        const int fd = connection.fd;
+        std::unique_ptr<Connection> owned;
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            auto it = loop.connections.find(&connection);
+            if (it == loop.connections.end()) return;
+            owned = std::move(it->second);
+            loop.connections.erase(it);
+        }
+        ::close(fd);
+        open.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Close the loop's connections idle past idle_timeout_ms; runs on the
+    // loop, so only connections with the pool can be in use
+    void sweep(Loop& loop) {
+        const auto cutoff = Clock::now() - std::chrono::milliseconds(options.idle_timeout_ms);
+        std::vector<Connection*> idle;
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            for (const auto& [ptr, connection] : loop.connections) {
+                if (!connection->busy && connection->active < cutoff) idle.push_back(ptr);
+            }
+        }
+        for (Connection* connection : idle) close(*connection);
+    }
+
+    void closeLoops() {
+        for (auto& loop : loops) {
+            for (auto& [ptr, connection] : loop->connections) ::close(connection->fd);
+            open.fetch_sub(loop->connections.size(), std::memory_order_relaxed);
+            loop->connections.clear();
+            for (int fd : {loop->listener, loop->epoll, loop->wake}) {
+                if (fd >= 0) ::close(fd);
+            }
+        }
+        loops.clear();
+    }
+};
+
+HttpServer::Options HttpServer::Options::fromConfig(const Config& config) {
+    Options options;
+    options.address = config.server.bind_address;
+    options.port = config.server.http_port;
+    options.threads = config.server.http_threads;
+    options.max_connections = config.server.max_connections;
+    options.max_body_bytes = config.limits.max_request_size_bytes;
+    options.timeout_ms = config.query.timeout_ms;
+    return options;
+}
+
+HttpServer::HttpServer(const Options& options, const VecHandler& handler, util::ThreadPool& pool)
+    : options_(options), impl_(std::make_unique<Impl>(options_, handler, pool)) {
+    if (options_.threads == 0) options_.threads = std::max<size_t>(1, util::cpu_count());
+    options_.max_connections = std::max(options_.max_connections, 1u);
+    options_.max_header_bytes = std::max<size_t>(options_.max_header_bytes, 1024);
+}
+
+HttpServer::~HttpServer() {
+    shutdown();
+}
+
+void HttpServer::start() {
+    if (running()) return;
+    Impl& impl = *impl_;
+    impl.stopping.store(false, std::memory_order_relaxed);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* resolved = nullptr;
+    const std::string where = options_.address + ":" + std::to_string(options_.port);
+    if (::getaddrinfo(options_.address.c_str(), std::to_string(options_.port).c_str(), &hints, &resolved) != 0 ||
+        !resolved) {
+        throw util::IOException("cannot resolve HTTP address " + where);
+    }
+    std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> address(resolved, &::freeaddrinfo);
+
+    // Every loop listens on the same port; the kernel spreads connections over them
+    auto fail = [&](const char* what) {
+        const std::string reason = std::strerror(errno);
+        impl.closeLoops();
+        throw util::IOException("cannot serve HTTP on " + where + ": " + what + ": " + reason);
+    };
+    port_ = options_.port;
+    for (size_t i = 0; i < options_.threads; ++i) {
+        auto& loop = *impl.loops.emplace_back(std::make_unique<Impl::Loop>());
+        loop.listener = ::socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (loop.listener < 0) fail("socket");
+        int one = 1;
+        ::setsockopt(loop.listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        ::setsockopt(loop.listener, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        sockaddr_storage bind_address{};
+        std::memcpy(&bind_address, address->ai_addr, address->ai_addrlen);
+        const auto port = htons(static_cast<uint16_t>(port_));
+        if (address->ai_family == AF_INET6) {
+            reinterpret_cast<sockaddr_in6*>(&bind_address)->sin6_port = port;
+        } else {
+            reinterpret_cast<sockaddr_in*>(&bind_address)->sin_port = port;
+        }
+        if (::bind(loop.listener, reinterpret_cast<sockaddr*>(&bind_address), address->ai_addrlen) != 0) fail("bind");
+        if (::listen(loop.listener, SOMAXCONN) != 0) fail("listen");
+        if (port_ == 0) {
+            socklen_t length = sizeof(bind_address);
+            ::getsockname(loop.listener, reinterpret_cast<sockaddr*>(&bind_address), &length);
+            port_ = ntohs(bind_address.ss_family == AF_INET6
+                              ? reinterpret_cast<sockaddr_in6*>(&bind_address)->sin6_port
+                              : reinterpret_cast<sockaddr_in*>(&bind_address)->sin_port);
+        }
+
+        loop.epoll = ::epoll_create1(EPOLL_CLOEXEC);
+        loop.wake = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop.epoll < 0 || loop.wake < 0) fail("epoll");
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = &loop.listener;
+        ::epoll_ctl(loop.epoll, EPOLL_CTL_ADD, loop.listener, &event);
+        event.data.ptr = &loop.wake;
+        ::epoll_ctl(loop.epoll, EPOLL_CTL_ADD, loop.wake, &event);
+    }
+    for (auto& loop : impl.loops) {
+        loop->thread = std::thread([&impl, &loop = *loop] { impl.run(loop); });
+    }
+    running_.store(true, std::memory_order_release);
+    LOG_INFO("HTTP server listening on {}:{}: {} event loops", options_.address, port_, impl.loops.size());
+}
+
+void HttpServer::shutdown() {
+    Impl& impl = *impl_;
+    if (impl.loops.empty()) return;
+    impl.stopping.store(true, std::memory_order_release);
+    for (auto& loop : impl.loops) {
+        const uint64_t one = 1;
+        [[maybe_unused]] auto ignored = ::write(loop->wake, &one, sizeof(one));
+    }
+    for (auto& loop : impl.loops) {
+        if (loop->thread.joinable()) loop->thread.join();
+    }
+    {
+        std::unique_lock<std::mutex> lock(impl.handling_mutex);
+        impl.handling_cv.wait(lock, [&] { return impl.handling.load(std::memory_order_acquire) == 0; });
+    }
+    impl.closeLoops();
+    running_.store(false, std::memory_order_release);
+    LOG_INFO("HTTP server on {}:{} stopped", options_.address, port_);
+}
+
+size_t HttpServer::threads() const {
+    return impl_->loops.size();
+}
+
+std::vector<std::pair<std::string_view, double>> HttpServer::metrics() const {
+    const Impl::Stats& stats = impl_->stats;
+    return {
+        {"woved_http_requests_total", static_cast<double>(stats.requests.load(std::memory_order_relaxed))},
+        {"woved_http_errors_total", static_cast<double>(stats.errors.load(std::memory_order_relaxed))},
+        {"woved_http_body_bytes_total", static_cast<double>(stats.body_bytes.load(std::memory_order_relaxed))},
+        {"woved_http_connections_accepted_total", static_cast<double>(stats.accepted.load(std::memory_order_relaxed))},
+        {"woved_http_connections_rejected_total", static_cast<double>(stats.rejected.load(std::memory_order_relaxed))},
+        {"woved_http_connections_open", static_cast<double>(impl_->open.load(std::memory_order_relaxed))},
+        {"woved_http_handlers_running", static_cast<double>(impl_->handling.load(std::memory_order_relaxed))},
+    };
+}
+
+} // namespace woved::api
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::util {
+class ThreadPool;
+}
+
+namespace woved::api {
+
+class VecHandler;
+
+// The HTTP/1.1 API:
+//
+//   POST   /v1/vectors          upsert
+//   GET    /v1/vectors/{id}     get; ?include_vector=true for the vector
+//   DELETE /v1/vectors/{id}     delete
+//   POST   /v1/search           search
+//   POST   /v1/search/batch     batch search
+//   GET    /health
+//   POST   /admin/config/reload reload the config file (reloadConfig());
+//                               400 if it is rejected
+//
+// Upsert and search bodies are JSON or application/octet-stream, packed
+// little-endian float32 with the other fields as query parameters (see
+// handlers/http-body.h); responses are JSON. A request is received into
+// one buffer sized from its Content-Length and its body is decoded in
+// place, straight into the entries handed to the engine.
+//
+// Connections are spread over event loops, each with its own
+// SO_REUSEPORT listener and epoll set. Connections are armed one-shot, so
+// each belongs to one thread at a time: its loop while it reads, or a
+// pool thread. Gets run inline on the loop; writes and searches go to the
+// worker pool's foreground lane, which answers them, serves any
+// pipelined requests and re-arms the connection. Keep-alive, pipelining
+// and Expect: 100-continue are supported; chunked request bodies are not.
+//
+// Status mapping: INVALID_ARGUMENT 400, NOT_FOUND 404, OVERLOADED 429 with
+// Retry-After and the woved-retry-after-ms header, DEADLINE_EXCEEDED 504,
+// INTERNAL 500.
+class HttpServer {
+public:
+    struct Options {
+        std::string address = "0.0.0.0";      // server.bind_address
+        uint16_t port = 8080;                  // server.http_port; 0: any free port
+        size_t threads = 0;                    // server.http_threads; 0: one per core
+        uint32_t max_connections = 1000;       // server.max_connections
+        uint64_t max_body_bytes = 104857600;   // limits.max_request_size_bytes
+        size_t max_header_bytes = 16384;
+        uint32_t timeout_ms = 5000;            // query.timeout_ms; also bounds a blocked response write
+        uint32_t idle_timeout_ms = 60000;      // Connections idle (or stalled mid-request) longer are closed
+
+        static Options fromConfig(const Config& config);
+    };
+
+    // `handler` and `pool` must outlive the server
+    HttpServer(const Options& options, const VecHandler& handler, util::ThreadPool& pool);
+    ~HttpServer();
+
+    HttpServer(const HttpServer&) = delete;
+    HttpServer& operator=(const HttpServer&) = delete;
+
+    // Bind and start the loops; throws util::IOException if the address
+    // cannot be bound
+    void start();
+    // Stop accepting, let running handlers answer, then close every
+    // connection. Idempotent.
+    void shutdown();
+
+    bool running() const { return running_.load(std::memory_order_acquire); }
+    int port() const { return port_; }
+    size_t threads() const;
+
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct Impl;
+
+    Options options_;
+    std::unique_ptr<Impl> impl_;
+    std::atomic<bool> running_{false};
+    int port_ = 0;
+};
+
+} // namespace woved::api
@@ -0,0 +1,474 @@
+#include "replica-follower.h"
+#include "core/config.h"
+#include "proto/woved.grpc.pb.h"
+#include "storage/buffer/msg-buf.h"
+#include "storage/latest-by-id.h"
+#include "storage/manifest/manifest.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-stable.h"
+#include "storage/wal/wal-record.h"
+#include "util/exceptions.h"
+#include "util/file-io.h"
+#include "util/logging.h"
+#include <grpcpp/grpcpp.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <unordered_set>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace woved::api {
+
+namespace {
+
+// Rows indexed per LatestByIdMap::upsertBatch, as BulkLoader does
+constexpr size_t kIndexChunk = 65536;
+
+int64_t steadyMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+std::string localPath(const std::string& dir, const std::string& remote) {
+    return (std::filesystem::path(dir) / std::filesystem::path(remote).filename()).string();
+}
+
+} // namespace
+
+struct ReplicaFollower::Channel {
+    std::unique_ptr<v1::ReplicationService::Stub> stub;
+};
+
+ReplicaFollower::Options ReplicaFollower::Options::fromConfig(const Config& config) {
+    const auto& replication = config.cluster.replication;
+    Options options;
+    options.leader = replication.leader;
+    options.name = config.server.bind_address;
+    options.segment_dir =
+        config.storage.segment_dirs.empty() ? config.storage.segment_dir : config.storage.segment_dirs.front();
+    options.data_dir = config.storage.data_dir;
+    options.uuid_ids = config.collection.id_type == "uuidv7";
+    options.manifest_poll = std::chrono::milliseconds(std::max<uint32_t>(replication.manifest_poll_ms, 10));
+    options.max_staleness = std::chrono::milliseconds(replication.max_staleness_ms);
+    options.max_message_bytes = config.limits.max_request_size_bytes;
+    options.delta_read = storage::SegmentReader::Options::fromConfig(config.io, false);
+    options.stable_read = storage::SegmentReader::Options::fromConfig(config.io, true);
+    options.delta_read.verify_checksums = config.recovery.verify_checksums;
+    options.stable_read.verify_checksums = config.recovery.verify_checksums;
+    return options;
+}
+
+ReplicaFollower::ReplicaFollower(const Options& options, storage::Manifest& manifest, storage::MessageBuffer& buffer,
+                                 std::shared_ptr<storage::LatestByIdMap> latest_by_id)
+    : options_(options),
+      manifest_(manifest),
+      buffer_(buffer),
+      latest_by_id_(std::move(latest_by_id)),
+      channel_(std::make_unique<Channel>()) {
+    if (options_.leader.empty()) throw util::ConfigException("replica follower without a leader");
+    grpc::ChannelArguments args;
+    const int max_message = static_cast<int>(std::min<uint64_t>(options_.max_message_bytes, INT32_MAX));
+    args.SetMaxSendMessageSize(max_message);
+    args.SetMaxReceiveMessageSize(max_message);
+    channel_->stub = v1::ReplicationService::NewStub(
+        grpc::CreateCustomChannel(options_.leader, grpc::InsecureChannelCredentials(), args));
+
+    // Resume after what the segments already hold
+    const auto version = manifest_.current();
+    applied_epoch_.store(version->flushed_epoch, std::memory_order_release);
+    stats_.flushed_epoch = version->flushed_epoch;
+}
+
+ReplicaFollower::~ReplicaFollower() {
+    stop();
+}
+
+void ReplicaFollower::start() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_) return;
+        running_ = true;
+    }
+    try {
+        syncManifest();
+    } catch (const std::exception& e) {
+        LOG_WARN("replica: initial manifest sync from {} failed: {}", options_.leader, e.what());
+    }
+    tail_thread_ = std::thread([this] { tailLoop(); });
+    manifest_thread_ = std::thread([this] { manifestLoop(); });
+    LOG_INFO("replica: following {} from epoch {}", options_.leader, appliedEpoch());
+}
+
+void ReplicaFollower::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+        if (tail_context_) tail_context_->TryCancel();
+    }
+    cv_.notify_all();
+    if (tail_thread_.joinable()) tail_thread_.join();
+    if (manifest_thread_.joinable()) manifest_thread_.join();
+}
+
+bool ReplicaFollower::waitFor(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return !cv_.wait_for(lock, timeout, [this] { return !running_; });
+}
+
+void ReplicaFollower::tailLoop() {
+    v1::WalShipment shipment;
+    bool connected_before = false;
+    while (true) {
+        grpc::ClientContext context;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_) return;
+            tail_context_ = &context;
+        }
+        v1::TailWalRequest request;
+        request.set_after_epoch(appliedEpoch());
+        request.set_follower(options_.name);
+        if (connected_before) {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.reconnects++;
+        }
+        connected_before = true;
+
+        auto reader = channel_->stub->TailWal(&context, request);
+        bool malformed = false;
+        while (reader->Read(&shipment)) {
+            const std::string& bytes = shipment.batch();
+            storage::WalBatchReader batch;
+            if (!batch.parse(std::as_bytes(std::span(bytes.data(), bytes.size()))) || !applyBatch(batch)) {
+                // Resume from the last whole batch
+                malformed = true;
+                context.TryCancel();
+                break;
+            }
+            if (shipment.caught_up()) caught_up_us_.store(steadyMicros(), std::memory_order_release);
+        }
+        const grpc::Status status = reader->Finish();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tail_context_ = nullptr;
+            if (!running_) return;
+        }
+        if (malformed) {
+            LOG_WARN("replica: malformed WAL shipment from {}, reconnecting", options_.leader);
+        } else {
+            LOG_WARN("replica: WAL tail from {} ended: {}", options_.leader,
+                     status.ok() ? "closed by the leader" : status.error_message());
+        }
+        if (!waitFor(options_.retry)) return;
+    }
+}
+
+bool ReplicaFollower::applyBatch(const storage::WalBatchReader& batch) {
+    storage::WalRecordReader rec;
+    BTreeMessage msg;
+    uint64_t applied = 0;
+    uint64_t stale = 0;
+    uint64_t malformed = 0;
+    {
+        std::lock_guard<std::mutex> lock(apply_mutex_);
+        const Epoch flushed = manifest_.current()->flushed_epoch;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (!batch.record(i, rec)) {
+                malformed++;
+                continue;
+            }
+            const Epoch epoch = rec.epoch();
+            if (rec.op() == storage::WalOp::FENCE) continue;
+            if (epoch <= flushed) {
+                stale++;
+                continue;
+            }
+            if (latest_by_id_) {
+                auto current = latest_by_id_->getPackedByHash(rec.idHash());
+                if (current && current->epoch() >= epoch) {
+                    stale++;
+                    continue;
+                }
+            }
+            if (!rec.decodeMessage(msg)) {
+                malformed++;
+                continue;
+            }
+            // Wait out a full buffer: a dropped record would never come again
+            bool warned = false;
+            while (!buffer_.append(rec.idHash(), msg).accepted()) {
+                if (!warned) {
+                    LOG_WARN("replica: buffer full at epoch {}, waiting for shipped segments", epoch);
+                    warned = true;
+                }
+                buffer_.waitForSpace(std::chrono::milliseconds(100));
+            }
+            applied++;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.shipments++;
+    stats_.applied += applied;
+    stats_.stale += stale;
+    stats_.malformed += malformed;
+    if (malformed > 0) return false;
+    Epoch current = applied_epoch_.load(std::memory_order_relaxed);
+    if (batch.fenceEpoch() > current) applied_epoch_.store(batch.fenceEpoch(), std::memory_order_release);
+    stats_.applied_epoch = std::max(current, batch.fenceEpoch());
+    return true;
+}
+
+void ReplicaFollower::manifestLoop() {
+    while (waitFor(options_.manifest_poll)) {
+        try {
+            syncManifest();
+        } catch (const std::exception& e) {
+            LOG_WARN("replica: manifest sync from {} failed: {}", options_.leader, e.what());
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.sync_failures++;
+        }
+    }
+}
+
+void ReplicaFollower::syncManifest() {
+    std::lock_guard<std::mutex> lock(sync_mutex_);
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(30));
+    v1::ManifestRequest request;
+    request.set_after_sequence(leader_sequence_);
+    v1::ManifestState state;
+    const grpc::Status status = channel_->stub->GetManifest(&context, request, &state);
+    if (!status.ok()) throw util::IOException("GetManifest from " + options_.leader + ": " + status.error_message());
+    if (!state.changed()) return;
+    install(state);
+    leader_sequence_ = state.sequence();
+}
+
+void ReplicaFollower::install(const v1::ManifestState& state) {
+    const auto version = manifest_.current();
+    std::unordered_set<std::string> live;
+    for (const auto& segment : version->segments) live.insert(segment->descriptor.segment_id);
+
+    storage::ManifestEdit edit;
+    uint64_t copied = 0;
+    uint64_t bytes = 0;
+    std::unordered_set<std::string> leader;
+    for (const auto& shipped : state.segments()) {
+        leader.insert(shipped.segment_id());
+        if (live.count(shipped.segment_id())) continue;
+        SegmentDescriptor d;
+        d.segment_id = shipped.segment_id();
+        d.file_path = localPath(options_.segment_dir, shipped.path());
+        d.num_vectors = shipped.num_vectors();
+        d.min_id_hash = shipped.min_id_hash();
+        d.max_id_hash = shipped.max_id_hash();
+        d.min_epoch = shipped.min_epoch();
+        d.max_epoch = shipped.max_epoch();
+        d.tombstone_ratio = shipped.tombstone_ratio();
+        d.created_at = std::chrono::duration_cast<Timestamp>(std::chrono::nanoseconds(shipped.created_at_ns()));
+        d.is_stable = shipped.stable();
+        fetch(shipped.path(), d.file_path, shipped.file_size());
+        copied++;
+        bytes += shipped.file_size();
+        edit.added.emplace_back(shipped.leaf(), std::move(d));
+    }
+
+    std::vector<std::string> retired_ids;
+    std::vector<std::string> retired_files;
+    for (const auto& segment : version->segments) {
+        if (leader.count(segment->descriptor.segment_id)) continue;
+        edit.retired.push_back(segment->ordinal);
+        retired_ids.push_back(segment->descriptor.segment_id);
+        retired_files.push_back(segment->descriptor.file_path);
+    }
+
+    if (!state.centroid_path().empty() && state.centroid_epoch() != version->centroid_epoch) {
+        const std::string path = localPath(options_.data_dir, state.centroid_path());
+        fetch(state.centroid_path(), path, state.centroid_size());
+        bytes += state.centroid_size();
+        edit.centroid_epoch = state.centroid_epoch();
+        edit.centroid_path = path;
+    }
+    if (state.flushed_epoch() > version->flushed_epoch) edit.flushed_epoch = state.flushed_epoch();
+
+    // Queries that took the version before the last edit have ended by now
+    for (const auto& path : retired_files_) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+    retired_files_.clear();
+    if (edit.added.empty() && edit.retired.empty() && !edit.centroid_epoch && !edit.flushed_epoch) return;
+
+    std::shared_ptr<const storage::ManifestVersion> installed;
+    {
+        std::lock_guard<std::mutex> lock(apply_mutex_);
+        const uint32_t first = manifest_.current()->next_ordinal;
+        installed = manifest_.apply(edit);
+        if (latest_by_id_) {
+            for (size_t i = 0; i < edit.added.size(); ++i) {
+                const auto ordinal = static_cast<uint32_t>(first + i);
+                latest_by_id_->registerSegment(ordinal, edit.added[i].second.segment_id);
+                indexSegment(ordinal, edit.added[i].second);
+            }
+            // After indexing, so rows a merge carried over move first
+            for (const auto& id : retired_ids) latest_by_id_->removeSegmentEntries(id);
+        }
+        evictThrough(installed->flushed_epoch);
+    }
+    retired_files_ = std::move(retired_files);
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.syncs++;
+        stats_.segments += copied;
+        stats_.bytes += bytes;
+        stats_.flushed_epoch = installed->flushed_epoch;
+    }
+    LOG_INFO("replica: manifest {} from {}: {} segments added, {} retired, flushed through epoch {}",
+             state.sequence(), options_.leader, edit.added.size(), edit.retired.size(), installed->flushed_epoch);
+    if (install_) install_(installed);
+}
+
+void ReplicaFollower::fetch(const std::string& remote, const std::string& local, uint64_t size) {
+    std::error_code ec;
+    if (std::filesystem::file_size(local, ec) == size && !ec) return;
+
+    const std::string part = local + ".part";
+    int fd = ::open(part.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) throw util::IOException("open " + part + ": " + std::strerror(errno));
+    uint64_t offset = std::filesystem::file_size(part, ec);
+    if (ec || offset > size) {
+        offset = 0;
+        if (::ftruncate(fd, 0) != 0) {
+            ::close(fd);
+            throw util::IOException("truncate " + part + ": " + std::strerror(errno));
+        }
+    }
+
+    grpc::ClientContext context;
+    v1::FetchFileRequest request;
+    request.set_path(remote);
+    request.set_offset(offset);
+    auto reader = channel_->stub->FetchFile(&context, request);
+    v1::FileChunk chunk;
+    std::string error;
+    while (error.empty() && reader->Read(&chunk)) {
+        const std::string& data = chunk.data();
+        try {
+            util::pwrite_all(fd, data.data(), data.size(), offset, part);
+        } catch (const util::IOException& e) {
+            error = e.what();
+            context.TryCancel();
+            break;
+        }
+        offset += data.size();
+    }
+    const grpc::Status status = reader->Finish();
+    if (error.empty() && !status.ok()) error = "FetchFile " + remote + ": " + status.error_message();
+    if (error.empty() && offset != size) {
+        error = "FetchFile " + remote + ": " + std::to_string(offset) + " bytes, expected " + std::to_string(size);
+    }
+    if (error.empty() && ::fsync(fd) != 0) error = "fsync " + part + ": " + std::strerror(errno);
+    ::close(fd);
+    if (!error.empty()) throw util::IOException(error);
+
+    std::filesystem::rename(part, local, ec);
+    if (ec) throw util::IOException("rename " + part + ": " + ec.message());
+    util::sync_parent_directory(local);
+}
+
+void ReplicaFollower::indexSegment(uint32_t ordinal, const SegmentDescriptor& descriptor) {
+    const bool string_ids = !options_.uuid_ids;
+    auto index = [&](const auto& segment) {
+        std::span<const VectorIdHash> hashes = segment.idHashes();
+        std::span<const Epoch> epochs = segment.epochs();
+        storage::RowColumns columns;
+        if (string_ids) columns = segment.readRows();
+        std::vector<storage::LatestByIdMap::HashedLocation> updates;
+        std::vector<VectorId> ids;
+        for (size_t first = 0; first < hashes.size(); first += kIndexChunk) {
+            const size_t n = std::min(kIndexChunk, hashes.size() - first);
+            updates.clear();
+            ids.clear();
+            ids.reserve(n);
+            for (size_t row = first; row < first + n; ++row) {
+                // A version the buffer or another segment holds may be newer
+                auto current = latest_by_id_->getPackedByHash(hashes[row]);
+                if (current && current->epoch() > epochs[row]) continue;
+                storage::VectorLocation location;
+                location.type = storage::VectorLocation::SEGMENT;
+                location.segment_ordinal = ordinal;
+                location.local_id = static_cast<uint32_t>(row);
+                location.timestamp = Timestamp{0};
+                location.epoch = epochs[row];
+                location.tombstone = segment.tombstone(row);
+                const VectorId* id = nullptr;
+                if (string_ids) id = &ids.emplace_back(columns.id(row));
+                updates.push_back({hashes[row], std::move(location), id});
+            }
+            latest_by_id_->upsertBatch(updates);
+        }
+    };
+    if (descriptor.is_stable) {
+        index(storage::StableSegment(descriptor.file_path, options_.stable_read));
+    } else {
+        index(storage::DeltaSegment(descriptor.file_path, options_.delta_read));
+    }
+}
+
+void ReplicaFollower::evictThrough(Epoch flushed) {
+    while (true) {
+        storage::LeafSlice slice = buffer_.sliceOldest(4096, flushed);
+        if (slice.empty()) return;
+        buffer_.evict(std::move(slice));
+    }
+}
+
+std::chrono::milliseconds ReplicaFollower::staleness() const {
+    const int64_t caught_up = caught_up_us_.load(std::memory_order_acquire);
+    if (caught_up == 0) return std::chrono::milliseconds::max();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::microseconds(steadyMicros() - caught_up));
+}
+
+void ReplicaFollower::checkFresh() const {
+    const auto behind = staleness();
+    if (behind <= options_.max_staleness) return;
+    if (behind == std::chrono::milliseconds::max()) {
+        throw util::IOException("replica has not caught up with " + options_.leader + " yet");
+    }
+    throw util::IOException("replica is " + std::to_string(behind.count()) + " ms behind " + options_.leader);
+}
+
+ReplicaFollower::Stats ReplicaFollower::getStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+std::vector<std::pair<std::string_view, double>> ReplicaFollower::metrics() const {
+    const Stats stats = getStats();
+    const auto behind = staleness();
+    return {
+        {"woved_replica_shipments", static_cast<double>(stats.shipments)},
+        {"woved_replica_records_applied", static_cast<double>(stats.applied)},
+        {"woved_replica_records_stale", static_cast<double>(stats.stale)},
+        {"woved_replica_records_malformed", static_cast<double>(stats.malformed)},
+        {"woved_replica_reconnects", static_cast<double>(stats.reconnects)},
+        {"woved_replica_manifest_syncs", static_cast<double>(stats.syncs)},
+        {"woved_replica_manifest_sync_failures", static_cast<double>(stats.sync_failures)},
+        {"woved_replica_segments_copied", static_cast<double>(stats.segments)},
+        {"woved_replica_bytes_copied", static_cast<double>(stats.bytes)},
+        {"woved_replica_applied_epoch", static_cast<double>(stats.applied_epoch)},
+        {"woved_replica_flushed_epoch", static_cast<double>(stats.flushed_epoch)},
+        {"woved_replica_staleness_seconds",
+         behind == std::chrono::milliseconds::max() ? -1.0 : std::chrono::duration<double>(behind).count()},
+    };
+}
+
+} // namespace woved::api
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "storage/segment/seg-r.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace grpc {
+class ClientContext;
+}
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::storage {
+class LatestByIdMap;
+class Manifest;
+class MessageBuffer;
+class WalBatchReader;
+struct ManifestVersion;
+}
+
+namespace woved::v1 {
+class ManifestState;
+}
+
+namespace woved::api {
+
+// Follower side of WAL-shipping read replicas (cluster.replication.role
+// follower): keeps a read-only node current from a ReplicationServer.
+//
+// The tail thread holds one TailWal call open from the epoch applied so
+// far and applies each WALBatch as WAL replay does: fences and records at
+// or below the manifest's flushed_epoch are skipped, a record loses to a
+// newer version of its id, and the rest go into the message buffer,
+// waiting for space rather than dropping writes. A batch's fence epoch
+// becomes the applied epoch; a lost call is opened again after `retry`
+// from there.
+//
+// The manifest thread polls GetManifest every manifest_poll. Segments the
+// leader added are copied into segment_dir (FetchFile to a .part file,
+// size checked, fsync'ed and renamed, resuming a cut-short copy), then one
+// edit adds them, retires what the leader retired and moves the centroid
+// file and flushed_epoch along. The new segments are indexed in
+// LatestByIdMap where their rows are not older than what it holds, and
+// buffered messages at or below the new flushed_epoch are dropped: the
+// segments hold them now. Files of retired segments are removed one sync
+// later, once queries that took the version before have ended. The
+// install callback (the node's index swap) runs after each applied edit.
+//
+// A follower builds no trees and never flushes or merges: leave the flush
+// scheduler and segment manager off. staleness() is the time since the
+// leader last reported the follower caught up (it does so at least every
+// heartbeat); reads should go through checkFresh().
+class ReplicaFollower {
+public:
+    struct Options {
+        std::string leader;                   // cluster.replication.leader
+        std::string name;                     // Reported to the leader (server.bind_address)
+        std::string segment_dir;              // storage.segment_dirs[0] or segment_dir
+        std::string data_dir;                 // Centroid files
+        bool uuid_ids = true;                 // collection.id_type uuidv7
+        std::chrono::milliseconds manifest_poll{1000};
+        std::chrono::milliseconds max_staleness{5000};
+        std::chrono::milliseconds retry{1000};
+        uint64_t max_message_bytes = 104857600;  // limits.max_request_size_bytes
+        storage::SegmentReader::Options delta_read;
+        storage::SegmentReader::Options stable_read;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        uint64_t shipments = 0;
+        uint64_t applied = 0;       // Records put in the buffer
+        uint64_t stale = 0;         // Lost to a newer version or already flushed
+        uint64_t malformed = 0;
+        uint64_t reconnects = 0;
+        uint64_t syncs = 0;         // Manifest edits applied
+        uint64_t segments = 0;      // Copied
+        uint64_t bytes = 0;         // Of segment and centroid files copied
+        uint64_t sync_failures = 0;
+        Epoch applied_epoch = 0;
+        Epoch flushed_epoch = 0;
+    };
+
+    // Called after each manifest edit with the version it made
+    using InstallFn = std::function<void(std::shared_ptr<const storage::ManifestVersion>)>;
+
+    // Everything passed must outlive the follower
+    ReplicaFollower(const Options& options, storage::Manifest& manifest, storage::MessageBuffer& buffer,
+                    std::shared_ptr<storage::LatestByIdMap> latest_by_id);
+    ~ReplicaFollower();
+
+    ReplicaFollower(const ReplicaFollower&) = delete;
+    ReplicaFollower& operator=(const ReplicaFollower&) = delete;
+
+    void setInstallCallback(InstallFn install) { install_ = std::move(install); }
+
+    // Sync the manifest once (logging if the leader cannot be reached),
+    // then start tailing and polling
+    void start();
+    void stop();
+
+    // Copy and install what the leader's manifest changed. Throws
+    // util::IOException if the leader cannot be asked or a file copied.
+    void syncManifest();
+
+    Epoch appliedEpoch() const { return applied_epoch_.load(std::memory_order_acquire); }
+    std::chrono::milliseconds staleness() const;
+    bool fresh() const { return staleness() <= options_.max_staleness; }
+    // Throws util::IOException when further behind than max_staleness
+    void checkFresh() const;
+
+    Stats getStats() const;
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct Channel;
+
+    Options options_;
+    storage::Manifest& manifest_;
+    storage::MessageBuffer& buffer_;
+    std::shared_ptr<storage::LatestByIdMap> latest_by_id_;
+    std::unique_ptr<Channel> channel_;
+    InstallFn install_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool running_ = false;
+    grpc::ClientContext* tail_context_ = nullptr;  // Of the open TailWal, for stop()
+    std::thread tail_thread_;
+    std::thread manifest_thread_;
+
+    // Serializes batches with manifest edits: a record is checked against
+    // flushed_epoch and LatestByIdMap as one step
+    std::mutex apply_mutex_;
+    std::mutex sync_mutex_;
+    uint64_t leader_sequence_ = 0;          // Last manifest sequence synced
+    std::vector<std::string> retired_files_;  // Removed at the next sync
+
+    std::atomic<Epoch> applied_epoch_{0};
+    std::atomic<int64_t> caught_up_us_{0};  // steady_clock, 0 = never
+
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+
+    void tailLoop();
+    void manifestLoop();
+    // Apply one shipment; false if it is malformed
+    bool applyBatch(const storage::WalBatchReader& batch);
+    void install(const v1::ManifestState& state);
+    // Copy `remote` to `local` unless it is there at `size` bytes
+    void fetch(const std::string& remote, const std::string& local, uint64_t size);
+    void indexSegment(uint32_t ordinal, const SegmentDescriptor& descriptor);
+    // Drop buffered messages the shipped segments now hold
+    void evictThrough(Epoch flushed);
+    bool waitFor(std::chrono::milliseconds timeout);
+};
+
+} // namespace woved::api
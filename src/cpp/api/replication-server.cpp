@@ -0,0 +1,243 @@
+#include "replication-server.h"
+#include "core/config.h"
+#include "proto/woved.grpc.pb.h"
+#include "storage/manifest/manifest.h"
+#include "storage/wal/wal-streams.h"
+#include "storage/wal/wal-tailer.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <grpcpp/grpcpp.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace woved::api {
+
+class ReplicationServer::Service final : public v1::ReplicationService::Service {
+public:
+    explicit Service(ReplicationServer& owner) : owner_(owner) {}
+
+    std::unique_ptr<grpc::Server> server;
+
+    grpc::Status TailWal(grpc::ServerContext* context, const v1::TailWalRequest* request,
+                         grpc::ServerWriter<v1::WalShipment>* writer) override {
+        const Options& options = owner_.options_;
+        storage::WalTailer tailer({options.wal_dirs, request->after_epoch(), options.batch_bytes,
+                                   options.verify_checksums});
+        owner_.tails_.fetch_add(1, std::memory_order_relaxed);
+        LOG_INFO("replication: {} tails the WAL after epoch {}", request->follower(), request->after_epoch());
+
+        storage::WalBatchEncoder batch;
+        std::vector<std::byte> bytes;
+        v1::WalShipment shipment;
+        Epoch sent_fence = request->after_epoch();
+        auto sent_at = std::chrono::steady_clock::now() - options.heartbeat;
+        grpc::Status status = grpc::Status::OK;
+        while (!context->IsCancelled()) {
+            batch.clear();
+            storage::WalTailer::Result result;
+            try {
+                result = tailer.read(batch, options.batch_bytes);
+            } catch (const std::exception& e) {
+                status = grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+                break;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            const bool idle = batch.empty() && result.fence_epoch == sent_fence;
+            if (!idle || now - sent_at >= options.heartbeat) {
+                batch.finish(result.fence_epoch, bytes);
+                shipment.set_batch(bytes.data(), bytes.size());
+                shipment.set_caught_up(result.caught_up);
+                if (!writer->Write(shipment)) break;  // The follower went away
+                owner_.shipments_.fetch_add(1, std::memory_order_relaxed);
+                owner_.records_.fetch_add(batch.size(), std::memory_order_relaxed);
+                sent_fence = result.fence_epoch;
+                sent_at = now;
+            }
+            if (!batch.empty()) continue;
+            std::unique_lock<std::mutex> lock(owner_.mutex_);
+            if (owner_.cv_.wait_for(lock, options.poll, [&] { return owner_.stopping_; })) break;
+        }
+
+        const auto& stats = tailer.getStats();
+        owner_.tails_.fetch_sub(1, std::memory_order_relaxed);
+        LOG_INFO("replication: {} stopped tailing: {} records shipped from {} files{}", request->follower(),
+                 stats.records, stats.files, status.ok() ? "" : ", " + status.error_message());
+        return status;
+    }
+
+    grpc::Status GetManifest(grpc::ServerContext*, const v1::ManifestRequest* request,
+                             v1::ManifestState* response) override {
+        const auto version = owner_.manifest_.current();
+        if (request->after_sequence() != 0 && request->after_sequence() == version->sequence) {
+            response->set_changed(false);
+            return grpc::Status::OK;
+        }
+        response->set_changed(true);
+        response->set_sequence(version->sequence);
+        response->set_flushed_epoch(version->flushed_epoch);
+        response->set_centroid_epoch(version->centroid_epoch);
+        std::error_code ec;
+        if (!version->centroid_path.empty()) {
+            response->set_centroid_path(version->centroid_path);
+            response->set_centroid_size(std::filesystem::file_size(version->centroid_path, ec));
+            if (ec) return missing(version->centroid_path, ec);
+        }
+        for (const auto& segment : version->segments) {
+            const SegmentDescriptor& d = segment->descriptor;
+            auto* shipped = response->add_segments();
+            shipped->set_ordinal(segment->ordinal);
+            shipped->set_leaf(segment->leaf);
+            shipped->set_segment_id(d.segment_id);
+            shipped->set_path(d.file_path);
+            shipped->set_file_size(std::filesystem::file_size(d.file_path, ec));
+            if (ec) return missing(d.file_path, ec);
+            shipped->set_num_vectors(d.num_vectors);
+            shipped->set_min_id_hash(d.min_id_hash);
+            shipped->set_max_id_hash(d.max_id_hash);
+            shipped->set_min_epoch(d.min_epoch);
+            shipped->set_max_epoch(d.max_epoch);
+            shipped->set_tombstone_ratio(d.tombstone_ratio);
+            shipped->set_created_at_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(d.created_at).count());
+            shipped->set_stable(d.is_stable);
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status FetchFile(grpc::ServerContext* context, const v1::FetchFileRequest* request,
+                           grpc::ServerWriter<v1::FileChunk>* writer) override {
+        const std::string& path = request->path();
+        if (!named(path)) {
+            return grpc::Status(grpc::StatusCode::NOT_FOUND, path + " is not in the current manifest");
+        }
+        // Once open, the file stays readable if a merge retires it meanwhile
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return grpc::Status(grpc::StatusCode::NOT_FOUND, path + ": " + std::strerror(errno));
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        std::string buffer(owner_.options_.chunk_bytes, '\0');
+        v1::FileChunk chunk;
+        uint64_t offset = request->offset();
+        grpc::Status status = grpc::Status::OK;
+        while (!context->IsCancelled()) {
+            ssize_t n = ::pread(fd, buffer.data(), buffer.size(), static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                status = grpc::Status(grpc::StatusCode::INTERNAL, "read " + path + ": " + std::strerror(errno));
+                break;
+            }
+            if (n == 0) {
+                owner_.files_.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            chunk.set_data(buffer.data(), static_cast<size_t>(n));
+            if (!writer->Write(chunk)) break;
+            offset += static_cast<uint64_t>(n);
+            owner_.file_bytes_.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        }
+        ::close(fd);
+        return status;
+    }
+
+private:
+    ReplicationServer& owner_;
+
+    static grpc::Status missing(const std::string& path, const std::error_code& ec) {
+        return grpc::Status(grpc::StatusCode::INTERNAL, path + ": " + ec.message());
+    }
+
+    // A segment or the centroid file of the current version
+    bool named(const std::string& path) const {
+        const auto version = owner_.manifest_.current();
+        if (!path.empty() && path == version->centroid_path) return true;
+        return std::any_of(version->segments.begin(), version->segments.end(),
+                           [&](const auto& segment) { return segment->descriptor.file_path == path; });
+    }
+};
+
+ReplicationServer::Options ReplicationServer::Options::fromConfig(const Config& config) {
+    const auto& replication = config.cluster.replication;
+    Options options;
+    options.address = config.server.bind_address + ":" + std::to_string(replication.port);
+    options.wal_dirs = storage::WalStreams::directories(config.storage);
+    options.poll = std::chrono::milliseconds(std::max<uint32_t>(replication.poll_ms, 1));
+    // Well inside the followers' staleness bound
+    options.heartbeat = std::clamp(std::chrono::milliseconds(replication.max_staleness_ms / 10),
+                                   options.poll, std::chrono::milliseconds(1000));
+    options.batch_bytes = std::max<uint32_t>(replication.batch_bytes, 65536);
+    options.verify_checksums = config.recovery.verify_checksums;
+    options.max_message_bytes = config.limits.max_request_size_bytes;
+    return options;
+}
+
+ReplicationServer::ReplicationServer(const Options& options, const storage::Manifest& manifest)
+    : options_(options), manifest_(manifest), service_(std::make_unique<Service>(*this)) {
+    // A shipment is a whole batch, plus its largest record
+    options_.max_message_bytes = std::max<uint64_t>(options_.max_message_bytes, 2 * options_.batch_bytes);
+    options_.chunk_bytes = std::min<size_t>(options_.chunk_bytes, options_.max_message_bytes / 2);
+}
+
+ReplicationServer::~ReplicationServer() {
+    shutdown();
+}
+
+void ReplicationServer::start() {
+    if (service_->server) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+    }
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(options_.address, grpc::InsecureServerCredentials(), &port_);
+    builder.RegisterService(service_.get());
+    const int max_message = static_cast<int>(std::min<uint64_t>(options_.max_message_bytes, INT_MAX));
+    builder.SetMaxReceiveMessageSize(max_message);
+    builder.SetMaxSendMessageSize(max_message);
+    service_->server = builder.BuildAndStart();
+    if (!service_->server || port_ == 0) {
+        service_->server.reset();
+        throw util::IOException("cannot serve replication on " + options_.address);
+    }
+    LOG_INFO("replication: leader listening on {} (port {}), {} WAL streams", options_.address, port_,
+             options_.wal_dirs.size());
+}
+
+void ReplicationServer::shutdown() {
+    if (!service_->server) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    // Tails end at their next poll; copies in flight are cancelled
+    service_->server->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(1));
+    service_->server->Wait();
+    service_->server.reset();
+}
+
+ReplicationServer::Stats ReplicationServer::getStats() const {
+    Stats stats;
+    stats.tails = tails_.load(std::memory_order_relaxed);
+    stats.shipments = shipments_.load(std::memory_order_relaxed);
+    stats.records = records_.load(std::memory_order_relaxed);
+    stats.files = files_.load(std::memory_order_relaxed);
+    stats.file_bytes = file_bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<std::pair<std::string_view, double>> ReplicationServer::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_replication_tails", static_cast<double>(stats.tails)},
+        {"woved_replication_shipments", static_cast<double>(stats.shipments)},
+        {"woved_replication_records_shipped", static_cast<double>(stats.records)},
+        {"woved_replication_files_sent", static_cast<double>(stats.files)},
+        {"woved_replication_file_bytes_sent", static_cast<double>(stats.file_bytes)},
+    };
+}
+
+} // namespace woved::api
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::storage {
+class Manifest;
+}
+
+namespace woved::api {
+
+// Leader side of WAL-shipping read replicas (cluster.replication.role
+// leader): woved.v1.ReplicationService on its own port, for
+// ReplicaFollower.
+//
+// TailWal follows the WAL directories from the follower's epoch, with a
+// storage::WalTailer per call, and streams WALBatches of up to
+// batch_bytes as fast as the follower reads them: HTTP/2 flow control
+// holds a slow follower back without anything queued here. Once the log
+// is read to its end the call looks again every poll_ms, and sends an
+// empty batch at least every heartbeat so an idle follower can tell it is
+// current.
+//
+// GetManifest answers with the current manifest version: its live segments
+// with their file sizes, the centroid file and flushed_epoch. FetchFile
+// streams a file that version names from an offset, so a copy cut short
+// resumes where it stopped; no other file can be read.
+class ReplicationServer {
+public:
+    struct Options {
+        std::string address = "0.0.0.0:9092";  // server.bind_address:cluster.replication.port
+        std::vector<std::string> wal_dirs;      // WalStreams::directories
+        std::chrono::milliseconds poll{10};
+        std::chrono::milliseconds heartbeat{100};
+        size_t batch_bytes = 4194304;
+        size_t chunk_bytes = 1048576;           // Per FetchFile message
+        bool verify_checksums = true;           // recovery.verify_checksums
+        uint64_t max_message_bytes = 104857600; // limits.max_request_size_bytes
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        size_t tails = 0;          // TailWal calls open now
+        uint64_t shipments = 0;
+        uint64_t records = 0;
+        uint64_t files = 0;        // FetchFile calls answered in full
+        uint64_t file_bytes = 0;
+    };
+
+    // `manifest` must outlive the server
+    ReplicationServer(const Options& options, const storage::Manifest& manifest);
+    ~ReplicationServer();
+
+    ReplicationServer(const ReplicationServer&) = delete;
+    ReplicationServer& operator=(const ReplicationServer&) = delete;
+
+    // Bind and serve; throws util::IOException if the address cannot be bound
+    void start();
+    // Ends open tails and copies; idempotent
+    void shutdown();
+
+    int port() const { return port_; }
+
+    Stats getStats() const;
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    class Service;
+
+    Options options_;
+    const storage::Manifest& manifest_;
+    std::unique_ptr<Service> service_;
+    int port_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;  // Wakes idle tails at shutdown
+    bool stopping_ = false;
+
+    std::atomic<size_t> tails_{0};
+    std::atomic<uint64_t> shipments_{0};
+    std::atomic<uint64_t> records_{0};
+    std::atomic<uint64_t> files_{0};
+    std::atomic<uint64_t> file_bytes_{0};
+};
+
+} // namespace woved::api
@@ -0,0 +1,191 @@
+#include "bitmap-cache.h"
+#include "core/config.h"
+#include <algorithm>
+#include <mutex>
+
+namespace woved::bitmaps {
+
+namespace {
+
+// Header of an array, bitset or run container (cardinality or run count,
+// capacity, payload pointer)
+constexpr size_t kContainerHeader = 16;
+// Per container slot of the bitmap: key, typecode, container pointer
+constexpr size_t kContainerSlot = sizeof(uint16_t) + sizeof(uint8_t) + sizeof(void*);
+// Control block and object of the shared pointer, index node and key
+constexpr size_t kEntryOverhead = 64 + sizeof(BitmapCache::Bitmap);
+
+} // namespace
+
+BitmapCache::Options BitmapCache::Options::fromConfig(const Config& config) {
+    Options options;
+    options.capacity_bytes = config.filtering.bitmap_cache_bytes;
+    options.segment_cap_bytes = std::min<uint64_t>(config.filtering.per_segment_soft_cap_bytes,
+                                                   config.filtering.bitmap_cache_bytes);
+    return options;
+}
+
+BitmapCache::BitmapCache(const Options& options) : options_(options), capacity_(options.capacity_bytes) {}
+
+size_t BitmapCache::KeyHash::operator()(const Key& key) const {
+    uint64_t h = (uint64_t{key.segment} << 32 | key.id) ^ (uint64_t{static_cast<uint8_t>(key.kind)} << 62);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
+size_t BitmapCache::footprint(const Bitmap& bitmap) {
+    roaring::api::roaring_statistics_t stats{};
+    roaring::api::roaring_bitmap_statistics(&bitmap.roaring, &stats);
+    const auto& containers = bitmap.roaring.high_low_container;
+    return kEntryOverhead + static_cast<size_t>(containers.allocation_size) * kContainerSlot +
+           size_t{stats.n_containers} * kContainerHeader + stats.n_bytes_array_containers +
+           stats.n_bytes_run_containers + stats.n_bytes_bitset_containers;
+}
+
+BitmapCache::BitmapPtr BitmapCache::find(const Key& key) {
+    std::shared_lock lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Slot& slot = ring_[it->second];
+    slot.referenced.store(true, std::memory_order_relaxed);
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return slot.bitmap;
+}
+
+BitmapCache::BitmapPtr BitmapCache::get(const Key& key, const Loader& load) {
+    if (BitmapPtr cached = find(key)) return cached;
+    return insert(key, load());
+}
+
+BitmapCache::BitmapPtr BitmapCache::insert(const Key& key, Bitmap bitmap) {
+    // Array and run containers are grown by doubling; charge what is used
+    bitmap.shrinkToFit();
+    const size_t bytes = footprint(bitmap);
+    auto owned = std::make_shared<const Bitmap>(std::move(bitmap));
+    if (bytes > capacity_.load(std::memory_order_relaxed)) {
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return owned;
+    }
+
+    std::unique_lock lock(mutex_);
+    if (auto it = index_.find(key); it != index_.end()) {
+        Slot& slot = ring_[it->second];
+        slot.referenced.store(true, std::memory_order_relaxed);
+        return slot.bitmap;
+    }
+
+    auto segmentBytes = [&] {
+        auto it = segment_bytes_.find(key.segment);
+        return it == segment_bytes_.end() ? size_t{0} : it->second;
+    };
+    while (segmentBytes() + bytes > options_.segment_cap_bytes && evictLocked(&key.segment)) {
+    }
+    while (bytes_ + bytes > capacity_.load(std::memory_order_relaxed) && evictLocked(nullptr)) {
+    }
+
+    uint32_t index;
+    if (!free_.empty()) {
+        index = free_.back();
+        free_.pop_back();
+    } else {
+        index = static_cast<uint32_t>(ring_.size());
+        ring_.emplace_back();
+    }
+    Slot& slot = ring_[index];
+    slot.key = key;
+    slot.bitmap = owned;
+    slot.bytes = bytes;
+    slot.referenced.store(false, std::memory_order_relaxed);
+    index_.emplace(key, index);
+    segment_bytes_[key.segment] += bytes;
+    bytes_ += bytes;
+    inserts_.fetch_add(1, std::memory_order_relaxed);
+    return owned;
+}
+
+void BitmapCache::eraseLocked(uint32_t index) {
+    Slot& slot = ring_[index];
+    auto seg = segment_bytes_.find(slot.key.segment);
+    if (seg != segment_bytes_.end()) {
+        seg->second -= slot.bytes;
+        if (seg->second == 0) segment_bytes_.erase(seg);
+    }
+    bytes_ -= slot.bytes;
+    index_.erase(slot.key);
+    slot.bitmap.reset();
+    slot.bytes = 0;
+    free_.push_back(index);
+}
+
+bool BitmapCache::evictLocked(const uint32_t* segment_only) {
+    // Two sweeps: the first may only clear reference bits
+    const size_t size = ring_.size();
+    for (size_t step = 0; step < 2 * size; ++step) {
+        const uint32_t index = static_cast<uint32_t>(hand_);
+        hand_ = hand_ + 1 < size ? hand_ + 1 : 0;
+        Slot& slot = ring_[index];
+        if (!slot.bitmap) continue;
+        if (segment_only && slot.key.segment != *segment_only) continue;
+        if (slot.referenced.exchange(false, std::memory_order_relaxed)) continue;
+        eraseLocked(index);
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void BitmapCache::setCapacity(size_t bytes) {
+    std::unique_lock lock(mutex_);
+    capacity_.store(bytes, std::memory_order_relaxed);
+    while (bytes_ > bytes && evictLocked(nullptr)) {
+    }
+}
+
+void BitmapCache::invalidateSegment(uint32_t segment) {
+    std::unique_lock lock(mutex_);
+    if (!segment_bytes_.contains(segment)) return;
+    for (uint32_t index = 0; index < ring_.size(); ++index) {
+        if (ring_[index].bitmap && ring_[index].key.segment == segment) eraseLocked(index);
+    }
+}
+
+void BitmapCache::clear() {
+    std::unique_lock lock(mutex_);
+    ring_.clear();
+    free_.clear();
+    index_.clear();
+    segment_bytes_.clear();
+    hand_ = 0;
+    bytes_ = 0;
+}
+
+BitmapCache::Stats BitmapCache::getStats() const {
+    Stats stats;
+    {
+        std::shared_lock lock(mutex_);
+        stats.entries = index_.size();
+        stats.bytes = bytes_;
+    }
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.inserts = inserts_.load(std::memory_order_relaxed);
+    stats.evictions = evictions_.load(std::memory_order_relaxed);
+    stats.rejected = rejected_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<std::pair<std::string_view, double>> BitmapCache::metrics() const {
+    Stats stats = getStats();
+    return {
+        {"woved_bitmap_cache_hits", static_cast<double>(stats.hits)},
+        {"woved_bitmap_cache_misses", static_cast<double>(stats.misses)},
+        {"woved_bitmap_cache_bytes", static_cast<double>(stats.bytes)},
+    };
+}
+
+} // namespace woved::bitmaps
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include <roaring/roaring.hh>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::bitmaps {
+
+// Cache of deserialized roaring bitmaps (filtering.bitmap_cache_bytes), one
+// per (segment, tag or tenant), so filtered queries do not re-read and
+// re-decode the segment's Bitmap sections.
+//
+// Entries are charged their in-memory footprint: container payloads,
+// container headers, the key/type/pointer arrays of the bitmap and the
+// slot itself. Bitmaps are shrunk to fit before they are measured, so the
+// charge is what the process actually holds.
+//
+// Eviction is CLOCK: a hit sets the entry's reference bit under the shared
+// lock; the hand clears set bits and evicts the first entry found clear.
+// A segment over per_segment_soft_cap_bytes gives up its own entries
+// first, so a burst of queries against one segment cannot flush every
+// other segment's bitmaps. The cap is soft: one bitmap larger than it is
+// still cached, once its segment holds nothing else.
+//
+// Bitmaps are handed out as shared pointers; an evicted bitmap stays valid
+// for readers still holding it.
+class BitmapCache {
+public:
+    using Bitmap = roaring::Roaring;
+    using BitmapPtr = std::shared_ptr<const Bitmap>;
+
+    struct Options {
+        size_t capacity_bytes = size_t{1} << 30;       // filtering.bitmap_cache_bytes
+        size_t segment_cap_bytes = size_t{128} << 20;  // filtering.per_segment_soft_cap_bytes
+
+        static Options fromConfig(const Config& config);
+    };
+
+    enum class Kind : uint8_t {
+        Tag,
+        Tenant
+    };
+
+    struct Key {
+        uint32_t segment = 0;  // Manifest ordinal
+        Kind kind = Kind::Tag;
+        uint32_t id = 0;       // TagId or TenantOrdinal
+
+        bool operator==(const Key&) const = default;
+    };
+
+    // Reads and deserializes one bitmap (a Bitmap section of the segment)
+    using Loader = std::function<Bitmap()>;
+
+    struct Stats {
+        size_t entries = 0;
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t inserts = 0;
+        uint64_t evictions = 0;
+        uint64_t rejected = 0;         // Larger than the whole cache
+    };
+
+    explicit BitmapCache(const Options& options);
+
+    BitmapCache(const BitmapCache&) = delete;
+    BitmapCache& operator=(const BitmapCache&) = delete;
+
+    // The cached bitmap, or nullptr
+    BitmapPtr find(const Key& key);
+
+    // The cached bitmap, or load() it outside the lock and cache it. Two
+    // threads missing on the same key may both load; the first insert wins.
+    BitmapPtr get(const Key& key, const Loader& load);
+
+    // Caches a bitmap; returns the entry now cached under the key (an
+    // earlier one if present), or the bitmap itself if it does not fit
+    BitmapPtr insert(const Key& key, Bitmap bitmap);
+
+    // Resize the cache (a MemoryGovernor budget), evicting down to it now
+    void setCapacity(size_t bytes);
+    size_t capacity() const { return capacity_.load(std::memory_order_relaxed); }
+
+    // Drops every entry of a segment (compacted away or unloaded)
+    void invalidateSegment(uint32_t segment);
+
+    void clear();
+
+    // Bytes charged for a bitmap as it is
+    static size_t footprint(const Bitmap& bitmap);
+
+    Stats getStats() const;
+
+    // Counters under their exported names (telemetry.metrics)
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Slot {
+        Key key;
+        BitmapPtr bitmap;              // nullptr: free
+        size_t bytes = 0;
+        std::atomic<bool> referenced{false};
+    };
+
+    void eraseLocked(uint32_t slot);
+    // Advances the hand to the next victim; segment_only restricts the
+    // sweep to one segment's entries. Returns false if none is left.
+    bool evictLocked(const uint32_t* segment_only);
+
+    Options options_;
+    std::atomic<size_t> capacity_;     // Options::capacity_bytes until setCapacity()
+    mutable std::shared_mutex mutex_;
+    std::deque<Slot> ring_;            // Never shrinks; slots are reused
+    std::vector<uint32_t> free_;
+    std::unordered_map<Key, uint32_t, KeyHash> index_;
+    std::unordered_map<uint32_t, size_t> segment_bytes_;
+    size_t hand_ = 0;
+    size_t bytes_ = 0;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> inserts_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<uint64_t> rejected_{0};
+};
+
+} // namespace woved::bitmaps
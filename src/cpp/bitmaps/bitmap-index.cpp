@@ -0,0 +1,203 @@
+#include "bitmap-index.h"
+#include "core/config.h"
+#include "util/cpu-dispatch.h"
+#include "util/exceptions.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <string>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace woved::bitmaps {
+
+namespace {
+
+constexpr uint32_t kArraySentinel = std::numeric_limits<uint32_t>::max();
+constexpr size_t kFilterChunk = 256;
+
+// Dense probes clamp an id to `rows`, whose bit is always clear (the spare
+// word), so the load needs no bounds branch
+using DenseFn = void (*)(const uint64_t* words, uint32_t rows, const uint32_t* ids, size_t n, uint8_t* out);
+
+void dense_scalar(const uint64_t* words, uint32_t rows, const uint32_t* ids, size_t n, uint8_t* out) {
+    for (size_t i = 0; i < n; ++i) {
+        const uint32_t id = std::min(ids[i], rows);
+        out[i] = static_cast<uint8_t>((words[id >> 6] >> (id & 63)) & 1);
+    }
+}
+
+#if defined(__x86_64__)
+// Gathers the 32-bit word holding each id's bit, shifts it down and keeps
+// the low byte of each lane
+__attribute__((target("avx2")))
+void dense_avx2(const uint64_t* words, uint32_t rows, const uint32_t* ids, size_t n, uint8_t* out) {
+    const int* base = reinterpret_cast<const int*>(words);
+    const __m256i limit = _mm256_set1_epi32(static_cast<int>(rows));
+    const __m256i low = _mm256_set1_epi32(31);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i pack = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                          0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i id = _mm256_min_epu32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i)), limit);
+        __m256i word = _mm256_i32gather_epi32(base, _mm256_srli_epi32(id, 5), 4);
+        __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(id, low)), one);
+        bit = _mm256_shuffle_epi8(bit, pack);
+        const uint32_t lo = static_cast<uint32_t>(_mm256_extract_epi32(bit, 0));
+        const uint32_t hi = static_cast<uint32_t>(_mm256_extract_epi32(bit, 4));
+        std::memcpy(out + i, &lo, 4);
+        std::memcpy(out + i + 4, &hi, 4);
+    }
+    dense_scalar(words, rows, ids + i, n - i, out + i);
+}
+
+__attribute__((target("avx512f")))
+void dense_avx512(const uint64_t* words, uint32_t rows, const uint32_t* ids, size_t n, uint8_t* out) {
+    const __m512i limit = _mm512_set1_epi32(static_cast<int>(rows));
+    const __m512i low = _mm512_set1_epi32(31);
+    const __m512i one = _mm512_set1_epi32(1);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i id = _mm512_min_epu32(_mm512_loadu_si512(ids + i), limit);
+        __m512i word = _mm512_i32gather_epi32(_mm512_srli_epi32(id, 5), words, 4);
+        __m512i bit = _mm512_and_si512(_mm512_srlv_epi32(word, _mm512_and_si512(id, low)), one);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm512_cvtepi32_epi8(bit));
+    }
+    dense_scalar(words, rows, ids + i, n - i, out + i);
+}
+#endif
+
+DenseFn dense_kernel() {
+    static const DenseFn fn = [] () -> DenseFn {
+#if defined(__x86_64__)
+        const auto& f = util::cpu_features();
+        if (f.avx512f) return dense_avx512;
+        if (f.avx2) return dense_avx2;
+#endif
+        return dense_scalar;
+    }();
+    return fn;
+}
+
+// Branch-free lower bound over `n` sorted ids followed by the sentinel:
+// the compare feeds a conditional move
+size_t lower_bound(const uint32_t* a, size_t n, uint32_t id) {
+    const uint32_t* base = a;
+    size_t len = n + 1;
+    while (len > 1) {
+        const size_t half = len / 2;
+        base += base[half] < id ? half : 0;
+        len -= half;
+    }
+    return static_cast<size_t>(base - a) + (*base < id);
+}
+
+} // namespace
+
+TagBitmap::Options TagBitmap::Options::fromConfig(const Config& config) {
+    Options options;
+    options.dense_threshold = std::clamp(config.filtering.dense_bitmap_threshold, 0.0f, 1.0f);
+    return options;
+}
+
+TagBitmap TagBitmap::build(std::span<const uint32_t> ids, uint32_t rows, const Options& options) {
+    return build(roaring::Roaring(ids.size(), ids.data()), rows, options);
+}
+
+TagBitmap TagBitmap::build(const roaring::Roaring& bitmap, uint32_t rows, const Options& options) {
+    TagBitmap out;
+    out.rows_ = rows;
+    out.cardinality_ = bitmap.cardinality();
+    if (out.cardinality_ > 0 && bitmap.maximum() >= rows) {
+        throw util::InvalidArgumentException("TagBitmap: row id " + std::to_string(bitmap.maximum()) +
+                                             " past " + std::to_string(rows) + " rows");
+    }
+
+    std::vector<uint32_t> ids(out.cardinality_);
+    if (!ids.empty()) bitmap.toUint32Array(ids.data());
+
+    if (rows > 0 && static_cast<double>(out.cardinality_) >= options.dense_threshold * static_cast<double>(rows)) {
+        out.format_ = Format::Dense;
+        out.words_.assign(size_t{rows} / 64 + 1, 0);
+        for (uint32_t id : ids) out.words_[id >> 6] |= uint64_t{1} << (id & 63);
+        return out;
+    }
+
+    roaring::Roaring compact(bitmap);
+    compact.runOptimize();
+    compact.shrinkToFit();
+    if ((ids.size() + 1) * sizeof(uint32_t) <= compact.getSizeInBytes()) {
+        out.format_ = Format::Array;
+        out.array_ = std::move(ids);
+        out.array_.push_back(kArraySentinel);
+        return out;
+    }
+    out.format_ = Format::Roaring;
+    out.roaring_ = std::move(compact);
+    return out;
+}
+
+size_t TagBitmap::bytes() const {
+    switch (format_) {
+        case Format::Dense: return words_.capacity() * sizeof(uint64_t);
+        case Format::Array: return array_.capacity() * sizeof(uint32_t);
+        case Format::Roaring: return roaring_.getSizeInBytes(false);
+    }
+    return 0;
+}
+
+bool TagBitmap::contains(uint32_t id) const {
+    uint8_t hit;
+    containsBatch(std::span<const uint32_t>(&id, 1), &hit);
+    return hit != 0;
+}
+
+void TagBitmap::containsBatch(std::span<const uint32_t> ids, uint8_t* out) const {
+    switch (format_) {
+        case Format::Dense:
+            dense_kernel()(words_.data(), rows_, ids.data(), ids.size(), out);
+            return;
+        case Format::Array: {
+            if (array_.empty()) {
+                std::fill_n(out, ids.size(), uint8_t{0});
+                return;
+            }
+            const size_t n = array_.size() - 1;
+            for (size_t i = 0; i < ids.size(); ++i) {
+                const uint32_t id = ids[i];
+                out[i] = static_cast<uint8_t>((array_[lower_bound(array_.data(), n, id)] == id) & (id < rows_));
+            }
+            return;
+        }
+        case Format::Roaring:
+            for (size_t i = 0; i < ids.size(); ++i) out[i] = static_cast<uint8_t>(roaring_.contains(ids[i]));
+            return;
+    }
+}
+
+size_t TagBitmap::filter(std::span<uint32_t> ids) const {
+    uint8_t hits[kFilterChunk];
+    size_t kept = 0;
+    for (size_t begin = 0; begin < ids.size(); begin += kFilterChunk) {
+        const size_t n = std::min(kFilterChunk, ids.size() - begin);
+        containsBatch(ids.subspan(begin, n), hits);
+        for (size_t i = 0; i < n; ++i) {
+            ids[kept] = ids[begin + i];
+            kept += hits[i];
+        }
+    }
+    return kept;
+}
+
+const char* TagBitmap::name(Format format) {
+    switch (format) {
+        case Format::Dense: return "dense";
+        case Format::Array: return "array";
+        case Format::Roaring: return "roaring";
+    }
+    return "unknown";
+}
+
+} // namespace woved::bitmaps
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <roaring/roaring.hh>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::bitmaps {
+
+// The local row ids of a segment carrying one tag (or tenant), held in the
+// representation its density calls for, picked when it is built:
+//  - Dense: a flat bitset over the segment's rows, once the tag covers at
+//    least filtering.dense_bitmap_threshold of them. A probe is one load
+//    and a shift, and a block of candidates is checked with one gather.
+//  - Array: sorted row ids, when that is no larger than the roaring form
+//    (few, scattered rows). Probed by branch-free binary search.
+//  - Roaring: everything in between, run-optimized.
+//
+// containsBatch() answers a whole block of candidate ids (an IVF list's
+// rows after ADC, say) without a branch on the outcome; ids at or past
+// rows() are never members.
+class TagBitmap {
+public:
+    enum class Format : uint8_t {
+        Dense,
+        Array,
+        Roaring
+    };
+
+    struct Options {
+        float dense_threshold = 0.2f;   // filtering.dense_bitmap_threshold
+
+        static Options fromConfig(const Config& config);
+    };
+
+    TagBitmap() = default;
+
+    // `ids` sorted and unique, each below `rows`
+    static TagBitmap build(std::span<const uint32_t> ids, uint32_t rows, const Options& options);
+    // From a deserialized Bitmap section
+    static TagBitmap build(const roaring::Roaring& bitmap, uint32_t rows, const Options& options);
+
+    Format format() const { return format_; }
+    uint32_t rows() const { return rows_; }
+    uint64_t cardinality() const { return cardinality_; }
+    // Heap bytes held
+    size_t bytes() const;
+
+    bool contains(uint32_t id) const;
+
+    // out[i] = 1 if ids[i] is a member, else 0
+    void containsBatch(std::span<const uint32_t> ids, uint8_t* out) const;
+
+    // Keeps the member ids of `ids` in place, in order; returns how many
+    size_t filter(std::span<uint32_t> ids) const;
+
+    static const char* name(Format format);
+
+private:
+    Format format_ = Format::Array;
+    uint32_t rows_ = 0;
+    uint64_t cardinality_ = 0;
+    std::vector<uint64_t> words_;       // Dense; one spare word
+    std::vector<uint32_t> array_;       // Array
+    roaring::Roaring roaring_;          // Roaring
+};
+
+} // namespace woved::bitmaps
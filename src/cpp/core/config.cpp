@@ -1,55 +1,497 @@
 #include "config.h"
+#include "util/logging.h"
 #include <yaml-cpp/yaml.h>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
 #include <bits/std_thread.h>
 
 namespace woved {
   
 Config g_config;
 
-bool loadConfig(const std::string& path) {
-    try {
-        YAML::Node yaml = YAML::LoadFile(path);
+namespace {
+
+// Sections present in `yaml` over `config`; absent keys keep its values
+void parseConfig(const YAML::Node& yaml, Config& config) {
+    // Server config
+    if (yaml["server"]) {
+        auto srv = yaml["server"];
+        config.server.bind_address = srv["bind_address"].as<std::string>(config.server.bind_address);
+        config.server.grpc_port = srv["grpc_port"].as<uint16_t>(config.server.grpc_port);
+        config.server.http_port = srv["http_port"].as<uint16_t>(config.server.http_port);
+        config.server.metrics_port = srv["metrics_port"].as<uint16_t>(config.server.metrics_port);
+        config.server.max_connections = srv["max_connections"].as<uint32_t>(config.server.max_connections);
+        config.server.worker_threads = srv["worker_threads"].as<uint32_t>(config.server.worker_threads);
+        config.server.grpc_queues = srv["grpc_queues"].as<uint32_t>(config.server.grpc_queues);
+        config.server.http_threads = srv["http_threads"].as<uint32_t>(config.server.http_threads);
+    }
+    
+    // Cluster config
+    if (yaml["cluster"]) {
+        auto cl = yaml["cluster"];
+        config.cluster.mode = cl["mode"].as<std::string>(config.cluster.mode);
+        config.cluster.shards = cl["shards"].as<std::vector<std::string>>(config.cluster.shards);
+        config.cluster.hedge_after_ms = cl["hedge_after_ms"].as<uint32_t>(config.cluster.hedge_after_ms);
+        config.cluster.hedge_quantile = cl["hedge_quantile"].as<float>(config.cluster.hedge_quantile);
+        config.cluster.write_timeout_ms = cl["write_timeout_ms"].as<uint32_t>(config.cluster.write_timeout_ms);
+        config.cluster.allow_partial = cl["allow_partial"].as<bool>(config.cluster.allow_partial);
+    }
+    if (yaml["cluster"] && yaml["cluster"]["replication"]) {
+        auto rep = yaml["cluster"]["replication"];
+        auto& r = config.cluster.replication;
+        r.role = rep["role"].as<std::string>(r.role);
+        r.port = rep["port"].as<uint32_t>(r.port);
+        r.leader = rep["leader"].as<std::string>(r.leader);
+        r.poll_ms = rep["poll_ms"].as<uint32_t>(r.poll_ms);
+        r.batch_bytes = rep["batch_bytes"].as<uint32_t>(r.batch_bytes);
+        r.manifest_poll_ms = rep["manifest_poll_ms"].as<uint32_t>(r.manifest_poll_ms);
+        r.max_staleness_ms = rep["max_staleness_ms"].as<uint32_t>(r.max_staleness_ms);
+    }
+    
+    // Collection config
+    if (yaml["collection"]) {
+        auto coll = yaml["collection"];
+        config.collection.dim = coll["dim"].as<uint32_t>(config.collection.dim);
+        config.collection.metric = coll["metric"].as<std::string>(config.collection.metric);
+        config.collection.max_vectors = coll["max_vectors"].as<uint64_t>(config.collection.max_vectors);
+        config.collection.id_type = coll["id_type"].as<std::string>(config.collection.id_type);
+        config.collection.element_type = coll["element_type"].as<std::string>(config.collection.element_type);
+    }
+    
+    // Storage config
+    if (yaml["storage"]) {
+        auto stor = yaml["storage"];
+        config.storage.data_dir = stor["data_dir"].as<std::string>(config.storage.data_dir);
+        config.storage.wal_dir = stor["wal_dir"].as<std::string>(config.storage.wal_dir);
+        config.storage.wal_dirs = stor["wal_dirs"].as<std::vector<std::string>>(config.storage.wal_dirs);
+        config.storage.segment_dir = stor["segment_dir"].as<std::string>(config.storage.segment_dir);
+        config.storage.segment_dirs = stor["segment_dirs"].as<std::vector<std::string>>(config.storage.segment_dirs);
+        
+        // WAL config
+        if (stor["wal"]) {
+            auto wal = stor["wal"];
+            config.storage.wal.group_commit_ms = wal["group_commit_ms"].as<uint32_t>(config.storage.wal.group_commit_ms);
+            config.storage.wal.fence_every_ms = wal["fence_every_ms"].as<uint32_t>(config.storage.wal.fence_every_ms);
+            config.storage.wal.fsync_every_fences = wal["fsync_every_fences"].as<uint32_t>(config.storage.wal.fsync_every_fences);
+            config.storage.wal.direct_io = wal["direct_io"].as<bool>(config.storage.wal.direct_io);
+            config.storage.wal.unit_bytes = wal["unit_bytes"].as<uint64_t>(config.storage.wal.unit_bytes);
+            config.storage.wal.rotate_bytes = wal["rotate_bytes"].as<uint64_t>(config.storage.wal.rotate_bytes);
+            config.storage.wal.preallocate = wal["preallocate"].as<bool>(config.storage.wal.preallocate);
+            config.storage.wal.pool_files = wal["pool_files"].as<uint32_t>(config.storage.wal.pool_files);
+            config.storage.wal.stream_sharding = wal["stream_sharding"].as<std::string>(config.storage.wal.stream_sharding);
+            config.storage.wal.compression = wal["compression"].as<std::string>(config.storage.wal.compression);
+            config.storage.wal.compression_level = wal["compression_level"].as<int>(config.storage.wal.compression_level);
+            config.storage.wal.dict_bytes = wal["dict_bytes"].as<uint32_t>(config.storage.wal.dict_bytes);
+        }
         
-        // Server config
-        if (yaml["server"]) {
-            auto srv = yaml["server"];
-            g_config.server.bind_address = srv["bind_address"].as<std::string>(g_config.server.bind_address);
-            g_config.server.grpc_port = srv["grpc_port"].as<uint16_t>(g_config.server.grpc_port);
-            g_config.server.http_port = srv["http_port"].as<uint16_t>(g_config.server.http_port);
-            g_config.server.metrics_port = srv["metrics_port"].as<uint16_t>(g_config.server.metrics_port);
-            g_config.server.worker_threads = srv["worker_threads"].as<uint32_t>(g_config.server.worker_threads);
+        // Buffer config
+        if (stor["buffer"]) {
+            auto buf = stor["buffer"];
+            config.storage.buffer.type = buf["type"].as<std::string>(config.storage.buffer.type);
+            config.storage.buffer.path = buf["path"].as<std::string>(config.storage.buffer.path);
+            config.storage.buffer.size_bytes = buf["size_bytes"].as<uint64_t>(config.storage.buffer.size_bytes);
+            config.storage.buffer.shard_count = buf["shard_count"].as<uint32_t>(config.storage.buffer.shard_count);
+            config.storage.buffer.shard_affinity = buf["shard_affinity"].as<std::string>(config.storage.buffer.shard_affinity);
+            config.storage.buffer.flush_threshold_bytes = buf["flush_threshold_bytes"].as<uint64_t>(config.storage.buffer.flush_threshold_bytes);
+            config.storage.buffer.flush_interval_ms = buf["flush_interval_ms"].as<uint32_t>(config.storage.buffer.flush_interval_ms);
+            config.storage.buffer.flush_threads = buf["flush_threads"].as<uint32_t>(config.storage.buffer.flush_threads);
+            config.storage.buffer.max_flush_lag_ms = buf["max_flush_lag_ms"].as<uint32_t>(config.storage.buffer.max_flush_lag_ms);
+            config.storage.buffer.flush_bandwidth_mbps = buf["flush_bandwidth_mbps"].as<uint32_t>(config.storage.buffer.flush_bandwidth_mbps);
+            config.storage.buffer.dedupe_enabled = buf["dedupe_enabled"].as<bool>(config.storage.buffer.dedupe_enabled);
+            config.storage.buffer.dedupe_id_index = buf["dedupe_id_index"].as<bool>(config.storage.buffer.dedupe_id_index);
+            config.storage.buffer.arena_enabled = buf["arena_enabled"].as<bool>(config.storage.buffer.arena_enabled);
+            config.storage.buffer.arena_slab_bytes = buf["arena_slab_bytes"].as<uint64_t>(config.storage.buffer.arena_slab_bytes);
+            config.storage.buffer.staged_append = buf["staged_append"].as<bool>(config.storage.buffer.staged_append);
+            config.storage.buffer.staging_batch = buf["staging_batch"].as<uint32_t>(config.storage.buffer.staging_batch);
+            config.storage.buffer.soft_watermark_bytes = buf["soft_watermark_bytes"].as<uint64_t>(config.storage.buffer.soft_watermark_bytes);
+            config.storage.buffer.hard_watermark_bytes = buf["hard_watermark_bytes"].as<uint64_t>(config.storage.buffer.hard_watermark_bytes);
+            config.storage.buffer.durable_ack = buf["durable_ack"].as<bool>(config.storage.buffer.durable_ack);
         }
         
-        // Storage config
-        if (yaml["storage"]) {
-            auto stor = yaml["storage"];
-            g_config.storage.data_dir = stor["data_dir"].as<std::string>(g_config.storage.data_dir);
-            g_config.storage.wal_dir = stor["wal_dir"].as<std::string>(g_config.storage.wal_dir);
-            g_config.storage.segment_dir = stor["segment_dir"].as<std::string>(g_config.storage.segment_dir);
-            
-            // WAL config
-            if (stor["wal"]) {
-                auto wal = stor["wal"];
-                g_config.storage.wal.group_commit_ms = wal["group_commit_ms"].as<uint32_t>(g_config.storage.wal.group_commit_ms);
-                g_config.storage.wal.fence_every_ms = wal["fence_every_ms"].as<uint32_t>(g_config.storage.wal.fence_every_ms);
-                g_config.storage.wal.rotate_bytes = wal["rotate_bytes"].as<uint64_t>(g_config.storage.wal.rotate_bytes);
-            }
-            
-            // B-tree config
-            if (stor["btree"]) {
-                auto btree = stor["btree"];
-                g_config.storage.btree.epsilon = btree["epsilon"].as<float>(g_config.storage.btree.epsilon);
-                g_config.storage.btree.adaptive_epsilon = btree["adaptive_epsilon"].as<bool>(g_config.storage.btree.adaptive_epsilon);
-                g_config.storage.btree.hot_partition_threshold = btree["hot_partition_threshold"].as<float>(g_config.storage.btree.hot_partition_threshold);
-            }
+        // B-tree config
+        if (stor["btree"]) {
+            auto btree = stor["btree"];
+            config.storage.btree.epsilon = btree["epsilon"].as<float>(config.storage.btree.epsilon);
+            config.storage.btree.min_epsilon = btree["min_epsilon"].as<float>(config.storage.btree.min_epsilon);
+            config.storage.btree.max_epsilon = btree["max_epsilon"].as<float>(config.storage.btree.max_epsilon);
+            config.storage.btree.adaptive_epsilon = btree["adaptive_epsilon"].as<bool>(config.storage.btree.adaptive_epsilon);
+            config.storage.btree.hot_partition_threshold = btree["hot_partition_threshold"].as<float>(config.storage.btree.hot_partition_threshold);
+            config.storage.btree.direct_flush_threshold = btree["direct_flush_threshold"].as<float>(config.storage.btree.direct_flush_threshold);
+            config.storage.btree.direct_flush_min_bytes = btree["direct_flush_min_bytes"].as<uint64_t>(config.storage.btree.direct_flush_min_bytes);
+            config.storage.btree.parallel_flush = btree["parallel_flush"].as<bool>(config.storage.btree.parallel_flush);
+            config.storage.btree.flush_threads = btree["flush_threads"].as<uint32_t>(config.storage.btree.flush_threads);
+            config.storage.btree.node_cache_mb = btree["node_cache_mb"].as<uint32_t>(config.storage.btree.node_cache_mb);
+            config.storage.btree.node_cache_protected_level = btree["node_cache_protected_level"].as<uint32_t>(config.storage.btree.node_cache_protected_level);
         }
         
+        // Segment config
+        if (stor["segment"]) {
+            auto seg = stor["segment"];
+            config.storage.segment.target_size_vectors = seg["target_size_vectors"].as<uint64_t>(config.storage.segment.target_size_vectors);
+            config.storage.segment.max_segments_per_leaf = seg["max_segments_per_leaf"].as<uint32_t>(config.storage.segment.max_segments_per_leaf);
+            config.storage.segment.tombstone_ratio_threshold = seg["tombstone_ratio_threshold"].as<float>(config.storage.segment.tombstone_ratio_threshold);
+            config.storage.segment.merge_bandwidth_limit = seg["merge_bandwidth_limit"].as<float>(config.storage.segment.merge_bandwidth_limit);
+            config.storage.segment.enable_compression = seg["enable_compression"].as<bool>(config.storage.segment.enable_compression);
+            config.storage.segment.compression_type = seg["compression_type"].as<std::string>(config.storage.segment.compression_type);
+            config.storage.segment.compression_level = seg["compression_level"].as<int>(config.storage.segment.compression_level);
+            config.storage.segment.dict_bytes = seg["dict_bytes"].as<uint32_t>(config.storage.segment.dict_bytes);
+        }
+        if (stor["cold"]) {
+            auto cold = stor["cold"];
+            config.storage.cold.store_dir = cold["store_dir"].as<std::string>(config.storage.cold.store_dir);
+            config.storage.cold.cache_mb = cold["cache_mb"].as<uint32_t>(config.storage.cold.cache_mb);
+            config.storage.cold.chunk_kb = cold["chunk_kb"].as<uint32_t>(config.storage.cold.chunk_kb);
+            config.storage.cold.idle_hours = cold["idle_hours"].as<uint32_t>(config.storage.cold.idle_hours);
+        }
+        if (stor["manifest"]) {
+            auto man = stor["manifest"];
+            config.storage.manifest.snapshot_edits = man["snapshot_edits"].as<uint32_t>(config.storage.manifest.snapshot_edits);
+            config.storage.manifest.snapshot_mb = man["snapshot_mb"].as<uint32_t>(config.storage.manifest.snapshot_mb);
+        }
+    }
+
+    // Index config
+    if (yaml["index"] && yaml["index"]["delta"]) {
+        auto delta = yaml["index"]["delta"];
+        config.index.delta.type = delta["type"].as<std::string>(config.index.delta.type);
+        config.index.delta.nlist = delta["nlist"].as<uint32_t>(config.index.delta.nlist);
+        config.index.delta.nprobe = delta["nprobe"].as<uint32_t>(config.index.delta.nprobe);
+        config.index.delta.sample_p = delta["sample_p"].as<float>(config.index.delta.sample_p);
+        config.index.delta.sort_by_norm = delta["sort_by_norm"].as<bool>(config.index.delta.sort_by_norm);
+        config.index.delta.tenant_partitioned = delta["tenant_partitioned"].as<bool>(config.index.delta.tenant_partitioned);
+        config.index.delta.dedicated_tenant_rows = delta["dedicated_tenant_rows"].as<uint64_t>(config.index.delta.dedicated_tenant_rows);
+        config.index.delta.list_cap = delta["list_cap"].as<uint32_t>(config.index.delta.list_cap);
+        config.index.delta.global_centroids = delta["global_centroids"].as<bool>(config.index.delta.global_centroids);
+        config.index.delta.rebuild_interval_hours = delta["rebuild_interval_hours"].as<uint32_t>(config.index.delta.rebuild_interval_hours);
+    }
+    if (yaml["index"] && yaml["index"]["stable"]) {
+        auto stable = yaml["index"]["stable"];
+        config.index.stable.type = stable["type"].as<std::string>(config.index.stable.type);
+        config.index.stable.nlist = stable["nlist"].as<uint32_t>(config.index.stable.nlist);
+        config.index.stable.nprobe = stable["nprobe"].as<uint32_t>(config.index.stable.nprobe);
+        config.index.stable.rerank_factor = stable["rerank_factor"].as<uint32_t>(config.index.stable.rerank_factor);
+        if (stable["pq"]) {
+            auto pq = stable["pq"];
+            config.index.stable.pq.m = pq["m"].as<uint32_t>(config.index.stable.pq.m);
+            config.index.stable.pq.nbits = pq["nbits"].as<uint32_t>(config.index.stable.pq.nbits);
+            config.index.stable.pq.use_opq = pq["use_opq"].as<bool>(config.index.stable.pq.use_opq);
+            config.index.stable.pq.fast_scan = pq["fast_scan"].as<bool>(config.index.stable.pq.fast_scan);
+        }
+    }
+    if (yaml["index"] && yaml["index"]["global"]) {
+        auto global = yaml["index"]["global"];
+        config.index.global.type = global["type"].as<std::string>(config.index.global.type);
+        config.index.global.nlist = global["nlist"].as<uint32_t>(config.index.global.nlist);
+        config.index.global.memory_cache_mb = global["memory_cache_mb"].as<uint32_t>(config.index.global.memory_cache_mb);
+        if (global["hnsw"]) {
+            auto hnsw = global["hnsw"];
+            config.index.global.hnsw_m = hnsw["m"].as<uint32_t>(config.index.global.hnsw_m);
+            config.index.global.hnsw_ef_construction = hnsw["ef_construction"].as<uint32_t>(config.index.global.hnsw_ef_construction);
+            config.index.global.hnsw_ef = hnsw["ef"].as<uint32_t>(config.index.global.hnsw_ef);
+        }
+    }
+    if (yaml["index"] && yaml["index"]["hnsw_cache"]) {
+        auto cache = yaml["index"]["hnsw_cache"];
+        config.index.hnsw_cache.enabled = cache["enabled"].as<bool>(config.index.hnsw_cache.enabled);
+        config.index.hnsw_cache.max_elements = cache["max_elements"].as<uint32_t>(config.index.hnsw_cache.max_elements);
+        config.index.hnsw_cache.m = cache["m"].as<uint32_t>(config.index.hnsw_cache.m);
+        config.index.hnsw_cache.ef_construction = cache["ef_construction"].as<uint32_t>(config.index.hnsw_cache.ef_construction);
+        config.index.hnsw_cache.ef = cache["ef"].as<uint32_t>(config.index.hnsw_cache.ef);
+        config.index.hnsw_cache.admit_hits = cache["admit_hits"].as<uint32_t>(config.index.hnsw_cache.admit_hits);
+        config.index.hnsw_cache.answer_recall = cache["answer_recall"].as<float>(config.index.hnsw_cache.answer_recall);
+        config.index.hnsw_cache.verify_every = cache["verify_every"].as<uint32_t>(config.index.hnsw_cache.verify_every);
+    }
+
+    // Filtering config
+    if (yaml["filtering"]) {
+        auto filtering = yaml["filtering"];
+        config.filtering.bitmap_cache_bytes = filtering["bitmap_cache_bytes"].as<uint64_t>(config.filtering.bitmap_cache_bytes);
+        config.filtering.per_segment_soft_cap_bytes = filtering["per_segment_soft_cap_bytes"].as<uint64_t>(config.filtering.per_segment_soft_cap_bytes);
+        config.filtering.bloom_filter_enabled = filtering["bloom_filter_enabled"].as<bool>(config.filtering.bloom_filter_enabled);
+        config.filtering.bloom_filter_fpp = filtering["bloom_filter_fpp"].as<float>(config.filtering.bloom_filter_fpp);
+        config.filtering.tag_dict_size = filtering["tag_dict_size"].as<uint32_t>(config.filtering.tag_dict_size);
+        config.filtering.max_tags_per_vector = filtering["max_tags_per_vector"].as<uint32_t>(config.filtering.max_tags_per_vector);
+        config.filtering.dense_bitmap_threshold = filtering["dense_bitmap_threshold"].as<float>(config.filtering.dense_bitmap_threshold);
+        config.filtering.prefilter_selectivity = filtering["prefilter_selectivity"].as<float>(config.filtering.prefilter_selectivity);
+        config.filtering.widen_selectivity = filtering["widen_selectivity"].as<float>(config.filtering.widen_selectivity);
+        config.filtering.max_nprobe_widen = filtering["max_nprobe_widen"].as<uint32_t>(config.filtering.max_nprobe_widen);
+    }
+
+    // Query config
+    if (yaml["query"]) {
+        auto query = yaml["query"];
+        config.query.timeout_ms = query["timeout_ms"].as<uint32_t>(config.query.timeout_ms);
+        config.query.max_candidates = query["max_candidates"].as<uint32_t>(config.query.max_candidates);
+        config.query.default_top_k = query["default_top_k"].as<uint32_t>(config.query.default_top_k);
+        config.query.max_top_k = query["max_top_k"].as<uint32_t>(config.query.max_top_k);
+        config.query.two_phase_enabled = query["two_phase_enabled"].as<bool>(config.query.two_phase_enabled);
+        config.query.buffer_scan_enabled = query["buffer_scan_enabled"].as<bool>(config.query.buffer_scan_enabled);
+        config.query.prefetch_enabled = query["prefetch_enabled"].as<bool>(config.query.prefetch_enabled);
+        config.query.prefetch_depth = query["prefetch_depth"].as<uint32_t>(config.query.prefetch_depth);
+        config.query.prefetch_threads = query["prefetch_threads"].as<uint32_t>(config.query.prefetch_threads);
+        config.query.executor_threads = query["executor_threads"].as<uint32_t>(config.query.executor_threads);
+        config.query.executor_max_in_flight =
+            query["executor_max_in_flight"].as<uint32_t>(config.query.executor_max_in_flight);
+        config.query.result_cache_enabled = query["result_cache_enabled"].as<bool>(config.query.result_cache_enabled);
+        config.query.result_cache_entries = query["result_cache_entries"].as<uint32_t>(config.query.result_cache_entries);
+        config.query.result_cache_similarity = query["result_cache_similarity"].as<float>(config.query.result_cache_similarity);
+        config.query.latency_budget_ms = query["latency_budget_ms"].as<uint32_t>(config.query.latency_budget_ms);
+        config.query.deadline_headroom = query["deadline_headroom"].as<float>(config.query.deadline_headroom);
+        config.query.deadline_drop_buffer = query["deadline_drop_buffer"].as<bool>(config.query.deadline_drop_buffer);
+    }
+
+    // Tuning config
+    if (yaml["tuning"]) {
+        auto tuning = yaml["tuning"];
+        config.tuning.recall_target = tuning["recall_target"].as<float>(config.tuning.recall_target);
+        config.tuning.auto_tune_enabled = tuning["auto_tune_enabled"].as<bool>(config.tuning.auto_tune_enabled);
+        config.tuning.nprobe_delta_min = tuning["nprobe_delta_min"].as<uint32_t>(config.tuning.nprobe_delta_min);
+        config.tuning.nprobe_delta_max = tuning["nprobe_delta_max"].as<uint32_t>(config.tuning.nprobe_delta_max);
+        config.tuning.nprobe_stable_min = tuning["nprobe_stable_min"].as<uint32_t>(config.tuning.nprobe_stable_min);
+        config.tuning.nprobe_stable_max = tuning["nprobe_stable_max"].as<uint32_t>(config.tuning.nprobe_stable_max);
+        config.tuning.persist_decisions = tuning["persist_decisions"].as<bool>(config.tuning.persist_decisions);
+        config.tuning.decision_window_hours = tuning["decision_window_hours"].as<uint32_t>(config.tuning.decision_window_hours);
+        config.tuning.shadow_sample_rate = tuning["shadow_sample_rate"].as<float>(config.tuning.shadow_sample_rate);
+        config.tuning.min_samples = tuning["min_samples"].as<uint32_t>(config.tuning.min_samples);
+    }
+
+    // IO config
+    if (yaml["io"]) {
+        auto io = yaml["io"];
+        config.io.use_iouring = io["use_iouring"].as<bool>(config.io.use_iouring);
+        if (io["iouring"]) {
+            auto ring = io["iouring"];
+            config.io.iouring.sqpoll = ring["sqpoll"].as<bool>(config.io.iouring.sqpoll);
+            config.io.iouring.sqpoll_cpu = ring["sqpoll_cpu"].as<int>(config.io.iouring.sqpoll_cpu);
+            config.io.iouring.queue_depth = ring["queue_depth"].as<uint32_t>(config.io.iouring.queue_depth);
+            config.io.iouring.register_files = ring["register_files"].as<bool>(config.io.iouring.register_files);
+            config.io.iouring.link_timeout_ms = ring["link_timeout_ms"].as<uint32_t>(config.io.iouring.link_timeout_ms);
+        }
+        config.io.use_direct_io = io["use_direct_io"].as<bool>(config.io.use_direct_io);
+        config.io.delta_read_mode = io["delta_read_mode"].as<std::string>(config.io.delta_read_mode);
+        config.io.stable_read_mode = io["stable_read_mode"].as<std::string>(config.io.stable_read_mode);
+        config.io.segment_huge_pages = io["segment_huge_pages"].as<bool>(config.io.segment_huge_pages);
+        config.io.prefetch_distance = io["prefetch_distance"].as<uint32_t>(config.io.prefetch_distance);
+        config.io.merge_bandwidth_limit_mbps = io["merge_bandwidth_limit_mbps"].as<uint32_t>(config.io.merge_bandwidth_limit_mbps);
+        config.io.read_ahead_kb = io["read_ahead_kb"].as<uint32_t>(config.io.read_ahead_kb);
+        config.io.device_bandwidth_mbps = io["device_bandwidth_mbps"].as<uint32_t>(config.io.device_bandwidth_mbps);
+        config.io.target_utilization = io["target_utilization"].as<float>(config.io.target_utilization);
+        config.io.query_p99_target_ms = io["query_p99_target_ms"].as<uint32_t>(config.io.query_p99_target_ms);
+        config.io.buffer_pool_mb = io["buffer_pool_mb"].as<uint32_t>(config.io.buffer_pool_mb);
+        config.io.buffer_pool_huge_pages = io["buffer_pool_huge_pages"].as<bool>(config.io.buffer_pool_huge_pages);
+    }
+
+    // Experimental config
+    if (yaml["experimental"]) {
+        auto exp = yaml["experimental"];
+        config.experimental.gpu_acceleration = exp["gpu_acceleration"].as<bool>(config.experimental.gpu_acceleration);
+        config.experimental.gpu_device_id = exp["gpu_device_id"].as<uint32_t>(config.experimental.gpu_device_id);
+        config.experimental.gpu_min_batch = exp["gpu_min_batch"].as<uint32_t>(config.experimental.gpu_min_batch);
+        config.experimental.gpu_staging_bytes = exp["gpu_staging_bytes"].as<uint64_t>(config.experimental.gpu_staging_bytes);
+        config.experimental.gpu_cached_segments = exp["gpu_cached_segments"].as<uint32_t>(config.experimental.gpu_cached_segments);
+        config.experimental.learned_index = exp["learned_index"].as<bool>(config.experimental.learned_index);
+        config.experimental.router_min_segments = exp["router_min_segments"].as<uint32_t>(config.experimental.router_min_segments);
+        config.experimental.router_recall_target = exp["router_recall_target"].as<float>(config.experimental.router_recall_target);
+        config.experimental.router_explore_every = exp["router_explore_every"].as<uint32_t>(config.experimental.router_explore_every);
+        config.experimental.adaptive_sampling = exp["adaptive_sampling"].as<bool>(config.experimental.adaptive_sampling);
+        config.experimental.connectivity_aware_layout = exp["connectivity_aware_layout"].as<bool>(config.experimental.connectivity_aware_layout);
+        config.experimental.vector_compression = exp["vector_compression"].as<bool>(config.experimental.vector_compression);
+    }
+
+    // Monitoring config
+    if (yaml["monitoring"] && yaml["monitoring"]["prometheus"]) {
+        auto prom = yaml["monitoring"]["prometheus"];
+        config.monitoring.prometheus.enabled = prom["enabled"].as<bool>(config.monitoring.prometheus.enabled);
+        config.monitoring.prometheus.scrape_interval_s = prom["scrape_interval_s"].as<uint32_t>(config.monitoring.prometheus.scrape_interval_s);
+        config.monitoring.prometheus.write_amp_window_s = prom["write_amp_window_s"].as<uint32_t>(config.monitoring.prometheus.write_amp_window_s);
+    }
+
+    if (yaml["monitoring"] && yaml["monitoring"]["tracing"]) {
+        auto tr = yaml["monitoring"]["tracing"];
+        config.monitoring.tracing.enabled = tr["enabled"].as<bool>(config.monitoring.tracing.enabled);
+        config.monitoring.tracing.sample_rate = tr["sample_rate"].as<double>(config.monitoring.tracing.sample_rate);
+        config.monitoring.tracing.slow_query_ms = tr["slow_query_ms"].as<uint32_t>(config.monitoring.tracing.slow_query_ms);
+        config.monitoring.tracing.keep = tr["keep"].as<uint32_t>(config.monitoring.tracing.keep);
+    }
+
+    if (yaml["monitoring"] && yaml["monitoring"]["recall"]) {
+        auto rc = yaml["monitoring"]["recall"];
+        config.monitoring.recall.enabled = rc["enabled"].as<bool>(config.monitoring.recall.enabled);
+        config.monitoring.recall.sample_rate = rc["sample_rate"].as<double>(config.monitoring.recall.sample_rate);
+        config.monitoring.recall.queue = rc["queue"].as<uint32_t>(config.monitoring.recall.queue);
+        config.monitoring.recall.min_interval_ms = rc["min_interval_ms"].as<uint32_t>(config.monitoring.recall.min_interval_ms);
+        config.monitoring.recall.window_s = rc["window_s"].as<uint32_t>(config.monitoring.recall.window_s);
+    }
+
+    // Logging config
+    if (yaml["logging"]) {
+        auto log = yaml["logging"];
+        config.logging.level = log["level"].as<std::string>(config.logging.level);
+        config.logging.file = log["file"].as<std::string>(config.logging.file);
+        config.logging.max_size_mb = log["max_size_mb"].as<uint32_t>(config.logging.max_size_mb);
+        config.logging.max_files = log["max_files"].as<uint32_t>(config.logging.max_files);
+        config.logging.console = log["console"].as<bool>(config.logging.console);
+        config.logging.structured = log["structured"].as<bool>(config.logging.structured);
+        config.logging.async = log["async"].as<bool>(config.logging.async);
+        config.logging.async_queue = log["async_queue"].as<uint32_t>(config.logging.async_queue);
+        config.logging.rate_limit_per_s = log["rate_limit_per_s"].as<uint32_t>(config.logging.rate_limit_per_s);
+    }
+
+    // Limits config
+    if (yaml["limits"]) {
+        auto lim = yaml["limits"];
+        config.limits.max_upsert_batch = lim["max_upsert_batch"].as<uint32_t>(config.limits.max_upsert_batch);
+        config.limits.max_query_batch = lim["max_query_batch"].as<uint32_t>(config.limits.max_query_batch);
+        config.limits.max_request_size_bytes = lim["max_request_size_bytes"].as<uint64_t>(config.limits.max_request_size_bytes);
+        config.limits.max_memory_gb = lim["max_memory_gb"].as<uint32_t>(config.limits.max_memory_gb);
+        config.limits.max_cpu_percent = lim["max_cpu_percent"].as<uint32_t>(config.limits.max_cpu_percent);
+        config.limits.max_disk_usage_percent = lim["max_disk_usage_percent"].as<uint32_t>(config.limits.max_disk_usage_percent);
+    }
+
+    if (yaml["limits"] && yaml["limits"]["memory"]) {
+        auto mem = yaml["limits"]["memory"];
+        config.limits.memory.enabled = mem["enabled"].as<bool>(config.limits.memory.enabled);
+        config.limits.memory.headroom = mem["headroom"].as<float>(config.limits.memory.headroom);
+        config.limits.memory.pressure = mem["pressure"].as<float>(config.limits.memory.pressure);
+        config.limits.memory.relief = mem["relief"].as<float>(config.limits.memory.relief);
+        config.limits.memory.interval_ms = mem["interval_ms"].as<uint32_t>(config.limits.memory.interval_ms);
+        config.limits.memory.restore_s = mem["restore_s"].as<uint32_t>(config.limits.memory.restore_s);
+    }
+
+    // Recovery config
+    if (yaml["recovery"]) {
+        auto rec = yaml["recovery"];
+        config.recovery.checkpoint_interval_s = rec["checkpoint_interval_s"].as<uint32_t>(config.recovery.checkpoint_interval_s);
+        config.recovery.max_recovery_time_s = rec["max_recovery_time_s"].as<uint32_t>(config.recovery.max_recovery_time_s);
+        config.recovery.parallel_recovery_threads = rec["parallel_recovery_threads"].as<uint32_t>(config.recovery.parallel_recovery_threads);
+        config.recovery.verify_checksums = rec["verify_checksums"].as<bool>(config.recovery.verify_checksums);
+        config.recovery.verify_bandwidth_mbps = rec["verify_bandwidth_mbps"].as<uint32_t>(config.recovery.verify_bandwidth_mbps);
+        config.recovery.checkpoint_full_every = rec["checkpoint_full_every"].as<uint32_t>(config.recovery.checkpoint_full_every);
+    }
+}
+
+// Fields a reload applies: each has a subsystem hook that changes it in
+// place (see config.h). The rest wait for a restart.
+struct LiveField {
+    const char* name;
+    bool (*differs)(const Config& a, const Config& b);
+    void (*copy)(const Config& from, Config& to);
+};
+
+#define WOVED_LIVE_FIELD(field)                                                   \
+    LiveField {                                                                   \
+        #field, [](const Config& a, const Config& b) { return a.field != b.field; }, \
+            [](const Config& from, Config& to) { to.field = from.field; }         \
+    }
+
+const LiveField kLiveFields[] = {
+    WOVED_LIVE_FIELD(tuning.recall_target),
+    WOVED_LIVE_FIELD(tuning.nprobe_delta_min),
+    WOVED_LIVE_FIELD(tuning.nprobe_delta_max),
+    WOVED_LIVE_FIELD(tuning.nprobe_stable_min),
+    WOVED_LIVE_FIELD(tuning.nprobe_stable_max),
+    WOVED_LIVE_FIELD(tuning.decision_window_hours),
+    WOVED_LIVE_FIELD(tuning.min_samples),
+    WOVED_LIVE_FIELD(filtering.bitmap_cache_bytes),
+    WOVED_LIVE_FIELD(storage.btree.node_cache_mb),
+    WOVED_LIVE_FIELD(storage.buffer.flush_interval_ms),
+    WOVED_LIVE_FIELD(storage.buffer.flush_threshold_bytes),
+    WOVED_LIVE_FIELD(storage.buffer.max_flush_lag_ms),
+    WOVED_LIVE_FIELD(storage.buffer.flush_bandwidth_mbps),
+    WOVED_LIVE_FIELD(storage.segment.merge_bandwidth_limit),
+    WOVED_LIVE_FIELD(io.merge_bandwidth_limit_mbps),
+    WOVED_LIVE_FIELD(io.device_bandwidth_mbps),
+    WOVED_LIVE_FIELD(io.target_utilization),
+    WOVED_LIVE_FIELD(io.query_p99_target_ms),
+};
+
+#undef WOVED_LIVE_FIELD
+
+// Where a file differs from the running config beyond the live fields
+struct Section {
+    const char* name;
+    bool (*differs)(const Config& a, const Config& b);
+};
+
+#define WOVED_SECTION(section) \
+    Section { #section, [](const Config& a, const Config& b) { return a.section != b.section; } }
+
+const Section kSections[] = {
+    WOVED_SECTION(server),
+    WOVED_SECTION(cluster),
+    WOVED_SECTION(collection),
+    Section{"storage",
+            [](const Config& a, const Config& b) {
+                auto dirs = [](const StorageConfig& s) {
+                    return std::tie(s.data_dir, s.wal_dir, s.wal_dirs, s.segment_dir, s.segment_dirs);
+                };
+                return dirs(a.storage) != dirs(b.storage);
+            }},
+    WOVED_SECTION(storage.btree),
+    WOVED_SECTION(storage.buffer),
+    WOVED_SECTION(storage.wal),
+    WOVED_SECTION(storage.segment),
+    WOVED_SECTION(storage.cold),
+    WOVED_SECTION(storage.manifest),
+    WOVED_SECTION(index),
+    WOVED_SECTION(filtering),
+    WOVED_SECTION(query),
+    WOVED_SECTION(tuning),
+    WOVED_SECTION(io),
+    WOVED_SECTION(numa),
+    WOVED_SECTION(monitoring),
+    WOVED_SECTION(limits),
+    WOVED_SECTION(recovery),
+    WOVED_SECTION(experimental),
+    WOVED_SECTION(logging),
+};
+
+#undef WOVED_SECTION
+
+std::atomic<std::shared_ptr<const Config>> g_snapshot{std::make_shared<const Config>()};
+std::atomic<uint64_t> g_generation{0};
+
+std::mutex g_reload_mutex;  // Serializes reloads and their listeners
+std::string g_config_path;  // Under g_reload_mutex
+
+std::mutex g_listeners_mutex;
+std::vector<std::pair<uint64_t, std::shared_ptr<const ConfigListener>>> g_listeners;
+uint64_t g_next_listener = 1;
+thread_local bool t_in_listener = false;
+
+void publishConfig(const Config& config, const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_reload_mutex);
+    g_config_path = path;
+    g_snapshot.store(std::make_shared<const Config>(config), std::memory_order_release);
+    g_generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+std::string join(const std::vector<std::string>& names) {
+    std::string out;
+    for (const auto& name : names) {
+        if (!out.empty()) out += ", ";
+        out += name;
+    }
+    return out;
+}
+
+} // namespace
+
+bool loadConfig(const std::string& path) {
+    try {
+        YAML::Node yaml = YAML::LoadFile(path);
+        parseConfig(yaml, g_config);
+
         // Apply defaults for any missing values
         applyDefaults(g_config);
         
-        return validateConfig(g_config);
+        if (!validateConfig(g_config)) return false;
+        publishConfig(g_config, path);
+        return true;
         
     } catch (const std::exception& e) {
         std::cerr << "Failed to load config: " << e.what() << std::endl;
@@ -72,4 +514,92 @@ void applyDefaults(Config& config) {
 }
 
 
-} // namespace woved
\ No newline at end of file
+ConfigSnapshot currentConfig() {
+    return g_snapshot.load(std::memory_order_acquire);
+}
+
+uint64_t configGeneration() {
+    return g_generation.load(std::memory_order_acquire);
+}
+
+ConfigReload reloadConfig(const std::string& path) {
+    std::lock_guard<std::mutex> reload_lock(g_reload_mutex);
+    ConfigReload result;
+    const std::string file = path.empty() ? g_config_path : path;
+    const ConfigSnapshot before = currentConfig();
+
+    // A fresh parse: keys removed from the file go back to their defaults
+    Config parsed;
+    try {
+        if (file.empty()) throw std::runtime_error("no config file was loaded");
+        parseConfig(YAML::LoadFile(file), parsed);
+        applyDefaults(parsed);
+        if (!validateConfig(parsed)) throw std::runtime_error("invalid configuration");
+    } catch (const std::exception& e) {
+        result.error = file + ": " + e.what();
+        result.generation = g_generation.load(std::memory_order_acquire);
+        LOG_WARN("config reload rejected, keeping generation {}: {}", result.generation, result.error);
+        return result;
+    }
+
+    Config next = *before;
+    for (const LiveField& field : kLiveFields) {
+        if (!field.differs(parsed, next)) continue;
+        field.copy(parsed, next);
+        result.changed.emplace_back(field.name);
+    }
+    for (const Section& section : kSections) {
+        if (section.differs(parsed, next)) result.restart.emplace_back(section.name);
+    }
+    result.ok = true;
+    if (!result.restart.empty()) {
+        LOG_WARN("config reload: {} changed in {} but take effect at restart", join(result.restart), file);
+    }
+    if (result.changed.empty()) {
+        result.generation = g_generation.load(std::memory_order_acquire);
+        LOG_INFO("config reload: nothing live changed in {}", file);
+        return result;
+    }
+
+    const auto after = std::make_shared<const Config>(std::move(next));
+    g_snapshot.store(after, std::memory_order_release);
+    result.generation = g_generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    LOG_INFO("config reload: generation {} from {}: {}", result.generation, file, join(result.changed));
+
+    // Outside their lock, so a listener may subscribe or unsubscribe others
+    std::vector<std::shared_ptr<const ConfigListener>> listeners;
+    {
+        std::lock_guard<std::mutex> lock(g_listeners_mutex);
+        for (const auto& [handle, listener] : g_listeners) listeners.push_back(listener);
+    }
+    t_in_listener = true;
+    for (const auto& listener : listeners) {
+        try {
+            (*listener)(*before, *after);
+        } catch (const std::exception& e) {
+            LOG_WARN("config reload: a subscriber failed to apply generation {}: {}", result.generation, e.what());
+        }
+    }
+    t_in_listener = false;
+    return result;
+}
+
+uint64_t subscribeConfig(ConfigListener listener) {
+    std::lock_guard<std::mutex> lock(g_listeners_mutex);
+    const uint64_t handle = g_next_listener++;
+    g_listeners.emplace_back(handle, std::make_shared<const ConfigListener>(std::move(listener)));
+    return handle;
+}
+
+void unsubscribeConfig(uint64_t handle) {
+    {
+        std::lock_guard<std::mutex> lock(g_listeners_mutex);
+        std::erase_if(g_listeners, [&](const auto& entry) { return entry.first == handle; });
+    }
+    // Wait out a reload that may still be calling it, unless this is one
+    if (!t_in_listener) {
+        std::lock_guard<std::mutex> reload_lock(g_reload_mutex);
+    }
+}
+
+} // namespace woved
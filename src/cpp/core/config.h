@@ -2,6 +2,10 @@
 
 #include <string>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
 
 namespace woved {
 
@@ -13,6 +17,34 @@ struct ServerConfig {
     uint16_t metrics_port = 9091;
     uint32_t max_connections = 1000;
     uint32_t worker_threads = 0;  // 0 = auto-detect
+    uint32_t grpc_queues = 0;     // gRPC completion queues, one poller each; 0 = one per core
+    uint32_t http_threads = 0;    // HTTP event loops, one listener each; 0 = one per core
+    bool operator==(const ServerConfig&) const = default;
+};
+
+// Coordinator mode: the collection hash-partitioned by id_hash over shard
+// nodes (api::Coordinator)
+struct ClusterConfig {
+    std::string mode = "standalone";   // standalone, coordinator
+    // Per shard, in partition order: its nodes' gRPC addresses,
+    // comma-separated, the one taking writes first
+    std::vector<std::string> shards;
+    uint32_t hedge_after_ms = 0;       // Ask a second replica after this long; 0 = the shard's hedge_quantile latency
+    float hedge_quantile = 0.95f;
+    uint32_t write_timeout_ms = 30000;
+    bool allow_partial = true;         // Searches answer without failed shards, marked partial
+    // WAL-shipping read replicas (ReplicationServer, ReplicaFollower)
+    struct ReplicationConfig {
+        std::string role = "none";         // none, leader, follower
+        uint32_t port = 9092;              // Leader: ReplicationService port
+        std::string leader;                // Follower: the leader's host:port
+        uint32_t poll_ms = 10;             // Leader: log poll once caught up
+        uint32_t batch_bytes = 4194304;    // Per WAL shipment
+        uint32_t manifest_poll_ms = 1000;  // Follower: segment sync cadence
+        uint32_t max_staleness_ms = 5000;  // Follower: reads fail once further behind
+        bool operator==(const ReplicationConfig&) const = default;
+    } replication;
+    bool operator==(const ClusterConfig&) const = default;
 };
 
 struct CollectionConfig {
@@ -20,24 +52,48 @@ struct CollectionConfig {
     std::string metric = "inner_product";  // cosine via normalization
     uint64_t max_vectors = 100000000;  // 100M
     std::string id_type = "uuidv7";
+    std::string element_type = "fp32";  // fp32, fp16, bf16, int8 (per-vector scale)
+    bool operator==(const CollectionConfig&) const = default;
 };
 
 struct BTreeConfig {
     float epsilon = 0.5f;
+    float min_epsilon = 0.2f;  // Per-partition range with adaptive_epsilon
+    float max_epsilon = 0.9f;
     size_t node_size_kb = 64;
     size_t fanout = 256;
     bool adaptive_epsilon = true;
     float hot_partition_threshold = 0.5f;
-    float direct_flush_threshold = 0.8f;
+    float direct_flush_threshold = 0.8f;  // Leaf share of a flush batch written straight to a delta segment
+    uint64_t direct_flush_min_bytes = 33554432;  // 32 MiB; smaller leaves always go through the tree
+    bool parallel_flush = true;  // Flush children and subtrees concurrently
+    uint32_t flush_threads = 0;  // Tree flush pool (0 = one per hardware thread)
+    uint32_t node_cache_mb = 512;  // Node page cache, apart from the centroids
+    uint32_t node_cache_protected_level = 1;  // Node levels flush traffic cannot evict (0 = off)
+    bool operator==(const BTreeConfig&) const = default;
 };
 
 struct BufferConfig {
     std::string type = "nvm";  // nvm, mmap, memory
+    std::string path;  // Pool file for nvm/mmap (empty = <data_dir>/buffer.pool)
     uint64_t size_bytes = 17179869184;  // 16 GiB
     uint32_t shard_count = 16;
+    std::string shard_affinity = "hash";  // hash, core, numa
     uint64_t flush_threshold_bytes = 134217728;  // 128 MiB (Lmax)
     uint32_t flush_interval_ms = 100;
+    uint32_t flush_threads = 2;  // Dedicated flush workers
+    uint32_t max_flush_lag_ms = 5000;  // Leaves older than this flush regardless of size (0 = off)
+    uint32_t flush_bandwidth_mbps = 0;  // Flush write cap (0 = unlimited)
     bool dedupe_enabled = true;
+    bool dedupe_id_index = true;  // Keep VectorId strings in latest_by_id (false = hash only)
+    bool arena_enabled = false;  // Slab-backed fixed-stride records
+    uint64_t arena_slab_bytes = 4194304;  // 4 MiB per slab
+    bool staged_append = false;  // Per-thread staging, batched publish
+    uint32_t staging_batch = 64;
+    uint64_t soft_watermark_bytes = 0;  // 0 = flush_threshold_bytes
+    uint64_t hard_watermark_bytes = 0;  // 0 = size_bytes
+    bool durable_ack = false;  // nvm: acknowledge writes once persisted in the buffer, bypassing the WAL
+    bool operator==(const BufferConfig&) const = default;
 };
 
 struct WALConfig {
@@ -46,9 +102,17 @@ struct WALConfig {
     uint32_t group_commit_ms = 8;
     uint32_t fence_every_ms = 5;
     uint32_t fsync_every_fences = 50;
+    bool direct_io = true;  // O_DIRECT log files, units padded to 4 KiB blocks
+    uint64_t unit_bytes = 4194304;  // Group commit buffer unit; caps one record
     uint64_t rotate_bytes = 3221225472;  // 3 GiB
+    bool preallocate = true;  // Rotate into fallocated, zero-filled spares
+    uint32_t pool_files = 2;  // Spares kept ready, refilled from truncated logs
+    std::string stream_sharding = "id_hash";  // Across wal_dirs: id_hash or tenant
     uint32_t max_files = 10;
     std::string compression = "none";  // none, lz4, zstd
+    int compression_level = 3;         // zstd level
+    uint32_t dict_bytes = 65536;       // Trained zstd dictionary, 0 disables
+    bool operator==(const WALConfig&) const = default;
 };
 
 struct SegmentConfig {
@@ -56,29 +120,55 @@ struct SegmentConfig {
     uint32_t max_segments_per_leaf = 8;
     float tombstone_ratio_threshold = 0.2f;
     float merge_bandwidth_limit = 0.3f;  // 30% of device bandwidth
-    bool enable_compression = false;
+    bool enable_compression = false;   // Metadata columns only; vectors and codes stay raw
     std::string compression_type = "zstd";
+    int compression_level = 3;
+    uint32_t dict_bytes = 65536;       // Trained per segment, 0 disables
+    bool operator==(const SegmentConfig&) const = default;
+};
+
+struct ColdTierConfig {
+    std::string store_dir;          // Object store mount (e.g. an S3 bucket); empty = no cold tier
+    uint32_t cache_mb = 4096;       // Local chunk cache for cold segments
+    uint32_t chunk_kb = 1024;       // Range GET and cache unit
+    uint32_t idle_hours = 336;      // Unread this long before a stable segment goes cold
+    bool operator==(const ColdTierConfig&) const = default;
+};
+
+struct ManifestConfig {
+    uint32_t snapshot_edits = 4096;  // Edits appended before the log is compacted into a snapshot
+    uint32_t snapshot_mb = 64;       // Log size that forces a snapshot
+    bool operator==(const ManifestConfig&) const = default;
 };
 
 struct StorageConfig {
     std::string data_dir = "/var/lib/woved";
     std::string wal_dir = "/var/lib/woved/wal";
+    std::vector<std::string> wal_dirs;  // One WAL stream each (one per device); empty = wal_dir
     std::string segment_dir = "/var/lib/woved/segments";
+    std::vector<std::string> segment_dirs;  // One per data device; empty = segment_dir
     
     BTreeConfig btree;
     BufferConfig buffer;
     WALConfig wal;
     SegmentConfig segment;
+    ColdTierConfig cold;
+    ManifestConfig manifest;
+    bool operator==(const StorageConfig&) const = default;
 };
 
 struct DeltaIndexConfig {
     std::string type = "ivf_flat";
     uint32_t nlist = 1024;
     uint32_t nprobe = 6;
-    float sample_p = 0.25f;
+    float sample_p = 0.25f;           // Least share of a list an adaptive scan visits
+    bool sort_by_norm = false;        // Inner product: rows of a list by decreasing norm (raw MIPS data only)
+    bool tenant_partitioned = false;  // Rows of a list grouped by tenant, with a directory
+    uint64_t dedicated_tenant_rows = 0;  // A tenant with this many rows in a flush gets its own segment; 0: never
     uint32_t list_cap = 2000;
     bool global_centroids = true;
     uint32_t rebuild_interval_hours = 24;
+    bool operator==(const DeltaIndexConfig&) const = default;
 };
 
 struct StableIndexConfig {
@@ -88,15 +178,22 @@ struct StableIndexConfig {
         uint32_t m = 96;
         uint32_t nbits = 8;
         bool use_opq = true;
+        bool fast_scan = false;  // 4-bit fast-scan codes; needs nbits = 4
+        bool operator==(const PQConfig&) const = default;
     } pq;
     uint32_t nprobe = 12;
     uint32_t rerank_factor = 4;
+    bool operator==(const StableIndexConfig&) const = default;
 };
 
 struct GlobalIndexConfig {
     std::string type = "ivf";
     uint32_t nlist = 1024;
     uint32_t memory_cache_mb = 512;
+    uint32_t hnsw_m = 16;                 // Centroid graph links (type hnsw)
+    uint32_t hnsw_ef_construction = 200;
+    uint32_t hnsw_ef = 64;
+    bool operator==(const GlobalIndexConfig&) const = default;
 };
 
 struct HNSWCacheConfig {
@@ -105,6 +202,10 @@ struct HNSWCacheConfig {
     uint32_t m = 16;
     uint32_t ef_construction = 200;
     uint32_t ef = 50;
+    uint32_t admit_hits = 3;        // Top-k appearances before a vector is cached
+    float answer_recall = 0.95f;    // Estimated recall to answer from the cache alone
+    uint32_t verify_every = 16;     // Every nth query still runs the full search
+    bool operator==(const HNSWCacheConfig&) const = default;
 };
 
 struct IndexConfig {
@@ -112,6 +213,7 @@ struct IndexConfig {
     StableIndexConfig stable;
     GlobalIndexConfig global;
     HNSWCacheConfig hnsw_cache;
+    bool operator==(const IndexConfig&) const = default;
 };
 
 struct FilteringConfig {
@@ -122,6 +224,10 @@ struct FilteringConfig {
     uint32_t tag_dict_size = 50000;
     uint32_t max_tags_per_vector = 16;
     float dense_bitmap_threshold = 0.2f;
+    float prefilter_selectivity = 0.01f;   // At or under: brute force over the filter bitmap
+    float widen_selectivity = 0.25f;       // Under: widen nprobe for filtered-out candidates
+    uint32_t max_nprobe_widen = 8;         // Widening factor cap
+    bool operator==(const FilteringConfig&) const = default;
 };
 
 struct QueryConfig {
@@ -132,7 +238,17 @@ struct QueryConfig {
     bool two_phase_enabled = true;
     bool buffer_scan_enabled = true;
     bool prefetch_enabled = true;
-    uint32_t prefetch_depth = 2;
+    uint32_t prefetch_depth = 2;          // Stable lists loaded ahead of the scan
+    uint32_t prefetch_threads = 2;        // Threads loading them, shared by all queries
+    uint32_t executor_threads = 0;        // Coroutine query drivers (io::CoroExecutor); 0: off
+    uint32_t executor_max_in_flight = 4096;  // Queries a driver holds at once
+    bool result_cache_enabled = false;    // Serve repeats of recent queries
+    uint32_t result_cache_entries = 100000;
+    float result_cache_similarity = 0.999f;  // Cosine at which two queries count as the same
+    uint32_t latency_budget_ms = 0;       // Deadline of a query that sends none; 0: unbudgeted
+    float deadline_headroom = 0.8f;       // Share of the deadline the predicted latency may fill
+    bool deadline_drop_buffer = false;    // Last resort: skip the buffer scan to meet a deadline
+    bool operator==(const QueryConfig&) const = default;
 };
 
 struct TuningConfig {
@@ -144,35 +260,70 @@ struct TuningConfig {
     uint32_t nprobe_stable_max = 16;
     bool persist_decisions = true;
     uint32_t decision_window_hours = 1;
+    float shadow_sample_rate = 0.01f;     // Share of queries rerun over every list
+    uint32_t min_samples = 64;            // Sampled queries before a decision
+    bool operator==(const TuningConfig&) const = default;
 };
 
 struct IOConfig {
     bool use_iouring = true;
     struct IOUringConfig {
         bool sqpoll = true;
+        int sqpoll_cpu = -1;  // Poller thread CPU; -1 = unpinned
         uint32_t queue_depth = 32;
         bool register_files = true;
         uint32_t link_timeout_ms = 5;
+        bool operator==(const IOUringConfig&) const = default;
     } iouring;
     bool use_direct_io = false;
+    std::string delta_read_mode = "auto";   // Segment reads per tier: mmap, direct, auto
+    std::string stable_read_mode = "auto";  // auto = direct when use_direct_io
+    bool segment_huge_pages = true;  // MADV_HUGEPAGE on mapped segments
     uint32_t prefetch_distance = 4;
     uint32_t merge_bandwidth_limit_mbps = 500;
     uint32_t read_ahead_kb = 8192;
+    uint32_t device_bandwidth_mbps = 0;   // 0: merge_bandwidth_limit_mbps / storage.segment.merge_bandwidth_limit
+    float target_utilization = 0.9f;      // Share of the device all classes together may use
+    uint32_t query_p99_target_ms = 20;    // Background I/O backs off above it; 0: bandwidth only
+    uint32_t buffer_pool_mb = 64;         // Aligned direct I/O buffers, split across NUMA nodes
+    bool buffer_pool_huge_pages = true;
+    bool operator==(const IOConfig&) const = default;
 };
 
 struct NUMAConfig {
     bool enabled = true;
     bool bind_threads = true;
     bool replicate_centroids = true;
-    std::string memory_policy = "interleave";  // bind, interleave, preferred
+    std::string memory_policy = "interleave";  // Message buffer: local, bind, interleave, preferred
+    bool operator==(const NUMAConfig&) const = default;
 };
 
 struct MonitoringConfig {
     struct PrometheusConfig {
-        bool enabled = true;
+        bool enabled = true;              // Serve /metrics on server.metrics_port
         uint32_t scrape_interval_s = 15;
+        uint32_t write_amp_window_s = 300;  // Window of woved_write_amplification
+        bool operator==(const PrometheusConfig&) const = default;
     } prometheus;
+    // Per-query timelines at /debug/traces (QueryTracer)
+    struct TracingConfig {
+        bool enabled = false;
+        double sample_rate = 0.001;
+        uint32_t slow_query_ms = 100;     // Also trace every query this slow; 0 = off
+        uint32_t keep = 256;              // Most recent traces kept
+        bool operator==(const TracingConfig&) const = default;
+    } tracing;
+    // woved_recall_estimate: sampled queries replayed exhaustively (RecallEstimator)
+    struct RecallConfig {
+        bool enabled = true;
+        double sample_rate = 0.0005;
+        uint32_t queue = 8;               // Sampled queries waiting; more are dropped
+        uint32_t min_interval_ms = 1000;  // Between replays
+        uint32_t window_s = 900;          // Recall is averaged over about this long
+        bool operator==(const RecallConfig&) const = default;
+    } recall;
     // Metrics list would be handled separately
+    bool operator==(const MonitoringConfig&) const = default;
 };
 
 struct LimitsConfig {
@@ -182,6 +333,17 @@ struct LimitsConfig {
     uint32_t max_memory_gb = 64;
     uint32_t max_cpu_percent = 85;
     uint32_t max_disk_usage_percent = 90;
+    // Per-subsystem budgets within max_memory_gb (MemoryGovernor)
+    struct MemoryConfig {
+        bool enabled = true;
+        float headroom = 0.15f;        // Of max_memory_gb outside every budget (heap, stacks, reads)
+        float pressure = 0.9f;         // Resident share of max_memory_gb that shrinks the caches
+        float relief = 0.8f;           // Resident share they are shrunk toward
+        uint32_t interval_ms = 500;    // Between resident size checks
+        uint32_t restore_s = 60;       // Calm time before shrunk budgets grow back
+        bool operator==(const MemoryConfig&) const = default;
+    } memory;
+    bool operator==(const LimitsConfig&) const = default;
 };
 
 struct RecoveryConfig {
@@ -189,15 +351,25 @@ struct RecoveryConfig {
     uint32_t max_recovery_time_s = 30;
     uint32_t parallel_recovery_threads = 4;
     bool verify_checksums = true;
+    uint32_t verify_bandwidth_mbps = 200;  // Background segment verification after restart; 0 = unlimited
+    uint32_t checkpoint_full_every = 16;  // Incremental tree checkpoints between full ones
+    bool operator==(const RecoveryConfig&) const = default;
 };
 
 struct ExperimentalConfig {
     bool gpu_acceleration = false;
     uint32_t gpu_device_id = 0;
+    uint32_t gpu_min_batch = 64;  // Query batches smaller than this search on the CPU
+    uint64_t gpu_staging_bytes = 67108864;  // 64 MiB pinned host buffer
+    uint32_t gpu_cached_segments = 8;  // Stable segments kept resident on the device
     bool learned_index = false;
+    uint32_t router_min_segments = 16;  // Fewer segments: every one is searched
+    float router_recall_target = 0.99f;  // Share of contributing segments the router must keep
+    uint32_t router_explore_every = 32;  // Every n-th query probes all segments to train
     bool adaptive_sampling = true;
-    bool connectivity_aware_layout = true;
-    bool vector_compression = false;
+    bool connectivity_aware_layout = true;  // Delta rows by list, stable list rows by proximity per page
+    bool vector_compression = false;  // SQ8 copy of delta vectors, resident for scans
+    bool operator==(const ExperimentalConfig&) const = default;
 };
 
 struct LoggingConfig {
@@ -207,11 +379,16 @@ struct LoggingConfig {
     uint32_t max_files = 10;
     bool console = true;
     bool structured = true;
+    bool async = true;                // Format and write on a background thread
+    uint32_t async_queue = 8192;      // Ring slots; messages past a full ring are dropped
+    uint32_t rate_limit_per_s = 50;   // Per call site; 0 = unlimited
+    bool operator==(const LoggingConfig&) const = default;
 };
 
 // Main configuration structure
 struct Config {
     ServerConfig server;
+    ClusterConfig cluster;
     CollectionConfig collection;
     StorageConfig storage;
     IndexConfig index;
@@ -228,9 +405,11 @@ struct Config {
     
     // Version info
     std::string version = "1.0";
+    bool operator==(const Config&) const = default;
 };
 
-// Global configuration instance
+// Global configuration instance, as loadConfig() read it. Reloads leave it
+// alone; code running after startup reads currentConfig().
 extern Config g_config;
 
 // Configuration loading from YAML
@@ -238,4 +417,58 @@ bool loadConfig(const std::string& path);
 bool validateConfig(const Config& config);
 void applyDefaults(Config& config);
 
+// Hot reload (SIGHUP via ConfigReloader, POST /admin/config/reload).
+//
+// loadConfig() publishes g_config as the first immutable snapshot.
+// reloadConfig() reads the file again and publishes a new snapshot that
+// takes from it only the live fields (kLiveFields in config.cpp: tuning
+// bounds, cache sizes, flush cadence, I/O rates); everything else keeps
+// its running value until a restart, and the sections where the file
+// differs are reported. Subscribers then run on the reloading thread, in
+// subscription order, with the snapshots before and after, and apply what
+// they read in place:
+//   tuning.*                             NprobeTuner::reconfigure
+//   filtering.bitmap_cache_bytes         MemoryGovernor::setWanted("bitmaps"), or BitmapCache::setCapacity
+//   storage.btree.node_cache_mb          MemoryGovernor::setWanted("nodes"), or NodeCache::setBudget
+//   storage.buffer.flush_*, max_flush_lag_ms
+//                                        FlushScheduler::reconfigure
+//   io.*, storage.segment.merge_bandwidth_limit
+//                                        IOManager::reconfigure
+using ConfigSnapshot = std::shared_ptr<const Config>;
+
+// The published snapshot; lock-free. Default values before loadConfig().
+ConfigSnapshot currentConfig();
+// Snapshots published so far (woved_config_generation)
+uint64_t configGeneration();
+
+struct ConfigReload {
+    bool ok = false;                   // false: the file was rejected, nothing changed
+    std::string error;
+    uint64_t generation = 0;           // Snapshots published so far
+    std::vector<std::string> changed;  // Live fields applied
+    std::vector<std::string> restart;  // Sections that differ in the file and need a restart
+};
+
+// Read `path` (empty: the file loadConfig() read) and publish what it
+// changes. Reloads are serialized; an unreadable or invalid file leaves
+// the running snapshot in place. Must not be called from a listener.
+ConfigReload reloadConfig(const std::string& path = {});
+
+using ConfigListener = std::function<void(const Config& before, const Config& after)>;
+
+// Run `listener` after every reload that publishes a snapshot. A listener
+// that throws is logged and the rest still run. Returns a handle for
+// unsubscribeConfig(); once that returns, the listener is not called again.
+uint64_t subscribeConfig(ConfigListener listener);
+void unsubscribeConfig(uint64_t handle);
+
+// Subscribe to part of the config: `apply(after)` runs when get(before)
+// and get(after) differ. `get` returns a field, or std::tie of several.
+template <typename Get, typename Apply>
+uint64_t watchConfig(Get get, Apply apply) {
+    return subscribeConfig([get = std::move(get), apply = std::move(apply)](const Config& before, const Config& after) {
+        if (!(get(before) == get(after))) apply(after);
+    });
+}
+
 } // namespace woved
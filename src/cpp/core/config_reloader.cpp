@@ -0,0 +1,135 @@
+#include "config_reloader.h"
+#include "core/config.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace woved {
+
+namespace {
+
+constexpr char kReload = 'r';
+constexpr char kStop = 's';
+
+// Write end of the running reloader's pipe; -1 when none runs
+std::atomic<int> g_signal_fd{-1};
+
+void onSighup(int) {
+    const int saved = errno;
+    const int fd = g_signal_fd.load(std::memory_order_relaxed);
+    // A full pipe already holds a pending reload
+    if (fd >= 0) (void)!::write(fd, &kReload, 1);
+    errno = saved;
+}
+
+} // namespace
+
+ConfigReloader::ConfigReloader(std::string path) : path_(std::move(path)) {}
+
+ConfigReloader::~ConfigReloader() {
+    stop();
+}
+
+void ConfigReloader::start() {
+    if (running_) return;
+    if (::pipe2(pipe_, O_CLOEXEC | O_NONBLOCK) != 0) {
+        throw util::IOException(std::string("config reloader: pipe: ") + std::strerror(errno));
+    }
+    int expected = -1;
+    if (!g_signal_fd.compare_exchange_strong(expected, pipe_[1])) {
+        ::close(pipe_[0]);
+        ::close(pipe_[1]);
+        pipe_[0] = pipe_[1] = -1;
+        throw util::IOException("config reloader: another reloader is running");
+    }
+
+    struct sigaction action {};
+    action.sa_handler = onSighup;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (::sigaction(SIGHUP, &action, &previous_) != 0) {
+        const int error = errno;
+        g_signal_fd.store(-1);
+        ::close(pipe_[0]);
+        ::close(pipe_[1]);
+        pipe_[0] = pipe_[1] = -1;
+        throw util::IOException(std::string("config reloader: cannot install the SIGHUP handler: ") +
+                                std::strerror(error));
+    }
+    running_ = true;
+    thread_ = std::thread([this] { loop(); });
+    LOG_INFO("config reloader: SIGHUP reloads {}", path_.empty() ? "the loaded config" : path_);
+}
+
+void ConfigReloader::stop() {
+    if (!running_) return;
+    ::sigaction(SIGHUP, &previous_, nullptr);
+    g_signal_fd.store(-1);
+    // The pipe may be full of reloads; the stop byte must get through
+    while (::write(pipe_[1], &kStop, 1) < 0 && (errno == EINTR || errno == EAGAIN)) {
+        pollfd pfd{pipe_[1], POLLOUT, 0};
+        ::poll(&pfd, 1, 10);
+    }
+    thread_.join();
+    ::close(pipe_[0]);
+    ::close(pipe_[1]);
+    pipe_[0] = pipe_[1] = -1;
+    running_ = false;
+}
+
+void ConfigReloader::loop() {
+    char bytes[64];
+    while (true) {
+        pollfd pfd{pipe_[0], POLLIN, 0};
+        if (::poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("config reloader: poll: {}", std::strerror(errno));
+            return;
+        }
+        // Drain: every signal pending now is served by one reload
+        size_t signals = 0;
+        bool stopping = false;
+        ssize_t n;
+        while ((n = ::read(pipe_[0], bytes, sizeof(bytes))) > 0 || (n < 0 && errno == EINTR)) {
+            for (ssize_t i = 0; i < n; ++i) {
+                if (bytes[i] == kStop) stopping = true;
+                signals += bytes[i] == kReload;
+            }
+        }
+        if (stopping) return;
+        if (signals == 0) continue;
+
+        LOG_INFO("config reloader: SIGHUP, reloading");
+        const ConfigReload result = reloadConfig(path_);
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.signals += signals;
+        if (!result.ok) {
+            stats_.rejected++;
+        } else if (result.changed.empty()) {
+            stats_.unchanged++;
+        } else {
+            stats_.reloads++;
+        }
+    }
+}
+
+ConfigReloader::Stats ConfigReloader::getStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+std::vector<std::pair<std::string_view, double>> ConfigReloader::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_config_generation", static_cast<double>(configGeneration())},
+        {"woved_config_reloads", static_cast<double>(stats.reloads)},
+        {"woved_config_reloads_rejected", static_cast<double>(stats.rejected)},
+        {"woved_config_signals", static_cast<double>(stats.signals)},
+    };
+}
+
+} // namespace woved
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace woved {
+
+// Reloads the config on SIGHUP, as POST /admin/config/reload does
+// (reloadConfig() in core/config.h).
+//
+// The signal handler only writes a byte to a pipe; the reload and the
+// subscribers it runs happen on the reloader's thread, so a subsystem
+// resizing a cache or retuning a limiter is never called from a signal.
+// Signals that arrive during a reload are folded into one more reload.
+// One reloader can be started at a time.
+class ConfigReloader {
+public:
+    struct Stats {
+        uint64_t signals = 0;
+        uint64_t reloads = 0;     // Published a snapshot
+        uint64_t unchanged = 0;   // Nothing live differed
+        uint64_t rejected = 0;    // Unreadable or invalid file
+    };
+
+    // `path` empty: the file loadConfig() read
+    explicit ConfigReloader(std::string path = {});
+    ~ConfigReloader();
+
+    ConfigReloader(const ConfigReloader&) = delete;
+    ConfigReloader& operator=(const ConfigReloader&) = delete;
+
+    // Install the SIGHUP handler and start the thread. Throws
+    // util::IOException if the pipe or handler cannot be set up, or
+    // another reloader is running.
+    void start();
+    // Stop the thread and restore the previous handler; idempotent
+    void stop();
+
+    Stats getStats() const;
+
+    // woved_config_generation, woved_config_reloads,
+    // woved_config_reloads_rejected, woved_config_signals
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    std::string path_;
+    int pipe_[2] = {-1, -1};
+    struct sigaction previous_ {};
+    bool running_ = false;
+    std::thread thread_;
+
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+
+    void loop();
+};
+
+} // namespace woved
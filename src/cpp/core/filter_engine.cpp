@@ -0,0 +1,42 @@
+#include "filter_engine.h"
+#include <utility>
+
+namespace woved {
+
+FilterEngine::FilterEngine(bitmaps::BitmapCache& cache, SourceFn source)
+    : cache_(cache), source_(std::move(source)) {}
+
+FilterEngine::BitmapPtr FilterEngine::bitmap(uint32_t segment, Kind kind, uint32_t id) const {
+    return cache_.get({segment, kind, id}, [&] { return source_(segment, kind, id); });
+}
+
+std::vector<uint64_t> FilterEngine::cardinalities(uint32_t segment, std::span<const TagId> tags) const {
+    std::vector<uint64_t> out;
+    out.reserve(tags.size());
+    for (TagId tag : tags) out.push_back(bitmap(segment, Kind::Tag, tag)->cardinality());
+    return out;
+}
+
+FilterEngine::Bitmap FilterEngine::matchAny(uint32_t segment, std::span<const TagId> tags,
+                                            TenantOrdinal tenant) const {
+    std::vector<BitmapPtr> held;
+    held.reserve(tags.size());
+    for (TagId tag : tags) {
+        BitmapPtr b = bitmap(segment, Kind::Tag, tag);
+        if (!b->isEmpty()) held.push_back(std::move(b));
+    }
+    Bitmap out;
+    if (held.empty()) return out;
+    if (held.size() == 1) {
+        out = *held.front();
+    } else {
+        std::vector<const Bitmap*> parts;
+        parts.reserve(held.size());
+        for (const BitmapPtr& b : held) parts.push_back(b.get());
+        out = Bitmap::fastunion(parts.size(), parts.data());
+    }
+    if (tenant != 0) out &= *bitmap(segment, Kind::Tenant, tenant);
+    return out;
+}
+
+} // namespace woved
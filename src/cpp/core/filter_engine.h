@@ -0,0 +1,45 @@
+#pragma once
+
+#include "bitmaps/bitmap-cache.h"
+#include "include/woved/types.h"
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+namespace woved {
+
+// Evaluates tag and tenant filters of one segment over its bitmaps, read
+// through the BitmapCache.
+//
+// A tags_any filter matches the union of its tags' bitmaps. A tag the
+// segment has no bitmap for matches no row. The per-tag cardinalities
+// are what QueryPlanner estimates selectivity from; they come from the
+// same cached bitmaps, so planning a query warms the cache for its scan.
+class FilterEngine {
+public:
+    using Bitmap = bitmaps::BitmapCache::Bitmap;
+    using BitmapPtr = bitmaps::BitmapCache::BitmapPtr;
+    using Kind = bitmaps::BitmapCache::Kind;
+
+    // Reads one bitmap of a segment (its Bitmap section); an empty bitmap
+    // if the segment has none for the key
+    using SourceFn = std::function<Bitmap(uint32_t segment, Kind kind, uint32_t id)>;
+
+    FilterEngine(bitmaps::BitmapCache& cache, SourceFn source);
+
+    // Bitmap of one key, cached
+    BitmapPtr bitmap(uint32_t segment, Kind kind, uint32_t id) const;
+
+    // Rows carrying each tag, in the order of `tags`
+    std::vector<uint64_t> cardinalities(uint32_t segment, std::span<const TagId> tags) const;
+
+    // Rows carrying any of the tags and, with a tenant, of that tenant
+    Bitmap matchAny(uint32_t segment, std::span<const TagId> tags, TenantOrdinal tenant = 0) const;
+
+private:
+    bitmaps::BitmapCache& cache_;
+    SourceFn source_;
+};
+
+} // namespace woved
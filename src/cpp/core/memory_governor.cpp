@@ -0,0 +1,246 @@
+#include "memory_governor.h"
+#include "core/config.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace woved {
+
+MemoryGovernor::Options MemoryGovernor::Options::fromConfig(const Config& config) {
+    const auto& memory = config.limits.memory;
+    Options options;
+    options.enabled = memory.enabled;
+    options.limit_bytes = size_t{config.limits.max_memory_gb} << 30;
+    options.headroom = std::clamp<double>(memory.headroom, 0.0, 0.9);
+    options.pressure = std::clamp<double>(memory.pressure, 0.1, 1.0);
+    options.relief = std::clamp<double>(memory.relief, 0.05, options.pressure);
+    options.interval = std::chrono::milliseconds(std::max<uint32_t>(memory.interval_ms, 10));
+    options.restore = std::chrono::seconds(memory.restore_s);
+    return options;
+}
+
+MemoryGovernor::MemoryGovernor(const Options& options)
+    : options_(options), calm_since_(std::chrono::steady_clock::now()) {
+    stats_.limit = options_.limit_bytes;
+}
+
+MemoryGovernor::~MemoryGovernor() {
+    stop();
+}
+
+void MemoryGovernor::add(std::string name, Consumer consumer) {
+    if (!consumer.usage || !consumer.resize) {
+        throw util::InvalidArgumentException("memory governor: consumer " + name + " lacks usage or resize");
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const Entry& e : entries_) {
+        if (e.name == name) throw util::InvalidArgumentException("memory governor: " + name + " added twice");
+    }
+    consumer.floor = std::min(consumer.floor, consumer.wanted);
+    entries_.push_back({std::move(name), std::move(consumer), 0, 0});
+    fitLocked();
+}
+
+void MemoryGovernor::remove(std::string_view name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto erased = std::erase_if(entries_, [&](const Entry& e) { return e.name == name; });
+    if (erased > 0) fitLocked();
+}
+
+void MemoryGovernor::setWanted(std::string_view name, size_t wanted) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(entries_.begin(), entries_.end(), [&](const Entry& e) { return e.name == name; });
+    if (it == entries_.end()) {
+        throw util::InvalidArgumentException("memory governor: no consumer " + std::string(name));
+    }
+    it->consumer.wanted = wanted;
+    it->consumer.floor = std::min(it->consumer.floor, wanted);
+    fitLocked();
+}
+
+void MemoryGovernor::fitLocked() {
+    const auto available = static_cast<size_t>(static_cast<double>(options_.limit_bytes) * (1.0 - options_.headroom));
+    size_t wanted = 0;
+    size_t floors = 0;
+    for (const Entry& e : entries_) {
+        wanted += e.consumer.wanted;
+        floors += e.consumer.floor;
+    }
+
+    // Above the floors, every consumer gives up the same share
+    double scale = 1.0;
+    if (options_.enabled && wanted > available) {
+        scale = floors >= available ? 0.0
+                                    : static_cast<double>(available - floors) / static_cast<double>(wanted - floors);
+        LOG_WARN("memory: subsystems want {} bytes, {} fit under limits.max_memory_gb; budgets scaled to {:.0f}%",
+                 wanted, available, 100.0 * scale);
+    }
+    for (Entry& e : entries_) {
+        const Consumer& c = e.consumer;
+        const size_t assigned = c.floor + static_cast<size_t>(static_cast<double>(c.wanted - c.floor) * scale);
+        // A budget shrunk under pressure stays shrunk
+        const bool fresh = e.assigned == 0 && e.budget == 0;
+        const size_t budget = fresh || e.budget >= e.assigned ? assigned : std::min(e.budget, assigned);
+        e.assigned = assigned;
+        if (fresh || budget != e.budget) {
+            e.budget = budget;
+            c.resize(budget);
+        }
+    }
+}
+
+void MemoryGovernor::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ || !options_.enabled) return;
+    running_ = true;
+    thread_ = std::thread([this] { loop(); });
+}
+
+void MemoryGovernor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+void MemoryGovernor::loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        cv_.wait_for(lock, options_.interval, [&] { return !running_; });
+        if (!running_) break;
+        try {
+            pollLocked();
+        } catch (const std::exception& e) {
+            LOG_WARN("memory governor: poll failed: {}", e.what());
+        }
+    }
+}
+
+void MemoryGovernor::poll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pollLocked();
+}
+
+void MemoryGovernor::pollLocked() {
+    std::vector<size_t> used(entries_.size());
+    size_t tracked = 0;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        used[i] = entries_[i].consumer.usage();
+        tracked += used[i];
+    }
+    size_t resident = residentBytes();
+    if (resident == 0) resident = tracked;
+    stats_.resident = resident;
+    stats_.tracked = tracked;
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto limit = static_cast<double>(options_.limit_bytes);
+    const auto high = static_cast<size_t>(limit * options_.pressure);
+    const auto low = static_cast<size_t>(limit * options_.relief);
+
+    if (resident > high) {
+        stats_.pressure_events++;
+        calm_since_ = now;
+        // The excess over `low`, split by what each cache holds above its floor
+        size_t spare = 0;
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            const Consumer& c = entries_[i].consumer;
+            if (c.reclaimable && used[i] > c.floor) spare += used[i] - c.floor;
+        }
+        if (spare == 0) {
+            LOG_WARN("memory: {} bytes resident of {} allowed, nothing left to reclaim", resident,
+                     options_.limit_bytes);
+            return;
+        }
+        const double share = std::min(1.0, static_cast<double>(resident - low) / static_cast<double>(spare));
+        size_t released = 0;
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            Entry& e = entries_[i];
+            const Consumer& c = e.consumer;
+            if (!c.reclaimable || used[i] <= c.floor) continue;
+            const auto give = static_cast<size_t>(static_cast<double>(used[i] - c.floor) * share);
+            const size_t target = std::max(c.floor, used[i] - give);
+            if (target >= e.budget) continue;
+            released += e.budget - target;
+            e.budget = target;
+            c.resize(target);
+            stats_.shrinks++;
+        }
+#if defined(__GLIBC__)
+        // Hand freed pages back, or resident size never shows the release
+        if (released > 0) malloc_trim(0);
+#endif
+        LOG_WARN("memory: {} bytes resident over the {} byte pressure mark; cache budgets cut by {} bytes", resident,
+                 high, released);
+        return;
+    }
+    if (resident >= low) {
+        calm_since_ = now;
+        return;
+    }
+    if (now - calm_since_ < options_.restore) return;
+    // A step per interval while calm; growth that brings back pressure stops it
+    for (Entry& e : entries_) {
+        if (e.budget >= e.assigned) continue;
+        e.budget = std::min(e.assigned, e.budget + std::max<size_t>(e.assigned / 4, 1));
+        e.consumer.resize(e.budget);
+        stats_.restores++;
+    }
+}
+
+std::vector<MemoryGovernor::Share> MemoryGovernor::shares() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Share> out;
+    out.reserve(entries_.size());
+    for (const Entry& e : entries_) {
+        out.push_back({e.name, e.consumer.wanted, e.assigned, e.budget, e.consumer.usage()});
+    }
+    return out;
+}
+
+MemoryGovernor::Stats MemoryGovernor::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+size_t MemoryGovernor::residentBytes() {
+    std::FILE* f = std::fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    const int read = std::fscanf(f, "%lu %lu", &size, &resident);
+    std::fclose(f);
+    if (read != 2) return 0;
+    return static_cast<size_t>(resident) * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+std::vector<std::pair<std::string_view, double>> MemoryGovernor::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_memory_limit_bytes", static_cast<double>(stats.limit)},
+        {"woved_memory_resident_bytes", static_cast<double>(stats.resident)},
+        {"woved_memory_tracked_bytes", static_cast<double>(stats.tracked)},
+        {"woved_memory_untracked_bytes",
+         static_cast<double>(stats.resident > stats.tracked ? stats.resident - stats.tracked : 0)},
+        {"woved_memory_pressure_events", static_cast<double>(stats.pressure_events)},
+    };
+}
+
+std::vector<Metrics::LabelledGauge> MemoryGovernor::labelledMetrics() const {
+    std::vector<Metrics::LabelledGauge> gauges;
+    for (const Share& s : shares()) {
+        gauges.push_back({"woved_memory_budget_bytes", {{"subsystem", s.name}}, static_cast<double>(s.budget)});
+        gauges.push_back({"woved_memory_used_bytes", {{"subsystem", s.name}}, static_cast<double>(s.used)});
+    }
+    return gauges;
+}
+
+} // namespace woved
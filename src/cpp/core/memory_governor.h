@@ -0,0 +1,143 @@
+#pragma once
+
+#include "core/metrics.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace woved {
+
+struct Config;
+
+// Memory budgets of the subsystems that size themselves (the message
+// buffer, bitmap cache, centroid replicas, HNSW cache, node cache),
+// fitted into limits.max_memory_gb.
+//
+// Each subsystem is add()ed as a Consumer with the size it is configured
+// for. While those sizes fit in the limit less its headroom, each gets
+// what it asked for; otherwise they are scaled down alike, none below its
+// floor, and the new budgets applied through resize().
+//
+// A background thread then compares the process's resident size with the
+// limit every interval. Above `pressure` of it, the reclaimable consumers
+// are shrunk toward `relief`, each giving up a share of the excess in
+// proportion to what it holds over its floor; the caches evict down to
+// their new budget. Budgets grow back to what they were given, a quarter
+// at a time, once resident size has stayed under `relief` for restore_s.
+// Consumers that are not reclaimable (the buffer) keep their budget; it
+// bounds what they take, and their usage still counts.
+//
+// The subsystems' hooks, as usage / resize:
+//   buffer     MessageBuffer::bytesUsed / setHardWatermark (not reclaimable)
+//   bitmaps    BitmapCache::getStats().bytes / setCapacity
+//   centroids  CentroidsManager::bytes / setMaxReplicaBytes
+//   hnsw       HnswCache::bytes / setBudget
+//   nodes      NodeCache::getStats().bytes / setBudget
+class MemoryGovernor {
+public:
+    struct Options {
+        bool enabled = true;                          // limits.memory.enabled
+        size_t limit_bytes = size_t{64} << 30;        // limits.max_memory_gb
+        double headroom = 0.15;
+        double pressure = 0.9;
+        double relief = 0.8;
+        std::chrono::milliseconds interval{500};
+        std::chrono::seconds restore{60};
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Consumer {
+        size_t wanted = 0;          // Configured size
+        size_t floor = 0;           // Never budgeted below
+        bool reclaimable = true;    // Shrunk under pressure
+        std::function<size_t()> usage;
+        std::function<void(size_t budget)> resize;  // Applies a budget
+    };
+
+    struct Share {
+        std::string name;
+        size_t wanted = 0;
+        size_t assigned = 0;   // Fitted into the limit
+        size_t budget = 0;     // Now; under assigned while shrunk
+        size_t used = 0;
+    };
+
+    struct Stats {
+        size_t limit = 0;
+        size_t resident = 0;        // Last measured; tracked usage where unknown
+        size_t tracked = 0;         // Sum of consumer usage
+        uint64_t pressure_events = 0;
+        uint64_t shrinks = 0;       // Budgets lowered under pressure
+        uint64_t restores = 0;      // Budgets raised back
+    };
+
+    explicit MemoryGovernor(const Options& options);
+    ~MemoryGovernor();
+
+    MemoryGovernor(const MemoryGovernor&) = delete;
+    MemoryGovernor& operator=(const MemoryGovernor&) = delete;
+
+    // Register a subsystem and refit every budget; the consumer's
+    // resize() is called with its own before this returns. Throws
+    // util::InvalidArgumentException if the name is taken or a function
+    // is unset.
+    void add(std::string name, Consumer consumer);
+    void remove(std::string_view name);
+
+    // A consumer's configured size changed (config reload): refit every
+    // budget. The floor is lowered with it if need be. Throws
+    // util::InvalidArgumentException for an unknown name.
+    void setWanted(std::string_view name, size_t wanted);
+
+    void start();
+    void stop();
+
+    // One resident size check on the calling thread, whether started or not
+    void poll();
+
+    std::vector<Share> shares() const;
+    Stats getStats() const;
+
+    // Resident set size of this process (/proc/self/statm); 0 if unknown
+    static size_t residentBytes();
+
+    // woved_memory_limit_bytes, _resident_bytes, _tracked_bytes,
+    // _untracked_bytes, _pressure_events
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+    // woved_memory_budget_bytes{subsystem} and woved_memory_used_bytes{subsystem}
+    std::vector<Metrics::LabelledGauge> labelledMetrics() const;
+
+private:
+    struct Entry {
+        std::string name;
+        Consumer consumer;
+        size_t assigned = 0;
+        size_t budget = 0;
+    };
+
+    Options options_;
+
+    // Held across resize() calls, which must not call back in
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Entry> entries_;
+    Stats stats_;
+    std::chrono::steady_clock::time_point calm_since_;
+    bool running_ = false;
+    std::thread thread_;
+
+    void loop();
+    void fitLocked();
+    void pollLocked();
+};
+
+} // namespace woved
@@ -0,0 +1,326 @@
+#include "core/metrics.h"
+#include "core/config.h"
+#include "util/exceptions.h"
+#include "util/intern-table.h"
+#include <prometheus/client_metric.h>
+#include <prometheus/collectable.h>
+#include <prometheus/exposer.h>
+#include <prometheus/metric_family.h>
+#include <algorithm>
+#include <exception>
+#include <limits>
+
+namespace woved {
+
+namespace {
+
+// Exported bucket bounds in seconds; the fine buckets stay internal
+constexpr double kBucketBounds[] = {
+    0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+    0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0,
+};
+
+constexpr std::pair<double, std::string_view> kQuantiles[] = {
+    {0.5, "_p50"}, {0.99, "_p99"}, {0.999, "_p999"},
+};
+
+double seconds(uint64_t ns) {
+    return static_cast<double>(ns) / 1e9;
+}
+
+prometheus::MetricFamily gauge(std::string name, double value, std::string help = {}) {
+    prometheus::ClientMetric metric;
+    metric.gauge.value = value;
+    return {std::move(name), std::move(help), prometheus::MetricType::Gauge, {metric}};
+}
+
+prometheus::MetricFamily counter(std::string name, const util::Counter& counter, std::string help) {
+    prometheus::ClientMetric metric;
+    metric.counter.value = static_cast<double>(counter.value());
+    return {std::move(name), std::move(help), prometheus::MetricType::Counter, {metric}};
+}
+
+void addHistogram(std::vector<prometheus::MetricFamily>& out, std::string_view name,
+                  const util::LatencyHistogram& histogram) {
+    const auto snapshot = histogram.snapshot();
+    prometheus::ClientMetric metric;
+    metric.histogram.sample_count = snapshot.count;
+    metric.histogram.sample_sum = seconds(snapshot.sum_ns);
+    for (double bound : kBucketBounds) {
+        metric.histogram.bucket.push_back(
+            {snapshot.countAtMost(static_cast<uint64_t>(bound * 1e9)), bound});
+    }
+    metric.histogram.bucket.push_back({snapshot.count, std::numeric_limits<double>::infinity()});
+    out.push_back({std::string(name) + "_seconds", "", prometheus::MetricType::Histogram, {metric}});
+    for (const auto& [q, suffix] : kQuantiles) {
+        out.push_back(gauge(std::string(name) + std::string(suffix), seconds(snapshot.quantile(q))));
+    }
+}
+
+prometheus::ClientMetric labelled(double value, std::vector<prometheus::ClientMetric::Label> labels) {
+    prometheus::ClientMetric metric;
+    metric.counter.value = value;
+    metric.label = std::move(labels);
+    return metric;
+}
+
+void addWrites(std::vector<prometheus::MetricFamily>& out, const WriteAccounting& writes,
+               std::chrono::seconds window) {
+    constexpr WritePoint kPoints[] = {WritePoint::Logical, WritePoint::WalAppend, WritePoint::NodeFlush,
+                                      WritePoint::SegmentSeal, WritePoint::Compaction, WritePoint::Manifest};
+    prometheus::MetricFamily totals{"woved_write_bytes_total", "Bytes written, by write point",
+                                    prometheus::MetricType::Counter, {}};
+    for (WritePoint point : kPoints) {
+        totals.metric.push_back(labelled(static_cast<double>(writes.bytes(point)),
+                                         {{"point", std::string(WriteAccounting::name(point))}}));
+    }
+    out.push_back(std::move(totals));
+
+    prometheus::MetricFamily levels{"woved_tree_flush_bytes_total",
+                                    "Message bytes moved into tree nodes, by node level",
+                                    prometheus::MetricType::Counter, {}};
+    for (uint32_t level = 0; level < WriteAccounting::kMaxLevels; ++level) {
+        if (uint64_t bytes = writes.levelBytes(level)) {
+            levels.metric.push_back(labelled(static_cast<double>(bytes), {{"level", std::to_string(level)}}));
+        }
+    }
+    out.push_back(std::move(levels));
+
+    prometheus::MetricFamily tenants{"woved_tenant_write_bytes_total",
+                                     "Bytes written, by tenant and write point (attributed)",
+                                     prometheus::MetricType::Counter, {}};
+    const auto& names = util::InternTable::tenants();
+    for (const auto& [tenant, bytes] : writes.tenants()) {
+        std::string name = tenant + 1 >= WriteAccounting::kMaxTenants ? "other" : names.name(tenant);
+        for (WritePoint point : kPoints) {
+            if (uint64_t b = bytes[static_cast<size_t>(point)]) {
+                tenants.metric.push_back(labelled(static_cast<double>(b),
+                                                  {{"tenant", name}, {"point", std::string(WriteAccounting::name(point))}}));
+            }
+        }
+    }
+    out.push_back(std::move(tenants));
+
+    const double logical = static_cast<double>(writes.bytes(WritePoint::Logical));
+    out.push_back(gauge("woved_write_amplification", writes.rollingAmplification(window),
+                        "Device bytes over logical bytes, recent window"));
+    out.push_back(gauge("woved_write_amplification_cumulative", writes.amplification(),
+                        "Device bytes over logical bytes since start"));
+    out.push_back(gauge("woved_tree_write_amplification",
+                        logical > 0 ? static_cast<double>(writes.bytes(WritePoint::NodeFlush)) / logical : 0.0,
+                        "Tree node flush bytes over logical bytes since start"));
+}
+
+// One family per name, in order of first appearance
+void addLabelledGauges(std::vector<prometheus::MetricFamily>& out, std::vector<Metrics::LabelledGauge> gauges) {
+    const size_t first = out.size();
+    for (auto& g : gauges) {
+        auto it = std::find_if(out.begin() + static_cast<std::ptrdiff_t>(first), out.end(),
+                               [&](const prometheus::MetricFamily& f) { return f.name == g.name; });
+        if (it == out.end()) {
+            out.push_back({std::move(g.name), "", prometheus::MetricType::Gauge, {}});
+            it = out.end() - 1;
+        }
+        prometheus::ClientMetric metric;
+        metric.gauge.value = g.value;
+        for (auto& [label, value] : g.labels) metric.label.push_back({std::move(label), std::move(value)});
+        it->metric.push_back(std::move(metric));
+    }
+}
+
+// Sums the shards at scrape time
+class Collector : public prometheus::Collectable {
+public:
+    Collector(const Metrics& metrics, std::chrono::seconds write_amp_window)
+        : metrics_(metrics), write_amp_window_(write_amp_window) {}
+
+    std::vector<prometheus::MetricFamily> Collect() const override {
+        const Metrics& metrics = metrics_;
+        std::vector<prometheus::MetricFamily> out;
+        for (auto stage : {QueryStage::CentroidProbe, QueryStage::BufferScan, QueryStage::Delta, QueryStage::Stable,
+                           QueryStage::Rerank, QueryStage::Total}) {
+            addHistogram(out, Metrics::name(stage), metrics.query(stage));
+        }
+        for (auto stage : {IngestStage::WalWait, IngestStage::BufferAppend, IngestStage::Flush}) {
+            addHistogram(out, Metrics::name(stage), metrics.ingest(stage));
+        }
+        out.push_back(counter("woved_queries_total", metrics.queries, "Searches run"));
+        out.push_back(counter("woved_partial_queries_total", metrics.partial_queries,
+                              "Searches cancelled with their best-so-far top k"));
+        out.push_back(counter("woved_upserts_total", metrics.upserts, "Messages admitted to the buffer"));
+        out.push_back(counter("woved_rejected_upserts_total", metrics.rejected_upserts,
+                              "Messages refused as overloaded"));
+        out.push_back(counter("woved_flushed_messages_total", metrics.flushed_messages,
+                              "Buffer messages written to segments"));
+        addWrites(out, metrics.writes, write_amp_window_);
+        for (auto& [name, value] : metrics.gauges()) out.push_back(gauge(std::move(name), value));
+        addLabelledGauges(out, metrics.labelledGauges());
+        return out;
+    }
+
+private:
+    const Metrics& metrics_;
+    std::chrono::seconds write_amp_window_;
+};
+
+} // namespace
+
+WriteAccounting::WriteAccounting()
+    : tenants_(std::make_unique<std::atomic<uint64_t>[]>(kMaxTenants * kPoints)) {}
+
+std::vector<std::pair<TenantOrdinal, std::array<uint64_t, WriteAccounting::kPoints>>>
+WriteAccounting::tenants() const {
+    std::vector<std::pair<TenantOrdinal, std::array<uint64_t, kPoints>>> out;
+    for (size_t slot = 0; slot < kMaxTenants; ++slot) {
+        std::array<uint64_t, kPoints> bytes{};
+        bool any = false;
+        for (size_t p = 0; p < kPoints; ++p) {
+            bytes[p] = tenants_[slot * kPoints + p].load(std::memory_order_relaxed);
+            any = any || bytes[p] != 0;
+        }
+        if (any) out.emplace_back(static_cast<TenantOrdinal>(slot), bytes);
+    }
+    return out;
+}
+
+uint64_t WriteAccounting::deviceBytes() const {
+    return bytes(WritePoint::WalAppend) + bytes(WritePoint::SegmentSeal) + bytes(WritePoint::Compaction) +
+           bytes(WritePoint::Manifest);
+}
+
+double WriteAccounting::amplification() const {
+    const uint64_t logical = bytes(WritePoint::Logical);
+    return logical == 0 ? 0.0 : static_cast<double>(deviceBytes()) / static_cast<double>(logical);
+}
+
+double WriteAccounting::rollingAmplification(std::chrono::seconds window) const {
+    const Sample now{std::chrono::steady_clock::now(), bytes(WritePoint::Logical), deviceBytes()};
+    std::lock_guard<std::mutex> lock(samples_mutex_);
+    // Keep the newest sample at least `window` old as the base
+    while (samples_.size() > 1 && now.at - samples_[1].at >= window) samples_.pop_front();
+    const Sample base = samples_.empty() ? Sample{now.at, 0, 0} : samples_.front();
+    samples_.push_back(now);
+    const uint64_t logical = now.logical - base.logical;
+    return logical == 0 ? 0.0 : static_cast<double>(now.device - base.device) / static_cast<double>(logical);
+}
+
+std::string_view WriteAccounting::name(WritePoint point) {
+    switch (point) {
+        case WritePoint::Logical: return "logical";
+        case WritePoint::WalAppend: return "wal";
+        case WritePoint::NodeFlush: return "node_flush";
+        case WritePoint::SegmentSeal: return "segment_seal";
+        case WritePoint::Compaction: return "compaction";
+        case WritePoint::Manifest: return "manifest";
+    }
+    return "unknown";
+}
+
+void TenantTally::add(TenantOrdinal tenant, uint64_t bytes) {
+    total_ += bytes;
+    for (auto it = bytes_.rbegin(); it != bytes_.rend(); ++it) {
+        if (it->first == tenant) {
+            it->second += bytes;
+            return;
+        }
+    }
+    bytes_.emplace_back(tenant, bytes);
+}
+
+void TenantTally::commit(WriteAccounting& accounting, WritePoint point) const {
+    for (const auto& [tenant, bytes] : bytes_) accounting.addTenant(point, tenant, bytes);
+}
+
+Metrics& Metrics::global() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Metrics() = default;
+
+void Metrics::addSource(const std::string& name, Source source) {
+    std::lock_guard<std::mutex> lock(sources_mutex_);
+    removeSourceLocked(name);
+    sources_.emplace_back(name, std::move(source));
+}
+
+void Metrics::removeSource(const std::string& name) {
+    std::lock_guard<std::mutex> lock(sources_mutex_);
+    removeSourceLocked(name);
+}
+
+void Metrics::addLabelledSource(const std::string& name, LabelledSource source) {
+    std::lock_guard<std::mutex> lock(sources_mutex_);
+    removeSourceLocked(name);
+    labelled_sources_.emplace_back(name, std::move(source));
+}
+
+void Metrics::removeSourceLocked(const std::string& name) {
+    sources_.erase(std::remove_if(sources_.begin(), sources_.end(), [&](const auto& s) { return s.first == name; }),
+                   sources_.end());
+    labelled_sources_.erase(std::remove_if(labelled_sources_.begin(), labelled_sources_.end(),
+                                           [&](const auto& s) { return s.first == name; }),
+                            labelled_sources_.end());
+}
+
+std::vector<std::pair<std::string, double>> Metrics::gauges() const {
+    std::lock_guard<std::mutex> lock(sources_mutex_);
+    std::vector<std::pair<std::string, double>> out;
+    for (const auto& [source_name, source] : sources_) {
+        for (const auto& [name, value] : source()) out.emplace_back(std::string(name), value);
+    }
+    return out;
+}
+
+std::vector<Metrics::LabelledGauge> Metrics::labelledGauges() const {
+    std::lock_guard<std::mutex> lock(sources_mutex_);
+    std::vector<LabelledGauge> out;
+    for (const auto& [source_name, source] : labelled_sources_) {
+        for (auto& gauge : source()) out.push_back(std::move(gauge));
+    }
+    return out;
+}
+
+std::string_view Metrics::name(QueryStage stage) {
+    switch (stage) {
+        case QueryStage::CentroidProbe: return "woved_query_centroid_probe_latency";
+        case QueryStage::BufferScan: return "woved_query_buffer_scan_latency";
+        case QueryStage::Delta: return "woved_query_delta_latency";
+        case QueryStage::Stable: return "woved_query_stable_latency";
+        case QueryStage::Rerank: return "woved_query_rerank_latency";
+        case QueryStage::Total: return "woved_query_latency";
+    }
+    return "woved_query_unknown_latency";
+}
+
+std::string_view Metrics::name(IngestStage stage) {
+    switch (stage) {
+        case IngestStage::WalWait: return "woved_ingest_wal_wait_latency";
+        case IngestStage::BufferAppend: return "woved_ingest_buffer_append_latency";
+        case IngestStage::Flush: return "woved_ingest_flush_latency";
+    }
+    return "woved_ingest_unknown_latency";
+}
+
+struct MetricsExporter::Impl {
+    std::shared_ptr<Collector> collector;
+    std::unique_ptr<prometheus::Exposer> exposer;
+};
+
+MetricsExporter::MetricsExporter(const Config& config) : impl_(std::make_unique<Impl>()) {
+    const std::string address = config.server.bind_address + ":" + std::to_string(config.server.metrics_port);
+    try {
+        impl_->exposer = std::make_unique<prometheus::Exposer>(address);
+    } catch (const std::exception& e) {
+        throw util::IOException("cannot serve metrics on " + address + ": " + e.what());
+    }
+    impl_->collector = std::make_shared<Collector>(
+        Metrics::global(), std::chrono::seconds(config.monitoring.prometheus.write_amp_window_s));
+    impl_->exposer->RegisterCollectable(impl_->collector);
+}
+
+MetricsExporter::~MetricsExporter() {
+    if (impl_->exposer) impl_->exposer->RemoveCollectable(impl_->collector);
+}
+
+} // namespace woved
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "util/telemetry.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+
+struct Config;
+
+// Query stages timed per query; Total is the whole search
+enum class QueryStage : uint8_t {
+    CentroidProbe,  // Nearest global centroids
+    BufferScan,
+    Delta,          // Delta segment scans, summed over segments
+    Stable,         // Stable ADC scans, summed over segments
+    Rerank,
+    Total,
+};
+
+// Ingest stages; WalWait is a commit waiting to be durable, Flush one
+// buffer leaf slice written to its segment
+enum class IngestStage : uint8_t {
+    WalWait,
+    BufferAppend,
+    Flush,
+};
+
+// Where ingest writes bytes. Logical is what clients asked to store (id
+// and vector of an upsert, id of a delete); WalAppend, SegmentSeal,
+// Compaction and Manifest reach the device; NodeFlush is messages moved
+// into a tree node's buffer, in memory, kept apart for tuning epsilon.
+enum class WritePoint : uint8_t {
+    Logical,
+    WalAppend,
+    NodeFlush,
+    SegmentSeal,
+    Compaction,
+    Manifest,
+};
+
+// Bytes written at each WritePoint, by tree level and by tenant, for
+// write amplification: device bytes over logical bytes.
+//
+// Totals are bytes as written: WAL units after compression and padding,
+// whole segment files and manifest frames and snapshots. NodeFlush is
+// also kept per level of the receiving node (the root is height - 1,
+// leaves 0). The tenant split is attributed: WAL records before
+// compression, messages moved in the tree, and a delta segment's file
+// bytes by its rows' share; stable builds and the manifest mix every
+// tenant and count in the totals only. Tenant ordinals from kMaxTenants
+// on share the last slot.
+class WriteAccounting {
+public:
+    static constexpr size_t kPoints = static_cast<size_t>(WritePoint::Manifest) + 1;
+    static constexpr size_t kMaxLevels = 16;
+    static constexpr size_t kMaxTenants = 4096;
+
+    WriteAccounting();
+    WriteAccounting(const WriteAccounting&) = delete;
+    WriteAccounting& operator=(const WriteAccounting&) = delete;
+
+    void add(WritePoint point, uint64_t bytes) { totals_[static_cast<size_t>(point)].add(bytes); }
+    // NodeFlush bytes into a node of `level`
+    void addLevel(uint32_t level, uint64_t bytes) {
+        levels_[std::min<size_t>(level, kMaxLevels - 1)].add(bytes);
+        add(WritePoint::NodeFlush, bytes);
+    }
+    // Tenant split only; the totals are added separately
+    void addTenant(WritePoint point, TenantOrdinal tenant, uint64_t bytes) {
+        const size_t slot = std::min<size_t>(tenant, kMaxTenants - 1);
+        tenants_[slot * kPoints + static_cast<size_t>(point)].fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    uint64_t bytes(WritePoint point) const { return totals_[static_cast<size_t>(point)].value(); }
+    uint64_t levelBytes(uint32_t level) const { return levels_[std::min<size_t>(level, kMaxLevels - 1)].value(); }
+    // Tenants with any bytes, and their bytes per point
+    std::vector<std::pair<TenantOrdinal, std::array<uint64_t, kPoints>>> tenants() const;
+
+    // Device bytes over logical bytes since start; 0 before any logical byte
+    double amplification() const;
+    // The same over about the last `window`, from the totals sampled at
+    // each call (a scrape); since start until a sample is that old
+    double rollingAmplification(std::chrono::seconds window) const;
+
+    static std::string_view name(WritePoint point);
+
+private:
+    struct Sample {
+        std::chrono::steady_clock::time_point at;
+        uint64_t logical;
+        uint64_t device;
+    };
+
+    std::array<util::Counter, kPoints> totals_;
+    std::array<util::Counter, kMaxLevels> levels_;
+    std::unique_ptr<std::atomic<uint64_t>[]> tenants_;  // kMaxTenants x kPoints
+
+    mutable std::mutex samples_mutex_;
+    mutable std::deque<Sample> samples_;
+
+    uint64_t deviceBytes() const;
+};
+
+// Bytes per tenant gathered over one batch, added to WriteAccounting at
+// once instead of per message
+class TenantTally {
+public:
+    void add(TenantOrdinal tenant, uint64_t bytes);
+    void commit(WriteAccounting& accounting, WritePoint point) const;
+    uint64_t total() const { return total_; }
+
+private:
+    std::vector<std::pair<TenantOrdinal, uint64_t>> bytes_;  // A batch holds few tenants
+    uint64_t total_ = 0;
+};
+
+// Process-wide latency histograms and counters, and the gauges that
+// components already publish through metrics().
+//
+// Hot paths record into util::LatencyHistogram and util::Counter, which
+// write per-thread shards without locks. Nothing is aggregated until a
+// scrape: MetricsExporter serves them on server.metrics_port through
+// prometheus-cpp, summing the shards and reading every registered gauge
+// source then.
+//
+// A stage named woved_query_rerank_latency (name()) exports as the
+// histogram woved_query_rerank_latency_seconds, with coarse buckets, and
+// the gauges woved_query_rerank_latency_p50, _p99 and _p999 in seconds,
+// from the fine buckets. The whole search is woved_query_latency.
+class Metrics {
+public:
+    using Source = std::function<std::vector<std::pair<std::string_view, double>>()>;
+
+    // One sample of a gauge family with labels, e.g. per tenant
+    struct LabelledGauge {
+        std::string name;
+        std::vector<std::pair<std::string, std::string>> labels;
+        double value;
+    };
+    using LabelledSource = std::function<std::vector<LabelledGauge>()>;
+
+    static Metrics& global();
+
+    Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    util::LatencyHistogram& query(QueryStage stage) { return query_[static_cast<size_t>(stage)]; }
+    util::LatencyHistogram& ingest(IngestStage stage) { return ingest_[static_cast<size_t>(stage)]; }
+    const util::LatencyHistogram& query(QueryStage stage) const { return query_[static_cast<size_t>(stage)]; }
+    const util::LatencyHistogram& ingest(IngestStage stage) const { return ingest_[static_cast<size_t>(stage)]; }
+
+    util::Counter queries;
+    util::Counter partial_queries;   // Cancelled with their best-so-far top k
+    util::Counter upserts;           // Messages admitted to the buffer
+    util::Counter rejected_upserts;  // Refused as overloaded
+    util::Counter flushed_messages;
+    WriteAccounting writes;
+
+    // Gauges read at each scrape, e.g. a component's metrics(). A source
+    // must stay valid until removed under the same name.
+    void addSource(const std::string& name, Source source);
+    // The same for gauges with labels; removeSource() removes either kind
+    void addLabelledSource(const std::string& name, LabelledSource source);
+    void removeSource(const std::string& name);
+
+    // Every source's gauges, read now
+    std::vector<std::pair<std::string, double>> gauges() const;
+    std::vector<LabelledGauge> labelledGauges() const;
+
+    static std::string_view name(QueryStage stage);
+    static std::string_view name(IngestStage stage);
+
+private:
+    static constexpr size_t kQueryStages = static_cast<size_t>(QueryStage::Total) + 1;
+    static constexpr size_t kIngestStages = static_cast<size_t>(IngestStage::Flush) + 1;
+
+    std::array<util::LatencyHistogram, kQueryStages> query_;
+    std::array<util::LatencyHistogram, kIngestStages> ingest_;
+
+    mutable std::mutex sources_mutex_;  // Registration and scrapes only
+    std::vector<std::pair<std::string, Source>> sources_;
+    std::vector<std::pair<std::string, LabelledSource>> labelled_sources_;
+
+    void removeSourceLocked(const std::string& name);
+};
+
+// Serves Metrics::global() for Prometheus at
+// http://<server.bind_address>:<server.metrics_port>/metrics while alive;
+// startup creates one when monitoring.prometheus.enabled. Write bytes
+// export as woved_write_bytes_total{point}, woved_tree_flush_bytes_total{level}
+// and woved_tenant_write_bytes_total{tenant,point}; woved_write_amplification
+// covers monitoring.prometheus.write_amp_window_s, and
+// woved_write_amplification_cumulative and woved_tree_write_amplification
+// (NodeFlush over logical bytes) the whole run.
+// Throws util::IOException if the port cannot be bound.
+class MetricsExporter {
+public:
+    explicit MetricsExporter(const Config& config);
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+} // namespace woved
@@ -0,0 +1,278 @@
+#include "query_planner.h"
+#include "core/config.h"
+#include "storage/segment/seg-zone.h"
+#include "util/cancellation.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace woved {
+
+QueryPlanner::Options QueryPlanner::Options::fromConfig(const Config& config) {
+    Options options;
+    options.prefilter_selectivity = std::clamp(config.filtering.prefilter_selectivity, 0.0f, 1.0f);
+    options.widen_selectivity =
+        std::clamp(config.filtering.widen_selectivity, options.prefilter_selectivity, 1.0f);
+    options.max_nprobe_widen = std::max(config.filtering.max_nprobe_widen, 1u);
+    return options;
+}
+
+QueryPlanner::QueryPlanner(const Options& options) : options_(options) {}
+
+float QueryPlanner::estimateSelectivity(uint64_t rows, std::span<const uint64_t> cardinalities) {
+    if (rows == 0) return 0.0f;
+    double miss = 1.0;
+    for (uint64_t c : cardinalities) {
+        miss *= 1.0 - std::min(static_cast<double>(c) / static_cast<double>(rows), 1.0);
+    }
+    return static_cast<float>(1.0 - miss);
+}
+
+QueryPlanner::Plan QueryPlanner::plan(const Segment& segment, std::span<const uint64_t> cardinalities) const {
+    Plan plan;
+    plan.selectivity = estimateSelectivity(segment.rows, cardinalities);
+    plan.matches = static_cast<uint64_t>(std::ceil(plan.selectivity * static_cast<double>(segment.rows)));
+    if (plan.matches == 0) {
+        plan.strategy = Strategy::Skip;
+        return plan;
+    }
+
+    const uint32_t nlist = std::max(segment.nlist, 1u);
+    const uint32_t nprobe = std::clamp(segment.nprobe, 1u, nlist);
+    if (plan.selectivity >= options_.widen_selectivity) {
+        plan.strategy = Strategy::PostFilter;
+        plan.nprobe = nprobe;
+        return plan;
+    }
+
+    // Probe enough lists that as many rows pass as an unfiltered search sees
+    const double widen = std::min(1.0 / plan.selectivity, static_cast<double>(options_.max_nprobe_widen));
+    const uint32_t widened =
+        static_cast<uint32_t>(std::min(std::ceil(nprobe * widen), static_cast<double>(nlist)));
+    // Rows the widened probe reads, lists being of average size
+    const uint64_t probed = segment.rows * widened / nlist;
+    if (plan.selectivity <= options_.prefilter_selectivity || plan.matches <= probed) {
+        plan.strategy = Strategy::PreFilter;
+        return plan;
+    }
+    plan.strategy = Strategy::WidenedPostFilter;
+    plan.nprobe = widened;
+    return plan;
+}
+
+QueryPlanner::Plan QueryPlanner::plan(const Segment& segment, const std::optional<storage::ZoneMap>& zones,
+                                      std::string_view tenant, std::span<const TagId> tags,
+                                      const CardinalityFn& cardinalities) const {
+    if (zones && !zones->mayMatch(tenant, {}, tags)) {
+        Plan skip;
+        skip.strategy = Strategy::Skip;
+        skip.selectivity = 0.0f;
+        return skip;
+    }
+    if (tags.empty()) return plan(segment, std::span<const uint64_t>(&segment.rows, 1));
+    const std::vector<uint64_t> counts = cardinalities(tags);
+    return plan(segment, counts);
+}
+
+const char* QueryPlanner::name(Strategy strategy) {
+    switch (strategy) {
+        case Strategy::Skip: return "skip";
+        case Strategy::PreFilter: return "pre_filter";
+        case Strategy::WidenedPostFilter: return "widened_post_filter";
+        case Strategy::PostFilter: return "post_filter";
+    }
+    return "unknown";
+}
+
+namespace {
+
+// A tier's prior: its cost and the work of a typical task, which scales
+// how much the prior weighs against observations
+struct Prior {
+    double segment_ns;
+    double unit_ns;
+    double units;
+};
+
+constexpr Prior kPriors[QueryCostModel::kTiers] = {
+    {2'000.0, 50.0, 10'000.0},      // Buffer
+    {20'000.0, 50.0, 100'000.0},    // Delta
+    {20'000.0, 5'000.0, 16.0},      // Stable
+    {10'000.0, 2'000.0, 40.0},      // Rerank
+};
+
+// A rung of the degradation ladder: shares of the full knobs kept
+struct Rung {
+    float nprobe;       // 0: one list
+    float rerank;       // 0: one candidate per result
+    float sample_p;
+    bool buffer;
+};
+
+constexpr Rung kLadder[] = {
+    {1.0f, 1.0f, 1.0f, true},
+    {0.75f, 1.0f, 1.0f, true},
+    {0.5f, 1.0f, 1.0f, true},
+    {0.5f, 0.5f, 1.0f, true},
+    {0.25f, 0.5f, 1.0f, true},
+    {0.25f, 0.25f, 0.5f, true},
+    {0.125f, 0.25f, 0.5f, true},
+    {0.0f, 0.0f, 0.5f, true},
+    {0.0f, 0.0f, 0.5f, false},
+};
+
+uint32_t scaled(uint32_t full, float share) {
+    if (full == index::TwoPhaseEngine::kAllLists && share >= 1.0f) return full;
+    return std::max(1u, static_cast<uint32_t>(std::ceil(static_cast<double>(full) * share)));
+}
+
+// Queries' worth of weight the prior carries
+constexpr double kPriorWeight = 0.1;
+
+} // namespace
+
+QueryCostModel::QueryCostModel(double decay) : decay_(std::clamp(decay, 0.0, 1.0)) {}
+
+void QueryCostModel::observe(Tier tier, double segments, double units, double ns) {
+    if (segments <= 0.0 && units <= 0.0) return;
+    std::lock_guard lock(mutex_);
+    Fit& f = fits_[static_cast<size_t>(tier)];
+    f.ss = f.ss * decay_ + segments * segments;
+    f.su = f.su * decay_ + segments * units;
+    f.uu = f.uu * decay_ + units * units;
+    f.sn = f.sn * decay_ + segments * ns;
+    f.un = f.un * decay_ + units * ns;
+}
+
+void QueryCostModel::observe(const index::TwoPhaseEngine::Stats& stats, uint64_t buffer_rows) {
+    if (stats.result_cached || stats.cache_answered) return;
+    if (stats.buffer_ns) observe(Tier::Buffer, 1.0, static_cast<double>(buffer_rows), static_cast<double>(stats.buffer_ns));
+    if (stats.delta_segments) {
+        observe(Tier::Delta, static_cast<double>(stats.delta_segments), static_cast<double>(stats.delta_rows),
+                static_cast<double>(stats.delta_ns));
+    }
+    if (stats.stable_segments) {
+        observe(Tier::Stable, static_cast<double>(stats.stable_segments), static_cast<double>(stats.stable_lists),
+                static_cast<double>(stats.stable_ns));
+    }
+    if (stats.reranked) {
+        observe(Tier::Rerank, static_cast<double>(stats.stable_segments), static_cast<double>(stats.reranked),
+                static_cast<double>(stats.rerank_ns));
+    }
+}
+
+QueryCostModel::Cost QueryCostModel::cost(Tier tier) const {
+    const Prior& prior = kPriors[static_cast<size_t>(tier)];
+    Fit f;
+    {
+        std::lock_guard lock(mutex_);
+        f = fits_[static_cast<size_t>(tier)];
+    }
+    // The prior as two light pseudo-queries: one segment and no work,
+    // and typical work without the segment
+    const double ref = kPriorWeight * prior.units * prior.units;
+    const double a = f.ss + kPriorWeight, b = f.su, d = f.uu + ref;
+    const double y0 = f.sn + kPriorWeight * prior.segment_ns, y1 = f.un + prior.unit_ns * ref;
+    const double det = a * d - b * b;
+    Cost cost{prior.segment_ns, prior.unit_ns};
+    if (det <= 1e-12 * a * d) return cost;
+    cost.segment_ns = std::max((y0 * d - b * y1) / det, 0.0);
+    cost.unit_ns = std::max((a * y1 - b * y0) / det, 0.0);
+    return cost;
+}
+
+double QueryCostModel::predictNs(Tier tier, double segments, double units) const {
+    const Cost c = cost(tier);
+    return c.segment_ns * segments + c.unit_ns * units;
+}
+
+const char* QueryCostModel::name(Tier tier) {
+    switch (tier) {
+        case Tier::Buffer: return "buffer";
+        case Tier::Delta: return "delta";
+        case Tier::Stable: return "stable";
+        case Tier::Rerank: return "rerank";
+    }
+    return "unknown";
+}
+
+DeadlinePlanner::Options DeadlinePlanner::Options::fromConfig(const Config& config) {
+    Options options;
+    options.default_budget_ms = config.query.latency_budget_ms;
+    options.max_budget_ms = config.query.timeout_ms;
+    options.headroom = std::clamp(config.query.deadline_headroom, 0.05f, 1.0f);
+    options.drop_buffer = config.query.deadline_drop_buffer;
+    return options;
+}
+
+DeadlinePlanner::DeadlinePlanner(const Options& options, const QueryCostModel& model)
+    : options_(options), model_(model) {}
+
+uint32_t DeadlinePlanner::deadlineMs(std::optional<uint32_t> requested) const {
+    const uint32_t budget = requested.value_or(options_.default_budget_ms);
+    if (budget == 0) return 0;
+    return options_.max_budget_ms ? std::min(budget, options_.max_budget_ms) : budget;
+}
+
+double DeadlinePlanner::predictMs(const Workload& workload, const Knobs& knobs) const {
+    using Tier = QueryCostModel::Tier;
+    // Rows an adaptive scan reads of a list, on average
+    const double share = knobs.sample_p < 1.0f ? (1.0 + std::max(knobs.sample_p, 0.0f)) / 2.0 : 1.0;
+    const double delta_lists = std::max(workload.delta_nlist, 1u);
+    const double delta_probed = std::min<double>(knobs.nprobe_delta, delta_lists) / delta_lists;
+    const auto delta = model_.cost(Tier::Delta);
+    const auto stable = model_.cost(Tier::Stable);
+    const auto rerank = model_.cost(Tier::Rerank);
+
+    double total = 0.0, slowest = 0.0;
+    auto task = [&](double ns) {
+        total += ns;
+        slowest = std::max(slowest, ns);
+    };
+    if (knobs.buffer_scan && workload.buffer_rows) {
+        task(model_.predictNs(Tier::Buffer, 1.0, static_cast<double>(workload.buffer_rows)));
+    }
+    for (uint64_t rows : workload.delta_rows) {
+        task(delta.segment_ns + delta.unit_ns * static_cast<double>(rows) * delta_probed * share);
+    }
+    const double candidates = static_cast<double>(workload.k) * std::max(knobs.rerank_factor, 1u);
+    for (uint32_t nlist : workload.stable_nlist) {
+        task(stable.segment_ns + stable.unit_ns * std::min(knobs.nprobe_stable, std::max(nlist, 1u)) +
+             rerank.segment_ns + rerank.unit_ns * candidates);
+    }
+    return std::max(slowest, total / std::max(workload.workers, 1u)) / 1e6;
+}
+
+DeadlinePlanner::Budget DeadlinePlanner::plan(const Workload& workload, const Knobs& full, uint32_t deadline_ms,
+                                              const util::CancellationToken* cancel) const {
+    if (cancel && cancel->hasDeadline()) {
+        // At least 1 ms: a tripped token gets the cheapest rung
+        const uint32_t left = std::max(cancel->remainingMs(), 1u);
+        deadline_ms = deadline_ms ? std::min(deadline_ms, left) : left;
+    }
+    Budget budget;
+    budget.knobs = full;
+    budget.deadline_ms = deadline_ms;
+    budget.predicted_ms = predictMs(workload, full);
+    if (deadline_ms == 0) return budget;
+
+    const double limit = deadline_ms * static_cast<double>(options_.headroom);
+    const size_t rungs = options_.drop_buffer ? std::size(kLadder) : std::size(kLadder) - 1;
+    for (size_t r = 0; r < rungs; ++r) {
+        const Rung& rung = kLadder[r];
+        Knobs knobs;
+        knobs.nprobe_delta = scaled(full.nprobe_delta, rung.nprobe);
+        knobs.nprobe_stable = scaled(full.nprobe_stable, rung.nprobe);
+        knobs.rerank_factor = scaled(full.rerank_factor, rung.rerank);
+        knobs.sample_p = std::clamp(full.sample_p * rung.sample_p, 0.0f, 1.0f);
+        knobs.buffer_scan = full.buffer_scan && rung.buffer;
+        budget.knobs = knobs;
+        budget.rung = static_cast<uint32_t>(r);
+        budget.predicted_ms = predictMs(workload, knobs);
+        if (budget.predicted_ms <= limit) return budget;
+    }
+    budget.fits = false;
+    return budget;
+}
+
+} // namespace woved
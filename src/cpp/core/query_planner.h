@@ -0,0 +1,214 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "index/two-phase-engine.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::storage {
+class ZoneMap;
+}
+
+namespace woved::util {
+class CancellationToken;
+}
+
+namespace woved {
+
+// Picks how a filtered (tags_any) query searches each segment, from the
+// selectivity its tag bitmaps give:
+//  - PreFilter: few rows match (under filtering.prefilter_selectivity, or
+//    fewer than the IVF probe would read anyway). The matching rows are
+//    scored by brute force, with exact recall.
+//  - WidenedPostFilter: IVF search with nprobe scaled by 1 / selectivity,
+//    up to max_nprobe_widen, so that as many candidates pass the bitmap
+//    check per query as an unfiltered search would produce.
+//  - PostFilter: most rows match (at or over widen_selectivity); plain IVF
+//    search and a bitmap check per candidate.
+//  - Skip: no row matches, by the segment's zone map bloom filter or
+//    the bitmaps.
+//
+// The union of the tags is estimated as if the tags were independent:
+// rows * (1 - prod(1 - c_i / rows)), between the largest tag and the sum.
+class QueryPlanner {
+public:
+    struct Options {
+        float prefilter_selectivity = 0.01f;  // filtering.prefilter_selectivity
+        float widen_selectivity = 0.25f;      // filtering.widen_selectivity
+        uint32_t max_nprobe_widen = 8;        // filtering.max_nprobe_widen
+
+        static Options fromConfig(const Config& config);
+    };
+
+    enum class Strategy : uint8_t {
+        Skip,
+        PreFilter,
+        WidenedPostFilter,
+        PostFilter
+    };
+
+    struct Segment {
+        uint64_t rows = 0;      // Rows in the segment, live or not
+        uint32_t nlist = 1;     // IVF lists of the segment
+        uint32_t nprobe = 1;    // Lists an unfiltered query probes
+    };
+
+    struct Plan {
+        Strategy strategy = Strategy::PostFilter;
+        float selectivity = 1.0f;
+        uint64_t matches = 0;   // Estimated matching rows
+        uint32_t nprobe = 0;    // Lists to probe; 0 for Skip and PreFilter
+    };
+
+    explicit QueryPlanner(const Options& options);
+
+    // Share of rows carrying any of the tags, given each tag's cardinality
+    static float estimateSelectivity(uint64_t rows, std::span<const uint64_t> cardinalities);
+
+    Plan plan(const Segment& segment, std::span<const uint64_t> cardinalities) const;
+
+    // Each tag's cardinality in the segment (FilterEngine::cardinalities)
+    using CardinalityFn = std::function<std::vector<uint64_t>(std::span<const TagId> tags)>;
+
+    // plan() of one segment, asking its resident zone map first: a segment
+    // whose bloom filter rules out the tenant or every tag is skipped
+    // before any bitmap is read. `tenant` empty: no tenant filter.
+    Plan plan(const Segment& segment, const std::optional<storage::ZoneMap>& zones, std::string_view tenant,
+              std::span<const TagId> tags, const CardinalityFn& cardinalities) const;
+
+    static const char* name(Strategy strategy);
+
+private:
+    Options options_;
+};
+
+// What a query costs, per tier, learned from the engine's own timings
+// (TwoPhaseEngine::Stats). Each tier is a fixed cost per segment task
+// plus a cost per unit of work:
+//  - Buffer: per buffered row scanned
+//  - Delta: per row scored
+//  - Stable: per list ADC scanned
+//  - Rerank: per candidate rescored
+// fitted by least squares over recent queries, older ones decaying
+// geometrically. Until a tier has data its fit leans on a fixed prior,
+// which a handful of queries outweigh. Thread-safe.
+class QueryCostModel {
+public:
+    enum class Tier : uint8_t {
+        Buffer,
+        Delta,
+        Stable,
+        Rerank
+    };
+    static constexpr size_t kTiers = 4;
+
+    struct Cost {
+        double segment_ns = 0.0;    // Per segment task
+        double unit_ns = 0.0;       // Per unit of work
+    };
+
+    // Weight of a query `n` queries back: decay^n
+    explicit QueryCostModel(double decay = 0.98);
+
+    void observe(Tier tier, double segments, double units, double ns);
+    // Every tier a search ran; `buffer_rows` scanned by its buffer task
+    void observe(const index::TwoPhaseEngine::Stats& stats, uint64_t buffer_rows);
+
+    Cost cost(Tier tier) const;
+    double predictNs(Tier tier, double segments, double units) const;
+
+    static const char* name(Tier tier);
+
+private:
+    // Decayed sums of the normal equations over (segments, units) -> ns
+    struct Fit {
+        double ss = 0.0, su = 0.0, uu = 0.0;
+        double sn = 0.0, un = 0.0;
+    };
+
+    mutable std::mutex mutex_;
+    std::array<Fit, kTiers> fits_{};
+    double decay_;
+};
+
+// Fits a query to a latency budget. A query's latency is predicted from
+// the QueryCostModel as its slowest task or its total work spread over
+// the workers, whichever is larger. When the full-quality knobs would
+// overrun the deadline (times query.deadline_headroom), quality is given
+// up in a fixed order, one rung at a time, until the prediction fits:
+//  1. nprobe (delta and stable) down to 3/4, then 1/2
+//  2. rerank_factor halved, then nprobe to 1/4
+//  3. sample_p halved along with rerank_factor, then nprobe to 1/8
+//  4. a single list per segment, one rerank candidate per result
+//  5. no buffer scan, with query.deadline_drop_buffer only
+// A query no rung fits runs at the last one and is reported as over.
+class DeadlinePlanner {
+public:
+    struct Options {
+        uint32_t default_budget_ms = 0;     // query.latency_budget_ms; 0: unbudgeted
+        uint32_t max_budget_ms = 5000;      // query.timeout_ms
+        float headroom = 0.8f;              // query.deadline_headroom
+        bool drop_buffer = false;           // query.deadline_drop_buffer
+
+        static Options fromConfig(const Config& config);
+    };
+
+    // The segments a query would search
+    struct Workload {
+        uint64_t buffer_rows = 0;               // Rows in the message buffer
+        std::vector<uint64_t> delta_rows;       // Per delta segment
+        uint32_t delta_nlist = 1;               // Global centroids
+        std::vector<uint32_t> stable_nlist;     // Per stable segment
+        size_t k = 10;
+        uint32_t workers = 1;                   // Query pool threads
+    };
+
+    // Query quality knobs, as TwoPhaseEngine::Query takes them
+    struct Knobs {
+        uint32_t nprobe_delta = 6;
+        uint32_t nprobe_stable = 12;
+        uint32_t rerank_factor = 4;
+        float sample_p = 1.0f;
+        bool buffer_scan = true;
+    };
+
+    struct Budget {
+        Knobs knobs;
+        double predicted_ms = 0.0;
+        double deadline_ms = 0.0;   // 0: unbudgeted
+        uint32_t rung = 0;          // 0: full quality
+        bool fits = true;
+    };
+
+    DeadlinePlanner(const Options& options, const QueryCostModel& model);
+
+    // The query's deadline: its own budget, or the default, capped at
+    // the query timeout; 0 when neither is set
+    uint32_t deadlineMs(std::optional<uint32_t> requested) const;
+
+    double predictMs(const Workload& workload, const Knobs& knobs) const;
+
+    // The best knobs, at most `full`, predicted to meet `deadline_ms`
+    // (0: `full` as is). A `cancel` token with a deadline caps it at the
+    // time the token has left, so a query planned late in its timeout
+    // degrades rather than being cut off.
+    Budget plan(const Workload& workload, const Knobs& full, uint32_t deadline_ms,
+                const util::CancellationToken* cancel = nullptr) const;
+
+private:
+    Options options_;
+    const QueryCostModel& model_;
+};
+
+} // namespace woved
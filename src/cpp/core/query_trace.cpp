@@ -0,0 +1,161 @@
+#include "core/query_trace.h"
+#include "core/config.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace woved {
+
+namespace {
+
+// splitmix64 seeded per thread: a sampling draw takes no lock
+uint64_t draw() {
+    thread_local uint64_t state = std::random_device{}() ^
+                                  (static_cast<uint64_t>(std::random_device{}()) << 32);
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+std::string_view stageName(QueryStage stage) {
+    switch (stage) {
+        case QueryStage::CentroidProbe: return "centroid_probe";
+        case QueryStage::BufferScan: return "buffer_scan";
+        case QueryStage::Delta: return "delta";
+        case QueryStage::Stable: return "stable";
+        case QueryStage::Rerank: return "rerank";
+        case QueryStage::Total: return "total";
+    }
+    return "unknown";
+}
+
+} // namespace
+
+QueryTrace::QueryTrace(uint64_t id, bool sampled, std::chrono::nanoseconds ago)
+    : id_(id),
+      sampled_(sampled),
+      start_(std::chrono::steady_clock::now() - ago),
+      wall_(std::chrono::system_clock::now() - std::chrono::duration_cast<std::chrono::system_clock::duration>(ago)) {}
+
+uint64_t QueryTrace::elapsedNs() const {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+}
+
+void QueryTrace::add(const Span& span) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    spans_.push_back(span);
+}
+
+std::vector<QueryTrace::Span> QueryTrace::spans() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return spans_;
+}
+
+QueryTracer::Options QueryTracer::Options::fromConfig(const Config& config) {
+    const auto& tracing = config.monitoring.tracing;
+    Options options;
+    options.enabled = tracing.enabled;
+    options.sample_rate = tracing.sample_rate;
+    options.slow_ms = tracing.slow_query_ms;
+    options.keep = tracing.keep;
+    return options;
+}
+
+QueryTracer::QueryTracer(const Options& options)
+    : options_(options), slow_ns_(static_cast<uint64_t>(options.slow_ms) * 1000000) {
+    const double rate = std::clamp(options_.sample_rate, 0.0, 1.0);
+    sample_below_ = rate >= 1.0 ? std::numeric_limits<uint64_t>::max()
+                                : static_cast<uint64_t>(std::ldexp(rate, 64));
+    options_.keep = std::max<size_t>(options_.keep, 1);
+}
+
+std::unique_ptr<QueryTrace> QueryTracer::start() {
+    if (!options_.enabled || sample_below_ == 0 || draw() >= sample_below_) return nullptr;
+    return std::make_unique<QueryTrace>(next_id_.fetch_add(1, std::memory_order_relaxed), true);
+}
+
+void QueryTracer::finish(std::unique_ptr<QueryTrace> trace, const Outcome& outcome) {
+    if (!options_.enabled) return;
+    if (!trace) {
+        if (slow_ns_ == 0 || outcome.total_ns < slow_ns_) return;
+        // One span per stage that ran, laid end to end: the tasks ran in
+        // parallel, so only their sums are known
+        trace = std::make_unique<QueryTrace>(next_id_.fetch_add(1, std::memory_order_relaxed), false,
+                                             std::chrono::nanoseconds(outcome.total_ns));
+        uint64_t at = 0;
+        auto stage = [&](QueryStage s, uint64_t ns, uint64_t lists, uint64_t rows, uint64_t bytes, uint64_t wait) {
+            if (ns == 0 && rows == 0) return;
+            trace->add({s, -1, at, ns, lists, rows, bytes, wait});
+            at += ns;
+        };
+        stage(QueryStage::CentroidProbe, outcome.probe_ns, 0, 0, 0, 0);
+        stage(QueryStage::BufferScan, outcome.buffer_ns, 0, 0, 0, 0);
+        stage(QueryStage::Delta, outcome.delta_ns, outcome.delta_lists, outcome.delta_rows, outcome.delta_bytes, 0);
+        stage(QueryStage::Stable, outcome.stable_ns, outcome.stable_lists, outcome.stable_rows, outcome.stable_bytes,
+              outcome.wait_ns);
+        stage(QueryStage::Rerank, outcome.rerank_ns, 0, outcome.reranked, 0, 0);
+    }
+    trace->total_ns = outcome.total_ns;
+    trace->k = outcome.k;
+    trace->nprobe_delta = outcome.nprobe_delta;
+    trace->nprobe_stable = outcome.nprobe_stable;
+    trace->partial = outcome.partial;
+    keep(std::move(trace));
+}
+
+void QueryTracer::keep(std::unique_ptr<QueryTrace> trace) {
+    traced_.fetch_add(1, std::memory_order_relaxed);
+    std::shared_ptr<const QueryTrace> kept(std::move(trace));
+    std::lock_guard<std::mutex> lock(mutex_);
+    kept_.push_front(std::move(kept));
+    if (kept_.size() > options_.keep) kept_.pop_back();
+}
+
+std::vector<std::shared_ptr<const QueryTrace>> QueryTracer::recent(size_t limit) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t n = limit ? std::min(limit, kept_.size()) : kept_.size();
+    return {kept_.begin(), kept_.begin() + static_cast<std::ptrdiff_t>(n)};
+}
+
+std::string QueryTracer::renderJson(size_t limit) const {
+    std::string out = "{\"traces\":[";
+    bool first = true;
+    for (const auto& trace : recent(limit)) {
+        if (!first) out += ',';
+        first = false;
+        const auto at = std::chrono::duration_cast<std::chrono::microseconds>(
+            trace->startedAt().time_since_epoch()).count();
+        out += "{\"id\":" + std::to_string(trace->id()) +
+               ",\"start_unix_us\":" + std::to_string(at) +
+               ",\"sampled\":" + (trace->sampled() ? "true" : "false") +
+               ",\"total_ns\":" + std::to_string(trace->total_ns) +
+               ",\"k\":" + std::to_string(trace->k) +
+               ",\"nprobe_delta\":" + std::to_string(trace->nprobe_delta) +
+               ",\"nprobe_stable\":" + std::to_string(trace->nprobe_stable) +
+               ",\"partial\":" + (trace->partial ? "true" : "false") + ",\"spans\":[";
+        auto spans = trace->spans();
+        std::sort(spans.begin(), spans.end(), [](const QueryTrace::Span& a, const QueryTrace::Span& b) {
+            return a.start_ns < b.start_ns;
+        });
+        for (size_t i = 0; i < spans.size(); ++i) {
+            const auto& span = spans[i];
+            if (i) out += ',';
+            out += "{\"stage\":\"" + std::string(stageName(span.stage)) + "\"";
+            if (span.segment >= 0) out += ",\"segment\":" + std::to_string(span.segment);
+            out += ",\"start_ns\":" + std::to_string(span.start_ns) +
+                   ",\"duration_ns\":" + std::to_string(span.duration_ns) +
+                   ",\"lists\":" + std::to_string(span.lists) +
+                   ",\"rows\":" + std::to_string(span.rows) +
+                   ",\"bytes\":" + std::to_string(span.bytes) +
+                   ",\"wait_ns\":" + std::to_string(span.wait_ns) + "}";
+        }
+        out += "]}";
+    }
+    out += "]}";
+    return out;
+}
+
+} // namespace woved
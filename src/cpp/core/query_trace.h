@@ -0,0 +1,137 @@
+#pragma once
+
+#include "core/metrics.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace woved {
+
+struct Config;
+
+// Timeline of one traced query: a span per stage task (the buffer scan,
+// each delta or stable segment, each rerank), with what it did.
+class QueryTrace {
+public:
+    struct Span {
+        QueryStage stage;
+        int32_t segment = -1;       // Index into the query's delta or stable segments
+        uint64_t start_ns = 0;      // From the start of the search
+        uint64_t duration_ns = 0;
+        uint64_t lists = 0;         // Lists probed
+        uint64_t rows = 0;          // Candidates scored
+        uint64_t bytes = 0;         // Vector and code bytes read
+        uint64_t wait_ns = 0;       // Waiting on list reads
+    };
+
+    // `ago`: the query began that long before now
+    QueryTrace(uint64_t id, bool sampled, std::chrono::nanoseconds ago = {});
+
+    uint64_t id() const { return id_; }
+    // Picked by the sample rate; otherwise traced for being slow, with
+    // one span per stage summed over its tasks
+    bool sampled() const { return sampled_; }
+
+    uint64_t elapsedNs() const;
+    // Safe from the search's parallel tasks
+    void add(const Span& span);
+
+    // Set once the search returns
+    uint64_t total_ns = 0;
+    size_t k = 0;
+    uint32_t nprobe_delta = 0;
+    uint32_t nprobe_stable = 0;
+    bool partial = false;
+
+    std::vector<Span> spans() const;
+    std::chrono::system_clock::time_point startedAt() const { return wall_; }
+
+private:
+    uint64_t id_;
+    bool sampled_;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::system_clock::time_point wall_;
+    mutable std::mutex mutex_;
+    std::vector<Span> spans_;
+};
+
+// Opt-in per-query tracing. start() samples sample_rate of queries; an
+// unsampled query gets no trace and its search records nothing beyond its
+// usual Stats. When it returns, finish() keeps the traces of sampled
+// queries, and of any query that took at least slow_ms, built from its
+// Stats as one span per stage. The last `keep` traces are kept for the
+// debug endpoint (renderJson(), served at /debug/traces).
+class QueryTracer {
+public:
+    struct Options {
+        bool enabled = false;
+        double sample_rate = 0.001;
+        uint32_t slow_ms = 100;     // 0: sampled queries only
+        size_t keep = 256;
+
+        // monitoring.tracing
+        static Options fromConfig(const Config& config);
+    };
+
+    explicit QueryTracer(const Options& options);
+
+    QueryTracer(const QueryTracer&) = delete;
+    QueryTracer& operator=(const QueryTracer&) = delete;
+
+    bool enabled() const { return options_.enabled; }
+
+    // A trace for a sampled query, null otherwise
+    std::unique_ptr<QueryTrace> start();
+
+    // How a query went; the stage totals make the spans of a slow
+    // query that was not sampled
+    struct Outcome {
+        uint64_t total_ns = 0;
+        size_t k = 0;
+        uint32_t nprobe_delta = 0;
+        uint32_t nprobe_stable = 0;
+        bool partial = false;
+        uint64_t probe_ns = 0;
+        uint64_t buffer_ns = 0;
+        uint64_t delta_ns = 0;
+        uint64_t stable_ns = 0;
+        uint64_t rerank_ns = 0;
+        uint64_t delta_lists = 0;
+        uint64_t delta_rows = 0;
+        uint64_t delta_bytes = 0;
+        uint64_t stable_lists = 0;
+        uint64_t stable_rows = 0;
+        uint64_t stable_bytes = 0;
+        uint64_t wait_ns = 0;       // Stable scans waiting on list reads
+        uint64_t reranked = 0;
+    };
+
+    // `trace` as start() returned it
+    void finish(std::unique_ptr<QueryTrace> trace, const Outcome& outcome);
+
+    // Kept traces, newest first, at most `limit` of them (0: all)
+    std::vector<std::shared_ptr<const QueryTrace>> recent(size_t limit = 0) const;
+    std::string renderJson(size_t limit = 0) const;
+
+    uint64_t traced() const { return traced_.load(std::memory_order_relaxed); }
+
+private:
+    Options options_;
+    uint64_t sample_below_;     // Of a 64-bit draw
+    uint64_t slow_ns_;
+    std::atomic<uint64_t> next_id_{1};
+    std::atomic<uint64_t> traced_{0};
+
+    mutable std::mutex mutex_;
+    std::deque<std::shared_ptr<const QueryTrace>> kept_;
+
+    void keep(std::unique_ptr<QueryTrace> trace);
+};
+
+} // namespace woved
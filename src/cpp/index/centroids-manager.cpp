@@ -0,0 +1,431 @@
+#include "centroids-manager.h"
+#include "core/config.h"
+#include "core/metrics.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include "util/numa-aware.h"
+#include "util/simd-dispatch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <string>
+#include <utility>
+
+namespace woved::index {
+
+namespace {
+
+// Centroids per block of a batch assignment: a block of 768-dim rows
+// stays in L2 while every tile of rows is scored against it
+constexpr size_t kCentroidBlock = 128;
+// Rows per tile
+constexpr size_t kAssignRows = 16;
+
+bool contains(const std::vector<CentroidId>& lists, CentroidId c) {
+    return std::find(lists.begin(), lists.end(), c) != lists.end();
+}
+
+// 2-means over the n rows of x, seeded with the row farthest from their
+// mean and the row farthest from that one. Writes both centers and their
+// sizes; false if the rows do not separate.
+bool twoMeans(const float* x, size_t n, size_t dim, uint32_t iterations, float* centers, uint64_t* counts) {
+    const auto& t = kernels::distance_table();
+    std::vector<float> mean(dim, 0.0f);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t d = 0; d < dim; ++d) mean[d] += x[i * dim + d];
+    }
+    for (float& v : mean) v /= static_cast<float>(n);
+    auto farthest = [&](const float* from) {
+        size_t best = 0;
+        float best_dist = -1.0f;
+        for (size_t i = 0; i < n; ++i) {
+            const float dist = t.l2_sqr(x + i * dim, from, dim);
+            if (dist > best_dist) {
+                best_dist = dist;
+                best = i;
+            }
+        }
+        return best;
+    };
+    const size_t a = farthest(mean.data());
+    const size_t b = farthest(x + a * dim);
+    if (t.l2_sqr(x + a * dim, x + b * dim, dim) <= 0.0f) return false;
+    std::copy_n(x + a * dim, dim, centers);
+    std::copy_n(x + b * dim, dim, centers + dim);
+
+    std::vector<uint8_t> side(n, 2);
+    for (uint32_t it = 0; it < std::max<uint32_t>(iterations, 1); ++it) {
+        bool moved = false;
+        for (size_t i = 0; i < n; ++i) {
+            const uint8_t s = t.l2_sqr(x + i * dim, centers + dim, dim) < t.l2_sqr(x + i * dim, centers, dim);
+            moved = moved || s != side[i];
+            side[i] = s;
+        }
+        if (!moved) break;
+        std::fill_n(centers, 2 * dim, 0.0f);
+        counts[0] = counts[1] = 0;
+        for (size_t i = 0; i < n; ++i) {
+            float* center = centers + side[i] * dim;
+            for (size_t d = 0; d < dim; ++d) center[d] += x[i * dim + d];
+            counts[side[i]]++;
+        }
+        if (counts[0] == 0 || counts[1] == 0) return false;
+        for (size_t h = 0; h < 2; ++h) {
+            for (size_t d = 0; d < dim; ++d) centers[h * dim + d] /= static_cast<float>(counts[h]);
+        }
+    }
+    return counts[0] != 0 && counts[1] != 0;
+}
+
+} // namespace
+
+CentroidReplica::CentroidReplica(std::span<const float> centroids, uint32_t dim, int node, uint64_t version,
+                                 std::vector<uint8_t> retired, std::shared_ptr<const CentroidHistory> history,
+                                 std::shared_ptr<const CentroidGraph> graph)
+    : bytes_(centroids.size_bytes()), dim_(dim), count_(dim ? centroids.size() / dim : 0), node_(node),
+      version_(version), retired_(std::move(retired)),
+      history_(history ? std::move(history) : std::make_shared<const CentroidHistory>()), graph_(std::move(graph)) {
+    if (node >= 0) {
+        data_ = static_cast<float*>(util::numa_alloc_on_node(bytes_, node));
+        numa_ = data_ != nullptr;
+    }
+    if (!data_) {
+        data_ = static_cast<float*>(::operator new(std::max<size_t>(bytes_, 1), std::align_val_t{64}));
+    }
+    // First touch: the pages land on the bound node
+    if (bytes_) std::memcpy(data_, centroids.data(), bytes_);
+}
+
+CentroidReplica::~CentroidReplica() {
+    if (numa_) {
+        util::numa_free(data_, bytes_);
+    } else {
+        ::operator delete(data_, std::align_val_t{64});
+    }
+}
+
+CentroidsManager::Options CentroidsManager::Options::fromConfig(const Config& config) {
+    Options options;
+    options.replicate = config.numa.enabled && config.numa.replicate_centroids;
+    options.max_replica_bytes = size_t{config.index.global.memory_cache_mb} << 20;
+    options.list_cap = config.index.delta.list_cap;
+    options.merge_below = options.list_cap / 20;
+    options.graph = CentroidGraph::Options::fromConfig(config);
+    return options;
+}
+
+CentroidsManager::CentroidsManager(const Options& options)
+    : options_(options), nodes_(std::max<size_t>(util::numa_node_count(), 1)),
+      slots_(std::make_unique<Slot[]>(nodes_)) {
+    util::numa_note_placement("centroids", options_.replicate && nodes_ > 1
+                                               ? "one replica bound to each of " + std::to_string(nodes_) + " nodes"
+                                               : std::string("one copy"));
+}
+
+uint64_t CentroidsManager::install(std::span<const float> centroids, uint32_t dim) {
+    if (dim == 0 || centroids.size() % dim != 0) {
+        throw util::InvalidArgumentException("Centroids: " + std::to_string(centroids.size()) +
+                                             " values are not rows of dimension " + std::to_string(dim));
+    }
+    std::lock_guard<std::mutex> lock(install_mutex_);
+    const uint64_t version = version_.load(std::memory_order_relaxed) + 1;
+    auto history = std::make_shared<CentroidHistory>();
+    history->base_version = version;
+    publish(centroids, dim, version, {}, std::move(history));
+    return version;
+}
+
+std::vector<CentroidChange> CentroidsManager::rebalance(std::span<const uint64_t> list_sizes,
+                                                        const MembersFn& members) {
+    std::lock_guard<std::mutex> lock(install_mutex_);
+    auto current = slots_[0].replica.load(std::memory_order_acquire);
+    if (!current) return {};
+    const size_t dim = current->dim();
+    const size_t count = current->count();
+    if (list_sizes.size() != count) {
+        throw util::InvalidArgumentException("Centroid rebalance: " + std::to_string(list_sizes.size()) +
+                                             " list sizes for " + std::to_string(count) + " lists");
+    }
+    const uint64_t version = version_.load(std::memory_order_relaxed) + 1;
+    std::vector<float> matrix(current->centroid(0), current->centroid(0) + count * dim);
+    std::vector<uint64_t> sizes(list_sizes.begin(), list_sizes.end());
+    std::vector<uint8_t> retired(count);
+    for (size_t c = 0; c < count; ++c) retired[c] = current->retired(static_cast<CentroidId>(c));
+    std::vector<uint8_t> touched(count);  // Changed this pass
+    std::vector<CentroidChange> changes;
+
+    // Split the largest lists first
+    std::vector<CentroidId> over;
+    for (size_t c = 0; c < count; ++c) {
+        if (!retired[c] && sizes[c] > options_.list_cap) over.push_back(static_cast<CentroidId>(c));
+    }
+    std::sort(over.begin(), over.end(), [&](CentroidId a, CentroidId b) { return sizes[a] > sizes[b]; });
+    if (over.size() > options_.max_splits) over.resize(options_.max_splits);
+    std::vector<float> halves(2 * dim);
+    for (CentroidId list : over) {
+        if (matrix.size() / dim > std::numeric_limits<CentroidId>::max()) break;  // Ids exhausted
+        const std::vector<float> x = members(list);
+        const size_t n = x.size() / dim;
+        uint64_t counts[2] = {0, 0};
+        if (n < 2 || x.size() % dim != 0 ||
+            !twoMeans(x.data(), n, dim, options_.kmeans_iterations, halves.data(), counts)) {
+            continue;
+        }
+        const auto added = static_cast<CentroidId>(matrix.size() / dim);
+        std::copy_n(halves.data(), dim, matrix.data() + size_t{list} * dim);
+        matrix.insert(matrix.end(), halves.begin() + dim, halves.end());
+        // The members may be a sample; split the list's size in the same ratio
+        const uint64_t total = sizes[list];
+        sizes[list] = total * counts[0] / n;
+        sizes.push_back(total - sizes[list]);
+        retired.push_back(0);
+        touched[list] = 1;
+        touched.push_back(1);
+        changes.push_back({CentroidChange::Kind::Split, version, list, added});
+    }
+
+    // Fold sparse lists into their nearest neighbour, weighting the new
+    // center by size
+    const auto& t = kernels::distance_table();
+    size_t live = std::count(retired.begin(), retired.end(), uint8_t{0});
+    for (size_t c = 0; c < sizes.size() && live > 1; ++c) {
+        if (retired[c] || touched[c] || sizes[c] >= options_.merge_below) continue;
+        const float* from = matrix.data() + c * dim;
+        size_t into = c;
+        float best = 0.0f;
+        for (size_t d = 0; d < sizes.size(); ++d) {
+            if (d == c || retired[d] || sizes[c] + sizes[d] > options_.list_cap) continue;
+            const float dist = t.l2_sqr(from, matrix.data() + d * dim, dim);
+            if (into == c || dist < best) {
+                best = dist;
+                into = d;
+            }
+        }
+        if (into == c) continue;
+        const uint64_t merged = sizes[c] + sizes[into];
+        if (merged > 0) {
+            float* to = matrix.data() + into * dim;
+            const float wc = static_cast<float>(sizes[c]) / static_cast<float>(merged);
+            for (size_t d = 0; d < dim; ++d) to[d] += (from[d] - to[d]) * wc;
+        }
+        sizes[into] = merged;
+        sizes[c] = 0;
+        retired[c] = 1;
+        touched[c] = touched[into] = 1;
+        --live;
+        changes.push_back({CentroidChange::Kind::Merge, version, static_cast<CentroidId>(c),
+                           static_cast<CentroidId>(into)});
+    }
+
+    if (changes.empty()) return {};
+    auto history = std::make_shared<CentroidHistory>(current->history());
+    history->changes.insert(history->changes.end(), changes.begin(), changes.end());
+    publish(matrix, static_cast<uint32_t>(dim), version, std::move(retired), std::move(history));
+    return changes;
+}
+
+void CentroidsManager::publish(std::span<const float> centroids, uint32_t dim, uint64_t version,
+                               std::vector<uint8_t> retired, std::shared_ptr<const CentroidHistory> history) {
+    const bool replicate = options_.replicate && nodes_ > 1 &&
+                           centroids.size_bytes() * nodes_ <= options_.max_replica_bytes;
+    const size_t count = centroids.size() / dim;
+    const size_t live = count - std::count(retired.begin(), retired.end(), uint8_t{1});
+    std::shared_ptr<const CentroidGraph> graph;
+    if (options_.graph.wanted(live)) {
+        graph = std::make_shared<const CentroidGraph>(centroids.data(), count, dim, options_.graph, retired);
+    }
+
+    // Build every replica before any is published
+    std::vector<std::shared_ptr<const CentroidReplica>> built;
+    if (replicate) {
+        for (size_t node = 0; node < nodes_; ++node) {
+            built.push_back(std::make_shared<const CentroidReplica>(centroids, dim, static_cast<int>(node), version,
+                                                                    retired, history, graph));
+        }
+    } else {
+        built.push_back(std::make_shared<const CentroidReplica>(centroids, dim, -1, version, std::move(retired),
+                                                                std::move(history), std::move(graph)));
+    }
+
+    for (size_t node = 0; node < nodes_; ++node) {
+        slots_[node].replica.store(built[replicate ? node : 0], std::memory_order_release);
+    }
+    replicas_.store(built.size(), std::memory_order_relaxed);
+    version_.store(version, std::memory_order_release);
+}
+
+size_t CentroidsManager::bytes() const {
+    const auto replica = slots_[0].replica.load(std::memory_order_acquire);
+    if (!replica) return 0;
+    return replica->count() * replica->dim() * sizeof(float) * replicas_.load(std::memory_order_relaxed);
+}
+
+void CentroidsManager::setMaxReplicaBytes(size_t bytes) {
+    std::lock_guard<std::mutex> lock(install_mutex_);
+    options_.max_replica_bytes = bytes;
+    if (replicas_.load(std::memory_order_relaxed) <= 1) return;
+    const auto shared = slots_[0].replica.load(std::memory_order_acquire);
+    if (shared->count() * shared->dim() * sizeof(float) * nodes_ <= bytes) return;
+    // Readers of the dropped replicas finish on them; each is freed with
+    // its last reader
+    for (size_t node = 1; node < nodes_; ++node) {
+        slots_[node].replica.store(shared, std::memory_order_release);
+    }
+    replicas_.store(1, std::memory_order_relaxed);
+    LOG_INFO("centroids: replication dropped to fit {} bytes", bytes);
+}
+
+std::shared_ptr<const CentroidReplica> CentroidsManager::local() const {
+    const size_t node = static_cast<size_t>(util::current_numa_node());
+    return slots_[node < nodes_ ? node : 0].replica.load(std::memory_order_acquire);
+}
+
+CentroidId CentroidsManager::assign(const float* x) const {
+    auto replica = local();
+    if (!replica || replica->count() == 0) return 0;
+    std::vector<float> dist(replica->count());
+    kernels::distance_table().l2_sqr_block(x, replica->centroid(0), dist.size(), replica->dim(), dist.data());
+    CentroidId best = 0;
+    float best_dist = std::numeric_limits<float>::infinity();
+    for (size_t c = 0; c < dist.size(); ++c) {
+        const auto id = static_cast<CentroidId>(c);
+        if (replica->retired(id)) continue;
+        if (dist[c] < best_dist) {
+            best_dist = dist[c];
+            best = id;
+        }
+    }
+    return best;
+}
+
+void CentroidsManager::assignBatch(std::span<const float* const> rows, uint32_t dim, bool normalize, float* out,
+                                   CentroidId* ids) const {
+    const auto& t = kernels::distance_table();
+    const size_t n = rows.size();
+    auto replica = local();
+    const size_t count = replica ? replica->count() : 0;
+    if (count > 0 && replica->dim() != dim) {
+        throw util::InvalidArgumentException("batch dim " + std::to_string(dim) + " does not match centroids dim " +
+                                             std::to_string(replica->dim()));
+    }
+
+    // Normalize on the way into the batch, the only copy of each row
+    for (size_t i = 0; i < n; ++i) {
+        const float* src = rows[i];
+        float* dst = out + i * dim;
+        const float norm_sqr = normalize ? t.inner_product(src, src, dim) : 0.0f;
+        const float scale = norm_sqr > 0.0f ? 1.0f / std::sqrt(norm_sqr) : 1.0f;
+        for (size_t d = 0; d < dim; ++d) dst[d] = src[d] * scale;
+    }
+    std::fill_n(ids, n, CentroidId{0});
+    if (count == 0) return;
+
+    std::vector<float> best(n, std::numeric_limits<float>::infinity());
+    float dist[kAssignRows * kCentroidBlock];
+    for (size_t c = 0; c < count; c += kCentroidBlock) {
+        const size_t cols = std::min(kCentroidBlock, count - c);
+        for (size_t r = 0; r < n; r += kAssignRows) {
+            const size_t tile = std::min(kAssignRows, n - r);
+            t.l2_sqr_matrix(out + r * dim, tile, replica->centroid(static_cast<CentroidId>(c)), cols, dim, dist);
+            for (size_t i = 0; i < tile; ++i) {
+                for (size_t j = 0; j < cols; ++j) {
+                    const auto id = static_cast<CentroidId>(c + j);
+                    if (dist[i * cols + j] < best[r + i] && !replica->retired(id)) {
+                        best[r + i] = dist[i * cols + j];
+                        ids[r + i] = id;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void CentroidsManager::prepareUpserts(std::span<storage::WalRecordView> records, bool normalize,
+                                      std::vector<float>& staging) const {
+    auto upsert = [](const storage::WalRecordView& rec) {
+        return rec.op == storage::WalOp::UPSERT && !rec.vector.empty();
+    };
+    std::vector<const float*> rows;
+    size_t dim = 0;
+    for (const storage::WalRecordView& rec : records) {
+        if (!upsert(rec)) continue;
+        if (dim == 0) dim = rec.vector.size();
+        if (rec.vector.size() != dim) throw util::InvalidArgumentException("upsert batch mixes vector dimensions");
+        rows.push_back(rec.vector.data());
+    }
+    if (rows.empty()) return;
+
+    staging.resize(rows.size() * dim);
+    std::vector<CentroidId> ids(rows.size());
+    assignBatch(rows, static_cast<uint32_t>(dim), normalize, staging.data(), ids.data());
+    size_t i = 0;
+    for (storage::WalRecordView& rec : records) {
+        if (!upsert(rec)) continue;
+        rec.vector = std::span<const float>(staging.data() + i * dim, dim);
+        rec.centroid_id = ids[i++];
+    }
+}
+
+std::vector<CentroidId> CentroidsManager::probe(const float* query, size_t nprobe) const {
+    util::ScopedTimer timer(Metrics::global().query(QueryStage::CentroidProbe));
+    auto replica = local();
+    if (!replica) return {};
+    if (const CentroidGraph* graph = replica->graph()) {
+        const auto found = graph->search(replica->centroid(0), query, nprobe);
+        return {found.begin(), found.end()};
+    }
+    std::vector<float> all(replica->count());
+    kernels::distance_table().l2_sqr_block(query, replica->centroid(0), all.size(), replica->dim(), all.data());
+    std::vector<std::pair<float, CentroidId>> dist;
+    dist.reserve(all.size());
+    for (size_t c = 0; c < all.size(); ++c) {
+        const auto id = static_cast<CentroidId>(c);
+        if (!replica->retired(id)) dist.emplace_back(all[c], id);
+    }
+    nprobe = std::min(nprobe, dist.size());
+    std::partial_sort(dist.begin(), dist.begin() + nprobe, dist.end());
+    std::vector<CentroidId> out(nprobe);
+    for (size_t i = 0; i < nprobe; ++i) out[i] = dist[i].second;
+    return out;
+}
+
+std::optional<std::vector<CentroidId>> CentroidsManager::translate(std::span<const CentroidId> probe,
+                                                                   uint64_t segment_version) const {
+    std::vector<CentroidId> lists(probe.begin(), probe.end());
+    auto replica = local();
+    if (!replica) return lists;
+    const CentroidHistory& history = replica->history();
+    if (segment_version < history.base_version) return std::nullopt;
+    // Newest first: either kind of change left the vectors of `from` in `to`
+    for (auto it = history.changes.rbegin(); it != history.changes.rend() && it->version > segment_version; ++it) {
+        if (contains(lists, it->to) && !contains(lists, it->from)) lists.push_back(it->from);
+    }
+    return lists;
+}
+
+CentroidId CentroidsManager::reassign(const float* x, CentroidId list, uint64_t since) const {
+    auto replica = local();
+    if (!replica || list >= replica->count() || since < replica->history().base_version) return assign(x);
+    std::vector<CentroidId> lists{list};
+    for (const CentroidChange& change : replica->history().changes) {
+        if (change.version <= since || !contains(lists, change.from)) continue;
+        if (change.kind == CentroidChange::Kind::Merge) std::erase(lists, change.from);
+        if (!contains(lists, change.to)) lists.push_back(change.to);
+    }
+    if (lists.size() == 1) return lists[0];
+    const auto& t = kernels::distance_table();
+    CentroidId best = lists[0];
+    float best_dist = std::numeric_limits<float>::infinity();
+    for (CentroidId c : lists) {
+        const float d = t.l2_sqr(x, replica->centroid(c), replica->dim());
+        if (d < best_dist) {
+            best_dist = d;
+            best = c;
+        }
+    }
+    return best;
+}
+
+} // namespace woved::index
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "index/global-index.h"
+#include "storage/wal/wal-record.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::index {
+
+// One step of online maintenance. Split: list `from` was cut in two and
+// `to` is the new half. Merge: list `from` was retired into `to`.
+struct CentroidChange {
+    enum class Kind : uint8_t { Split, Merge };
+
+    Kind kind;
+    uint64_t version;  // The version that made the change
+    CentroidId from;
+    CentroidId to;
+};
+
+// The changes made since the last full install(), oldest first. Ids are
+// never reused: a split appends a row (none once CentroidId runs out), a
+// merge retires one.
+struct CentroidHistory {
+    uint64_t base_version = 0;  // The full install() the ids count from
+    std::vector<CentroidChange> changes;
+};
+
+// One copy of the global centroid matrix (count x dim, row-major), in
+// memory bound to one NUMA node. Immutable once built.
+class CentroidReplica {
+public:
+    // node < 0: ordinary memory. `retired` is empty or one flag per row.
+    // `graph`, if set, links these rows and is shared by every replica.
+    CentroidReplica(std::span<const float> centroids, uint32_t dim, int node, uint64_t version,
+                    std::vector<uint8_t> retired = {}, std::shared_ptr<const CentroidHistory> history = nullptr,
+                    std::shared_ptr<const CentroidGraph> graph = nullptr);
+    ~CentroidReplica();
+
+    CentroidReplica(const CentroidReplica&) = delete;
+    CentroidReplica& operator=(const CentroidReplica&) = delete;
+
+    uint32_t dim() const { return dim_; }
+    size_t count() const { return count_; }
+    int node() const { return node_; }
+    uint64_t version() const { return version_; }
+    const float* centroid(CentroidId c) const { return data_ + size_t{c} * dim_; }
+    bool retired(CentroidId c) const { return !retired_.empty() && retired_[c] != 0; }
+    const CentroidHistory& history() const { return *history_; }
+    const CentroidGraph* graph() const { return graph_.get(); }
+
+private:
+    float* data_ = nullptr;
+    size_t bytes_ = 0;
+    uint32_t dim_;
+    size_t count_;
+    int node_;
+    uint64_t version_;
+    bool numa_ = false;  // From util::numa_alloc_on_node()
+    std::vector<uint8_t> retired_;
+    std::shared_ptr<const CentroidHistory> history_;
+    std::shared_ptr<const CentroidGraph> graph_;
+};
+
+// The global centroids (the delta IVF lists) that every insert assigns
+// its centroid_id against and every query probes.
+//
+// With replication, each NUMA node holds its own replica and a thread
+// reads the one of the node it runs on, so the scan over the matrix stays
+// in local memory. Each node's replica pointer sits in its own cache
+// line, so the reference counting of readers on one node never touches
+// another node's line. Replication is skipped (one shared copy) on a
+// single node, or when a replica per node would exceed max_replica_bytes.
+//
+// install() publishes a retrained matrix RCU style: every replica is
+// built first, then each node's pointer is flipped. Readers hold a
+// shared_ptr to the replica they loaded, so a scan in flight finishes on
+// the old matrix, which is freed when its last reader lets go. During the
+// flip two nodes may briefly serve different versions.
+//
+// With index.global.type hnsw, each version also gets a CentroidGraph,
+// built with the replicas, and probe() walks it over the local replica.
+//
+// Between full rebuilds, rebalance() keeps the lists near list_cap: it
+// splits lists above it with a 2-means over their members and merges
+// lists below merge_below into their nearest neighbour, publishing the
+// result as a new version. Only the members of split lists are read, and
+// only vectors of changed lists need reassign(). Delta segments record
+// the version they were clustered at; translate() maps a probe set back
+// to it, so older segments keep answering without a rewrite.
+class CentroidsManager {
+public:
+    struct Options {
+        bool replicate = true;                          // numa.enabled && numa.replicate_centroids
+        size_t max_replica_bytes = size_t{512} << 20;   // index.global.memory_cache_mb, all replicas
+        size_t list_cap = 2000;                         // index.delta.list_cap
+        size_t merge_below = 100;                       // list_cap / 20
+        size_t max_splits = 64;                         // Per rebalance() pass
+        uint32_t kmeans_iterations = 8;
+        CentroidGraph::Options graph;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    // The vectors of one list (rows x dim, row-major) for a split
+    using MembersFn = std::function<std::vector<float>(CentroidId list)>;
+
+    explicit CentroidsManager(const Options& options);
+
+    // Publish a new matrix of centroids.size() / dim rows and start a new
+    // history; segments clustered before it no longer translate. Throws
+    // util::InvalidArgumentException if that is not a whole number.
+    // Returns the new version.
+    uint64_t install(std::span<const float> centroids, uint32_t dim);
+
+    // One maintenance pass. `list_sizes` holds the current size of every
+    // list (indexed by id, count() entries; throws
+    // util::InvalidArgumentException otherwise). Returns the changes made,
+    // all under one new version, or none (and no new version).
+    std::vector<CentroidChange> rebalance(std::span<const uint64_t> list_sizes, const MembersFn& members);
+
+    // The lists of a segment clustered at `segment_version` that may hold
+    // vectors of the current lists `probe`: the lists themselves, the lists
+    // they were split from and the lists merged into them since. nullopt if
+    // the segment predates the last install(); every list must be read.
+    std::optional<std::vector<CentroidId>> translate(std::span<const CentroidId> probe,
+                                                     uint64_t segment_version) const;
+
+    // The current list of `x`, assigned to `list` at `since`: the nearest of
+    // the lists `list` turned into, so only vectors of changed lists move.
+    // A full assign() if `since` predates the last install().
+    CentroidId reassign(const float* x, CentroidId list, uint64_t since) const;
+
+    // The calling thread's local replica; null before the first install()
+    std::shared_ptr<const CentroidReplica> local() const;
+
+    // Nearest live centroid to `x` (L2), as used for centroid_id; 0 before
+    // the first install()
+    CentroidId assign(const float* x) const;
+
+    // Fused ingest for a batch of upserts: writes each row (dim floats)
+    // to out[i * dim], scaled to unit norm when `normalize` (INNER_PRODUCT
+    // collections store cosine that way), and its nearest live centroid
+    // to ids[i], as assign() would. The centroids are read once per batch,
+    // a block at a time against tiles of rows (l2_sqr_matrix). A row may
+    // point into `out` at its own slot. Ids are 0 before the first
+    // install(); throws util::InvalidArgumentException if `dim` is not the
+    // centroids'.
+    void assignBatch(std::span<const float* const> rows, uint32_t dim, bool normalize, float* out,
+                     CentroidId* ids) const;
+
+    // assignBatch() over the upserts of a WAL batch: their vectors are
+    // staged in `staging`, which must outlive the records, and each record
+    // is pointed at its staged row with its centroid_id set, so the WAL
+    // and the buffer take the row as prepared. Throws
+    // util::InvalidArgumentException if the upserts differ in dimension.
+    void prepareUpserts(std::span<storage::WalRecordView> records, bool normalize,
+                        std::vector<float>& staging) const;
+
+    // The nprobe nearest live centroids to `query` (L2), nearest first;
+    // approximate when the version has a graph
+    std::vector<CentroidId> probe(const float* query, size_t nprobe) const;
+
+    uint64_t version() const { return version_.load(std::memory_order_acquire); }
+    size_t nodes() const { return nodes_; }
+    size_t replicas() const { return replicas_.load(std::memory_order_relaxed); }
+
+    // Centroid matrix bytes held, over every replica
+    size_t bytes() const;
+
+    // Move max_replica_bytes (a MemoryGovernor budget). Replicas that no
+    // longer fit are dropped now, every node then reading node 0's copy,
+    // until an install() or rebalance() finds room for them again.
+    void setMaxReplicaBytes(size_t bytes);
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<std::shared_ptr<const CentroidReplica>> replica;
+    };
+
+    // Builds the replicas of `version` and flips every node to them;
+    // install_mutex_ held
+    void publish(std::span<const float> centroids, uint32_t dim, uint64_t version, std::vector<uint8_t> retired,
+                 std::shared_ptr<const CentroidHistory> history);
+
+    Options options_;
+    size_t nodes_;
+    std::unique_ptr<Slot[]> slots_;  // One per node
+    std::mutex install_mutex_;
+    std::atomic<uint64_t> version_{0};
+    std::atomic<size_t> replicas_{0};
+};
+
+} // namespace woved::index
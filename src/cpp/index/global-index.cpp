@@ -0,0 +1,308 @@
+#include "global-index.h"
+#include "core/config.h"
+#include "util/exceptions.h"
+#include "util/simd-dispatch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <string>
+
+namespace woved::index {
+
+namespace {
+
+constexpr uint64_t kGraphMagic = 0x5247434445564f57ULL;  // "WOVEDCGR"
+constexpr uint32_t kGraphVersion = 1;
+constexpr uint32_t kMaxLevel = 16;
+
+struct GraphHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t m;
+    uint32_t ef_search;
+    uint32_t count;
+    uint32_t dim;
+    uint32_t entry;
+    uint32_t max_level;
+    uint32_t reserved;
+    uint64_t upper_size;
+};
+
+// Per thread visited marks; a new generation clears them
+class Visited {
+public:
+    void reset(size_t n) {
+        if (marks_.size() < n) marks_.resize(n, 0);
+        if (++generation_ == 0) {
+            std::fill(marks_.begin(), marks_.end(), 0);
+            generation_ = 1;
+        }
+    }
+    bool visit(uint32_t node) {
+        if (marks_[node] == generation_) return false;
+        marks_[node] = generation_;
+        return true;
+    }
+
+private:
+    std::vector<uint32_t> marks_;
+    uint32_t generation_ = 0;
+};
+
+Visited& visited() {
+    thread_local Visited marks;
+    return marks;
+}
+
+template <typename T>
+void append(std::vector<std::byte>& out, const std::vector<T>& values) {
+    const size_t at = out.size();
+    out.resize(at + values.size() * sizeof(T));
+    if (!values.empty()) std::memcpy(out.data() + at, values.data(), values.size() * sizeof(T));
+}
+
+template <typename T>
+void take(std::span<const std::byte>& in, std::vector<T>& values, size_t n) {
+    if (in.size() < n * sizeof(T)) throw util::IOException("Centroid graph: truncated");
+    values.resize(n);
+    if (n) std::memcpy(values.data(), in.data(), n * sizeof(T));
+    in = in.subspan(n * sizeof(T));
+}
+
+} // namespace
+
+CentroidGraph::Options CentroidGraph::Options::fromConfig(const Config& config) {
+    Options options;
+    options.enabled = config.index.global.type == "hnsw";
+    options.m = std::max(config.index.global.hnsw_m, 2u);
+    options.ef_construction = std::max(config.index.global.hnsw_ef_construction, options.m);
+    options.ef_search = std::max(config.index.global.hnsw_ef, 1u);
+    return options;
+}
+
+CentroidGraph::CentroidGraph(const float* centroids, size_t count, uint32_t dim, const Options& options,
+                             std::span<const uint8_t> skip)
+    : dim_(dim), m_(std::max(options.m, 2u)), ef_search_(std::max(options.ef_search, 1u)) {
+    if (count >= kNone) throw util::InvalidArgumentException("Centroid graph: too many centroids");
+    const auto& t = kernels::distance_table();
+
+    // Levels drawn up front so the upper link blocks are laid out once
+    std::mt19937_64 rng(0x5eed0c0a75e9ULL);
+    std::uniform_real_distribution<double> uniform(std::nextafter(0.0, 1.0), 1.0);
+    const double mult = 1.0 / std::log(static_cast<double>(m_));
+    levels_.assign(count, kNone);
+    upper_offset_.assign(count, 0);
+    for (size_t node = 0; node < count; ++node) {
+        if (!skip.empty() && skip[node]) continue;
+        const auto level = static_cast<uint32_t>(std::min<double>(-std::log(uniform(rng)) * mult, kMaxLevel));
+        levels_[node] = level;
+        upper_offset_[node] = static_cast<uint32_t>(upper_.size());
+        upper_.resize(upper_.size() + size_t{level} * m_, kNone);
+    }
+    links0_.assign(count * 2 * m_, kNone);
+
+    const uint32_t ef = std::max(options.ef_construction, m_);
+    for (uint32_t node = 0; node < count; ++node) {
+        const uint32_t level = levels_[node];
+        if (level == kNone) continue;
+        if (entry_ == kNone) {
+            entry_ = node;
+            max_level_ = level;
+            continue;
+        }
+        const float* q = centroids + size_t{node} * dim_;
+        std::vector<Candidate> entry{level < max_level_ ? descend(centroids, q, level + 1)
+                                                        : Candidate{t.l2_sqr(q, centroids + size_t{entry_} * dim_, dim_),
+                                                                    entry_}};
+        for (uint32_t lev = std::min(level, max_level_) + 1; lev-- > 0;) {
+            auto found = layer(centroids, q, entry, ef, lev);
+            const auto neighbours = select(centroids, found, m_);
+            uint32_t* own = links(node, lev);
+            for (size_t i = 0; i < neighbours.size(); ++i) own[i] = neighbours[i].second;
+
+            // Link back, re-selecting a neighbour's links when it is full
+            const uint32_t cap = width(lev);
+            for (const Candidate& n : neighbours) {
+                uint32_t* theirs = links(n.second, lev);
+                uint32_t used = 0;
+                while (used < cap && theirs[used] != kNone) ++used;
+                if (used < cap) {
+                    theirs[used] = node;
+                    continue;
+                }
+                const float* base = centroids + size_t{n.second} * dim_;
+                std::vector<Candidate> pool{{n.first, node}};
+                for (uint32_t i = 0; i < cap; ++i) {
+                    pool.emplace_back(t.l2_sqr(base, centroids + size_t{theirs[i]} * dim_, dim_), theirs[i]);
+                }
+                std::sort(pool.begin(), pool.end());
+                const auto kept = select(centroids, pool, cap);
+                std::fill_n(theirs, cap, kNone);
+                for (size_t i = 0; i < kept.size(); ++i) theirs[i] = kept[i].second;
+            }
+            entry = std::move(found);
+        }
+        if (level > max_level_) {
+            entry_ = node;
+            max_level_ = level;
+        }
+    }
+}
+
+uint32_t* CentroidGraph::links(uint32_t node, uint32_t level) {
+    if (level == 0) return links0_.data() + size_t{node} * 2 * m_;
+    return upper_.data() + upper_offset_[node] + size_t{level - 1} * m_;
+}
+
+const uint32_t* CentroidGraph::links(uint32_t node, uint32_t level) const {
+    return const_cast<CentroidGraph*>(this)->links(node, level);
+}
+
+CentroidGraph::Candidate CentroidGraph::descend(const float* centroids, const float* query, uint32_t level) const {
+    const auto& t = kernels::distance_table();
+    Candidate best{t.l2_sqr(query, centroids + size_t{entry_} * dim_, dim_), entry_};
+    for (uint32_t lev = max_level_; lev >= level && lev > 0; --lev) {
+        for (bool moved = true; moved;) {
+            moved = false;
+            const uint32_t* out = links(best.second, lev);
+            for (uint32_t i = 0; i < width(lev) && out[i] != kNone; ++i) {
+                const float d = t.l2_sqr(query, centroids + size_t{out[i]} * dim_, dim_);
+                if (d < best.first) {
+                    best = {d, out[i]};
+                    moved = true;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+std::vector<CentroidGraph::Candidate> CentroidGraph::layer(const float* centroids, const float* query,
+                                                           std::vector<Candidate> entry, uint32_t ef,
+                                                           uint32_t level) const {
+    const auto& t = kernels::distance_table();
+    Visited& seen = visited();
+    seen.reset(levels_.size());
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>> frontier;  // Nearest on top
+    std::priority_queue<Candidate> best;                                              // Farthest on top
+    for (const Candidate& c : entry) {
+        if (!seen.visit(c.second)) continue;
+        frontier.push(c);
+        best.push(c);
+        if (best.size() > ef) best.pop();
+    }
+    while (!frontier.empty()) {
+        const Candidate c = frontier.top();
+        if (best.size() >= ef && c.first > best.top().first) break;
+        frontier.pop();
+        const uint32_t* out = links(c.second, level);
+        for (uint32_t i = 0; i < width(level) && out[i] != kNone; ++i) {
+            if (!seen.visit(out[i])) continue;
+            const float d = t.l2_sqr(query, centroids + size_t{out[i]} * dim_, dim_);
+            if (best.size() < ef || d < best.top().first) {
+                frontier.emplace(d, out[i]);
+                best.emplace(d, out[i]);
+                if (best.size() > ef) best.pop();
+            }
+        }
+    }
+    std::vector<Candidate> out(best.size());
+    for (size_t i = out.size(); i-- > 0; best.pop()) out[i] = best.top();
+    return out;
+}
+
+std::vector<CentroidGraph::Candidate> CentroidGraph::select(const float* centroids,
+                                                            const std::vector<Candidate>& candidates,
+                                                            uint32_t limit) const {
+    const auto& t = kernels::distance_table();
+    std::vector<Candidate> kept;
+    for (const Candidate& c : candidates) {
+        if (kept.size() >= limit) break;
+        const float* x = centroids + size_t{c.second} * dim_;
+        const bool covered = std::any_of(kept.begin(), kept.end(), [&](const Candidate& k) {
+            return t.l2_sqr(x, centroids + size_t{k.second} * dim_, dim_) < c.first;
+        });
+        if (!covered) kept.push_back(c);
+    }
+    return kept;
+}
+
+std::vector<uint32_t> CentroidGraph::search(const float* centroids, const float* query, size_t nprobe) const {
+    if (entry_ == kNone || nprobe == 0) return {};
+    const auto ef = static_cast<uint32_t>(std::max<size_t>(ef_search_, nprobe));
+    const auto found = layer(centroids, query, {descend(centroids, query, 1)}, ef, 0);
+    std::vector<uint32_t> out(std::min(nprobe, found.size()));
+    for (size_t i = 0; i < out.size(); ++i) out[i] = found[i].second;
+    return out;
+}
+
+std::vector<std::byte> CentroidGraph::serialize() const {
+    GraphHeader header{};
+    header.magic = kGraphMagic;
+    header.version = kGraphVersion;
+    header.m = m_;
+    header.ef_search = ef_search_;
+    header.count = static_cast<uint32_t>(levels_.size());
+    header.dim = dim_;
+    header.entry = entry_;
+    header.max_level = max_level_;
+    header.upper_size = upper_.size();
+
+    std::vector<std::byte> out(sizeof(header));
+    std::memcpy(out.data(), &header, sizeof(header));
+    append(out, levels_);
+    append(out, upper_offset_);
+    append(out, links0_);
+    append(out, upper_);
+    return out;
+}
+
+std::unique_ptr<CentroidGraph> CentroidGraph::deserialize(std::span<const std::byte> bytes, size_t count,
+                                                          uint32_t dim) {
+    GraphHeader header{};
+    if (bytes.size() < sizeof(header)) throw util::IOException("Centroid graph: truncated");
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != kGraphMagic || header.version != kGraphVersion) {
+        throw util::IOException("Centroid graph: bad magic or version " + std::to_string(header.version));
+    }
+    if (header.count != count || header.dim != dim || header.m < 2 || header.max_level > kMaxLevel ||
+        (header.entry != kNone && header.entry >= count)) {
+        throw util::IOException("Centroid graph: does not match its centroids");
+    }
+
+    std::unique_ptr<CentroidGraph> graph(new CentroidGraph());
+    graph->dim_ = dim;
+    graph->m_ = header.m;
+    graph->ef_search_ = std::max(header.ef_search, 1u);
+    graph->entry_ = header.entry;
+    graph->max_level_ = header.max_level;
+    bytes = bytes.subspan(sizeof(header));
+    take(bytes, graph->levels_, count);
+    take(bytes, graph->upper_offset_, count);
+    take(bytes, graph->links0_, count * 2 * header.m);
+    take(bytes, graph->upper_, header.upper_size);
+    if (!bytes.empty()) throw util::IOException("Centroid graph: trailing bytes");
+
+    // Every link must land on a node and every block inside upper_
+    auto bad = [&](uint32_t link) { return link != kNone && link >= count; };
+    if (std::any_of(graph->links0_.begin(), graph->links0_.end(), bad) ||
+        std::any_of(graph->upper_.begin(), graph->upper_.end(), bad)) {
+        throw util::IOException("Centroid graph: link out of range");
+    }
+    for (size_t node = 0; node < count; ++node) {
+        const uint32_t level = graph->levels_[node];
+        if (level == kNone) continue;
+        if (level > header.max_level ||
+            uint64_t{graph->upper_offset_[node]} + uint64_t{level} * header.m > header.upper_size) {
+            throw util::IOException("Centroid graph: corrupt levels");
+        }
+    }
+    if (graph->entry_ != kNone && graph->levels_[graph->entry_] != header.max_level) {
+        throw util::IOException("Centroid graph: corrupt entry point");
+    }
+    return graph;
+}
+
+} // namespace woved::index
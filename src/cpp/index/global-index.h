@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::index {
+
+// HNSW graph over a coarse centroid matrix (index.global.type: hnsw).
+//
+// Finding the nprobe nearest of nlist centroids by brute force costs
+// nlist x dim per query and segment; the graph answers in about
+// log(nlist) x m x dim. It holds only the links: the vectors stay in the
+// caller's matrix (a NUMA local replica, an IVF-PQ model's coarse table)
+// and are passed to every search, so one graph serves every copy.
+//
+// Built once when the centroids are trained, never updated. Lists the
+// build skips (retired centroids) are never returned.
+class CentroidGraph {
+public:
+    struct Options {
+        bool enabled = false;          // index.global.type == "hnsw"
+        uint32_t m = 16;               // Links per node above level 0; 2m at level 0
+        uint32_t ef_construction = 200;
+        uint32_t ef_search = 64;       // Raised to nprobe when smaller
+        size_t min_lists = 256;        // Fewer centroids: brute force is as fast
+
+        static Options fromConfig(const Config& config);
+
+        // Whether a matrix of `lists` centroids should get a graph
+        bool wanted(size_t lists) const { return enabled && lists >= min_lists; }
+    };
+
+    // Links the `count` rows of `centroids` (row-major, dim wide) whose
+    // `skip` flag is clear (empty: all rows). Deterministic for a given
+    // input.
+    CentroidGraph(const float* centroids, size_t count, uint32_t dim, const Options& options,
+                  std::span<const uint8_t> skip = {});
+
+    // The nprobe nearest linked rows of `centroids` (the matrix the graph
+    // was built on, or a copy) to `query` by L2, nearest first
+    std::vector<uint32_t> search(const float* centroids, const float* query, size_t nprobe) const;
+
+    size_t size() const { return levels_.size(); }
+    uint32_t dim() const { return dim_; }
+
+    std::vector<std::byte> serialize() const;
+
+    // Throws util::IOException if `bytes` is not a graph over `count` rows
+    // of `dim`
+    static std::unique_ptr<CentroidGraph> deserialize(std::span<const std::byte> bytes, size_t count, uint32_t dim);
+
+private:
+    CentroidGraph() = default;
+
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    uint32_t* links(uint32_t node, uint32_t level);
+    const uint32_t* links(uint32_t node, uint32_t level) const;
+    uint32_t width(uint32_t level) const { return level == 0 ? 2 * m_ : m_; }
+
+    using Candidate = std::pair<float, uint32_t>;  // L2 distance, node
+
+    // Greedy descent from the entry point to `level`
+    Candidate descend(const float* centroids, const float* query, uint32_t level) const;
+
+    // Beam search of one level from `entry`; up to ef nodes, nearest first
+    std::vector<Candidate> layer(const float* centroids, const float* query, std::vector<Candidate> entry,
+                                 uint32_t ef, uint32_t level) const;
+
+    // Up to `limit` of `candidates` (nearest first) that are not closer to
+    // an already kept neighbour than to the node: spreads the links out
+    std::vector<Candidate> select(const float* centroids, const std::vector<Candidate>& candidates,
+                                  uint32_t limit) const;
+
+    uint32_t dim_ = 0;
+    uint32_t m_ = 16;
+    uint32_t ef_search_ = 64;
+    uint32_t entry_ = kNone;
+    uint32_t max_level_ = 0;
+    std::vector<uint32_t> levels_;        // Top level per node; kNone = not linked
+    std::vector<uint32_t> links0_;        // 2m per node, kNone padded
+    std::vector<uint32_t> upper_offset_;  // Start of a node's level 1.. blocks in upper_
+    std::vector<uint32_t> upper_;         // m per node and level above 0
+};
+
+} // namespace woved::index
@@ -0,0 +1,303 @@
+#include "gpu-backend.h"
+#include "core/config.h"
+#include "storage/segment/seg-stable.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <numeric>
+
+#ifdef WOVED_USE_GPU
+#include <cuda_runtime.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/gpu/GpuAutoTune.h>
+#include <faiss/gpu/GpuCloner.h>
+#include <faiss/gpu/GpuIndexFlat.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/impl/FaissException.h>
+#include <list>
+#include <mutex>
+#include <string>
+#endif
+
+namespace woved::index {
+
+#ifdef WOVED_USE_GPU
+
+namespace {
+
+// Largest k FAISS GPU selects in one search
+constexpr size_t kMaxSelect = 2048;
+
+// cudaHostAlloc'd buffer: page-locked, so copies to the device run at
+// full bus speed without a staging copy in the driver
+class PinnedBuffer {
+public:
+    explicit PinnedBuffer(size_t bytes) {
+        if (cudaHostAlloc(&data_, bytes, cudaHostAllocDefault) != cudaSuccess) {
+            data_ = nullptr;
+            return;
+        }
+        bytes_ = bytes;
+    }
+    ~PinnedBuffer() {
+        if (data_) cudaFreeHost(data_);
+    }
+
+    PinnedBuffer(const PinnedBuffer&) = delete;
+    PinnedBuffer& operator=(const PinnedBuffer&) = delete;
+
+    std::byte* data() const { return static_cast<std::byte*>(data_); }
+    size_t bytes() const { return bytes_; }
+
+private:
+    void* data_ = nullptr;
+    size_t bytes_ = 0;
+};
+
+} // namespace
+
+struct GpuBackend::Impl {
+    // A stable segment's IVF-PQ on the device
+    struct Mirror {
+        const storage::StableSegment* segment;
+        std::string path;
+        std::unique_ptr<faiss::Index> index;
+    };
+
+    faiss::gpu::StandardGpuResources resources;
+    PinnedBuffer staging;
+    int device;
+    std::mutex mutex;
+    std::list<Mirror> mirrors;  // Most recently searched first
+
+    Impl(int device, size_t staging_bytes) : staging(staging_bytes), device(device) {}
+
+    // Rows per staging round of `row_bytes` each
+    size_t rounds(size_t row_bytes) const { return std::max<size_t>(staging.bytes() / row_bytes, 1); }
+
+    // The segment's mirror, built on a miss; null if it cannot be
+    faiss::Index* mirror(const storage::StableSegment& segment, size_t keep, bool& built);
+};
+
+faiss::Index* GpuBackend::Impl::mirror(const storage::StableSegment& segment, size_t keep, bool& built) {
+    built = false;
+    const std::string& path = segment.reader().path();
+    for (auto it = mirrors.begin(); it != mirrors.end(); ++it) {
+        if (it->segment == &segment && it->path == path) {
+            mirrors.splice(mirrors.begin(), mirrors, it);
+            return mirrors.front().index.get();
+        }
+    }
+
+    const IvfPqModel& model = *segment.model();
+    const ProductQuantizer& pq = model.pq();
+    const size_t dim = model.dim();
+    if (pq.nbits() != 8) return nullptr;
+
+    // Probe and score in the rotated space: rotate(q) - cR is the rotated
+    // residual the codes were trained on, and rotation keeps L2 order
+    faiss::IndexFlatL2 quantizer(static_cast<faiss::idx_t>(dim));
+    quantizer.add(model.nlist(), model.centroidsRotated().data());
+    faiss::IndexIVFPQ cpu(&quantizer, dim, model.nlist(), pq.m(), pq.nbits());
+    cpu.pq.centroids.assign(pq.centroids().begin(), pq.centroids().end());
+    cpu.is_trained = true;
+
+    std::vector<uint32_t> lists(model.nlist());
+    std::iota(lists.begin(), lists.end(), 0u);
+    std::vector<std::byte> codes;
+    const auto ranges = segment.readListCodes(lists, codes);
+    size_t pos = 0;
+    std::vector<faiss::idx_t> ids;
+    for (uint32_t l = 0; l < ranges.size(); ++l) {
+        const auto& range = ranges[l];
+        if (range.rows == 0) continue;
+        ids.resize(range.rows);
+        std::iota(ids.begin(), ids.end(), static_cast<faiss::idx_t>(range.first_row));
+        cpu.invlists->add_entries(l, range.rows, ids.data(), reinterpret_cast<const uint8_t*>(codes.data() + pos));
+        cpu.ntotal += static_cast<faiss::idx_t>(range.rows);
+        pos += range.rows * pq.codeBytes();
+    }
+
+    faiss::gpu::GpuClonerOptions options;
+    options.useFloat16LookupTables = false;  // Keep ADC distances as the CPU computes them
+    std::unique_ptr<faiss::Index> index(faiss::gpu::index_cpu_to_gpu(&resources, device, &cpu, &options));
+    mirrors.push_front({&segment, path, std::move(index)});
+    while (mirrors.size() > std::max<size_t>(keep, 1)) mirrors.pop_back();
+    built = true;
+    return mirrors.front().index.get();
+}
+
+std::unique_ptr<GpuBackend> GpuBackend::create(const Options& options) {
+    if (!options.enabled) return nullptr;
+    int devices = 0;
+    if (cudaGetDeviceCount(&devices) != cudaSuccess || static_cast<int>(options.device) >= devices) {
+        LOG_WARN("gpu: device {} not available ({} found); using the CPU", options.device, devices);
+        return nullptr;
+    }
+    try {
+        auto impl = std::make_unique<Impl>(static_cast<int>(options.device), options.staging_bytes);
+        if (!impl->staging.data()) {
+            LOG_WARN("gpu: cannot pin {} bytes of staging memory; using the CPU", options.staging_bytes);
+            return nullptr;
+        }
+        LOG_INFO("gpu: device {} ready, {} MiB staging", options.device, options.staging_bytes >> 20);
+        return std::unique_ptr<GpuBackend>(new GpuBackend(options, std::move(impl)));
+    } catch (const faiss::FaissException& e) {
+        LOG_WARN("gpu: device {}: {}; using the CPU", options.device, e.what());
+        return nullptr;
+    }
+}
+
+bool GpuBackend::assign(const float* x, size_t n, size_t dim, const float* centroids, size_t k, uint32_t* out) {
+    if (n == 0) return true;
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    try {
+        faiss::gpu::GpuIndexFlatConfig config;
+        config.device = impl_->device;
+        faiss::gpu::GpuIndexFlatL2 flat(&impl_->resources, static_cast<int>(dim), config);
+        flat.add(static_cast<faiss::idx_t>(k), centroids);
+
+        // Stage rows in, labels (and their distances) out
+        const size_t row_bytes = dim * sizeof(float) + sizeof(float) + sizeof(faiss::idx_t);
+        const size_t per_round = impl_->rounds(row_bytes);
+        auto* rows = reinterpret_cast<float*>(impl_->staging.data());
+        for (size_t first = 0; first < n; first += per_round) {
+            const size_t count = std::min(per_round, n - first);
+            auto* labels = reinterpret_cast<faiss::idx_t*>(rows + count * dim);
+            auto* dist = reinterpret_cast<float*>(labels + count);
+            std::copy_n(x + first * dim, count * dim, rows);
+            flat.search(static_cast<faiss::idx_t>(count), rows, 1, dist, labels);
+            for (size_t i = 0; i < count; ++i) out[first + i] = static_cast<uint32_t>(std::max<faiss::idx_t>(labels[i], 0));
+        }
+    } catch (const faiss::FaissException& e) {
+        LOG_WARN("gpu: assignment failed, using the CPU: {}", e.what());
+        fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    assigns_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool GpuBackend::searchStable(const storage::StableSegment& segment, const float* queries_rotated, size_t nq,
+                              uint32_t nprobe, size_t candidates, std::vector<std::vector<kernels::ScanHit>>& out) {
+    out.assign(nq, {});
+    if (nq == 0 || candidates == 0) return true;
+    if (!segment.model() || candidates > kMaxSelect) {
+        fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    const size_t dim = segment.model()->dim();
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    try {
+        bool built = false;
+        faiss::Index* index = impl_->mirror(segment, options_.cached_segments, built);
+        if (built) uploads_.fetch_add(1, std::memory_order_relaxed);
+        if (!index) {
+            fallbacks_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        faiss::gpu::GpuParameterSpace().set_index_parameter(
+            index, "nprobe", std::min<double>(nprobe, segment.model()->nlist()));
+
+        const size_t row_bytes = dim * sizeof(float) + candidates * (sizeof(float) + sizeof(faiss::idx_t));
+        const size_t per_round = impl_->rounds(row_bytes);
+        auto* rows = reinterpret_cast<float*>(impl_->staging.data());
+        for (size_t first = 0; first < nq; first += per_round) {
+            const size_t count = std::min(per_round, nq - first);
+            auto* labels = reinterpret_cast<faiss::idx_t*>(rows + count * dim);
+            auto* dist = reinterpret_cast<float*>(labels + count * candidates);
+            std::copy_n(queries_rotated + first * dim, count * dim, rows);
+            index->search(static_cast<faiss::idx_t>(count), rows, static_cast<faiss::idx_t>(candidates), dist, labels);
+            for (size_t q = 0; q < count; ++q) {
+                auto& hits = out[first + q];
+                for (size_t j = 0; j < candidates; ++j) {
+                    const faiss::idx_t row = labels[q * candidates + j];
+                    if (row < 0) break;
+                    hits.push_back({-dist[q * candidates + j], static_cast<uint64_t>(row)});
+                }
+            }
+        }
+    } catch (const faiss::FaissException& e) {
+        LOG_WARN("gpu: stable search failed, using the CPU: {}", e.what());
+        impl_->mirrors.clear();
+        fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    queries_.fetch_add(nq, std::memory_order_relaxed);
+    return true;
+}
+
+void GpuBackend::evict(const storage::StableSegment& segment) {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    impl_->mirrors.remove_if([&](const Impl::Mirror& m) { return m.segment == &segment; });
+}
+
+#else // !WOVED_USE_GPU
+
+struct GpuBackend::Impl {};
+
+std::unique_ptr<GpuBackend> GpuBackend::create(const Options& options) {
+    if (options.enabled) LOG_WARN("gpu: experimental.gpu_acceleration is set but this build has no GPU support");
+    return nullptr;
+}
+
+bool GpuBackend::assign(const float*, size_t, size_t, const float*, size_t, uint32_t*) {
+    fallbacks_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool GpuBackend::searchStable(const storage::StableSegment&, const float*, size_t, uint32_t, size_t,
+                              std::vector<std::vector<kernels::ScanHit>>&) {
+    fallbacks_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void GpuBackend::evict(const storage::StableSegment&) {}
+
+#endif // WOVED_USE_GPU
+
+GpuBackend::Options GpuBackend::Options::fromConfig(const Config& config) {
+    const ExperimentalConfig& experimental = config.experimental;
+    Options options;
+    options.enabled = experimental.gpu_acceleration;
+    options.device = experimental.gpu_device_id;
+    options.min_batch = std::max(experimental.gpu_min_batch, 1u);
+    options.staging_bytes = experimental.gpu_staging_bytes;
+    options.cached_segments = std::max(experimental.gpu_cached_segments, 1u);
+    return options;
+}
+
+GpuBackend::GpuBackend(const Options& options, std::unique_ptr<Impl> impl)
+    : options_(options), impl_(std::move(impl)) {}
+
+GpuBackend::~GpuBackend() = default;
+
+AssignFn GpuBackend::assigner() {
+    return [this](const float* x, size_t n, size_t dim, const float* centroids, size_t k, uint32_t* out) {
+        return assign(x, n, dim, centroids, k, out);
+    };
+}
+
+GpuBackend::Stats GpuBackend::getStats() const {
+    Stats stats;
+    stats.batches = batches_.load(std::memory_order_relaxed);
+    stats.queries = queries_.load(std::memory_order_relaxed);
+    stats.assigns = assigns_.load(std::memory_order_relaxed);
+    stats.fallbacks = fallbacks_.load(std::memory_order_relaxed);
+    stats.uploads = uploads_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<std::pair<std::string_view, double>> GpuBackend::metrics() const {
+    Stats stats = getStats();
+    return {
+        {"woved_gpu_batches_total", static_cast<double>(stats.batches)},
+        {"woved_gpu_queries_total", static_cast<double>(stats.queries)},
+        {"woved_gpu_assigns_total", static_cast<double>(stats.assigns)},
+        {"woved_gpu_fallbacks_total", static_cast<double>(stats.fallbacks)},
+        {"woved_gpu_uploads_total", static_cast<double>(stats.uploads)},
+    };
+}
+
+} // namespace woved::index
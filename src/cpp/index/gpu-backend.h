@@ -0,0 +1,108 @@
+#pragma once
+
+#include "index/ivf-pq.h"
+#include "util/simd-dispatch.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::storage {
+class StableSegment;
+}
+
+namespace woved::index {
+
+// Optional GPU offload (experimental.gpu_acceleration), through FAISS GPU
+// in builds with WOVED_USE_GPU:
+//
+//  - Batched stable-tier ADC (TwoPhaseEngine::searchBatch): a stable
+//    segment is mirrored on the device as a FAISS IVF-PQ over the model's
+//    rotated coarse centroids and PQ codebooks, and a batch of queries
+//    gets its ADC candidates there; rerank stays on the CPU. Mirrors are
+//    built on first use and kept for the cached_segments most recently
+//    searched segments. 8-bit PQ only.
+//  - Segment builds: assigner() runs the nearest-centroid steps of
+//    k-means, PQ training and encoding (IvfPqModel::Params::assign; set
+//    it on StableBuildScheduler::Options::build).
+//
+// Rows cross the bus through a pinned host staging buffer of
+// staging_bytes, in as many rounds as it takes. Every call returns false
+// rather than throwing when the device fails or the input does not fit
+// (PQ width, k over the device's selection limit), and the caller runs
+// the CPU path. Calls are serialized on one device.
+class GpuBackend {
+public:
+    struct Options {
+        bool enabled = false;           // experimental.gpu_acceleration
+        uint32_t device = 0;            // experimental.gpu_device_id
+        size_t min_batch = 64;          // experimental.gpu_min_batch
+        size_t staging_bytes = 64 << 20;  // experimental.gpu_staging_bytes
+        size_t cached_segments = 8;     // experimental.gpu_cached_segments
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        uint64_t batches = 0;           // Stable segment searches run on the device
+        uint64_t queries = 0;
+        uint64_t assigns = 0;           // Assignment calls run on the device
+        uint64_t fallbacks = 0;         // Calls handed back to the CPU
+        uint64_t uploads = 0;           // Segment mirrors built
+    };
+
+    // Null when disabled, built without WOVED_USE_GPU, or the device
+    // cannot be opened (logged)
+    static std::unique_ptr<GpuBackend> create(const Options& options);
+    ~GpuBackend();
+
+    GpuBackend(const GpuBackend&) = delete;
+    GpuBackend& operator=(const GpuBackend&) = delete;
+
+    // Batches smaller than this are not worth the transfer
+    size_t minBatch() const { return options_.min_batch; }
+
+    // Nearest of `k` centroids (L2) to each of `n` rows
+    bool assign(const float* x, size_t n, size_t dim, const float* centroids, size_t k, uint32_t* out);
+
+    // assign() as an IvfPqModel::Params::assign hook; the backend must
+    // outlive builds using it
+    AssignFn assigner();
+
+    // ADC candidates over `nprobe` lists of one stable segment for `nq`
+    // queries (rows of `queries_rotated`, the model's rotate() of each).
+    // out[q] receives up to `candidates` hits, best first, scored by
+    // negated approximate distance as on the CPU.
+    bool searchStable(const storage::StableSegment& segment, const float* queries_rotated, size_t nq,
+                      uint32_t nprobe, size_t candidates, std::vector<std::vector<kernels::ScanHit>>& out);
+
+    // Drop a segment's mirror (call before the segment is closed)
+    void evict(const storage::StableSegment& segment);
+
+    Stats getStats() const;
+
+    // Gauges under their exported names (telemetry.metrics)
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct Impl;
+
+    GpuBackend(const Options& options, std::unique_ptr<Impl> impl);
+
+    Options options_;
+    std::unique_ptr<Impl> impl_;
+    std::atomic<uint64_t> batches_{0};
+    std::atomic<uint64_t> queries_{0};
+    std::atomic<uint64_t> assigns_{0};
+    std::atomic<uint64_t> fallbacks_{0};
+    std::atomic<uint64_t> uploads_{0};
+};
+
+} // namespace woved::index
@@ -0,0 +1,493 @@
+#include "hnsw-cache.h"
+#include "core/config.h"
+#include "util/exceptions.h"
+#include "util/simd-dispatch.h"
+#include "util/vector-codec.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <queue>
+
+namespace woved::index {
+
+namespace {
+
+constexpr uint32_t kMaxLevel = 16;
+constexpr size_t kVictimSample = 8;
+constexpr size_t kMaxQueued = 4096;
+constexpr uint64_t kMinRecallSamples = 32;
+
+uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Cosine vectors are stored, and queried, at unit length
+void normalize(float* x, size_t dim) {
+    const float norm = std::sqrt(kernels::distance_table().inner_product(x, x, dim));
+    if (norm > 0.0f) {
+        for (size_t i = 0; i < dim; ++i) x[i] /= norm;
+    }
+}
+
+// Per thread visited marks; a new generation clears them
+class Visited {
+public:
+    void reset(size_t n) {
+        if (marks_.size() < n) marks_.resize(n, 0);
+        if (++generation_ == 0) {
+            std::fill(marks_.begin(), marks_.end(), 0);
+            generation_ = 1;
+        }
+    }
+    bool visit(uint32_t slot) {
+        if (marks_[slot] == generation_) return false;
+        marks_[slot] = generation_;
+        return true;
+    }
+
+private:
+    std::vector<uint32_t> marks_;
+    uint32_t generation_ = 0;
+};
+
+Visited& visited() {
+    thread_local Visited marks;
+    return marks;
+}
+
+} // namespace
+
+HnswCache::Options HnswCache::Options::fromConfig(const Config& config) {
+    const HNSWCacheConfig& cache = config.index.hnsw_cache;
+    Options options;
+    options.max_elements = cache.max_elements;
+    options.m = std::max(cache.m, 2u);
+    options.ef_construction = std::max(cache.ef_construction, options.m);
+    options.ef = std::max(cache.ef, 1u);
+    options.admit_hits = cache.admit_hits;
+    options.answer_recall = cache.answer_recall;
+    options.verify_every = cache.verify_every;
+    options.metric = util::parse_metric(config.collection.metric);
+    return options;
+}
+
+HnswCache::HnswCache(const Options& options, uint32_t dim)
+    : options_(options), dim_(dim), max_elements_(options.max_elements) {
+    if (dim == 0) throw util::InvalidArgumentException("HNSW cache: dimension is 0");
+    options_.m = std::max(options_.m, 2u);
+    options_.ef = std::max(options_.ef, 1u);
+    options_.verify_every = std::max(options_.verify_every, 1u);
+    level_mult_ = 1.0 / std::log(static_cast<double>(options_.m));
+    const size_t width = std::bit_ceil(std::clamp<size_t>(options_.max_elements, 1024, size_t{1} << 24));
+    sketch_.assign(kSketchRows * width, 0);
+    sketch_mask_ = width - 1;
+}
+
+float HnswCache::distance(const float* query, uint32_t slot) const {
+    const auto& t = kernels::distance_table();
+    return options_.metric == Metric::L2 ? t.l2_sqr(query, vector(slot), dim_)
+                                         : -t.inner_product(query, vector(slot), dim_);
+}
+
+uint32_t* HnswCache::links(uint32_t slot, uint32_t level) {
+    if (level == 0) return links0_.data() + size_t{slot} * 2 * options_.m;
+    return upper_[slot].data() + size_t{level - 1} * options_.m;
+}
+
+const uint32_t* HnswCache::links(uint32_t slot, uint32_t level) const {
+    return const_cast<HnswCache*>(this)->links(slot, level);
+}
+
+// A link may lead into a reused slot whose new level is lower than the
+// link's; such nodes are skipped at levels they no longer reach.
+HnswCache::Candidate HnswCache::descend(const float* query, uint32_t level) const {
+    Candidate best{distance(query, entry_), entry_};
+    for (uint32_t lev = max_level_; lev >= level && lev > 0; --lev) {
+        for (bool moved = true; moved;) {
+            moved = false;
+            const uint32_t* out = links(best.second, lev);
+            for (uint32_t i = 0; i < width(lev) && out[i] != kNone; ++i) {
+                if (nodes_[out[i]].level < lev) continue;
+                const float d = distance(query, out[i]);
+                if (d < best.first) {
+                    best = {d, out[i]};
+                    moved = true;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+std::vector<HnswCache::Candidate> HnswCache::layer(const float* query, std::vector<Candidate> entry, uint32_t ef,
+                                                   uint32_t level) const {
+    Visited& seen = visited();
+    seen.reset(nodes_.size());
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>> frontier;  // Nearest on top
+    std::priority_queue<Candidate> best;                                              // Farthest on top
+    for (const Candidate& c : entry) {
+        if (!seen.visit(c.second)) continue;
+        frontier.push(c);
+        best.push(c);
+        if (best.size() > ef) best.pop();
+    }
+    while (!frontier.empty()) {
+        const Candidate c = frontier.top();
+        if (best.size() >= ef && c.first > best.top().first) break;
+        frontier.pop();
+        const uint32_t* out = links(c.second, level);
+        for (uint32_t i = 0; i < width(level) && out[i] != kNone; ++i) {
+            const uint32_t next = out[i];
+            if (nodes_[next].level < level || !seen.visit(next)) continue;
+            const float d = distance(query, next);
+            if (best.size() < ef || d < best.top().first) {
+                frontier.emplace(d, next);
+                best.emplace(d, next);
+                if (best.size() > ef) best.pop();
+            }
+        }
+    }
+    std::vector<Candidate> out(best.size());
+    for (size_t i = out.size(); i-- > 0; best.pop()) out[i] = best.top();
+    return out;
+}
+
+std::vector<HnswCache::Candidate> HnswCache::select(const std::vector<Candidate>& candidates,
+                                                    uint32_t limit) const {
+    std::vector<Candidate> kept;
+    for (const Candidate& c : candidates) {
+        if (kept.size() >= limit) break;
+        const float* x = vector(c.second);
+        const bool covered = std::any_of(kept.begin(), kept.end(),
+                                         [&](const Candidate& k) { return distance(x, k.second) < c.first; });
+        if (!covered) kept.push_back(c);
+    }
+    return kept;
+}
+
+std::vector<HnswCache::Hit> HnswCache::search(std::span<const float> query, size_t k) const {
+    if (query.size() != dim_ || k == 0) return {};
+    std::vector<float> q(query.begin(), query.end());
+    if (options_.metric == Metric::COSINE) normalize(q.data(), dim_);
+
+    std::shared_lock lock(mutex_);
+    if (entry_ == kNone) return {};
+    const auto ef = static_cast<uint32_t>(std::max<size_t>(options_.ef, k));
+    const auto found = layer(q.data(), {descend(q.data(), 1)}, ef, 0);
+    std::vector<Hit> out;
+    for (const Candidate& c : found) {
+        const Node& node = nodes_[c.second];
+        if (!node.live) continue;
+        out.push_back({node.id_hash, node.epoch, -c.first});
+        if (out.size() == k) break;
+    }
+    return out;
+}
+
+bool HnswCache::answer(size_t k, size_t found) {
+    const uint64_t n = queries_.fetch_add(1, std::memory_order_relaxed);
+    if (k == 0 || found < k || n % options_.verify_every == 0) return false;
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    if (recall_samples_ < kMinRecallSamples || recall_ < options_.answer_recall) return false;
+    stats_.answered++;
+    return true;
+}
+
+void HnswCache::recordRecall(std::span<const Hit> cached, std::span<const VectorIdHash> final_ids) {
+    if (final_ids.empty()) return;
+    size_t found = 0;
+    for (VectorIdHash id : final_ids) {
+        found += std::any_of(cached.begin(), cached.end(), [&](const Hit& h) { return h.id_hash == id; });
+    }
+    const float recall = static_cast<float>(found) / static_cast<float>(final_ids.size());
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    // Running mean over the first samples, then a moving average
+    recall_samples_++;
+    const float alpha = std::max(1.0f / static_cast<float>(recall_samples_), 1.0f / 64.0f);
+    recall_ += (recall - recall_) * alpha;
+}
+
+uint32_t HnswCache::frequency(VectorIdHash id) const {
+    const size_t width = sketch_mask_ + 1;
+    uint32_t count = UINT32_MAX;
+    uint64_t h = id;
+    for (size_t row = 0; row < kSketchRows; ++row) {
+        h = mix(h + row);
+        count = std::min<uint32_t>(count, sketch_[row * width + (h & sketch_mask_)]);
+    }
+    return count;
+}
+
+uint32_t HnswCache::increment(VectorIdHash id) {
+    const size_t width = sketch_mask_ + 1;
+    uint32_t count = UINT32_MAX;
+    uint64_t h = id;
+    for (size_t row = 0; row < kSketchRows; ++row) {
+        h = mix(h + row);
+        uint8_t& c = sketch_[row * width + (h & sketch_mask_)];
+        if (c < UINT8_MAX) ++c;
+        count = std::min<uint32_t>(count, c);
+    }
+    if (++observed_ >= 10 * std::max<size_t>(options_.max_elements, 1)) {
+        for (uint8_t& c : sketch_) c >>= 1;
+        observed_ /= 2;
+    }
+    return count;
+}
+
+void HnswCache::observe(std::span<const VectorIdHash> ids) {
+    // Cached ids are looked up first: the graph lock is never taken under
+    // the statistics lock
+    std::vector<uint8_t> cached(ids.size());
+    {
+        std::shared_lock lock(mutex_);
+        for (size_t i = 0; i < ids.size(); ++i) cached[i] = slots_.count(ids[i]) != 0;
+    }
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        const uint32_t count = increment(ids[i]);
+        if (cached[i] || count < options_.admit_hits || queue_.size() >= kMaxQueued) continue;
+        if (queued_.insert(ids[i]).second) queue_.push_back(ids[i]);
+    }
+}
+
+std::vector<VectorIdHash> HnswCache::wanted(size_t max) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    const size_t n = std::min(max, queue_.size());
+    std::vector<VectorIdHash> out(queue_.begin(), queue_.begin() + n);
+    queue_.erase(queue_.begin(), queue_.begin() + n);
+    for (VectorIdHash id : out) queued_.erase(id);
+    return out;
+}
+
+uint32_t HnswCache::allocate(uint32_t level) {
+    uint32_t slot;
+    if (!free_.empty()) {
+        slot = free_.back();
+        free_.pop_back();
+    } else {
+        slot = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+        vectors_.resize(vectors_.size() + dim_);
+        links0_.resize(links0_.size() + 2 * options_.m, kNone);
+        upper_.emplace_back();
+    }
+    std::fill_n(links(slot, 0), 2 * options_.m, kNone);
+    upper_[slot].assign(size_t{level} * options_.m, kNone);
+    nodes_[slot].level = level;
+
+    if (slot == entry_) {
+        // The entry point is being reused: enter at the highest other node
+        entry_ = kNone;
+        max_level_ = 0;
+        for (uint32_t s = 0; s < nodes_.size(); ++s) {
+            if (s != slot && (entry_ == kNone || nodes_[s].level > max_level_)) {
+                entry_ = s;
+                max_level_ = nodes_[s].level;
+            }
+        }
+    }
+    return slot;
+}
+
+void HnswCache::link(uint32_t slot) {
+    const uint32_t level = nodes_[slot].level;
+    if (entry_ == kNone) {
+        entry_ = slot;
+        max_level_ = level;
+        return;
+    }
+    const float* q = vector(slot);
+    std::vector<Candidate> entry{level < max_level_ ? descend(q, level + 1) : Candidate{distance(q, entry_), entry_}};
+    for (uint32_t lev = std::min(level, max_level_) + 1; lev-- > 0;) {
+        auto found = layer(q, entry, options_.ef_construction, lev);
+        std::erase_if(found, [&](const Candidate& c) { return c.second == slot; });
+        const auto neighbours = select(found, options_.m);
+        uint32_t* own = links(slot, lev);
+        for (size_t i = 0; i < neighbours.size(); ++i) own[i] = neighbours[i].second;
+
+        // Link back, re-selecting a neighbour's links when it is full
+        const uint32_t cap = width(lev);
+        for (const Candidate& n : neighbours) {
+            uint32_t* theirs = links(n.second, lev);
+            uint32_t used = 0;
+            while (used < cap && theirs[used] != kNone) ++used;
+            if (used < cap) {
+                theirs[used] = slot;
+                continue;
+            }
+            const float* base = vector(n.second);
+            std::vector<Candidate> pool{{n.first, slot}};
+            for (uint32_t i = 0; i < cap; ++i) {
+                if (nodes_[theirs[i]].level >= lev) pool.emplace_back(distance(base, theirs[i]), theirs[i]);
+            }
+            std::sort(pool.begin(), pool.end());
+            const auto kept = select(pool, cap);
+            std::fill_n(theirs, cap, kNone);
+            for (size_t i = 0; i < kept.size(); ++i) theirs[i] = kept[i].second;
+        }
+        entry = std::move(found);
+        if (entry.empty()) entry.push_back({distance(q, entry_), entry_});
+    }
+    if (level > max_level_) {
+        entry_ = slot;
+        max_level_ = level;
+    }
+}
+
+void HnswCache::drop(uint32_t slot) {
+    Node& node = nodes_[slot];
+    node.live = false;
+    slots_.erase(node.id_hash);
+    free_.push_back(slot);
+}
+
+uint32_t HnswCache::victim() {
+    uint32_t best = kNone;
+    uint32_t best_count = UINT32_MAX;
+    const size_t n = nodes_.size();
+    for (size_t looked = 0, sampled = 0; looked < n && sampled < kVictimSample; ++looked) {
+        const auto slot = static_cast<uint32_t>(clock_++ % n);
+        if (!nodes_[slot].live) continue;
+        ++sampled;
+        const uint32_t count = frequency(nodes_[slot].id_hash);
+        if (count < best_count) {
+            best_count = count;
+            best = slot;
+        }
+    }
+    return best;
+}
+
+bool HnswCache::admit(VectorIdHash id_hash, Epoch epoch, std::span<const float> vec) {
+    if (vec.size() != dim_ || max_elements_.load(std::memory_order_relaxed) == 0) return false;
+    std::unique_lock lock(mutex_);
+    auto it = slots_.find(id_hash);
+    if (it != slots_.end()) {
+        if (nodes_[it->second].epoch >= epoch) return false;
+        drop(it->second);
+    }
+    {
+        std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+        if (slots_.size() >= max_elements_.load(std::memory_order_relaxed)) {
+            const uint32_t v = victim();
+            if (v == kNone || frequency(id_hash) <= frequency(nodes_[v].id_hash)) {
+                stats_.rejected++;
+                return false;
+            }
+            drop(v);
+            stats_.evicted++;
+        }
+        stats_.admitted++;
+    }
+
+    place(id_hash, epoch, vec.data());
+    return true;
+}
+
+void HnswCache::place(VectorIdHash id_hash, Epoch epoch, const float* vec) {
+    rng_state_ = mix(rng_state_);
+    const double u = static_cast<double>((rng_state_ >> 11) + 1) * 0x1.0p-53;
+    const auto level = static_cast<uint32_t>(std::min<double>(-std::log(u) * level_mult_, kMaxLevel));
+    const uint32_t slot = allocate(level);
+    float* out = vectors_.data() + size_t{slot} * dim_;
+    std::copy_n(vec, dim_, out);
+    if (options_.metric == Metric::COSINE) normalize(out, dim_);
+    nodes_[slot].id_hash = id_hash;
+    nodes_[slot].epoch = epoch;
+    nodes_[slot].live = true;
+    slots_[id_hash] = slot;
+    link(slot);
+}
+
+void HnswCache::invalidate(VectorIdHash id_hash, Epoch epoch) {
+    {
+        std::shared_lock lock(mutex_);
+        auto it = slots_.find(id_hash);
+        if (it == slots_.end() || nodes_[it->second].epoch > epoch) return;
+    }
+    std::unique_lock lock(mutex_);
+    auto it = slots_.find(id_hash);
+    if (it == slots_.end() || nodes_[it->second].epoch > epoch) return;
+    drop(it->second);
+    std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+    stats_.invalidated++;
+}
+
+size_t HnswCache::elementBytes(uint32_t dim, uint32_t m) {
+    // The vector, level 0 links, the node, the id index entry, and the
+    // upper links of the 1 / (m - 1) levels a node has on average
+    m = std::max(m, 2u);
+    return size_t{dim} * sizeof(float) + size_t{2} * m * sizeof(uint32_t) + sizeof(Node) +
+           sizeof(std::vector<uint32_t>) + m * sizeof(uint32_t) / (m - 1) + 48;
+}
+
+size_t HnswCache::bytes() const {
+    std::shared_lock lock(mutex_);
+    return nodes_.size() * elementBytes(dim_, options_.m) + sketch_.size();
+}
+
+void HnswCache::setBudget(size_t bytes) {
+    const size_t per = elementBytes(dim_, options_.m);
+    const size_t cap = bytes > sketch_.size() ? (bytes - sketch_.size()) / per : 0;
+    std::unique_lock lock(mutex_);
+    max_elements_.store(cap, std::memory_order_relaxed);
+    if (nodes_.size() <= cap) return;
+
+    // Slots are only ever reused, so returning memory takes a rebuild over
+    // the most popular residents that fit
+    struct Resident {
+        uint32_t count;
+        uint32_t slot;
+    };
+    std::vector<Resident> residents;
+    {
+        std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+        for (uint32_t slot = 0; slot < nodes_.size(); ++slot) {
+            if (nodes_[slot].live) residents.push_back({frequency(nodes_[slot].id_hash), slot});
+        }
+        if (residents.size() > cap) {
+            std::nth_element(residents.begin(), residents.begin() + static_cast<std::ptrdiff_t>(cap),
+                             residents.end(), [](const Resident& a, const Resident& b) { return a.count > b.count; });
+            stats_.evicted += residents.size() - cap;
+            residents.resize(cap);
+        }
+    }
+
+    std::vector<float> vectors(residents.size() * dim_);
+    std::vector<Node> kept(residents.size());
+    for (size_t i = 0; i < residents.size(); ++i) {
+        std::copy_n(vector(residents[i].slot), dim_, vectors.data() + i * dim_);
+        kept[i] = nodes_[residents[i].slot];
+    }
+    std::vector<float>().swap(vectors_);
+    std::vector<uint32_t>().swap(links0_);
+    std::vector<std::vector<uint32_t>>().swap(upper_);
+    std::vector<Node>().swap(nodes_);
+    std::unordered_map<VectorIdHash, uint32_t>().swap(slots_);
+    std::vector<uint32_t>().swap(free_);
+    entry_ = kNone;
+    max_level_ = 0;
+    clock_ = 0;
+    for (size_t i = 0; i < kept.size(); ++i) place(kept[i].id_hash, kept[i].epoch, vectors.data() + i * dim_);
+}
+
+size_t HnswCache::size() const {
+    std::shared_lock lock(mutex_);
+    return slots_.size();
+}
+
+HnswCache::Stats HnswCache::getStats() const {
+    std::shared_lock lock(mutex_);
+    std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+    Stats stats = stats_;
+    stats.size = slots_.size();
+    stats.recall = recall_;
+    return stats;
+}
+
+} // namespace woved::index
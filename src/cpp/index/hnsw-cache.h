@@ -0,0 +1,188 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::index {
+
+// In-memory HNSW over the vectors queries return most often
+// (index.hnsw_cache). It is searched before the IVF tiers: its k-th score
+// seeds their shared threshold, and once its measured recall is high
+// enough it answers queries on its own.
+//
+// Popularity is counted in a TinyLFU sketch: observe() feeds it the ids
+// of each final top-k, and every counter is halved after 10 x
+// max_elements observations so old popularity fades. An uncached id that
+// reaches admit_hits is queued; the owner fetches the vectors of wanted()
+// ids and passes them to admit(). Once the cache is full, a newcomer
+// must be more popular than the least popular of a few sampled residents,
+// which it replaces.
+//
+// Evicted and invalidated nodes stay in the graph as unreported waypoints
+// until their slot is reused. Links into a reused slot are kept; they
+// cost search quality, not correctness, since every node is scored on its
+// own vector.
+//
+// Cached vectors are copies: the owner must invalidate() an id on every
+// upsert and delete, or a query may see the old version.
+//
+// The recall estimate compares the cache's top-k with the full search's
+// on queries that run both. answer() lets a query skip the full search
+// once the estimate reaches answer_recall, except every verify_every-th
+// query, which keeps measuring.
+//
+// Searches share a reader lock; admit() and invalidate() take it
+// exclusively. Popularity counting has its own lock.
+class HnswCache {
+public:
+    struct Options {
+        size_t max_elements = 1000000;
+        uint32_t m = 16;
+        uint32_t ef_construction = 200;
+        uint32_t ef = 50;
+        uint32_t admit_hits = 3;                // Sketch count that queues an id
+        float answer_recall = 0.95f;            // Above 1: never answer alone
+        uint32_t verify_every = 16;
+        Metric metric = Metric::INNER_PRODUCT;  // collection.metric
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Hit {
+        VectorIdHash id_hash;
+        Epoch epoch;
+        Score score;
+    };
+
+    struct Stats {
+        size_t size = 0;
+        uint64_t admitted = 0;
+        uint64_t rejected = 0;     // Lost to a more popular resident
+        uint64_t evicted = 0;
+        uint64_t invalidated = 0;
+        uint64_t answered = 0;     // Queries answered from the cache alone
+        float recall = 0.0f;       // Estimated recall@k of the cache
+    };
+
+    HnswCache(const Options& options, uint32_t dim);
+
+    HnswCache(const HnswCache&) = delete;
+    HnswCache& operator=(const HnswCache&) = delete;
+
+    Metric metric() const { return options_.metric; }
+    uint32_t dim() const { return dim_; }
+
+    // The k best cached vectors for `query` under metric(), best first
+    std::vector<Hit> search(std::span<const float> query, size_t k) const;
+
+    // Whether a query that found `found` of its k in the cache may skip
+    // the full search
+    bool answer(size_t k, size_t found);
+
+    // A query that ran both: its cache hits against its final top-k
+    void recordRecall(std::span<const Hit> cached, std::span<const VectorIdHash> final_ids);
+
+    // Count a final top-k toward admission
+    void observe(std::span<const VectorIdHash> ids);
+
+    // Up to `max` queued ids, taken off the queue
+    std::vector<VectorIdHash> wanted(size_t max);
+
+    // Cache `vector` as the version of `id_hash` at `epoch`. False if it is
+    // not popular enough to displace a resident, the dimension is wrong or
+    // the same or a newer version is cached.
+    bool admit(VectorIdHash id_hash, Epoch epoch, std::span<const float> vector);
+
+    // Drop `id_hash` if cached at `epoch` or older
+    void invalidate(VectorIdHash id_hash, Epoch epoch);
+
+    size_t size() const;
+    Stats getStats() const;
+
+    // Memory held, estimated from the slots allocated
+    size_t bytes() const;
+    // Cap the cache at about `bytes` (a MemoryGovernor budget). Below what
+    // it holds, the least popular residents are evicted and the graph is
+    // rebuilt over the rest, under the exclusive lock.
+    void setBudget(size_t bytes);
+    // Estimated bytes per cached vector
+    static size_t elementBytes(uint32_t dim, uint32_t m);
+
+private:
+    static constexpr uint32_t kNone = UINT32_MAX;
+    static constexpr size_t kSketchRows = 4;
+
+    using Candidate = std::pair<float, uint32_t>;  // Distance (lower is better), slot
+
+    struct Node {
+        VectorIdHash id_hash = 0;
+        Epoch epoch = 0;
+        uint32_t level = 0;
+        bool live = false;
+    };
+
+    const float* vector(uint32_t slot) const { return vectors_.data() + size_t{slot} * dim_; }
+    float distance(const float* query, uint32_t slot) const;
+    uint32_t width(uint32_t level) const { return level == 0 ? 2 * options_.m : options_.m; }
+    uint32_t* links(uint32_t slot, uint32_t level);
+    const uint32_t* links(uint32_t slot, uint32_t level) const;
+
+    Candidate descend(const float* query, uint32_t level) const;
+    std::vector<Candidate> layer(const float* query, std::vector<Candidate> entry, uint32_t ef,
+                                 uint32_t level) const;
+    std::vector<Candidate> select(const std::vector<Candidate>& candidates, uint32_t limit) const;
+
+    // Exclusive lock held
+    uint32_t allocate(uint32_t level);
+    void place(VectorIdHash id_hash, Epoch epoch, const float* vec);
+    void link(uint32_t slot);
+    void drop(uint32_t slot);
+    uint32_t victim();
+
+    // stats_mutex_ held
+    uint32_t frequency(VectorIdHash id) const;
+    uint32_t increment(VectorIdHash id);
+
+    Options options_;
+    uint32_t dim_;
+    double level_mult_;
+    std::atomic<size_t> max_elements_;        // Options::max_elements until setBudget()
+
+    mutable std::shared_mutex mutex_;
+    std::vector<float> vectors_;              // Slot x dim; normalized for cosine
+    std::vector<uint32_t> links0_;            // 2m per slot
+    std::vector<std::vector<uint32_t>> upper_;  // m per level above 0, per slot
+    std::vector<Node> nodes_;
+    std::unordered_map<VectorIdHash, uint32_t> slots_;  // Live ids
+    std::vector<uint32_t> free_;              // Dead slots
+    uint32_t entry_ = kNone;
+    uint32_t max_level_ = 0;
+    uint64_t rng_state_ = 0x2545f4914f6cdd1dULL;
+    size_t clock_ = 0;                        // Victim sampling position
+
+    mutable std::mutex stats_mutex_;
+    std::vector<uint8_t> sketch_;             // kSketchRows x sketch_mask_ + 1
+    size_t sketch_mask_ = 0;
+    uint64_t observed_ = 0;
+    std::vector<VectorIdHash> queue_;
+    std::unordered_set<VectorIdHash> queued_;
+    float recall_ = 0.0f;
+    uint64_t recall_samples_ = 0;
+    Stats stats_;
+    std::atomic<uint64_t> queries_{0};
+};
+
+} // namespace woved::index
@@ -0,0 +1,70 @@
+#include "ivf-flat.h"
+#include "util/vector-codec.h"
+#include <algorithm>
+
+namespace woved::index {
+
+IvfFlatScanner::IvfFlatScanner(Metric metric, std::span<const float> query, size_t top_k)
+    : metric_(metric), query_(query), hits_(top_k), heap_{hits_.data(), top_k} {
+    if (metric_ != Metric::INNER_PRODUCT) {
+        query_sqr_ = kernels::distance_table().inner_product(query_.data(), query_.data(), query_.size());
+    }
+}
+
+void IvfFlatScanner::scan(const float* vectors, size_t count, uint64_t first_row) {
+    const size_t dim = query_.size();
+    const auto& t = kernels::distance_table();
+    if (metric_ != Metric::COSINE) {
+        t.scan_list(query_.data(), vectors, count, dim, metric_ == Metric::L2, first_row, heap_);
+        return;
+    }
+    // Cosine scores a block at a time, then offers them
+    constexpr size_t kBlock = 64;
+    Score scores[kBlock];
+    float scratch[kBlock];
+    for (size_t b = 0; b < count; b += kBlock) {
+        const size_t n = std::min(kBlock, count - b);
+        kernels::score_block(metric_, query_.data(), query_sqr_, vectors + b * dim, n, dim, scores, scratch);
+        for (size_t i = 0; i < n; ++i) {
+            if (scores[i] > heap_.threshold()) heap_.push(scores[i], first_row + b + i);
+        }
+    }
+}
+
+void IvfFlatScanner::scan(const void* vectors, ElementType type, const float* scales, size_t count,
+                          uint64_t first_row) {
+    if (type == ElementType::FP32) {
+        scan(static_cast<const float*>(vectors), count, first_row);
+        return;
+    }
+    const size_t dim = query_.size();
+    const size_t bytes = dim * util::element_size(type);
+    const auto* base = static_cast<const std::byte*>(vectors);
+    constexpr size_t kBlock = 64;
+    Score scores[kBlock];
+    float scratch[kBlock];
+    for (size_t b = 0; b < count; b += kBlock) {
+        const size_t n = std::min(kBlock, count - b);
+        kernels::score_block(metric_, query_.data(), query_sqr_, base + b * bytes, type, scales ? scales + b : nullptr,
+                             n, dim, scores, scratch);
+        for (size_t i = 0; i < n; ++i) {
+            if (scores[i] > heap_.threshold()) heap_.push(scores[i], first_row + b + i);
+        }
+    }
+}
+
+size_t IvfFlatScanner::held(uint64_t first_row, uint64_t rows, Score above) const {
+    return std::count_if(hits_.begin(), hits_.begin() + heap_.size, [&](const kernels::ScanHit& h) {
+        return h.row >= first_row && h.row - first_row < rows && h.score > above;
+    });
+}
+
+std::vector<kernels::ScanHit> IvfFlatScanner::results() const {
+    std::vector<kernels::ScanHit> out(hits_.begin(), hits_.begin() + heap_.size);
+    std::sort(out.begin(), out.end(), [](const auto& a, const auto& b) {
+        return a.score != b.score ? a.score > b.score : a.row < b.row;
+    });
+    return out;
+}
+
+} // namespace woved::index
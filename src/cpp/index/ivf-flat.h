@@ -0,0 +1,47 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "util/simd-dispatch.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace woved::index {
+
+// Exact top-k over IVF-Flat lists: full fp32 vectors, one query. Lists
+// are scanned one after another into the same heap, so later lists only
+// pay for the candidates that beat the k-th best seen so far. Inner
+// product and L2 run the fused kernel (kernels::ListScanFn); cosine
+// scores vector by vector.
+class IvfFlatScanner {
+public:
+    IvfFlatScanner(Metric metric, std::span<const float> query, size_t top_k);
+
+    // Scan `count` row-major vectors of the query's dimension, numbered
+    // first_row, first_row + 1, ...
+    void scan(const float* vectors, size_t count, uint64_t first_row);
+
+    // Same for vectors stored as `type` (util/vector-codec.h); `scales`
+    // holds one per vector for INT8 and may be null otherwise
+    void scan(const void* vectors, ElementType type, const float* scales, size_t count, uint64_t first_row);
+
+    // Score a candidate must beat to enter the top-k (lowest() until full)
+    Score threshold() const { return heap_.threshold(); }
+
+    // Results held from rows [first_row, first_row + rows) that score
+    // above `above`
+    size_t held(uint64_t first_row, uint64_t rows, Score above) const;
+
+    // The top-k so far, best first
+    std::vector<kernels::ScanHit> results() const;
+
+private:
+    Metric metric_;
+    std::span<const float> query_;
+    float query_sqr_ = 0.0f;
+    std::vector<kernels::ScanHit> hits_;
+    kernels::ScanHeap heap_;
+};
+
+} // namespace woved::index
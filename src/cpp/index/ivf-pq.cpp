@@ -0,0 +1,654 @@
+#include "ivf-pq.h"
+#include "core/config.h"
+#include "util/crc32c.h"
+#include "util/exceptions.h"
+#include "util/simd-dispatch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace woved::index {
+
+namespace {
+
+constexpr uint64_t kModelMagic = 0x5150494445564f57ULL;  // "WOVEDIPQ"
+constexpr uint32_t kModelVersion = 1;
+constexpr uint32_t kModelRotated = 0x1;
+constexpr uint32_t kModelGraph = 0x2;  // A CentroidGraph follows the PQ centroids
+
+struct ModelHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t nlist;
+    uint32_t m;
+    uint32_t nbits;
+    uint32_t flags;
+    float distortion;
+    uint32_t graph_bytes;
+};
+
+// Centroids scored per block kernel call; bounds the stack scratch
+constexpr size_t kCentroidBlock = 256;
+// Rows per tile of the k-means assignment
+constexpr size_t kAssignRows = 16;
+
+// Nearest of k centroids for each of n rows, and its squared distance,
+// scoring tiles of rows against blocks of centroids
+void assignNearest(const float* x, size_t n, const float* centroids, size_t k, size_t dim, uint32_t* out,
+                   float* out_dist) {
+    const auto& t = kernels::distance_table();
+    float dist[kAssignRows * kCentroidBlock];
+    for (size_t r = 0; r < n; r += kAssignRows) {
+        const size_t rows = std::min(kAssignRows, n - r);
+        std::fill(out_dist + r, out_dist + r + rows, std::numeric_limits<float>::max());
+        std::fill(out + r, out + r + rows, 0u);
+        for (size_t c = 0; c < k; c += kCentroidBlock) {
+            const size_t cols = std::min(kCentroidBlock, k - c);
+            t.l2_sqr_matrix(x + r * dim, rows, centroids + c * dim, cols, dim, dist);
+            for (size_t i = 0; i < rows; ++i) {
+                for (size_t j = 0; j < cols; ++j) {
+                    if (dist[i * cols + j] < out_dist[r + i]) {
+                        out_dist[r + i] = dist[i * cols + j];
+                        out[r + i] = static_cast<uint32_t>(c + j);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// c (rows x cols) = a (rows x inner) * b (inner x cols), all row-major
+void matmul(const float* a, size_t rows, size_t inner, const float* b, size_t cols, float* c) {
+#pragma omp parallel for schedule(static)
+    for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(rows); ++i) {
+        float* out = c + i * cols;
+        std::fill(out, out + cols, 0.0f);
+        const float* row = a + i * inner;
+        for (size_t k = 0; k < inner; ++k) {
+            const float v = row[k];
+            const float* brow = b + k * cols;
+#pragma omp simd
+            for (size_t j = 0; j < cols; ++j) out[j] += v * brow[j];
+        }
+    }
+}
+
+std::vector<float> transpose(const float* a, size_t rows, size_t cols) {
+    std::vector<float> t(rows * cols);
+    for (size_t i = 0; i < rows; ++i) {
+        for (size_t j = 0; j < cols; ++j) t[j * rows + i] = a[i * cols + j];
+    }
+    return t;
+}
+
+double frobenius(const std::vector<double>& a) {
+    double sum = 0.0;
+    for (double v : a) sum += v * v;
+    return std::sqrt(sum);
+}
+
+// Gauss-Jordan with partial pivoting; false if `a` is singular
+bool invert(std::vector<double> a, size_t n, std::vector<double>& inv) {
+    inv.assign(n * n, 0.0);
+    for (size_t i = 0; i < n; ++i) inv[i * n + i] = 1.0;
+    const double tiny = 1e-12 * std::max(frobenius(a), 1e-300);
+
+    for (size_t col = 0; col < n; ++col) {
+        size_t pivot = col;
+        for (size_t r = col + 1; r < n; ++r) {
+            if (std::fabs(a[r * n + col]) > std::fabs(a[pivot * n + col])) pivot = r;
+        }
+        if (std::fabs(a[pivot * n + col]) <= tiny) return false;
+        if (pivot != col) {
+            std::swap_ranges(a.begin() + pivot * n, a.begin() + (pivot + 1) * n, a.begin() + col * n);
+            std::swap_ranges(inv.begin() + pivot * n, inv.begin() + (pivot + 1) * n, inv.begin() + col * n);
+        }
+        const double scale = 1.0 / a[col * n + col];
+        for (size_t j = 0; j < n; ++j) {
+            a[col * n + j] *= scale;
+            inv[col * n + j] *= scale;
+        }
+#pragma omp parallel for schedule(static)
+        for (ptrdiff_t r = 0; r < static_cast<ptrdiff_t>(n); ++r) {
+            if (static_cast<size_t>(r) == col) continue;
+            const double f = a[r * n + col];
+            if (f == 0.0) continue;
+            for (size_t j = 0; j < n; ++j) {
+                a[r * n + j] -= f * a[col * n + j];
+                inv[r * n + j] -= f * inv[col * n + j];
+            }
+        }
+    }
+    return true;
+}
+
+// Orthogonal polar factor U V^T of m (n x n) by scaled Newton iteration
+// Z <- (g Z + Z^-T / g) / 2, g = sqrt(|Z^-1| / |Z|) (Higham). A singular m
+// (fewer sample rows than dimensions) is nudged towards the identity.
+std::vector<float> polarFactor(const std::vector<float>& m, size_t n) {
+    std::vector<double> z(m.begin(), m.end());
+    std::vector<double> inv;
+    double ridge = 1e-6 * frobenius(z) / std::sqrt(static_cast<double>(n));
+    if (ridge == 0.0) ridge = 1.0;
+    while (!invert(z, n, inv)) {
+        for (size_t i = 0; i < n; ++i) z[i * n + i] += ridge;
+        ridge *= 10.0;
+    }
+
+    for (int iter = 0; iter < 100; ++iter) {
+        const double g = std::sqrt(frobenius(inv) / frobenius(z));
+        std::vector<double> next(n * n);
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) next[i * n + j] = 0.5 * (g * z[i * n + j] + inv[j * n + i] / g);
+        }
+        double diff = 0.0;
+        for (size_t i = 0; i < n * n; ++i) diff += (next[i] - z[i]) * (next[i] - z[i]);
+        z = std::move(next);
+        if (std::sqrt(diff) <= 1e-10 * frobenius(z)) break;
+        if (!invert(z, n, inv)) break;  // Converged to machine precision
+    }
+    return std::vector<float>(z.begin(), z.end());
+}
+
+void checkShape(uint32_t dim, uint32_t m, uint32_t nbits) {
+    if (dim == 0 || m == 0 || dim % m != 0) {
+        throw util::InvalidArgumentException("PQ: dimension " + std::to_string(dim) +
+                                             " is not a multiple of m = " + std::to_string(m));
+    }
+    if (nbits == 0 || nbits > 8) {
+        throw util::InvalidArgumentException("PQ: nbits must be in [1, 8], got " + std::to_string(nbits));
+    }
+}
+
+} // namespace
+
+uint32_t nearestCentroid(const float* x, const float* centroids, size_t k, size_t dim) {
+    uint32_t best = 0;
+    float best_dist = std::numeric_limits<float>::max();
+    assignNearest(x, 1, centroids, k, dim, &best, &best_dist);
+    return best;
+}
+
+float trainKMeans(const float* x, size_t n, size_t dim, size_t k, uint32_t iters, uint64_t seed,
+                  float* centroids, bool seeded, const AssignFn& assign_fn) {
+    if (n == 0 || k == 0 || dim == 0) throw util::InvalidArgumentException("k-means: empty input");
+
+    if (!seeded) {
+        std::mt19937_64 rng(seed);
+        std::vector<size_t> perm(n);
+        std::iota(perm.begin(), perm.end(), size_t{0});
+        for (size_t i = 0; i < std::min(n, k); ++i) {
+            std::swap(perm[i], perm[i + rng() % (n - i)]);
+        }
+        for (size_t c = 0; c < k; ++c) std::memcpy(centroids + c * dim, x + perm[c % n] * dim, dim * sizeof(float));
+    }
+
+    std::vector<uint32_t> assign(n);
+    std::vector<float> dist(n);
+    std::vector<double> sums(k * dim);
+    std::vector<size_t> counts(k);
+    double objective = 0.0;
+    const auto& t = kernels::distance_table();
+    const ptrdiff_t tiles = static_cast<ptrdiff_t>((n + kAssignRows - 1) / kAssignRows);
+    for (uint32_t iter = 0;; ++iter) {
+        double total = 0.0;
+        const bool offloaded = assign_fn && assign_fn(x, n, dim, centroids, k, assign.data());
+#pragma omp parallel for reduction(+:total) schedule(static)
+        for (ptrdiff_t b = 0; b < tiles; ++b) {
+            const size_t first = static_cast<size_t>(b) * kAssignRows;
+            const size_t rows = std::min(kAssignRows, n - first);
+            if (offloaded) {
+                for (size_t i = first; i < first + rows; ++i) {
+                    dist[i] = t.l2_sqr(x + i * dim, centroids + assign[i] * dim, dim);
+                }
+            } else {
+                assignNearest(x + first * dim, rows, centroids, k, dim, assign.data() + first, dist.data() + first);
+            }
+            for (size_t i = first; i < first + rows; ++i) total += dist[i];
+        }
+        objective = total / static_cast<double>(n);
+        if (iter == iters) break;
+
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+        for (size_t i = 0; i < n; ++i) {
+            double* sum = sums.data() + assign[i] * dim;
+            const float* row = x + i * dim;
+            for (size_t j = 0; j < dim; ++j) sum[j] += row[j];
+            counts[assign[i]]++;
+        }
+        for (size_t c = 0; c < k; ++c) {
+            if (counts[c] == 0) continue;
+            const double inv = 1.0 / static_cast<double>(counts[c]);
+            for (size_t j = 0; j < dim; ++j) centroids[c * dim + j] = static_cast<float>(sums[c * dim + j] * inv);
+        }
+
+        // An empty cluster takes half of the largest one: both copies are
+        // pushed slightly apart and the next assignment splits the points
+        for (size_t c = 0; c < k; ++c) {
+            if (counts[c] != 0) continue;
+            const size_t big = static_cast<size_t>(std::max_element(counts.begin(), counts.end()) - counts.begin());
+            if (counts[big] < 2) break;
+            constexpr float kEps = 1.0f / 1024.0f;
+            for (size_t j = 0; j < dim; ++j) {
+                const float sign = j % 2 == 0 ? 1.0f : -1.0f;
+                const float v = centroids[big * dim + j];
+                centroids[c * dim + j] = v * (1.0f + sign * kEps) + sign * kEps;
+                centroids[big * dim + j] = v * (1.0f - sign * kEps) - sign * kEps;
+            }
+            counts[c] = counts[big] / 2;
+            counts[big] -= counts[c];
+        }
+    }
+    return static_cast<float>(objective);
+}
+
+ProductQuantizer::ProductQuantizer(uint32_t dim, uint32_t m, uint32_t nbits)
+    : dim_(dim), m_(m), nbits_(nbits) {
+    checkShape(dim, m, nbits);
+    centroids_.assign(static_cast<size_t>(ksub()) * dim_, 0.0f);
+}
+
+void ProductQuantizer::train(const float* x, size_t n, uint32_t iters, uint64_t seed, bool warm,
+                             const AssignFn& assign) {
+    const size_t dsub = this->dsub();
+    const size_t ksub = this->ksub();
+    // Subspaces are independent; each clusters serially on its own thread
+#pragma omp parallel for schedule(dynamic)
+    for (ptrdiff_t j = 0; j < static_cast<ptrdiff_t>(m_); ++j) {
+        std::vector<float> sub(n * dsub);
+        for (size_t i = 0; i < n; ++i) {
+            std::memcpy(sub.data() + i * dsub, x + i * dim_ + j * dsub, dsub * sizeof(float));
+        }
+        trainKMeans(sub.data(), n, dsub, ksub, iters, seed + j, centroids_.data() + j * ksub * dsub, warm, assign);
+    }
+}
+
+void ProductQuantizer::encode(const float* x, uint8_t* code) const {
+    const size_t dsub = this->dsub();
+    const size_t ksub = this->ksub();
+    for (size_t j = 0; j < m_; ++j) {
+        code[j] = static_cast<uint8_t>(nearestCentroid(x + j * dsub, centroids_.data() + j * ksub * dsub, ksub, dsub));
+    }
+}
+
+void ProductQuantizer::decode(const uint8_t* code, float* out) const {
+    const size_t dsub = this->dsub();
+    const size_t ksub = this->ksub();
+    for (size_t j = 0; j < m_; ++j) {
+        std::memcpy(out + j * dsub, centroids_.data() + (j * ksub + code[j]) * dsub, dsub * sizeof(float));
+    }
+}
+
+void ProductQuantizer::distanceTable(const float* x, float* table) const {
+    const size_t dsub = this->dsub();
+    const size_t ksub = this->ksub();
+    for (size_t j = 0; j < m_; ++j) {
+        const float* sub = centroids_.data() + j * ksub * dsub;
+        kernels::distance_table().l2_sqr_block(x + j * dsub, sub, ksub, dsub, table + j * ksub);
+    }
+}
+
+float ProductQuantizer::distance(const float* table, const uint8_t* code) const {
+    const size_t ksub = this->ksub();
+    float sum = 0.0f;
+    for (size_t j = 0; j < m_; ++j) sum += table[j * ksub + code[j]];
+    return sum;
+}
+
+void packFastScanCodes(const uint8_t* codes, size_t rows, uint32_t m, uint8_t* out) {
+    const size_t block_bytes = fastScanBlockBytes(m);
+    std::memset(out, 0, fastScanBlocks(rows) * block_bytes);
+    for (size_t r = 0; r < rows; ++r) {
+        uint8_t* block = out + (r / kFastScanBlock) * block_bytes;
+        const size_t lane = r % 16;
+        const int shift = r % kFastScanBlock < 16 ? 0 : 4;
+        const uint8_t* code = codes + r * m;
+        for (size_t j = 0; j < m; ++j) block[j * 16 + lane] |= static_cast<uint8_t>((code[j] & 0x0f) << shift);
+    }
+}
+
+void fastScanDistances(const FastScanTable& table, const uint8_t* blocks, size_t rows, float* out) {
+    const size_t nblocks = fastScanBlocks(rows);
+    std::vector<uint16_t> sums(nblocks * kFastScanBlock);
+    kernels::distance_table().pq4_scan(table.lut.data(), blocks, nblocks, table.lut.size() / 32, sums.data());
+    const float inv = 1.0f / table.scale;
+    for (size_t r = 0; r < rows; ++r) out[r] = table.bias + sums[r] * inv;
+}
+
+IvfPqModel::Params IvfPqModel::Params::fromConfig(const StableIndexConfig& config) {
+    Params params;
+    params.nlist = config.nlist;
+    params.m = config.pq.m;
+    params.nbits = config.pq.nbits;
+    params.use_opq = config.pq.use_opq;
+    params.fast_scan = config.pq.fast_scan;
+    return params;
+}
+
+std::shared_ptr<const IvfPqModel> IvfPqModel::train(const Params& params, uint32_t dim, const float* sample,
+                                                    size_t n, const float* coarse) {
+    checkShape(dim, params.m, params.nbits);
+    if (params.fast_scan && (params.nbits != 4 || params.m > kFastScanMaxM)) {
+        throw util::InvalidArgumentException("IVF-PQ: fast scan needs nbits = 4 and m <= " +
+                                             std::to_string(kFastScanMaxM));
+    }
+    if (n == 0) throw util::InvalidArgumentException("IVF-PQ: empty training sample");
+
+    auto model = std::make_shared<IvfPqModel>();
+    model->dim_ = dim;
+    model->nlist_ = coarse ? std::max(1u, params.nlist)
+                           : static_cast<uint32_t>(std::clamp<size_t>(params.nlist, 1, n));
+    model->coarse_.resize(static_cast<size_t>(model->nlist_) * dim);
+    if (coarse) {
+        std::copy(coarse, coarse + model->coarse_.size(), model->coarse_.begin());
+    } else {
+        trainKMeans(sample, n, dim, model->nlist_, params.kmeans_iters, params.seed, model->coarse_.data(), false,
+                    params.assign);
+    }
+
+    std::vector<float> residuals(n * dim);
+#pragma omp parallel for schedule(static)
+    for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+        const float* x = sample + i * dim;
+        const float* c = model->coarse_.data() + model->assign(x) * size_t{dim};
+        for (size_t j = 0; j < dim; ++j) residuals[i * dim + j] = x[j] - c[j];
+    }
+
+    model->pq_ = ProductQuantizer(dim, params.m, params.nbits);
+    if (params.use_opq) {
+        // Fit the rotation on an evenly strided subset
+        const size_t rows = std::clamp<size_t>(params.opq_sample, 1, n);
+        std::vector<float> x(rows * dim);
+        for (size_t i = 0; i < rows; ++i) {
+            std::memcpy(x.data() + i * dim, residuals.data() + (i * n / rows) * dim, dim * sizeof(float));
+        }
+        const std::vector<float> xt = transpose(x.data(), rows, dim);
+
+        std::vector<float> rotation(size_t{dim} * dim, 0.0f);
+        for (size_t i = 0; i < dim; ++i) rotation[i * dim + i] = 1.0f;
+        std::vector<float> xr(rows * dim);
+        std::vector<float> y(rows * dim);
+        std::vector<float> xty(size_t{dim} * dim);
+        for (uint32_t iter = 0; iter < params.opq_iters; ++iter) {
+            matmul(x.data(), rows, dim, rotation.data(), dim, xr.data());
+            model->pq_.train(xr.data(), rows, params.opq_pq_iters, params.seed, iter > 0, params.assign);
+#pragma omp parallel for schedule(static)
+            for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(rows); ++i) {
+                std::vector<uint8_t> code(model->pq_.codeBytes());
+                model->pq_.encode(xr.data() + i * dim, code.data());
+                model->pq_.decode(code.data(), y.data() + i * dim);
+            }
+            matmul(xt.data(), dim, rows, y.data(), dim, xty.data());
+            rotation = polarFactor(xty, dim);
+        }
+        model->rotation_ = std::move(rotation);
+
+        std::vector<float> rotated(n * dim);
+        matmul(residuals.data(), n, dim, model->rotation_.data(), dim, rotated.data());
+        residuals = std::move(rotated);
+        model->pq_.train(residuals.data(), n, params.kmeans_iters, params.seed, params.opq_iters > 0, params.assign);
+    } else {
+        model->pq_.train(residuals.data(), n, params.kmeans_iters, params.seed, false, params.assign);
+    }
+
+    double total = 0.0;
+#pragma omp parallel for reduction(+:total) schedule(static)
+    for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+        std::vector<uint8_t> code(model->pq_.codeBytes());
+        std::vector<float> decoded(dim);
+        const float* r = residuals.data() + i * dim;
+        model->pq_.encode(r, code.data());
+        model->pq_.decode(code.data(), decoded.data());
+        total += kernels::distance_table().l2_sqr(r, decoded.data(), dim);
+    }
+    model->distortion_ = static_cast<float>(total / static_cast<double>(n));
+    if (params.graph.wanted(model->nlist_)) {
+        model->graph_ = std::make_unique<const CentroidGraph>(model->coarse_.data(), model->nlist_, dim, params.graph);
+    }
+    model->finish();
+    return model;
+}
+
+void IvfPqModel::finish() {
+    if (rotated()) {
+        coarse_rotated_.resize(coarse_.size());
+        matmul(coarse_.data(), nlist_, dim_, rotation_.data(), dim_, coarse_rotated_.data());
+    } else {
+        coarse_rotated_ = coarse_;
+    }
+    auto bytes = serialize();
+    id_ = util::crc32c(bytes.data(), bytes.size());
+}
+
+std::vector<std::byte> IvfPqModel::serialize() const {
+    ModelHeader header{};
+    header.magic = kModelMagic;
+    header.version = kModelVersion;
+    header.dim = dim_;
+    header.nlist = nlist_;
+    header.m = pq_.m();
+    header.nbits = pq_.nbits();
+    header.flags = (rotated() ? kModelRotated : 0) | (graph_ ? kModelGraph : 0);
+    header.distortion = distortion_;
+    const std::vector<std::byte> graph = graph_ ? graph_->serialize() : std::vector<std::byte>();
+    header.graph_bytes = static_cast<uint32_t>(graph.size());
+
+    const auto pq = pq_.centroids();
+    std::vector<std::byte> out(sizeof(header) + (coarse_.size() + rotation_.size() + pq.size()) * sizeof(float) +
+                               graph.size());
+    std::byte* p = out.data();
+    std::memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    std::memcpy(p, coarse_.data(), coarse_.size() * sizeof(float));
+    p += coarse_.size() * sizeof(float);
+    if (!rotation_.empty()) std::memcpy(p, rotation_.data(), rotation_.size() * sizeof(float));
+    p += rotation_.size() * sizeof(float);
+    std::memcpy(p, pq.data(), pq.size() * sizeof(float));
+    p += pq.size() * sizeof(float);
+    if (!graph.empty()) std::memcpy(p, graph.data(), graph.size());
+    return out;
+}
+
+std::shared_ptr<const IvfPqModel> IvfPqModel::deserialize(std::span<const std::byte> bytes) {
+    ModelHeader header{};
+    if (bytes.size() < sizeof(header)) throw util::IOException("IVF-PQ model: truncated");
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != kModelMagic || header.version != kModelVersion) {
+        throw util::IOException("IVF-PQ model: bad magic or version " + std::to_string(header.version));
+    }
+    try {
+        checkShape(header.dim, header.m, header.nbits);
+    } catch (const util::InvalidArgumentException& e) {
+        throw util::IOException(std::string("IVF-PQ model: ") + e.what());
+    }
+
+    auto model = std::make_shared<IvfPqModel>();
+    model->dim_ = header.dim;
+    model->nlist_ = header.nlist;
+    model->distortion_ = header.distortion;
+    model->pq_ = ProductQuantizer(header.dim, header.m, header.nbits);
+    const size_t coarse = size_t{header.nlist} * header.dim;
+    const size_t rotation = header.flags & kModelRotated ? size_t{header.dim} * header.dim : 0;
+    const size_t pq = model->pq_.centroids().size();
+    const size_t graph = header.flags & kModelGraph ? header.graph_bytes : 0;
+    if (header.nlist == 0 || bytes.size() != sizeof(header) + (coarse + rotation + pq) * sizeof(float) + graph) {
+        throw util::IOException("IVF-PQ model: size does not match its header");
+    }
+
+    const std::byte* p = bytes.data() + sizeof(header);
+    model->coarse_.resize(coarse);
+    std::memcpy(model->coarse_.data(), p, coarse * sizeof(float));
+    p += coarse * sizeof(float);
+    model->rotation_.resize(rotation);
+    if (rotation) std::memcpy(model->rotation_.data(), p, rotation * sizeof(float));
+    p += rotation * sizeof(float);
+    std::memcpy(model->pq_.centroids().data(), p, pq * sizeof(float));
+    p += pq * sizeof(float);
+    if (graph) model->graph_ = CentroidGraph::deserialize({p, graph}, header.nlist, header.dim);
+    model->finish();
+    return model;
+}
+
+uint32_t IvfPqModel::assign(const float* x) const {
+    return nearestCentroid(x, coarse_.data(), nlist_, dim_);
+}
+
+std::vector<uint32_t> IvfPqModel::probe(const float* query, size_t nprobe) const {
+    if (graph_) return graph_->search(coarse_.data(), query, nprobe);
+    std::vector<float> dist(nlist_);
+    kernels::distance_table().l2_sqr_block(query, coarse_.data(), nlist_, dim_, dist.data());
+    std::vector<std::pair<float, uint32_t>> nearest(nlist_);
+    for (uint32_t c = 0; c < nlist_; ++c) nearest[c] = {dist[c], c};
+    nprobe = std::min<size_t>(nprobe, nlist_);
+    std::partial_sort(nearest.begin(), nearest.begin() + nprobe, nearest.end());
+    std::vector<uint32_t> out(nprobe);
+    for (size_t i = 0; i < nprobe; ++i) out[i] = nearest[i].second;
+    return out;
+}
+
+void IvfPqModel::rotate(const float* x, float* out) const {
+    if (!rotated()) {
+        std::memcpy(out, x, dim_ * sizeof(float));
+        return;
+    }
+    std::fill(out, out + dim_, 0.0f);
+    for (size_t k = 0; k < dim_; ++k) {
+        const float v = x[k];
+        const float* row = rotation_.data() + k * dim_;
+#pragma omp simd
+        for (size_t j = 0; j < dim_; ++j) out[j] += v * row[j];
+    }
+}
+
+void IvfPqModel::encode(const float* x, uint32_t list, uint8_t* code, float* scratch) const {
+    const float* c = coarse_.data() + size_t{list} * dim_;
+    for (size_t j = 0; j < dim_; ++j) scratch[j] = x[j] - c[j];
+    if (rotated()) {
+        rotate(scratch, scratch + dim_);
+        pq_.encode(scratch + dim_, code);
+    } else {
+        pq_.encode(scratch, code);
+    }
+}
+
+void IvfPqModel::encodeBatch(const float* x, size_t n, uint32_t* lists, uint8_t* codes,
+                             const AssignFn& assign_fn) const {
+    if (assign_fn && n > 0 && assign_fn(x, n, dim_, coarse_.data(), nlist_, lists)) {
+        // Lists came back; code the rotated residuals one subspace at a time
+        const size_t dsub = pq_.dsub();
+        const size_t ksub = pq_.ksub();
+        const size_t m = pq_.m();
+        std::vector<float> residuals(n * dim_);
+#pragma omp parallel
+        {
+            std::vector<float> scratch(dim_);
+#pragma omp for schedule(static)
+            for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+                const float* row = x + i * dim_;
+                const float* c = coarse_.data() + size_t{lists[i]} * dim_;
+                for (size_t j = 0; j < dim_; ++j) scratch[j] = row[j] - c[j];
+                rotate(scratch.data(), residuals.data() + i * dim_);
+            }
+        }
+        std::vector<float> sub(n * dsub);
+        std::vector<uint32_t> nearest(n);
+        size_t j = 0;
+        for (; j < m; ++j) {
+            for (size_t i = 0; i < n; ++i) {
+                std::memcpy(sub.data() + i * dsub, residuals.data() + i * dim_ + j * dsub, dsub * sizeof(float));
+            }
+            if (!assign_fn(sub.data(), n, dsub, pq_.centroids().data() + j * ksub * dsub, ksub, nearest.data())) break;
+            for (size_t i = 0; i < n; ++i) codes[i * m + j] = static_cast<uint8_t>(nearest[i]);
+        }
+        if (j == m) return;
+        // The accelerator gave up part way: finish on the CPU
+#pragma omp parallel for schedule(static)
+        for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) pq_.encode(residuals.data() + i * dim_, codes + i * m);
+        return;
+    }
+#pragma omp parallel
+    {
+        std::vector<float> scratch(2 * size_t{dim_});
+#pragma omp for schedule(dynamic, 256)
+        for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+            const float* row = x + i * dim_;
+            lists[i] = assign(row);
+            encode(row, lists[i], codes + i * codeBytes(), scratch.data());
+        }
+    }
+}
+
+void IvfPqModel::decodeRotated(uint32_t list, const uint8_t* code, float* out) const {
+    pq_.decode(code, out);
+    const float* c = coarse_rotated_.data() + size_t{list} * dim_;
+    for (size_t j = 0; j < dim_; ++j) out[j] += c[j];
+}
+
+void IvfPqModel::distanceTable(const float* query_rotated, uint32_t list, float* table, float* scratch) const {
+    const float* c = coarse_rotated_.data() + size_t{list} * dim_;
+    for (size_t j = 0; j < dim_; ++j) scratch[j] = query_rotated[j] - c[j];
+    pq_.distanceTable(scratch, table);
+}
+
+// One scale for all subquantizers, so the uint8 entries add up: each
+// table is shifted to start at 0 (the shifts summed into the bias) and
+// the widest table spans 0-255
+void IvfPqModel::fastScanTable(const float* query_rotated, uint32_t list, FastScanTable& table,
+                               float* scratch) const {
+    if (pq_.nbits() != 4 || pq_.m() > kFastScanMaxM) {
+        throw std::logic_error("IVF-PQ: fast scan needs a 4-bit model");
+    }
+    const uint32_t m = pq_.m();
+    float* dist = scratch + dim_;
+    distanceTable(query_rotated, list, dist, scratch);
+
+    float bias = 0.0f;
+    float range = 0.0f;
+    for (size_t j = 0; j < m; ++j) {
+        const auto [lo, hi] = std::minmax_element(dist + j * 16, dist + j * 16 + 16);
+        bias += *lo;
+        range = std::max(range, *hi - *lo);
+    }
+    table.scale = range > 0.0f ? 255.0f / range : 1.0f;
+    table.bias = bias;
+    table.lut.assign(fastScanBlockBytes(m), 0);
+    for (size_t j = 0; j < m; ++j) {
+        const float* t = dist + j * 16;
+        const float lo = *std::min_element(t, t + 16);
+        for (size_t c = 0; c < 16; ++c) {
+            table.lut[j * 16 + c] = static_cast<uint8_t>(std::min(255.0f, std::nearbyint((t[c] - lo) * table.scale)));
+        }
+    }
+}
+
+float IvfPqModel::distortion(const float* x, size_t n) const {
+    if (n == 0) return 0.0f;
+    double total = 0.0;
+#pragma omp parallel reduction(+:total)
+    {
+        std::vector<float> scratch(2 * size_t{dim_});
+        std::vector<float> rotated(dim_);
+        std::vector<float> decoded(dim_);
+        std::vector<uint8_t> code(codeBytes());
+#pragma omp for schedule(static)
+        for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+            const float* row = x + i * dim_;
+            const uint32_t list = assign(row);
+            encode(row, list, code.data(), scratch.data());
+            decodeRotated(list, code.data(), decoded.data());
+            rotate(row, rotated.data());
+            total += kernels::distance_table().l2_sqr(rotated.data(), decoded.data(), dim_);
+        }
+    }
+    return static_cast<float>(total / static_cast<double>(n));
+}
+
+} // namespace woved::index
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "index/global-index.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace woved {
+struct StableIndexConfig;
+}
+
+namespace woved::index {
+
+// Nearest of `k` centroids (L2) to each of `n` rows, into `out`. Lets
+// k-means and encoding hand their assignment steps to an accelerator
+// (GpuBackend::assigner()); returning false leaves the step to the CPU.
+using AssignFn = std::function<bool(const float* x, size_t n, size_t dim, const float* centroids, size_t k,
+                                    uint32_t* out)>;
+
+// Lloyd's k-means under L2. Seeds from k distinct sample points (or, if
+// `seeded`, starts from the centroids passed in), splits the largest
+// cluster into any that empties, and runs the assignment step in parallel
+// (OpenMP), or through `assign` when set. With fewer points than k the
+// extra centroids repeat points. Returns the final mean squared distance.
+float trainKMeans(const float* x, size_t n, size_t dim, size_t k, uint32_t iters, uint64_t seed,
+                  float* centroids, bool seeded = false, const AssignFn& assign = {});
+
+// Index of the nearest of `k` centroids to `x` (L2)
+uint32_t nearestCentroid(const float* x, const float* centroids, size_t k, size_t dim);
+
+// Product quantizer: the vector is cut into m subvectors of dim / m
+// components, each coded as the nearest of 2^nbits sub-centroids, one
+// byte per subvector.
+class ProductQuantizer {
+public:
+    ProductQuantizer() = default;
+    ProductQuantizer(uint32_t dim, uint32_t m, uint32_t nbits);
+
+    uint32_t dim() const { return dim_; }
+    uint32_t m() const { return m_; }
+    uint32_t nbits() const { return nbits_; }
+    uint32_t ksub() const { return 1u << nbits_; }
+    uint32_t dsub() const { return dim_ / m_; }
+    size_t codeBytes() const { return m_; }
+
+    // `warm` keeps the current sub-centroids as the starting point
+    void train(const float* x, size_t n, uint32_t iters, uint64_t seed, bool warm = false,
+               const AssignFn& assign = {});
+
+    void encode(const float* x, uint8_t* code) const;
+    void decode(const uint8_t* code, float* out) const;
+
+    // L2 lookup table, m x ksub: table[j * ksub + c] is the squared
+    // distance from subvector j of `x` to sub-centroid c
+    void distanceTable(const float* x, float* table) const;
+
+    // Sum of table entries selected by `code`
+    float distance(const float* table, const uint8_t* code) const;
+
+    std::span<const float> centroids() const { return centroids_; }
+    std::span<float> centroids() { return centroids_; }
+
+private:
+    uint32_t dim_ = 0;
+    uint32_t m_ = 0;
+    uint32_t nbits_ = 0;
+    std::vector<float> centroids_;  // m x ksub x dsub
+};
+
+// 4-bit PQ fast scan (André et al.): with nbits = 4 a subquantizer's ADC
+// table has 16 entries, which quantized to uint8 fit one SIMD register,
+// so codes are looked up with byte shuffles (kernels::Pq4ScanFn) instead
+// of per-code loads. Codes are laid out in blocks of kFastScanBlock rows:
+// per subquantizer 16 bytes, byte i holding row i's code in the low
+// nibble and row i + 16's in the high one. An odd m is padded with a
+// subquantizer whose codes and table are zero; the last block of a list
+// is padded with zero codes.
+inline constexpr size_t kFastScanBlock = 32;
+inline constexpr uint32_t kFastScanMaxM = 256;  // Sums must fit uint16
+
+inline size_t fastScanBlocks(size_t rows) { return (rows + kFastScanBlock - 1) / kFastScanBlock; }
+inline size_t fastScanBlockBytes(uint32_t m) { return size_t{(m + 1) / 2} * 2 * 16; }
+
+// Pack `rows` codes of m bytes each (one 4-bit code per byte) into
+// fastScanBlocks(rows) * fastScanBlockBytes(m) bytes at `out`
+void packFastScanCodes(const uint8_t* codes, size_t rows, uint32_t m, uint8_t* out);
+
+// ADC table quantized to uint8: distance ~= bias + sum / scale
+struct FastScanTable {
+    std::vector<uint8_t> lut;  // fastScanBlockBytes(m) bytes
+    float scale = 1.0f;
+    float bias = 0.0f;
+};
+
+// Approximate squared distances of `rows` packed codes
+void fastScanDistances(const FastScanTable& table, const uint8_t* blocks, size_t rows, float* out);
+
+// Stable-tier IVF-PQ quantizer: coarse lists, an optional OPQ rotation,
+// and a product quantizer on rotated residuals.
+//
+// A vector x in list c is coded as PQ((x - c) R). R is orthonormal, so
+// distances between residuals are preserved and a query needs only qR and
+// the rotated centroids cR (precomputed on load): the residual of list c
+// is qR - cR, with no per-list rotation.
+//
+// OPQ follows the non-parametric method of Ge et al.: starting from R = I,
+// alternate training the PQ on XR and solving the orthogonal Procrustes
+// problem R = argmin |XR - Y| for the reconstruction Y, whose solution is
+// the polar factor of X^T Y. The factor is found with scaled Newton
+// iterations, so no SVD routine is needed.
+//
+// Models are immutable once trained and are shared between the builds
+// that reuse them and the segments written with them.
+class IvfPqModel {
+public:
+    struct Params {
+        uint32_t nlist = constants::STABLE_IVF_NLIST;
+        uint32_t m = constants::STABLE_PQ_M;
+        uint32_t nbits = constants::STABLE_PQ_NBITS;
+        bool use_opq = true;
+        uint32_t kmeans_iters = 10;
+        uint32_t opq_iters = 8;           // Alternating rotation / PQ rounds
+        uint32_t opq_pq_iters = 4;        // k-means iterations per round
+        size_t opq_sample = 65536;        // Rows used to fit the rotation
+        uint64_t seed = 1234;
+        bool fast_scan = false;           // Write fast-scan codes (nbits = 4)
+        CentroidGraph::Options graph;     // From index.global; not set by fromConfig
+        AssignFn assign;                  // k-means and encoding offload; not set by fromConfig
+
+        static Params fromConfig(const StableIndexConfig& config);
+    };
+
+    // Trains on `n` sample rows. `coarse` (nlist x dim) reuses existing
+    // centroids instead of clustering the sample. nlist is lowered to the
+    // sample size if the sample is smaller. Throws
+    // util::InvalidArgumentException if dim is not a multiple of m or
+    // nbits is not in [1, 8], or fast_scan is set without nbits = 4 or
+    // with m over kFastScanMaxM. With params.graph wanted for nlist, the
+    // model carries a CentroidGraph over its lists.
+    static std::shared_ptr<const IvfPqModel> train(const Params& params, uint32_t dim, const float* sample,
+                                                   size_t n, const float* coarse = nullptr);
+
+    // Throws util::IOException if the bytes are not a valid model
+    static std::shared_ptr<const IvfPqModel> deserialize(std::span<const std::byte> bytes);
+    std::vector<std::byte> serialize() const;
+
+    uint32_t dim() const { return dim_; }
+    uint32_t nlist() const { return nlist_; }
+    bool rotated() const { return !rotation_.empty(); }
+    const ProductQuantizer& pq() const { return pq_; }
+    size_t codeBytes() const { return pq_.codeBytes(); }
+
+    // CRC-32C of the serialized model; segments record it
+    uint32_t id() const { return id_; }
+
+    // Mean squared reconstruction error on the training sample
+    float trainedDistortion() const { return distortion_; }
+
+    // Same, measured on other rows (to decide whether the model still fits)
+    float distortion(const float* x, size_t n) const;
+
+    uint32_t assign(const float* x) const;
+
+    // The nprobe nearest lists to `query` (L2), nearest first; through the
+    // centroid graph when the model has one
+    std::vector<uint32_t> probe(const float* query, size_t nprobe) const;
+    const CentroidGraph* graph() const { return graph_.get(); }
+    void rotate(const float* x, float* out) const;
+
+    // Code `x` in `list`; `scratch` holds 2 * dim floats
+    void encode(const float* x, uint32_t list, uint8_t* code, float* scratch) const;
+
+    // Assign and code n rows in parallel (OpenMP), or with the nearest
+    // centroid searches through `assign` when set
+    void encodeBatch(const float* x, size_t n, uint32_t* lists, uint8_t* codes, const AssignFn& assign = {}) const;
+
+    // Approximate x, in the rotated space
+    void decodeRotated(uint32_t list, const uint8_t* code, float* out) const;
+
+    // ADC table of `query_rotated` (rotate() of the query) for one list
+    void distanceTable(const float* query_rotated, uint32_t list, float* table, float* scratch) const;
+
+    // Quantized ADC table for fast scan (nbits = 4 only; throws
+    // std::logic_error otherwise); `scratch` holds dim + m * 16 floats
+    void fastScanTable(const float* query_rotated, uint32_t list, FastScanTable& table, float* scratch) const;
+
+    std::span<const float> centroids() const { return coarse_; }
+
+    // The coarse centroids in the rotated space (cR): ADC of a list is
+    // against rotate(query) - centroidsRotated()[list]
+    std::span<const float> centroidsRotated() const { return coarse_rotated_; }
+
+private:
+    uint32_t dim_ = 0;
+    uint32_t nlist_ = 0;
+    std::vector<float> coarse_;          // nlist x dim
+    std::vector<float> rotation_;        // dim x dim, row-major; empty = identity
+    std::vector<float> coarse_rotated_;  // coarse_ R
+    ProductQuantizer pq_;
+    std::unique_ptr<const CentroidGraph> graph_;  // Over coarse_; serialized with the model
+    float distortion_ = 0.0f;
+    uint32_t id_ = 0;
+
+    void finish();
+};
+
+} // namespace woved::index
@@ -0,0 +1,282 @@
+#include "nprobe-tuner.h"
+#include "core/config.h"
+#include "util/crc32c.h"
+#include "util/exceptions.h"
+#include "util/file-io.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+namespace woved::index {
+
+namespace {
+
+constexpr uint64_t kStateMagic = 0x4e55544445564f57ULL;  // "WOVEDTUN"
+constexpr uint32_t kStateVersion = 1;
+
+// State file: StateHeader, then per entry a StateEntry and its tenant
+// name, then the CRC-32C of everything before it
+struct StateHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t entries;
+};
+
+struct StateEntry {
+    uint32_t name_bytes;
+    uint32_t tier;
+    uint32_t nprobe;
+    uint32_t reserved;
+};
+
+template <typename T>
+void put(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+} // namespace
+
+NprobeTuner::Options NprobeTuner::Options::fromConfig(const Config& config) {
+    const TuningConfig& tuning = config.tuning;
+    Options options;
+    options.enabled = tuning.auto_tune_enabled;
+    options.recall_target = tuning.recall_target;
+    options.delta_min = tuning.nprobe_delta_min;
+    options.delta_max = std::max(tuning.nprobe_delta_max, tuning.nprobe_delta_min);
+    options.stable_min = tuning.nprobe_stable_min;
+    options.stable_max = std::max(tuning.nprobe_stable_max, tuning.nprobe_stable_min);
+    options.window = std::chrono::hours(tuning.decision_window_hours);
+    options.sample_rate = tuning.shadow_sample_rate;
+    options.min_samples = tuning.min_samples;
+    if (tuning.persist_decisions) options.state_path = config.storage.data_dir + "/nprobe-tuning.state";
+    return options;
+}
+
+NprobeTuner::NprobeTuner(const Options& options)
+    : options_(options),
+      sample_every_(options.sample_rate > 0.0 ? static_cast<uint64_t>(std::max(1.0, std::round(1.0 / options.sample_rate)))
+                                              : 0) {
+    if (!options_.state_path.empty()) load();
+}
+
+NprobeTuner::Tiers NprobeTuner::fresh() const {
+    Tiers tiers;
+    const auto now = std::chrono::steady_clock::now();
+    for (Tier tier : {Tier::Delta, Tier::Stable}) {
+        tiers[static_cast<size_t>(tier)].nprobe = upper(tier);
+        tiers[static_cast<size_t>(tier)].window_start = now;
+    }
+    return tiers;
+}
+
+uint32_t NprobeTuner::nprobe(std::string_view tenant, Tier tier) const {
+    std::shared_lock lock(mutex_);
+    if (!options_.enabled) return upper(tier);
+    auto it = tenants_.find(tenant);
+    return it == tenants_.end() ? upper(tier) : it->second[static_cast<size_t>(tier)].nprobe;
+}
+
+bool NprobeTuner::shouldSample() {
+    if (!options_.enabled || sample_every_ == 0) return false;
+    return queries_.fetch_add(1, std::memory_order_relaxed) % sample_every_ == 0;
+}
+
+void NprobeTuner::record(std::string_view tenant, Tier tier, size_t found, size_t k) {
+    if (!options_.enabled || k == 0) return;
+    bool changed = false;
+    {
+        std::unique_lock lock(mutex_);
+        auto it = tenants_.find(tenant);
+        if (it == tenants_.end()) it = tenants_.emplace(std::string(tenant), fresh()).first;
+        State& state = it->second[static_cast<size_t>(tier)];
+        state.hits += std::min(found, k);
+        state.total += k;
+        state.queries++;
+
+        const auto now = std::chrono::steady_clock::now();
+        if (state.queries < options_.min_samples || now - state.window_start < options_.window) return;
+        const double recall = static_cast<double>(state.hits) / static_cast<double>(state.total);
+        // Queries, not neighbours, are the independent samples
+        const double error = std::sqrt(recall * (1.0 - recall) / static_cast<double>(state.queries));
+        const uint32_t before = state.nprobe;
+        if (recall < options_.recall_target) {
+            state.nprobe = std::min(state.nprobe + 1, upper(tier));
+        } else if (recall - 2.0 * error >= options_.recall_target) {
+            state.nprobe = std::max(state.nprobe, lower(tier) + 1) - 1;
+        }
+        state.recall = static_cast<float>(recall);
+        state.hits = state.total = state.queries = 0;
+        state.window_start = now;
+        changed = state.nprobe != before;
+        if (changed) {
+            LOG_INFO("nprobe tuner: tenant '{}' {} nprobe {} -> {} (recall {:.3f})", tenant,
+                     tier == Tier::Delta ? "delta" : "stable", before, state.nprobe, recall);
+        }
+    }
+    if (changed && !options_.state_path.empty()) {
+        try {
+            save();
+        } catch (const util::IOException& e) {
+            LOG_WARN("nprobe tuner: {}", e.what());
+        }
+    }
+}
+
+void NprobeTuner::measure(const TwoPhaseEngine& engine, const TwoPhaseEngine::Query& query, std::string_view tenant,
+                          std::span<const storage::DeltaSegment* const> delta,
+                          std::span<const storage::StableSegment* const> stable) {
+    TwoPhaseEngine::Query q = query;
+    q.buffer = nullptr;
+    q.cache = nullptr;
+    q.stable_adc = {};
+    q.router = nullptr;
+    q.results = nullptr;
+    auto overlap = [&](Tier tier, std::span<const storage::DeltaSegment* const> d,
+                       std::span<const storage::StableSegment* const> s) {
+        if (d.empty() && s.empty()) return;
+        uint32_t& nprobe = tier == Tier::Delta ? q.nprobe_delta : q.nprobe_stable;
+        nprobe = this->nprobe(tenant, tier);
+        q.sample_p = query.sample_p;
+        const auto approx = engine.search(q, d, s);
+        nprobe = TwoPhaseEngine::kAllLists;
+        q.sample_p = 1.0f;
+        const auto exact = engine.search(q, d, s);
+        size_t found = 0;
+        for (const auto& e : exact) {
+            found += std::any_of(approx.begin(), approx.end(),
+                                 [&](const TwoPhaseEngine::Hit& a) { return a.id_hash == e.id_hash; });
+        }
+        record(tenant, tier, found, exact.size());
+    };
+    overlap(Tier::Delta, delta, {});
+    overlap(Tier::Stable, {}, stable);
+}
+
+void NprobeTuner::reconfigure(const Options& options) {
+    size_t clamped = 0;
+    {
+        std::unique_lock lock(mutex_);
+        options_.recall_target = options.recall_target;
+        options_.delta_min = options.delta_min;
+        options_.delta_max = std::max(options.delta_max, options.delta_min);
+        options_.stable_min = options.stable_min;
+        options_.stable_max = std::max(options.stable_max, options.stable_min);
+        options_.window = options.window;
+        options_.min_samples = options.min_samples;
+        for (auto& [tenant, tiers] : tenants_) {
+            for (Tier tier : {Tier::Delta, Tier::Stable}) {
+                State& state = tiers[static_cast<size_t>(tier)];
+                const uint32_t nprobe = std::clamp(state.nprobe, lower(tier), upper(tier));
+                clamped += nprobe != state.nprobe;
+                state.nprobe = nprobe;
+            }
+        }
+    }
+    LOG_INFO("nprobe tuner: recall target {:.3f}, delta nprobe [{}, {}], stable [{}, {}]; {} decisions clamped",
+             options.recall_target, options.delta_min, std::max(options.delta_max, options.delta_min),
+             options.stable_min, std::max(options.stable_max, options.stable_min), clamped);
+    if (clamped > 0 && !options_.state_path.empty()) {
+        try {
+            save();
+        } catch (const util::IOException& e) {
+            LOG_WARN("nprobe tuner: {}", e.what());
+        }
+    }
+}
+
+std::vector<NprobeTuner::Decision> NprobeTuner::decisions() const {
+    std::shared_lock lock(mutex_);
+    std::vector<Decision> out;
+    for (const auto& [tenant, tiers] : tenants_) {
+        for (Tier tier : {Tier::Delta, Tier::Stable}) {
+            const State& state = tiers[static_cast<size_t>(tier)];
+            out.push_back({tenant, tier, state.nprobe, state.recall, state.queries});
+        }
+    }
+    return out;
+}
+
+void NprobeTuner::save() const {
+    if (options_.state_path.empty()) return;
+    std::string bytes;
+    {
+        std::shared_lock lock(mutex_);
+        put(bytes, StateHeader{kStateMagic, kStateVersion, static_cast<uint32_t>(tenants_.size() * 2)});
+        for (const auto& [tenant, tiers] : tenants_) {
+            for (Tier tier : {Tier::Delta, Tier::Stable}) {
+                put(bytes, StateEntry{static_cast<uint32_t>(tenant.size()), static_cast<uint32_t>(tier),
+                                      tiers[static_cast<size_t>(tier)].nprobe, 0});
+                bytes += tenant;
+            }
+        }
+    }
+    put(bytes, util::crc32c(bytes.data(), bytes.size()));
+
+    std::lock_guard<std::mutex> lock(save_mutex_);
+    const std::string tmp = options_.state_path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw util::IOException("open " + tmp + ": " + std::strerror(errno));
+    try {
+        util::write_all(fd, bytes.data(), bytes.size(), tmp);
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw;
+    }
+    if (::fsync(fd) != 0 || ::close(fd) != 0) {
+        const int err = errno;
+        ::unlink(tmp.c_str());
+        throw util::IOException("sync " + tmp + ": " + std::strerror(err));
+    }
+    if (::rename(tmp.c_str(), options_.state_path.c_str()) != 0) {
+        const int err = errno;
+        ::unlink(tmp.c_str());
+        throw util::IOException("rename " + tmp + ": " + std::strerror(err));
+    }
+    util::sync_parent_directory(options_.state_path);
+}
+
+void NprobeTuner::load() {
+    std::ifstream in(options_.state_path, std::ios::binary);
+    if (!in) return;
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    auto corrupt = [&](const char* why) {
+        LOG_WARN("nprobe tuner: ignoring {}: {}", options_.state_path, why);
+        tenants_.clear();
+    };
+
+    StateHeader header{};
+    uint32_t crc = 0;
+    if (bytes.size() < sizeof(header) + sizeof(crc)) return corrupt("truncated");
+    std::memcpy(&crc, bytes.data() + bytes.size() - sizeof(crc), sizeof(crc));
+    if (util::crc32c(bytes.data(), bytes.size() - sizeof(crc)) != crc) return corrupt("checksum mismatch");
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != kStateMagic || header.version != kStateVersion) return corrupt("bad magic or version");
+
+    size_t pos = sizeof(header);
+    const size_t end = bytes.size() - sizeof(crc);
+    for (uint32_t i = 0; i < header.entries; ++i) {
+        StateEntry entry{};
+        if (end - pos < sizeof(entry)) return corrupt("truncated entry");
+        std::memcpy(&entry, bytes.data() + pos, sizeof(entry));
+        pos += sizeof(entry);
+        if (end - pos < entry.name_bytes || entry.tier > 1) return corrupt("bad entry");
+        std::string tenant = bytes.substr(pos, entry.name_bytes);
+        pos += entry.name_bytes;
+
+        auto it = tenants_.find(tenant);
+        if (it == tenants_.end()) it = tenants_.emplace(std::move(tenant), fresh()).first;
+        const auto tier = static_cast<Tier>(entry.tier);
+        // Bounds may have changed since the decision was made
+        it->second[entry.tier].nprobe = std::clamp(entry.nprobe, lower(tier), upper(tier));
+    }
+    LOG_INFO("nprobe tuner: loaded {} decisions from {}", header.entries, options_.state_path);
+}
+
+} // namespace woved::index
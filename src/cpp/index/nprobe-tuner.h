@@ -0,0 +1,122 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "index/two-phase-engine.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::index {
+
+// Closed-loop nprobe per tenant and tier, held at tuning.recall_target.
+//
+// A sampled query (shouldSample(), about shadow_sample_rate of them) is
+// rerun per tier by measure(): once with the tenant's nprobe and once
+// over every list. The overlap of the two top k is that tier's recall
+// for the query. Recall accumulates per tenant and tier, and when a
+// decision window closes with at least min_samples queries the tier
+// moves one step, within its [min, max]:
+//   up    if the recall is under the target
+//   down  if it is over the target by two standard errors
+// A tenant starts at max, so an unmeasured tenant is never short of
+// probes, and is walked down as samples arrive. The stable rerun over
+// every list keeps ADC and rerank, so it measures the recall lost to
+// nprobe alone.
+//
+// Decisions that change are saved to state_path (written to a temporary
+// file, synced and renamed) and read back on construction. A state file
+// that fails its checksum is ignored with a warning.
+class NprobeTuner {
+public:
+    enum class Tier : uint8_t { Delta = 0, Stable = 1 };
+
+    struct Options {
+        bool enabled = true;                             // tuning.auto_tune_enabled
+        float recall_target = 0.95f;
+        uint32_t delta_min = 4;
+        uint32_t delta_max = 8;
+        uint32_t stable_min = 8;
+        uint32_t stable_max = 16;
+        std::chrono::seconds window{3600};               // tuning.decision_window_hours
+        double sample_rate = 0.01;                       // tuning.shadow_sample_rate
+        uint32_t min_samples = 64;                       // Per window and tier
+        std::string state_path;                          // Empty: decisions are not saved
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Decision {
+        std::string tenant;
+        Tier tier;
+        uint32_t nprobe;
+        float recall;        // Of the last closed window; 0 before one
+        uint64_t samples;    // In the current window
+    };
+
+    explicit NprobeTuner(const Options& options);
+
+    // nprobe for a query of `tenant` on `tier`; max while unmeasured or
+    // when tuning is off
+    uint32_t nprobe(std::string_view tenant, Tier tier) const;
+
+    // Whether to measure() this query
+    bool shouldSample();
+
+    // One sampled query: `found` of the exact top `k` came back
+    void record(std::string_view tenant, Tier tier, size_t found, size_t k);
+
+    // Rerun `query` on each tier with the tenant's nprobe and over every
+    // list, every row, and record() the overlap. The buffer and cache
+    // phases are left out.
+    void measure(const TwoPhaseEngine& engine, const TwoPhaseEngine::Query& query, std::string_view tenant,
+                 std::span<const storage::DeltaSegment* const> delta,
+                 std::span<const storage::StableSegment* const> stable);
+
+    std::vector<Decision> decisions() const;
+
+    // Live tuning (config reload): the recall target, bounds, window and
+    // min_samples of `options`. Each tenant's nprobe is clamped into the
+    // new bounds; enabled, sample_rate and state_path stay as constructed.
+    void reconfigure(const Options& options);
+
+    // Write the decisions to state_path now. Throws util::IOException.
+    void save() const;
+
+private:
+    struct State {
+        uint32_t nprobe = 0;
+        uint64_t hits = 0;
+        uint64_t total = 0;
+        uint64_t queries = 0;
+        float recall = 0.0f;
+        std::chrono::steady_clock::time_point window_start;
+    };
+    using Tiers = std::array<State, 2>;
+
+    uint32_t lower(Tier tier) const { return tier == Tier::Delta ? options_.delta_min : options_.stable_min; }
+    uint32_t upper(Tier tier) const { return tier == Tier::Delta ? options_.delta_max : options_.stable_max; }
+    Tiers fresh() const;
+    void load();
+
+    Options options_;
+    uint64_t sample_every_;
+    std::atomic<uint64_t> queries_{0};
+    mutable std::shared_mutex mutex_;
+    std::map<std::string, Tiers, std::less<>> tenants_;
+    mutable std::mutex save_mutex_;
+};
+
+} // namespace woved::index
@@ -0,0 +1,428 @@
+#include "recall-estimator.h"
+#include "core/config.h"
+#include "index/nprobe-tuner.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-stable.h"
+#include "storage/snapshot.h"
+#include "util/cancellation.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <unordered_map>
+
+namespace woved::index {
+
+namespace {
+
+// Tenants tracked by name; the rest are pooled as "other"
+constexpr size_t kMaxTenants = 1024;
+// Stable rows scored per rerank() call of the exhaustive scan
+constexpr uint64_t kScanChunk = 65536;
+
+using Hit = TwoPhaseEngine::Hit;
+using Hits = std::vector<Hit>;
+
+size_t overlap(const Hits& approx, const Hits& exact) {
+    size_t found = 0;
+    for (const Hit& e : exact) {
+        found += std::any_of(approx.begin(), approx.end(), [&](const Hit& a) { return a.id_hash == e.id_hash; });
+    }
+    return found;
+}
+
+void keepTop(Hits& hits, size_t k) {
+    const auto better = [](const Hit& a, const Hit& b) { return a.score > b.score; };
+    if (hits.size() > k) {
+        std::nth_element(hits.begin(), hits.begin() + static_cast<std::ptrdiff_t>(k), hits.end(), better);
+        hits.resize(k);
+    }
+    std::sort(hits.begin(), hits.end(), better);
+}
+
+// Newest version of an id as of the read epoch; a tombstone wins a tie
+struct Newest {
+    Epoch epoch = 0;
+    bool tombstone = false;
+};
+using NewestMap = std::unordered_map<VectorIdHash, Newest>;
+
+// Folds one segment's rows into the versions of the ids already in `newest`
+void foldVersions(NewestMap& newest, std::span<const VectorIdHash> ids, std::span<const Epoch> epochs,
+                  std::span<const uint8_t> flags, Epoch read_epoch) {
+    for (size_t row = 0; row < ids.size(); ++row) {
+        if (epochs[row] > read_epoch) continue;
+        auto it = newest.find(ids[row]);
+        if (it == newest.end()) continue;
+        const bool tombstone = (flags[row] & storage::kDeltaTombstone) != 0;
+        if (epochs[row] > it->second.epoch || (epochs[row] == it->second.epoch && tombstone)) {
+            it->second = {epochs[row], tombstone};
+        }
+    }
+}
+
+// Drops hits that are not the newest version of their id, over the
+// stable tier and, with `delta`, the delta tier too
+void dropSuperseded(Hits& hits, const storage::SegmentSet& set, bool delta, Epoch read_epoch) {
+    NewestMap newest;
+    for (const Hit& h : hits) newest.emplace(h.id_hash, Newest{});
+    for (const auto* segment : set.stable_view) {
+        foldVersions(newest, segment->idHashes(), segment->epochs(), segment->flags(), read_epoch);
+    }
+    if (delta) {
+        for (const auto* segment : set.delta_view) {
+            foldVersions(newest, segment->idHashes(), segment->epochs(), segment->flags(), read_epoch);
+        }
+    }
+    std::erase_if(hits, [&](const Hit& h) {
+        const Newest& n = newest[h.id_hash];
+        return n.tombstone || n.epoch != h.epoch;
+    });
+}
+
+// Top `m` live stable rows written by read_epoch, by full vector, in
+// chunks so the candidate list stays small on large segments
+Hits scanStable(const storage::SegmentSet& set, const TwoPhaseEngine::Query& query, size_t m,
+                const util::CancellationToken* cancel) {
+    Hits top;
+    std::vector<RerankCandidate> chunk;
+    for (uint32_t s = 0; s < set.stable_view.size(); ++s) {
+        const storage::StableSegment& segment = *set.stable_view[s];
+        const auto ids = segment.idHashes();
+        const auto epochs = segment.epochs();
+        for (uint64_t begin = 0; begin < segment.liveRows(); begin += kScanChunk) {
+            if (cancel && cancel->cancelled()) return top;
+            chunk.clear();
+            const uint64_t end = std::min(begin + kScanChunk, segment.liveRows());
+            for (uint64_t row = begin; row < end; ++row) {
+                if (epochs[row] <= query.read_epoch) chunk.push_back({s, row});
+            }
+            for (const RerankHit& h : rerank(set.stable_view, chunk, query.metric, query.vector, m, cancel)) {
+                top.push_back({ids[h.row], epochs[h.row], h.score});
+            }
+            keepTop(top, m);
+        }
+    }
+    return top;
+}
+
+// Exhaustive top k of the stable tier; with `delta` set, only rows that
+// are not superseded in the delta tier either. The scan keeps a few more
+// than k so superseded rows can be dropped, and is rerun wider in the
+// rare case too many were.
+Hits exactStable(const storage::SegmentSet& set, const TwoPhaseEngine::Query& query, bool delta,
+                 const util::CancellationToken* cancel) {
+    uint64_t live = 0;
+    for (const auto* segment : set.stable_view) live += segment->liveRows();
+    for (size_t m = 2 * query.k;; m *= 4) {
+        Hits hits = scanStable(set, query, m, cancel);
+        const bool complete = hits.size() < m;
+        dropSuperseded(hits, set, delta, query.read_epoch);
+        if (hits.size() >= query.k || complete || m >= live) {
+            keepTop(hits, query.k);
+            return hits;
+        }
+    }
+}
+
+// Newest version of each id across the two exhaustive tiers, top k
+Hits mergeTiers(Hits delta, const Hits& stable, size_t k) {
+    std::unordered_map<VectorIdHash, size_t> at;
+    for (size_t i = 0; i < delta.size(); ++i) at.emplace(delta[i].id_hash, i);
+    for (const Hit& h : stable) {
+        auto it = at.find(h.id_hash);
+        if (it == at.end()) {
+            at.emplace(h.id_hash, delta.size());
+            delta.push_back(h);
+        } else if (h.epoch > delta[it->second].epoch) {
+            delta[it->second] = h;
+        }
+    }
+    keepTop(delta, k);
+    return delta;
+}
+
+double ratio(uint64_t hits, uint64_t total) {
+    return total == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(total);
+}
+
+} // namespace
+
+RecallEstimator::Options RecallEstimator::Options::fromConfig(const Config& config) {
+    const auto& recall = config.monitoring.recall;
+    Options options;
+    options.enabled = recall.enabled;
+    options.sample_rate = recall.sample_rate;
+    options.queue = std::max<size_t>(recall.queue, 1);
+    options.min_interval = std::chrono::milliseconds(recall.min_interval_ms);
+    options.window = std::chrono::seconds(std::max<uint32_t>(recall.window_s, 2));
+    return options;
+}
+
+RecallEstimator::RecallEstimator(const Options& options, const TwoPhaseEngine& engine, NprobeTuner* tuner)
+    : options_(options),
+      engine_(engine),
+      tuner_(tuner),
+      sample_every_(options.sample_rate > 0.0 ? static_cast<uint64_t>(std::max(1.0, std::round(1.0 / options.sample_rate)))
+                                              : 0),
+      half_start_(std::chrono::steady_clock::now()) {}
+
+RecallEstimator::~RecallEstimator() {
+    stop();
+}
+
+void RecallEstimator::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ || !options_.enabled) return;
+    running_ = true;
+    cancel_ = std::make_unique<util::CancellationToken>();
+    thread_ = std::thread([this] { loop(); });
+}
+
+void RecallEstimator::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+        cancel_->cancel();
+    }
+    cv_.notify_all();
+    thread_.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.clear();
+}
+
+bool RecallEstimator::shouldSample() {
+    if (!options_.enabled || sample_every_ == 0) return false;
+    return queries_.fetch_add(1, std::memory_order_relaxed) % sample_every_ == 0;
+}
+
+bool RecallEstimator::submit(const TwoPhaseEngine::Query& query, const storage::SegmentSet& segments) {
+    if (query.k == 0) return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.sampled++;
+        if (!running_ || pending_.size() >= options_.queue) {
+            stats_.dropped++;
+            return false;
+        }
+    }
+
+    auto sample = std::make_unique<Sample>();
+    sample->vector.assign(query.vector.begin(), query.vector.end());
+    sample->probe.assign(query.probe.begin(), query.probe.end());
+    sample->tenant = query.tenant;
+    sample->query = query;
+    sample->query.vector = sample->vector;
+    sample->query.probe = sample->probe;
+    sample->query.tenant = sample->tenant;
+    // Nothing of the live query's phases may be touched after it returns
+    sample->query.buffer = nullptr;
+    sample->query.stable_adc = {};
+    sample->query.cancel = nullptr;
+    sample->query.tracer = nullptr;
+    sample->segments = segments;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_ || pending_.size() >= options_.queue) {
+            stats_.dropped++;
+            return false;
+        }
+        pending_.push_back(std::move(sample));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+void RecallEstimator::loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto next = std::chrono::steady_clock::now();
+    while (running_) {
+        cv_.wait(lock, [&] { return !running_ || !pending_.empty(); });
+        if (!running_) break;
+        if (std::chrono::steady_clock::now() < next) {
+            cv_.wait_until(lock, next, [&] { return !running_; });
+            continue;
+        }
+        auto sample = std::move(pending_.front());
+        pending_.pop_front();
+        const util::CancellationToken* cancel = cancel_.get();
+        lock.unlock();
+        bool ok = true;
+        try {
+            replay(sample->query, sample->segments, cancel);
+        } catch (const std::exception& e) {
+            ok = false;
+            LOG_WARN("recall estimator: replay failed: {}", e.what());
+        }
+        sample.reset();
+        lock.lock();
+        if (ok) {
+            stats_.measured++;
+        } else {
+            stats_.failed++;
+        }
+        next = std::chrono::steady_clock::now() + options_.min_interval;
+    }
+}
+
+void RecallEstimator::measure(const TwoPhaseEngine::Query& query, const storage::SegmentSet& segments) {
+    replay(query, segments, nullptr);
+}
+
+void RecallEstimator::replay(const TwoPhaseEngine::Query& query, const storage::SegmentSet& set,
+                             const util::CancellationToken* cancel) {
+    const std::string_view tenant = query.tenant;
+    auto cancelled = [&] { return cancel && cancel->cancelled(); };
+
+    // The caches and the buffer are left out; the rest runs as it did live
+    TwoPhaseEngine::Query approx = query;
+    approx.buffer = nullptr;
+    approx.cache = nullptr;
+    approx.stable_adc = {};
+    approx.router = nullptr;
+    approx.results = nullptr;
+    approx.tracer = nullptr;
+    approx.cancel = cancel;
+    approx.delta_dead = set.delta_dead_view;
+    approx.stable_dead = set.stable_dead_view;
+    TwoPhaseEngine::Query exact = approx;
+    exact.nprobe_delta = TwoPhaseEngine::kAllLists;
+    exact.sample_p = 1.0f;
+
+    const std::span<const storage::DeltaSegment* const> delta = set.delta_view;
+    const std::span<const storage::StableSegment* const> stable = set.stable_view;
+    // Per tier: found, exhaustive top k size
+    std::array<std::pair<size_t, size_t>, 3> tiers{};
+    Hits exact_delta;
+    if (!delta.empty()) {
+        const Hits found = engine_.search(approx, delta, {});
+        exact_delta = engine_.search(exact, delta, {});
+        tiers[static_cast<size_t>(Tier::Delta)] = {overlap(found, exact_delta), exact_delta.size()};
+    }
+    if (!stable.empty() && !cancelled()) {
+        const Hits found = engine_.search(approx, {}, stable);
+        const Hits truth = exactStable(set, approx, false, cancel);
+        tiers[static_cast<size_t>(Tier::Stable)] = {overlap(found, truth), truth.size()};
+    }
+    if (!delta.empty() && !stable.empty() && !cancelled()) {
+        const Hits found = engine_.search(approx, delta, stable);
+        const Hits truth = mergeTiers(std::move(exact_delta), exactStable(set, approx, true, cancel), approx.k);
+        tiers[static_cast<size_t>(Tier::All)] = {overlap(found, truth), truth.size()};
+    } else {
+        // One tier holds everything
+        tiers[static_cast<size_t>(Tier::All)] = tiers[static_cast<size_t>(delta.empty() ? Tier::Stable : Tier::Delta)];
+    }
+    // A cancelled replay may have cut an exhaustive scan short
+    if (cancelled()) return;
+    for (Tier tier : {Tier::All, Tier::Delta, Tier::Stable}) {
+        const auto [found, k] = tiers[static_cast<size_t>(tier)];
+        if (k > 0) record(tenant, tier, found, k);
+    }
+}
+
+void RecallEstimator::record(std::string_view tenant, Tier tier, size_t found, size_t k) {
+    if (tuner_ && tier != Tier::All) {
+        tuner_->record(tenant, tier == Tier::Delta ? NprobeTuner::Tier::Delta : NprobeTuner::Tier::Stable, found, k);
+    }
+    std::lock_guard<std::mutex> lock(windows_mutex_);
+    rotateLocked();
+    auto it = tenants_.find(tenant);
+    if (it == tenants_.end()) {
+        const std::string name = tenants_.size() < kMaxTenants ? std::string(tenant) : "other";
+        it = tenants_.try_emplace(name).first;
+    }
+    for (Tiers* tiers : {&it->second, &pooled_}) {
+        Window& w = (*tiers)[static_cast<size_t>(tier)];
+        w.hits[0] += std::min(found, k);
+        w.total[0] += k;
+        w.queries[0]++;
+    }
+}
+
+void RecallEstimator::rotateLocked() {
+    const auto now = std::chrono::steady_clock::now();
+    const auto half = options_.window / 2;
+    if (now - half_start_ < half) return;
+    // Idle for a whole window or more: nothing recent is left
+    const bool stale = now - half_start_ >= 2 * half;
+    auto rotate = [&](Tiers& tiers) {
+        for (Window& w : tiers) {
+            w.hits = {0, stale ? 0 : w.hits[0]};
+            w.total = {0, stale ? 0 : w.total[0]};
+            w.queries = {0, stale ? 0 : w.queries[0]};
+        }
+    };
+    for (auto& [tenant, tiers] : tenants_) rotate(tiers);
+    rotate(pooled_);
+    std::erase_if(tenants_, [](const auto& entry) {
+        return std::all_of(entry.second.begin(), entry.second.end(), [](const Window& w) { return w.queries[1] == 0; });
+    });
+    half_start_ = now;
+}
+
+RecallEstimator::Estimate RecallEstimator::estimate(std::string_view tenant, Tier tier) const {
+    std::lock_guard<std::mutex> lock(windows_mutex_);
+    const Tiers* tiers = &pooled_;
+    if (!tenant.empty()) {
+        auto it = tenants_.find(tenant);
+        if (it == tenants_.end()) return {std::string(tenant), tier, 0.0, 0};
+        tiers = &it->second;
+    }
+    const Window& w = (*tiers)[static_cast<size_t>(tier)];
+    return {std::string(tenant), tier, ratio(w.hits[0] + w.hits[1], w.total[0] + w.total[1]),
+            w.queries[0] + w.queries[1]};
+}
+
+std::vector<RecallEstimator::Estimate> RecallEstimator::estimates() const {
+    std::lock_guard<std::mutex> lock(windows_mutex_);
+    std::vector<Estimate> out;
+    for (const auto& [tenant, tiers] : tenants_) {
+        for (Tier tier : {Tier::All, Tier::Delta, Tier::Stable}) {
+            const Window& w = tiers[static_cast<size_t>(tier)];
+            const uint64_t queries = w.queries[0] + w.queries[1];
+            if (queries == 0) continue;
+            out.push_back({tenant, tier, ratio(w.hits[0] + w.hits[1], w.total[0] + w.total[1]), queries});
+        }
+    }
+    return out;
+}
+
+RecallEstimator::Stats RecallEstimator::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::string_view RecallEstimator::name(Tier tier) {
+    switch (tier) {
+        case Tier::All: return "all";
+        case Tier::Delta: return "delta";
+        case Tier::Stable: return "stable";
+    }
+    return "unknown";
+}
+
+std::vector<std::pair<std::string_view, double>> RecallEstimator::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_recall_estimate", estimate({}, Tier::All).recall},
+        {"woved_recall_estimate_delta", estimate({}, Tier::Delta).recall},
+        {"woved_recall_estimate_stable", estimate({}, Tier::Stable).recall},
+        {"woved_recall_samples", static_cast<double>(estimate({}, Tier::All).samples)},
+        {"woved_recall_measured", static_cast<double>(stats.measured)},
+        {"woved_recall_dropped", static_cast<double>(stats.dropped)},
+        {"woved_recall_failed", static_cast<double>(stats.failed)},
+    };
+}
+
+std::vector<Metrics::LabelledGauge> RecallEstimator::labelledMetrics() const {
+    std::vector<Metrics::LabelledGauge> out;
+    for (const Estimate& e : estimates()) {
+        out.push_back({"woved_tenant_recall_estimate", {{"tenant", e.tenant}, {"tier", std::string(name(e.tier))}},
+                       e.recall});
+    }
+    return out;
+}
+
+} // namespace woved::index
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "core/metrics.h"
+#include "index/two-phase-engine.h"
+#include "storage/snapshot.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::index {
+
+class NprobeTuner;
+
+// Online recall@k of live queries (woved_recall_estimate).
+//
+// About sample_rate of queries (shouldSample()) are handed to submit()
+// with the segment set of their snapshot (and its epoch as read_epoch),
+// and replayed on a background thread over those same segments, as of
+// that epoch. Each tier
+// is searched with the query's own nprobe, sample_p and rerank factor,
+// and the top k compared with an exhaustive one:
+//   delta   the delta tier over every list and every row
+//   stable  the stable tier against full vectors of every row, so the
+//           recall lost to PQ codes counts, not just the lists skipped
+//   all     both tiers at once; newest version of each id across them
+// The buffer and cache phases are left out: the buffer scan is exact,
+// and the caches keep their own hit statistics.
+//
+// Recall accumulates per tenant and tier over about `window` (two halves,
+// the older dropped as a new one starts). Exhaustive search is expensive,
+// so replays are at least min_interval apart and at most `queue` sampled
+// queries wait; the rest are dropped and counted.
+//
+// With a tuner, each delta and stable measurement is also record()ed
+// there, so the autotuner steers on the same numbers, and its own shadow
+// sampling (tuning.shadow_sample_rate) can be set to 0. Its stable recall
+// then includes PQ loss that more lists cannot win back: a tenant whose
+// codes lose more than 1 - recall_target stays at nprobe_stable_max.
+class RecallEstimator {
+public:
+    enum class Tier : uint8_t { All = 0, Delta = 1, Stable = 2 };
+
+    struct Options {
+        bool enabled = true;                              // monitoring.recall.enabled
+        double sample_rate = 0.0005;
+        size_t queue = 8;
+        std::chrono::milliseconds min_interval{1000};
+        std::chrono::seconds window{900};
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Estimate {
+        std::string tenant;
+        Tier tier;
+        double recall;      // 0 without samples
+        uint64_t samples;   // Queries in the window
+    };
+
+    struct Stats {
+        uint64_t sampled = 0;    // Submitted
+        uint64_t measured = 0;
+        uint64_t dropped = 0;    // Queue full
+        uint64_t failed = 0;     // Replay threw
+    };
+
+    // `engine` and `tuner` must outlive the estimator
+    RecallEstimator(const Options& options, const TwoPhaseEngine& engine, NprobeTuner* tuner = nullptr);
+    ~RecallEstimator();
+
+    RecallEstimator(const RecallEstimator&) = delete;
+    RecallEstimator& operator=(const RecallEstimator&) = delete;
+
+    void start();
+    void stop();  // Abandons a replay in flight
+
+    // Whether to submit() this query
+    bool shouldSample();
+
+    // Queue a sampled query as it ran over `segments`
+    // (Snapshot::segments()). The query's spans and tenant and the set
+    // are copied, so the segments outlive the snapshot until the replay.
+    // False if dropped.
+    bool submit(const TwoPhaseEngine::Query& query, const storage::SegmentSet& segments);
+
+    // Replay one query on the calling thread, whether started or not
+    void measure(const TwoPhaseEngine::Query& query, const storage::SegmentSet& segments);
+
+    // Recall over the window; an empty tenant pools every tenant
+    Estimate estimate(std::string_view tenant, Tier tier) const;
+    std::vector<Estimate> estimates() const;
+
+    Stats getStats() const;
+    static std::string_view name(Tier tier);
+
+    // woved_recall_estimate (all tiers), _delta and _stable, pooled
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+    // woved_tenant_recall_estimate{tenant,tier}
+    std::vector<Metrics::LabelledGauge> labelledMetrics() const;
+
+private:
+    // Hits of the exhaustive top k found, and the size of that top k
+    struct Window {
+        std::array<uint64_t, 2> hits{};
+        std::array<uint64_t, 2> total{};
+        std::array<uint64_t, 2> queries{};
+    };
+    using Tiers = std::array<Window, 3>;
+
+    // A sampled query, its spans pointing into owned copies
+    struct Sample {
+        std::vector<float> vector;
+        std::vector<CentroidId> probe;
+        std::string tenant;
+        TwoPhaseEngine::Query query;
+        storage::SegmentSet segments;
+    };
+
+    Options options_;
+    const TwoPhaseEngine& engine_;
+    NprobeTuner* tuner_;
+    uint64_t sample_every_;
+    std::atomic<uint64_t> queries_{0};
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::unique_ptr<Sample>> pending_;
+    bool running_ = false;
+    std::unique_ptr<util::CancellationToken> cancel_;
+    Stats stats_;
+    std::thread thread_;
+
+    mutable std::mutex windows_mutex_;
+    std::map<std::string, Tiers, std::less<>> tenants_;
+    Tiers pooled_;
+    std::chrono::steady_clock::time_point half_start_;
+
+    void loop();
+    void replay(const TwoPhaseEngine::Query& query, const storage::SegmentSet& set,
+                const util::CancellationToken* cancel);
+    void record(std::string_view tenant, Tier tier, size_t found, size_t k);
+    void rotateLocked();
+};
+
+} // namespace woved::index
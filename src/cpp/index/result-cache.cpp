@@ -0,0 +1,173 @@
+#include "result-cache.h"
+#include "core/config.h"
+#include "util/simd-dispatch.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <random>
+
+namespace woved::index {
+
+namespace {
+
+constexpr uint32_t kSketchBits = 64;
+
+uint64_t mix(uint64_t h, uint64_t v) {
+    h ^= v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    return h * 0xff51afd7ed558ccdULL;
+}
+
+} // namespace
+
+QueryResultCache::Options QueryResultCache::Options::fromConfig(const Config& config) {
+    Options options;
+    options.enabled = config.query.result_cache_enabled;
+    options.max_entries = config.query.result_cache_entries;
+    options.min_similarity = std::clamp(config.query.result_cache_similarity, 0.0f, 1.0f);
+    return options;
+}
+
+QueryResultCache::QueryResultCache(const Options& options, uint32_t dim, WatermarkFn watermark, LatestFn latest)
+    : options_(options), dim_(dim), watermark_(std::move(watermark)), latest_(std::move(latest)) {
+    options_.band_bits = std::clamp(options_.band_bits, 1u, kSketchBits);
+    if (!watermark_ || !latest_) options_.enabled = false;
+    std::mt19937_64 rng(options_.seed);
+    std::normal_distribution<float> gauss;
+    planes_.resize(size_t{kSketchBits} * dim_);
+    for (float& v : planes_) v = gauss(rng);
+}
+
+uint64_t QueryResultCache::filterHash(std::span<const std::string> tags_any) {
+    // Sum of per-tag hashes: the order of the list does not matter
+    uint64_t h = 0;
+    for (const std::string& tag : tags_any) h += mix(0, std::hash<std::string>{}(tag));
+    return mix(h, tags_any.size());
+}
+
+uint64_t QueryResultCache::sketch(const float* query) const {
+    float proj[kSketchBits];
+    kernels::distance_table().inner_product_block(query, planes_.data(), kSketchBits, dim_, proj);
+    uint64_t bits = 0;
+    for (uint32_t b = 0; b < kSketchBits; ++b) {
+        if (proj[b] >= 0.0f) bits |= uint64_t{1} << (kSketchBits - 1 - b);
+    }
+    return bits;
+}
+
+uint64_t QueryResultCache::bucket(const Key& key, uint64_t band) const {
+    uint64_t h = mix(key.tenant, key.ns);
+    h = mix(h, key.filter);
+    h = mix(h, static_cast<uint64_t>(key.metric) << 32 | key.k);
+    return mix(h, band);
+}
+
+bool QueryResultCache::current(const Entry& entry) const {
+    if (watermark_(entry.key.tenant, entry.key.ns) > entry.watermark) return false;
+    return std::all_of(entry.hits.begin(), entry.hits.end(), [&](const Hit& hit) {
+        const auto epoch = latest_(hit.id_hash);
+        return epoch && *epoch <= hit.epoch;
+    });
+}
+
+void QueryResultCache::eraseLocked(Shard& shard, std::list<Entry>::iterator it) {
+    auto range = shard.buckets.equal_range(it->bucket);
+    for (auto b = range.first; b != range.second; ++b) {
+        if (b->second == it) {
+            shard.buckets.erase(b);
+            break;
+        }
+    }
+    shard.lru.erase(it);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::optional<std::vector<QueryResultCache::Hit>> QueryResultCache::lookup(const Key& key,
+                                                                           std::span<const float> query) {
+    if (!options_.enabled || query.size() != dim_) return std::nullopt;
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    const auto& kernels = kernels::distance_table();
+    const uint64_t bits = sketch(query.data());
+    const float norm = std::sqrt(kernels.inner_product(query.data(), query.data(), dim_));
+    const uint32_t shift = kSketchBits - options_.band_bits;
+    const uint64_t band = bits >> shift;
+
+    // The query's band, then each band one bit away
+    for (uint32_t flip = 0; flip <= options_.band_bits; ++flip) {
+        const uint64_t b = bucket(key, flip == 0 ? band : band ^ (uint64_t{1} << (flip - 1)));
+        Shard& shard = shards_[b % kShards];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto range = shard.buckets.equal_range(b);
+        for (auto it = range.first; it != range.second; ++it) {
+            const Entry& e = *it->second;
+            if (e.key.tenant != key.tenant || e.key.ns != key.ns || e.key.filter != key.filter ||
+                e.key.metric != key.metric || e.key.k != key.k) {
+                continue;
+            }
+            if (static_cast<uint32_t>(std::popcount(e.sketch ^ bits)) > options_.max_hamming) continue;
+            const float dist = kernels.l2_sqr(query.data(), e.query.data(), dim_);
+            if (dist > 2.0f * (1.0f - options_.min_similarity) * norm * e.norm) continue;
+            if (!current(e)) {
+                stale_.fetch_add(1, std::memory_order_relaxed);
+                eraseLocked(shard, it->second);
+                return std::nullopt;
+            }
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return e.hits;
+        }
+    }
+    return std::nullopt;
+}
+
+void QueryResultCache::insert(const Key& key, std::span<const float> query, std::vector<Hit> hits, Epoch watermark) {
+    if (!options_.enabled || query.size() != dim_ || options_.max_entries == 0) return;
+    const uint64_t bits = sketch(query.data());
+    const uint64_t b = bucket(key, bits >> (kSketchBits - options_.band_bits));
+    Entry entry{key, b, bits,
+                std::sqrt(kernels::distance_table().inner_product(query.data(), query.data(), dim_)),
+                std::vector<float>(query.begin(), query.end()), std::move(hits), watermark};
+
+    Shard& shard = shards_[b % kShards];
+    const size_t per_shard = std::max<size_t>(options_.max_entries / kShards, 1);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.lru.push_front(std::move(entry));
+    shard.buckets.emplace(b, shard.lru.begin());
+    size_.fetch_add(1, std::memory_order_relaxed);
+    inserts_.fetch_add(1, std::memory_order_relaxed);
+    while (shard.lru.size() > per_shard) {
+        eraseLocked(shard, std::prev(shard.lru.end()));
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void QueryResultCache::clear() {
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size_.fetch_sub(shard.lru.size(), std::memory_order_relaxed);
+        shard.buckets.clear();
+        shard.lru.clear();
+    }
+}
+
+QueryResultCache::Stats QueryResultCache::getStats() const {
+    Stats stats;
+    stats.size = size_.load(std::memory_order_relaxed);
+    stats.lookups = lookups_.load(std::memory_order_relaxed);
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.stale = stale_.load(std::memory_order_relaxed);
+    stats.inserts = inserts_.load(std::memory_order_relaxed);
+    stats.evictions = evictions_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<std::pair<std::string_view, double>> QueryResultCache::metrics() const {
+    Stats stats = getStats();
+    return {
+        {"woved_result_cache_entries", static_cast<double>(stats.size)},
+        {"woved_result_cache_hit_ratio",
+         stats.lookups ? static_cast<double>(stats.hits) / static_cast<double>(stats.lookups) : 0.0},
+        {"woved_result_cache_stale_total", static_cast<double>(stats.stale)},
+    };
+}
+
+} // namespace woved::index
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::index {
+
+// Semantic cache of final query results (query.result_cache_*), for
+// clients that repeat a query or send a near copy of one.
+//
+// Entries are keyed by tenant, namespace, tag filter, metric, k and a
+// SimHash sketch of the query (signs of 64 fixed random projections).
+// The sketch's top band_bits pick the bucket; a lookup probes its own
+// bucket and those one band bit away, skips entries whose sketch is more
+// than max_hamming bits off, and answers from one within the radius:
+// |a - b|^2 <= 2 (1 - min_similarity) |a| |b|, cosine >= min_similarity
+// for queries of equal norm.
+//
+// A hit is served only if it is still current:
+//  - no message newer than the entry's watermark (MessageBuffer::
+//    writeEpoch() of its scope, taken before the search ran) became
+//    visible in the scope: a new row could now make the top k;
+//  - every cached id is still live at an epoch no newer than the cached
+//    one (LatestByIdMap), so none was updated or deleted from elsewhere.
+// A stale entry is dropped. Both checks are callbacks, bound by the
+// owner to the buffer and the map.
+//
+// Entries are spread over shards by bucket, each with its own lock and
+// LRU order.
+class QueryResultCache {
+public:
+    struct Options {
+        bool enabled = false;           // query.result_cache_enabled
+        size_t max_entries = 100000;    // query.result_cache_entries
+        float min_similarity = 0.999f;  // query.result_cache_similarity
+        uint32_t band_bits = 10;
+        uint32_t max_hamming = 6;
+        uint64_t seed = 0x5eed;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Key {
+        TenantOrdinal tenant = 0;       // 0: any, as in MessageBuffer::scanTopK
+        NamespaceOrdinal ns = 0;
+        uint64_t filter = 0;            // filterHash() of the tag filter
+        Metric metric = Metric::COSINE;
+        uint32_t k = 0;
+    };
+
+    struct Hit {
+        VectorIdHash id_hash;
+        Epoch epoch;
+        Score score;
+    };
+
+    // MessageBuffer::writeEpoch()
+    using WatermarkFn = std::function<Epoch(TenantOrdinal tenant, NamespaceOrdinal ns)>;
+    // Epoch of an id's live version; nullopt if deleted or unknown
+    // (LatestByIdMap::getPackedByHash())
+    using LatestFn = std::function<std::optional<Epoch>(VectorIdHash id_hash)>;
+
+    struct Stats {
+        size_t size = 0;
+        uint64_t lookups = 0;
+        uint64_t hits = 0;
+        uint64_t stale = 0;             // Found but invalidated
+        uint64_t inserts = 0;
+        uint64_t evictions = 0;
+    };
+
+    QueryResultCache(const Options& options, uint32_t dim, WatermarkFn watermark, LatestFn latest);
+
+    bool enabled() const { return options_.enabled; }
+
+    // Order-insensitive hash of a tags_any filter
+    static uint64_t filterHash(std::span<const std::string> tags_any);
+
+    // The scope's watermark; take it before searching and pass it to insert()
+    Epoch watermark(const Key& key) const { return watermark_(key.tenant, key.ns); }
+
+    // Cached results for a query within the radius, still current
+    std::optional<std::vector<Hit>> lookup(const Key& key, std::span<const float> query);
+
+    void insert(const Key& key, std::span<const float> query, std::vector<Hit> hits, Epoch watermark);
+
+    void clear();
+
+    Stats getStats() const;
+
+    // Gauges under their exported names (telemetry.metrics)
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    static constexpr size_t kShards = 16;
+
+    struct Entry {
+        Key key;
+        uint64_t bucket;
+        uint64_t sketch;
+        float norm;
+        std::vector<float> query;
+        std::vector<Hit> hits;
+        Epoch watermark;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru;           // Most recently used first
+        std::unordered_multimap<uint64_t, std::list<Entry>::iterator> buckets;
+    };
+
+    uint64_t sketch(const float* query) const;
+    uint64_t bucket(const Key& key, uint64_t band) const;
+    bool current(const Entry& entry) const;
+    void eraseLocked(Shard& shard, std::list<Entry>::iterator it);
+
+    Options options_;
+    uint32_t dim_;
+    WatermarkFn watermark_;
+    LatestFn latest_;
+    std::vector<float> planes_;         // 64 x dim
+    std::array<Shard, kShards> shards_;
+    std::atomic<size_t> size_{0};
+    std::atomic<uint64_t> lookups_{0};
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> stale_{0};
+    std::atomic<uint64_t> inserts_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+
+} // namespace woved::index
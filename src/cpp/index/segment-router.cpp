@@ -0,0 +1,157 @@
+#include "segment-router.h"
+#include "core/config.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <numeric>
+
+namespace woved::index {
+
+namespace {
+
+// Recall counts are halved past this many contributing segments, so the
+// estimate follows the model as it learns
+constexpr double kRecallHorizon = 4096.0;
+
+float sigmoid(float x) { return 1.0f / (1.0f + std::exp(-x)); }
+
+} // namespace
+
+SegmentRouter::Options SegmentRouter::Options::fromConfig(const Config& config) {
+    const ExperimentalConfig& experimental = config.experimental;
+    Options options;
+    options.enabled = experimental.learned_index;
+    options.min_segments = std::max<size_t>(experimental.router_min_segments, 1);
+    options.recall_target = experimental.router_recall_target;
+    options.explore_every = std::max(experimental.router_explore_every, 1u);
+    return options;
+}
+
+SegmentRouter::SegmentRouter(const Options& options) : options_(options) {}
+
+float SegmentRouter::predictLocked(const Features& features) const {
+    return sigmoid(std::inner_product(features.begin(), features.end(), weights_.begin(), 0.0f));
+}
+
+float SegmentRouter::predict(const Features& features) const {
+    std::shared_lock lock(mutex_);
+    return predictLocked(features);
+}
+
+bool SegmentRouter::activeLocked() const {
+    return samples_ >= options_.min_samples && contributing_ > 0 &&
+           hits_ / contributing_ >= static_cast<double>(options_.recall_target);
+}
+
+SegmentRouter::Route SegmentRouter::route(std::span<const Summary> segments) {
+    Route route;
+    const size_t n = segments.size();
+    route.keep.assign(n, true);
+    route.features.assign(n, Features{});
+    if (!options_.enabled) return route;
+
+    // Normalize against the query's own spread of bounds and means
+    Score best_bound = std::numeric_limits<Score>::lowest(), worst_bound = std::numeric_limits<Score>::max();
+    Score best_mean = std::numeric_limits<Score>::lowest(), worst_mean = std::numeric_limits<Score>::max();
+    uint64_t max_rows = 0;
+    std::vector<size_t> known;
+    for (size_t i = 0; i < n; ++i) {
+        const Summary& s = segments[i];
+        if (!s.known) continue;
+        known.push_back(i);
+        best_bound = std::max(best_bound, s.bound);
+        worst_bound = std::min(worst_bound, s.bound);
+        best_mean = std::max(best_mean, s.mean);
+        worst_mean = std::min(worst_mean, s.mean);
+        max_rows = std::max(max_rows, s.rows);
+    }
+    if (known.size() < options_.min_segments) {
+        full_.fetch_add(1, std::memory_order_relaxed);
+        return route;
+    }
+    std::stable_sort(known.begin(), known.end(),
+                     [&](size_t a, size_t b) { return segments[a].bound > segments[b].bound; });
+    const float bound_spread = std::max(best_bound - worst_bound, 1e-6f);
+    const float mean_spread = std::max(best_mean - worst_mean, 1e-6f);
+    const float log_rows = std::log1p(static_cast<float>(max_rows));
+    for (size_t rank = 0; rank < known.size(); ++rank) {
+        const Summary& s = segments[known[rank]];
+        route.features[known[rank]] = {
+            1.0f,
+            (s.bound - best_bound) / bound_spread,
+            (s.mean - best_mean) / mean_spread,
+            log_rows > 0.0f ? std::log1p(static_cast<float>(s.rows)) / log_rows : 0.0f,
+            static_cast<float>(rank) / static_cast<float>(std::max<size_t>(known.size() - 1, 1)),
+        };
+    }
+
+    // Explore (probe all, learn) on every explore_every-th query and while
+    // the model is not trusted
+    std::shared_lock lock(mutex_);
+    const bool explore = queries_.fetch_add(1, std::memory_order_relaxed) % options_.explore_every == 0;
+    if (explore || !activeLocked()) {
+        route.learn = true;
+        full_.fetch_add(1, std::memory_order_relaxed);
+        return route;
+    }
+    size_t kept = n - known.size();
+    for (size_t i : known) {
+        route.keep[i] = predictLocked(route.features[i]) >= options_.keep_threshold;
+        kept += route.keep[i];
+    }
+    lock.unlock();
+    routed_.fetch_add(1, std::memory_order_relaxed);
+    kept_.fetch_add(kept, std::memory_order_relaxed);
+    seen_.fetch_add(n, std::memory_order_relaxed);
+    return route;
+}
+
+void SegmentRouter::learn(const Route& route, const std::vector<bool>& contributed) {
+    if (!route.learn) return;
+    std::unique_lock lock(mutex_);
+    // Measure on the sample, then train on it
+    for (size_t i = 0; i < route.features.size() && i < contributed.size(); ++i) {
+        const Features& f = route.features[i];
+        if (f[0] == 0.0f || !contributed[i]) continue;  // Unknown segment, or nothing to miss
+        contributing_ += 1.0;
+        hits_ += predictLocked(f) >= options_.keep_threshold ? 1.0 : 0.0;
+    }
+    if (contributing_ > kRecallHorizon) {
+        contributing_ /= 2.0;
+        hits_ /= 2.0;
+    }
+    for (size_t i = 0; i < route.features.size() && i < contributed.size(); ++i) {
+        const Features& f = route.features[i];
+        if (f[0] == 0.0f) continue;
+        const float error = (contributed[i] ? 1.0f : 0.0f) - predictLocked(f);
+        for (size_t j = 0; j < kFeatures; ++j) weights_[j] += options_.learning_rate * error * f[j];
+    }
+    samples_++;
+}
+
+SegmentRouter::Stats SegmentRouter::getStats() const {
+    Stats stats;
+    stats.routed = routed_.load(std::memory_order_relaxed);
+    stats.full = full_.load(std::memory_order_relaxed);
+    stats.segments_kept = kept_.load(std::memory_order_relaxed);
+    stats.segments_seen = seen_.load(std::memory_order_relaxed);
+    std::shared_lock lock(mutex_);
+    stats.samples = samples_;
+    stats.recall = contributing_ > 0 ? static_cast<float>(hits_ / contributing_) : 0.0f;
+    stats.active = activeLocked();
+    return stats;
+}
+
+std::vector<std::pair<std::string_view, double>> SegmentRouter::metrics() const {
+    Stats stats = getStats();
+    return {
+        {"woved_router_segment_recall", stats.recall},
+        {"woved_router_fanout",
+         stats.segments_seen ? static_cast<double>(stats.segments_kept) / static_cast<double>(stats.segments_seen)
+                             : 1.0},
+        {"woved_router_active", stats.active ? 1.0 : 0.0},
+    };
+}
+
+} // namespace woved::index
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::index {
+
+// Learned segment routing (experimental.learned_index): a logistic model
+// that predicts, from a query's zone map summary of each segment, which
+// segments can place a row in its top k, so a query over hundreds of
+// segments searches the few that matter.
+//
+// Features of a segment, against the other segments of the same query
+// so they do not depend on the metric's scale:
+//   the segment's score bound (ZoneMap::maxScore) below the best bound,
+//   as a share of the bounds' spread; the same for its best list mean
+//   score; its live rows, log-scaled to the largest segment's; and its
+//   rank by bound.
+// A segment is searched if its predicted probability reaches
+// keep_threshold.
+//
+// The model learns from the query log as it runs: every explore_every-th
+// routed query probes every segment instead, and learn() takes which
+// segments contributed to its final top k. Before a sample trains the
+// model it measures it: the share of contributing segments the current
+// model would have kept is the router's segment recall. Until min_samples
+// queries are seen and while that recall is under recall_target, and for
+// queries over fewer than min_segments segments, every segment is
+// searched. Segments without a zone map are always searched.
+class SegmentRouter {
+public:
+    static constexpr size_t kFeatures = 5;
+    using Features = std::array<float, kFeatures>;
+
+    struct Options {
+        bool enabled = false;           // experimental.learned_index
+        size_t min_segments = 16;       // experimental.router_min_segments
+        float keep_threshold = 0.05f;
+        float recall_target = 0.99f;    // experimental.router_recall_target
+        uint32_t explore_every = 32;    // experimental.router_explore_every
+        uint32_t min_samples = 256;
+        float learning_rate = 0.05f;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    // A segment as the query sees it through its zone map
+    struct Summary {
+        bool known = false;     // Has a zone map; unknown segments are always searched
+        Score bound = 0;        // Best maxScore() of its lists
+        Score mean = 0;         // Best meanScore() of its lists
+        uint64_t rows = 0;      // Live rows
+    };
+
+    // The routing of one query
+    struct Route {
+        std::vector<bool> keep;         // Per segment
+        std::vector<Features> features; // Per segment, for learn()
+        bool learn = false;             // Every segment kept to train on: report the outcome
+    };
+
+    struct Stats {
+        uint64_t routed = 0;            // Queries searched on the model's pick
+        uint64_t full = 0;              // Queries probing every segment
+        uint64_t segments_kept = 0;     // Over routed queries
+        uint64_t segments_seen = 0;
+        uint64_t samples = 0;           // Queries learned from
+        float recall = 0.0f;            // Share of contributing segments the model keeps
+        bool active = false;
+    };
+
+    explicit SegmentRouter(const Options& options);
+
+    bool enabled() const { return options_.enabled; }
+
+    Route route(std::span<const Summary> segments);
+
+    // Outcome of a route() with learn set: which segments placed a row in
+    // the final top k
+    void learn(const Route& route, const std::vector<bool>& contributed);
+
+    // Probability that a segment with these features contributes
+    float predict(const Features& features) const;
+
+    Stats getStats() const;
+
+    // Gauges under their exported names (telemetry.metrics)
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    float predictLocked(const Features& features) const;
+    bool activeLocked() const;
+
+    Options options_;
+    mutable std::shared_mutex mutex_;
+    Features weights_{};
+    double hits_ = 0;           // Contributing segments kept, decayed
+    double contributing_ = 0;   // Contributing segments, decayed
+    uint64_t samples_ = 0;
+    std::atomic<uint64_t> queries_{0};
+    std::atomic<uint64_t> routed_{0};
+    std::atomic<uint64_t> full_{0};
+    std::atomic<uint64_t> kept_{0};
+    std::atomic<uint64_t> seen_{0};
+};
+
+} // namespace woved::index
@@ -0,0 +1,100 @@
+#include "stable-scanner.h"
+#include "io/prefetcher.h"
+#include <algorithm>
+#include <exception>
+#include <optional>
+
+namespace woved::index {
+
+StableScanner::Stats StableScanner::scan(const float* query_rotated, std::span<const uint32_t> lists,
+                                         kernels::ScanHeap& candidates,
+                                         const std::function<bool(size_t)>& prune) const {
+    Stats stats;
+    std::vector<storage::StableSegment::ListAdc> prepared(lists.size());
+    std::optional<io::Prefetcher::Walk> walk;
+    if (prefetcher_) {
+        walk.emplace(*prefetcher_, lists.size(),
+                     [&](size_t i) { segment_.prepareAdc(query_rotated, lists[i], prepared[i]); });
+    }
+
+    std::vector<float> dist;
+    for (size_t i = 0; i < lists.size(); ++i) {
+        if (prune(i)) {
+            stats.lists_pruned += lists.size() - i;
+            break;
+        }
+        if (walk) {
+            stats.stall_ns += walk->take(i);
+        } else {
+            segment_.prepareAdc(query_rotated, lists[i], prepared[i]);
+        }
+        stats.rows_dead += offer(prepared[i], dist, candidates);
+        stats.rows_scanned += dist.size();
+        stats.code_bytes += prepared[i].codes.size();
+        prepared[i] = {};
+        stats.lists_scanned++;
+    }
+    return stats;
+}
+
+util::Task<StableScanner::Stats> StableScanner::scanAsync(const float* query_rotated,
+                                                          std::span<const uint32_t> lists,
+                                                          kernels::ScanHeap& candidates,
+                                                          std::function<bool(size_t)> prune, size_t ahead) const {
+    Stats stats;
+    std::vector<storage::StableSegment::ListAdc> prepared(lists.size());
+    std::vector<util::Task<void>> loads(lists.size());
+    size_t started = 0;
+    auto startUpTo = [&](size_t end) {
+        for (; started < std::min(end, lists.size()); ++started) {
+            loads[started] = segment_.prepareAdcAsync(query_rotated, lists[started], prepared[started]);
+            loads[started].start();
+        }
+    };
+
+    std::vector<float> dist;
+    std::exception_ptr error;
+    size_t i = 0;
+    try {
+        for (; i < lists.size(); ++i) {
+            if (prune(i)) {
+                stats.lists_pruned += lists.size() - i;
+                break;
+            }
+            startUpTo(i + 1 + ahead);
+            co_await loads[i];
+            loads[i] = {};
+            stats.rows_dead += offer(prepared[i], dist, candidates);
+            stats.rows_scanned += dist.size();
+            stats.code_bytes += prepared[i].codes.size();
+            prepared[i] = {};
+            stats.lists_scanned++;
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    // Loads started past a prune or a failure still land before their
+    // frames go; what they read is dropped
+    for (size_t j = i; j < started; ++j) {
+        if (!loads[j].valid()) continue;
+        try {
+            co_await loads[j];
+        } catch (...) {
+        }
+    }
+    if (error) std::rethrow_exception(error);
+    co_return stats;
+}
+
+uint64_t StableScanner::offer(const storage::StableSegment::ListAdc& prepared, std::vector<float>& dist,
+                              kernels::ScanHeap& candidates) const {
+    segment_.adc(prepared, dist);
+    const uint64_t first_row = prepared.range.first_row;
+    return storage::forEachLiveRun(dead_, first_row, dist.size(), [&](uint64_t first, uint64_t rows) {
+        for (uint64_t r = first - first_row; r < first - first_row + rows; ++r) {
+            if (-dist[r] > candidates.threshold()) candidates.push(-dist[r], first_row + r);
+        }
+    });
+}
+
+} // namespace woved::index
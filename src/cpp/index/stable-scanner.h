@@ -0,0 +1,67 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "storage/segment/seg-dead.h"
+#include "storage/segment/seg-stable.h"
+#include "util/simd-dispatch.h"
+#include "util/task.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+namespace woved::io {
+class Prefetcher;
+}
+
+namespace woved::index {
+
+// Streaming ADC pass over the probed lists of one stable segment, as a
+// pipeline: while list i is scanned on the calling thread, the prefetcher
+// (io/prefetcher.h) reads the codes of lists i + 1 .. i + depth and builds
+// the query's distance table for each as its read lands, so a scan finds
+// its next list decoded rather than waiting on a cold read. With prefetch
+// disabled the prefetcher still times the inline loads, so its stall time
+// shows what a depth would save. Without one, lists load inline untimed.
+// Rows in the segment's DeadRows are never offered as candidates.
+//
+// scanAsync() is the same pass as a coroutine for io::IoLoop: no
+// prefetcher thread; the next `ahead` lists are prepared as coroutines
+// whose reads are in flight while the current list is scored.
+class StableScanner {
+public:
+    struct Stats {
+        uint64_t lists_scanned = 0;
+        uint64_t lists_pruned = 0;
+        uint64_t rows_scanned = 0;
+        uint64_t rows_dead = 0;     // Of rows_scanned, superseded and not offered
+        uint64_t code_bytes = 0;    // Codes of the scanned lists
+        uint64_t stall_ns = 0;      // Waiting on lists not yet loaded
+    };
+
+    // `prefetcher` and `dead` may be null
+    StableScanner(const storage::StableSegment& segment, io::Prefetcher* prefetcher,
+                  const storage::DeadRows* dead = nullptr)
+        : segment_(segment), prefetcher_(prefetcher), dead_(dead) {}
+
+    // Offer every row of `lists`, in order, to `candidates` scored by
+    // negated ADC distance. `prune(i)` is asked before list i; true stops
+    // the scan there and counts the rest as pruned.
+    Stats scan(const float* query_rotated, std::span<const uint32_t> lists, kernels::ScanHeap& candidates,
+               const std::function<bool(size_t)>& prune) const;
+    util::Task<Stats> scanAsync(const float* query_rotated, std::span<const uint32_t> lists,
+                                kernels::ScanHeap& candidates, std::function<bool(size_t)> prune,
+                                size_t ahead = 2) const;
+
+private:
+    // Offer the rows of a prepared list; returns the dead rows stepped over
+    uint64_t offer(const storage::StableSegment::ListAdc& prepared, std::vector<float>& dist,
+                   kernels::ScanHeap& candidates) const;
+
+    const storage::StableSegment& segment_;
+    io::Prefetcher* prefetcher_;
+    const storage::DeadRows* dead_;
+};
+
+} // namespace woved::index
@@ -0,0 +1,989 @@
+#include "two-phase-engine.h"
+#include "core/config.h"
+#include "core/metrics.h"
+#include "core/query_trace.h"
+#include "index/centroids-manager.h"
+#include "index/gpu-backend.h"
+#include "index/hnsw-cache.h"
+#include "index/ivf-flat.h"
+#include "index/segment-router.h"
+#include "index/stable-scanner.h"
+#include "io/io-loop.h"
+#include "storage/segment/seg-dead.h"
+#include "storage/segment/seg-stable.h"
+#include "util/cancellation.h"
+#include "util/exceptions.h"
+#include "util/simd-dispatch.h"
+#include "util/telemetry.h"
+#include "util/thread-pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <string>
+
+namespace woved::index {
+
+namespace {
+
+// Rows [first, first + rows) of one segment, read as one request, and the
+// sorted candidates [begin, end) inside it
+struct Run {
+    uint64_t first;
+    uint64_t rows;
+    size_t begin;
+    size_t end;
+    size_t slot = 0;      // First row of the run in the batch buffers
+    unsigned pending = 0; // Reads not yet landed
+};
+
+// A list to visit and its zone map score bound
+struct Probe {
+    uint32_t list;
+    Score bound;
+};
+
+// Rows an adaptive delta scan visits between checks
+constexpr uint64_t kSampleChunk = 256;
+
+// Relative slack on the |q| |v| bound of norm-ordered scans, for rounding
+constexpr float kNormSlack = 1e-4f;
+
+uint64_t elapsedNs(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - since).count());
+}
+
+// Work and time counters of one query's tasks, added into `total`
+void addStats(TwoPhaseEngine::Stats& total, const TwoPhaseEngine::Stats& one) {
+    total.lists_scanned += one.lists_scanned;
+    total.lists_pruned += one.lists_pruned;
+    total.segments_pruned += one.segments_pruned;
+    total.reranked += one.reranked;
+    total.prefetch_stall_us += one.prefetch_stall_us;
+    total.rows_skipped += one.rows_skipped;
+    total.rows_dead += one.rows_dead;
+    total.gpu_segments += one.gpu_segments;
+    total.partial = total.partial || one.partial;
+    total.lists_cancelled += one.lists_cancelled;
+    total.delta_segments += one.delta_segments;
+    total.delta_rows += one.delta_rows;
+    total.delta_bytes += one.delta_bytes;
+    total.stable_segments += one.stable_segments;
+    total.stable_lists += one.stable_lists;
+    total.stable_rows += one.stable_rows;
+    total.stable_bytes += one.stable_bytes;
+    total.buffer_ns += one.buffer_ns;
+    total.delta_ns += one.delta_ns;
+    total.stable_ns += one.stable_ns;
+    total.rerank_ns += one.rerank_ns;
+}
+
+// Stage times of one search into the process-wide histograms
+void recordStages(const TwoPhaseEngine::Stats& stats, bool buffer) {
+    Metrics& metrics = Metrics::global();
+    if (buffer) metrics.query(QueryStage::BufferScan).record(stats.buffer_ns);
+    if (stats.delta_segments) metrics.query(QueryStage::Delta).record(stats.delta_ns);
+    if (stats.stable_segments) metrics.query(QueryStage::Stable).record(stats.stable_ns);
+    if (stats.reranked) metrics.query(QueryStage::Rerank).record(stats.rerank_ns);
+    if (stats.partial) metrics.partial_queries.add();
+}
+
+// What the tracer keeps of a search that was not sampled
+QueryTracer::Outcome traceOutcome(const TwoPhaseEngine::Query& q, const TwoPhaseEngine::Stats& stats,
+                                  uint64_t total_ns, uint32_t nprobe_delta, uint32_t nprobe_stable) {
+    QueryTracer::Outcome out;
+    out.total_ns = total_ns;
+    out.k = q.k;
+    out.nprobe_delta = nprobe_delta;
+    out.nprobe_stable = nprobe_stable;
+    out.partial = stats.partial;
+    out.probe_ns = q.probe_ns;
+    out.buffer_ns = stats.buffer_ns;
+    out.delta_ns = stats.delta_ns;
+    out.stable_ns = stats.stable_ns;
+    out.rerank_ns = stats.rerank_ns;
+    out.delta_lists = stats.lists_scanned - std::min(stats.lists_scanned, stats.stable_lists);
+    out.delta_rows = stats.delta_rows;
+    out.delta_bytes = stats.delta_bytes;
+    out.stable_lists = stats.stable_lists;
+    out.stable_rows = stats.stable_rows;
+    out.stable_bytes = stats.stable_bytes;
+    out.wait_ns = stats.prefetch_stall_us * 1000;
+    out.reranked = stats.reranked;
+    return out;
+}
+
+// One task's own top k
+struct TaskResult {
+    std::vector<TwoPhaseEngine::Hit> hits;
+    TwoPhaseEngine::Stats stats;
+};
+
+// The lists of `lists` the segment holds rows of, best bound first.
+// Without a zone map every list is kept, in the order given, unbounded.
+std::vector<Probe> orderByBound(const std::optional<storage::ZoneMap>& zones, std::span<const uint32_t> lists,
+                                Metric metric, const float* query, float query_sqr) {
+    std::vector<Probe> probes;
+    probes.reserve(lists.size());
+    for (uint32_t list : lists) {
+        Score bound = std::numeric_limits<Score>::max();
+        if (zones) {
+            const storage::ListZone* zone = zones->zone(list);
+            if (!zone) continue;
+            bound = zones->maxScore(*zone, metric, query, query_sqr);
+        }
+        probes.push_back({list, bound});
+    }
+    std::stable_sort(probes.begin(), probes.end(), [](const Probe& a, const Probe& b) { return a.bound > b.bound; });
+    return probes;
+}
+
+bool cancelled(const TwoPhaseEngine::Query& q) {
+    return q.cancel && q.cancel->cancelled();
+}
+
+bool segmentPruned(const std::optional<storage::ZoneMap>& zones, Metric metric, const float* query,
+                   float query_sqr, const SharedThreshold& bar) {
+    return zones && zones->maxScore(metric, query, query_sqr) <= bar.get();
+}
+
+// A segment as the router sees it: its best list bound and mean score
+SegmentRouter::Summary summarize(const std::optional<storage::ZoneMap>& zones, uint64_t rows, Metric metric,
+                                 const float* query, float query_sqr) {
+    SegmentRouter::Summary summary;
+    if (!zones || zones->header().dim == 0) return summary;
+    summary.known = true;
+    summary.bound = summary.mean = std::numeric_limits<Score>::lowest();
+    summary.rows = rows;
+    for (const storage::ListZone& zone : zones->lists()) {
+        summary.bound = std::max(summary.bound, zones->maxScore(zone, metric, query, query_sqr));
+        summary.mean = std::max(summary.mean, zones->meanScore(zone, metric, query, query_sqr));
+    }
+    if (zones->lists().empty()) summary.bound = summary.mean = 0;
+    return summary;
+}
+
+void searchBuffer(const TwoPhaseEngine::Query& q, SharedThreshold& bar, TaskResult& out) {
+    out.hits = q.buffer(q.k);
+    if (out.hits.size() > q.k) out.hits.resize(q.k);
+    if (out.hits.size() == q.k) {
+        bar.raise(std::min_element(out.hits.begin(), out.hits.end(), [](const auto& a, const auto& b) {
+            return a.score < b.score;
+        })->score);
+    }
+}
+
+// Rows of a delta list to scan before an adaptive scan may stop: the
+// sample_p floor plus the rest in proportion to the lesser of the list's
+// probe rank and where the threshold falls in its score spread
+uint64_t sampleBudget(const storage::ZoneMap& zones, const Probe& probe, size_t rank, size_t lists,
+                      uint64_t rows, const TwoPhaseEngine::Query& q, float query_sqr, float sample_p, Score bar) {
+    const storage::ListZone* zone = zones.zone(probe.list);
+    if (!zone) return rows;
+    const Score center = zones.meanScore(*zone, q.metric, q.vector.data(), query_sqr);
+    const double spread = probe.bound - center;
+    const double room = spread > 0.0 ? std::clamp((probe.bound - bar) / spread, 0.0, 1.0) : 0.0;
+    const double early = 1.0 - static_cast<double>(rank) / static_cast<double>(lists);
+    const double share = sample_p + (1.0 - sample_p) * std::min(room, early);
+    return std::clamp<uint64_t>(static_cast<uint64_t>(std::ceil(share * static_cast<double>(rows))),
+                                kSampleChunk, rows);
+}
+
+// Exact scores of a quantized delta segment's candidates, from its stored
+// vectors: rows joined into runs as rerank() does, one read batch. The
+// top k, best first.
+util::Task<std::vector<kernels::ScanHit>> rerankDelta(const storage::DeltaSegment& segment,
+                                                      std::vector<kernels::ScanHit> candidates,
+                                                      const TwoPhaseEngine::Query& q) {
+    std::sort(candidates.begin(), candidates.end(),
+              [](const kernels::ScanHit& a, const kernels::ScanHit& b) { return a.row < b.row; });
+    const size_t dim = segment.header().dim;
+    const size_t vector_bytes = segment.vectorBytes();
+    const storage::SegmentSection& section = segment.vectorSection();
+    const uint64_t chunk = std::max<uint64_t>(segment.reader().footer().chunk_bytes, 1);
+    std::vector<Run> runs;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        const uint64_t row = candidates[i].row;
+        if (!runs.empty()) {
+            Run& run = runs.back();
+            const uint64_t gap = (row - (run.first + run.rows)) * vector_bytes;
+            const uint64_t from = section.offset + run.first * vector_bytes;
+            const uint64_t to = section.offset + (row + 1) * vector_bytes;
+            if (gap <= kRerankGapBytes && from / chunk == (to - 1) / chunk) {
+                run.rows = row + 1 - run.first;
+                run.end = i + 1;
+                continue;
+            }
+        }
+        runs.push_back({row, 1, i, i + 1});
+    }
+
+    size_t slots = 0;
+    for (Run& run : runs) {
+        run.slot = slots;
+        slots += run.rows;
+    }
+    std::vector<std::byte> vectors(slots * vector_bytes);
+    std::vector<storage::SegmentReader::ReadRequest> requests;
+    requests.reserve(runs.size());
+    for (const Run& run : runs) {
+        requests.push_back({&section, run.first * vector_bytes,
+                            std::span(vectors).subspan(run.slot * vector_bytes, run.rows * vector_bytes)});
+    }
+    std::vector<kernels::ScanHit> hits(std::min(q.k, candidates.size()));
+    kernels::ScanHeap top{hits.data(), hits.size()};
+    const auto type = static_cast<ElementType>(segment.header().element_type);
+    co_await segment.reader().readBatchAsync(requests, [&](size_t i) {
+        const Run& run = runs[i];
+        for (size_t c = run.begin; c < run.end; ++c) {
+            const size_t slot = run.slot + (candidates[c].row - run.first);
+            const Score score = kernels::score(q.metric, q.vector.data(), vectors.data() + slot * vector_bytes,
+                                               type, 1.0f, dim);
+            if (score > top.threshold()) top.push(score, candidates[c].row);
+        }
+    });
+    hits.resize(top.size);
+    std::sort(hits.begin(), hits.end(),
+              [](const kernels::ScanHit& a, const kernels::ScanHit& b) { return a.score > b.score; });
+    co_return hits;
+}
+
+util::Task<void> searchDelta(const storage::DeltaSegment& segment, const storage::DeadRows* dead, const TwoPhaseEngine::Query& q,
+                             float query_sqr, uint32_t nprobe, float sample_p, uint32_t rerank_factor,
+                             SharedThreshold& bar, TaskResult& out) {
+    const size_t dim = q.vector.size();
+    if (segment.header().dim != dim || segment.header().min_epoch > q.read_epoch) co_return;
+    dead = storage::DeadRows::at(dead, q.read_epoch);
+    if (dead && dead->count() >= segment.liveRows()) co_return;
+    const auto& zones = segment.zoneMap();
+    if (segmentPruned(zones, q.metric, q.vector.data(), query_sqr, bar) ||
+        (!q.tenant.empty() && zones && !zones->mayContainTenant(q.tenant))) {
+        out.stats.segments_pruned++;
+        co_return;
+    }
+    const bool sliced = !q.tenant.empty() && segment.tenantPartitioned();
+    const uint64_t tenant_hash = sliced ? storage::zoneTenantHash(q.tenant) : 0;
+
+    // Clustered segments hold the global centroid lists as of their
+    // centroid version; an unclustered one is a single list
+    std::vector<uint32_t> lists;
+    if (segment.clustered() && nprobe == TwoPhaseEngine::kAllLists) {
+        for (const auto& extent : segment.lists()) lists.push_back(extent.centroid);
+    } else if (segment.clustered()) {
+        const auto probe = q.probe.first(std::min<size_t>(nprobe, q.probe.size()));
+        lists.assign(probe.begin(), probe.end());
+        if (q.centroids) {
+            auto translated = q.centroids->translate(probe, segment.header().centroid_version);
+            if (translated) {
+                lists.assign(translated->begin(), translated->end());
+            } else {
+                // Clustered before the last full rebuild: its ids mean nothing now
+                lists.clear();
+                for (const auto& extent : segment.lists()) lists.push_back(extent.centroid);
+            }
+        }
+    } else {
+        lists.push_back(storage::kZoneAllLists);
+    }
+    const auto probes = orderByBound(zones, lists, q.metric, q.vector.data(), query_sqr);
+
+    const auto type = static_cast<ElementType>(segment.header().element_type);
+    const bool mapped = segment.reader().mode() == storage::SegmentReader::Mode::Mmap;
+    const bool norm_bound = segment.normOrdered() && q.metric == Metric::INNER_PRODUCT;
+    const float query_norm = std::sqrt(std::max(query_sqr, 0.0f)) * (1.0f + kNormSlack);
+    const auto norms = segment.norms();
+    // Quantized: SQ8 scores pick rerank_factor * k candidates and only
+    // exact scores may raise the bar
+    const bool quantized = segment.quantized();
+    IvfFlatScanner scanner(q.metric, q.vector, quantized ? q.k * std::max(rerank_factor, 1u) : q.k);
+    auto raise = [&] {
+        if (!quantized) bar.raise(scanner.threshold());
+    };
+    std::vector<std::byte> copied;
+    for (size_t i = 0; i < probes.size(); ++i) {
+        if (probes[i].bound <= bar.get()) {
+            out.stats.lists_pruned += probes.size() - i;
+            break;
+        }
+        if (cancelled(q)) {
+            out.stats.lists_cancelled += probes.size() - i;
+            out.stats.partial = true;
+            break;
+        }
+        const auto range = sliced ? segment.tenantSlice(probes[i].list, tenant_hash)
+                                  : segment.list(static_cast<CentroidId>(probes[i].list));
+        if (range.rows == 0) continue;
+        std::span<const std::byte> vectors;
+        if (quantized) {
+            vectors = segment.quantizedVectors(range);
+        } else if (mapped) {
+            vectors = segment.rangeVectors(range);
+        } else {
+            co_await segment.readRangeAsync(range, copied);
+            vectors = copied;
+        }
+        const auto scales = !quantized && type == ElementType::INT8 ? segment.scales(range) : std::vector<float>();
+        const ElementType scan_type = quantized ? ElementType::INT8 : type;
+        const float* scan_scales = quantized ? segment.quantizedScales(range).data()
+                                             : (scales.empty() ? nullptr : scales.data());
+        const size_t vector_bytes = quantized ? dim : segment.vectorBytes();
+        // Rows [first, first + rows) of the range, dead ones stepped over
+        const auto scan = [&](uint64_t first, uint64_t rows) {
+            return storage::forEachLiveRun(dead, first, rows, [&](uint64_t from, uint64_t n) {
+                const uint64_t at = from - range.first_row;
+                scanner.scan(vectors.data() + at * vector_bytes, scan_type, scan_scales ? scan_scales + at : nullptr,
+                             n, from);
+            });
+        };
+        if (!norm_bound && (sample_p >= 1.0f || i == 0)) {
+            const uint64_t dead_rows = scan(range.first_row, range.rows);
+            out.stats.lists_scanned++;
+            out.stats.rows_dead += dead_rows;
+            out.stats.delta_rows += range.rows - dead_rows;
+            out.stats.delta_bytes += (range.rows - dead_rows) * vector_bytes;
+            raise();
+            continue;
+        }
+
+        const Score start = bar.get();
+        const uint64_t budget = sample_p < 1.0f && i > 0 && zones && start > std::numeric_limits<Score>::lowest()
+                                    ? sampleBudget(*zones, probes[i], i, probes.size(), range.rows, q, query_sqr,
+                                                   sample_p, start)
+                                    : range.rows;
+        uint64_t done = 0;
+        uint64_t dead_rows = 0;
+        bool paying = true;
+        while (done < range.rows && (done < budget || paying)) {
+            if (cancelled(q)) {
+                out.stats.partial = true;
+                break;
+            }
+            const Score floor = bar.get();
+            if (norm_bound && query_norm * norms[range.first_row + done] <= floor) break;
+            const uint64_t rows = std::min(kSampleChunk, range.rows - done);
+            const uint64_t first = range.first_row + done;
+            dead_rows += scan(first, rows);
+            paying = scanner.held(first, rows, floor) > 0;
+            done += rows;
+            raise();
+        }
+        out.stats.rows_skipped += range.rows - done;
+        out.stats.rows_dead += dead_rows;
+        out.stats.lists_scanned++;
+        out.stats.delta_rows += done - dead_rows;
+        out.stats.delta_bytes += (done - dead_rows) * vector_bytes;
+    }
+
+    const bool newer = segment.header().max_epoch > q.read_epoch;
+    if (!quantized) {
+        for (const kernels::ScanHit& hit : scanner.results()) {
+            if (newer && segment.epochs()[hit.row] > q.read_epoch) continue;
+            out.hits.push_back({segment.idHashes()[hit.row], segment.epochs()[hit.row], hit.score});
+        }
+        co_return;
+    }
+
+    // SQ8 scores cannot be merged; without the rerank the segment adds nothing
+    auto candidates = scanner.results();
+    if (candidates.empty()) co_return;
+    if (out.stats.partial || cancelled(q)) {
+        out.stats.partial = true;
+        co_return;
+    }
+    out.stats.reranked += candidates.size();
+    const auto start = std::chrono::steady_clock::now();
+    const auto hits = co_await rerankDelta(segment, std::move(candidates), q);
+    out.stats.rerank_ns += elapsedNs(start);
+    size_t kept = 0;
+    for (const kernels::ScanHit& hit : hits) {
+        if (newer && segment.epochs()[hit.row] > q.read_epoch) continue;
+        out.hits.push_back({segment.idHashes()[hit.row], segment.epochs()[hit.row], hit.score});
+        kept++;
+    }
+    if (kept == q.k) bar.raise(hits.back().score);
+}
+
+// ADC over the segment's nearest model lists into `candidates`, best
+// bound first, stopping at the first list that cannot beat the bar.
+// Without a prefetcher the scan's own coroutines read ahead.
+util::Task<void> scanStable(const storage::StableSegment& segment, const storage::DeadRows* dead,
+                            const TwoPhaseEngine::Query& q, float query_sqr, uint32_t nprobe,
+                            io::Prefetcher* prefetcher, SharedThreshold& bar, kernels::ScanHeap& candidates,
+                            TaskResult& out) {
+    const auto& model = segment.model();
+    std::vector<uint32_t> lists;
+    if (nprobe >= model->nlist()) {
+        lists.resize(model->nlist());
+        std::iota(lists.begin(), lists.end(), 0u);
+    } else {
+        lists = model->probe(q.vector.data(), std::max(nprobe, 1u));
+    }
+    const auto probes = orderByBound(segment.zoneMap(), lists, q.metric, q.vector.data(), query_sqr);
+
+    std::vector<float> rotated(q.vector.size());
+    model->rotate(q.vector.data(), rotated.data());
+    std::vector<uint32_t> ordered(probes.size());
+    for (size_t i = 0; i < probes.size(); ++i) ordered[i] = probes[i].list;
+    bool stopped = false;
+    const auto prune = [&](size_t i) {
+        if (probes[i].bound <= bar.get()) return true;
+        stopped = cancelled(q);
+        return stopped;
+    };
+    const StableScanner scanner(segment, prefetcher, dead);
+    const auto scanned = prefetcher ? scanner.scan(rotated.data(), ordered, candidates, prune)
+                                    : co_await scanner.scanAsync(rotated.data(), ordered, candidates, prune);
+    out.stats.lists_scanned += scanned.lists_scanned;
+    out.stats.stable_lists += scanned.lists_scanned;
+    out.stats.stable_rows += scanned.rows_scanned;
+    out.stats.rows_dead += scanned.rows_dead;
+    out.stats.stable_bytes += scanned.code_bytes;
+    if (stopped) {
+        out.stats.lists_cancelled += scanned.lists_pruned;
+        out.stats.partial = true;
+    } else {
+        out.stats.lists_pruned += scanned.lists_pruned;
+    }
+    out.stats.prefetch_stall_us += scanned.stall_ns / 1000;
+}
+
+util::Task<void> searchStable(const storage::StableSegment& segment, const storage::DeadRows* dead,
+                              const TwoPhaseEngine::Query& q, float query_sqr, uint32_t rerank_factor,
+                              uint32_t nprobe, io::Prefetcher* prefetcher, const std::vector<kernels::ScanHit>* adc,
+                              SharedThreshold& bar, TaskResult& out) {
+    const auto& model = segment.model();
+    if (!model || model->dim() != q.vector.size() || segment.liveRows() == 0) co_return;
+    if (segment.header().min_epoch > q.read_epoch) co_return;
+    dead = storage::DeadRows::at(dead, q.read_epoch);
+    if (dead && dead->count() >= segment.liveRows()) co_return;
+    if (segmentPruned(segment.zoneMap(), q.metric, q.vector.data(), query_sqr, bar)) {
+        out.stats.segments_pruned++;
+        co_return;
+    }
+
+    // ADC candidates by negated approximate distance
+    std::vector<kernels::ScanHit> pool(q.k * std::max(rerank_factor, 1u));
+    kernels::ScanHeap candidates{pool.data(), pool.size()};
+    if (adc) {
+        // Picked on the device for the whole batch, which knows no dead rows
+        for (const kernels::ScanHit& hit : *adc) {
+            if (candidates.size == pool.size()) break;
+            if (dead && dead->contains(hit.row)) {
+                out.stats.rows_dead++;
+                continue;
+            }
+            pool[candidates.size++] = hit;
+        }
+        out.stats.gpu_segments++;
+    } else {
+        co_await scanStable(segment, dead, q, query_sqr, nprobe, prefetcher, bar, candidates, out);
+    }
+    if (candidates.size == 0) co_return;
+    // ADC scores cannot be merged; without the rerank the segment adds nothing
+    if (out.stats.partial || cancelled(q)) {
+        out.stats.partial = true;
+        co_return;
+    }
+
+    std::vector<RerankCandidate> rows(candidates.size);
+    for (size_t i = 0; i < candidates.size; ++i) rows[i] = {0, pool[i].row};
+    const storage::StableSegment* segments[] = {&segment};
+    const auto start = std::chrono::steady_clock::now();
+    const auto hits = co_await rerankAsync(segments, rows, q.metric, q.vector, q.k, q.cancel);
+    out.stats.rerank_ns += elapsedNs(start);
+    out.stats.reranked += rows.size();
+    const bool newer = segment.header().max_epoch > q.read_epoch;
+    size_t kept = 0;
+    for (const RerankHit& hit : hits) {
+        if (newer && segment.epochs()[hit.row] > q.read_epoch) continue;
+        out.hits.push_back({segment.idHashes()[hit.row], segment.epochs()[hit.row], hit.score});
+        kept++;
+    }
+    if (kept == q.k) bar.raise(hits.back().score);
+}
+
+// Round-robin `run` across the devices holding its segments, so workers
+// taking tasks in order read from every device at once
+void interleaveByDevice(std::vector<size_t>& run, std::span<const storage::StableSegment* const> stable) {
+    std::vector<std::pair<uint64_t, std::vector<size_t>>> devices;
+    for (size_t s : run) {
+        const uint64_t device = stable[s]->reader().device();
+        auto it = std::find_if(devices.begin(), devices.end(), [&](const auto& d) { return d.first == device; });
+        if (it == devices.end()) {
+            devices.push_back({device, {}});
+            it = devices.end() - 1;
+        }
+        it->second.push_back(s);
+    }
+    if (devices.size() < 2) return;
+    const size_t n = run.size();
+    run.clear();
+    for (size_t i = 0; run.size() < n; ++i) {
+        for (const auto& [device, segments] : devices) {
+            if (i < segments.size()) run.push_back(segments[i]);
+        }
+    }
+}
+
+} // namespace
+
+std::vector<RerankHit> rerank(std::span<const storage::StableSegment* const> segments,
+                              std::span<const RerankCandidate> candidates, Metric metric,
+                              std::span<const float> query, size_t k, const util::CancellationToken* cancel) {
+    return io::syncWait(rerankAsync(segments, candidates, metric, query, k, cancel));
+}
+
+util::Task<std::vector<RerankHit>> rerankAsync(std::span<const storage::StableSegment* const> segments,
+                                               std::span<const RerankCandidate> candidates, Metric metric,
+                                               std::span<const float> query, size_t k,
+                                               const util::CancellationToken* cancel) {
+    if (k == 0 || candidates.empty()) co_return std::vector<RerankHit>();
+    std::vector<RerankCandidate> sorted(candidates.begin(), candidates.end());
+    std::sort(sorted.begin(), sorted.end(), [](const RerankCandidate& a, const RerankCandidate& b) {
+        return a.segment != b.segment ? a.segment < b.segment : a.row < b.row;
+    });
+    sorted.erase(std::unique(sorted.begin(), sorted.end(), [](const RerankCandidate& a, const RerankCandidate& b) {
+        return a.segment == b.segment && a.row == b.row;
+    }), sorted.end());
+
+    // Heap rows are indices into `sorted`
+    std::vector<kernels::ScanHit> hits(k);
+    kernels::ScanHeap top{hits.data(), k};
+    std::vector<Run> runs;
+    std::vector<std::byte> vectors;
+    std::vector<float> scales;
+    std::vector<storage::SegmentReader::ReadRequest> requests;
+
+    for (size_t s = 0; s < sorted.size();) {
+        if (cancel && cancel->cancelled()) break;
+        size_t e = s;
+        while (e < sorted.size() && sorted[e].segment == sorted[s].segment) ++e;
+        if (sorted[s].segment >= segments.size()) {
+            throw util::InvalidArgumentException("Rerank: no segment " + std::to_string(sorted[s].segment));
+        }
+        const storage::StableSegment& segment = *segments[sorted[s].segment];
+        const size_t dim = segment.header().dim;
+        const size_t vector_bytes = segment.vectorBytes();
+        if (query.size() != dim) {
+            throw util::InvalidArgumentException("Rerank: query has " + std::to_string(query.size()) +
+                                                 " dimensions, segment " + std::to_string(dim));
+        }
+        if (sorted[e - 1].row >= segment.liveRows()) {
+            throw util::InvalidArgumentException("Rerank: row " + std::to_string(sorted[e - 1].row) +
+                                                 " is not a live row of " + segment.reader().path());
+        }
+
+        // Join nearby rows, without crossing a chunk of the file
+        const storage::SegmentSection& section = segment.vectorSection();
+        const storage::SegmentSection* scale_section = segment.scaleSection();
+        const uint64_t chunk = std::max<uint64_t>(segment.reader().footer().chunk_bytes, 1);
+        runs.clear();
+        for (size_t i = s; i < e; ++i) {
+            const uint64_t row = sorted[i].row;
+            if (!runs.empty()) {
+                Run& run = runs.back();
+                const uint64_t gap = (row - (run.first + run.rows)) * vector_bytes;
+                const uint64_t from = section.offset + run.first * vector_bytes;
+                const uint64_t to = section.offset + (row + 1) * vector_bytes;
+                if (gap <= kRerankGapBytes && from / chunk == (to - 1) / chunk) {
+                    run.rows = row + 1 - run.first;
+                    run.end = i + 1;
+                    continue;
+                }
+            }
+            runs.push_back({row, 1, i, i + 1});
+        }
+
+        size_t slots = 0;
+        for (Run& run : runs) {
+            run.slot = slots;
+            slots += run.rows;
+        }
+        vectors.resize(slots * vector_bytes);
+        scales.assign(slots, 1.0f);
+        requests.clear();
+        for (Run& run : runs) {
+            requests.push_back({&section, run.first * vector_bytes,
+                                std::span(vectors).subspan(run.slot * vector_bytes, run.rows * vector_bytes)});
+            if (scale_section) {
+                requests.push_back({scale_section, run.first * sizeof(float),
+                                    std::as_writable_bytes(std::span(scales).subspan(run.slot, run.rows))});
+            }
+            run.pending = scale_section ? 2 : 1;
+        }
+
+        const size_t parts = scale_section ? 2 : 1;
+        const auto type = static_cast<ElementType>(segment.header().element_type);
+        co_await segment.reader().readBatchAsync(requests, [&](size_t i) {
+            Run& run = runs[i / parts];
+            if (--run.pending > 0) return;
+            for (size_t c = run.begin; c < run.end; ++c) {
+                const size_t slot = run.slot + (sorted[c].row - run.first);
+                const Score score = kernels::score(metric, query.data(), vectors.data() + slot * vector_bytes,
+                                                   type, scales[slot], dim);
+                if (score > top.threshold()) top.push(score, c);
+            }
+        });
+        s = e;
+    }
+
+    std::vector<RerankHit> out;
+    out.reserve(top.size);
+    for (size_t i = 0; i < top.size; ++i) {
+        const RerankCandidate& c = sorted[hits[i].row];
+        out.push_back({c.segment, c.row, hits[i].score});
+    }
+    std::sort(out.begin(), out.end(), [](const RerankHit& a, const RerankHit& b) { return a.score > b.score; });
+    co_return out;
+}
+
+TwoPhaseEngine::Options TwoPhaseEngine::Options::fromConfig(const Config& config) {
+    Options options;
+    options.buffer_scan = config.query.buffer_scan_enabled;
+    options.two_phase = config.query.two_phase_enabled;
+    options.nprobe_delta = config.index.delta.nprobe;
+    options.nprobe_stable = config.index.stable.nprobe;
+    options.rerank_factor = config.index.stable.rerank_factor;
+    options.sample_p = config.experimental.adaptive_sampling ? config.index.delta.sample_p : 1.0f;
+    options.dim = config.collection.dim;
+    return options;
+}
+
+TwoPhaseEngine::TwoPhaseEngine(const Options& options, util::ThreadPool* pool, io::Prefetcher* prefetcher,
+                               GpuBackend* gpu)
+    : options_(options), pool_(pool), prefetcher_(prefetcher), gpu_(gpu) {
+    // The collection is open: kernels for its dim from here on
+    if (options_.dim) kernels::select_dimension(options_.dim);
+}
+
+struct TwoPhaseEngine::Plan {
+    Plan(const Query& q, std::span<const storage::DeltaSegment* const> d,
+         std::span<const storage::StableSegment* const> s)
+        : query(q), delta(d), stable(s), began(std::chrono::steady_clock::now()) {}
+
+    const Query& query;
+    std::span<const storage::DeltaSegment* const> delta;
+    std::span<const storage::StableSegment* const> stable;
+    Stats total;
+    SharedThreshold bar;
+    uint32_t nprobe_delta = 0;
+    uint32_t nprobe_stable = 0;
+    std::chrono::steady_clock::time_point began;
+    std::unique_ptr<QueryTrace> trace;
+    QueryResultCache* results_cache = nullptr;
+    QueryResultCache::Key result_key;
+    Epoch watermark = 0;
+    HnswCache* cache = nullptr;
+    std::vector<HnswCache::Hit> cached;
+    float query_sqr = 0;
+    size_t stable_count = 0;
+    std::vector<size_t> delta_run, stable_run;
+    SegmentRouter::Route route;
+    bool buffer = false;
+    size_t first_delta = 0;
+    size_t first_stable = 0;
+    std::vector<TaskResult> results;
+    float sample_p = 1.0f;
+    uint32_t rerank_factor = 0;
+
+    void finishTrace() {
+        if (query.tracer) {
+            query.tracer->finish(std::move(trace), traceOutcome(query, total, query.probe_ns + elapsedNs(began),
+                                                                nprobe_delta, nprobe_stable));
+        }
+    }
+};
+
+std::vector<TwoPhaseEngine::Hit> TwoPhaseEngine::search(const Query& query,
+                                                        std::span<const storage::DeltaSegment* const> delta,
+                                                        std::span<const storage::StableSegment* const> stable,
+                                                        Stats* stats) const {
+    if (query.k == 0 || query.vector.empty()) return {};
+    util::ScopedTimer timer(Metrics::global().query(QueryStage::Total));
+    Metrics::global().queries.add();
+    Plan plan(query, delta, stable);
+    std::vector<Hit> answered;
+    if (prepare(plan, answered)) {
+        if (stats) *stats = plan.total;
+        return answered;
+    }
+    auto run = [&](size_t i) { io::syncWait(runTask(plan, i, prefetcher_)); };
+    if (pool_) {
+        pool_->parallelFor(plan.results.size(), run);
+    } else {
+        for (size_t i = 0; i < plan.results.size(); ++i) run(i);
+    }
+    return finish(plan, stats);
+}
+
+util::Task<std::vector<TwoPhaseEngine::Hit>> TwoPhaseEngine::searchAsync(
+    const Query& query, std::span<const storage::DeltaSegment* const> delta,
+    std::span<const storage::StableSegment* const> stable, Stats* stats) const {
+    if (query.k == 0 || query.vector.empty()) co_return std::vector<Hit>();
+    util::ScopedTimer timer(Metrics::global().query(QueryStage::Total));
+    Metrics::global().queries.add();
+    Plan plan(query, delta, stable);
+    std::vector<Hit> answered;
+    if (prepare(plan, answered)) {
+        if (stats) *stats = plan.total;
+        co_return answered;
+    }
+    std::vector<util::Task<void>> tasks;
+    tasks.reserve(plan.results.size());
+    for (size_t i = 0; i < plan.results.size(); ++i) tasks.push_back(runTask(plan, i, nullptr));
+    co_await util::whenAll(std::move(tasks));
+    co_return finish(plan, stats);
+}
+
+bool TwoPhaseEngine::prepare(Plan& plan, std::vector<Hit>& answered) const {
+    const Query& query = plan.query;
+    plan.nprobe_delta = query.nprobe_delta ? query.nprobe_delta : options_.nprobe_delta;
+    plan.nprobe_stable = query.nprobe_stable ? query.nprobe_stable : options_.nprobe_stable;
+
+    // Sampled queries record a span per task; the rest only their Stats
+    plan.trace = query.tracer ? query.tracer->start() : nullptr;
+    if (plan.trace && query.probe_ns) plan.trace->add({QueryStage::CentroidProbe, -1, 0, query.probe_ns});
+
+    // A repeat of a cached query
+    plan.results_cache = query.results && query.results->enabled() ? query.results : nullptr;
+    plan.result_key = query.result_key;
+    plan.result_key.metric = query.metric;
+    plan.result_key.k = static_cast<uint32_t>(query.k);
+    if (plan.results_cache) {
+        if (auto cached = plan.results_cache->lookup(plan.result_key, query.vector)) {
+            answered.reserve(cached->size());
+            for (const auto& h : *cached) answered.push_back({h.id_hash, h.epoch, h.score});
+            plan.total.result_cached = true;
+            plan.finishTrace();
+            return true;
+        }
+        plan.watermark = plan.results_cache->watermark(plan.result_key);
+    }
+
+    // Hot vectors first
+    plan.cache = query.cache && query.cache->metric() == query.metric ? query.cache : nullptr;
+    if (plan.cache) {
+        plan.cached = plan.cache->search(query.vector, query.k);
+        if (plan.cache->answer(query.k, plan.cached.size())) {
+            std::vector<VectorIdHash> ids;
+            for (const auto& h : plan.cached) {
+                answered.push_back({h.id_hash, h.epoch, h.score});
+                ids.push_back(h.id_hash);
+            }
+            plan.cache->observe(ids);
+            plan.total.cache_hits = answered.size();
+            plan.total.cache_answered = true;
+            plan.finishTrace();
+            return true;
+        }
+        if (plan.cached.size() == query.k) plan.bar.raise(plan.cached.back().score);
+    }
+
+    plan.query_sqr = kernels::distance_table().inner_product(query.vector.data(), query.vector.data(),
+                                                            query.vector.size());
+
+    // The segments to search: all, or the router's pick
+    const auto delta = plan.delta;
+    const auto stable = plan.stable;
+    plan.stable_count = options_.two_phase ? stable.size() : 0;
+    if (query.router && query.router->enabled()) {
+        std::vector<SegmentRouter::Summary> summaries;
+        summaries.reserve(delta.size() + plan.stable_count);
+        for (const auto* segment : delta) {
+            summaries.push_back(summarize(segment->zoneMap(), segment->liveRows(), query.metric, query.vector.data(),
+                                          plan.query_sqr));
+        }
+        for (size_t s = 0; s < plan.stable_count; ++s) {
+            summaries.push_back(summarize(stable[s]->zoneMap(), stable[s]->liveRows(), query.metric,
+                                          query.vector.data(), plan.query_sqr));
+        }
+        plan.route = query.router->route(summaries);
+    }
+    for (size_t d = 0; d < delta.size(); ++d) {
+        if (plan.route.keep.empty() || plan.route.keep[d]) plan.delta_run.push_back(d);
+    }
+    for (size_t s = 0; s < plan.stable_count; ++s) {
+        if (plan.route.keep.empty() || plan.route.keep[delta.size() + s]) plan.stable_run.push_back(s);
+    }
+    interleaveByDevice(plan.stable_run, stable);
+    plan.total.segments_routed = delta.size() + plan.stable_count - plan.delta_run.size() - plan.stable_run.size();
+
+    // Tasks: the buffer, then each delta segment, then each stable segment
+    plan.buffer = options_.buffer_scan && query.buffer;
+    plan.first_delta = plan.buffer ? 1 : 0;
+    plan.first_stable = plan.first_delta + plan.delta_run.size();
+    plan.results.resize(plan.first_stable + plan.stable_run.size());
+    plan.sample_p = std::clamp(query.sample_p > 0.0f ? query.sample_p : options_.sample_p, 0.0f, 1.0f);
+    plan.rerank_factor = query.rerank_factor ? query.rerank_factor : options_.rerank_factor;
+    return false;
+}
+
+util::Task<void> TwoPhaseEngine::runTask(Plan& plan, size_t i, io::Prefetcher* prefetcher) const {
+    const Query& query = plan.query;
+    Stats& stats = plan.results[i].stats;
+    if (cancelled(query)) {
+        stats.partial = true;
+        co_return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    if (i < plan.first_delta) {
+        searchBuffer(query, plan.bar, plan.results[i]);
+        stats.buffer_ns = elapsedNs(start);
+    } else if (i < plan.first_stable) {
+        const size_t d = plan.delta_run[i - plan.first_delta];
+        co_await searchDelta(*plan.delta[d], d < query.delta_dead.size() ? query.delta_dead[d] : nullptr, query,
+                             plan.query_sqr, plan.nprobe_delta, plan.sample_p, plan.rerank_factor, plan.bar,
+                             plan.results[i]);
+        const uint64_t ns = elapsedNs(start);
+        stats.delta_segments = 1;
+        stats.delta_ns = ns - std::min(ns, stats.rerank_ns);
+    } else {
+        const size_t s = plan.stable_run[i - plan.first_stable];
+        co_await searchStable(*plan.stable[s], s < query.stable_dead.size() ? query.stable_dead[s] : nullptr, query,
+                              plan.query_sqr, plan.rerank_factor, plan.nprobe_stable, prefetcher,
+                              s < query.stable_adc.size() ? query.stable_adc[s] : nullptr, plan.bar,
+                              plan.results[i]);
+        const uint64_t ns = elapsedNs(start);
+        stats.stable_segments = 1;
+        stats.stable_ns = ns - std::min(ns, stats.rerank_ns);
+    }
+    if (!plan.trace) co_return;
+    const uint64_t at = query.probe_ns + static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(start - plan.began).count());
+    if (i < plan.first_delta) {
+        plan.trace->add({QueryStage::BufferScan, -1, at, stats.buffer_ns});
+    } else if (i < plan.first_stable) {
+        const auto segment = static_cast<int32_t>(plan.delta_run[i - plan.first_delta]);
+        plan.trace->add({QueryStage::Delta, segment, at, stats.delta_ns, stats.lists_scanned, stats.delta_rows,
+                         stats.delta_bytes});
+        if (stats.reranked) {
+            plan.trace->add({QueryStage::Rerank, segment, at + stats.delta_ns, stats.rerank_ns, 0, stats.reranked});
+        }
+    } else {
+        const auto segment = static_cast<int32_t>(plan.stable_run[i - plan.first_stable]);
+        plan.trace->add({QueryStage::Stable, segment, at, stats.stable_ns, stats.stable_lists, stats.stable_rows,
+                         stats.stable_bytes, stats.prefetch_stall_us * 1000});
+        if (stats.reranked) {
+            plan.trace->add({QueryStage::Rerank, segment, at + stats.stable_ns, stats.rerank_ns, 0, stats.reranked});
+        }
+    }
+}
+
+std::vector<TwoPhaseEngine::Hit> TwoPhaseEngine::finish(Plan& plan, Stats* stats) const {
+    const Query& query = plan.query;
+    Stats& total = plan.total;
+
+    // Newest version of each id, then the best k
+    std::vector<Hit> merged;
+    for (const auto& h : plan.cached) merged.push_back({h.id_hash, h.epoch, h.score});
+    for (TaskResult& r : plan.results) {
+        merged.insert(merged.end(), r.hits.begin(), r.hits.end());
+        addStats(total, r.stats);
+    }
+    std::sort(merged.begin(), merged.end(), [](const Hit& a, const Hit& b) {
+        if (a.id_hash != b.id_hash) return a.id_hash < b.id_hash;
+        return a.epoch != b.epoch ? a.epoch > b.epoch : a.score > b.score;
+    });
+    merged.erase(std::unique(merged.begin(), merged.end(),
+                             [](const Hit& a, const Hit& b) { return a.id_hash == b.id_hash; }),
+                 merged.end());
+    const size_t k = std::min(query.k, merged.size());
+    std::partial_sort(merged.begin(), merged.begin() + k, merged.end(),
+                      [](const Hit& a, const Hit& b) { return a.score > b.score; });
+    merged.resize(k);
+
+    if (plan.route.learn && !total.partial) {
+        // Which searched segments placed a row in the top k
+        std::vector<std::pair<VectorIdHash, Epoch>> top(merged.size());
+        for (size_t i = 0; i < merged.size(); ++i) top[i] = {merged[i].id_hash, merged[i].epoch};
+        std::sort(top.begin(), top.end());
+        auto placed = [&](const TaskResult& r) {
+            return std::any_of(r.hits.begin(), r.hits.end(), [&](const Hit& h) {
+                return std::binary_search(top.begin(), top.end(), std::make_pair(h.id_hash, h.epoch));
+            });
+        };
+        std::vector<bool> contributed(plan.delta.size() + plan.stable_count, false);
+        for (size_t i = 0; i < plan.delta_run.size(); ++i) {
+            contributed[plan.delta_run[i]] = placed(plan.results[plan.first_delta + i]);
+        }
+        for (size_t i = 0; i < plan.stable_run.size(); ++i) {
+            contributed[plan.delta.size() + plan.stable_run[i]] = placed(plan.results[plan.first_stable + i]);
+        }
+        query.router->learn(plan.route, contributed);
+    }
+
+    if (plan.cache && !total.partial) {
+        std::vector<VectorIdHash> ids(merged.size());
+        for (size_t i = 0; i < merged.size(); ++i) ids[i] = merged[i].id_hash;
+        for (const auto& h : plan.cached) {
+            total.cache_hits += std::any_of(merged.begin(), merged.end(), [&](const Hit& m) {
+                return m.id_hash == h.id_hash && m.epoch == h.epoch;
+            });
+        }
+        plan.cache->recordRecall(plan.cached, ids);
+        plan.cache->observe(ids);
+    }
+    if (plan.results_cache && !total.partial) {
+        std::vector<QueryResultCache::Hit> entry(merged.size());
+        for (size_t i = 0; i < merged.size(); ++i) entry[i] = {merged[i].id_hash, merged[i].epoch, merged[i].score};
+        plan.results_cache->insert(plan.result_key, query.vector, std::move(entry), plan.watermark);
+    }
+    recordStages(total, plan.buffer);
+    plan.finishTrace();
+    if (stats) *stats = total;
+    return merged;
+}
+
+std::vector<std::vector<TwoPhaseEngine::Hit>> TwoPhaseEngine::searchBatch(
+    std::span<const Query> queries, std::span<const storage::DeltaSegment* const> delta,
+    std::span<const storage::StableSegment* const> stable, Stats* stats) const {
+    // Stable ADC for the whole batch on the device: adc[segment][query]
+    std::vector<std::vector<std::vector<kernels::ScanHit>>> adc(stable.size());
+    std::vector<bool> offloaded(stable.size(), false);
+    if (gpu_ && options_.two_phase && !queries.empty() && queries.size() >= gpu_->minBatch()) {
+        // One probe width and pool for the batch, its widest; each query
+        // keeps its own k * rerank_factor of the candidates
+        uint32_t nprobe = 0;
+        size_t candidates = 0;
+        for (const Query& q : queries) {
+            nprobe = std::max(nprobe, q.nprobe_stable ? q.nprobe_stable : options_.nprobe_stable);
+            candidates = std::max(candidates,
+                                  q.k * std::max(q.rerank_factor ? q.rerank_factor : options_.rerank_factor, 1u));
+        }
+        for (size_t s = 0; s < stable.size(); ++s) {
+            const auto& model = stable[s]->model();
+            if (!model || stable[s]->liveRows() == 0) continue;
+            const size_t dim = model->dim();
+            if (std::any_of(queries.begin(), queries.end(), [&](const Query& q) { return q.vector.size() != dim; })) {
+                continue;
+            }
+            std::vector<float> rotated(queries.size() * dim);
+            for (size_t i = 0; i < queries.size(); ++i) model->rotate(queries[i].vector.data(), rotated.data() + i * dim);
+            offloaded[s] = gpu_->searchStable(*stable[s], rotated.data(), queries.size(), nprobe, candidates, adc[s]);
+        }
+    }
+    const bool any = std::find(offloaded.begin(), offloaded.end(), true) != offloaded.end();
+
+    std::vector<std::vector<Hit>> out;
+    out.reserve(queries.size());
+    Stats total;
+    std::vector<const std::vector<kernels::ScanHit>*> picked(stable.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        Query q = queries[i];
+        if (any) {
+            for (size_t s = 0; s < stable.size(); ++s) picked[s] = offloaded[s] ? &adc[s][i] : nullptr;
+            q.stable_adc = picked;
+        }
+        Stats one;
+        out.push_back(search(q, delta, stable, &one));
+        addStats(total, one);
+        total.segments_routed += one.segments_routed;
+        total.cache_hits += one.cache_hits;
+        total.cache_answered = total.cache_answered || one.cache_answered;
+    }
+    if (stats) *stats = total;
+    return out;
+}
+
+} // namespace woved::index
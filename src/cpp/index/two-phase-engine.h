@@ -0,0 +1,332 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "index/result-cache.h"
+#include "util/task.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace woved {
+struct Config;
+class QueryTracer;
+}
+
+namespace woved::util {
+class CancellationToken;
+class ThreadPool;
+}
+
+namespace woved::io {
+class Prefetcher;
+}
+
+namespace woved::kernels {
+struct ScanHit;
+}
+
+namespace woved::storage {
+class DeltaSegment;
+class StableSegment;
+struct DeadRows;
+}
+
+namespace woved::index {
+
+class CentroidsManager;
+class GpuBackend;
+class HnswCache;
+class SegmentRouter;
+
+// A PQ candidate to rescore: a live row of segments[segment]
+struct RerankCandidate {
+    uint32_t segment;
+    uint64_t row;
+};
+
+struct RerankHit {
+    uint32_t segment;
+    uint64_t row;
+    Score score;
+};
+
+// Bytes of unwanted vectors a rerank read may span to join two candidates
+// into one request; direct reads are widened to 4 KiB blocks anyway
+inline constexpr size_t kRerankGapBytes = 4096;
+
+// Exact rerank of ADC candidates (rerank_factor * k of them) spread over
+// stable segments. Candidates are grouped by segment, sorted by row and
+// joined into runs of nearby rows, no run crossing a segment chunk; each
+// segment's runs (and INT8 scales) go out as one read batch
+// (SegmentReader::readBatch), and a run is scored as soon as its reads
+// land rather than after the whole batch. Duplicate candidates are scored
+// once. Returns the top k, best first. With `cancel` tripped, segments
+// not yet submitted are left out.
+std::vector<RerankHit> rerank(std::span<const storage::StableSegment* const> segments,
+                              std::span<const RerankCandidate> candidates, Metric metric,
+                              std::span<const float> query, size_t k,
+                              const util::CancellationToken* cancel = nullptr);
+
+// rerank() as a coroutine, awaiting each batch (SegmentReader::
+// readBatchAsync()); the spans must outlive it
+util::Task<std::vector<RerankHit>> rerankAsync(std::span<const storage::StableSegment* const> segments,
+                                               std::span<const RerankCandidate> candidates, Metric metric,
+                                               std::span<const float> query, size_t k,
+                                               const util::CancellationToken* cancel = nullptr);
+
+// The bar a result must beat to reach the merged top k, shared by phases
+// running at once. A phase that holds k results of its own raises it to
+// its k-th score; the merged k-th can only be higher, so any phase may
+// skip work that cannot beat it. Versions of one id found in several
+// tiers count once in the merge, so the bar can overshoot by the few
+// superseded rows a phase held; that trades the rare lost candidate for
+// the pruning.
+class SharedThreshold {
+public:
+    Score get() const { return value_.load(std::memory_order_acquire); }
+
+    void raise(Score score) {
+        Score current = value_.load(std::memory_order_relaxed);
+        while (score > current &&
+               !value_.compare_exchange_weak(current, score, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+        }
+    }
+
+private:
+    std::atomic<Score> value_{std::numeric_limits<Score>::lowest()};
+};
+
+// Query execution over the three tiers: the message buffer, delta
+// segments (IVF-Flat over global centroid lists) and stable segments
+// (IVF-PQ, reranked). Every tier and every segment is its own task on the
+// thread pool, so a query costs the slowest tier rather than the sum of
+// them, and the tasks share one SharedThreshold.
+//
+// Within a segment lists are visited in decreasing order of their zone
+// map score bound (centroid and radius, seg-zone.h), and the scan stops at
+// the first list whose bound cannot beat the shared threshold. Segments
+// without a zone map are scanned in probe order, unpruned. In
+// norm-ordered delta segments an inner product scan also stops inside a
+// list at the first row whose |q| |v| bound cannot beat it.
+//
+// With sample_p under 1 (experimental.adaptive_sampling), a delta list
+// other than a segment's first is scanned in chunks and may stop early.
+// Its share runs from all rows down to sample_p, falling with the list's
+// rank in probe order and as the threshold nears the top of the list's
+// score spread (zone map mean to bound). Past that share the scan goes
+// on while the last chunk still placed a result above the threshold, so
+// a list that keeps paying is read to the end. Stable
+// candidates are ranked by ADC and only exact (reranked) scores are
+// published, as ADC distances are not comparable to them. With a
+// Prefetcher, a stable segment's lists are read and decoded ahead of its
+// ADC scan (StableScanner).
+//
+// A quantized delta segment (experimental.vector_compression) is scanned
+// on its in-memory SQ8 copy the same way: the scan keeps rerank_factor *
+// k candidates by SQ8 score, which reads nothing from the file and never
+// raises the threshold, and only those rows' stored vectors are read and
+// rescored. The list and norm bounds still prune as for any delta segment.
+//
+// With a QueryResultCache, a query within its radius of a cached one
+// whose results are still current is answered from it; every other
+// query's final top k is cached, under the scope watermark taken before
+// the search began.
+//
+// With a hot vector cache (HnswCache) of the query's metric, the cache is
+// searched first. A full top k from it seeds the shared threshold, or
+// answers the query outright when the cache's measured recall allows;
+// every final top k then feeds its admission statistics.
+//
+// A tenant-scoped query reads only the tenant's slice of each list of a
+// tenant-partitioned delta segment (index.delta.tenant_partitioned), so a
+// small tenant does not pay for scanning its neighbours' rows.
+//
+// With a SegmentRouter, only the segments it predicts can reach the top
+// k are searched; queries it samples to learn from search every segment
+// and report which ones contributed.
+//
+// A query with a CancellationToken checks it at every task start, list
+// boundary, adaptive scan chunk and rerank read batch. Once it trips
+// (the client left, or query.timeout_ms passed) the remaining work is
+// dropped and the query returns its best-so-far top k with Stats::partial
+// set. Only exact scores are merged, so a stable segment whose ADC pass
+// was cut off contributes nothing. Partial results are neither cached
+// nor learned from.
+//
+// A query with a read_epoch sees the segments as of that epoch: a segment
+// written wholly after it is skipped, and rows newer than it are dropped
+// from a segment's results. The segments passed in should come from the
+// same snapshot (storage/snapshot.h), so only segments merged or built
+// since hold such rows, and a query rarely loses a slot of its top k to
+// them.
+//
+// With DeadRows for a segment (SegmentSet::delta_dead, stable_dead),
+// rows a later segment superseded are stepped over as lists are scanned:
+// they take no heap slot and no rerank read, and the merge needs no
+// LatestByIdMap lookup to drop a deleted id's older versions. A query
+// reading before a set's newest superseding epoch does not use it.
+//
+// searchBatch() runs a batch of queries; with a GpuBackend and a batch
+// of at least its minBatch(), the stable tier's ADC for the whole batch
+// runs on the device first and each query only reranks its candidates.
+//
+// Each task is a coroutine (util::Task) that awaits its segment reads.
+// search() runs every task to completion on a pool thread
+// (io::syncWait()), blocking in that thread's ring while its reads are
+// out. searchAsync() instead runs all of a query's tasks at once on the
+// calling thread's io::IoLoop: a task waiting on a read yields to the
+// others, and to other queries on the loop, so a few threads
+// (io::CoroExecutor) keep thousands of queries' reads in flight rather
+// than a thread each. The async form uses no Prefetcher; a stable scan's
+// coroutines read its next lists while it scores the current one
+// (StableScanner::scanAsync()). Its task times are wall time on a shared
+// loop, so they include other tasks' turns.
+class TwoPhaseEngine {
+public:
+    struct Options {
+        bool buffer_scan = true;        // query.buffer_scan_enabled
+        bool two_phase = true;          // query.two_phase_enabled: search the stable tier
+        uint32_t nprobe_delta = 6;      // Global centroids probed in delta segments
+        uint32_t nprobe_stable = 12;    // Model lists probed per stable segment
+        uint32_t rerank_factor = 4;
+        float sample_p = 1.0f;          // Least share of a delta list scanned; 1: every row
+        uint32_t dim = 0;               // collection.dim, for fixed-dim kernels; 0: generic
+
+        static Options fromConfig(const Config& config);
+    };
+
+    // Query::nprobe_delta / nprobe_stable: probe every list
+    static constexpr uint32_t kAllLists = UINT32_MAX;
+
+    struct Hit {
+        VectorIdHash id_hash;
+        Epoch epoch;
+        Score score;
+    };
+
+    // Buffered results for the query, best first (e.g. from
+    // MessageBuffer::scanTopK); buffered rows are newer than any segment,
+    // so report them with the maximum epoch
+    using BufferScanFn = std::function<std::vector<Hit>(size_t k)>;
+
+    struct Query {
+        std::span<const float> vector;
+        Metric metric = Metric::COSINE;
+        size_t k = 10;
+        std::span<const CentroidId> probe;  // Nearest global centroids, nearest first
+        BufferScanFn buffer;                // Unset: no buffer phase
+        // Maps `probe` back to the centroid version each delta segment was
+        // clustered at; unset: segments share the current ids
+        const CentroidsManager* centroids = nullptr;
+        HnswCache* cache = nullptr;         // Unset: no cache phase
+        // Per query nprobe (e.g. NprobeTuner); 0: Options. `probe` must
+        // hold at least nprobe_delta centroids.
+        uint32_t nprobe_delta = 0;
+        uint32_t nprobe_stable = 0;
+        float sample_p = 0.0f;              // QueryRequest::sample_p; 0: Options
+        uint32_t rerank_factor = 0;         // Per query (deadline budget); 0: Options
+        // Per stable segment, ADC candidates picked elsewhere (GPU), best
+        // first; unset or a null entry: the segment is scanned here
+        std::span<const std::vector<kernels::ScanHit>* const> stable_adc;
+        SegmentRouter* router = nullptr;    // Unset: every segment is searched
+        QueryResultCache* results = nullptr;  // Unset: no result cache
+        QueryResultCache::Key result_key;   // Tenant, namespace and filter of the query
+        // Tenant scope; empty: any. Delta segments whose zone map lacks
+        // the tenant are skipped, and tenant-partitioned ones scan only
+        // its slice of each list.
+        std::string_view tenant;
+        const util::CancellationToken* cancel = nullptr;  // Unset: runs to completion
+        // Unset: not traced. A sampled query records a span per task;
+        // probe_ns is the time spent finding `probe`, before the search.
+        QueryTracer* tracer = nullptr;
+        uint64_t probe_ns = 0;
+        // Snapshot epoch (SnapshotRegistry::Snapshot::epoch); segment rows
+        // written after it are not returned. `buffer` should scan as of
+        // the same epoch.
+        Epoch read_epoch = kLatestEpoch;
+        // Per delta / stable segment, its superseded rows
+        // (SnapshotRegistry::Snapshot::deltaDead()); unset or a null
+        // entry: none are skipped
+        std::span<const storage::DeadRows* const> delta_dead;
+        std::span<const storage::DeadRows* const> stable_dead;
+    };
+
+    struct Stats {
+        uint64_t lists_scanned = 0;
+        uint64_t lists_pruned = 0;     // Stopped on the score bound
+        uint64_t segments_pruned = 0;  // Whole segment bound under the threshold
+        uint64_t segments_routed = 0;  // Skipped by the segment router
+        uint64_t reranked = 0;
+        uint64_t prefetch_stall_us = 0; // Stable scans waiting on list reads
+        uint64_t rows_skipped = 0;     // Delta rows left by sampling or the norm bound
+        uint64_t rows_dead = 0;        // Segment rows stepped over as superseded
+        uint64_t gpu_segments = 0;     // Stable segments whose ADC ran on the GPU
+        uint64_t cache_hits = 0;       // Final hits the cache also returned
+        bool cache_answered = false;   // The cache alone answered
+        bool result_cached = false;    // Answered from the result cache
+        bool partial = false;          // Cancelled: the best k found before it
+        uint64_t lists_cancelled = 0;  // Lists left unscanned on cancellation
+        // Per tier work and task time, summed over segments (not wall
+        // time: tasks run at once), for QueryCostModel
+        uint64_t delta_segments = 0;   // Delta segment tasks run, pruned or not
+        uint64_t delta_rows = 0;       // Delta rows scored
+        uint64_t delta_bytes = 0;      // Vector bytes of those rows (SQ8 bytes if quantized)
+        uint64_t stable_segments = 0;
+        uint64_t stable_lists = 0;     // Stable lists ADC scanned
+        uint64_t stable_rows = 0;      // Rows ADC scored
+        uint64_t stable_bytes = 0;     // Code bytes of the scanned lists
+        uint64_t buffer_ns = 0;
+        uint64_t delta_ns = 0;         // Without the rerank of quantized segments
+        uint64_t stable_ns = 0;        // ADC, without the rerank
+        uint64_t rerank_ns = 0;
+    };
+
+    // `pool` null runs the phases one after another on the calling thread;
+    // `prefetcher` null reads each stable list when its scan reaches it;
+    // `gpu` null keeps searchBatch() on the CPU
+    TwoPhaseEngine(const Options& options, util::ThreadPool* pool, io::Prefetcher* prefetcher = nullptr,
+                   GpuBackend* gpu = nullptr);
+
+    // Top k over the buffer and the given segments, best first, one hit per
+    // id (its newest version found)
+    std::vector<Hit> search(const Query& query, std::span<const storage::DeltaSegment* const> delta,
+                            std::span<const storage::StableSegment* const> stable, Stats* stats = nullptr) const;
+
+    // search() as a coroutine on the calling thread's io::IoLoop; the
+    // query, its spans, the segments and `stats` must outlive it
+    util::Task<std::vector<Hit>> searchAsync(const Query& query, std::span<const storage::DeltaSegment* const> delta,
+                                             std::span<const storage::StableSegment* const> stable,
+                                             Stats* stats = nullptr) const;
+
+    // search() of each query, the stable ADC batched on the GPU when
+    // there is one and the batch is large enough; a segment the device
+    // fails on is scanned on the CPU. `stats` sums over the batch.
+    std::vector<std::vector<Hit>> searchBatch(std::span<const Query> queries,
+                                              std::span<const storage::DeltaSegment* const> delta,
+                                              std::span<const storage::StableSegment* const> stable,
+                                              Stats* stats = nullptr) const;
+
+private:
+    // One query's state from the cache lookups to the merge
+    struct Plan;
+
+    // Cache lookups and routing; true if a cache answered, into `answered`
+    bool prepare(Plan& plan, std::vector<Hit>& answered) const;
+    // Task i of the plan: the buffer, a delta segment or a stable segment
+    util::Task<void> runTask(Plan& plan, size_t i, io::Prefetcher* prefetcher) const;
+    // Merge the tasks' results, feed the caches and router, finish the trace
+    std::vector<Hit> finish(Plan& plan, Stats* stats) const;
+
+    Options options_;
+    util::ThreadPool* pool_;
+    io::Prefetcher* prefetcher_;
+    GpuBackend* gpu_;
+};
+
+} // namespace woved::index
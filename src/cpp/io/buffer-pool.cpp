@@ -0,0 +1,210 @@
+#include "buffer-pool.h"
+#include "core/config.h"
+#include "util/logging.h"
+#include "util/numa-aware.h"
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+
+namespace woved::io {
+
+namespace {
+
+constexpr size_t kNoClass = SIZE_MAX;
+constexpr size_t kCacheDepth = 8;   // Buffers per class in a thread cache
+
+std::mutex g_global_mutex;
+BufferPool::Options g_global_options;
+bool g_global_built = false;
+
+} // namespace
+
+// Free buffers of global() held by one thread, handed back when it exits
+struct BufferPool::ThreadCache {
+    struct Entry {
+        std::byte* data;
+        int node;
+    };
+    std::array<std::array<Entry, kCacheDepth>, kClasses> entries{};
+    std::array<uint8_t, kClasses> counts{};
+
+    ~ThreadCache() {
+        BufferPool& pool = global();
+        for (size_t c = 0; c < kClasses; ++c) {
+            for (uint8_t i = 0; i < counts[c]; ++i) pool.giveBack(entries[c][i].node, c, entries[c][i].data);
+        }
+    }
+
+    static ThreadCache& get() {
+        thread_local ThreadCache cache;
+        return cache;
+    }
+};
+
+BufferPool::Options BufferPool::Options::fromConfig(const IOConfig& io) {
+    Options options;
+    options.arena_bytes = size_t{io.buffer_pool_mb} * 1048576;
+    options.huge_pages = io.buffer_pool_huge_pages;
+    return options;
+}
+
+BufferPool::BufferPool(const Options& options) : options_(options) {
+    const size_t count = options_.numa ? std::max<size_t>(1, util::numa_node_count()) : 1;
+    const size_t per_node = options_.arena_bytes / count / kSlabBytes * kSlabBytes;
+    for (size_t n = 0; n < count; ++n) {
+        auto node = std::make_unique<Node>();
+        if (per_node > 0) {
+            // Over-allocate one slab so the arena starts slab (huge page) aligned
+            node->allocation_bytes = per_node + kSlabBytes;
+            node->allocation = util::numa_alloc_on_node(node->allocation_bytes, static_cast<int>(n));
+            if (node->allocation) {
+                auto start = reinterpret_cast<uintptr_t>(node->allocation);
+                node->base = reinterpret_cast<std::byte*>((start + kSlabBytes - 1) / kSlabBytes * kSlabBytes);
+                node->end = node->base + per_node;
+                node->next = node->base;
+                if (options_.huge_pages) ::madvise(node->base, per_node, MADV_HUGEPAGE);
+                regions_.push_back(iovec{node->base, per_node});
+                reserved_bytes_ += per_node;
+            } else {
+                LOG_WARN("Buffer pool: no {} byte arena on node {}, using the heap", per_node, n);
+            }
+        }
+        nodes_.push_back(std::move(node));
+    }
+    util::numa_note_placement("io buffer pool", std::to_string(regions_.size()) + " arena(s) of " +
+                                                    std::to_string(per_node >> 20) + " MiB, bound per node" +
+                                                    (options_.huge_pages ? ", huge pages" : ""));
+}
+
+BufferPool::~BufferPool() {
+    for (auto& node : nodes_) {
+        if (node->allocation) util::numa_free(node->allocation, node->allocation_bytes);
+    }
+}
+
+void BufferPool::configure(const Options& options) {
+    std::lock_guard lock(g_global_mutex);
+    if (g_global_built) {
+        LOG_WARN("Buffer pool already in use; new options ignored");
+        return;
+    }
+    g_global_options = options;
+}
+
+BufferPool& BufferPool::global() {
+    // Never destroyed: thread caches hand buffers back as threads exit,
+    // which may be after static destruction
+    static BufferPool* pool = [] {
+        std::lock_guard lock(g_global_mutex);
+        g_global_built = true;
+        auto* built = new BufferPool(g_global_options);
+        built->thread_cache_ = true;
+        return built;
+    }();
+    return *pool;
+}
+
+size_t BufferPool::sizeClass(size_t bytes) {
+    if (bytes <= kMinClass) return 0;
+    const size_t c = static_cast<size_t>(std::bit_width(bytes - 1)) - std::bit_width(kMinClass - 1);
+    return c < kClasses ? c : kNoClass;
+}
+
+int BufferPool::localNode() const {
+    if (nodes_.size() == 1) return 0;
+    const int node = util::current_numa_node();
+    return node >= 0 && static_cast<size_t>(node) < nodes_.size() ? node : 0;
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t bytes) {
+    Buffer buffer;
+    buffer.pool_ = this;
+    const size_t c = sizeClass(bytes);
+    if (c != kNoClass) {
+        const int node = localNode();
+        if (thread_cache_) {
+            ThreadCache& cache = ThreadCache::get();
+            uint8_t& n = cache.counts[c];
+            if (n > 0 && cache.entries[c][n - 1].node == node) {
+                buffer.data_ = cache.entries[c][--n].data;
+            }
+        }
+        if (!buffer.data_) {
+            buffer.data_ = take(*nodes_[node], c);
+            if (buffer.data_) pooled_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (buffer.data_) {
+            buffer.bytes_ = classBytes(c);
+            buffer.size_class_ = static_cast<uint8_t>(c);
+            buffer.node_ = static_cast<int16_t>(node);
+            return buffer;
+        }
+    }
+
+    const size_t rounded = (std::max<size_t>(bytes, 1) + kMinClass - 1) / kMinClass * kMinClass;
+    buffer.data_ = static_cast<std::byte*>(std::aligned_alloc(kMinClass, rounded));
+    if (!buffer.data_) throw std::bad_alloc();
+    buffer.bytes_ = rounded;
+    overflows_.fetch_add(1, std::memory_order_relaxed);
+    return buffer;
+}
+
+std::byte* BufferPool::take(Node& node, size_t size_class) {
+    std::lock_guard lock(node.mutex);
+    auto& free = node.free[size_class];
+    if (!free.empty()) {
+        std::byte* data = free.back();
+        free.pop_back();
+        return data;
+    }
+    const size_t bytes = classBytes(size_class);
+    const size_t slab = std::max(kSlabBytes, bytes);
+    if (!node.next || static_cast<size_t>(node.end - node.next) < slab) return nullptr;
+    std::byte* begin = node.next;
+    node.next += slab;
+    carved_bytes_.fetch_add(slab, std::memory_order_relaxed);
+    // Room for every buffer of the class, so giveBack() never allocates
+    free.reserve(free.capacity() + slab / bytes);
+    for (std::byte* p = begin + slab - bytes; p > begin; p -= bytes) free.push_back(p);
+    return begin;
+}
+
+void BufferPool::Buffer::release() noexcept {
+    if (data_) pool_->put(*this);
+    data_ = nullptr;
+}
+
+void BufferPool::put(Buffer& buffer) noexcept {
+    if (buffer.size_class_ == Buffer::kHeap) {
+        std::free(buffer.data_);
+        return;
+    }
+    if (thread_cache_) {
+        ThreadCache& cache = ThreadCache::get();
+        uint8_t& n = cache.counts[buffer.size_class_];
+        if (n < kCacheDepth) {
+            cache.entries[buffer.size_class_][n++] = {buffer.data_, buffer.node_};
+            return;
+        }
+    }
+    giveBack(buffer.node_, buffer.size_class_, buffer.data_);
+}
+
+void BufferPool::giveBack(int node, size_t size_class, std::byte* data) noexcept {
+    Node& owner = *nodes_[static_cast<size_t>(node)];
+    std::lock_guard lock(owner.mutex);
+    owner.free[size_class].push_back(data);
+}
+
+BufferPool::Stats BufferPool::getStats() const {
+    Stats stats;
+    stats.pooled = pooled_.load(std::memory_order_relaxed);
+    stats.overflows = overflows_.load(std::memory_order_relaxed);
+    stats.carved_bytes = carved_bytes_.load(std::memory_order_relaxed);
+    stats.reserved_bytes = reserved_bytes_;
+    return stats;
+}
+
+} // namespace woved::io
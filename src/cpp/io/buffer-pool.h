@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+
+namespace woved {
+struct IOConfig;
+}
+
+namespace woved::io {
+
+// Aligned buffers for direct I/O, recycled rather than allocated per read
+// or write.
+//
+// Buffers come in power-of-two size classes from 4 KiB to 4 MiB, each
+// aligned to at least 4 KiB. A request is rounded up to its class. Each
+// NUMA node has one arena, reserved at construction and backed by huge
+// pages where the kernel allows it. Arenas are carved lazily into
+// 2 MiB slabs, and a slab serves one class. A buffer always returns to
+// its own node's free list, and acquire() serves the calling thread's
+// node first.
+//
+// The arenas are registered with io_uring (regions()).
+// UringWrapper::local() rings register them when created. A queued read
+// or write whose buffer lies in an arena then goes out as a fixed-buffer
+// I/O, which skips per-request page pinning.
+//
+// global() gives each thread a small cache of free buffers per class, so
+// an acquire and release pair in a steady loop takes no lock. Requests
+// above the largest class, or made once an arena is used up, fall back to
+// aligned heap memory. Such fallbacks are counted in Stats::overflows.
+class BufferPool {
+public:
+    static constexpr size_t kMinClass = 4096;
+    static constexpr size_t kClasses = 11;            // 4 KiB .. 4 MiB
+    static constexpr size_t kSlabBytes = 2097152;     // One huge page
+
+    struct Options {
+        size_t arena_bytes = 67108864;  // io.buffer_pool_mb, split across nodes
+        bool huge_pages = true;         // io.buffer_pool_huge_pages (MADV_HUGEPAGE)
+        bool numa = true;               // One arena per node; off: one arena
+
+        static Options fromConfig(const IOConfig& io);
+    };
+
+    // Counted off the thread caches' fast path
+    struct Stats {
+        uint64_t pooled = 0;          // Served from a node's free lists
+        uint64_t overflows = 0;       // Served from the heap
+        uint64_t carved_bytes = 0;    // Arena bytes handed to slabs
+        uint64_t reserved_bytes = 0;
+    };
+
+    // A borrowed buffer; goes back to its pool when destroyed
+    class Buffer {
+    public:
+        Buffer() = default;
+        ~Buffer() { release(); }
+
+        Buffer(Buffer&& other) noexcept
+            : pool_(std::exchange(other.pool_, nullptr)), data_(std::exchange(other.data_, nullptr)),
+              bytes_(other.bytes_), size_class_(other.size_class_), node_(other.node_) {}
+        Buffer& operator=(Buffer&& other) noexcept {
+            if (this != &other) {
+                release();
+                pool_ = std::exchange(other.pool_, nullptr);
+                data_ = std::exchange(other.data_, nullptr);
+                bytes_ = other.bytes_;
+                size_class_ = other.size_class_;
+                node_ = other.node_;
+            }
+            return *this;
+        }
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        std::byte* data() const { return data_; }
+        // The whole class, at least what was asked for
+        size_t size() const { return bytes_; }
+        explicit operator bool() const { return data_ != nullptr; }
+
+    private:
+        friend class BufferPool;
+        static constexpr uint8_t kHeap = 0xff;
+
+        BufferPool* pool_ = nullptr;
+        std::byte* data_ = nullptr;
+        size_t bytes_ = 0;
+        uint8_t size_class_ = kHeap;
+        int16_t node_ = 0;
+
+        void release() noexcept;
+    };
+
+    explicit BufferPool(const Options& options);
+    // Every buffer must have been returned
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Options of global(); takes effect only before its first use
+    static void configure(const Options& options);
+    static BufferPool& global();
+
+    // At least `bytes`; throws std::bad_alloc only if the heap fallback fails
+    Buffer acquire(size_t bytes);
+
+    // One iovec per arena, for UringWrapper::registerBuffers()
+    std::span<const iovec> regions() const { return regions_; }
+
+    Stats getStats() const;
+
+    static size_t classBytes(size_t size_class) { return kMinClass << size_class; }
+
+private:
+    struct Node {
+        std::mutex mutex;
+        std::byte* base = nullptr;     // Arena, slab aligned
+        std::byte* end = nullptr;
+        std::byte* next = nullptr;     // Next slab to carve
+        void* allocation = nullptr;
+        size_t allocation_bytes = 0;
+        std::array<std::vector<std::byte*>, kClasses> free;
+    };
+
+    struct ThreadCache;
+
+    Options options_;
+    std::vector<std::unique_ptr<Node>> nodes_;
+    std::vector<iovec> regions_;
+    bool thread_cache_ = false;     // global() only; its cache outlives no pool
+
+    size_t reserved_bytes_ = 0;
+    std::atomic<uint64_t> pooled_{0};
+    std::atomic<uint64_t> overflows_{0};
+    std::atomic<uint64_t> carved_bytes_{0};
+
+    static size_t sizeClass(size_t bytes);
+    int localNode() const;
+    // Pop a free buffer of `size_class` from `node`, carving a slab if none
+    std::byte* take(Node& node, size_t size_class);
+    void put(Buffer& buffer) noexcept;
+    void giveBack(int node, size_t size_class, std::byte* data) noexcept;
+};
+
+} // namespace woved::io
@@ -0,0 +1,212 @@
+#include "coro-executor.h"
+#include "core/config.h"
+#include "io/io-loop.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace woved::io {
+
+namespace {
+
+// A coroutine nobody awaits: runs from the call, frees itself at the end
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+Detached runDetached(util::Task<void> task, std::function<void(std::exception_ptr)> finished) {
+    std::exception_ptr error;
+    try {
+        co_await task;
+    } catch (...) {
+        error = std::current_exception();
+    }
+    finished(error);
+}
+
+} // namespace
+
+CoroExecutor::Options CoroExecutor::Options::fromConfig(const Config& config) {
+    Options options;
+    options.threads = config.query.executor_threads;
+    options.max_in_flight = std::max(config.query.executor_max_in_flight, 1u);
+    return options;
+}
+
+CoroExecutor::CoroExecutor(const Options& options) : options_(options) {}
+
+CoroExecutor::~CoroExecutor() { stop(); }
+
+void CoroExecutor::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ || !enabled()) return;
+    running_ = true;
+    stopping_ = false;
+    drivers_.clear();
+    for (uint32_t i = 0; i < options_.threads; ++i) {
+        auto driver = std::make_unique<Driver>();
+        driver->doorbell = eventfd(0, EFD_CLOEXEC);
+        if (driver->doorbell < 0) {
+            LOG_WARN("Coroutine executor: eventfd failed ({}), drivers wake on I/O only", std::strerror(errno));
+        }
+        drivers_.push_back(std::move(driver));
+    }
+    for (auto& driver : drivers_) driver->thread = std::thread([this, d = driver.get()] { drive(*d); });
+}
+
+void CoroExecutor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& driver : drivers_) ring(*driver);
+    for (auto& driver : drivers_) {
+        if (driver->thread.joinable()) driver->thread.join();
+        if (driver->doorbell >= 0) close(driver->doorbell);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    drivers_.clear();
+    running_ = false;
+}
+
+void CoroExecutor::spawn(util::Task<void> task, DoneFn done) {
+    const Driver* least = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_ || stopping_) {
+            throw util::InvalidArgumentException("Coroutine executor: not running");
+        }
+        inbox_.push_back({std::move(task), std::move(done)});
+        for (const auto& driver : drivers_) {
+            if (!least || driver->running.load(std::memory_order_relaxed) <
+                              least->running.load(std::memory_order_relaxed)) {
+                least = driver.get();
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.spawned++;
+    }
+    cv_.notify_one();
+    if (least) ring(*least);
+}
+
+void CoroExecutor::ring(const Driver& driver) {
+    if (driver.doorbell < 0) return;
+    const uint64_t one = 1;
+    [[maybe_unused]] const ssize_t n = write(driver.doorbell, &one, sizeof(one));
+}
+
+std::vector<CoroExecutor::Job> CoroExecutor::take(Driver& driver) {
+    std::vector<Job> jobs;
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t running = driver.running.load(std::memory_order_relaxed);
+    const size_t room = options_.max_in_flight > running ? options_.max_in_flight - running : 0;
+    while (!inbox_.empty() && jobs.size() < room) {
+        jobs.push_back(std::move(inbox_.front()));
+        inbox_.pop_front();
+    }
+    return jobs;
+}
+
+void CoroExecutor::launch(Driver& driver, Job job) {
+    driver.running.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.running++;
+        stats_.peak_running = std::max(stats_.peak_running, stats_.running);
+    }
+    // Runs to the task's first suspension before returning
+    runDetached(std::move(job.task), [this, &driver, done = std::move(job.done)](std::exception_ptr error) {
+        finished(driver, done, error);
+    });
+}
+
+void CoroExecutor::finished(Driver& driver, const DoneFn& done, std::exception_ptr error) {
+    driver.running.fetch_sub(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.running--;
+        stats_.completed++;
+        if (error) stats_.failed++;
+    }
+    if (!done) return;
+    try {
+        done(error);
+    } catch (const std::exception& e) {
+        LOG_WARN("Coroutine executor: completion callback threw: {}", e.what());
+    }
+}
+
+void CoroExecutor::drive(Driver& driver) {
+    IoLoop& loop = IoLoop::local();
+    // The doorbell only helps a driver that can block in its ring
+    const bool bell = driver.doorbell >= 0 && loop.ring().usingRing();
+    bool armed = false;
+    uint64_t rung = 0;
+    auto arm = [&] {
+        armed = true;
+        loop.ring().submitRead(driver.doorbell, &rung, sizeof(rung), 0, [&](int) { armed = false; });
+    };
+
+    while (true) {
+        for (Job& job : take(driver)) launch(driver, std::move(job));
+        loop.runReady();
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (stopping_ && inbox_.empty() && driver.running.load(std::memory_order_relaxed) == 0) break;
+            // Nothing of ours in flight: sleep until there is work
+            if (!bell && loop.idle()) {
+                cv_.wait(lock, [&] { return stopping_ || !inbox_.empty(); });
+                continue;
+            }
+        }
+        if (bell && !armed) arm();
+        loop.poll(true);
+    }
+
+    // The doorbell read is still in the ring; land it before the loop goes
+    if (armed) {
+        ring(driver);
+        while (armed) {
+            loop.poll(true);
+            loop.runReady();
+        }
+    }
+}
+
+CoroExecutor::Stats CoroExecutor::getStats() const {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats = stats_;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.queued = inbox_.size();
+    return stats;
+}
+
+std::vector<std::pair<std::string_view, double>> CoroExecutor::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_executor_running", static_cast<double>(stats.running)},
+        {"woved_executor_queued", static_cast<double>(stats.queued)},
+        {"woved_executor_completed", static_cast<double>(stats.completed)},
+        {"woved_executor_failed", static_cast<double>(stats.failed)},
+    };
+}
+
+} // namespace woved::io
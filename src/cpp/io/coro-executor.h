@@ -0,0 +1,141 @@
+#pragma once
+
+#include "util/task.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::io {
+
+// Runs coroutines (util::Task, e.g. TwoPhaseEngine::searchAsync()) on a
+// few driver threads, each over its own io::IoLoop and ring. A driver
+// starts a task, runs it to its first read and goes on to the next, then
+// blocks in its ring until some read lands and resumes whoever awaited
+// it. A query waiting on the device costs a coroutine frame rather than
+// a thread, so a driver holds up to max_in_flight of them at once and a
+// few cores keep the device's queues full.
+//
+// Tasks wait in a shared queue until a driver has room. spawn() rings
+// the least loaded driver through an eventfd read it keeps in its ring,
+// so a driver blocked on I/O still picks up new work. Without a ring
+// every read completes inside its submit; a driver then runs each task
+// to completion in turn and waits on a condition variable for more.
+//
+// A task stays on the driver that started it. It must only await I/O of
+// that thread's loop (not block on a mutex or a future), or it holds up
+// every other task of the driver.
+class CoroExecutor {
+public:
+    struct Options {
+        uint32_t threads = 0;           // query.executor_threads; 0: off
+        uint32_t max_in_flight = 4096;  // query.executor_max_in_flight, per driver
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        uint64_t spawned = 0;
+        uint64_t completed = 0;
+        uint64_t failed = 0;        // Of completed, ended by an exception
+        uint64_t running = 0;       // Started, not yet done
+        uint64_t queued = 0;        // Waiting for room on a driver
+        uint64_t peak_running = 0;
+    };
+
+    // Given the exception the task ended with; null if it returned
+    using DoneFn = std::function<void(std::exception_ptr error)>;
+
+    explicit CoroExecutor(const Options& options);
+    ~CoroExecutor();
+
+    CoroExecutor(const CoroExecutor&) = delete;
+    CoroExecutor& operator=(const CoroExecutor&) = delete;
+
+    bool enabled() const { return options_.threads > 0; }
+
+    void start();
+    // Runs every task already spawned to completion, then joins the drivers
+    void stop();
+
+    // Run `task` on a driver; `done` runs there once it has finished.
+    // Throws util::InvalidArgumentException if the executor is not running.
+    void spawn(util::Task<void> task, DoneFn done = nullptr);
+
+    // spawn() delivering the task's result, or its exception, to a future
+    template <typename T>
+    std::future<T> submit(util::Task<T> task) {
+        auto promise = std::make_shared<std::promise<T>>();
+        std::future<T> future = promise->get_future();
+        spawn(deliver(std::move(task), promise));
+        return future;
+    }
+
+    Stats getStats() const;
+
+    // woved_executor_running, woved_executor_queued,
+    // woved_executor_completed, woved_executor_failed
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct Job {
+        util::Task<void> task;
+        DoneFn done;
+    };
+
+    struct Driver {
+        std::thread thread;
+        std::atomic<size_t> running{0};
+        int doorbell = -1;          // eventfd; -1: none
+    };
+
+    template <typename T>
+    static util::Task<void> deliver(util::Task<T> task, std::shared_ptr<std::promise<T>> promise) {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await task;
+                promise->set_value();
+            } else {
+                promise->set_value(co_await task);
+            }
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    }
+
+    void drive(Driver& driver);
+    // Up to the driver's room of queued jobs
+    std::vector<Job> take(Driver& driver);
+    void launch(Driver& driver, Job job);
+    void finished(Driver& driver, const DoneFn& done, std::exception_ptr error);
+    static void ring(const Driver& driver);
+
+    Options options_;
+    std::vector<std::unique_ptr<Driver>> drivers_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> inbox_;
+    bool running_ = false;
+    bool stopping_ = false;
+
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+};
+
+} // namespace woved::io
@@ -0,0 +1,52 @@
+#include "io-loop.h"
+#include "util/exceptions.h"
+#include <cstring>
+#include <string>
+
+namespace woved::io {
+
+IoLoop& IoLoop::local() {
+    thread_local IoLoop loop;
+    return loop;
+}
+
+size_t IoLoop::runReady() {
+    size_t count = 0;
+    while (!ready_.empty()) {
+        const std::coroutine_handle<> handle = ready_.front();
+        ready_.pop_front();
+        handle.resume();
+        count++;
+    }
+    return count;
+}
+
+size_t IoLoop::poll(bool block) {
+    // Only callback I/O is in flight between the loop's turns: tagged I/O
+    // is reaped by the call that submitted it
+    return ring_.reap(block ? 1 : 0, [](uint64_t) {});
+}
+
+void IoLoop::ReadAwaitable::await_suspend(std::coroutine_handle<> handle) {
+    // Without a ring the read completes inside the submit; posting still
+    // defers the resume to runReady()
+    loop_.ring_.submitRead(fd_, data_, len_, offset_, [this, handle](int error) {
+        error_ = error;
+        loop_.post(handle);
+    });
+}
+
+void IoLoop::ReadAwaitable::await_resume() const {
+    if (error_) throw util::IOException(std::string("read: ") + std::strerror(error_));
+}
+
+void IoBatch::submitRead(int fd, void* data, size_t len, uint64_t offset, uint64_t index) {
+    in_flight_++;
+    loop_.ring().submitRead(fd, data, len, offset, [this, index](int error) {
+        in_flight_--;
+        landed_.push_back({index, error});
+        if (waiter_) loop_.post(std::exchange(waiter_, nullptr));
+    });
+}
+
+} // namespace woved::io
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "io/uring-wrapper.h"
+#include "util/task.h"
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace woved::io {
+
+// Drives coroutines (util::Task) on one thread over that thread's ring
+// (UringWrapper::local()). An I/O a coroutine awaits completes inside a
+// reap of the ring; the completion only posts the coroutine here, and
+// runReady() resumes it after the reap has returned, so a resumed
+// coroutine may submit more I/O to the same ring.
+//
+// Every thread has one (local()); a coroutine stays on the thread that
+// started it. syncWait() runs a task to completion on the calling thread,
+// CoroExecutor keeps thousands in flight on a few.
+class IoLoop {
+public:
+    static IoLoop& local();
+
+    IoLoop(const IoLoop&) = delete;
+    IoLoop& operator=(const IoLoop&) = delete;
+
+    UringWrapper& ring() { return ring_; }
+
+    // Resume `handle` from the next runReady()
+    void post(std::coroutine_handle<> handle) { ready_.push_back(handle); }
+    bool hasReady() const { return !ready_.empty(); }
+
+    // Resume every posted coroutine, and those they post in turn;
+    // returns how many resumed
+    size_t runReady();
+
+    // Reap completed I/O, posting its coroutines; with `block`, wait for
+    // one if any is in flight. Returns how many completed.
+    size_t poll(bool block);
+
+    // Nothing posted and no I/O in flight
+    bool idle() const { return ready_.empty() && ring_.inFlight() == 0; }
+
+    // `co_await loop.read(...)`: one read, resumed from runReady(); throws
+    // util::IOException if it failed
+    class ReadAwaitable {
+    public:
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() const;
+
+    private:
+        friend class IoLoop;
+        ReadAwaitable(IoLoop& loop, int fd, void* data, size_t len, uint64_t offset)
+            : loop_(loop), fd_(fd), data_(data), len_(len), offset_(offset) {}
+
+        IoLoop& loop_;
+        int fd_;
+        void* data_;
+        size_t len_;
+        uint64_t offset_;
+        int error_ = 0;
+    };
+
+    ReadAwaitable read(int fd, void* data, size_t len, uint64_t offset) {
+        return ReadAwaitable(*this, fd, data, len, offset);
+    }
+
+private:
+    IoLoop() : ring_(UringWrapper::local()) {}
+
+    UringWrapper& ring_;
+    std::deque<std::coroutine_handle<>> ready_;
+};
+
+// Reads of one coroutine, reported as they land rather than all at once.
+// Lives in the coroutine's frame; every read submitted must have landed
+// before it is destroyed.
+class IoBatch {
+public:
+    struct Landed {
+        uint64_t index;
+        int error;      // errno, 0 on success
+    };
+
+    explicit IoBatch(IoLoop& loop = IoLoop::local()) : loop_(loop) {}
+
+    IoBatch(const IoBatch&) = delete;
+    IoBatch& operator=(const IoBatch&) = delete;
+
+    // Queue a read reported under `index`
+    void submitRead(int fd, void* data, size_t len, uint64_t offset, uint64_t index);
+
+    size_t inFlight() const { return in_flight_; }
+
+    // `co_await batch.next()`: the reads landed since the last call, in
+    // completion order, suspending until there is one (empty only if
+    // nothing is in flight)
+    class NextAwaitable {
+    public:
+        bool await_ready() const noexcept { return !batch_.landed_.empty() || batch_.in_flight_ == 0; }
+        void await_suspend(std::coroutine_handle<> handle) noexcept { batch_.waiter_ = handle; }
+        std::vector<Landed> await_resume() { return std::exchange(batch_.landed_, {}); }
+
+    private:
+        friend class IoBatch;
+        explicit NextAwaitable(IoBatch& batch) : batch_(batch) {}
+        IoBatch& batch_;
+    };
+
+    NextAwaitable next() { return NextAwaitable(*this); }
+
+private:
+    IoLoop& loop_;
+    size_t in_flight_ = 0;
+    std::vector<Landed> landed_;
+    std::coroutine_handle<> waiter_;
+};
+
+// Run `task` to completion on the calling thread, driving its loop; other
+// coroutines of the loop posted meanwhile run too. Rethrows what the task
+// threw. Throws std::logic_error if the task waits on something no I/O of
+// this thread will deliver.
+template <typename T>
+T syncWait(util::Task<T> task) {
+    IoLoop& loop = IoLoop::local();
+    task.start();
+    while (!task.done()) {
+        if (loop.runReady() > 0) continue;
+        if (loop.idle()) throw std::logic_error("syncWait: the task waits on nothing this thread drives");
+        loop.poll(true);
+    }
+    return task.result();
+}
+
+} // namespace woved::io
@@ -0,0 +1,228 @@
+#include "io-manager.h"
+#include "core/config.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace woved::io {
+
+namespace {
+
+constexpr uint64_t kMiB = 1048576;
+constexpr uint64_t kMinLatencySamples = 16;   // Per interval, before p99 counts
+constexpr double kMinScale = 1.0 / 64;
+constexpr double kRecoverStep = 0.125;
+constexpr double kSmoothing = 0.5;            // Weight of the newest interval
+
+size_t index(IOClass io_class) { return static_cast<size_t>(io_class); }
+
+} // namespace
+
+IOManager::Options IOManager::Options::fromConfig(const Config& config) {
+    Options options;
+    const float share = config.storage.segment.merge_bandwidth_limit;
+    options.compaction_bytes_per_s = std::max<uint64_t>(1, config.io.merge_bandwidth_limit_mbps) * kMiB;
+    if (config.io.device_bandwidth_mbps > 0) {
+        options.device_bytes_per_s = uint64_t{config.io.device_bandwidth_mbps} * kMiB;
+        if (share > 0) {
+            options.compaction_bytes_per_s = std::min(
+                options.compaction_bytes_per_s, static_cast<uint64_t>(share * options.device_bytes_per_s));
+        }
+    } else {
+        // The merge cap is the configured share of a device of this size
+        options.device_bytes_per_s = share > 0 && share <= 1
+                                         ? static_cast<uint64_t>(options.compaction_bytes_per_s / share)
+                                         : options.compaction_bytes_per_s;
+    }
+    options.target_utilization = config.io.target_utilization;
+    options.query_p99_target_ms = config.io.query_p99_target_ms;
+    return options;
+}
+
+IOManager::IOManager(const Options& options) : options_(options), last_(RateLimiter::Clock::now()) {
+    options_.device_bytes_per_s = std::max<uint64_t>(1, options_.device_bytes_per_s);
+    options_.target_utilization = std::clamp(options_.target_utilization, 0.05f, 1.0f);
+    options_.flush_floor_bytes_per_s = std::max<uint64_t>(1, options_.flush_floor_bytes_per_s);
+    options_.compaction_floor_bytes_per_s = std::max<uint64_t>(1, options_.compaction_floor_bytes_per_s);
+    options_.compaction_bytes_per_s = std::max(options_.compaction_bytes_per_s,
+                                               options_.compaction_floor_bytes_per_s);
+    options_.interval_ms = std::max<uint32_t>(1, options_.interval_ms);
+
+    const auto budget = static_cast<uint64_t>(options_.device_bytes_per_s * options_.target_utilization);
+    limiters_[index(IOClass::Wal)] = std::make_shared<RateLimiter>(0);
+    limiters_[index(IOClass::Query)] = std::make_shared<RateLimiter>(0);
+    limiters_[index(IOClass::Flush)] =
+        std::make_shared<RateLimiter>(std::max(budget, options_.flush_floor_bytes_per_s));
+    limiters_[index(IOClass::Compaction)] = std::make_shared<RateLimiter>(options_.compaction_bytes_per_s);
+    for (size_t c = 0; c < kClasses; ++c) stats_.rate_bytes_per_s[c] = limiters_[c]->rate();
+}
+
+IOManager::~IOManager() {
+    stop();
+}
+
+size_t IOManager::latencyBucket(uint64_t us) {
+    if (us < 4) return static_cast<size_t>(us);
+    const int octave = std::bit_width(us) - 1;
+    const uint64_t sub = (us >> (octave - 2)) & 3;
+    return std::min(kLatencyBuckets - 1, static_cast<size_t>(4 * (octave - 1) + sub));
+}
+
+double IOManager::bucketUpperMs(size_t bucket) {
+    if (bucket < 4) return static_cast<double>(bucket + 1) / 1000.0;
+    const int octave = static_cast<int>(bucket / 4) + 1;
+    const double sub = static_cast<double>(bucket % 4);
+    return std::ldexp(5.0 + sub, octave - 2) / 1000.0;
+}
+
+void IOManager::observeQueryLatency(std::chrono::nanoseconds latency) {
+    const auto us = static_cast<uint64_t>(std::max<int64_t>(0, latency.count() / 1000));
+    latency_[latencyBucket(us)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void IOManager::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+    thread_ = std::thread([this] { loop(); });
+}
+
+void IOManager::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+void IOManager::loop() {
+    const auto interval = std::chrono::milliseconds(options_.interval_ms);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        cv_.wait_for(lock, interval, [this] { return !running_; });
+        if (!running_) break;
+        lock.unlock();
+        rebalance();
+        lock.lock();
+    }
+}
+
+void IOManager::rebalance() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = RateLimiter::Clock::now();
+    const double dt = std::chrono::duration<double>(now - last_).count();
+    if (dt <= 0) return;
+    last_ = now;
+
+    // Bytes each class moved since the last call
+    std::array<uint64_t, kClasses> moved{};
+    for (size_t c = 0; c < kClasses; ++c) {
+        const uint64_t bytes = limiters_[c]->getStats().granted_bytes;
+        moved[c] = bytes - last_bytes_[c];
+        last_bytes_[c] = bytes;
+        const double rate = static_cast<double>(moved[c]) / dt;
+        stats_.used_bytes_per_s[c] = stats_.rebalances == 0
+                                         ? rate
+                                         : kSmoothing * rate + (1 - kSmoothing) * stats_.used_bytes_per_s[c];
+    }
+
+    // This interval's query p99
+    std::array<uint64_t, kLatencyBuckets> counts{};
+    uint64_t samples = 0;
+    for (size_t b = 0; b < kLatencyBuckets; ++b) {
+        counts[b] = latency_[b].exchange(0, std::memory_order_relaxed);
+        samples += counts[b];
+    }
+    bool over = false;
+    if (samples >= kMinLatencySamples) {
+        const uint64_t rank = samples - samples / 100;
+        uint64_t seen = 0;
+        size_t b = 0;
+        for (; b < kLatencyBuckets; ++b) {
+            seen += counts[b];
+            if (seen >= rank) break;
+        }
+        stats_.query_p99_ms = bucketUpperMs(std::min(b, kLatencyBuckets - 1));
+        over = options_.query_p99_target_ms > 0 && stats_.query_p99_ms > options_.query_p99_target_ms;
+    }
+    if (over) {
+        stats_.latency_scale = std::max(kMinScale, stats_.latency_scale * 0.5);
+        stats_.over_target++;
+    } else if (samples < kMinLatencySamples || options_.query_p99_target_ms == 0 ||
+               stats_.query_p99_ms < 0.8 * options_.query_p99_target_ms) {
+        stats_.latency_scale = std::min(1.0, stats_.latency_scale + kRecoverStep);
+    }
+
+    const double budget = static_cast<double>(options_.device_bytes_per_s) * options_.target_utilization;
+    const double foreground = stats_.used_bytes_per_s[index(IOClass::Wal)] +
+                              stats_.used_bytes_per_s[index(IOClass::Query)];
+    const double spare = std::max(0.0, budget - foreground);
+
+    // Flushes first; merges get what flushes leave, and while queries read,
+    // no more than their share
+    const double flush = spare * stats_.latency_scale;
+    const double room = std::max(0.0, spare - std::min(stats_.used_bytes_per_s[index(IOClass::Flush)], flush));
+    const bool querying = moved[index(IOClass::Query)] > 0 || samples > 0;
+    const double ceiling = querying ? std::min(room, static_cast<double>(options_.compaction_bytes_per_s)) : room;
+    const double compaction = ceiling * stats_.latency_scale;
+
+    auto retune = [&](IOClass io_class, double rate, uint64_t floor) {
+        const uint64_t target = std::max(floor, static_cast<uint64_t>(rate));
+        uint64_t& current = stats_.rate_bytes_per_s[index(io_class)];
+        // Skip changes under 1/16, which would only churn the waiters
+        const uint64_t step = std::max<uint64_t>(current / 16, 1);
+        if (target + step <= current || target >= current + step) {
+            // A burst of one interval, so a backlog cannot land all at once
+            const uint64_t burst = std::max<uint64_t>(target / 1000 * options_.interval_ms, kMiB);
+            limiters_[index(io_class)]->setRate(target, burst);
+            current = target;
+        }
+    };
+    retune(IOClass::Flush, flush, options_.flush_floor_bytes_per_s);
+    retune(IOClass::Compaction, compaction, options_.compaction_floor_bytes_per_s);
+    stats_.rebalances++;
+}
+
+void IOManager::reconfigure(const Options& options) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    options_.device_bytes_per_s = std::max<uint64_t>(1, options.device_bytes_per_s);
+    options_.target_utilization = std::clamp(options.target_utilization, 0.05f, 1.0f);
+    options_.compaction_bytes_per_s = std::max(options.compaction_bytes_per_s, options_.compaction_floor_bytes_per_s);
+    options_.query_p99_target_ms = options.query_p99_target_ms;
+}
+
+IOManager::Stats IOManager::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::vector<std::pair<std::string_view, double>> IOManager::metrics() const {
+    const Stats stats = getStats();
+    static constexpr std::string_view kUsed[kClasses] = {
+        "woved_io_wal_mbps", "woved_io_query_mbps", "woved_io_flush_mbps", "woved_io_compaction_mbps"};
+    std::vector<std::pair<std::string_view, double>> out;
+    for (size_t c = 0; c < kClasses; ++c) {
+        out.emplace_back(kUsed[c], stats.used_bytes_per_s[c] / kMiB);
+    }
+    out.emplace_back("woved_io_flush_limit_mbps",
+                     static_cast<double>(stats.rate_bytes_per_s[index(IOClass::Flush)]) / kMiB);
+    out.emplace_back("woved_io_compaction_limit_mbps",
+                     static_cast<double>(stats.rate_bytes_per_s[index(IOClass::Compaction)]) / kMiB);
+    out.emplace_back("woved_io_query_p99_ms", stats.query_p99_ms);
+    out.emplace_back("woved_io_background_scale", stats.latency_scale);
+    return out;
+}
+
+const char* IOManager::name(IOClass io_class) {
+    switch (io_class) {
+        case IOClass::Wal: return "wal";
+        case IOClass::Query: return "query";
+        case IOClass::Flush: return "flush";
+        case IOClass::Compaction: return "compaction";
+    }
+    return "unknown";
+}
+
+} // namespace woved::io
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "io/rate-limiter.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::io {
+
+// Device I/O classes, highest priority first
+enum class IOClass : uint8_t {
+    Wal,
+    Query,        // Segment reads on behalf of queries
+    Flush,        // Buffer to delta segments
+    Compaction,   // Merges and stable builds
+};
+
+// Shares the device's bandwidth between the I/O classes. Each class has
+// its own RateLimiter. Hand limiter(c) to whatever issues that class's I/O
+// (WalManager, SegmentReader, FlushScheduler, SegmentManager,
+// StableBuildScheduler).
+//
+// WAL and query I/O never wait. Their limiters are unlimited and only count
+// bytes. Every interval_ms, rebalance() measures what each class used and
+// retunes the two background classes:
+//  - Foreground use (WAL and query reads) is taken off the device budget,
+//    device_bytes_per_s * target_utilization. What is left is spare.
+//  - Flushes get the spare first. Merges get what flushes leave.
+//  - While queries read, merges are held to compaction_bytes_per_s (their
+//    configured share). When no query has read for an interval, merges
+//    borrow the whole spare.
+//  - Query latency (observeQueryLatency) is a second signal. While the
+//    interval's p99 is above query_p99_target_ms, both background rates
+//    are halved each interval. Once p99 is back below 80% of the target,
+//    they recover a step at a time.
+//  - Neither background class drops below its floor. A flush backlog
+//    stalls writes, and a merge backlog grows the segment count, so both
+//    always make some progress.
+class IOManager {
+public:
+    static constexpr size_t kClasses = 4;
+
+    struct Options {
+        // io.device_bandwidth_mbps; from config, 0 means
+        // merge_bandwidth_limit_mbps / storage.segment.merge_bandwidth_limit
+        uint64_t device_bytes_per_s = 1747626666;
+        float target_utilization = 0.9f;                // io.target_utilization
+        uint64_t compaction_bytes_per_s = 524288000;    // io.merge_bandwidth_limit_mbps
+        uint64_t flush_floor_bytes_per_s = 33554432;    // 32 MiB/s
+        uint64_t compaction_floor_bytes_per_s = 4194304;  // 4 MiB/s
+        uint32_t query_p99_target_ms = 20;              // io.query_p99_target_ms; 0: bandwidth only
+        uint32_t interval_ms = 100;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        std::array<double, kClasses> used_bytes_per_s{};  // Smoothed, per class
+        std::array<uint64_t, kClasses> rate_bytes_per_s{};  // 0: unlimited
+        double query_p99_ms = 0;        // Last interval with enough samples
+        double latency_scale = 1;       // Background rates' share of their budget
+        uint64_t rebalances = 0;
+        uint64_t over_target = 0;       // Intervals with query p99 above the target
+    };
+
+    explicit IOManager(const Options& options);
+    ~IOManager();
+
+    IOManager(const IOManager&) = delete;
+    IOManager& operator=(const IOManager&) = delete;
+
+    std::shared_ptr<RateLimiter> limiter(IOClass io_class) const {
+        return limiters_[static_cast<size_t>(io_class)];
+    }
+
+    // One query's end-to-end latency; lock-free
+    void observeQueryLatency(std::chrono::nanoseconds latency);
+
+    // Run rebalance() every interval_ms on a thread of its own
+    void start();
+    void stop();
+
+    // Measure use since the last call and retune the background limiters
+    void rebalance();
+
+    // Live tuning (config reload): device bandwidth, target utilization,
+    // merge share and query p99 target of `options`, applied by the next
+    // rebalance()
+    void reconfigure(const Options& options);
+
+    Stats getStats() const;
+
+    // Gauges under their exported names (telemetry.metrics)
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+    static const char* name(IOClass io_class);
+
+private:
+    // Quarter-octave latency buckets over microseconds
+    static constexpr size_t kLatencyBuckets = 128;
+    static size_t latencyBucket(uint64_t us);
+    static double bucketUpperMs(size_t bucket);
+
+    Options options_;
+    std::array<std::shared_ptr<RateLimiter>, kClasses> limiters_;
+    std::array<std::atomic<uint64_t>, kLatencyBuckets> latency_{};
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool running_ = false;
+    std::thread thread_;
+    RateLimiter::Clock::time_point last_;
+    std::array<uint64_t, kClasses> last_bytes_{};
+    Stats stats_;
+
+    void loop();
+};
+
+} // namespace woved::io
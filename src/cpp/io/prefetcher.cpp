@@ -0,0 +1,125 @@
+#include "prefetcher.h"
+#include "core/config.h"
+#include "util/thread-pool.h"
+#include <algorithm>
+#include <chrono>
+
+namespace woved::io {
+
+Prefetcher::Options Prefetcher::Options::fromConfig(const Config& config) {
+    Options options;
+    options.enabled = config.query.prefetch_enabled;
+    options.depth = config.query.prefetch_depth;
+    options.threads = config.query.prefetch_threads;
+    return options;
+}
+
+Prefetcher::Prefetcher(const Options& options) : options_(options) {
+    if (options_.enabled && options_.depth > 0) {
+        pool_ = std::make_unique<util::ThreadPool>(std::max(options_.threads, 1u));
+    } else {
+        options_.enabled = false;
+    }
+}
+
+Prefetcher::~Prefetcher() = default;
+
+Prefetcher::Stats Prefetcher::getStats() const {
+    Stats stats;
+    stats.items = items_.load(std::memory_order_relaxed);
+    stats.ahead = ahead_.load(std::memory_order_relaxed);
+    stats.stalls = stalls_.load(std::memory_order_relaxed);
+    stats.stall_ns = stall_ns_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<std::pair<std::string_view, double>> Prefetcher::metrics() const {
+    Stats stats = getStats();
+    return {
+        {"woved_prefetch_stall_ms", static_cast<double>(stats.stall_ns) / 1e6},
+        {"woved_prefetch_stall_ratio",
+         stats.items ? static_cast<double>(stats.stalls) / static_cast<double>(stats.items) : 0.0},
+        {"woved_prefetch_depth", static_cast<double>(depth())},
+    };
+}
+
+Prefetcher::Walk::Walk(Prefetcher& prefetcher, size_t items, LoadFn load)
+    : prefetcher_(prefetcher), state_(std::make_shared<State>()) {
+    state_->slots.assign(items, Slot::Idle);
+    state_->errors.resize(items);
+    state_->load = std::move(load);
+}
+
+Prefetcher::Walk::~Walk() {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->closed = true;
+    state_->changed.wait(lock, [&] { return state_->running == 0; });
+}
+
+void Prefetcher::Walk::run(State& state, size_t i, std::unique_lock<std::mutex>& lock) {
+    state.slots[i] = Slot::Running;
+    state.running++;
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+        state.load(i);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    lock.lock();
+    state.errors[i] = error;
+    state.slots[i] = Slot::Done;
+    state.running--;
+    state.changed.notify_all();
+}
+
+uint64_t Prefetcher::Walk::take(size_t i) {
+    State& state = *state_;
+    const auto start = std::chrono::steady_clock::now();
+
+    // Queue the next depth items; skipped items are never loaded
+    std::vector<size_t> queued;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    const size_t end = std::min(state.slots.size(), i + 1 + prefetcher_.depth());
+    for (size_t j = std::max(issued_, i + 1); j < end; ++j) {
+        if (state.slots[j] != Slot::Idle) continue;
+        state.slots[j] = Slot::Queued;
+        queued.push_back(j);
+    }
+    issued_ = std::max({issued_, end, i + 1});
+    const bool ready = state.slots[i] == Slot::Done;
+    if (!queued.empty()) {
+        lock.unlock();
+        for (size_t j : queued) {
+            prefetcher_.pool_->submit([weak = std::weak_ptr<State>(state_), j] {
+                auto shared = weak.lock();
+                if (!shared) return;
+                std::unique_lock<std::mutex> task_lock(shared->mutex);
+                if (shared->closed || shared->slots[j] != Slot::Queued) return;
+                run(*shared, j, task_lock);
+            });
+        }
+        lock.lock();
+    }
+
+    // Load it here if no worker has picked it up, else wait for the worker
+    if (state.slots[i] == Slot::Idle || state.slots[i] == Slot::Queued) run(state, i, lock);
+    state.changed.wait(lock, [&] { return state.slots[i] == Slot::Done; });
+    std::exception_ptr error = std::exchange(state.errors[i], nullptr);
+    lock.unlock();
+
+    uint64_t waited = 0;
+    prefetcher_.items_.fetch_add(1, std::memory_order_relaxed);
+    if (ready) {
+        prefetcher_.ahead_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        waited = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        prefetcher_.stalls_.fetch_add(1, std::memory_order_relaxed);
+        prefetcher_.stall_ns_.fetch_add(waited, std::memory_order_relaxed);
+    }
+    if (error) std::rethrow_exception(error);
+    return waited;
+}
+
+} // namespace woved::io
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::util {
+class ThreadPool;
+}
+
+namespace woved::io {
+
+// Loads the upcoming items of an ordered walk on its own threads, up to
+// `depth` items ahead of the consumer: while the consumer works on item i,
+// items i + 1 .. i + depth are being read (and whatever the owner's load
+// function does after the read, e.g. building a lookup table). Loads run
+// on a dedicated pool, not the query pool, so a consumer that waits on one
+// never holds up the worker that would run it.
+//
+// take(i) returns once item i is loaded. An item the pool has not started
+// yet is loaded on the consumer's thread instead of waiting in the queue.
+// Time consumers spend in take() for an item that was not ready is stall
+// time: near zero means the depth covers the device's latency; if it grows,
+// the depth (query.prefetch_depth) or threads are too small for the device.
+class Prefetcher {
+public:
+    struct Options {
+        bool enabled = true;     // query.prefetch_enabled; off: every load is inline
+        uint32_t depth = 2;      // query.prefetch_depth
+        uint32_t threads = 2;    // query.prefetch_threads
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        uint64_t items = 0;         // Taken
+        uint64_t ahead = 0;         // Loaded before they were taken
+        uint64_t stalls = 0;        // Taken before they were loaded
+        uint64_t stall_ns = 0;      // Spent waiting in take()
+    };
+
+    explicit Prefetcher(const Options& options);
+    ~Prefetcher();
+
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    uint32_t depth() const { return options_.enabled ? options_.depth : 0; }
+
+    Stats getStats() const;
+
+    // Gauges under their exported names (telemetry.metrics)
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+    // One ordered walk over `items` items. load(i) runs at most once per
+    // item, on the pool or the consumer's thread. Destroying the walk drops
+    // loads not yet started and waits for those running, so `load` may
+    // write into buffers owned by the caller.
+    class Walk {
+    public:
+        using LoadFn = std::function<void(size_t index)>;
+
+        Walk(Prefetcher& prefetcher, size_t items, LoadFn load);
+        ~Walk();
+
+        Walk(const Walk&) = delete;
+        Walk& operator=(const Walk&) = delete;
+
+        // Block until item i is loaded, queueing i + 1 .. i + depth first.
+        // Rethrows what load(i) threw. Returns the nanoseconds waited.
+        uint64_t take(size_t i);
+
+    private:
+        enum class Slot : uint8_t { Idle, Queued, Running, Done };
+
+        struct State {
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::vector<Slot> slots;
+            std::vector<std::exception_ptr> errors;
+            size_t running = 0;
+            bool closed = false;
+            LoadFn load;
+        };
+
+        // Run item i's load on this thread; state->mutex held on entry and exit
+        static void run(State& state, size_t i, std::unique_lock<std::mutex>& lock);
+
+        Prefetcher& prefetcher_;
+        std::shared_ptr<State> state_;
+        size_t issued_ = 0;   // Items [0, issued_) were queued or loaded
+    };
+
+private:
+    Options options_;
+    std::unique_ptr<util::ThreadPool> pool_;
+    std::atomic<uint64_t> items_{0};
+    std::atomic<uint64_t> ahead_{0};
+    std::atomic<uint64_t> stalls_{0};
+    std::atomic<uint64_t> stall_ns_{0};
+};
+
+} // namespace woved::io
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace woved::io {
+
+// Token bucket over bytes for background I/O (flushes, merges). acquire()
+// blocks until the bucket covers the request; a request larger than the
+// burst waits for a full bucket and then drives it negative, so large
+// writes are paced rather than refused. A rate of 0 means unlimited, and
+// then acquire() and charge() only count bytes, without taking the lock.
+//
+// IOManager gives each I/O class its own limiter and retunes their rates
+// from what each class used.
+class RateLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // burst_bytes = 0: one second of rate
+    explicit RateLimiter(uint64_t bytes_per_s, uint64_t burst_bytes = 0)
+        : last_refill_(Clock::now()) {
+        setRate(bytes_per_s, burst_bytes);
+        tokens_ = static_cast<double>(burst_);
+    }
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    void acquire(uint64_t bytes) {
+        if (unlimited_.load(std::memory_order_relaxed)) {
+            granted_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (rate_ > 0) {
+            refill(Clock::now());
+            double need = static_cast<double>(std::min<uint64_t>(bytes, burst_));
+            if (tokens_ >= need) break;
+
+            auto wait = std::chrono::duration<double>((need - tokens_) / rate_);
+            waits_++;
+            changed_.wait_for(lock, wait);
+        }
+        tokens_ -= static_cast<double>(bytes);
+        granted_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // Count I/O that has already run (or must not wait), e.g. a WAL write:
+    // takes the tokens, driving the bucket negative if need be
+    void charge(uint64_t bytes) {
+        granted_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        if (unlimited_.load(std::memory_order_relaxed)) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        refill(Clock::now());
+        tokens_ -= static_cast<double>(bytes);
+    }
+
+    bool tryAcquire(uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (rate_ > 0) {
+            refill(Clock::now());
+            if (tokens_ < static_cast<double>(std::min<uint64_t>(bytes, burst_))) return false;
+        }
+        tokens_ -= static_cast<double>(bytes);
+        granted_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Takes effect for waiting callers at once
+    void setRate(uint64_t bytes_per_s, uint64_t burst_bytes = 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            refill(Clock::now());
+            rate_ = static_cast<double>(bytes_per_s);
+            burst_ = burst_bytes ? burst_bytes : std::max<uint64_t>(bytes_per_s, 1);
+            tokens_ = std::min(tokens_, static_cast<double>(burst_));
+            unlimited_.store(bytes_per_s == 0, std::memory_order_relaxed);
+        }
+        changed_.notify_all();
+    }
+
+    uint64_t rate() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return static_cast<uint64_t>(rate_);
+    }
+
+    struct Stats {
+        uint64_t granted_bytes = 0;
+        uint64_t waits = 0;  // Times a caller had to sleep
+    };
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return {granted_bytes_.load(std::memory_order_relaxed), waits_};
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    double rate_ = 0;  // Bytes/s
+    uint64_t burst_ = 1;
+    double tokens_ = 0;
+    Clock::time_point last_refill_;
+    std::atomic<bool> unlimited_{true};
+    std::atomic<uint64_t> granted_bytes_{0};
+    uint64_t waits_ = 0;
+
+    void refill(Clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+        last_refill_ = now;
+        tokens_ = std::min(static_cast<double>(burst_), tokens_ + elapsed * rate_);
+    }
+};
+
+} // namespace woved::io
@@ -0,0 +1,554 @@
+#include "uring-wrapper.h"
+#include "core/config.h"
+#include "io/buffer-pool.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include "util/numa-aware.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#ifdef WOVED_USE_IOURING
+#include <liburing.h>
+#endif
+
+namespace woved::io {
+
+namespace {
+
+std::string errnoMessage(const std::string& what, int err) {
+    return what + ": " + std::strerror(err);
+}
+
+// Finish a write from `done` bytes in, looping over partial pwritev results
+void writeRemaining(int fd, std::span<const iovec> iov, uint64_t offset, size_t done) {
+    std::vector<iovec> rest(iov.begin(), iov.end());
+    size_t first = 0;
+    while (first < rest.size()) {
+        size_t skip = done;
+        while (first < rest.size() && skip >= rest[first].iov_len) {
+            skip -= rest[first].iov_len;
+            ++first;
+        }
+        if (first == rest.size()) break;
+        rest[first].iov_base = static_cast<std::byte*>(rest[first].iov_base) + skip;
+        rest[first].iov_len -= skip;
+        offset += done;
+
+        int count = static_cast<int>(std::min<size_t>(rest.size() - first, IOV_MAX));
+        ssize_t n = ::pwritev(fd, rest.data() + first, count, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                done = 0;
+                continue;
+            }
+            throw util::IOException(errnoMessage("pwritev", errno));
+        }
+        done = static_cast<size_t>(n);
+    }
+}
+
+// Finish a read from `done` bytes in; past the end of the file reads zeros
+void readRemaining(int fd, void* data, size_t len, uint64_t offset, size_t done) {
+    auto* dst = static_cast<std::byte*>(data);
+    while (done < len) {
+        ssize_t n = ::pread(fd, dst + done, len - done, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw util::IOException(errnoMessage("pread", errno));
+        }
+        if (n == 0) {
+            std::memset(dst + done, 0, len - done);
+            return;
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+void datasync(int fd) {
+    while (::fdatasync(fd) != 0) {
+        if (errno != EINTR) throw util::IOException(errnoMessage("fdatasync", errno));
+    }
+}
+
+// Slots in a ring's file table
+constexpr unsigned kFileSlots = 64;
+
+// Ring whose SQPOLL thread later rings attach to; -1: none yet
+std::atomic<int> g_sqpoll_anchor{-1};
+
+std::mutex g_local_mutex;
+UringWrapper::Options g_local_options;
+
+} // namespace
+
+#ifdef WOVED_USE_IOURING
+struct UringWrapper::Ring {
+    io_uring ring;
+    std::unordered_map<int, unsigned> files;    // fd -> file table slot
+    std::vector<unsigned> free_slots;
+    bool file_table = false;
+    __kernel_timespec timeout{};
+
+    // Point `sqe` at the registered slot of its fd, if any
+    void target(io_uring_sqe* sqe) const {
+        auto it = files.find(sqe->fd);
+        if (it == files.end()) return;
+        sqe->fd = static_cast<int>(it->second);
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+};
+#else
+struct UringWrapper::Ring {};
+#endif
+
+UringWrapper::Options UringWrapper::Options::fromConfig(const IOConfig& io) {
+    Options options;
+    options.enabled = io.use_iouring;
+    options.entries = std::max(1u, io.iouring.queue_depth);
+    options.sqpoll = io.iouring.sqpoll;
+    options.sqpoll_cpu = io.iouring.sqpoll_cpu;
+    options.register_files = io.iouring.register_files;
+    options.link_timeout_ms = io.iouring.link_timeout_ms;
+    return options;
+}
+
+UringWrapper::UringWrapper(unsigned entries)
+    : UringWrapper([entries] {
+          Options options;
+          options.entries = entries;
+          return options;
+      }()) {}
+
+UringWrapper::UringWrapper(const Options& options)
+    : options_(options), entries_(std::max(1u, options.entries)) {
+    // An I/O and its linked timeout take two entries
+    if (options_.link_timeout_ms) entries_ = std::max(entries_, 2u);
+#ifdef WOVED_USE_IOURING
+    if (!options_.enabled) return;
+    auto ring = std::make_unique<Ring>();
+    auto init = [&](bool sqpoll, int attach) {
+        io_uring_params params{};
+        if (sqpoll) {
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = options_.sqpoll_idle_ms;
+            if (options_.sqpoll_cpu >= 0) {
+                params.flags |= IORING_SETUP_SQ_AFF;
+                params.sq_thread_cpu = static_cast<uint32_t>(options_.sqpoll_cpu);
+            }
+        }
+        if (attach >= 0) {
+            params.flags |= IORING_SETUP_ATTACH_WQ;
+            params.wq_fd = static_cast<uint32_t>(attach);
+        }
+        return io_uring_queue_init_params(entries_, &ring->ring, &params);
+    };
+    int rc = -EINVAL;
+    if (options_.sqpoll) {
+        // Share the first ring's poller; that ring may be gone
+        const int anchor = g_sqpoll_anchor.load(std::memory_order_acquire);
+        if (anchor >= 0) rc = init(true, anchor);
+        if (rc < 0) rc = init(true, -1);
+        if (rc == 0) {
+            sqpoll_ = true;
+            int none = -1;
+            if (g_sqpoll_anchor.compare_exchange_strong(none, ring->ring.ring_fd, std::memory_order_acq_rel)) {
+                util::numa_note_placement("io_uring poller",
+                                          options_.sqpoll_cpu >= 0
+                                              ? "CPU " + std::to_string(options_.sqpoll_cpu) + " (node " +
+                                                    std::to_string(util::numa_node_of_cpu(options_.sqpoll_cpu)) + ")"
+                                              : std::string("unpinned"));
+            }
+        } else {
+            LOG_WARN("io_uring SQPOLL unavailable ({}), submitting with syscalls", std::strerror(-rc));
+        }
+    }
+    if (rc < 0) rc = init(false, -1);
+    if (rc == 0) {
+        ring->timeout.tv_sec = options_.link_timeout_ms / 1000;
+        ring->timeout.tv_nsec = static_cast<long long>(options_.link_timeout_ms % 1000) * 1000000;
+        ring_ = std::move(ring);
+    } else {
+        LOG_WARN("io_uring unavailable ({}), using pwritev + fdatasync", std::strerror(-rc));
+    }
+#endif
+}
+
+UringWrapper::~UringWrapper() {
+#ifdef WOVED_USE_IOURING
+    if (ring_) {
+        int fd = ring_->ring.ring_fd;
+        g_sqpoll_anchor.compare_exchange_strong(fd, -1, std::memory_order_acq_rel);
+        io_uring_queue_exit(&ring_->ring);
+    }
+#endif
+}
+
+void UringWrapper::setLocalOptions(const Options& options) {
+    std::lock_guard lock(g_local_mutex);
+    g_local_options = options;
+}
+
+UringWrapper& UringWrapper::local() {
+    thread_local UringWrapper ring([] {
+        std::lock_guard lock(g_local_mutex);
+        return g_local_options;
+    }());
+    // Reads into pooled buffers go out as fixed-buffer I/O
+    thread_local bool registered = ring.registerBuffers(BufferPool::global().regions());
+    (void)registered;
+    return ring;
+}
+
+bool UringWrapper::registerFile(int fd) {
+#ifdef WOVED_USE_IOURING
+    if (!ring_ || !options_.register_files || fd < 0) return false;
+    if (ring_->files.count(fd)) return true;
+    if (!ring_->file_table) {
+        int rc = io_uring_register_files_sparse(&ring_->ring, kFileSlots);
+        if (rc < 0) {
+            LOG_WARN("io_uring file registration failed ({}), using plain fds", std::strerror(-rc));
+            options_.register_files = false;
+            return false;
+        }
+        ring_->file_table = true;
+        for (unsigned slot = kFileSlots; slot-- > 0;) ring_->free_slots.push_back(slot);
+    }
+    if (ring_->free_slots.empty()) return false;
+    const unsigned slot = ring_->free_slots.back();
+    if (io_uring_register_files_update(&ring_->ring, slot, &fd, 1) < 0) return false;
+    ring_->free_slots.pop_back();
+    ring_->files.emplace(fd, slot);
+    return true;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
+void UringWrapper::unregisterFile(int fd) {
+#ifdef WOVED_USE_IOURING
+    if (!ring_) return;
+    auto it = ring_->files.find(fd);
+    if (it == ring_->files.end()) return;
+    int none = -1;
+    io_uring_register_files_update(&ring_->ring, it->second, &none, 1);
+    ring_->free_slots.push_back(it->second);
+    ring_->files.erase(it);
+#else
+    (void)fd;
+#endif
+}
+
+#ifdef WOVED_USE_IOURING
+namespace {
+
+// Submit the write prepared by `prep`, linked to an fdatasync when `sync`,
+// and wait for both. Returns bytes written; throws on errors.
+template <typename Ring, typename Prep>
+size_t submitLinked(Ring& r, int fd, bool sync, Prep&& prep) {
+    io_uring* ring = &r.ring;
+    io_uring_sqe* sqe = io_uring_get_sqe(ring);
+    prep(sqe);
+    r.target(sqe);
+    sqe->user_data = 0;
+    unsigned submitted = 1;
+    if (sync) {
+        sqe->flags |= IOSQE_IO_LINK;
+        sqe = io_uring_get_sqe(ring);
+        io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+        r.target(sqe);
+        sqe->user_data = 1;
+        submitted = 2;
+    }
+
+    int rc;
+    do {
+        rc = io_uring_submit_and_wait(ring, submitted);
+    } while (rc == -EINTR);
+    if (rc < 0) throw util::IOException(errnoMessage("io_uring_submit", -rc));
+
+    int write_res = 0;
+    int sync_res = 0;
+    for (unsigned i = 0; i < submitted; ++i) {
+        io_uring_cqe* cqe = nullptr;
+        do {
+            rc = io_uring_wait_cqe(ring, &cqe);
+        } while (rc == -EINTR);
+        if (rc < 0) throw util::IOException(errnoMessage("io_uring_wait_cqe", -rc));
+        (cqe->user_data == 0 ? write_res : sync_res) = cqe->res;
+        io_uring_cqe_seen(ring, cqe);
+    }
+
+    if (write_res < 0) throw util::IOException(errnoMessage("write", -write_res));
+    // A short write cancels the linked fsync; the caller finishes inline
+    if (sync_res < 0 && sync_res != -ECANCELED) {
+        throw util::IOException(errnoMessage("fdatasync", -sync_res));
+    }
+    return static_cast<size_t>(write_res);
+}
+
+} // namespace
+#endif
+
+void UringWrapper::writeLinked(int fd, std::span<const iovec> iov, uint64_t offset, bool sync) {
+#ifdef WOVED_USE_IOURING
+    if (ring_ && iov.size() <= IOV_MAX) {
+        size_t total = 0;
+        for (const auto& v : iov) total += v.iov_len;
+        size_t done = submitLinked(*ring_, fd, sync, [&](io_uring_sqe* sqe) {
+            io_uring_prep_writev(sqe, fd, iov.data(), static_cast<unsigned>(iov.size()), offset);
+        });
+        if (done < total) {
+            writeRemaining(fd, iov, offset, done);
+            if (sync) datasync(fd);
+        }
+        return;
+    }
+#endif
+
+    writeRemaining(fd, iov, offset, 0);
+    if (sync) datasync(fd);
+}
+
+bool UringWrapper::registerBuffers(std::span<const iovec> buffers) {
+#ifdef WOVED_USE_IOURING
+    if (ring_ && !buffers.empty()) {
+        int rc = io_uring_register_buffers(&ring_->ring, buffers.data(),
+                                           static_cast<unsigned>(buffers.size()));
+        if (rc == 0) {
+            fixed_buffers_ = true;
+            registered_.clear();
+            for (size_t i = 0; i < buffers.size(); ++i) {
+                registered_.push_back({static_cast<const std::byte*>(buffers[i].iov_base),
+                                       buffers[i].iov_len, static_cast<unsigned>(i)});
+            }
+            std::sort(registered_.begin(), registered_.end(),
+                      [](const Registered& a, const Registered& b) { return a.base < b.base; });
+            return true;
+        }
+        LOG_WARN("io_uring buffer registration failed ({}), using unregistered writes",
+                 std::strerror(-rc));
+    }
+#else
+    (void)buffers;
+#endif
+    return false;
+}
+
+void UringWrapper::writeFixed(int fd, unsigned index, const std::byte* data, size_t len,
+                              uint64_t offset, bool sync) {
+    iovec iov{const_cast<std::byte*>(data), len};
+#ifdef WOVED_USE_IOURING
+    if (fixed_buffers_) {
+        size_t done = submitLinked(*ring_, fd, sync, [&](io_uring_sqe* sqe) {
+            io_uring_prep_write_fixed(sqe, fd, data, static_cast<unsigned>(len), offset, index);
+        });
+        if (done < len) {
+            writeRemaining(fd, std::span<const iovec>(&iov, 1), offset, done);
+            if (sync) datasync(fd);
+        }
+        return;
+    }
+#else
+    (void)index;
+#endif
+    writeLinked(fd, std::span<const iovec>(&iov, 1), offset, sync);
+}
+
+void UringWrapper::sync(int fd) {
+    datasync(fd);
+}
+
+void UringWrapper::submitWrite(int fd, const void* data, size_t len, uint64_t offset, uint64_t tag) {
+    submit(PendingIo{fd, const_cast<void*>(data), len, offset, false}, tag);
+}
+
+void UringWrapper::submitRead(int fd, void* data, size_t len, uint64_t offset, uint64_t tag) {
+    submit(PendingIo{fd, data, len, offset, true}, tag);
+}
+
+void UringWrapper::submitWrite(int fd, const void* data, size_t len, uint64_t offset, Completion done) {
+    submit(PendingIo{fd, const_cast<void*>(data), len, offset, false}, std::move(done));
+}
+
+void UringWrapper::submitRead(int fd, void* data, size_t len, uint64_t offset, Completion done) {
+    submit(PendingIo{fd, data, len, offset, true}, std::move(done));
+}
+
+void UringWrapper::submit(const PendingIo& io, Completion done) {
+    const uint64_t tag = kCompletionTag | next_completion_;
+    next_completion_ = (next_completion_ + 1) % ((uint64_t{1} << 62) - 1);
+    completions_.emplace(tag, std::move(done));
+    try {
+        submit(io, tag);
+    } catch (const util::IOException&) {
+        // Failed inline (no ring): report it like a failed completion
+        completed_.emplace_back(tag, EIO);
+    } catch (...) {
+        completions_.erase(tag);
+        throw;
+    }
+}
+
+int UringWrapper::fixedIndex(const void* data, size_t len) const {
+    if (registered_.empty()) return -1;
+    const auto* p = static_cast<const std::byte*>(data);
+    auto it = std::upper_bound(registered_.begin(), registered_.end(), p,
+                               [](const std::byte* q, const Registered& r) { return q < r.base; });
+    if (it == registered_.begin()) return -1;
+    --it;
+    return p + len <= it->base + it->len ? static_cast<int>(it->index) : -1;
+}
+
+void UringWrapper::submit(const PendingIo& io, uint64_t tag) {
+#ifdef WOVED_USE_IOURING
+    if (ring_) {
+        const bool timed = options_.link_timeout_ms > 0;
+        const size_t per_io = timed ? 2 : 1;
+        // Completions reaped to make room are reported by the next reap()
+        while (!pending_.empty() && (pending_.size() + 1) * per_io > entries_) reapRing(1, nullptr, true);
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring_->ring);
+        const int index = fixedIndex(io.data, io.len);
+        if (index >= 0 && io.read) {
+            io_uring_prep_read_fixed(sqe, io.fd, io.data, static_cast<unsigned>(io.len), io.offset, index);
+        } else if (index >= 0) {
+            io_uring_prep_write_fixed(sqe, io.fd, io.data, static_cast<unsigned>(io.len), io.offset, index);
+        } else if (io.read) {
+            io_uring_prep_read(sqe, io.fd, io.data, static_cast<unsigned>(io.len), io.offset);
+        } else {
+            io_uring_prep_write(sqe, io.fd, io.data, static_cast<unsigned>(io.len), io.offset);
+        }
+        ring_->target(sqe);
+        sqe->user_data = tag;
+        if (timed) {
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe* timeout = io_uring_get_sqe(&ring_->ring);
+            io_uring_prep_link_timeout(timeout, &ring_->timeout, 0);
+            timeout->user_data = kTimeoutTag;
+        }
+        int rc;
+        do {
+            rc = io_uring_submit(&ring_->ring);
+        } while (rc == -EINTR);
+        if (rc < 0) throw util::IOException(errnoMessage("io_uring_submit", -rc));
+        pending_.emplace(tag, io);
+        return;
+    }
+#endif
+    if (io.read) {
+        readRemaining(io.fd, io.data, io.len, io.offset, 0);
+    } else {
+        iovec iov{io.data, io.len};
+        writeRemaining(io.fd, std::span<const iovec>(&iov, 1), io.offset, 0);
+    }
+    completed_.emplace_back(tag, 0);
+}
+
+void UringWrapper::finish(uint64_t tag, int error, const std::function<void(uint64_t tag)>& done) {
+    if (!internalTag(tag)) {
+        done(tag);
+        return;
+    }
+    auto it = completions_.find(tag);
+    if (it == completions_.end()) return;
+    Completion completion = std::move(it->second);
+    completions_.erase(it);
+    completion(error);
+}
+
+size_t UringWrapper::reap(size_t min, const std::function<void(uint64_t tag)>& done) {
+    size_t count = 0;
+    while (!completed_.empty()) {
+        const auto [tag, error] = completed_.front();
+        completed_.pop_front();
+        finish(tag, error, done);
+        count++;
+    }
+    return count + reapRing(min > count ? min - count : 0, done);
+}
+
+size_t UringWrapper::reapRing(size_t min, const std::function<void(uint64_t tag)>& done, bool defer) {
+    size_t count = 0;
+#ifdef WOVED_USE_IOURING
+    std::string error;
+    while (ring_ && !pending_.empty()) {
+        io_uring_cqe* cqe = nullptr;
+        int rc;
+        if (count < min) {
+            do {
+                rc = io_uring_wait_cqe(&ring_->ring, &cqe);
+            } while (rc == -EINTR);
+        } else {
+            rc = io_uring_peek_cqe(&ring_->ring, &cqe);
+            if (rc == -EAGAIN) break;
+        }
+        if (rc < 0) throw util::IOException(errnoMessage("io_uring_wait_cqe", -rc));
+
+        const uint64_t tag = cqe->user_data;
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring_->ring, cqe);
+        auto it = pending_.find(tag);
+        if (it == pending_.end()) continue;  // A linked timeout's own completion
+        PendingIo io = it->second;
+        pending_.erase(it);
+
+        // The linked timeout fired and cancelled the I/O
+        if (res == -ECANCELED && options_.link_timeout_ms) res = -ETIMEDOUT;
+        int failed = res < 0 ? -res : 0;
+        if (res >= 0 && static_cast<size_t>(res) < io.len) {
+            try {
+                if (io.read) {
+                    readRemaining(io.fd, io.data, io.len, io.offset, static_cast<size_t>(res));
+                } else {
+                    iovec iov{io.data, io.len};
+                    writeRemaining(io.fd, std::span<const iovec>(&iov, 1), io.offset,
+                                   static_cast<size_t>(res));
+                }
+            } catch (const util::IOException& e) {
+                // Reported like any failure, so callers counting tags see it
+                failed = EIO;
+                if (!internalTag(tag) && error.empty()) error = e.what();
+            }
+        }
+        if (failed && !internalTag(tag) && error.empty()) {
+            error = errnoMessage(io.read ? "read" : "write", failed);
+        }
+        if (defer) {
+            completed_.emplace_back(tag, failed);
+        } else {
+            finish(tag, failed, done);
+        }
+        count++;
+    }
+    if (!error.empty()) throw util::IOException(error);
+#else
+    (void)min;
+    (void)done;
+    (void)defer;
+#endif
+    return count;
+}
+
+void UringWrapper::Awaitable::await_suspend(std::coroutine_handle<> handle) {
+    Completion resume = [this, handle](int error) {
+        error_ = error;
+        handle.resume();
+    };
+    if (read_) {
+        ring_.submitRead(fd_, data_, len_, offset_, std::move(resume));
+    } else {
+        ring_.submitWrite(fd_, data_, len_, offset_, std::move(resume));
+    }
+}
+
+void UringWrapper::Awaitable::await_resume() const {
+    if (error_) throw util::IOException(errnoMessage(read_ ? "read" : "write", error_));
+}
+
+} // namespace woved::io
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+
+namespace woved {
+struct IOConfig;
+}
+
+namespace woved::io {
+
+// Single-owner io_uring for ordered durable writes. A write and the
+// fdatasync that must follow it go out as one linked chain (IOSQE_IO_LINK),
+// so the committer pays one submission and one wakeup per group commit.
+//
+// Streaming writers and batched readers use the asynchronous calls instead:
+// submitWrite() or submitRead() queues the I/O and returns, and reap()
+// collects completions, so several chunks stay in flight up to the ring
+// size. The synchronous calls reap any completion they see, so a wrapper
+// is used one way or the other while asynchronous I/O is in flight.
+//
+// A queued I/O reports its completion one of three ways, all delivered
+// by reap() on the thread that calls it:
+//  - a tag, passed to reap()'s `done`
+//  - a Completion callback, given the I/O's errno (0 on success)
+//  - a coroutine resumed from `co_await ring.read(...)`, which throws
+//    util::IOException on failure
+//
+// Options (io.iouring) add, where the kernel allows them:
+//  - sqpoll: a kernel thread polls the submission queue, so a submit
+//    is a store rather than a syscall. Rings with it share one poller
+//    thread (IORING_SETUP_ATTACH_WQ). sqpoll_cpu pins that thread to a
+//    CPU (IORING_SETUP_SQ_AFF), best kept on the node of the devices and
+//    of the threads that submit.
+//  - register_files: registerFile() puts a long-lived fd in the ring's
+//    file table, and its I/O skips the per-request file lookup.
+//  - link_timeout_ms: every queued I/O carries a linked timeout. One the
+//    device has not completed by then is cancelled and fails with
+//    ETIMEDOUT.
+//
+// local() is the calling thread's own ring, built from setLocalOptions().
+// Segment reads (rerank, prefetched list loads) share it, so a thread
+// keeps one ring however many segments it reads. It registers the
+// BufferPool arenas, so reads into pooled buffers are fixed-buffer I/O. The WAL and segment
+// writers keep rings of their own, because their linked write and sync
+// chains must not wait behind other I/O. Tag-based I/O on the local ring
+// must be reaped before the caller returns; callback and coroutine I/O may
+// stay in flight. Tags from 2^63 to 2^63 + 2^62 are the wrapper's own.
+//
+// Without WOVED_USE_IOURING, or when the kernel refuses to set up a ring,
+// the same calls run as pwritev, pread and fdatasync on the calling thread
+// (queued I/O completes inside the submit call).
+class UringWrapper {
+public:
+    struct Options {
+        bool enabled = true;            // io.use_iouring; off: synchronous calls
+        unsigned entries = 64;          // io.iouring.queue_depth
+        bool sqpoll = false;            // io.iouring.sqpoll
+        uint32_t sqpoll_idle_ms = 50;   // Before the poller thread sleeps
+        int sqpoll_cpu = -1;            // io.iouring.sqpoll_cpu; -1: unpinned
+        bool register_files = false;    // io.iouring.register_files
+        uint32_t link_timeout_ms = 0;   // io.iouring.link_timeout_ms; 0: none
+
+        static Options fromConfig(const IOConfig& io);
+    };
+
+    // errno of the I/O, 0 on success
+    using Completion = std::function<void(int error)>;
+
+    // co_await of one read or write: suspends until reap() sees it
+    // complete and resumes there
+    class Awaitable {
+    public:
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        // Throws util::IOException if the I/O failed
+        void await_resume() const;
+
+    private:
+        friend class UringWrapper;
+        Awaitable(UringWrapper& ring, int fd, void* data, size_t len, uint64_t offset, bool read)
+            : ring_(ring), fd_(fd), data_(data), len_(len), offset_(offset), read_(read) {}
+
+        UringWrapper& ring_;
+        int fd_;
+        void* data_;
+        size_t len_;
+        uint64_t offset_;
+        bool read_;
+        int error_ = 0;
+    };
+
+    explicit UringWrapper(unsigned entries = 64);
+    explicit UringWrapper(const Options& options);
+    ~UringWrapper();
+
+    // Options of the rings local() builds from here on; set at startup
+    static void setLocalOptions(const Options& options);
+    // The calling thread's ring
+    static UringWrapper& local();
+
+    UringWrapper(const UringWrapper&) = delete;
+    UringWrapper& operator=(const UringWrapper&) = delete;
+
+    // Write `iov` at `offset`, then fdatasync when `sync`; blocks until both
+    // are complete. Short writes are finished synchronously. Throws
+    // util::IOException on failure.
+    void writeLinked(int fd, std::span<const iovec> iov, uint64_t offset, bool sync);
+
+    // Register long-lived buffers for fixed writes. Returns false (and
+    // writeFixed() falls back to plain writes) if the kernel refuses, e.g.
+    // over RLIMIT_MEMLOCK. Queued reads and writes that lie inside one of
+    // them go out as fixed-buffer I/O.
+    bool registerBuffers(std::span<const iovec> buffers);
+
+    // writeLinked() for `len` bytes at `data`, which lies inside registered
+    // buffer `index`: the kernel skips per-write page pinning
+    void writeFixed(int fd, unsigned index, const std::byte* data, size_t len, uint64_t offset,
+                    bool sync);
+
+    // fdatasync alone (e.g. before closing a rotated file)
+    void sync(int fd);
+
+    // Put `fd` in the ring's file table (Options::register_files); false
+    // if the ring has none or it is full, and the fd is used as is.
+    // Unregister before closing it, with none of its I/O in flight.
+    bool registerFile(int fd);
+    void unregisterFile(int fd);
+
+    // Queue a write of `len` bytes at `offset`; `data` must stay valid until
+    // reap() reports `tag`. Waits for a completion when the ring is full.
+    void submitWrite(int fd, const void* data, size_t len, uint64_t offset, uint64_t tag);
+
+    // Queue a read into `data`; bytes past the end of the file read as zero
+    void submitRead(int fd, void* data, size_t len, uint64_t offset, uint64_t tag);
+
+    // As above, reporting to `done` instead of a tag; a failure goes to
+    // `done` rather than being thrown from reap()
+    void submitWrite(int fd, const void* data, size_t len, uint64_t offset, Completion done);
+    void submitRead(int fd, void* data, size_t len, uint64_t offset, Completion done);
+
+    // `co_await ring.read(...)`: submitRead() resuming the coroutine
+    Awaitable read(int fd, void* data, size_t len, uint64_t offset) {
+        return Awaitable(*this, fd, data, len, offset, true);
+    }
+    Awaitable write(int fd, const void* data, size_t len, uint64_t offset) {
+        return Awaitable(*this, fd, const_cast<void*>(data), len, offset, false);
+    }
+
+    // Wait until at least `min` queued I/Os complete (fewer if fewer are
+    // in flight) and pass each tag to `done`, or run its Completion;
+    // returns how many completed. Short transfers are finished
+    // synchronously before they are reported. Throws util::IOException
+    // once the batch is reported if any tagged I/O failed.
+    size_t reap(size_t min, const std::function<void(uint64_t tag)>& done);
+
+    size_t inFlight() const { return pending_.size() + completed_.size(); }
+
+    bool usingRing() const { return ring_ != nullptr; }
+    bool usingFixedBuffers() const { return fixed_buffers_; }
+    bool usingSqPoll() const { return sqpoll_; }
+
+private:
+    struct Ring;
+    struct PendingIo {
+        int fd;
+        void* data;
+        size_t len;
+        uint64_t offset;
+        bool read;
+    };
+
+    // Tags of Completion I/O: 0b10 in the top bits
+    static constexpr uint64_t kCompletionTag = uint64_t{1} << 63;
+    static constexpr uint64_t kTimeoutTag = kCompletionTag | ((uint64_t{1} << 62) - 1);
+    static bool internalTag(uint64_t tag) { return (tag >> 62) == 2; }
+
+    std::unique_ptr<Ring> ring_;
+    Options options_;
+    unsigned entries_;
+    bool fixed_buffers_ = false;
+    bool sqpoll_ = false;
+    uint64_t next_completion_ = 0;
+    std::unordered_map<uint64_t, PendingIo> pending_;     // Submitted to the ring
+    std::unordered_map<uint64_t, Completion> completions_;
+    std::deque<std::pair<uint64_t, int>> completed_;      // Finished, not yet reaped: tag, errno
+
+    struct Registered {
+        const std::byte* base;
+        size_t len;
+        unsigned index;
+    };
+    std::vector<Registered> registered_;  // Sorted by base
+
+    // Registered buffer holding [data, data + len), or -1
+    int fixedIndex(const void* data, size_t len) const;
+
+    void submit(const PendingIo& io, uint64_t tag);
+    void submit(const PendingIo& io, Completion done);
+    // Report one finished I/O: its Completion, or `done`
+    void finish(uint64_t tag, int error, const std::function<void(uint64_t tag)>& done);
+    // `defer`: queue every completion for the next reap() instead
+    size_t reapRing(size_t min, const std::function<void(uint64_t tag)>& done, bool defer = false);
+};
+
+} // namespace woved::io
@@ -0,0 +1,160 @@
+#include "util/simd-dispatch.h"
+#include "util/logging.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+
+namespace woved::kernels {
+
+namespace {
+
+const DistanceTable& resolve() {
+    switch (util::best_cpu_level()) {
+        case util::CpuLevel::AVX512:
+#ifdef WOVED_KERNELS_AVX512
+            return avx512::table;
+#endif
+            [[fallthrough]];
+        case util::CpuLevel::AVX2:
+#ifdef WOVED_KERNELS_AVX2
+            return avx2::table;
+#endif
+            [[fallthrough]];
+        case util::CpuLevel::SVE:
+#ifdef WOVED_KERNELS_SVE
+            return sve::table;
+#endif
+            [[fallthrough]];
+        case util::CpuLevel::NEON:
+#ifdef WOVED_KERNELS_NEON
+            return neon::table;
+#endif
+            [[fallthrough]];
+        case util::CpuLevel::BASE:
+            break;
+    }
+    return base::table;
+}
+
+#ifdef WOVED_KERNELS_AMX
+// Sapphire Rapids and later: the AVX-512 table with int8 and bf16 batch
+// kernels on VNNI, AVX512-BF16 and, once the OS grants tile state, AMX
+const DistanceTable& extend(const DistanceTable& t) {
+    static DistanceTable patched;
+    static std::string isa;
+    const auto& f = util::cpu_features();
+    if (&t != &avx512::table || !f.avx512bw || !f.avx512vl) return t;
+    patched = t;
+    isa = t.isa;
+    const bool amx = util::request_amx();
+    if (f.avx512vnni) {
+        const EncodedBatchKernels& k = amx && f.amx_int8 ? amx::int8_tiles : amx::int8_vnni;
+        patched.int8.inner_product_block = k.inner_product_block;
+        patched.int8.inner_product_matrix = k.inner_product_matrix;
+        isa += amx && f.amx_int8 ? "+amx-int8" : "+vnni";
+    }
+    if (f.avx512bf16) {
+        const EncodedBatchKernels& k = amx && f.amx_bf16 ? amx::bf16_tiles : amx::bf16_dot;
+        patched.bf16.inner_product_block = k.inner_product_block;
+        patched.bf16.inner_product_matrix = k.inner_product_matrix;
+        isa += amx && f.amx_bf16 ? "+amx-bf16" : "+bf16";
+    }
+    patched.isa = isa.c_str();
+    return patched;
+}
+#endif
+
+const DistanceTable& generic_table() {
+    static const DistanceTable& table = [] () -> const DistanceTable& {
+#ifdef WOVED_KERNELS_AMX
+        const DistanceTable& t = extend(resolve());
+#else
+        const DistanceTable& t = resolve();
+#endif
+        LOG_INFO("Distance kernels: {}", t.isa);
+        return t;
+    }();
+    return table;
+}
+
+// The fixed-dim kernels of the table resolve() picks; the ARM tables
+// have none
+const FixedDimKernels* fixed_kernels() {
+    switch (util::best_cpu_level()) {
+        case util::CpuLevel::AVX512:
+#ifdef WOVED_KERNELS_AVX512
+            return avx512::fixed_dims;
+#endif
+            [[fallthrough]];
+        case util::CpuLevel::AVX2:
+#ifdef WOVED_KERNELS_AVX2
+            return avx2::fixed_dims;
+#endif
+            [[fallthrough]];
+        case util::CpuLevel::SVE:
+#ifdef WOVED_KERNELS_SVE
+            return nullptr;
+#endif
+            [[fallthrough]];
+        case util::CpuLevel::NEON:
+#ifdef WOVED_KERNELS_NEON
+            return nullptr;
+#endif
+            [[fallthrough]];
+        case util::CpuLevel::BASE:
+            break;
+    }
+    return base::fixed_dims;
+}
+
+std::atomic<const DistanceTable*> selected{nullptr};
+
+} // namespace
+
+const DistanceTable& distance_table() {
+    const DistanceTable* t = selected.load(std::memory_order_acquire);
+    return t ? *t : generic_table();
+}
+
+void select_dimension(size_t dim) {
+    // One table per fixed dim, built on first selection and never freed:
+    // callers hold references across a later selection
+    static std::mutex mutex;
+    static DistanceTable tables[kFixedDimCount];
+    static std::string isas[kFixedDimCount];
+    static bool built[kFixedDimCount] = {};
+
+    const DistanceTable& generic = generic_table();
+    const FixedDimKernels* fixed = fixed_kernels();
+    size_t slot = 0;
+    while (slot < kFixedDimCount && kFixedDims[slot] != dim) ++slot;
+    if (!fixed || slot == kFixedDimCount) {
+        selected.store(&generic, std::memory_order_release);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!built[slot]) {
+        // fp32 kernels for the dim over the resolved table, which keeps
+        // any patched encoded kernels
+        const FixedDimKernels& k = fixed[slot];
+        DistanceTable& t = tables[slot];
+        t = generic;
+        t.inner_product = k.inner_product;
+        t.l2_sqr = k.l2_sqr;
+        t.inner_product_batch = k.inner_product_batch;
+        t.l2_sqr_batch = k.l2_sqr_batch;
+        t.inner_product_block = k.inner_product_block;
+        t.l2_sqr_block = k.l2_sqr_block;
+        t.inner_product_matrix = k.inner_product_matrix;
+        t.l2_sqr_matrix = k.l2_sqr_matrix;
+        t.scan_list = k.scan_list;
+        isas[slot] = std::string(generic.isa) + "/d" + std::to_string(dim);
+        t.isa = isas[slot].c_str();
+        built[slot] = true;
+        LOG_INFO("Distance kernels: {}", t.isa);
+    }
+    selected.store(&tables[slot], std::memory_order_release);
+}
+
+} // namespace woved::kernels
@@ -0,0 +1,259 @@
+#include "util/simd-dispatch.h"
+#include "util/vector-codec.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace woved::kernels::amx {
+
+namespace {
+
+// Below this many queries a matrix call runs the block kernel per query:
+// a tile pass costs its setup and fills at most 16 rows
+constexpr size_t kTileMinQueries = 4;
+constexpr size_t kTileRows = 16;
+constexpr size_t kTileBytes = 64;
+
+inline __mmask64 byteMask(size_t remaining) {
+    return remaining >= 64 ? ~__mmask64(0) : (__mmask64(1) << remaining) - 1;
+}
+
+inline __mmask32 wordMask(size_t remaining) {
+    return remaining >= 32 ? ~__mmask32(0) : (__mmask32(1) << remaining) - 1;
+}
+
+inline __m512bh asBf16(__m512i v) { return (__m512bh)v; }
+
+// Symmetric int8 like util::encode_vector(), zero-padded to `padded`;
+// returns the scale
+float quantizeInt8(const float* x, size_t dim, size_t padded, int8_t* out) {
+    float max_abs = 0.0f;
+    for (size_t i = 0; i < dim; ++i) max_abs = std::max(max_abs, std::fabs(x[i]));
+    const float scale = max_abs / 127.0f;
+    const float inv = scale > 0.0f ? 1.0f / scale : 0.0f;
+    for (size_t i = 0; i < dim; ++i) {
+        out[i] = static_cast<int8_t>(std::clamp(std::nearbyint(x[i] * inv), -127.0f, 127.0f));
+    }
+    std::memset(out + dim, 0, padded - dim);
+    return scale;
+}
+
+void toBf16(const float* x, size_t dim, size_t padded, uint16_t* out) {
+    for (size_t i = 0; i < dim; ++i) out[i] = util::float_to_bf16(x[i]);
+    std::fill(out + dim, out + padded, uint16_t{0});
+}
+
+int32_t int8SqrNorm(const int8_t* v, size_t dim) {
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < dim; i += 64) {
+        __m512i a = _mm512_abs_epi8(_mm512_maskz_loadu_epi8(byteMask(dim - i), v + i));
+        acc = _mm512_dpbusd_epi32(acc, a, a);
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+
+float bf16SqrNorm(const uint16_t* v, size_t dim) {
+    __m512 acc = _mm512_setzero_ps();
+    for (size_t i = 0; i < dim; i += 32) {
+        __m512bh x = asBf16(_mm512_maskz_loadu_epi16(wordMask(dim - i), v + i));
+        acc = _mm512_dpbf16_ps(acc, x, x);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+// VNNI: the query's magnitudes are the unsigned operand of vpdpbusd and
+// its signs are moved onto the vector's bytes (stored int8 never holds
+// -128, so negation cannot overflow). Four vectors per query load.
+void int8Block(const float* query, const void* vectors, const float* scales, size_t count, size_t dim,
+               float* out, float* sqr_norms) {
+    thread_local std::vector<int8_t> q;
+    const size_t padded = (dim + 63) / 64 * 64;
+    q.resize(padded);
+    const float qscale = quantizeInt8(query, dim, padded, q.data());
+    const auto* rows = static_cast<const int8_t*>(vectors);
+    const __m512i zero = _mm512_setzero_si512();
+    for (size_t b = 0; b < count; b += 4) {
+        const size_t n = std::min<size_t>(4, count - b);
+        __m512i acc[4] = {zero, zero, zero, zero};
+        __m512i nrm[4] = {zero, zero, zero, zero};
+        for (size_t i = 0; i < dim; i += 64) {
+            const __mmask64 m = byteMask(dim - i);
+            const __m512i qi = _mm512_loadu_si512(q.data() + i);
+            const __m512i mag = _mm512_abs_epi8(qi);
+            const __mmask64 neg = _mm512_movepi8_mask(qi);
+            for (size_t j = 0; j < n; ++j) {
+                __m512i x = _mm512_maskz_loadu_epi8(m, rows + (b + j) * dim + i);
+                if (sqr_norms) {
+                    const __m512i ax = _mm512_abs_epi8(x);
+                    nrm[j] = _mm512_dpbusd_epi32(nrm[j], ax, ax);
+                }
+                x = _mm512_mask_sub_epi8(x, neg, zero, x);
+                acc[j] = _mm512_dpbusd_epi32(acc[j], mag, x);
+            }
+        }
+        for (size_t j = 0; j < n; ++j) {
+            const float vscale = scales ? scales[b + j] : 1.0f;
+            out[b + j] = static_cast<float>(_mm512_reduce_add_epi32(acc[j])) * qscale * vscale;
+            if (sqr_norms) sqr_norms[b + j] = static_cast<float>(_mm512_reduce_add_epi32(nrm[j])) * vscale * vscale;
+        }
+    }
+}
+
+// AVX512-BF16: the query is rounded to bf16 and vdpbf16ps sums pairs of
+// products in fp32
+void bf16Block(const float* query, const void* vectors, const float* scales, size_t count, size_t dim,
+               float* out, float* sqr_norms) {
+    thread_local std::vector<uint16_t> q;
+    const size_t padded = (dim + 31) / 32 * 32;
+    q.resize(padded);
+    toBf16(query, dim, padded, q.data());
+    const auto* rows = static_cast<const uint16_t*>(vectors);
+    for (size_t b = 0; b < count; b += 4) {
+        const size_t n = std::min<size_t>(4, count - b);
+        __m512 acc[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+        __m512 nrm[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+        for (size_t i = 0; i < dim; i += 32) {
+            const __mmask32 m = wordMask(dim - i);
+            const __m512bh qb = asBf16(_mm512_loadu_si512(q.data() + i));
+            for (size_t j = 0; j < n; ++j) {
+                const __m512bh x = asBf16(_mm512_maskz_loadu_epi16(m, rows + (b + j) * dim + i));
+                acc[j] = _mm512_dpbf16_ps(acc[j], qb, x);
+                if (sqr_norms) nrm[j] = _mm512_dpbf16_ps(nrm[j], x, x);
+            }
+        }
+        for (size_t j = 0; j < n; ++j) {
+            const float vscale = scales ? scales[b + j] : 1.0f;
+            out[b + j] = _mm512_reduce_add_ps(acc[j]) * vscale;
+            if (sqr_norms) sqr_norms[b + j] = _mm512_reduce_add_ps(nrm[j]) * vscale * vscale;
+        }
+    }
+}
+
+template <EncodedBlockFn Block>
+void blockMatrix(const float* queries, size_t nq, const void* vectors, const float* scales, size_t count,
+                 size_t dim, float* out, float* sqr_norms) {
+    for (size_t q = 0; q < nq; ++q) {
+        Block(queries + q * dim, vectors, scales, count, dim, out + q * count, q == 0 ? sqr_norms : nullptr);
+    }
+}
+
+struct alignas(64) TileConfig {
+    uint8_t palette = 1;
+    uint8_t start_row = 0;
+    uint8_t reserved[14] = {};
+    uint16_t colsb[16] = {};
+    uint8_t rows[16] = {};
+};
+
+// AMX: C (tmm0, 16 x 16 sums) += A (tmm1, 16 queries x 64 bytes of
+// components) * B (tmm2, the same components of 16 vectors, packed in
+// groups of 4 bytes per vector as the dot product instructions read them).
+// Queries are packed once per call, each block of 16 vectors once for all
+// query blocks. INT8 queries are quantized per row like the vectors.
+template <typename T>
+void tileMatrix(const float* queries, size_t nq, const void* vectors, const float* scales, size_t count,
+                size_t dim, float* out, float* sqr_norms) {
+    constexpr bool kInt8 = std::is_same_v<T, int8_t>;
+    constexpr size_t kPerRow = kTileBytes / sizeof(T);     // Components per tile row
+    constexpr size_t kGroup = 4 / sizeof(T);                // Components per 32-bit dot
+    if (nq < kTileMinQueries) {
+        blockMatrix<kInt8 ? int8Block : bf16Block>(queries, nq, vectors, scales, count, dim, out, sqr_norms);
+        return;
+    }
+    const auto* rows = static_cast<const T*>(vectors);
+    const size_t chunks = (dim + kPerRow - 1) / kPerRow;
+    const size_t padded = chunks * kPerRow;
+    const size_t qblocks = (nq + kTileRows - 1) / kTileRows;
+    constexpr size_t kTile = kTileRows * kPerRow;           // Components per tile
+
+    // A tiles: [query block][chunk][16 rows][kPerRow]
+    std::vector<T> a(qblocks * chunks * kTile, T{0});
+    std::vector<float> qscale(qblocks * kTileRows, 0.0f);
+    std::vector<T> row(padded);
+    for (size_t q = 0; q < nq; ++q) {
+        if constexpr (kInt8) {
+            qscale[q] = quantizeInt8(queries + q * dim, dim, padded, row.data());
+        } else {
+            toBf16(queries + q * dim, dim, padded, row.data());
+            qscale[q] = 1.0f;
+        }
+        T* dst = a.data() + (q / kTileRows) * chunks * kTile + (q % kTileRows) * kPerRow;
+        for (size_t c = 0; c < chunks; ++c) std::memcpy(dst + c * kTile, row.data() + c * kPerRow, kTileBytes);
+    }
+
+    TileConfig config;
+    for (int t = 0; t < 3; ++t) {
+        config.colsb[t] = kTileBytes;
+        config.rows[t] = kTileRows;
+    }
+    _tile_loadconfig(&config);
+
+    // A B tile is a 16 x 16 transpose of 32-bit words: row r, column j is
+    // word r of vector j's chunk (4 int8 or 2 bf16 components)
+    constexpr size_t kWords = kTileRows * kTileRows;
+    std::vector<uint32_t> b(chunks * kWords);
+    alignas(64) std::conditional_t<kInt8, int32_t, float> c[kTileRows * kTileRows];
+    for (size_t v0 = 0; v0 < count; v0 += kTileRows) {
+        const size_t nv = std::min(kTileRows, count - v0);
+        if (nv < kTileRows) std::fill(b.begin(), b.end(), 0u);
+        for (size_t j = 0; j < nv; ++j) {
+            std::memcpy(row.data(), rows + (v0 + j) * dim, dim * sizeof(T));
+            std::fill(row.begin() + dim, row.end(), T{0});
+            for (size_t w = 0; w < chunks * kTileRows; ++w) {
+                std::memcpy(&b[(w / kTileRows) * kWords + (w % kTileRows) * kTileRows + j],
+                            row.data() + w * kGroup, sizeof(uint32_t));
+            }
+        }
+        const __mmask16 m = static_cast<__mmask16>((1u << nv) - 1);
+        const __m512 vscale = scales ? _mm512_maskz_loadu_ps(m, scales + v0) : _mm512_set1_ps(1.0f);
+        for (size_t qb = 0; qb < qblocks; ++qb) {
+            _tile_zero(0);
+            for (size_t ch = 0; ch < chunks; ++ch) {
+                _tile_loadd(1, a.data() + (qb * chunks + ch) * kTile, kTileBytes);
+                _tile_loadd(2, b.data() + ch * kWords, kTileBytes);
+                if constexpr (kInt8) {
+                    _tile_dpbssd(0, 1, 2);
+                } else {
+                    _tile_dpbf16ps(0, 1, 2);
+                }
+            }
+            _tile_stored(0, c, kTileBytes);
+            const size_t rows_here = std::min(kTileRows, nq - qb * kTileRows);
+            for (size_t r = 0; r < rows_here; ++r) {
+                const size_t q = qb * kTileRows + r;
+                __m512 sums;
+                if constexpr (kInt8) {
+                    sums = _mm512_cvtepi32_ps(_mm512_load_si512(c + r * kTileRows));
+                } else {
+                    sums = _mm512_load_ps(c + r * kTileRows);
+                }
+                sums = _mm512_mul_ps(sums, _mm512_mul_ps(vscale, _mm512_set1_ps(qscale[q])));
+                _mm512_mask_storeu_ps(out + q * count + v0, m, sums);
+            }
+        }
+        if (sqr_norms) {
+            for (size_t j = 0; j < nv; ++j) {
+                const float vscale = scales ? scales[v0 + j] : 1.0f;
+                const T* v = rows + (v0 + j) * dim;
+                if constexpr (kInt8) {
+                    sqr_norms[v0 + j] = static_cast<float>(int8SqrNorm(v, dim)) * vscale * vscale;
+                } else {
+                    sqr_norms[v0 + j] = bf16SqrNorm(v, dim) * vscale * vscale;
+                }
+            }
+        }
+    }
+    _tile_release();
+}
+
+} // namespace
+
+const EncodedBatchKernels int8_vnni = {int8Block, blockMatrix<int8Block>};
+const EncodedBatchKernels int8_tiles = {int8Block, tileMatrix<int8_t>};
+const EncodedBatchKernels bf16_dot = {bf16Block, blockMatrix<bf16Block>};
+const EncodedBatchKernels bf16_tiles = {bf16Block, tileMatrix<uint16_t>};
+
+} // namespace woved::kernels::amx
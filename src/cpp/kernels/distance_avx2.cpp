@@ -0,0 +1,487 @@
+#include "util/simd-dispatch.h"
+#include "util/vector-codec.h"
+#include <immintrin.h>
+
+namespace woved::kernels::avx2 {
+
+namespace {
+
+inline float hsum(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_hadd_ps(lo, lo);
+    lo = _mm_hadd_ps(lo, lo);
+    return _mm_cvtss_f32(lo);
+}
+
+// Dim 0 takes the length at run time; otherwise it is fixed (kFixedDims)
+// and other lengths fall back to Dim 0
+template <size_t Dim>
+float inner_product(const float* a, const float* b, size_t dim) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return inner_product<0>(a, b, dim);
+        dim = Dim;
+    }
+    if constexpr (Dim % 32 == 0 && Dim != 0) {
+        // Four chains hide the FMA latency; the trip count is exact
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        for (size_t i = 0; i < Dim; i += 32) {
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+        }
+        return hsum(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    }
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <size_t Dim>
+float l2_sqr(const float* a, const float* b, size_t dim) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return l2_sqr<0>(a, b, dim);
+        dim = Dim;
+    }
+    if constexpr (Dim % 32 == 0 && Dim != 0) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        for (size_t i = 0; i < Dim; i += 32) {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+            __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+            __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+            acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+            acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+        }
+        return hsum(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    }
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < dim; ++i) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+// Four queries per pass share each load of the vector
+template <size_t Dim>
+void inner_product_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                         float* out) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return inner_product_batch<0>(queries, count, vec, dim, out);
+        dim = Dim;
+    }
+    size_t q = 0;
+    for (; q + 4 <= count; q += 4) {
+        const float* q0 = queries + q * dim;
+        const float* q1 = q0 + dim;
+        const float* q2 = q1 + dim;
+        const float* q3 = q2 + dim;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= dim; i += 8) {
+            __m256 v = _mm256_loadu_ps(vec + i);
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q0 + i), v, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q1 + i), v, acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(q2 + i), v, acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(q3 + i), v, acc3);
+        }
+        float s0 = hsum(acc0), s1 = hsum(acc1), s2 = hsum(acc2), s3 = hsum(acc3);
+        for (; i < dim; ++i) {
+            s0 += q0[i] * vec[i];
+            s1 += q1[i] * vec[i];
+            s2 += q2[i] * vec[i];
+            s3 += q3[i] * vec[i];
+        }
+        out[q] = s0;
+        out[q + 1] = s1;
+        out[q + 2] = s2;
+        out[q + 3] = s3;
+    }
+    for (; q < count; ++q) {
+        out[q] = inner_product<Dim>(queries + q * dim, vec, dim);
+    }
+}
+
+template <size_t Dim>
+void l2_sqr_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                  float* out) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return l2_sqr_batch<0>(queries, count, vec, dim, out);
+        dim = Dim;
+    }
+    size_t q = 0;
+    for (; q + 4 <= count; q += 4) {
+        const float* q0 = queries + q * dim;
+        const float* q1 = q0 + dim;
+        const float* q2 = q1 + dim;
+        const float* q3 = q2 + dim;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= dim; i += 8) {
+            __m256 v = _mm256_loadu_ps(vec + i);
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(q0 + i), v);
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(q1 + i), v);
+            __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(q2 + i), v);
+            __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(q3 + i), v);
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+            acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+            acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+        }
+        float s0 = hsum(acc0), s1 = hsum(acc1), s2 = hsum(acc2), s3 = hsum(acc3);
+        for (; i < dim; ++i) {
+            float d0 = q0[i] - vec[i], d1 = q1[i] - vec[i];
+            float d2 = q2[i] - vec[i], d3 = q3[i] - vec[i];
+            s0 += d0 * d0;
+            s1 += d1 * d1;
+            s2 += d2 * d2;
+            s3 += d3 * d3;
+        }
+        out[q] = s0;
+        out[q + 1] = s1;
+        out[q + 2] = s2;
+        out[q + 3] = s3;
+    }
+    for (; q < count; ++q) {
+        out[q] = l2_sqr<Dim>(queries + q * dim, vec, dim);
+    }
+}
+
+// Both metrics are symmetric: one query against a block of vectors is
+// the batch kernel with the roles swapped, four vectors per query load
+template <size_t Dim>
+void inner_product_block(const float* query, const float* vectors, size_t count, size_t dim,
+                         float* out) {
+    inner_product_batch<Dim>(vectors, count, query, dim, out);
+}
+
+template <size_t Dim>
+void l2_sqr_block(const float* query, const float* vectors, size_t count, size_t dim, float* out) {
+    l2_sqr_batch<Dim>(vectors, count, query, dim, out);
+}
+
+template <bool L2>
+inline __m256 accumulate(__m256 x, __m256 y, __m256 acc) {
+    if constexpr (L2) {
+        __m256 d = _mm256_sub_ps(x, y);
+        return _mm256_fmadd_ps(d, d, acc);
+    } else {
+        return _mm256_fmadd_ps(x, y, acc);
+    }
+}
+
+template <bool L2>
+inline float accumulate(float x, float y, float acc) {
+    if constexpr (L2) {
+        return acc + (x - y) * (x - y);
+    } else {
+        return acc + x * y;
+    }
+}
+
+// Tiles of two queries by four vectors: each load feeds two or four FMAs,
+// eight accumulators in flight
+template <bool L2, size_t Dim>
+void matrix(const float* queries, size_t nq, const float* vectors, size_t count, size_t dim,
+            float* out) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return matrix<L2, 0>(queries, nq, vectors, count, dim, out);
+        dim = Dim;
+    }
+    size_t q = 0;
+    for (; q + 2 <= nq; q += 2) {
+        const float* a0 = queries + q * dim;
+        const float* a1 = a0 + dim;
+        float* out0 = out + q * count;
+        float* out1 = out0 + count;
+        size_t v = 0;
+        for (; v + 4 <= count; v += 4) {
+            const float* b0 = vectors + v * dim;
+            const float* b1 = b0 + dim;
+            const float* b2 = b1 + dim;
+            const float* b3 = b2 + dim;
+            __m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps();
+            __m256 acc02 = _mm256_setzero_ps(), acc03 = _mm256_setzero_ps();
+            __m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps();
+            __m256 acc12 = _mm256_setzero_ps(), acc13 = _mm256_setzero_ps();
+            size_t i = 0;
+            for (; i + 8 <= dim; i += 8) {
+                __m256 x0 = _mm256_loadu_ps(a0 + i);
+                __m256 x1 = _mm256_loadu_ps(a1 + i);
+                __m256 y = _mm256_loadu_ps(b0 + i);
+                acc00 = accumulate<L2>(x0, y, acc00);
+                acc10 = accumulate<L2>(x1, y, acc10);
+                y = _mm256_loadu_ps(b1 + i);
+                acc01 = accumulate<L2>(x0, y, acc01);
+                acc11 = accumulate<L2>(x1, y, acc11);
+                y = _mm256_loadu_ps(b2 + i);
+                acc02 = accumulate<L2>(x0, y, acc02);
+                acc12 = accumulate<L2>(x1, y, acc12);
+                y = _mm256_loadu_ps(b3 + i);
+                acc03 = accumulate<L2>(x0, y, acc03);
+                acc13 = accumulate<L2>(x1, y, acc13);
+            }
+            float s00 = hsum(acc00), s01 = hsum(acc01), s02 = hsum(acc02), s03 = hsum(acc03);
+            float s10 = hsum(acc10), s11 = hsum(acc11), s12 = hsum(acc12), s13 = hsum(acc13);
+            for (; i < dim; ++i) {
+                s00 = accumulate<L2>(a0[i], b0[i], s00);
+                s01 = accumulate<L2>(a0[i], b1[i], s01);
+                s02 = accumulate<L2>(a0[i], b2[i], s02);
+                s03 = accumulate<L2>(a0[i], b3[i], s03);
+                s10 = accumulate<L2>(a1[i], b0[i], s10);
+                s11 = accumulate<L2>(a1[i], b1[i], s11);
+                s12 = accumulate<L2>(a1[i], b2[i], s12);
+                s13 = accumulate<L2>(a1[i], b3[i], s13);
+            }
+            out0[v] = s00;
+            out0[v + 1] = s01;
+            out0[v + 2] = s02;
+            out0[v + 3] = s03;
+            out1[v] = s10;
+            out1[v + 1] = s11;
+            out1[v + 2] = s12;
+            out1[v + 3] = s13;
+        }
+        for (; v < count; ++v) {
+            const float* b = vectors + v * dim;
+            out0[v] = L2 ? l2_sqr<Dim>(a0, b, dim) : inner_product<Dim>(a0, b, dim);
+            out1[v] = L2 ? l2_sqr<Dim>(a1, b, dim) : inner_product<Dim>(a1, b, dim);
+        }
+    }
+    for (; q < nq; ++q) {
+        if constexpr (L2) {
+            l2_sqr_block<Dim>(queries + q * dim, vectors, count, dim, out + q * count);
+        } else {
+            inner_product_block<Dim>(queries + q * dim, vectors, count, dim, out + q * count);
+        }
+    }
+}
+
+template <size_t Dim>
+void inner_product_matrix(const float* queries, size_t nq, const float* vectors, size_t count,
+                          size_t dim, float* out) {
+    matrix<false, Dim>(queries, nq, vectors, count, dim, out);
+}
+
+template <size_t Dim>
+void l2_sqr_matrix(const float* queries, size_t nq, const float* vectors, size_t count, size_t dim,
+                   float* out) {
+    matrix<true, Dim>(queries, nq, vectors, count, dim, out);
+}
+
+// One vector at a time, prefetching the next one's first lines
+template <size_t Dim>
+void scan_list(const float* query, const float* vectors, size_t count, size_t dim, bool l2,
+               uint64_t first_row, ScanHeap& heap) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return scan_list<0>(query, vectors, count, dim, l2, first_row, heap);
+        dim = Dim;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const float* v = vectors + i * dim;
+        if (i + 1 < count) {
+            for (size_t d = 0; d < dim && d < 64; d += 16) {
+                _mm_prefetch(reinterpret_cast<const char*>(v + dim + d), _MM_HINT_T0);
+            }
+        }
+        const Score s = l2 ? -l2_sqr<Dim>(query, v, dim) : inner_product<Dim>(query, v, dim);
+        if (s > heap.threshold()) heap.push(s, first_row + i);
+    }
+}
+
+// Each 32-byte load covers one pair of subquantizers: lane 0 the codes of
+// subquantizer 2p, lane 1 those of 2p + 1, so one in-lane byte shuffle
+// against both 16-entry tables looks up 32 codes. Low nibbles are rows
+// 0-15, high nibbles rows 16-31; lookups widen to uint16 to accumulate.
+void pq4_scan(const uint8_t* lut, const uint8_t* blocks, size_t nblocks, size_t pairs, uint16_t* out) {
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const size_t block_bytes = pairs * 32;
+    for (size_t b = 0; b < nblocks; ++b) {
+        const uint8_t* codes = blocks + b * block_bytes;
+        __m256i acc_lo = _mm256_setzero_si256();
+        __m256i acc_hi = _mm256_setzero_si256();
+        for (size_t p = 0; p < pairs; ++p) {
+            if (p % 2 == 0 && b + 1 < nblocks) {
+                _mm_prefetch(reinterpret_cast<const char*>(codes + block_bytes + p * 32), _MM_HINT_T0);
+            }
+            const __m256i table = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lut + p * 32));
+            const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + p * 32));
+            const __m256i d_lo = _mm256_shuffle_epi8(table, _mm256_and_si256(c, nibble));
+            const __m256i d_hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(c, 4), nibble));
+            acc_lo = _mm256_add_epi16(acc_lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d_lo)));
+            acc_lo = _mm256_add_epi16(acc_lo, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d_lo, 1)));
+            acc_hi = _mm256_add_epi16(acc_hi, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d_hi)));
+            acc_hi = _mm256_add_epi16(acc_hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d_hi, 1)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + b * 32), acc_lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + b * 32 + 16), acc_hi);
+    }
+}
+
+// Widen 8 stored components to fp32
+inline __m256 load_fp16(const uint16_t* p) {
+    return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+inline __m256 load_bf16(const uint16_t* p) {
+    __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(w, 16));
+}
+
+inline __m256 load_int8(const int8_t* p) {
+    __m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(b));
+}
+
+inline float fp16_at(uint16_t v) { return util::fp16_to_float(v); }
+inline float bf16_at(uint16_t v) { return util::bf16_to_float(v); }
+inline float int8_at(int8_t v) { return static_cast<float>(v); }
+
+template <typename T, __m256 (*Load)(const T*), float (*At)(T)>
+float encoded_inner_product(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), Load(v + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8), Load(v + i + 8), acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), Load(v + i), acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += q[i] * At(v[i]);
+    }
+    return sum * scale;
+}
+
+template <typename T, __m256 (*Load)(const T*), float (*At)(T)>
+float encoded_l2_sqr(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    const __m256 s = _mm256_set1_ps(scale);
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_fnmadd_ps(s, Load(v + i), _mm256_loadu_ps(q + i));
+        __m256 d1 = _mm256_fnmadd_ps(s, Load(v + i + 8), _mm256_loadu_ps(q + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d = _mm256_fnmadd_ps(s, Load(v + i), _mm256_loadu_ps(q + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < dim; ++i) {
+        float d = q[i] - scale * At(v[i]);
+        sum += d * d;
+    }
+    return sum;
+}
+
+// Pair kernels over a block; stored norms from |q - v|^2 - |q|^2 + 2 q.v
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_block(const float* query, const void* vectors, const float* scales, size_t count, size_t dim,
+                   float* out, float* sqr_norms) {
+    const auto* rows = static_cast<const T*>(vectors);
+    const float qq = sqr_norms ? inner_product<0>(query, query, dim) : 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        const T* v = rows + i * dim;
+        const float scale = scales ? scales[i] : 1.0f;
+        out[i] = Ip(query, v, scale, dim);
+        if (sqr_norms) sqr_norms[i] = L2(query, v, scale, dim) - qq + 2.0f * out[i];
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_matrix(const float* queries, size_t nq, const void* vectors, const float* scales, size_t count,
+                    size_t dim, float* out, float* sqr_norms) {
+    for (size_t q = 0; q < nq; ++q) {
+        encoded_block<T, Ip, L2>(queries + q * dim, vectors, scales, count, dim, out + q * count,
+                                 q == 0 ? sqr_norms : nullptr);
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+constexpr EncodedKernels encoded() {
+    return {Ip, L2, encoded_block<T, Ip, L2>, encoded_matrix<T, Ip, L2>};
+}
+
+template <size_t Dim>
+constexpr FixedDimKernels fixed() {
+    return {Dim, inner_product<Dim>, l2_sqr<Dim>, inner_product_batch<Dim>, l2_sqr_batch<Dim>,
+            inner_product_block<Dim>, l2_sqr_block<Dim>, inner_product_matrix<Dim>, l2_sqr_matrix<Dim>,
+            scan_list<Dim>};
+}
+
+} // namespace
+
+const DistanceTable table = {
+    "avx2",
+    inner_product<0>,
+    l2_sqr<0>,
+    inner_product_batch<0>,
+    l2_sqr_batch<0>,
+    inner_product_block<0>,
+    l2_sqr_block<0>,
+    inner_product_matrix<0>,
+    l2_sqr_matrix<0>,
+    scan_list<0>,
+    pq4_scan,
+    encoded<uint16_t, encoded_inner_product<uint16_t, load_fp16, fp16_at>,
+            encoded_l2_sqr<uint16_t, load_fp16, fp16_at>>(),
+    encoded<uint16_t, encoded_inner_product<uint16_t, load_bf16, bf16_at>,
+            encoded_l2_sqr<uint16_t, load_bf16, bf16_at>>(),
+    encoded<int8_t, encoded_inner_product<int8_t, load_int8, int8_at>,
+            encoded_l2_sqr<int8_t, load_int8, int8_at>>(),
+};
+
+const FixedDimKernels fixed_dims[kFixedDimCount] = {
+    fixed<kFixedDims[0]>(),
+    fixed<kFixedDims[1]>(),
+    fixed<kFixedDims[2]>(),
+    fixed<kFixedDims[3]>(),
+};
+
+} // namespace woved::kernels::avx2
@@ -0,0 +1,484 @@
+#include "util/simd-dispatch.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cstring>
+
+namespace woved::kernels::avx512 {
+
+namespace {
+
+inline __mmask16 tailMask(size_t remaining) {
+    return static_cast<__mmask16>((1u << remaining) - 1);
+}
+
+// Dim 0 takes the length at run time; otherwise it is fixed (kFixedDims)
+// and other lengths fall back to Dim 0
+template <size_t Dim>
+float inner_product(const float* a, const float* b, size_t dim) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return inner_product<0>(a, b, dim);
+        dim = Dim;
+    }
+    if constexpr (Dim % 64 == 0 && Dim != 0) {
+        // Four chains hide the FMA latency; the trip count is exact
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        for (size_t i = 0; i < Dim; i += 64) {
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+            acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+            acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+    }
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask(dim - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+template <size_t Dim>
+float l2_sqr(const float* a, const float* b, size_t dim) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return l2_sqr<0>(a, b, dim);
+        dim = Dim;
+    }
+    if constexpr (Dim % 64 == 0 && Dim != 0) {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        for (size_t i = 0; i < Dim; i += 64) {
+            __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+            __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+            __m512 d2 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32));
+            __m512 d3 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48));
+            acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+            acc2 = _mm512_fmadd_ps(d2, d2, acc2);
+            acc3 = _mm512_fmadd_ps(d3, d3, acc3);
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+    }
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask(dim - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+// Four queries per pass share each load of the vector
+template <size_t Dim>
+void inner_product_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                         float* out) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return inner_product_batch<0>(queries, count, vec, dim, out);
+        dim = Dim;
+    }
+    size_t q = 0;
+    for (; q + 4 <= count; q += 4) {
+        const float* q0 = queries + q * dim;
+        const float* q1 = q0 + dim;
+        const float* q2 = q1 + dim;
+        const float* q3 = q2 + dim;
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps();
+        __m512 acc3 = _mm512_setzero_ps();
+        for (size_t i = 0; i < dim; i += 16) {
+            __mmask16 m = dim - i >= 16 ? __mmask16(0xffff) : tailMask(dim - i);
+            __m512 v = _mm512_maskz_loadu_ps(m, vec + i);
+            acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q0 + i), v, acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q1 + i), v, acc1);
+            acc2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q2 + i), v, acc2);
+            acc3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q3 + i), v, acc3);
+        }
+        out[q] = _mm512_reduce_add_ps(acc0);
+        out[q + 1] = _mm512_reduce_add_ps(acc1);
+        out[q + 2] = _mm512_reduce_add_ps(acc2);
+        out[q + 3] = _mm512_reduce_add_ps(acc3);
+    }
+    for (; q < count; ++q) {
+        out[q] = inner_product<Dim>(queries + q * dim, vec, dim);
+    }
+}
+
+template <size_t Dim>
+void l2_sqr_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                  float* out) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return l2_sqr_batch<0>(queries, count, vec, dim, out);
+        dim = Dim;
+    }
+    size_t q = 0;
+    for (; q + 4 <= count; q += 4) {
+        const float* q0 = queries + q * dim;
+        const float* q1 = q0 + dim;
+        const float* q2 = q1 + dim;
+        const float* q3 = q2 + dim;
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps();
+        __m512 acc3 = _mm512_setzero_ps();
+        for (size_t i = 0; i < dim; i += 16) {
+            __mmask16 m = dim - i >= 16 ? __mmask16(0xffff) : tailMask(dim - i);
+            __m512 v = _mm512_maskz_loadu_ps(m, vec + i);
+            __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, q0 + i), v);
+            __m512 d1 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, q1 + i), v);
+            __m512 d2 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, q2 + i), v);
+            __m512 d3 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, q3 + i), v);
+            acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+            acc2 = _mm512_fmadd_ps(d2, d2, acc2);
+            acc3 = _mm512_fmadd_ps(d3, d3, acc3);
+        }
+        out[q] = _mm512_reduce_add_ps(acc0);
+        out[q + 1] = _mm512_reduce_add_ps(acc1);
+        out[q + 2] = _mm512_reduce_add_ps(acc2);
+        out[q + 3] = _mm512_reduce_add_ps(acc3);
+    }
+    for (; q < count; ++q) {
+        out[q] = l2_sqr<Dim>(queries + q * dim, vec, dim);
+    }
+}
+
+// Both metrics are symmetric: one query against a block of vectors is
+// the batch kernel with the roles swapped, four vectors per query load
+template <size_t Dim>
+void inner_product_block(const float* query, const float* vectors, size_t count, size_t dim,
+                         float* out) {
+    inner_product_batch<Dim>(vectors, count, query, dim, out);
+}
+
+template <size_t Dim>
+void l2_sqr_block(const float* query, const float* vectors, size_t count, size_t dim, float* out) {
+    l2_sqr_batch<Dim>(vectors, count, query, dim, out);
+}
+
+constexpr size_t kTile = 4;
+
+// Tiles of four queries by four vectors: each load feeds four FMAs,
+// sixteen accumulators in flight
+template <bool L2, size_t Dim>
+void matrix(const float* queries, size_t nq, const float* vectors, size_t count, size_t dim,
+            float* out) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return matrix<L2, 0>(queries, nq, vectors, count, dim, out);
+        dim = Dim;
+    }
+    size_t q = 0;
+    for (; q + kTile <= nq; q += kTile) {
+        const float* a = queries + q * dim;
+        size_t v = 0;
+        for (; v + kTile <= count; v += kTile) {
+            const float* b = vectors + v * dim;
+            __m512 acc[kTile][kTile];
+            for (size_t r = 0; r < kTile; ++r) {
+                for (size_t c = 0; c < kTile; ++c) acc[r][c] = _mm512_setzero_ps();
+            }
+            for (size_t i = 0; i < dim; i += 16) {
+                __mmask16 m = dim - i >= 16 ? __mmask16(0xffff) : tailMask(dim - i);
+                __m512 x[kTile];
+                for (size_t r = 0; r < kTile; ++r) x[r] = _mm512_maskz_loadu_ps(m, a + r * dim + i);
+                for (size_t c = 0; c < kTile; ++c) {
+                    __m512 y = _mm512_maskz_loadu_ps(m, b + c * dim + i);
+                    for (size_t r = 0; r < kTile; ++r) {
+                        if constexpr (L2) {
+                            __m512 d = _mm512_sub_ps(x[r], y);
+                            acc[r][c] = _mm512_fmadd_ps(d, d, acc[r][c]);
+                        } else {
+                            acc[r][c] = _mm512_fmadd_ps(x[r], y, acc[r][c]);
+                        }
+                    }
+                }
+            }
+            for (size_t r = 0; r < kTile; ++r) {
+                for (size_t c = 0; c < kTile; ++c) {
+                    out[(q + r) * count + v + c] = _mm512_reduce_add_ps(acc[r][c]);
+                }
+            }
+        }
+        for (; v < count; ++v) {
+            const float* b = vectors + v * dim;
+            for (size_t r = 0; r < kTile; ++r) {
+                out[(q + r) * count + v] = L2 ? l2_sqr<Dim>(a + r * dim, b, dim) : inner_product<Dim>(a + r * dim, b, dim);
+            }
+        }
+    }
+    for (; q < nq; ++q) {
+        if constexpr (L2) {
+            l2_sqr_block<Dim>(queries + q * dim, vectors, count, dim, out + q * count);
+        } else {
+            inner_product_block<Dim>(queries + q * dim, vectors, count, dim, out + q * count);
+        }
+    }
+}
+
+template <size_t Dim>
+void inner_product_matrix(const float* queries, size_t nq, const float* vectors, size_t count,
+                          size_t dim, float* out) {
+    matrix<false, Dim>(queries, nq, vectors, count, dim, out);
+}
+
+template <size_t Dim>
+void l2_sqr_matrix(const float* queries, size_t nq, const float* vectors, size_t count, size_t dim,
+                   float* out) {
+    matrix<true, Dim>(queries, nq, vectors, count, dim, out);
+}
+
+constexpr size_t kScanBlock = 16;
+
+// Score n <= 16 consecutive vectors against the query, one accumulator
+// each, walking all of them down the dimensions together so every query
+// load is shared. The next block is prefetched at the same offset as the
+// current one is read. Scores land in lane j for vector j.
+template<bool L2, size_t Dim>
+__m512 score_block(const float* query, const float* block, size_t n, size_t dim,
+                   const float* next, size_t next_n) {
+    if constexpr (Dim != 0) dim = Dim;  // Checked by scan_list
+    __m512 acc[kScanBlock];
+    for (size_t j = 0; j < kScanBlock; ++j) acc[j] = _mm512_setzero_ps();
+    for (size_t i = 0; i < dim; i += 16) {
+        __mmask16 m = dim - i >= 16 ? __mmask16(0xffff) : tailMask(dim - i);
+        __m512 q = _mm512_maskz_loadu_ps(m, query + i);
+        for (size_t j = 0; j < next_n; ++j) {
+            _mm_prefetch(reinterpret_cast<const char*>(next + j * dim + i), _MM_HINT_T0);
+        }
+        for (size_t j = 0; j < n; ++j) {
+            __m512 v = _mm512_maskz_loadu_ps(m, block + j * dim + i);
+            if constexpr (L2) {
+                __m512 d = _mm512_sub_ps(q, v);
+                acc[j] = _mm512_fmadd_ps(d, d, acc[j]);
+            } else {
+                acc[j] = _mm512_fmadd_ps(q, v, acc[j]);
+            }
+        }
+    }
+    alignas(64) float scores[kScanBlock] = {};
+    for (size_t j = 0; j < n; ++j) scores[j] = _mm512_reduce_add_ps(acc[j]);
+    __m512 s = _mm512_load_ps(scores);
+    return L2 ? _mm512_sub_ps(_mm512_setzero_ps(), s) : s;
+}
+
+// Fused scan: score a block, compare all 16 scores against the heap
+// threshold at once, and only offer the lanes that beat it. The threshold
+// is re-read per offer since each push may raise it.
+template<bool L2, size_t Dim>
+void scan_list_impl(const float* query, const float* vectors, size_t count, size_t dim,
+                    uint64_t first_row, ScanHeap& heap) {
+    alignas(64) float scores[kScanBlock];
+    for (size_t b = 0; b < count; b += kScanBlock) {
+        const size_t n = std::min(kScanBlock, count - b);
+        const size_t next = b + n;
+        const size_t next_n = std::min(kScanBlock, count - next);
+        const float* block = vectors + b * dim;
+        __m512 s = score_block<L2, Dim>(query, block, n, dim, block + n * dim, next_n);
+        __mmask16 hits = _mm512_cmp_ps_mask(s, _mm512_set1_ps(heap.threshold()), _CMP_GT_OQ) &
+                         tailMask(n);
+        if (!hits) continue;
+        _mm512_store_ps(scores, s);
+        while (hits) {
+            const unsigned j = static_cast<unsigned>(__builtin_ctz(hits));
+            hits = static_cast<__mmask16>(hits & (hits - 1));
+            if (scores[j] > heap.threshold()) heap.push(scores[j], first_row + b + j);
+        }
+    }
+}
+
+template <size_t Dim>
+void scan_list(const float* query, const float* vectors, size_t count, size_t dim, bool l2,
+               uint64_t first_row, ScanHeap& heap) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return scan_list<0>(query, vectors, count, dim, l2, first_row, heap);
+        dim = Dim;
+    }
+    if (l2) {
+        scan_list_impl<true, Dim>(query, vectors, count, dim, first_row, heap);
+    } else {
+        scan_list_impl<false, Dim>(query, vectors, count, dim, first_row, heap);
+    }
+}
+
+// Same as the AVX2 kernel: 512-bit byte shuffles need AVX-512BW, which
+// this build does not assume
+void pq4_scan(const uint8_t* lut, const uint8_t* blocks, size_t nblocks, size_t pairs, uint16_t* out) {
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const size_t block_bytes = pairs * 32;
+    for (size_t b = 0; b < nblocks; ++b) {
+        const uint8_t* codes = blocks + b * block_bytes;
+        __m256i acc_lo = _mm256_setzero_si256();
+        __m256i acc_hi = _mm256_setzero_si256();
+        for (size_t p = 0; p < pairs; ++p) {
+            if (p % 2 == 0 && b + 1 < nblocks) {
+                _mm_prefetch(reinterpret_cast<const char*>(codes + block_bytes + p * 32), _MM_HINT_T0);
+            }
+            const __m256i table = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lut + p * 32));
+            const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + p * 32));
+            const __m256i d_lo = _mm256_shuffle_epi8(table, _mm256_and_si256(c, nibble));
+            const __m256i d_hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(c, 4), nibble));
+            acc_lo = _mm256_add_epi16(acc_lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d_lo)));
+            acc_lo = _mm256_add_epi16(acc_lo, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d_lo, 1)));
+            acc_hi = _mm256_add_epi16(acc_hi, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d_hi)));
+            acc_hi = _mm256_add_epi16(acc_hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d_hi, 1)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + b * 32), acc_lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + b * 32 + 16), acc_hi);
+    }
+}
+
+// Widen 16 stored components to fp32
+inline __m512 load_fp16(const uint16_t* p) {
+    return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+
+inline __m512 load_bf16(const uint16_t* p) {
+    __m512i w = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(w, 16));
+}
+
+inline __m512 load_int8(const int8_t* p) {
+    return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+}
+
+// Tail of fewer than 16 components: byte-masked loads need AVX512BW, so
+// stage them in a zeroed block instead
+template <typename T, __m512 (*Load)(const T*)>
+inline __m512 load_tail(const T* p, size_t remaining) {
+    T block[16] = {};
+    std::memcpy(block, p, remaining * sizeof(T));
+    return Load(block);
+}
+
+template <typename T, __m512 (*Load)(const T*)>
+float encoded_inner_product(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), Load(v + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 16), Load(v + i + 16), acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), Load(v + i), acc0);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask(dim - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q + i), load_tail<T, Load>(v + i, dim - i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)) * scale;
+}
+
+template <typename T, __m512 (*Load)(const T*)>
+float encoded_l2_sqr(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    const __m512 s = _mm512_set1_ps(scale);
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 d0 = _mm512_fnmadd_ps(s, Load(v + i), _mm512_loadu_ps(q + i));
+        __m512 d1 = _mm512_fnmadd_ps(s, Load(v + i + 16), _mm512_loadu_ps(q + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m512 d = _mm512_fnmadd_ps(s, Load(v + i), _mm512_loadu_ps(q + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask(dim - i);
+        __m512 d = _mm512_fnmadd_ps(s, load_tail<T, Load>(v + i, dim - i), _mm512_maskz_loadu_ps(m, q + i));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+// Pair kernels over a block; stored norms from |q - v|^2 - |q|^2 + 2 q.v
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_block(const float* query, const void* vectors, const float* scales, size_t count, size_t dim,
+                   float* out, float* sqr_norms) {
+    const auto* rows = static_cast<const T*>(vectors);
+    const float qq = sqr_norms ? inner_product<0>(query, query, dim) : 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        const T* v = rows + i * dim;
+        const float scale = scales ? scales[i] : 1.0f;
+        out[i] = Ip(query, v, scale, dim);
+        if (sqr_norms) sqr_norms[i] = L2(query, v, scale, dim) - qq + 2.0f * out[i];
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_matrix(const float* queries, size_t nq, const void* vectors, const float* scales, size_t count,
+                    size_t dim, float* out, float* sqr_norms) {
+    for (size_t q = 0; q < nq; ++q) {
+        encoded_block<T, Ip, L2>(queries + q * dim, vectors, scales, count, dim, out + q * count,
+                                 q == 0 ? sqr_norms : nullptr);
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+constexpr EncodedKernels encoded() {
+    return {Ip, L2, encoded_block<T, Ip, L2>, encoded_matrix<T, Ip, L2>};
+}
+
+template <size_t Dim>
+constexpr FixedDimKernels fixed() {
+    return {Dim, inner_product<Dim>, l2_sqr<Dim>, inner_product_batch<Dim>, l2_sqr_batch<Dim>,
+            inner_product_block<Dim>, l2_sqr_block<Dim>, inner_product_matrix<Dim>, l2_sqr_matrix<Dim>,
+            scan_list<Dim>};
+}
+
+} // namespace
+
+const DistanceTable table = {
+    "avx512",
+    inner_product<0>,
+    l2_sqr<0>,
+    inner_product_batch<0>,
+    l2_sqr_batch<0>,
+    inner_product_block<0>,
+    l2_sqr_block<0>,
+    inner_product_matrix<0>,
+    l2_sqr_matrix<0>,
+    scan_list<0>,
+    pq4_scan,
+    encoded<uint16_t, encoded_inner_product<uint16_t, load_fp16>,
+            encoded_l2_sqr<uint16_t, load_fp16>>(),
+    encoded<uint16_t, encoded_inner_product<uint16_t, load_bf16>,
+            encoded_l2_sqr<uint16_t, load_bf16>>(),
+    encoded<int8_t, encoded_inner_product<int8_t, load_int8>,
+            encoded_l2_sqr<int8_t, load_int8>>(),
+};
+
+const FixedDimKernels fixed_dims[kFixedDimCount] = {
+    fixed<kFixedDims[0]>(),
+    fixed<kFixedDims[1]>(),
+    fixed<kFixedDims[2]>(),
+    fixed<kFixedDims[3]>(),
+};
+
+} // namespace woved::kernels::avx512
@@ -0,0 +1,203 @@
+#include "util/simd-dispatch.h"
+#include "util/vector-codec.h"
+
+namespace woved::kernels::base {
+
+namespace {
+
+// Dim 0: the length is the runtime argument. Otherwise the kernel is
+// compiled for that length (kFixedDims): past the check `dim` is a
+// constant, and other lengths take the Dim 0 kernel.
+template <size_t Dim>
+float inner_product(const float* a, const float* b, size_t dim) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return inner_product<0>(a, b, dim);
+        dim = Dim;
+    }
+    float sum = 0.0f;
+#pragma omp simd reduction(+:sum)
+    for (size_t i = 0; i < dim; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <size_t Dim>
+float l2_sqr(const float* a, const float* b, size_t dim) {
+    if constexpr (Dim != 0) {
+        if (dim != Dim) return l2_sqr<0>(a, b, dim);
+        dim = Dim;
+    }
+    float sum = 0.0f;
+#pragma omp simd reduction(+:sum)
+    for (size_t i = 0; i < dim; ++i) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+template <size_t Dim>
+void inner_product_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                         float* out) {
+    for (size_t q = 0; q < count; ++q) {
+        out[q] = inner_product<Dim>(queries + q * dim, vec, dim);
+    }
+}
+
+template <size_t Dim>
+void l2_sqr_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                  float* out) {
+    for (size_t q = 0; q < count; ++q) {
+        out[q] = l2_sqr<Dim>(queries + q * dim, vec, dim);
+    }
+}
+
+template <size_t Dim>
+void inner_product_block(const float* query, const float* vectors, size_t count, size_t dim,
+                         float* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = inner_product<Dim>(query, vectors + i * dim, dim);
+    }
+}
+
+template <size_t Dim>
+void l2_sqr_block(const float* query, const float* vectors, size_t count, size_t dim, float* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = l2_sqr<Dim>(query, vectors + i * dim, dim);
+    }
+}
+
+template <size_t Dim>
+void inner_product_matrix(const float* queries, size_t nq, const float* vectors, size_t count,
+                          size_t dim, float* out) {
+    for (size_t q = 0; q < nq; ++q) {
+        inner_product_block<Dim>(queries + q * dim, vectors, count, dim, out + q * count);
+    }
+}
+
+template <size_t Dim>
+void l2_sqr_matrix(const float* queries, size_t nq, const float* vectors, size_t count, size_t dim,
+                   float* out) {
+    for (size_t q = 0; q < nq; ++q) {
+        l2_sqr_block<Dim>(queries + q * dim, vectors, count, dim, out + q * count);
+    }
+}
+
+template <size_t Dim>
+void scan_list(const float* query, const float* vectors, size_t count, size_t dim, bool l2,
+               uint64_t first_row, ScanHeap& heap) {
+    for (size_t i = 0; i < count; ++i) {
+        const float* v = vectors + i * dim;
+        const Score s = l2 ? -l2_sqr<Dim>(query, v, dim) : inner_product<Dim>(query, v, dim);
+        if (s > heap.threshold()) heap.push(s, first_row + i);
+    }
+}
+
+void pq4_scan(const uint8_t* lut, const uint8_t* blocks, size_t nblocks, size_t pairs, uint16_t* out) {
+    for (size_t b = 0; b < nblocks; ++b) {
+        const uint8_t* codes = blocks + b * pairs * 32;
+        uint16_t* sums = out + b * 32;
+        for (size_t r = 0; r < 32; ++r) sums[r] = 0;
+        for (size_t j = 0; j < 2 * pairs; ++j) {
+            const uint8_t* table = lut + j * 16;
+            const uint8_t* sub = codes + j * 16;
+            for (size_t r = 0; r < 16; ++r) {
+                sums[r] = static_cast<uint16_t>(sums[r] + table[sub[r] & 0x0f]);
+                sums[r + 16] = static_cast<uint16_t>(sums[r + 16] + table[sub[r] >> 4]);
+            }
+        }
+    }
+}
+
+// Narrow element types: decode one component at a time, fp32 accumulate
+template <typename T, float (*Decode)(T)>
+float encoded_inner_product(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    float sum = 0.0f;
+#pragma omp simd reduction(+:sum)
+    for (size_t i = 0; i < dim; ++i) {
+        sum += q[i] * Decode(v[i]);
+    }
+    return sum * scale;
+}
+
+template <typename T, float (*Decode)(T)>
+float encoded_l2_sqr(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    float sum = 0.0f;
+#pragma omp simd reduction(+:sum)
+    for (size_t i = 0; i < dim; ++i) {
+        float d = q[i] - scale * Decode(v[i]);
+        sum += d * d;
+    }
+    return sum;
+}
+
+inline float int8_to_float(int8_t v) { return static_cast<float>(v); }
+
+// Pair kernels over a block; stored norms from |q - v|^2 - |q|^2 + 2 q.v
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_block(const float* query, const void* vectors, const float* scales, size_t count, size_t dim,
+                   float* out, float* sqr_norms) {
+    const auto* rows = static_cast<const T*>(vectors);
+    const float qq = sqr_norms ? inner_product<0>(query, query, dim) : 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        const T* v = rows + i * dim;
+        const float scale = scales ? scales[i] : 1.0f;
+        out[i] = Ip(query, v, scale, dim);
+        if (sqr_norms) sqr_norms[i] = L2(query, v, scale, dim) - qq + 2.0f * out[i];
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_matrix(const float* queries, size_t nq, const void* vectors, const float* scales, size_t count,
+                    size_t dim, float* out, float* sqr_norms) {
+    for (size_t q = 0; q < nq; ++q) {
+        encoded_block<T, Ip, L2>(queries + q * dim, vectors, scales, count, dim, out + q * count,
+                                 q == 0 ? sqr_norms : nullptr);
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+constexpr EncodedKernels encoded() {
+    return {Ip, L2, encoded_block<T, Ip, L2>, encoded_matrix<T, Ip, L2>};
+}
+
+template <size_t Dim>
+constexpr FixedDimKernels fixed() {
+    return {Dim, inner_product<Dim>, l2_sqr<Dim>, inner_product_batch<Dim>, l2_sqr_batch<Dim>,
+            inner_product_block<Dim>, l2_sqr_block<Dim>, inner_product_matrix<Dim>, l2_sqr_matrix<Dim>,
+            scan_list<Dim>};
+}
+
+} // namespace
+
+const DistanceTable table = {
+    "base",
+    inner_product<0>,
+    l2_sqr<0>,
+    inner_product_batch<0>,
+    l2_sqr_batch<0>,
+    inner_product_block<0>,
+    l2_sqr_block<0>,
+    inner_product_matrix<0>,
+    l2_sqr_matrix<0>,
+    scan_list<0>,
+    pq4_scan,
+    encoded<uint16_t, encoded_inner_product<uint16_t, util::fp16_to_float>,
+            encoded_l2_sqr<uint16_t, util::fp16_to_float>>(),
+    encoded<uint16_t, encoded_inner_product<uint16_t, util::bf16_to_float>,
+            encoded_l2_sqr<uint16_t, util::bf16_to_float>>(),
+    encoded<int8_t, encoded_inner_product<int8_t, int8_to_float>,
+            encoded_l2_sqr<int8_t, int8_to_float>>(),
+};
+
+const FixedDimKernels fixed_dims[kFixedDimCount] = {
+    fixed<kFixedDims[0]>(),
+    fixed<kFixedDims[1]>(),
+    fixed<kFixedDims[2]>(),
+    fixed<kFixedDims[3]>(),
+};
+
+} // namespace woved::kernels::base
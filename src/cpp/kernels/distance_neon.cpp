@@ -0,0 +1,358 @@
+#include "util/simd-dispatch.h"
+#include "util/vector-codec.h"
+#include <arm_neon.h>
+
+namespace woved::kernels::neon {
+
+namespace {
+
+float inner_product(const float* a, const float* b, size_t dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc2 = vfmaq_f32(acc2, vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+        acc3 = vfmaq_f32(acc3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+    }
+    for (; i + 4 <= dim; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i < dim; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+float l2_sqr(const float* a, const float* b, size_t dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        float32x4_t d2 = vsubq_f32(vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+        float32x4_t d3 = vsubq_f32(vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+        acc1 = vfmaq_f32(acc1, d1, d1);
+        acc2 = vfmaq_f32(acc2, d2, d2);
+        acc3 = vfmaq_f32(acc3, d3, d3);
+    }
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t d = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        acc0 = vfmaq_f32(acc0, d, d);
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i < dim; ++i) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+template <bool L2>
+inline float32x4_t accumulate(float32x4_t x, float32x4_t y, float32x4_t acc) {
+    if constexpr (L2) {
+        float32x4_t d = vsubq_f32(x, y);
+        return vfmaq_f32(acc, d, d);
+    } else {
+        return vfmaq_f32(acc, x, y);
+    }
+}
+
+template <bool L2>
+inline float accumulate(float x, float y, float acc) {
+    if constexpr (L2) {
+        return acc + (x - y) * (x - y);
+    } else {
+        return acc + x * y;
+    }
+}
+
+// Four queries per pass share each load of the vector
+template <bool L2>
+void batch(const float* queries, size_t count, const float* vec, size_t dim, float* out) {
+    size_t q = 0;
+    for (; q + 4 <= count; q += 4) {
+        const float* q0 = queries + q * dim;
+        const float* q1 = q0 + dim;
+        const float* q2 = q1 + dim;
+        const float* q3 = q2 + dim;
+        float32x4_t acc0 = vdupq_n_f32(0.0f);
+        float32x4_t acc1 = vdupq_n_f32(0.0f);
+        float32x4_t acc2 = vdupq_n_f32(0.0f);
+        float32x4_t acc3 = vdupq_n_f32(0.0f);
+        size_t i = 0;
+        for (; i + 4 <= dim; i += 4) {
+            float32x4_t v = vld1q_f32(vec + i);
+            acc0 = accumulate<L2>(vld1q_f32(q0 + i), v, acc0);
+            acc1 = accumulate<L2>(vld1q_f32(q1 + i), v, acc1);
+            acc2 = accumulate<L2>(vld1q_f32(q2 + i), v, acc2);
+            acc3 = accumulate<L2>(vld1q_f32(q3 + i), v, acc3);
+        }
+        float s0 = vaddvq_f32(acc0), s1 = vaddvq_f32(acc1), s2 = vaddvq_f32(acc2), s3 = vaddvq_f32(acc3);
+        for (; i < dim; ++i) {
+            s0 = accumulate<L2>(q0[i], vec[i], s0);
+            s1 = accumulate<L2>(q1[i], vec[i], s1);
+            s2 = accumulate<L2>(q2[i], vec[i], s2);
+            s3 = accumulate<L2>(q3[i], vec[i], s3);
+        }
+        out[q] = s0;
+        out[q + 1] = s1;
+        out[q + 2] = s2;
+        out[q + 3] = s3;
+    }
+    for (; q < count; ++q) {
+        out[q] = L2 ? l2_sqr(queries + q * dim, vec, dim) : inner_product(queries + q * dim, vec, dim);
+    }
+}
+
+void inner_product_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                         float* out) {
+    batch<false>(queries, count, vec, dim, out);
+}
+
+void l2_sqr_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                  float* out) {
+    batch<true>(queries, count, vec, dim, out);
+}
+
+// Both metrics are symmetric: one query against a block of vectors is
+// the batch kernel with the roles swapped, four vectors per query load
+void inner_product_block(const float* query, const float* vectors, size_t count, size_t dim,
+                         float* out) {
+    batch<false>(vectors, count, query, dim, out);
+}
+
+void l2_sqr_block(const float* query, const float* vectors, size_t count, size_t dim, float* out) {
+    batch<true>(vectors, count, query, dim, out);
+}
+
+// Tiles of four queries by four vectors: 16 accumulators and 8 operands
+// fit the 32 vector registers, each load feeding four FMAs
+template <bool L2>
+void matrix(const float* queries, size_t nq, const float* vectors, size_t count, size_t dim,
+            float* out) {
+    constexpr size_t kTile = 4;
+    size_t q = 0;
+    for (; q + kTile <= nq; q += kTile) {
+        const float* a[kTile];
+        for (size_t r = 0; r < kTile; ++r) a[r] = queries + (q + r) * dim;
+        size_t v = 0;
+        for (; v + kTile <= count; v += kTile) {
+            const float* b[kTile];
+            for (size_t c = 0; c < kTile; ++c) b[c] = vectors + (v + c) * dim;
+            float32x4_t acc[kTile][kTile];
+            for (size_t r = 0; r < kTile; ++r) {
+                for (size_t c = 0; c < kTile; ++c) acc[r][c] = vdupq_n_f32(0.0f);
+            }
+            size_t i = 0;
+            for (; i + 4 <= dim; i += 4) {
+                float32x4_t x[kTile];
+                for (size_t r = 0; r < kTile; ++r) x[r] = vld1q_f32(a[r] + i);
+                for (size_t c = 0; c < kTile; ++c) {
+                    const float32x4_t y = vld1q_f32(b[c] + i);
+                    for (size_t r = 0; r < kTile; ++r) acc[r][c] = accumulate<L2>(x[r], y, acc[r][c]);
+                }
+            }
+            for (size_t r = 0; r < kTile; ++r) {
+                for (size_t c = 0; c < kTile; ++c) {
+                    float s = vaddvq_f32(acc[r][c]);
+                    for (size_t j = i; j < dim; ++j) s = accumulate<L2>(a[r][j], b[c][j], s);
+                    out[(q + r) * count + v + c] = s;
+                }
+            }
+        }
+        for (; v < count; ++v) {
+            const float* b = vectors + v * dim;
+            for (size_t r = 0; r < kTile; ++r) {
+                out[(q + r) * count + v] = L2 ? l2_sqr(a[r], b, dim) : inner_product(a[r], b, dim);
+            }
+        }
+    }
+    for (; q < nq; ++q) {
+        batch<L2>(vectors, count, queries + q * dim, dim, out + q * count);
+    }
+}
+
+void inner_product_matrix(const float* queries, size_t nq, const float* vectors, size_t count,
+                          size_t dim, float* out) {
+    matrix<false>(queries, nq, vectors, count, dim, out);
+}
+
+void l2_sqr_matrix(const float* queries, size_t nq, const float* vectors, size_t count, size_t dim,
+                   float* out) {
+    matrix<true>(queries, nq, vectors, count, dim, out);
+}
+
+// One vector at a time, prefetching the next one's first lines
+void scan_list(const float* query, const float* vectors, size_t count, size_t dim, bool l2,
+               uint64_t first_row, ScanHeap& heap) {
+    for (size_t i = 0; i < count; ++i) {
+        const float* v = vectors + i * dim;
+        if (i + 1 < count) {
+            for (size_t d = 0; d < dim && d < 64; d += 16) {
+                __builtin_prefetch(v + dim + d, 0, 3);
+            }
+        }
+        const Score s = l2 ? -l2_sqr(query, v, dim) : inner_product(query, v, dim);
+        if (s > heap.threshold()) heap.push(s, first_row + i);
+    }
+}
+
+// One 16-byte table lookup (tbl) per subquantizer looks up its 16 codes:
+// low nibbles are rows 0-15, high nibbles rows 16-31. A pair's lookups
+// are summed while widening to uint16.
+void pq4_scan(const uint8_t* lut, const uint8_t* blocks, size_t nblocks, size_t pairs, uint16_t* out) {
+    const uint8x16_t nibble = vdupq_n_u8(0x0f);
+    const size_t block_bytes = pairs * 32;
+    for (size_t b = 0; b < nblocks; ++b) {
+        const uint8_t* codes = blocks + b * block_bytes;
+        uint16x8_t acc_lo0 = vdupq_n_u16(0), acc_lo1 = vdupq_n_u16(0);
+        uint16x8_t acc_hi0 = vdupq_n_u16(0), acc_hi1 = vdupq_n_u16(0);
+        for (size_t p = 0; p < pairs; ++p) {
+            if (p % 2 == 0 && b + 1 < nblocks) {
+                __builtin_prefetch(codes + block_bytes + p * 32, 0, 3);
+            }
+            const uint8x16_t t0 = vld1q_u8(lut + p * 32);
+            const uint8x16_t t1 = vld1q_u8(lut + p * 32 + 16);
+            const uint8x16_t c0 = vld1q_u8(codes + p * 32);
+            const uint8x16_t c1 = vld1q_u8(codes + p * 32 + 16);
+            const uint8x16_t lo0 = vqtbl1q_u8(t0, vandq_u8(c0, nibble));
+            const uint8x16_t lo1 = vqtbl1q_u8(t1, vandq_u8(c1, nibble));
+            const uint8x16_t hi0 = vqtbl1q_u8(t0, vshrq_n_u8(c0, 4));
+            const uint8x16_t hi1 = vqtbl1q_u8(t1, vshrq_n_u8(c1, 4));
+            acc_lo0 = vaddq_u16(acc_lo0, vaddl_u8(vget_low_u8(lo0), vget_low_u8(lo1)));
+            acc_lo1 = vaddq_u16(acc_lo1, vaddl_high_u8(lo0, lo1));
+            acc_hi0 = vaddq_u16(acc_hi0, vaddl_u8(vget_low_u8(hi0), vget_low_u8(hi1)));
+            acc_hi1 = vaddq_u16(acc_hi1, vaddl_high_u8(hi0, hi1));
+        }
+        vst1q_u16(out + b * 32, acc_lo0);
+        vst1q_u16(out + b * 32 + 8, acc_lo1);
+        vst1q_u16(out + b * 32 + 16, acc_hi0);
+        vst1q_u16(out + b * 32 + 24, acc_hi1);
+    }
+}
+
+// Widen 8 stored components to two fp32 vectors
+inline void load_fp16(const uint16_t* p, float32x4_t& lo, float32x4_t& hi) {
+    const float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(p));
+    lo = vcvt_f32_f16(vget_low_f16(h));
+    hi = vcvt_high_f32_f16(h);
+}
+
+inline void load_bf16(const uint16_t* p, float32x4_t& lo, float32x4_t& hi) {
+    const uint16x8_t w = vld1q_u16(p);
+    lo = vreinterpretq_f32_u32(vshll_n_u16(vget_low_u16(w), 16));
+    hi = vreinterpretq_f32_u32(vshll_high_n_u16(w, 16));
+}
+
+inline void load_int8(const int8_t* p, float32x4_t& lo, float32x4_t& hi) {
+    const int16x8_t w = vmovl_s8(vld1_s8(p));
+    lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(w)));
+    hi = vcvtq_f32_s32(vmovl_high_s16(w));
+}
+
+inline float fp16_at(uint16_t v) { return util::fp16_to_float(v); }
+inline float bf16_at(uint16_t v) { return util::bf16_to_float(v); }
+inline float int8_at(int8_t v) { return static_cast<float>(v); }
+
+template <typename T, void (*Load)(const T*, float32x4_t&, float32x4_t&), float (*At)(T)>
+float encoded_inner_product(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        float32x4_t lo, hi;
+        Load(v + i, lo, hi);
+        acc0 = vfmaq_f32(acc0, vld1q_f32(q + i), lo);
+        acc1 = vfmaq_f32(acc1, vld1q_f32(q + i + 4), hi);
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += q[i] * At(v[i]);
+    }
+    return sum * scale;
+}
+
+template <typename T, void (*Load)(const T*, float32x4_t&, float32x4_t&), float (*At)(T)>
+float encoded_l2_sqr(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    const float32x4_t s = vdupq_n_f32(scale);
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        float32x4_t lo, hi;
+        Load(v + i, lo, hi);
+        float32x4_t d0 = vfmsq_f32(vld1q_f32(q + i), lo, s);
+        float32x4_t d1 = vfmsq_f32(vld1q_f32(q + i + 4), hi, s);
+        acc0 = vfmaq_f32(acc0, d0, d0);
+        acc1 = vfmaq_f32(acc1, d1, d1);
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < dim; ++i) {
+        float d = q[i] - scale * At(v[i]);
+        sum += d * d;
+    }
+    return sum;
+}
+
+// Pair kernels over a block; stored norms from |q - v|^2 - |q|^2 + 2 q.v
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_block(const float* query, const void* vectors, const float* scales, size_t count, size_t dim,
+                   float* out, float* sqr_norms) {
+    const auto* rows = static_cast<const T*>(vectors);
+    const float qq = sqr_norms ? inner_product(query, query, dim) : 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        const T* v = rows + i * dim;
+        const float scale = scales ? scales[i] : 1.0f;
+        out[i] = Ip(query, v, scale, dim);
+        if (sqr_norms) sqr_norms[i] = L2(query, v, scale, dim) - qq + 2.0f * out[i];
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_matrix(const float* queries, size_t nq, const void* vectors, const float* scales, size_t count,
+                    size_t dim, float* out, float* sqr_norms) {
+    for (size_t q = 0; q < nq; ++q) {
+        encoded_block<T, Ip, L2>(queries + q * dim, vectors, scales, count, dim, out + q * count,
+                                 q == 0 ? sqr_norms : nullptr);
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+constexpr EncodedKernels encoded() {
+    return {Ip, L2, encoded_block<T, Ip, L2>, encoded_matrix<T, Ip, L2>};
+}
+
+} // namespace
+
+const DistanceTable table = {
+    "neon",
+    inner_product,
+    l2_sqr,
+    inner_product_batch,
+    l2_sqr_batch,
+    inner_product_block,
+    l2_sqr_block,
+    inner_product_matrix,
+    l2_sqr_matrix,
+    scan_list,
+    pq4_scan,
+    encoded<uint16_t, encoded_inner_product<uint16_t, load_fp16, fp16_at>,
+            encoded_l2_sqr<uint16_t, load_fp16, fp16_at>>(),
+    encoded<uint16_t, encoded_inner_product<uint16_t, load_bf16, bf16_at>,
+            encoded_l2_sqr<uint16_t, load_bf16, bf16_at>>(),
+    encoded<int8_t, encoded_inner_product<int8_t, load_int8, int8_at>,
+            encoded_l2_sqr<int8_t, load_int8, int8_at>>(),
+};
+
+} // namespace woved::kernels::neon
@@ -0,0 +1,337 @@
+#include "util/simd-dispatch.h"
+#include <arm_sve.h>
+
+// Vector-length agnostic: every loop steps by svcntw() lanes and the
+// tail is a whilelt predicate, so one binary runs on 128- to 2048-bit
+// implementations. Predicated loads zero inactive lanes.
+namespace woved::kernels::sve {
+
+namespace {
+
+template <bool L2>
+inline svfloat32_t accumulate(svbool_t pg, svfloat32_t x, svfloat32_t y, svfloat32_t acc) {
+    if constexpr (L2) {
+        svfloat32_t d = svsub_f32_x(pg, x, y);
+        return svmla_f32_m(pg, acc, d, d);
+    } else {
+        return svmla_f32_m(pg, acc, x, y);
+    }
+}
+
+// Two accumulators over full vectors, then one predicated pass
+template <bool L2>
+float pair(const float* a, const float* b, size_t dim) {
+    const size_t vl = svcntw();
+    const svbool_t all = svptrue_b32();
+    svfloat32_t acc0 = svdup_n_f32(0.0f);
+    svfloat32_t acc1 = svdup_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 2 * vl <= dim; i += 2 * vl) {
+        acc0 = accumulate<L2>(all, svld1_f32(all, a + i), svld1_f32(all, b + i), acc0);
+        acc1 = accumulate<L2>(all, svld1_f32(all, a + i + vl), svld1_f32(all, b + i + vl), acc1);
+    }
+    for (; i < dim; i += vl) {
+        const svbool_t pg = svwhilelt_b32_u64(i, dim);
+        acc0 = accumulate<L2>(pg, svld1_f32(pg, a + i), svld1_f32(pg, b + i), acc0);
+    }
+    return svaddv_f32(all, svadd_f32_x(all, acc0, acc1));
+}
+
+float inner_product(const float* a, const float* b, size_t dim) { return pair<false>(a, b, dim); }
+
+float l2_sqr(const float* a, const float* b, size_t dim) { return pair<true>(a, b, dim); }
+
+// Four queries per pass share each load of the vector
+template <bool L2>
+void batch(const float* queries, size_t count, const float* vec, size_t dim, float* out) {
+    const svbool_t all = svptrue_b32();
+    size_t q = 0;
+    for (; q + 4 <= count; q += 4) {
+        const float* q0 = queries + q * dim;
+        const float* q1 = q0 + dim;
+        const float* q2 = q1 + dim;
+        const float* q3 = q2 + dim;
+        svfloat32_t acc0 = svdup_n_f32(0.0f);
+        svfloat32_t acc1 = svdup_n_f32(0.0f);
+        svfloat32_t acc2 = svdup_n_f32(0.0f);
+        svfloat32_t acc3 = svdup_n_f32(0.0f);
+        for (size_t i = 0; i < dim; i += svcntw()) {
+            const svbool_t pg = svwhilelt_b32_u64(i, dim);
+            const svfloat32_t v = svld1_f32(pg, vec + i);
+            acc0 = accumulate<L2>(pg, svld1_f32(pg, q0 + i), v, acc0);
+            acc1 = accumulate<L2>(pg, svld1_f32(pg, q1 + i), v, acc1);
+            acc2 = accumulate<L2>(pg, svld1_f32(pg, q2 + i), v, acc2);
+            acc3 = accumulate<L2>(pg, svld1_f32(pg, q3 + i), v, acc3);
+        }
+        out[q] = svaddv_f32(all, acc0);
+        out[q + 1] = svaddv_f32(all, acc1);
+        out[q + 2] = svaddv_f32(all, acc2);
+        out[q + 3] = svaddv_f32(all, acc3);
+    }
+    for (; q < count; ++q) {
+        out[q] = pair<L2>(queries + q * dim, vec, dim);
+    }
+}
+
+void inner_product_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                         float* out) {
+    batch<false>(queries, count, vec, dim, out);
+}
+
+void l2_sqr_batch(const float* queries, size_t count, const float* vec, size_t dim,
+                  float* out) {
+    batch<true>(queries, count, vec, dim, out);
+}
+
+// Both metrics are symmetric: one query against a block of vectors is
+// the batch kernel with the roles swapped, four vectors per query load
+void inner_product_block(const float* query, const float* vectors, size_t count, size_t dim,
+                         float* out) {
+    batch<false>(vectors, count, query, dim, out);
+}
+
+void l2_sqr_block(const float* query, const float* vectors, size_t count, size_t dim, float* out) {
+    batch<true>(vectors, count, query, dim, out);
+}
+
+// Tiles of four queries by four vectors, as for NEON: SVE also has 32
+// vector registers
+template <bool L2>
+void matrix(const float* queries, size_t nq, const float* vectors, size_t count, size_t dim,
+            float* out) {
+    constexpr size_t kTile = 4;
+    const svbool_t all = svptrue_b32();
+    size_t q = 0;
+    for (; q + kTile <= nq; q += kTile) {
+        const float* a0 = queries + q * dim;
+        const float* a1 = a0 + dim;
+        const float* a2 = a1 + dim;
+        const float* a3 = a2 + dim;
+        size_t v = 0;
+        for (; v + kTile <= count; v += kTile) {
+            // Sizeless SVE types cannot form arrays: one named accumulator
+            // per query and vector
+            svfloat32_t acc00 = svdup_n_f32(0.0f), acc01 = svdup_n_f32(0.0f);
+            svfloat32_t acc02 = svdup_n_f32(0.0f), acc03 = svdup_n_f32(0.0f);
+            svfloat32_t acc10 = svdup_n_f32(0.0f), acc11 = svdup_n_f32(0.0f);
+            svfloat32_t acc12 = svdup_n_f32(0.0f), acc13 = svdup_n_f32(0.0f);
+            svfloat32_t acc20 = svdup_n_f32(0.0f), acc21 = svdup_n_f32(0.0f);
+            svfloat32_t acc22 = svdup_n_f32(0.0f), acc23 = svdup_n_f32(0.0f);
+            svfloat32_t acc30 = svdup_n_f32(0.0f), acc31 = svdup_n_f32(0.0f);
+            svfloat32_t acc32 = svdup_n_f32(0.0f), acc33 = svdup_n_f32(0.0f);
+            const float* b0 = vectors + v * dim;
+            const float* b1 = b0 + dim;
+            const float* b2 = b1 + dim;
+            const float* b3 = b2 + dim;
+            for (size_t i = 0; i < dim; i += svcntw()) {
+                const svbool_t pg = svwhilelt_b32_u64(i, dim);
+                const svfloat32_t x0 = svld1_f32(pg, a0 + i);
+                const svfloat32_t x1 = svld1_f32(pg, a1 + i);
+                const svfloat32_t x2 = svld1_f32(pg, a2 + i);
+                const svfloat32_t x3 = svld1_f32(pg, a3 + i);
+                svfloat32_t y = svld1_f32(pg, b0 + i);
+                acc00 = accumulate<L2>(pg, x0, y, acc00);
+                acc10 = accumulate<L2>(pg, x1, y, acc10);
+                acc20 = accumulate<L2>(pg, x2, y, acc20);
+                acc30 = accumulate<L2>(pg, x3, y, acc30);
+                y = svld1_f32(pg, b1 + i);
+                acc01 = accumulate<L2>(pg, x0, y, acc01);
+                acc11 = accumulate<L2>(pg, x1, y, acc11);
+                acc21 = accumulate<L2>(pg, x2, y, acc21);
+                acc31 = accumulate<L2>(pg, x3, y, acc31);
+                y = svld1_f32(pg, b2 + i);
+                acc02 = accumulate<L2>(pg, x0, y, acc02);
+                acc12 = accumulate<L2>(pg, x1, y, acc12);
+                acc22 = accumulate<L2>(pg, x2, y, acc22);
+                acc32 = accumulate<L2>(pg, x3, y, acc32);
+                y = svld1_f32(pg, b3 + i);
+                acc03 = accumulate<L2>(pg, x0, y, acc03);
+                acc13 = accumulate<L2>(pg, x1, y, acc13);
+                acc23 = accumulate<L2>(pg, x2, y, acc23);
+                acc33 = accumulate<L2>(pg, x3, y, acc33);
+            }
+            float* o0 = out + q * count + v;
+            float* o1 = o0 + count;
+            float* o2 = o1 + count;
+            float* o3 = o2 + count;
+            o0[0] = svaddv_f32(all, acc00); o0[1] = svaddv_f32(all, acc01);
+            o0[2] = svaddv_f32(all, acc02); o0[3] = svaddv_f32(all, acc03);
+            o1[0] = svaddv_f32(all, acc10); o1[1] = svaddv_f32(all, acc11);
+            o1[2] = svaddv_f32(all, acc12); o1[3] = svaddv_f32(all, acc13);
+            o2[0] = svaddv_f32(all, acc20); o2[1] = svaddv_f32(all, acc21);
+            o2[2] = svaddv_f32(all, acc22); o2[3] = svaddv_f32(all, acc23);
+            o3[0] = svaddv_f32(all, acc30); o3[1] = svaddv_f32(all, acc31);
+            o3[2] = svaddv_f32(all, acc32); o3[3] = svaddv_f32(all, acc33);
+        }
+        for (; v < count; ++v) {
+            const float* b = vectors + v * dim;
+            out[q * count + v] = pair<L2>(a0, b, dim);
+            out[(q + 1) * count + v] = pair<L2>(a1, b, dim);
+            out[(q + 2) * count + v] = pair<L2>(a2, b, dim);
+            out[(q + 3) * count + v] = pair<L2>(a3, b, dim);
+        }
+    }
+    for (; q < nq; ++q) {
+        batch<L2>(vectors, count, queries + q * dim, dim, out + q * count);
+    }
+}
+
+void inner_product_matrix(const float* queries, size_t nq, const float* vectors, size_t count,
+                          size_t dim, float* out) {
+    matrix<false>(queries, nq, vectors, count, dim, out);
+}
+
+void l2_sqr_matrix(const float* queries, size_t nq, const float* vectors, size_t count, size_t dim,
+                   float* out) {
+    matrix<true>(queries, nq, vectors, count, dim, out);
+}
+
+// One vector at a time, prefetching the next one's first lines
+void scan_list(const float* query, const float* vectors, size_t count, size_t dim, bool l2,
+               uint64_t first_row, ScanHeap& heap) {
+    for (size_t i = 0; i < count; ++i) {
+        const float* v = vectors + i * dim;
+        if (i + 1 < count) {
+            for (size_t d = 0; d < dim && d < 64; d += 16) {
+                __builtin_prefetch(v + dim + d, 0, 3);
+            }
+        }
+        const Score s = l2 ? -l2_sqr(query, v, dim) : inner_product(query, v, dim);
+        if (s > heap.threshold()) heap.push(s, first_row + i);
+    }
+}
+
+// The tables and a block's codes share one layout, 16 bytes per
+// subquantizer, so a vector load of each lines up VL / 16 subquantizers
+// with their tables, one per 128-bit segment. One tbl over the whole
+// vector looks them all up once each segment's indices are offset by
+// 16 * segment. Sums accumulate per byte lane, widened to uint16, and
+// fold across segments per block (row = lane % 16). The tail predicate
+// ends on a segment boundary (pairs * 32 bytes): its inactive segments
+// load zero tables and look up zeros.
+void pq4_scan(const uint8_t* lut, const uint8_t* blocks, size_t nblocks, size_t pairs, uint16_t* out) {
+    const size_t vl = svcntb();
+    const size_t half = svcnth();
+    const size_t block_bytes = pairs * 32;
+    const svbool_t all8 = svptrue_b8();
+    const svbool_t all16 = svptrue_b16();
+    const svuint8_t segment = svand_n_u8_x(all8, svindex_u8(0, 1), 0xf0);
+    uint16_t lanes[2 * 256];  // Two vectors of uint16 per nibble, up to 2048-bit
+    for (size_t b = 0; b < nblocks; ++b) {
+        const uint8_t* codes = blocks + b * block_bytes;
+        svuint16_t lo0 = svdup_n_u16(0), lo1 = svdup_n_u16(0);
+        svuint16_t hi0 = svdup_n_u16(0), hi1 = svdup_n_u16(0);
+        for (size_t off = 0; off < block_bytes; off += vl) {
+            const svbool_t pg = svwhilelt_b8_u64(off, block_bytes);
+            const svuint8_t table = svld1_u8(pg, lut + off);
+            const svuint8_t c = svld1_u8(pg, codes + off);
+            const svuint8_t d_lo = svtbl_u8(table, svorr_u8_x(all8, svand_n_u8_x(all8, c, 0x0f), segment));
+            const svuint8_t d_hi = svtbl_u8(table, svorr_u8_x(all8, svlsr_n_u8_x(all8, c, 4), segment));
+            lo0 = svadd_u16_x(all16, lo0, svunpklo_u16(d_lo));
+            lo1 = svadd_u16_x(all16, lo1, svunpkhi_u16(d_lo));
+            hi0 = svadd_u16_x(all16, hi0, svunpklo_u16(d_hi));
+            hi1 = svadd_u16_x(all16, hi1, svunpkhi_u16(d_hi));
+        }
+        svst1_u16(all16, lanes, lo0);
+        svst1_u16(all16, lanes + half, lo1);
+        svst1_u16(all16, lanes + vl, hi0);
+        svst1_u16(all16, lanes + vl + half, hi1);
+        uint16_t* sums = out + b * 32;
+        for (size_t r = 0; r < 32; ++r) sums[r] = 0;
+        for (size_t k = 0; k < vl; ++k) {
+            sums[k % 16] = static_cast<uint16_t>(sums[k % 16] + lanes[k]);
+            sums[16 + k % 16] = static_cast<uint16_t>(sums[16 + k % 16] + lanes[vl + k]);
+        }
+    }
+}
+
+// Widen one vector's worth of stored components to fp32: extending loads
+// put each in its own 32-bit lane
+inline svfloat32_t load_fp16(svbool_t pg, const uint16_t* p) {
+    // An fp16 in the low half of a 32-bit container is what fcvt reads
+    return svcvt_f32_f16_x(pg, svreinterpret_f16_u32(svld1uh_u32(pg, p)));
+}
+
+inline svfloat32_t load_bf16(svbool_t pg, const uint16_t* p) {
+    return svreinterpret_f32_u32(svlsl_n_u32_x(pg, svld1uh_u32(pg, p), 16));
+}
+
+inline svfloat32_t load_int8(svbool_t pg, const int8_t* p) {
+    return svcvt_f32_s32_x(pg, svld1sb_s32(pg, p));
+}
+
+template <typename T, svfloat32_t (*Load)(svbool_t, const T*)>
+float encoded_inner_product(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    svfloat32_t acc = svdup_n_f32(0.0f);
+    for (size_t i = 0; i < dim; i += svcntw()) {
+        const svbool_t pg = svwhilelt_b32_u64(i, dim);
+        acc = svmla_f32_m(pg, acc, svld1_f32(pg, q + i), Load(pg, v + i));
+    }
+    return svaddv_f32(svptrue_b32(), acc) * scale;
+}
+
+template <typename T, svfloat32_t (*Load)(svbool_t, const T*)>
+float encoded_l2_sqr(const float* q, const void* vec, float scale, size_t dim) {
+    const T* v = static_cast<const T*>(vec);
+    const svfloat32_t s = svdup_n_f32(scale);
+    svfloat32_t acc = svdup_n_f32(0.0f);
+    for (size_t i = 0; i < dim; i += svcntw()) {
+        const svbool_t pg = svwhilelt_b32_u64(i, dim);
+        const svfloat32_t d = svmls_f32_x(pg, svld1_f32(pg, q + i), s, Load(pg, v + i));
+        acc = svmla_f32_m(pg, acc, d, d);
+    }
+    return svaddv_f32(svptrue_b32(), acc);
+}
+
+// Pair kernels over a block; stored norms from |q - v|^2 - |q|^2 + 2 q.v
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_block(const float* query, const void* vectors, const float* scales, size_t count, size_t dim,
+                   float* out, float* sqr_norms) {
+    const auto* rows = static_cast<const T*>(vectors);
+    const float qq = sqr_norms ? inner_product(query, query, dim) : 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        const T* v = rows + i * dim;
+        const float scale = scales ? scales[i] : 1.0f;
+        out[i] = Ip(query, v, scale, dim);
+        if (sqr_norms) sqr_norms[i] = L2(query, v, scale, dim) - qq + 2.0f * out[i];
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+void encoded_matrix(const float* queries, size_t nq, const void* vectors, const float* scales, size_t count,
+                    size_t dim, float* out, float* sqr_norms) {
+    for (size_t q = 0; q < nq; ++q) {
+        encoded_block<T, Ip, L2>(queries + q * dim, vectors, scales, count, dim, out + q * count,
+                                 q == 0 ? sqr_norms : nullptr);
+    }
+}
+
+template <typename T, EncodedPairFn Ip, EncodedPairFn L2>
+constexpr EncodedKernels encoded() {
+    return {Ip, L2, encoded_block<T, Ip, L2>, encoded_matrix<T, Ip, L2>};
+}
+
+} // namespace
+
+const DistanceTable table = {
+    "sve",
+    inner_product,
+    l2_sqr,
+    inner_product_batch,
+    l2_sqr_batch,
+    inner_product_block,
+    l2_sqr_block,
+    inner_product_matrix,
+    l2_sqr_matrix,
+    scan_list,
+    pq4_scan,
+    encoded<uint16_t, encoded_inner_product<uint16_t, load_fp16>,
+            encoded_l2_sqr<uint16_t, load_fp16>>(),
+    encoded<uint16_t, encoded_inner_product<uint16_t, load_bf16>,
+            encoded_l2_sqr<uint16_t, load_bf16>>(),
+    encoded<int8_t, encoded_inner_product<int8_t, load_int8>,
+            encoded_l2_sqr<int8_t, load_int8>>(),
+};
+
+} // namespace woved::kernels::sve
@@ -0,0 +1,349 @@
+#include "b-epsilon-tree.h"
+#include "core/metrics.h"
+#include "storage/betree/epsilon-tuner.h"
+#include "util/logging.h"
+#include "util/thread-pool.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+
+namespace woved::storage {
+
+class BEpsilonTree::Impl {
+public:
+    Impl(const BTreeConfig& config, std::shared_ptr<SegmentManager> segment_mgr)
+        : config(config), segments(std::move(segment_mgr)),
+          tuner(EpsilonTuner::Options::fromConfig(config, config.fanout)) {
+        this->config.fanout = std::max<size_t>(2, this->config.fanout);
+        this->config.height = std::max<size_t>(1, this->config.height);
+        build(0, Range(1) << 64, this->config.height - 1, 0);
+        if (this->config.parallel_flush) {
+            util::ThreadPool::Options pool_options;
+            pool_options.threads = this->config.flush_threads;
+            pool_options.name = "tree flush pool";
+            pool = std::make_unique<util::ThreadPool>(pool_options);
+        }
+    }
+
+    using Range = unsigned __int128;  // Full hash space is 2^64 wide
+
+    BTreeConfig config;
+    std::shared_ptr<SegmentManager> segments;
+    EpsilonTuner tuner;
+
+    // nodes[0] is the root; children follow their parent (preorder)
+    std::vector<std::unique_ptr<BEpsilonNode>> nodes;
+    std::vector<size_t> partition_of;  // Node id -> root child (tuner partition)
+    std::vector<size_t> leaf_of;       // Node id -> leaf ordinal (leaves only)
+    size_t leaves = 0;
+
+    std::unique_ptr<util::ThreadPool> pool;
+    LeafSink leaf_sink;
+    std::atomic<Epoch> epoch{0};
+    std::atomic<size_t> flush_count{0};
+
+    BEpsilonNode& root() const { return *nodes.front(); }
+
+    size_t partitionOf(VectorIdHash hash) const {
+        return root().isLeaf() ? 0 : root().findChild(hash);
+    }
+
+    // Buffer bytes at which a node pushes its messages down
+    size_t limit(const BEpsilonNode& node) const {
+        if (&node == &root()) {
+            size_t pivots = node.pivotCount() * sizeof(VectorIdHash);
+            return config.node_size_bytes > pivots ? config.node_size_bytes - pivots : 1;
+        }
+        return std::max<size_t>(1, tuner.bufferBytes(partition_of[node.id()]));
+    }
+
+    bool due(const BEpsilonNode& node, bool force) const {
+        std::shared_lock<std::shared_mutex> latch(node.latch());
+        return force ? node.bufferCount() > 0 : node.bufferBytes() >= limit(node);
+    }
+
+    size_t build(Range lo, Range hi, size_t level, size_t partition);
+    void apply(BTreeMessage&& msg);
+
+    template <typename Fn>
+    void forEach(size_t n, Fn&& fn) {
+        if (pool && n > 1) {
+            pool->parallelFor(n, fn);
+        } else {
+            for (size_t i = 0; i < n; ++i) fn(i);
+        }
+    }
+
+    // Flush `node` if due, then look for due nodes below it
+    void visit(BEpsilonNode& node, bool force);
+    void flushNode(BEpsilonNode& node, bool force);
+    void flushLeaf(BEpsilonNode& leaf);
+};
+
+size_t BEpsilonTree::Impl::build(Range lo, Range hi, size_t level, size_t partition) {
+    const size_t id = nodes.size();
+    const bool leaf = level == 0 || hi - lo < config.fanout;
+    nodes.push_back(std::make_unique<BEpsilonNode>(id, leaf ? 0 : static_cast<uint32_t>(level),
+                                                   leaf ? 0 : config.fanout - 1));
+    partition_of.push_back(partition);
+    leaf_of.push_back(leaf ? leaves++ : 0);
+    if (leaf) return id;
+
+    std::vector<VectorIdHash> pivots(config.fanout - 1);
+    const Range width = hi - lo;
+    for (size_t i = 1; i < config.fanout; ++i) {
+        pivots[i - 1] = static_cast<VectorIdHash>(lo + width * i / config.fanout);
+    }
+    nodes[id]->setPivots(pivots);
+
+    std::vector<uint64_t> children;
+    for (size_t i = 0; i < config.fanout; ++i) {
+        Range child_lo = i == 0 ? lo : Range(pivots[i - 1]);
+        Range child_hi = i + 1 == config.fanout ? hi : Range(pivots[i]);
+        children.push_back(build(child_lo, child_hi, level - 1, id == 0 ? i : partition));
+    }
+    nodes[id]->children() = std::move(children);
+    return id;
+}
+
+void BEpsilonTree::Impl::apply(BTreeMessage&& msg) {
+    tuner.recordWrites(partitionOf(msg.entry.id_hash));
+    Epoch seen = epoch.load(std::memory_order_relaxed);
+    while (msg.epoch > seen && !epoch.compare_exchange_weak(seen, msg.epoch)) {}
+
+    BEpsilonNode& node = root();
+    WriteAccounting& writes = Metrics::global().writes;
+    const uint64_t bytes = BEpsilonNode::messageBytes(msg);
+    writes.addLevel(node.level(), bytes);
+    writes.addTenant(WritePoint::NodeFlush, msg.entry.tenant, bytes);
+    {
+        std::unique_lock<std::shared_mutex> latch(node.latch());
+        node.append(std::move(msg));
+    }
+    if (!due(node, false)) return;
+    try {
+        flushNode(node, false);
+    } catch (const std::exception& e) {
+        // The messages stay buffered for the next flush
+        LOG_WARN("B-epsilon tree flush failed: {}", e.what());
+    }
+}
+
+void BEpsilonTree::Impl::visit(BEpsilonNode& node, bool force) {
+    if (due(node, force)) flushNode(node, force);
+
+    // Subtrees are independent: check them concurrently for nodes still due
+    const auto& children = node.children();
+    forEach(children.size(), [&](size_t i) { visit(*nodes[children[i]], force); });
+}
+
+void BEpsilonTree::Impl::flushNode(BEpsilonNode& node, bool force) {
+    if (!node.tryBeginFlush()) return;  // Another thread is on it
+    struct Release {
+        BEpsilonNode& node;
+        ~Release() { node.endFlush(); }
+    } release{node};
+
+    if (node.isLeaf()) {
+        flushLeaf(node);
+        return;
+    }
+
+    const auto& children = node.children();
+    WriteAccounting& writes = Metrics::global().writes;
+    TenantTally moved;
+    {
+        std::unique_lock<std::shared_mutex> latch(node.latch());
+        if (node.bufferCount() == 0) return;
+        auto runs = node.takeChildRuns();
+
+        // Every run reaches its child before the parent latch drops. The
+        // moves are cheap; no pool work runs under a latch, so a helping
+        // thread never waits on a latch it holds itself.
+        for (size_t i = 0; i < children.size(); ++i) {
+            if (runs[i].empty()) continue;
+            BEpsilonNode& child = *nodes[children[i]];
+            std::unique_lock<std::shared_mutex> child_latch(child.latch());
+            const uint64_t before = moved.total();
+            for (auto& m : runs[i]) {
+                moved.add(m.msg.entry.tenant, BEpsilonNode::messageBytes(m.msg));
+                child.append(std::move(m.msg));
+            }
+            writes.addLevel(child.level(), moved.total() - before);
+        }
+    }
+    flush_count.fetch_add(1, std::memory_order_relaxed);
+    moved.commit(writes, WritePoint::NodeFlush);
+
+    forEach(children.size(), [&](size_t i) {
+        BEpsilonNode& child = *nodes[children[i]];
+        if (due(child, force)) flushNode(child, force);
+    });
+}
+
+void BEpsilonTree::Impl::flushLeaf(BEpsilonNode& leaf) {
+    if (!leaf_sink) return;  // Nowhere to write yet: keep buffering
+
+    size_t count = 0;
+    {
+        std::unique_lock<std::shared_mutex> latch(leaf.latch());
+        leaf.sortBuffer();
+        count = leaf.bufferCount();
+    }
+    if (count == 0) return;
+
+    // Readers still see the messages while they are written; appends from
+    // the parent wait and then land behind them
+    {
+        std::shared_lock<std::shared_mutex> latch(leaf.latch());
+        leaf_sink(leaf_of[leaf.id()], leaf.messages().first(count));
+    }
+    {
+        std::unique_lock<std::shared_mutex> latch(leaf.latch());
+        leaf.eraseFront(count);
+    }
+    flush_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+BEpsilonTree::BEpsilonTree(const BTreeConfig& config, std::shared_ptr<SegmentManager> segment_mgr)
+    : impl_(std::make_unique<Impl>(config, std::move(segment_mgr))) {
+    LOG_INFO("B-epsilon tree: {} nodes, {} leaves, pivot search {}, {} flush",
+             impl_->nodes.size(), impl_->leaves, BEpsilonNode::pivotSearchIsa(),
+             impl_->pool ? "parallel" : "serial");
+}
+
+BEpsilonTree::~BEpsilonTree() = default;
+
+namespace {
+
+BTreeMessage makeMessage(OperationType op, VectorEntry entry, Epoch epoch) {
+    BTreeMessage msg;
+    msg.op = op;
+    msg.entry = std::move(entry);
+    msg.epoch = epoch;
+    msg.timestamp = std::chrono::duration_cast<Timestamp>(
+        std::chrono::system_clock::now().time_since_epoch());
+    return msg;
+}
+
+} // namespace
+
+void BEpsilonTree::insert(const VectorEntry& entry) {
+    impl_->apply(makeMessage(OperationType::INSERT, entry, impl_->epoch.fetch_add(1) + 1));
+}
+
+void BEpsilonTree::upsert(const VectorEntry& entry) {
+    impl_->apply(makeMessage(OperationType::UPSERT, entry, impl_->epoch.fetch_add(1) + 1));
+}
+
+void BEpsilonTree::remove(const VectorId& id, const VectorIdHash& id_hash) {
+    VectorEntry entry;
+    entry.id = id;
+    entry.id_hash = id_hash;
+    entry.deleted = true;
+    impl_->apply(makeMessage(OperationType::DELETE, std::move(entry), impl_->epoch.fetch_add(1) + 1));
+}
+
+void BEpsilonTree::apply(BTreeMessage&& msg) {
+    impl_->apply(std::move(msg));
+}
+
+std::optional<BTreeMessage> BEpsilonTree::lookup(VectorIdHash id_hash) const {
+    impl_->tuner.recordQueries(impl_->partitionOf(id_hash));
+
+    std::optional<BTreeMessage> found;
+    const BEpsilonNode* node = &impl_->root();
+    while (true) {
+        std::shared_lock<std::shared_mutex> latch(node->latch());
+        const BEpsilonNode::Message* m = node->findLatest(id_hash);
+        if (m && (!found || m->msg.epoch > found->epoch)) found = m->msg;
+        if (node->isLeaf()) break;
+        node = impl_->nodes[node->children()[node->findChild(id_hash)]].get();
+    }
+    return found;
+}
+
+void BEpsilonTree::flush(bool force) {
+    impl_->visit(impl_->root(), force);
+}
+
+void BEpsilonTree::flushNode(BEpsilonNode* node) {
+    if (node) impl_->flushNode(*node, false);
+}
+
+size_t BEpsilonTree::checkpoint(std::vector<uint64_t>& versions,
+                               const std::function<void(NodeImage&&)>& emit) const {
+    // Preorder: a parent is copied before any of its children
+    versions.resize(impl_->nodes.size(), ~uint64_t{0});
+    size_t copied = 0;
+    for (const auto& node : impl_->nodes) {
+        NodeImage image;
+        {
+            std::shared_lock<std::shared_mutex> latch(node->latch());
+            if (node->version() == versions[node->id()]) continue;
+            const bool first = versions[node->id()] == ~uint64_t{0};
+            versions[node->id()] = node->version();
+            if (first && node->bufferCount() == 0) continue;  // Restored as empty anyway
+            image.node = node->id();
+            image.messages.reserve(node->bufferCount());
+            for (const auto& m : node->messages()) image.messages.push_back(m.msg);
+        }
+        emit(std::move(image));
+        copied++;
+    }
+    return copied;
+}
+
+void BEpsilonTree::restore(NodeImage&& image) {
+    BEpsilonNode& node = *impl_->nodes.at(image.node);
+    std::unique_lock<std::shared_mutex> latch(node.latch());
+    node.takeBuffer();
+    for (auto& msg : image.messages) node.append(std::move(msg));
+}
+
+size_t BEpsilonTree::nodeCount() const {
+    return impl_->nodes.size();
+}
+
+void BEpsilonTree::setLeafSink(LeafSink sink) {
+    impl_->leaf_sink = std::move(sink);
+}
+
+size_t BEpsilonTree::leafCount() const {
+    return impl_->leaves;
+}
+
+BEpsilonTree::Stats BEpsilonTree::getStats() const {
+    Stats stats{};
+    double fill = 0;
+    for (const auto& node : impl_->nodes) {
+        std::shared_lock<std::shared_mutex> latch(node->latch());
+        stats.total_nodes++;
+        stats.leaf_nodes += node->isLeaf();
+        stats.messages_buffered += node->bufferCount();
+        stats.bytes_buffered += node->bufferBytes();
+        fill += std::min(1.0, static_cast<double>(node->bufferBytes()) / impl_->limit(*node));
+    }
+    stats.avg_fill_ratio = stats.total_nodes ? static_cast<float>(fill / stats.total_nodes) : 0.0f;
+    stats.flush_count = impl_->flush_count.load();
+    return stats;
+}
+
+void BEpsilonTree::adjustEpsilon(float new_epsilon) {
+    impl_->tuner.setEpsilon(new_epsilon);
+    impl_->config.epsilon = new_epsilon;
+    LOG_INFO("B-epsilon tree: base epsilon {:.2f} ({})", new_epsilon,
+             impl_->tuner.adaptive() ? "adaptive" : "fixed");
+}
+
+void BEpsilonTree::enableAdaptiveMode(bool enable) {
+    impl_->tuner.setAdaptive(enable);
+    impl_->config.adaptive_epsilon = enable;
+}
+
+EpsilonTuner& BEpsilonTree::tuner() {
+    return impl_->tuner;
+}
+
+} // namespace woved::storage
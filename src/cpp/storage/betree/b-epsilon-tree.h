@@ -1,10 +1,16 @@
+#pragma once
+
 #include "include/woved/types.h"
+#include "storage/betree/node.h"
 #include <memory>
 #include <functional>
+#include <optional>
+#include <span>
+#include <vector>
 
 namespace woved::storage {
 
-class BEpsilonNode;
+class EpsilonTuner;
 class MessageBuffer;
 class SegmentManager;
 
@@ -12,13 +18,40 @@ struct BTreeConfig {
     size_t node_size_bytes = 65536;  // 64KB
     size_t fanout = 256;
     float epsilon = 0.5f;
+    float min_epsilon = 0.2f;  // Adaptive range per partition
+    float max_epsilon = 0.9f;
     bool adaptive_epsilon = true;
     float hot_partition_threshold = 0.5f;
-    float direct_flush_threshold = 0.8f;
+    float direct_flush_threshold = 0.8f;  // Leaf share of a flush batch that bypasses the tree
+    size_t direct_flush_min_bytes = 33554432;  // 32 MiB
+    size_t height = 2;  // Levels including the leaves (root + fanout leaves)
+    bool parallel_flush = true;  // Flush children and subtrees on a thread pool
+    size_t flush_threads = 0;  // 0 = one per hardware thread
+    size_t node_cache_bytes = 536870912;  // 512 MiB of node pages
+    uint32_t node_cache_protected_level = 1;  // Levels at or above stay cached (0 = off)
 };
 
+// Pivots are fixed at construction: every level splits its hash range into
+// `fanout` equal parts, and each leaf owns one range. Writes land in the
+// root buffer; a node whose buffer passes its limit (the tuner's per-
+// partition buffer size) pushes it down one run per child, and leaves hand
+// theirs to the leaf sink (the delta segment writer).
+//
+// Parallel flush: the runs of a node are appended to its children
+// concurrently, then the children due for a flush, each an independent
+// subtree, are flushed concurrently too, all on the tree's thread pool.
+// Every node has its own latch. A flushing node is latched exclusively
+// only while its runs move into its children, so no message is ever out
+// of both; a leaf keeps its messages, readable under a shared latch,
+// until the sink has written them (a parent flush reaching that leaf
+// waits for the write). Readers walk root to leaf taking
+// shared latches one node at a time.
 class BEpsilonTree {
 public:
+    // Writes the sorted messages of one leaf (ordinal in hash order);
+    // throwing keeps them buffered and fails the flush
+    using LeafSink = std::function<void(size_t leaf, std::span<const BEpsilonNode::Message>)>;
+
     explicit BEpsilonTree(const BTreeConfig& config, 
                           std::shared_ptr<SegmentManager> segment_mgr);
     ~BEpsilonTree();
@@ -28,13 +61,35 @@ public:
     void upsert(const VectorEntry& entry);
     void remove(const VectorId& id, const VectorIdHash& id_hash);
     
-    // Flush control
+    // A message flushed from the message buffer, with its own epoch
+    void apply(BTreeMessage&& msg);
+    
+    // Newest buffered message for an id (a DELETE for removed ids)
+    std::optional<BTreeMessage> lookup(VectorIdHash id_hash) const;
+    
+    // Flush control. force drains every buffer down to the leaf sink;
+    // otherwise only nodes past their limit flush.
     void flush(bool force = false);
     void flushNode(BEpsilonNode* node);
+    void setLeafSink(LeafSink sink);  // Before writes start
+    size_t leafCount() const;
     
-    // Recovery and persistence
-    void checkpoint();
-    void recover(const std::string& manifest_path);
+    // Fuzzy checkpoints (FuzzyCheckpointer). checkpoint() copies the
+    // buffers of the nodes changed since `versions` (one entry per node,
+    // updated in place; start with an empty vector for a full copy) and
+    // hands each to `emit`. Nodes are visited parents first, each under
+    // its own shared latch only, so writes and flushes go on around it; a
+    // message moving down during the pass is copied in its parent, its
+    // child, or both, never in neither. Returns the nodes copied.
+    struct NodeImage {
+        uint64_t node = 0;
+        std::vector<BTreeMessage> messages;
+    };
+    size_t checkpoint(std::vector<uint64_t>& versions, const std::function<void(NodeImage&&)>& emit) const;
+    // Replace a node's buffer with a checkpointed image; before writes start.
+    // Throws std::out_of_range for a node the tree does not have.
+    void restore(NodeImage&& image);
+    size_t nodeCount() const;
     
     // Statistics
     struct Stats {
@@ -47,9 +102,12 @@ public:
     };
     Stats getStats() const;
     
-    // Adaptive tuning
+    // Adaptive tuning. Each subtree under the root (fanout partitions)
+    // has its own epsilon, driven by its write and query rates; these set
+    // the base it is tuned around, or the fixed value without adaptive mode.
     void adjustEpsilon(float new_epsilon);
     void enableAdaptiveMode(bool enable);
+    EpsilonTuner& tuner();
 
 private:
     class Impl;
@@ -0,0 +1,548 @@
+#include "checkpoint.h"
+#include "core/config.h"
+#include "storage/betree/b-epsilon-tree.h"
+#include "storage/buffer/msg-buf.h"
+#include "storage/wal/wal-record.h"
+#include "util/crc32c.h"
+#include "util/exceptions.h"
+#include "util/file-io.h"
+#include "util/intern-table.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <span>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr char kMagic[8] = {'W', 'O', 'V', 'E', 'D', 'F', 'C', 'K'};
+constexpr uint32_t kFormatVersion = 1;
+constexpr size_t kFrameHeader = 8;  // Length, CRC32C
+constexpr uint32_t kMaxRecord = 1u << 30;
+constexpr size_t kWriteBuffer = 1048576;
+
+enum Tag : uint8_t {
+    kHeader = 1,  // Full flag, seq, base, low and high epoch, node and shard count
+    kNode = 2,    // Node, message count, messages
+    kShard = 3,   // Shard, front, end, message count, (seq, message) pairs
+    kEnd = 4,
+};
+
+bool parseName(const std::string& name, uint64_t& seq) {
+    unsigned long long n = 0;
+    int end = 0;
+    if (std::sscanf(name.c_str(), "ckpt-%16llx.bin%n", &n, &end) != 1) return false;
+    if (static_cast<size_t>(end) != name.size()) return false;
+    seq = n;
+    return true;
+}
+
+// Little-endian field writer and reader
+class Writer {
+public:
+    explicit Writer(std::vector<std::byte>& out) : out_(out) {}
+
+    template <typename T>
+    void put(T value) {
+        const auto* p = reinterpret_cast<const std::byte*>(&value);
+        out_.insert(out_.end(), p, p + sizeof(T));
+    }
+    void put(std::span<const std::byte> bytes) {
+        put(static_cast<uint32_t>(bytes.size()));
+        out_.insert(out_.end(), bytes.begin(), bytes.end());
+    }
+
+private:
+    std::vector<std::byte>& out_;
+};
+
+class Reader {
+public:
+    explicit Reader(std::span<const std::byte> in) : in_(in) {}
+
+    bool done() const { return pos_ == in_.size(); }
+
+    template <typename T>
+    T get() {
+        need(sizeof(T));
+        T value;
+        std::memcpy(&value, in_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return value;
+    }
+    std::span<const std::byte> getBytes() {
+        const uint32_t len = get<uint32_t>();
+        need(len);
+        auto bytes = in_.subspan(pos_, len);
+        pos_ += len;
+        return bytes;
+    }
+
+private:
+    std::span<const std::byte> in_;
+    size_t pos_ = 0;
+
+    void need(size_t len) const {
+        if (in_.size() - pos_ < len) throw util::IOException("checkpoint record truncated");
+    }
+};
+
+// A message is stored as the WAL record it was logged as, names in full so
+// it re-interns after a restart
+class MessageCodec {
+public:
+    void encode(const BTreeMessage& msg, Writer& out) {
+        const VectorEntry& entry = msg.entry;
+        tenant_ = util::InternTable::tenants().name(entry.tenant);
+        ns_ = util::InternTable::namespaces().name(entry.namespace_id);
+        WalRecordView view;
+        view.op = msg.op == OperationType::DELETE ? WalOp::DELETE : WalOp::UPSERT;
+        view.id = entry.id;
+        view.uuid = entry.uuid;
+        view.id_hash = entry.id_hash;
+        view.timestamp_nanos = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(msg.timestamp).count());
+        if (!entry.deleted) view.vector = entry.vector;
+        view.tags = entry.tags;
+        view.epoch = msg.epoch;
+        view.centroid_id = entry.centroid_id;
+        view.tenant = tenant_;
+        view.namespace_name = ns_;
+
+        // The encoder wants an 8-byte aligned destination
+        scratch_.assign((WalRecordEncoder::size(view) + 7) / 8, 0);
+        const size_t len = WalRecordEncoder::encode(view, reinterpret_cast<std::byte*>(scratch_.data()));
+        out.put(std::span<const std::byte>(reinterpret_cast<const std::byte*>(scratch_.data()), len));
+    }
+
+    // As WalReplayer::apply builds it
+    BTreeMessage decode(std::span<const std::byte> bytes) {
+        scratch_.assign((bytes.size() + 7) / 8, 0);
+        std::memcpy(scratch_.data(), bytes.data(), bytes.size());
+        if (!rec_.parse({reinterpret_cast<const std::byte*>(scratch_.data()), bytes.size()})) {
+            throw util::IOException("checkpoint message malformed");
+        }
+        BTreeMessage msg;
+        msg.op = rec_.op() == WalOp::DELETE ? OperationType::DELETE : OperationType::UPSERT;
+        msg.epoch = rec_.epoch();
+        msg.timestamp = std::chrono::duration_cast<Timestamp>(std::chrono::nanoseconds(rec_.timestampNanos()));
+        VectorEntry& entry = msg.entry;
+        entry.id.assign(rec_.id());
+        entry.uuid = rec_.uuid();
+        entry.id_hash = rec_.idHash();
+        entry.centroid_id = rec_.centroidId();
+        entry.created_at = entry.updated_at = msg.timestamp;
+        entry.deleted = msg.op == OperationType::DELETE;
+        if (!entry.deleted && !rec_.decodeVector(entry.vector)) {
+            throw util::IOException("checkpoint message vector malformed");
+        }
+        rec_.tags(entry.tags);
+        auto tenant = rec_.tenant();
+        auto ns = rec_.namespaceName();
+        entry.tenant = tenant.empty() ? 0 : util::InternTable::tenants().intern(tenant);
+        entry.namespace_id = ns.empty() ? 0 : util::InternTable::namespaces().intern(ns);
+        return msg;
+    }
+
+private:
+    std::string tenant_;
+    std::string ns_;
+    std::vector<uint64_t> scratch_;
+    WalRecordReader rec_;
+};
+
+// Streams framed records to a temporary file, renamed into place by commit()
+class FileWriter {
+public:
+    FileWriter(std::string path, bool sync) : path_(std::move(path)), tmp_(path_ + ".tmp"), sync_(sync) {
+        fd_ = ::open(tmp_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) throw util::IOException("create " + tmp_ + ": " + std::strerror(errno));
+        buf_.reserve(kWriteBuffer);
+    }
+    ~FileWriter() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            ::unlink(tmp_.c_str());
+        }
+    }
+
+    void record(std::span<const std::byte> payload) {
+        if (payload.size() > kMaxRecord) throw util::IOException("checkpoint record too large: " + path_);
+        const uint32_t len = static_cast<uint32_t>(payload.size());
+        const uint32_t crc = util::crc32c(payload.data(), payload.size());
+        const auto* l = reinterpret_cast<const std::byte*>(&len);
+        const auto* c = reinterpret_cast<const std::byte*>(&crc);
+        buf_.insert(buf_.end(), l, l + 4);
+        buf_.insert(buf_.end(), c, c + 4);
+        buf_.insert(buf_.end(), payload.begin(), payload.end());
+        if (buf_.size() >= kWriteBuffer) drain();
+    }
+
+    // Returns the bytes written
+    uint64_t commit(const std::string& dir) {
+        drain();
+        if (sync_ && ::fsync(fd_) != 0) throw util::IOException("fsync " + tmp_ + ": " + std::strerror(errno));
+        ::close(fd_);
+        fd_ = -1;
+        if (::rename(tmp_.c_str(), path_.c_str()) != 0) {
+            const int err = errno;
+            ::unlink(tmp_.c_str());
+            throw util::IOException("rename " + tmp_ + ": " + std::strerror(err));
+        }
+        if (sync_) util::sync_directory(dir);
+        return bytes_;
+    }
+
+private:
+    std::string path_;
+    std::string tmp_;
+    bool sync_;
+    int fd_ = -1;
+    std::vector<std::byte> buf_;
+    uint64_t bytes_ = 0;
+
+    void drain() {
+        util::write_all(fd_, buf_.data(), buf_.size(), tmp_);
+        bytes_ += buf_.size();
+        buf_.clear();
+    }
+};
+
+std::vector<std::byte> readFile(const std::string& path) {
+    std::error_code ec;
+    const uint64_t size = std::filesystem::file_size(path, ec);
+    if (ec) throw util::IOException("open " + path + ": " + ec.message());
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw util::IOException("open " + path + ": " + std::strerror(errno));
+    std::vector<std::byte> data(size);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::read(fd, data.data() + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    data.resize(done);
+    return data;
+}
+
+// Payloads of a file's valid records, in order. `complete` is set if the
+// last one is the end record.
+std::vector<std::span<const std::byte>> records(std::span<const std::byte> data, bool& complete) {
+    std::vector<std::span<const std::byte>> out;
+    complete = false;
+    size_t pos = 0;
+    while (data.size() - pos >= kFrameHeader) {
+        uint32_t len, crc;
+        std::memcpy(&len, data.data() + pos, 4);
+        std::memcpy(&crc, data.data() + pos + 4, 4);
+        if (len > kMaxRecord || data.size() - pos - kFrameHeader < len) break;
+        auto payload = data.subspan(pos + kFrameHeader, len);
+        if (util::crc32c(payload.data(), payload.size()) != crc) break;
+        pos += kFrameHeader + len;
+        if (!payload.empty() && static_cast<Tag>(payload[0]) == kEnd) {
+            complete = true;
+            break;
+        }
+        out.push_back(payload);
+    }
+    return out;
+}
+
+} // namespace
+
+struct FuzzyCheckpointer::File {
+    uint64_t seq = 0;
+    uint64_t base = 0;
+    bool full = false;
+    Epoch low = 0;
+    Epoch high = 0;
+    uint64_t nodes = 0;
+    uint32_t shards = 0;
+    std::vector<std::byte> data;
+    std::vector<std::span<const std::byte>> records;  // After the header, into `data`
+
+    // Nullopt if the file is cut short or not a checkpoint
+    static std::optional<File> read(const std::string& path) {
+        File file;
+        file.data = readFile(path);
+        bool complete = false;
+        file.records = storage::records(file.data, complete);
+        if (!complete || file.records.empty()) return std::nullopt;
+        try {
+            Reader r(file.records.front());
+            if (r.get<uint8_t>() != kHeader) return std::nullopt;
+            char magic[8];
+            for (char& c : magic) c = r.get<char>();
+            if (std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) return std::nullopt;
+            if (r.get<uint32_t>() != kFormatVersion) return std::nullopt;
+            file.full = r.get<uint8_t>() != 0;
+            file.seq = r.get<uint64_t>();
+            file.base = r.get<uint64_t>();
+            file.low = r.get<uint64_t>();
+            file.high = r.get<uint64_t>();
+            file.nodes = r.get<uint64_t>();
+            file.shards = r.get<uint32_t>();
+        } catch (const util::IOException&) {
+            return std::nullopt;
+        }
+        file.records.erase(file.records.begin());
+        return file;
+    }
+};
+
+FuzzyCheckpointer::Options FuzzyCheckpointer::Options::fromConfig(const Config& config) {
+    Options options;
+    options.dir = config.storage.data_dir + "/checkpoint";
+    options.full_every = std::max<uint32_t>(1, config.recovery.checkpoint_full_every);
+    options.include_buffer = config.storage.buffer.type != "nvm";
+    return options;
+}
+
+FuzzyCheckpointer::FuzzyCheckpointer(const Options& options, const BEpsilonTree& tree, MessageBuffer& buffer)
+    : options_(options), tree_(tree), buffer_(buffer) {
+    std::error_code ec;
+    std::filesystem::create_directories(options_.dir, ec);
+    if (ec) throw util::IOException("create " + options_.dir + ": " + ec.message());
+
+    // Number on from the files already there, so load() finds the newest
+    for (const auto& entry : std::filesystem::directory_iterator(options_.dir, ec)) {
+        uint64_t seq = 0;
+        if (parseName(entry.path().filename().string(), seq)) stats_.seq = std::max(stats_.seq, seq);
+    }
+    if (ec) throw util::IOException("list " + options_.dir + ": " + ec.message());
+}
+
+std::string FuzzyCheckpointer::filePath(uint64_t seq) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "ckpt-%016llx.bin", static_cast<unsigned long long>(seq));
+    return options_.dir + "/" + name;
+}
+
+uint64_t FuzzyCheckpointer::run(Epoch stable_epoch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto start = std::chrono::steady_clock::now();
+    const bool full = need_full_ || increments_ >= options_.full_every ||
+                      stats_.chain_bytes > 2 * full_bytes_;
+    const uint64_t seq = stats_.seq + 1;
+    const uint64_t base = full ? seq : base_;
+
+    // Work on copies: a failed checkpoint leaves the chain to build on as it was
+    std::vector<uint64_t> versions = full ? std::vector<uint64_t>() : versions_;
+    const size_t shards = options_.include_buffer ? buffer_.shardCount() : 0;
+    std::vector<uint64_t> cursors = full ? std::vector<uint64_t>(shards, 0) : cursors_;
+    cursors.resize(shards, 0);
+
+    FileWriter file(filePath(seq), options_.sync);
+    std::vector<std::byte> payload;
+    Writer w(payload);
+    MessageCodec codec;
+
+    w.put(static_cast<uint8_t>(kHeader));
+    for (char c : kMagic) w.put(c);
+    w.put(kFormatVersion);
+    w.put(static_cast<uint8_t>(full));
+    w.put(seq);
+    w.put(base);
+    w.put(static_cast<uint64_t>(full ? 0 : stats_.epoch));
+    w.put(static_cast<uint64_t>(stable_epoch));
+    w.put(static_cast<uint64_t>(tree_.nodeCount()));
+    w.put(static_cast<uint32_t>(shards));
+    file.record(payload);
+
+    // Buffer first: what flushes out of it meanwhile lands in the tree,
+    // which is copied after
+    uint64_t messages = 0;
+    if (shards > 0) buffer_.publishStaged();
+    std::vector<MessageBuffer::CheckpointMessage> batch;
+    for (size_t s = 0; s < shards; ++s) {
+        uint64_t front = 0;
+        for (;;) {
+            batch.clear();
+            const uint64_t from = cursors[s];
+            cursors[s] = buffer_.collect(s, from, options_.batch, batch, front);
+            payload.clear();
+            w.put(static_cast<uint8_t>(kShard));
+            w.put(static_cast<uint32_t>(s));
+            w.put(front);
+            w.put(cursors[s]);
+            w.put(static_cast<uint32_t>(batch.size()));
+            for (const auto& m : batch) {
+                w.put(m.seq);
+                codec.encode(m.msg, w);
+            }
+            file.record(payload);
+            messages += batch.size();
+            if (batch.size() < options_.batch) break;
+        }
+    }
+
+    const size_t nodes = tree_.checkpoint(versions, [&](BEpsilonTree::NodeImage&& image) {
+        payload.clear();
+        w.put(static_cast<uint8_t>(kNode));
+        w.put(image.node);
+        w.put(static_cast<uint32_t>(image.messages.size()));
+        for (const auto& msg : image.messages) codec.encode(msg, w);
+        file.record(payload);
+    });
+
+    payload.clear();
+    w.put(static_cast<uint8_t>(kEnd));
+    file.record(payload);
+    const uint64_t bytes = file.commit(options_.dir);
+
+    versions_ = std::move(versions);
+    cursors_ = std::move(cursors);
+    need_full_ = false;
+    stats_.seq = seq;
+    stats_.epoch = stable_epoch;
+    stats_.checkpoints++;
+    stats_.last_bytes = bytes;
+    stats_.last_nodes = nodes;
+    stats_.last_messages = messages;
+    stats_.last_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (full) {
+        stats_.full++;
+        base_ = seq;
+        increments_ = 0;
+        full_bytes_ = bytes;
+        stats_.chain_bytes = bytes;
+        removeBefore(seq);
+    } else {
+        increments_++;
+        stats_.chain_bytes += bytes;
+    }
+    LOG_DEBUG("Checkpoint {} ({}): epoch {}, {} nodes, {} buffer messages, {} bytes in {:.3f}s", seq,
+              full ? "full" : "incremental", stable_epoch, nodes, messages, bytes, stats_.last_seconds);
+    return seq;
+}
+
+void FuzzyCheckpointer::removeBefore(uint64_t seq) {
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(options_.dir, ec)) {
+        uint64_t file_seq = 0;
+        if (parseName(entry.path().filename().string(), file_seq) && file_seq < seq) {
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+}
+
+Epoch FuzzyCheckpointer::load(const Options& options, BEpsilonTree& tree, MessageBuffer& buffer, Stats* stats) {
+    std::error_code ec;
+    std::vector<uint64_t> seqs;
+    for (const auto& entry : std::filesystem::directory_iterator(options.dir, ec)) {
+        uint64_t seq = 0;
+        if (parseName(entry.path().filename().string(), seq)) seqs.push_back(seq);
+    }
+    std::sort(seqs.begin(), seqs.end());
+
+    // The newest complete full checkpoint, then its increments up to the
+    // first one missing or cut short
+    auto path = [&](uint64_t seq) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "ckpt-%016llx.bin", static_cast<unsigned long long>(seq));
+        return options.dir + "/" + name;
+    };
+    std::vector<File> chain;
+    for (auto it = seqs.rbegin(); it != seqs.rend() && chain.empty(); ++it) {
+        auto file = File::read(path(*it));
+        if (file && file->full && file->seq == *it) chain.push_back(std::move(*file));
+    }
+    if (chain.empty()) return 0;
+    for (uint64_t seq = chain.front().seq + 1; std::binary_search(seqs.begin(), seqs.end(), seq); ++seq) {
+        auto file = File::read(path(seq));
+        if (!file || file->full || file->base != chain.front().seq || file->low != chain.back().high) break;
+        chain.push_back(std::move(*file));
+    }
+
+    // Node images replace each other in order; buffer messages collect per
+    // shard and are cut at the last front
+    MessageCodec codec;
+    std::vector<std::map<uint64_t, BTreeMessage>> shards(chain.front().shards);
+    std::vector<uint64_t> fronts(chain.front().shards, 0);
+    for (const File& file : chain) {
+        if (file.nodes != tree.nodeCount() || file.shards != shards.size()) {
+            throw util::IOException("checkpoint " + path(file.seq) + " is of another tree or buffer shape");
+        }
+        for (auto record : file.records) {
+            Reader r(record);
+            const auto tag = static_cast<Tag>(r.get<uint8_t>());
+            if (tag == kNode) {
+                BEpsilonTree::NodeImage image;
+                image.node = r.get<uint64_t>();
+                const uint32_t count = r.get<uint32_t>();
+                image.messages.reserve(count);
+                for (uint32_t i = 0; i < count; ++i) image.messages.push_back(codec.decode(r.getBytes()));
+                if (image.node >= tree.nodeCount()) throw util::IOException("checkpoint node out of range");
+                tree.restore(std::move(image));
+            } else if (tag == kShard) {
+                const uint32_t s = r.get<uint32_t>();
+                if (s >= shards.size()) throw util::IOException("checkpoint shard out of range");
+                fronts[s] = std::max(fronts[s], r.get<uint64_t>());
+                r.get<uint64_t>();  // End
+                const uint32_t count = r.get<uint32_t>();
+                for (uint32_t i = 0; i < count; ++i) {
+                    const uint64_t seq = r.get<uint64_t>();
+                    shards[s].insert_or_assign(seq, codec.decode(r.getBytes()));
+                }
+            } else {
+                throw util::IOException("checkpoint record of unknown kind " + std::to_string(tag));
+            }
+        }
+    }
+
+    uint64_t restored = 0;
+    for (size_t s = 0; s < shards.size(); ++s) {
+        for (auto it = shards[s].lower_bound(fronts[s]); it != shards[s].end(); ++it) {
+            const BTreeMessage& msg = it->second;
+            while (!buffer.append(msg.entry.id_hash, msg).accepted()) {
+                buffer.waitForSpace(std::chrono::milliseconds(100));
+            }
+            restored++;
+        }
+    }
+
+    const Epoch epoch = chain.back().high;
+    LOG_INFO("Checkpoint: restored {} files up to {} at epoch {}, {} buffer messages", chain.size(),
+             chain.back().seq, epoch, restored);
+    if (stats) {
+        stats->seq = chain.back().seq;
+        stats->epoch = epoch;
+        stats->loaded_files = chain.size();
+        stats->last_messages = restored;
+    }
+    return epoch;
+}
+
+FuzzyCheckpointer::Stats FuzzyCheckpointer::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::vector<std::pair<std::string_view, double>> FuzzyCheckpointer::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_checkpoint_total", static_cast<double>(stats.checkpoints)},
+        {"woved_checkpoint_full_total", static_cast<double>(stats.full)},
+        {"woved_checkpoint_epoch", static_cast<double>(stats.epoch)},
+        {"woved_checkpoint_last_bytes", static_cast<double>(stats.last_bytes)},
+        {"woved_checkpoint_last_nodes", static_cast<double>(stats.last_nodes)},
+        {"woved_checkpoint_last_messages", static_cast<double>(stats.last_messages)},
+        {"woved_checkpoint_last_seconds", stats.last_seconds},
+        {"woved_checkpoint_chain_bytes", static_cast<double>(stats.chain_bytes)},
+    };
+}
+
+} // namespace woved::storage
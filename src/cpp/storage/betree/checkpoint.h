@@ -0,0 +1,116 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::storage {
+
+class BEpsilonTree;
+class MessageBuffer;
+
+// Incremental fuzzy checkpoints of the B-epsilon tree's node buffers and
+// of the message buffer, so a restart replays the WAL only from the last
+// checkpoint instead of rebuilding every buffered message from it.
+//
+// A checkpoint is taken while writes and flushes continue. Each buffer
+// shard, then each tree node, is copied under its own lock only, in the
+// direction messages flow (buffer, then the tree parents first), so a
+// message moving down during the pass is captured at least once; the
+// copies it may leave behind are the same version and resolve by epoch
+// like a replayed WAL record.
+//
+// A full checkpoint copies every non-empty node and every live buffered
+// message. An incremental one copies only the nodes whose version changed
+// since the previous checkpoint and the buffer messages appended since,
+// plus each shard's front, below which messages have left the buffer.
+// Files are ckpt-<seq>.bin in `dir`, each a header, records framed as
+// length, CRC32C and payload, and an end record; a file without its end
+// record was cut short and ends the chain. A full checkpoint is written
+// every full_every checkpoints, and earlier once the increments outgrow
+// the full one they build on; the previous chain is deleted after it.
+//
+// Caller contract: every write at or below `stable_epoch` has reached the
+// buffer when run() is called. The WAL files before WalManager's file_seq
+// taken before run() can then be recycled, and recovery replays the WAL
+// from the epoch load() returns.
+//
+// A persistent (nvm) buffer survives restarts by itself; its shards are
+// then not checkpointed.
+class FuzzyCheckpointer {
+public:
+    struct Options {
+        std::string dir;
+        uint32_t full_every = 16;  // Incremental checkpoints between full ones
+        size_t batch = 4096;       // Buffer messages copied per shard lock
+        bool include_buffer = true;
+        bool sync = true;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        uint64_t checkpoints = 0;
+        uint64_t full = 0;
+        uint64_t seq = 0;             // Of the last checkpoint
+        Epoch epoch = 0;              // Covered by the last checkpoint
+        uint64_t last_bytes = 0;
+        uint64_t last_nodes = 0;
+        uint64_t last_messages = 0;   // Buffer messages
+        double last_seconds = 0;
+        uint64_t chain_bytes = 0;     // Last full checkpoint and its increments
+        uint64_t loaded_files = 0;
+    };
+
+    // Throws util::IOException if `dir` cannot be created or listed
+    FuzzyCheckpointer(const Options& options, const BEpsilonTree& tree, MessageBuffer& buffer);
+
+    FuzzyCheckpointer(const FuzzyCheckpointer&) = delete;
+    FuzzyCheckpointer& operator=(const FuzzyCheckpointer&) = delete;
+
+    // Write one checkpoint covering every write at or below `stable_epoch`.
+    // The first one after construction is full. Returns its sequence
+    // number; throws util::IOException if it cannot be written, leaving
+    // the chain as it was.
+    uint64_t run(Epoch stable_epoch);
+
+    // Restore the newest complete chain in `dir` into an empty tree and
+    // buffer, before writes start. Returns the epoch the WAL is replayed
+    // after (0 without a checkpoint). Throws util::IOException for a
+    // corrupt chain or one taken of a tree with other nodes.
+    static Epoch load(const Options& options, BEpsilonTree& tree, MessageBuffer& buffer,
+                      Stats* stats = nullptr);
+
+    Stats getStats() const;
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct File;
+
+    Options options_;
+    const BEpsilonTree& tree_;
+    MessageBuffer& buffer_;
+
+    mutable std::mutex mutex_;  // run() and the chain
+    std::vector<uint64_t> versions_;  // Node versions at the last checkpoint
+    std::vector<uint64_t> cursors_;   // Per shard: next sequence to copy
+    bool need_full_ = true;
+    uint64_t base_ = 0;               // Sequence of the chain's full checkpoint
+    uint32_t increments_ = 0;
+    uint64_t full_bytes_ = 0;
+    Stats stats_;
+
+    std::string filePath(uint64_t seq) const;
+    void removeBefore(uint64_t seq);
+};
+
+} // namespace woved::storage
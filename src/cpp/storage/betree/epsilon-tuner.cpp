@@ -0,0 +1,140 @@
+#include "epsilon-tuner.h"
+#include "b-epsilon-tree.h"
+#include <algorithm>
+#include <cmath>
+
+namespace woved::storage {
+
+EpsilonTuner::Options EpsilonTuner::Options::fromConfig(const BTreeConfig& config,
+                                                        size_t partitions) {
+    Options options;
+    options.partitions = partitions;
+    options.node_size_bytes = config.node_size_bytes;
+    options.epsilon = config.epsilon;
+    options.min_epsilon = config.min_epsilon;
+    options.max_epsilon = config.max_epsilon;
+    options.adaptive = config.adaptive_epsilon;
+    options.hot_partition_threshold = config.hot_partition_threshold;
+    return options;
+}
+
+EpsilonTuner::EpsilonTuner(const Options& options)
+    : options_(options), adaptive_(options.adaptive), last_retune_(Clock::now()) {
+    options_.partitions = std::max<size_t>(1, options_.partitions);
+    options_.node_size_bytes = std::max(options_.node_size_bytes, 4 * kPivotBytes);
+    options_.min_epsilon = std::clamp(options_.min_epsilon, 0.0f, 1.0f);
+    options_.max_epsilon = std::clamp(options_.max_epsilon, options_.min_epsilon, 1.0f);
+    options_.hot_partition_threshold = std::clamp(options_.hot_partition_threshold, 0.0f, 1.0f);
+
+    float base = std::clamp(options_.epsilon, options_.min_epsilon, options_.max_epsilon);
+    base_epsilon_.store(base, std::memory_order_relaxed);
+    partitions_ = std::make_unique<Partition[]>(options_.partitions);
+    for (size_t i = 0; i < options_.partitions; ++i) apply(partitions_[i], base);
+}
+
+// Pivots B^epsilon of a node's B entries, never all of the node
+void EpsilonTuner::apply(Partition& p, float epsilon) {
+    const double entries = static_cast<double>(options_.node_size_bytes / kPivotBytes);
+    auto fanout = static_cast<size_t>(std::lround(std::pow(entries, static_cast<double>(epsilon))));
+    fanout = std::clamp<size_t>(fanout, 2, static_cast<size_t>(entries) / 2);
+
+    p.epsilon.store(epsilon, std::memory_order_relaxed);
+    p.fanout.store(static_cast<uint32_t>(fanout), std::memory_order_relaxed);
+    p.buffer_bytes.store(static_cast<uint32_t>(options_.node_size_bytes - fanout * kPivotBytes),
+                         std::memory_order_relaxed);
+}
+
+// Write share at the threshold keeps the base; all writes reach
+// min_epsilon, all queries max_epsilon, linearly in between
+float EpsilonTuner::target(const Partition& p, float base) const {
+    double total = p.write_rate + p.query_rate;
+    if (total < options_.min_rate) return base;
+
+    const double share = p.write_rate / total;
+    const double t = options_.hot_partition_threshold;
+    if (share >= t) {
+        double k = t < 1.0 ? (share - t) / (1.0 - t) : 1.0;
+        return static_cast<float>(base - (base - options_.min_epsilon) * k);
+    }
+    double k = (t - share) / t;
+    return static_cast<float>(base + (options_.max_epsilon - base) * k);
+}
+
+size_t EpsilonTuner::retune(Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    double dt = std::chrono::duration<double>(now - last_retune_).count();
+    if (dt <= 0) return 0;
+    last_retune_ = now;
+    ++retunes_;
+
+    // Exponentially decayed per-second rates
+    const double keep = std::exp2(-dt / options_.half_life_s);
+    const float base = base_epsilon_.load(std::memory_order_relaxed);
+    const bool adaptive = adaptive_.load(std::memory_order_relaxed);
+
+    size_t changed = 0;
+    for (size_t i = 0; i < options_.partitions; ++i) {
+        Partition& p = partitions_[i];
+        double writes = static_cast<double>(p.writes.exchange(0, std::memory_order_relaxed));
+        double queries = static_cast<double>(p.queries.exchange(0, std::memory_order_relaxed));
+        p.write_rate = p.write_rate * keep + (writes / dt) * (1.0 - keep);
+        p.query_rate = p.query_rate * keep + (queries / dt) * (1.0 - keep);
+        if (!adaptive) continue;
+
+        float current = p.epsilon.load(std::memory_order_relaxed);
+        float delta = std::clamp(target(p, base) - current, -options_.max_step, options_.max_step);
+        if (std::fabs(delta) < options_.min_step) continue;
+        apply(p, current + delta);
+        ++changed;
+    }
+    adjustments_ += changed;
+    return changed;
+}
+
+void EpsilonTuner::setEpsilon(float epsilon) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    float base = std::clamp(epsilon, options_.min_epsilon, options_.max_epsilon);
+    base_epsilon_.store(base, std::memory_order_relaxed);
+    if (adaptive_.load(std::memory_order_relaxed)) return;  // Partitions drift to it
+    for (size_t i = 0; i < options_.partitions; ++i) apply(partitions_[i], base);
+}
+
+void EpsilonTuner::setAdaptive(bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    adaptive_.store(enable, std::memory_order_relaxed);
+    if (enable) return;
+    float base = base_epsilon_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < options_.partitions; ++i) apply(partitions_[i], base);
+}
+
+EpsilonTuner::PartitionStats EpsilonTuner::partition(size_t partition) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Partition& p = slot(partition);
+    PartitionStats stats;
+    stats.epsilon = p.epsilon.load(std::memory_order_relaxed);
+    stats.fanout = p.fanout.load(std::memory_order_relaxed);
+    stats.buffer_bytes = p.buffer_bytes.load(std::memory_order_relaxed);
+    stats.write_rate = p.write_rate;
+    stats.query_rate = p.query_rate;
+    return stats;
+}
+
+EpsilonTuner::Stats EpsilonTuner::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const float base = base_epsilon_.load(std::memory_order_relaxed);
+    Stats stats;
+    stats.min_epsilon = options_.max_epsilon;
+    stats.max_epsilon = options_.min_epsilon;
+    for (size_t i = 0; i < options_.partitions; ++i) {
+        float e = partitions_[i].epsilon.load(std::memory_order_relaxed);
+        stats.write_hot += e < base - options_.min_step;
+        stats.query_heavy += e > base + options_.min_step;
+        stats.min_epsilon = std::min(stats.min_epsilon, e);
+        stats.max_epsilon = std::max(stats.max_epsilon, e);
+    }
+    stats.retunes = retunes_;
+    stats.adjustments = adjustments_;
+    return stats;
+}
+
+} // namespace woved::storage
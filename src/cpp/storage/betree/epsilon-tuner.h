@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace woved::storage {
+
+struct BTreeConfig;
+
+// Per-partition epsilon for the B-epsilon tree. A node of B bytes spends
+// B^epsilon on pivots and the rest on its message buffer: a low epsilon
+// buffers more (cheaper writes), a high one gives more pivots and smaller
+// buffers to scan (cheaper queries). Write skew makes one global value
+// wrong for most partitions, so each partition (a subtree, typically a
+// leaf range of the message buffer) gets its own.
+//
+// Writers and queries count their partition's operations (one relaxed
+// add); retune() turns the counts into decayed rates and moves every
+// partition's epsilon toward a target set by its write share:
+// partitions above hot_partition_threshold go toward min_epsilon, query-heavy
+// ones toward max_epsilon, idle ones back to the base epsilon. Moves are
+// capped per retune and small ones skipped, so node layouts do not churn.
+class EpsilonTuner {
+public:
+    struct Options {
+        size_t partitions = 256;
+        size_t node_size_bytes = 65536;
+        float epsilon = 0.5f;               // Base, and the value when not adaptive
+        float min_epsilon = 0.2f;
+        float max_epsilon = 0.9f;
+        bool adaptive = true;
+        float hot_partition_threshold = 0.5f;  // Write share of a partition's operations
+        float flush_fill = 1.0f;            // Buffer fill that triggers a flush
+        double half_life_s = 30.0;          // Rate decay
+        double min_rate = 1.0;              // Ops/s below which a partition is idle
+        float max_step = 0.05f;             // Largest epsilon move per retune
+        float min_step = 0.01f;             // Smaller moves are skipped
+
+        static Options fromConfig(const BTreeConfig& config, size_t partitions);
+    };
+
+    struct PartitionStats {
+        float epsilon = 0;
+        size_t fanout = 0;
+        size_t buffer_bytes = 0;
+        double write_rate = 0;  // Ops/s, decayed
+        double query_rate = 0;
+    };
+
+    struct Stats {
+        size_t write_hot = 0;     // Below the base epsilon (by more than min_step)
+        size_t query_heavy = 0;   // Above it
+        float min_epsilon = 0;
+        float max_epsilon = 0;
+        uint64_t retunes = 0;
+        uint64_t adjustments = 0;  // Partition epsilon changes
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    explicit EpsilonTuner(const Options& options);
+
+    EpsilonTuner(const EpsilonTuner&) = delete;
+    EpsilonTuner& operator=(const EpsilonTuner&) = delete;
+
+    size_t partitions() const { return options_.partitions; }
+
+    // Hot path, any thread
+    void recordWrites(size_t partition, uint64_t count = 1) {
+        slot(partition).writes.fetch_add(count, std::memory_order_relaxed);
+    }
+    void recordQueries(size_t partition, uint64_t count = 1) {
+        slot(partition).queries.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    // Current layout of a partition's nodes
+    float epsilon(size_t partition) const {
+        return slot(partition).epsilon.load(std::memory_order_relaxed);
+    }
+    size_t fanout(size_t partition) const {
+        return slot(partition).fanout.load(std::memory_order_relaxed);
+    }
+    size_t bufferBytes(size_t partition) const {
+        return slot(partition).buffer_bytes.load(std::memory_order_relaxed);
+    }
+
+    // A node of `partition` holding `buffered_bytes` should flush to its children
+    bool shouldFlush(size_t partition, size_t buffered_bytes) const {
+        return buffered_bytes >= options_.flush_fill * bufferBytes(partition);
+    }
+
+    // Fold the counts since the last call into the rates and adjust every
+    // partition; returns the number of partitions whose epsilon changed.
+    // Call periodically (e.g. from the flush scheduler).
+    size_t retune(Clock::time_point now = Clock::now());
+
+    // New base epsilon (clamped to [min_epsilon, max_epsilon]). Without
+    // adaptive mode every partition takes it at once.
+    void setEpsilon(float epsilon);
+    void setAdaptive(bool enable);
+    bool adaptive() const { return adaptive_.load(std::memory_order_relaxed); }
+
+    PartitionStats partition(size_t partition) const;
+    Stats getStats() const;
+
+private:
+    static constexpr size_t kPivotBytes = 16;  // Key hash + child reference
+
+    struct alignas(64) Partition {
+        std::atomic<uint64_t> writes{0};
+        std::atomic<uint64_t> queries{0};
+        std::atomic<float> epsilon{0};
+        std::atomic<uint32_t> fanout{0};
+        std::atomic<uint32_t> buffer_bytes{0};
+
+        // retune() only, under mutex_
+        double write_rate = 0;
+        double query_rate = 0;
+    };
+
+    Options options_;
+    std::unique_ptr<Partition[]> partitions_;
+    std::atomic<float> base_epsilon_;
+    std::atomic<bool> adaptive_;
+
+    mutable std::mutex mutex_;  // retune() and setters
+    Clock::time_point last_retune_;
+    uint64_t retunes_ = 0;
+    uint64_t adjustments_ = 0;
+
+    Partition& slot(size_t partition) const { return partitions_[partition % options_.partitions]; }
+    float target(const Partition& p, float base) const;
+    void apply(Partition& p, float epsilon);
+};
+
+} // namespace woved::storage
@@ -0,0 +1,304 @@
+#include "flush-scheduler.h"
+
+namespace woved::storage {
+
+FlushScheduler::Options FlushScheduler::Options::fromConfig(const StorageConfig& storage) {
+    const BufferConfig& buffer = storage.buffer;
+    Options options;
+    options.threads = std::max<size_t>(1, buffer.flush_threads);
+    options.interval_ms = std::max<uint32_t>(1, buffer.flush_interval_ms);
+    options.threshold_bytes = buffer.flush_threshold_bytes;
+    options.max_lag_ms = buffer.max_flush_lag_ms;
+    options.bandwidth_bytes_per_s = uint64_t{buffer.flush_bandwidth_mbps} * 1048576;
+    options.direct_threshold = storage.btree.direct_flush_threshold;
+    options.direct_min_bytes = storage.btree.direct_flush_min_bytes;
+    return options;
+}
+
+FlushScheduler::FlushScheduler(const Options& options, MessageBuffer& buffer, FlushSink sink,
+                               std::shared_ptr<io::RateLimiter> limiter, EpsilonTuner* tuner)
+    : options_(options), buffer_(buffer), sink_(std::move(sink)),
+      limiter_(std::move(limiter)), tuner_(tuner) {
+    options_.threads = std::max<size_t>(1, options_.threads);
+    options_.interval_ms = std::max<uint32_t>(1, options_.interval_ms);
+    options_.max_batch = std::max<size_t>(1, options_.max_batch);
+    options_.max_queued = std::max(options_.max_queued, options_.threads);
+    options_.direct_threshold = std::clamp(options_.direct_threshold, 0.0f, 1.0f);
+    if (!limiter_) {
+        limiter_ = std::make_shared<io::RateLimiter>(options_.bandwidth_bytes_per_s);
+        own_limiter_ = true;
+    }
+    buffer_.setFlushCallback([this](size_t) { wake(); });
+}
+
+FlushScheduler::~FlushScheduler() {
+    stop();
+    buffer_.setFlushCallback(nullptr);
+}
+
+void FlushScheduler::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+    stopping_ = false;
+    scheduler_ = std::thread([this] { schedule(); });
+    for (size_t i = 0; i < options_.threads; ++i) {
+        workers_.emplace_back([this] { work(); });
+    }
+}
+
+void FlushScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        stopping_ = true;
+    }
+    pass_cv_.notify_all();
+    job_cv_.notify_all();
+    scheduler_.join();
+    for (auto& worker : workers_) worker.join();
+    workers_.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const Job& job : jobs_) pending_.erase(job.leaf_id);
+    jobs_.clear();
+    round_left_ = 0;
+    stats_.queued = pending_.size();
+    running_ = false;
+    done_cv_.notify_all();
+}
+
+void FlushScheduler::wake() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        woken_ = true;
+    }
+    pass_cv_.notify_one();
+}
+
+void FlushScheduler::reconfigure(const Options& options) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        options_.interval_ms = std::max<uint32_t>(1, options.interval_ms);
+        options_.threshold_bytes = options.threshold_bytes;
+        options_.max_lag_ms = options.max_lag_ms;
+        options_.bandwidth_bytes_per_s = options.bandwidth_bytes_per_s;
+        woken_ = true;
+    }
+    if (own_limiter_) limiter_->setRate(options.bandwidth_bytes_per_s);
+    pass_cv_.notify_one();
+    LOG_INFO("flush scheduler: every {} ms, threshold {} bytes, max lag {} ms, {} bytes/s",
+             std::max<uint32_t>(1, options.interval_ms), options.threshold_bytes, options.max_lag_ms,
+             options.bandwidth_bytes_per_s);
+}
+
+bool FlushScheduler::flushAll() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!running_ || stopping_) return false;
+    const uint64_t round = ++round_;
+    round_failed_ = false;
+    lock.unlock();
+
+    pass(round);
+
+    lock.lock();
+    done_cv_.wait(lock, [&] { return round_left_ == 0 || !running_ || round_ != round; });
+    return round_left_ == 0 && !round_failed_ && running_;
+}
+
+void FlushScheduler::schedule() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        const auto interval = std::chrono::milliseconds(options_.interval_ms);
+        pass_cv_.wait_for(lock, interval, [this] { return stopping_ || woken_; });
+        if (stopping_) break;
+        woken_ = false;
+        lock.unlock();
+        pass(0);
+        lock.lock();
+    }
+}
+
+void FlushScheduler::pass(uint64_t round) {
+    if (tuner_) tuner_->retune();
+
+    std::vector<MessageBuffer::LeafStats> leaves = buffer_.leafStats();
+    const size_t used = buffer_.getStats().bytes_used;
+    const Timestamp now = std::chrono::duration_cast<Timestamp>(
+        std::chrono::system_clock::now().time_since_epoch());
+
+    struct Candidate {
+        size_t leaf_id;
+        size_t messages;
+        size_t bytes;
+        double overlap;
+        double age_ms;
+        double score;
+    };
+    std::vector<Candidate> ranked;
+    ranked.reserve(leaves.size());
+
+    double lag_ms = 0;
+    size_t max_bytes = 1;
+    double max_query_rate = 0;
+    std::vector<double> query_rates(leaves.size(), 0.0);
+    for (size_t i = 0; i < leaves.size(); ++i) {
+        const auto& leaf = leaves[i];
+        max_bytes = std::max(max_bytes, leaf.bytes);
+        if (tuner_) {
+            query_rates[i] = tuner_->partition(leaf.leaf_id).query_rate;
+            max_query_rate = std::max(max_query_rate, query_rates[i]);
+        }
+    }
+
+    double lag_scale;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lag_scale = options_.max_lag_ms ? options_.max_lag_ms : 1000.0;
+    }
+    for (size_t i = 0; i < leaves.size(); ++i) {
+        const auto& leaf = leaves[i];
+        double age_ms = std::max<double>(0, (now - leaf.oldest).count() / 1000.0);
+        lag_ms = std::max(lag_ms, age_ms);
+
+        double overlap = static_cast<double>(leaf.superseded) /
+                         static_cast<double>(leaf.messages + leaf.superseded);
+        double score =
+            options_.bytes_weight * static_cast<double>(leaf.bytes) / max_bytes +
+            options_.age_weight * std::min(age_ms / lag_scale, 1.0) +
+            options_.overlap_weight * overlap +
+            (max_query_rate > 0 ? options_.query_weight * query_rates[i] / max_query_rate : 0.0);
+        ranked.push_back({leaf.leaf_id, leaf.messages, leaf.bytes, overlap, age_ms, score});
+    }
+    std::sort(ranked.begin(), ranked.end(),
+              [](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+
+    size_t queued = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.passes++;
+        stats_.backlog_leaves = leaves.size();
+        stats_.flush_lag_ms = lag_ms;
+        stats_.compaction_debt = used > options_.threshold_bytes ? used - options_.threshold_bytes : 0;
+        if (stopping_) return;
+
+        // Leaves already queued are already being drained
+        size_t projected = used;
+        for (const Candidate& c : ranked) {
+            if (pending_.count(c.leaf_id)) {
+                projected -= std::min(projected, c.bytes);
+            }
+        }
+
+        std::vector<const Candidate*> batch;
+        size_t batch_bytes = 0;
+        for (const Candidate& c : ranked) {
+            if (pending_.count(c.leaf_id)) continue;
+            bool late = options_.max_lag_ms && c.age_ms >= options_.max_lag_ms;
+            if (!round && !late && projected <= options_.threshold_bytes) continue;
+            if (!round && pending_.size() + batch.size() >= options_.max_queued) break;
+
+            batch.push_back(&c);
+            batch_bytes += c.bytes;
+            projected -= std::min(projected, c.bytes);
+        }
+
+        // A leaf dominating the batch with new data skips the tree
+        const bool direct_path = direct_sink_ && options_.direct_threshold > 0;
+        for (const Candidate* c : batch) {
+            bool direct = direct_path && c->bytes >= options_.direct_min_bytes &&
+                          c->bytes >= options_.direct_threshold * batch_bytes &&
+                          c->overlap <= 1.0 - options_.direct_threshold;
+            jobs_.push_back({c->leaf_id, c->messages, c->bytes, round, direct});
+            pending_.insert(c->leaf_id);
+        }
+        queued = batch.size();
+        if (round == round_ && round) round_left_ += queued;
+        stats_.queued = pending_.size();
+    }
+    if (queued == 1) {
+        job_cv_.notify_one();
+    } else if (queued > 1) {
+        job_cv_.notify_all();
+    }
+}
+
+void FlushScheduler::work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        job_cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+        if (stopping_) return;
+        Job job = jobs_.front();
+        jobs_.pop_front();
+        lock.unlock();
+
+        // A leaf with more than max_batch messages is drained slice by slice
+        bool ok = true;
+        size_t messages = 0;
+        size_t direct = 0;
+        const size_t chunk_bytes = job.messages > options_.max_batch
+            ? job.bytes / (job.messages / options_.max_batch) : job.bytes;
+        for (size_t left = job.messages; ok && left > 0 && !stopping(); ) {
+            limiter_->acquire(std::min(chunk_bytes, job.bytes));
+            LeafSlice slice = buffer_.sliceForLeaf(job.leaf_id, options_.max_batch);
+            if (slice.empty()) break;
+            const size_t taken = slice.size();
+            try {
+                util::ScopedTimer timer(Metrics::global().ingest(IngestStage::Flush));
+                bool written = job.direct && direct_sink_(slice);
+                if (!written) sink_(slice);
+                util::fault_point("buffer_drain");
+                if (options_.snapshot_grace) util::EpochDomain::global().synchronize();
+                buffer_.evict(std::move(slice));
+                Metrics::global().flushed_messages.add(taken);
+                messages += taken;
+                if (written) direct += taken;
+            } catch (const std::exception& e) {
+                // The slice returns its messages to the buffer as it goes
+                ok = false;
+                LOG_WARN("Flush of leaf {} failed: {}", job.leaf_id, e.what());
+            }
+            if (taken < options_.max_batch) break;
+            left -= std::min(left, taken);
+        }
+
+        finish(job, ok, messages, direct);
+        lock.lock();
+    }
+}
+
+void FlushScheduler::finish(const Job& job, bool ok, size_t messages, size_t direct) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.erase(job.leaf_id);
+    stats_.queued = pending_.size();
+    if (ok && messages > 0) {
+        stats_.flushes++;
+        stats_.messages_flushed += messages;
+        const size_t per_message = job.messages ? job.bytes / job.messages : 0;
+        stats_.bytes_flushed += per_message * messages;
+        stats_.direct_messages += direct;
+        stats_.direct_bytes += per_message * direct;
+    } else if (!ok) {
+        stats_.failed_flushes++;
+    }
+
+    if (job.round && job.round == round_ && round_left_ > 0) {
+        round_failed_ |= !ok;
+        if (--round_left_ == 0) done_cv_.notify_all();
+    }
+}
+
+FlushScheduler::Stats FlushScheduler::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::vector<std::pair<std::string_view, double>> FlushScheduler::metrics() const {
+    Stats stats = getStats();
+    return {
+        {"woved_flush_lag_ms", stats.flush_lag_ms},
+        {"woved_compaction_debt", static_cast<double>(stats.compaction_debt)},
+    };
+}
+
+} // namespace woved::storage
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "core/config.h"
+#include "core/metrics.h"
+#include "io/rate-limiter.h"
+#include "storage/betree/epsilon-tuner.h"
+#include "storage/buffer/msg-buf.h"
+#include "util/epoch-reclaim.h"
+#include "util/fault-point.h"
+#include "util/logging.h"
+#include "util/telemetry.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace woved::storage {
+
+// Decides which buffered leaves move into the B-epsilon tree, and when.
+// Each pass (every interval_ms, or at once when the buffer crosses its soft
+// watermark) takes the buffer's per-leaf backlog and ranks the leaves on
+//  - bytes:   backlog against the largest one
+//  - age:     oldest message against max_lag_ms
+//  - overlap: superseded versions per buffered message; rewrite-heavy leaves
+//             collapse the most work per flush
+//  - queries: decayed query rate of the leaf's tuner partition, since every
+//             query routed to a leaf scans its buffered messages
+// Above threshold_bytes the best leaves are queued until the projected usage
+// is back under it. Leaves whose oldest message is older than max_lag_ms
+// are queued regardless, so cold leaves cannot sit in the buffer forever.
+//
+// Direct path: when one leaf holds at least direct_threshold of the bytes a
+// pass queues, at least direct_min_bytes of them, and almost no superseded
+// versions (nearly all new data, e.g. a backfill of a new tenant), its
+// messages go to the direct sink, which writes them into a new delta
+// segment for the leaf instead of through every tree level.
+//
+// Queued leaves are flushed by `threads` dedicated workers, which mostly
+// wait on the tree's writes rather than the CPU. Each flush is charged to
+// the rate limiter before its slice is leased, so a throttled flush holds
+// no messages while it waits.
+//
+// A flushed slice leaves the buffer only after every reader pinned before
+// the sink returned has finished (snapshot_grace), so a query holding a
+// snapshot (storage/snapshot.h) taken before the data reached its new
+// tier still finds it in the buffer rather than in neither.
+class FlushScheduler {
+public:
+    struct Options {
+        size_t threads = 2;
+        uint32_t interval_ms = 100;
+        size_t threshold_bytes = 134217728;  // 128 MiB
+        uint32_t max_lag_ms = 5000;          // 0 = no age deadline
+        size_t max_batch = 65536;            // Messages per leaf slice
+        size_t max_queued = 64;              // Leaves queued or in flight
+        uint64_t bandwidth_bytes_per_s = 0;  // Own limiter when none is passed; 0 = unlimited
+        float direct_threshold = 0.8f;       // 0 = no direct path
+        size_t direct_min_bytes = 33554432;  // 32 MiB
+        bool snapshot_grace = true;          // Wait out pinned readers before evicting
+
+        // Ranking weights
+        float bytes_weight = 1.0f;
+        float age_weight = 1.0f;
+        float overlap_weight = 0.5f;
+        float query_weight = 0.5f;
+
+        static Options fromConfig(const StorageConfig& storage);
+    };
+
+    // Writes one leaf's slice into the tree. Throwing keeps the messages
+    // buffered for a later pass.
+    using FlushSink = std::function<void(const LeafSlice& slice)>;
+
+    // Writes one leaf's slice into a new delta segment for that leaf.
+    // Returns false to send the slice through the tree instead; throwing
+    // fails the flush as for FlushSink.
+    using DirectSink = std::function<bool(const LeafSlice& slice)>;
+
+    struct Stats {
+        uint64_t passes = 0;
+        uint64_t flushes = 0;
+        uint64_t failed_flushes = 0;
+        uint64_t messages_flushed = 0;
+        uint64_t bytes_flushed = 0;   // Estimated from the leaf backlog
+        uint64_t direct_messages = 0; // Of messages_flushed, via the direct sink
+        uint64_t direct_bytes = 0;
+        size_t queued = 0;            // Leaves queued or in flight
+        size_t backlog_leaves = 0;    // Leaves with buffered messages at the last pass
+        double flush_lag_ms = 0;      // woved_flush_lag_ms: oldest buffered message
+        size_t compaction_debt = 0;   // woved_compaction_debt: bytes above threshold
+    };
+
+    // Installs the buffer's flush callback: construct before writers start
+    // and destroy after they stop. `limiter` may be shared with other
+    // background I/O; `tuner` (optional) supplies query rates and is retuned
+    // every pass.
+    FlushScheduler(const Options& options, MessageBuffer& buffer, FlushSink sink,
+                   std::shared_ptr<io::RateLimiter> limiter = nullptr,
+                   EpsilonTuner* tuner = nullptr);
+    ~FlushScheduler();
+
+    FlushScheduler(const FlushScheduler&) = delete;
+    FlushScheduler& operator=(const FlushScheduler&) = delete;
+
+    void start();
+    void stop();  // Finishes flushes in flight; queued leaves stay buffered
+
+    // Enables the direct path; set before start()
+    void setDirectSink(DirectSink sink) { direct_sink_ = std::move(sink); }
+
+    // Run a pass now
+    void wake();
+
+    // Live tuning (config reload): interval, threshold, lag deadline and
+    // bandwidth of `options` apply from the next pass; the bandwidth only
+    // to the scheduler's own limiter, not one it was handed
+    void reconfigure(const Options& options);
+
+    // Queue every buffered leaf not already queued and wait until those
+    // flushes finish (checkpoint, shutdown). Returns false if any failed.
+    bool flushAll();
+
+    Stats getStats() const;
+
+    // Gauges under their exported names (telemetry.metrics)
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct Job {
+        size_t leaf_id;
+        size_t messages;  // Backlog when queued
+        size_t bytes;     // Charged to the limiter
+        uint64_t round;   // flushAll() round that queued it (0 = none)
+        bool direct;      // Offer slices to the direct sink first
+    };
+
+    Options options_;
+    MessageBuffer& buffer_;
+    FlushSink sink_;
+    DirectSink direct_sink_;
+    std::shared_ptr<io::RateLimiter> limiter_;
+    bool own_limiter_ = false;
+    EpsilonTuner* tuner_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable pass_cv_;  // Scheduler thread
+    std::condition_variable job_cv_;   // Workers
+    std::condition_variable done_cv_;  // flushAll()
+    bool running_ = false;
+    bool stopping_ = false;
+    bool woken_ = false;
+    std::deque<Job> jobs_;
+    std::unordered_set<size_t> pending_;  // Leaves queued or in flight
+    uint64_t round_ = 0;
+    size_t round_left_ = 0;  // Jobs of the current flushAll() round
+    bool round_failed_ = false;
+    Stats stats_;
+
+    std::thread scheduler_;
+    std::vector<std::thread> workers_;
+
+    void schedule();
+    void pass(uint64_t round);
+    void work();
+    void finish(const Job& job, bool ok, size_t messages, size_t direct);
+    bool stopping() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stopping_;
+    }
+};
+
+} // namespace woved::storage
@@ -0,0 +1,300 @@
+#include "node-cache.h"
+#include "storage/betree/b-epsilon-tree.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace woved::storage {
+
+NodeCache::Options NodeCache::Options::fromConfig(const BTreeConfig& config) {
+    Options options;
+    options.budget_bytes = config.node_cache_bytes;
+    options.protected_level = config.node_cache_protected_level;
+    return options;
+}
+
+NodeCache::NodeCache(const Options& options, Loader loader, Evictor evictor)
+    : options_(options), loader_(std::move(loader)), evictor_(std::move(evictor)) {
+    options_.a1in_share = std::clamp(options_.a1in_share, 0.0f, 1.0f);
+    options_.a1out_share = std::max(0.0f, options_.a1out_share);
+}
+
+NodeCache::~NodeCache() {
+    for (auto& [id, entry] : entries_) {
+        if (!entry.node) continue;
+        try {
+            evictor_(*entry.node, entry.dirty);
+        } catch (const std::exception& e) {
+            LOG_ERROR("Node cache: write-back of node {} failed at shutdown: {}", id, e.what());
+        }
+    }
+}
+
+NodeCache::Handle NodeCache::get(uint64_t id, Access access) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        auto it = entries_.find(id);
+        if (it == entries_.end()) break;
+        if (it->second.busy) {
+            loaded_.wait(lock);
+            continue;  // Loaded, written back and dropped, or failed
+        }
+        stats_.hits++;
+        touch(it->second, access);
+        return pin(it->second);
+    }
+
+    stats_.misses++;
+    // Flush reads are one-off: they leave the ghost for a query to claim
+    const bool ghost = access == Access::Query && takeGhost(id);
+    Entry& entry = entries_[id];
+    entry.busy = true;
+    lock.unlock();
+
+    std::unique_ptr<BEpsilonNode> node;
+    try {
+        node = loader_(id);
+        if (!node || node->id() != id) {
+            throw std::runtime_error("Node cache: loader returned the wrong node for id " + std::to_string(id));
+        }
+    } catch (...) {
+        lock.lock();
+        entries_.erase(id);
+        loaded_.notify_all();
+        throw;
+    }
+
+    Victims victims;
+    Handle handle;
+    lock.lock();
+    entry.node = std::move(node);
+    entry.bytes = entry.node->memoryBytes();
+    entry.busy = false;
+    if (ghost) stats_.ghost_hits++;
+    link(id, entry, ghost || isProtected(entry) ? Queue::Am : Queue::A1in);
+    handle = pin(entry);
+    evictLocked(victims);
+    loaded_.notify_all();
+    lock.unlock();
+
+    release(victims);
+    return handle;
+}
+
+NodeCache::Handle NodeCache::peek(uint64_t id, Access access) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(id);
+    if (it == entries_.end() || it->second.busy) return {};
+    stats_.hits++;
+    touch(it->second, access);
+    return pin(it->second);
+}
+
+NodeCache::Handle NodeCache::insert(std::unique_ptr<BEpsilonNode> node) {
+    if (!node) throw std::invalid_argument("Node cache: null node");
+    const uint64_t id = node->id();
+
+    Victims victims;
+    Handle handle;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto [it, added] = entries_.try_emplace(id);
+        if (!added) {
+            throw std::invalid_argument("Node cache: node " + std::to_string(id) + " is already cached");
+        }
+        Entry& entry = it->second;
+        entry.node = std::move(node);
+        entry.bytes = entry.node->memoryBytes();
+        entry.dirty = true;
+        takeGhost(id);
+        link(id, entry, isProtected(entry) ? Queue::Am : Queue::A1in);
+        handle = pin(entry);
+        evictLocked(victims);
+    }
+    release(victims);
+    return handle;
+}
+
+bool NodeCache::erase(uint64_t id) {
+    Victims victims;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(id);
+        if (it == entries_.end() || it->second.busy || it->second.pins > 0) return false;
+        evict(id, it->second, victims);
+    }
+    release(victims);
+    return true;
+}
+
+void NodeCache::setBudget(size_t bytes) {
+    Victims victims;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        options_.budget_bytes = bytes;
+        evictLocked(victims);
+    }
+    release(victims);
+}
+
+size_t NodeCache::budget() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return options_.budget_bytes;
+}
+
+NodeCache::Stats NodeCache::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.nodes = a1in_.size() + am_.size();
+    stats.a1in_bytes = a1in_bytes_;
+    stats.am_bytes = am_bytes_;
+    stats.bytes = a1in_bytes_ + am_bytes_;
+    stats.pinned = pinned_;
+    stats.ghosts = a1out_.size();
+    return stats;
+}
+
+void NodeCache::Handle::markDirty() {
+    if (!cache_) return;
+    std::lock_guard<std::mutex> lock(cache_->mutex_);
+    cache_->entries_.at(node_->id()).dirty = true;
+}
+
+NodeCache::Handle NodeCache::pin(Entry& entry) {
+    if (entry.pins++ == 0) pinned_++;
+    return Handle(this, entry.node.get());
+}
+
+void NodeCache::unpin(uint64_t id) {
+    Victims victims;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_.at(id);
+        if (--entry.pins > 0) return;
+        pinned_--;
+
+        // The buffer may have grown or drained while pinned
+        const size_t bytes = entry.node->memoryBytes();
+        size_t& queue_bytes = entry.queue == Queue::Am ? am_bytes_ : a1in_bytes_;
+        queue_bytes = queue_bytes - entry.bytes + bytes;
+        entry.bytes = bytes;
+        evictLocked(victims);
+    }
+    release(victims);
+}
+
+void NodeCache::link(uint64_t id, Entry& entry, Queue queue) {
+    auto& list = queue == Queue::Am ? am_ : a1in_;
+    list.push_front(id);
+    entry.pos = list.begin();
+    entry.queue = queue;
+    (queue == Queue::Am ? am_bytes_ : a1in_bytes_) += entry.bytes;
+}
+
+void NodeCache::unlink(Entry& entry) {
+    if (entry.queue == Queue::Am) {
+        am_.erase(entry.pos);
+        am_bytes_ -= entry.bytes;
+    } else if (entry.queue == Queue::A1in) {
+        a1in_.erase(entry.pos);
+        a1in_bytes_ -= entry.bytes;
+    }
+    entry.queue = Queue::None;
+}
+
+void NodeCache::touch(Entry& entry, Access access) {
+    // A1in hits are correlated re-reads and stay put (2Q); flush hits never
+    // move anything, so a flush sweeping the tree cannot refresh cold nodes
+    if (access == Access::Flush || entry.queue != Queue::Am) return;
+    am_.splice(am_.begin(), am_, entry.pos);
+}
+
+bool NodeCache::isProtected(const Entry& entry) const {
+    return options_.protected_level > 0 && entry.node->level() >= options_.protected_level;
+}
+
+void NodeCache::addGhost(uint64_t id) {
+    const size_t limit = std::max<size_t>(
+        16, static_cast<size_t>(options_.a1out_share * static_cast<float>(entries_.size())));
+    a1out_.push_front(id);
+    ghosts_[id] = a1out_.begin();
+    while (a1out_.size() > limit) {
+        ghosts_.erase(a1out_.back());
+        a1out_.pop_back();
+    }
+}
+
+bool NodeCache::takeGhost(uint64_t id) {
+    auto it = ghosts_.find(id);
+    if (it == ghosts_.end()) return false;
+    a1out_.erase(it->second);
+    ghosts_.erase(it);
+    return true;
+}
+
+void NodeCache::evictLocked(Victims& victims) {
+    const auto a1in_limit = static_cast<size_t>(options_.a1in_share * static_cast<double>(options_.budget_bytes));
+    while (a1in_bytes_ + am_bytes_ > options_.budget_bytes) {
+        // A1in over its share goes first; protected upper levels go last
+        bool evicted = a1in_bytes_ > a1in_limit
+            ? evictFrom(a1in_, false, victims) || evictFrom(am_, true, victims)
+            : evictFrom(am_, true, victims) || evictFrom(a1in_, false, victims);
+        if (!evicted) evicted = evictFrom(am_, false, victims);
+        if (!evicted) {
+            stats_.overcommits++;  // Everything left is pinned
+            return;
+        }
+    }
+}
+
+bool NodeCache::evictFrom(std::list<uint64_t>& queue, bool skip_protected, Victims& victims) {
+    for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+        Entry& entry = entries_.at(*it);
+        if (entry.pins > 0 || (skip_protected && isProtected(entry))) continue;
+        const uint64_t id = *it;
+        if (entry.queue == Queue::A1in) addGhost(id);
+        evict(id, entry, victims);
+        return true;
+    }
+    return false;
+}
+
+void NodeCache::evict(uint64_t id, Entry& entry, Victims& victims) {
+    unlink(entry);
+    entry.busy = true;
+    victims.push_back(id);
+    stats_.evictions++;
+}
+
+void NodeCache::release(Victims& victims) {
+    for (uint64_t id : victims) {
+        // Busy and unpinned: nothing else touches the entry until it is
+        // erased or relinked below
+        Entry* entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entry = &entries_.at(id);
+        }
+
+        bool written = true;
+        try {
+            evictor_(*entry->node, entry->dirty);
+        } catch (const std::exception& e) {
+            LOG_WARN("Node cache: write-back of node {} failed, keeping it: {}", id, e.what());
+            written = false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (written) {
+            if (entry->dirty) stats_.writebacks++;
+            entries_.erase(id);
+        } else {
+            entry->busy = false;
+            link(id, *entry, Queue::Am);
+        }
+        loaded_.notify_all();
+    }
+}
+
+} // namespace woved::storage
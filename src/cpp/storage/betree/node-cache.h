@@ -0,0 +1,189 @@
+#pragma once
+
+#include "storage/betree/node.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace woved::storage {
+
+struct BTreeConfig;
+
+// Memory-budgeted cache of B-epsilon tree node pages, with 2Q eviction.
+//
+// A node seen for the first time enters A1in, a FIFO holding a quarter of
+// the budget. Nodes evicted from A1in leave their id on the A1out ghost
+// list; a query that misses on a ghost id admits the node straight into
+// Am, the LRU of nodes touched more than once. Am only loses nodes when
+// A1in is within its share, so a burst of one-off reads churns A1in and
+// leaves Am alone.
+//
+// Flush traffic reads every node it passes once, so Access::Flush never
+// promotes: a flush miss lands in A1in (and ages out from there) and a
+// flush hit does not refresh LRU position. Nodes at protected_level and
+// above (the root and the levels just below it, read by every query)
+// are admitted to Am directly and are only evicted once nothing else is
+// left to evict.
+//
+// Pinned nodes are never evicted. A flush pins the nodes it is rewriting
+// for as long as it holds their Handle, and the cache may run past its
+// budget while too much is pinned (counted in Stats::overcommits). Sizes
+// are charged on load and re-measured when the last pin drops, since a
+// pinned node's buffer changes.
+//
+// Loads and write-backs run outside the cache lock. A node is busy while
+// either is in flight, and get() on a busy id waits, so a miss never reads
+// a page whose write-back has not finished.
+class NodeCache {
+public:
+    struct Options {
+        size_t budget_bytes = 536870912;  // 512 MiB
+        float a1in_share = 0.25f;         // Of the budget
+        float a1out_share = 0.5f;         // Ghost ids, as a share of cached nodes
+        uint32_t protected_level = 1;     // 0 turns level protection off
+
+        static Options fromConfig(const BTreeConfig& config);
+    };
+
+    enum class Access { Query, Flush };
+
+    // Reads a node page; throwing fails the get()
+    using Loader = std::function<std::unique_ptr<BEpsilonNode>(uint64_t id)>;
+
+    // Called before a node is dropped; dirty nodes must be written back.
+    // Throwing keeps the node cached, still dirty.
+    using Evictor = std::function<void(BEpsilonNode& node, bool dirty)>;
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t ghost_hits = 0;    // Misses admitted to Am from A1out
+        uint64_t evictions = 0;
+        uint64_t writebacks = 0;    // Dirty evictions
+        uint64_t overcommits = 0;   // Inserts that found only pinned nodes to evict
+        size_t nodes = 0;
+        size_t bytes = 0;
+        size_t a1in_bytes = 0;
+        size_t am_bytes = 0;
+        size_t pinned = 0;
+        size_t ghosts = 0;
+    };
+
+    class Handle;
+
+    NodeCache(const Options& options, Loader loader, Evictor evictor);
+    ~NodeCache();  // Hands every cached node to the evictor
+
+    NodeCache(const NodeCache&) = delete;
+    NodeCache& operator=(const NodeCache&) = delete;
+
+    // Pin a node, loading it on a miss
+    Handle get(uint64_t id, Access access = Access::Query);
+
+    // Pin a cached node without loading it; the handle is empty on a miss
+    Handle peek(uint64_t id, Access access = Access::Query);
+
+    // Add a node created in memory (a split, a new root). It starts dirty.
+    Handle insert(std::unique_ptr<BEpsilonNode> node);
+
+    // Evict an unpinned node now; false if it is pinned or not cached
+    bool erase(uint64_t id);
+
+    void setBudget(size_t bytes);
+    size_t budget() const;
+
+    Stats getStats() const;
+
+private:
+    enum class Queue : uint8_t { None, A1in, Am };
+
+    struct Entry {
+        std::unique_ptr<BEpsilonNode> node;
+        size_t bytes = 0;
+        uint32_t pins = 0;
+        bool dirty = false;
+        bool busy = false;  // Loading or being written back
+        Queue queue = Queue::None;
+        std::list<uint64_t>::iterator pos;
+    };
+
+    Options options_;
+    Loader loader_;
+    Evictor evictor_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable loaded_;
+    std::unordered_map<uint64_t, Entry> entries_;
+    std::list<uint64_t> a1in_;   // FIFO, newest at the front
+    std::list<uint64_t> am_;     // LRU, most recent at the front
+    std::list<uint64_t> a1out_;  // Ghost ids, newest at the front
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> ghosts_;
+    size_t a1in_bytes_ = 0;
+    size_t am_bytes_ = 0;
+    size_t pinned_ = 0;
+    Stats stats_;
+
+    using Victims = std::vector<uint64_t>;  // Busy, unlinked, awaiting release()
+
+    Handle pin(Entry& entry);
+    void unpin(uint64_t id);
+    void link(uint64_t id, Entry& entry, Queue queue);
+    void unlink(Entry& entry);
+    void touch(Entry& entry, Access access);
+    void evict(uint64_t id, Entry& entry, Victims& victims);
+    bool isProtected(const Entry& entry) const;
+    void addGhost(uint64_t id);
+    bool takeGhost(uint64_t id);
+    void evictLocked(Victims& victims);
+    bool evictFrom(std::list<uint64_t>& queue, bool skip_protected, Victims& victims);
+    void release(Victims& victims);
+};
+
+// A pinned node. Moving transfers the pin; destruction drops it.
+class NodeCache::Handle {
+public:
+    Handle() = default;
+    Handle(Handle&& other) noexcept { *this = std::move(other); }
+    Handle& operator=(Handle&& other) noexcept {
+        if (this != &other) {
+            reset();
+            cache_ = std::exchange(other.cache_, nullptr);
+            node_ = std::exchange(other.node_, nullptr);
+        }
+        return *this;
+    }
+    ~Handle() { reset(); }
+
+    Handle(const Handle&) = delete;
+    Handle& operator=(const Handle&) = delete;
+
+    explicit operator bool() const { return node_ != nullptr; }
+    BEpsilonNode* get() const { return node_; }
+    BEpsilonNode& operator*() const { return *node_; }
+    BEpsilonNode* operator->() const { return node_; }
+
+    // The node changed and must be written back before it is evicted
+    void markDirty();
+
+    void reset() {
+        if (cache_) cache_->unpin(node_->id());
+        cache_ = nullptr;
+        node_ = nullptr;
+    }
+
+private:
+    friend class NodeCache;
+    Handle(NodeCache* cache, BEpsilonNode* node) : cache_(cache), node_(node) {}
+
+    NodeCache* cache_ = nullptr;
+    BEpsilonNode* node_ = nullptr;
+};
+
+} // namespace woved::storage
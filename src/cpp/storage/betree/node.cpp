@@ -0,0 +1,282 @@
+#include "node.h"
+#include "util/cpu-dispatch.h"
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t kLine = BEpsilonNode::kPivotsPerLine;
+constexpr std::align_val_t kAlign{64};
+
+// Pivots <= key: `p` holds `lines` cache lines of pivots, `heads` the first
+// pivot of every line (padded to whole lines)
+using FindFn = size_t (*)(const uint64_t* p, const uint64_t* heads, size_t lines, uint64_t key);
+using RouteFn = void (*)(const uint64_t* p, const uint64_t* heads, size_t lines,
+                         const uint64_t* keys, size_t n, uint32_t* out);
+
+// Branch-free upper bound: the compare feeds a conditional move
+size_t find_scalar(const uint64_t* p, const uint64_t*, size_t lines, uint64_t key) {
+    if (lines == 0) return 0;
+    const uint64_t* base = p;
+    size_t n = lines * kLine;
+    while (n > 1) {
+        size_t half = n / 2;
+        base += base[half] <= key ? half : 0;
+        n -= half;
+    }
+    return static_cast<size_t>(base - p) + (*base <= key);
+}
+
+void route_scalar(const uint64_t* p, const uint64_t* heads, size_t lines, const uint64_t* keys,
+                  size_t n, uint32_t* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = static_cast<uint32_t>(find_scalar(p, heads, lines, keys[i]));
+    }
+}
+
+#if defined(__x86_64__)
+// Both levels compare a whole cache line at once: the line heads pick the
+// line (a 256-way node has 32 heads, four lines), then that line is counted.
+// AVX2 only compares signed 64-bit lanes, so the sign bits are flipped.
+__attribute__((target("avx2,popcnt")))
+inline unsigned gt_mask_avx2(const uint64_t* line, __m256i k) {
+    const __m256i bias = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+    __m256i lo = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(line)), bias);
+    __m256i hi = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(line + 4)), bias);
+    return static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(lo, k)))) |
+           static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(hi, k)))) << 4;
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t find_avx2(const uint64_t* p, const uint64_t* heads, size_t lines, uint64_t key) {
+    const __m256i k = _mm256_set1_epi64x(static_cast<int64_t>(key ^ (uint64_t{1} << 63)));
+    size_t line = 0;
+    for (size_t i = 0; i < lines; i += kLine) {
+        unsigned gt = gt_mask_avx2(heads + i, k);
+        line += kLine - static_cast<size_t>(__builtin_popcount(gt));
+        if (gt) break;  // Sorted: every later head is past the key too
+    }
+    line = std::min(line, lines);
+    if (line == 0) return 0;
+    const uint64_t* hit = p + (line - 1) * kLine;
+    return (line - 1) * kLine + kLine - static_cast<size_t>(__builtin_popcount(gt_mask_avx2(hit, k)));
+}
+
+__attribute__((target("avx2,popcnt")))
+void route_avx2(const uint64_t* p, const uint64_t* heads, size_t lines, const uint64_t* keys,
+                size_t n, uint32_t* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = static_cast<uint32_t>(find_avx2(p, heads, lines, keys[i]));
+    }
+}
+
+__attribute__((target("avx512f,popcnt")))
+size_t find_avx512(const uint64_t* p, const uint64_t* heads, size_t lines, uint64_t key) {
+    const __m512i k = _mm512_set1_epi64(static_cast<int64_t>(key));
+    size_t line = 0;
+    for (size_t i = 0; i < lines; i += kLine) {
+        __mmask8 gt = _mm512_cmpgt_epu64_mask(_mm512_load_si512(heads + i), k);
+        line += kLine - static_cast<size_t>(__builtin_popcount(gt));
+        if (gt) break;
+    }
+    line = std::min(line, lines);
+    if (line == 0) return 0;
+    __mmask8 gt = _mm512_cmpgt_epu64_mask(_mm512_load_si512(p + (line - 1) * kLine), k);
+    return (line - 1) * kLine + kLine - static_cast<size_t>(__builtin_popcount(gt));
+}
+
+__attribute__((target("avx512f,popcnt")))
+void route_avx512(const uint64_t* p, const uint64_t* heads, size_t lines, const uint64_t* keys,
+                  size_t n, uint32_t* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = static_cast<uint32_t>(find_avx512(p, heads, lines, keys[i]));
+    }
+}
+#endif
+
+struct PivotSearch {
+    const char* isa;
+    FindFn find;
+    RouteFn route;
+};
+
+const PivotSearch& pivot_search() {
+    static const PivotSearch search = [] () -> PivotSearch {
+#if defined(__x86_64__)
+        const auto& f = util::cpu_features();
+        if (f.avx512f) return {"avx512", find_avx512, route_avx512};
+        if (f.avx2) return {"avx2", find_avx2, route_avx2};
+#endif
+        return {"scalar", find_scalar, route_scalar};
+    }();
+    return search;
+}
+
+} // namespace
+
+BEpsilonNode::BEpsilonNode(uint64_t id, uint32_t level, size_t max_pivots)
+    : id_(id), level_(level), max_pivots_(max_pivots),
+      padded_pivots_(std::max<size_t>(1, (max_pivots + kLine - 1) / kLine) * kLine),
+      padded_heads_((padded_pivots_ / kLine + kLine - 1) / kLine * kLine),
+      pivots_(static_cast<VectorIdHash*>(::operator new(
+          (padded_pivots_ + padded_heads_) * sizeof(VectorIdHash), kAlign))),
+      heads_(pivots_ + padded_pivots_) {
+    std::fill_n(pivots_, padded_pivots_ + padded_heads_, std::numeric_limits<VectorIdHash>::max());
+}
+
+BEpsilonNode::~BEpsilonNode() {
+    ::operator delete(pivots_, kAlign);
+}
+
+void BEpsilonNode::setPivots(std::span<const VectorIdHash> pivots) {
+    if (pivots.size() > max_pivots_) {
+        throw std::invalid_argument("Too many pivots for node " + std::to_string(id_));
+    }
+    if (std::adjacent_find(pivots.begin(), pivots.end(),
+                           [](VectorIdHash a, VectorIdHash b) { return a >= b; }) != pivots.end()) {
+        throw std::invalid_argument("Pivots of node " + std::to_string(id_) + " are not ascending");
+    }
+
+    std::copy(pivots.begin(), pivots.end(), pivots_);
+    std::fill(pivots_ + pivots.size(), pivots_ + padded_pivots_ + padded_heads_,
+              std::numeric_limits<VectorIdHash>::max());
+    pivot_count_ = pivots.size();
+    for (size_t line = 0; line < searchLines(); ++line) heads_[line] = pivots_[line * kLine];
+    sorted_ = buffer_.empty();
+}
+
+size_t BEpsilonNode::findChild(VectorIdHash key) const {
+    // Padding counts for key == UINT64_MAX only; the clamp folds it back
+    return std::min(pivot_search().find(pivots_, heads_, searchLines(), key), pivot_count_);
+}
+
+void BEpsilonNode::findChildren(std::span<const VectorIdHash> keys, uint32_t* out) const {
+    pivot_search().route(pivots_, heads_, searchLines(), keys.data(), keys.size(), out);
+    const auto last = static_cast<uint32_t>(pivot_count_);
+    for (size_t i = 0; i < keys.size(); ++i) out[i] = std::min(out[i], last);
+}
+
+void BEpsilonNode::append(BTreeMessage&& msg) {
+    buffer_bytes_ += messageBytes(msg);
+    VectorIdHash hash = msg.entry.id_hash;
+    buffer_.push_back({hash, 0, std::move(msg)});
+    sorted_ = false;
+    version_++;
+}
+
+size_t BEpsilonNode::sortBuffer() {
+    if (sorted_) return 0;
+
+    std::vector<VectorIdHash> keys(buffer_.size());
+    std::vector<uint32_t> children(buffer_.size());
+    for (size_t i = 0; i < buffer_.size(); ++i) keys[i] = buffer_[i].id_hash;
+    findChildren(keys, children.data());
+    for (size_t i = 0; i < buffer_.size(); ++i) buffer_[i].child = children[i];
+
+    std::sort(buffer_.begin(), buffer_.end(), [](const Message& a, const Message& b) {
+        return std::tie(a.child, a.id_hash, a.msg.epoch) < std::tie(b.child, b.id_hash, b.msg.epoch);
+    });
+
+    // Versions of one id are adjacent (same hash, same child): keep the last
+    size_t kept = 0;
+    for (size_t i = 0; i < buffer_.size(); ++i) {
+        if (i + 1 < buffer_.size() && buffer_[i + 1].id_hash == buffer_[i].id_hash) {
+            buffer_bytes_ -= messageBytes(buffer_[i].msg);
+            continue;
+        }
+        if (kept != i) buffer_[kept] = std::move(buffer_[i]);
+        kept++;
+    }
+    size_t dropped = buffer_.size() - kept;
+    buffer_.resize(kept);
+    sorted_ = true;
+    return dropped;
+}
+
+std::span<BEpsilonNode::Message> BEpsilonNode::childMessages(size_t child) {
+    sortBuffer();
+    auto first = std::lower_bound(buffer_.begin(), buffer_.end(), child,
+                                  [](const Message& m, size_t c) { return m.child < c; });
+    auto last = std::upper_bound(first, buffer_.end(), child,
+                                 [](size_t c, const Message& m) { return c < m.child; });
+    return {first, last};
+}
+
+std::vector<BEpsilonNode::Message> BEpsilonNode::takeChildMessages(size_t child) {
+    std::span<Message> run = childMessages(child);
+    std::vector<Message> taken(std::make_move_iterator(run.begin()),
+                               std::make_move_iterator(run.end()));
+    for (const Message& m : taken) buffer_bytes_ -= messageBytes(m.msg);
+
+    auto first = buffer_.begin() + (run.data() - buffer_.data());
+    buffer_.erase(first, first + static_cast<std::ptrdiff_t>(run.size()));
+    version_++;
+    return taken;
+}
+
+std::vector<std::vector<BEpsilonNode::Message>> BEpsilonNode::takeChildRuns() {
+    sortBuffer();
+    std::vector<std::vector<Message>> runs(childCount());
+    for (size_t i = 0; i < buffer_.size(); ) {
+        size_t end = i;
+        const uint32_t child = buffer_[i].child;
+        while (end < buffer_.size() && buffer_[end].child == child) end++;
+        runs[child].assign(std::make_move_iterator(buffer_.begin() + i),
+                           std::make_move_iterator(buffer_.begin() + end));
+        i = end;
+    }
+    buffer_.clear();
+    buffer_bytes_ = 0;
+    version_++;
+    return runs;
+}
+
+std::vector<BEpsilonNode::Message> BEpsilonNode::takeBuffer() {
+    std::vector<Message> taken = std::move(buffer_);
+    buffer_.clear();
+    buffer_bytes_ = 0;
+    sorted_ = true;
+    version_++;
+    return taken;
+}
+
+void BEpsilonNode::eraseFront(size_t count) {
+    count = std::min(count, buffer_.size());
+    for (size_t i = 0; i < count; ++i) buffer_bytes_ -= messageBytes(buffer_[i].msg);
+    buffer_.erase(buffer_.begin(), buffer_.begin() + static_cast<std::ptrdiff_t>(count));
+    sorted_ = sorted_ || buffer_.empty();
+    if (count > 0) version_++;
+}
+
+const BEpsilonNode::Message* BEpsilonNode::findLatest(VectorIdHash id_hash) const {
+    const Message* latest = nullptr;
+    for (const Message& m : buffer_) {
+        if (m.id_hash == id_hash && (!latest || m.msg.epoch >= latest->msg.epoch)) latest = &m;
+    }
+    return latest;
+}
+
+size_t BEpsilonNode::memoryBytes() const {
+    return sizeof(*this) + (padded_pivots_ + padded_heads_) * sizeof(VectorIdHash) +
+           children_.capacity() * sizeof(uint64_t) + buffer_bytes_;
+}
+
+size_t BEpsilonNode::messageBytes(const BTreeMessage& msg) {
+    return sizeof(Message) + msg.entry.vector.size() * sizeof(float) + msg.entry.id.size() +
+           msg.entry.tags.size() * sizeof(TagId);
+}
+
+const char* BEpsilonNode::pivotSearchIsa() {
+    return pivot_search().isa;
+}
+
+} // namespace woved::storage
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <vector>
+
+namespace woved::storage {
+
+// Node of the B-epsilon tree: sorted id_hash pivots that route to
+// pivotCount() + 1 children, and a buffer of messages not yet pushed down.
+//
+// Pivots live in one 64-byte aligned array padded to whole cache lines
+// with UINT64_MAX, followed by the first pivot of every line. Child i holds
+// hashes in [pivot[i-1], pivot[i]), so the child of a key is the number of
+// pivots <= key. findChild() counts them with 64-bit compares and movemasks
+// (AVX-512 or AVX2, picked at runtime): the line heads select a line, then
+// that line is compared, so a 256-way node costs five line compares and no
+// data-dependent branches beyond the heads loop. Without either ISA a
+// branch-free binary search is used.
+//
+// The buffer is an unsorted append log until sortBuffer() routes every
+// message and sorts it in place by (child, id_hash, epoch), dropping the
+// versions superseded within the node. A flush then moves one contiguous
+// run per child.
+//
+// The node does no locking of its own: callers hold latch() shared to read
+// the buffer and exclusively to change it, and claim the node with
+// tryBeginFlush() so only one thread flushes it at a time.
+class BEpsilonNode {
+public:
+    static constexpr size_t kPivotsPerLine = 64 / sizeof(VectorIdHash);
+
+    struct Message {
+        VectorIdHash id_hash = 0;
+        uint32_t child = 0;  // Set by sortBuffer()
+        BTreeMessage msg;
+    };
+
+    // Up to max_pivots pivots (fanout - 1); level 0 is a leaf
+    BEpsilonNode(uint64_t id, uint32_t level, size_t max_pivots);
+    ~BEpsilonNode();
+
+    BEpsilonNode(const BEpsilonNode&) = delete;
+    BEpsilonNode& operator=(const BEpsilonNode&) = delete;
+
+    uint64_t id() const { return id_; }
+    uint32_t level() const { return level_; }
+    bool isLeaf() const { return level_ == 0; }
+
+    // Replace the pivots (strictly ascending, at most max_pivots; throws
+    // std::invalid_argument otherwise). A sorted buffer becomes unsorted.
+    void setPivots(std::span<const VectorIdHash> pivots);
+    std::span<const VectorIdHash> pivots() const { return {pivots_, pivot_count_}; }
+    size_t pivotCount() const { return pivot_count_; }
+    size_t childCount() const { return pivot_count_ + 1; }
+
+    size_t findChild(VectorIdHash key) const;
+
+    // findChild() for a batch of keys (flush routing)
+    void findChildren(std::span<const VectorIdHash> keys, uint32_t* out) const;
+
+    // Child node ids, childCount() of them on interior nodes
+    std::vector<uint64_t>& children() { return children_; }
+    const std::vector<uint64_t>& children() const { return children_; }
+
+    // Buffer
+    void append(BTreeMessage&& msg);
+    size_t bufferCount() const { return buffer_.size(); }
+    size_t bufferBytes() const { return buffer_bytes_; }
+    bool bufferSorted() const { return sorted_; }
+
+    // Route, sort by (child, id_hash, epoch) and keep only the newest
+    // version of every id; returns the versions dropped
+    size_t sortBuffer();
+
+    // Sorted buffer: the messages routed to `child`, oldest first per id
+    std::span<Message> childMessages(size_t child);
+
+    // Sorted buffer: remove and return the messages routed to `child`
+    std::vector<Message> takeChildMessages(size_t child);
+
+    // Sorted buffer: remove every message, one run per child
+    std::vector<std::vector<Message>> takeChildRuns();
+
+    // Remove and return the whole buffer
+    std::vector<Message> takeBuffer();
+
+    // Drop the first `count` messages: a sorted prefix handed to a leaf
+    // sink, with any appends since then behind it
+    void eraseFront(size_t count);
+
+    std::span<const Message> messages() const { return buffer_; }
+
+    // Bumped by every change to the buffer's contents (not by sorting), so
+    // a checkpoint can tell the nodes changed since it last copied them
+    uint64_t version() const { return version_; }
+
+    // Newest buffered message for an id, or null
+    const Message* findLatest(VectorIdHash id_hash) const;
+
+    std::shared_mutex& latch() const { return latch_; }
+    bool tryBeginFlush() { return !flushing_.exchange(true, std::memory_order_acquire); }
+    void endFlush() { flushing_.store(false, std::memory_order_release); }
+
+    // Approximate heap and object bytes of the node, buffer included
+    size_t memoryBytes() const;
+
+    // Approximate bytes a message holds in a buffer
+    static size_t messageBytes(const BTreeMessage& msg);
+
+    // Pivot search in use: "avx512", "avx2" or "scalar"
+    static const char* pivotSearchIsa();
+
+private:
+    uint64_t id_;
+    uint32_t level_;
+    size_t max_pivots_;
+    size_t padded_pivots_;        // Capacity, whole cache lines
+    size_t padded_heads_;
+    VectorIdHash* pivots_;        // 64-byte aligned, padded with UINT64_MAX
+    VectorIdHash* heads_;         // pivots_[line * kPivotsPerLine], same allocation
+    size_t pivot_count_ = 0;
+    std::vector<uint64_t> children_;
+
+    std::vector<Message> buffer_;
+    size_t buffer_bytes_ = 0;
+    bool sorted_ = true;
+    uint64_t version_ = 0;
+
+    mutable std::shared_mutex latch_;
+    std::atomic<bool> flushing_{false};
+
+    // Cache lines holding pivots
+    size_t searchLines() const {
+        return (pivot_count_ + kPivotsPerLine - 1) / kPivotsPerLine;
+    }
+};
+
+} // namespace woved::storage
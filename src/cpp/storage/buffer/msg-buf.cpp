@@ -0,0 +1,1365 @@
+#include "msg-buf.h"
+#include "util/epoch-reclaim.h"
+
+namespace woved::storage {
+
+namespace {
+
+// A hit of an affine scan whose id was rewritten after the read epoch,
+// checked against the other shards once the scan's shard lock is released
+struct PendingHit {
+    VectorIdHash hash;
+    Epoch epoch;
+    Score score;
+    size_t query = 0;  // Batch scans: index of the query scored
+};
+
+// Min-heap on score: front is the current k-th best
+void offerHit(std::vector<BufferHit>& heap, size_t top_k, VectorIdHash hash, Score s) {
+    auto worse = [](const BufferHit& a, const BufferHit& b) { return a.score > b.score; };
+    if (heap.size() < top_k) {
+        heap.push_back({hash, s});
+        std::push_heap(heap.begin(), heap.end(), worse);
+    } else if (s > heap.front().score) {
+        std::pop_heap(heap.begin(), heap.end(), worse);
+        heap.back() = {hash, s};
+        std::push_heap(heap.begin(), heap.end(), worse);
+    }
+}
+
+} // namespace
+
+ShardAffinity parseShardAffinity(const std::string& name) {
+    if (name == "hash") return ShardAffinity::HASH;
+    if (name == "core") return ShardAffinity::CORE;
+    if (name == "numa") return ShardAffinity::NUMA;
+    throw util::ConfigException("unknown buffer shard affinity: " + name);
+}
+
+LeafSlice& LeafSlice::operator=(LeafSlice&& other) noexcept {
+    if (this != &other) {
+        if (owner_) owner_->releaseSlice(*this, false);
+        owner_ = std::exchange(other.owner_, nullptr);
+        leaf_id_ = other.leaf_id_;
+        views_ = std::move(other.views_);
+        ranges_ = std::move(other.ranges_);
+    }
+    return *this;
+}
+
+LeafSlice::~LeafSlice() {
+    if (owner_) owner_->releaseSlice(*this, false);
+}
+
+MessageBuffer::MessageBuffer(const Config& config,
+                            std::shared_ptr<LatestByIdMap> latest_by_id)
+    : config_(config), latest_by_id_(latest_by_id),
+      soft_watermark_(config.soft_watermark_bytes ? config.soft_watermark_bytes
+                                                  : config.flush_threshold_bytes),
+      hard_watermark_(config.hard_watermark_bytes ? config.hard_watermark_bytes
+                                                  : config.max_bytes) {
+    
+    // Initialize shards
+    shards_.reserve(config_.shard_count);
+    for (size_t i = 0; i < config_.shard_count; ++i) {
+        shards_.emplace_back(std::make_unique<Shard>());
+        shards_.back()->id = static_cast<uint32_t>(i);
+    }
+    
+    if (config_.arena_enabled &&
+        config_.arena_slab_bytes < BufferSlab::strideFor(config_.dim, config_.element_type)) {
+        throw util::InvalidArgumentException(
+            "arena_slab_bytes too small for collection dim");
+    }
+    
+    if (config_.shard_affinity != ShardAffinity::HASH && !latest_by_id_) {
+        throw util::ConfigException("affine buffer sharding requires latest_by_id");
+    }
+    if (config_.shard_affinity == ShardAffinity::NUMA) {
+        const size_t nodes = std::max<size_t>(1, util::numa_node_count());
+        for (size_t n = 0; n < nodes; ++n) {
+            size_t first = std::min(n * config_.shard_count / nodes, config_.shard_count - 1);
+            size_t last = std::max(first + 1, (n + 1) * config_.shard_count / nodes);
+            node_shards_.emplace_back(first, last - first);
+        }
+    }
+    
+    if (!config_.backend) {
+        config_.backend = std::make_shared<DramSlabBackend>();
+    } else if (config_.backend->persistent()) {
+        if (!config_.arena_enabled) {
+            throw util::ConfigException("persistent buffer backend requires arena mode");
+        }
+        recoverSlabs();
+    }
+    
+    if (config_.durable_ack) {
+        if (!config_.backend->powerSafe()) {
+            throw util::ConfigException("durable_ack requires an nvm buffer backend");
+        }
+        if (config_.staged_append) {
+            throw util::ConfigException("durable_ack cannot be combined with staged_append");
+        }
+    }
+    
+    LOG_INFO("MessageBuffer initialized with {} shards, max {} bytes, arena {}{}{}",
+             config_.shard_count, config_.max_bytes,
+             config_.arena_enabled ? "on" : "off",
+             config_.backend->persistent() ? " (persistent)" : "",
+             config_.durable_ack ? ", acknowledging without the WAL" : "");
+}
+
+void MessageBuffer::recoverSlabs() {
+    for (auto& open : config_.backend->recover()) {
+        if (open.shard >= shards_.size()) {
+            throw util::ConfigException("buffer pool has more shards than configured");
+        }
+        Shard* shard = shards_[open.shard].get();
+        
+        auto slab = std::make_unique<BufferSlab>(config_.backend.get(), open.region, config_.dim,
+                                                 config_.element_type);
+        if (slab->live() == 0) {
+            continue;  // Destructor returns the region to the pool
+        }
+        shard->slabs.push_back(std::move(slab));
+        BufferSlab* adopted = shard->slabs.back().get();
+        
+        // Replay in append order; dedupe retires versions that were superseded
+        // but not yet dropped when the process stopped
+        for (size_t i = 0, n = adopted->count(); i < n; ++i) {
+            ArenaRecord* rec = adopted->record(i);
+            if (!adopted->isLive(*rec)) continue;
+            adopted->reintern(rec);
+            
+            BTreeMessage msg = adopted->materialize(*rec);
+            size_t msg_size = estimateSize(msg);
+            
+            Slot slot;
+            slot.id_hash = rec->id_hash;
+            slot.epoch = msg.epoch;
+            slot.bytes = static_cast<uint32_t>(msg_size);
+            slot.rec = rec;
+            slot.slab = adopted;
+            recovered_count_++;
+            recovered_epoch_ = std::max(recovered_epoch_, msg.epoch);
+            if (!linkLocked(shard, std::move(slot), leafOf(msg.entry), msg.entry.centroid_id)) {
+                continue;  // A later version of the id was replayed first
+            }
+            
+            shard->bytes.fetch_add(msg_size);
+            shard->count.fetch_add(1);
+            total_bytes_.fetch_add(msg_size);
+            total_messages_.fetch_add(1);
+            
+            if (latest_by_id_) {
+                // Shards replay independently; upsert() never steps an id back
+                VectorLocation loc;
+                loc.type = VectorLocation::BUFFER;
+                loc.timestamp = msg.timestamp;
+                loc.epoch = msg.epoch;
+                loc.tombstone = (msg.op == OperationType::DELETE);
+                latest_by_id_->upsert(msg.entry.id, rec->id_hash, loc);
+            }
+        }
+    }
+    
+    if (recovered_count_ > 0) {
+        LOG_INFO("MessageBuffer recovered {} messages ({} bytes) up to epoch {}",
+                 recovered_count_, total_bytes_.load(), recovered_epoch_);
+    }
+}
+
+MessageBuffer::~MessageBuffer() {
+    LOG_INFO("MessageBuffer destroyed with {} messages, {} bytes",
+             total_messages_.load(), total_bytes_.load());
+}
+
+AdmissionResult MessageBuffer::append(VectorIdHash hash, const BTreeMessage& msg) {
+    util::ScopedTimer timer(Metrics::global().ingest(IngestStage::BufferAppend));
+    size_t shard_idx = shardForWrite(hash);
+    auto& shard = shards_[shard_idx];
+    
+    if (config_.arena_enabled && msg.entry.vector.size() > config_.dim) {
+        throw util::InvalidArgumentException(
+            "vector dimension exceeds collection dim");
+    }
+    
+    size_t msg_size = estimateSize(msg);
+    
+    // Reject instead of stalling the worker; the caller relays retry_after
+    size_t used = total_bytes_.load(std::memory_order_relaxed);
+    if (used + msg_size > hard_watermark_.load(std::memory_order_relaxed)) {
+        rejected_count_++;
+        Metrics::global().rejected_upserts.add();
+        signalFlush(used, true);
+        return {AdmissionResult::OVERLOADED, retryAfter(used + msg_size)};
+    }
+    
+    AdmissionResult result;
+    if (used + msg_size >= soft_watermark_) {
+        result.status = AdmissionResult::THROTTLED;
+        signalFlush(used + msg_size, false);
+    }
+    
+    Metrics& metrics = Metrics::global();
+    metrics.upserts.add();
+    // Logical bytes: the id and, for a live entry, its fp32 vector
+    const uint64_t logical = (msg.entry.id.empty() ? sizeof(VectorUuid) : msg.entry.id.size()) +
+        (msg.op == OperationType::DELETE ? 0 : msg.entry.vector.size() * sizeof(float));
+    metrics.writes.add(WritePoint::Logical, logical);
+    metrics.writes.addTenant(WritePoint::Logical, msg.entry.tenant, logical);
+    if (config_.staged_append) {
+        stageAppend(shard_idx, hash, msg);
+        return result;
+    }
+    
+    bool live;
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        live = insertLocked(shard.get(), hash, msg, msg_size);
+        if (live) {
+            shard->bytes.fetch_add(msg_size);
+            shard->count.fetch_add(1);
+        }
+    }
+    
+    result.durable = config_.durable_ack;
+    if (!live) return result;  // Stored already superseded by a later epoch
+    total_bytes_.fetch_add(msg_size);
+    total_messages_.fetch_add(1);
+    
+    // Update latest_by_id for read-your-writes
+    if (latest_by_id_) {
+        VectorLocation loc;
+        loc.type = VectorLocation::BUFFER;
+        loc.timestamp = msg.timestamp;
+        loc.epoch = msg.epoch;
+        loc.tombstone = (msg.op == OperationType::DELETE);
+        
+        latest_by_id_->upsert(msg.entry.id, hash, loc);
+    }
+    
+    return result;
+}
+
+size_t MessageBuffer::shardForWrite(VectorIdHash hash) const {
+    switch (config_.shard_affinity) {
+        case ShardAffinity::CORE:
+            return static_cast<size_t>(util::current_cpu()) % config_.shard_count;
+        case ShardAffinity::NUMA: {
+            const size_t node = static_cast<size_t>(util::current_numa_node());
+            const auto& [first, count] = node_shards_[node % node_shards_.size()];
+            return first + hash % count;
+        }
+        case ShardAffinity::HASH:
+            break;
+    }
+    return getShardIndex(hash);
+}
+
+std::optional<bool> MessageBuffer::isLatest(const Slot& slot, Epoch read_epoch) const {
+    if (config_.shard_affinity == ShardAffinity::HASH) return true;
+    auto latest = latest_by_id_->getPackedByHash(slot.id_hash);
+    if (!latest || latest->epoch() <= slot.epoch) return true;
+    if (latest->epoch() <= read_epoch) return false;
+    // Rewritten after read_epoch: an older version may still be the one read
+    return std::nullopt;
+}
+
+bool MessageBuffer::shadowedElsewhere(VectorIdHash hash, Epoch epoch, Epoch read_epoch,
+                                      uint32_t home) const {
+    for (const auto& shard : shards_) {
+        if (shard->id == home) continue;
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        if (config_.dedupe_enabled) {
+            // The id's versions in this shard, newest first
+            auto it = shard->latest_map.find(hash);
+            const Slot* slot = it != shard->latest_map.end() ? shard->at(it->second) : nullptr;
+            for (; slot; slot = shard->at(slot->prev)) {
+                if (slot->epoch > read_epoch) continue;
+                if (slot->epoch > epoch) return true;
+                break;
+            }
+            continue;
+        }
+        for (const Slot& slot : shard->slots) {
+            if (slot.id_hash == hash && slot.epoch > epoch && slot.epoch <= read_epoch) return true;
+        }
+    }
+    return false;
+}
+
+Epoch MessageBuffer::leafCutoff(size_t leaf_id, size_t max_batch) {
+    // k-way merge by epoch over the shards' leaf lists: the cut is the
+    // max_batch-th oldest candidate
+    std::vector<Epoch> epochs;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        auto it = shard->leaf_index.find(leaf_id);
+        if (it == shard->leaf_index.end()) continue;
+        
+        size_t taken = 0;
+        for (uint64_t seq : it->second) {
+            if (taken >= max_batch) break;
+            const Slot* slot = shard->at(seq);
+            if (!slot || slot->state != SlotState::LIVE || slot->leased) continue;
+            epochs.push_back(viewOf(*slot).epoch());
+            taken++;
+        }
+    }
+    
+    if (max_batch == 0 || epochs.size() <= max_batch) {
+        return std::numeric_limits<Epoch>::max();
+    }
+    std::nth_element(epochs.begin(), epochs.begin() + (max_batch - 1), epochs.end());
+    return epochs[max_batch - 1];
+}
+
+Epoch MessageBuffer::oldestCutoff(size_t per_shard) {
+    // Shards that cannot be drained to their share bound the cut
+    Epoch cutoff = std::numeric_limits<Epoch>::max();
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        
+        Epoch newest = 0;
+        size_t taken = 0;
+        for (const auto& slot : shard->slots) {
+            if (slot.leased) break;
+            if (slot.state != SlotState::LIVE) continue;
+            if (taken == per_shard) {
+                cutoff = std::min(cutoff, newest);
+                break;
+            }
+            newest = std::max(newest, viewOf(slot).epoch());
+            taken++;
+        }
+    }
+    return cutoff;
+}
+
+void MessageBuffer::setFlushCallback(FlushCallback callback) {
+    flush_callback_ = std::move(callback);
+}
+
+void MessageBuffer::signalFlush(size_t bytes_used, bool force) {
+    // Edge-triggered above the soft watermark; re-armed once a flush brings
+    // usage back below it. Rejections always signal.
+    bool already = flush_signalled_.exchange(true);
+    if ((force || !already) && flush_callback_) {
+        flush_callback_(bytes_used);
+    }
+}
+
+std::chrono::milliseconds MessageBuffer::retryAfter(size_t bytes_needed) const {
+    const auto fallback = std::chrono::milliseconds(config_.flush_interval_ms);
+    uint64_t rate = drain_bytes_per_ms_.load(std::memory_order_relaxed);
+    if (rate == 0) return fallback;
+    
+    // Time for an observed-rate drain to make room, bounded to a sane hint
+    const size_t hard = hard_watermark_.load(std::memory_order_relaxed);
+    size_t excess = bytes_needed > hard ? bytes_needed - hard : 0;
+    int64_t ms = static_cast<int64_t>((excess + rate - 1) / rate);
+    return std::clamp(std::chrono::milliseconds(ms),
+                      std::chrono::milliseconds(1), fallback * 10);
+}
+
+void MessageBuffer::recordDrain(size_t bytes_freed) {
+    using namespace std::chrono;
+    int64_t now = duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    int64_t last = last_evict_us_.exchange(now);
+    
+    if (last > 0 && now > last && bytes_freed > 0) {
+        uint64_t sample = bytes_freed * 1000 / static_cast<uint64_t>(now - last);
+        uint64_t prev = drain_bytes_per_ms_.load(std::memory_order_relaxed);
+        drain_bytes_per_ms_.store(prev ? (prev * 4 + sample) / 5 : sample,
+                                  std::memory_order_relaxed);
+    }
+    
+    if (total_bytes_.load() < soft_watermark_) {
+        flush_signalled_.store(false);
+    }
+}
+
+void MessageBuffer::noteWrite(TenantOrdinal tenant, NamespaceOrdinal ns, Epoch epoch) {
+    auto raise = [epoch](std::atomic<Epoch>& slot) {
+        Epoch current = slot.load(std::memory_order_relaxed);
+        while (current < epoch &&
+               !slot.compare_exchange_weak(current, epoch, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    };
+    raise(write_epoch_);
+    raise(tenant_write_epochs_[writeBucket(tenant, 0)]);
+    raise(scope_write_epochs_[writeBucket(tenant, ns)]);
+}
+
+Epoch MessageBuffer::writeEpoch(TenantOrdinal tenant, NamespaceOrdinal ns) const {
+    if (tenant == 0) return write_epoch_.load(std::memory_order_acquire);
+    if (ns == 0) return tenant_write_epochs_[writeBucket(tenant, 0)].load(std::memory_order_acquire);
+    return scope_write_epochs_[writeBucket(tenant, ns)].load(std::memory_order_acquire);
+}
+
+bool MessageBuffer::insertLocked(Shard* shard, VectorIdHash hash,
+                                 const BTreeMessage& msg, size_t msg_size) {
+    noteWrite(msg.entry.tenant, msg.entry.namespace_id, msg.epoch);
+    Slot slot;
+    slot.id_hash = hash;
+    slot.epoch = msg.epoch;
+    slot.bytes = static_cast<uint32_t>(msg_size);
+    if (config_.arena_enabled) {
+        slot.rec = appendToArena(shard, msg);
+        slot.slab = shard->slabs.back().get();
+    } else {
+        slot.msg = std::make_unique<BTreeMessage>(msg);
+    }
+    
+    return linkLocked(shard, std::move(slot), leafOf(msg.entry), msg.entry.centroid_id);
+}
+
+bool MessageBuffer::linkLocked(Shard* shard, Slot slot, size_t leaf,
+                               CentroidId centroid) {
+    // Deduplication within shard: the buffered version is superseded and its
+    // bytes released now. A copy already leased to a flush stays readable
+    // until that slice is evicted. The new version is stored first, so a
+    // persistent slab never retires the old record before its replacement
+    // is sealed.
+    VectorIdHash hash = slot.id_hash;
+    uint64_t seq = shard->base_seq + shard->slots.size();
+    bool live = !config_.dedupe_enabled || supersede(shard, slot, seq);
+    
+    shard->slots.push_back(std::move(slot));
+    if (!live) {
+        deferPayload(shard, seq);
+    } else if (config_.dedupe_enabled) {
+        shard->latest_map[hash] = seq;
+    }
+    shard->leaf_index[leaf].push_back(seq);
+    shard->postings[centroid].push_back(seq);
+    shard->posting_entries++;
+    return live;
+}
+
+template <typename Visit>
+void MessageBuffer::forEachVisible(Shard* shard, std::span<const CentroidId> probe,
+                                   Epoch read_epoch, Visit&& visit) {
+    if (probe.empty()) {
+        for (const auto& slot : shard->slots) {
+            if (!slot.visibleAt(read_epoch)) continue;
+            if (!visit(slot)) return;
+        }
+        return;
+    }
+    
+    for (CentroidId centroid : probe) {
+        auto it = shard->postings.find(centroid);
+        if (it == shard->postings.end()) continue;
+        
+        // Compact the list in place while walking it
+        auto& list = it->second;
+        size_t keep = 0;
+        size_t i = 0;
+        bool more = true;
+        for (; i < list.size() && more; ++i) {
+            const Slot* slot = shard->at(list[i]);
+            if (!slot || !slot->readable()) continue;
+            list[keep++] = list[i];
+            if (slot->visibleAt(read_epoch)) more = visit(*slot);
+        }
+        keep = static_cast<size_t>(
+            std::copy(list.begin() + i, list.end(), list.begin() + keep) - list.begin());
+        
+        shard->posting_entries -= list.size() - keep;
+        list.resize(keep);
+        if (list.empty()) shard->postings.erase(it);
+        if (!more) return;
+    }
+}
+
+void MessageBuffer::compactPostings(Shard* shard) {
+    for (auto it = shard->postings.begin(); it != shard->postings.end();) {
+        auto& list = it->second;
+        size_t before = list.size();
+        std::erase_if(list, [shard](uint64_t seq) {
+            const Slot* slot = shard->at(seq);
+            return !slot || !slot->readable();
+        });
+        shard->posting_entries -= before - list.size();
+        it = list.empty() ? shard->postings.erase(it) : std::next(it);
+    }
+}
+
+MessageBuffer::Staging& MessageBuffer::localStaging() {
+    // Keyed by instance id, not address, so a new buffer at a recycled
+    // address never sees a stale staging area
+    thread_local std::unordered_map<uint64_t, std::shared_ptr<Staging>> stagings;
+    
+    auto& staging = stagings[instance_id_];
+    if (!staging) {
+        staging = std::make_shared<Staging>();
+        staging->per_shard.resize(shards_.size());
+        
+        std::lock_guard<std::mutex> lock(staging_registry_mutex_);
+        staging_registry_.push_back(staging);
+    }
+    return *staging;
+}
+
+void MessageBuffer::stageAppend(size_t shard_idx, VectorIdHash hash,
+                                const BTreeMessage& msg) {
+    Staging& staging = localStaging();
+    std::vector<StagedMessage> batch;
+    
+    {
+        // Only contended while a reader is publishing this thread's batch
+        std::lock_guard<std::mutex> lock(staging.mutex);
+        auto& pending = staging.per_shard[shard_idx];
+        pending.push_back({hash, msg});
+        if (pending.size() < config_.staging_batch) return;
+        batch.swap(pending);
+    }
+    
+    publishBatch(shard_idx, batch);
+}
+
+void MessageBuffer::publishBatch(size_t shard_idx, std::vector<StagedMessage>& batch) {
+    Shard* shard = shards_[shard_idx].get();
+    size_t batch_bytes = 0;
+    size_t batch_count = 0;
+    std::vector<uint8_t> live(batch.size());
+    
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            size_t msg_size = estimateSize(batch[i].msg);
+            live[i] = insertLocked(shard, batch[i].hash, batch[i].msg, msg_size);
+            if (!live[i]) continue;
+            batch_bytes += msg_size;
+            batch_count++;
+        }
+        
+        shard->bytes.fetch_add(batch_bytes);
+        shard->count.fetch_add(batch_count);
+    }
+    
+    // One update of the shared counters per batch
+    total_bytes_.fetch_add(batch_bytes);
+    total_messages_.fetch_add(batch_count);
+    
+    if (latest_by_id_) {
+        std::vector<LatestByIdMap::HashedLocation> updates;
+        updates.reserve(batch_count);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (!live[i]) continue;
+            const StagedMessage& staged = batch[i];
+            VectorLocation loc;
+            loc.type = VectorLocation::BUFFER;
+            loc.timestamp = staged.msg.timestamp;
+            loc.epoch = staged.msg.epoch;
+            loc.tombstone = (staged.msg.op == OperationType::DELETE);
+            
+            const VectorId& id = staged.msg.entry.id;
+            updates.push_back({staged.hash, std::move(loc), id.empty() ? nullptr : &id});
+        }
+        latest_by_id_->upsertBatch(updates);
+    }
+}
+
+void MessageBuffer::publishStaged() {
+    if (!config_.staged_append) return;
+    
+    std::vector<std::shared_ptr<Staging>> stagings;
+    {
+        std::lock_guard<std::mutex> lock(staging_registry_mutex_);
+        stagings = staging_registry_;
+    }
+    
+    for (auto& staging : stagings) {
+        std::vector<std::vector<StagedMessage>> pending(shards_.size());
+        {
+            std::lock_guard<std::mutex> lock(staging->mutex);
+            pending.swap(staging->per_shard);
+            staging->per_shard.resize(shards_.size());
+        }
+        for (size_t i = 0; i < pending.size(); ++i) {
+            if (!pending[i].empty()) {
+                publishBatch(i, pending[i]);
+            }
+        }
+    }
+}
+
+uint64_t MessageBuffer::collect(size_t shard_idx, uint64_t from, size_t max,
+                                std::vector<CheckpointMessage>& out, uint64_t& front) const {
+    const Shard* shard = shards_.at(shard_idx).get();
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    front = shard->base_seq;
+    const uint64_t end = shard->base_seq + shard->slots.size();
+    uint64_t seq = std::max(from, shard->base_seq);
+    for (size_t taken = 0; seq < end && taken < max; ++seq) {
+        const Slot& slot = shard->slots[seq - shard->base_seq];
+        if (slot.state != SlotState::LIVE || !slot.hasPayload()) continue;
+        out.push_back({seq, viewOf(slot).materialize()});
+        taken++;
+    }
+    return seq;
+}
+
+LeafSlice MessageBuffer::sliceForLeaf(size_t leaf_id, size_t max_batch) {
+    publishStaged();
+    
+    LeafSlice slice;
+    slice.owner_ = this;
+    slice.leaf_id_ = leaf_id;
+    
+    const Epoch cutoff = config_.shard_affinity == ShardAffinity::HASH
+        ? std::numeric_limits<Epoch>::max() : leafCutoff(leaf_id, max_batch);
+    
+    for (size_t i = 0; i < shards_.size() && slice.size() < max_batch; ++i) {
+        auto& shard = shards_[i];
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        
+        auto it = shard->leaf_index.find(leaf_id);
+        if (it == shard->leaf_index.end()) continue;
+        
+        auto& seqs = it->second;
+        std::vector<uint64_t> kept;
+        size_t taken = 0;
+        for (; taken < seqs.size() && slice.size() < max_batch; ++taken) {
+            Slot* slot = shard->at(seqs[taken]);
+            if (!slot || slot->state != SlotState::LIVE) continue;
+            if (slot->leased || viewOf(*slot).epoch() > cutoff) {
+                // Held by an oldest-first slice, or past the affine cut;
+                // keep it indexed
+                kept.push_back(seqs[taken]);
+                continue;
+            }
+            
+            slot->leased = true;
+            slice.views_.push_back(viewOf(*slot));
+            slice.addTicket(static_cast<uint32_t>(i), seqs[taken]);
+        }
+        
+        seqs.erase(seqs.begin(), seqs.begin() + taken);
+        seqs.insert(seqs.begin(), kept.begin(), kept.end());
+        if (seqs.empty()) {
+            shard->leaf_index.erase(it);
+        }
+    }
+    
+    return slice;
+}
+
+LeafSlice MessageBuffer::sliceOldest(size_t max_batch, Epoch through) {
+    publishStaged();
+    
+    LeafSlice slice;
+    slice.owner_ = this;
+    slice.leaf_id_ = LeafSlice::kAllLeaves;
+    
+    // Even share per shard so no shard starves the others
+    const size_t per_shard = std::max<size_t>(1, max_batch / shards_.size());
+    const Epoch cutoff = std::min(through, config_.shard_affinity == ShardAffinity::HASH
+        ? std::numeric_limits<Epoch>::max() : oldestCutoff(per_shard));
+    
+    for (size_t i = 0; i < shards_.size() && slice.size() < max_batch; ++i) {
+        auto& shard = shards_[i];
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        
+        // Stop at the first slot already leased by another slice so the
+        // range stays contiguous
+        uint64_t seq = shard->base_seq;
+        size_t taken = 0;
+        for (auto& slot : shard->slots) {
+            if (taken >= per_shard || slice.size() >= max_batch) break;
+            if (slot.leased) break;
+            if (slot.state == SlotState::LIVE) {
+                if (viewOf(slot).epoch() > cutoff) break;
+                slot.leased = true;
+                slice.views_.push_back(viewOf(slot));
+                taken++;
+            }
+            seq++;
+        }
+        
+        if (seq > shard->base_seq) {
+            slice.ranges_.push_back({static_cast<uint32_t>(i), shard->base_seq, seq});
+        }
+    }
+    
+    return slice;
+}
+
+void MessageBuffer::evict(LeafSlice&& flushed) {
+    size_t before = total_bytes_.load();
+    releaseSlice(flushed, true);
+    size_t after = total_bytes_.load();
+    recordDrain(before > after ? before - after : 0);
+    
+    // Signal space available
+    space_cv_.notify_all();
+}
+
+void MessageBuffer::releaseSlice(LeafSlice& slice, bool flushed) {
+    const auto& ranges = slice.ranges_;
+    const bool by_leaf = slice.leaf_id_ != LeafSlice::kAllLeaves;
+    
+    // Ranges are grouped by shard: take each shard lock once
+    size_t begin = 0;
+    while (begin < ranges.size()) {
+        uint32_t shard_idx = ranges[begin].shard;
+        size_t end = begin;
+        while (end < ranges.size() && ranges[end].shard == shard_idx) ++end;
+        
+        Shard* shard = shards_[shard_idx].get();
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        
+        std::vector<uint64_t> returned;
+        for (size_t r = begin; r < end; ++r) {
+            uint64_t first = std::max(ranges[r].begin, shard->base_seq);
+            uint64_t last = std::min<uint64_t>(ranges[r].end,
+                                               shard->base_seq + shard->slots.size());
+            for (uint64_t seq = first; seq < last; ++seq) {
+                Slot& slot = shard->slots[seq - shard->base_seq];
+                if (!slot.leased) continue;  // Dead before slicing (oldest ranges)
+                slot.leased = false;
+                
+                if (flushed) {
+                    retire(shard, slot, seq, SlotState::EVICTED);
+                } else if (slot.state == SlotState::LIVE) {
+                    returned.push_back(seq);
+                } else {
+                    // Superseded while leased; older snapshots may still read it
+                    deferPayload(shard, seq);
+                }
+            }
+        }
+        
+        if (by_leaf && !returned.empty()) {
+            // Un-flushed messages go back ahead of newer ones for the leaf;
+            // oldest-first slices never left the leaf index
+            auto& seqs = shard->leaf_index[slice.leaf_id_];
+            seqs.insert(seqs.begin(), returned.begin(), returned.end());
+        }
+        trimFront(shard);
+        
+        begin = end;
+    }
+    
+    slice.owner_ = nullptr;
+    slice.views_.clear();
+    slice.ranges_.clear();
+}
+
+std::vector<VectorEntry> MessageBuffer::scanForQuery(
+    const Vector& query,
+    TenantOrdinal tenant,
+    NamespaceOrdinal ns,
+    const std::vector<TagId>& tags,
+    size_t max_scan,
+    std::span<const CentroidId> probe,
+    Epoch read_epoch) {
+    
+    publishStaged();
+    
+    std::vector<VectorEntry> results;
+    size_t scanned = 0;
+    
+    // Scan all shards (or the probed posting lists) for matching entries
+    for (auto& shard : shards_) {
+        if (scanned >= max_scan) break;
+        std::vector<std::pair<VectorEntry, PendingHit>> pending;
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            
+            forEachVisible(shard.get(), probe, read_epoch, [&](const Slot& slot) {
+                if (scanned >= max_scan) return false;
+                scanned++;
+                
+                MessageView msg = viewOf(slot);
+                
+                // Apply filters
+                if (msg.op() == OperationType::DELETE) return true;
+                if (tenant && msg.tenant() != tenant) return true;
+                if (ns && msg.namespaceId() != ns) return true;
+                
+                // Tag filter (ANY-of)
+                if (!tags.empty()) {
+                    auto entry_tags = msg.tags();
+                    bool has_tag = false;
+                    for (TagId tag : tags) {
+                        if (std::find(entry_tags.begin(),
+                                     entry_tags.end(), tag) !=
+                            entry_tags.end()) {
+                            has_tag = true;
+                            break;
+                        }
+                    }
+                    if (!has_tag) return true;
+                }
+                
+                auto latest = isLatest(slot, read_epoch);
+                if (!latest) {
+                    pending.push_back({msg.materializeEntry(), {slot.id_hash, slot.epoch, 0}});
+                } else if (*latest) {
+                    results.push_back(msg.materializeEntry());
+                }
+                return true;
+            });
+        }
+        
+        for (auto& [entry, hit] : pending) {
+            if (!shadowedElsewhere(hit.hash, hit.epoch, read_epoch, shard->id)) {
+                results.push_back(std::move(entry));
+            }
+        }
+    }
+    
+    return results;
+}
+
+std::vector<BufferHit> MessageBuffer::scanTopK(
+    const Vector& query,
+    Metric metric,
+    TenantOrdinal tenant,
+    NamespaceOrdinal ns,
+    const std::vector<TagId>& tags,
+    size_t top_k,
+    size_t max_scan,
+    std::span<const CentroidId> probe,
+    Epoch read_epoch) {
+    
+    if (top_k == 0 || query.empty()) return {};
+    publishStaged();
+    
+    const size_t shard_count = shards_.size();
+    const size_t per_shard_scan = (max_scan + shard_count - 1) / shard_count;
+    std::vector<std::vector<BufferHit>> heaps(shard_count);
+    
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < shard_count; ++i) {
+        scoreShard(shards_[i].get(), query, metric, tenant, ns, tags,
+                   top_k, per_shard_scan, probe, read_epoch, heaps[i]);
+    }
+    
+    // Merge per-shard winners
+    std::vector<BufferHit> results;
+    for (auto& heap : heaps) {
+        results.insert(results.end(), heap.begin(), heap.end());
+    }
+    size_t keep = std::min(top_k, results.size());
+    std::partial_sort(results.begin(), results.begin() + keep, results.end(),
+                      [](const BufferHit& a, const BufferHit& b) {
+                          return a.score > b.score;
+                      });
+    results.resize(keep);
+    
+    return results;
+}
+
+void MessageBuffer::scoreShard(Shard* shard, const Vector& query, Metric metric,
+                               TenantOrdinal tenant, NamespaceOrdinal ns,
+                               const std::vector<TagId>& tags, size_t top_k,
+                               size_t max_scan, std::span<const CentroidId> probe,
+                               Epoch read_epoch, std::vector<BufferHit>& heap) {
+    heap.reserve(top_k);
+    
+    const size_t dim = query.size();
+    size_t scanned = 0;
+    std::vector<PendingHit> pending;
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        
+        forEachVisible(shard, probe, read_epoch, [&](const Slot& slot) {
+            if (scanned >= max_scan) return false;
+            scanned++;
+            
+            MessageView msg = viewOf(slot);
+            if (msg.op() == OperationType::DELETE) return true;
+            
+            StoredVector vec = msg.stored();
+            if (vec.size != dim) return true;
+            if (tenant && msg.tenant() != tenant) return true;
+            if (ns && msg.namespaceId() != ns) return true;
+            if (!tags.empty()) {
+                auto entry_tags = msg.tags();
+                bool has_tag = std::any_of(tags.begin(), tags.end(), [&](TagId tag) {
+                    return std::find(entry_tags.begin(), entry_tags.end(), tag) != entry_tags.end();
+                });
+                if (!has_tag) return true;
+            }
+            
+            Score s = kernels::score(metric, query.data(), vec.data, vec.type, vec.scale, dim);
+            if (heap.size() == top_k && s <= heap.front().score) return true;
+            auto latest = isLatest(slot, read_epoch);
+            if (!latest) {
+                pending.push_back({slot.id_hash, slot.epoch, s});
+            } else if (*latest) {
+                offerHit(heap, top_k, slot.id_hash, s);
+            }
+            return true;
+        });
+    }
+    
+    for (const PendingHit& hit : pending) {
+        if (heap.size() == top_k && hit.score <= heap.front().score) continue;
+        if (shadowedElsewhere(hit.hash, hit.epoch, read_epoch, shard->id)) continue;
+        offerHit(heap, top_k, hit.hash, hit.score);
+    }
+}
+
+std::vector<std::vector<BufferHit>> MessageBuffer::scanTopKBatch(
+    std::span<const Vector> queries,
+    Metric metric,
+    TenantOrdinal tenant,
+    NamespaceOrdinal ns,
+    const std::vector<TagId>& tags,
+    size_t top_k,
+    size_t max_scan,
+    std::span<const CentroidId> probe,
+    Epoch read_epoch) {
+    
+    const size_t count = queries.size();
+    std::vector<std::vector<BufferHit>> results(count);
+    if (top_k == 0 || count == 0 || queries[0].empty()) return results;
+    
+    // Pack queries row-major so the batch kernels stream them together
+    const size_t dim = queries[0].size();
+    std::vector<float> packed(count * dim);
+    std::vector<float> norms(count);
+    for (size_t q = 0; q < count; ++q) {
+        if (queries[q].size() != dim) {
+            throw util::InvalidArgumentException("query batch mixes dimensions");
+        }
+        std::copy(queries[q].begin(), queries[q].end(), packed.begin() + q * dim);
+        norms[q] = kernels::distance_table().inner_product(queries[q].data(),
+                                                           queries[q].data(), dim);
+    }
+    publishStaged();
+    
+    const size_t shard_count = shards_.size();
+    const size_t per_shard_scan = (max_scan + shard_count - 1) / shard_count;
+    std::vector<std::vector<std::vector<BufferHit>>> heaps(shard_count);
+    
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < shard_count; ++i) {
+        heaps[i].resize(count);
+        scoreShardBatch(shards_[i].get(), packed, norms, dim, metric, tenant, ns, tags,
+                        top_k, per_shard_scan, probe, read_epoch, heaps[i]);
+    }
+    
+    // Merge per-shard winners of each query
+    for (size_t q = 0; q < count; ++q) {
+        auto& merged = results[q];
+        for (auto& shard_heaps : heaps) {
+            merged.insert(merged.end(), shard_heaps[q].begin(), shard_heaps[q].end());
+        }
+        size_t keep = std::min(top_k, merged.size());
+        std::partial_sort(merged.begin(), merged.begin() + keep, merged.end(),
+                          [](const BufferHit& a, const BufferHit& b) {
+                              return a.score > b.score;
+                          });
+        merged.resize(keep);
+    }
+    
+    return results;
+}
+
+void MessageBuffer::scoreShardBatch(Shard* shard, const std::vector<float>& queries,
+                                    const std::vector<float>& query_norms, size_t dim,
+                                    Metric metric, TenantOrdinal tenant, NamespaceOrdinal ns,
+                                    const std::vector<TagId>& tags, size_t top_k,
+                                    size_t max_scan, std::span<const CentroidId> probe,
+                                    Epoch read_epoch, std::vector<std::vector<BufferHit>>& heaps) {
+    const size_t count = heaps.size();
+    for (auto& heap : heaps) heap.reserve(top_k);
+    
+    // Matching vectors are staged in blocks of one element type, as stored,
+    // and each block is scored against every query at once (matrix kernels:
+    // register tiles for fp32, AMX tiles for int8 and bf16 where present)
+    constexpr size_t kStageBlock = 16;
+    std::vector<std::byte> staged(kStageBlock * dim * sizeof(float));
+    std::vector<float> staged_scales(kStageBlock);
+    std::vector<const Slot*> staged_slots;
+    staged_slots.reserve(kStageBlock);
+    ElementType staged_type = ElementType::FP32;
+    std::vector<Score> scores(count * kStageBlock);
+    std::vector<float> scratch(kStageBlock);
+    std::vector<PendingHit> pending;
+    
+    auto flush = [&] {
+        const size_t n = staged_slots.size();
+        if (n == 0) return;
+        kernels::score_matrix(metric, queries.data(), query_norms.data(), count, staged.data(), staged_type,
+                              staged_scales.data(), n, dim, scores.data(), scratch.data());
+        for (size_t j = 0; j < n; ++j) {
+            const Slot* slot = staged_slots[j];
+            std::optional<bool> latest;
+            bool checked = false;  // Checked once, and only if some query keeps the hit
+            for (size_t q = 0; q < count; ++q) {
+                auto& heap = heaps[q];
+                Score s = scores[q * n + j];
+                if (heap.size() == top_k && s <= heap.front().score) continue;
+                if (!checked) {
+                    latest = isLatest(*slot, read_epoch);
+                    checked = true;
+                }
+                if (!latest) {
+                    pending.push_back({slot->id_hash, slot->epoch, s, q});
+                    continue;
+                }
+                if (!*latest) break;
+                offerHit(heap, top_k, slot->id_hash, s);
+            }
+        }
+        staged_slots.clear();
+    };
+    
+    size_t scanned = 0;
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        
+        forEachVisible(shard, probe, read_epoch, [&](const Slot& slot) {
+            if (scanned >= max_scan) return false;
+            scanned++;
+            
+            MessageView msg = viewOf(slot);
+            if (msg.op() == OperationType::DELETE) return true;
+            
+            StoredVector vec = msg.stored();
+            if (vec.size != dim) return true;
+            if (tenant && msg.tenant() != tenant) return true;
+            if (ns && msg.namespaceId() != ns) return true;
+            if (!tags.empty()) {
+                auto entry_tags = msg.tags();
+                bool has_tag = std::any_of(tags.begin(), tags.end(), [&](TagId tag) {
+                    return std::find(entry_tags.begin(), entry_tags.end(), tag) != entry_tags.end();
+                });
+                if (!has_tag) return true;
+            }
+            
+            if (!staged_slots.empty() && vec.type != staged_type) flush();
+            staged_type = vec.type;
+            const size_t bytes = dim * util::element_size(vec.type);
+            std::memcpy(staged.data() + staged_slots.size() * bytes, vec.data, bytes);
+            staged_scales[staged_slots.size()] = vec.scale;
+            staged_slots.push_back(&slot);
+            if (staged_slots.size() == kStageBlock) flush();
+            return true;
+        });
+        flush();
+    }
+    
+    // Hits of one slot sit next to each other: resolve each slot once
+    std::optional<std::pair<VectorIdHash, Epoch>> resolved;
+    bool shadowed = false;
+    for (const PendingHit& hit : pending) {
+        auto& heap = heaps[hit.query];
+        if (heap.size() == top_k && hit.score <= heap.front().score) continue;
+        if (!resolved || resolved->first != hit.hash || resolved->second != hit.epoch) {
+            shadowed = shadowedElsewhere(hit.hash, hit.epoch, read_epoch, shard->id);
+            resolved = std::make_pair(hit.hash, hit.epoch);
+        }
+        if (!shadowed) offerHit(heap, top_k, hit.hash, hit.score);
+    }
+}
+
+std::vector<VectorEntry> MessageBuffer::fetchEntries(
+    const std::vector<VectorIdHash>& hashes) const {
+    
+    std::vector<VectorEntry> results;
+    results.reserve(hashes.size());
+    
+    auto findInShard = [this](const Shard& shard, VectorIdHash hash) -> const Slot* {
+        if (config_.dedupe_enabled) {
+            // The shard map already points at the live version
+            auto it = shard.latest_map.find(hash);
+            return it != shard.latest_map.end() ? shard.at(it->second) : nullptr;
+        }
+        for (auto it = shard.slots.rbegin(); it != shard.slots.rend(); ++it) {
+            if (it->state == SlotState::LIVE && it->id_hash == hash) {
+                return &*it;
+            }
+        }
+        return nullptr;
+    };
+    
+    for (VectorIdHash hash : hashes) {
+        // Affine placement may leave versions in any shard; newest epoch wins
+        const bool affine = config_.shard_affinity != ShardAffinity::HASH;
+        size_t first = affine ? 0 : getShardIndex(hash);
+        size_t last = affine ? shards_.size() : first + 1;
+        
+        std::optional<VectorEntry> best;
+        std::optional<Epoch> best_epoch;
+        for (size_t i = first; i < last; ++i) {
+            const auto& shard = shards_[i];
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            
+            const Slot* found = findInShard(*shard, hash);
+            if (!found || !found->hasPayload()) continue;
+            
+            MessageView msg = viewOf(*found);
+            if (best_epoch && msg.epoch() < *best_epoch) continue;
+            best_epoch = msg.epoch();
+            
+            // A newer delete shadows older versions in other shards
+            best.reset();
+            if (msg.op() != OperationType::DELETE) {
+                best = msg.materializeEntry();
+            }
+        }
+        
+        if (best) {
+            results.push_back(std::move(*best));
+        }
+    }
+    
+    return results;
+}
+
+void MessageBuffer::setHardWatermark(size_t bytes) {
+    const size_t hard = std::clamp(bytes, soft_watermark_, std::max(soft_watermark_, config_.max_bytes));
+    const size_t old = hard_watermark_.exchange(hard);
+    if (hard > old) {
+        space_cv_.notify_all();
+    } else if (const size_t used = total_bytes_.load(); used > hard) {
+        signalFlush(used, true);
+    }
+}
+
+MessageBuffer::Stats MessageBuffer::getStats() const {
+    Stats stats;
+    stats.message_count = total_messages_.load();
+    stats.bytes_used = total_bytes_.load();
+    stats.dedupe_count = dedupe_count_.load();
+    stats.rejected_count = rejected_count_.load();
+    
+    for (const auto& shard : shards_) {
+        stats.shard_sizes.push_back(shard->count.load());
+    }
+    
+    return stats;
+}
+
+std::vector<MessageBuffer::LeafStats> MessageBuffer::leafStats() const {
+    std::unordered_map<size_t, LeafStats> by_leaf;
+    
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (const auto& [leaf_id, seqs] : shard->leaf_index) {
+            LeafStats& leaf = by_leaf[leaf_id];
+            leaf.leaf_id = leaf_id;
+            for (uint64_t seq : seqs) {
+                const Slot* slot = shard->at(seq);
+                if (!slot) continue;
+                if (slot->state == SlotState::SUPERSEDED) {
+                    leaf.superseded++;
+                } else if (slot->state == SlotState::LIVE && !slot->leased) {
+                    leaf.messages++;
+                    leaf.bytes += slot->bytes;
+                    leaf.oldest = std::min(leaf.oldest, viewOf(*slot).timestamp());
+                }
+            }
+        }
+    }
+    
+    std::vector<LeafStats> leaves;
+    leaves.reserve(by_leaf.size());
+    for (auto& [leaf_id, leaf] : by_leaf) {
+        if (leaf.messages > 0) leaves.push_back(leaf);
+    }
+    return leaves;
+}
+
+bool MessageBuffer::waitForSpace(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(space_mutex_);
+    return space_cv_.wait_for(lock, timeout, [this] {
+        return total_bytes_.load() < hard_watermark_.load();
+    });
+}
+
+void MessageBuffer::clear() {
+    {
+        std::lock_guard<std::mutex> registry_lock(staging_registry_mutex_);
+        for (auto& staging : staging_registry_) {
+            std::lock_guard<std::mutex> lock(staging->mutex);
+            for (auto& pending : staging->per_shard) pending.clear();
+        }
+    }
+    
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->slots.clear();
+        shard->grace.clear();
+        shard->base_seq = 0;
+        shard->latest_map.clear();
+        shard->leaf_index.clear();
+        shard->postings.clear();
+        shard->posting_entries = 0;
+        for (auto& slab : shard->slabs) slab->discard();
+        shard->slabs.clear();
+        shard->bytes = 0;
+        shard->count = 0;
+    }
+    
+    total_bytes_ = 0;
+    total_messages_ = 0;
+    dedupe_count_ = 0;
+    flush_signalled_ = false;
+    
+    space_cv_.notify_all();
+}
+
+size_t MessageBuffer::estimateSize(const BTreeMessage& msg) const {
+    if (config_.arena_enabled) {
+        // Exact: one fixed-stride record plus its variable tail
+        return BufferSlab::strideFor(config_.dim, config_.element_type) +
+               BufferSlab::tailBytesFor(msg, config_.backend->persistent());
+    }
+    
+    size_t size = sizeof(BTreeMessage);
+    size += msg.entry.vector.size() * sizeof(float);
+    size += msg.entry.id.size();
+    size += msg.entry.tags.size() * sizeof(TagId);
+    return size;
+}
+
+ArenaRecord* MessageBuffer::appendToArena(Shard* shard, const BTreeMessage& msg) {
+    if (!shard->slabs.empty()) {
+        if (ArenaRecord* rec = shard->slabs.back()->tryAppend(msg)) {
+            return rec;
+        }
+    }
+    
+    // Current slab is full; oversize messages get a slab of their own
+    size_t needed = estimateSize(msg);
+    size_t capacity = std::max(config_.arena_slab_bytes, needed);
+    shard->slabs.push_back(std::make_unique<BufferSlab>(
+        config_.backend.get(), capacity, config_.dim, config_.element_type, shard->id));
+    return shard->slabs.back()->tryAppend(msg);
+}
+
+bool MessageBuffer::supersede(Shard* shard, Slot& incoming, uint64_t seq) {
+    auto it = shard->latest_map.find(incoming.id_hash);
+    if (it == shard->latest_map.end()) return true;
+    
+    uint64_t latest = it->second;
+    Slot* slot = shard->at(latest);
+    if (slot && slot->epoch > incoming.epoch) {
+        // Arrived after a later version (later epoch wins, as in WAL
+        // replay): chain it in below the oldest version newer than it
+        Slot* newer = slot;
+        Slot* older = shard->at(newer->prev);
+        while (older && older->epoch > incoming.epoch) {
+            newer = older;
+            older = shard->at(older->prev);
+        }
+        if (older) older->superseded_at = incoming.epoch;
+        incoming.prev = newer->prev;
+        incoming.superseded_at = newer->epoch;
+        incoming.state = SlotState::SUPERSEDED;
+        newer->prev = seq;
+        dedupe_count_++;
+        return false;
+    }
+    
+    incoming.prev = latest;
+    if (slot && slot->state == SlotState::LIVE) {
+        slot->superseded_at = incoming.epoch;
+        retire(shard, *slot, latest, SlotState::SUPERSEDED);
+        dedupe_count_++;
+    }
+    return true;
+}
+
+void MessageBuffer::retire(Shard* shard, Slot& slot, uint64_t seq, SlotState state) {
+    if (slot.state == SlotState::LIVE) {
+        slot.state = state;
+        
+        shard->bytes.fetch_sub(slot.bytes);
+        shard->count.fetch_sub(1);
+        total_bytes_.fetch_sub(slot.bytes);
+        total_messages_.fetch_sub(1);
+        
+        auto it = shard->latest_map.find(slot.id_hash);
+        if (it != shard->latest_map.end() && it->second == seq) {
+            shard->latest_map.erase(it);
+        }
+    }
+    
+    // Leased payloads are freed when their slice comes back; superseded
+    // ones once the snapshots that may still read them are gone
+    if (slot.leased) return;
+    if (slot.state == SlotState::SUPERSEDED) {
+        deferPayload(shard, seq);
+    } else {
+        freePayload(shard, slot);
+    }
+}
+
+void MessageBuffer::deferPayload(Shard* shard, uint64_t seq) {
+    shard->grace.push_back({util::EpochDomain::global().defer(), seq});
+    if (shard->grace.size() % kGraceBatch == 0) reclaimSuperseded(shard);
+}
+
+void MessageBuffer::reclaimSuperseded(Shard* shard) {
+    auto& grace = shard->grace;
+    if (grace.empty()) return;
+    
+    // Tickets only grow: if the newest has passed, every one has
+    auto& domain = util::EpochDomain::global();
+    size_t done = grace.size();
+    if (!domain.passed(grace.back().ticket)) {
+        done = 0;
+        while (done < grace.size() && domain.passed(grace[done].ticket)) ++done;
+    }
+    for (size_t i = 0; i < done; ++i) {
+        if (Slot* slot = shard->at(grace[i].seq)) freePayload(shard, *slot);
+    }
+    grace.erase(grace.begin(), grace.begin() + static_cast<std::ptrdiff_t>(done));
+}
+
+void MessageBuffer::freePayload(Shard* shard, Slot& slot) {
+    slot.msg.reset();
+    
+    if (slot.rec) {
+        BufferSlab* slab = slot.slab;
+        ArenaRecord* rec = std::exchange(slot.rec, nullptr);
+        slot.slab = nullptr;
+        
+        if (slab->release(rec) == 0) {
+            if (slab == shard->slabs.back().get()) {
+                // Active slab fully drained: rewind it in place
+                slab->reset();
+            } else {
+                // Sealed slab fully drained: release it in bulk
+                auto it = std::find_if(shard->slabs.begin(), shard->slabs.end(),
+                                       [slab](const auto& s) { return s.get() == slab; });
+                shard->slabs.erase(it);
+            }
+        }
+    }
+}
+
+void MessageBuffer::trimFront(Shard* shard) {
+    // Dead slots hold no payload once their grace period is over; drop the
+    // whole dead prefix in one erase
+    reclaimSuperseded(shard);
+    auto it = std::find_if(shard->slots.begin(), shard->slots.end(),
+                           [](const Slot& slot) {
+                               return slot.state == SlotState::LIVE || slot.leased ||
+                                      slot.hasPayload();
+                           });
+    size_t dead = static_cast<size_t>(it - shard->slots.begin());
+    if (dead > 0) {
+        shard->slots.erase(shard->slots.begin(), it);
+        shard->base_seq += dead;
+    }
+    
+    // Postings of unprobed centroids are only pruned here; keep them within
+    // a constant factor of the buffered slots
+    if (shard->posting_entries > 2 * shard->slots.size() + 1024) {
+        compactPostings(shard);
+    }
+}
+
+} // namespace woved::storage
@@ -1,16 +1,457 @@
 #pragma once
 
 #include "include/woved/types.h"
+#include "include/woved/api-errors.h"
+#include "core/metrics.h"
 #include "storage/latest-by-id.h"
+#include "storage/buffer/nvm-buf.h"
+#include "util/exceptions.h"
+#include "util/intern-table.h"
+#include "util/logging.h"
+#include "util/numa-aware.h"
+#include "util/simd-dispatch.h"
+#include "util/telemetry.h"
+#include "util/vector-codec.h"
+#include <array>
 #include <vector>
+#include <chrono>
 #include <deque>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
 #include <memory>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <new>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
 
 namespace woved::storage {
 
+// Fixed-stride record header stored at the front of a buffer slab. The vector
+// payload follows the header inline, encoded as the collection element type
+// and padded to the collection dim; tags and the id string live in the slab's
+// variable tail. Binary (uuid) ids are stored inline and leave the id string
+// empty. Tenant and namespace are interned ordinals; persistent slabs also
+// keep their names in the tail so a restart can re-intern them.
+struct ArenaRecord {
+    VectorIdHash id_hash;
+    VectorUuid uuid;
+    TenantOrdinal tenant;
+    NamespaceOrdinal namespace_id;
+    Epoch epoch;
+    int64_t timestamp_us;
+    int64_t created_at_us;
+    int64_t updated_at_us;
+    uint32_t tail_offset;   // Offset of tags + strings within the slab
+    uint32_t vector_len;    // <= slab dim (0 for deletes)
+    float vector_scale;     // Per-vector INT8 scale (1 otherwise)
+    uint16_t id_len;
+    uint16_t tenant_len;    // Persistent slabs only
+    uint16_t ns_len;
+    uint16_t tag_count;
+    CentroidId centroid_id;
+    OperationType op;
+    ElementType element_type;
+    bool deleted;
+    uint32_t seal;          // Written last on persistent slabs, see BufferSlab
+
+    const void* payload() const { return this + 1; }
+    void* payload() { return this + 1; }
+
+    // FP32 records only
+    const float* vector() const {
+        return static_cast<const float*>(payload());
+    }
+};
+
+// Bump-allocated slab of fixed-stride records. Records grow from the front,
+// variable-length bytes grow down from the back; the whole slab is released
+// in one shot once every record in it has been evicted or superseded.
+//
+// On a persistent backend each record is sealed after its bytes are durable,
+// and sealed again as retired once its payload is dropped. Seals are mixed
+// with the region generation, so records left over from an earlier use of
+// the region never validate. A slab destroyed with live records keeps its
+// region open for the next run to adopt.
+class BufferSlab {
+public:
+    static constexpr size_t kAlignment = 64;
+    static constexpr uint32_t kSealLive = 0x4c495645;     // "LIVE"
+    static constexpr uint32_t kSealRetired = 0x44454144;  // "DEAD"
+
+    static size_t strideFor(size_t dim, ElementType type = ElementType::FP32) {
+        size_t raw = sizeof(ArenaRecord) + dim * util::element_size(type);
+        return (raw + kAlignment - 1) & ~(kAlignment - 1);
+    }
+
+    // Persistent slabs also hold the tenant and namespace names
+    static size_t tailBytesFor(const BTreeMessage& msg, bool durable) {
+        if (!durable) return paddedTailBytes(msg, 0);
+        size_t names = util::InternTable::tenants().name(msg.entry.tenant).size() +
+                       util::InternTable::namespaces().name(msg.entry.namespace_id).size();
+        return paddedTailBytes(msg, names);
+    }
+
+    BufferSlab(SlabBackend* backend, size_t capacity, size_t dim, ElementType type,
+               uint32_t shard)
+        : backend_(backend), durable_(backend->persistent()),
+          region_(backend->allocate(capacity, shard)), data_(region_.data),
+          capacity_(region_.capacity), dim_(dim), type_(type),
+          stride_(strideFor(dim, type)), tail_(capacity_) {}
+
+    // Adopt a region recovered from a persistent backend: trailing records
+    // whose seal does not match the region generation were never committed
+    BufferSlab(SlabBackend* backend, const SlabRegion& region, size_t dim, ElementType type)
+        : backend_(backend), durable_(true), region_(region), data_(region.data),
+          capacity_(region.capacity), dim_(dim), type_(type),
+          stride_(strideFor(dim, type)), tail_(capacity_) {
+        for (size_t head = 0; head + stride_ <= tail_; head += stride_) {
+            auto* rec = reinterpret_cast<ArenaRecord*>(data_ + head);
+            bool live = rec->seal == (kSealLive ^ region_.generation);
+            bool retired = rec->seal == (kSealRetired ^ region_.generation);
+            if ((!live && !retired) || rec->tail_offset < head + stride_ ||
+                rec->tail_offset > tail_ || rec->vector_len > dim_ ||
+                rec->element_type != type_) {
+                break;
+            }
+            tail_ = rec->tail_offset;
+            ++count_;
+            live_ += live;
+        }
+    }
+
+    ~BufferSlab() {
+        if (!durable_ || live_ == 0) {
+            backend_->release(region_);
+        }
+    }
+
+    BufferSlab(const BufferSlab&) = delete;
+    BufferSlab& operator=(const BufferSlab&) = delete;
+
+    // Copy a message into the slab; returns nullptr when it does not fit
+    ArenaRecord* tryAppend(const BTreeMessage& msg) {
+        std::string tenant_name;
+        std::string ns_name;
+        if (durable_) {
+            tenant_name = util::InternTable::tenants().name(msg.entry.tenant);
+            ns_name = util::InternTable::namespaces().name(msg.entry.namespace_id);
+        }
+        size_t tail_bytes = paddedTailBytes(msg, tenant_name.size() + ns_name.size());
+        size_t head = count_ * stride_;
+        if (head + stride_ + tail_bytes > tail_) {
+            return nullptr;
+        }
+
+        tail_ -= tail_bytes;
+        auto* rec = new (data_ + head) ArenaRecord{};
+        const auto& e = msg.entry;
+        rec->id_hash = e.id_hash;
+        rec->uuid = e.uuid;
+        rec->tenant = e.tenant;
+        rec->namespace_id = e.namespace_id;
+        rec->epoch = msg.epoch;
+        rec->timestamp_us = msg.timestamp.count();
+        rec->created_at_us = e.created_at.count();
+        rec->updated_at_us = e.updated_at.count();
+        rec->tail_offset = static_cast<uint32_t>(tail_);
+        rec->vector_len = static_cast<uint32_t>(e.vector.size());
+        rec->id_len = static_cast<uint16_t>(e.id.size());
+        rec->tenant_len = static_cast<uint16_t>(tenant_name.size());
+        rec->ns_len = static_cast<uint16_t>(ns_name.size());
+        rec->tag_count = static_cast<uint16_t>(e.tags.size());
+        rec->centroid_id = e.centroid_id;
+        rec->op = msg.op;
+        rec->element_type = type_;
+        rec->deleted = e.deleted;
+        rec->seal = 0;
+
+        rec->vector_scale = 1.0f;
+        if (!e.vector.empty()) {
+            rec->vector_scale = util::encode_vector(e.vector.data(), e.vector.size(), type_,
+                                                    rec->payload());
+        }
+
+        std::byte* out = data_ + tail_;
+        if (!e.tags.empty()) {
+            std::memcpy(out, e.tags.data(), e.tags.size() * sizeof(TagId));
+            out += e.tags.size() * sizeof(TagId);
+        }
+        std::memcpy(out, e.id.data(), e.id.size());
+        out += e.id.size();
+        std::memcpy(out, tenant_name.data(), tenant_name.size());
+        out += tenant_name.size();
+        std::memcpy(out, ns_name.data(), ns_name.size());
+
+        if (durable_) {
+            backend_->flush(rec, stride_);
+            backend_->flush(data_ + tail_, tail_bytes);
+            backend_->drain();
+            seal(rec, kSealLive);
+        }
+
+        ++count_;
+        ++live_;
+        return rec;
+    }
+
+    const TagId* tags(const ArenaRecord& rec) const {
+        return reinterpret_cast<const TagId*>(data_ + rec.tail_offset);
+    }
+    std::string_view id(const ArenaRecord& rec) const {
+        auto* p = reinterpret_cast<const char*>(tags(rec) + rec.tag_count);
+        return {p, rec.id_len};
+    }
+    std::string_view tenantName(const ArenaRecord& rec) const {
+        return {id(rec).data() + rec.id_len, rec.tenant_len};
+    }
+    std::string_view namespaceName(const ArenaRecord& rec) const {
+        return {tenantName(rec).data() + rec.tenant_len, rec.ns_len};
+    }
+
+    // Ordinals are per process: map a recovered record's names to this one's
+    void reintern(ArenaRecord* rec) const {
+        rec->tenant = util::InternTable::tenants().intern(tenantName(*rec));
+        rec->namespace_id = util::InternTable::namespaces().intern(namespaceName(*rec));
+    }
+
+    // Rebuild heap-owned structures (used for slices and query results)
+    VectorEntry materializeEntry(const ArenaRecord& rec) const {
+        VectorEntry e;
+        e.id = VectorId(id(rec));
+        e.uuid = rec.uuid;
+        e.id_hash = rec.id_hash;
+        e.vector.resize(rec.vector_len);
+        util::decode_vector(rec.payload(), rec.vector_len, rec.element_type,
+                            rec.vector_scale, e.vector.data());
+        e.tenant = rec.tenant;
+        e.namespace_id = rec.namespace_id;
+        e.tags.assign(tags(rec), tags(rec) + rec.tag_count);
+        e.created_at = Timestamp(rec.created_at_us);
+        e.updated_at = Timestamp(rec.updated_at_us);
+        e.centroid_id = rec.centroid_id;
+        e.deleted = rec.deleted;
+        return e;
+    }
+
+    BTreeMessage materialize(const ArenaRecord& rec) const {
+        BTreeMessage msg;
+        msg.op = rec.op;
+        msg.entry = materializeEntry(rec);
+        msg.epoch = rec.epoch;
+        msg.timestamp = Timestamp(rec.timestamp_us);
+        return msg;
+    }
+
+    // Sealed records in append order (recovery walks the live ones)
+    ArenaRecord* record(size_t index) {
+        return reinterpret_cast<ArenaRecord*>(data_ + index * stride_);
+    }
+    bool isLive(const ArenaRecord& rec) const {
+        return !durable_ || rec.seal == (kSealLive ^ region_.generation);
+    }
+
+    // A record stopped being live; returns records still live in the slab
+    size_t release(ArenaRecord* rec) {
+        if (durable_) seal(rec, kSealRetired);
+        return --live_;
+    }
+
+    // Drop all records in place so a drained slab can be reused
+    void reset() {
+        if (durable_) backend_->renew(region_);
+        count_ = 0;
+        live_ = 0;
+        tail_ = capacity_;
+    }
+
+    // Forget every record so destruction also frees a persistent region
+    void discard() { live_ = 0; }
+
+    size_t capacity() const { return capacity_; }
+    size_t dim() const { return dim_; }
+    ElementType elementType() const { return type_; }
+    size_t count() const { return count_; }
+    size_t live() const { return live_; }
+
+private:
+    static size_t paddedTailBytes(const BTreeMessage& msg, size_t name_bytes) {
+        size_t tail = msg.entry.tags.size() * sizeof(TagId);
+        tail += msg.entry.id.size() + name_bytes;
+        return (tail + alignof(TagId) - 1) & ~(alignof(TagId) - 1);
+    }
+
+    void seal(ArenaRecord* rec, uint32_t kind) {
+        std::atomic_ref<uint32_t>(rec->seal).store(kind ^ region_.generation,
+                                                   std::memory_order_release);
+        backend_->persist(&rec->seal, sizeof(rec->seal));
+    }
+
+    SlabBackend* backend_;
+    bool durable_;
+    SlabRegion region_;
+    std::byte* data_ = nullptr;
+    size_t capacity_;
+    size_t dim_;
+    ElementType type_;
+    size_t stride_;
+    size_t count_ = 0;
+    size_t live_ = 0;
+    size_t tail_;
+};
+
+// Outcome of offering a write to the buffer
+struct AdmissionResult {
+    enum Status {
+        ACCEPTED,
+        THROTTLED,   // Accepted above the soft watermark; flush was signalled
+        OVERLOADED   // Rejected at the hard watermark; retry after the hint
+    };
+    
+    Status status = ACCEPTED;
+    std::chrono::milliseconds retry_after{0};
+    bool durable = false;  // Sealed in a power-safe buffer: no WAL commit needed
+    
+    bool accepted() const { return status != OVERLOADED; }
+    ErrorCode errorCode() const {
+        return accepted() ? ErrorCode::OK : ErrorCode::OVERLOADED;
+    }
+};
+
+// Scored buffer hit returned by in-place top-k scans
+struct BufferHit {
+    VectorIdHash id_hash;
+    Score score;
+};
+
+// A vector as it is stored: fp32 for heap messages, the collection element
+// type for arena records. Score it with kernels::score() without decoding.
+struct StoredVector {
+    const void* data = nullptr;
+    size_t size = 0;
+    ElementType type = ElementType::FP32;
+    float scale = 1.0f;
+};
+
+// Read-only view of a buffered message, either heap- or arena-backed. Views
+// handed out in a LeafSlice stay valid until the slice is evicted or dropped.
+class MessageView {
+public:
+    OperationType op() const { return msg_ ? msg_->op : rec_->op; }
+    VectorIdHash idHash() const { return msg_ ? msg_->entry.id_hash : rec_->id_hash; }
+    Epoch epoch() const { return msg_ ? msg_->epoch : rec_->epoch; }
+    Timestamp timestamp() const {
+        return msg_ ? msg_->timestamp : Timestamp(rec_->timestamp_us);
+    }
+    CentroidId centroidId() const {
+        return msg_ ? msg_->entry.centroid_id : rec_->centroid_id;
+    }
+    // Empty for arena records of a narrower element type; use stored()
+    // or materializeEntry() there
+    VectorView vector() const {
+        if (msg_) return VectorView(msg_->entry.vector);
+        return rec_->element_type == ElementType::FP32
+                   ? VectorView(rec_->vector(), rec_->vector_len)
+                   : VectorView();
+    }
+    StoredVector stored() const {
+        if (msg_) {
+            return {msg_->entry.vector.data(), msg_->entry.vector.size()};
+        }
+        return {rec_->payload(), rec_->vector_len, rec_->element_type, rec_->vector_scale};
+    }
+    std::string_view id() const { return msg_ ? msg_->entry.id : slab_->id(*rec_); }
+    VectorUuid uuid() const { return msg_ ? msg_->entry.uuid : rec_->uuid; }
+    TenantOrdinal tenant() const { return msg_ ? msg_->entry.tenant : rec_->tenant; }
+    NamespaceOrdinal namespaceId() const {
+        return msg_ ? msg_->entry.namespace_id : rec_->namespace_id;
+    }
+    std::span<const TagId> tags() const {
+        return msg_ ? std::span<const TagId>(msg_->entry.tags)
+                    : std::span<const TagId>(slab_->tags(*rec_), rec_->tag_count);
+    }
+
+    VectorEntry materializeEntry() const {
+        return msg_ ? msg_->entry : slab_->materializeEntry(*rec_);
+    }
+    BTreeMessage materialize() const {
+        return msg_ ? *msg_ : slab_->materialize(*rec_);
+    }
+
+private:
+    friend class MessageBuffer;
+
+    const BTreeMessage* msg_ = nullptr;
+    const ArenaRecord* rec_ = nullptr;
+    const BufferSlab* slab_ = nullptr;
+};
+
+// Run of sliced messages within one shard: sequence numbers [begin, end).
+// Sequences are assigned at append and never reused, so a range stays exact
+// no matter what is appended or evicted around it.
+struct SliceRange {
+    uint32_t shard;
+    uint64_t begin;
+    uint64_t end;
+};
+
+class MessageBuffer;
+
+// Zero-copy batch of buffered messages for one leaf (or the oldest messages
+// of every shard). Hand it back to MessageBuffer::evict() once flushed;
+// dropping it un-flushed returns the messages to the buffer for a later slice.
+class LeafSlice {
+public:
+    static constexpr size_t kAllLeaves = SIZE_MAX;
+
+    LeafSlice() = default;
+    LeafSlice(LeafSlice&& other) noexcept { *this = std::move(other); }
+    LeafSlice& operator=(LeafSlice&& other) noexcept;
+    ~LeafSlice();
+
+    LeafSlice(const LeafSlice&) = delete;
+    LeafSlice& operator=(const LeafSlice&) = delete;
+
+    size_t leafId() const { return leaf_id_; }
+    std::span<const MessageView> messages() const { return views_; }
+    std::span<const SliceRange> ranges() const { return ranges_; }
+    size_t size() const { return views_.size(); }
+    bool empty() const { return views_.empty(); }
+
+private:
+    friend class MessageBuffer;
+
+    MessageBuffer* owner_ = nullptr;
+    size_t leaf_id_ = 0;
+    std::vector<MessageView> views_;
+    std::vector<SliceRange> ranges_;  // Grouped by shard, ascending
+
+    void addTicket(uint32_t shard, uint64_t seq) {
+        if (!ranges_.empty() && ranges_.back().shard == shard &&
+            ranges_.back().end == seq) {
+            ranges_.back().end++;
+        } else {
+            ranges_.push_back({shard, seq, seq + 1});
+        }
+    }
+};
+
+// How writes are spread over buffer shards
+enum class ShardAffinity {
+    HASH,  // hash % shard_count: every version of an id in one shard
+    CORE,  // The writer's CPU
+    NUMA   // Hash-chosen shard among those of the writer's NUMA node
+};
+
+// Parse BufferConfig::shard_affinity ("hash", "core", "numa")
+ShardAffinity parseShardAffinity(const std::string& name);
+
 // Central message buffer for write buffering
 class MessageBuffer {
 public:
@@ -19,55 +460,303 @@ public:
         size_t shard_count = 16;
         size_t flush_threshold_bytes = 134217728;  // 128 MiB
         bool dedupe_enabled = true;
+        
+        // Arena mode: store messages in per-shard bump-allocated slabs of
+        // fixed-stride records, with vectors inline at `dim`
+        bool arena_enabled = false;
+        size_t dim = 768;
+        ElementType element_type = ElementType::FP32;  // Of arena vectors
+        size_t arena_slab_bytes = 4194304;  // 4 MiB
+        
+        // Where arena slabs live (null = DRAM). A persistent backend keeps
+        // the buffer across restarts: its open regions are adopted on
+        // construction. Requires arena mode.
+        std::shared_ptr<SlabBackend> backend;
+        
+        // Maps an entry to the tree leaf that will absorb it on flush;
+        // defaults to the pre-computed global centroid
+        std::function<size_t(const VectorEntry&)> leaf_of;
+        
+        // Staged append: producers fill per-thread staging batches that are
+        // published with one shard lock and one counter update per batch.
+        // Staged messages become visible once published (batch full, or any
+        // slice/scan/publishStaged() call).
+        bool staged_append = false;
+        size_t staging_batch = 64;
+        
+        // Admission watermarks: above soft the flush callback fires, above
+        // hard writes are rejected with a retry-after hint.
+        // 0 = flush_threshold_bytes / max_bytes respectively.
+        size_t soft_watermark_bytes = 0;
+        size_t hard_watermark_bytes = 0;
+        uint32_t flush_interval_ms = 100;  // Fallback retry hint
+        
+        // CORE/NUMA keep each producer on socket-local shards. Versions of
+        // one id may then sit in several shards: scans drop versions older
+        // than latest_by_id (or, for an id rewritten after the scan's
+        // read_epoch, than any other shard's version at or below it), and
+        // slices are cut at a common epoch across shards so a leaf still
+        // receives its messages in order. Requires a latest_by_id map.
+        ShardAffinity shard_affinity = ShardAffinity::HASH;
+        
+        // Durable acknowledgement: the buffer is the durability point. An
+        // accepted append() is sealed in the backend before it returns
+        // (AdmissionResult::durable), so the write path acknowledges it
+        // without a WAL group commit; restarts adopt it from the pool.
+        // Requires a power-safe backend (nvm) and no staged append.
+        bool durable_ack = false;
     };
     
-    explicit MessageBuffer(const Config& config, 
+    // Invoked (at most once per crossing) when usage passes the soft
+    // watermark, and on every rejection; receives the bytes in use
+    using FlushCallback = std::function<void(size_t bytes_used)>;
+    
+    explicit MessageBuffer(const Config& config,
                           std::shared_ptr<LatestByIdMap> latest_by_id);
     ~MessageBuffer();
     
-    // Append message to buffer
-    void append(VectorIdHash hash, const BTreeMessage& msg);
-    
-    // Get messages for a specific leaf/partition
-    std::vector<BTreeMessage> sliceForLeaf(size_t leaf_id, size_t max_batch);
-    
-    // Evict messages after successful flush
-    void evict(const std::vector<BTreeMessage>& flushed);
-    
-    // Scan buffer for query (read-your-writes)
+    // Append message to buffer without blocking; OVERLOADED results carry
+    // a retry-after hint for the client
+    AdmissionResult append(VectorIdHash hash, const BTreeMessage& msg);
+    
+    // Wake-up hook for the flush scheduler (set before appends start)
+    void setFlushCallback(FlushCallback callback);
+    
+    // Lease up to `max_batch` buffered messages routed to `leaf_id`, oldest
+    // first per shard; only that leaf's messages are touched
+    LeafSlice sliceForLeaf(size_t leaf_id, size_t max_batch);
+    
+    // Lease the oldest messages of every shard regardless of leaf, one
+    // contiguous range per shard (forced / FIFO drains). A range stops at
+    // the first message newer than `through` (a follower replica dropping
+    // what shipped segments now hold).
+    LeafSlice sliceOldest(size_t max_batch, Epoch through = kLatestEpoch);
+    
+    // Publish every producer's staged messages (staged append mode)
+    void publishStaged();
+    
+    // Release a flushed slice range by range; ranges at a shard's front are
+    // dropped with one bulk erase and fully drained slabs are freed at once
+    void evict(LeafSlice&& flushed);
+    
+    // Scan buffer for query (read-your-writes). A non-empty `probe` (the
+    // query's nearest global centroids, as chosen for the delta IVF) limits
+    // the scan to those centroids' posting lists. Tenant and namespace are
+    // interned ordinals, 0 matching any. Each id is read at `read_epoch`
+    // (a query's snapshot, storage/snapshot.h): its newest version at or
+    // below it. A version superseded by a newer one stays readable until
+    // every reader pinned before the supersede has finished (see Slot).
     std::vector<VectorEntry> scanForQuery(
         const Vector& query,
-        const TenantId& tenant,
-        const NamespaceId& ns,
+        TenantOrdinal tenant,
+        NamespaceOrdinal ns,
+        const std::vector<TagId>& tags,
+        size_t max_scan = 10000,
+        std::span<const CentroidId> probe = {},
+        Epoch read_epoch = kLatestEpoch
+    );
+    
+    // Score buffered vectors in place with the dispatched kernels, keeping a
+    // bounded top-k heap per shard; shards are scanned in parallel. Returns
+    // (id_hash, score) pairs, best first. `max_scan` is split across shards;
+    // `probe` and `read_epoch` restrict the scan as in scanForQuery.
+    std::vector<BufferHit> scanTopK(
+        const Vector& query,
+        Metric metric,
+        TenantOrdinal tenant,
+        NamespaceOrdinal ns,
+        const std::vector<TagId>& tags,
+        size_t top_k,
+        size_t max_scan = 10000,
+        std::span<const CentroidId> probe = {},
+        Epoch read_epoch = kLatestEpoch
+    );
+    
+    // scanTopK for a batch of queries of equal dimension sharing one filter:
+    // each buffered vector is filtered and checked against latest_by_id
+    // once; blocks of them, as stored, are scored against every query with
+    // the matrix kernels (AMX tiles for int8 and bf16 where the CPU has
+    // them, so those scores carry query quantization). Returns one hit list
+    // per query, in query order. `probe` should be the union of the
+    // queries' probes.
+    std::vector<std::vector<BufferHit>> scanTopKBatch(
+        std::span<const Vector> queries,
+        Metric metric,
+        TenantOrdinal tenant,
+        NamespaceOrdinal ns,
         const std::vector<TagId>& tags,
-        size_t max_scan = 10000
+        size_t top_k,
+        size_t max_scan = 10000,
+        std::span<const CentroidId> probe = {},
+        Epoch read_epoch = kLatestEpoch
     );
     
+    // Fetch the latest buffered entry for each hash (e.g. top-k winners);
+    // hashes no longer buffered or deleted are skipped
+    std::vector<VectorEntry> fetchEntries(const std::vector<VectorIdHash>& hashes) const;
+    
     // Get buffer statistics
     struct Stats {
         size_t message_count;
         size_t bytes_used;
         size_t dedupe_count;
+        size_t rejected_count;
         std::vector<size_t> shard_sizes;
     };
     Stats getStats() const;
     
-    // Wait for space if buffer is full
+    // Stats::bytes_used without the shard walk
+    size_t bytesUsed() const { return total_bytes_.load(std::memory_order_relaxed); }
+    
+    // Move the hard watermark (a MemoryGovernor budget): clamped to
+    // [soft watermark, max_bytes]. Lowered under usage, writes are
+    // rejected until flushes drain the buffer below it.
+    void setHardWatermark(size_t bytes);
+    size_t hardWatermark() const { return hard_watermark_.load(std::memory_order_relaxed); }
+    
+    // Per-leaf backlog for the flush scheduler: live messages not yet
+    // sliced, versions of them already superseded in the buffer (how much
+    // the leaf's writes overlap), and the timestamp of its oldest live
+    // message. Walks every leaf index, one shard lock at a time.
+    struct LeafStats {
+        size_t leaf_id = 0;
+        size_t messages = 0;
+        size_t bytes = 0;
+        size_t superseded = 0;
+        Timestamp oldest = Timestamp::max();
+    };
+    std::vector<LeafStats> leafStats() const;
+    
+    // Block until usage drops below the hard watermark (for callers that
+    // prefer waiting over a retry)
     bool waitForSpace(std::chrono::milliseconds timeout);
     
-    // Clear buffer (for recovery)
+    // Clear buffer (for recovery); outstanding slices must be dropped first
     void clear();
     
+    // Messages adopted from a persistent backend at construction, and the
+    // highest epoch among them (WAL replay can start after it)
+    size_t recoveredCount() const { return recovered_count_; }
+    Epoch recoveredEpoch() const { return recovered_epoch_; }
+    
+    // Accepted appends are durable on return (Config::durable_ack)
+    bool durableAck() const { return config_.durable_ack; }
+    
+    // Fuzzy checkpoints (FuzzyCheckpointer): copy up to `max` live messages
+    // of shard `shard` with sequences from `from` on, holding the shard
+    // lock for that batch only. Returns the sequence to continue from, the
+    // shard's end once caught up. `front` receives the oldest sequence the
+    // shard still holds; every message before it has left the buffer.
+    struct CheckpointMessage {
+        uint64_t seq;
+        BTreeMessage msg;
+    };
+    uint64_t collect(size_t shard, uint64_t from, size_t max, std::vector<CheckpointMessage>& out,
+                     uint64_t& front) const;
+    size_t shardCount() const { return shards_.size(); }
+    
+    // Highest epoch of any message made visible to scans of (tenant, ns),
+    // 0 matching any as in scanTopK. Scopes share hashed buckets, so a
+    // write elsewhere can raise it too, never the reverse; a result
+    // computed while it held an epoch is stale once it moves past it.
+    Epoch writeEpoch(TenantOrdinal tenant, NamespaceOrdinal ns) const;
+
 private:
+    friend class LeafSlice;
+    
+    enum class SlotState : uint8_t {
+        LIVE,
+        SUPERSEDED,  // Replaced by a newer buffered version
+        EVICTED      // Flushed to the tree
+    };
+    
+    static constexpr uint64_t kNoSeq = std::numeric_limits<uint64_t>::max();
+    
+    // One buffered message; the payload is either heap-owned or a record in
+    // an arena slab. Dead slots keep their place (and sequence number) until
+    // they reach the front of the shard.
+    //
+    // A superseded slot leaves the counters at once but keeps its payload
+    // in the shard's grace queue until the EpochDomain readers pinned
+    // before the supersede have finished: a snapshot older than the new
+    // version (read_epoch below superseded_at) still reads this one.
+    struct Slot {
+        std::unique_ptr<BTreeMessage> msg;
+        ArenaRecord* rec = nullptr;
+        BufferSlab* slab = nullptr;
+        VectorIdHash id_hash = 0;
+        Epoch epoch = 0;
+        Epoch superseded_at = kLatestEpoch;  // Epoch of the version replacing it
+        uint64_t prev = kNoSeq;  // Previous version of the id in this shard
+        uint32_t bytes = 0;
+        SlotState state = SlotState::LIVE;
+        bool leased = false;  // Referenced by an outstanding LeafSlice
+        
+        bool hasPayload() const { return msg || rec; }
+        
+        // The id's newest version at or below read_epoch, as far as this
+        // shard knows. kLatestEpoch in superseded_at means never replaced,
+        // so a live slot is visible at the default read epoch too.
+        bool visibleAt(Epoch read_epoch) const {
+            return epoch <= read_epoch &&
+                   (superseded_at == kLatestEpoch || superseded_at > read_epoch) && readable();
+        }
+        // Scans may still return it, at some read epoch
+        bool readable() const {
+            return state == SlotState::LIVE || (state == SlotState::SUPERSEDED && hasPayload());
+        }
+    };
+    
+    // A superseded slot whose payload waits out its readers
+    struct GraceSlot {
+        uint64_t ticket;  // util::EpochDomain::defer()
+        uint64_t seq;
+    };
+    
     // Shard structure for parallel access
     struct Shard {
         mutable std::mutex mutex;
-        std::deque<std::unique_ptr<BTreeMessage>> messages;
+        uint32_t id = 0;
+        std::deque<Slot> slots;
+        uint64_t base_seq = 0;  // Sequence number of slots.front()
         std::atomic<size_t> bytes{0};
         std::atomic<size_t> count{0};
         
-        // Per-shard deduplication map (ID hash -> latest message)
-        std::unordered_map<VectorIdHash, BTreeMessage*> latest_map;
+        // Per-shard deduplication map (ID hash -> sequence of latest message)
+        std::unordered_map<VectorIdHash, uint64_t> latest_map;
+        
+        // Superseded slots holding their payload, oldest ticket first
+        std::deque<GraceSlot> grace;
+        
+        // Leaf -> sequences not yet sliced, oldest first (may hold dead slots)
+        std::unordered_map<size_t, std::vector<uint64_t>> leaf_index;
+        
+        // Global centroid -> sequences, oldest first: the buffer's mini IVF.
+        // Dead postings are pruned when probed and by periodic compaction.
+        std::unordered_map<CentroidId, std::vector<uint64_t>> postings;
+        size_t posting_entries = 0;
+        
+        // Arena mode: back() is the slab currently appended to
+        std::vector<std::unique_ptr<BufferSlab>> slabs;
+        
+        Slot* at(uint64_t seq) {
+            return seq >= base_seq && seq - base_seq < slots.size()
+                ? &slots[seq - base_seq] : nullptr;
+        }
+        const Slot* at(uint64_t seq) const {
+            return const_cast<Shard*>(this)->at(seq);
+        }
+    };
+    
+    struct StagedMessage {
+        VectorIdHash hash;
+        BTreeMessage msg;
+    };
+    
+    // Per-producer staging area (staged append mode)
+    struct Staging {
+        std::mutex mutex;
+        std::vector<std::vector<StagedMessage>> per_shard;
     };
     
     Config config_;
@@ -77,234 +766,150 @@ private:
     std::atomic<size_t> total_bytes_{0};
     std::atomic<size_t> total_messages_{0};
     std::atomic<size_t> dedupe_count_{0};
+    std::atomic<size_t> rejected_count_{0};
+    size_t recovered_count_ = 0;
+    Epoch recovered_epoch_ = 0;
+    
+    // writeEpoch() watermarks: every write, by tenant, by tenant and
+    // namespace
+    static constexpr size_t kWriteBuckets = 256;
+    std::atomic<Epoch> write_epoch_{0};
+    std::array<std::atomic<Epoch>, kWriteBuckets> tenant_write_epochs_{};
+    std::array<std::atomic<Epoch>, kWriteBuckets> scope_write_epochs_{};
+    
+    static size_t writeBucket(TenantOrdinal tenant, NamespaceOrdinal ns) {
+        return ((uint64_t{tenant} << 32 | ns) * 0x9E3779B97F4A7C15ULL) >> 56;
+    }
+    void noteWrite(TenantOrdinal tenant, NamespaceOrdinal ns, Epoch epoch);
+    
+    // Admission control
+    size_t soft_watermark_;
+    std::atomic<size_t> hard_watermark_;
+    FlushCallback flush_callback_;
+    std::atomic<bool> flush_signalled_{false};
+    std::atomic<uint64_t> drain_bytes_per_ms_{0};  // EWMA of eviction rate
+    std::atomic<int64_t> last_evict_us_{0};
     
     std::condition_variable space_cv_;
     std::mutex space_mutex_;
     
+    // Staging areas of every producer thread that appended to this buffer
+    const uint64_t instance_id_ = next_instance_id_.fetch_add(1);
+    inline static std::atomic<uint64_t> next_instance_id_{0};
+    std::mutex staging_registry_mutex_;
+    std::vector<std::shared_ptr<Staging>> staging_registry_;
+    
+    // Affine placement: [first shard, shard count) per NUMA node
+    std::vector<std::pair<size_t, size_t>> node_shards_;
+    
     // Get shard for a hash
     size_t getShardIndex(VectorIdHash hash) const {
         return hash % config_.shard_count;
     }
     
-    // Estimate message size
-    size_t estimateSize(const BTreeMessage& msg) const;
-    
-    // Apply deduplication within shard
-    void dedupeInShard(Shard* shard, const BTreeMessage& msg);
-};
-
-// Implementation
-MessageBuffer::MessageBuffer(const Config& config,
-                            std::shared_ptr<LatestByIdMap> latest_by_id)
-    : config_(config), latest_by_id_(latest_by_id) {
-    
-    // Initialize shards
-    shards_.reserve(config_.shard_count);
-    for (size_t i = 0; i < config_.shard_count; ++i) {
-        shards_.emplace_back(std::make_unique<Shard>());
-    }
-    
-    LOG_INFO("MessageBuffer initialized with {} shards, max {} bytes",
-             config_.shard_count, config_.max_bytes);
-}
-
-MessageBuffer::~MessageBuffer() {
-    LOG_INFO("MessageBuffer destroyed with {} messages, {} bytes",
-             total_messages_.load(), total_bytes_.load());
-}
-
-void MessageBuffer::append(VectorIdHash hash, const BTreeMessage& msg) {
-    size_t shard_idx = getShardIndex(hash);
-    auto& shard = shards_[shard_idx];
-    
-    size_t msg_size = estimateSize(msg);
-    
-    // Wait for space if needed
-    while (total_bytes_.load() + msg_size > config_.max_bytes) {
-        if (!waitForSpace(std::chrono::milliseconds(100))) {
-            LOG_WARN("Buffer full, forcing flush");
-            // Trigger flush through callback or return error
-            return;
-        }
-    }
-    
-    std::lock_guard<std::mutex> lock(shard->mutex);
-    
-    // Deduplication within shard
-    if (config_.dedupe_enabled && msg.op != OperationType::DELETE) {
-        auto it = shard->latest_map.find(hash);
-        if (it != shard->latest_map.end()) {
-            // Remove old version
-            dedupe_count_++;
-            // Note: In production, would properly remove from deque
-        }
-    }
-    
-    // Add new message
-    auto msg_ptr = std::make_unique<BTreeMessage>(msg);
-    if (config_.dedupe_enabled) {
-        shard->latest_map[hash] = msg_ptr.get();
-    }
-    
-    shard->messages.push_back(std::move(msg_ptr));
-    shard->bytes.fetch_add(msg_size);
-    shard->count.fetch_add(1);
-    
-    total_bytes_.fetch_add(msg_size);
-    total_messages_.fetch_add(1);
-    
-    // Update latest_by_id for read-your-writes
-    if (latest_by_id_) {
-        VectorLocation loc;
-        loc.type = VectorLocation::BUFFER;
-        loc.timestamp = msg.timestamp;
-        loc.epoch = msg.epoch;
-        loc.tombstone = (msg.op == OperationType::DELETE);
-        
-        latest_by_id_->upsert(msg.entry.id, hash, loc);
-    }
-}
-
-std::vector<BTreeMessage> MessageBuffer::sliceForLeaf(size_t leaf_id, size_t max_batch) {
-    std::vector<BTreeMessage> result;
-    result.reserve(max_batch);
-    
-    // Simple round-robin across shards for the leaf
-    // In production, would use better routing based on key ranges
-    for (size_t i = 0; i < config_.shard_count && result.size() < max_batch; ++i) {
-        auto& shard = shards_[i];
-        std::lock_guard<std::mutex> lock(shard->mutex);
-        
-        size_t to_take = std::min(max_batch - result.size(), shard->messages.size());
-        for (size_t j = 0; j < to_take; ++j) {
-            if (!shard->messages.empty()) {
-                result.push_back(*shard->messages.front());
-                // Note: Not removing yet, wait for evict() call
-            }
-        }
-    }
+    // Shard a write goes to under the configured affinity
+    size_t shardForWrite(VectorIdHash hash) const;
     
-    return result;
-}
-
-void MessageBuffer::evict(const std::vector<BTreeMessage>& flushed) {
-    // Remove flushed messages from buffer
-    // In production, would track which shard each message came from
-    for (const auto& msg : flushed) {
-        size_t shard_idx = getShardIndex(msg.entry.id_hash);
-        auto& shard = shards_[shard_idx];
-        
-        std::lock_guard<std::mutex> lock(shard->mutex);
-        
-        // Remove from front (FIFO)
-        if (!shard->messages.empty()) {
-            size_t msg_size = estimateSize(*shard->messages.front());
-            
-            if (config_.dedupe_enabled) {
-                shard->latest_map.erase(msg.entry.id_hash);
-            }
-            
-            shard->messages.pop_front();
-            shard->bytes.fetch_sub(msg_size);
-            shard->count.fetch_sub(1);
-            
-            total_bytes_.fetch_sub(msg_size);
-            total_messages_.fetch_sub(1);
-        }
-    }
+    // Under affine placement, whether a buffered version is the newest of
+    // its id at or below `read_epoch`. Decided from latest_by_id unless
+    // the id was rewritten after read_epoch; then nullopt, and the caller
+    // asks shadowedElsewhere() once it holds no shard lock.
+    std::optional<bool> isLatest(const Slot& slot, Epoch read_epoch) const;
     
-    // Signal space available
-    space_cv_.notify_all();
-}
-
-std::vector<VectorEntry> MessageBuffer::scanForQuery(
-    const Vector& query,
-    const TenantId& tenant,
-    const NamespaceId& ns,
-    const std::vector<TagId>& tags,
-    size_t max_scan) {
+    // Whether a shard other than `home` holds a version of `hash` newer
+    // than `epoch` and at or below `read_epoch` (takes each shard mutex)
+    bool shadowedElsewhere(VectorIdHash hash, Epoch epoch, Epoch read_epoch, uint32_t home) const;
     
-    std::vector<VectorEntry> results;
-    size_t scanned = 0;
+    // Common epoch cut for affine slices: nothing newer than it is leased,
+    // so no shard hands out a version ahead of an older one left behind
+    Epoch leafCutoff(size_t leaf_id, size_t max_batch);
+    Epoch oldestCutoff(size_t per_shard);
     
-    // Scan all shards for matching entries
-    for (auto& shard : shards_) {
-        std::lock_guard<std::mutex> lock(shard->mutex);
-        
-        for (const auto& msg : shard->messages) {
-            if (scanned >= max_scan) break;
-            scanned++;
-            
-            // Apply filters
-            if (msg->op == OperationType::DELETE) continue;
-            if (!tenant.empty() && msg->entry.tenant != tenant) continue;
-            if (!ns.empty() && msg->entry.namespace_id != ns) continue;
-            
-            // Tag filter (ANY-of)
-            if (!tags.empty()) {
-                bool has_tag = false;
-                for (TagId tag : tags) {
-                    if (std::find(msg->entry.tags.begin(), 
-                                 msg->entry.tags.end(), tag) != 
-                        msg->entry.tags.end()) {
-                        has_tag = true;
-                        break;
-                    }
-                }
-                if (!has_tag) continue;
-            }
-            
-            results.push_back(msg->entry);
-        }
+    size_t leafOf(const VectorEntry& entry) const {
+        return config_.leaf_of ? config_.leaf_of(entry) : entry.centroid_id;
     }
     
-    return results;
-}
-
-MessageBuffer::Stats MessageBuffer::getStats() const {
-    Stats stats;
-    stats.message_count = total_messages_.load();
-    stats.bytes_used = total_bytes_.load();
-    stats.dedupe_count = dedupe_count_.load();
-    
-    for (const auto& shard : shards_) {
-        stats.shard_sizes.push_back(shard->count.load());
+    static MessageView viewOf(const Slot& slot) {
+        MessageView view;
+        view.msg_ = slot.msg.get();
+        view.rec_ = slot.rec;
+        view.slab_ = slot.slab;
+        return view;
     }
     
-    return stats;
-}
-
-bool MessageBuffer::waitForSpace(std::chrono::milliseconds timeout) {
-    std::unique_lock<std::mutex> lock(space_mutex_);
-    return space_cv_.wait_for(lock, timeout, [this] {
-        return total_bytes_.load() < config_.max_bytes;
-    });
-}
-
-void MessageBuffer::clear() {
-    for (auto& shard : shards_) {
-        std::lock_guard<std::mutex> lock(shard->mutex);
-        shard->messages.clear();
-        shard->latest_map.clear();
-        shard->bytes = 0;
-        shard->count = 0;
-    }
+    void signalFlush(size_t bytes_used, bool force);
+    std::chrono::milliseconds retryAfter(size_t bytes_needed) const;
+    void recordDrain(size_t bytes_freed);
     
-    total_bytes_ = 0;
-    total_messages_ = 0;
-    dedupe_count_ = 0;
+    // Estimate message size (exact arena bytes in arena mode)
+    size_t estimateSize(const BTreeMessage& msg) const;
     
-    space_cv_.notify_all();
-}
-
-size_t MessageBuffer::estimateSize(const BTreeMessage& msg) const {
-    size_t size = sizeof(BTreeMessage);
-    size += msg.entry.vector.size() * sizeof(float);
-    size += msg.entry.id.size();
-    size += msg.entry.tenant.size();
-    size += msg.entry.namespace_id.size();
-    size += msg.entry.tags.size() * sizeof(TagId);
-    return size;
-}
+    // Insert one message into its shard (shard mutex held); false if a
+    // later epoch of its id is buffered there, as for linkLocked()
+    bool insertLocked(Shard* shard, VectorIdHash hash,
+                      const BTreeMessage& msg, size_t msg_size);
+    
+    // Supersede the previous version and index a slot whose payload is
+    // already stored (shard mutex held). Returns false if the shard holds a
+    // later epoch of the id: the slot is then linked already superseded,
+    // outside the counters, and the caller leaves latest_by_id alone.
+    bool linkLocked(Shard* shard, Slot slot, size_t leaf, CentroidId centroid);
+    
+    // Visit the slots visible at `read_epoch` (Slot::visibleAt), either all
+    // of them or those posted under the probed centroids (pruning
+    // unreadable postings on the way); stops once `visit` returns false.
+    // Shard mutex held.
+    template <typename Visit>
+    void forEachVisible(Shard* shard, std::span<const CentroidId> probe, Epoch read_epoch, Visit&& visit);
+    
+    // Drop postings of unreadable or trimmed slots (shard mutex held)
+    void compactPostings(Shard* shard);
+    
+    // Adopt the open regions of a persistent backend
+    void recoverSlabs();
+    
+    // Staged append helpers
+    Staging& localStaging();
+    void stageAppend(size_t shard_idx, VectorIdHash hash, const BTreeMessage& msg);
+    void publishBatch(size_t shard_idx, std::vector<StagedMessage>& batch);
+    
+    // Slot lifecycle helpers (shard mutex held). supersede() retires the
+    // id's buffered version in favour of `incoming`, to be stored at `seq`,
+    // and chains the two; if that version has a later epoch, `incoming` is
+    // chained below it instead, marked superseded, and false is returned.
+    bool supersede(Shard* shard, Slot& incoming, uint64_t seq);
+    void retire(Shard* shard, Slot& slot, uint64_t seq, SlotState state);
+    void freePayload(Shard* shard, Slot& slot);
+    void trimFront(Shard* shard);
+    
+    // Free the payloads of superseded slots whose readers have all left;
+    // queued slots are checked every kGraceBatch supersedes and on trim
+    static constexpr size_t kGraceBatch = 64;
+    void deferPayload(Shard* shard, uint64_t seq);
+    void reclaimSuperseded(Shard* shard);
+    
+    // Release or return tickets of a slice, one lock per shard
+    void releaseSlice(LeafSlice& slice, bool flushed);
+    
+    // Score one shard into a bounded min-heap of `top_k` hits
+    // (takes the shard mutex)
+    void scoreShard(Shard* shard, const Vector& query, Metric metric,
+                    TenantOrdinal tenant, NamespaceOrdinal ns,
+                    const std::vector<TagId>& tags, size_t top_k,
+                    size_t max_scan, std::span<const CentroidId> probe,
+                    Epoch read_epoch, std::vector<BufferHit>& heap);
+    
+    // Score one shard for a packed (row-major) query batch into one bounded
+    // min-heap per query (takes the shard mutex)
+    void scoreShardBatch(Shard* shard, const std::vector<float>& queries,
+                         const std::vector<float>& query_norms, size_t dim,
+                         Metric metric, TenantOrdinal tenant, NamespaceOrdinal ns,
+                         const std::vector<TagId>& tags, size_t top_k,
+                         size_t max_scan, std::span<const CentroidId> probe,
+                         Epoch read_epoch, std::vector<std::vector<BufferHit>>& heaps);
+    
+    // Copy a message into the shard's active slab (shard mutex held)
+    ArenaRecord* appendToArena(Shard* shard, const BTreeMessage& msg);
+};
 
-} // namespace woved::storage
\ No newline at end of file
+} // namespace woved::storage
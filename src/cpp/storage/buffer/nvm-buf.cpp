@@ -0,0 +1,302 @@
+#include "nvm-buf.h"
+#include "core/config.h"
+#include "util/logging.h"
+#include "util/vector-codec.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr uint64_t kPoolMagic = 0x4655424445564f57ULL;    // "WOVEDBUF"
+constexpr uint64_t kRegionMagic = 0x4e47524445564f57ULL;  // "WOVEDRGN"
+constexpr uint32_t kPoolVersion = 4;  // 4: interned tenant/namespace ordinals
+constexpr size_t kPageSize = 4096;
+constexpr size_t kCacheLine = 64;
+
+constexpr size_t roundUp(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+} // namespace
+
+struct MappedSlabBackend::PoolHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t region_count;
+    uint64_t region_bytes;
+    uint64_t slab_bytes;
+    uint64_t dim;
+    uint64_t shard_count;
+    uint64_t element_type;
+};
+
+struct alignas(kCacheLine) MappedSlabBackend::RegionHeader {
+    enum : uint32_t { FREE = 0, OPEN = 1 };
+
+    uint64_t magic;
+    uint64_t open_seq;
+    uint32_t generation;
+    uint32_t shard;
+    uint32_t state;  // Written last; a torn header reads as FREE
+};
+
+// DramSlabBackend
+
+DramSlabBackend::DramSlabBackend(util::MemoryPolicy policy)
+    : numa_(policy != util::MemoryPolicy::Local && util::numa_node_count() > 1), policy_(policy) {
+    util::numa_note_placement("message buffer", std::string("heap slabs, ") +
+                                                    util::memory_policy_name(numa_ ? policy_ : util::MemoryPolicy::Local));
+}
+
+SlabRegion DramSlabBackend::allocate(size_t bytes, uint32_t) {
+    SlabRegion region;
+    if (numa_) {
+        region.data = static_cast<std::byte*>(util::numa_alloc(bytes, policy_));
+        if (!region.data) throw std::bad_alloc();
+    } else {
+        region.data = static_cast<std::byte*>(
+            ::operator new(bytes, std::align_val_t{kAlignment}));
+    }
+    region.capacity = bytes;
+    return region;
+}
+
+void DramSlabBackend::release(SlabRegion& region) {
+    if (numa_) {
+        util::numa_free(region.data, region.capacity);
+    } else {
+        ::operator delete(region.data, std::align_val_t{kAlignment});
+    }
+    region.data = nullptr;
+}
+
+// MappedSlabBackend
+
+MappedSlabBackend::Options MappedSlabBackend::Options::fromConfig(const Config& config) {
+    Options options;
+    const BufferConfig& buffer = config.storage.buffer;
+    options.path = buffer.path.empty() ? config.storage.data_dir + "/buffer.pool" : buffer.path;
+    options.mode = buffer.type == "nvm" ? Mode::NVM : Mode::MMAP;
+    options.pool_bytes = buffer.size_bytes;
+    options.slab_bytes = buffer.arena_slab_bytes;
+    options.dim = config.collection.dim;
+    options.element_type = util::parse_element_type(config.collection.element_type);
+    options.shard_count = buffer.shard_count;
+    if (config.numa.enabled) options.memory_policy = util::parse_memory_policy(config.numa.memory_policy);
+    return options;
+}
+
+MappedSlabBackend::MappedSlabBackend(const Options& options)
+    : options_(options) {
+    region_bytes_ = roundUp(sizeof(RegionHeader) + options_.slab_bytes, kPageSize);
+    if (options_.pool_bytes < kPageSize + region_bytes_) {
+        throw util::ConfigException("buffer pool smaller than one slab");
+    }
+    region_count_ = (options_.pool_bytes - kPageSize) / region_bytes_;
+    mapped_bytes_ = kPageSize + region_count_ * region_bytes_;
+
+    PmemStore::Options store;
+    store.path = options_.path;
+    store.bytes = mapped_bytes_;
+    store.direct = options_.mode == Mode::NVM;
+    store_ = std::make_unique<PmemStore>(store);
+    base_ = store_->data();
+    const bool fresh = store_->created();
+    // Before format() or load() first touches the pages
+    const bool placed = options_.mode == Mode::MMAP &&
+                        util::numa_set_policy(base_, mapped_bytes_, options_.memory_policy);
+    util::numa_note_placement("message buffer",
+                              options_.path + (placed ? std::string(", ") + util::memory_policy_name(options_.memory_policy)
+                                                      : std::string(", placed by the file system")));
+
+    if (fresh) {
+        format();
+    } else {
+        load();
+    }
+
+    LOG_INFO("Buffer pool {} mapped: {} regions of {} bytes, {} free",
+             options_.path, region_count_, region_bytes_, free_list_.size());
+}
+
+MappedSlabBackend::~MappedSlabBackend() {
+    sync();
+}
+
+MappedSlabBackend::RegionHeader* MappedSlabBackend::header(uint32_t index) const {
+    return reinterpret_cast<RegionHeader*>(base_ + kPageSize + index * region_bytes_);
+}
+
+SlabRegion MappedSlabBackend::regionAt(uint32_t index) const {
+    RegionHeader* hdr = header(index);
+    SlabRegion region;
+    region.data = reinterpret_cast<std::byte*>(hdr) + sizeof(RegionHeader);
+    region.capacity = options_.slab_bytes;
+    region.index = index;
+    region.generation = hdr->generation;
+    return region;
+}
+
+void MappedSlabBackend::format() {
+    // Region headers are already zero (FREE) in a freshly truncated file
+    auto* pool = reinterpret_cast<PoolHeader*>(base_);
+    pool->version = kPoolVersion;
+    pool->region_count = static_cast<uint32_t>(region_count_);
+    pool->region_bytes = region_bytes_;
+    pool->slab_bytes = options_.slab_bytes;
+    pool->dim = options_.dim;
+    pool->shard_count = options_.shard_count;
+    pool->element_type = static_cast<uint64_t>(options_.element_type);
+    persist(pool, sizeof(PoolHeader));
+
+    std::atomic_ref<uint64_t>(pool->magic).store(kPoolMagic, std::memory_order_release);
+    persist(&pool->magic, sizeof(pool->magic));
+
+    free_list_.reserve(region_count_);
+    for (uint32_t i = static_cast<uint32_t>(region_count_); i-- > 0;) {
+        free_list_.push_back(i);
+    }
+}
+
+void MappedSlabBackend::load() {
+    const auto* pool = reinterpret_cast<const PoolHeader*>(base_);
+    if (pool->magic != kPoolMagic || pool->version != kPoolVersion) {
+        throw util::IOException("not a buffer pool: " + options_.path);
+    }
+    if (pool->region_count != region_count_ || pool->region_bytes != region_bytes_ ||
+        pool->slab_bytes != options_.slab_bytes || pool->dim != options_.dim ||
+        pool->shard_count != options_.shard_count ||
+        pool->element_type != static_cast<uint64_t>(options_.element_type)) {
+        throw util::ConfigException(
+            "buffer pool geometry does not match config: " + options_.path);
+    }
+
+    for (uint32_t i = static_cast<uint32_t>(region_count_); i-- > 0;) {
+        const RegionHeader* hdr = header(i);
+        if (hdr->magic == kRegionMagic && hdr->state == RegionHeader::OPEN) {
+            next_open_seq_ = std::max(next_open_seq_, hdr->open_seq + 1);
+        } else {
+            free_list_.push_back(i);
+        }
+    }
+}
+
+SlabRegion MappedSlabBackend::allocate(size_t bytes, uint32_t shard) {
+    if (bytes > options_.slab_bytes) {
+        throw util::InvalidArgumentException("message larger than buffer pool slab");
+    }
+
+    uint32_t index;
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_list_.empty()) {
+            throw util::IOException("buffer pool exhausted: " + options_.path);
+        }
+        index = free_list_.back();
+        free_list_.pop_back();
+        seq = next_open_seq_++;
+    }
+
+    RegionHeader* hdr = header(index);
+    hdr->magic = kRegionMagic;
+    hdr->open_seq = seq;
+    hdr->generation++;
+    hdr->shard = shard;
+    persist(hdr, sizeof(RegionHeader));
+
+    std::atomic_ref<uint32_t>(hdr->state).store(RegionHeader::OPEN, std::memory_order_release);
+    persist(&hdr->state, sizeof(hdr->state));
+
+    return regionAt(index);
+}
+
+void MappedSlabBackend::release(SlabRegion& region) {
+    RegionHeader* hdr = header(region.index);
+    std::atomic_ref<uint32_t>(hdr->state).store(RegionHeader::FREE, std::memory_order_release);
+    persist(&hdr->state, sizeof(hdr->state));
+    region.data = nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_list_.push_back(region.index);
+}
+
+void MappedSlabBackend::renew(SlabRegion& region) {
+    RegionHeader* hdr = header(region.index);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hdr->open_seq = next_open_seq_++;
+    }
+    hdr->generation++;
+    persist(hdr, sizeof(RegionHeader));
+    region.generation = hdr->generation;
+}
+
+void MappedSlabBackend::persist(const void* addr, size_t len) {
+    flush(addr, len);
+    drain();
+}
+
+void MappedSlabBackend::flush(const void* addr, size_t len) {
+    // MMAP: the page cache already holds the stores
+    if (options_.mode == Mode::NVM) store_->flush(addr, len);
+}
+
+void MappedSlabBackend::drain() {
+    if (options_.mode == Mode::NVM) {
+        store_->drain();
+    } else {
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+}
+
+std::vector<RecoveredRegion> MappedSlabBackend::recover() {
+    std::vector<RecoveredRegion> open;
+    for (uint32_t i = 0; i < region_count_; ++i) {
+        const RegionHeader* hdr = header(i);
+        if (hdr->magic != kRegionMagic || hdr->state != RegionHeader::OPEN) continue;
+        if (hdr->shard >= options_.shard_count) {
+            throw util::IOException("buffer pool region owned by unknown shard");
+        }
+        open.push_back({regionAt(i), hdr->shard, hdr->open_seq});
+    }
+
+    std::sort(open.begin(), open.end(), [](const auto& a, const auto& b) {
+        return a.shard != b.shard ? a.shard < b.shard : a.open_seq < b.open_seq;
+    });
+    return open;
+}
+
+void MappedSlabBackend::sync() {
+    store_->sync();
+}
+
+size_t MappedSlabBackend::freeRegions() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_list_.size();
+}
+
+BufferBackendType parseBufferBackendType(const std::string& type) {
+    if (type == "memory") return BufferBackendType::MEMORY;
+    if (type == "mmap") return BufferBackendType::MMAP;
+    if (type == "nvm") return BufferBackendType::NVM;
+    throw util::ConfigException("unknown buffer type: " + type);
+}
+
+std::shared_ptr<SlabBackend> makeSlabBackend(BufferBackendType type,
+                                             const MappedSlabBackend::Options& options) {
+    if (type == BufferBackendType::MEMORY) {
+        return std::make_shared<DramSlabBackend>(options.memory_policy);
+    }
+
+    MappedSlabBackend::Options opts = options;
+    opts.mode = type == BufferBackendType::NVM ? MappedSlabBackend::Mode::NVM
+                                               : MappedSlabBackend::Mode::MMAP;
+    return std::make_shared<MappedSlabBackend>(opts);
+}
+
+} // namespace woved::storage
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "storage/pmem/pmem-store.h"
+#include "util/exceptions.h"
+#include "util/numa-aware.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::storage {
+
+// Memory backing one buffer slab
+struct SlabRegion {
+    std::byte* data = nullptr;
+    size_t capacity = 0;
+    uint32_t index = 0;       // Region slot within a persistent pool
+    uint32_t generation = 0;  // Changes whenever the region is (re)opened
+};
+
+// A region left open by a previous run, with the shard that owned it
+struct RecoveredRegion {
+    SlabRegion region;
+    uint32_t shard;
+    uint64_t open_seq;  // Allocation order within the pool
+};
+
+// Where MessageBuffer slabs live. The DRAM backend is plain aligned heap
+// memory; persistent backends keep regions in a mapped pool that can be
+// reopened in place after a restart.
+class SlabBackend {
+public:
+    virtual ~SlabBackend() = default;
+
+    // Open a region of at least `bytes` for `shard`
+    virtual SlabRegion allocate(size_t bytes, uint32_t shard) = 0;
+
+    // Discard a region and its contents
+    virtual void release(SlabRegion& region) = 0;
+
+    // Rewind a drained region in place; records written under the previous
+    // generation stop being valid
+    virtual void renew(SlabRegion& region) = 0;
+
+    // Make [addr, addr + len) durable (no-op for volatile backends)
+    virtual void persist(const void* addr, size_t len) = 0;
+
+    // persist() split in two: flush() starts writing ranges back, drain()
+    // waits for every earlier flush(). One drain covers a record's pieces.
+    virtual void flush(const void* addr, size_t len) { persist(addr, len); }
+    virtual void drain() {}
+
+    virtual bool persistent() const = 0;
+
+    // persist() also survives power loss, not only a process crash
+    virtual bool powerSafe() const { return false; }
+
+    // Regions still open from a previous run, by shard then allocation order
+    virtual std::vector<RecoveredRegion> recover() { return {}; }
+};
+
+// Volatile backend: 64-byte aligned heap allocations. Under a policy
+// other than Local (numa.memory_policy, interleave by default for the
+// buffer), slabs are page-aligned allocations placed by that policy, so
+// writers and flushers on every socket see the same average latency.
+class DramSlabBackend : public SlabBackend {
+public:
+    static constexpr size_t kAlignment = 64;
+
+    explicit DramSlabBackend(util::MemoryPolicy policy = util::MemoryPolicy::Local);
+
+    SlabRegion allocate(size_t bytes, uint32_t shard) override;
+    void release(SlabRegion& region) override;
+    void renew(SlabRegion& region) override { region.generation++; }
+    void persist(const void*, size_t) override {}
+    bool persistent() const override { return false; }
+
+private:
+    bool numa_;  // Slabs from util::numa_alloc()
+    util::MemoryPolicy policy_;
+};
+
+// Persistent backend over a mapped pool file split into fixed-size regions.
+//
+// File layout: a 4 KiB pool header (magic, version, geometry) followed by
+// `region_count` page-aligned regions, each a 64-byte region header
+// (state, owning shard, generation, allocation sequence) plus slab bytes.
+// Region headers are persisted before a region is handed out; records inside
+// are sealed by the slab once their bytes are durable, so reopening only
+// trusts records whose seal matches the region's generation.
+//
+// MMAP mode relies on the page cache (survives process crashes, synced on
+// close); NVM mode maps the pool through PmemStore, for DAX files on
+// Optane/CXL memory, and writes cache lines back on every persist (CLWB +
+// SFENCE; msync where the file is not DAX), so it also survives power loss.
+class MappedSlabBackend : public SlabBackend {
+public:
+    enum class Mode { MMAP, NVM };
+
+    struct Options {
+        std::string path;
+        Mode mode = Mode::MMAP;
+        size_t pool_bytes = 17179869184;  // 16 GiB
+        size_t slab_bytes = 4194304;      // Usable bytes per region
+        size_t dim = 768;
+        ElementType element_type = ElementType::FP32;
+        size_t shard_count = 16;
+        // Applied to the mapping (also DramSlabBackend's); honoured where the
+        // pool is shared memory, such as a file on tmpfs
+        util::MemoryPolicy memory_policy = util::MemoryPolicy::Local;
+
+        // storage.buffer geometry, collection dim and element type, and
+        // numa.memory_policy when numa.enabled
+        static Options fromConfig(const Config& config);
+    };
+
+    // Create the pool file, or reopen it if it exists with the same geometry
+    explicit MappedSlabBackend(const Options& options);
+    ~MappedSlabBackend() override;
+
+    MappedSlabBackend(const MappedSlabBackend&) = delete;
+    MappedSlabBackend& operator=(const MappedSlabBackend&) = delete;
+
+    SlabRegion allocate(size_t bytes, uint32_t shard) override;
+    void release(SlabRegion& region) override;
+    void renew(SlabRegion& region) override;
+    void persist(const void* addr, size_t len) override;
+    void flush(const void* addr, size_t len) override;
+    void drain() override;
+    bool persistent() const override { return true; }
+    bool powerSafe() const override { return options_.mode == Mode::NVM; }
+    std::vector<RecoveredRegion> recover() override;
+
+    // Flush the whole mapping (clean shutdown / checkpoints)
+    void sync();
+
+    size_t regionCount() const { return region_count_; }
+    size_t freeRegions() const;
+
+private:
+    struct PoolHeader;
+    struct RegionHeader;
+
+    Options options_;
+    std::unique_ptr<PmemStore> store_;
+    std::byte* base_ = nullptr;
+    size_t mapped_bytes_ = 0;
+    size_t region_bytes_ = 0;
+    size_t region_count_ = 0;
+
+    mutable std::mutex mutex_;
+    std::vector<uint32_t> free_list_;
+    uint64_t next_open_seq_ = 1;
+
+    RegionHeader* header(uint32_t index) const;
+    SlabRegion regionAt(uint32_t index) const;
+    void format();
+    void load();
+};
+
+enum class BufferBackendType { MEMORY, MMAP, NVM };
+
+// Parse BufferConfig::type ("memory", "mmap", "nvm")
+BufferBackendType parseBufferBackendType(const std::string& type);
+
+// Build the backend for a buffer; MEMORY returns a DramSlabBackend
+std::shared_ptr<SlabBackend> makeSlabBackend(BufferBackendType type,
+                                             const MappedSlabBackend::Options& options);
+
+} // namespace woved::storage
@@ -0,0 +1,1006 @@
+#include "latest-by-id.h"
+
+namespace woved::storage {
+
+LatestByIdMap::LatestByIdMap(size_t shard_count, size_t initial_capacity, bool index_ids)
+    : shard_mask_(std::bit_ceil(std::max<size_t>(1, shard_count)) - 1),
+      initial_capacity_(std::bit_ceil(std::max<size_t>(16, initial_capacity))),
+      index_ids_(index_ids) {
+    shards_ = std::make_unique<Shard[]>(shard_mask_ + 1);
+    for (size_t i = 0; i <= shard_mask_; ++i) {
+        shards_[i].table.store(new Table(initial_capacity_));
+    }
+    LOG_DEBUG("LatestByIdMap initialized with {} shards", shard_mask_ + 1);
+}
+
+LatestByIdMap::~LatestByIdMap() {
+    LOG_DEBUG("LatestByIdMap destroyed with {} entries", getStats().total_entries);
+}
+
+void LatestByIdMap::upsert(const VectorId& id, const VectorIdHash& id_hash,
+                           const VectorLocation& location) {
+    upsertImpl(id, id_hash, location, nullptr);
+}
+
+bool LatestByIdMap::upsertIfVersion(const VectorId& id, VectorIdHash id_hash,
+                                    const VectorLocation& location, uint64_t version) {
+    return upsertImpl(id, id_hash, location, &version);
+}
+
+bool LatestByIdMap::upsertImpl(const VectorId& id, VectorIdHash id_hash,
+                               const VectorLocation& location, const uint64_t* expected) {
+    Record rec = toRecord(id_hash, location, fingerprintOf(id));
+    if (!index_ids_ && !expected && updateCollision(id, rec)) {
+        return true;
+    }
+    
+    Shard& shard = shardFor(id_hash);
+    std::unique_ptr<Table> retired;
+    PutResult result;
+    
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (expected && shard.seq.load(std::memory_order_relaxed) != *expected) {
+            return false;
+        }
+        beginWrite(shard);
+        result = putIdLocked(shard, rec, retired);
+        endWrite(shard);
+    }
+    
+    if (retired) {
+        util::EpochDomain::global().synchronize();
+    }
+    
+    if (result == PutResult::STALE) {
+        return true;
+    }
+    if (result == PutResult::COLLIDED) {
+        putCollision(id, rec);
+        return true;
+    }
+    
+    if (rec.loc.type() == VectorLocation::SEGMENT && rec.loc.segment() != 0) {
+        trackMembers(rec.loc.segment(), &id_hash, 1);
+    }
+    
+    if (index_ids_ && result == PutResult::INSERTED && !id.empty()) {
+        std::unique_lock<std::shared_mutex> lock(id_mutex_);
+        id_to_hash_[id] = id_hash;
+    }
+    return true;
+}
+
+void LatestByIdMap::upsertBatch(std::span<const HashedLocation> updates) {
+    struct Pending {
+        Record rec;
+        const VectorId* id;
+    };
+    std::vector<Pending> pending;
+    pending.reserve(updates.size());
+    std::vector<const Pending*> collided;
+    for (const auto& update : updates) {
+        uint16_t fingerprint = update.id ? fingerprintOf(*update.id) : 0;
+        Record rec = toRecord(update.id_hash, update.location, fingerprint);
+        if (!index_ids_ && update.id && updateCollision(*update.id, rec)) {
+            continue;
+        }
+        pending.push_back({rec, update.id});
+    }
+    
+    // Stable, so the last update of a repeated hash is applied last
+    std::stable_sort(pending.begin(), pending.end(), [this](const Pending& a, const Pending& b) {
+        return shardIndex(a.rec.id_hash) < shardIndex(b.rec.id_hash);
+    });
+    
+    std::vector<std::unique_ptr<Table>> retired;
+    std::vector<const Pending*> inserted;
+    std::vector<std::pair<uint32_t, VectorIdHash>> segment_members;
+    
+    for (size_t i = 0; i < pending.size();) {
+        Shard& shard = shardFor(pending[i].rec.id_hash);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        beginWrite(shard);
+        
+        for (; i < pending.size() && &shardFor(pending[i].rec.id_hash) == &shard; ++i) {
+            const Record& rec = pending[i].rec;
+            std::unique_ptr<Table> old;
+            PutResult result = putIdLocked(shard, rec, old);
+            if (old) retired.push_back(std::move(old));
+            if (result == PutResult::STALE) continue;
+            if (result == PutResult::COLLIDED) {
+                collided.push_back(&pending[i]);
+                continue;
+            }
+            if (result == PutResult::INSERTED && pending[i].id) {
+                inserted.push_back(&pending[i]);
+            }
+            if (rec.loc.type() == VectorLocation::SEGMENT && rec.loc.segment() != 0) {
+                segment_members.emplace_back(rec.loc.segment(), rec.id_hash);
+            }
+        }
+        
+        endWrite(shard);
+    }
+    
+    if (!retired.empty()) {
+        util::EpochDomain::global().synchronize();
+        retired.clear();
+    }
+    
+    std::sort(segment_members.begin(), segment_members.end());
+    std::vector<VectorIdHash> group;
+    for (size_t i = 0; i < segment_members.size();) {
+        uint32_t ordinal = segment_members[i].first;
+        group.clear();
+        for (; i < segment_members.size() && segment_members[i].first == ordinal; ++i) {
+            group.push_back(segment_members[i].second);
+        }
+        trackMembers(ordinal, group.data(), group.size());
+    }
+    
+    for (const Pending* p : collided) {
+        putCollision(*p->id, p->rec);
+    }
+    
+    if (index_ids_ && !inserted.empty()) {
+        std::unique_lock<std::shared_mutex> lock(id_mutex_);
+        for (const Pending* p : inserted) {
+            id_to_hash_[*p->id] = p->rec.id_hash;
+        }
+    }
+}
+
+void LatestByIdMap::markDeleted(const VectorId& id, const VectorIdHash& id_hash,
+                                Timestamp timestamp, Epoch epoch) {
+    VectorLocation location;
+    location.type = VectorLocation::DELETED;
+    location.timestamp = timestamp;
+    location.epoch = epoch;
+    location.tombstone = true;
+    
+    upsert(id, id_hash, location);
+}
+
+std::optional<VectorLocation> LatestByIdMap::getLatest(const VectorId& id) const {
+    if (!index_ids_) {
+        if (auto rec = findCollision(id)) {
+            return toLocation(rec->loc);
+        }
+        auto rec = readRecord(util::hash_id(id));
+        uint16_t fingerprint = rec ? rec->loc.fingerprint() : 0;
+        if (!rec || (fingerprint != 0 && fingerprint != fingerprintOf(id))) {
+            return std::nullopt;
+        }
+        return toLocation(rec->loc);
+    }
+    
+    VectorIdHash hash;
+    {
+        std::shared_lock<std::shared_mutex> lock(id_mutex_);
+        auto hash_it = id_to_hash_.find(id);
+        if (hash_it == id_to_hash_.end()) {
+            return std::nullopt;
+        }
+        hash = hash_it->second;
+    }
+    
+    return getLatestByHash(hash);
+}
+
+std::optional<VectorLocation> LatestByIdMap::getLatest(const VectorUuid& uuid) const {
+    return getLatestByHash(util::hash_uuid(uuid));
+}
+
+std::optional<VectorLocation> LatestByIdMap::getLatestByHash(VectorIdHash id_hash) const {
+    auto rec = readRecord(id_hash);
+    if (!rec) {
+        return std::nullopt;
+    }
+    return toLocation(rec->loc);
+}
+
+std::optional<PackedLocation> LatestByIdMap::getPackedByHash(VectorIdHash id_hash) const {
+    auto rec = readRecord(id_hash);
+    if (!rec) {
+        return std::nullopt;
+    }
+    return rec->loc;
+}
+
+bool LatestByIdMap::exists(const VectorId& id) const {
+    auto location = getLatest(id);
+    return location.has_value() && !location->tombstone;
+}
+
+bool LatestByIdMap::exists(const VectorUuid& uuid) const {
+    return existsByHash(util::hash_uuid(uuid));
+}
+
+bool LatestByIdMap::existsByHash(VectorIdHash id_hash) const {
+    // No segment name resolution on this path
+    auto rec = readRecord(id_hash);
+    return rec.has_value() && !rec->loc.tombstone();
+}
+
+void LatestByIdMap::filterExisting(std::span<const VectorIdHash> hashes,
+                                   std::span<uint8_t> live) const {
+    if (live.size() < hashes.size()) {
+        throw util::InvalidArgumentException("filterExisting: output span too small");
+    }
+    
+    // One pin covers the batch; the per-hash pins below are no-ops
+    auto guard = util::EpochDomain::global().pin();
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        auto rec = readRecord(hashes[i]);
+        live[i] = rec.has_value() && !rec->loc.tombstone();
+    }
+}
+
+LatestByIdMap::VersionedRead LatestByIdMap::readVersioned(VectorIdHash id_hash) const {
+    VersionedRead read;
+    auto rec = readRecord(id_hash, &read.version);
+    if (rec) {
+        read.location = rec->loc;
+    }
+    return read;
+}
+
+bool LatestByIdMap::validateVersion(VectorIdHash id_hash, uint64_t version) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return shardFor(id_hash).seq.load(std::memory_order_relaxed) == version;
+}
+
+void LatestByIdMap::removeSegmentEntries(const std::string& segment_id) {
+    while (removeSegmentEntries(segment_id, kRemoveBatch) > 0) {}
+}
+
+size_t LatestByIdMap::removeSegmentEntries(const std::string& segment_id,
+                                           size_t max_entries) {
+    auto ordinal = segmentOrdinal(segment_id);
+    if (!ordinal) return 0;
+    
+    // Detach a batch from the tail of the membership list. The shared lock
+    // keeps the list from being erased under us.
+    std::vector<VectorIdHash> batch;
+    size_t remaining;
+    {
+        std::shared_lock<std::shared_mutex> lock(members_mutex_);
+        auto it = members_.find(*ordinal);
+        if (it == members_.end()) return 0;
+        SegmentMembers& members = *it->second;
+        
+        std::lock_guard<std::mutex> members_lock(members.mutex);
+        size_t take = std::min(std::max<size_t>(1, max_entries), members.hashes.size());
+        batch.assign(members.hashes.end() - take, members.hashes.end());
+        members.hashes.resize(members.hashes.size() - take);
+        remaining = members.hashes.size();
+    }
+    
+    if (collision_count_.load(std::memory_order_relaxed) > 0) {
+        std::unique_lock<std::shared_mutex> lock(collision_mutex_);
+        std::erase_if(collisions_, [&](const auto& kv) {
+            return kv.second.loc.type() == VectorLocation::SEGMENT &&
+                   kv.second.loc.segment() == *ordinal;
+        });
+        collision_count_ = collisions_.size();
+    }
+    
+    size_t removed = eraseMembers(*ordinal, batch);
+    if (index_ids_ && removed > 0) {
+        size_t orphaned = orphaned_ids_.fetch_add(removed) + removed;
+        if (orphaned * 2 > getStats().total_entries) {
+            sweepOrphanedIds();
+        }
+    }
+    
+    if (remaining == 0) {
+        // Exclusive: no writer holds the list, so it can go with its mutex
+        std::unique_lock<std::shared_mutex> lock(members_mutex_);
+        auto it = members_.find(*ordinal);
+        if (it != members_.end()) {
+            if (it->second->hashes.empty()) {
+                members_.erase(it);
+            } else {
+                remaining = it->second->hashes.size();  // Concurrent writes
+            }
+        }
+    }
+    return remaining;
+}
+
+void LatestByIdMap::moveToSegment(const std::vector<VectorId>& ids,
+                                  const std::string& segment_id,
+                                  Epoch epoch) {
+    std::vector<VectorIdHash> hashes;
+    if (!index_ids_) {
+        const uint32_t ordinal = internSegment(segment_id);
+        hashes.resize(ids.size());
+        util::hash_ids(ids, hashes);
+        size_t kept = 0;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            const auto& id = ids[i];
+            auto collided = findCollision(id);
+            if (!collided) {
+                hashes[kept++] = hashes[i];
+                continue;
+            }
+            collided->loc = PackedLocation::make(VectorLocation::SEGMENT, ordinal,
+                                                 collided->loc.localId(), epoch,
+                                                 collided->loc.tombstone(),
+                                                 collided->loc.fingerprint());
+            updateCollision(id, *collided);
+        }
+        hashes.resize(kept);
+    } else {
+        hashes.reserve(ids.size());
+        std::shared_lock<std::shared_mutex> lock(id_mutex_);
+        for (const auto& id : ids) {
+            auto hash_it = id_to_hash_.find(id);
+            if (hash_it != id_to_hash_.end()) {
+                hashes.push_back(hash_it->second);
+            }
+        }
+    }
+    
+    moveToSegment(std::span<const VectorIdHash>(hashes), segment_id, epoch);
+}
+
+void LatestByIdMap::moveToSegment(std::span<const VectorIdHash> ids,
+                                  const std::string& segment_id,
+                                  Epoch epoch) {
+    const uint32_t ordinal = internSegment(segment_id);
+    
+    // One lock acquisition per shard
+    std::vector<VectorIdHash> hashes(ids.begin(), ids.end());
+    std::sort(hashes.begin(), hashes.end(), [this](VectorIdHash a, VectorIdHash b) {
+        return shardIndex(a) < shardIndex(b);
+    });
+    
+    std::vector<VectorIdHash> moved;
+    moved.reserve(hashes.size());
+    for (size_t i = 0; i < hashes.size();) {
+        Shard& shard = shardFor(hashes[i]);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        beginWrite(shard);
+        
+        Table& table = *shard.table.load(std::memory_order_relaxed);
+        for (; i < hashes.size() && &shardFor(hashes[i]) == &shard; ++i) {
+            size_t slot = findSlot(table, hashes[i]);
+            if (slot > table.mask) continue;
+            
+            Record rec = table.records[slot];
+            account(shard, rec, false);
+            
+            // Update location
+            rec.loc = PackedLocation::make(VectorLocation::SEGMENT, ordinal,
+                                           rec.loc.localId(), epoch, rec.loc.tombstone(),
+                                           rec.loc.fingerprint());
+            
+            account(shard, rec, true);
+            storeRecord(table.records[slot], rec);
+            moved.push_back(hashes[i]);
+        }
+        
+        endWrite(shard);
+    }
+    
+    trackMembers(ordinal, moved.data(), moved.size());
+}
+
+LatestByIdMap::Stats LatestByIdMap::getStats() const {
+    Stats stats{};
+    for (size_t s = 0; s <= shard_mask_; ++s) {
+        const Shard& shard = shards_[s];
+        stats.total_entries += shard.size.load(std::memory_order_relaxed);
+        stats.buffer_entries += shard.buffer_count.load(std::memory_order_relaxed);
+        stats.segment_entries += shard.segment_count.load(std::memory_order_relaxed);
+        stats.tombstone_entries += shard.tombstone_count.load(std::memory_order_relaxed);
+    }
+    
+    if (collision_count_.load(std::memory_order_relaxed) > 0) {
+        std::shared_lock<std::shared_mutex> lock(collision_mutex_);
+        for (const auto& [id, rec] : collisions_) {
+            stats.total_entries++;
+            if (rec.loc.type() == VectorLocation::BUFFER) stats.buffer_entries++;
+            if (rec.loc.type() == VectorLocation::SEGMENT) stats.segment_entries++;
+            if (rec.loc.tombstone()) stats.tombstone_entries++;
+        }
+    }
+    
+    return stats;
+}
+
+void LatestByIdMap::clear() {
+    std::vector<std::unique_ptr<Table>> retired;
+    
+    for (size_t s = 0; s <= shard_mask_; ++s) {
+        Shard& shard = shards_[s];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        beginWrite(shard);
+        
+        retired.emplace_back(shard.table.exchange(new Table(initial_capacity_),
+                                                  std::memory_order_release));
+        shard.size = 0;
+        shard.buffer_count = 0;
+        shard.segment_count = 0;
+        shard.tombstone_count = 0;
+        
+        endWrite(shard);
+    }
+    
+    util::EpochDomain::global().synchronize();
+    retired.clear();
+    
+    {
+        std::unique_lock<std::shared_mutex> lock(members_mutex_);
+        members_.clear();
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(collision_mutex_);
+        collisions_.clear();
+        collision_count_ = 0;
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(id_mutex_);
+    id_to_hash_.clear();
+    orphaned_ids_ = 0;
+}
+
+void LatestByIdMap::rebuild(const std::vector<SegmentDescriptor>& segments,
+                            const SegmentRowReader& reader, size_t threads) {
+    // Clear existing entries
+    clear();
+    
+    std::vector<uint32_t> ordinals;
+    ordinals.reserve(segments.size());
+    for (const auto& seg : segments) {
+        ordinals.push_back(internSegment(seg.segment_id));
+    }
+    if (!reader || segments.empty()) {
+        return;
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    const size_t shard_count = shard_mask_ + 1;
+    threads = std::clamp<size_t>(threads, 1, segments.size());
+    
+    // Phase 1: each worker reads whole segments into its own partial map,
+    // bucketed by destination shard
+    std::vector<RebuildPartial> partials(threads);
+    std::atomic<size_t> next_segment{0};
+    runWorkers(threads, [&](size_t w) {
+        RebuildPartial& partial = partials[w];
+        partial.shards.resize(shard_count);
+        for (size_t i; (i = next_segment.fetch_add(1)) < segments.size();) {
+            LOG_DEBUG("Rebuilding latest_by_id from segment {}", segments[i].segment_id);
+            for (auto& row : reader(segments[i])) {
+                Record rec;
+                rec.id_hash = row.id_hash;
+                uint16_t fingerprint = row.id.empty() ? 0 : fingerprintOf(row.id);
+                rec.loc = PackedLocation::make(VectorLocation::SEGMENT, ordinals[i],
+                                               row.local_id, row.epoch, row.tombstone,
+                                               fingerprint);
+                partial.shards[shardIndex(row.id_hash)].push_back(rec);
+                if (index_ids_ && !row.id.empty()) {
+                    partial.ids.emplace_back(row.id_hash, std::move(row.id));
+                }
+            }
+        }
+    });
+    
+    // Phase 2: merge every worker's bucket for a shard into a fresh table
+    mergePartials(partials, threads);
+    
+    {
+        std::unique_lock<std::shared_mutex> lock(id_mutex_);
+        for (auto& partial : partials) {
+            for (auto& [hash, id] : partial.ids) {
+                id_to_hash_.emplace(std::move(id), hash);
+            }
+        }
+    }
+    
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    LOG_INFO("Rebuilt latest_by_id from {} segments with {} threads: {} entries in {} ms",
+             segments.size(), threads, getStats().total_entries, elapsed.count());
+}
+
+std::vector<LatestByIdMap::PackedEntry> LatestByIdMap::snapshot() const {
+    std::vector<PackedEntry> entries;
+    for (size_t s = 0; s <= shard_mask_; ++s) {
+        Shard& shard = shards_[s];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const Table& table = *shard.table.load(std::memory_order_relaxed);
+        entries.reserve(entries.size() + shard.size.load(std::memory_order_relaxed));
+        for (const Record& rec : table.records) {
+            if (rec.used()) entries.push_back({rec.id_hash, rec.loc});
+        }
+    }
+    return entries;
+}
+
+void LatestByIdMap::restore(std::span<const PackedEntry> entries, size_t threads) {
+    clear();
+    if (entries.empty()) return;
+    
+    auto start = std::chrono::steady_clock::now();
+    const size_t shard_count = shard_mask_ + 1;
+    threads = std::clamp<size_t>(threads, 1, (entries.size() + kRemoveBatch - 1) / kRemoveBatch);
+    
+    std::vector<RebuildPartial> partials(threads);
+    runWorkers(threads, [&](size_t w) {
+        RebuildPartial& partial = partials[w];
+        partial.shards.resize(shard_count);
+        size_t begin = entries.size() * w / threads;
+        size_t end = entries.size() * (w + 1) / threads;
+        for (size_t i = begin; i < end; ++i) {
+            if (!entries[i].loc.valid()) {
+                throw util::InvalidArgumentException("restore: invalid packed location");
+            }
+            partial.shards[shardIndex(entries[i].id_hash)].push_back(
+                {entries[i].id_hash, entries[i].loc});
+        }
+    });
+    mergePartials(partials, threads);
+    
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    LOG_INFO("Restored latest_by_id with {} threads: {} entries in {} ms",
+             threads, getStats().total_entries, elapsed.count());
+}
+
+void LatestByIdMap::runWorkers(size_t threads, const std::function<void(size_t)>& work) {
+    std::vector<std::exception_ptr> errors(threads);
+    auto guarded = [&](size_t w) {
+        try {
+            work(w);
+        } catch (...) {
+            errors[w] = std::current_exception();
+        }
+    };
+    
+    std::vector<std::thread> workers;
+    for (size_t w = 1; w < threads; ++w) {
+        workers.emplace_back(guarded, w);
+    }
+    guarded(0);
+    for (auto& worker : workers) worker.join();
+    
+    for (auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+void LatestByIdMap::mergePartials(const std::vector<RebuildPartial>& partials, size_t threads) {
+    const size_t shard_count = shard_mask_ + 1;
+    std::atomic<size_t> next_shard{0};
+    std::vector<std::vector<std::unique_ptr<Table>>> retired(threads);
+    runWorkers(threads, [&](size_t w) {
+        for (size_t s; (s = next_shard.fetch_add(1)) < shard_count;) {
+            retired[w].push_back(mergeShard(shards_[s], partials, s));
+        }
+    });
+    
+    // One grace period for every replaced table
+    util::EpochDomain::global().synchronize();
+}
+
+std::unique_ptr<LatestByIdMap::Table> LatestByIdMap::mergeShard(
+    Shard& shard, const std::vector<RebuildPartial>& partials, size_t s) {
+    size_t rows = 0;
+    for (const auto& partial : partials) {
+        rows += partial.shards[s].size();
+    }
+    
+    size_t capacity = initial_capacity_;
+    while (rows * kMaxLoadDen > capacity * kMaxLoadNum) capacity *= 2;
+    auto table = std::make_unique<Table>(capacity);
+    
+    size_t size = 0;
+    for (const auto& partial : partials) {
+        for (const Record& rec : partial.shards[s]) {
+            size_t slot = findSlot(*table, rec.id_hash);
+            if (slot > table->mask) {
+                size_t i = rec.id_hash & table->mask;
+                while (table->records[i].used()) i = (i + 1) & table->mask;
+                table->records[i] = rec;
+                ++size;
+                continue;
+            }
+            
+            const PackedLocation& cur = table->records[slot].loc;
+            if (rec.loc.epoch() > cur.epoch() ||
+                (rec.loc.epoch() == cur.epoch() && rec.loc.tombstone())) {
+                table->records[slot] = rec;
+            }
+        }
+    }
+    
+    // Segment membership and counters from the merged table
+    std::vector<std::pair<uint32_t, VectorIdHash>> members;
+    members.reserve(size);
+    std::unique_ptr<Table> retired;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        beginWrite(shard);
+        Table* merged = table.release();
+        retired.reset(shard.table.exchange(merged, std::memory_order_release));
+        shard.size = size;
+        shard.buffer_count = 0;
+        shard.segment_count = 0;
+        shard.tombstone_count = 0;
+        for (const Record& rec : merged->records) {
+            if (!rec.used()) continue;
+            account(shard, rec, true);
+            if (rec.loc.type() == VectorLocation::SEGMENT && rec.loc.segment() != 0) {
+                members.emplace_back(rec.loc.segment(), rec.id_hash);
+            }
+        }
+        endWrite(shard);
+    }
+    
+    std::sort(members.begin(), members.end());
+    std::vector<VectorIdHash> group;
+    for (size_t i = 0; i < members.size();) {
+        uint32_t ordinal = members[i].first;
+        group.clear();
+        for (; i < members.size() && members[i].first == ordinal; ++i) {
+            group.push_back(members[i].second);
+        }
+        trackMembers(ordinal, group.data(), group.size());
+    }
+    
+    // Freed by the caller after one grace period for all shards
+    return retired;
+}
+
+std::optional<LatestByIdMap::Record> LatestByIdMap::readRecord(VectorIdHash hash,
+                                                              uint64_t* version) const {
+    const Shard& shard = shardFor(hash);
+    auto guard = util::EpochDomain::global().pin();
+    
+    for (unsigned spins = 0;; ++spins) {
+        uint64_t before = shard.seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            // Writers hold a shard for a few stores; spin briefly first
+            if (spins >= 64) std::this_thread::yield();
+            continue;
+        }
+        
+        const Table* table = shard.table.load(std::memory_order_acquire);
+        std::optional<Record> found;
+        for (size_t i = hash & table->mask, probes = 0; probes <= table->mask;
+             i = (i + 1) & table->mask, ++probes) {
+            Record rec = loadRecord(table->records[i]);
+            if (!rec.used()) break;
+            if (rec.id_hash == hash) {
+                found = rec;
+                break;
+            }
+        }
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shard.seq.load(std::memory_order_relaxed) == before) {
+            if (version) *version = before;
+            return found;
+        }
+    }
+}
+
+void LatestByIdMap::beginWrite(Shard& shard) {
+    shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void LatestByIdMap::endWrite(Shard& shard) {
+    shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+LatestByIdMap::Record LatestByIdMap::loadRecord(const Record& rec) {
+    auto load = [](const uint64_t& word) {
+        return std::atomic_ref<uint64_t>(const_cast<uint64_t&>(word))
+            .load(std::memory_order_relaxed);
+    };
+    Record out;
+    out.id_hash = load(rec.id_hash);
+    out.loc.lo = load(rec.loc.lo);
+    out.loc.hi = load(rec.loc.hi);
+    return out;
+}
+
+void LatestByIdMap::storeRecord(Record& dst, const Record& src) {
+    auto store = [](uint64_t& word, uint64_t value) {
+        std::atomic_ref<uint64_t>(word).store(value, std::memory_order_relaxed);
+    };
+    store(dst.id_hash, src.id_hash);
+    store(dst.loc.lo, src.loc.lo);
+    store(dst.loc.hi, src.loc.hi);
+}
+
+size_t LatestByIdMap::findSlot(const Table& table, VectorIdHash hash) {
+    for (size_t i = hash & table.mask, probes = 0; probes <= table.mask;
+         i = (i + 1) & table.mask, ++probes) {
+        const Record& rec = table.records[i];
+        if (!rec.used()) break;
+        if (rec.id_hash == hash) return i;
+    }
+    return table.mask + 1;
+}
+
+void LatestByIdMap::eraseAt(Table& table, size_t index) {
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    size_t hole = index;
+    for (size_t j = (hole + 1) & table.mask;; j = (j + 1) & table.mask) {
+        const Record& rec = table.records[j];
+        if (!rec.used()) break;
+        
+        size_t home = rec.id_hash & table.mask;
+        bool movable = hole <= j ? (home <= hole || home > j)
+                                 : (home <= hole && home > j);
+        if (movable) {
+            storeRecord(table.records[hole], rec);
+            hole = j;
+        }
+    }
+    storeRecord(table.records[hole], Record{});
+}
+
+void LatestByIdMap::account(Shard& shard, const Record& rec, bool add) {
+    auto bump = [add](std::atomic<size_t>& counter) {
+        if (add) counter.fetch_add(1, std::memory_order_relaxed);
+        else counter.fetch_sub(1, std::memory_order_relaxed);
+    };
+    
+    auto type = rec.loc.type();
+    if (type == VectorLocation::BUFFER) bump(shard.buffer_count);
+    if (type == VectorLocation::SEGMENT) bump(shard.segment_count);
+    if (rec.loc.tombstone()) bump(shard.tombstone_count);
+}
+
+bool LatestByIdMap::putLocked(Shard& shard, const Record& rec,
+                              std::unique_ptr<Table>& retired) {
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    
+    size_t slot = findSlot(*table, rec.id_hash);
+    if (slot <= table->mask) {
+        // Update existing entry
+        account(shard, table->records[slot], false);
+        account(shard, rec, true);
+        storeRecord(table->records[slot], rec);
+        return false;
+    }
+    
+    size_t size = shard.size.load(std::memory_order_relaxed);
+    if ((size + 1) * kMaxLoadDen > (table->mask + 1) * kMaxLoadNum) {
+        // Grow into a private table, then publish it inside the write section
+        auto grown = std::make_unique<Table>((table->mask + 1) * 2);
+        for (const Record& old : table->records) {
+            if (!old.used()) continue;
+            size_t i = old.id_hash & grown->mask;
+            while (grown->records[i].used()) i = (i + 1) & grown->mask;
+            grown->records[i] = old;
+        }
+        retired.reset(table);
+        table = grown.release();
+        shard.table.store(table, std::memory_order_release);
+    }
+    
+    size_t i = rec.id_hash & table->mask;
+    while (table->records[i].used()) i = (i + 1) & table->mask;
+    storeRecord(table->records[i], rec);
+    
+    shard.size.fetch_add(1, std::memory_order_relaxed);
+    account(shard, rec, true);
+    return true;
+}
+
+void LatestByIdMap::trackMembers(uint32_t ordinal, const VectorIdHash* hashes,
+                                 size_t count) {
+    if (count == 0) return;
+    
+    // Appends hold members_mutex_ shared, so removeSegmentEntries() cannot
+    // erase the list they are writing to
+    {
+        std::shared_lock<std::shared_mutex> lock(members_mutex_);
+        auto it = members_.find(ordinal);
+        if (it != members_.end()) {
+            std::lock_guard<std::mutex> members_lock(it->second->mutex);
+            it->second->hashes.insert(it->second->hashes.end(), hashes, hashes + count);
+            return;
+        }
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(members_mutex_);
+    auto& slot = members_[ordinal];
+    if (!slot) slot = std::make_unique<SegmentMembers>();
+    slot->hashes.insert(slot->hashes.end(), hashes, hashes + count);
+}
+
+size_t LatestByIdMap::eraseMembers(uint32_t ordinal, std::vector<VectorIdHash>& hashes) {
+    std::sort(hashes.begin(), hashes.end(), [this](VectorIdHash a, VectorIdHash b) {
+        return shardIndex(a) < shardIndex(b);
+    });
+    
+    size_t removed = 0;
+    for (size_t i = 0; i < hashes.size();) {
+        Shard& shard = shardFor(hashes[i]);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        beginWrite(shard);
+        
+        Table& table = *shard.table.load(std::memory_order_relaxed);
+        for (; i < hashes.size() && &shardFor(hashes[i]) == &shard; ++i) {
+            size_t slot = findSlot(table, hashes[i]);
+            if (slot > table.mask) continue;
+            
+            // Skip members that have been rewritten since
+            const Record& rec = table.records[slot];
+            if (rec.loc.type() != VectorLocation::SEGMENT || rec.loc.segment() != ordinal) {
+                continue;
+            }
+            
+            account(shard, rec, false);
+            shard.size.fetch_sub(1, std::memory_order_relaxed);
+            eraseAt(table, slot);
+            ++removed;
+        }
+        
+        endWrite(shard);
+    }
+    return removed;
+}
+
+void LatestByIdMap::sweepOrphanedIds() {
+    // Amortized: runs once orphans outnumber half the live entries
+    std::unique_lock<std::shared_mutex> lock(id_mutex_);
+    std::erase_if(id_to_hash_, [this](const auto& kv) {
+        return !readRecord(kv.second).has_value();
+    });
+    orphaned_ids_ = 0;
+}
+
+LatestByIdMap::PutResult LatestByIdMap::putIdLocked(Shard& shard, const Record& rec,
+                                                     std::unique_ptr<Table>& retired) {
+    const Table& table = *shard.table.load(std::memory_order_relaxed);
+    size_t slot = findSlot(table, rec.id_hash);
+    if (slot <= table.mask) {
+        const PackedLocation& held = table.records[slot].loc;
+        if (!index_ids_) {
+            uint16_t mine = rec.loc.fingerprint();
+            if (held.fingerprint() != 0 && mine != 0 && held.fingerprint() != mine) {
+                return PutResult::COLLIDED;
+            }
+        }
+        // A write arriving after a later version of the id must not
+        // step it back
+        if (held.epoch() > rec.loc.epoch()) {
+            return PutResult::STALE;
+        }
+    }
+    return putLocked(shard, rec, retired) ? PutResult::INSERTED : PutResult::UPDATED;
+}
+
+uint16_t LatestByIdMap::fingerprintOf(const VectorId& id) const {
+    if (index_ids_ || id.empty()) return 0;
+    // 1..4095, so 0 keeps meaning "unknown"
+    return static_cast<uint16_t>(util::hash_id_secondary(id) % PackedLocation::kFingerprintMask) + 1;
+}
+
+std::optional<LatestByIdMap::Record> LatestByIdMap::findCollision(const VectorId& id) const {
+    if (collision_count_.load(std::memory_order_acquire) == 0) {
+        return std::nullopt;
+    }
+    std::shared_lock<std::shared_mutex> lock(collision_mutex_);
+    auto it = collisions_.find(id);
+    if (it == collisions_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void LatestByIdMap::putCollision(const VectorId& id, const Record& rec) {
+    LOG_WARN("Vector id hash collision on {:016x}; keeping {} in the side map", rec.id_hash, id);
+    std::unique_lock<std::shared_mutex> lock(collision_mutex_);
+    collisions_[id] = rec;
+    collision_count_.store(collisions_.size(), std::memory_order_release);
+}
+
+bool LatestByIdMap::updateCollision(const VectorId& id, const Record& rec) {
+    if (collision_count_.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    std::unique_lock<std::shared_mutex> lock(collision_mutex_);
+    auto it = collisions_.find(id);
+    if (it == collisions_.end()) {
+        return false;
+    }
+    if (it->second.loc.epoch() <= rec.loc.epoch()) {
+        it->second = rec;
+    }
+    return true;
+}
+
+LatestByIdMap::Record LatestByIdMap::toRecord(VectorIdHash hash,
+                                              const VectorLocation& location,
+                                              uint16_t fingerprint) {
+    uint32_t ordinal = location.segment_ordinal;
+    if (ordinal == 0 && !location.segment_id.empty()) {
+        ordinal = internSegment(location.segment_id);
+    }
+    if (location.epoch > PackedLocation::kEpochMask) {
+        throw util::InvalidArgumentException("epoch exceeds 48 bits");
+    }
+    
+    Record rec;
+    rec.id_hash = hash;
+    rec.loc = PackedLocation::make(location.type, ordinal, location.local_id,
+                                   location.epoch, location.tombstone, fingerprint);
+    return rec;
+}
+
+VectorLocation LatestByIdMap::toLocation(const PackedLocation& loc) const {
+    VectorLocation location;
+    location.type = loc.type();
+    location.segment_ordinal = loc.segment();
+    location.local_id = loc.localId();
+    location.timestamp = Timestamp(0);
+    location.epoch = loc.epoch();
+    location.tombstone = loc.tombstone();
+    
+    if (loc.segment() != 0) {
+        location.segment_id = segmentName(loc.segment());
+    }
+    return location;
+}
+
+void LatestByIdMap::registerSegment(uint32_t ordinal, const std::string& segment_id) {
+    if (ordinal == 0) {
+        throw util::InvalidArgumentException("segment ordinal 0 is reserved");
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(segment_mutex_);
+    if (ordinal < segment_names_.size() && !segment_names_[ordinal].empty()) {
+        if (segment_names_[ordinal] != segment_id) {
+            throw util::InvalidArgumentException(
+                "segment ordinal " + std::to_string(ordinal) + " already bound");
+        }
+        return;
+    }
+    
+    if (ordinal >= segment_names_.size()) {
+        segment_names_.resize(ordinal + 1);
+    }
+    segment_names_[ordinal] = segment_id;
+    segment_ordinals_[segment_id] = ordinal;
+}
+
+std::optional<uint32_t> LatestByIdMap::segmentOrdinal(const std::string& segment_id) const {
+    std::shared_lock<std::shared_mutex> lock(segment_mutex_);
+    auto it = segment_ordinals_.find(segment_id);
+    if (it == segment_ordinals_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::string LatestByIdMap::segmentName(uint32_t ordinal) const {
+    std::shared_lock<std::shared_mutex> lock(segment_mutex_);
+    return ordinal < segment_names_.size() ? segment_names_[ordinal] : std::string();
+}
+
+uint32_t LatestByIdMap::internSegment(const std::string& segment_id) {
+    if (auto ordinal = segmentOrdinal(segment_id)) {
+        return *ordinal;
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(segment_mutex_);
+    auto [it, inserted] = segment_ordinals_.try_emplace(
+        segment_id, static_cast<uint32_t>(segment_names_.size()));
+    if (inserted) {
+        segment_names_.push_back(segment_id);
+    }
+    return it->second;
+}
+
+} // namespace woved::storage
@@ -2,10 +2,25 @@
 #pragma once
 
 #include "include/woved/types.h"
+#include "util/epoch-reclaim.h"
+#include "util/exceptions.h"
+#include "util/hash.h"
+#include "util/logging.h"
 #include <unordered_map>
 #include <shared_mutex>
 #include <atomic>
 #include <optional>
+#include <span>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <thread>
 
 namespace woved::storage {
 
@@ -19,41 +34,147 @@ struct VectorLocation {
     
     LocationType type;
     std::string segment_id;  // Empty if in buffer
+    uint32_t segment_ordinal = 0;  // Manifest ordinal (0 = resolve segment_id)
     uint32_t local_id;        // Local ID within segment
-    Timestamp timestamp;
+    Timestamp timestamp;      // Not retained by LatestByIdMap; epochs order versions
     Epoch epoch;
     bool tombstone = false;
 };
 
-// Thread-safe latest-by-id map for deduplication and version tracking
+// Packed 16-byte form of a location as LatestByIdMap stores it: segment
+// ordinal, local id, 48-bit epoch and flag bits. Segment names are resolved
+// through the map's ordinal table only when a full VectorLocation is needed.
+struct PackedLocation {
+    static constexpr uint64_t kEpochMask = (1ULL << 48) - 1;
+    static constexpr uint16_t kTypeMask = 0x3;
+    static constexpr uint16_t kTombstone = 1u << 2;
+    static constexpr unsigned kFingerprintShift = 3;  // Bits 3..14
+    static constexpr uint16_t kFingerprintMask = 0xfff;
+    static constexpr uint16_t kValid = 1u << 15;
+    
+    uint64_t lo = 0;  // segment ordinal | local_id << 32
+    uint64_t hi = 0;  // epoch | flags << 48
+    
+    static PackedLocation make(VectorLocation::LocationType type, uint32_t segment,
+                               uint32_t local_id, Epoch epoch, bool tombstone,
+                               uint16_t fingerprint = 0) {
+        uint64_t flags = kValid | (static_cast<uint16_t>(type) & kTypeMask) |
+                         (tombstone ? kTombstone : 0) |
+                         ((fingerprint & kFingerprintMask) << kFingerprintShift);
+        return {uint64_t{segment} | (uint64_t{local_id} << 32),
+                (epoch & kEpochMask) | (flags << 48)};
+    }
+    
+    uint32_t segment() const { return static_cast<uint32_t>(lo); }
+    uint32_t localId() const { return static_cast<uint32_t>(lo >> 32); }
+    Epoch epoch() const { return hi & kEpochMask; }
+    uint16_t flags() const { return static_cast<uint16_t>(hi >> 48); }
+    VectorLocation::LocationType type() const {
+        return static_cast<VectorLocation::LocationType>(flags() & kTypeMask);
+    }
+    bool tombstone() const { return flags() & kTombstone; }
+    bool valid() const { return flags() & kValid; }
+    
+    // Secondary id hash bits kept when the map has no id index (0 = unknown)
+    uint16_t fingerprint() const { return (flags() >> kFingerprintShift) & kFingerprintMask; }
+};
+static_assert(sizeof(PackedLocation) == 16, "PackedLocation must stay 16 bytes");
+
+// Thread-safe latest-by-id map for deduplication and version tracking.
+//
+// Entries live in sharded open-addressing tables keyed by VectorIdHash
+// (linear probing, backward-shift deletion). Writers take their shard's
+// mutex; readers never lock: they copy the record and validate it against
+// the shard's sequence counter, retrying if a writer overlapped. Tables
+// replaced by growth are freed after an epoch grace period. Segment names
+// map to ordinals, so each entry is a 24-byte record (hash + PackedLocation).
+//
+// Each segment ordinal also keeps a membership list of the hashes written
+// with that segment, so retiring a segment touches only its own entries.
+// Lists are append-only; entries that have since moved are filtered against
+// the table when the segment is removed.
+//
+// With index_ids off there is no VectorId -> hash index: id lookups hash
+// the string with util::hash_id() and check a 12-bit secondary fingerprint
+// kept in the entry. An id whose hash collides with a different id's entry
+// is held, by string, in a small side map. rebuild() and restore() assume
+// their inputs have no such collisions.
 class LatestByIdMap {
 public:
-    LatestByIdMap();
+    explicit LatestByIdMap(size_t shard_count = 64, size_t initial_capacity = 1024,
+                           bool index_ids = true);
     ~LatestByIdMap();
     
-    // Update location for a vector ID
-    void upsert(const VectorId& id, const VectorIdHash& id_hash, 
+    LatestByIdMap(const LatestByIdMap&) = delete;
+    LatestByIdMap& operator=(const LatestByIdMap&) = delete;
+    
+    // Update location for a vector ID. Later epochs win: a location older
+    // than the one held (a write that arrived late) is dropped, and an
+    // equal epoch overwrites.
+    void upsert(const VectorId& id, const VectorIdHash& id_hash,
                 const VectorLocation& location);
     
+    // Batched upsert keyed by hash. Updates are grouped by shard and applied
+    // with one lock acquisition per shard. Epochs order updates as in
+    // upsert(); for repeated hashes of one epoch the last one wins. `id`
+    // (optional) registers new keys in the id index.
+    struct HashedLocation {
+        VectorIdHash id_hash;
+        VectorLocation location;
+        const VectorId* id = nullptr;
+    };
+    void upsertBatch(std::span<const HashedLocation> updates);
+    
     // Mark as deleted (tombstone)
     void markDeleted(const VectorId& id, const VectorIdHash& id_hash,
                      Timestamp timestamp, Epoch epoch);
     
-    // Get latest location for an ID
+    // Get latest location for an ID (lock-free by hash). Binary ids are not
+    // kept in the id index; they resolve through util::hash_uuid().
     std::optional<VectorLocation> getLatest(const VectorId& id) const;
+    std::optional<VectorLocation> getLatest(const VectorUuid& uuid) const;
     std::optional<VectorLocation> getLatestByHash(VectorIdHash id_hash) const;
     
+    // Packed location without segment name resolution
+    std::optional<PackedLocation> getPackedByHash(VectorIdHash id_hash) const;
+    
     // Check if ID exists and is not deleted
     bool exists(const VectorId& id) const;
+    bool exists(const VectorUuid& uuid) const;
     bool existsByHash(VectorIdHash id_hash) const;
     
+    // Batch form for result merging: live[i] = existsByHash(hashes[i])
+    void filterExisting(std::span<const VectorIdHash> hashes, std::span<uint8_t> live) const;
+    
+    // Optimistic reads. The version is the sequence of the entry's shard at
+    // read time; it stays valid until a writer touches that shard, so a
+    // caller can validate a read or make a conditional write without
+    // holding anything in between.
+    struct VersionedRead {
+        std::optional<PackedLocation> location;
+        uint64_t version;
+    };
+    VersionedRead readVersioned(VectorIdHash id_hash) const;
+    bool validateVersion(VectorIdHash id_hash, uint64_t version) const;
+    
+    // upsert() that applies only if the shard is still at `version`
+    bool upsertIfVersion(const VectorId& id, VectorIdHash id_hash,
+                         const VectorLocation& location, uint64_t version);
+    
     // Remove entries for a segment (after compaction)
     void removeSegmentEntries(const std::string& segment_id);
     
+    // Incremental form: process at most max_entries members, taking only
+    // shard locks; returns how many remain
+    size_t removeSegmentEntries(const std::string& segment_id, size_t max_entries);
+    
     // Move entries from buffer to segment (after flush)
     void moveToSegment(const std::vector<VectorId>& ids,
                        const std::string& segment_id,
                        Epoch epoch);
+    void moveToSegment(std::span<const VectorIdHash> hashes,
+                       const std::string& segment_id,
+                       Epoch epoch);
     
     // Get statistics
     struct Stats {
@@ -64,226 +185,165 @@ public:
     };
     Stats getStats() const;
     
+    // Bind a manifest segment ordinal to its name. Names first seen through
+    // VectorLocation::segment_id are assigned the next free ordinal.
+    void registerSegment(uint32_t ordinal, const std::string& segment_id);
+    std::optional<uint32_t> segmentOrdinal(const std::string& segment_id) const;
+    std::string segmentName(uint32_t ordinal) const;
+    
     // Clear all entries (for testing/recovery)
     void clear();
     
-    // Rebuild from segments (recovery)
-    void rebuild(const std::vector<SegmentDescriptor>& segments);
+    // Raw entries for checkpointing; unordered, consistent per shard
+    struct PackedEntry {
+        VectorIdHash id_hash;
+        PackedLocation loc;
+    };
+    std::vector<PackedEntry> snapshot() const;
     
-private:
-    // Internal entry structure
-    struct Entry {
-        VectorId id;
+    // Replace the contents with checkpointed entries (segment ordinals must
+    // already be registered); repeated hashes resolve like rebuild()
+    void restore(std::span<const PackedEntry> entries, size_t threads = 1);
+    
+    // One row of a segment's id/epoch row table
+    struct SegmentRow {
         VectorIdHash id_hash;
-        VectorLocation location;
-        std::atomic<uint64_t> version;  // For optimistic concurrency
+        uint32_t local_id;
+        Epoch epoch;
+        bool tombstone = false;
+        VectorId id;  // Optional; registers the id index when set
     };
     
-    // Primary map: ID hash -> Entry
-    mutable std::shared_mutex map_mutex_;
-    std::unordered_map<VectorIdHash, std::unique_ptr<Entry>> id_map_;
+    // Reads a segment's row table; called concurrently from rebuild workers
+    using SegmentRowReader = std::function<std::vector<SegmentRow>(const SegmentDescriptor&)>;
+    
+    // Rebuild from segments (recovery). Row tables are read by `threads`
+    // workers into per-worker partial maps, which are merged shard by shard
+    // in parallel: the newest epoch wins, a tombstone wins a tie. Without a
+    // reader only the segment ordinals are registered.
+    void rebuild(const std::vector<SegmentDescriptor>& segments,
+                 const SegmentRowReader& reader = {}, size_t threads = 1);
+
+private:
+    // Table record: three 64-bit words so readers can copy it with relaxed
+    // atomic loads while a writer may be rewriting it. Empty slots have an
+    // invalid location.
+    struct Record {
+        VectorIdHash id_hash = 0;
+        PackedLocation loc;
+        
+        bool used() const { return loc.valid(); }
+    };
+    
+    static constexpr size_t kMaxLoadNum = 3;  // Grow past 3/4 full
+    static constexpr size_t kMaxLoadDen = 4;
+    
+    struct Table {
+        explicit Table(size_t capacity) : mask(capacity - 1), records(capacity) {}
+        size_t mask;
+        std::vector<Record> records;
+    };
+    
+    struct alignas(64) Shard {
+        std::mutex mutex;                 // Writers only
+        std::atomic<uint64_t> seq{0};     // Odd while a writer is mid-update
+        std::atomic<Table*> table{nullptr};
+        std::atomic<size_t> size{0};
+        std::atomic<size_t> buffer_count{0};
+        std::atomic<size_t> segment_count{0};
+        std::atomic<size_t> tombstone_count{0};
+        
+        ~Shard() { delete table.load(); }
+    };
+    
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_mask_;
+    size_t initial_capacity_;
     
     // Secondary index: ID string -> hash (for exact lookups)
+    bool index_ids_;
+    mutable std::shared_mutex id_mutex_;
     std::unordered_map<VectorId, VectorIdHash> id_to_hash_;
     
-    // Statistics counters
-    std::atomic<size_t> buffer_count_{0};
-    std::atomic<size_t> segment_count_{0};
-    std::atomic<size_t> tombstone_count_{0};
+    // Without the id index: ids whose hash collides with another id's entry
+    mutable std::shared_mutex collision_mutex_;
+    std::unordered_map<VectorId, Record> collisions_;
+    std::atomic<size_t> collision_count_{0};
     
-    // Version counter for optimistic concurrency
-    std::atomic<uint64_t> global_version_{0};
+    // Segment names by ordinal; ordinal 0 means "no segment"
+    mutable std::shared_mutex segment_mutex_;
+    std::vector<std::string> segment_names_{""};
+    std::unordered_map<std::string, uint32_t> segment_ordinals_;
     
-    // Helper to update an entry
-    void updateEntry(Entry* entry, const VectorLocation& location);
-};
-
-// Implementation
-LatestByIdMap::LatestByIdMap() {
-    LOG_DEBUG("LatestByIdMap initialized");
-}
-
-LatestByIdMap::~LatestByIdMap() {
-    LOG_DEBUG("LatestByIdMap destroyed with {} entries", id_map_.size());
-}
-
-void LatestByIdMap::upsert(const VectorId& id, const VectorIdHash& id_hash,
-                           const VectorLocation& location) {
-    std::unique_lock<std::shared_mutex> lock(map_mutex_);
-    
-    auto it = id_map_.find(id_hash);
-    if (it != id_map_.end()) {
-        // Update existing entry
-        auto& entry = it->second;
-        
-        // Update counters
-        if (entry->location.type == VectorLocation::BUFFER) buffer_count_--;
-        if (entry->location.type == VectorLocation::SEGMENT) segment_count_--;
-        if (entry->location.tombstone) tombstone_count_--;
-        
-        updateEntry(entry.get(), location);
-    } else {
-    void LatestByIdMap::upsert(const VectorId& id, const VectorIdHash& id_hash,
-                           const VectorLocation& location) {
-    std::unique_lock<std::shared_mutex> lock(map_mutex_);
-    
-    auto it = id_map_.find(id_hash);
-    if (it != id_map_.end()) {
-        // Update existing entry
-        auto& entry = it->second;
-        
-        // Update counters
-        if (entry->location.type == VectorLocation::BUFFER) buffer_count_--;
-        if (entry->location.type == VectorLocation::SEGMENT) segment_count_--;
-        if (entry->location.tombstone) tombstone_count_--;
-        
-        updateEntry(entry.get(), location);
-    } else {
-        // Create new entry
-        auto entry = std::make_unique<Entry>();
-        entry->id = id;
-        entry->id_hash = id_hash;
-        entry->location = location;
-        entry->version = global_version_.fetch_add(1);
-        
-        id_map_[id_hash] = std::move(entry);
-        id_to_hash_[id] = id_hash;
-    }
+    // Per-segment reverse index: hashes written with each segment ordinal.
+    // A list is used under members_mutex_ held shared plus its own mutex,
+    // and erased only with members_mutex_ held exclusive.
+    struct SegmentMembers {
+        std::mutex mutex;
+        std::vector<VectorIdHash> hashes;
+    };
+    static constexpr size_t kRemoveBatch = 4096;
+    mutable std::shared_mutex members_mutex_;
+    std::unordered_map<uint32_t, std::unique_ptr<SegmentMembers>> members_;
     
-    // Update counters for new location
-    if (location.type == VectorLocation::BUFFER) buffer_count_++;
-    if (location.type == VectorLocation::SEGMENT) segment_count_++;
-    if (location.tombstone) tombstone_count_++;
-}
-
-void LatestByIdMap::markDeleted(const VectorId& id, const VectorIdHash& id_hash,
-                                Timestamp timestamp, Epoch epoch) {
-    VectorLocation location;
-    location.type = VectorLocation::DELETED;
-    location.timestamp = timestamp;
-    location.epoch = epoch;
-    location.tombstone = true;
-    
-    upsert(id, id_hash, location);
-}
-
-std::optional<VectorLocation> LatestByIdMap::getLatest(const VectorId& id) const {
-    std::shared_lock<std::shared_mutex> lock(map_mutex_);
+    // id_to_hash_ entries whose hash was removed; swept once they dominate
+    std::atomic<size_t> orphaned_ids_{0};
     
-    auto hash_it = id_to_hash_.find(id);
-    if (hash_it == id_to_hash_.end()) {
-        return std::nullopt;
+    size_t shardIndex(VectorIdHash hash) const {
+        // High bits pick the shard, low bits the slot
+        return (hash >> 48) & shard_mask_;
     }
+    Shard& shardFor(VectorIdHash hash) const { return shards_[shardIndex(hash)]; }
     
-    return getLatestByHash(hash_it->second);
-}
-
-std::optional<VectorLocation> LatestByIdMap::getLatestByHash(VectorIdHash id_hash) const {
-    std::shared_lock<std::shared_mutex> lock(map_mutex_);
+    // Lock-free probe of the shard's current table; `version` receives the
+    // shard sequence the read was validated against
+    std::optional<Record> readRecord(VectorIdHash hash, uint64_t* version = nullptr) const;
     
-    auto it = id_map_.find(id_hash);
-    if (it != id_map_.end()) {
-        return it->second->location;
-    }
+    bool upsertImpl(const VectorId& id, VectorIdHash id_hash,
+                    const VectorLocation& location, const uint64_t* expected);
     
-    return std::nullopt;
-}
-
-bool LatestByIdMap::exists(const VectorId& id) const {
-    auto location = getLatest(id);
-    return location.has_value() && !location->tombstone;
-}
-
-bool LatestByIdMap::existsByHash(VectorIdHash id_hash) const {
-    auto location = getLatestByHash(id_hash);
-    return location.has_value() && !location->tombstone;
-}
-
-void LatestByIdMap::removeSegmentEntries(const std::string& segment_id) {
-    std::unique_lock<std::shared_mutex> lock(map_mutex_);
-    
-    for (auto it = id_map_.begin(); it != id_map_.end(); ) {
-        if (it->second->location.type == VectorLocation::SEGMENT &&
-            it->second->location.segment_id == segment_id) {
-            
-            id_to_hash_.erase(it->second->id);
-            segment_count_--;
-            if (it->second->location.tombstone) tombstone_count_--;
-            
-            it = id_map_.erase(it);
-        } else {
-            ++it;
-        }
-    }
-}
-
-void LatestByIdMap::moveToSegment(const std::vector<VectorId>& ids,
-                                  const std::string& segment_id,
-                                  Epoch epoch) {
-    std::unique_lock<std::shared_mutex> lock(map_mutex_);
-    
-    for (const auto& id : ids) {
-        auto hash_it = id_to_hash_.find(id);
-        if (hash_it != id_to_hash_.end()) {
-            auto entry_it = id_map_.find(hash_it->second);
-            if (entry_it != id_map_.end()) {
-                auto& entry = entry_it->second;
-                
-                // Update counters
-                if (entry->location.type == VectorLocation::BUFFER) {
-                    buffer_count_--;
-                    segment_count_++;
-                }
-                
-                // Update location
-                entry->location.type = VectorLocation::SEGMENT;
-                entry->location.segment_id = segment_id;
-                entry->location.epoch = epoch;
-                entry->version = global_version_.fetch_add(1);
-            }
-        }
-    }
-}
-
-LatestByIdMap::Stats LatestByIdMap::getStats() const {
-    std::shared_lock<std::shared_mutex> lock(map_mutex_);
+    // Writer-side helpers (shard mutex held, inside a write section)
+    static void beginWrite(Shard& shard);
+    static void endWrite(Shard& shard);
+    static Record loadRecord(const Record& rec);
+    static void storeRecord(Record& dst, const Record& src);
+    static size_t findSlot(const Table& table, VectorIdHash hash);
+    static void eraseAt(Table& table, size_t index);
+    static void account(Shard& shard, const Record& rec, bool add);
     
-    Stats stats;
-    stats.total_entries = id_map_.size();
-    stats.buffer_entries = buffer_count_.load();
-    stats.segment_entries = segment_count_.load();
-    stats.tombstone_entries = tombstone_count_.load();
+    // Insert or overwrite; returns true for a new key. A table replaced by
+    // growth is handed back in `retired` to be freed after a grace period.
+    bool putLocked(Shard& shard, const Record& rec, std::unique_ptr<Table>& retired);
     
-    return stats;
-}
-
-void LatestByIdMap::clear() {
-    std::unique_lock<std::shared_mutex> lock(map_mutex_);
-    
-    id_map_.clear();
-    id_to_hash_.clear();
-    buffer_count_ = 0;
-    segment_count_ = 0;
-    tombstone_count_ = 0;
-}
-
-void LatestByIdMap::rebuild(const std::vector<SegmentDescriptor>& segments) {
-    std::unique_lock<std::shared_mutex> lock(map_mutex_);
+    // putLocked() for upserts: COLLIDED (nothing written) if the slot holds
+    // a different id's fingerprint, STALE (nothing written) if it holds a
+    // later epoch of the id
+    enum class PutResult { INSERTED, UPDATED, COLLIDED, STALE };
+    PutResult putIdLocked(Shard& shard, const Record& rec, std::unique_ptr<Table>& retired);
     
-    // Clear existing entries
-    clear();
+    uint16_t fingerprintOf(const VectorId& id) const;
+    std::optional<Record> findCollision(const VectorId& id) const;
+    void putCollision(const VectorId& id, const Record& rec);
+    bool updateCollision(const VectorId& id, const Record& rec);
     
-    // Rebuild from segments (would scan segment headers in production)
-    for (const auto& seg : segments) {
-        LOG_DEBUG("Rebuilding latest_by_id from segment {}", seg.segment_id);
-        // In production, would scan segment's row table to get all IDs
-        // and their timestamps, keeping only the latest for each ID
-    }
-}
-
-void LatestByIdMap::updateEntry(Entry* entry, const VectorLocation& location) {
-    entry->location = location;
-    entry->version = global_version_.fetch_add(1);
-}
+    void trackMembers(uint32_t ordinal, const VectorIdHash* hashes, size_t count);
+    size_t eraseMembers(uint32_t ordinal, std::vector<VectorIdHash>& hashes);
+    void sweepOrphanedIds();
+    
+    // Per-worker rebuild output, bucketed by shard
+    struct RebuildPartial {
+        std::vector<std::vector<Record>> shards;
+        std::vector<std::pair<VectorIdHash, VectorId>> ids;
+    };
+    static void runWorkers(size_t threads, const std::function<void(size_t)>& work);
+    void mergePartials(const std::vector<RebuildPartial>& partials, size_t threads);
+    std::unique_ptr<Table> mergeShard(Shard& shard, const std::vector<RebuildPartial>& partials,
+                                      size_t s);
+    
+    Record toRecord(VectorIdHash hash, const VectorLocation& location,
+                    uint16_t fingerprint = 0);
+    VectorLocation toLocation(const PackedLocation& loc) const;
+    uint32_t internSegment(const std::string& segment_id);
+};
 
-} // namespace woved::storage
\ No newline at end of file
+} // namespace woved::storage
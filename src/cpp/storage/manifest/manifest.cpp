@@ -0,0 +1,537 @@
+#include "manifest.h"
+#include "core/config.h"
+#include "core/metrics.h"
+#include "util/crc32c.h"
+#include "util/exceptions.h"
+#include "util/file-io.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t kFrameHeader = 8;                 // Length, CRC32C
+constexpr uint32_t kMaxRecord = 1u << 30;
+
+// Record fields
+enum Tag : uint8_t {
+    kSnapshot = 1,       // Sequence; resets the version
+    kAddSegment = 2,
+    kRetireSegment = 3,
+    kCentroids = 4,
+    kFlushedEpoch = 5,
+    kNextOrdinal = 6,
+};
+
+// Length, CRC32C, payload
+std::vector<std::byte> frame(std::span<const std::byte> payload) {
+    std::vector<std::byte> out(kFrameHeader + payload.size());
+    const uint32_t len = static_cast<uint32_t>(payload.size());
+    const uint32_t crc = util::crc32c(payload.data(), payload.size());
+    std::memcpy(out.data(), &len, 4);
+    std::memcpy(out.data() + 4, &crc, 4);
+    std::memcpy(out.data() + kFrameHeader, payload.data(), payload.size());
+    return out;
+}
+
+std::vector<std::byte> readFile(const std::string& path) {
+    std::vector<std::byte> data;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw util::IOException("open " + path + ": " + std::strerror(errno));
+    std::byte chunk[65536];
+    for (;;) {
+        ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            int err = errno;
+            ::close(fd);
+            throw util::IOException("read " + path + ": " + std::strerror(err));
+        }
+        if (n == 0) break;
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    ::close(fd);
+    return data;
+}
+
+// Little-endian field writer and reader
+class Writer {
+public:
+    explicit Writer(std::vector<std::byte>& out) : out_(out) {}
+
+    template <typename T>
+    void put(T value) {
+        const auto* p = reinterpret_cast<const std::byte*>(&value);
+        out_.insert(out_.end(), p, p + sizeof(T));
+    }
+    void put(const std::string& s) {
+        put(static_cast<uint32_t>(s.size()));
+        const auto* p = reinterpret_cast<const std::byte*>(s.data());
+        out_.insert(out_.end(), p, p + s.size());
+    }
+
+private:
+    std::vector<std::byte>& out_;
+};
+
+class Reader {
+public:
+    explicit Reader(std::span<const std::byte> in) : in_(in) {}
+
+    bool done() const { return pos_ == in_.size(); }
+
+    template <typename T>
+    T get() {
+        need(sizeof(T));
+        T value;
+        std::memcpy(&value, in_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return value;
+    }
+    std::string getString() {
+        const uint32_t len = get<uint32_t>();
+        need(len);
+        std::string s(reinterpret_cast<const char*>(in_.data() + pos_), len);
+        pos_ += len;
+        return s;
+    }
+
+private:
+    std::span<const std::byte> in_;
+    size_t pos_ = 0;
+
+    void need(size_t len) const {
+        if (in_.size() - pos_ < len) throw util::IOException("manifest record truncated");
+    }
+};
+
+} // namespace
+
+struct Manifest::Record {
+    bool snapshot = false;
+    uint64_t sequence = 0;  // Snapshot only
+    std::vector<ManifestSegment> added;
+    std::vector<uint32_t> retired;
+    std::optional<uint64_t> centroid_epoch;
+    std::string centroid_path;
+    std::optional<Epoch> flushed_epoch;
+    uint32_t next_ordinal = 0;  // 0: past the last segment added
+};
+
+std::shared_ptr<const ManifestSegment> ManifestVersion::find(uint32_t ordinal) const {
+    auto it = std::lower_bound(segments.begin(), segments.end(), ordinal,
+                               [](const auto& s, uint32_t o) { return s->ordinal < o; });
+    return it != segments.end() && (*it)->ordinal == ordinal ? *it : nullptr;
+}
+
+Manifest::Options Manifest::Options::fromConfig(const StorageConfig& storage) {
+    Options options;
+    options.dir = storage.data_dir + "/manifest";
+    options.snapshot_edits = storage.manifest.snapshot_edits;
+    options.snapshot_bytes = uint64_t{storage.manifest.snapshot_mb} * 1048576;
+    return options;
+}
+
+Manifest::Manifest(const Options& options) : options_(options) {
+    if (options_.dir.empty()) throw util::ConfigException("manifest directory is not set");
+    std::error_code ec;
+    std::filesystem::create_directories(options_.dir, ec);
+    if (ec) throw util::IOException("create " + options_.dir + ": " + ec.message());
+    recover();
+}
+
+Manifest::~Manifest() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+std::string Manifest::filePath(uint64_t number) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "MANIFEST-%06llu", static_cast<unsigned long long>(number));
+    return options_.dir + "/" + name;
+}
+
+void Manifest::recover() {
+    // Manifest files by number
+    std::vector<uint64_t> numbers;
+    for (const auto& entry : std::filesystem::directory_iterator(options_.dir)) {
+        const std::string name = entry.path().filename().string();
+        if (name.rfind("MANIFEST-", 0) != 0) continue;
+        char* end = nullptr;
+        const unsigned long long number = std::strtoull(name.c_str() + 9, &end, 10);
+        if (end && *end == '\0' && number > 0) numbers.push_back(number);
+    }
+    std::sort(numbers.begin(), numbers.end());
+
+    uint64_t current = 0;
+    const std::string current_path = options_.dir + "/CURRENT";
+    if (std::filesystem::exists(current_path)) {
+        const auto text = readFile(current_path);
+        const std::string name(reinterpret_cast<const char*>(text.data()), text.size());
+        if (name.rfind("MANIFEST-", 0) == 0) current = std::strtoull(name.c_str() + 9, nullptr, 10);
+        if (current == 0 || !std::binary_search(numbers.begin(), numbers.end(), current)) {
+            throw util::IOException(current_path + " does not name a manifest file");
+        }
+    }
+
+    std::shared_ptr<const ManifestVersion> version = std::make_shared<ManifestVersion>();
+    std::optional<uint64_t> valid;
+    if (current > 0) {
+        valid = replayFile(filePath(current), version);
+        if (!valid) throw util::IOException(filePath(current) + " does not start with a snapshot");
+    } else {
+        // Lost before CURRENT was first written: the newest complete file
+        for (auto it = numbers.rbegin(); it != numbers.rend() && !valid; ++it) {
+            version = std::make_shared<ManifestVersion>();
+            valid = replayFile(filePath(*it), version);
+            if (valid) current = *it;
+        }
+        if (valid) LOG_WARN("Manifest: {} has no CURRENT, using {}", options_.dir, filePath(current));
+    }
+
+    // Files of unfinished or completed switches
+    std::error_code ec;
+    for (uint64_t number : numbers) {
+        if (number != current) std::filesystem::remove(filePath(number), ec);
+    }
+    stats_.file_number = current;
+
+    if (!valid) {
+        current_.store(version, std::memory_order_release);
+        snapshotLocked(*version);
+        LOG_INFO("Manifest: created in {}", options_.dir);
+        return;
+    }
+
+    const std::string path = filePath(current);
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd_ < 0) throw util::IOException("open " + path + ": " + std::strerror(errno));
+    // Drop a torn tail so appends follow the last valid record
+    if (::ftruncate(fd_, static_cast<off_t>(*valid)) != 0 || ::fdatasync(fd_) != 0) {
+        throw util::IOException("truncate " + path + ": " + std::strerror(errno));
+    }
+    offset_ = *valid;
+    if (!std::filesystem::exists(current_path)) snapshotLocked(*version);
+    current_.store(version, std::memory_order_release);
+    LOG_INFO("Manifest: {} segments at sequence {} from {} ({} records)", version->segments.size(),
+             version->sequence, path, stats_.replayed);
+}
+
+std::optional<uint64_t> Manifest::replayFile(const std::string& path,
+                                             std::shared_ptr<const ManifestVersion>& version) {
+    const auto data = readFile(path);
+    uint64_t pos = 0;
+    uint64_t records = 0;
+    uint64_t snapshot_end = 0;
+    while (data.size() - pos >= kFrameHeader) {
+        uint32_t len;
+        uint32_t crc;
+        std::memcpy(&len, data.data() + pos, 4);
+        std::memcpy(&crc, data.data() + pos + 4, 4);
+        if (len == 0 || len > kMaxRecord || data.size() - pos - kFrameHeader < len) break;
+        std::span<const std::byte> payload(data.data() + pos + kFrameHeader, len);
+        if (util::crc32c(payload.data(), payload.size()) != crc) break;
+
+        Record record = decode(payload);
+        if ((records == 0) != record.snapshot) {
+            if (records == 0) return std::nullopt;
+            throw util::IOException(path + ": snapshot record inside the log");
+        }
+        try {
+            version = build(*version, record);
+        } catch (const util::InvalidArgumentException& e) {
+            throw util::IOException(path + ": " + e.what());
+        }
+        pos += kFrameHeader + len;
+        if (records++ == 0) snapshot_end = pos;
+    }
+    if (records == 0) return std::nullopt;
+    if (pos < data.size()) {
+        LOG_WARN("Manifest: {} ends in {} bytes of a torn record, dropped", path, data.size() - pos);
+    }
+    stats_.replayed += records;
+    stats_.log_edits = records - 1;
+    stats_.log_bytes = pos - snapshot_end;
+    stats_.segments = version->segments.size();
+    return pos;
+}
+
+void Manifest::append(std::span<const std::byte> payload) {
+    const auto record = frame(payload);
+    const std::string path = filePath(stats_.file_number);
+    try {
+        util::pwrite_all(fd_, record.data(), record.size(), offset_, path);
+        if (options_.sync && ::fdatasync(fd_) != 0) {
+            throw util::IOException("sync " + path + ": " + std::strerror(errno));
+        }
+    } catch (...) {
+        // A partial record would end the log on replay; edits after it
+        // must not land behind it
+        if (::ftruncate(fd_, static_cast<off_t>(offset_)) != 0) {
+            LOG_WARN("Manifest: cannot drop a failed append to {}: {}", path, std::strerror(errno));
+        }
+        throw;
+    }
+    offset_ += record.size();
+}
+
+std::shared_ptr<const ManifestVersion> Manifest::apply(const ManifestEdit& edit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto base = current_.load(std::memory_order_acquire);
+
+    Record record;
+    record.added.reserve(edit.added.size());
+    uint32_t ordinal = base->next_ordinal;
+    for (const auto& [leaf, descriptor] : edit.added) {
+        record.added.push_back(ManifestSegment{ordinal++, leaf, descriptor});
+    }
+    record.retired = edit.retired;
+    record.centroid_epoch = edit.centroid_epoch;
+    record.centroid_path = edit.centroid_path;
+    record.flushed_epoch = edit.flushed_epoch;
+
+    // Validated before it is logged
+    auto version = build(*base, record);
+    std::vector<std::byte> payload;
+    encode(record, payload);
+    append(payload);
+    current_.store(version, std::memory_order_release);
+
+    stats_.edits++;
+    stats_.log_edits++;
+    stats_.log_bytes += kFrameHeader + payload.size();
+    Metrics::global().writes.add(WritePoint::Manifest, kFrameHeader + payload.size());
+    stats_.segments = version->segments.size();
+
+    if (stats_.log_edits >= options_.snapshot_edits || stats_.log_bytes >= options_.snapshot_bytes) {
+        // The edit is durable either way; the next one retries
+        try {
+            snapshotLocked(*version);
+        } catch (const util::IOException& e) {
+            LOG_WARN("Manifest: snapshot failed, log kept: {}", e.what());
+        }
+    }
+    return version;
+}
+
+void Manifest::snapshot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshotLocked(*current_.load(std::memory_order_acquire));
+}
+
+void Manifest::snapshotLocked(const ManifestVersion& version) {
+    Record record;
+    record.snapshot = true;
+    record.sequence = version.sequence;
+    record.added.reserve(version.segments.size());
+    for (const auto& segment : version.segments) record.added.push_back(*segment);
+    record.centroid_epoch = version.centroid_epoch;
+    record.centroid_path = version.centroid_path;
+    record.flushed_epoch = version.flushed_epoch;
+    record.next_ordinal = version.next_ordinal;
+
+    std::vector<std::byte> payload;
+    encode(record, payload);
+    const auto data = frame(payload);
+
+    const uint64_t number = stats_.file_number + 1;
+    const std::string path = filePath(number);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw util::IOException("create " + path + ": " + std::strerror(errno));
+    try {
+        util::pwrite_all(fd, data.data(), data.size(), 0, path);
+        if (::fsync(fd) != 0) throw util::IOException("sync " + path + ": " + std::strerror(errno));
+
+        const std::string current = options_.dir + "/CURRENT";
+        const std::string tmp = current + ".tmp";
+        const std::string name = path.substr(path.find_last_of('/') + 1) + "\n";
+        int cur = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (cur < 0) throw util::IOException("create " + tmp + ": " + std::strerror(errno));
+        try {
+            util::pwrite_all(cur, reinterpret_cast<const std::byte*>(name.data()), name.size(), 0, tmp);
+            if (::fsync(cur) != 0) throw util::IOException("sync " + tmp + ": " + std::strerror(errno));
+        } catch (...) {
+            ::close(cur);
+            throw;
+        }
+        ::close(cur);
+        util::sync_directory(options_.dir);
+        if (::rename(tmp.c_str(), current.c_str()) != 0) {
+            throw util::IOException("rename " + tmp + ": " + std::strerror(errno));
+        }
+        util::sync_directory(options_.dir);
+    } catch (...) {
+        ::close(fd);
+        ::unlink(path.c_str());
+        throw;
+    }
+
+    // CURRENT names the new file: the old one is no longer read
+    if (fd_ >= 0) {
+        ::close(fd_);
+        std::error_code ec;
+        std::filesystem::remove(filePath(stats_.file_number), ec);
+    }
+    fd_ = fd;
+    offset_ = data.size();
+    Metrics::global().writes.add(WritePoint::Manifest, data.size());
+    stats_.file_number = number;
+    stats_.snapshots++;
+    stats_.log_edits = 0;
+    stats_.log_bytes = 0;
+}
+
+void Manifest::encode(const Record& record, std::vector<std::byte>& out) {
+    Writer w(out);
+    if (record.snapshot) {
+        w.put(kSnapshot);
+        w.put(record.sequence);
+    }
+    for (const auto& s : record.added) {
+        const SegmentDescriptor& d = s.descriptor;
+        w.put(kAddSegment);
+        w.put(s.ordinal);
+        w.put(s.leaf);
+        w.put(d.segment_id);
+        w.put(d.file_path);
+        w.put(d.num_vectors);
+        w.put(d.min_id_hash);
+        w.put(d.max_id_hash);
+        w.put(d.min_epoch);
+        w.put(d.max_epoch);
+        w.put(d.tombstone_ratio);
+        w.put(static_cast<int64_t>(d.created_at.count()));
+        w.put(static_cast<uint8_t>(d.is_stable));
+    }
+    for (uint32_t ordinal : record.retired) {
+        w.put(kRetireSegment);
+        w.put(ordinal);
+    }
+    if (record.centroid_epoch) {
+        w.put(kCentroids);
+        w.put(*record.centroid_epoch);
+        w.put(record.centroid_path);
+    }
+    if (record.flushed_epoch) {
+        w.put(kFlushedEpoch);
+        w.put(*record.flushed_epoch);
+    }
+    if (record.next_ordinal > 0) {
+        w.put(kNextOrdinal);
+        w.put(record.next_ordinal);
+    }
+}
+
+Manifest::Record Manifest::decode(std::span<const std::byte> payload) {
+    Record record;
+    Reader r(payload);
+    while (!r.done()) {
+        switch (r.get<uint8_t>()) {
+        case kSnapshot:
+            record.snapshot = true;
+            record.sequence = r.get<uint64_t>();
+            break;
+        case kAddSegment: {
+            ManifestSegment s;
+            SegmentDescriptor& d = s.descriptor;
+            s.ordinal = r.get<uint32_t>();
+            s.leaf = r.get<uint64_t>();
+            d.segment_id = r.getString();
+            d.file_path = r.getString();
+            d.num_vectors = r.get<uint64_t>();
+            d.min_id_hash = r.get<VectorIdHash>();
+            d.max_id_hash = r.get<VectorIdHash>();
+            d.min_epoch = r.get<Epoch>();
+            d.max_epoch = r.get<Epoch>();
+            d.tombstone_ratio = r.get<float>();
+            d.created_at = Timestamp(r.get<int64_t>());
+            d.is_stable = r.get<uint8_t>() != 0;
+            record.added.push_back(std::move(s));
+            break;
+        }
+        case kRetireSegment:
+            record.retired.push_back(r.get<uint32_t>());
+            break;
+        case kCentroids:
+            record.centroid_epoch = r.get<uint64_t>();
+            record.centroid_path = r.getString();
+            break;
+        case kFlushedEpoch:
+            record.flushed_epoch = r.get<Epoch>();
+            break;
+        case kNextOrdinal:
+            record.next_ordinal = r.get<uint32_t>();
+            break;
+        default:
+            throw util::IOException("manifest record has an unknown field");
+        }
+    }
+    return record;
+}
+
+std::shared_ptr<const ManifestVersion> Manifest::build(const ManifestVersion& base, const Record& record) {
+    auto version = std::make_shared<ManifestVersion>();
+    if (record.snapshot) {
+        version->sequence = record.sequence;
+    } else {
+        version->sequence = base.sequence + 1;
+        version->centroid_epoch = base.centroid_epoch;
+        version->centroid_path = base.centroid_path;
+        version->flushed_epoch = base.flushed_epoch;
+        version->next_ordinal = base.next_ordinal;
+
+        // Unchanged segments are shared with `base`
+        std::vector<uint32_t> retired = record.retired;
+        std::sort(retired.begin(), retired.end());
+        for (uint32_t ordinal : retired) {
+            if (!base.find(ordinal)) {
+                throw util::InvalidArgumentException("segment " + std::to_string(ordinal) + " is not live");
+            }
+        }
+        version->segments.reserve(base.segments.size() + record.added.size());
+        for (const auto& segment : base.segments) {
+            if (!std::binary_search(retired.begin(), retired.end(), segment->ordinal)) {
+                version->segments.push_back(segment);
+            }
+        }
+    }
+
+    for (const auto& s : record.added) {
+        if (!version->segments.empty() && version->segments.back()->ordinal >= s.ordinal) {
+            throw util::InvalidArgumentException("segment " + std::to_string(s.ordinal) + " is out of order");
+        }
+        version->segments.push_back(std::make_shared<const ManifestSegment>(s));
+        version->next_ordinal = std::max(version->next_ordinal, s.ordinal + 1);
+    }
+    if (record.centroid_epoch) {
+        version->centroid_epoch = *record.centroid_epoch;
+        version->centroid_path = record.centroid_path;
+    }
+    if (record.flushed_epoch) version->flushed_epoch = std::max(version->flushed_epoch, *record.flushed_epoch);
+    version->next_ordinal = std::max(version->next_ordinal, record.next_ordinal);
+    return version;
+}
+
+Manifest::Stats Manifest::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::vector<std::pair<std::string_view, double>> Manifest::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_manifest_edits_total", static_cast<double>(stats.edits)},
+        {"woved_manifest_snapshots_total", static_cast<double>(stats.snapshots)},
+        {"woved_manifest_log_edits", static_cast<double>(stats.log_edits)},
+        {"woved_manifest_log_bytes", static_cast<double>(stats.log_bytes)},
+        {"woved_manifest_segments", static_cast<double>(stats.segments)},
+    };
+}
+
+} // namespace woved::storage
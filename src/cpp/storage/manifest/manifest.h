@@ -0,0 +1,152 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct StorageConfig;
+}
+
+namespace woved::storage {
+
+// A segment as the manifest knows it. `ordinal` is assigned when it is
+// added and never reused; LatestByIdMap locations refer to it.
+struct ManifestSegment {
+    uint32_t ordinal = 0;
+    uint64_t leaf = 0;  // B-epsilon leaf the segment belongs to
+    SegmentDescriptor descriptor;
+};
+
+// Changes applied together: segments added and retired, a new centroid
+// epoch, the epoch every record at or below which is in segments
+struct ManifestEdit {
+    std::vector<std::pair<uint64_t, SegmentDescriptor>> added;  // Leaf, segment
+    std::vector<uint32_t> retired;                              // Ordinals
+    std::optional<uint64_t> centroid_epoch;
+    std::string centroid_path;                                  // With centroid_epoch
+    std::optional<Epoch> flushed_epoch;
+};
+
+// One immutable state of the manifest. Segments are sorted by ordinal and
+// shared with the versions before and after it.
+struct ManifestVersion {
+    uint64_t sequence = 0;  // Edits applied since the manifest was created
+    uint64_t centroid_epoch = 0;
+    std::string centroid_path;
+    Epoch flushed_epoch = 0;
+    uint32_t next_ordinal = 1;
+    std::vector<std::shared_ptr<const ManifestSegment>> segments;
+
+    // Null if `ordinal` is not live in this version
+    std::shared_ptr<const ManifestSegment> find(uint32_t ordinal) const;
+};
+
+// The list of live segments and centroid epochs, kept as a LevelDB-style
+// edit log.
+//
+// The directory holds MANIFEST-<n> files and CURRENT, which names the one
+// in use. A manifest file starts with a snapshot of a whole version and
+// continues with one record per edit, each framed as length, CRC32C and
+// payload; an edit is durable once its record is fdatasync'ed, so a flush
+// or a merge costs one small append instead of a rewrite of thousands of
+// entries. After snapshot_edits edits, or once the log outgrows
+// snapshot_bytes, the current version is written as the snapshot of a new
+// file, which CURRENT is renamed to name; the old file is then removed.
+//
+// On open the records of the current file are replayed in order. A record
+// cut short or failing its CRC ends the log (a torn last append) and is
+// truncated away; an edit that does not apply to the version before it
+// (an unknown ordinal) means the log is corrupt.
+//
+// In memory each edit builds a new ManifestVersion from the previous one
+// and publishes it with one atomic store, after it is durable. Readers take
+// current() without a lock and keep a consistent segment list for as long
+// as they hold it, whatever is applied meanwhile. Edits are serialized; a
+// failed append leaves the published version unchanged.
+class Manifest {
+public:
+    struct Options {
+        std::string dir;
+        uint32_t snapshot_edits = 4096;       // Edits logged before a snapshot
+        uint64_t snapshot_bytes = 67108864;   // Log bytes before a snapshot
+        bool sync = true;                     // fdatasync every edit
+
+        static Options fromConfig(const StorageConfig& storage);
+    };
+
+    struct Stats {
+        uint64_t edits = 0;              // Applied since open
+        uint64_t replayed = 0;           // Records replayed on open
+        uint64_t snapshots = 0;          // Written since open
+        uint64_t log_edits = 0;          // In the current file after its snapshot
+        uint64_t log_bytes = 0;
+        uint64_t file_number = 0;
+        uint64_t segments = 0;
+    };
+
+    // Open the manifest in `dir`, creating an empty one if there is none.
+    // Throws util::IOException if it cannot be read or written or a record
+    // does not apply.
+    explicit Manifest(const Options& options);
+    ~Manifest();
+
+    Manifest(const Manifest&) = delete;
+    Manifest& operator=(const Manifest&) = delete;
+
+    std::shared_ptr<const ManifestVersion> current() const {
+        return current_.load(std::memory_order_acquire);
+    }
+
+    // Log `edit` and publish the version it makes. Added segments get the
+    // next ordinals, in order. Throws util::InvalidArgumentException if it
+    // retires a segment that is not live, util::IOException if it cannot
+    // be logged.
+    std::shared_ptr<const ManifestVersion> apply(const ManifestEdit& edit);
+
+    // Write the current version as a new snapshot now
+    void snapshot();
+
+    Stats getStats() const;
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    // One logged edit, or the snapshot a file starts with, ordinals resolved
+    struct Record;
+
+    Options options_;
+    std::atomic<std::shared_ptr<const ManifestVersion>> current_;
+
+    mutable std::mutex mutex_;  // Edits and the log
+    int fd_ = -1;
+    uint64_t offset_ = 0;  // End of the current file
+    Stats stats_;
+
+    std::string filePath(uint64_t number) const;
+    void recover();
+    // Replay a file into `version`; returns the bytes of valid records, or
+    // nullopt if it does not start with a snapshot
+    std::optional<uint64_t> replayFile(const std::string& path, std::shared_ptr<const ManifestVersion>& version);
+    void append(std::span<const std::byte> payload);
+
+    // Write a new file holding `version` and point CURRENT at it
+    void snapshotLocked(const ManifestVersion& version);
+
+    static void encode(const Record& record, std::vector<std::byte>& out);
+    // Throws util::IOException for a malformed record
+    static Record decode(std::span<const std::byte> payload);
+    // Throws util::InvalidArgumentException if `record` retires a segment
+    // `base` does not hold
+    static std::shared_ptr<const ManifestVersion> build(const ManifestVersion& base, const Record& record);
+};
+
+} // namespace woved::storage
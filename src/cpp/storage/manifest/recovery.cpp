@@ -0,0 +1,637 @@
+#include "recovery.h"
+#include "index/centroids-manager.h"
+#include "storage/restart-index/restart-index.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-stable.h"
+#include "util/file-io.h"
+
+namespace woved::storage {
+
+namespace {
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+// WalReplayer
+
+WalReplayer::Options WalReplayer::Options::fromConfig(const Config& config) {
+    Options options;
+    options.dirs = WalStreams::directories(config.storage);
+    options.threads = std::max<size_t>(1, config.recovery.parallel_recovery_threads);
+    options.verify_checksums = config.recovery.verify_checksums;
+    options.buffer_shards = std::max<size_t>(1, config.storage.buffer.shard_count);
+    options.max_recovery_time_s = config.recovery.max_recovery_time_s;
+    return options;
+}
+
+WalReplayer::WalReplayer(const Options& options, MessageBuffer& buffer,
+                         std::shared_ptr<LatestByIdMap> latest_by_id)
+    : options_(options), buffer_(buffer), latest_by_id_(std::move(latest_by_id)) {
+    options_.threads = std::max<size_t>(1, options_.threads);
+    options_.buffer_shards = std::max<size_t>(1, options_.buffer_shards);
+    options_.batch_records = std::max<size_t>(1, options_.batch_records);
+    options_.queue_batches = std::max<size_t>(1, options_.queue_batches);
+}
+
+WalReplayer::Stats WalReplayer::run() {
+    auto start = std::chrono::steady_clock::now();
+    stats_ = Stats{};
+    lanes_.clear();
+    for (size_t i = 0; i < options_.threads; ++i) lanes_.push_back(std::make_unique<Lane>());
+
+    std::vector<std::thread> workers;
+    workers.reserve(lanes_.size());
+    for (auto& lane : lanes_) {
+        workers.emplace_back([this, lane = lane.get()] { work(*lane); });
+    }
+
+    // Streams are read concurrently, each from its own device
+    std::vector<std::unique_ptr<Reader>> readers;
+    for (const auto& dir : options_.dirs) {
+        readers.push_back(std::make_unique<Reader>());
+        readers.back()->dir = dir;
+        readers.back()->pending.resize(lanes_.size());
+    }
+    std::vector<std::thread> reading;
+    reading.reserve(readers.size());
+    for (auto& reader : readers) {
+        reading.emplace_back([this, reader = reader.get()] {
+            try {
+                readStream(*reader);
+            } catch (...) {
+                reader->error = std::current_exception();
+            }
+        });
+    }
+    for (auto& thread : reading) thread.join();
+    closeLanes();
+    for (auto& worker : workers) worker.join();
+
+    for (const auto& reader : readers) {
+        if (reader->error) std::rethrow_exception(reader->error);
+    }
+    stats_.streams = readers.size();
+    stats_.fence_epoch = readers.empty() ? 0 : std::numeric_limits<Epoch>::max();
+    for (const auto& reader : readers) {
+        const Stats& read = reader->stats;
+        stats_.files += read.files;
+        stats_.torn_files += read.torn_files;
+        stats_.frames += read.frames;
+        stats_.before_start += read.before_start;
+        stats_.bytes += read.bytes;
+        stats_.fence_epoch = std::min(stats_.fence_epoch, read.fence_epoch);
+    }
+    for (const auto& lane : lanes_) {
+        stats_.applied += lane->applied;
+        stats_.stale += lane->stale;
+        stats_.malformed += lane->malformed;
+        stats_.max_epoch = std::max(stats_.max_epoch, lane->max_epoch);
+    }
+    lanes_.clear();
+
+    stats_.elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("WAL replay: {} streams, {} files, {} MiB, {} applied, {} stale, {} skipped in {:.2f}s "
+             "({} threads, crc32c {})",
+             stats_.streams, stats_.files, stats_.bytes >> 20, stats_.applied, stats_.stale,
+             stats_.before_start, stats_.elapsed_s, options_.threads,
+             options_.verify_checksums ? util::crc32c_isa() : "off");
+    if (stats_.torn_files > 0 || stats_.malformed > 0) {
+        LOG_WARN("WAL replay: {} files ended in an invalid frame, {} malformed records",
+                 stats_.torn_files, stats_.malformed);
+    }
+    if (stats_.elapsed_s > options_.max_recovery_time_s) {
+        LOG_WARN("WAL replay took {:.1f}s, above max_recovery_time_s = {}", stats_.elapsed_s,
+                 options_.max_recovery_time_s);
+    }
+    return stats_;
+}
+
+void WalReplayer::readStream(Reader& reader) {
+    for (const auto& path : WalStreams::logFiles(reader.dir)) {
+        reader.stats.files++;
+        if (!readFile(reader, path)) reader.stats.torn_files++;
+    }
+    for (size_t i = 0; i < lanes_.size(); ++i) flushLane(reader, i);
+}
+
+bool WalReplayer::readFile(Reader& reader, const std::filesystem::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw util::IOException("open " + path.string() + ": " + std::strerror(errno));
+    }
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Each read lands in a fresh buffer that the batches borrowing from it
+    // keep alive; an incomplete frame at the end moves to the next one
+    std::shared_ptr<Bytes> chunk;
+    Bytes carry;
+    bool bad = false;
+    bool end = false;
+    bool eof = false;
+    while (!bad && !end && !eof) {
+        size_t want = std::max(options_.read_bytes, carry.size() * 2);
+        chunk = std::make_shared<Bytes>(want);
+        if (!carry.empty()) std::memcpy(chunk->data(), carry.data(), carry.size());
+        size_t have = carry.size();
+        while (have < want) {
+            ssize_t n = ::read(fd, chunk->data() + have, want - have);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                int err = errno;
+                ::close(fd);
+                throw util::IOException("read " + path.string() + ": " + std::strerror(err));
+            }
+            if (n == 0) {
+                eof = true;
+                break;
+            }
+            have += static_cast<size_t>(n);
+            reader.stats.bytes += static_cast<uint64_t>(n);
+        }
+
+        size_t used = scanFrames(reader, chunk, {chunk->data(), have}, true, bad, end);
+        carry.assign(chunk->begin() + used, chunk->begin() + have);
+    }
+    ::close(fd);
+
+    // Leftover bytes at EOF are a frame cut short by a crash
+    bool clean = !bad && (end || std::all_of(carry.begin(), carry.end(),
+                                             [](std::byte b) { return b == std::byte{0}; }));
+    if (!clean) {
+        LOG_WARN("WAL {} ends in an invalid frame, replaying up to it", path.string());
+    }
+    return clean;
+}
+
+bool WalReplayer::validFrame(const WalFrameHeader& hdr, std::span<const std::byte> payload) const {
+    if (hdr.codec() > WalCodec::PADDING) return false;
+    if (options_.verify_checksums) {
+        return WalFrameHeader::checksum(hdr.len, hdr.epoch, payload.data()) == hdr.crc32c;
+    }
+    return true;
+}
+
+size_t WalReplayer::scanFrames(Reader& reader, const std::shared_ptr<const Bytes>& owner,
+                               std::span<const std::byte> data, bool outer, bool& bad,
+                               bool& end) {
+    size_t pos = 0;
+    while (pos + sizeof(WalFrameHeader) <= data.size()) {
+        WalFrameHeader hdr;
+        std::memcpy(&hdr, data.data() + pos, sizeof(hdr));
+        if (hdr.len == 0 && hdr.crc32c == 0 && hdr.epoch == 0) {
+            // Zeroed space after the last write (a checksummed frame is never all zero)
+            if (outer) {
+                end = true;
+            } else {
+                bad = true;
+            }
+            return pos;
+        }
+        size_t stride = WalFrameHeader::stride(hdr.size());
+        if (hdr.size() > data.size() - pos - sizeof(hdr)) {
+            if (outer) return pos;  // Completed by the next read
+            bad = true;
+            return pos;
+        }
+        auto payload = data.subspan(pos + sizeof(hdr), hdr.size());
+        if (!validFrame(hdr, payload)) {
+            bad = true;
+            return pos;
+        }
+
+        switch (hdr.codec()) {
+            case WalCodec::NONE:
+                if (hdr.size() == 0) {
+                    reader.stats.fence_epoch = std::max(reader.stats.fence_epoch, hdr.epoch);
+                } else if (hdr.epoch <= options_.start_epoch) {
+                    reader.stats.frames++;
+                    reader.stats.before_start++;
+                } else {
+                    reader.stats.frames++;
+                    dispatch(reader, owner, payload);
+                }
+                break;
+            case WalCodec::DICTIONARY:
+                reader.codec.loadDictionary(payload);
+                break;
+            case WalCodec::PADDING:
+                break;
+            default: {
+                // A compressed unit: its epoch is the newest inside it
+                if (!outer) {
+                    bad = true;
+                    return pos;
+                }
+                if (hdr.epoch <= options_.start_epoch) break;
+                auto raw = std::make_shared<Bytes>();
+                try {
+                    reader.codec.decompress(static_cast<WalCodec::Kind>(hdr.codec()), payload, *raw);
+                } catch (const util::IOException& e) {
+                    LOG_WARN("WAL replay: {}", e.what());
+                    bad = true;
+                    return pos;
+                }
+                bool inner_bad = false;
+                bool inner_end = false;
+                std::shared_ptr<const Bytes> inner = raw;
+                size_t used = scanFrames(reader, inner, *inner, false, inner_bad, inner_end);
+                if (inner_bad || used != inner->size()) {
+                    bad = true;
+                    return pos;
+                }
+                break;
+            }
+        }
+        pos += std::min(stride, data.size() - pos);
+    }
+    return pos;
+}
+
+void WalReplayer::dispatch(Reader& reader, const std::shared_ptr<const Bytes>& owner,
+                           std::span<const std::byte> record) {
+    WalRecordReader rec;
+    VectorIdHash hash = rec.parse(record) ? rec.idHash() : 0;
+    size_t lane = (hash % options_.buffer_shards) % lanes_.size();
+
+    Batch& batch = reader.pending[lane];
+    if (batch.owners.empty() || batch.owners.back() != owner) batch.owners.push_back(owner);
+    batch.records.push_back(record);
+    if (batch.records.size() >= options_.batch_records) flushLane(reader, lane);
+}
+
+void WalReplayer::flushLane(Reader& reader, size_t index) {
+    Batch& pending = reader.pending[index];
+    if (pending.records.empty()) return;
+    Lane& lane = *lanes_[index];
+    std::unique_lock<std::mutex> lock(lane.mutex);
+    lane.cv.wait(lock, [&] { return lane.queue.size() < options_.queue_batches; });
+    lane.queue.push_back(std::move(pending));
+    pending = Batch{};
+    lock.unlock();
+    lane.cv.notify_all();
+}
+
+void WalReplayer::closeLanes() {
+    for (auto& lane : lanes_) {
+        {
+            std::lock_guard<std::mutex> lock(lane->mutex);
+            lane->closed = true;
+        }
+        lane->cv.notify_all();
+    }
+}
+
+void WalReplayer::work(Lane& lane) {
+    BTreeMessage msg;
+    WalRecordReader rec;
+    while (true) {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> lock(lane.mutex);
+            lane.cv.wait(lock, [&] { return !lane.queue.empty() || lane.closed; });
+            if (lane.queue.empty()) return;
+            batch = std::move(lane.queue.front());
+            lane.queue.pop_front();
+        }
+        lane.cv.notify_all();
+
+        for (auto record : batch.records) {
+            if (!rec.parse(record)) {
+                lane.malformed++;
+                continue;
+            }
+            try {
+                apply(lane, rec, msg);
+            } catch (const std::exception& e) {
+                if (lane.malformed++ == 0) LOG_WARN("WAL replay: skipping record: {}", e.what());
+            }
+        }
+    }
+}
+
+void WalReplayer::apply(Lane& lane, const WalRecordReader& rec, BTreeMessage& msg) {
+    const VectorIdHash hash = rec.idHash();
+    const Epoch epoch = rec.epoch();
+    if (rec.op() == WalOp::FENCE) return;
+
+    // Later epoch wins; this worker owns every version of the id
+    if (latest_by_id_) {
+        auto current = latest_by_id_->getPackedByHash(hash);
+        if (current && current->epoch() >= epoch) {
+            lane.stale++;
+            return;
+        }
+    } else {
+        auto [it, inserted] = lane.latest.try_emplace(hash, epoch);
+        if (!inserted) {
+            if (it->second >= epoch) {
+                lane.stale++;
+                return;
+            }
+            it->second = epoch;
+        }
+    }
+
+    if (!rec.decodeMessage(msg)) {
+        lane.malformed++;
+        return;
+    }
+
+    // Replay waits out a full buffer instead of dropping writes
+    bool warned = false;
+    while (!buffer_.append(hash, msg).accepted()) {
+        if (!warned) {
+            LOG_WARN("WAL replay: buffer full at epoch {}, waiting for flushes", epoch);
+            warned = true;
+        }
+        buffer_.waitForSpace(std::chrono::milliseconds(100));
+    }
+    lane.applied++;
+    lane.max_epoch = std::max(lane.max_epoch, epoch);
+}
+
+// LazySegment
+
+LazySegment::LazySegment(std::shared_ptr<const ManifestSegment> segment, const SegmentReader::Options& options)
+    : segment_(std::move(segment)), options_(options) {}
+
+const SegmentReader& LazySegment::open() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::string& path = segment_->descriptor.file_path;
+    if (isStable()) {
+        if (!stable_) stable_ = std::make_shared<const StableSegment>(path, options_);
+    } else {
+        if (!delta_) delta_ = std::make_shared<const DeltaSegment>(path, options_);
+    }
+    State closed = State::Closed;
+    state_.compare_exchange_strong(closed, State::Open, std::memory_order_acq_rel);
+    return isStable() ? stable_->reader() : delta_->reader();
+}
+
+std::shared_ptr<const DeltaSegment> LazySegment::openDelta() const {
+    if (isStable()) throw std::logic_error("segment " + segment_->descriptor.segment_id + " is stable");
+    open();
+    std::lock_guard<std::mutex> lock(mutex_);
+    return delta_;
+}
+
+std::shared_ptr<const StableSegment> LazySegment::openStable() const {
+    if (!isStable()) throw std::logic_error("segment " + segment_->descriptor.segment_id + " is a delta segment");
+    open();
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stable_;
+}
+
+uint64_t LazySegment::verify(io::RateLimiter* limiter) const {
+    uint64_t bytes = 0;
+    try {
+        const SegmentReader& reader = open();
+        for (const SegmentSection& section : reader.sections()) {
+            if (limiter) limiter->acquire(section.length);
+            reader.verify(section);
+            bytes += section.length;
+        }
+    } catch (const util::IOException&) {
+        state_.store(State::Corrupt, std::memory_order_release);
+        throw;
+    }
+    state_.store(State::Verified, std::memory_order_release);
+    return bytes;
+}
+
+// Recovery
+
+Recovery::Options Recovery::Options::fromConfig(const Config& config) {
+    Options options;
+    options.checkpoint_path = config.storage.data_dir + "/restart-index";
+    options.threads = std::max<uint32_t>(1, config.recovery.parallel_recovery_threads);
+    options.verify_checksums = config.recovery.verify_checksums;
+    options.verify_bytes_per_s = uint64_t{config.recovery.verify_bandwidth_mbps} * 1048576;
+    options.max_recovery_time_s = config.recovery.max_recovery_time_s;
+    options.delta_read = SegmentReader::Options::fromConfig(config.io, false);
+    options.stable_read = SegmentReader::Options::fromConfig(config.io, true);
+    options.delta_read.verify_checksums = options.verify_checksums;
+    options.stable_read.verify_checksums = options.verify_checksums;
+    options.wal = WalReplayer::Options::fromConfig(config);
+    return options;
+}
+
+Recovery::Recovery(const Options& options, Manifest& manifest, index::CentroidsManager& centroids,
+                   MessageBuffer& buffer, std::shared_ptr<LatestByIdMap> latest_by_id)
+    : options_(options), manifest_(manifest), centroids_(centroids), buffer_(buffer),
+      latest_by_id_(std::move(latest_by_id)),
+      limiter_(std::make_unique<io::RateLimiter>(options.verify_bytes_per_s)) {}
+
+Recovery::~Recovery() {
+    stop();
+}
+
+void Recovery::run() {
+    start_ = std::chrono::steady_clock::now();
+    auto version = manifest_.current();
+    loadCentroids(*version);
+
+    const Epoch checkpoint = loadCheckpoint();
+    WalReplayer::Options wal = options_.wal;
+    wal.start_epoch = checkpoint;
+    WalReplayer replayer(wal, buffer_, latest_by_id_);
+    WalReplayer::Stats replayed = replayer.run();
+
+    const double ready = secondsSince(start_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.ready_s = ready;
+        stats_.wal = replayed;
+    }
+    LOG_INFO("Recovery: ready in {:.2f}s ({} segments unopened, checkpoint epoch {}, {} WAL records)", ready,
+             version->segments.size(), checkpoint, replayed.applied);
+    if (ready > options_.max_recovery_time_s) {
+        LOG_WARN("Recovery: {:.2f}s to ready exceeds max_recovery_time_s ({})", ready,
+                 options_.max_recovery_time_s);
+    }
+}
+
+void Recovery::loadCentroids(const ManifestVersion& version) {
+    if (version.centroid_path.empty()) {
+        LOG_INFO("Recovery: no centroids in the manifest yet");
+        return;
+    }
+    uint32_t dim = 0;
+    auto matrix = readCentroids(version.centroid_path, dim);
+    centroids_.install(matrix, dim);
+    LOG_INFO("Recovery: {} centroids of epoch {} from {}", matrix.size() / dim, version.centroid_epoch,
+             version.centroid_path);
+}
+
+Epoch Recovery::loadCheckpoint() {
+    if (!latest_by_id_ || !std::filesystem::exists(options_.checkpoint_path)) return 0;
+    try {
+        RestartIndex index(options_.checkpoint_path, options_.verify_checksums);
+        index.loadInto(*latest_by_id_, options_.threads);
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.checkpoint_epoch = index.checkpointEpoch();
+        stats_.checkpoint_entries = index.size();
+        return index.checkpointEpoch();
+    } catch (const util::IOException& e) {
+        // The map is rebuilt from the WAL and, as segments open, from them
+        LOG_WARN("Recovery: checkpoint {} unusable, replaying the whole WAL: {}", options_.checkpoint_path, e.what());
+        latest_by_id_->clear();
+        return 0;
+    }
+}
+
+std::shared_ptr<LazySegment> Recovery::segment(uint32_t ordinal) {
+    auto live = manifest_.current()->find(ordinal);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = segments_.find(ordinal);
+    if (!live) {
+        if (it != segments_.end()) segments_.erase(it);  // Retired
+        return nullptr;
+    }
+    if (it == segments_.end()) {
+        const auto& read = live->descriptor.is_stable ? options_.stable_read : options_.delta_read;
+        it = segments_.emplace(ordinal, std::make_shared<LazySegment>(std::move(live), read)).first;
+    }
+    return it->second;
+}
+
+void Recovery::startWarmup() {
+    if (warmup_.joinable()) return;
+    stopping_.store(false);
+    warmup_ = std::thread([this] { warmup(); });
+}
+
+void Recovery::stop() {
+    stopping_.store(true);
+    if (warmup_.joinable()) warmup_.join();
+}
+
+void Recovery::warmup() {
+    auto version = manifest_.current();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.segments = version->segments.size();
+    }
+
+    // Newest first
+    for (auto it = version->segments.rbegin(); it != version->segments.rend(); ++it) {
+        if (stopping_.load(std::memory_order_relaxed)) return;
+        auto segment = this->segment((*it)->ordinal);
+        if (!segment) continue;  // Retired meanwhile
+        try {
+            uint64_t bytes = 0;
+            if (options_.verify_checksums) {
+                bytes = segment->verify(limiter_.get());
+            } else if (segment->isStable()) {
+                segment->openStable();
+            } else {
+                segment->openDelta();
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.opened++;
+            if (options_.verify_checksums) {
+                stats_.verified++;
+                stats_.verified_bytes += bytes;
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR("Recovery: segment {} failed verification: {}", (*it)->descriptor.file_path, e.what());
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.corrupt++;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.warm = true;
+    stats_.warm_s = secondsSince(start_);
+    LOG_INFO("Recovery: warm in {:.2f}s, {} segments opened, {} verified, {} corrupt", stats_.warm_s,
+             stats_.opened, stats_.verified, stats_.corrupt);
+}
+
+void Recovery::writeCentroids(const std::string& path, std::span<const float> centroids, uint32_t dim) {
+    if (dim == 0 || centroids.size() % dim != 0) {
+        throw util::InvalidArgumentException("centroid matrix is not a whole number of rows");
+    }
+    const std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw util::IOException("create " + tmp + ": " + std::strerror(errno));
+    try {
+        std::vector<std::byte> row(sizeof(int32_t) + dim * sizeof(float));
+        const int32_t d = static_cast<int32_t>(dim);
+        std::memcpy(row.data(), &d, sizeof(d));
+        for (size_t r = 0; r < centroids.size() / dim; ++r) {
+            std::memcpy(row.data() + sizeof(d), centroids.data() + r * dim, dim * sizeof(float));
+            util::write_all(fd, row.data(), row.size(), tmp);
+        }
+        if (::fsync(fd) != 0) throw util::IOException("fsync " + tmp + ": " + std::strerror(errno));
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw;
+    }
+    if (::close(fd) != 0) {
+        const int err = errno;
+        ::unlink(tmp.c_str());
+        throw util::IOException("close " + tmp + ": " + std::strerror(err));
+    }
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        const int err = errno;
+        ::unlink(tmp.c_str());
+        throw util::IOException("rename " + tmp + ": " + std::strerror(err));
+    }
+    util::sync_parent_directory(path);
+}
+
+std::vector<float> Recovery::readCentroids(const std::string& path, uint32_t& dim) {
+    std::error_code ec;
+    const uint64_t bytes = std::filesystem::file_size(path, ec);
+    if (ec) throw util::IOException("open " + path + ": " + ec.message());
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw util::IOException("open " + path + ": " + std::strerror(errno));
+    std::vector<std::byte> data(bytes);
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = ::read(fd, data.data() + done, bytes - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+
+    int32_t d = 0;
+    if (done == bytes && bytes >= sizeof(d)) std::memcpy(&d, data.data(), sizeof(d));
+    const size_t row = sizeof(d) + size_t(d > 0 ? d : 0) * sizeof(float);
+    if (done != bytes || d <= 0 || bytes % row != 0) {
+        throw util::IOException("centroid file " + path + " is truncated or not .fvecs");
+    }
+    dim = static_cast<uint32_t>(d);
+    std::vector<float> matrix(bytes / row * dim);
+    for (size_t r = 0; r < bytes / row; ++r) {
+        int32_t rd;
+        std::memcpy(&rd, data.data() + r * row, sizeof(rd));
+        if (rd != d) throw util::IOException("centroid file " + path + " mixes dimensions");
+        std::memcpy(matrix.data() + r * dim, data.data() + r * row + sizeof(rd), dim * sizeof(float));
+    }
+    return matrix;
+}
+
+Recovery::Stats Recovery::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::vector<std::pair<std::string_view, double>> Recovery::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_recovery_ready_seconds", stats.ready_s},
+        {"woved_recovery_warm_seconds", stats.warm_s},
+        {"woved_recovery_warm", stats.warm ? 1.0 : 0.0},
+        {"woved_recovery_segments_opened", static_cast<double>(stats.opened)},
+        {"woved_recovery_segments_verified", static_cast<double>(stats.verified)},
+        {"woved_recovery_segments_corrupt", static_cast<double>(stats.corrupt)},
+    };
+}
+
+} // namespace woved::storage
@@ -0,0 +1,298 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "core/config.h"
+#include "io/rate-limiter.h"
+#include "storage/buffer/msg-buf.h"
+#include "storage/latest-by-id.h"
+#include "storage/manifest/manifest.h"
+#include "storage/segment/seg-r.h"
+#include "storage/wal/group-commit.h"
+#include "storage/wal/wal-codec.h"
+#include "storage/wal/wal-record.h"
+#include "storage/wal/wal-streams.h"
+#include "util/crc32c.h"
+#include "util/exceptions.h"
+#include "util/intern-table.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace woved::index {
+class CentroidsManager;
+}
+
+namespace woved::storage {
+
+class DeltaSegment;
+class StableSegment;
+
+// Parallel WAL replay in three stages:
+//  - one reader per WAL stream directory reads its wal-<seq>.log files in
+//    order with large sequential reads, checks frame CRCs (verify_checksums), expands
+//    compressed units and stops a file at zeroed (preallocated) space or
+//    at its first torn or corrupt frame;
+//  - records are routed by id_hash to `threads` workers through bounded
+//    per-worker queues, so reading stays at most a few chunks ahead;
+//  - each worker decodes its records and appends them to the buffer
+//    shards it owns, which also rebuilds their LatestByIdMap entries.
+//
+// Routing follows the buffer's hash sharding, so every shard and every id
+// has exactly one worker: later-epoch-wins is a local check against the
+// map (or a per-worker table without one), and replay runs at device
+// speed rather than at the speed of one core. Epochs are global across
+// streams, so the same check merges them in any interleaving, including
+// after a change of stream count or sharding.
+class WalReplayer {
+public:
+    struct Options {
+        std::vector<std::string> dirs;  // One per WAL stream
+        size_t threads = 4;
+        bool verify_checksums = true;
+        Epoch start_epoch = 0;         // Records at or below are already recovered
+        size_t buffer_shards = 16;     // MessageBuffer shard count
+        size_t read_bytes = 16777216;  // 16 MiB sequential reads
+        size_t batch_records = 1024;   // Records per hand-off to a worker
+        size_t queue_batches = 8;      // Queued batches per worker
+        uint32_t max_recovery_time_s = 30;  // Logged as a warning when exceeded
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        size_t files = 0;
+        size_t torn_files = 0;       // Files that ended in an invalid frame
+        size_t frames = 0;           // Data frames, after decompression
+        size_t applied = 0;
+        size_t stale = 0;            // Older than the version already recovered
+        size_t before_start = 0;     // At or below start_epoch
+        size_t malformed = 0;        // Valid frame, undecodable record
+        uint64_t bytes = 0;          // Log bytes read
+        Epoch max_epoch = 0;         // Of applied records
+        Epoch fence_epoch = 0;       // Lowest last fence of any stream
+        size_t streams = 0;
+        double elapsed_s = 0;
+    };
+
+    WalReplayer(const Options& options, MessageBuffer& buffer,
+                std::shared_ptr<LatestByIdMap> latest_by_id);
+
+    // Replay every stream, each in file sequence order. Throws
+    // util::IOException if a file cannot be read.
+    Stats run();
+
+private:
+    using Bytes = std::vector<std::byte>;
+
+    // Records of one worker, borrowed from a shared read or decompression
+    // buffer
+    struct Batch {
+        std::vector<std::shared_ptr<const Bytes>> owners;
+        std::vector<std::span<const std::byte>> records;
+    };
+
+    // One worker's queue and counters
+    struct Lane {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Batch> queue;
+        bool closed = false;
+
+        size_t applied = 0;
+        size_t stale = 0;
+        size_t malformed = 0;
+        Epoch max_epoch = 0;
+        std::unordered_map<VectorIdHash, Epoch> latest;  // Without a map only
+    };
+
+    // One stream's reader state
+    struct Reader {
+        std::string dir;
+        WalCodec codec{WalCodec::ZSTD, 0, 0};  // Decompression only
+        std::vector<Batch> pending;            // Per lane, not yet queued
+        Stats stats;
+        std::exception_ptr error;
+    };
+
+    Options options_;
+    MessageBuffer& buffer_;
+    std::shared_ptr<LatestByIdMap> latest_by_id_;
+    std::vector<std::unique_ptr<Lane>> lanes_;
+    Stats stats_;
+
+    // Stage 1: every file of one stream; readFile returns false if the
+    // file ended in an invalid frame
+    void readStream(Reader& reader);
+    bool readFile(Reader& reader, const std::filesystem::path& path);
+
+    // Walk frames in `data`; returns the offset of the first frame not
+    // fully inside it. `bad` is set at an invalid frame, `end` at zeroes.
+    size_t scanFrames(Reader& reader, const std::shared_ptr<const Bytes>& owner,
+                      std::span<const std::byte> data, bool outer, bool& bad, bool& end);
+    bool validFrame(const WalFrameHeader& hdr, std::span<const std::byte> payload) const;
+
+    // Stage 2: route a record to its worker
+    void dispatch(Reader& reader, const std::shared_ptr<const Bytes>& owner,
+                  std::span<const std::byte> record);
+    void flushLane(Reader& reader, size_t index);
+    void closeLanes();
+
+    // Stage 3
+    void work(Lane& lane);
+    void apply(Lane& lane, const WalRecordReader& rec, BTreeMessage& msg);
+};
+
+// A live manifest segment, opened on first access. Until then it costs
+// its manifest entry; opening reads the footer and directory, the header
+// and the id hash, epoch and flag columns (DeltaSegment, StableSegment).
+class LazySegment {
+public:
+    enum class State : uint8_t { Closed, Open, Verified, Corrupt };
+
+    LazySegment(std::shared_ptr<const ManifestSegment> segment, const SegmentReader::Options& options);
+
+    const ManifestSegment& manifest() const { return *segment_; }
+    bool isStable() const { return segment_->descriptor.is_stable; }
+    State state() const { return state_.load(std::memory_order_acquire); }
+
+    // Open on first call; a failed open is retried by the next one. Throws
+    // util::IOException if the file is missing or corrupt, std::logic_error
+    // for the other tier.
+    std::shared_ptr<const DeltaSegment> openDelta() const;
+    std::shared_ptr<const StableSegment> openStable() const;
+
+    // Check the chunk checksums of every section, charging their bytes to
+    // `limiter` (may be null); opens the segment first. Returns the bytes
+    // checked. Throws util::IOException, and stays Corrupt, on a mismatch.
+    uint64_t verify(io::RateLimiter* limiter) const;
+
+private:
+    std::shared_ptr<const ManifestSegment> segment_;
+    SegmentReader::Options options_;
+    mutable std::mutex mutex_;
+    mutable std::shared_ptr<const DeltaSegment> delta_;
+    mutable std::shared_ptr<const StableSegment> stable_;
+    mutable std::atomic<State> state_{State::Closed};
+
+    const SegmentReader& open() const;
+};
+
+// Restart that takes queries first and warms up after.
+//
+// run() loads only what answering a query needs: the centroids the
+// manifest names, the latest-by-id checkpoint (whose entry blocks are
+// checksummed on first use, see RestartIndex) and the WAL tail after its
+// epoch. No segment file is touched, so the time to ready is that of the
+// manifest, the checkpoint metadata and the tail, however many segments
+// there are; max_recovery_time_s bounds it and is warned about when
+// exceeded. Each live segment is then a LazySegment, opened by the first
+// query that routes to it.
+//
+// startWarmup() opens every segment in the background, newest first (the
+// delta segments queries hit most), and with verify_checksums checks all
+// of its chunks, at verify_bandwidth_mbps so it stays out of the way of
+// queries. A corrupt segment is logged and counted; its reads keep
+// failing their own checksum checks. Segments the manifest gains later are
+// opened lazily like the rest.
+//
+// Centroids are installed as a new history (CentroidsManager::install), so
+// delta segments clustered before the restart are probed with every list
+// until rebalance() has run again.
+class Recovery {
+public:
+    struct Options {
+        std::string checkpoint_path;            // storage.data_dir/restart-index
+        size_t threads = 4;                     // recovery.parallel_recovery_threads
+        bool verify_checksums = true;
+        uint64_t verify_bytes_per_s = 0;        // recovery.verify_bandwidth_mbps; 0 = unlimited
+        uint32_t max_recovery_time_s = 30;      // Time to ready
+        SegmentReader::Options delta_read;
+        SegmentReader::Options stable_read;
+        WalReplayer::Options wal;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Stats {
+        double ready_s = 0;           // Until run() returned
+        double warm_s = 0;            // Until the warmup pass finished
+        bool warm = false;
+        Epoch checkpoint_epoch = 0;
+        size_t checkpoint_entries = 0;
+        size_t segments = 0;          // Live at startWarmup()
+        size_t opened = 0;
+        size_t verified = 0;
+        size_t corrupt = 0;
+        uint64_t verified_bytes = 0;
+        WalReplayer::Stats wal;
+    };
+
+    // The manifest, centroids, buffer and map must outlive this
+    Recovery(const Options& options, Manifest& manifest, index::CentroidsManager& centroids,
+             MessageBuffer& buffer, std::shared_ptr<LatestByIdMap> latest_by_id);
+    ~Recovery();
+
+    Recovery(const Recovery&) = delete;
+    Recovery& operator=(const Recovery&) = delete;
+
+    // Load centroids, checkpoint and WAL tail; returns once queries can be
+    // served. Throws util::IOException if the centroids or the WAL cannot
+    // be read. A missing or corrupt checkpoint is rebuilt from the WAL
+    // alone, and from the segments by their warmup.
+    void run();
+
+    // Background open and verification of every live segment
+    void startWarmup();
+    void stop();
+
+    // The segment of a live ordinal, opened on first access; null if the
+    // manifest does not hold it
+    std::shared_ptr<LazySegment> segment(uint32_t ordinal);
+
+    // Centroid matrix files named by the manifest: .fvecs rows (int32
+    // dim, then dim float32). write() goes through a temporary file.
+    static void writeCentroids(const std::string& path, std::span<const float> centroids, uint32_t dim);
+    static std::vector<float> readCentroids(const std::string& path, uint32_t& dim);
+
+    Stats getStats() const;
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    Options options_;
+    Manifest& manifest_;
+    index::CentroidsManager& centroids_;
+    MessageBuffer& buffer_;
+    std::shared_ptr<LatestByIdMap> latest_by_id_;
+    std::unique_ptr<io::RateLimiter> limiter_;
+    std::chrono::steady_clock::time_point start_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint32_t, std::shared_ptr<LazySegment>> segments_;
+    Stats stats_;
+
+    std::atomic<bool> stopping_{false};
+    std::thread warmup_;
+
+    void loadCentroids(const ManifestVersion& version);
+    Epoch loadCheckpoint();
+    void warmup();
+};
+
+} // namespace woved::storage
@@ -0,0 +1,587 @@
+#include "nvm-allocator.h"
+#include "util/crc32c.h"
+#include "util/exceptions.h"
+#include "util/fault-point.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <bit>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr uint64_t kPoolMagic = 0x434f4c4c41564f57ULL;  // "WOVALLOC"
+constexpr uint32_t kPoolVersion = 1;
+constexpr size_t kPageSize = 4096;
+constexpr size_t kCacheLine = 64;
+
+// Persistent chunk states
+constexpr uint64_t kStateSlab = 1ull << 62;  // | size class
+constexpr uint64_t kStateRun = 1ull << 63;   // | chunks in the run (head only)
+
+// Redo operations, in the low bits of an entry's target offset
+constexpr uint64_t kOpSet = 0;
+constexpr uint64_t kOpOr = 1;
+constexpr uint64_t kOpAndNot = 2;
+constexpr uint64_t kOpMask = 7;
+
+constexpr size_t roundUp(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+} // namespace
+
+struct NvmAllocator::PoolHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint16_t pool_id;
+    uint16_t reserved;
+    uint64_t chunk_bytes;
+    uint64_t chunk_count;
+    uint64_t table_offset;
+    uint64_t chunks_offset;
+    PmemPtr<void> root;
+};
+
+struct alignas(kCacheLine) NvmAllocator::RedoLog {
+    uint64_t commit;  // Sequence once committed, 0 otherwise
+    uint32_t crc;     // Over the sequence, count and entries
+    uint32_t count;
+    Transaction::Entry entries[kLogEntries];
+};
+
+std::atomic<uint64_t> NvmAllocator::next_instance_id_{1};
+
+// Transaction
+
+void NvmAllocator::Transaction::add(uint64_t target, uint64_t value) {
+    if (count_ == kLogEntries) {
+        throw util::InvalidArgumentException("persistent transaction exceeds " + std::to_string(kLogEntries) +
+                                             " entries");
+    }
+    entries_[count_++] = {target, value};
+}
+
+void NvmAllocator::Transaction::publish(PmemPtr<void> block) {
+    const uint64_t offset = allocator_.checkedBlock(block);
+    const size_t chunk = allocator_.chunkOf(offset);
+    const uint32_t kind = allocator_.kinds_[chunk].load(std::memory_order_acquire);
+    if (kind & kRunKind) {
+        add(allocator_.wordOffset(allocator_.chunkState(chunk)) | kOpSet,
+            kStateRun | (kind & ~kRunKind));
+    } else {
+        const size_t index = (offset - allocator_.chunkOffset(chunk)) / allocator_.classBytes(kind - 1);
+        add(allocator_.wordOffset(allocator_.chunkBitmap(chunk) + index / 64) | kOpOr,
+            uint64_t{1} << (index % 64));
+    }
+    published_.push_back(block);
+}
+
+void NvmAllocator::Transaction::release(PmemPtr<void> block) {
+    if (!block) return;
+    const uint64_t offset = allocator_.checkedBlock(block);
+    const size_t chunk = allocator_.chunkOf(offset);
+    const uint32_t kind = allocator_.kinds_[chunk].load(std::memory_order_acquire);
+    if (kind & kRunKind) {
+        add(allocator_.wordOffset(allocator_.chunkState(chunk)) | kOpSet, 0);
+    } else {
+        const size_t index = (offset - allocator_.chunkOffset(chunk)) / allocator_.classBytes(kind - 1);
+        add(allocator_.wordOffset(allocator_.chunkBitmap(chunk) + index / 64) | kOpAndNot,
+            uint64_t{1} << (index % 64));
+    }
+    released_.push_back(block);
+}
+
+void NvmAllocator::Transaction::set(uint64_t* word, uint64_t value) {
+    // The root pointer or a word inside a chunk; never allocator metadata
+    const auto* p = reinterpret_cast<const std::byte*>(word);
+    const std::byte* chunks = allocator_.base_ + allocator_.chunks_offset_;
+    const bool in_chunks =
+        p >= chunks && p + sizeof(uint64_t) <= chunks + allocator_.chunk_count_ * allocator_.options_.chunk_bytes;
+    if ((!in_chunks && word != reinterpret_cast<uint64_t*>(allocator_.root())) ||
+        reinterpret_cast<uintptr_t>(p) % sizeof(uint64_t) != 0) {
+        throw util::InvalidArgumentException("persistent transaction: word outside the pool's blocks");
+    }
+    add(static_cast<uint64_t>(p - allocator_.base_) | kOpSet, value);
+}
+
+void NvmAllocator::Transaction::commit() {
+    if (committed_) return;
+    allocator_.commit(*this);
+    committed_ = true;
+}
+
+// NvmAllocator
+
+NvmAllocator::NvmAllocator(const Options& options)
+    : options_(options),
+      store_(PmemStore::Options{options.path, options.pool_bytes, true, options.require_pmem}),
+      base_(store_.data()) {
+    if (!std::has_single_bit(options_.chunk_bytes) || options_.chunk_bytes < 65536 ||
+        options_.chunk_bytes > 268435456) {
+        throw util::ConfigException("allocator chunk_bytes must be a power of two from 64 KiB to 256 MiB");
+    }
+    class_count_ = static_cast<size_t>(std::countr_zero(options_.chunk_bytes / 4 / kMinBlock)) + 1;
+    bitmap_words_ = options_.chunk_bytes / kMinBlock / 64;
+    meta_bytes_ = roundUp(sizeof(uint64_t) * (1 + bitmap_words_), kCacheLine);
+    table_offset_ = kPageSize + kLanes * sizeof(RedoLog);
+
+    if (store_.created()) {
+        const size_t avail = store_.size() - roundUp(table_offset_, kPageSize);
+        chunk_count_ = avail / (options_.chunk_bytes + meta_bytes_);
+        while (chunk_count_ > 0 &&
+               roundUp(table_offset_ + chunk_count_ * meta_bytes_, kPageSize) + chunk_count_ * options_.chunk_bytes >
+                   store_.size()) {
+            chunk_count_--;
+        }
+        if (chunk_count_ == 0) throw util::ConfigException("persistent pool smaller than one chunk: " + options_.path);
+        chunks_offset_ = roundUp(table_offset_ + chunk_count_ * meta_bytes_, kPageSize);
+        format();
+    } else {
+        load();
+    }
+    PmemPools::add(pool_id_, base_);
+
+    kinds_ = std::vector<std::atomic<uint32_t>>(chunk_count_);
+    if (!store_.created()) replay();
+    rebuild();
+
+    LOG_INFO("Persistent pool {} (id {}): {} chunks of {} bytes, {} free, {} redo logs replayed", options_.path,
+             pool_id_, chunk_count_, options_.chunk_bytes, free_chunks_.size(), replayed_);
+}
+
+NvmAllocator::~NvmAllocator() {
+    PmemPools::remove(pool_id_);
+    store_.sync();
+}
+
+NvmAllocator::RedoLog* NvmAllocator::log(size_t lane) const {
+    return reinterpret_cast<RedoLog*>(base_ + kPageSize) + lane;
+}
+
+uint64_t* NvmAllocator::chunkState(size_t chunk) const {
+    return reinterpret_cast<uint64_t*>(base_ + table_offset_ + chunk * meta_bytes_);
+}
+
+uint64_t* NvmAllocator::chunkBitmap(size_t chunk) const {
+    return chunkState(chunk) + 1;
+}
+
+size_t NvmAllocator::classOf(size_t bytes) const {
+    if (bytes <= kMinBlock) return 0;
+    return static_cast<size_t>(std::bit_width(bytes - 1)) - std::countr_zero(kMinBlock);
+}
+
+void NvmAllocator::format() {
+    // Logs, table and chunk states are already zero in a fresh file
+    std::random_device random;
+    do {
+        pool_id_ = static_cast<uint16_t>(random());
+    } while (pool_id_ == 0 || PmemPools::base(pool_id_) != nullptr);
+
+    PoolHeader* hdr = header();
+    hdr->version = kPoolVersion;
+    hdr->pool_id = pool_id_;
+    hdr->chunk_bytes = options_.chunk_bytes;
+    hdr->chunk_count = chunk_count_;
+    hdr->table_offset = table_offset_;
+    hdr->chunks_offset = chunks_offset_;
+    hdr->root = PmemPtr<void>();
+    store_.persist(hdr, sizeof(PoolHeader));
+
+    std::atomic_ref<uint64_t>(hdr->magic).store(kPoolMagic, std::memory_order_release);
+    store_.persist(&hdr->magic, sizeof(hdr->magic));
+}
+
+void NvmAllocator::load() {
+    const PoolHeader* hdr = header();
+    if (hdr->magic != kPoolMagic || hdr->version != kPoolVersion) {
+        throw util::IOException("not a persistent allocator pool: " + options_.path);
+    }
+    if (hdr->chunk_bytes != options_.chunk_bytes || hdr->table_offset != table_offset_) {
+        throw util::ConfigException("persistent pool geometry does not match config: " + options_.path);
+    }
+    chunk_count_ = hdr->chunk_count;
+    chunks_offset_ = hdr->chunks_offset;
+    pool_id_ = hdr->pool_id;
+    if (chunks_offset_ + chunk_count_ * options_.chunk_bytes > store_.size()) {
+        throw util::ConfigException("persistent pool is larger than configured: " + options_.path);
+    }
+}
+
+void NvmAllocator::replay() {
+    std::vector<RedoLog*> committed;
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        RedoLog* l = log(lane);
+        if (l->commit == 0) continue;
+        const uint32_t count = std::min<uint32_t>(l->count, kLogEntries);
+        uint32_t crc = util::crc32c(&l->commit, sizeof(l->commit));
+        crc = util::crc32c(&count, sizeof(count), crc);
+        crc = util::crc32c(l->entries, count * sizeof(Transaction::Entry), crc);
+        if (crc == l->crc && count == l->count) {
+            committed.push_back(l);
+        } else {
+            l->commit = 0;  // Torn before its commit word was durable
+            store_.persist(&l->commit, sizeof(l->commit));
+        }
+    }
+    std::sort(committed.begin(), committed.end(), [](const RedoLog* a, const RedoLog* b) {
+        return a->commit < b->commit;
+    });
+    for (RedoLog* l : committed) {
+        for (uint32_t i = 0; i < l->count; ++i) apply(l->entries[i].target, l->entries[i].value);
+        store_.drain();
+        l->commit = 0;
+        store_.persist(&l->commit, sizeof(l->commit));
+    }
+    replayed_ = committed.size();
+}
+
+void NvmAllocator::rebuild() {
+    for (size_t chunk = 0; chunk < chunk_count_;) {
+        const uint64_t state = *chunkState(chunk);
+        if (state & kStateRun) {
+            const size_t length = static_cast<size_t>(state & ~kStateRun);
+            if (length == 0 || chunk + length > chunk_count_) {
+                throw util::IOException("persistent pool chunk " + std::to_string(chunk) + " has a bad run length");
+            }
+            kinds_[chunk].store(kRunKind | static_cast<uint32_t>(length), std::memory_order_relaxed);
+            allocated_bytes_ += length * options_.chunk_bytes;
+            chunk += length;
+            continue;
+        }
+
+        const uint64_t* bitmap = chunkBitmap(chunk);
+        const size_t c = static_cast<size_t>(state & ~kStateSlab);
+        size_t used = 0;
+        if (state & kStateSlab) {
+            if (c >= class_count_) {
+                throw util::IOException("persistent pool chunk " + std::to_string(chunk) + " has a bad size class");
+            }
+            const size_t blocks = options_.chunk_bytes / classBytes(c);
+            for (size_t i = 0; i < blocks; ++i) {
+                if (bitmap[i / 64] & (uint64_t{1} << (i % 64))) {
+                    used++;
+                } else {
+                    classes_[c].free.push_back(chunkOffset(chunk) + i * classBytes(c));
+                }
+            }
+            if (used > 0) {
+                kinds_[chunk].store(static_cast<uint32_t>(c) + 1, std::memory_order_relaxed);
+                allocated_bytes_ += used * classBytes(c);
+                chunk++;
+                continue;
+            }
+            classes_[c].free.resize(classes_[c].free.size() - blocks);
+        }
+
+        // Free: clear whatever a previous use left so the chunk reads as
+        // empty under any class
+        if (state != 0 || std::any_of(bitmap, bitmap + bitmap_words_, [](uint64_t w) { return w != 0; })) {
+            std::fill(chunkBitmap(chunk), chunkBitmap(chunk) + bitmap_words_, 0);
+            *chunkState(chunk) = 0;
+            store_.flush(chunkState(chunk), meta_bytes_);
+        }
+        free_chunks_.insert(static_cast<uint32_t>(chunk));
+        chunk++;
+    }
+    store_.drain();
+}
+
+NvmAllocator::Cache& NvmAllocator::localCache() {
+    // The handle marks the cache orphaned when its thread exits
+    struct Handle {
+        std::shared_ptr<Cache> cache;
+        ~Handle() {
+            if (cache) cache->orphaned.store(true, std::memory_order_release);
+        }
+    };
+    thread_local std::unordered_map<uint64_t, Handle> caches;
+
+    Handle& handle = caches[instance_id_];
+    if (!handle.cache) {
+        handle.cache = std::make_shared<Cache>();
+        handle.cache->lane = next_lane_.fetch_add(1) % kLanes;
+        std::lock_guard<std::mutex> lock(caches_mutex_);
+        caches_.push_back(handle.cache);
+    }
+    return *handle.cache;
+}
+
+PmemPtr<void> NvmAllocator::reserve(size_t bytes) {
+    if (bytes > classBytes(class_count_ - 1)) {
+        return PmemPtr<void>(pool_id_, reserveRun((bytes + options_.chunk_bytes - 1) / options_.chunk_bytes));
+    }
+    const size_t c = classOf(std::max<size_t>(bytes, 1));
+    std::vector<uint64_t>& cached = localCache().blocks[c];
+    if (cached.empty()) refill(c, cached);
+    const uint64_t offset = cached.back();
+    cached.pop_back();
+    return PmemPtr<void>(pool_id_, offset);
+}
+
+void NvmAllocator::refill(size_t c, std::vector<uint64_t>& out) {
+    const size_t batch = std::max<size_t>(1, options_.cache_blocks / 2);
+    SizeClass& cls = classes_[c];
+    for (bool reclaimed = false;;) {
+        {
+            std::lock_guard<std::mutex> lock(cls.mutex);
+            if (!cls.free.empty()) {
+                const size_t n = std::min(batch, cls.free.size());
+                out.insert(out.end(), cls.free.end() - static_cast<std::ptrdiff_t>(n), cls.free.end());
+                cls.free.resize(cls.free.size() - n);
+                return;
+            }
+        }
+        if (!reclaimed) {
+            reclaimed = true;
+            if (reclaimOrphans()) continue;
+        }
+        break;
+    }
+
+    // Carve a fresh chunk. Its class is persisted at once: an empty slab
+    // chunk is harmless and is freed on the next open.
+    uint32_t chunk;
+    {
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        if (free_chunks_.empty()) throw util::IOException("persistent pool exhausted: " + options_.path);
+        chunk = *free_chunks_.begin();
+        free_chunks_.erase(free_chunks_.begin());
+        kinds_[chunk].store(static_cast<uint32_t>(c) + 1, std::memory_order_release);
+    }
+    *chunkState(chunk) = kStateSlab | c;
+    store_.persist(chunkState(chunk), sizeof(uint64_t));
+
+    const size_t blocks = options_.chunk_bytes / classBytes(c);
+    std::vector<uint64_t> carved(blocks);
+    for (size_t i = 0; i < blocks; ++i) carved[i] = chunkOffset(chunk) + (blocks - 1 - i) * classBytes(c);
+    const size_t n = std::min(batch, blocks);
+    out.insert(out.end(), carved.end() - static_cast<std::ptrdiff_t>(n), carved.end());
+    carved.resize(blocks - n);
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    cls.free.insert(cls.free.end(), carved.begin(), carved.end());
+}
+
+bool NvmAllocator::reclaimOrphans() {
+    std::vector<std::shared_ptr<Cache>> orphans;
+    {
+        std::lock_guard<std::mutex> lock(caches_mutex_);
+        auto dead = std::stable_partition(caches_.begin(), caches_.end(), [](const auto& cache) {
+            return !cache->orphaned.load(std::memory_order_acquire);
+        });
+        orphans.assign(std::make_move_iterator(dead), std::make_move_iterator(caches_.end()));
+        caches_.erase(dead, caches_.end());
+    }
+    bool any = false;
+    for (const auto& cache : orphans) {
+        for (size_t c = 0; c < class_count_; ++c) {
+            if (cache->blocks[c].empty()) continue;
+            std::lock_guard<std::mutex> lock(classes_[c].mutex);
+            classes_[c].free.insert(classes_[c].free.end(), cache->blocks[c].begin(), cache->blocks[c].end());
+            any = true;
+        }
+    }
+    return any;
+}
+
+uint64_t NvmAllocator::reserveRun(size_t chunks) {
+    std::lock_guard<std::mutex> lock(chunks_mutex_);
+    // First fit over consecutive free chunks
+    uint32_t first = 0;
+    size_t length = 0;
+    for (uint32_t chunk : free_chunks_) {
+        if (length > 0 && chunk == first + length) {
+            length++;
+        } else {
+            first = chunk;
+            length = 1;
+        }
+        if (length == chunks) {
+            for (uint32_t i = first; i < first + chunks; ++i) free_chunks_.erase(i);
+            kinds_[first].store(kRunKind | static_cast<uint32_t>(chunks), std::memory_order_release);
+            return chunkOffset(first);
+        }
+    }
+    throw util::IOException("persistent pool has no run of " + std::to_string(chunks) + " free chunks: " +
+                            options_.path);
+}
+
+uint64_t NvmAllocator::checkedBlock(PmemPtr<void> block) const {
+    const uint64_t offset = block.offset();
+    if (block.pool() != pool_id_ || offset < chunks_offset_ ||
+        offset >= chunks_offset_ + chunk_count_ * options_.chunk_bytes) {
+        throw util::InvalidArgumentException("pointer outside persistent pool " + options_.path);
+    }
+    const size_t chunk = chunkOf(offset);
+    const uint32_t kind = kinds_[chunk].load(std::memory_order_acquire);
+    const bool valid = (kind & kRunKind) ? offset == chunkOffset(chunk)
+                                         : kind != 0 && (offset - chunkOffset(chunk)) % classBytes(kind - 1) == 0;
+    if (!valid) throw util::InvalidArgumentException("not a block of persistent pool " + options_.path);
+    return offset;
+}
+
+size_t NvmAllocator::blockBytes(PmemPtr<void> block) const {
+    const uint32_t kind = kinds_[chunkOf(checkedBlock(block))].load(std::memory_order_acquire);
+    return (kind & kRunKind) ? (kind & ~kRunKind) * options_.chunk_bytes : classBytes(kind - 1);
+}
+
+bool NvmAllocator::allocated(PmemPtr<void> block) const {
+    const uint64_t offset = block.offset();
+    if (block.pool() != pool_id_ || offset < chunks_offset_ ||
+        offset >= chunks_offset_ + chunk_count_ * options_.chunk_bytes) {
+        return false;
+    }
+    const size_t chunk = chunkOf(offset);
+    const uint64_t state = std::atomic_ref<uint64_t>(*chunkState(chunk)).load(std::memory_order_acquire);
+    if (state & kStateRun) return offset == chunkOffset(chunk);
+    if (!(state & kStateSlab)) return false;
+    const size_t c = static_cast<size_t>(state & ~kStateSlab);
+    if (c >= class_count_ || (offset - chunkOffset(chunk)) % classBytes(c) != 0) return false;
+    const size_t index = (offset - chunkOffset(chunk)) / classBytes(c);
+    const uint64_t word = std::atomic_ref<uint64_t>(chunkBitmap(chunk)[index / 64]).load(std::memory_order_acquire);
+    return word & (uint64_t{1} << (index % 64));
+}
+
+void NvmAllocator::cancel(PmemPtr<void> block) {
+    giveBack(checkedBlock(block));
+}
+
+void NvmAllocator::giveBack(uint64_t offset) {
+    const size_t chunk = chunkOf(offset);
+    const uint32_t kind = kinds_[chunk].load(std::memory_order_acquire);
+    if (kind & kRunKind) {
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        const uint32_t length = kind & ~kRunKind;
+        kinds_[chunk].store(0, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < length; ++i) free_chunks_.insert(static_cast<uint32_t>(chunk + i));
+        return;
+    }
+    const size_t c = kind - 1;
+    std::vector<uint64_t>& cached = localCache().blocks[c];
+    if (cached.size() < options_.cache_blocks) {
+        cached.push_back(offset);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(classes_[c].mutex);
+    classes_[c].free.push_back(offset);
+}
+
+void NvmAllocator::apply(uint64_t target, uint64_t value) {
+    const uint64_t offset = target & ~kOpMask;
+    if (offset + sizeof(uint64_t) > store_.size()) {
+        throw util::IOException("persistent pool redo entry outside the pool: " + options_.path);
+    }
+    std::atomic_ref<uint64_t> word(*reinterpret_cast<uint64_t*>(base_ + offset));
+    switch (target & kOpMask) {
+        case kOpSet:
+            word.store(value, std::memory_order_relaxed);
+            break;
+        case kOpOr:
+            word.fetch_or(value, std::memory_order_relaxed);
+            break;
+        case kOpAndNot:
+            word.fetch_and(~value, std::memory_order_relaxed);
+            break;
+        default:
+            throw util::IOException("persistent pool redo entry with unknown operation: " + options_.path);
+    }
+    store_.flush(base_ + offset, sizeof(uint64_t));
+}
+
+void NvmAllocator::commit(Transaction& tx) {
+    Cache& cache = localCache();
+    Lane& lane = lanes_[cache.lane];
+    std::lock_guard<std::mutex> lock(lane.mutex);
+
+    // Announce before drawing the sequence, so a later transaction never
+    // misses this one while it is in flight
+    lane.active.store(1, std::memory_order_seq_cst);
+    const uint64_t seq = next_seq_.fetch_add(1, std::memory_order_seq_cst);
+    lane.active.store(seq, std::memory_order_seq_cst);
+
+    RedoLog* l = log(cache.lane);
+    l->count = static_cast<uint32_t>(tx.count_);
+    std::copy_n(tx.entries_.begin(), tx.count_, l->entries);
+    uint32_t crc = util::crc32c(&seq, sizeof(seq));
+    crc = util::crc32c(&l->count, sizeof(l->count), crc);
+    l->crc = util::crc32c(l->entries, tx.count_ * sizeof(Transaction::Entry), crc);
+    store_.flush(&l->crc, sizeof(l->crc) + sizeof(l->count) + tx.count_ * sizeof(Transaction::Entry));
+
+    // Commit after every earlier transaction still in flight has retired
+    // its log, so none can be replayed over this one
+    bool waited = false;
+    for (size_t i = 0; i < kLanes; ++i) {
+        if (&lanes_[i] == &lane) continue;
+        for (uint64_t other; (other = lanes_[i].active.load(std::memory_order_acquire)) != 0 && other < seq;) {
+            waited = true;
+            std::this_thread::yield();
+        }
+    }
+    store_.drain();
+    util::fault_point("pmem_logged");
+
+    std::atomic_ref<uint64_t>(l->commit).store(seq, std::memory_order_release);
+    store_.persist(&l->commit, sizeof(l->commit));
+    util::fault_point("pmem_committed");
+
+    for (size_t i = 0; i < tx.count_; ++i) apply(tx.entries_[i].target, tx.entries_[i].value);
+    store_.drain();
+    util::fault_point("pmem_applied");
+
+    std::atomic_ref<uint64_t>(l->commit).store(0, std::memory_order_release);
+    store_.persist(&l->commit, sizeof(l->commit));
+    lane.active.store(0, std::memory_order_release);
+
+    transactions_.fetch_add(1, std::memory_order_relaxed);
+    if (waited) commit_waits_.fetch_add(1, std::memory_order_relaxed);
+    for (PmemPtr<void> block : tx.published_) allocated_bytes_.fetch_add(blockBytes(block), std::memory_order_relaxed);
+    for (PmemPtr<void> block : tx.released_) {
+        allocated_bytes_.fetch_sub(blockBytes(block), std::memory_order_relaxed);
+        giveBack(block.offset());
+    }
+}
+
+PmemPtr<void>* NvmAllocator::root() const {
+    return &header()->root;
+}
+
+PmemPtr<void> NvmAllocator::toPtr(const void* addr) const {
+    const auto* p = static_cast<const std::byte*>(addr);
+    if (!p) return {};
+    if (p < base_ || p >= base_ + store_.size()) {
+        throw util::InvalidArgumentException("address outside persistent pool " + options_.path);
+    }
+    return PmemPtr<void>(pool_id_, static_cast<uint64_t>(p - base_));
+}
+
+NvmAllocator::Stats NvmAllocator::getStats() const {
+    Stats stats;
+    stats.chunks = chunk_count_;
+    {
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        stats.free_chunks = free_chunks_.size();
+    }
+    stats.allocated_bytes = allocated_bytes_.load(std::memory_order_relaxed);
+    stats.transactions = transactions_.load(std::memory_order_relaxed);
+    stats.replayed = replayed_;
+    stats.commit_waits = commit_waits_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<std::pair<std::string_view, double>> NvmAllocator::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_nvm_pool_chunks", static_cast<double>(stats.chunks)},
+        {"woved_nvm_pool_free_chunks", static_cast<double>(stats.free_chunks)},
+        {"woved_nvm_pool_allocated_bytes", static_cast<double>(stats.allocated_bytes)},
+        {"woved_nvm_transactions_total", static_cast<double>(stats.transactions)},
+        {"woved_nvm_commit_waits_total", static_cast<double>(stats.commit_waits)},
+        {"woved_nvm_redo_replayed", static_cast<double>(stats.replayed)},
+    };
+}
+
+} // namespace woved::storage
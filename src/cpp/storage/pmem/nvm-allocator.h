@@ -0,0 +1,261 @@
+#pragma once
+
+#include "storage/pmem/pmem-ptr.h"
+#include "storage/pmem/pmem-store.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved::storage {
+
+// Crash-consistent slab allocator for persistent structures on a
+// PmemStore pool (Optane, CXL memory, DAX files).
+//
+// Pool layout: a 4 KiB header (geometry, pool id, one root pointer),
+// kLanes redo logs, a chunk table holding a persistent state word and an
+// allocation bitmap per chunk, then the chunks themselves. A chunk either
+// serves one size class (powers of two from 64 bytes to a quarter chunk)
+// as equal blocks, or is part of a run of whole chunks for a larger
+// request.
+//
+// Allocation takes two steps. reserve() pops a block from the calling
+// thread's cache, touching nothing persistent, so it runs at DRAM speed;
+// a block reserved and lost to a crash is simply free again on restart.
+// A Transaction then publishes it: setting its bitmap bit and storing its
+// pointer into the structure that owns it commit together, and a free
+// clears both together. Blocks are never leaked or doubly owned.
+//
+// A transaction writes its entries to its lane's redo log, flushes them
+// with a CRC, then persists a commit word holding a global sequence
+// number, applies the entries and clears the word. Entries are word
+// stores and bit sets and clears, so replaying one twice is harmless. On
+// open, committed logs are replayed in sequence order and cleared; a log
+// whose CRC fails was never committed and is dropped whole. A transaction
+// commits only after every earlier one still in flight has cleared its
+// log, so a replayed log is never older than one already retired.
+//
+// Volatile state is rebuilt from the bitmaps on open. A slab chunk keeps
+// its class while the pool is open; chunks whose blocks are all free go
+// back to the free chunks on the next open. Threads keep up to
+// cache_blocks reserved blocks per class; a cache left by an exited thread
+// is folded back into its classes when they run dry.
+//
+// Pointers are PmemPtr offsets under the pool's id, so the pool can be
+// mapped at any address.
+class NvmAllocator {
+public:
+    static constexpr size_t kMinBlock = 64;
+    static constexpr size_t kMaxClasses = 21;  // 64 B .. 64 MiB
+    static constexpr size_t kLanes = 64;
+    static constexpr size_t kLogEntries = 62;  // Per transaction
+
+    struct Options {
+        std::string path;
+        size_t pool_bytes = 1073741824;  // 1 GiB
+        size_t chunk_bytes = 262144;     // Power of two, 64 KiB .. 256 MiB
+        size_t cache_blocks = 64;        // Per class and thread
+        bool require_pmem = false;       // Refuse a pool that is not DAX
+    };
+
+    struct Stats {
+        uint64_t chunks = 0;
+        uint64_t free_chunks = 0;
+        uint64_t allocated_bytes = 0;    // Published and not freed
+        uint64_t transactions = 0;
+        uint64_t replayed = 0;           // Redo logs replayed on open
+        uint64_t commit_waits = 0;       // Commits that waited on an earlier one
+    };
+
+    // Changes to persistent state applied together or not at all, up to
+    // kLogEntries of them. A transaction destroyed uncommitted applies
+    // nothing; blocks it would have published stay reserved.
+    class Transaction {
+    public:
+        explicit Transaction(NvmAllocator& allocator) : allocator_(allocator) {}
+
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+
+        // Mark a reserve()d block allocated
+        void publish(PmemPtr<void> block);
+        // Mark an allocated block free; it is reused after commit()
+        void release(PmemPtr<void> block);
+        // Store `value` into a word inside the pool
+        void set(uint64_t* word, uint64_t value);
+        template <typename T>
+        void set(PmemPtr<T>* field, PmemPtr<T> value) {
+            set(reinterpret_cast<uint64_t*>(field), value.raw());
+        }
+
+        // Throws util::InvalidArgumentException past kLogEntries or for a
+        // word or block outside the pool
+        void commit();
+
+    private:
+        friend class NvmAllocator;
+
+        struct Entry {
+            uint64_t target;  // Pool offset; the low bits select the operation
+            uint64_t value;
+        };
+
+        NvmAllocator& allocator_;
+        std::array<Entry, kLogEntries> entries_{};
+        size_t count_ = 0;
+        std::vector<PmemPtr<void>> published_;
+        std::vector<PmemPtr<void>> released_;
+        bool committed_ = false;
+
+        void add(uint64_t target, uint64_t value);
+    };
+
+    // Format the pool file, or open and recover it. Throws
+    // util::ConfigException if its geometry does not match `options`,
+    // util::IOException if it is not a pool or cannot be mapped.
+    explicit NvmAllocator(const Options& options);
+    ~NvmAllocator();
+
+    NvmAllocator(const NvmAllocator&) = delete;
+    NvmAllocator& operator=(const NvmAllocator&) = delete;
+
+    // A block of at least `bytes`, contents unspecified, not yet
+    // allocated persistently. Throws util::IOException when the pool is
+    // exhausted.
+    PmemPtr<void> reserve(size_t bytes);
+    template <typename T>
+    PmemPtr<T> reserve() {
+        return reserve(sizeof(T)).template cast<T>();
+    }
+
+    // Hand back a reserved block that was never published
+    void cancel(PmemPtr<void> block);
+
+    // One-step transactions: publish `block` and store it in `field`; free
+    // the block in `field` and null it
+    template <typename T>
+    void publish(PmemPtr<T> block, PmemPtr<T>* field) {
+        Transaction tx(*this);
+        tx.publish(block);
+        tx.set(field, block);
+        tx.commit();
+    }
+    template <typename T>
+    void free(PmemPtr<T>* field) {
+        Transaction tx(*this);
+        tx.release(*field);
+        tx.set(field, PmemPtr<T>());
+        tx.commit();
+    }
+
+    // Usable bytes of a block
+    size_t blockBytes(PmemPtr<void> block) const;
+
+    // Whether the pool's persistent state marks `block` allocated: its
+    // bitmap bit, or the run starting at it. False for anything else.
+    bool allocated(PmemPtr<void> block) const;
+
+    // The pool's root pointer, for finding its structures after a restart;
+    // change it through a Transaction
+    PmemPtr<void>* root() const;
+
+    PmemPtr<void> toPtr(const void* addr) const;
+    uint16_t poolId() const { return pool_id_; }
+    const PmemStore& store() const { return store_; }
+
+    Stats getStats() const;
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct PoolHeader;
+    struct RedoLog;
+
+    // Per-thread reserved blocks by class
+    struct Cache {
+        std::array<std::vector<uint64_t>, kMaxClasses> blocks;
+        size_t lane = 0;
+        std::atomic<bool> orphaned{false};
+    };
+
+    // Unreserved blocks of one class
+    struct SizeClass {
+        std::mutex mutex;
+        std::vector<uint64_t> free;
+    };
+
+    struct Lane {
+        std::mutex mutex;
+        std::atomic<uint64_t> active{0};  // Sequence of the transaction in flight
+    };
+
+    Options options_;
+    PmemStore store_;
+    std::byte* base_ = nullptr;
+    uint16_t pool_id_ = 0;
+    size_t chunk_count_ = 0;
+    size_t class_count_ = 0;
+    size_t meta_bytes_ = 0;        // Chunk table entry
+    size_t bitmap_words_ = 0;
+    uint64_t table_offset_ = 0;
+    uint64_t chunks_offset_ = 0;
+
+    std::array<SizeClass, kMaxClasses> classes_;
+    std::array<Lane, kLanes> lanes_;
+    std::atomic<uint64_t> next_seq_{2};  // 1 marks a lane taking a sequence
+
+    // Chunks: free set, and per chunk 0 (free), class + 1 (slab) or the
+    // run length with kRunKind (run head)
+    mutable std::mutex chunks_mutex_;
+    std::set<uint32_t> free_chunks_;
+    std::vector<std::atomic<uint32_t>> kinds_;
+
+    // Thread caches, keyed by instance id like MessageBuffer staging
+    static std::atomic<uint64_t> next_instance_id_;
+    const uint64_t instance_id_ = next_instance_id_.fetch_add(1);
+    std::mutex caches_mutex_;
+    std::vector<std::shared_ptr<Cache>> caches_;
+    std::atomic<size_t> next_lane_{0};
+
+    std::atomic<uint64_t> allocated_bytes_{0};
+    std::atomic<uint64_t> transactions_{0};
+    std::atomic<uint64_t> commit_waits_{0};
+    uint64_t replayed_ = 0;
+
+    static constexpr uint32_t kRunKind = 1u << 31;
+
+    PoolHeader* header() const { return reinterpret_cast<PoolHeader*>(base_); }
+    RedoLog* log(size_t lane) const;
+    uint64_t* chunkState(size_t chunk) const;
+    uint64_t* chunkBitmap(size_t chunk) const;
+    uint64_t wordOffset(const uint64_t* word) const {
+        return static_cast<uint64_t>(reinterpret_cast<const std::byte*>(word) - base_);
+    }
+    uint64_t chunkOffset(size_t chunk) const { return chunks_offset_ + chunk * options_.chunk_bytes; }
+    size_t chunkOf(uint64_t offset) const { return (offset - chunks_offset_) / options_.chunk_bytes; }
+    size_t classBytes(size_t c) const { return kMinBlock << c; }
+    size_t classOf(size_t bytes) const;
+
+    void format();
+    void load();
+    void replay();
+    void rebuild();
+
+    Cache& localCache();
+    void refill(size_t c, std::vector<uint64_t>& out);
+    bool reclaimOrphans();
+    uint64_t reserveRun(size_t chunks);
+    void giveBack(uint64_t offset);
+    uint64_t checkedBlock(PmemPtr<void> block) const;
+
+    void commit(Transaction& tx);
+    void apply(uint64_t target, uint64_t value);
+};
+
+} // namespace woved::storage
@@ -0,0 +1,21 @@
+#include "pmem-ptr.h"
+#include "util/exceptions.h"
+#include <string>
+
+namespace woved::storage {
+
+std::atomic<std::byte*> PmemPools::bases_[1 << 16];
+
+void PmemPools::add(uint16_t id, std::byte* base) {
+    if (id == 0) throw util::ConfigException("persistent pool id 0 is reserved");
+    std::byte* expected = nullptr;
+    if (!bases_[id].compare_exchange_strong(expected, base, std::memory_order_acq_rel)) {
+        throw util::ConfigException("persistent pool id " + std::to_string(id) + " is already open");
+    }
+}
+
+void PmemPools::remove(uint16_t id) {
+    bases_[id].store(nullptr, std::memory_order_release);
+}
+
+} // namespace woved::storage
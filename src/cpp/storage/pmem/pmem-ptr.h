@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace woved::storage {
+
+// Base addresses of the open persistent pools, by pool id. A pool's id is
+// chosen when it is formatted and kept in its header, so pointers stored
+// in it stay valid wherever it is mapped next. Ids are 16-bit; 0 is never
+// used.
+class PmemPools {
+public:
+    // Record where pool `id` is mapped; throws util::ConfigException if
+    // another pool with that id is open
+    static void add(uint16_t id, std::byte* base);
+    static void remove(uint16_t id);
+
+    static std::byte* base(uint16_t id) {
+        return bases_[id].load(std::memory_order_acquire);
+    }
+
+private:
+    static std::atomic<std::byte*> bases_[1 << 16];
+};
+
+// Relocatable pointer into a persistent pool: the pool id in the top 16
+// bits and the byte offset from the pool base below. Stored as is in
+// persistent memory; 0 is null. Resolving it costs one table load.
+template <typename T>
+class PmemPtr {
+public:
+    static constexpr unsigned kOffsetBits = 48;
+    static constexpr uint64_t kOffsetMask = (uint64_t{1} << kOffsetBits) - 1;
+
+    PmemPtr() = default;
+    PmemPtr(uint16_t pool, uint64_t offset) : raw_(uint64_t{pool} << kOffsetBits | offset) {}
+
+    static PmemPtr fromRaw(uint64_t raw) {
+        PmemPtr p;
+        p.raw_ = raw;
+        return p;
+    }
+
+    template <typename U>
+        requires std::is_convertible_v<T*, U*>
+    operator PmemPtr<U>() const { return PmemPtr<U>::fromRaw(raw_); }
+
+    template <typename U>
+    PmemPtr<U> cast() const { return PmemPtr<U>::fromRaw(raw_); }
+
+    uint64_t raw() const { return raw_; }
+    uint16_t pool() const { return static_cast<uint16_t>(raw_ >> kOffsetBits); }
+    uint64_t offset() const { return raw_ & kOffsetMask; }
+
+    // Null for a null pointer or a pool that is not open
+    T* get() const {
+        if (raw_ == 0) return nullptr;
+        std::byte* base = PmemPools::base(pool());
+        return base ? reinterpret_cast<T*>(base + offset()) : nullptr;
+    }
+    T* operator->() const { return get(); }
+    template <typename U = T>
+        requires(!std::is_void_v<U>)
+    U& operator*() const { return *get(); }
+
+    explicit operator bool() const { return raw_ != 0; }
+    bool operator==(const PmemPtr&) const = default;
+
+private:
+    uint64_t raw_ = 0;
+};
+
+static_assert(sizeof(PmemPtr<void>) == sizeof(uint64_t) && std::is_trivially_copyable_v<PmemPtr<void>>);
+
+} // namespace woved::storage
@@ -0,0 +1,211 @@
+#include "pmem-store.h"
+#include "util/cpu-dispatch.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef WOVED_USE_PMEM
+#include <libpmem.h>
+#endif
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t kCacheLine = 64;
+constexpr size_t kPageSize = 4096;
+
+std::string errnoMessage(const std::string& what, const std::string& path) {
+    return what + " " + path + ": " + std::strerror(errno);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("clwb"))) void writeBackClwb(uintptr_t begin, uintptr_t end) {
+    for (uintptr_t line = begin; line < end; line += kCacheLine) _mm_clwb(reinterpret_cast<void*>(line));
+}
+
+__attribute__((target("clflushopt"))) void writeBackClflushopt(uintptr_t begin, uintptr_t end) {
+    for (uintptr_t line = begin; line < end; line += kCacheLine) _mm_clflushopt(reinterpret_cast<void*>(line));
+}
+
+void writeBackClflush(uintptr_t begin, uintptr_t end) {
+    for (uintptr_t line = begin; line < end; line += kCacheLine) _mm_clflush(reinterpret_cast<void*>(line));
+}
+#endif
+
+} // namespace
+
+PmemStore::PmemStore(const Options& options) : options_(options), bytes_(options.bytes) {
+    if (bytes_ == 0) throw util::ConfigException("persistent memory pool of zero bytes: " + options_.path);
+
+    int fd = ::open(options_.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) throw util::IOException(errnoMessage("cannot open persistent memory pool", options_.path));
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw util::IOException(errnoMessage("cannot stat persistent memory pool", options_.path));
+    }
+    created_ = st.st_size == 0;
+    if (created_) {
+        // A direct pool allocates its blocks now: a DAX fault on a hole
+        // would allocate (and journal) them on the write path
+        const bool allocated = options_.direct && ::posix_fallocate(fd, 0, static_cast<off_t>(bytes_)) == 0;
+        if (!allocated && ::ftruncate(fd, static_cast<off_t>(bytes_)) != 0) {
+            ::close(fd);
+            throw util::IOException(errnoMessage("cannot size persistent memory pool", options_.path));
+        }
+    } else if (static_cast<uint64_t>(st.st_size) < bytes_) {
+        ::close(fd);
+        throw util::ConfigException("persistent memory pool " + options_.path + " is smaller than configured");
+    }
+
+#ifdef WOVED_USE_PMEM
+    if (options_.direct) {
+        ::close(fd);
+        size_t mapped = 0;
+        int is_pmem = 0;
+        void* addr = pmem_map_file(options_.path.c_str(), 0, 0, 0, &mapped, &is_pmem);
+        if (!addr) throw util::IOException("cannot map persistent memory pool " + options_.path + ": " + pmem_errormsg());
+        base_ = static_cast<std::byte*>(addr);
+        bytes_ = std::min(bytes_, mapped);
+        flush_ = is_pmem ? (pmem_has_auto_flush() == 1 ? PmemFlush::NONE : cpuFlush()) : PmemFlush::MSYNC;
+    }
+#endif
+
+    if (!base_) {
+        void* addr = MAP_FAILED;
+#if defined(MAP_SYNC) && defined(MAP_SHARED_VALIDATE)
+        if (options_.direct) {
+            addr = ::mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED_VALIDATE | MAP_SYNC, fd, 0);
+            if (addr != MAP_FAILED) flush_ = cpuFlush();
+        }
+#endif
+        if (addr == MAP_FAILED) addr = ::mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            ::close(fd);
+            throw util::IOException(errnoMessage("cannot map persistent memory pool", options_.path));
+        }
+        base_ = static_cast<std::byte*>(addr);
+        fd_ = fd;
+    }
+
+    if (options_.direct && !isPmem()) {
+        if (options_.require_pmem) {
+            unmap();
+            throw util::ConfigException("not a DAX mapping: " + options_.path);
+        }
+        LOG_WARN("MAP_SYNC unavailable for {}, persisting with msync", options_.path);
+    }
+    LOG_INFO("Persistent memory pool {} mapped: {} bytes, flush {}", options_.path, bytes_, name(flush_));
+}
+
+PmemStore::~PmemStore() {
+    unmap();
+}
+
+void PmemStore::unmap() {
+    if (!base_) return;
+#ifdef WOVED_USE_PMEM
+    if (fd_ < 0) {
+        pmem_unmap(base_, bytes_);
+        base_ = nullptr;
+        return;
+    }
+#endif
+    ::munmap(base_, bytes_);
+    ::close(fd_);
+    base_ = nullptr;
+}
+
+void PmemStore::flush(const void* addr, size_t len) const {
+    if (len == 0) return;
+#ifdef WOVED_USE_PMEM
+    if (fd_ < 0) {
+        if (flush_ == PmemFlush::MSYNC) {
+            pmem_msync(addr, len);
+        } else {
+            pmem_flush(addr, len);
+        }
+        return;
+    }
+#endif
+    switch (flush_) {
+        case PmemFlush::NONE:
+            return;
+        case PmemFlush::MSYNC: {
+            const auto begin = reinterpret_cast<uintptr_t>(addr) & ~(kPageSize - 1);
+            const auto end = reinterpret_cast<uintptr_t>(addr) + len;
+            if (::msync(reinterpret_cast<void*>(begin), end - begin, MS_SYNC) != 0) {
+                throw util::IOException(errnoMessage("msync failed for", options_.path));
+            }
+            return;
+        }
+        default:
+            break;
+    }
+#if defined(__x86_64__)
+    const auto begin = reinterpret_cast<uintptr_t>(addr) & ~(kCacheLine - 1);
+    const auto end = reinterpret_cast<uintptr_t>(addr) + len;
+    switch (flush_) {
+        case PmemFlush::CLWB:
+            writeBackClwb(begin, end);
+            break;
+        case PmemFlush::CLFLUSHOPT:
+            writeBackClflushopt(begin, end);
+            break;
+        default:
+            writeBackClflush(begin, end);
+            break;
+    }
+#endif
+}
+
+void PmemStore::drain() const {
+#ifdef WOVED_USE_PMEM
+    if (fd_ < 0) {
+        pmem_drain();
+        return;
+    }
+#endif
+#if defined(__x86_64__)
+    if (flush_ != PmemFlush::MSYNC && flush_ != PmemFlush::NONE) _mm_sfence();
+#endif
+}
+
+void PmemStore::sync() const {
+    if (::msync(base_, bytes_, MS_SYNC) != 0) {
+        LOG_ERROR("{}", errnoMessage("msync failed for", options_.path));
+    }
+}
+
+PmemFlush PmemStore::cpuFlush() {
+    const auto& cpu = util::cpu_features();
+    if (cpu.clwb) return PmemFlush::CLWB;
+    if (cpu.clflushopt) return PmemFlush::CLFLUSHOPT;
+#if defined(__x86_64__)
+    return PmemFlush::CLFLUSH;
+#else
+    return PmemFlush::MSYNC;
+#endif
+}
+
+std::string_view PmemStore::name(PmemFlush flush) {
+    switch (flush) {
+        case PmemFlush::CLWB: return "clwb";
+        case PmemFlush::CLFLUSHOPT: return "clflushopt";
+        case PmemFlush::CLFLUSH: return "clflush";
+        case PmemFlush::MSYNC: return "msync";
+        case PmemFlush::NONE: return "none (eADR)";
+    }
+    return "unknown";
+}
+
+} // namespace woved::storage
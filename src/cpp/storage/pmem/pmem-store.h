@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace woved::storage {
+
+// How stores are pushed to the persistence domain
+enum class PmemFlush : uint8_t {
+    CLWB,        // Write back, line stays cached
+    CLFLUSHOPT,  // Write back and evict, weakly ordered
+    CLFLUSH,     // Write back and evict, serialized per line
+    MSYNC,       // Not a DAX mapping: msync the covering pages
+    NONE,        // eADR: the caches are already persistent (libpmem only)
+};
+
+// A file mapped for load/store persistence: Optane DIMMs or CXL memory
+// behind a DAX mount.
+//
+// With a synchronous mapping (MAP_SYNC on a DAX file) a store is durable
+// once its cache line has been written back. flush() writes back the
+// lines of a range with the best instruction the CPU has (CLWB, else
+// CLFLUSHOPT, else CLFLUSH); drain() is one SFENCE ordering every flush
+// before it. Callers flush the pieces of a record, drain once, then
+// publish it. CLWB leaves the lines cached, so a record scanned right
+// after it is persisted still hits.
+//
+// Where MAP_SYNC is refused (no DAX, or a kernel without it) the file is
+// an ordinary shared mapping and flush() is an msync of the covering
+// pages: still durable, at page-cache speed. `direct` false skips the
+// MAP_SYNC attempt for pools that only need to survive process crashes.
+//
+// In builds with WOVED_USE_PMEM, libpmem maps the file and picks the
+// instructions, including none on eADR platforms.
+class PmemStore {
+public:
+    struct Options {
+        std::string path;
+        size_t bytes = 0;        // Mapped size; an empty file is sized to it
+        bool direct = true;      // Try a synchronous DAX mapping
+        bool require_pmem = false;  // Refuse a mapping that is not synchronous
+    };
+
+    // Create or open the file and map it. Throws util::IOException if the
+    // file cannot be opened, sized or mapped, util::ConfigException if it
+    // is smaller than `bytes` or `require_pmem` cannot be met.
+    explicit PmemStore(const Options& options);
+    ~PmemStore();
+
+    PmemStore(const PmemStore&) = delete;
+    PmemStore& operator=(const PmemStore&) = delete;
+
+    std::byte* data() const { return base_; }
+    size_t size() const { return bytes_; }
+    const std::string& path() const { return options_.path; }
+
+    // The file was empty before this mapping (contents are zero)
+    bool created() const { return created_; }
+    // Stores are durable once flushed from the CPU caches
+    bool isPmem() const { return flush_ != PmemFlush::MSYNC; }
+    PmemFlush flushKind() const { return flush_; }
+
+    // Write back [addr, addr + len); unordered until drain()
+    void flush(const void* addr, size_t len) const;
+    // Wait for every earlier flush() to reach the persistence domain
+    void drain() const;
+    void persist(const void* addr, size_t len) const {
+        flush(addr, len);
+        drain();
+    }
+
+    // msync the whole mapping (clean shutdown)
+    void sync() const;
+
+    // The cache line write-back this CPU supports best
+    static PmemFlush cpuFlush();
+    static std::string_view name(PmemFlush flush);
+
+private:
+    Options options_;
+    std::byte* base_ = nullptr;
+    size_t bytes_ = 0;
+    int fd_ = -1;          // -1 when libpmem owns the mapping
+    bool created_ = false;
+    PmemFlush flush_ = PmemFlush::MSYNC;
+
+    void unmap();
+};
+
+} // namespace woved::storage
@@ -0,0 +1,283 @@
+#include "restart-index.h"
+#include "util/file-io.h"
+
+namespace woved::storage {
+
+size_t RestartIndex::write(const std::string& path, const LatestByIdMap& map,
+                           Epoch checkpoint_epoch) {
+    static_assert(sizeof(FileHeader) == 64, "restart index header is 64 bytes");
+    static_assert(sizeof(LatestByIdMap::PackedEntry) == 24,
+                  "restart index entries are mapped in place");
+    static_assert(std::endian::native == std::endian::little,
+                  "restart index files are little endian");
+    auto start = std::chrono::steady_clock::now();
+    
+    // Durable entries only; newer ones come back from the WAL tail
+    std::vector<LatestByIdMap::PackedEntry> entries = map.snapshot();
+    Epoch oldest_buffered = kLatestEpoch;
+    for (const auto& e : entries) {
+        if (e.loc.type() == VectorLocation::BUFFER) oldest_buffered = std::min(oldest_buffered, e.loc.epoch());
+    }
+    if (oldest_buffered <= checkpoint_epoch) {
+        // Replay starts after checkpoint_epoch, so this entry would be lost
+        throw util::InvalidArgumentException("restart index at epoch " + std::to_string(checkpoint_epoch) +
+                                             " would drop an unflushed entry of epoch " +
+                                             std::to_string(oldest_buffered));
+    }
+    std::erase_if(entries, [&](const auto& e) {
+        return e.loc.type() == VectorLocation::BUFFER || e.loc.epoch() > checkpoint_epoch;
+    });
+    std::sort(entries.begin(), entries.end(),
+              [](const auto& a, const auto& b) { return a.id_hash < b.id_hash; });
+    
+    std::vector<uint32_t> ordinals;
+    for (const auto& e : entries) {
+        if (e.loc.segment() != 0) ordinals.push_back(e.loc.segment());
+    }
+    std::sort(ordinals.begin(), ordinals.end());
+    ordinals.erase(std::unique(ordinals.begin(), ordinals.end()), ordinals.end());
+    
+    std::vector<std::byte> meta;
+    for (uint32_t ordinal : ordinals) {
+        std::string name = map.segmentName(ordinal);
+        uint32_t len = static_cast<uint32_t>(name.size());
+        size_t at = meta.size();
+        meta.resize(at + sizeof(ordinal) + sizeof(len) + len);
+        std::memcpy(meta.data() + at, &ordinal, sizeof(ordinal));
+        std::memcpy(meta.data() + at + sizeof(ordinal), &len, sizeof(len));
+        std::memcpy(meta.data() + at + sizeof(ordinal) + sizeof(len), name.data(), len);
+    }
+    meta.resize((meta.size() + 7) & ~size_t{7});
+    size_t names_bytes = meta.size();
+    
+    size_t block_count = (entries.size() + kBlockEntries - 1) / kBlockEntries;
+    meta.resize(names_bytes + block_count * sizeof(uint64_t));
+    for (size_t b = 0; b < block_count; ++b) {
+        size_t first = b * kBlockEntries;
+        size_t count = std::min<size_t>(kBlockEntries, entries.size() - first);
+        uint64_t sum = XXH64(entries.data() + first, count * sizeof(entries[0]), 0);
+        std::memcpy(meta.data() + names_bytes + b * sizeof(uint64_t), &sum, sizeof(sum));
+    }
+    
+    FileHeader header{};
+    header.magic = kIndexMagic;
+    header.version = kVersion;
+    header.id_hash = static_cast<uint16_t>(util::kIdHashFunction);
+    header.block_entries = kBlockEntries;
+    header.checkpoint_epoch = checkpoint_epoch;
+    header.entry_count = entries.size();
+    header.segment_count = static_cast<uint32_t>(ordinals.size());
+    header.names_bytes = static_cast<uint32_t>(names_bytes);
+    header.created_at_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    header.meta_checksum = XXH64(meta.data(), meta.size(), 0);
+    header.header_checksum = XXH64(&header, offsetof(FileHeader, header_checksum), 0);
+    
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw util::IOException(errnoMessage("cannot create restart index", tmp));
+    }
+    try {
+        util::write_all(fd, &header, sizeof(header), tmp);
+        util::write_all(fd, meta.data(), meta.size(), tmp);
+        util::write_all(fd, entries.data(), entries.size() * sizeof(entries[0]), tmp);
+        if (::fsync(fd) != 0) {
+            throw util::IOException(errnoMessage("cannot sync restart index", tmp));
+        }
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw;
+    }
+    ::close(fd);
+    
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        throw util::IOException(errnoMessage("cannot publish restart index", path));
+    }
+    
+    // Persist the rename itself
+    util::sync_parent_directory(path);
+    
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    LOG_INFO("Restart index {} written at epoch {}: {} entries in {} ms",
+             path, checkpoint_epoch, entries.size(), elapsed.count());
+    return entries.size();
+}
+
+RestartIndex::RestartIndex(const std::string& path, bool verify_checksums)
+    : path_(path), verify_checksums_(verify_checksums) {
+    fd_ = ::open(path_.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        throw util::IOException(errnoMessage("cannot open restart index", path_));
+    }
+    
+    struct stat st {};
+    if (::fstat(fd_, &st) != 0) {
+        ::close(fd_);
+        throw util::IOException(errnoMessage("cannot stat restart index", path_));
+    }
+    mapped_bytes_ = static_cast<size_t>(st.st_size);
+    if (mapped_bytes_ < sizeof(FileHeader)) {
+        ::close(fd_);
+        throw util::IOException("truncated restart index: " + path_);
+    }
+    
+    void* addr = ::mmap(nullptr, mapped_bytes_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+        ::close(fd_);
+        throw util::IOException(errnoMessage("cannot map restart index", path_));
+    }
+    base_ = static_cast<const std::byte*>(addr);
+    
+    try {
+        parse();
+    } catch (...) {
+        ::munmap(const_cast<std::byte*>(base_), mapped_bytes_);
+        ::close(fd_);
+        throw;
+    }
+    
+    // Lookups before loadInto() are point reads
+    ::madvise(const_cast<std::byte*>(base_), mapped_bytes_, MADV_RANDOM);
+    LOG_INFO("Restart index {} opened: {} entries at epoch {}",
+             path_, entry_count_, checkpoint_epoch_);
+}
+
+RestartIndex::~RestartIndex() {
+    ::munmap(const_cast<std::byte*>(base_), mapped_bytes_);
+    ::close(fd_);
+}
+
+void RestartIndex::parse() {
+    FileHeader header;
+    std::memcpy(&header, base_, sizeof(header));
+    if (header.magic != kIndexMagic) {
+        throw util::IOException("not a restart index: " + path_);
+    }
+    if (header.version != 1 && header.version != kVersion) {
+        throw util::IOException("unsupported restart index version " +
+                                std::to_string(header.version) + ": " + path_);
+    }
+    if (header.header_checksum != XXH64(&header, offsetof(FileHeader, header_checksum), 0)) {
+        throw util::IOException("restart index header checksum mismatch: " + path_);
+    }
+    const auto id_hash = header.id_hash == 0 ? util::IdHashFunction::kXxh64
+                                             : static_cast<util::IdHashFunction>(header.id_hash);
+    if (id_hash != util::kIdHashFunction) {
+        throw util::IOException(std::string("restart index hashes ids with ") + util::id_hash_name(id_hash) +
+                                ", not " + util::id_hash_name(util::kIdHashFunction) + ": " + path_);
+    }
+    if (header.block_entries == 0) {
+        throw util::IOException("restart index has no block size: " + path_);
+    }
+    
+    entry_count_ = header.entry_count;
+    checkpoint_epoch_ = header.checkpoint_epoch;
+    block_count_ = (entry_count_ + header.block_entries - 1) / header.block_entries;
+    
+    size_t meta_bytes = header.names_bytes + block_count_ * sizeof(uint64_t);
+    size_t expected = sizeof(FileHeader) + meta_bytes +
+                      entry_count_ * sizeof(LatestByIdMap::PackedEntry);
+    if (mapped_bytes_ != expected || header.block_entries != kBlockEntries) {
+        throw util::IOException("restart index size does not match header: " + path_);
+    }
+    
+    const std::byte* meta = base_ + sizeof(FileHeader);
+    if (header.meta_checksum != XXH64(meta, meta_bytes, 0)) {
+        throw util::IOException("restart index metadata checksum mismatch: " + path_);
+    }
+    
+    const std::byte* names_end = meta + header.names_bytes;
+    for (uint32_t i = 0; i < header.segment_count; ++i) {
+        uint32_t ordinal, len;
+        if (meta + sizeof(ordinal) + sizeof(len) > names_end) {
+            throw util::IOException("restart index segment table truncated: " + path_);
+        }
+        std::memcpy(&ordinal, meta, sizeof(ordinal));
+        std::memcpy(&len, meta + sizeof(ordinal), sizeof(len));
+        meta += sizeof(ordinal) + sizeof(len);
+        if (meta + len > names_end) {
+            throw util::IOException("restart index segment table truncated: " + path_);
+        }
+        segments_.emplace_back(ordinal, std::string(reinterpret_cast<const char*>(meta), len));
+        meta += len;
+    }
+    
+    block_sums_ = reinterpret_cast<const uint64_t*>(names_end);
+    entries_ = reinterpret_cast<const LatestByIdMap::PackedEntry*>(
+        names_end + block_count_ * sizeof(uint64_t));
+    block_state_ = std::make_unique<std::atomic<uint8_t>[]>(block_count_);
+}
+
+void RestartIndex::verifyBlock(size_t block) const {
+    if (!verify_checksums_) return;
+    
+    uint8_t state = block_state_[block].load(std::memory_order_acquire);
+    if (state == kUnchecked) {
+        size_t first = block * kBlockEntries;
+        size_t count = std::min<size_t>(kBlockEntries, entry_count_ - first);
+        bool ok = XXH64(entries_ + first, count * sizeof(entries_[0]), 0) == block_sums_[block];
+        state = ok ? kVerified : kCorrupt;
+        block_state_[block].store(state, std::memory_order_release);
+    }
+    if (state == kCorrupt) {
+        throw util::IOException("restart index block " + std::to_string(block) +
+                                " checksum mismatch: " + path_);
+    }
+}
+
+std::optional<PackedLocation> RestartIndex::lookup(VectorIdHash id_hash) const {
+    const auto* end = entries_ + entry_count_;
+    const auto* it = std::lower_bound(entries_, end, id_hash,
+                                      [](const auto& e, VectorIdHash h) { return e.id_hash < h; });
+    if (it == end) {
+        return std::nullopt;
+    }
+    
+    verifyBlock(static_cast<size_t>(it - entries_) / kBlockEntries);
+    if (it->id_hash != id_hash) {
+        return std::nullopt;
+    }
+    return it->loc;
+}
+
+void RestartIndex::loadInto(LatestByIdMap& map, size_t threads) const {
+    threads = std::clamp<size_t>(threads, 1, std::max<size_t>(1, block_count_));
+    ::madvise(const_cast<std::byte*>(base_), mapped_bytes_, MADV_SEQUENTIAL);
+    
+    // Verify every block up front so a corrupt file never half-loads
+    std::atomic<size_t> next_block{0};
+    std::vector<std::exception_ptr> errors(threads);
+    auto verify = [&](size_t w) {
+        try {
+            for (size_t b; (b = next_block.fetch_add(1)) < block_count_;) {
+                verifyBlock(b);
+            }
+        } catch (...) {
+            errors[w] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t w = 1; w < threads; ++w) {
+        workers.emplace_back(verify, w);
+    }
+    verify(0);
+    for (auto& worker : workers) worker.join();
+    for (auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+    
+    for (const auto& [ordinal, name] : segments_) {
+        map.registerSegment(ordinal, name);
+    }
+    map.restore({entries_, entry_count_}, threads);
+}
+
+std::string RestartIndex::errnoMessage(const std::string& what, const std::string& path) {
+    return what + " " + path + ": " + std::strerror(errno);
+}
+
+} // namespace woved::storage
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "storage/latest-by-id.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include "xxhash.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace woved::storage {
+
+// Checkpointed image of LatestByIdMap, so a restart replays only the WAL
+// tail after the checkpoint epoch instead of scanning every segment.
+//
+// File layout (little endian, 8-byte aligned sections):
+//   header        64 bytes: magic, version, id hash function, geometry,
+//                 checkpoint epoch and checksums of the header and of the
+//                 two metadata sections
+//   segment names {ordinal, length, bytes} per referenced segment
+//   block sums    XXH64 of each block of kBlockEntries entries
+//   entries       PackedEntry records (hash, packed location) sorted by hash
+//
+// A checkpoint holds the durable entries at or below its epoch: segment
+// locations and tombstones. Buffer locations are left to WAL replay, which
+// restarts after the checkpoint epoch (Recovery), so that epoch must be
+// below every buffered entry of the map: write() refuses one that is not.
+// Files are written to a temporary name and renamed into place.
+//
+// Entries are keyed by id hash, so the header records the function that
+// made them (util::IdHashFunction; version 1 files predate the field and
+// used XXH64). A checkpoint made with a function other than
+// util::kIdHashFunction is refused like a corrupt one, and the map is
+// rebuilt from the segments instead.
+//
+// Readers map the file and can answer lookups straight from the mapping
+// while loadInto() populates the map; entry blocks are checksummed on first
+// use, so opening is O(metadata) regardless of entry count.
+class RestartIndex {
+public:
+    static constexpr uint16_t kVersion = 2;
+    static constexpr uint32_t kBlockEntries = 65536;
+    
+    // Write a checkpoint of `map` taken at `checkpoint_epoch` to `path`;
+    // returns the number of entries written. Throws InvalidArgumentException
+    // if a buffer location of the map is at or below `checkpoint_epoch`.
+    static size_t write(const std::string& path, const LatestByIdMap& map,
+                        Epoch checkpoint_epoch);
+    
+    // Map and validate a checkpoint; throws IOException if it is corrupt
+    explicit RestartIndex(const std::string& path, bool verify_checksums = true);
+    ~RestartIndex();
+    
+    RestartIndex(const RestartIndex&) = delete;
+    RestartIndex& operator=(const RestartIndex&) = delete;
+    
+    Epoch checkpointEpoch() const { return checkpoint_epoch_; }
+    size_t size() const { return entry_count_; }
+    const std::vector<std::pair<uint32_t, std::string>>& segments() const { return segments_; }
+    
+    // Binary search of the mapped entries (thread-safe)
+    std::optional<PackedLocation> lookup(VectorIdHash id_hash) const;
+    
+    // Register segment ordinals and bulk-load every entry into `map`
+    void loadInto(LatestByIdMap& map, size_t threads = 1) const;
+
+private:
+    static constexpr uint64_t kIndexMagic = 0x5849524445564f57ULL;  // "WOVEDRIX"
+    
+    struct FileHeader {
+        uint64_t magic;
+        uint16_t version;
+        uint16_t id_hash;          // util::IdHashFunction; 0 in version 1
+        uint32_t block_entries;
+        uint64_t checkpoint_epoch;
+        uint64_t entry_count;
+        uint32_t segment_count;
+        uint32_t names_bytes;      // Padded to 8
+        uint64_t created_at_us;
+        uint64_t meta_checksum;    // Segment names + block sums
+        uint64_t header_checksum;  // Every field above
+    };
+    
+    enum : uint8_t { kUnchecked = 0, kVerified = 1, kCorrupt = 2 };
+    
+    std::string path_;
+    bool verify_checksums_;
+    int fd_ = -1;
+    const std::byte* base_ = nullptr;
+    size_t mapped_bytes_ = 0;
+    
+    Epoch checkpoint_epoch_ = 0;
+    size_t entry_count_ = 0;
+    const LatestByIdMap::PackedEntry* entries_ = nullptr;
+    const uint64_t* block_sums_ = nullptr;
+    size_t block_count_ = 0;
+    std::unique_ptr<std::atomic<uint8_t>[]> block_state_;
+    std::vector<std::pair<uint32_t, std::string>> segments_;
+    
+    void parse();
+    void verifyBlock(size_t block) const;
+    
+    static std::string errnoMessage(const std::string& what, const std::string& path);
+};
+
+} // namespace woved::storage
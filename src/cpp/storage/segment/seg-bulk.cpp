@@ -0,0 +1,681 @@
+#include "seg-bulk.h"
+#include "core/config.h"
+#include "index/centroids-manager.h"
+#include "index/ivf-pq.h"
+#include "storage/segment/seg-placement.h"
+#include "util/exceptions.h"
+#include "util/hash.h"
+#include "util/logging.h"
+#include "util/thread-pool.h"
+#include "util/uuid-v7.h"
+#include "util/vector-codec.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace woved::storage {
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little, "vector files are read in place as little endian");
+
+constexpr uint64_t kKMeansSeed = 0x5eed;
+constexpr size_t kIdStride = 4096;       // Rows between indexed line starts of an id file
+constexpr size_t kIndexChunk = 65536;    // Map updates per upsertBatch()
+
+std::string errnoMessage(const std::string& what, const std::string& path) {
+    return what + " " + path + ": " + std::strerror(errno);
+}
+
+bool endsWith(std::string_view s, std::string_view suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+void checkCancel(const std::atomic<bool>* cancel) {
+    if (cancel && cancel->load(std::memory_order_relaxed)) {
+        throw util::WovedException("Bulk import cancelled");
+    }
+}
+
+// One input file of rows, read with positioned reads from any thread
+class VectorFile {
+public:
+    explicit VectorFile(const std::string& path) : path_(path) {
+        if (endsWith(path, ".parquet")) {
+            throw util::InvalidArgumentException("Bulk import: " + path +
+                                                 ": Parquet input is not supported; convert it to .npy or .fvecs");
+        }
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) throw util::InvalidArgumentException(errnoMessage("Bulk import: cannot open", path));
+        try {
+            struct stat st {};
+            if (::fstat(fd_, &st) != 0) throw util::IOException(errnoMessage("Bulk import: cannot stat", path));
+            const uint64_t size = static_cast<uint64_t>(st.st_size);
+            if (endsWith(path, ".fvecs") || endsWith(path, ".bvecs")) {
+                openVecs(size, endsWith(path, ".fvecs") ? Element::F32 : Element::U8);
+            } else if (endsWith(path, ".npy")) {
+                openNpy(size);
+            } else {
+                throw util::InvalidArgumentException("Bulk import: " + path +
+                                                     ": unknown format (expected .fvecs, .bvecs or .npy)");
+            }
+        } catch (...) {
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    ~VectorFile() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    VectorFile(const VectorFile&) = delete;
+    VectorFile& operator=(const VectorFile&) = delete;
+
+    const std::string& path() const { return path_; }
+    uint64_t rows() const { return rows_; }
+    uint32_t dim() const { return dim_; }
+
+    // Rows [first, first + count) as float32, dim() per row, into `out`
+    void read(uint64_t first, size_t count, float* out) const {
+        const size_t bytes = count * row_bytes_;
+        const uint64_t offset = data_offset_ + first * row_bytes_;
+        if (element_ == Element::F32 && prefix_ == 0) {
+            readAt(out, bytes, offset);
+            return;
+        }
+        thread_local std::vector<std::byte> scratch;
+        scratch.resize(bytes);
+        readAt(scratch.data(), bytes, offset);
+        const size_t element_bytes = elementBytes(element_);
+        for (size_t r = 0; r < count; ++r) {
+            const std::byte* row = scratch.data() + r * row_bytes_;
+            if (prefix_ != 0) {
+                int32_t dim = 0;
+                std::memcpy(&dim, row, sizeof(dim));
+                if (dim != static_cast<int32_t>(dim_)) {
+                    throw util::InvalidArgumentException("Bulk import: " + path_ + ": row " +
+                                                         std::to_string(first + r) + " has dimension " +
+                                                         std::to_string(dim) + ", expected " + std::to_string(dim_));
+                }
+                row += prefix_;
+            }
+            float* dst = out + r * dim_;
+            switch (element_) {
+                case Element::F32:
+                    std::memcpy(dst, row, dim_ * element_bytes);
+                    break;
+                case Element::F16:
+                    util::decode_vector(row, dim_, ElementType::FP16, 1.0f, dst);
+                    break;
+                case Element::F64:
+                    for (uint32_t i = 0; i < dim_; ++i) {
+                        double v;
+                        std::memcpy(&v, row + i * sizeof(double), sizeof(double));
+                        dst[i] = static_cast<float>(v);
+                    }
+                    break;
+                case Element::U8:
+                    for (uint32_t i = 0; i < dim_; ++i) dst[i] = static_cast<float>(std::to_integer<uint8_t>(row[i]));
+                    break;
+            }
+        }
+    }
+
+private:
+    enum class Element : uint8_t { F32, F16, F64, U8 };
+
+    std::string path_;
+    int fd_ = -1;
+    Element element_ = Element::F32;
+    uint32_t dim_ = 0;
+    uint64_t rows_ = 0;
+    uint64_t data_offset_ = 0;
+    size_t prefix_ = 0;     // Per-row dimension prefix of the .vecs formats
+    size_t row_bytes_ = 0;
+
+    static size_t elementBytes(Element element) {
+        switch (element) {
+            case Element::F32: return 4;
+            case Element::F16: return 2;
+            case Element::F64: return 8;
+            case Element::U8: return 1;
+        }
+        return 4;
+    }
+
+    void readAt(void* out, size_t bytes, uint64_t offset) const {
+        auto* p = static_cast<char*>(out);
+        while (bytes > 0) {
+            const ssize_t n = ::pread(fd_, p, bytes, static_cast<off_t>(offset));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw util::IOException(errnoMessage("Bulk import: cannot read", path_));
+            }
+            if (n == 0) throw util::InvalidArgumentException("Bulk import: " + path_ + ": truncated");
+            p += n;
+            offset += static_cast<uint64_t>(n);
+            bytes -= static_cast<size_t>(n);
+        }
+    }
+
+    void openVecs(uint64_t size, Element element) {
+        element_ = element;
+        prefix_ = sizeof(int32_t);
+        if (size == 0) return;
+        int32_t dim = 0;
+        readAt(&dim, sizeof(dim), 0);
+        if (dim <= 0) throw util::InvalidArgumentException("Bulk import: " + path_ + ": bad dimension");
+        dim_ = static_cast<uint32_t>(dim);
+        row_bytes_ = prefix_ + dim_ * elementBytes(element);
+        if (size % row_bytes_ != 0) {
+            throw util::InvalidArgumentException("Bulk import: " + path_ + ": size is not a whole number of rows");
+        }
+        rows_ = size / row_bytes_;
+    }
+
+    // NPY format 1.0 to 3.0: magic, version, header length, then a Python
+    // dict literal with descr, fortran_order and shape
+    void openNpy(uint64_t size) {
+        char magic[12] = {};
+        if (size < sizeof(magic)) throw util::InvalidArgumentException("Bulk import: " + path_ + ": not an .npy file");
+        readAt(magic, sizeof(magic), 0);
+        if (std::memcmp(magic, "\x93NUMPY", 6) != 0) {
+            throw util::InvalidArgumentException("Bulk import: " + path_ + ": not an .npy file");
+        }
+        uint64_t header_len = 0;
+        uint64_t header_start = 0;
+        if (magic[6] == 1) {
+            uint16_t len;
+            std::memcpy(&len, magic + 8, sizeof(len));
+            header_len = len;
+            header_start = 10;
+        } else {
+            uint32_t len;
+            std::memcpy(&len, magic + 8, sizeof(len));
+            header_len = len;
+            header_start = 12;
+        }
+        if (header_start + header_len > size) throw util::InvalidArgumentException("Bulk import: " + path_ + ": truncated");
+        std::string header(header_len, '\0');
+        readAt(header.data(), header_len, header_start);
+
+        const std::string descr = dictString(header, "descr");
+        if (descr == "<f4") {
+            element_ = Element::F32;
+        } else if (descr == "<f2") {
+            element_ = Element::F16;
+        } else if (descr == "<f8") {
+            element_ = Element::F64;
+        } else if (descr == "|u1") {
+            element_ = Element::U8;
+        } else {
+            throw util::InvalidArgumentException("Bulk import: " + path_ + ": unsupported dtype " + descr);
+        }
+        if (header.find("'fortran_order': True") != std::string::npos) {
+            throw util::InvalidArgumentException("Bulk import: " + path_ + ": Fortran-order arrays are not supported");
+        }
+        const std::vector<uint64_t> shape = dictShape(header);
+        if (shape.size() != 2 || shape[1] == 0 || shape[1] > std::numeric_limits<uint32_t>::max()) {
+            throw util::InvalidArgumentException("Bulk import: " + path_ + ": expected a 2-D (rows, dim) array");
+        }
+        rows_ = shape[0];
+        dim_ = static_cast<uint32_t>(shape[1]);
+        row_bytes_ = dim_ * elementBytes(element_);
+        data_offset_ = header_start + header_len;
+        if (data_offset_ + rows_ * row_bytes_ > size) {
+            throw util::InvalidArgumentException("Bulk import: " + path_ + ": truncated");
+        }
+    }
+
+    std::string dictString(const std::string& header, const std::string& key) const {
+        size_t pos = header.find("'" + key + "'");
+        if (pos != std::string::npos) pos = header.find('\'', header.find(':', pos));
+        const size_t end = pos == std::string::npos ? pos : header.find('\'', pos + 1);
+        if (end == std::string::npos) throw util::InvalidArgumentException("Bulk import: " + path_ + ": no " + key);
+        return header.substr(pos + 1, end - pos - 1);
+    }
+
+    std::vector<uint64_t> dictShape(const std::string& header) const {
+        std::vector<uint64_t> shape;
+        size_t pos = header.find("'shape'");
+        if (pos != std::string::npos) pos = header.find('(', pos);
+        const size_t end = pos == std::string::npos ? pos : header.find(')', pos);
+        if (end == std::string::npos) throw util::InvalidArgumentException("Bulk import: " + path_ + ": no shape");
+        const char* p = header.data() + pos + 1;
+        const char* last = header.data() + end;
+        while (p < last) {
+            while (p < last && (*p == ' ' || *p == ',')) ++p;
+            if (p == last) break;
+            uint64_t v = 0;
+            auto [next, ec] = std::from_chars(p, last, v);
+            if (ec != std::errc()) throw util::InvalidArgumentException("Bulk import: " + path_ + ": bad shape");
+            shape.push_back(v);
+            p = next;
+        }
+        return shape;
+    }
+};
+
+// The inputs as one sequence of rows
+class RowSource {
+public:
+    RowSource(const std::vector<std::string>& paths, uint32_t dim) {
+        for (const std::string& path : paths) {
+            auto file = std::make_unique<VectorFile>(path);
+            if (file->rows() == 0) continue;
+            if (file->dim() != dim) {
+                throw util::InvalidArgumentException("Bulk import: " + path + " has dimension " +
+                                                     std::to_string(file->dim()) + ", the collection " +
+                                                     std::to_string(dim));
+            }
+            starts_.push_back(rows_);
+            rows_ += file->rows();
+            files_.push_back(std::move(file));
+        }
+    }
+
+    uint64_t rows() const { return rows_; }
+
+    void read(uint64_t first, size_t count, float* out, uint32_t dim) const {
+        size_t f = std::upper_bound(starts_.begin(), starts_.end(), first) - starts_.begin() - 1;
+        while (count > 0) {
+            const uint64_t local = first - starts_[f];
+            const size_t n = static_cast<size_t>(std::min<uint64_t>(count, files_[f]->rows() - local));
+            files_[f]->read(local, n, out);
+            out += n * dim;
+            first += n;
+            count -= n;
+            ++f;
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<VectorFile>> files_;
+    std::vector<uint64_t> starts_;
+    uint64_t rows_ = 0;
+};
+
+// A mapped text file of ids, one per line; the start of every
+// kIdStride-th line is indexed so any row is found with a short scan
+class IdFile {
+public:
+    explicit IdFile(const std::string& path) : path_(path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw util::InvalidArgumentException(errnoMessage("Bulk import: cannot open", path));
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw util::IOException(errnoMessage("Bulk import: cannot stat", path));
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* base = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED) {
+                ::close(fd);
+                throw util::IOException(errnoMessage("Bulk import: cannot map", path));
+            }
+            data_ = static_cast<const char*>(base);
+            ::madvise(base, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+
+        size_t pos = 0;
+        while (pos < size_) {
+            if (lines_ % kIdStride == 0) index_.push_back(pos);
+            const void* nl = std::memchr(data_ + pos, '\n', size_ - pos);
+            pos = nl ? static_cast<size_t>(static_cast<const char*>(nl) - data_) + 1 : size_;
+            lines_++;
+        }
+    }
+
+    ~IdFile() {
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    IdFile(const IdFile&) = delete;
+    IdFile& operator=(const IdFile&) = delete;
+
+    uint64_t lines() const { return lines_; }
+
+    // Lines [first, first + count), without line endings, into `out`
+    void read(uint64_t first, size_t count, std::string_view* out) const {
+        size_t pos = index_[first / kIdStride];
+        for (uint64_t skip = first % kIdStride; skip > 0; --skip) pos = next(pos);
+        for (size_t i = 0; i < count; ++i) {
+            const size_t end = next(pos);
+            size_t len = end - pos;
+            if (len > 0 && data_[pos + len - 1] == '\n') --len;
+            if (len > 0 && data_[pos + len - 1] == '\r') --len;
+            if (len == 0) {
+                throw util::InvalidArgumentException("Bulk import: " + path_ + ": empty id on line " +
+                                                     std::to_string(first + i + 1));
+            }
+            out[i] = std::string_view(data_ + pos, len);
+            pos = end;
+        }
+    }
+
+private:
+    std::string path_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    uint64_t lines_ = 0;
+    std::vector<size_t> index_;
+
+    size_t next(size_t pos) const {
+        const void* nl = std::memchr(data_ + pos, '\n', size_ - pos);
+        return nl ? static_cast<size_t>(static_cast<const char*>(nl) - data_) + 1 : size_;
+    }
+};
+
+void normalizeRow(float* x, size_t dim) {
+    float norm_sqr = 0;
+    for (size_t i = 0; i < dim; ++i) norm_sqr += x[i] * x[i];
+    if (norm_sqr <= 0) return;
+    const float inv = 1.0f / std::sqrt(norm_sqr);
+    for (size_t i = 0; i < dim; ++i) x[i] *= inv;
+}
+
+// Id map entries of one written segment
+template <typename Segment>
+void indexSegment(LatestByIdMap& map, const Segment& segment, uint32_t ordinal, Epoch epoch, bool string_ids) {
+    std::span<const VectorIdHash> hashes = segment.idHashes();
+    RowColumns columns;
+    if (string_ids) columns = segment.readRows();
+    std::vector<LatestByIdMap::HashedLocation> updates;
+    std::vector<VectorId> ids;
+    for (size_t first = 0; first < hashes.size(); first += kIndexChunk) {
+        const size_t n = std::min(kIndexChunk, hashes.size() - first);
+        updates.clear();
+        ids.clear();
+        if (string_ids) {
+            ids.reserve(n);
+            for (size_t i = 0; i < n; ++i) ids.emplace_back(columns.id(first + i));
+        }
+        for (size_t i = 0; i < n; ++i) {
+            VectorLocation location;
+            location.type = VectorLocation::SEGMENT;
+            location.segment_ordinal = ordinal;
+            location.local_id = static_cast<uint32_t>(first + i);
+            location.timestamp = Timestamp{0};
+            location.epoch = epoch;
+            updates.push_back({hashes[first + i], std::move(location), string_ids ? &ids[i] : nullptr});
+        }
+        map.upsertBatch(updates);
+    }
+}
+
+} // namespace
+
+BulkLoader::Options BulkLoader::Options::fromConfig(const Config& config) {
+    Options options;
+    options.dim = config.collection.dim;
+    options.uuid_ids = config.collection.id_type == "uuidv7";
+    options.normalize = util::parse_metric(config.collection.metric) == Metric::INNER_PRODUCT;
+    options.centroids = std::clamp<uint32_t>(config.index.global.nlist, 1, std::numeric_limits<CentroidId>::max());
+    options.segment_rows = std::clamp<uint64_t>(config.storage.segment.target_size_vectors, 1,
+                                                std::numeric_limits<uint32_t>::max());
+    options.delta = DeltaSegmentWriter::Options::fromConfig(config);
+    options.stable = StableSegmentBuilder::Options::fromConfig(config);
+    return options;
+}
+
+BulkLoader::BulkLoader(const Options& options, index::CentroidsManager& centroids, SegmentPlacement& placement,
+                       util::ThreadPool& pool, std::shared_ptr<LatestByIdMap> latest_by_id, EpochFn epoch,
+                       InstallFn install, CheckpointFn checkpoint)
+    : options_(options),
+      centroids_(centroids),
+      placement_(placement),
+      pool_(pool),
+      latest_by_id_(std::move(latest_by_id)),
+      epoch_(std::move(epoch)),
+      install_(std::move(install)),
+      checkpoint_(std::move(checkpoint)) {
+    options_.segment_rows = std::clamp<uint64_t>(options_.segment_rows, 1, std::numeric_limits<uint32_t>::max());
+    options_.parallel_segments = std::max<size_t>(1, options_.parallel_segments);
+    options_.block_rows = std::max<size_t>(1, options_.block_rows);
+    options_.centroids = std::clamp<uint32_t>(options_.centroids, 1, std::numeric_limits<CentroidId>::max());
+    options_.delta.dim = options_.dim;
+    options_.stable.dim = options_.dim;
+}
+
+BulkLoader::Result BulkLoader::run(const Request& request, const std::atomic<bool>* cancel) {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    const auto start = std::chrono::steady_clock::now();
+    const size_t dim = options_.dim;
+    Result result;
+
+    std::mutex files_mutex;
+    std::vector<std::string> files;  // Written so far, removed on failure
+    auto track = [&](const std::string& path) {
+        placement_.added(path);
+        std::lock_guard<std::mutex> lock(files_mutex);
+        files.push_back(path);
+    };
+    auto untrack = [&](const std::string& path) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        placement_.removed(path);
+        std::lock_guard<std::mutex> lock(files_mutex);
+        std::erase(files, path);
+    };
+
+    try {
+        if (request.files.empty()) throw util::InvalidArgumentException("Bulk import: no input files");
+        const RowSource source(request.files, options_.dim);
+        std::unique_ptr<IdFile> id_file;
+        if (!request.ids_file.empty()) {
+            id_file = std::make_unique<IdFile>(request.ids_file);
+            if (id_file->lines() != source.rows()) {
+                throw util::InvalidArgumentException("Bulk import: " + request.ids_file + " has " +
+                                                     std::to_string(id_file->lines()) + " ids for " +
+                                                     std::to_string(source.rows()) + " rows");
+            }
+        } else if (!options_.uuid_ids) {
+            throw util::InvalidArgumentException("Bulk import: string id collections need an ids file");
+        }
+        result.rows = source.rows();
+        if (result.rows == 0) throw util::InvalidArgumentException("Bulk import: the inputs hold no rows");
+
+        // Centroids from a uniform sample, unless the collection has them
+        DeltaSegmentWriter::Options delta = options_.delta;
+        if (request.train || centroids_.version() == 0) {
+            const size_t n = static_cast<size_t>(std::min<uint64_t>(options_.train_sample, result.rows));
+            std::vector<float> sample(n * dim);
+            const size_t blocks = (n + options_.block_rows - 1) / options_.block_rows;
+            pool_.parallelFor(blocks, [&](size_t b) {
+                checkCancel(cancel);
+                const size_t end = std::min(n, (b + 1) * options_.block_rows);
+                for (size_t i = b * options_.block_rows; i < end; ++i) {
+                    const uint64_t row = static_cast<uint64_t>(static_cast<double>(i) * result.rows / n);
+                    source.read(row, 1, sample.data() + i * dim, options_.dim);
+                    if (options_.normalize) normalizeRow(sample.data() + i * dim, dim);
+                }
+            }, util::ThreadPool::Priority::Background);
+            std::vector<float> trained(size_t{options_.centroids} * dim);
+            index::trainKMeans(sample.data(), n, dim, options_.centroids, options_.kmeans_iterations, kKMeansSeed,
+                               trained.data());
+            checkCancel(cancel);
+            delta.centroid_version = centroids_.install(trained, options_.dim);
+            result.trained = true;
+        } else {
+            delta.centroid_version = centroids_.version();
+        }
+
+        result.epoch = epoch_();
+        const std::string prefix = "bulk-" + std::to_string(result.epoch) + "-";
+        const uint64_t segments = (result.rows + options_.segment_rows - 1) / options_.segment_rows;
+        result.segments.resize(segments);
+
+        // parallel_segments workers take segments in turn; each segment's
+        // blocks are read and assigned across the pool
+        std::atomic<uint64_t> next{0};
+        const size_t workers = static_cast<size_t>(std::min<uint64_t>(options_.parallel_segments, segments));
+        pool_.parallelFor(workers, [&](size_t) {
+            std::vector<float> vectors;
+            std::vector<CentroidId> lists;
+            std::vector<VectorIdHash> hashes;
+            std::vector<VectorUuid> uuids;
+            std::vector<std::string_view> ids;
+            std::vector<DeltaRow> rows;
+            for (uint64_t s; (s = next.fetch_add(1)) < segments;) {
+                checkCancel(cancel);
+                const uint64_t first = s * options_.segment_rows;
+                const size_t n = static_cast<size_t>(std::min<uint64_t>(options_.segment_rows, result.rows - first));
+                vectors.resize(n * dim);
+                lists.resize(n);
+                hashes.resize(n);
+                uuids.assign(options_.uuid_ids ? n : 0, VectorUuid{});
+                ids.assign(id_file ? n : 0, std::string_view());
+
+                const size_t blocks = (n + options_.block_rows - 1) / options_.block_rows;
+                pool_.parallelFor(blocks, [&](size_t b) {
+                    checkCancel(cancel);
+                    const size_t lo = b * options_.block_rows;
+                    const size_t count = std::min(options_.block_rows, n - lo);
+                    float* block = vectors.data() + lo * dim;
+                    source.read(first + lo, count, block, options_.dim);
+                    std::vector<const float*> ptrs(count);
+                    for (size_t i = 0; i < count; ++i) ptrs[i] = block + i * dim;
+                    centroids_.assignBatch(ptrs, options_.dim, options_.normalize, block, lists.data() + lo);
+
+                    std::span<VectorUuid> block_uuids;
+                    if (options_.uuid_ids) block_uuids = std::span(uuids).subspan(lo, count);
+                    if (id_file) {
+                        id_file->read(first + lo, count, ids.data() + lo);
+                        for (size_t i = 0; i < count; ++i) {
+                            if (!options_.uuid_ids) {
+                                hashes[lo + i] = util::hash_id(ids[lo + i]);
+                                continue;
+                            }
+                            auto uuid = util::parse_uuid(ids[lo + i]);
+                            if (!uuid) {
+                                throw util::InvalidArgumentException("Bulk import: " + request.ids_file + ": line " +
+                                                                     std::to_string(first + lo + i + 1) +
+                                                                     " is not a UUID");
+                            }
+                            block_uuids[i] = *uuid;
+                        }
+                    } else {
+                        util::UuidV7Generator::local().generateBatch(block_uuids);
+                    }
+                    if (options_.uuid_ids) util::hash_uuids(block_uuids, std::span(hashes).subspan(lo, count));
+                }, util::ThreadPool::Priority::Background);
+
+                rows.resize(n);
+                for (size_t i = 0; i < n; ++i) {
+                    DeltaRow& row = rows[i];
+                    row.id_hash = hashes[i];
+                    row.epoch = result.epoch;
+                    row.centroid_id = lists[i];
+                    if (options_.uuid_ids) {
+                        row.uuid = uuids[i];
+                    } else {
+                        row.id = ids[i];
+                    }
+                    row.tenant = request.tenant;
+                    row.namespace_name = request.namespace_name;
+                    row.vector = vectors.data() + i * dim;
+                    row.vector_len = options_.dim;
+                }
+                checkCancel(cancel);
+                const uint64_t planned = n * dim * util::element_size(delta.element_type);
+                const std::string path = placement_.path(prefix + std::to_string(s) + ".seg", planned);
+                result.segments[s] = DeltaSegmentWriter::write(path, delta, rows);
+                track(path);
+            }
+        }, util::ThreadPool::Priority::Background);
+
+        // Stable import: the first build trains the model the rest reuse;
+        // each build encodes in parallel itself
+        if (request.stable) {
+            std::shared_ptr<const index::IvfPqModel> model;
+            for (uint64_t s = 0; s < segments; ++s) {
+                checkCancel(cancel);
+                const std::string input = result.segments[s].file_path;
+                const std::string path = placement_.path(prefix + std::to_string(s) + "-stable.seg",
+                                                         SegmentPlacement::fileBytes(std::span(&result.segments[s], 1)));
+                StableSegmentBuilder::Result built =
+                    StableSegmentBuilder::build(path, options_.stable, std::span(&input, 1), model, false, cancel);
+                track(path);
+                model = built.model;
+                result.segments[s] = built.descriptor;
+                untrack(input);
+            }
+        }
+
+        checkCancel(cancel);
+        const std::vector<uint32_t> ordinals = install_(result.segments);
+        if (ordinals.size() != result.segments.size()) {
+            throw std::logic_error("BulkLoader: install returned " + std::to_string(ordinals.size()) +
+                                   " ordinals for " + std::to_string(result.segments.size()) + " segments");
+        }
+        {
+            std::lock_guard<std::mutex> lock(files_mutex);
+            files.clear();  // Owned by the manifest now
+        }
+        indexSegments(result.segments, ordinals, result.epoch);
+        if (checkpoint_) checkpoint_(result.epoch);
+    } catch (...) {
+        for (const std::string& path : std::vector<std::string>(files)) untrack(path);
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.failed++;
+        throw;
+    }
+
+    result.elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.imports++;
+        stats_.rows += result.rows;
+        stats_.segments += result.segments.size();
+        stats_.rows_per_s = result.elapsed_s > 0 ? static_cast<double>(result.rows) / result.elapsed_s : 0.0;
+    }
+    LOG_INFO("Bulk import: {} rows from {} files into {} {} segments at epoch {}{}, {:.1f} s", result.rows,
+             request.files.size(), result.segments.size(), request.stable ? "stable" : "delta", result.epoch,
+             result.trained ? " (centroids trained)" : "", result.elapsed_s);
+    return result;
+}
+
+void BulkLoader::indexSegments(const std::vector<SegmentDescriptor>& segments, const std::vector<uint32_t>& ordinals,
+                               Epoch epoch) {
+    if (!latest_by_id_) return;
+    for (size_t i = 0; i < segments.size(); ++i) latest_by_id_->registerSegment(ordinals[i], segments[i].segment_id);
+
+    SegmentReader::Options read_options;
+    read_options.huge_pages = false;
+    const bool string_ids = !options_.uuid_ids;
+    pool_.parallelFor(segments.size(), [&](size_t i) {
+        if (segments[i].is_stable) {
+            const StableSegment segment(segments[i].file_path, read_options);
+            indexSegment(*latest_by_id_, segment, ordinals[i], epoch, string_ids);
+        } else {
+            const DeltaSegment segment(segments[i].file_path, read_options);
+            indexSegment(*latest_by_id_, segment, ordinals[i], epoch, string_ids);
+        }
+    }, util::ThreadPool::Priority::Background);
+}
+
+std::vector<std::pair<std::string_view, double>> BulkLoader::metrics() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return {
+        {"woved_bulk_imports_total", static_cast<double>(stats_.imports)},
+        {"woved_bulk_import_failures_total", static_cast<double>(stats_.failed)},
+        {"woved_bulk_import_rows_total", static_cast<double>(stats_.rows)},
+        {"woved_bulk_import_segments_total", static_cast<double>(stats_.segments)},
+        {"woved_bulk_import_rows_per_second", stats_.rows_per_s},
+    };
+}
+
+} // namespace woved::storage
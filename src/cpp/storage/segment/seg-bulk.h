@@ -0,0 +1,146 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "storage/latest-by-id.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-stable.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::index {
+class CentroidsManager;
+}
+
+namespace woved::util {
+class ThreadPool;
+}
+
+namespace woved::storage {
+
+class SegmentPlacement;
+
+// Offline import: builds sealed segments straight from vector files,
+// bypassing the WAL, the message buffer and the B-epsilon tree.
+//
+// Inputs are read as one sequence of rows, in the order given:
+//   .fvecs  int32 dim, then dim float32, per row
+//   .bvecs  int32 dim, then dim uint8, per row
+//   .npy    2-D C-order array of <f4, <f2 or <f8
+// Parquet needs Arrow, which is not linked; such files are refused.
+// Ids come from a text file, one per line in row order, or are generated
+// UUIDv7s (uuidv7 collections only).
+//
+// If no centroids are installed (or the request asks for it), global
+// centroids are trained on a uniform sample and installed first. Rows
+// are then cut into segments of segment_rows; parallel_segments of them
+// are prepared at once, each read, normalized and assigned in blocks
+// across the pool, and written as delta segments placed over the segment
+// directories. A stable import builds each into a stable segment, the
+// first training the IVF-PQ model the rest reuse.
+//
+// Every row carries one epoch reserved for the import. The import is
+// committed by one manifest edit (InstallFn); only then are the rows
+// entered in the id map, and CheckpointFn asked for a restart checkpoint:
+// the rows never pass through the WAL, so a restart from an older
+// checkpoint finds them only by rebuilding from the segments. A failed or
+// cancelled import removes its files. Meant for initial loads: a
+// concurrent write to an imported id may be shadowed by the import.
+class BulkLoader {
+public:
+    struct Options {
+        uint32_t dim = 768;                  // collection.dim
+        bool uuid_ids = true;                // collection.id_type uuidv7
+        bool normalize = true;               // collection.metric inner_product
+        uint32_t centroids = 1024;           // index.global.nlist
+        size_t train_sample = 262144;
+        uint32_t kmeans_iterations = 20;
+        uint64_t segment_rows = 2000000;     // storage.segment.target_size_vectors
+        size_t parallel_segments = 2;        // Segments in memory at once
+        size_t block_rows = 16384;           // Rows read and assigned per task
+        DeltaSegmentWriter::Options delta;
+        StableSegmentBuilder::Options stable;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Request {
+        std::vector<std::string> files;
+        std::string ids_file;                // Empty: generated UUIDv7 ids
+        std::string tenant;
+        std::string namespace_name;
+        bool stable = false;                 // Build stable segments
+        bool train = false;                  // Retrain centroids even if installed
+    };
+
+    struct Result {
+        std::vector<SegmentDescriptor> segments;
+        uint64_t rows = 0;
+        Epoch epoch = 0;
+        bool trained = false;                // Centroids were trained and installed
+        double elapsed_s = 0;
+    };
+
+    // Reserve the epoch the imported rows carry
+    using EpochFn = std::function<Epoch()>;
+    // Add the segments to the manifest in one edit and return their
+    // ordinals, in order. Throwing abandons the import.
+    using InstallFn = std::function<std::vector<uint32_t>(const std::vector<SegmentDescriptor>& segments)>;
+    // Write a restart checkpoint (RestartIndex::write) covering `epoch`, or
+    // only up to the newest epoch below every buffered write if that is lower
+    using CheckpointFn = std::function<void(Epoch epoch)>;
+
+    // The centroids, placement, pool and map must outlive the loader
+    BulkLoader(const Options& options, index::CentroidsManager& centroids, SegmentPlacement& placement,
+               util::ThreadPool& pool, std::shared_ptr<LatestByIdMap> latest_by_id, EpochFn epoch,
+               InstallFn install, CheckpointFn checkpoint = {});
+
+    BulkLoader(const BulkLoader&) = delete;
+    BulkLoader& operator=(const BulkLoader&) = delete;
+
+    // Run one import; imports are serialized. Throws
+    // util::InvalidArgumentException for unreadable or mismatched inputs,
+    // util::IOException on write failure; a set `cancel` aborts with
+    // util::WovedException.
+    Result run(const Request& request, const std::atomic<bool>* cancel = nullptr);
+
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct Stats {
+        uint64_t imports = 0;
+        uint64_t failed = 0;
+        uint64_t rows = 0;
+        uint64_t segments = 0;
+        double rows_per_s = 0;               // Of the last import
+    };
+
+    Options options_;
+    index::CentroidsManager& centroids_;
+    SegmentPlacement& placement_;
+    util::ThreadPool& pool_;
+    std::shared_ptr<LatestByIdMap> latest_by_id_;
+    EpochFn epoch_;
+    InstallFn install_;
+    CheckpointFn checkpoint_;
+
+    std::mutex run_mutex_;
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+
+    void indexSegments(const std::vector<SegmentDescriptor>& segments, const std::vector<uint32_t>& ordinals,
+                       Epoch epoch);
+};
+
+} // namespace woved::storage
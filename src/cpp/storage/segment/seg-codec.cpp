@@ -0,0 +1,137 @@
+#include "seg-codec.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <zdict.h>
+#include <zstd.h>
+
+namespace woved::storage {
+
+namespace {
+
+struct DCtxDeleter {
+    void operator()(ZSTD_DCtx* dctx) const { ZSTD_freeDCtx(dctx); }
+};
+
+// One decompression context per thread, shared by every reader
+ZSTD_DCtx* threadDCtx() {
+    thread_local std::unique_ptr<ZSTD_DCtx, DCtxDeleter> dctx(ZSTD_createDCtx());
+    if (!dctx) throw std::bad_alloc();
+    return dctx.get();
+}
+
+} // namespace
+
+SectionCompressor::SectionCompressor(int level) : level_(level) {
+    cctx_ = ZSTD_createCCtx();
+    if (!cctx_) throw std::bad_alloc();
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level_);
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_checksumFlag, 1);
+}
+
+SectionCompressor::~SectionCompressor() {
+    ZSTD_freeCDict(cdict_);
+    ZSTD_freeCCtx(cctx_);
+}
+
+bool SectionCompressor::train(std::span<const std::byte> samples, std::span<const size_t> sizes,
+                              size_t dict_bytes) {
+    if (dict_bytes == 0 || sizes.empty()) return false;
+    std::vector<std::byte> dict(dict_bytes);
+    size_t size = ZDICT_trainFromBuffer(dict.data(), dict.size(), samples.data(), sizes.data(),
+                                        static_cast<unsigned>(sizes.size()));
+    if (ZDICT_isError(size)) {
+        LOG_DEBUG("Segment dictionary training failed ({}), using plain zstd", ZDICT_getErrorName(size));
+        return false;
+    }
+    dict.resize(size);
+    cdict_ = ZSTD_createCDict(dict.data(), dict.size(), level_);
+    if (!cdict_) throw std::bad_alloc();
+    ZSTD_CCtx_refCDict(cctx_, cdict_);
+    dict_ = std::move(dict);
+    return true;
+}
+
+size_t SectionCompressor::compress(std::span<const std::byte> in, std::vector<std::byte>& out) {
+    out.resize(ZSTD_compressBound(in.size()));
+    size_t written = ZSTD_compress2(cctx_, out.data(), out.size(), in.data(), in.size());
+    if (ZSTD_isError(written) || written >= in.size()) {
+        out.clear();
+        return 0;
+    }
+    out.resize(written);
+    return written;
+}
+
+SectionDecompressor::SectionDecompressor(std::span<const std::byte> dict) {
+    if (dict.empty()) return;
+    ddict_ = ZSTD_createDDict(dict.data(), dict.size());
+    if (!ddict_) throw util::IOException("Invalid segment compression dictionary");
+}
+
+SectionDecompressor::~SectionDecompressor() {
+    ZSTD_freeDDict(ddict_);
+}
+
+CompressedSectionTrailer SectionDecompressor::trailer(std::span<const std::byte> tail, uint64_t length) {
+    CompressedSectionTrailer t{};
+    if (tail.size() < sizeof(t)) throw util::IOException("Truncated compressed segment section");
+    std::memcpy(&t, tail.data() + tail.size() - sizeof(t), sizeof(t));
+    const uint64_t index_bytes = uint64_t{t.blocks} * sizeof(uint64_t);
+    if (t.block_bytes == 0 || index_bytes + sizeof(t) > length ||
+        t.blocks != (t.raw_length + t.block_bytes - 1) / t.block_bytes) {
+        throw util::IOException("Corrupt compressed segment section trailer");
+    }
+    return t;
+}
+
+std::vector<uint64_t> SectionDecompressor::index(std::span<const std::byte> bytes,
+                                                 const CompressedSectionTrailer& trailer, uint64_t length) {
+    std::vector<uint64_t> ends(trailer.blocks);
+    if (bytes.size() != ends.size() * sizeof(uint64_t)) {
+        throw util::IOException("Truncated compressed segment section index");
+    }
+    if (!bytes.empty()) std::memcpy(ends.data(), bytes.data(), bytes.size());
+    const uint64_t data_end = length - bytes.size() - sizeof(CompressedSectionTrailer);
+    if (!std::is_sorted(ends.begin(), ends.end()) || (!ends.empty() && ends.back() != data_end)) {
+        throw util::IOException("Corrupt compressed segment section index");
+    }
+    return ends;
+}
+
+void SectionDecompressor::block(std::span<const std::byte> stored, std::span<std::byte> out) const {
+    if (stored.size() == out.size()) {
+        // Stored as is: zstd did not make it smaller
+        if (!out.empty()) std::memcpy(out.data(), stored.data(), out.size());
+        return;
+    }
+    ZSTD_DCtx* dctx = threadDCtx();
+    size_t n = ddict_ ? ZSTD_decompress_usingDDict(dctx, out.data(), out.size(), stored.data(), stored.size(), ddict_)
+                      : ZSTD_decompressDCtx(dctx, out.data(), out.size(), stored.data(), stored.size());
+    if (ZSTD_isError(n) || n != out.size()) {
+        throw util::IOException(std::string("Corrupt compressed segment block: ") +
+                                (ZSTD_isError(n) ? ZSTD_getErrorName(n) : "size mismatch"));
+    }
+}
+
+std::vector<std::byte> SectionDecompressor::section(std::span<const std::byte> stored) const {
+    const CompressedSectionTrailer t = trailer(stored, stored.size());
+    const size_t index_bytes = size_t{t.blocks} * sizeof(uint64_t);
+    const auto ends = index(stored.subspan(stored.size() - sizeof(t) - index_bytes, index_bytes), t, stored.size());
+
+    std::vector<std::byte> out(t.raw_length);
+    uint64_t begin = 0;
+    for (uint32_t b = 0; b < t.blocks; ++b) {
+        const uint64_t raw_begin = uint64_t{b} * t.block_bytes;
+        const uint64_t raw_len = std::min<uint64_t>(t.block_bytes, t.raw_length - raw_begin);
+        block(stored.subspan(begin, ends[b] - begin), std::span(out).subspan(raw_begin, raw_len));
+        begin = ends[b];
+    }
+    return out;
+}
+
+} // namespace woved::storage
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace woved::storage {
+
+// Compressed segment sections. Metadata columns (row table, tag lists, id
+// strings, bitmaps) may be zstd compressed; vectors and PQ codes never
+// are, so scans keep reading them in place. A section whose flags carry
+// kSectionZstd holds:
+//   blocks     the raw section cut into block_bytes blocks (the last
+//              short), each compressed on its own, or stored as is where
+//              zstd does not make it smaller
+//   index      uint64_t end of each block, from the start of the section
+//   trailer    CompressedSectionTrailer
+//
+// All blocks of a segment share one dictionary, trained by the writer on
+// that segment's own metadata and stored as Metadata kSegmentDictSection.
+// Blocks carry zstd content checksums, so a block read without the
+// section CRC is still checked.
+inline constexpr uint32_t kSectionZstd = 0x1;
+inline constexpr uint32_t kSegmentDictSection = 4;
+
+struct CompressedSectionTrailer {
+    uint64_t raw_length;
+    uint32_t block_bytes;
+    uint32_t blocks;
+};
+
+// Write side; one per segment writer
+class SectionCompressor {
+public:
+    explicit SectionCompressor(int level);
+    ~SectionCompressor();
+
+    SectionCompressor(const SectionCompressor&) = delete;
+    SectionCompressor& operator=(const SectionCompressor&) = delete;
+
+    // Train a dictionary of up to dict_bytes from samples laid back to back.
+    // Returns false (and keeps compressing without one) if training fails.
+    bool train(std::span<const std::byte> samples, std::span<const size_t> sizes, size_t dict_bytes);
+
+    std::span<const std::byte> dictionary() const { return dict_; }
+
+    // Compress one block into `out` (replacing its contents). Returns the
+    // compressed size, or 0 when the result would not be smaller.
+    size_t compress(std::span<const std::byte> in, std::vector<std::byte>& out);
+
+private:
+    int level_;
+    ZSTD_CCtx_s* cctx_ = nullptr;
+    ZSTD_CDict_s* cdict_ = nullptr;
+    std::vector<std::byte> dict_;
+};
+
+// Read side; thread-safe (decompression contexts are per thread)
+class SectionDecompressor {
+public:
+    // An empty dictionary decodes segments written without one
+    explicit SectionDecompressor(std::span<const std::byte> dict);
+    ~SectionDecompressor();
+
+    SectionDecompressor(const SectionDecompressor&) = delete;
+    SectionDecompressor& operator=(const SectionDecompressor&) = delete;
+
+    // The trailer of a compressed section of `length` stored bytes, and
+    // its block index (the `blocks` ends before the trailer). Throw
+    // util::IOException if they do not fit the section.
+    static CompressedSectionTrailer trailer(std::span<const std::byte> tail, uint64_t length);
+    static std::vector<uint64_t> index(std::span<const std::byte> bytes, const CompressedSectionTrailer& trailer,
+                                       uint64_t length);
+
+    // Decode one stored block into `out`, its raw size
+    void block(std::span<const std::byte> stored, std::span<std::byte> out) const;
+
+    // Decode a whole stored section
+    std::vector<std::byte> section(std::span<const std::byte> stored) const;
+
+private:
+    ZSTD_DDict_s* ddict_ = nullptr;
+};
+
+} // namespace woved::storage
@@ -0,0 +1,488 @@
+#include "seg-cold.h"
+#include "storage/segment/seg-stable.h"
+#include "core/config.h"
+#include "io/buffer-pool.h"
+#include "util/exceptions.h"
+#include "util/file-io.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t kBlock = 4096;
+constexpr size_t kCopyBytes = 1048576;
+
+bool punch(int fd, uint64_t offset, uint64_t len) {
+    return ::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset),
+                       static_cast<off_t>(len)) == 0;
+}
+
+} // namespace
+
+DirectoryObjectStore::DirectoryObjectStore(std::string root) : root_(std::move(root)) {
+    std::error_code ec;
+    std::filesystem::create_directories(root_, ec);
+    if (ec) throw util::IOException("create object store " + root_ + ": " + ec.message());
+}
+
+void DirectoryObjectStore::put(const std::string& key, const std::string& path) {
+    const std::string target = root_ + "/" + key;
+    int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) throw util::IOException("open " + path + ": " + std::strerror(errno));
+    int out = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        int err = errno;
+        ::close(in);
+        throw util::IOException("create " + target + ": " + std::strerror(err));
+    }
+    try {
+        std::vector<std::byte> buffer(kCopyBytes);
+        uint64_t offset = 0;
+        for (;;) {
+            ssize_t n = ::pread(in, buffer.data(), buffer.size(), static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw util::IOException("read " + path + ": " + std::strerror(errno));
+            if (n == 0) break;
+            util::pwrite_all(out, buffer.data(), static_cast<size_t>(n), offset, target);
+            offset += static_cast<uint64_t>(n);
+        }
+        // On an S3 mount the upload completes here
+        if (::fsync(out) != 0 || ::close(out) != 0) {
+            out = -1;
+            throw util::IOException("upload " + target + ": " + std::strerror(errno));
+        }
+    } catch (...) {
+        if (out >= 0) ::close(out);
+        ::close(in);
+        throw;
+    }
+    ::close(in);
+}
+
+void DirectoryObjectStore::get(const std::string& key, uint64_t offset, std::span<std::byte> out) {
+    const std::string target = root_ + "/" + key;
+    int fd = ::open(target.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw util::IOException("open " + target + ": " + std::strerror(errno));
+    try {
+        util::pread_all(fd, out.data(), out.size(), offset, target);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+}
+
+void DirectoryObjectStore::remove(const std::string& key) {
+    const std::string target = root_ + "/" + key;
+    if (::unlink(target.c_str()) != 0 && errno != ENOENT) {
+        throw util::IOException("remove " + target + ": " + std::strerror(errno));
+    }
+}
+
+// One cold segment: its chunks and the stub they are fetched into
+class ColdTier::File final : public SegmentSource {
+public:
+    File(ColdTier& tier, std::string path, std::string key)
+        : tier(tier), path(std::move(path)), key(std::move(key)) {}
+    ~File() override {
+        if (fd >= 0) ::close(fd);
+    }
+
+    void pin(uint64_t offset, uint64_t len) override { tier.pin(*this, offset, len); }
+    void unpin(uint64_t offset, uint64_t len) noexcept override { tier.unpin(*this, offset, len); }
+
+    ColdTier& tier;
+    const std::string path;
+    const std::string key;
+    int fd = -1;              // Read-write, to fill and punch holes
+    uint64_t bytes = 0;
+    uint64_t cold_bytes = 0;  // In non-local chunks
+    bool cold = true;         // Cleared by restore() and removed()
+    std::vector<Chunk> chunks;
+};
+
+ColdTier::Options ColdTier::Options::fromConfig(const StorageConfig& storage) {
+    Options options;
+    options.store_dir = storage.cold.store_dir;
+    options.state_path = storage.data_dir + "/cold-segments";
+    options.cache_bytes = uint64_t{storage.cold.cache_mb} * 1048576;
+    options.chunk_bytes = uint64_t{storage.cold.chunk_kb} * 1024;
+    options.idle = std::chrono::hours(storage.cold.idle_hours);
+    return options;
+}
+
+ColdTier::ColdTier(const Options& options, std::shared_ptr<ObjectStore> store)
+    : options_(options), store_(std::move(store)) {
+    if (options_.chunk_bytes == 0 || options_.chunk_bytes % kBlock != 0) {
+        throw util::ConfigException("Cold tier chunk size must be a multiple of 4 KiB");
+    }
+    if (!store_) {
+        if (options_.store_dir.empty()) throw util::ConfigException("No cold tier store");
+        store_ = std::make_shared<DirectoryObjectStore>(options_.store_dir);
+    }
+    if (options_.state_path.empty()) throw util::ConfigException("No cold tier state path");
+
+    std::ifstream in(options_.state_path);
+    if (!in) return;
+    bool dropped = false;
+    std::string line;
+    while (std::getline(in, line)) {
+        const auto tab = line.find('\t');
+        if (tab == std::string::npos) continue;
+        std::string key = line.substr(0, tab);
+        std::string path = line.substr(tab + 1);
+        try {
+            auto file = open(path, key);
+            // Cached chunks are not tracked across runs: empty the cache
+            for (uint64_t c = 0; c < file->chunks.size(); ++c) {
+                if (file->chunks[c].state == kAbsent) punch(file->fd, c * options_.chunk_bytes, chunkBytes(*file, c));
+            }
+            stats_.cold_segments++;
+            stats_.cold_bytes += file->cold_bytes;
+            files_.emplace(path, std::move(file));
+        } catch (const util::IOException& e) {
+            LOG_WARN("Cold tier: dropping {}: {}", path, e.what());
+            dropped = true;
+        }
+    }
+    if (dropped) saveLocked();
+    LOG_INFO("Cold tier: {} cold segments, {} bytes in the store", stats_.cold_segments, stats_.cold_bytes);
+}
+
+ColdTier::~ColdTier() = default;
+
+std::shared_ptr<ColdTier::File> ColdTier::open(const std::string& path, const std::string& key) {
+    // The directory and footer are always local
+    SegmentReader::Options read_options;
+    read_options.mode = SegmentReader::Mode::Direct;
+    SegmentReader reader(path, read_options);
+
+    auto file = std::make_shared<File>(*this, path, key);
+    file->bytes = reader.fileBytes();
+    file->chunks.resize((file->bytes + options_.chunk_bytes - 1) / options_.chunk_bytes);
+    auto keep = [&](uint64_t offset, uint64_t len) {
+        if (len == 0) return;
+        for (uint64_t c = offset / options_.chunk_bytes; c <= (offset + len - 1) / options_.chunk_bytes; ++c) {
+            file->chunks[c].state = kLocal;
+        }
+    };
+    // Everything but the vector and code sections
+    for (const SegmentSection& section : reader.sections()) {
+        if (section.kind != static_cast<uint32_t>(SegmentSectionKind::Vectors)) keep(section.offset, section.length);
+    }
+    keep(reader.footer().data_bytes, file->bytes - reader.footer().data_bytes);
+    for (uint64_t c = 0; c < file->chunks.size(); ++c) {
+        if (file->chunks[c].state != kLocal) file->cold_bytes += chunkBytes(*file, c);
+    }
+
+    file->fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (file->fd < 0) throw util::IOException("open " + path + ": " + std::strerror(errno));
+    return file;
+}
+
+uint64_t ColdTier::chunkBytes(const File& file, uint64_t chunk) const {
+    return std::min(options_.chunk_bytes, file.bytes - chunk * options_.chunk_bytes);
+}
+
+bool ColdTier::cold(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_.count(path) > 0;
+}
+
+SegmentReader::Options ColdTier::readerOptions(const std::string& path, SegmentReader::Options options) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(path);
+    if (it != files_.end()) {
+        options.mode = SegmentReader::Mode::Direct;
+        options.source = it->second;
+    }
+    return options;
+}
+
+void ColdTier::offload(const std::string& path) {
+    if (cold(path)) return;
+    if (!isStableSegment(path)) throw util::InvalidArgumentException("Not a stable segment: " + path);
+    const std::string key = std::filesystem::path(path).filename().string();
+    store_->put(key, path);
+
+    // The stub: local chunks at their offsets, holes elsewhere
+    auto file = open(path, key);
+    const std::string tmp = path + ".tmp";
+    int out = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) throw util::IOException("create " + tmp + ": " + std::strerror(errno));
+    try {
+        if (::ftruncate(out, static_cast<off_t>(file->bytes)) != 0) {
+            throw util::IOException("truncate " + tmp + ": " + std::strerror(errno));
+        }
+        auto buffer = io::BufferPool::global().acquire(options_.chunk_bytes);
+        for (uint64_t c = 0; c < file->chunks.size(); ++c) {
+            if (file->chunks[c].state != kLocal) continue;
+            const uint64_t offset = c * options_.chunk_bytes;
+            const size_t len = chunkBytes(*file, c);
+            util::pread_all(file->fd, buffer.data(), len, offset, path);
+            util::pwrite_all(out, buffer.data(), len, offset, tmp);
+        }
+        if (::fsync(out) != 0) throw util::IOException("sync " + tmp + ": " + std::strerror(errno));
+    } catch (...) {
+        ::close(out);
+        ::unlink(tmp.c_str());
+        throw;
+    }
+    // Chunks are fetched into the stub, which becomes the segment
+    ::close(file->fd);
+    file->fd = out;
+
+    // Recorded before the rename, so a stub is never left unlisted
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        files_.emplace(path, file);
+        try {
+            saveLocked();
+        } catch (...) {
+            files_.erase(path);
+            ::unlink(tmp.c_str());
+            throw;
+        }
+        stats_.cold_segments++;
+        stats_.cold_bytes += file->cold_bytes;
+    }
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        int err = errno;
+        std::lock_guard<std::mutex> lock(mutex_);
+        dropLocked(*file);
+        files_.erase(path);
+        saveLocked();
+        ::unlink(tmp.c_str());
+        throw util::IOException("rename " + tmp + ": " + std::strerror(err));
+    }
+    util::sync_parent_directory(path);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.offloads++;
+    LOG_INFO("Cold tier: {} offloaded, {} of {} bytes now in the store", path, file->cold_bytes, file->bytes);
+}
+
+std::vector<std::string> ColdTier::offloadIdle(std::span<const StableSegment* const> segments) {
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<std::string> offloaded;
+    for (const StableSegment* segment : segments) {
+        const SegmentReader& reader = segment->reader();
+        if (cold(reader.path()) || now - reader.lastRead() < options_.idle) continue;
+        try {
+            offload(reader.path());
+            offloaded.push_back(reader.path());
+        } catch (const util::WovedException& e) {
+            LOG_WARN("Cold tier: {} stays local: {}", reader.path(), e.what());
+        }
+    }
+    return offloaded;
+}
+
+void ColdTier::restore(const std::string& path) {
+    std::shared_ptr<File> file;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = files_.find(path);
+        if (it == files_.end()) return;
+        file = it->second;
+    }
+    pin(*file, 0, file->bytes);
+    if (::fsync(file->fd) != 0) {
+        int err = errno;
+        unpin(*file, 0, file->bytes);
+        throw util::IOException("sync " + path + ": " + std::strerror(err));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!file->cold) return;  // Raced with another restore or removed()
+        dropLocked(*file);
+        files_.erase(path);
+        saveLocked();
+        stats_.restores++;
+    }
+    try {
+        store_->remove(file->key);
+    } catch (const util::IOException& e) {
+        LOG_WARN("Cold tier: {} left in the store: {}", file->key, e.what());
+    }
+    LOG_INFO("Cold tier: {} restored", path);
+}
+
+void ColdTier::removed(const std::string& path) {
+    std::shared_ptr<File> file;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = files_.find(path);
+        if (it == files_.end()) return;
+        file = it->second;
+        dropLocked(*file);
+        files_.erase(it);
+        saveLocked();
+    }
+    try {
+        store_->remove(file->key);
+    } catch (const util::IOException& e) {
+        LOG_WARN("Cold tier: {} left in the store: {}", file->key, e.what());
+    }
+}
+
+void ColdTier::pin(File& file, uint64_t offset, uint64_t len) {
+    if (len == 0 || file.chunks.empty()) return;
+    const uint64_t first = offset / options_.chunk_bytes;
+    const uint64_t last = std::min<uint64_t>((offset + len - 1) / options_.chunk_bytes, file.chunks.size() - 1);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!file.cold) return;
+    for (uint64_t c = first; c <= last; ++c) {
+        Chunk& chunk = file.chunks[c];
+        chunk.pins++;
+        if (chunk.state == kCached) {
+            lru_.splice(lru_.begin(), lru_, chunk.lru);
+            stats_.hits++;
+        }
+    }
+
+    auto cache = [&](uint64_t c) {
+        Chunk& chunk = file.chunks[c];
+        chunk.state = kCached;
+        const uint64_t bytes = chunkBytes(file, c);
+        stats_.fetches++;
+        stats_.fetched_bytes += bytes;
+        if (!file.cold) return;
+        lru_.push_front({&file, c});
+        chunk.lru = lru_.begin();
+        stats_.cached_bytes += bytes;
+    };
+
+    // Fetch the missing chunks, then wait for those other readers fetch;
+    // a failed fetch leaves its chunks to whoever still needs them
+    std::vector<uint64_t> ours;
+    for (;;) {
+        ours.clear();
+        bool waiting = false;
+        for (uint64_t c = first; c <= last; ++c) {
+            Chunk& chunk = file.chunks[c];
+            if (chunk.state == kAbsent) {
+                chunk.state = kFetching;
+                ours.push_back(c);
+            } else if (chunk.state == kFetching) {
+                waiting = true;
+            }
+        }
+        if (!ours.empty()) {
+            lock.unlock();
+            size_t done = 0;
+            try {
+                for (; done < ours.size(); ++done) fetch(file, ours[done]);
+            } catch (...) {
+                lock.lock();
+                for (size_t i = 0; i < ours.size(); ++i) {
+                    if (i < done) {
+                        cache(ours[i]);
+                    } else {
+                        file.chunks[ours[i]].state = kAbsent;
+                    }
+                }
+                for (uint64_t c = first; c <= last; ++c) file.chunks[c].pins--;
+                fetched_.notify_all();
+                throw;
+            }
+            lock.lock();
+            for (uint64_t c : ours) cache(c);
+            fetched_.notify_all();
+            continue;
+        }
+        if (!waiting) break;
+        fetched_.wait(lock);
+    }
+    evictLocked();
+}
+
+void ColdTier::unpin(File& file, uint64_t offset, uint64_t len) noexcept {
+    if (len == 0 || file.chunks.empty()) return;
+    const uint64_t first = offset / options_.chunk_bytes;
+    const uint64_t last = std::min<uint64_t>((offset + len - 1) / options_.chunk_bytes, file.chunks.size() - 1);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!file.cold) return;
+    for (uint64_t c = first; c <= last; ++c) {
+        if (file.chunks[c].pins > 0) file.chunks[c].pins--;
+    }
+    evictLocked();
+}
+
+void ColdTier::fetch(File& file, uint64_t chunk) {
+    const uint64_t offset = chunk * options_.chunk_bytes;
+    const size_t len = chunkBytes(file, chunk);
+    auto buffer = io::BufferPool::global().acquire(len);
+    store_->get(file.key, offset, std::span(buffer.data(), len));
+    util::pwrite_all(file.fd, buffer.data(), len, offset, file.path);
+}
+
+void ColdTier::evictLocked() {
+    // Least recently pinned first, skipping chunks being read
+    auto it = lru_.end();
+    while (stats_.cached_bytes > options_.cache_bytes && it != lru_.begin()) {
+        --it;
+        File& file = *it->file;
+        Chunk& chunk = file.chunks[it->chunk];
+        if (chunk.pins > 0) continue;
+        const uint64_t bytes = chunkBytes(file, it->chunk);
+        if (!punch(file.fd, it->chunk * options_.chunk_bytes, bytes)) {
+            LOG_WARN("Cold tier: cannot punch a chunk of {}: {}", file.path, std::strerror(errno));
+        }
+        chunk.state = kAbsent;
+        stats_.cached_bytes -= bytes;
+        stats_.evictions++;
+        it = lru_.erase(it);
+    }
+}
+
+void ColdTier::dropLocked(File& file) {
+    for (uint64_t c = 0; c < file.chunks.size(); ++c) {
+        Chunk& chunk = file.chunks[c];
+        if (chunk.state != kCached) continue;
+        lru_.erase(chunk.lru);
+        stats_.cached_bytes -= chunkBytes(file, c);
+    }
+    if (file.cold) {
+        stats_.cold_segments--;
+        stats_.cold_bytes -= file.cold_bytes;
+    }
+    file.cold = false;
+}
+
+void ColdTier::saveLocked() const {
+    std::string text;
+    for (const auto& [path, file] : files_) text += file->key + "\t" + path + "\n";
+
+    const std::string tmp = options_.state_path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw util::IOException("create " + tmp + ": " + std::strerror(errno));
+    try {
+        util::pwrite_all(fd, reinterpret_cast<const std::byte*>(text.data()), text.size(), 0, tmp);
+        if (::fsync(fd) != 0) throw util::IOException("sync " + tmp + ": " + std::strerror(errno));
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+    if (::rename(tmp.c_str(), options_.state_path.c_str()) != 0) {
+        throw util::IOException("rename " + tmp + ": " + std::strerror(errno));
+    }
+    util::sync_parent_directory(options_.state_path);
+}
+
+ColdTier::Stats ColdTier::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+} // namespace woved::storage
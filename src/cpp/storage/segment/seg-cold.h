@@ -0,0 +1,165 @@
+#pragma once
+
+#include "storage/segment/seg-r.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace woved {
+struct StorageConfig;
+}
+
+namespace woved::storage {
+
+class StableSegment;
+
+// Where cold segments are kept; objects are named by flat keys
+class ObjectStore {
+public:
+    virtual ~ObjectStore() = default;
+
+    // Upload the file at `path` as `key`, replacing any object of that key
+    virtual void put(const std::string& key, const std::string& path) = 0;
+    // Fill `out` from `offset` of `key` (a range GET)
+    virtual void get(const std::string& key, uint64_t offset, std::span<std::byte> out) = 0;
+    virtual void remove(const std::string& key) = 0;
+};
+
+// Objects as files under one directory: an S3-compatible bucket mounted
+// with mountpoint-s3 or s3fs, or any cheaper filesystem. Objects are
+// written once, front to back, and never renamed, which is all such
+// mounts allow; get() is a pread, which they serve as a range GET.
+class DirectoryObjectStore : public ObjectStore {
+public:
+    explicit DirectoryObjectStore(std::string root);
+
+    void put(const std::string& key, const std::string& path) override;
+    void get(const std::string& key, uint64_t offset, std::span<std::byte> out) override;
+    void remove(const std::string& key) override;
+
+private:
+    std::string root_;
+};
+
+// Moves stable segments nobody reads to an object store, keeping only
+// what opening and planning need on local disk.
+//
+// offload() uploads a sealed stable segment whole, then replaces the
+// local file with a sparse stub of the same size: the row table,
+// metadata (the IVF-PQ model and its centroids), list directory, zone
+// map and footer stay, and the vector and code sections become holes.
+// Offsets do not change, so a cold segment is read like any other.
+// Readers opened through readerOptions() read it in direct mode with the
+// tier as their source: each read pins the chunks it covers, and missing
+// chunks are fetched by range GET and written into the stub's holes.
+// That is the chunk cache. It holds at most cache_bytes of fetched chunks
+// across all cold segments, and evicts the least recently pinned unpinned
+// chunk by punching its hole again. The cache starts empty on restart.
+//
+// The stub replaces the segment by rename, so readers already open keep
+// the whole file; reopen the segment through readerOptions() to free the
+// space. restore() fetches every chunk and makes the segment local again.
+// StableSegmentBuilder restores cold inputs before a merge maps them.
+//
+// Cold segments and their object keys are listed in state_path, written
+// before a stub replaces its segment.
+class ColdTier {
+public:
+    struct Options {
+        std::string store_dir;            // DirectoryObjectStore root without a store
+        std::string state_path;
+        uint64_t cache_bytes = 4294967296;  // 4 GiB
+        uint64_t chunk_bytes = 1048576;     // Multiple of 4 KiB
+        std::chrono::hours idle{336};       // offloadIdle(): two weeks unread
+
+        // storage.cold; state in <data_dir>/cold-segments
+        static Options fromConfig(const StorageConfig& storage);
+    };
+
+    struct Stats {
+        uint64_t cold_segments = 0;
+        uint64_t cold_bytes = 0;          // Held in the store only
+        uint64_t cached_bytes = 0;
+        uint64_t hits = 0;                // Chunks pinned while cached
+        uint64_t fetches = 0;
+        uint64_t fetched_bytes = 0;
+        uint64_t evictions = 0;
+        uint64_t offloads = 0;
+        uint64_t restores = 0;
+    };
+
+    // A null store is a DirectoryObjectStore at store_dir. Loads the state
+    // file; throws util::ConfigException without a store or on a bad
+    // chunk size, util::IOException if the state cannot be read.
+    explicit ColdTier(const Options& options, std::shared_ptr<ObjectStore> store = nullptr);
+    ~ColdTier();
+
+    ColdTier(const ColdTier&) = delete;
+    ColdTier& operator=(const ColdTier&) = delete;
+
+    bool cold(const std::string& path) const;
+
+    // `options` for opening the segment at `path`: direct mode with the
+    // tier as source if it is cold, unchanged otherwise. The tier must
+    // outlive the reader.
+    SegmentReader::Options readerOptions(const std::string& path, SegmentReader::Options options) const;
+
+    // Throws util::InvalidArgumentException unless `path` is a stable
+    // segment, util::IOException if the upload or stub fails (the segment
+    // then stays local). A no-op for a cold segment.
+    void offload(const std::string& path);
+    // Offloads the segments not read for `idle`; returns their paths,
+    // which the caller reopens
+    std::vector<std::string> offloadIdle(std::span<const StableSegment* const> segments);
+
+    // Fetch a cold segment back whole; a no-op for a local one
+    void restore(const std::string& path);
+
+    // The segment at `path` was deleted and no reader has it open: drops
+    // its object and cached chunks
+    void removed(const std::string& path);
+
+    Stats getStats() const;
+
+private:
+    enum : uint8_t { kLocal = 0, kAbsent = 1, kFetching = 2, kCached = 3 };
+
+    class File;
+    struct Cached {
+        File* file;
+        uint64_t chunk;
+    };
+    struct Chunk {
+        uint8_t state = kAbsent;
+        uint32_t pins = 0;
+        std::list<Cached>::iterator lru;
+    };
+
+    Options options_;
+    std::shared_ptr<ObjectStore> store_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable fetched_;
+    std::unordered_map<std::string, std::shared_ptr<File>> files_;
+    std::list<Cached> lru_;   // Cached chunks, most recently pinned first
+    Stats stats_;
+
+    std::shared_ptr<File> open(const std::string& path, const std::string& key);
+    void pin(File& file, uint64_t offset, uint64_t len);
+    void unpin(File& file, uint64_t offset, uint64_t len) noexcept;
+    void fetch(File& file, uint64_t chunk);
+    void evictLocked();
+    void dropLocked(File& file);
+    void saveLocked() const;
+    uint64_t chunkBytes(const File& file, uint64_t chunk) const;
+};
+
+} // namespace woved::storage
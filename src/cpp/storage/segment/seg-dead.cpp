@@ -0,0 +1,167 @@
+#include "seg-dead.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-stable.h"
+#include "storage/snapshot.h"
+#include <algorithm>
+#include <numeric>
+#include <span>
+
+namespace woved::storage {
+
+namespace {
+
+// One installed segment as the joins see it
+struct Member {
+    const void* key;
+    std::span<const VectorIdHash> hashes;
+    std::span<const Epoch> epochs;
+    std::span<const uint8_t> flags;
+    uint64_t live;
+    const std::vector<uint32_t>* by_hash = nullptr;
+    bool fresh = false;
+};
+
+// Rows to mark in one segment, and the newest version that superseded them
+struct Marks {
+    std::vector<uint32_t> rows;
+    Epoch epoch = 0;
+
+    void add(uint32_t row, Epoch by) {
+        rows.push_back(row);
+        epoch = std::max(epoch, by);
+    }
+};
+
+template <typename Segment>
+Member member(const Segment& segment) {
+    return {&segment, segment.idHashes(), segment.epochs(), segment.flags(), segment.liveRows()};
+}
+
+std::vector<uint32_t> indexByHash(const Member& m) {
+    std::vector<uint32_t> rows(m.hashes.size());
+    std::iota(rows.begin(), rows.end(), 0u);
+    std::sort(rows.begin(), rows.end(), [&](uint32_t a, uint32_t b) { return m.hashes[a] < m.hashes[b]; });
+    return rows;
+}
+
+// Two rows holding one id: the older version, or a live row against a
+// delete at the same epoch, is dead in its segment
+void settle(const Member& a, uint32_t ra, Marks& ma, const Member& b, uint32_t rb, Marks& mb) {
+    const Epoch ea = a.epochs[ra];
+    const Epoch eb = b.epochs[rb];
+    const bool ta = (a.flags[ra] & kDeltaTombstone) != 0;
+    const bool tb = (b.flags[rb] & kDeltaTombstone) != 0;
+    if (ea < eb || (ea == eb && tb && !ta)) {
+        if (ra < a.live) ma.add(ra, eb);
+    } else if (eb < ea || (ea == eb && ta && !tb)) {
+        if (rb < b.live) mb.add(rb, ea);
+    }
+}
+
+// Every id held by both segments; walks the smaller in hash order and
+// probes the larger, each probe starting where the last one ended
+void join(const Member& a, Marks& ma, const Member& b, Marks& mb) {
+    const bool a_small = a.hashes.size() <= b.hashes.size();
+    const Member& small = a_small ? a : b;
+    const Member& large = a_small ? b : a;
+    Marks& ms = a_small ? ma : mb;
+    Marks& ml = a_small ? mb : ma;
+    const auto& probe = *large.by_hash;
+    auto from = probe.begin();
+    for (const uint32_t row : *small.by_hash) {
+        const VectorIdHash hash = small.hashes[row];
+        from = std::lower_bound(from, probe.end(), hash,
+                                [&](uint32_t r, VectorIdHash h) { return large.hashes[r] < h; });
+        if (from == probe.end()) break;
+        for (auto it = from; it != probe.end() && large.hashes[*it] == hash; ++it) {
+            settle(small, row, ms, large, *it, ml);
+        }
+    }
+}
+
+} // namespace
+
+void DeadRowTracker::update(SegmentSet& set) {
+    std::vector<Member> members;
+    members.reserve(set.delta.size() + set.stable.size());
+    for (const auto& segment : set.delta) members.push_back(member(*segment));
+    for (const auto& segment : set.stable) members.push_back(member(*segment));
+
+    std::unordered_map<const void*, Entry> next;
+    next.reserve(members.size());
+    for (Member& m : members) {
+        auto old = entries_.find(m.key);
+        Entry& entry = next[m.key];
+        if (old != entries_.end()) {
+            entry = std::move(old->second);
+        } else {
+            entry.by_hash = indexByHash(m);
+            m.fresh = true;
+        }
+        m.by_hash = &entry.by_hash;
+    }
+
+    // Pairs already installed were joined when the newer of them came in
+    std::vector<Marks> marks(members.size());
+    for (size_t i = 0; i < members.size(); ++i) {
+        if (!members[i].fresh) continue;
+        for (size_t j = 0; j < members.size(); ++j) {
+            if (j == i || (members[j].fresh && j < i)) continue;
+            join(members[i], marks[i], members[j], marks[j]);
+        }
+    }
+
+    uint64_t marked = 0;
+    uint64_t dead_rows = 0;
+    uint64_t bitmap_bytes = 0;
+    uint64_t index_bytes = 0;
+    set.delta_dead.clear();
+    set.stable_dead.clear();
+    for (size_t i = 0; i < members.size(); ++i) {
+        Entry& entry = next[members[i].key];
+        if (!marks[i].rows.empty()) {
+            auto dead = entry.dead ? std::make_shared<DeadRows>(*entry.dead) : std::make_shared<DeadRows>();
+            dead->rows.addMany(marks[i].rows.size(), marks[i].rows.data());
+            dead->rows.runOptimize();
+            dead->rows.shrinkToFit();
+            dead->epoch = std::max(dead->epoch, marks[i].epoch);
+            marked += marks[i].rows.size();
+            entry.dead = std::move(dead);
+        }
+        if (entry.dead) {
+            dead_rows += entry.dead->count();
+            bitmap_bytes += entry.dead->rows.getSizeInBytes();
+        }
+        index_bytes += entry.by_hash.size() * sizeof(uint32_t);
+        (i < set.delta.size() ? set.delta_dead : set.stable_dead).push_back(entry.dead);
+    }
+    set.delta_dead_view.clear();
+    for (const auto& dead : set.delta_dead) set.delta_dead_view.push_back(dead.get());
+    set.stable_dead_view.clear();
+    for (const auto& dead : set.stable_dead) set.stable_dead_view.push_back(dead.get());
+    entries_ = std::move(next);
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.installs++;
+    stats_.rows_marked += marked;
+    stats_.dead_rows = dead_rows;
+    stats_.bitmap_bytes = bitmap_bytes;
+    stats_.index_bytes = index_bytes;
+}
+
+DeadRowTracker::Stats DeadRowTracker::getStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+std::vector<std::pair<std::string_view, double>> DeadRowTracker::metrics() const {
+    const Stats stats = getStats();
+    return {
+        {"woved_dead_rows", static_cast<double>(stats.dead_rows)},
+        {"woved_dead_rows_marked", static_cast<double>(stats.rows_marked)},
+        {"woved_dead_row_bitmap_bytes", static_cast<double>(stats.bitmap_bytes)},
+        {"woved_dead_row_index_bytes", static_cast<double>(stats.index_bytes)},
+    };
+}
+
+} // namespace woved::storage
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include <roaring/roaring.hh>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace woved::storage {
+
+struct SegmentSet;
+
+// Live rows of one segment that no query may return any more: a later
+// segment holds a newer version of their id, or a delete of it. Kept as a
+// roaring bitmap over the segment's row ids, so scans step over dead rows
+// as they go instead of the merge asking LatestByIdMap about each
+// candidate. A DeadRows never changes once published; marking more rows
+// makes a new one (DeadRowTracker).
+//
+// `epoch` is the newest version that superseded a row here. A query
+// reading as of an earlier epoch (TwoPhaseEngine::Query::read_epoch) may
+// still need those rows, so at() leaves it without the set.
+struct DeadRows {
+    roaring::Roaring rows;
+    Epoch epoch = 0;
+
+    bool contains(uint64_t row) const { return rows.contains(static_cast<uint32_t>(row)); }
+    uint64_t count() const { return rows.cardinality(); }
+
+    // `dead` if it applies to a read at `read_epoch`; null if not or empty
+    static const DeadRows* at(const DeadRows* dead, Epoch read_epoch) {
+        return dead && dead->epoch <= read_epoch && !dead->rows.isEmpty() ? dead : nullptr;
+    }
+};
+
+// Calls fn(first, count) for each run of rows of [first, first + count)
+// not in `dead` (null: the whole range), in order. Returns the dead rows
+// stepped over.
+template <typename Fn>
+uint64_t forEachLiveRun(const DeadRows* dead, uint64_t first, uint64_t count, Fn&& fn) {
+    if (!dead) {
+        if (count) fn(first, count);
+        return 0;
+    }
+    const uint64_t end = first + count;
+    uint64_t at = first;
+    uint64_t skipped = 0;
+    auto it = dead->rows.begin();
+    it.equalorlarger(static_cast<uint32_t>(first));
+    for (; it != dead->rows.end() && *it < end; ++it) {
+        if (*it > at) fn(at, *it - at);
+        at = uint64_t{*it} + 1;
+        skipped++;
+    }
+    if (at < end) fn(at, end - at);
+    return skipped;
+}
+
+// Keeps the DeadRows of installed segments current; SnapshotRegistry
+// runs it on every install, before the set is published.
+//
+// A segment gets an index of its rows by id hash when first installed (4
+// bytes a row, held while it stays installed). Each segment new to an
+// install (a flush, a merge output) is joined on id hash with every other
+// segment of the set: of two versions of one id the older is dead, and at
+// one epoch a live row loses to a delete. A join walks the smaller side in
+// hash order, probing the other's index, so a flush costs a probe per row
+// per segment rather than a pass over every row installed. Only live rows
+// are marked; tombstones hold no vector to skip.
+//
+// A segment whose rows gain marks gets a new DeadRows; sets published
+// before keep the old one, so a snapshot sees its segments and their dead
+// rows as of one install. Versions still in the message buffer mark
+// nothing until they are flushed.
+class DeadRowTracker {
+public:
+    struct Stats {
+        uint64_t installs = 0;
+        uint64_t rows_marked = 0;    // Over all installs
+        uint64_t dead_rows = 0;      // In the current set
+        uint64_t bitmap_bytes = 0;   // Of the current set's bitmaps
+        uint64_t index_bytes = 0;    // Of the id hash indexes
+    };
+
+    // Fill set.delta_dead and set.stable_dead for its segments, carrying
+    // over what the previous call found. Not thread safe: installs are
+    // serialized by the caller.
+    void update(SegmentSet& set);
+
+    Stats getStats() const;
+
+    // woved_dead_rows, woved_dead_rows_marked, woved_dead_row_bitmap_bytes,
+    // woved_dead_row_index_bytes
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const DeadRows> dead;
+        std::vector<uint32_t> by_hash;  // Row ids, ordered by id hash
+    };
+
+    // By segment object
+    std::unordered_map<const void*, Entry> entries_;
+
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+};
+
+} // namespace woved::storage
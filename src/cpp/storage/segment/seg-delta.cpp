@@ -0,0 +1,789 @@
+#include "seg-delta.h"
+#include "core/config.h"
+#include "core/metrics.h"
+#include "storage/segment/seg-zone.h"
+#include "util/exceptions.h"
+#include "util/fault-point.h"
+#include "util/intern-table.h"
+#include "util/simd-dispatch.h"
+#include "util/vector-codec.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <unordered_map>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t kStreamBytes = 1 << 20;
+// Least max/min ratio of live norms worth a norm-ordered layout
+constexpr float kMinNormSpread = 1.01f;
+
+// Batches small column values into large appends, so the segment writer
+// copies and checksums big pieces instead of one value at a time
+class SectionStream {
+public:
+    explicit SectionStream(SegmentWriter& writer) : writer_(writer) { buf_.reserve(kStreamBytes); }
+
+    void put(const void* data, size_t len) {
+        if (buf_.size() + len > kStreamBytes) flush();
+        if (len >= kStreamBytes) {
+            writer_.append(data, len);
+            return;
+        }
+        const auto* p = static_cast<const std::byte*>(data);
+        buf_.insert(buf_.end(), p, p + len);
+    }
+
+    template <typename T>
+    void put(const T& value) {
+        put(&value, sizeof(T));
+    }
+
+    void flush() {
+        if (buf_.empty()) return;
+        writer_.append(buf_.data(), buf_.size());
+        buf_.clear();
+    }
+
+private:
+    SegmentWriter& writer_;
+    std::vector<std::byte> buf_;
+};
+
+// One RowTable column, a value per row in segment order
+template <typename Fn>
+void writeColumn(SegmentWriter& writer, DeltaColumn column, std::span<const DeltaRow> rows,
+                 std::span<const uint32_t> order, Fn value) {
+    writer.beginSection(SegmentSectionKind::RowTable, static_cast<uint32_t>(column), true);
+    SectionStream stream(writer);
+    for (uint32_t i : order) stream.put(value(rows[i]));
+    stream.flush();
+    writer.endSection();
+}
+
+std::vector<std::byte> readSection(const SegmentReader& reader, DeltaColumn column) {
+    const SegmentSection* section = reader.find(SegmentSectionKind::RowTable, static_cast<uint32_t>(column));
+    if (!section) {
+        throw util::IOException("Segment " + reader.path() + ": missing column " +
+                                std::to_string(static_cast<uint32_t>(column)));
+    }
+    return reader.readSection(*section);
+}
+
+// A fixed-width column; `count` values unless 0 (any whole number)
+template <typename T>
+std::vector<T> loadColumn(const SegmentReader& reader, DeltaColumn column, uint64_t count) {
+    auto bytes = readSection(reader, column);
+    if (count ? bytes.size() != count * sizeof(T) : bytes.size() % sizeof(T) != 0) {
+        throw util::IOException("Segment " + reader.path() + ": column " +
+                                std::to_string(static_cast<uint32_t>(column)) + " has the wrong size");
+    }
+    std::vector<T> values(bytes.size() / sizeof(T));
+    if (!bytes.empty()) std::memcpy(values.data(), bytes.data(), bytes.size());
+    return values;
+}
+
+// Offsets must start at 0, never decrease and end at `total`
+void checkOffsets(const SegmentReader& reader, const std::vector<uint32_t>& offsets, uint64_t total) {
+    if (offsets.empty() || offsets.front() != 0 || offsets.back() != total ||
+        !std::is_sorted(offsets.begin(), offsets.end())) {
+        throw util::IOException("Segment " + reader.path() + ": corrupt offset column");
+    }
+}
+
+uint32_t checkedOffset(uint64_t offset, const char* what) {
+    if (offset > std::numeric_limits<uint32_t>::max()) {
+        throw util::InvalidArgumentException(std::string("Delta segment: ") + what + " exceed 4 GiB");
+    }
+    return static_cast<uint32_t>(offset);
+}
+
+} // namespace
+
+// Total and per-tenant write bytes of a segment file, split by row count
+void accountSegment(WritePoint point, uint64_t file_bytes, std::span<const DeltaRow> rows) {
+    WriteAccounting& writes = Metrics::global().writes;
+    writes.add(point, file_bytes);
+    if (rows.empty()) return;
+    std::unordered_map<std::string_view, uint64_t> counts;
+    for (const DeltaRow& row : rows) counts[row.tenant]++;
+    const auto& tenants = util::InternTable::tenants();
+    for (const auto& [name, count] : counts) {
+        writes.addTenant(point, tenants.find(name).value_or(util::InternTable::kNone),
+                         file_bytes * count / rows.size());
+    }
+}
+
+void writeRowColumns(SegmentWriter& writer, std::span<const DeltaRow> rows, std::span<const uint32_t> order) {
+    writeColumn(writer, DeltaColumn::IdHash, rows, order, [](const DeltaRow& r) { return r.id_hash; });
+    writeColumn(writer, DeltaColumn::Epoch, rows, order, [](const DeltaRow& r) { return r.epoch; });
+    writeColumn(writer, DeltaColumn::Flags, rows, order, [](const DeltaRow& r) {
+        return static_cast<uint8_t>(r.tombstone ? kDeltaTombstone : 0);
+    });
+    writeColumn(writer, DeltaColumn::Uuid, rows, order, [](const DeltaRow& r) { return r.uuid; });
+
+    // Variable-length columns: offsets, then the bytes in the same order
+    uint64_t id_bytes = 0;
+    uint64_t tag_count = 0;
+    std::vector<uint32_t> id_offsets{0};
+    std::vector<uint32_t> tag_offsets{0};
+    id_offsets.reserve(order.size() + 1);
+    tag_offsets.reserve(order.size() + 1);
+    for (uint32_t i : order) {
+        id_bytes += rows[i].id.size();
+        tag_count += rows[i].tags.size();
+        id_offsets.push_back(checkedOffset(id_bytes, "ids"));
+        tag_offsets.push_back(checkedOffset(tag_count, "tags"));
+    }
+    writer.writeSection(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::IdOffsets),
+                        id_offsets.data(), id_offsets.size() * sizeof(uint32_t), true);
+    writer.beginSection(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::IdBytes), true);
+    {
+        SectionStream stream(writer);
+        for (uint32_t i : order) stream.put(rows[i].id.data(), rows[i].id.size());
+        stream.flush();
+    }
+    writer.endSection();
+    writer.writeSection(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::TagOffsets),
+                        tag_offsets.data(), tag_offsets.size() * sizeof(uint32_t), true);
+    writer.beginSection(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::Tags), true);
+    {
+        SectionStream stream(writer);
+        for (uint32_t i : order) stream.put(rows[i].tags.data(), rows[i].tags.size_bytes());
+        stream.flush();
+    }
+    writer.endSection();
+
+    // Tenant and namespace names go through a per-segment dictionary:
+    // ordinals are per process and cannot be persisted
+    std::vector<std::string_view> names{std::string_view()};
+    std::unordered_map<std::string_view, uint32_t> name_index{{std::string_view(), 0}};
+    auto nameOf = [&](std::string_view name) {
+        auto [it, added] = name_index.try_emplace(name, static_cast<uint32_t>(names.size()));
+        if (added) names.push_back(name);
+        return it->second;
+    };
+    writeColumn(writer, DeltaColumn::Tenant, rows, order, [&](const DeltaRow& r) { return nameOf(r.tenant); });
+    writeColumn(writer, DeltaColumn::Namespace, rows, order,
+                [&](const DeltaRow& r) { return nameOf(r.namespace_name); });
+
+    std::vector<uint32_t> name_offsets{0};
+    uint64_t name_bytes = 0;
+    for (std::string_view name : names) {
+        name_bytes += name.size();
+        name_offsets.push_back(checkedOffset(name_bytes, "names"));
+    }
+    writer.writeSection(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::NameOffsets),
+                        name_offsets.data(), name_offsets.size() * sizeof(uint32_t), true);
+    writer.beginSection(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::NameBytes), true);
+    for (std::string_view name : names) writer.append(name.data(), name.size());
+    writer.endSection();
+}
+
+uint64_t newestVersions(std::span<const RowVersions> inputs, bool drop_tombstones,
+                        std::vector<MergedRow>& live, std::vector<MergedRow>& dead) {
+    std::vector<MergedRow> candidates;
+    size_t total = 0;
+    for (const RowVersions& input : inputs) total += input.id_hashes.size();
+    candidates.reserve(total);
+    for (uint32_t s = 0; s < inputs.size(); ++s) {
+        const RowVersions& input = inputs[s];
+        for (uint64_t row = 0; row < input.id_hashes.size(); ++row) {
+            candidates.push_back({input.id_hashes[row], input.epochs[row],
+                                  (input.flags[row] & kDeltaTombstone) != 0, s, row});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const MergedRow& a, const MergedRow& b) {
+        if (a.id_hash != b.id_hash) return a.id_hash < b.id_hash;
+        if (a.epoch != b.epoch) return a.epoch > b.epoch;
+        return a.tombstone && !b.tombstone;
+    });
+    live.clear();
+    dead.clear();
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (i > 0 && candidates[i].id_hash == candidates[i - 1].id_hash) continue;
+        if (!candidates[i].tombstone) {
+            live.push_back(candidates[i]);
+        } else if (!drop_tombstones) {
+            dead.push_back(candidates[i]);
+        }
+    }
+    return total - live.size() - dead.size();
+}
+
+DeltaSegmentWriter::Options DeltaSegmentWriter::Options::fromConfig(const Config& config) {
+    Options options;
+    options.dim = config.collection.dim;
+    options.element_type = util::parse_element_type(config.collection.element_type);
+    options.clustered = config.experimental.connectivity_aware_layout;
+    options.norm_ordered = config.index.delta.sort_by_norm &&
+                           util::parse_metric(config.collection.metric) == Metric::INNER_PRODUCT;
+    options.tenant_partitioned = config.index.delta.tenant_partitioned;
+    options.quantized = config.experimental.vector_compression;
+    options.dedicated_tenant_rows = config.index.delta.dedicated_tenant_rows;
+    options.bloom_fpp = config.filtering.bloom_filter_enabled ? config.filtering.bloom_filter_fpp : 0.0f;
+    options.writer = SegmentWriter::Options::fromConfig(config);
+    return options;
+}
+
+SegmentDescriptor DeltaSegmentWriter::write(const std::string& path, const Options& options,
+                                            std::span<const DeltaRow> rows) {
+    return writeRows(path, options, rows, false);
+}
+
+SegmentDescriptor DeltaSegmentWriter::writeRows(const std::string& path, const Options& options,
+                                                std::span<const DeltaRow> rows, bool compaction) {
+    static_assert(sizeof(DeltaSegmentHeader) == 88, "delta segment header is 88 bytes");
+    static_assert(sizeof(DeltaListExtent) == 24, "delta list extents are 24 bytes");
+    static_assert(sizeof(DeltaTenantExtent) == 32, "delta tenant extents are 32 bytes");
+
+    if (options.dim == 0) throw util::ConfigException("Delta segment: dimension is 0");
+    if (rows.size() > std::numeric_limits<uint32_t>::max()) {
+        throw util::InvalidArgumentException("Delta segment: too many rows: " + std::to_string(rows.size()));
+    }
+    const size_t dim = options.dim;
+    const size_t vector_bytes = dim * util::element_size(options.element_type);
+
+    // Norms of the live vectors as the segment will store them
+    const bool clustered = options.clustered;
+    bool norm_ordered = clustered && options.norm_ordered;
+    std::vector<float> row_norms;
+    if (norm_ordered) {
+        row_norms.assign(rows.size(), 0.0f);
+        std::vector<float> decoded(dim);
+        std::vector<std::byte> encoded(vector_bytes);
+        for (size_t i = 0; i < rows.size(); ++i) {
+            const DeltaRow& r = rows[i];
+            if (r.tombstone || !r.vector || r.vector_len != dim) continue;
+            util::decode_vector(r.vector, dim, r.vector_type, r.vector_scale, decoded.data());
+            if (r.vector_type != options.element_type) {
+                const float scale = util::encode_vector(decoded.data(), dim, options.element_type, encoded.data());
+                util::decode_vector(encoded.data(), dim, options.element_type, scale, decoded.data());
+            }
+            row_norms[i] = std::sqrt(kernels::distance_table().inner_product(decoded.data(), decoded.data(), dim));
+        }
+        // Rows normalized at ingest share one norm up to encoding error:
+        // the bound prunes nothing, so keep the id hash order
+        float lo = std::numeric_limits<float>::infinity();
+        float hi = 0.0f;
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (rows[i].tombstone || row_norms[i] == 0.0f) continue;
+            lo = std::min(lo, row_norms[i]);
+            hi = std::max(hi, row_norms[i]);
+        }
+        if (hi <= lo * kMinNormSpread) {
+            norm_ordered = false;
+            row_norms.clear();
+        }
+    }
+
+    const bool partitioned = options.tenant_partitioned;
+    const bool quantized = options.quantized && options.element_type != ElementType::INT8;
+    std::vector<uint64_t> tenant_hashes;
+    if (partitioned) {
+        tenant_hashes.reserve(rows.size());
+        for (const DeltaRow& r : rows) tenant_hashes.push_back(zoneTenantHash(r.tenant));
+    }
+
+    // Live rows first, grouped by list (then tenant); id hash (or
+    // decreasing norm) order within a list or slice
+    std::vector<uint32_t> order(rows.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        const DeltaRow& x = rows[a];
+        const DeltaRow& y = rows[b];
+        if (x.tombstone != y.tombstone) return y.tombstone;
+        if (clustered && !x.tombstone && x.centroid_id != y.centroid_id) return x.centroid_id < y.centroid_id;
+        if (partitioned && !x.tombstone && tenant_hashes[a] != tenant_hashes[b]) {
+            return tenant_hashes[a] < tenant_hashes[b];
+        }
+        if (norm_ordered && !x.tombstone && row_norms[a] != row_norms[b]) return row_norms[a] > row_norms[b];
+        return x.id_hash < y.id_hash;
+    });
+
+    DeltaSegmentHeader header{};
+    header.magic = DeltaSegmentHeader::kMagic;
+    header.version = DeltaSegmentHeader::kVersion;
+    header.dim = options.dim;
+    header.element_type = static_cast<uint32_t>(options.element_type);
+    header.flags = (clustered ? DeltaSegmentHeader::kClustered : 0) |
+                   (norm_ordered ? DeltaSegmentHeader::kNormOrdered : 0) |
+                   (partitioned ? DeltaSegmentHeader::kTenantPartitioned : 0) |
+                   (quantized ? DeltaSegmentHeader::kQuantized : 0);
+    header.rows = rows.size();
+    header.centroid_version = options.centroid_version;
+    header.min_id_hash = std::numeric_limits<VectorIdHash>::max();
+    header.min_epoch = std::numeric_limits<Epoch>::max();
+
+    std::vector<DeltaListExtent> lists;
+    std::vector<DeltaTenantExtent> slices;
+    for (uint64_t pos = 0; pos < order.size(); ++pos) {
+        const DeltaRow& row = rows[order[pos]];
+        header.min_id_hash = std::min(header.min_id_hash, row.id_hash);
+        header.max_id_hash = std::max(header.max_id_hash, row.id_hash);
+        header.min_epoch = std::min(header.min_epoch, row.epoch);
+        header.max_epoch = std::max(header.max_epoch, row.epoch);
+        if (row.tombstone) continue;
+
+        if (!row.vector || row.vector_len != dim) {
+            throw util::InvalidArgumentException("Delta segment: vector of " + std::to_string(row.vector_len) +
+                                                 " components, expected " + std::to_string(dim));
+        }
+        header.live_rows++;
+        if (partitioned) {
+            const uint32_t list = clustered ? row.centroid_id : kZoneAllLists;
+            const uint64_t tenant = tenant_hashes[order[pos]];
+            if (slices.empty() || slices.back().list != list || slices.back().tenant_hash != tenant) {
+                slices.push_back({list, 0, tenant, pos, 0});
+            }
+            slices.back().rows++;
+        }
+        if (!clustered) continue;
+        if (lists.empty() || lists.back().centroid != row.centroid_id) {
+            lists.push_back({row.centroid_id, 0, pos, 0});
+        }
+        lists.back().rows++;
+    }
+    header.lists = lists.size();
+    if (rows.empty()) {
+        header.min_id_hash = 0;
+        header.min_epoch = 0;
+    }
+    const std::span<const uint32_t> live(order.data(), header.live_rows);
+
+    SegmentWriter writer(path, options.writer);
+    writer.writeSection(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::Header),
+                        &header, sizeof(header));
+    if (clustered) {
+        writer.writeSection(SegmentSectionKind::ListDirectory, 0, lists.data(),
+                            lists.size() * sizeof(DeltaListExtent));
+    }
+    if (partitioned) {
+        writer.writeSection(SegmentSectionKind::ListDirectory, 1, slices.data(),
+                            slices.size() * sizeof(DeltaTenantExtent));
+    }
+
+    // Vectors, re-encoded where the buffered type differs from the segment's
+    std::vector<float> scales;
+    {
+        std::vector<float> decoded(dim);
+        std::vector<std::byte> encoded(vector_bytes);
+        writer.beginSection(SegmentSectionKind::Vectors, 0);
+        SectionStream stream(writer);
+        for (uint32_t i : live) {
+            const DeltaRow& row = rows[i];
+            float scale = row.vector_scale;
+            if (row.vector_type == options.element_type) {
+                stream.put(row.vector, vector_bytes);
+            } else {
+                util::decode_vector(row.vector, dim, row.vector_type, row.vector_scale, decoded.data());
+                scale = util::encode_vector(decoded.data(), dim, options.element_type, encoded.data());
+                stream.put(encoded.data(), vector_bytes);
+            }
+            if (options.element_type == ElementType::INT8) scales.push_back(scale);
+        }
+        stream.flush();
+        writer.endSection();
+    }
+    if (options.element_type == ElementType::INT8) {
+        writer.writeSection(SegmentSectionKind::Vectors, 1, scales.data(), scales.size() * sizeof(float));
+    }
+    if (norm_ordered) {
+        std::vector<float> norms;
+        norms.reserve(live.size());
+        for (uint32_t i : live) norms.push_back(row_norms[i]);
+        writer.writeSection(SegmentSectionKind::Vectors, 2, norms.data(), norms.size() * sizeof(float));
+    }
+    if (quantized) {
+        std::vector<float> decoded(dim);
+        std::vector<std::byte> encoded(dim);
+        std::vector<float> sq8_scales;
+        sq8_scales.reserve(live.size());
+        writer.beginSection(SegmentSectionKind::Vectors, 3);
+        SectionStream stream(writer);
+        for (uint32_t i : live) {
+            const DeltaRow& row = rows[i];
+            util::decode_vector(row.vector, dim, row.vector_type, row.vector_scale, decoded.data());
+            sq8_scales.push_back(util::encode_vector(decoded.data(), dim, ElementType::INT8, encoded.data()));
+            stream.put(encoded.data(), dim);
+        }
+        stream.flush();
+        writer.endSection();
+        writer.writeSection(SegmentSectionKind::Vectors, 4, sq8_scales.data(), sq8_scales.size() * sizeof(float));
+    }
+
+    // Zone map over the vectors as stored, so its bounds hold for what
+    // queries score
+    {
+        ZoneMapBuilder zones(options.dim, options.bloom_fpp);
+        std::vector<std::byte> encoded(vector_bytes);
+        auto addZone = [&](uint32_t list, uint64_t first_row, uint64_t count) {
+            auto row = [&](uint64_t i) -> const DeltaRow& { return rows[live[first_row + i]]; };
+            zones.addList(list, count, row, [&](uint64_t i, float* out) {
+                const DeltaRow& r = row(i);
+                util::decode_vector(r.vector, dim, r.vector_type, r.vector_scale, out);
+                if (r.vector_type == options.element_type) return;
+                const float scale = util::encode_vector(out, dim, options.element_type, encoded.data());
+                util::decode_vector(encoded.data(), dim, options.element_type, scale, out);
+            });
+        };
+        if (clustered) {
+            for (const DeltaListExtent& extent : lists) addZone(extent.centroid, extent.first_row, extent.rows);
+        } else {
+            addZone(kZoneAllLists, 0, header.live_rows);
+        }
+        zones.write(writer);
+    }
+
+    writeRowColumns(writer, rows, order);
+    if (!compaction) util::fault_point("segment_flush");
+    const uint64_t file_bytes = writer.seal();
+    accountSegment(compaction ? WritePoint::Compaction : WritePoint::SegmentSeal, file_bytes, rows);
+
+    SegmentDescriptor descriptor;
+    descriptor.segment_id = std::filesystem::path(path).stem().string();
+    descriptor.file_path = path;
+    descriptor.num_vectors = header.rows;
+    descriptor.min_id_hash = header.min_id_hash;
+    descriptor.max_id_hash = header.max_id_hash;
+    descriptor.min_epoch = header.min_epoch;
+    descriptor.max_epoch = header.max_epoch;
+    descriptor.tombstone_ratio = header.rows == 0 ? 0.0f
+        : static_cast<float>(header.rows - header.live_rows) / static_cast<float>(header.rows);
+    descriptor.created_at = std::chrono::duration_cast<Timestamp>(
+        std::chrono::system_clock::now().time_since_epoch());
+    descriptor.is_stable = false;
+    return descriptor;
+}
+
+SegmentDescriptor DeltaSegmentWriter::merge(const std::string& path, const Options& options,
+                                            std::span<const std::string> inputs, bool drop_tombstones,
+                                            const std::atomic<bool>* cancel) {
+    auto checkCancel = [cancel] {
+        if (cancel && cancel->load(std::memory_order_relaxed)) {
+            throw util::WovedException("Delta segment merge cancelled");
+        }
+    };
+
+    struct Input {
+        std::unique_ptr<DeltaSegment> segment;
+        RowColumns columns;
+        std::span<const std::byte> vectors;
+        std::vector<float> scales;
+    };
+    SegmentReader::Options read_options;
+    read_options.mode = SegmentReader::Mode::Mmap;
+    read_options.huge_pages = false;
+    Options out = options;
+    std::vector<Input> sources(inputs.size());
+    std::vector<RowVersions> versions;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        Input& source = sources[i];
+        source.segment = std::make_unique<DeltaSegment>(inputs[i], read_options);
+        const DeltaSegment& segment = *source.segment;
+        if (segment.header().dim != options.dim) {
+            throw util::InvalidArgumentException("Delta merge: " + inputs[i] + " has dimension " +
+                                                 std::to_string(segment.header().dim));
+        }
+        if (options.writer.limiter) options.writer.limiter->acquire(source.segment->reader().fileBytes());
+        source.columns = segment.readRows();
+        source.vectors = segment.vectors();
+        source.scales = segment.scales({0, segment.liveRows()});
+        out.clustered = out.clustered && segment.clustered();
+        // Older list ids translate forward, never back
+        if (i == 0 || segment.header().centroid_version < out.centroid_version) {
+            out.centroid_version = segment.header().centroid_version;
+        }
+        versions.push_back({segment.idHashes(), segment.epochs(), segment.flags()});
+        checkCancel();
+    }
+
+    std::vector<MergedRow> live;
+    std::vector<MergedRow> dead;
+    newestVersions(versions, drop_tombstones, live, dead);
+    checkCancel();
+
+    std::vector<DeltaRow> rows;
+    rows.reserve(live.size() + dead.size());
+    for (const MergedRow& m : live) {
+        const Input& source = sources[m.source];
+        const DeltaSegment& segment = *source.segment;
+        DeltaRow row = segment.row(source.columns, m.row);
+        row.vector = source.vectors.data() + m.row * segment.vectorBytes();
+        row.vector_len = segment.header().dim;
+        row.vector_type = static_cast<ElementType>(segment.header().element_type);
+        row.vector_scale = source.scales[m.row];
+        if (out.clustered) {
+            // The extent holding the row names its list
+            const auto& lists = segment.lists();
+            auto it = std::upper_bound(lists.begin(), lists.end(), m.row,
+                                       [](uint64_t r, const DeltaListExtent& e) { return r < e.first_row; });
+            row.centroid_id = it == lists.begin() ? 0 : std::prev(it)->centroid;
+        }
+        rows.push_back(row);
+    }
+    for (const MergedRow& m : dead) rows.push_back(sources[m.source].segment->row(sources[m.source].columns, m.row));
+    checkCancel();
+    return writeRows(path, out, rows, true);
+}
+
+std::vector<std::vector<DeltaRow>> DeltaSegmentWriter::splitTenants(const Options& options,
+                                                                    std::span<const DeltaRow> rows) {
+    std::vector<std::vector<DeltaRow>> groups;
+    std::unordered_map<std::string_view, uint64_t> counts;
+    if (options.dedicated_tenant_rows > 0) {
+        for (const DeltaRow& r : rows) counts[r.tenant]++;
+    }
+    // Group 0 is shared; a dedicated tenant's group is made on its first row
+    std::unordered_map<std::string_view, size_t> dedicated;
+    groups.emplace_back();
+    for (const DeltaRow& r : rows) {
+        auto it = counts.find(r.tenant);
+        if (it == counts.end() || it->second < options.dedicated_tenant_rows) {
+            groups.front().push_back(r);
+            continue;
+        }
+        auto [slot, added] = dedicated.try_emplace(r.tenant, groups.size());
+        if (added) groups.emplace_back();
+        groups[slot->second].push_back(r);
+    }
+    if (groups.front().empty() && groups.size() > 1) groups.erase(groups.begin());
+    return groups;
+}
+
+DeltaSegment::DeltaSegment(std::string path, const SegmentReader::Options& options)
+    : reader_(std::move(path), options) {
+    auto raw = readColumn(DeltaColumn::Header);
+    // Version 1 headers end before centroid_version
+    constexpr size_t kHeaderV1 = offsetof(DeltaSegmentHeader, centroid_version);
+    if (raw.size() != sizeof(header_) && raw.size() != kHeaderV1) {
+        throw util::IOException("Delta segment " + reader_.path() + ": bad header size");
+    }
+    header_ = {};
+    std::memcpy(&header_, raw.data(), raw.size());
+    const uint32_t expect_version = raw.size() == kHeaderV1 ? 1 : DeltaSegmentHeader::kVersion;
+    if (header_.magic != DeltaSegmentHeader::kMagic || header_.version != expect_version) {
+        throw util::IOException("Delta segment " + reader_.path() + ": not a delta segment (version " +
+                                std::to_string(header_.version) + ")");
+    }
+    if (header_.element_type > static_cast<uint32_t>(ElementType::INT8) || header_.live_rows > header_.rows) {
+        throw util::IOException("Delta segment " + reader_.path() + ": corrupt header");
+    }
+
+    vector_bytes_ = header_.dim * util::element_size(static_cast<ElementType>(header_.element_type));
+    vectors_ = reader_.find(SegmentSectionKind::Vectors, 0);
+    if (!vectors_ || vectors_->length != header_.live_rows * vector_bytes_) {
+        throw util::IOException("Delta segment " + reader_.path() + ": vector section does not match the header");
+    }
+
+    if (clustered()) {
+        const SegmentSection* dir = reader_.find(SegmentSectionKind::ListDirectory, 0);
+        if (!dir || dir->length != header_.lists * sizeof(DeltaListExtent)) {
+            throw util::IOException("Delta segment " + reader_.path() + ": bad list directory");
+        }
+        lists_.resize(header_.lists);
+        auto bytes = reader_.readSection(*dir);
+        if (!bytes.empty()) std::memcpy(lists_.data(), bytes.data(), bytes.size());
+        for (const DeltaListExtent& extent : lists_) {
+            if (extent.first_row + extent.rows > header_.live_rows) {
+                throw util::IOException("Delta segment " + reader_.path() + ": list extent out of range");
+            }
+        }
+    }
+
+    if (tenantPartitioned()) {
+        const SegmentSection* dir = reader_.find(SegmentSectionKind::ListDirectory, 1);
+        if (!dir || dir->length % sizeof(DeltaTenantExtent) != 0) {
+            throw util::IOException("Delta segment " + reader_.path() + ": bad tenant directory");
+        }
+        tenants_.resize(dir->length / sizeof(DeltaTenantExtent));
+        auto bytes = reader_.readSection(*dir);
+        if (!bytes.empty()) std::memcpy(tenants_.data(), bytes.data(), bytes.size());
+        for (const DeltaTenantExtent& extent : tenants_) {
+            if (extent.first_row + extent.rows > header_.live_rows) {
+                throw util::IOException("Delta segment " + reader_.path() + ": tenant extent out of range");
+            }
+        }
+        if (!std::is_sorted(tenants_.begin(), tenants_.end(), [](const DeltaTenantExtent& a, const DeltaTenantExtent& b) {
+                return std::pair(a.list, a.tenant_hash) < std::pair(b.list, b.tenant_hash);
+            })) {
+            throw util::IOException("Delta segment " + reader_.path() + ": tenant directory out of order");
+        }
+    }
+
+    id_hashes_ = loadColumn<VectorIdHash>(reader_, DeltaColumn::IdHash, header_.rows);
+    epochs_ = loadColumn<Epoch>(reader_, DeltaColumn::Epoch, header_.rows);
+    flags_ = loadColumn<uint8_t>(reader_, DeltaColumn::Flags, header_.rows);
+    if (normOrdered()) {
+        const SegmentSection* section = reader_.find(SegmentSectionKind::Vectors, 2);
+        if (!section || section->length != header_.live_rows * sizeof(float)) {
+            throw util::IOException("Delta segment " + reader_.path() + ": bad norm section");
+        }
+        norms_.resize(header_.live_rows);
+        auto bytes = reader_.readSection(*section);
+        if (!bytes.empty()) std::memcpy(norms_.data(), bytes.data(), bytes.size());
+    }
+    if (quantized()) {
+        const SegmentSection* codes = reader_.find(SegmentSectionKind::Vectors, 3);
+        const SegmentSection* scales = reader_.find(SegmentSectionKind::Vectors, 4);
+        if (!codes || codes->length != header_.live_rows * header_.dim || !scales ||
+            scales->length != header_.live_rows * sizeof(float)) {
+            throw util::IOException("Delta segment " + reader_.path() + ": bad quantized vector sections");
+        }
+        sq8_ = reader_.readSection(*codes);
+        sq8_scales_.resize(header_.live_rows);
+        auto bytes = reader_.readSection(*scales);
+        if (!bytes.empty()) std::memcpy(sq8_scales_.data(), bytes.data(), bytes.size());
+    }
+    zone_map_ = ZoneMap::read(reader_);
+}
+
+std::vector<std::byte> DeltaSegment::readColumn(DeltaColumn column) const {
+    return readSection(reader_, column);
+}
+
+DeltaRow DeltaSegment::row(const RowColumns& columns, uint64_t row) const {
+    DeltaRow out;
+    out.id_hash = id_hashes_[row];
+    out.epoch = epochs_[row];
+    out.tombstone = tombstone(row);
+    out.uuid = columns.uuids[row];
+    out.id = columns.id(row);
+    out.tenant = columns.name(columns.tenants[row]);
+    out.namespace_name = columns.name(columns.namespaces[row]);
+    out.tags = columns.tagsOf(row);
+    out.vector_type = static_cast<ElementType>(header_.element_type);
+    return out;
+}
+
+RowColumns RowColumns::read(const SegmentReader& reader, uint64_t rows) {
+    RowColumns columns;
+    columns.uuids = loadColumn<VectorUuid>(reader, DeltaColumn::Uuid, rows);
+    columns.id_offsets = loadColumn<uint32_t>(reader, DeltaColumn::IdOffsets, rows + 1);
+    columns.id_bytes = loadColumn<char>(reader, DeltaColumn::IdBytes, 0);
+    columns.tenants = loadColumn<uint32_t>(reader, DeltaColumn::Tenant, rows);
+    columns.namespaces = loadColumn<uint32_t>(reader, DeltaColumn::Namespace, rows);
+    columns.tag_offsets = loadColumn<uint32_t>(reader, DeltaColumn::TagOffsets, rows + 1);
+    columns.tags = loadColumn<TagId>(reader, DeltaColumn::Tags, 0);
+    columns.name_offsets = loadColumn<uint32_t>(reader, DeltaColumn::NameOffsets, 0);
+    columns.name_bytes = loadColumn<char>(reader, DeltaColumn::NameBytes, 0);
+
+    checkOffsets(reader, columns.id_offsets, columns.id_bytes.size());
+    checkOffsets(reader, columns.tag_offsets, columns.tags.size());
+    checkOffsets(reader, columns.name_offsets, columns.name_bytes.size());
+    const size_t names = columns.name_offsets.size() - 1;
+    auto inRange = [names](uint32_t index) { return index < names; };
+    if (!std::all_of(columns.tenants.begin(), columns.tenants.end(), inRange) ||
+        !std::all_of(columns.namespaces.begin(), columns.namespaces.end(), inRange)) {
+        throw util::IOException("Segment " + reader.path() + ": name index out of range");
+    }
+    return columns;
+}
+
+DeltaSegment::RowRange DeltaSegment::list(CentroidId centroid) const {
+    if (!clustered()) return {0, header_.live_rows};
+    auto it = std::lower_bound(lists_.begin(), lists_.end(), centroid,
+                               [](const DeltaListExtent& e, CentroidId c) { return e.centroid < c; });
+    if (it == lists_.end() || it->centroid != centroid) return {};
+    return {it->first_row, it->rows};
+}
+
+DeltaSegment::RowRange DeltaSegment::tenantSlice(uint32_t list, uint64_t tenant_hash) const {
+    if (!tenantPartitioned()) return this->list(static_cast<CentroidId>(list));
+    if (!clustered()) list = kZoneAllLists;
+    auto it = std::lower_bound(tenants_.begin(), tenants_.end(), std::pair(list, tenant_hash),
+                               [](const DeltaTenantExtent& e, const std::pair<uint32_t, uint64_t>& key) {
+                                   return std::pair(e.list, e.tenant_hash) < key;
+                               });
+    if (it == tenants_.end() || it->list != list || it->tenant_hash != tenant_hash) return {};
+    return {it->first_row, it->rows};
+}
+
+std::span<const std::byte> DeltaSegment::listVectors(CentroidId centroid) const {
+    return rangeVectors(list(centroid));
+}
+
+std::span<const std::byte> DeltaSegment::rangeVectors(RowRange range) const {
+    auto vectors = reader_.view(*vectors_);
+    return vectors.subspan(range.first_row * vector_bytes_, range.rows * vector_bytes_);
+}
+
+void DeltaSegment::readRange(RowRange range, std::vector<std::byte>& out) const {
+    out.resize(range.rows * vector_bytes_);
+    if (range.rows == 0) return;
+    reader_.read(*vectors_, range.first_row * vector_bytes_, out);
+}
+
+std::span<const std::byte> DeltaSegment::quantizedVectors(RowRange range) const {
+    if (sq8_.empty()) return {};
+    return std::span(sq8_).subspan(range.first_row * header_.dim, range.rows * header_.dim);
+}
+
+std::span<const float> DeltaSegment::quantizedScales(RowRange range) const {
+    if (sq8_scales_.empty()) return {};
+    return std::span(sq8_scales_).subspan(range.first_row, range.rows);
+}
+
+util::Task<void> DeltaSegment::readRangeAsync(RowRange range, std::vector<std::byte>& out) const {
+    out.resize(range.rows * vector_bytes_);
+    if (range.rows == 0) co_return;
+    co_await reader_.readAsync(*vectors_, range.first_row * vector_bytes_, out);
+}
+
+std::vector<DeltaSegment::RowRange> DeltaSegment::readLists(std::span<const CentroidId> centroids,
+                                                            std::vector<std::byte>& out) const {
+    std::vector<RowRange> ranges;
+    ranges.reserve(centroids.size());
+    uint64_t total = 0;
+    for (CentroidId centroid : centroids) {
+        ranges.push_back(list(centroid));
+        total += ranges.back().rows;
+    }
+    out.resize(total * vector_bytes_);
+
+    std::vector<SegmentReader::ReadRequest> requests;
+    requests.reserve(ranges.size());
+    size_t pos = 0;
+    for (const RowRange& range : ranges) {
+        if (range.rows == 0) continue;
+        const size_t bytes = range.rows * vector_bytes_;
+        requests.push_back({vectors_, range.first_row * vector_bytes_, std::span(out).subspan(pos, bytes)});
+        pos += bytes;
+    }
+    reader_.readBatch(requests);
+    return ranges;
+}
+
+std::vector<float> DeltaSegment::scales(RowRange range) const {
+    std::vector<float> values(range.rows, 1.0f);
+    if (static_cast<ElementType>(header_.element_type) != ElementType::INT8 || range.rows == 0) return values;
+    const SegmentSection* section = reader_.find(SegmentSectionKind::Vectors, 1);
+    if (!section) throw util::IOException("Delta segment " + reader_.path() + ": missing INT8 scales");
+    reader_.read(*section, range.first_row * sizeof(float), std::as_writable_bytes(std::span(values)));
+    return values;
+}
+
+SegmentDescriptor DeltaSegment::descriptor() const {
+    SegmentDescriptor descriptor;
+    descriptor.segment_id = std::filesystem::path(reader_.path()).stem().string();
+    descriptor.file_path = reader_.path();
+    descriptor.num_vectors = header_.rows;
+    descriptor.min_id_hash = header_.min_id_hash;
+    descriptor.max_id_hash = header_.max_id_hash;
+    descriptor.min_epoch = header_.min_epoch;
+    descriptor.max_epoch = header_.max_epoch;
+    descriptor.tombstone_ratio = header_.rows == 0 ? 0.0f
+        : static_cast<float>(header_.rows - header_.live_rows) / static_cast<float>(header_.rows);
+    descriptor.created_at = std::chrono::microseconds(reader_.footer().created_at_us);
+    descriptor.is_stable = false;
+    return descriptor;
+}
+
+} // namespace woved::storage
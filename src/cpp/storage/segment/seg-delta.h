@@ -0,0 +1,350 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "storage/segment/seg-r.h"
+#include "storage/segment/seg-w.h"
+#include "storage/segment/seg-zone.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::storage {
+
+// Delta segment layout on top of the segment file (seg-w.h).
+//
+// Rows are ordered live before tombstones, then by global centroid, then
+// by id hash, so each IVF list's vectors are one contiguous extent of the
+// vector section. The list directory maps a centroid to its row range: a
+// query probing nprobe lists issues nprobe sequential reads (or touches
+// nprobe runs of the mapping) instead of gathering scattered rows.
+// Tombstones carry no vector and sort last, so vector i is row i.
+//
+// With experimental.connectivity_aware_layout off, live rows are ordered
+// by id hash only, there is no directory, and every list resolves to the
+// whole live range.
+//
+// centroid_version is the CentroidsManager version the rows were assigned
+// against; a query maps its probe lists back to that version
+// (CentroidsManager::translate) before reading the directory. Version 1
+// segments predate it and read as 0.
+//
+// Norm-ordered segments (kNormOrdered, inner product collections with
+// index.delta.sort_by_norm) sort the rows of each list by decreasing norm
+// instead of id hash and keep the norms: q.v <= |q| |v|, so a scan may
+// stop at the first row whose norm bound cannot beat the k-th score, and
+// a sampled prefix of a list holds its most promising rows. This only
+// helps raw MIPS data: vectors normalized at ingest share one norm, and a
+// flush whose live norms lie within 1% of each other is written in id
+// hash order without the flag.
+//
+// Tenant-partitioned segments (kTenantPartitioned, index.delta.
+// tenant_partitioned) order the rows of each list by tenant before id
+// hash or norm, and a second directory maps (list, tenant) to its slice:
+// a tenant-scoped query reads only its own rows of a list instead of
+// every tenant's. Tenants are keyed by zoneTenantHash(), as interned
+// ordinals are per process. An unclustered segment has one slice per
+// tenant, under list kZoneAllLists.
+//
+// Quantized segments (kQuantized, experimental.vector_compression) also
+// hold an SQ8 copy of the live vectors: INT8 with a per-vector scale
+// (util::encode_vector), a quarter of fp32. The reader keeps it in memory,
+// so delta scans score the copy without touching the file and read the
+// stored vectors only to rescore their candidates exactly. INT8 segments
+// have no copy; their vectors are already SQ8.
+//
+// Sections:
+//   RowTable 0        DeltaSegmentHeader
+//   ListDirectory 0   DeltaListExtent per list, by centroid
+//   ListDirectory 1   DeltaTenantExtent per slice, by list then tenant
+//                     hash; tenant-partitioned only
+//   Vectors 0         Live vectors, row-major, dim x element_type
+//   Vectors 1         Per-vector INT8 scales (float), INT8 only
+//   Vectors 2         Per-vector norms (float), norm-ordered only
+//   Vectors 3         SQ8 copy of the live vectors, dim bytes each;
+//                     quantized only
+//   Vectors 4         Per-vector scales of the copy (float); quantized only
+//   Metadata 2, 3     Zone map, one zone per list (seg-zone.h)
+//   RowTable <col>    One column per DeltaColumn
+enum class DeltaColumn : uint32_t {
+    Header = 0,
+    IdHash = 1,       // VectorIdHash per row
+    Epoch = 2,        // Epoch per row
+    Flags = 3,        // uint8_t per row, kDeltaTombstone
+    Uuid = 4,         // VectorUuid per row, nil for string ids
+    IdOffsets = 5,    // uint32_t, rows + 1, into IdBytes
+    IdBytes = 6,
+    Tenant = 7,       // uint32_t index into the name dictionary
+    Namespace = 8,    // uint32_t index into the name dictionary
+    TagOffsets = 9,   // uint32_t, rows + 1, into Tags
+    Tags = 10,        // TagId
+    NameOffsets = 11, // uint32_t, names + 1, into NameBytes; name 0 is ""
+    NameBytes = 12,
+};
+
+inline constexpr uint8_t kDeltaTombstone = 0x1;
+
+struct DeltaSegmentHeader {
+    static constexpr uint64_t kMagic = 0x544c444445564f57ULL;  // "WOVEDDLT"
+    static constexpr uint32_t kVersion = 2;
+    static constexpr uint32_t kClustered = 0x1;
+    static constexpr uint32_t kNormOrdered = 0x2;
+    static constexpr uint32_t kTenantPartitioned = 0x4;
+    static constexpr uint32_t kQuantized = 0x8;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t element_type;     // ElementType
+    uint32_t flags;            // kClustered, kNormOrdered, kTenantPartitioned, kQuantized
+    uint64_t rows;
+    uint64_t live_rows;        // Rows [0, live_rows) have vectors
+    uint64_t lists;            // Directory entries
+    VectorIdHash min_id_hash;
+    VectorIdHash max_id_hash;
+    Epoch min_epoch;
+    Epoch max_epoch;
+    uint64_t centroid_version;
+};
+
+struct DeltaListExtent {
+    uint32_t centroid;         // CentroidId
+    uint32_t reserved;
+    uint64_t first_row;
+    uint64_t rows;
+};
+
+// Rows of one tenant within a list
+struct DeltaTenantExtent {
+    uint32_t list;             // CentroidId, kZoneAllLists if unclustered
+    uint32_t reserved;
+    uint64_t tenant_hash;      // zoneTenantHash()
+    uint64_t first_row;
+    uint64_t rows;
+};
+
+// One row handed to the writer, borrowed from the message buffer
+struct DeltaRow {
+    VectorIdHash id_hash = 0;
+    Epoch epoch = 0;
+    bool tombstone = false;
+    CentroidId centroid_id = 0;
+    VectorUuid uuid;
+    std::string_view id;
+    std::string_view tenant;
+    std::string_view namespace_name;
+    std::span<const TagId> tags;
+    const void* vector = nullptr;      // Ignored for tombstones
+    uint32_t vector_len = 0;           // Components
+    ElementType vector_type = ElementType::FP32;
+    float vector_scale = 1.0f;
+};
+
+// Builds one delta segment from a flushed batch of rows
+class DeltaSegmentWriter {
+public:
+    struct Options {
+        uint32_t dim = 768;
+        ElementType element_type = ElementType::FP32;
+        bool clustered = true;
+        bool norm_ordered = false;      // Rows of a list by decreasing norm; clustered only
+        bool tenant_partitioned = false;  // Rows of a list grouped by tenant
+        bool quantized = false;         // Add an SQ8 copy of the vectors; ignored for INT8
+        uint64_t dedicated_tenant_rows = 0;  // splitTenants() threshold; 0: never split
+        uint64_t centroid_version = 0;  // CentroidsManager::version() the rows were assigned at
+        float bloom_fpp = 0.01f;        // Zone map bloom filter; 0: none
+        SegmentWriter::Options writer;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    // Sorts the rows into list order, writes and seals `path`. Throws
+    // util::InvalidArgumentException for a live row whose vector does not
+    // have `dim` components, util::IOException on write failure.
+    static SegmentDescriptor write(const std::string& path, const Options& options,
+                                   std::span<const DeltaRow> rows);
+
+    // Compacts the delta segments at `inputs` into one, keeping the newest
+    // version of each id (newestVersions). Rows keep the list they were
+    // clustered into; if any input is unclustered the output is too. The
+    // output takes the oldest centroid_version of its inputs. Input
+    // reads and output writes are charged to options.writer.limiter. A set
+    // `cancel` aborts with util::WovedException before the output is
+    // written.
+    static SegmentDescriptor merge(const std::string& path, const Options& options,
+                                   std::span<const std::string> inputs, bool drop_tombstones = false,
+                                   const std::atomic<bool>* cancel = nullptr);
+
+    // Splits a flushed batch into the segments to write: each tenant with
+    // at least options.dedicated_tenant_rows rows (live or not) in a
+    // segment of its own, the others together. One group, in the input
+    // order, when the threshold is 0 or no tenant reaches it.
+    static std::vector<std::vector<DeltaRow>> splitTenants(const Options& options, std::span<const DeltaRow> rows);
+
+private:
+    // write(); merge() output counts as compaction bytes, not a seal
+    static SegmentDescriptor writeRows(const std::string& path, const Options& options,
+                                       std::span<const DeltaRow> rows, bool compaction);
+};
+
+// The id hash, epoch and flag columns of one merge input
+struct RowVersions {
+    std::span<const VectorIdHash> id_hashes;
+    std::span<const Epoch> epochs;
+    std::span<const uint8_t> flags;
+};
+
+// A winning row of a merge: row `row` of input `source`
+struct MergedRow {
+    VectorIdHash id_hash;
+    Epoch epoch;
+    bool tombstone;
+    uint32_t source;
+    uint64_t row;
+};
+
+// Newest version of each id across `inputs`, in id hash order; a tombstone
+// wins an epoch tie. Live winners go to `live`, tombstones to `dead` unless
+// `drop_tombstones` (nothing older can hold their ids). Returns the number
+// of rows superseded or dropped.
+uint64_t newestVersions(std::span<const RowVersions> inputs, bool drop_tombstones,
+                        std::vector<MergedRow>& live, std::vector<MergedRow>& dead);
+
+// Writes the RowTable columns from IdHash on, one value per row of
+// `order`; shared by the delta and stable segment writers. The columns are
+// compressible: with compress_metadata they are stored zstd compressed.
+void writeRowColumns(SegmentWriter& writer, std::span<const DeltaRow> rows, std::span<const uint32_t> order);
+
+// The id, uuid, tenant, namespace and tag columns of a segment, read in one
+// go for merges; the accessors return views into them
+struct RowColumns {
+    std::vector<VectorUuid> uuids;
+    std::vector<uint32_t> id_offsets;
+    std::vector<char> id_bytes;
+    std::vector<uint32_t> tenants;
+    std::vector<uint32_t> namespaces;
+    std::vector<uint32_t> tag_offsets;
+    std::vector<TagId> tags;
+    std::vector<uint32_t> name_offsets;
+    std::vector<char> name_bytes;
+
+    std::string_view id(uint64_t row) const {
+        return {id_bytes.data() + id_offsets[row], id_offsets[row + 1] - id_offsets[row]};
+    }
+    std::string_view name(uint32_t index) const {
+        return {name_bytes.data() + name_offsets[index], name_offsets[index + 1] - name_offsets[index]};
+    }
+    std::span<const TagId> tagsOf(uint64_t row) const {
+        return std::span(tags).subspan(tag_offsets[row], tag_offsets[row + 1] - tag_offsets[row]);
+    }
+
+    // Throws util::IOException if a column is missing or inconsistent
+    static RowColumns read(const SegmentReader& reader, uint64_t rows);
+};
+
+// Read side of a delta segment. The header, directory, the id hash,
+// epoch and flag columns and the SQ8 copy (quantized segments) are loaded
+// on open; vectors and the remaining columns are read on demand.
+class DeltaSegment {
+public:
+    struct RowRange {
+        uint64_t first_row = 0;
+        uint64_t rows = 0;
+    };
+
+    DeltaSegment(std::string path, const SegmentReader::Options& options);
+
+    const DeltaSegmentHeader& header() const { return header_; }
+    bool clustered() const { return (header_.flags & DeltaSegmentHeader::kClustered) != 0; }
+    bool normOrdered() const { return (header_.flags & DeltaSegmentHeader::kNormOrdered) != 0; }
+    bool tenantPartitioned() const { return (header_.flags & DeltaSegmentHeader::kTenantPartitioned) != 0; }
+    bool quantized() const { return (header_.flags & DeltaSegmentHeader::kQuantized) != 0; }
+    uint64_t rows() const { return header_.rows; }
+    uint64_t liveRows() const { return header_.live_rows; }
+    size_t vectorBytes() const { return vector_bytes_; }
+    const std::vector<DeltaListExtent>& lists() const { return lists_; }
+    SegmentReader& reader() { return reader_; }
+    const SegmentReader& reader() const { return reader_; }
+
+    // Rows of one list; empty if the list has no live rows here
+    RowRange list(CentroidId centroid) const;
+
+    // Rows of one tenant (zoneTenantHash()) within a list; the whole list
+    // unless tenantPartitioned(). `list` is ignored if unclustered.
+    RowRange tenantSlice(uint32_t list, uint64_t tenant_hash) const;
+
+    // The list's vectors in place (mmap mode only)
+    std::span<const std::byte> listVectors(CentroidId centroid) const;
+
+    // Vectors of a row range in place (mmap mode only), or copied into
+    // `out` with one read, blocking or awaited
+    std::span<const std::byte> rangeVectors(RowRange range) const;
+    void readRange(RowRange range, std::vector<std::byte>& out) const;
+    util::Task<void> readRangeAsync(RowRange range, std::vector<std::byte>& out) const;
+
+    // Copy the vectors of several lists, one read per list, submitted as a
+    // single batch. `out` is resized to the lists' rows back to back, in
+    // the order given; returns each list's range.
+    std::vector<RowRange> readLists(std::span<const CentroidId> centroids,
+                                    std::vector<std::byte>& out) const;
+
+    // Per-vector INT8 scales of a row range (1 for other types)
+    std::vector<float> scales(RowRange range) const;
+
+    // Norm of each live vector as stored; empty unless normOrdered()
+    std::span<const float> norms() const { return norms_; }
+
+    // Every live vector in place (mmap mode only)
+    std::span<const std::byte> vectors() const { return reader_.view(*vectors_); }
+    const SegmentSection& vectorSection() const { return *vectors_; }
+
+    // The SQ8 copy of a row range and its scales, in memory; empty unless
+    // quantized()
+    std::span<const std::byte> quantizedVectors(RowRange range) const;
+    std::span<const float> quantizedScales(RowRange range) const;
+    // Bytes of the copy held
+    size_t residentBytes() const { return sq8_.size() + sq8_scales_.size() * sizeof(float); }
+
+    std::span<const VectorIdHash> idHashes() const { return id_hashes_; }
+    std::span<const Epoch> epochs() const { return epochs_; }
+    std::span<const uint8_t> flags() const { return flags_; }
+    bool tombstone(uint64_t row) const { return (flags_[row] & kDeltaTombstone) != 0; }
+
+    // Whole column, checksum verified
+    std::vector<std::byte> readColumn(DeltaColumn column) const;
+
+    RowColumns readRows() const { return RowColumns::read(reader_, header_.rows); }
+
+    // Row fields as views into `columns` (from readRows()), without the vector
+    DeltaRow row(const RowColumns& columns, uint64_t row) const;
+
+    // Loaded on open; std::nullopt for segments written without one
+    const std::optional<ZoneMap>& zoneMap() const { return zone_map_; }
+
+    SegmentDescriptor descriptor() const;
+
+private:
+    SegmentReader reader_;
+    DeltaSegmentHeader header_{};
+    size_t vector_bytes_ = 0;
+    const SegmentSection* vectors_ = nullptr;
+    std::vector<DeltaListExtent> lists_;
+    std::vector<DeltaTenantExtent> tenants_;
+    std::vector<VectorIdHash> id_hashes_;
+    std::vector<Epoch> epochs_;
+    std::vector<uint8_t> flags_;
+    std::vector<float> norms_;
+    std::vector<std::byte> sq8_;
+    std::vector<float> sq8_scales_;
+    std::optional<ZoneMap> zone_map_;
+};
+
+} // namespace woved::storage
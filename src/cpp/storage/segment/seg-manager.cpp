@@ -0,0 +1,308 @@
+#include "seg-manager.h"
+#include "core/config.h"
+#include "storage/segment/seg-placement.h"
+#include "util/fault-point.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace woved::storage {
+
+namespace {
+
+double deadRows(const SegmentDescriptor& d) {
+    return static_cast<double>(d.num_vectors) * static_cast<double>(d.tombstone_ratio);
+}
+
+bool olderThan(const SegmentDescriptor& a, const SegmentDescriptor& b) {
+    return a.max_epoch != b.max_epoch ? a.max_epoch < b.max_epoch : a.min_epoch < b.min_epoch;
+}
+
+} // namespace
+
+SegmentManager::Options SegmentManager::Options::fromConfig(const Config& config) {
+    Options options;
+    const SegmentConfig& segment = config.storage.segment;
+    options.max_segments_per_leaf = std::max<uint32_t>(1, segment.max_segments_per_leaf);
+    options.tombstone_ratio_threshold = segment.tombstone_ratio_threshold;
+    options.target_size_vectors = std::max<uint64_t>(1, segment.target_size_vectors);
+    // As for stable builds: the absolute cap, unless an IOManager's
+    // compaction limiter is passed in
+    options.bandwidth_bytes_per_s = uint64_t{config.io.merge_bandwidth_limit_mbps} * 1048576;
+    options.delta = DeltaSegmentWriter::Options::fromConfig(config);
+    options.stable = StableSegmentBuilder::Options::fromConfig(config);
+    return options;
+}
+
+SegmentManager::SegmentManager(const Options& options, PathFn path, InstallFn install,
+                               std::shared_ptr<io::RateLimiter> limiter, SegmentPlacement* placement)
+    : options_(options), path_(std::move(path)), install_(std::move(install)), limiter_(std::move(limiter)),
+      placement_(placement) {
+    options_.interval_ms = std::max<uint32_t>(1, options_.interval_ms);
+    options_.max_merge_inputs = std::max<size_t>(2, options_.max_merge_inputs);
+    options_.max_segments_per_leaf = std::max<uint32_t>(1, options_.max_segments_per_leaf);
+    if (!limiter_) limiter_ = std::make_shared<io::RateLimiter>(options_.bandwidth_bytes_per_s);
+    options_.delta.writer.limiter = limiter_;
+    options_.stable.writer.limiter = limiter_;
+}
+
+SegmentManager::~SegmentManager() {
+    stop();
+}
+
+void SegmentManager::add(uint64_t leaf, const SegmentDescriptor& segment) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    insertLocked(leaf, segment);
+}
+
+void SegmentManager::insertLocked(uint64_t leaf, const SegmentDescriptor& segment) {
+    auto& entries = leaves_[leaf];
+    auto pos = std::upper_bound(entries.begin(), entries.end(), segment, [](const SegmentDescriptor& s, const Entry& e) {
+        return olderThan(s, e.descriptor);
+    });
+    entries.insert(pos, {segment, leaf});
+}
+
+bool SegmentManager::remove(const std::string& segment_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = leaves_.begin(); it != leaves_.end(); ++it) {
+        auto& entries = it->second;
+        auto pos = std::find_if(entries.begin(), entries.end(),
+                                [&](const Entry& e) { return e.descriptor.segment_id == segment_id; });
+        if (pos == entries.end()) continue;
+        entries.erase(pos);
+        if (entries.empty()) leaves_.erase(it);
+        return true;
+    }
+    return false;
+}
+
+void SegmentManager::removeLocked(const std::vector<SegmentDescriptor>& inputs) {
+    for (auto it = leaves_.begin(); it != leaves_.end();) {
+        auto& entries = it->second;
+        std::erase_if(entries, [&](const Entry& e) {
+            return std::any_of(inputs.begin(), inputs.end(),
+                               [&](const SegmentDescriptor& d) { return d.segment_id == e.descriptor.segment_id; });
+        });
+        it = entries.empty() ? leaves_.erase(it) : std::next(it);
+    }
+}
+
+void SegmentManager::replace(const std::vector<SegmentDescriptor>& inputs, uint64_t leaf,
+                             const SegmentDescriptor& output) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    removeLocked(inputs);
+    insertLocked(leaf, output);
+}
+
+std::vector<SegmentDescriptor> SegmentManager::segments(uint64_t leaf) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<SegmentDescriptor> out;
+    auto it = leaves_.find(leaf);
+    if (it == leaves_.end()) return out;
+    for (const Entry& e : it->second) out.push_back(e.descriptor);
+    return out;
+}
+
+size_t SegmentManager::fanout(uint64_t leaf) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = leaves_.find(leaf);
+    return it == leaves_.end() ? 0 : it->second.size();
+}
+
+std::vector<SegmentManager::Plan> SegmentManager::plan() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return planLocked();
+}
+
+std::vector<SegmentManager::Plan> SegmentManager::planLocked() const {
+    std::vector<Plan> candidates;
+    for (const auto& [leaf, entries] : leaves_) {
+        const bool over_limit = entries.size() > options_.max_segments_per_leaf;
+        for (bool stable : {true, false}) {
+            // The tier's segments, oldest first; a segment being merged
+            // splits the runs around it
+            std::vector<const SegmentDescriptor*> tier;
+            for (const Entry& e : entries) {
+                if (e.descriptor.is_stable == stable) tier.push_back(&e.descriptor);
+            }
+            // Tombstones can go only where nothing older in the leaf can
+            // hold their ids: stable segments precede delta segments
+            const bool bottom_tier = stable || tier.size() == entries.size();
+
+            for (size_t first = 0; first < tier.size(); ++first) {
+                uint64_t rows = 0;
+                double dead = 0;
+                double shadowing = 0;
+                bool heavy = false;
+                for (size_t last = first; last < tier.size() && last - first < options_.max_merge_inputs; ++last) {
+                    const SegmentDescriptor& d = *tier[last];
+                    if (merging_.count(d.segment_id)) break;
+                    rows += d.num_vectors;
+                    if (rows > options_.target_size_vectors && last > first) break;
+                    dead += deadRows(d);
+                    if (last > first) shadowing += deadRows(d);
+                    heavy = heavy || d.tombstone_ratio >= options_.tombstone_ratio_threshold;
+
+                    const size_t inputs = last - first + 1;
+                    const bool drop = bottom_tier && first == 0;
+                    // Each shadowing tombstone removes one older row at most
+                    const double older_rows = static_cast<double>(rows - d.num_vectors);
+                    const double reclaimed = std::min(shadowing, older_rows) + (drop ? dead : 0.0);
+                    if (inputs == 1 && !(drop && dead > 0)) continue;
+
+                    Plan plan;
+                    plan.leaf = leaf;
+                    plan.stable = stable;
+                    plan.drop_tombstones = drop;
+                    plan.reclaimed_rows = reclaimed;
+                    plan.written_rows = static_cast<uint64_t>(std::max(0.0, static_cast<double>(rows) - reclaimed));
+                    plan.score = options_.tombstone_weight * reclaimed +
+                                 options_.fanout_weight * static_cast<double>((inputs - 1) * options_.probe_cost_rows) -
+                                 options_.write_weight * static_cast<double>(plan.written_rows);
+                    const bool eligible = plan.score > 0 || (heavy && reclaimed > 0) || (over_limit && inputs > 1);
+                    if (!eligible) continue;
+                    for (size_t i = first; i <= last; ++i) plan.inputs.push_back(*tier[i]);
+                    candidates.push_back(std::move(plan));
+                }
+            }
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Plan& a, const Plan& b) { return a.score > b.score; });
+    std::vector<Plan> plans;
+    std::unordered_set<std::string> taken;
+    for (Plan& plan : candidates) {
+        bool overlaps = std::any_of(plan.inputs.begin(), plan.inputs.end(),
+                                    [&](const SegmentDescriptor& d) { return taken.count(d.segment_id) > 0; });
+        if (overlaps) continue;
+        for (const SegmentDescriptor& d : plan.inputs) taken.insert(d.segment_id);
+        plans.push_back(std::move(plan));
+    }
+    return plans;
+}
+
+void SegmentManager::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+    cancel_ = false;
+    thread_ = std::thread([this] { loop(); });
+}
+
+void SegmentManager::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    cancel_ = true;
+    cv_.notify_all();
+    thread_.join();
+    cancel_ = false;
+}
+
+void SegmentManager::wake() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        woken_ = true;
+    }
+    cv_.notify_one();
+}
+
+SegmentManager::Stats SegmentManager::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.segments = 0;
+    stats.max_fanout = 0;
+    for (const auto& [leaf, entries] : leaves_) {
+        stats.segments += entries.size();
+        stats.max_fanout = std::max(stats.max_fanout, entries.size());
+    }
+    return stats;
+}
+
+void SegmentManager::loop() {
+    const auto interval = std::chrono::milliseconds(options_.interval_ms);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        cv_.wait_for(lock, interval, [this] { return !running_ || woken_; });
+        if (!running_) break;
+        woken_ = false;
+        lock.unlock();
+        try {
+            // Keep merging while there is work, so a backlog drains at the
+            // limiter's pace rather than one merge per interval
+            while (!cancel_ && compactOnce()) {
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR("Compaction pass failed: {}", e.what());
+        }
+        lock.lock();
+    }
+}
+
+SegmentDescriptor SegmentManager::merge(const Plan& plan, const std::string& path) {
+    std::vector<std::string> paths;
+    for (const SegmentDescriptor& d : plan.inputs) paths.push_back(d.file_path);
+    if (!plan.stable) return DeltaSegmentWriter::merge(path, options_.delta, paths, plan.drop_tombstones, &cancel_);
+    return StableSegmentBuilder::build(path, options_.stable, paths, nullptr, plan.drop_tombstones, &cancel_).descriptor;
+}
+
+bool SegmentManager::compactOnce() {
+    std::lock_guard<std::mutex> merge_lock(merge_mutex_);
+    Plan plan;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.passes++;
+        std::vector<Plan> plans = planLocked();
+        if (plans.empty()) return false;
+        plan = std::move(plans.front());
+        for (const SegmentDescriptor& d : plan.inputs) merging_.insert(d.segment_id);
+    }
+    auto release = [&] {
+        for (const SegmentDescriptor& d : plan.inputs) merging_.erase(d.segment_id);
+    };
+
+    const std::string output = placement_ ? placement_->place(path_(plan), SegmentPlacement::fileBytes(plan.inputs))
+                                          : path_(plan);
+    const auto started = std::chrono::steady_clock::now();
+    SegmentDescriptor merged;
+    try {
+        merged = merge(plan, output);
+        util::fault_point("compaction_merge");
+        install_(plan, merged);
+    } catch (const std::exception& e) {
+        std::remove(output.c_str());
+        if (placement_) placement_->removed(output);
+        std::lock_guard<std::mutex> lock(mutex_);
+        release();
+        stats_.failed_merges++;
+        LOG_ERROR("Compaction of {} {} segments in leaf {} into {} failed: {}", plan.inputs.size(),
+                  plan.stable ? "stable" : "delta", plan.leaf, output, e.what());
+        return false;
+    }
+
+    if (placement_) placement_->replaced(plan.inputs, output);
+    uint64_t input_rows = 0;
+    for (const SegmentDescriptor& d : plan.inputs) input_rows += d.num_vectors;
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    LOG_INFO("Compaction: {} {} segments in leaf {} ({} rows, score {:.0f}) into {}: {} rows, {:.1f} s",
+             plan.inputs.size(), plan.stable ? "stable" : "delta", plan.leaf, input_rows, plan.score, output,
+             merged.num_vectors, seconds);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        release();
+        removeLocked(plan.inputs);
+        if (merged.num_vectors > 0) insertLocked(plan.leaf, merged);
+        stats_.merges++;
+        stats_.merged_segments += plan.inputs.size();
+        stats_.rows_written += merged.num_vectors;
+        stats_.rows_reclaimed += input_rows - std::min(input_rows, merged.num_vectors);
+    }
+    return true;
+}
+
+} // namespace woved::storage
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "io/rate-limiter.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-stable.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::storage {
+
+class SegmentPlacement;
+
+// Catalog of a collection's segments by B-epsilon leaf, and the compaction
+// policy over them.
+//
+// Every segment of a leaf is probed by a query routed to it, so each one
+// costs a probe, and dead rows (tombstones, and live rows a newer version
+// shadows) are scanned for nothing until a merge drops them. Segments are
+// levelled by tier: delta segments merge into delta segments, stable into
+// stable, and delta-to-stable promotion is StableBuildScheduler's job.
+//
+// The planner scores each run of 2 to max_merge_inputs segments adjacent
+// in epoch order within one leaf and tier, and the oldest segment of a
+// leaf alone if it holds tombstones:
+//
+//   score = tombstone_weight * reclaimed rows
+//         + fanout_weight * (inputs - 1) * probe_cost_rows
+//         - write_weight * rows rewritten
+//
+// Reclaimed rows are the tombstones of all but the oldest input (each
+// shadows a row of an older one), plus every tombstone if the run starts
+// at the leaf's oldest segment, where they can be dropped. A run is
+// eligible if its score is positive, if one of its inputs is at
+// tombstone_ratio_threshold and it reclaims rows, or if its leaf is over
+// max_segments_per_leaf. Runs are capped at target_size_vectors rows.
+//
+// A background thread runs the best plan one merge at a time, charging its
+// reads and writes to the limiter (io.merge_bandwidth_limit_mbps), and
+// replans until nothing is eligible.
+class SegmentManager {
+public:
+    struct Options {
+        uint32_t max_segments_per_leaf = 8;
+        float tombstone_ratio_threshold = 0.2f;
+        uint64_t target_size_vectors = 2000000;
+        size_t max_merge_inputs = 8;
+        float tombstone_weight = 1.0f;     // Per row reclaimed
+        float fanout_weight = 1.0f;        // Per probe avoided, in probe_cost_rows
+        uint64_t probe_cost_rows = 65536;  // Rows a segment probe is worth
+        float write_weight = 0.25f;        // Per row rewritten
+        uint32_t interval_ms = 1000;
+        uint64_t bandwidth_bytes_per_s = 0;  // 0 = unlimited
+        DeltaSegmentWriter::Options delta;
+        StableSegmentBuilder::Options stable;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Plan {
+        uint64_t leaf = 0;
+        bool stable = false;               // Tier of the inputs and the output
+        bool drop_tombstones = false;
+        std::vector<SegmentDescriptor> inputs;  // Oldest first
+        double reclaimed_rows = 0;
+        uint64_t written_rows = 0;
+        double score = 0;
+    };
+
+    // Path of the merged segment of a plan
+    using PathFn = std::function<std::string(const Plan& plan)>;
+    // Replace the plan's inputs by `merged` (manifest update). Throwing
+    // discards the merged segment and keeps the inputs. A merge that
+    // reclaimed every row yields an empty segment, which leaves the catalog.
+    using InstallFn = std::function<void(const Plan& plan, const SegmentDescriptor& merged)>;
+
+    struct Stats {
+        uint64_t passes = 0;
+        uint64_t merges = 0;
+        uint64_t failed_merges = 0;
+        uint64_t merged_segments = 0;
+        uint64_t rows_written = 0;
+        uint64_t rows_reclaimed = 0;
+        size_t segments = 0;
+        size_t max_fanout = 0;             // Most segments in one leaf
+    };
+
+    // With a placement, the merged segment keeps the file name PathFn
+    // gives and goes to the directory the placement picks
+    SegmentManager(const Options& options, PathFn path, InstallFn install,
+                   std::shared_ptr<io::RateLimiter> limiter = nullptr, SegmentPlacement* placement = nullptr);
+    ~SegmentManager();
+
+    SegmentManager(const SegmentManager&) = delete;
+    SegmentManager& operator=(const SegmentManager&) = delete;
+
+    void add(uint64_t leaf, const SegmentDescriptor& segment);
+    bool remove(const std::string& segment_id);
+
+    // Swap segments replaced outside the manager (stable builds); inputs
+    // missing from the catalog are ignored
+    void replace(const std::vector<SegmentDescriptor>& inputs, uint64_t leaf, const SegmentDescriptor& output);
+
+    // A leaf's segments, oldest first
+    std::vector<SegmentDescriptor> segments(uint64_t leaf) const;
+    size_t fanout(uint64_t leaf) const;
+
+    // Eligible plans of the current catalog, best first, no two sharing a
+    // segment; segments being merged are left out
+    std::vector<Plan> plan() const;
+
+    void start();
+    void stop();  // Cancels a merge in flight
+    void wake();
+
+    // Run the best plan on the calling thread; true if a merge was installed
+    bool compactOnce();
+
+    Stats getStats() const;
+
+private:
+    struct Entry {
+        SegmentDescriptor descriptor;
+        uint64_t leaf;
+    };
+
+    Options options_;
+    PathFn path_;
+    InstallFn install_;
+    std::shared_ptr<io::RateLimiter> limiter_;
+    SegmentPlacement* placement_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::mutex merge_mutex_;  // One merge at a time
+    std::map<uint64_t, std::vector<Entry>> leaves_;
+    std::unordered_set<std::string> merging_;
+    bool running_ = false;
+    bool woken_ = false;
+    std::atomic<bool> cancel_{false};
+    Stats stats_;
+    std::thread thread_;
+
+    void loop();
+    std::vector<Plan> planLocked() const;
+    void insertLocked(uint64_t leaf, const SegmentDescriptor& segment);
+    SegmentDescriptor merge(const Plan& plan, const std::string& path);
+    void removeLocked(const std::vector<SegmentDescriptor>& inputs);
+};
+
+} // namespace woved::storage
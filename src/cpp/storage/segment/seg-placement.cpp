@@ -0,0 +1,163 @@
+#include "seg-placement.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <sys/statvfs.h>
+
+namespace woved::storage {
+
+namespace {
+
+uint64_t freeBytes(const std::string& dir) {
+    struct statvfs st{};
+    if (::statvfs(dir.c_str(), &st) != 0) return std::numeric_limits<uint64_t>::max();
+    return static_cast<uint64_t>(st.f_bavail) * st.f_frsize;
+}
+
+bool isTemporary(const std::filesystem::path& path) {
+    return path.extension() == ".tmp";
+}
+
+} // namespace
+
+SegmentPlacement::Options SegmentPlacement::Options::fromConfig(const StorageConfig& storage) {
+    Options options;
+    options.dirs = storage.segment_dirs.empty() ? std::vector<std::string>{storage.segment_dir}
+                                                : storage.segment_dirs;
+    return options;
+}
+
+SegmentPlacement::SegmentPlacement(const Options& options) : options_(options) {
+    if (options_.dirs.empty()) {
+        throw util::ConfigException("No segment directories");
+    }
+    for (std::string& dir : options_.dirs) {
+        while (dir.size() > 1 && dir.back() == '/') dir.pop_back();
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (ec) {
+            throw util::IOException("create segment directory " + dir + ": " + ec.message());
+        }
+        devices_.push_back({dir, 0, 0, 0});
+    }
+
+    // Segments left by an earlier run
+    for (size_t d = 0; d < options_.dirs.size(); ++d) {
+        for (const auto& entry : std::filesystem::directory_iterator(options_.dirs[d])) {
+            std::error_code ec;
+            if (!entry.is_regular_file(ec) || isTemporary(entry.path())) continue;
+            const uint64_t bytes = entry.file_size(ec);
+            if (!ec) countLocked(entry.path().string(), d, bytes);
+        }
+    }
+    if (options_.dirs.size() > 1) {
+        for (const Device& device : devices_) {
+            LOG_INFO("Segment device {}: {} segments, {} bytes", device.dir, device.segments, device.bytes);
+        }
+    }
+}
+
+void SegmentPlacement::countLocked(const std::string& path, size_t device, uint64_t bytes) {
+    auto [it, inserted] = files_.try_emplace(path, File{device, bytes});
+    Device& to = devices_[device];
+    if (inserted) {
+        to.segments++;
+    } else {
+        Device& from = devices_[it->second.device];
+        from.bytes -= std::min(from.bytes, it->second.bytes);
+        if (it->second.device != device) {
+            from.segments--;
+            to.segments++;
+        }
+        it->second = File{device, bytes};
+    }
+    to.bytes += bytes;
+}
+
+std::string SegmentPlacement::path(const std::string& name, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t best = 0;
+    if (devices_.size() > 1) {
+        // Fewest live bytes among devices with room; else the most free space
+        size_t roomiest = 0;
+        uint64_t most_free = 0;
+        best = kNoDevice;
+        for (size_t d = 0; d < devices_.size(); ++d) {
+            const uint64_t free = freeBytes(devices_[d].dir);
+            if (free >= most_free) {
+                most_free = free;
+                roomiest = d;
+            }
+            if (free < bytes + options_.reserve_bytes) continue;
+            if (best == kNoDevice || devices_[d].bytes < devices_[best].bytes) best = d;
+        }
+        if (best == kNoDevice) {
+            LOG_WARN("Segment placement: no device has {} bytes to spare, using {}", bytes,
+                     devices_[roomiest].dir);
+            best = roomiest;
+        }
+    }
+    std::string out = devices_[best].dir + "/" + name;
+    countLocked(out, best, bytes);
+    return out;
+}
+
+std::string SegmentPlacement::place(const std::string& path, uint64_t bytes) {
+    return this->path(std::filesystem::path(path).filename().string(), bytes);
+}
+
+uint64_t SegmentPlacement::fileBytes(std::span<const SegmentDescriptor> segments) {
+    uint64_t bytes = 0;
+    for (const SegmentDescriptor& segment : segments) {
+        std::error_code ec;
+        const uint64_t size = std::filesystem::file_size(segment.file_path, ec);
+        if (!ec) bytes += size;
+    }
+    return bytes;
+}
+
+void SegmentPlacement::replaced(std::span<const SegmentDescriptor> inputs, const std::string& output) {
+    added(output);
+    for (const SegmentDescriptor& input : inputs) removed(input.file_path);
+}
+
+void SegmentPlacement::added(const std::string& path) {
+    const size_t device = deviceOf(path);
+    if (device == kNoDevice) return;
+    std::error_code ec;
+    const uint64_t bytes = std::filesystem::file_size(path, ec);
+    if (ec) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    countLocked(path, device, bytes);
+}
+
+void SegmentPlacement::removed(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(path);
+    if (it == files_.end()) return;
+    Device& device = devices_[it->second.device];
+    device.bytes -= std::min(device.bytes, it->second.bytes);
+    device.segments--;
+    files_.erase(it);
+}
+
+size_t SegmentPlacement::deviceOf(const std::string& path) const {
+    for (size_t d = 0; d < options_.dirs.size(); ++d) {
+        const std::string& dir = options_.dirs[d];
+        if (path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 && path[dir.size()] == '/') {
+            return d;
+        }
+    }
+    return kNoDevice;
+}
+
+std::vector<SegmentPlacement::Device> SegmentPlacement::devices() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Device> out = devices_;
+    for (Device& device : out) device.free_bytes = freeBytes(device.dir);
+    return out;
+}
+
+} // namespace woved::storage
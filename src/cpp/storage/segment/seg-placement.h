@@ -0,0 +1,94 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "core/config.h"
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace woved::storage {
+
+// Spreads segment files over several data directories, one per device,
+// so that scans and reranks, which read many segments at once, draw on
+// every device's bandwidth.
+//
+// A whole segment lands on one device. A segment is installed by renaming
+// one file, and its reader maps or opens that one file, so a segment is
+// not split into chunks across devices. A query reads from many segments,
+// so spreading them evenly is enough to keep every device busy.
+// TwoPhaseEngine then orders its stable segment tasks by device
+// (SegmentReader::device()), so parallel workers hit different devices.
+//
+// path() picks the directory whose device holds the fewest live segment
+// bytes among those with room for the new segment. Planned sizes count
+// until added() records the real size, so concurrent builds spread out
+// too. Files already in the directories are counted at construction.
+// Given one, SegmentManager and StableBuildScheduler place their outputs
+// through it and keep its counts current.
+class SegmentPlacement {
+public:
+    static constexpr size_t kNoDevice = SIZE_MAX;
+
+    struct Options {
+        std::vector<std::string> dirs;
+        uint64_t reserve_bytes = 1073741824;  // Free space a device keeps; 1 GiB
+
+        // storage.segment_dirs, or storage.segment_dir alone when that is empty
+        static Options fromConfig(const StorageConfig& storage);
+    };
+
+    struct Device {
+        std::string dir;
+        uint64_t bytes = 0;          // Live segment bytes, planned ones included
+        uint64_t segments = 0;
+        uint64_t free_bytes = 0;
+    };
+
+    // Creates missing directories; throws util::ConfigException without
+    // any, util::IOException if one cannot be created
+    explicit SegmentPlacement(const Options& options);
+
+    SegmentPlacement(const SegmentPlacement&) = delete;
+    SegmentPlacement& operator=(const SegmentPlacement&) = delete;
+
+    // Path for a new segment file `name` of about `bytes`
+    std::string path(const std::string& name, uint64_t bytes = 0);
+    // path() for the file name of `path`, in the directory the placement
+    // picks (SegmentManager and StableBuildScheduler outputs)
+    std::string place(const std::string& path, uint64_t bytes = 0);
+
+    // Size of a set of segment files: the planned size of their merge
+    static uint64_t fileBytes(std::span<const SegmentDescriptor> segments);
+
+    // The segment at `path` was written (its size replaces the plan) or
+    // deleted; unknown paths are ignored by removed()
+    void added(const std::string& path);
+    void removed(const std::string& path);
+    // `inputs` were merged into `output`
+    void replaced(std::span<const SegmentDescriptor> inputs, const std::string& output);
+
+    // Index into dirs of the directory holding `path`, or kNoDevice
+    size_t deviceOf(const std::string& path) const;
+
+    size_t deviceCount() const { return options_.dirs.size(); }
+    std::vector<Device> devices() const;
+
+private:
+    struct File {
+        size_t device;
+        uint64_t bytes;
+    };
+
+    Options options_;
+    mutable std::mutex mutex_;
+    std::vector<Device> devices_;
+    std::unordered_map<std::string, File> files_;
+
+    void countLocked(const std::string& path, size_t device, uint64_t bytes);
+};
+
+} // namespace woved::storage
@@ -0,0 +1,517 @@
+#include "seg-r.h"
+#include "core/config.h"
+#include "io/buffer-pool.h"
+#include "io/io-loop.h"
+#include "util/crc32c.h"
+#include "util/exceptions.h"
+#include "util/file-io.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t kBlock = 4096;
+constexpr size_t kHugePage = 2097152;
+
+constexpr uint64_t roundDown(uint64_t value, uint64_t align) {
+    return value & ~(align - 1);
+}
+
+constexpr uint64_t roundUp(uint64_t value, uint64_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Ranges pinned in a source, unpinned when the reads are done
+class Pins {
+public:
+    explicit Pins(SegmentSource* source) : source_(source) {}
+    ~Pins() {
+        for (const auto& [offset, len] : ranges_) source_->unpin(offset, len);
+    }
+    Pins(const Pins&) = delete;
+    Pins& operator=(const Pins&) = delete;
+
+    void pin(uint64_t offset, uint64_t len) {
+        if (!source_) return;
+        source_->pin(offset, len);
+        ranges_.emplace_back(offset, len);
+    }
+
+private:
+    SegmentSource* source_;
+    std::vector<std::pair<uint64_t, uint64_t>> ranges_;
+};
+
+int adviceFor(SegmentReader::Access access) {
+    switch (access) {
+    case SegmentReader::Access::Random: return MADV_RANDOM;
+    case SegmentReader::Access::Sequential: return MADV_SEQUENTIAL;
+    case SegmentReader::Access::WillNeed: return MADV_WILLNEED;
+    case SegmentReader::Access::Normal: break;
+    }
+    return MADV_NORMAL;
+}
+
+SegmentReader::Mode parseMode(const std::string& mode, bool use_direct_io) {
+    if (mode == "mmap") return SegmentReader::Mode::Mmap;
+    if (mode == "direct") return SegmentReader::Mode::Direct;
+    if (mode == "auto" || mode.empty()) {
+        return use_direct_io ? SegmentReader::Mode::Direct : SegmentReader::Mode::Mmap;
+    }
+    throw util::ConfigException("Unknown segment read mode: " + mode);
+}
+
+} // namespace
+
+SegmentReader::Options SegmentReader::Options::fromConfig(const IOConfig& io, bool stable) {
+    Options options;
+    options.mode = parseMode(stable ? io.stable_read_mode : io.delta_read_mode, io.use_direct_io);
+    options.huge_pages = io.segment_huge_pages;
+    options.queue_depth = std::max(1u, io.iouring.queue_depth);
+    return options;
+}
+
+SegmentReader::SegmentReader(std::string path, const Options& options)
+    : path_(std::move(path)), options_(options) {
+    options_.queue_depth = std::max(1u, options_.queue_depth);
+    if (options_.source && options_.mode != Mode::Direct) {
+        throw std::logic_error("Segment reader: a source needs direct mode (" + path_ + ")");
+    }
+    touch();
+    open();
+    try {
+        readFooter();
+        if (options_.mode == Mode::Mmap) map();
+    } catch (...) {
+        ::close(fd_);
+        throw;
+    }
+}
+
+SegmentReader::~SegmentReader() {
+    if (reservation_) ::munmap(reservation_, reservation_bytes_);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void SegmentReader::open() {
+    const bool direct = options_.mode == Mode::Direct;
+    fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0));
+    if (fd_ < 0 && errno == EINVAL && direct) {
+        // No O_DIRECT here (tmpfs): explicit reads still bypass the mapping
+        LOG_WARN("Segment reader: O_DIRECT unsupported for {}, using buffered reads", path_);
+        fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd_ < 0) {
+        throw util::IOException("open " + path_ + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+        int err = errno;
+        ::close(fd_);
+        throw util::IOException("stat " + path_ + ": " + std::strerror(err));
+    }
+    file_bytes_ = static_cast<uint64_t>(st.st_size);
+    device_ = static_cast<uint64_t>(st.st_dev);
+}
+
+void SegmentReader::preadAll(void* data, size_t len, uint64_t offset) const {
+    util::pread_all(fd_, data, len, offset, path_);
+}
+
+void SegmentReader::touch() const {
+    last_read_.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+void SegmentReader::readFooter() {
+    auto corrupt = [&](const std::string& what) {
+        return util::IOException("segment " + path_ + ": " + what);
+    };
+    if (file_bytes_ < kBlock || file_bytes_ % kBlock != 0) throw corrupt("truncated");
+
+    // The directory and footer share the blocks after the data region;
+    // read the last block first to learn where that starts
+    auto last = io::BufferPool::global().acquire(kBlock);
+    preadAll(last.data(), kBlock, file_bytes_ - kBlock);
+    std::memcpy(&footer_, last.data() + kBlock - sizeof(footer_), sizeof(footer_));
+    if (footer_.magic != SegmentFooter::kMagic) throw corrupt("bad magic");
+    if (footer_.version != SegmentFooter::kVersion) {
+        throw corrupt("unsupported version " + std::to_string(footer_.version));
+    }
+    if (util::crc32c(&footer_, offsetof(SegmentFooter, footer_crc)) != footer_.footer_crc) {
+        throw corrupt("footer checksum mismatch");
+    }
+    if (footer_.chunk_bytes == 0 || footer_.chunk_bytes % kBlock != 0 ||
+        footer_.data_bytes % kBlock != 0 || footer_.data_bytes >= file_bytes_ ||
+        footer_.chunk_count != (footer_.data_bytes + footer_.chunk_bytes - 1) / footer_.chunk_bytes) {
+        throw corrupt("inconsistent geometry");
+    }
+
+    const size_t tail_bytes = file_bytes_ - footer_.data_bytes;
+    const size_t entries_bytes = footer_.section_count * sizeof(SegmentSection);
+    const size_t crcs_bytes = footer_.chunk_count * sizeof(uint32_t);
+    if (entries_bytes + crcs_bytes + sizeof(SegmentFooter) > tail_bytes) throw corrupt("directory overflows");
+
+    auto tail = io::BufferPool::global().acquire(tail_bytes);
+    preadAll(tail.data(), tail_bytes, footer_.data_bytes);
+    if (util::crc32c(tail.data(), entries_bytes + crcs_bytes) != footer_.directory_crc) {
+        throw corrupt("directory checksum mismatch");
+    }
+    sections_.resize(footer_.section_count);
+    chunk_crcs_.resize(footer_.chunk_count);
+    std::memcpy(sections_.data(), tail.data(), entries_bytes);
+    std::memcpy(chunk_crcs_.data(), tail.data() + entries_bytes, crcs_bytes);
+    for (const SegmentSection& s : sections_) {
+        if (s.offset > footer_.data_bytes || s.length > footer_.data_bytes - s.offset) {
+            throw corrupt("section outside the data region");
+        }
+    }
+    chunk_state_ = std::make_unique<std::atomic<uint8_t>[]>(footer_.chunk_count);
+}
+
+void SegmentReader::map() {
+    if (footer_.data_bytes == 0) return;  // No sections to map
+
+    // Reserve a window with room to put the file on a huge page boundary;
+    // mapping the file over it keeps the whole range ours
+    reservation_bytes_ = footer_.data_bytes + kHugePage;
+    reservation_ = ::mmap(nullptr, reservation_bytes_, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation_ == MAP_FAILED) {
+        reservation_ = nullptr;
+        throw util::IOException("mmap reservation for " + path_ + ": " + std::strerror(errno));
+    }
+    auto* aligned = reinterpret_cast<void*>(roundUp(reinterpret_cast<uintptr_t>(reservation_), kHugePage));
+    void* mapped = ::mmap(aligned, footer_.data_bytes, PROT_READ, MAP_SHARED | MAP_FIXED, fd_, 0);
+    if (mapped == MAP_FAILED) {
+        int err = errno;
+        ::munmap(reservation_, reservation_bytes_);
+        reservation_ = nullptr;
+        throw util::IOException("mmap " + path_ + ": " + std::strerror(err));
+    }
+    base_ = static_cast<const std::byte*>(mapped);
+
+#ifdef MADV_HUGEPAGE
+    if (options_.huge_pages) {
+        huge_pages_ = ::madvise(mapped, footer_.data_bytes, MADV_HUGEPAGE) == 0;
+        if (!huge_pages_) LOG_DEBUG("Segment reader: no huge pages for {}: {}", path_, std::strerror(errno));
+    }
+#endif
+}
+
+const SegmentSection* SegmentReader::find(SegmentSectionKind kind, uint32_t id) const {
+    for (const SegmentSection& s : sections_) {
+        if (s.kind == static_cast<uint32_t>(kind) && s.id == id) return &s;
+    }
+    return nullptr;
+}
+
+std::span<const std::byte> SegmentReader::view(const SegmentSection& section, Access access) const {
+    if (options_.mode != Mode::Mmap) {
+        throw std::logic_error("Segment reader: view() of " + path_ + " in direct mode");
+    }
+    if (compressed(section)) {
+        throw std::logic_error("Segment reader: view() of a compressed section in " + path_);
+    }
+    touch();
+    if (access != Access::Normal) advise(section, access);
+    if (options_.verify_checksums && access != Access::Random) check(section, 0, section.length);
+    return {base_ + section.offset, section.length};
+}
+
+void SegmentReader::advise(const SegmentSection& section, Access access) const {
+    if (!base_ || section.length == 0) return;  // Direct reads skip the page cache
+    const auto start = roundDown(reinterpret_cast<uintptr_t>(base_ + section.offset), kBlock);
+    const auto end = roundUp(reinterpret_cast<uintptr_t>(base_ + section.offset + section.length), kBlock);
+    if (::madvise(reinterpret_cast<void*>(start), end - start, adviceFor(access)) != 0) {
+        LOG_DEBUG("Segment reader: madvise on {} failed: {}", path_, std::strerror(errno));
+    }
+}
+
+void SegmentReader::read(const SegmentSection& section, uint64_t offset, std::span<std::byte> out) const {
+    ReadRequest request{&section, offset, out};
+    readBatch(std::span<const ReadRequest>(&request, 1));
+}
+
+void SegmentReader::readBatch(std::span<const ReadRequest> requests) const {
+    readBatch(requests, nullptr);
+}
+
+void SegmentReader::readBatch(std::span<const ReadRequest> requests, const ReadDoneFn& done) const {
+    const bool any_compressed = std::any_of(requests.begin(), requests.end(),
+                                            [](const ReadRequest& r) { return compressed(*r.section); });
+    if (!any_compressed) {
+        readStored(requests, done);
+        return;
+    }
+    std::vector<ReadRequest> stored;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        if (compressed(*requests[i].section)) {
+            readCompressed(requests[i]);
+            if (done) done(i);
+        } else {
+            stored.push_back(requests[i]);
+            indices.push_back(i);
+        }
+    }
+    if (!done) {
+        readStored(stored);
+        return;
+    }
+    readStored(stored, [&](size_t i) { done(indices[i]); });
+}
+
+void SegmentReader::readStored(const SegmentSection& section, uint64_t offset, std::span<std::byte> out) const {
+    ReadRequest request{&section, offset, out};
+    readStored(std::span<const ReadRequest>(&request, 1));
+}
+
+void SegmentReader::prepareStored(std::span<const ReadRequest> requests) const {
+    for (const ReadRequest& r : requests) {
+        if (r.offset > r.section->length || r.out.size() > r.section->length - r.offset) {
+            throw std::out_of_range("Segment reader: read past the end of a section in " + path_);
+        }
+    }
+    touch();
+}
+
+void SegmentReader::readStored(std::span<const ReadRequest> requests, const ReadDoneFn& done) const {
+    if (requests.empty()) return;
+    prepareStored(requests);
+
+    if (options_.mode == Mode::Mmap) {
+        for (const ReadRequest& r : requests) {
+            if (!r.out.empty()) std::memcpy(r.out.data(), base_ + r.section->offset + r.offset, r.out.size());
+            if (done) done(&r - requests.data());
+        }
+        return;
+    }
+
+    // Widen every request to whole blocks and submit them together
+    std::vector<io::BufferPool::Buffer> staging;
+    std::vector<uint64_t> starts;
+    staging.reserve(requests.size());
+    starts.reserve(requests.size());
+    Pins pins(options_.source.get());
+    // Copy out each request as it completes
+    auto land = [&](uint64_t i) {
+        const ReadRequest& r = requests[i];
+        std::memcpy(r.out.data(), staging[i].data() + (r.section->offset + r.offset - starts[i]), r.out.size());
+        if (done) done(i);
+    };
+    // The thread's shared ring; queue_depth caps this batch's share of it
+    io::UringWrapper& ring = io::UringWrapper::local();
+    size_t in_flight = 0;
+    auto reapOne = [&](const std::function<void(uint64_t)>& on) {
+        ring.reap(1, [&](uint64_t i) {
+            --in_flight;
+            on(i);
+        });
+    };
+    try {
+        for (size_t i = 0; i < requests.size(); ++i) {
+            const ReadRequest& r = requests[i];
+            const uint64_t begin = r.section->offset + r.offset;
+            const uint64_t start = roundDown(begin, kBlock);
+            const uint64_t len = roundUp(begin + r.out.size(), kBlock) - start;
+            pins.pin(start, len);
+            staging.push_back(io::BufferPool::global().acquire(len));
+            starts.push_back(start);
+            while (in_flight >= options_.queue_depth) reapOne(land);
+            ring.submitRead(fd_, staging.back().data(), len, start, i);
+            ++in_flight;
+            if (options_.limiter) options_.limiter->charge(len);
+        }
+        while (in_flight > 0) reapOne(land);
+    } catch (...) {
+        // Keep the staging buffers alive until the kernel is done with them
+        while (in_flight > 0) {
+            try {
+                reapOne([](uint64_t) {});
+            } catch (const std::exception&) {
+            }
+        }
+        throw;
+    }
+}
+
+util::Task<void> SegmentReader::readAsync(const SegmentSection& section, uint64_t offset,
+                                           std::span<std::byte> out) const {
+    const ReadRequest request{&section, offset, out};
+    co_await readBatchAsync(std::span<const ReadRequest>(&request, 1));
+}
+
+util::Task<void> SegmentReader::readBatchAsync(std::span<const ReadRequest> requests, ReadDoneFn done) const {
+    const bool any_compressed = std::any_of(requests.begin(), requests.end(),
+                                            [](const ReadRequest& r) { return compressed(*r.section); });
+    if (options_.mode == Mode::Mmap || any_compressed || requests.empty()) {
+        readBatch(requests, done);
+        co_return;
+    }
+    prepareStored(requests);
+
+    // As readStored(), with each block read awaited rather than reaped
+    std::vector<io::BufferPool::Buffer> staging(requests.size());
+    std::vector<uint64_t> starts(requests.size());
+    Pins pins(options_.source.get());
+    io::IoBatch batch;
+    size_t next = 0;
+    std::exception_ptr error;
+    auto submit = [&] {
+        const ReadRequest& r = requests[next];
+        const uint64_t begin = r.section->offset + r.offset;
+        const uint64_t start = roundDown(begin, kBlock);
+        const uint64_t len = roundUp(begin + r.out.size(), kBlock) - start;
+        pins.pin(start, len);
+        staging[next] = io::BufferPool::global().acquire(len);
+        starts[next] = start;
+        batch.submitRead(fd_, staging[next].data(), len, start, next);
+        if (options_.limiter) options_.limiter->charge(len);
+        next++;
+    };
+    try {
+        while (next < requests.size() && batch.inFlight() < options_.queue_depth) submit();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    // Once anything failed, nothing more is submitted; what is in flight
+    // still lands before the staging buffers go
+    while (batch.inFlight() > 0) {
+        for (const io::IoBatch::Landed& landed : co_await batch.next()) {
+            if (error) continue;
+            try {
+                if (landed.error) {
+                    throw util::IOException("segment " + path_ + ": read: " + std::strerror(landed.error));
+                }
+                const ReadRequest& r = requests[landed.index];
+                std::memcpy(r.out.data(),
+                            staging[landed.index].data() + (r.section->offset + r.offset - starts[landed.index]),
+                            r.out.size());
+                staging[landed.index] = {};
+                if (done) done(landed.index);
+                while (next < requests.size() && batch.inFlight() < options_.queue_depth) submit();
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+std::vector<std::byte> SegmentReader::readSection(const SegmentSection& section) const {
+    auto stored = readStoredSection(section);
+    return compressed(section) ? decompressor().section(stored) : stored;
+}
+
+std::vector<std::byte> SegmentReader::readStoredSection(const SegmentSection& section) const {
+    std::vector<std::byte> out(section.length);
+    readStored(section, 0, out);
+    if (options_.verify_checksums && util::crc32c(out.data(), out.size()) != section.crc32c) {
+        throw util::IOException("segment " + path_ + ": checksum mismatch in section " +
+                                std::to_string(section.kind) + "/" + std::to_string(section.id));
+    }
+    return out;
+}
+
+void SegmentReader::readCompressed(const ReadRequest& r) const {
+    // Trailer, then index, then only the blocks the range covers
+    const SegmentSection& section = *r.section;
+    CompressedSectionTrailer trailer{};
+    if (section.length < sizeof(trailer)) {
+        throw util::IOException("segment " + path_ + ": truncated compressed section " +
+                                std::to_string(section.kind) + "/" + std::to_string(section.id));
+    }
+    readStored(section, section.length - sizeof(trailer), std::as_writable_bytes(std::span(&trailer, 1)));
+    trailer = SectionDecompressor::trailer(std::as_bytes(std::span(&trailer, 1)), section.length);
+    if (r.offset > trailer.raw_length || r.out.size() > trailer.raw_length - r.offset) {
+        throw std::out_of_range("Segment reader: read past the end of a section in " + path_);
+    }
+    if (r.out.empty()) return;
+
+    std::vector<std::byte> index_bytes(size_t{trailer.blocks} * sizeof(uint64_t));
+    readStored(section, section.length - sizeof(trailer) - index_bytes.size(), index_bytes);
+    const auto ends = SectionDecompressor::index(index_bytes, trailer, section.length);
+
+    const uint64_t first = r.offset / trailer.block_bytes;
+    const uint64_t last = (r.offset + r.out.size() - 1) / trailer.block_bytes;
+    const uint64_t begin = first == 0 ? 0 : ends[first - 1];
+    std::vector<std::byte> stored(ends[last] - begin);
+    readStored(section, begin, stored);
+
+    const SectionDecompressor& codec = decompressor();
+    std::vector<std::byte> raw(trailer.block_bytes);
+    uint64_t pos = begin;
+    for (uint64_t b = first; b <= last; ++b) {
+        const uint64_t raw_begin = b * trailer.block_bytes;
+        const uint64_t raw_len = std::min<uint64_t>(trailer.block_bytes, trailer.raw_length - raw_begin);
+        codec.block(std::span(stored).subspan(pos - begin, ends[b] - pos), std::span(raw).first(raw_len));
+        pos = ends[b];
+
+        const uint64_t from = std::max(r.offset, raw_begin);
+        const uint64_t to = std::min(r.offset + r.out.size(), raw_begin + raw_len);
+        std::memcpy(r.out.data() + (from - r.offset), raw.data() + (from - raw_begin), to - from);
+    }
+}
+
+const SectionDecompressor& SegmentReader::decompressor() const {
+    std::call_once(decompressor_once_, [this] {
+        const SegmentSection* dict = find(SegmentSectionKind::Metadata, kSegmentDictSection);
+        decompressor_ = dict ? std::make_unique<SectionDecompressor>(readStoredSection(*dict))
+                             : std::make_unique<SectionDecompressor>(std::span<const std::byte>());
+    });
+    return *decompressor_;
+}
+
+void SegmentReader::verify(const SegmentSection& section) const {
+    check(section, 0, section.length);
+}
+
+void SegmentReader::check(const SegmentSection& section, uint64_t offset, size_t len) const {
+    if (len == 0) return;
+    const uint64_t begin = section.offset + offset;
+    for (uint64_t chunk = begin / footer_.chunk_bytes; chunk <= (begin + len - 1) / footer_.chunk_bytes; ++chunk) {
+        verifyChunk(chunk);
+    }
+}
+
+void SegmentReader::verifyChunk(size_t chunk) const {
+    uint8_t state = chunk_state_[chunk].load(std::memory_order_acquire);
+    if (state == kVerified) return;
+    if (state == kUnchecked) {
+        const uint64_t start = uint64_t{chunk} * footer_.chunk_bytes;
+        const size_t len = std::min<uint64_t>(footer_.chunk_bytes, footer_.data_bytes - start);
+        uint32_t crc;
+        if (base_) {
+            crc = util::crc32c(base_ + start, len);
+        } else {
+            Pins pins(options_.source.get());
+            pins.pin(start, len);
+            auto buffer = io::BufferPool::global().acquire(len);
+            preadAll(buffer.data(), len, start);
+            crc = util::crc32c(buffer.data(), len);
+        }
+        // Racing verifiers compute the same answer
+        state = crc == chunk_crcs_[chunk] ? kVerified : kCorrupt;
+        chunk_state_[chunk].store(state, std::memory_order_release);
+    }
+    if (state == kCorrupt) {
+        throw util::IOException("segment " + path_ + ": checksum mismatch in chunk " + std::to_string(chunk));
+    }
+}
+
+} // namespace woved::storage
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "storage/segment/seg-codec.h"
+#include "storage/segment/seg-w.h"
+#include "io/rate-limiter.h"
+#include "io/uring-wrapper.h"
+#include "util/task.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace woved {
+struct IOConfig;
+}
+
+namespace woved::storage {
+
+// Where a reader's file bytes come from when not all of them are local
+// (ColdTier). pin() makes a range of the file readable, fetching what is
+// missing, and keeps it so until the matching unpin().
+class SegmentSource {
+public:
+    virtual ~SegmentSource() = default;
+    virtual void pin(uint64_t offset, uint64_t len) = 0;
+    virtual void unpin(uint64_t offset, uint64_t len) noexcept = 0;
+};
+
+// Read side of a segment file (layout in seg-w.h). Opening reads and
+// checks the footer and directory only.
+//
+// Mmap mode maps the whole file read-only at a 2 MiB aligned address and
+// asks for transparent huge pages (MADV_HUGEPAGE), which the kernel honours
+// where the filesystem supports huge file pages (tmpfs, or read-only THP
+// for files); elsewhere the advice is ignored. view() returns sections in
+// place, and advise() sets the access pattern per section: Random for PQ
+// codes probed by list (no readahead), Sequential for rerank and full
+// scans (aggressive readahead, pages dropped behind the scan).
+//
+// Direct mode never maps: the file is opened with O_DIRECT and sections
+// are copied out with explicit reads, batched through io_uring, so scans
+// of a large stable tier do not push hot delta segments out of the page
+// cache. Reads are widened to 4 KiB blocks and staged in aligned buffers.
+//
+// Checksums: readSection() checks the section CRC; view() checks every
+// chunk the section covers the first time any view touches it (chunk
+// state is shared, so each chunk is checked once). Random-access views are
+// not checked, as that would fault in the whole section; verify() checks
+// them explicitly.
+//
+// Compressed sections (seg-codec.h) are decoded transparently and lazily:
+// readSection() decodes the whole section, read() only the blocks the
+// range covers. Offsets and sizes are then of the raw section, and
+// view() is not available for them.
+//
+// With a source (Options::source), direct reads pin their blocks for as
+// long as they are in flight; the footer and directory are read as they
+// are, so they must stay local.
+//
+// All calls are thread-safe; direct batches go through the calling
+// thread's ring (io::UringWrapper::local()). The coroutine forms
+// (readAsync(), readBatchAsync()) suspend on the ring rather than block,
+// resumed by the thread's io::IoLoop.
+class SegmentReader {
+public:
+    enum class Mode { Mmap, Direct };
+    enum class Access { Normal, Random, Sequential, WillNeed };
+
+    struct Options {
+        Mode mode = Mode::Mmap;
+        bool huge_pages = true;         // MADV_HUGEPAGE on the mapping
+        bool verify_checksums = true;
+        unsigned queue_depth = 32;      // Direct reads in flight per batch
+        // Charged, never waited on, for direct reads (IOManager's query
+        // class); null = not counted
+        std::shared_ptr<io::RateLimiter> limiter;
+        // Direct mode only (std::logic_error otherwise); null = all local
+        std::shared_ptr<SegmentSource> source;
+
+        // Tier defaults from io.delta_read_mode / io.stable_read_mode:
+        // "mmap", "direct", or "auto" (direct when io.use_direct_io)
+        static Options fromConfig(const IOConfig& io, bool stable);
+    };
+
+    struct ReadRequest {
+        const SegmentSection* section;
+        uint64_t offset;               // Within the section
+        std::span<std::byte> out;
+    };
+
+    // Called with the index of each request of a batch once its bytes are
+    // in place, in completion order
+    using ReadDoneFn = std::function<void(size_t index)>;
+
+    // Throws util::IOException if the file is truncated or corrupt
+    SegmentReader(std::string path, const Options& options);
+    ~SegmentReader();
+
+    SegmentReader(const SegmentReader&) = delete;
+    SegmentReader& operator=(const SegmentReader&) = delete;
+
+    const std::string& path() const { return path_; }
+    Mode mode() const { return options_.mode; }
+    bool hugePages() const { return huge_pages_; }
+    uint64_t fileBytes() const { return file_bytes_; }
+    // st_dev of the file: segments on one device share its bandwidth
+    uint64_t device() const { return device_; }
+    const SegmentFooter& footer() const { return footer_; }
+    // Last read or view of a section; opening counts as one
+    std::chrono::steady_clock::time_point lastRead() const {
+        return std::chrono::steady_clock::time_point(
+            std::chrono::steady_clock::duration(last_read_.load(std::memory_order_relaxed)));
+    }
+    const std::vector<SegmentSection>& sections() const { return sections_; }
+
+    // First section of a kind and id, or null
+    const SegmentSection* find(SegmentSectionKind kind, uint32_t id = 0) const;
+
+    // Mmap mode and uncompressed sections only (std::logic_error
+    // otherwise). A non-Normal access also advises the section.
+    std::span<const std::byte> view(const SegmentSection& section,
+                                     Access access = Access::Normal) const;
+
+    // madvise() the pages of a section; a no-op in direct mode
+    void advise(const SegmentSection& section, Access access) const;
+
+    // Either mode. read() copies part of a section; readBatch() submits
+    // every request at once in direct mode. Out-of-range requests throw
+    // std::out_of_range.
+    void read(const SegmentSection& section, uint64_t offset, std::span<std::byte> out) const;
+    void readBatch(std::span<const ReadRequest> requests) const;
+
+    // readBatch() that reports each request as it completes, so the caller
+    // works on early reads while the rest are in flight. `done` runs on the
+    // calling thread, in direct mode from inside a reap of its ring: it must
+    // not read from any segment reader.
+    void readBatch(std::span<const ReadRequest> requests, const ReadDoneFn& done) const;
+
+    // read() and readBatch() as coroutines: direct reads are awaited on
+    // the thread's io::IoLoop, and `done` runs as each request lands, from
+    // the coroutine rather than a reap, so it may read again. Mmap and
+    // compressed reads complete before the first suspension.
+    util::Task<void> readAsync(const SegmentSection& section, uint64_t offset, std::span<std::byte> out) const;
+    util::Task<void> readBatchAsync(std::span<const ReadRequest> requests, ReadDoneFn done = nullptr) const;
+
+    // Whole section, checksum verified and decompressed
+    std::vector<std::byte> readSection(const SegmentSection& section) const;
+
+    static bool compressed(const SegmentSection& section) { return (section.flags & kSectionZstd) != 0; }
+
+    // Check the chunk checksums covering a section; throws on a mismatch
+    void verify(const SegmentSection& section) const;
+
+private:
+    enum : uint8_t { kUnchecked = 0, kVerified = 1, kCorrupt = 2 };
+
+    std::string path_;
+    Options options_;
+    int fd_ = -1;
+    uint64_t file_bytes_ = 0;
+    uint64_t device_ = 0;
+    SegmentFooter footer_{};
+    std::vector<SegmentSection> sections_;
+    std::vector<uint32_t> chunk_crcs_;
+    mutable std::atomic<std::chrono::steady_clock::rep> last_read_{0};
+
+    // Mmap mode
+    void* reservation_ = nullptr;     // Aligned window holding the mapping
+    size_t reservation_bytes_ = 0;
+    const std::byte* base_ = nullptr;
+    bool huge_pages_ = false;
+    std::unique_ptr<std::atomic<uint8_t>[]> chunk_state_;
+
+    // Created with the segment's dictionary on first use
+    mutable std::once_flag decompressor_once_;
+    mutable std::unique_ptr<SectionDecompressor> decompressor_;
+
+    void open();
+    void map();
+    void readFooter();
+    void check(const SegmentSection& section, uint64_t offset, size_t len) const;
+    void verifyChunk(size_t chunk) const;
+    void preadAll(void* data, size_t len, uint64_t offset) const;
+    void touch() const;
+    void readStored(std::span<const ReadRequest> requests, const ReadDoneFn& done = nullptr) const;
+    // Checks and touch() common to both forms
+    void prepareStored(std::span<const ReadRequest> requests) const;
+    void readStored(const SegmentSection& section, uint64_t offset, std::span<std::byte> out) const;
+    std::vector<std::byte> readStoredSection(const SegmentSection& section) const;
+    void readCompressed(const ReadRequest& request) const;
+    const SectionDecompressor& decompressor() const;
+};
+
+} // namespace woved::storage
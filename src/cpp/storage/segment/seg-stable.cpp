@@ -0,0 +1,892 @@
+#include "seg-stable.h"
+#include "core/config.h"
+#include "core/metrics.h"
+#include "storage/segment/seg-cold.h"
+#include "storage/segment/seg-placement.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include "util/simd-dispatch.h"
+#include "util/vector-codec.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <numeric>
+#include <random>
+
+namespace woved::storage {
+
+namespace {
+
+// Rows the reuse check codes; distortion settles well before this
+constexpr size_t kDriftSample = 16384;
+
+// Page of the vector section (sections start page aligned) that the
+// page-clustered layout groups rows into
+constexpr size_t kLayoutPageBytes = 4096;
+
+// Page of the vector section holding the start of the row at `pos`
+uint64_t pageOf(uint64_t pos, size_t vector_bytes) {
+    return pos * vector_bytes / kLayoutPageBytes;
+}
+
+// Orders `slots`, local rows of one list whose vectors are row-major in
+// `data` and which go to section positions [first, first + size), so rows
+// close to each other share a page: splits the span at the page boundary
+// nearest its middle along the line through two far apart rows, and
+// recurses into both halves until a span starts within one page.
+// `direction` is scratch for that line.
+void clusterPages(std::span<uint32_t> slots, const float* data, size_t dim, uint64_t first,
+                  size_t vector_bytes, std::vector<float>& projection, std::vector<float>& direction) {
+    const uint64_t last = first + slots.size() - 1;
+    const uint64_t first_page = pageOf(first, vector_bytes);
+    const uint64_t last_page = pageOf(last, vector_bytes);
+    if (slots.size() < 2 || first_page == last_page) return;
+
+    const auto& t = kernels::distance_table();
+    auto vec = [&](uint32_t slot) { return data + size_t{slot} * dim; };
+    auto farthest = [&](const float* from) {
+        uint32_t best = slots[0];
+        float best_distance = -1.0f;
+        for (uint32_t slot : slots) {
+            const float distance = t.l2_sqr(from, vec(slot), dim);
+            if (distance > best_distance) {
+                best = slot;
+                best_distance = distance;
+            }
+        }
+        return best;
+    };
+    const float* a = vec(farthest(vec(slots[0])));
+    const float* b = vec(farthest(a));
+    direction.resize(dim);
+    for (size_t d = 0; d < dim; ++d) direction[d] = b[d] - a[d];
+    for (uint32_t slot : slots) projection[slot] = t.inner_product(vec(slot), direction.data(), dim);
+
+    // Page boundaries in (first, last]: the first row starting in each of
+    // pages first_page + 1 .. last_page. Take the one nearest the middle.
+    const uint64_t mid = first + slots.size() / 2;
+    const uint64_t page = std::clamp<uint64_t>((mid * vector_bytes + kLayoutPageBytes / 2) / kLayoutPageBytes,
+                                               first_page + 1, last_page);
+    const uint64_t split = (page * kLayoutPageBytes + vector_bytes - 1) / vector_bytes;
+    const size_t cut = split - first;
+    std::nth_element(slots.begin(), slots.begin() + cut, slots.end(),
+                     [&](uint32_t x, uint32_t y) { return projection[x] < projection[y]; });
+    clusterPages(slots.first(cut), data, dim, first, vector_bytes, projection, direction);
+    clusterPages(slots.subspan(cut), data, dim, split, vector_bytes, projection, direction);
+}
+
+// A merge input of either tier
+struct Source {
+    std::unique_ptr<DeltaSegment> delta;
+    std::unique_ptr<StableSegment> stable;
+    RowColumns columns;
+    ElementType type = ElementType::FP32;
+    std::span<const std::byte> vectors;
+    std::vector<float> scales;
+    std::vector<uint32_t> row_lists;   // Stable: list of each live row
+
+    RowVersions versions() const {
+        return delta ? RowVersions{delta->idHashes(), delta->epochs(), delta->flags()}
+                     : RowVersions{stable->idHashes(), stable->epochs(), stable->flags()};
+    }
+    DeltaRow row(uint64_t r) const { return delta ? delta->row(columns, r) : stable->row(columns, r); }
+};
+
+void checkCancel(const std::atomic<bool>* cancel) {
+    if (cancel && cancel->load(std::memory_order_relaxed)) {
+        throw util::WovedException("Stable segment build cancelled");
+    }
+}
+
+template <typename T>
+std::vector<T> loadFixed(const SegmentReader& reader, DeltaColumn column, uint64_t count) {
+    // Columns may be stored compressed: check the decoded size
+    const SegmentSection* section = reader.find(SegmentSectionKind::RowTable, static_cast<uint32_t>(column));
+    auto bytes = section ? reader.readSection(*section) : std::vector<std::byte>();
+    if (!section || bytes.size() != count * sizeof(T)) {
+        throw util::IOException("Stable segment " + reader.path() + ": missing or short column " +
+                                std::to_string(static_cast<uint32_t>(column)));
+    }
+    std::vector<T> values(count);
+    if (!bytes.empty()) std::memcpy(values.data(), bytes.data(), bytes.size());
+    return values;
+}
+
+SegmentDescriptor describe(const std::string& path, const StableSegmentHeader& header, Timestamp created_at) {
+    SegmentDescriptor descriptor;
+    descriptor.segment_id = std::filesystem::path(path).stem().string();
+    descriptor.file_path = path;
+    descriptor.num_vectors = header.rows;
+    descriptor.min_id_hash = header.min_id_hash;
+    descriptor.max_id_hash = header.max_id_hash;
+    descriptor.min_epoch = header.min_epoch;
+    descriptor.max_epoch = header.max_epoch;
+    descriptor.tombstone_ratio = header.rows == 0 ? 0.0f
+        : static_cast<float>(header.rows - header.live_rows) / static_cast<float>(header.rows);
+    descriptor.created_at = created_at;
+    descriptor.is_stable = true;
+    return descriptor;
+}
+
+} // namespace
+
+StableSegmentBuilder::Options StableSegmentBuilder::Options::fromConfig(const Config& config) {
+    Options options;
+    options.dim = config.collection.dim;
+    options.element_type = util::parse_element_type(config.collection.element_type);
+    options.params = index::IvfPqModel::Params::fromConfig(config.index.stable);
+    options.bloom_fpp = config.filtering.bloom_filter_enabled ? config.filtering.bloom_filter_fpp : 0.0f;
+    options.page_clustered = config.experimental.connectivity_aware_layout;
+    options.writer = SegmentWriter::Options::fromConfig(config);
+    return options;
+}
+
+StableSegmentBuilder::Result StableSegmentBuilder::build(const std::string& path, const Options& options,
+                                                         std::span<const std::string> inputs,
+                                                         std::shared_ptr<const index::IvfPqModel> model,
+                                                         bool drop_tombstones, const std::atomic<bool>* cancel) {
+    static_assert(sizeof(StableSegmentHeader) == 96, "stable segment header is 96 bytes");
+    const size_t dim = options.dim;
+    const size_t vector_bytes = dim * util::element_size(options.element_type);
+    Result result;
+
+    // Inputs are mapped; the reads are charged up front as whole files
+    SegmentReader::Options read_options;
+    read_options.mode = SegmentReader::Mode::Mmap;
+    read_options.huge_pages = false;
+    std::vector<Source> sources(inputs.size());
+    std::vector<RowVersions> versions;
+    std::shared_ptr<const index::IvfPqModel> inherited;
+    uint64_t inherited_rows = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        Source& source = sources[i];
+        const SegmentReader* reader = nullptr;
+        uint32_t input_dim = 0;
+        if (options.cold) options.cold->restore(inputs[i]);
+        if (isStableSegment(inputs[i])) {
+            source.stable = std::make_unique<StableSegment>(inputs[i], read_options);
+            const StableSegment& segment = *source.stable;
+            reader = &source.stable->reader();
+            input_dim = segment.header().dim;
+            source.columns = segment.readRows();
+            source.type = static_cast<ElementType>(segment.header().element_type);
+            source.vectors = segment.vectors();
+            source.scales = segment.scales({0, segment.liveRows()});
+            source.row_lists.resize(segment.liveRows());
+            for (const DeltaListExtent& extent : segment.lists()) {
+                std::fill_n(source.row_lists.begin() + extent.first_row, extent.rows, extent.centroid);
+            }
+            if (segment.model() && segment.liveRows() > inherited_rows) {
+                inherited = segment.model();
+                inherited_rows = segment.liveRows();
+            }
+            result.input_rows += segment.rows();
+        } else {
+            source.delta = std::make_unique<DeltaSegment>(inputs[i], read_options);
+            const DeltaSegment& segment = *source.delta;
+            reader = &source.delta->reader();
+            input_dim = segment.header().dim;
+            source.columns = segment.readRows();
+            source.type = static_cast<ElementType>(segment.header().element_type);
+            source.vectors = segment.vectors();
+            source.scales = segment.scales({0, segment.liveRows()});
+            result.input_rows += segment.rows();
+        }
+        if (input_dim != dim) {
+            throw util::InvalidArgumentException("Stable build: " + inputs[i] + " has dimension " +
+                                                 std::to_string(input_dim));
+        }
+        const uint64_t bytes = reader->fileBytes();
+        if (options.writer.limiter) options.writer.limiter->acquire(bytes);
+        result.bytes_read += bytes;
+        versions.push_back(source.versions());
+        checkCancel(cancel);
+    }
+    if (!model) model = inherited;
+
+    std::vector<MergedRow> live;
+    std::vector<MergedRow> dead;
+    result.superseded_rows = newestVersions(versions, drop_tombstones, live, dead);
+    checkCancel(cancel);
+
+    auto decode = [&](const MergedRow& c, float* out) {
+        const Source& source = sources[c.source];
+        const size_t bytes = dim * util::element_size(source.type);
+        util::decode_vector(source.vectors.data() + c.row * bytes, dim, source.type, source.scales[c.row], out);
+    };
+
+    // Train, or keep a model that still fits
+    const size_t n = live.size();
+    if (n > 0) {
+        const size_t k = std::min(n, std::max<size_t>(options.train_sample, 1));
+        std::vector<size_t> picks(n);
+        std::iota(picks.begin(), picks.end(), size_t{0});
+        std::mt19937_64 rng(options.params.seed);
+        for (size_t i = 0; i < k && k < n; ++i) std::swap(picks[i], picks[i + rng() % (n - i)]);
+        std::vector<float> sample(k * dim);
+#pragma omp parallel for schedule(static)
+        for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(k); ++i) decode(live[picks[i]], sample.data() + i * dim);
+
+        bool reuse = model && model->dim() == dim && model->pq().m() == options.params.m &&
+                     model->pq().nbits() == options.params.nbits &&
+                     model->rotated() == options.params.use_opq;
+        if (reuse) {
+            const float drift = model->distortion(sample.data(), std::min(k, kDriftSample));
+            reuse = drift <= model->trainedDistortion() * (1.0f + options.retrain_drift);
+            if (!reuse) {
+                LOG_INFO("Stable build: model distortion {} against {} at training, retraining", drift,
+                         model->trainedDistortion());
+            }
+        }
+        if (!reuse) {
+            model = index::IvfPqModel::train(options.params, options.dim, sample.data(), k);
+            result.trained = true;
+        }
+    }
+    result.model = model;
+    checkCancel(cancel);
+
+    // Copy the codes of rows already coded with the model; assign and code
+    // the rest in batches
+    const size_t code_bytes = model ? model->codeBytes() : 0;
+    const uint32_t model_id = model ? model->id() : 0;
+    std::vector<uint32_t> lists(n);
+    std::vector<uint8_t> codes(n * code_bytes);
+    {
+        const size_t batch_rows = std::max<size_t>(options.encode_batch, 1);
+        std::vector<size_t> pending;
+        std::vector<float> batch(std::min(n, batch_rows) * dim);
+        std::vector<uint32_t> batch_lists(std::min(n, batch_rows));
+        std::vector<uint8_t> batch_codes(std::min(n, batch_rows) * code_bytes);
+        auto encodePending = [&] {
+            checkCancel(cancel);
+            const size_t count = pending.size();
+#pragma omp parallel for schedule(static)
+            for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(count); ++i) decode(live[pending[i]], batch.data() + i * dim);
+            model->encodeBatch(batch.data(), count, batch_lists.data(), batch_codes.data(), options.params.assign);
+            for (size_t i = 0; i < count; ++i) {
+                lists[pending[i]] = batch_lists[i];
+                std::memcpy(codes.data() + pending[i] * code_bytes, batch_codes.data() + i * code_bytes, code_bytes);
+            }
+            pending.clear();
+        };
+        for (size_t i = 0; i < n; ++i) {
+            const Source& source = sources[live[i].source];
+            if (source.stable && source.stable->header().model_id == model_id) {
+                lists[i] = source.row_lists[live[i].row];
+                std::memcpy(codes.data() + i * code_bytes,
+                            source.stable->codes().data() + live[i].row * code_bytes, code_bytes);
+                result.copied_codes++;
+                continue;
+            }
+            pending.push_back(i);
+            if (pending.size() == batch_rows) encodePending();
+        }
+        if (!pending.empty()) encodePending();
+    }
+
+    // Live rows by list, then id hash; tombstones after them
+    std::vector<uint32_t> order(n + dead.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.begin() + n, [&](uint32_t a, uint32_t b) {
+        if (lists[a] != lists[b]) return lists[a] < lists[b];
+        return live[a].id_hash < live[b].id_hash;
+    });
+
+    // Regroup each list's rows by proximity, page by page
+    if (options.page_clustered && n > 0 && dim > 0) {
+        std::vector<std::pair<uint64_t, uint64_t>> spans;  // [begin, end) of order, per list
+        for (uint64_t pos = 0; pos < n;) {
+            uint64_t end = pos + 1;
+            while (end < n && lists[order[end]] == lists[order[pos]]) end++;
+            if (end - pos <= std::max<size_t>(options.encode_batch, 1) &&
+                pageOf(pos, vector_bytes) != pageOf(end - 1, vector_bytes)) {
+                spans.emplace_back(pos, end);
+            }
+            pos = end;
+        }
+        checkCancel(cancel);
+#pragma omp parallel
+        {
+            std::vector<float> data;
+            std::vector<uint32_t> slots;
+            std::vector<uint32_t> rows_of;
+            std::vector<float> projection;
+            std::vector<float> direction;
+#pragma omp for schedule(dynamic, 1)
+            for (ptrdiff_t s = 0; s < static_cast<ptrdiff_t>(spans.size()); ++s) {
+                const auto [begin, end] = spans[s];
+                const size_t count = end - begin;
+                data.resize(count * dim);
+                rows_of.assign(order.begin() + begin, order.begin() + end);
+                for (size_t i = 0; i < count; ++i) decode(live[rows_of[i]], data.data() + i * dim);
+                slots.resize(count);
+                std::iota(slots.begin(), slots.end(), 0u);
+                projection.resize(count);
+                clusterPages(slots, data.data(), dim, begin, vector_bytes, projection, direction);
+                for (size_t i = 0; i < count; ++i) order[begin + i] = rows_of[slots[i]];
+            }
+        }
+        result.clustered_lists = spans.size();
+    }
+
+    StableSegmentHeader header{};
+    header.magic = StableSegmentHeader::kMagic;
+    header.version = StableSegmentHeader::kVersion;
+    header.dim = options.dim;
+    header.element_type = static_cast<uint32_t>(options.element_type);
+    header.rows = order.size();
+    header.live_rows = n;
+    header.min_id_hash = std::numeric_limits<VectorIdHash>::max();
+    header.min_epoch = std::numeric_limits<Epoch>::max();
+    if (model) {
+        header.flags = model->rotated() ? StableSegmentHeader::kRotated : 0;
+        if (options.params.fast_scan && model->pq().nbits() == 4 && model->pq().m() <= index::kFastScanMaxM) {
+            header.flags |= StableSegmentHeader::kFastScan;
+        }
+        header.nlist = model->nlist();
+        header.pq_m = model->pq().m();
+        header.pq_nbits = model->pq().nbits();
+        header.model_id = model->id();
+    }
+
+    std::vector<DeltaRow> rows(order.size());
+    std::vector<DeltaListExtent> directory;
+    for (uint64_t pos = 0; pos < order.size(); ++pos) {
+        const uint32_t i = order[pos];
+        const MergedRow& c = i < n ? live[i] : dead[i - n];
+        rows[i] = sources[c.source].row(c.row);
+        header.min_id_hash = std::min(header.min_id_hash, c.id_hash);
+        header.max_id_hash = std::max(header.max_id_hash, c.id_hash);
+        header.min_epoch = std::min(header.min_epoch, c.epoch);
+        header.max_epoch = std::max(header.max_epoch, c.epoch);
+        if (i >= n) continue;
+        if (directory.empty() || directory.back().centroid != lists[i]) directory.push_back({lists[i], 0, pos, 0});
+        directory.back().rows++;
+    }
+    header.lists = directory.size();
+    if (order.empty()) {
+        header.min_id_hash = 0;
+        header.min_epoch = 0;
+    }
+
+    SegmentWriter writer(path, options.writer);
+    writer.writeSection(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::Header),
+                        &header, sizeof(header));
+    if (model) {
+        auto bytes = model->serialize();
+        writer.writeSection(SegmentSectionKind::Metadata, kStableModelSection, bytes.data(), bytes.size());
+    }
+    writer.writeSection(SegmentSectionKind::ListDirectory, 0, directory.data(),
+                        directory.size() * sizeof(DeltaListExtent));
+    checkCancel(cancel);
+
+    // Full vectors for rerank, in list order
+    std::vector<float> scales;
+    {
+        std::vector<float> decoded(dim);
+        std::vector<std::byte> encoded(vector_bytes);
+        writer.beginSection(SegmentSectionKind::Vectors, 0);
+        for (size_t pos = 0; pos < n; ++pos) {
+            if (pos % options.encode_batch == 0) checkCancel(cancel);
+            const MergedRow& c = live[order[pos]];
+            const Source& source = sources[c.source];
+            float scale = source.scales[c.row];
+            if (source.type == options.element_type) {
+                writer.append(source.vectors.data() + c.row * vector_bytes, vector_bytes);
+            } else {
+                decode(c, decoded.data());
+                scale = util::encode_vector(decoded.data(), dim, options.element_type, encoded.data());
+                writer.append(encoded.data(), vector_bytes);
+            }
+            if (options.element_type == ElementType::INT8) scales.push_back(scale);
+        }
+        writer.endSection();
+    }
+    if (options.element_type == ElementType::INT8) {
+        writer.writeSection(SegmentSectionKind::Vectors, 1, scales.data(), scales.size() * sizeof(float));
+    }
+    {
+        std::vector<uint8_t> ordered(codes.size());
+        for (size_t pos = 0; pos < n; ++pos) {
+            std::memcpy(ordered.data() + pos * code_bytes, codes.data() + order[pos] * code_bytes, code_bytes);
+        }
+        writer.writeSection(SegmentSectionKind::Vectors, kStableCodesSection, ordered.data(), ordered.size());
+
+        if (header.flags & StableSegmentHeader::kFastScan) {
+            const uint32_t m = model->pq().m();
+            std::vector<uint8_t> packed;
+            writer.beginSection(SegmentSectionKind::Vectors, kStableFastScanSection);
+            for (const DeltaListExtent& extent : directory) {
+                packed.resize(index::fastScanBlocks(extent.rows) * index::fastScanBlockBytes(m));
+                index::packFastScanCodes(ordered.data() + extent.first_row * code_bytes, extent.rows, m,
+                                         packed.data());
+                writer.append(packed.data(), packed.size());
+            }
+            writer.endSection();
+        }
+    }
+    checkCancel(cancel);
+
+    // Zone map per IVF list, over the vectors as stored
+    {
+        ZoneMapBuilder zones(options.dim, options.bloom_fpp);
+        std::vector<std::byte> encoded(vector_bytes);
+        for (const DeltaListExtent& extent : directory) {
+            auto row = [&](uint64_t i) -> const DeltaRow& { return rows[order[extent.first_row + i]]; };
+            zones.addList(extent.centroid, extent.rows, row, [&](uint64_t i, float* out) {
+                const MergedRow& c = live[order[extent.first_row + i]];
+                decode(c, out);
+                if (sources[c.source].type == options.element_type) return;
+                const float scale = util::encode_vector(out, dim, options.element_type, encoded.data());
+                util::decode_vector(encoded.data(), dim, options.element_type, scale, out);
+            });
+        }
+        zones.write(writer);
+    }
+    checkCancel(cancel);
+
+    writeRowColumns(writer, rows, order);
+    // Stable rows mix every tenant: counted in the totals only
+    Metrics::global().writes.add(WritePoint::Compaction, writer.seal());
+
+    result.descriptor = describe(path, header, std::chrono::duration_cast<Timestamp>(
+        std::chrono::system_clock::now().time_since_epoch()));
+    return result;
+}
+
+StableSegment::StableSegment(std::string path, const SegmentReader::Options& options)
+    : reader_(std::move(path), options) {
+    const SegmentSection* section = reader_.find(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::Header));
+    if (!section || section->length != sizeof(header_)) {
+        throw util::IOException("Stable segment " + reader_.path() + ": missing header");
+    }
+    auto raw = reader_.readSection(*section);
+    std::memcpy(&header_, raw.data(), sizeof(header_));
+    if (header_.magic != StableSegmentHeader::kMagic || header_.version != StableSegmentHeader::kVersion) {
+        throw util::IOException("Stable segment " + reader_.path() + ": not a stable segment (version " +
+                                std::to_string(header_.version) + ")");
+    }
+    if (header_.element_type > static_cast<uint32_t>(ElementType::INT8) || header_.live_rows > header_.rows) {
+        throw util::IOException("Stable segment " + reader_.path() + ": corrupt header");
+    }
+
+    if (const SegmentSection* blob = reader_.find(SegmentSectionKind::Metadata, kStableModelSection)) {
+        model_ = index::IvfPqModel::deserialize(reader_.readSection(*blob));
+        if (model_->id() != header_.model_id || model_->dim() != header_.dim) {
+            throw util::IOException("Stable segment " + reader_.path() + ": model does not match the header");
+        }
+    } else if (header_.live_rows > 0) {
+        throw util::IOException("Stable segment " + reader_.path() + ": missing IVF-PQ model");
+    }
+
+    vector_bytes_ = header_.dim * util::element_size(static_cast<ElementType>(header_.element_type));
+    vectors_ = reader_.find(SegmentSectionKind::Vectors, 0);
+    codes_ = reader_.find(SegmentSectionKind::Vectors, kStableCodesSection);
+    if (!vectors_ || vectors_->length != header_.live_rows * vector_bytes_ ||
+        !codes_ || codes_->length != header_.live_rows * codeBytes()) {
+        throw util::IOException("Stable segment " + reader_.path() + ": vector sections do not match the header");
+    }
+
+    const SegmentSection* dir = reader_.find(SegmentSectionKind::ListDirectory, 0);
+    if (!dir || dir->length != header_.lists * sizeof(DeltaListExtent)) {
+        throw util::IOException("Stable segment " + reader_.path() + ": bad list directory");
+    }
+    lists_.resize(header_.lists);
+    auto bytes = reader_.readSection(*dir);
+    if (!bytes.empty()) std::memcpy(lists_.data(), bytes.data(), bytes.size());
+    for (const DeltaListExtent& extent : lists_) {
+        if (extent.first_row + extent.rows > header_.live_rows || extent.centroid >= header_.nlist) {
+            throw util::IOException("Stable segment " + reader_.path() + ": list extent out of range");
+        }
+    }
+
+    if (header_.flags & StableSegmentHeader::kFastScan) {
+        fast_scan_ = reader_.find(SegmentSectionKind::Vectors, kStableFastScanSection);
+        if (!model_ || model_->pq().nbits() != 4 || !fast_scan_) {
+            throw util::IOException("Stable segment " + reader_.path() + ": bad fast-scan codes");
+        }
+        const size_t block_bytes = index::fastScanBlockBytes(model_->pq().m());
+        uint64_t offset = 0;
+        fast_scan_offsets_.reserve(lists_.size());
+        for (const DeltaListExtent& extent : lists_) {
+            fast_scan_offsets_.push_back(offset);
+            offset += index::fastScanBlocks(extent.rows) * block_bytes;
+        }
+        if (fast_scan_->length != offset) {
+            throw util::IOException("Stable segment " + reader_.path() + ": fast-scan codes do not match the directory");
+        }
+    }
+    if (static_cast<ElementType>(header_.element_type) == ElementType::INT8) {
+        scales_ = reader_.find(SegmentSectionKind::Vectors, 1);
+        if (!scales_ || scales_->length != header_.live_rows * sizeof(float)) {
+            throw util::IOException("Stable segment " + reader_.path() + ": missing INT8 scales");
+        }
+    }
+
+    id_hashes_ = loadFixed<VectorIdHash>(reader_, DeltaColumn::IdHash, header_.rows);
+    epochs_ = loadFixed<Epoch>(reader_, DeltaColumn::Epoch, header_.rows);
+    flags_ = loadFixed<uint8_t>(reader_, DeltaColumn::Flags, header_.rows);
+    zone_map_ = ZoneMap::read(reader_);
+}
+
+const DeltaListExtent* StableSegment::extent(uint32_t list) const {
+    auto it = std::lower_bound(lists_.begin(), lists_.end(), list,
+                               [](const DeltaListExtent& e, uint32_t l) { return e.centroid < l; });
+    return it == lists_.end() || it->centroid != list ? nullptr : &*it;
+}
+
+StableSegment::RowRange StableSegment::list(uint32_t list) const {
+    const DeltaListExtent* e = extent(list);
+    if (!e) return {};
+    return {e->first_row, e->rows};
+}
+
+std::span<const std::byte> StableSegment::listCodes(uint32_t list) const {
+    RowRange range = this->list(list);
+    return reader_.view(*codes_).subspan(range.first_row * codeBytes(), range.rows * codeBytes());
+}
+
+std::vector<StableSegment::RowRange> StableSegment::readListCodes(std::span<const uint32_t> lists,
+                                                                  std::vector<std::byte>& out) const {
+    std::vector<RowRange> ranges;
+    ranges.reserve(lists.size());
+    uint64_t total = 0;
+    for (uint32_t l : lists) {
+        ranges.push_back(list(l));
+        total += ranges.back().rows;
+    }
+    out.resize(total * codeBytes());
+
+    std::vector<SegmentReader::ReadRequest> requests;
+    size_t pos = 0;
+    for (const RowRange& range : ranges) {
+        if (range.rows == 0) continue;
+        const size_t bytes = range.rows * codeBytes();
+        requests.push_back({codes_, range.first_row * codeBytes(), std::span(out).subspan(pos, bytes)});
+        pos += bytes;
+    }
+    reader_.readBatch(requests);
+    return ranges;
+}
+
+StableSegment::RowRange StableSegment::adc(const float* query_rotated, uint32_t list,
+                                           std::vector<float>& dist) const {
+    thread_local ListAdc prepared;
+    prepareAdc(query_rotated, list, prepared);
+    adc(prepared, dist);
+    return prepared.range;
+}
+
+void StableSegment::prepareAdc(const float* query_rotated, uint32_t list, ListAdc& out) const {
+    uint64_t offset = 0;
+    const SegmentSection* section = prepareTable(query_rotated, list, out, offset);
+    if (!section) return;
+    reader_.read(*section, offset, out.codes);
+    out.range = {extent(list)->first_row, extent(list)->rows};
+}
+
+util::Task<void> StableSegment::prepareAdcAsync(const float* query_rotated, uint32_t list, ListAdc& out) const {
+    uint64_t offset = 0;
+    const SegmentSection* section = prepareTable(query_rotated, list, out, offset);
+    if (!section) co_return;
+    co_await reader_.readAsync(*section, offset, out.codes);
+    out.range = {extent(list)->first_row, extent(list)->rows};
+}
+
+const SegmentSection* StableSegment::prepareTable(const float* query_rotated, uint32_t list, ListAdc& out,
+                                                  uint64_t& offset) const {
+    const DeltaListExtent* e = extent(list);
+    out.range = {};
+    if (!model_ || !e || e->rows == 0) return nullptr;
+    const index::ProductQuantizer& pq = model_->pq();
+    const size_t dim = header_.dim;
+    thread_local std::vector<float> scratch;
+    scratch.resize(dim + size_t{pq.m()} * pq.ksub());
+    if (fast_scan_) {
+        model_->fastScanTable(query_rotated, list, out.fast, scratch.data());
+        out.codes.resize(index::fastScanBlocks(e->rows) * index::fastScanBlockBytes(pq.m()));
+        offset = fast_scan_offsets_[e - lists_.data()];
+        return fast_scan_;
+    }
+    out.table.resize(size_t{pq.m()} * pq.ksub());
+    model_->distanceTable(query_rotated, list, out.table.data(), scratch.data());
+    out.codes.resize(e->rows * codeBytes());
+    offset = e->first_row * codeBytes();
+    return codes_;
+}
+
+void StableSegment::adc(const ListAdc& prepared, std::vector<float>& dist) const {
+    const uint64_t rows = prepared.range.rows;
+    dist.resize(rows);
+    if (rows == 0) return;
+    const auto* code = reinterpret_cast<const uint8_t*>(prepared.codes.data());
+    if (fast_scan_) {
+        index::fastScanDistances(prepared.fast, code, rows, dist.data());
+    } else {
+        const index::ProductQuantizer& pq = model_->pq();
+        for (uint64_t r = 0; r < rows; ++r) dist[r] = pq.distance(prepared.table.data(), code + r * codeBytes());
+    }
+}
+
+std::vector<kernels::ScanHit> StableSegment::search(std::span<const float> query, Metric metric,
+                                                    std::span<const uint32_t> lists, size_t k,
+                                                    uint32_t rerank_factor) const {
+    if (!model_ || k == 0 || query.size() != header_.dim) return {};
+    const size_t dim = header_.dim;
+    std::vector<float> rotated(dim);
+    model_->rotate(query.data(), rotated.data());
+
+    // ADC pass: candidates by negated approximate distance
+    std::vector<kernels::ScanHit> pool(k * std::max(rerank_factor, 1u));
+    kernels::ScanHeap candidates{pool.data(), pool.size()};
+    std::vector<float> dist;
+    for (uint32_t l : lists) {
+        const RowRange range = adc(rotated.data(), l, dist);
+        for (uint64_t r = 0; r < range.rows; ++r) {
+            if (-dist[r] > candidates.threshold()) candidates.push(-dist[r], range.first_row + r);
+        }
+    }
+
+    // Rerank in row order, so the vector reads walk the file forward
+    std::sort(pool.begin(), pool.begin() + candidates.size,
+              [](const kernels::ScanHit& a, const kernels::ScanHit& b) { return a.row < b.row; });
+    std::vector<kernels::ScanHit> hits(k);
+    kernels::ScanHeap top{hits.data(), k};
+    const auto type = static_cast<ElementType>(header_.element_type);
+    std::vector<std::byte> vector(vector_bytes_);
+    for (size_t i = 0; i < candidates.size; ++i) {
+        const uint64_t row = pool[i].row;
+        readVectors({row, 1}, vector);
+        const float scale = type == ElementType::INT8 ? scales({row, 1})[0] : 1.0f;
+        top.push(kernels::score(metric, query.data(), vector.data(), type, scale, dim), row);
+    }
+    hits.resize(top.size);
+    std::sort(hits.begin(), hits.end(),
+              [](const kernels::ScanHit& a, const kernels::ScanHit& b) { return a.score > b.score; });
+    return hits;
+}
+
+void StableSegment::readVectors(RowRange range, std::span<std::byte> out) const {
+    if (out.size() != range.rows * vector_bytes_) throw std::out_of_range("Stable segment: bad vector buffer");
+    reader_.read(*vectors_, range.first_row * vector_bytes_, out);
+}
+
+std::vector<float> StableSegment::scales(RowRange range) const {
+    std::vector<float> values(range.rows, 1.0f);
+    if (!scales_ || range.rows == 0) return values;
+    reader_.read(*scales_, range.first_row * sizeof(float), std::as_writable_bytes(std::span(values)));
+    return values;
+}
+
+DeltaRow StableSegment::row(const RowColumns& columns, uint64_t row) const {
+    DeltaRow out;
+    out.id_hash = id_hashes_[row];
+    out.epoch = epochs_[row];
+    out.tombstone = tombstone(row);
+    out.uuid = columns.uuids[row];
+    out.id = columns.id(row);
+    out.tenant = columns.name(columns.tenants[row]);
+    out.namespace_name = columns.name(columns.namespaces[row]);
+    out.tags = columns.tagsOf(row);
+    out.vector_type = static_cast<ElementType>(header_.element_type);
+    return out;
+}
+
+SegmentDescriptor StableSegment::descriptor() const {
+    return describe(reader_.path(), header_, std::chrono::microseconds(reader_.footer().created_at_us));
+}
+
+bool isStableSegment(const std::string& path) {
+    SegmentReader::Options options;
+    options.huge_pages = false;
+    SegmentReader reader(path, options);
+    const SegmentSection* section = reader.find(SegmentSectionKind::RowTable, static_cast<uint32_t>(DeltaColumn::Header));
+    uint64_t magic = 0;
+    if (section && section->length >= sizeof(magic)) {
+        reader.read(*section, 0, std::as_writable_bytes(std::span(&magic, 1)));
+    }
+    if (magic == StableSegmentHeader::kMagic) return true;
+    if (magic == DeltaSegmentHeader::kMagic) return false;
+    throw util::IOException("Segment " + path + ": neither a delta nor a stable segment");
+}
+
+StableBuildScheduler::Options StableBuildScheduler::Options::fromConfig(const Config& config) {
+    Options options;
+    options.target_vectors = std::max<uint64_t>(1, config.storage.segment.target_size_vectors);
+    // Standalone, the absolute cap applies; under an IOManager, pass its
+    // compaction limiter, which also applies storage.segment.merge_bandwidth_limit
+    options.bandwidth_bytes_per_s = uint64_t{config.io.merge_bandwidth_limit_mbps} * 1048576;
+    options.build = StableSegmentBuilder::Options::fromConfig(config);
+    return options;
+}
+
+StableBuildScheduler::StableBuildScheduler(const Options& options, InventoryFn inventory, PathFn path,
+                                           InstallFn install, std::shared_ptr<io::RateLimiter> limiter,
+                                           SegmentPlacement* placement)
+    : options_(options), inventory_(std::move(inventory)), path_(std::move(path)),
+      install_(std::move(install)), limiter_(std::move(limiter)), own_limiter_(!limiter_),
+      placement_(placement) {
+    options_.interval_ms = std::max<uint32_t>(1, options_.interval_ms);
+    options_.catch_up_factor = std::max(1.0f, options_.catch_up_factor);
+    options_.target_vectors = std::max<uint64_t>(1, options_.target_vectors);
+    if (own_limiter_) limiter_ = std::make_shared<io::RateLimiter>(options_.bandwidth_bytes_per_s);
+    options_.build.writer.limiter = limiter_;
+}
+
+StableBuildScheduler::~StableBuildScheduler() {
+    stop();
+}
+
+void StableBuildScheduler::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+    cancel_ = false;
+    thread_ = std::thread([this] { loop(); });
+}
+
+void StableBuildScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    cancel_ = true;
+    cv_.notify_all();
+    thread_.join();
+    cancel_ = false;
+}
+
+void StableBuildScheduler::wake() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        woken_ = true;
+    }
+    cv_.notify_one();
+}
+
+bool StableBuildScheduler::buildNow() {
+    return pass(true);
+}
+
+void StableBuildScheduler::setModel(std::shared_ptr<const index::IvfPqModel> model) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    model_ = std::move(model);
+}
+
+std::shared_ptr<const index::IvfPqModel> StableBuildScheduler::model() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return model_;
+}
+
+StableBuildScheduler::Stats StableBuildScheduler::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::vector<std::pair<std::string_view, double>> StableBuildScheduler::metrics() const {
+    Stats stats = getStats();
+    return {
+        {"woved_delta_fraction", stats.delta_fraction},
+        {"woved_stable_builds", static_cast<double>(stats.builds)},
+        {"woved_stable_failed_builds", static_cast<double>(stats.failed_builds)},
+        {"woved_stable_rows_written", static_cast<double>(stats.rows_written)},
+        {"woved_stable_catching_up", stats.catching_up ? 1.0 : 0.0},
+    };
+}
+
+void StableBuildScheduler::loop() {
+    const auto interval = std::chrono::milliseconds(options_.interval_ms);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        cv_.wait_for(lock, interval, [this] { return !running_ || woken_; });
+        if (!running_) break;
+        woken_ = false;
+        lock.unlock();
+        try {
+            pass(false);
+        } catch (const std::exception& e) {
+            LOG_ERROR("Stable build pass failed: {}", e.what());
+        }
+        lock.lock();
+    }
+}
+
+bool StableBuildScheduler::pass(bool force) {
+    std::lock_guard<std::mutex> build_lock(build_mutex_);
+    Inventory inventory = inventory_();
+
+    uint64_t delta_rows = 0;
+    for (const SegmentDescriptor& d : inventory.delta) delta_rows += d.num_vectors;
+    const double fraction = inventory.total_vectors == 0 ? 0.0
+        : static_cast<double>(delta_rows) / static_cast<double>(inventory.total_vectors);
+    const bool catching_up = fraction > options_.max_delta_fraction;
+    std::shared_ptr<const index::IvfPqModel> model;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.passes++;
+        stats_.delta_fraction = fraction;
+        stats_.catching_up = catching_up;
+        model = model_;
+    }
+    if (own_limiter_ && options_.bandwidth_bytes_per_s > 0) {
+        const double factor = catching_up ? options_.catch_up_factor : 1.0;
+        limiter_->setRate(static_cast<uint64_t>(static_cast<double>(options_.bandwidth_bytes_per_s) * factor));
+    }
+    if (inventory.delta.empty()) return false;
+    if (!force && fraction < options_.trigger_share * options_.max_delta_fraction) return false;
+
+    // Oldest delta segments first, up to one stable segment's worth
+    std::sort(inventory.delta.begin(), inventory.delta.end(), [](const SegmentDescriptor& a, const SegmentDescriptor& b) {
+        return a.max_epoch != b.max_epoch ? a.max_epoch < b.max_epoch : a.min_epoch < b.min_epoch;
+    });
+    std::vector<SegmentDescriptor> merged;
+    std::vector<std::string> paths;
+    uint64_t rows = 0;
+    for (const SegmentDescriptor& d : inventory.delta) {
+        if (!merged.empty() && rows + d.num_vectors > options_.target_vectors) break;
+        merged.push_back(d);
+        paths.push_back(d.file_path);
+        rows += d.num_vectors;
+    }
+    // Tombstones may still shadow rows in delta segments left for later
+    const bool drop_tombstones = inventory.drop_tombstones && merged.size() == inventory.delta.size();
+
+    const std::string output = placement_ ? placement_->place(path_(), SegmentPlacement::fileBytes(merged))
+                                          : path_();
+    const auto started = std::chrono::steady_clock::now();
+    StableSegmentBuilder::Result result;
+    try {
+        result = StableSegmentBuilder::build(output, options_.build, paths, model, drop_tombstones, &cancel_);
+        install_(merged, result.descriptor);
+    } catch (const std::exception& e) {
+        std::remove(output.c_str());
+        if (placement_) placement_->removed(output);
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.failed_builds++;
+        LOG_ERROR("Stable build of {} delta segments into {} failed: {}", merged.size(), output, e.what());
+        return false;
+    }
+
+    if (placement_) placement_->replaced(merged, output);
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    LOG_INFO("Stable build: {} delta segments ({} rows) into {}: {} rows, {} superseded, {} model, {:.1f} s",
+             merged.size(), result.input_rows, output, result.descriptor.num_vectors, result.superseded_rows,
+             result.trained ? "new" : "reused", seconds);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (result.model) model_ = result.model;
+    stats_.builds++;
+    if (result.trained) stats_.trainings++;
+    stats_.merged_segments += merged.size();
+    stats_.rows_written += result.descriptor.num_vectors;
+    stats_.superseded_rows += result.superseded_rows;
+    return true;
+}
+
+} // namespace woved::storage
@@ -0,0 +1,350 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "index/ivf-pq.h"
+#include "io/rate-limiter.h"
+#include "storage/segment/seg-delta.h"
+#include "util/simd-dispatch.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::storage {
+
+class ColdTier;
+class SegmentPlacement;
+
+// Stable segment layout on top of the segment file (seg-w.h). Rows are
+// IVF-PQ coded against the segment's model; live rows are ordered by list,
+// then id hash, so each list's codes (and its full vectors, for rerank)
+// are one contiguous block. Tombstones follow the live rows.
+//
+// With experimental.connectivity_aware_layout the rows of a list are
+// instead ordered so that vectors close to each other share a 4 KiB page
+// of the vector section: a query's rerank candidates are neighbours of
+// the query and so of each other, and land on fewer pages, which rerank
+// coalesces into fewer reads (and the page cache keeps fewer of).
+//
+// Sections:
+//   RowTable 0        StableSegmentHeader
+//   Metadata 1        IVF-PQ model (IvfPqModel::serialize)
+//   ListDirectory 0   DeltaListExtent per non-empty list, by list number
+//   Vectors 0         Live vectors, row-major, dim x element_type
+//   Vectors 1         Per-vector INT8 scales (float), INT8 only
+//   Vectors 2         PQ codes, codeBytes() per live row
+//   Vectors 3         Fast-scan codes (kFastScan only): each list's codes
+//                     packed into 32-row blocks (index::packFastScanCodes),
+//                     lists in directory order
+//   Metadata 2, 3     Zone map, one zone per list (seg-zone.h)
+//   RowTable <col>    Row columns as in delta segments (DeltaColumn)
+inline constexpr uint32_t kStableModelSection = 1;
+inline constexpr uint32_t kStableCodesSection = 2;
+inline constexpr uint32_t kStableFastScanSection = 3;
+
+struct StableSegmentHeader {
+    static constexpr uint64_t kMagic = 0x4254534445564f57ULL;  // "WOVEDSTB"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint32_t kRotated = 0x1;  // The model has an OPQ rotation
+    static constexpr uint32_t kFastScan = 0x2; // Fast-scan codes are written
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t element_type;     // ElementType
+    uint32_t flags;
+    uint32_t nlist;
+    uint32_t pq_m;
+    uint32_t pq_nbits;
+    uint32_t model_id;         // IvfPqModel::id()
+    uint64_t rows;
+    uint64_t live_rows;
+    uint64_t lists;            // Directory entries
+    VectorIdHash min_id_hash;
+    VectorIdHash max_id_hash;
+    Epoch min_epoch;
+    Epoch max_epoch;
+};
+
+// Merges delta and stable segments into one stable segment. The newest
+// version of each id wins (a tombstone wins a tie); superseded rows are
+// dropped.
+//
+// The model is reused while it still fits: its distortion on a sample of
+// the new rows may exceed the distortion it was trained at by at most
+// retrain_drift. Without a model passed in, the largest stable input's is
+// the candidate. Otherwise coarse centroids, OPQ rotation and codebooks
+// are trained on a uniform sample of train_sample rows. Rows of stable
+// inputs coded with the kept model are copied as they are; the rest are
+// encoded in parallel in batches, so the merge holds the codes but never
+// the decoded vectors of the whole segment.
+class StableSegmentBuilder {
+public:
+    struct Options {
+        uint32_t dim = 768;
+        ElementType element_type = ElementType::FP32;
+        index::IvfPqModel::Params params;
+        size_t train_sample = 262144;
+        float retrain_drift = 0.25f;
+        size_t encode_batch = 65536;    // Rows decoded and encoded at a time
+        float bloom_fpp = 0.01f;        // Zone map bloom filter; 0: none
+        // experimental.connectivity_aware_layout: rows of a list grouped
+        // by proximity into pages. Lists over encode_batch rows keep id
+        // hash order, so a build thread never decodes more than a batch.
+        bool page_clustered = true;
+        SegmentWriter::Options writer;  // writer.limiter throttles the build
+        ColdTier* cold = nullptr;       // Restores cold inputs before they are mapped
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Result {
+        SegmentDescriptor descriptor;
+        std::shared_ptr<const index::IvfPqModel> model;
+        bool trained = false;           // A new model was trained
+        uint64_t input_rows = 0;
+        uint64_t superseded_rows = 0;   // Older versions and dropped tombstones
+        uint64_t copied_codes = 0;      // Taken from stable inputs unchanged
+        uint64_t clustered_lists = 0;   // Lists laid out by proximity (page_clustered)
+        uint64_t bytes_read = 0;
+    };
+
+    // Builds `path` from the delta or stable segments at `inputs`. Tombstones are
+    // kept unless `drop_tombstones` (nothing older can hold their ids).
+    // A set `cancel` aborts the build between batches with
+    // util::WovedException; the partial file is removed.
+    static Result build(const std::string& path, const Options& options, std::span<const std::string> inputs,
+                        std::shared_ptr<const index::IvfPqModel> model = nullptr, bool drop_tombstones = false,
+                        const std::atomic<bool>* cancel = nullptr);
+};
+
+// Read side of a stable segment. The header, model, directory and the id
+// hash, epoch and flag columns are loaded on open.
+class StableSegment {
+public:
+    using RowRange = DeltaSegment::RowRange;
+
+    StableSegment(std::string path, const SegmentReader::Options& options);
+
+    const StableSegmentHeader& header() const { return header_; }
+    const std::shared_ptr<const index::IvfPqModel>& model() const { return model_; }
+    uint64_t rows() const { return header_.rows; }
+    uint64_t liveRows() const { return header_.live_rows; }
+    size_t codeBytes() const { return model_ ? model_->codeBytes() : 0; }
+    size_t vectorBytes() const { return vector_bytes_; }
+    const std::vector<DeltaListExtent>& lists() const { return lists_; }
+    SegmentReader& reader() { return reader_; }
+    const SegmentReader& reader() const { return reader_; }
+
+    // Sections behind readVectors() and scales(), for callers batching
+    // their own reads; scaleSection() is null unless INT8
+    const SegmentSection& vectorSection() const { return *vectors_; }
+    const SegmentSection* scaleSection() const { return scales_; }
+
+    RowRange list(uint32_t list) const;
+
+    // The list's codes in place (mmap mode only)
+    std::span<const std::byte> listCodes(uint32_t list) const;
+
+    // Copy the codes of several lists in one batch, back to back in the
+    // order given; returns each list's range
+    std::vector<RowRange> readListCodes(std::span<const uint32_t> lists, std::vector<std::byte>& out) const;
+
+    // Fast-scan codes were written (4-bit models built with fast_scan)
+    bool fastScan() const { return fast_scan_ != nullptr; }
+
+    // Approximate squared L2 distances (ADC) from `query_rotated` (the
+    // model's rotate() of the query) to every row of a list, fast scan
+    // when written. `dist` is resized to the list's rows; returns them.
+    RowRange adc(const float* query_rotated, uint32_t list, std::vector<float>& dist) const;
+
+    // The same in two steps, so the first can run ahead of the scan
+    // (index/stable-scanner.h): prepareAdc() reads a list's codes and
+    // builds the query's table for it; adc() scores the prepared list.
+    // prepareAdcAsync() builds the table before its first suspension and
+    // then awaits the codes (SegmentReader::readAsync()).
+    struct ListAdc {
+        RowRange range;
+        std::vector<std::byte> codes;
+        std::vector<float> table;       // m x ksub, plain codes
+        index::FastScanTable fast;      // Fast-scan codes
+    };
+    void prepareAdc(const float* query_rotated, uint32_t list, ListAdc& out) const;
+    util::Task<void> prepareAdcAsync(const float* query_rotated, uint32_t list, ListAdc& out) const;
+    void adc(const ListAdc& prepared, std::vector<float>& dist) const;
+
+    // Top k rows of `lists` for the query, best first. Candidates are
+    // picked by ADC on the PQ codes (fast scan when written), then
+    // rerank_factor * k of them are rescored exactly on the full vectors.
+    // ADC ranks by L2 distance for every metric; rerank restores the
+    // metric's order.
+    std::vector<kernels::ScanHit> search(std::span<const float> query, Metric metric,
+                                         std::span<const uint32_t> lists, size_t k,
+                                         uint32_t rerank_factor) const;
+
+    // Full vectors of a row range, for rerank
+    void readVectors(RowRange range, std::span<std::byte> out) const;
+    std::vector<float> scales(RowRange range) const;
+
+    // Every live vector and code in place (mmap mode only)
+    std::span<const std::byte> vectors() const { return reader_.view(*vectors_); }
+    std::span<const std::byte> codes() const { return reader_.view(*codes_); }
+
+    std::span<const VectorIdHash> idHashes() const { return id_hashes_; }
+    std::span<const Epoch> epochs() const { return epochs_; }
+    std::span<const uint8_t> flags() const { return flags_; }
+    bool tombstone(uint64_t row) const { return (flags_[row] & kDeltaTombstone) != 0; }
+    RowColumns readRows() const { return RowColumns::read(reader_, header_.rows); }
+
+    // Row fields as views into `columns` (from readRows()), without the vector
+    DeltaRow row(const RowColumns& columns, uint64_t row) const;
+
+    // Loaded on open; std::nullopt for segments written without one
+    const std::optional<ZoneMap>& zoneMap() const { return zone_map_; }
+
+    SegmentDescriptor descriptor() const;
+
+private:
+    SegmentReader reader_;
+    StableSegmentHeader header_{};
+    std::shared_ptr<const index::IvfPqModel> model_;
+    size_t vector_bytes_ = 0;
+    const SegmentSection* vectors_ = nullptr;
+    const SegmentSection* codes_ = nullptr;
+    const SegmentSection* fast_scan_ = nullptr;
+    const SegmentSection* scales_ = nullptr;
+    std::vector<DeltaListExtent> lists_;
+    std::vector<uint64_t> fast_scan_offsets_;  // Per directory entry
+    std::vector<VectorIdHash> id_hashes_;
+    std::vector<Epoch> epochs_;
+    std::vector<uint8_t> flags_;
+    std::optional<ZoneMap> zone_map_;
+
+    const DeltaListExtent* extent(uint32_t list) const;
+
+    // prepareAdc() up to the read: builds the table and sizes out.codes;
+    // returns the codes' section and offset, or null for an empty list
+    const SegmentSection* prepareTable(const float* query_rotated, uint32_t list, ListAdc& out,
+                                       uint64_t& offset) const;
+};
+
+// True if `path` holds a stable segment rather than a delta segment; throws
+// util::IOException if it is neither
+bool isStableSegment(const std::string& path);
+
+// Background merges of delta segments into stable segments, one build at
+// a time. Every interval_ms (or on wake()) a pass asks for the current
+// inventory; once delta rows reach trigger_share of max_delta_fraction of
+// all rows it merges the oldest delta segments, up to target_vectors rows,
+// and hands the result to the install callback.
+//
+// Builds charge every write to the limiter (io.merge_bandwidth_limit_mbps)
+// so merges do not starve foreground I/O. While the delta fraction is over
+// the maximum the scheduler's own limiter runs catch_up_factor faster, so
+// a heavy ingest cannot outrun the merges; a shared limiter is left alone.
+//
+// The model is carried from build to build and retrained only when it
+// drifts (StableSegmentBuilder); seed it with setModel() from the newest
+// stable segment at startup.
+class StableBuildScheduler {
+public:
+    struct Options {
+        uint32_t interval_ms = 1000;
+        float max_delta_fraction = constants::MAX_DELTA_FRACTION;
+        float trigger_share = 0.8f;
+        uint64_t target_vectors = constants::DEFAULT_VECTORS_PER_SEGMENT;
+        uint64_t bandwidth_bytes_per_s = 0;  // 0 = unlimited
+        float catch_up_factor = 2.0f;
+        StableSegmentBuilder::Options build;
+
+        static Options fromConfig(const Config& config);
+    };
+
+    struct Inventory {
+        std::vector<SegmentDescriptor> delta;
+        uint64_t total_vectors = 0;    // Delta and stable rows
+        bool drop_tombstones = false;  // No stable segment holds older rows
+    };
+
+    using InventoryFn = std::function<Inventory()>;
+    // Path of the next stable segment
+    using PathFn = std::function<std::string()>;
+    // Replace `merged` by `stable` (manifest update). Throwing discards
+    // the new segment and leaves the delta segments in place.
+    using InstallFn = std::function<void(const std::vector<SegmentDescriptor>& merged,
+                                         const SegmentDescriptor& stable)>;
+
+    struct Stats {
+        uint64_t passes = 0;
+        uint64_t builds = 0;
+        uint64_t failed_builds = 0;
+        uint64_t trainings = 0;
+        uint64_t merged_segments = 0;
+        uint64_t rows_written = 0;
+        uint64_t superseded_rows = 0;
+        double delta_fraction = 0;   // At the last pass
+        bool catching_up = false;
+    };
+
+    // With a placement, the new segment keeps the file name PathFn gives
+    // and goes to the directory the placement picks
+    StableBuildScheduler(const Options& options, InventoryFn inventory, PathFn path, InstallFn install,
+                         std::shared_ptr<io::RateLimiter> limiter = nullptr,
+                         SegmentPlacement* placement = nullptr);
+    ~StableBuildScheduler();
+
+    StableBuildScheduler(const StableBuildScheduler&) = delete;
+    StableBuildScheduler& operator=(const StableBuildScheduler&) = delete;
+
+    void start();
+    void stop();  // Cancels a build in flight
+    void wake();
+
+    // Run a pass on the calling thread, building even below the trigger.
+    // Returns true if a segment was built and installed.
+    bool buildNow();
+
+    void setModel(std::shared_ptr<const index::IvfPqModel> model);
+    std::shared_ptr<const index::IvfPqModel> model() const;
+
+    Stats getStats() const;
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    Options options_;
+    InventoryFn inventory_;
+    PathFn path_;
+    InstallFn install_;
+    std::shared_ptr<io::RateLimiter> limiter_;
+    bool own_limiter_;
+    SegmentPlacement* placement_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::mutex build_mutex_;  // One build at a time
+    bool running_ = false;
+    bool woken_ = false;
+    std::atomic<bool> cancel_{false};
+    std::shared_ptr<const index::IvfPqModel> model_;
+    Stats stats_;
+    std::thread thread_;
+
+    void loop();
+    bool pass(bool force);
+};
+
+} // namespace woved::storage
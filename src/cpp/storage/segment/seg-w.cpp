@@ -0,0 +1,427 @@
+#include "seg-w.h"
+#include "core/config.h"
+#include "util/crc32c.h"
+#include "util/exceptions.h"
+#include "util/file-io.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t kBlock = 4096;
+
+constexpr size_t roundUp(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Dictionary samples are cut from held blocks in pieces of this size
+constexpr size_t kSamplePiece = 4096;
+
+} // namespace
+
+// A compressible section held back while the dictionary is sampled
+struct SegmentWriter::HeldSection {
+    SegmentSectionKind kind;
+    uint32_t id;
+    std::vector<std::vector<std::byte>> blocks;  // Raw, compression_block each
+    bool open = true;
+};
+
+SegmentWriter::Options SegmentWriter::Options::fromConfig(const IOConfig& io) {
+    Options options;
+    options.queue_depth = std::max(1u, io.iouring.queue_depth);
+    options.direct_io = io.use_direct_io;
+    options.ring = io::UringWrapper::Options::fromConfig(io);
+    return options;
+}
+
+SegmentWriter::Options SegmentWriter::Options::fromConfig(const Config& config) {
+    Options options = fromConfig(config.io);
+    const SegmentConfig& segment = config.storage.segment;
+    if (segment.enable_compression) {
+        if (segment.compression_type != "zstd") {
+            throw util::ConfigException("Unsupported segment compression: " + segment.compression_type);
+        }
+        options.compress_metadata = true;
+        options.compression_level = segment.compression_level;
+        options.dict_bytes = segment.dict_bytes;
+    }
+    return options;
+}
+
+io::UringWrapper::Options SegmentWriter::ringOptions(const Options& options) {
+    io::UringWrapper::Options ring = options.ring;
+    ring.entries = std::max(1u, options.queue_depth);
+    return ring;
+}
+
+SegmentWriter::SegmentWriter(std::string path, const Options& options)
+    : options_(options), path_(std::move(path)), tmp_path_(path_ + ".tmp"),
+      ring_(ringOptions(options)) {
+    static_assert(sizeof(SegmentSection) == 32, "segment directory entries are 32 bytes");
+    static_assert(sizeof(SegmentFooter) == 64, "segment footer is 64 bytes");
+    static_assert(std::endian::native == std::endian::little, "segment files are little endian");
+
+    options_.queue_depth = std::max(1u, options_.queue_depth);
+    if (options_.chunk_bytes == 0 || options_.chunk_bytes % kBlock != 0 ||
+        options_.chunk_bytes > UINT32_MAX) {
+        throw util::ConfigException("Segment chunk size must be a positive multiple of 4 KiB: " +
+                                    std::to_string(options_.chunk_bytes));
+    }
+    if (!std::has_single_bit(options_.section_align) || options_.section_align > options_.chunk_bytes) {
+        throw util::ConfigException("Segment section alignment must be a power of two up to the chunk size: " +
+                                    std::to_string(options_.section_align));
+    }
+    if (options_.compress_metadata) {
+        if (options_.compression_block == 0 || options_.compression_block > UINT32_MAX) {
+            throw util::ConfigException("Segment compression block must be 1 byte to 4 GiB: " +
+                                        std::to_string(options_.compression_block));
+        }
+        compressor_ = std::make_unique<SectionCompressor>(options_.compression_level);
+        dict_resolved_ = options_.dict_bytes == 0;
+    }
+
+    // One buffer fills while the others are in flight
+    for (unsigned i = 0; i <= options_.queue_depth; ++i) {
+        buffers_.push_back(io::BufferPool::global().acquire(options_.chunk_bytes));
+        if (i > 0) free_.push_back(i);
+    }
+    openFile();
+}
+
+SegmentWriter::~SegmentWriter() {
+    if (!sealed_) abort();
+}
+
+void SegmentWriter::openFile() {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    fd_ = ::open(tmp_path_.c_str(), options_.direct_io ? flags | O_DIRECT : flags, 0644);
+    if (fd_ < 0 && errno == EINVAL && options_.direct_io) {
+        // The filesystem has no O_DIRECT (tmpfs)
+        LOG_WARN("Segment writer: O_DIRECT unsupported for {}, using buffered writes", tmp_path_);
+        options_.direct_io = false;
+        fd_ = ::open(tmp_path_.c_str(), flags, 0644);
+    }
+    if (fd_ < 0) {
+        throw util::IOException("open " + tmp_path_ + ": " + std::strerror(errno));
+    }
+    ring_.registerFile(fd_);
+}
+
+void SegmentWriter::beginSection(SegmentSectionKind kind, uint32_t id, bool compressible) {
+    if (in_section_) throw std::logic_error("Segment writer: section still open");
+    if (sealed_ || failed_) throw std::logic_error("Segment writer: " + path_ + " is closed");
+
+    if (!compressible || !compressor_) {
+        // Held sections go first, so sections stay in the order begun
+        if (!held_.empty()) placeHeld();
+        openSection(kind, id, 0);
+        return;
+    }
+    compressing_ = true;
+    block_.clear();
+    block_.reserve(options_.compression_block);
+    if (dict_resolved_) {
+        openSection(kind, id, kSectionZstd);
+        return;
+    }
+    held_.push_back({kind, id, {}, true});
+    holding_ = true;
+    in_section_ = true;
+}
+
+void SegmentWriter::openSection(SegmentSectionKind kind, uint32_t id, uint32_t flags) {
+    pad(options_.section_align);
+    sections_.push_back({static_cast<uint32_t>(kind), id, bytesWritten(), 0, 0, flags});
+    block_ends_.clear();
+    raw_length_ = 0;
+    in_section_ = true;
+}
+
+void SegmentWriter::append(const void* data, size_t len) {
+    if (!in_section_) throw std::logic_error("Segment writer: append outside a section");
+    if (!compressing_) {
+        appendStored(data, len);
+        return;
+    }
+    const auto* src = static_cast<const std::byte*>(data);
+    while (len > 0) {
+        size_t n = std::min(len, options_.compression_block - block_.size());
+        block_.insert(block_.end(), src, src + n);
+        src += n;
+        len -= n;
+        if (block_.size() == options_.compression_block) putBlock();
+    }
+}
+
+void SegmentWriter::appendStored(const void* data, size_t len) {
+    SegmentSection& section = sections_.back();
+    copy(data, len, &section.crc32c);
+    section.length += len;
+    stats_.bytes += len;
+}
+
+void SegmentWriter::putBlock() {
+    if (block_.empty()) return;
+    if (!holding_) {
+        writeBlock(block_);
+        block_.clear();
+        return;
+    }
+    held_bytes_ += block_.size();
+    held_.back().blocks.push_back(std::move(block_));
+    block_ = {};
+    block_.reserve(options_.compression_block);
+    if (held_bytes_ >= options_.dict_bytes * kDictSamplesPerByte) placeHeld();
+}
+
+void SegmentWriter::writeBlock(std::span<const std::byte> raw) {
+    const size_t packed = compressor_->compress(raw, packed_);
+    if (packed > 0) {
+        appendStored(packed_.data(), packed);
+    } else {
+        appendStored(raw.data(), raw.size());
+    }
+    block_ends_.push_back(sections_.back().length);
+    raw_length_ += raw.size();
+    stats_.raw_compressed += raw.size();
+    stats_.compressed += packed > 0 ? packed : raw.size();
+}
+
+void SegmentWriter::closeCompressed() {
+    CompressedSectionTrailer trailer{};
+    trailer.raw_length = raw_length_;
+    trailer.block_bytes = static_cast<uint32_t>(options_.compression_block);
+    trailer.blocks = static_cast<uint32_t>(block_ends_.size());
+    appendStored(block_ends_.data(), block_ends_.size() * sizeof(uint64_t));
+    appendStored(&trailer, sizeof(trailer));
+}
+
+void SegmentWriter::placeHeld() {
+    // Train on pieces of every held block, then place the held sections;
+    // the last one may still be open, and is streamed from here on
+    dict_resolved_ = true;
+    std::vector<std::byte> samples;
+    std::vector<size_t> sizes;
+    for (const HeldSection& held : held_) {
+        for (const auto& block : held.blocks) {
+            for (size_t pos = 0; pos < block.size(); pos += kSamplePiece) {
+                const size_t n = std::min(kSamplePiece, block.size() - pos);
+                samples.insert(samples.end(), block.begin() + pos, block.begin() + pos + n);
+                sizes.push_back(n);
+            }
+        }
+    }
+    if (compressor_->train(samples, sizes, options_.dict_bytes)) {
+        auto dict = compressor_->dictionary();
+        openSection(SegmentSectionKind::Metadata, kSegmentDictSection, 0);
+        appendStored(dict.data(), dict.size());
+        in_section_ = false;
+    }
+    samples = {};
+
+    std::vector<HeldSection> held = std::move(held_);
+    held_.clear();
+    held_bytes_ = 0;
+    holding_ = false;
+    for (HeldSection& section : held) {
+        openSection(section.kind, section.id, kSectionZstd);
+        for (auto& block : section.blocks) {
+            writeBlock(block);
+            block = {};
+        }
+        if (section.open) break;  // Always the last
+        closeCompressed();
+        in_section_ = false;
+    }
+}
+
+void SegmentWriter::endSection() {
+    if (!in_section_) throw std::logic_error("Segment writer: no section open");
+    if (compressing_) {
+        putBlock();
+        if (holding_) {
+            held_.back().open = false;
+            holding_ = false;
+        } else {
+            closeCompressed();
+        }
+        compressing_ = false;
+    }
+    in_section_ = false;
+}
+
+void SegmentWriter::writeSection(SegmentSectionKind kind, uint32_t id, const void* data, size_t len,
+                                 bool compressible) {
+    beginSection(kind, id, compressible);
+    append(data, len);
+    endSection();
+}
+
+void SegmentWriter::copy(const void* data, size_t len, uint32_t* section_crc) {
+    const auto* src = static_cast<const std::byte*>(data);
+    while (len > 0) {
+        size_t n = std::min(len, options_.chunk_bytes - fill_);
+        std::byte* dst = buffers_[current_].data() + fill_;
+        if (src) {
+            std::memcpy(dst, src, n);
+            src += n;
+        } else {
+            std::memset(dst, 0, n);  // Padding
+        }
+
+        uint32_t crc = util::crc32c(dst, n);
+        chunk_crc_ = util::crc32c_combine(chunk_crc_, crc, n);
+        if (section_crc) *section_crc = util::crc32c_combine(*section_crc, crc, n);
+        fill_ += n;
+        len -= n;
+        if (fill_ == options_.chunk_bytes) submitChunk();
+    }
+}
+
+void SegmentWriter::pad(size_t align) {
+    size_t gap = roundUp(bytesWritten(), align) - bytesWritten();
+    if (gap == 0) return;
+    copy(nullptr, gap, nullptr);
+    stats_.padding += gap;
+}
+
+void SegmentWriter::submitChunk() {
+    if (fill_ == 0) return;
+    if (options_.limiter) options_.limiter->acquire(fill_);
+    try {
+        ring_.submitWrite(fd_, buffers_[current_].data(), fill_, offset_, current_);
+    } catch (...) {
+        fail();
+        throw;
+    }
+    chunk_crcs_.push_back(chunk_crc_);
+    stats_.chunks++;
+    stats_.max_in_flight = std::max(stats_.max_in_flight, ring_.inFlight());
+    offset_ += fill_;
+    fill_ = 0;
+    chunk_crc_ = 0;
+
+    if (free_.empty()) {
+        stats_.stalls++;
+        reapOne();
+    }
+    current_ = free_.back();
+    free_.pop_back();
+}
+
+void SegmentWriter::reapOne() {
+    try {
+        ring_.reap(1, [this](uint64_t tag) { release(tag); });
+    } catch (...) {
+        fail();
+        throw;
+    }
+}
+
+void SegmentWriter::release(uint64_t tag) {
+    if (tag < buffers_.size()) free_.push_back(static_cast<uint32_t>(tag));  // Not the tail
+}
+
+void SegmentWriter::drain() {
+    while (ring_.inFlight() > 0) reapOne();
+}
+
+uint64_t SegmentWriter::seal() {
+    if (in_section_) throw std::logic_error("Segment writer: section still open at seal");
+    if (sealed_ || failed_) throw std::logic_error("Segment writer: " + path_ + " is closed");
+    if (!held_.empty()) placeHeld();
+
+    // Data region: whole blocks, the last chunk short
+    pad(kBlock);
+    submitChunk();
+    const uint64_t data_bytes = offset_;
+
+    const size_t entries_bytes = sections_.size() * sizeof(SegmentSection);
+    const size_t crcs_bytes = chunk_crcs_.size() * sizeof(uint32_t);
+    const size_t tail_bytes = roundUp(entries_bytes + crcs_bytes + sizeof(SegmentFooter), kBlock);
+    auto tail = io::BufferPool::global().acquire(tail_bytes);
+    std::memset(tail.data(), 0, tail_bytes);
+    std::memcpy(tail.data(), sections_.data(), entries_bytes);
+    std::memcpy(tail.data() + entries_bytes, chunk_crcs_.data(), crcs_bytes);
+
+    SegmentFooter footer{};
+    footer.magic = SegmentFooter::kMagic;
+    footer.version = SegmentFooter::kVersion;
+    footer.chunk_bytes = static_cast<uint32_t>(options_.chunk_bytes);
+    footer.data_bytes = data_bytes;
+    footer.section_count = sections_.size();
+    footer.chunk_count = chunk_crcs_.size();
+    footer.section_align = static_cast<uint32_t>(options_.section_align);
+    // Padding between the checksums and the footer is not covered
+    footer.directory_crc = util::crc32c(tail.data(), entries_bytes + crcs_bytes);
+    footer.created_at_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    footer.footer_crc = util::crc32c(&footer, offsetof(SegmentFooter, footer_crc));
+    std::memcpy(tail.data() + tail_bytes - sizeof(footer), &footer, sizeof(footer));
+
+    if (options_.limiter) options_.limiter->acquire(tail_bytes);
+    try {
+        ring_.submitWrite(fd_, tail.data(), tail_bytes, data_bytes, UINT64_MAX);
+        drain();
+        ring_.sync(fd_);
+    } catch (...) {
+        fail();
+        throw;
+    }
+
+    ring_.unregisterFile(fd_);
+    ::close(fd_);
+    fd_ = -1;
+    if (::rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+        int err = errno;
+        fail();
+        throw util::IOException("rename " + tmp_path_ + ": " + std::strerror(err));
+    }
+    util::sync_parent_directory(path_);
+
+    sealed_ = true;
+    stats_.file_bytes = data_bytes + tail_bytes;
+    return stats_.file_bytes;
+}
+
+void SegmentWriter::reapAll() noexcept {
+    // The kernel may still read the buffers: wait out every write
+    while (ring_.inFlight() > 0) {
+        try {
+            ring_.reap(1, [this](uint64_t tag) { release(tag); });
+        } catch (const std::exception&) {
+            // Already failing; the file is dropped
+        }
+    }
+}
+
+void SegmentWriter::fail() {
+    failed_ = true;
+    abort();
+}
+
+void SegmentWriter::abort() {
+    if (sealed_) return;
+    reapAll();
+    if (fd_ >= 0) {
+        ring_.unregisterFile(fd_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+    ::unlink(tmp_path_.c_str());
+    failed_ = true;
+}
+
+} // namespace woved::storage
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "io/buffer-pool.h"
+#include "io/rate-limiter.h"
+#include "io/uring-wrapper.h"
+#include "storage/segment/seg-codec.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace woved {
+struct Config;
+struct IOConfig;
+}
+
+namespace woved::storage {
+
+// Segment file layout (little endian):
+//   data       sections, each starting at a section_align boundary (zero
+//              padded), written as chunk_bytes chunks
+//   directory  SegmentSection per section, then the CRC-32C of every data
+//              chunk, zero padded so the footer ends on a 4 KiB block
+//   footer     64 bytes: geometry, directory checksum, footer checksum
+//
+// The footer is found from the file size, so a writer never seeks back to
+// patch a header. Every chunk and every section has its own CRC-32C: a
+// reader can verify whole chunks as it maps them, or just the section it
+// reads directly.
+enum class SegmentSectionKind : uint32_t {
+    Vectors = 1,   // Vector column (VectorTable data)
+    RowTable = 2,  // Id, epoch and tombstone columns (RowTable)
+    IvfList = 3,   // One posting list; id is the list number
+    Bitmap = 4,    // One serialized bitmap; id is its key (tag, tenant)
+    Metadata = 5,  // Segment metadata (segment-meta.fbs)
+    ListDirectory = 6,  // IVF list -> row range of a list-clustered section
+};
+
+struct SegmentSection {
+    uint32_t kind;     // SegmentSectionKind
+    uint32_t id;
+    uint64_t offset;   // From the start of the file
+    uint64_t length;   // Excluding alignment padding
+    uint32_t crc32c;   // Of the section bytes (as stored)
+    uint32_t flags;    // kSectionZstd (seg-codec.h)
+};
+
+struct SegmentFooter {
+    static constexpr uint64_t kMagic = 0x4745534445564f57ULL;  // "WOVEDSEG"
+    static constexpr uint32_t kVersion = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t chunk_bytes;
+    uint64_t data_bytes;       // Offset of the directory, block aligned
+    uint64_t section_count;
+    uint64_t chunk_count;
+    uint32_t section_align;
+    uint32_t directory_crc;    // Sections and chunk checksums
+    uint64_t created_at_us;
+    uint32_t reserved;
+    uint32_t footer_crc;       // Every field above
+};
+
+// Streams one segment file. Sections are appended in any order and size;
+// the writer copies them into a ring of queue_depth chunk buffers and
+// hands every full chunk to io_uring without waiting, so writes overlap
+// with building the next chunk and memory stays at queue_depth chunks
+// however large the segment is. A buffer is reused once its write
+// completes.
+//
+// Checksums are computed as the bytes are copied in: each piece is
+// checksummed once and folded into both its chunk's and its section's
+// CRC with crc32c_combine().
+//
+// The file is written as <path>.tmp. seal() writes the directory, issues
+// the segment's only fdatasync and renames it into place; a writer that
+// is destroyed or aborted unsealed removes the temporary file.
+//
+// With compress_metadata, sections begun `compressible` are zstd
+// compressed per compression_block (seg-codec.h). The first such sections
+// are held back, up to dict_bytes x kDictSamplesPerByte raw bytes, to train
+// the segment's dictionary; they are placed once it is trained, when a
+// plain section begins, or at seal(), so their offsets are not known at
+// endSection().
+class SegmentWriter {
+public:
+    struct Options {
+        size_t chunk_bytes = constants::SEGMENT_CHUNK_SIZE;
+        unsigned queue_depth = 32;     // Chunk writes in flight
+        size_t section_align = 4096;   // Power of two
+        bool direct_io = false;        // O_DIRECT; falls back where unsupported
+        // Charged before each write (background builds); null = unthrottled
+        std::shared_ptr<io::RateLimiter> limiter;
+        bool compress_metadata = false;
+        int compression_level = 3;     // zstd
+        size_t compression_block = constants::SEGMENT_CHUNK_SIZE;  // Raw bytes per block
+        size_t dict_bytes = 65536;     // Per-segment dictionary; 0 = none
+        // io.iouring (sqpoll, register_files, link_timeout_ms); its entries
+        // are queue_depth
+        io::UringWrapper::Options ring;
+
+        static Options fromConfig(const IOConfig& io);
+
+        // Also takes storage.segment compression; throws
+        // util::ConfigException for a compression_type other than zstd
+        static Options fromConfig(const Config& config);
+    };
+
+    // Raw bytes sampled per dictionary byte before training
+    static constexpr size_t kDictSamplesPerByte = 64;
+
+    struct Stats {
+        uint64_t chunks = 0;
+        uint64_t bytes = 0;          // Section bytes
+        uint64_t padding = 0;        // Alignment padding in the data region
+        uint64_t file_bytes = 0;     // Set by seal()
+        uint64_t stalls = 0;         // Chunks that waited for a free buffer
+        size_t max_in_flight = 0;
+        uint64_t raw_compressed = 0; // Raw bytes of compressed sections
+        uint64_t compressed = 0;     // What they were stored as
+    };
+
+    SegmentWriter(std::string path, const Options& options);
+    ~SegmentWriter();
+
+    SegmentWriter(const SegmentWriter&) = delete;
+    SegmentWriter& operator=(const SegmentWriter&) = delete;
+
+    // Start a section; the previous one must be ended. A `compressible`
+    // section is compressed when compress_metadata is set.
+    void beginSection(SegmentSectionKind kind, uint32_t id = 0, bool compressible = false);
+
+    void append(const void* data, size_t len);
+
+    template <typename T>
+    void append(std::span<const T> values) {
+        append(values.data(), values.size_bytes());
+    }
+
+    void endSection();
+
+    // beginSection() + append() + endSection()
+    void writeSection(SegmentSectionKind kind, uint32_t id, const void* data, size_t len,
+                      bool compressible = false);
+
+    // Write the directory and footer, fdatasync once and rename into place.
+    // Returns the file size. Throws util::IOException on failure, leaving
+    // the writer aborted.
+    uint64_t seal();
+
+    // Drop the file; safe to call at any point
+    void abort();
+
+    const std::string& path() const { return path_; }
+    // Placed sections; held-back compressed ones appear once placed
+    const std::vector<SegmentSection>& sections() const { return sections_; }
+    uint64_t bytesWritten() const { return offset_ + fill_; }
+    const Stats& getStats() const { return stats_; }
+
+private:
+    struct HeldSection;
+
+    static io::UringWrapper::Options ringOptions(const Options& options);
+
+    Options options_;
+    std::string path_;
+    std::string tmp_path_;
+    int fd_ = -1;
+    io::UringWrapper ring_;
+
+    std::vector<io::BufferPool::Buffer> buffers_;   // From BufferPool::global()
+    std::vector<uint32_t> free_;        // Idle buffer indexes
+    uint32_t current_ = 0;             // Buffer being filled
+    size_t fill_ = 0;                  // Bytes in it
+    uint32_t chunk_crc_ = 0;           // Of those bytes
+    uint64_t offset_ = 0;              // File offset of the current chunk
+
+    std::vector<SegmentSection> sections_;
+    std::vector<uint32_t> chunk_crcs_;
+
+    // Compression
+    std::unique_ptr<SectionCompressor> compressor_;
+    bool dict_resolved_ = false;       // Trained, or given up on
+    bool compressing_ = false;         // The open section is compressed...
+    bool holding_ = false;             // ...and held back in held_
+    std::vector<std::byte> block_;     // Raw bytes of its current block
+    std::vector<uint64_t> block_ends_; // Index of the placed section
+    uint64_t raw_length_ = 0;
+    std::vector<HeldSection> held_;
+    size_t held_bytes_ = 0;
+    std::vector<std::byte> packed_;    // One compressed block
+
+    bool in_section_ = false;
+    bool sealed_ = false;
+    bool failed_ = false;
+    Stats stats_;
+
+    void openFile();
+    void openSection(SegmentSectionKind kind, uint32_t id, uint32_t flags);
+    void appendStored(const void* data, size_t len);
+    void putBlock();
+    void writeBlock(std::span<const std::byte> raw);
+    void closeCompressed();
+    void placeHeld();
+    void copy(const void* data, size_t len, uint32_t* section_crc);
+    void pad(size_t align);
+    void submitChunk();
+    void release(uint64_t tag);
+    void reapOne();
+    void drain();
+    void reapAll() noexcept;
+    void fail();
+};
+
+} // namespace woved::storage
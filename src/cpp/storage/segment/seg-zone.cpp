@@ -0,0 +1,375 @@
+#include "seg-zone.h"
+#include "storage/segment/seg-delta.h"
+#include "util/exceptions.h"
+#include "util/hash.h"
+#include "util/simd-dispatch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+namespace woved::storage {
+
+namespace {
+
+// Blocked filter: keys of one block collide more than in a plain filter
+// of the same size; 20% more bits brings the rate back to the target
+constexpr double kBlockedBitsFactor = 1.2;
+constexpr uint64_t kBlockBits = 512;
+constexpr uint64_t kTenantKeySalt = 0x7465'6e61'6e74'0000ULL;  // "tenant"
+
+// Slack on score bounds, so float rounding in the means and norms never
+// prunes a list that holds a qualifying row
+constexpr float kBoundSlack = 1e-4f;
+
+uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t mixTag(TagId tag) {
+    return mix64(tag);
+}
+
+// Bloom key of a tenant, apart from the tag keys
+uint64_t tenantKey(uint64_t tenant_hash) {
+    return mix64(tenant_hash ^ kTenantKeySalt);
+}
+
+uint64_t maskBit(uint64_t hash) {
+    return uint64_t{1} << (hash & 63);
+}
+
+// Bit positions of a tag in a version 1 filter: double hashing over one
+// 64-bit mix
+template <typename Fn>
+void forEachBloomBit(TagId tag, uint32_t hashes, uint64_t bits, Fn fn) {
+    const uint64_t h = mixTag(tag);
+    const uint64_t h1 = h;
+    const uint64_t h2 = (h >> 32) | 1;
+    for (uint32_t i = 0; i < hashes; ++i) fn((h1 + i * h2) & (bits - 1));
+}
+
+// Blocked filter: the key's high half picks the block, a second mix of it
+// the bits within
+template <typename Fn>
+void forEachBlockBit(uint64_t key, uint32_t hashes, uint64_t blocks, Fn fn) {
+    const uint64_t block = (key >> 32) & (blocks - 1);
+    const uint64_t h = mix64(key);
+    const uint64_t h1 = h;
+    const uint64_t h2 = (h >> 32) | 1;
+    for (uint32_t i = 0; i < hashes; ++i) fn(block, (h1 + i * h2) & (kBlockBits - 1));
+}
+
+template <typename T>
+void take(const std::vector<std::byte>& bytes, size_t& pos, T* out, size_t count, const std::string& path) {
+    const size_t len = count * sizeof(T);
+    if (count > bytes.size() / sizeof(T) || pos + len > bytes.size()) {
+        throw util::IOException("Segment " + path + ": truncated zone map");
+    }
+    if (len) std::memcpy(out, bytes.data() + pos, len);
+    pos += len;
+}
+
+} // namespace
+
+uint64_t zoneTenantHash(std::string_view tenant) {
+    return util::hash_id(tenant);
+}
+
+uint64_t zoneScopeHash(std::string_view tenant, std::string_view namespace_name) {
+    return XXH64(namespace_name.data(), namespace_name.size(), zoneTenantHash(tenant));
+}
+
+void ZoneMapBuilder::addList(uint32_t list, uint64_t rows, const RowFn& row, const VectorFn& vector) {
+    if (rows == 0) return;
+    const auto& t = kernels::distance_table();
+    ListZone zone{};
+    zone.list = list;
+    zone.rows = rows;
+    zone.min_norm = std::numeric_limits<float>::max();
+
+    std::vector<double> sum(dim_, 0.0);
+    std::vector<float> v(dim_);
+    for (uint64_t i = 0; i < rows; ++i) {
+        const DeltaRow& r = row(i);
+        const uint64_t tenant = zoneTenantHash(r.tenant);
+        tenants_.insert(tenant);
+        scopes_.insert(zoneScopeHash(r.tenant, r.namespace_name));
+        zone.tenant_mask |= maskBit(tenant);
+        for (TagId tag : r.tags) {
+            tags_.insert(tag);
+            zone.tag_mask |= maskBit(mixTag(tag));
+        }
+
+        vector(i, v.data());
+        const float norm = std::sqrt(t.inner_product(v.data(), v.data(), dim_));
+        zone.min_norm = std::min(zone.min_norm, norm);
+        zone.max_norm = std::max(zone.max_norm, norm);
+        for (uint32_t d = 0; d < dim_; ++d) sum[d] += v[d];
+    }
+
+    const size_t offset = means_.size();
+    means_.resize(offset + dim_);
+    float* mean = means_.data() + offset;
+    for (uint32_t d = 0; d < dim_; ++d) mean[d] = static_cast<float>(sum[d] / static_cast<double>(rows));
+    zone.mean_norm = std::sqrt(t.inner_product(mean, mean, dim_));
+
+    float radius_sqr = 0;
+    for (uint64_t i = 0; i < rows; ++i) {
+        vector(i, v.data());
+        radius_sqr = std::max(radius_sqr, t.l2_sqr(v.data(), mean, dim_));
+    }
+    zone.radius = std::sqrt(radius_sqr);
+    zones_.push_back(zone);
+}
+
+void ZoneMapBuilder::write(SegmentWriter& writer) {
+    static_assert(sizeof(ZoneMapHeader) == 64, "zone map header is 64 bytes");
+    static_assert(sizeof(ListZone) == 48, "list zones are 48 bytes");
+
+    // Zones and their means in list order
+    std::vector<size_t> order(zones_.size());
+    std::iota(order.begin(), order.end(), size_t{0});
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return zones_[a].list < zones_[b].list; });
+    std::vector<ListZone> zones;
+    std::vector<float> means;
+    zones.reserve(order.size());
+    means.reserve(means_.size());
+    for (size_t i : order) {
+        zones.push_back(zones_[i]);
+        means.insert(means.end(), means_.begin() + i * dim_, means_.begin() + (i + 1) * dim_);
+    }
+
+    std::vector<uint64_t> tenants(tenants_.begin(), tenants_.end());
+    std::vector<uint64_t> scopes(scopes_.begin(), scopes_.end());
+    std::sort(tenants.begin(), tenants.end());
+    std::sort(scopes.begin(), scopes.end());
+
+    // Blocked bloom over tag ids and tenant hashes, sized as a plain filter
+    // for the target rate (-ln(p) / ln(2)^2 bits per key, ln(2) times as
+    // many probes) plus the blocking allowance
+    std::vector<BloomBlock> bloom;
+    uint32_t hashes = 0;
+    if (bloom_fpp_ > 0.0f && bloom_fpp_ < 1.0f) {
+        const double ln2 = std::log(2.0);
+        const double bits_per_key = -std::log(static_cast<double>(bloom_fpp_)) / (ln2 * ln2);
+        hashes = static_cast<uint32_t>(std::clamp(std::lround(bits_per_key * ln2), 1L, 16L));
+        const double bits = static_cast<double>(tags_.size() + tenants.size()) * bits_per_key * kBlockedBitsFactor;
+        size_t blocks = 1;
+        while (static_cast<double>(blocks * kBlockBits) < bits) blocks <<= 1;
+        bloom.assign(blocks, BloomBlock{});
+        auto add = [&](uint64_t key) {
+            forEachBlockBit(key, hashes, blocks, [&](uint64_t block, uint64_t bit) {
+                bloom[block].words[bit / 64] |= maskBit(bit);
+            });
+        };
+        for (TagId tag : tags_) add(mixTag(tag));
+        for (uint64_t tenant : tenants) add(tenantKey(tenant));
+    }
+
+    ZoneMapHeader header{};
+    header.magic = ZoneMapHeader::kMagic;
+    header.version = ZoneMapHeader::kVersion;
+    header.dim = dim_;
+    header.lists = zones.size();
+    header.tenants = tenants.size();
+    header.scopes = scopes.size();
+    header.bloom_words = bloom.size() * std::size(BloomBlock{}.words);
+    header.bloom_hashes = hashes;
+    header.min_norm = zones.empty() ? 0.0f : std::numeric_limits<float>::max();
+    for (const ListZone& zone : zones) {
+        header.min_norm = std::min(header.min_norm, zone.min_norm);
+        header.max_norm = std::max(header.max_norm, zone.max_norm);
+    }
+
+    writer.beginSection(SegmentSectionKind::Metadata, kZoneMapSection);
+    writer.append(&header, sizeof(header));
+    writer.append(std::span<const uint64_t>(tenants));
+    writer.append(std::span<const uint64_t>(scopes));
+    writer.append(std::span<const BloomBlock>(bloom));
+    writer.append(std::span<const ListZone>(zones));
+    writer.endSection();
+    writer.writeSection(SegmentSectionKind::Metadata, kZoneCentroidsSection, means.data(),
+                        means.size() * sizeof(float));
+}
+
+std::optional<ZoneMap> ZoneMap::read(const SegmentReader& reader) {
+    const SegmentSection* section = reader.find(SegmentSectionKind::Metadata, kZoneMapSection);
+    if (!section) return std::nullopt;
+    const std::string& path = reader.path();
+    auto bytes = reader.readSection(*section);
+
+    ZoneMap map;
+    size_t pos = 0;
+    take(bytes, pos, &map.header_, 1, path);
+    const ZoneMapHeader& h = map.header_;
+    if (h.magic != ZoneMapHeader::kMagic ||
+        (h.version != ZoneMapHeader::kVersion && h.version != ZoneMapHeader::kPlainBloomVersion)) {
+        throw util::IOException("Segment " + path + ": bad zone map (version " + std::to_string(h.version) + ")");
+    }
+    const bool plain = h.version == ZoneMapHeader::kPlainBloomVersion;
+    constexpr uint64_t kBlockWords = std::size(BloomBlock{}.words);
+    const uint64_t blocks = h.bloom_words / kBlockWords;
+    const bool bloom_ok = plain ? h.bloom_words != 0 && (h.bloom_words & (h.bloom_words - 1)) == 0 && h.bloom_hashes != 0
+                                : h.bloom_words == 0 || (h.bloom_words % kBlockWords == 0 &&
+                                                         (blocks & (blocks - 1)) == 0 && h.bloom_hashes != 0);
+    if (!bloom_ok) throw util::IOException("Segment " + path + ": corrupt zone map bloom filter");
+    map.tenants_.resize(std::min<uint64_t>(h.tenants, bytes.size()));
+    map.scopes_.resize(std::min<uint64_t>(h.scopes, bytes.size()));
+    map.zones_.resize(std::min<uint64_t>(h.lists, bytes.size()));
+    take(bytes, pos, map.tenants_.data(), h.tenants, path);
+    take(bytes, pos, map.scopes_.data(), h.scopes, path);
+    if (plain) {
+        map.bloom_.resize(std::min<uint64_t>(h.bloom_words, bytes.size()));
+        take(bytes, pos, map.bloom_.data(), h.bloom_words, path);
+    } else {
+        map.blocks_.resize(std::min<uint64_t>(blocks, bytes.size()));
+        take(bytes, pos, map.blocks_.data(), blocks, path);
+    }
+    take(bytes, pos, map.zones_.data(), h.lists, path);
+    if (pos != bytes.size()) throw util::IOException("Segment " + path + ": zone map has trailing bytes");
+    if (!std::is_sorted(map.zones_.begin(), map.zones_.end(),
+                        [](const ListZone& a, const ListZone& b) { return a.list < b.list; })) {
+        throw util::IOException("Segment " + path + ": zone map lists out of order");
+    }
+
+    const SegmentSection* means = reader.find(SegmentSectionKind::Metadata, kZoneCentroidsSection);
+    if (!means || means->length != h.lists * h.dim * sizeof(float)) {
+        throw util::IOException("Segment " + path + ": zone map means do not match the header");
+    }
+    auto raw = reader.readSection(*means);
+    map.means_.resize(h.lists * h.dim);
+    if (!raw.empty()) std::memcpy(map.means_.data(), raw.data(), raw.size());
+    return map;
+}
+
+const ListZone* ZoneMap::zone(uint32_t list) const {
+    if (zones_.size() == 1 && zones_.front().list == kZoneAllLists) return &zones_.front();
+    auto it = std::lower_bound(zones_.begin(), zones_.end(), list,
+                               [](const ListZone& z, uint32_t l) { return z.list < l; });
+    return it != zones_.end() && it->list == list ? &*it : nullptr;
+}
+
+std::span<const float> ZoneMap::mean(const ListZone& zone) const {
+    const size_t index = &zone - zones_.data();
+    return std::span(means_).subspan(index * header_.dim, header_.dim);
+}
+
+bool ZoneMap::blockMayContain(uint64_t key) const {
+    bool hit = true;
+    forEachBlockBit(key, header_.bloom_hashes, blocks_.size(), [&](uint64_t block, uint64_t bit) {
+        hit = hit && (blocks_[block].words[bit / 64] & maskBit(bit)) != 0;
+    });
+    return hit;
+}
+
+bool ZoneMap::mayContainTenant(std::string_view tenant) const {
+    const uint64_t hash = zoneTenantHash(tenant);
+    if (!blocks_.empty() && !blockMayContain(tenantKey(hash))) return false;
+    return std::binary_search(tenants_.begin(), tenants_.end(), hash);
+}
+
+bool ZoneMap::mayContainScope(std::string_view tenant, std::string_view namespace_name) const {
+    return std::binary_search(scopes_.begin(), scopes_.end(), zoneScopeHash(tenant, namespace_name));
+}
+
+bool ZoneMap::mayContainTag(TagId tag) const {
+    if (header_.version != ZoneMapHeader::kPlainBloomVersion) {
+        return blocks_.empty() || blockMayContain(mixTag(tag));
+    }
+    bool hit = true;
+    forEachBloomBit(tag, header_.bloom_hashes, header_.bloom_words * 64, [&](uint64_t bit) {
+        hit = hit && (bloom_[bit / 64] & maskBit(bit)) != 0;
+    });
+    return hit;
+}
+
+bool ZoneMap::mayMatch(std::string_view tenant, std::string_view namespace_name,
+                       std::span<const TagId> any_tags) const {
+    if (zones_.empty()) return false;
+    if (!tenant.empty()) {
+        if (!mayContainTenant(tenant)) return false;
+        if (!namespace_name.empty() && !mayContainScope(tenant, namespace_name)) return false;
+    }
+    return any_tags.empty() ||
+           std::any_of(any_tags.begin(), any_tags.end(), [this](TagId tag) { return mayContainTag(tag); });
+}
+
+bool ZoneMap::listMayContain(const ListZone& zone, std::string_view tenant,
+                             std::span<const TagId> any_tags) const {
+    if (!tenant.empty() && (zone.tenant_mask & maskBit(zoneTenantHash(tenant))) == 0) return false;
+    return any_tags.empty() || std::any_of(any_tags.begin(), any_tags.end(), [&](TagId tag) {
+        return (zone.tag_mask & maskBit(mixTag(tag))) != 0;
+    });
+}
+
+Score ZoneMap::maxScore(const ListZone& zone, Metric metric, const float* query, float query_sqr) const {
+    const float qn = std::sqrt(std::max(query_sqr, 0.0f));
+    const float qm = kernels::distance_table().inner_product(query, mean(zone).data(), header_.dim);
+    const float m = zone.mean_norm;
+    const float r = zone.radius;
+    switch (metric) {
+        case Metric::INNER_PRODUCT: {
+            // q.v = q.m + q.(v - m) <= q.m + |q| r, and <= |q| |v|
+            const float bound = std::min(qm + qn * r, qn * zone.max_norm);
+            return bound + kBoundSlack * qn * (zone.max_norm + r);
+        }
+        case Metric::L2: {
+            // |q - v| >= |q - m| - r, and >= the gap between |q| and the norm range
+            const float center = std::sqrt(std::max(query_sqr - 2.0f * qm + m * m, 0.0f));
+            const float gap = std::max({zone.min_norm - qn, qn - zone.max_norm, 0.0f});
+            float d = std::max({center - r, gap, 0.0f});
+            d = std::max(d - kBoundSlack * (qn + zone.max_norm), 0.0f);
+            return -(d * d);
+        }
+        case Metric::COSINE: {
+            // The ball around the mean subtends asin(r / |m|) seen from the origin
+            if (qn == 0.0f) return 0.0f;
+            if (m <= r) return 1.0f;
+            const float theta = std::acos(std::clamp(qm / (qn * m), -1.0f, 1.0f));
+            const float alpha = std::asin(r / m);
+            return std::min(std::cos(std::max(theta - alpha, 0.0f)) + kBoundSlack, 1.0f);
+        }
+    }
+    return std::numeric_limits<Score>::max();
+}
+
+Score ZoneMap::meanScore(const ListZone& zone, Metric metric, const float* query, float query_sqr) const {
+    const float qm = kernels::distance_table().inner_product(query, mean(zone).data(), header_.dim);
+    const float m = zone.mean_norm;
+    switch (metric) {
+        case Metric::INNER_PRODUCT: return qm;
+        case Metric::L2: return -std::max(query_sqr - 2.0f * qm + m * m, 0.0f);
+        case Metric::COSINE: {
+            const float denom = std::sqrt(std::max(query_sqr, 0.0f)) * m;
+            return denom > 0.0f ? qm / denom : 0.0f;
+        }
+    }
+    return 0.0f;
+}
+
+Score ZoneMap::maxScore(Metric metric, const float* query, float query_sqr) const {
+    Score best = std::numeric_limits<Score>::lowest();
+    for (const ListZone& zone : zones_) best = std::max(best, maxScore(zone, metric, query, query_sqr));
+    return best;
+}
+
+std::vector<uint32_t> ZoneMap::pruneLists(std::span<const uint32_t> probed, std::string_view tenant,
+                                          std::span<const TagId> any_tags, Metric metric, const float* query,
+                                          float query_sqr, Score kth) const {
+    std::vector<uint32_t> kept;
+    kept.reserve(probed.size());
+    for (uint32_t list : probed) {
+        const ListZone* z = zone(list);
+        if (!z || !listMayContain(*z, tenant, any_tags)) continue;
+        if (maxScore(*z, metric, query, query_sqr) <= kth) continue;
+        kept.push_back(list);
+    }
+    return kept;
+}
+
+} // namespace woved::storage
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "storage/segment/seg-r.h"
+#include "storage/segment/seg-w.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace woved::storage {
+
+struct DeltaRow;
+
+// Zone map of a segment: what its live rows can match, per segment and per
+// IVF list, so a query skips a segment or list whose tenants, namespaces or
+// tags exclude the filter, or whose best possible score cannot beat the
+// current k-th result. Written by the delta and stable writers; layout in
+// schemas/segment-meta.fbs (ZoneMap), stored as these fixed structs.
+//
+// Tenant and namespace names are kept as hashes: interned ordinals are per
+// process. Each list records the mean of its vectors, their distance to it
+// (radius) and their norm range; a query scores the ball around the mean
+// rather than the rows.
+//
+// Tag ids and tenant hashes also go into a blocked bloom filter sized for
+// filtering.bloom_filter_fpp: each key sets all its bits in one 64-byte
+// block, so a negative costs a single cache line. The map stays resident
+// with its segment; a query is turned away on a negative before any
+// bitmap or list is read. Version 1 maps carry a plain bloom filter over
+// tags only and are still read.
+//
+// Sections:
+//   Metadata 2        ZoneMapHeader, tenant hashes, scope hashes, bloom
+//                     words, ListZone per list
+//   Metadata 3        List means, lists x dim floats
+inline constexpr uint32_t kZoneMapSection = 2;
+inline constexpr uint32_t kZoneCentroidsSection = 3;
+
+// List number of the single zone of an unclustered segment
+inline constexpr uint32_t kZoneAllLists = 0xffffffffu;
+
+struct ZoneMapHeader {
+    static constexpr uint64_t kMagic = 0x504d5a4445564f57ULL;  // "WOVEDZMP"
+    static constexpr uint32_t kVersion = 2;
+    static constexpr uint32_t kPlainBloomVersion = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint64_t lists;
+    uint64_t tenants;          // Sorted tenant hashes
+    uint64_t scopes;           // Sorted tenant + namespace hashes
+    uint64_t bloom_words;      // 8 per block, blocks a power of two; 0: none
+    uint32_t bloom_hashes;     // Bits per key
+    float min_norm;            // Over live vectors
+    float max_norm;
+    uint32_t reserved;
+};
+
+struct ListZone {
+    uint32_t list;             // Centroid or list number, kZoneAllLists
+    uint32_t reserved;
+    uint64_t rows;
+    float mean_norm;
+    float radius;              // Largest distance of a vector to the mean
+    float min_norm;
+    float max_norm;
+    uint64_t tenant_mask;      // One bit per tenant hash present
+    uint64_t tag_mask;         // One bit per tag present
+};
+
+// Hashes the zone map keeps for a tenant, and for a tenant's namespace
+uint64_t zoneTenantHash(std::string_view tenant);
+uint64_t zoneScopeHash(std::string_view tenant, std::string_view namespace_name);
+
+// One cache line of the blocked bloom filter
+struct alignas(64) BloomBlock {
+    uint64_t words[8];
+};
+
+// Accumulates a zone map as a writer lays out its lists
+class ZoneMapBuilder {
+public:
+    // Row `i` of the list, and its vector decoded to fp32
+    using RowFn = std::function<const DeltaRow&(uint64_t i)>;
+    using VectorFn = std::function<void(uint64_t i, float* out)>;
+
+    // `bloom_fpp` is the target false positive rate of the tag and tenant
+    // bloom filter (filtering.bloom_filter_fpp); 0 writes none
+    explicit ZoneMapBuilder(uint32_t dim, float bloom_fpp = 0.01f) : dim_(dim), bloom_fpp_(bloom_fpp) {}
+
+    // Adds one list of live rows; every vector is decoded twice (mean,
+    // then radius)
+    void addList(uint32_t list, uint64_t rows, const RowFn& row, const VectorFn& vector);
+
+    void write(SegmentWriter& writer);
+
+private:
+    uint32_t dim_;
+    float bloom_fpp_;
+    std::vector<ListZone> zones_;
+    std::vector<float> means_;
+    std::unordered_set<uint64_t> tenants_;
+    std::unordered_set<uint64_t> scopes_;
+    std::unordered_set<TagId> tags_;
+};
+
+// Read side; loaded whole on open
+class ZoneMap {
+public:
+    // std::nullopt for a segment written without one; throws
+    // util::IOException if it is corrupt
+    static std::optional<ZoneMap> read(const SegmentReader& reader);
+
+    const ZoneMapHeader& header() const { return header_; }
+    const std::vector<ListZone>& lists() const { return zones_; }
+
+    // Zone of a list; nullptr if the segment has no live rows in it
+    const ListZone* zone(uint32_t list) const;
+    std::span<const float> mean(const ListZone& zone) const;
+
+    // False only if no live row can match (false positives possible).
+    // Tags and tenants are checked against the bloom filter first.
+    bool mayContainTenant(std::string_view tenant) const;
+    bool mayContainScope(std::string_view tenant, std::string_view namespace_name) const;
+    bool mayContainTag(TagId tag) const;
+
+    // Whole-segment filter check: an empty tenant, namespace or tag list
+    // does not filter; a row matches if it carries any of `any_tags`
+    bool mayMatch(std::string_view tenant, std::string_view namespace_name,
+                  std::span<const TagId> any_tags) const;
+
+    // Same for one list, from its tenant and tag masks only
+    bool listMayContain(const ListZone& zone, std::string_view tenant, std::span<const TagId> any_tags) const;
+
+    // Upper bound on the score (kernels::score: higher is better) of any
+    // vector in the zone against `query`, whose squared norm is `query_sqr`
+    Score maxScore(const ListZone& zone, Metric metric, const float* query, float query_sqr) const;
+
+    // Score of the zone's mean against `query`: the middle of the spread
+    // whose top is maxScore()
+    Score meanScore(const ListZone& zone, Metric metric, const float* query, float query_sqr) const;
+
+    // Same over the whole segment
+    Score maxScore(Metric metric, const float* query, float query_sqr) const;
+
+    // The lists of `probed` a query still has to scan: those with live rows
+    // here that may match the filter and whose maxScore() beats `kth` (the
+    // current k-th score; lowest() while fewer than k results are held)
+    std::vector<uint32_t> pruneLists(std::span<const uint32_t> probed, std::string_view tenant,
+                                     std::span<const TagId> any_tags, Metric metric, const float* query,
+                                     float query_sqr, Score kth) const;
+
+private:
+    bool blockMayContain(uint64_t key) const;
+
+    ZoneMapHeader header_{};
+    std::vector<uint64_t> tenants_;
+    std::vector<uint64_t> scopes_;
+    std::vector<uint64_t> bloom_;       // Version 1: plain, tags only
+    std::vector<BloomBlock> blocks_;    // Blocked, tags and tenants
+    std::vector<ListZone> zones_;
+    std::vector<float> means_;
+};
+
+} // namespace woved::storage
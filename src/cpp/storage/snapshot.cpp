@@ -0,0 +1,73 @@
+#include "snapshot.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-stable.h"
+#include <utility>
+
+namespace woved::storage {
+
+SnapshotRegistry::SnapshotRegistry() : current_(new SegmentSet()) {}
+
+SnapshotRegistry::~SnapshotRegistry() {
+    delete current_.load(std::memory_order_acquire);
+}
+
+SnapshotRegistry::Snapshot SnapshotRegistry::snapshot() const {
+    // Pin before reading the set, so an install that swaps it out waits
+    auto guard = util::EpochDomain::global().pin();
+    const SegmentSet* set = current_.load(std::memory_order_seq_cst);
+    return Snapshot(std::move(guard), set, visible_.load(std::memory_order_acquire));
+}
+
+void SnapshotRegistry::publish(Epoch visible) {
+    Epoch current = visible_.load(std::memory_order_relaxed);
+    while (current < visible &&
+           !visible_.compare_exchange_weak(current, visible, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+void SnapshotRegistry::install(std::vector<std::shared_ptr<const DeltaSegment>> delta,
+                               std::vector<std::shared_ptr<const StableSegment>> stable) {
+    auto set = std::make_unique<SegmentSet>();
+    set->delta = std::move(delta);
+    set->stable = std::move(stable);
+    set->delta_view.reserve(set->delta.size());
+    for (const auto& segment : set->delta) set->delta_view.push_back(segment.get());
+    set->stable_view.reserve(set->stable.size());
+    for (const auto& segment : set->stable) set->stable_view.push_back(segment.get());
+
+    uint64_t live = 0;
+    uint64_t resident = 0;
+    uint64_t resident_bytes = 0;
+    for (const auto& segment : set->delta) {
+        live += segment->liveRows();
+        if (segment->quantized()) {
+            resident += segment->liveRows();
+            resident_bytes += segment->residentBytes();
+        }
+    }
+
+    std::lock_guard lock(install_mutex_);
+    dead_rows_.update(*set);
+    delta_resident_fraction_.store(live ? static_cast<double>(resident) / static_cast<double>(live) : 1.0,
+                                   std::memory_order_relaxed);
+    delta_resident_bytes_.store(resident_bytes, std::memory_order_relaxed);
+    set->version = current_.load(std::memory_order_relaxed)->version + 1;
+    const SegmentSet* old = current_.exchange(set.release(), std::memory_order_seq_cst);
+    util::EpochDomain::global().synchronize();
+    delete old;
+}
+
+std::vector<std::pair<std::string_view, double>> SnapshotRegistry::metrics() const {
+    auto metrics = dead_rows_.metrics();
+    metrics.push_back({"woved_delta_resident_fraction", delta_resident_fraction_.load(std::memory_order_relaxed)});
+    metrics.push_back({"woved_delta_resident_bytes",
+                       static_cast<double>(delta_resident_bytes_.load(std::memory_order_relaxed))});
+    return metrics;
+}
+
+uint64_t SnapshotRegistry::version() const {
+    auto guard = util::EpochDomain::global().pin();
+    return current_.load(std::memory_order_seq_cst)->version;
+}
+
+} // namespace woved::storage
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "storage/segment/seg-dead.h"
+#include "util/epoch-reclaim.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved::storage {
+
+class DeltaSegment;
+class StableSegment;
+
+// The segments queries search, as of one install. A set never changes
+// once published; installing segments publishes a new one.
+struct SegmentSet {
+    std::vector<std::shared_ptr<const DeltaSegment>> delta;
+    std::vector<std::shared_ptr<const StableSegment>> stable;
+    // The same segments as TwoPhaseEngine::search takes them
+    std::vector<const DeltaSegment*> delta_view;
+    std::vector<const StableSegment*> stable_view;
+    // Per segment, in the same order, its rows superseded as of this set
+    // (DeadRowTracker); null where none are
+    std::vector<std::shared_ptr<const DeadRows>> delta_dead;
+    std::vector<std::shared_ptr<const DeadRows>> stable_dead;
+    std::vector<const DeadRows*> delta_dead_view;   // TwoPhaseEngine::Query::delta_dead
+    std::vector<const DeadRows*> stable_dead_view;
+    uint64_t version = 0;
+};
+
+// Consistent reads across the tiers without locks on the query path.
+//
+// A query takes a Snapshot first: it pins the calling thread in the
+// global EpochDomain, then reads the current SegmentSet and the visible
+// write epoch. Every tier is then read as of that epoch. Buffer scans
+// return each id's newest message at or below it (MessageBuffer::scanTopK's
+// read_epoch), and the engine skips newer segment rows
+// (TwoPhaseEngine::Query::read_epoch).
+// Data changes tiers in the same order everywhere. It is written to the
+// new tier first. Then the writer waits out every reader pinned before
+// that (EpochDomain::synchronize). Only then is it dropped from the old
+// tier. So a snapshot finds each row in at least one tier. Where it finds
+// it in two, the engine's merge keeps one copy, by id and epoch.
+//  - install() publishes a new set, waits out the older readers and
+//    frees the old set. A segment is released with the last set
+//    holding it.
+//  - install() also marks the rows a new segment supersedes, and its own
+//    rows other segments supersede, in the new set's copies of their
+//    DeadRows (seg-dead.h); older snapshots keep theirs.
+//  - FlushScheduler waits the same way before evicting a flushed slice
+//    from the buffer (snapshot_grace).
+//  - A buffered version overwritten in place stays readable until the
+//    readers pinned before the overwrite have left; MessageBuffer frees
+//    it later without blocking the write (EpochDomain::defer/passed).
+//  - install() also measures how much of the delta tier scans from
+//    memory: the share of live delta rows with an SQ8 copy held by their
+//    segment (woved_delta_resident_fraction).
+//
+// The write path raises the visible epoch with publish() once a write is
+// visible to buffer scans (MessageBuffer::writeEpoch(0, 0)).
+class SnapshotRegistry {
+public:
+    // Held for the length of one query, on the thread that took it: the
+    // pin belongs to that thread. Snapshots taken on one thread nest and
+    // must be released in reverse order.
+    class Snapshot {
+    public:
+        Snapshot(Snapshot&&) = default;
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        Epoch epoch() const { return epoch_; }
+        const SegmentSet& segments() const { return *set_; }
+        std::span<const DeltaSegment* const> delta() const { return set_->delta_view; }
+        std::span<const StableSegment* const> stable() const { return set_->stable_view; }
+        std::span<const DeadRows* const> deltaDead() const { return set_->delta_dead_view; }
+        std::span<const DeadRows* const> stableDead() const { return set_->stable_dead_view; }
+
+    private:
+        friend class SnapshotRegistry;
+        Snapshot(util::EpochDomain::Guard guard, const SegmentSet* set, Epoch epoch)
+            : guard_(std::move(guard)), set_(set), epoch_(epoch) {}
+
+        util::EpochDomain::Guard guard_;
+        const SegmentSet* set_;
+        Epoch epoch_;
+    };
+
+    SnapshotRegistry();
+    ~SnapshotRegistry();
+
+    SnapshotRegistry(const SnapshotRegistry&) = delete;
+    SnapshotRegistry& operator=(const SnapshotRegistry&) = delete;
+
+    Snapshot snapshot() const;
+
+    // Raise the visible epoch; lower values are ignored
+    void publish(Epoch visible);
+    Epoch visibleEpoch() const { return visible_.load(std::memory_order_acquire); }
+
+    // Publish the given segments as the current set. Returns once no
+    // snapshot of an older set remains, so the caller may then drop the
+    // data the new segments took over (a merge's inputs). Must not be
+    // called while holding a snapshot.
+    void install(std::vector<std::shared_ptr<const DeltaSegment>> delta,
+                 std::vector<std::shared_ptr<const StableSegment>> stable);
+
+    uint64_t version() const;
+
+    DeadRowTracker::Stats deadRowStats() const { return dead_rows_.getStats(); }
+
+    // The dead row gauges (DeadRowTracker::metrics()), woved_delta_resident_fraction
+    // and woved_delta_resident_bytes
+    std::vector<std::pair<std::string_view, double>> metrics() const;
+
+private:
+    std::mutex install_mutex_;
+    DeadRowTracker dead_rows_;  // Under install_mutex_
+    std::atomic<double> delta_resident_fraction_{1.0};
+    std::atomic<uint64_t> delta_resident_bytes_{0};
+    std::atomic<const SegmentSet*> current_;
+    std::atomic<Epoch> visible_{0};
+};
+
+} // namespace woved::storage
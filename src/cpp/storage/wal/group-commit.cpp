@@ -0,0 +1,166 @@
+#include "group-commit.h"
+#include "util/exceptions.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t kPage = 4096;
+
+constexpr size_t roundUp(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+std::byte* allocatePages(size_t bytes) {
+    auto* data = static_cast<std::byte*>(std::aligned_alloc(kPage, bytes));
+    if (!data) throw std::bad_alloc();
+    std::memset(data, 0, bytes);  // Fault the pages in before registration
+    return data;
+}
+
+} // namespace
+
+GroupCommitBuffer::GroupCommitBuffer(size_t unit_bytes, size_t slack, size_t scratch_bytes)
+    : unit_bytes_(roundUp(unit_bytes, kPage)), scratch_bytes_(roundUp(scratch_bytes, kPage)),
+      claim_(uint64_t{1} << 32) {
+    if (unit_bytes_ == 0 || unit_bytes_ > kOffsetMask) {
+        throw util::ConfigException("WAL unit size out of range: " + std::to_string(unit_bytes));
+    }
+    size_t capacity = roundUp(unit_bytes_ + slack, kPage);
+    for (auto& unit : units_) {
+        unit.data = allocatePages(capacity);
+        iov_[iov_count_++] = iovec{unit.data, capacity};
+    }
+    if (scratch_bytes_ > 0) {
+        scratch_ = allocatePages(scratch_bytes_);
+        iov_[iov_count_++] = iovec{scratch_, scratch_bytes_};
+    }
+}
+
+GroupCommitBuffer::~GroupCommitBuffer() {
+    for (auto& unit : units_) std::free(unit.data);
+    std::free(scratch_);
+}
+
+GroupCommitBuffer::Claim GroupCommitBuffer::claim(size_t payload_size) {
+    size_t bytes = WalFrameHeader::stride(payload_size);
+    if (payload_size > WalFrameHeader::kMaxPayload || bytes > unit_bytes_) {
+        throw util::InvalidArgumentException("WAL record of " + std::to_string(payload_size) +
+                                             " bytes exceeds the group commit unit");
+    }
+
+    uint64_t word = claim_.load(std::memory_order_acquire);
+    while (true) {
+        if (word & kSealed) {
+            claim_.wait(word, std::memory_order_acquire);
+            word = claim_.load(std::memory_order_acquire);
+            continue;
+        }
+        uint64_t offset = word & kOffsetMask;
+        if (offset + bytes > unit_bytes_) {
+            // Full: seal it for the committer and wait for the next unit
+            if (claim_.compare_exchange_weak(word, word | kSealed, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+                ring();
+            }
+            continue;
+        }
+        if (claim_.compare_exchange_weak(word, word + bytes, std::memory_order_acq_rel,
+                                         std::memory_order_acquire)) {
+            auto gen = static_cast<uint32_t>(word >> 32);
+            if (offset == 0) ring();  // First frame starts the group commit clock
+            return {units_[gen & 1].data + offset, bytes, gen};
+        }
+    }
+}
+
+void GroupCommitBuffer::finish(const Claim& claim, Epoch epoch, bool durable) {
+    CommitUnit& unit = units_[claim.gen & 1];
+    uint64_t prev = unit.max_epoch.load(std::memory_order_relaxed);
+    while (prev < epoch &&
+           !unit.max_epoch.compare_exchange_weak(prev, epoch, std::memory_order_relaxed)) {
+    }
+    // Padding frames of abandoned reservations carry epoch 0
+    prev = unit.min_epoch.load(std::memory_order_relaxed);
+    while (epoch != 0 && prev > epoch &&
+           !unit.min_epoch.compare_exchange_weak(prev, epoch, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+    }
+    unit.frames.fetch_add(1, std::memory_order_relaxed);
+    bool first_waiter = durable && unit.waiters.fetch_add(1, std::memory_order_relaxed) == 0;
+
+    // Publishes the frame and the counters above to seal()
+    unit.filled.fetch_add(claim.bytes, std::memory_order_release);
+    if (first_waiter) ring();
+}
+
+Epoch GroupCommitBuffer::pendingEpoch() const {
+    return std::min(units_[0].min_epoch.load(std::memory_order_acquire),
+                    units_[1].min_epoch.load(std::memory_order_acquire));
+}
+
+bool GroupCommitBuffer::waitSynced(uint32_t gen) const {
+    uint64_t word = synced_.load(std::memory_order_acquire);
+    while (true) {
+        if (static_cast<int32_t>(static_cast<uint32_t>(word) - gen) >= 0) return true;
+        if (word & kFailed) return false;
+        synced_.wait(word, std::memory_order_acquire);
+        word = synced_.load(std::memory_order_acquire);
+    }
+}
+
+CommitUnit& GroupCommitBuffer::seal(size_t& size, uint32_t& gen) {
+    uint64_t word = claim_.load(std::memory_order_acquire);
+    while (!(word & kSealed) &&
+           !claim_.compare_exchange_weak(word, word | kSealed, std::memory_order_acq_rel,
+                                         std::memory_order_acquire)) {
+    }
+    gen = static_cast<uint32_t>(word >> 32);
+    size = word & kOffsetMask;
+
+    // The other unit was written before this one was sealed, so it is free
+    uint32_t next_gen = gen + 1;
+    CommitUnit& next = units_[next_gen & 1];
+    next.filled.store(0, std::memory_order_relaxed);
+    next.max_epoch.store(0, std::memory_order_relaxed);
+    next.frames.store(0, std::memory_order_relaxed);
+    next.waiters.store(0, std::memory_order_relaxed);
+    claim_.store(uint64_t{next_gen} << 32, std::memory_order_release);
+    claim_.notify_all();
+
+    CommitUnit& unit = units_[gen & 1];
+    while (unit.filled.load(std::memory_order_acquire) < size) {
+        std::this_thread::yield();
+    }
+    return unit;
+}
+
+void GroupCommitBuffer::markSynced(uint32_t gen) {
+    uint64_t failed = synced_.load(std::memory_order_relaxed) & kFailed;
+    synced_.store(failed | gen, std::memory_order_release);
+    synced_.notify_all();
+}
+
+void GroupCommitBuffer::markFailed() {
+    synced_.fetch_or(kFailed, std::memory_order_acq_rel);
+    synced_.notify_all();
+}
+
+void GroupCommitBuffer::waitUntil(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_cv_.wait_until(lock, deadline, [this] { return doorbell_; });
+    doorbell_ = false;
+}
+
+void GroupCommitBuffer::ring() {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    doorbell_ = true;
+    wake_cv_.notify_one();
+}
+
+} // namespace woved::storage
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "util/crc32c.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <sys/uio.h>
+
+namespace woved::storage {
+
+// On-disk frame header: payload length, CRC-32C and epoch. The top bits
+// of `len` carry the payload codec (see WalCodec); the rest is the payload
+// size. The CRC covers the length word, the epoch and the payload so zeroed
+// or torn tails never validate. A zero-length frame is a fence.
+//
+// Frames start on 8-byte boundaries (stride()) so FlatBuffers payloads are
+// aligned in place; the gap after a payload is zero.
+struct WalFrameHeader {
+    static constexpr uint32_t kCodecShift = 28;
+    static constexpr uint32_t kMaxPayload = (1u << kCodecShift) - 1;  // 256 MiB
+    static constexpr size_t kAlign = 8;
+
+    uint32_t len;
+    uint32_t crc32c;
+    uint64_t epoch;
+
+    static uint32_t pack(size_t size, uint8_t codec) {
+        return static_cast<uint32_t>(size) | (static_cast<uint32_t>(codec) << kCodecShift);
+    }
+    size_t size() const { return len & kMaxPayload; }
+    uint8_t codec() const { return static_cast<uint8_t>(len >> kCodecShift); }
+
+    // Bytes from this frame's header to the next one
+    static size_t stride(size_t payload_size) {
+        return (sizeof(WalFrameHeader) + payload_size + kAlign - 1) & ~(kAlign - 1);
+    }
+
+    static uint32_t checksum(uint32_t len, uint64_t epoch, const void* payload) {
+        uint32_t crc = util::crc32c(&len, sizeof(len));
+        crc = util::crc32c(&epoch, sizeof(epoch), crc);
+        return util::crc32c(payload, len & kMaxPayload, crc);
+    }
+
+    // Seal a frame whose payload is already at out + sizeof(header)
+    static void seal(std::byte* out, uint8_t codec, uint64_t epoch, size_t payload_size) {
+        WalFrameHeader hdr;
+        hdr.len = pack(payload_size, codec);
+        hdr.epoch = epoch;
+        hdr.crc32c = checksum(hdr.len, epoch, out + sizeof(hdr));
+        std::memcpy(out, &hdr, sizeof(hdr));
+        size_t end = sizeof(hdr) + payload_size;
+        std::memset(out + end, 0, stride(payload_size) - end);
+    }
+
+    // Header + payload written at `out`; returns the stride used
+    static size_t write(std::byte* out, uint8_t codec, uint64_t epoch,
+                        std::span<const std::byte> payload) {
+        if (!payload.empty()) {
+            std::memcpy(out + sizeof(WalFrameHeader), payload.data(), payload.size());
+        }
+        seal(out, codec, epoch, payload.size());
+        return stride(payload.size());
+    }
+};
+static_assert(sizeof(WalFrameHeader) == 16);
+
+// One group commit unit: a page-aligned buffer that writers frame records
+// into directly. Reset by the committer before each reuse.
+struct CommitUnit {
+    std::byte* data = nullptr;
+    std::atomic<uint64_t> filled{0};      // Bytes finished by writers
+    std::atomic<uint64_t> max_epoch{0};
+    std::atomic<uint64_t> min_epoch{kLatestEpoch};  // Until the committer takes it
+    std::atomic<uint32_t> frames{0};
+    std::atomic<uint32_t> waiters{0};     // Writers blocked on durability
+};
+
+// Double-buffered log buffer shared by writers and the WAL committer.
+//
+// Writers claim space in the open unit with one CAS on a packed word
+// (generation, sealed bit, offset), write their frame in place and add its
+// size to `filled`. The committer seals the unit, opens the other one,
+// waits for in-flight writers and submits the sealed unit straight from
+// its buffer. Both units, and a scratch buffer for compressed or O_DIRECT
+// output, can be registered with io_uring as fixed buffers.
+//
+// Durability is tracked per generation: the synced word holds the newest
+// generation covered by an fdatasync. Generations are 32-bit and compared
+// with wraparound.
+class GroupCommitBuffer {
+public:
+    struct Claim {
+        std::byte* frame = nullptr;  // Header position; payload follows
+        size_t bytes = 0;            // Stride claimed
+        uint32_t gen = 0;
+    };
+
+    // `unit_bytes` is claimable space per unit; `slack` more is kept after
+    // it for the committer's fence. `scratch_bytes` 0 skips the scratch.
+    GroupCommitBuffer(size_t unit_bytes, size_t slack, size_t scratch_bytes);
+    ~GroupCommitBuffer();
+
+    GroupCommitBuffer(const GroupCommitBuffer&) = delete;
+    GroupCommitBuffer& operator=(const GroupCommitBuffer&) = delete;
+
+    size_t unitBytes() const { return unit_bytes_; }
+
+    // Units, then the scratch buffer, for io_uring registration
+    std::span<const iovec> buffers() const { return {iov_.data(), iov_count_}; }
+    std::byte* scratch() const { return scratch_; }
+    size_t scratchBytes() const { return scratch_bytes_; }
+
+    // Writer side
+
+    // Claim room for a frame with `payload_size` bytes. Blocks while the
+    // unit is full and being switched; throws util::InvalidArgumentException
+    // if the frame can never fit in a unit.
+    Claim claim(size_t payload_size);
+
+    // Frame written: account it and, when `durable`, register as a waiter
+    void finish(const Claim& claim, Epoch epoch, bool durable);
+
+    // Lowest epoch finished in either unit and not yet taken by the
+    // committer, kLatestEpoch if none
+    Epoch pendingEpoch() const;
+
+    // Block until `gen` is synced; false if the log failed first
+    bool waitSynced(uint32_t gen) const;
+
+    // Committer side
+
+    uint32_t openGen() const {
+        return static_cast<uint32_t>(claim_.load(std::memory_order_acquire) >> 32);
+    }
+    size_t openBytes() const { return claim_.load(std::memory_order_acquire) & kOffsetMask; }
+    bool openFull() const { return claim_.load(std::memory_order_acquire) & kSealed; }
+    bool openHasWaiters() const {
+        return units_[openGen() & 1].waiters.load(std::memory_order_acquire) > 0;
+    }
+
+    // Seal the open unit, open the next generation and wait for writers
+    // still filling the sealed one. Returns it with its size.
+    CommitUnit& seal(size_t& size, uint32_t& gen);
+
+    // Publish durability through `gen`, or failure, and wake waiters
+    void markSynced(uint32_t gen);
+    void markFailed();
+
+    // Committer sleep: until a writer rings, `deadline`, or wake()
+    void waitUntil(std::chrono::steady_clock::time_point deadline);
+    void wake() { ring(); }
+
+private:
+    static constexpr uint64_t kSealed = 1ull << 31;
+    static constexpr uint64_t kOffsetMask = kSealed - 1;
+    static constexpr uint64_t kFailed = 1ull << 32;
+
+    size_t unit_bytes_;
+    size_t scratch_bytes_;
+    std::array<CommitUnit, 2> units_;
+    std::byte* scratch_ = nullptr;
+    std::array<iovec, 3> iov_{};
+    size_t iov_count_ = 0;
+
+    std::atomic<uint64_t> claim_;               // gen << 32 | sealed | offset
+    std::atomic<uint64_t> synced_{0};           // failed bit | synced gen
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    bool doorbell_ = false;
+
+    void ring();
+};
+
+} // namespace woved::storage
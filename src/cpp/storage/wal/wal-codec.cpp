@@ -0,0 +1,147 @@
+#include "wal-codec.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cstring>
+#include <lz4.h>
+#include <zdict.h>
+#include <zstd.h>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t kSizePrefix = sizeof(uint32_t);
+
+// Enough samples for ZDICT to find repeated structure
+constexpr size_t kSamplesPerDictByte = 32;
+
+} // namespace
+
+WalCodec::Kind WalCodec::parse(const std::string& name) {
+    if (name == "none") return NONE;
+    if (name == "lz4") return LZ4;
+    if (name == "zstd") return ZSTD;
+    throw util::ConfigException("Unknown WAL compression: " + name);
+}
+
+WalCodec::WalCodec(Kind kind, int level, size_t dict_bytes)
+    : kind_(kind), level_(level), dict_bytes_(kind == ZSTD ? dict_bytes : 0),
+      sample_target_(dict_bytes_ * kSamplesPerDictByte) {
+    if (kind_ == ZSTD) {
+        cctx_ = ZSTD_createCCtx();
+        if (!cctx_) throw std::bad_alloc();
+    }
+}
+
+WalCodec::~WalCodec() {
+    ZSTD_freeCDict(cdict_);
+    ZSTD_freeDDict(ddict_);
+    ZSTD_freeCCtx(cctx_);
+    ZSTD_freeDCtx(dctx_);
+}
+
+size_t WalCodec::bound(size_t size) const {
+    size_t codec_bound = kind_ == LZ4 ? static_cast<size_t>(LZ4_compressBound(static_cast<int>(size)))
+                                      : ZSTD_compressBound(size);
+    return kSizePrefix + codec_bound;
+}
+
+size_t WalCodec::compress(std::span<const std::byte> in, std::span<std::byte> out) {
+    if (kind_ == NONE || in.size() > UINT32_MAX || out.size() < kSizePrefix) return 0;
+
+    uint32_t raw = static_cast<uint32_t>(in.size());
+    std::memcpy(out.data(), &raw, kSizePrefix);
+    char* dst = reinterpret_cast<char*>(out.data() + kSizePrefix);
+    size_t capacity = out.size() - kSizePrefix;
+
+    size_t written = 0;
+    if (kind_ == LZ4) {
+        int n = LZ4_compress_default(reinterpret_cast<const char*>(in.data()), dst,
+                                     static_cast<int>(in.size()), static_cast<int>(capacity));
+        if (n <= 0) return 0;
+        written = static_cast<size_t>(n);
+    } else {
+        written = cdict_ ? ZSTD_compress_usingCDict(cctx_, dst, capacity, in.data(), in.size(), cdict_)
+                         : ZSTD_compressCCtx(cctx_, dst, capacity, in.data(), in.size(), level_);
+        if (ZSTD_isError(written)) return 0;
+    }
+
+    if (kSizePrefix + written >= in.size()) return 0;
+    return kSizePrefix + written;
+}
+
+bool WalCodec::sample(std::span<const std::byte> payload) {
+    if (!sampling() || payload.empty()) return false;
+    size_t take = std::min(payload.size(), kMaxSample);
+    samples_.insert(samples_.end(), payload.begin(), payload.begin() + take);
+    sample_sizes_.push_back(take);
+    if (samples_.size() < sample_target_) return false;
+
+    train();
+    return !dict_.empty();
+}
+
+void WalCodec::train() {
+    std::vector<std::byte> dict(dict_bytes_);
+    size_t size = ZDICT_trainFromBuffer(dict.data(), dict.size(), samples_.data(),
+                                        sample_sizes_.data(),
+                                        static_cast<unsigned>(sample_sizes_.size()));
+    samples_.clear();
+    samples_.shrink_to_fit();
+    sample_sizes_.clear();
+    sample_sizes_.shrink_to_fit();
+    sample_target_ = 0;
+    if (ZDICT_isError(size)) {
+        LOG_WARN("WAL dictionary training failed ({}), using plain zstd",
+                 ZDICT_getErrorName(size));
+        return;
+    }
+
+    dict.resize(size);
+    cdict_ = ZSTD_createCDict(dict.data(), dict.size(), level_);
+    if (!cdict_) throw std::bad_alloc();
+    dict_ = std::move(dict);
+    LOG_INFO("WAL zstd dictionary trained: {} bytes, dict id {}", dict_.size(),
+             ZDICT_getDictID(dict_.data(), dict_.size()));
+}
+
+void WalCodec::loadDictionary(std::span<const std::byte> dict) {
+    ZSTD_freeDDict(ddict_);
+    ddict_ = ZSTD_createDDict(dict.data(), dict.size());
+    if (!ddict_) throw util::IOException("Invalid WAL dictionary frame");
+}
+
+void WalCodec::decompress(Kind kind, std::span<const std::byte> in, std::vector<std::byte>& out) {
+    if (in.size() < kSizePrefix) throw util::IOException("Truncated compressed WAL frame");
+    uint32_t raw = 0;
+    std::memcpy(&raw, in.data(), kSizePrefix);
+    out.resize(raw);
+    const char* src = reinterpret_cast<const char*>(in.data() + kSizePrefix);
+    size_t src_size = in.size() - kSizePrefix;
+
+    if (kind == LZ4) {
+        int n = LZ4_decompress_safe(src, reinterpret_cast<char*>(out.data()),
+                                    static_cast<int>(src_size), static_cast<int>(raw));
+        if (n < 0 || static_cast<uint32_t>(n) != raw) {
+            throw util::IOException("Corrupt lz4 WAL frame");
+        }
+        return;
+    }
+    if (kind != ZSTD) {
+        throw util::IOException("Unknown WAL frame codec " + std::to_string(kind));
+    }
+
+    if (!dctx_) {
+        dctx_ = ZSTD_createDCtx();
+        if (!dctx_) throw std::bad_alloc();
+    }
+    size_t n = ddict_ ? ZSTD_decompress_usingDDict(dctx_, out.data(), raw, src, src_size, ddict_)
+                      : ZSTD_decompressDCtx(dctx_, out.data(), raw, src, src_size);
+    if (ZSTD_isError(n) || n != raw) {
+        throw util::IOException(std::string("Corrupt zstd WAL frame: ") +
+                                (ZSTD_isError(n) ? ZSTD_getErrorName(n) : "size mismatch"));
+    }
+}
+
+} // namespace woved::storage
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace woved::storage {
+
+// Block codec for WAL frames. The committer compresses a whole group commit
+// unit (the concatenated inner frames) into one outer frame whose header
+// records the codec; recovery decompresses it and walks the inner frames.
+//
+// zstd can use a dictionary trained on the first payloads of a run. It is
+// written to the log as a DICTIONARY frame at the start of every file that
+// uses it, so each file decodes on its own.
+//
+// Compressed payload layout: raw size (u32) followed by the codec block.
+class WalCodec {
+public:
+    // Frame kinds in WalFrameHeader::codec(); PADDING frames are skipped
+    enum Kind : uint8_t { NONE = 0, LZ4 = 1, ZSTD = 2, DICTIONARY = 3, PADDING = 4 };
+
+    // "none", "lz4" or "zstd"; throws util::ConfigException otherwise
+    static Kind parse(const std::string& name);
+
+    // dict_bytes = 0 disables dictionary training (zstd only)
+    WalCodec(Kind kind, int level, size_t dict_bytes);
+    ~WalCodec();
+
+    WalCodec(const WalCodec&) = delete;
+    WalCodec& operator=(const WalCodec&) = delete;
+
+    Kind kind() const { return kind_; }
+
+    // Output space compress() may need for `size` input bytes
+    size_t bound(size_t size) const;
+
+    // Compress `in` into `out` (at least bound() bytes). Returns the bytes
+    // written, or 0 when the result would not be smaller.
+    size_t compress(std::span<const std::byte> in, std::span<std::byte> out);
+
+    // Offer a payload for dictionary training. Returns true exactly once,
+    // when a dictionary has just been trained and compress() starts using it.
+    bool sample(std::span<const std::byte> payload);
+    bool sampling() const { return sample_target_ > 0 && dict_.empty(); }
+
+    std::span<const std::byte> dictionary() const { return dict_; }
+
+    // Recovery side: install a DICTIONARY frame's payload
+    void loadDictionary(std::span<const std::byte> dict);
+
+    // Decode a payload written with `kind`; throws util::IOException if it
+    // is corrupt or needs a dictionary that was not loaded
+    void decompress(Kind kind, std::span<const std::byte> in, std::vector<std::byte>& out);
+
+private:
+    static constexpr size_t kMaxSample = 16384;  // Bytes taken from one payload
+
+    Kind kind_;
+    int level_;
+    size_t dict_bytes_;
+    size_t sample_target_;  // Sample bytes to collect before training
+
+    ZSTD_CCtx_s* cctx_ = nullptr;
+    ZSTD_DCtx_s* dctx_ = nullptr;
+    ZSTD_CDict_s* cdict_ = nullptr;
+    ZSTD_DDict_s* ddict_ = nullptr;
+
+    std::vector<std::byte> samples_;
+    std::vector<size_t> sample_sizes_;
+    std::vector<std::byte> dict_;
+
+    void train();
+};
+
+} // namespace woved::storage
@@ -0,0 +1,663 @@
+#include "wal-manager.h"
+#include "core/metrics.h"
+#include "io/buffer-pool.h"
+#include "util/crc32c.h"
+#include "util/exceptions.h"
+#include "util/fault-point.h"
+#include "util/file-io.h"
+#include "util/intern-table.h"
+#include "util/logging.h"
+#include "util/telemetry.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace woved::storage {
+
+namespace {
+
+constexpr size_t roundUp(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+std::string walFileName(uint64_t seq) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "wal-%016llu.log", static_cast<unsigned long long>(seq));
+    return name;
+}
+
+// Sequence of a wal-<seq>.log name, 0 for anything else
+uint64_t walFileSeq(const std::string& name) {
+    unsigned long long seq = 0;
+    char tail = 0;
+    if (name.size() != 24 || std::sscanf(name.c_str(), "wal-%16llu.lo%c", &seq, &tail) != 2 ||
+        tail != 'g') {
+        return 0;
+    }
+    return seq;
+}
+
+// Number of a wal-spare-<n>.log (ready) or .tmp (to be zeroed), 0 otherwise
+uint64_t spareNumber(const std::string& name, bool& ready) {
+    unsigned long long n = 0;
+    char ext[4] = {};
+    if (name.size() != 30 || std::sscanf(name.c_str(), "wal-spare-%16llu.%3s", &n, ext) != 2) {
+        return 0;
+    }
+    ready = std::strcmp(ext, "log") == 0;
+    return ready || std::strcmp(ext, "tmp") == 0 ? n : 0;
+}
+
+constexpr size_t kZeroChunk = 1048576;  // Zero-fill write size
+
+// Tenant share of the WAL, as encoded records; the device bytes are
+// counted per unit by the committer
+void accountRecord(const WalRecordView& rec, size_t bytes) {
+    const TenantOrdinal tenant = util::InternTable::tenants().find(rec.tenant).value_or(util::InternTable::kNone);
+    Metrics::global().writes.addTenant(WritePoint::WalAppend, tenant, bytes);
+}
+
+} // namespace
+
+WalManager::Options WalManager::Options::fromConfig(const WALConfig& wal, const std::string& dir) {
+    Options options;
+    options.dir = dir;
+    options.group_commit_ms = wal.group_commit_ms;
+    options.fence_every_ms = wal.fence_every_ms;
+    options.fsync_every_fences = std::max<uint32_t>(1, wal.fsync_every_fences);
+    options.rotate_bytes = wal.rotate_bytes;
+    options.unit_bytes = wal.unit_bytes;
+    options.direct_io = wal.direct_io;
+    options.compression = wal.compression;
+    options.compression_level = wal.compression_level;
+    options.dict_bytes = wal.dict_bytes;
+    options.preallocate = wal.preallocate;
+    options.pool_files = wal.pool_files;
+    return options;
+}
+
+WalManager::Options WalManager::Options::fromConfig(const Config& config, const std::string& dir) {
+    Options options = fromConfig(config.storage.wal, dir);
+    options.ring = io::UringWrapper::Options::fromConfig(config.io);
+    return options;
+}
+
+io::UringWrapper::Options WalManager::ringOptions(const Options& options) {
+    io::UringWrapper::Options ring = options.ring;
+    ring.entries = options.ring_entries;
+    return ring;
+}
+
+size_t WalManager::scratchBytes(const Options& options, const WalCodec& codec) {
+    bool compress = codec.kind() != WalCodec::NONE;
+    if (!compress && !options.direct_io) return 0;
+
+    // Carried block, the largest unit output, a fence, block padding
+    size_t unit = roundUp(options.unit_bytes, kBlock) + sizeof(WalFrameHeader);
+    if (compress) {
+        unit = std::max(unit, WalFrameHeader::stride(options.dict_bytes) +
+                                  WalFrameHeader::stride(codec.bound(unit)));
+    }
+    return kBlock + unit + sizeof(WalFrameHeader) + kBlock;
+}
+
+WalManager::WalManager(const Options& options)
+    : options_(options), ring_(ringOptions(options)),
+      codec_(WalCodec::parse(options.compression), options.compression_level, options.dict_bytes),
+      buffer_(options.unit_bytes, sizeof(WalFrameHeader), scratchBytes(options, codec_)) {
+    if (options_.dir.empty()) {
+        throw util::ConfigException("WAL directory not set");
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(options_.dir, ec);
+    if (ec) {
+        throw util::IOException("create WAL directory " + options_.dir + ": " + ec.message());
+    }
+    for (const auto& entry : std::filesystem::directory_iterator(options_.dir)) {
+        file_seq_ = std::max(file_seq_, walFileSeq(entry.path().filename().string()));
+    }
+
+    // Room for the largest write that starts below rotate_bytes
+    size_t max_write = std::max(buffer_.scratchBytes(), options_.unit_bytes + 2 * sizeof(WalFrameHeader));
+    file_bytes_ = roundUp(options_.rotate_bytes + max_write, kBlock) + kBlock;
+    if (options_.preallocate) adoptSpares();
+
+    ring_.registerBuffers(buffer_.buffers());
+    openNextFile();
+    last_fence_ = std::chrono::steady_clock::now();
+
+    if (options_.preallocate) preparer_ = std::thread([this] { preparePool(); });
+    committer_ = std::thread([this] { run(); });
+    LOG_INFO("WAL {} at {} (io_uring {}, fixed buffers {}, direct I/O {}, compression {}, crc32c {})",
+             walFileName(file_seq_), options_.dir, ring_.usingRing() ? "on" : "off",
+             ring_.usingFixedBuffers() ? "on" : "off", options_.direct_io ? "on" : "off",
+             options_.compression, util::crc32c_isa());
+}
+
+WalManager::~WalManager() {
+    stop_.store(true, std::memory_order_release);
+    buffer_.wake();
+    if (committer_.joinable()) committer_.join();
+    closeFile();
+
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        pool_stop_.store(true, std::memory_order_relaxed);
+    }
+    pool_cv_.notify_all();
+    if (preparer_.joinable()) preparer_.join();
+}
+
+WalManager::Reservation::Reservation(Reservation&& other) noexcept
+    : wal_(other.wal_), claim_(other.claim_), size_(other.size_) {
+    other.wal_ = nullptr;
+}
+
+WalManager::Reservation::~Reservation() {
+    if (!wal_) return;
+    // Abandoned: keep the unit parseable and let the committer proceed
+    WalFrameHeader::seal(claim_.frame, WalCodec::PADDING, 0, claim_.bytes - sizeof(WalFrameHeader));
+    wal_->buffer_.finish(claim_, 0, false);
+}
+
+WalManager::Reservation WalManager::reserve(size_t payload_bytes) {
+    if (failed_.load(std::memory_order_acquire)) {
+        throw util::IOException("WAL is failed: " + options_.dir);
+    }
+    return Reservation(this, buffer_.claim(payload_bytes), payload_bytes);
+}
+
+void WalManager::submit(Reservation& reservation, Epoch epoch, bool durable) {
+    if (reservation.wal_ != this) {
+        throw util::InvalidArgumentException("WAL reservation is not open on this log");
+    }
+    reservation.wal_ = nullptr;
+    WalFrameHeader::seal(reservation.claim_.frame, WalCodec::NONE, epoch, reservation.size_);
+    Epoch seen = submitted_epoch_.load(std::memory_order_relaxed);
+    while (seen < epoch &&
+           !submitted_epoch_.compare_exchange_weak(seen, epoch, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+    }
+    buffer_.finish(reservation.claim_, epoch, durable);
+}
+
+void WalManager::commit(Reservation&& reservation, Epoch epoch) {
+    uint32_t gen = reservation.claim_.gen;
+    submit(reservation, epoch, true);
+    util::ScopedTimer timer(Metrics::global().ingest(IngestStage::WalWait));
+    if (!buffer_.waitSynced(gen)) {
+        throw util::IOException("WAL commit failed: " + options_.dir);
+    }
+}
+
+void WalManager::append(Reservation&& reservation, Epoch epoch) {
+    submit(reservation, epoch, false);
+}
+
+void WalManager::commit(const WalRecordView& rec) {
+    const size_t size = WalRecordEncoder::size(rec);
+    Reservation reservation = reserve(size);
+    WalRecordEncoder::encode(rec, reservation.payload().data());
+    accountRecord(rec, size);
+    commit(std::move(reservation), rec.epoch);
+}
+
+void WalManager::append(const WalRecordView& rec) {
+    const size_t size = WalRecordEncoder::size(rec);
+    Reservation reservation = reserve(size);
+    WalRecordEncoder::encode(rec, reservation.payload().data());
+    accountRecord(rec, size);
+    append(std::move(reservation), rec.epoch);
+}
+
+void WalManager::commit(std::span<const std::byte> payload, Epoch epoch) {
+    Reservation reservation = reserve(payload.size());
+    if (!payload.empty()) std::memcpy(reservation.payload().data(), payload.data(), payload.size());
+    commit(std::move(reservation), epoch);
+}
+
+void WalManager::append(std::span<const std::byte> payload, Epoch epoch) {
+    Reservation reservation = reserve(payload.size());
+    if (!payload.empty()) std::memcpy(reservation.payload().data(), payload.data(), payload.size());
+    append(std::move(reservation), epoch);
+}
+
+size_t WalManager::recycleBefore(uint64_t seq) {
+    uint64_t open_seq;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        open_seq = stats_.file_seq;
+    }
+    seq = std::min(seq, open_seq);
+
+    std::vector<std::string> obsolete;
+    for (const auto& entry : std::filesystem::directory_iterator(options_.dir)) {
+        uint64_t file_seq = walFileSeq(entry.path().filename().string());
+        if (file_seq > 0 && file_seq < seq) obsolete.push_back(entry.path().string());
+    }
+
+    size_t released = 0;
+    for (const auto& path : obsolete) {
+        if (!options_.preallocate) {
+            if (::unlink(path.c_str()) != 0) {
+                LOG_WARN("WAL truncate: unlink {}: {}", path, std::strerror(errno));
+                continue;
+            }
+        } else {
+            // Renamed out of the log sequence now, zeroed by the preparer
+            std::lock_guard<std::mutex> lock(pool_mutex_);
+            std::string dirty = sparePath(false);
+            if (::rename(path.c_str(), dirty.c_str()) != 0) {
+                LOG_WARN("WAL recycle: rename {}: {}", path, std::strerror(errno));
+                continue;
+            }
+            dirty_.push_back(std::move(dirty));
+        }
+        ++released;
+    }
+    if (released == 0) return 0;
+
+    pool_cv_.notify_all();
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.recycled_files += released;
+    return released;
+}
+
+WalManager::Stats WalManager::getStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+Epoch WalManager::pendingEpoch() const {
+    // Units first: the committer holds a unit's epochs before taking them
+    Epoch open = buffer_.pendingEpoch();
+    return std::min(open, unsynced_epoch_.load(std::memory_order_acquire));
+}
+
+void WalManager::holdPending(CommitUnit& unit) {
+    Epoch lowest = unit.min_epoch.load(std::memory_order_relaxed);
+    if (lowest < unsynced_epoch_.load(std::memory_order_relaxed)) {
+        unsynced_epoch_.store(lowest, std::memory_order_relaxed);
+    }
+    // Release: a reader that sees the unit taken sees it held
+    unit.min_epoch.store(kLatestEpoch, std::memory_order_release);
+}
+
+void WalManager::run() {
+    using clock = std::chrono::steady_clock;
+    const auto window = std::chrono::milliseconds(options_.group_commit_ms);
+    const auto fence_every = std::chrono::milliseconds(options_.fence_every_ms);
+
+    while (true) {
+        bool stopping = stop_.load(std::memory_order_acquire);
+        if (failed_.load(std::memory_order_relaxed)) {
+            // Keep switching units so blocked writers see the failure
+            if (buffer_.openBytes() > 0 || buffer_.openFull()) {
+                size_t size;
+                uint32_t gen;
+                holdPending(buffer_.seal(size, gen));
+            }
+            buffer_.markFailed();
+            if (stopping) break;
+            buffer_.waitUntil(clock::now() + std::chrono::seconds(1));
+            continue;
+        }
+
+        auto now = clock::now();
+        size_t open = buffer_.openBytes();
+        if (open > 0 && !open_nonempty_) {
+            open_since_ = now;
+            open_nonempty_ = true;
+        }
+        bool fence_due = options_.fence_every_ms > 0 && now - last_fence_ >= fence_every &&
+                         (max_epoch_ > fenced_epoch_ || unsynced_ || open > 0);
+        bool write_due = buffer_.openHasWaiters() || buffer_.openFull() || fence_due ||
+                         stopping || (open > 0 && now - open_since_ >= window);
+
+        if (write_due) {
+            try {
+                writeUnit(stopping, fence_due);
+            } catch (const std::exception& e) {
+                LOG_ERROR("WAL write failed, rejecting further appends: {}", e.what());
+                failed_.store(true, std::memory_order_release);
+                continue;
+            }
+            if (stopping && buffer_.openBytes() == 0) break;
+            continue;
+        }
+
+        // Idle: sleep until a writer rings or a timer is due
+        auto deadline = now + std::chrono::seconds(1);
+        if (open > 0) deadline = std::min(deadline, open_since_ + window);
+        if (options_.fence_every_ms > 0 && (max_epoch_ > fenced_epoch_ || unsynced_)) {
+            deadline = std::min(deadline, last_fence_ + fence_every);
+        }
+        buffer_.waitUntil(deadline);
+    }
+}
+
+void WalManager::writeUnit(bool final, bool fence) {
+    size_t size;
+    uint32_t gen;
+    CommitUnit& unit = buffer_.seal(size, gen);
+    holdPending(unit);
+    open_nonempty_ = false;
+
+    const Epoch unit_epoch = std::max(max_epoch_, unit.max_epoch.load(std::memory_order_relaxed));
+    const uint32_t frames = unit.frames.load(std::memory_order_relaxed);
+    const bool durable = unit.waiters.load(std::memory_order_relaxed) > 0;
+
+    if (codec_.sampling()) {
+        for (size_t pos = 0; pos < size;) {
+            WalFrameHeader hdr;
+            std::memcpy(&hdr, unit.data + pos, sizeof(hdr));
+            if (hdr.codec() == WalCodec::NONE && hdr.size() > 0) {
+                dict_pending_ |= codec_.sample({unit.data + pos + sizeof(hdr), hdr.size()});
+            }
+            pos += WalFrameHeader::stride(hdr.size());
+        }
+    }
+
+    // Pick the write source: the unit itself, or the scratch when staging
+    std::byte* out = unit.data;
+    unsigned index = gen & 1;
+    size_t used = size;
+    bool compressed = false;
+    std::byte* staged = buffer_.scratch() ? buffer_.scratch() + carry_ : nullptr;
+    if (codec_.kind() != WalCodec::NONE && size >= kMinCompressBytes) {
+        if (size_t n = compressUnit(unit.data, size, unit_epoch)) {
+            out = staged;
+            used = n;
+            compressed = true;
+        }
+    }
+    if (!compressed && options_.direct_io) {
+        std::memcpy(staged, unit.data, size);
+        out = staged;
+    }
+    if (out == staged) index = kScratchIndex;
+
+    // A fence records the highest epoch written so far (space is reserved)
+    if (fence) {
+        used += WalFrameHeader::write(out + used, 0, unit_epoch, {});
+        fenced_epoch_ = unit_epoch;
+        last_fence_ = std::chrono::steady_clock::now();
+        ++fences_since_sync_;
+    }
+
+    const bool rotate = file_end_ + used >= options_.rotate_bytes;
+    const bool sync = durable || rotate || fences_since_sync_ >= options_.fsync_every_fences ||
+                      (final && (used > 0 || unsynced_));
+
+    if (used > 0) {
+        if (options_.direct_io) {
+            // Whole blocks from the start of the carried block, zero padded
+            size_t len = roundUp(carry_ + used, kBlock);
+            std::memset(buffer_.scratch() + carry_ + used, 0, len - carry_ - used);
+            ring_.writeFixed(fd_, kScratchIndex, buffer_.scratch(), len, file_end_ - carry_, sync);
+        } else {
+            ring_.writeFixed(fd_, index, out, used, file_end_, sync);
+        }
+        if (options_.limiter) options_.limiter->charge(used);
+        Metrics::global().writes.add(WritePoint::WalAppend, used);
+        file_end_ += used;
+        util::fault_point("wal_append");
+    } else if (sync) {
+        ring_.sync(fd_);
+    }
+
+    max_epoch_ = unit_epoch;
+    if (sync) {
+        durable_epoch_.store(max_epoch_, std::memory_order_release);
+        unsynced_epoch_.store(kLatestEpoch, std::memory_order_release);
+        fences_since_sync_ = 0;
+        buffer_.markSynced(gen);
+    }
+    unsynced_ = !sync && (unsynced_ || used > 0);
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.units++;
+        stats_.syncs += sync;
+        stats_.frames += frames;
+        stats_.fences += fence;
+        stats_.bytes += used;
+        stats_.raw_bytes += size;
+        stats_.compressed_units += compressed;
+        stats_.max_unit_frames = std::max<uint64_t>(stats_.max_unit_frames, frames);
+    }
+
+    // Direct I/O rewrites the partial tail block with the next unit
+    if (options_.direct_io) {
+        size_t tail = file_end_ % kBlock;
+        std::memmove(buffer_.scratch(), buffer_.scratch() + carry_ + used - tail, tail);
+        carry_ = tail;
+    }
+
+    if (rotate) {
+        closeFile();
+        openNextFile();
+    }
+}
+
+// Compress `size` frame bytes into the scratch after carry_ as one frame,
+// preceded by the dictionary if this file has not seen it yet. Returns the
+// bytes used, or 0 when compression did not help.
+size_t WalManager::compressUnit(const std::byte* data, size_t size, Epoch epoch) {
+    std::byte* out = buffer_.scratch() + carry_;
+    auto dict = codec_.dictionary();
+    size_t dict_stride = dict_pending_ && !dict.empty() ? WalFrameHeader::stride(dict.size()) : 0;
+
+    std::byte* frame = out + dict_stride;
+    size_t capacity = buffer_.scratchBytes() - carry_ - dict_stride - 2 * sizeof(WalFrameHeader) - kBlock;
+    size_t n = codec_.compress({data, size}, {frame + sizeof(WalFrameHeader), capacity});
+    if (n == 0 || WalFrameHeader::stride(n) >= size) return 0;
+
+    WalFrameHeader::seal(frame, codec_.kind(), epoch, n);
+    if (dict_stride > 0) {
+        WalFrameHeader::write(out, WalCodec::DICTIONARY, epoch, dict);
+        dict_pending_ = false;
+    }
+    return dict_stride + WalFrameHeader::stride(n);
+}
+
+void WalManager::openNextFile() {
+    ++file_seq_;
+    std::string path = options_.dir + "/" + walFileName(file_seq_);
+
+    std::string spare;
+    if (options_.preallocate) {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        if (!ready_.empty()) {
+            spare = std::move(ready_.front());
+            ready_.pop_front();
+        }
+    }
+    pool_cv_.notify_all();  // Replace the spare in the background
+
+    bool hit = false;
+    if (!spare.empty()) {
+        if (::rename(spare.c_str(), path.c_str()) != 0) {
+            LOG_WARN("WAL rotate: rename {}: {}", spare, std::strerror(errno));
+        } else {
+            fd_ = openFile(path, false);
+            hit = true;
+        }
+    }
+    if (!hit) {
+        if (options_.preallocate && stats_.units > 0) {
+            LOG_WARN("WAL rotate: no prepared spare, creating {}", walFileName(file_seq_));
+        }
+        fd_ = openFile(path, true);
+    }
+    ring_.registerFile(fd_);
+
+    // Make the new directory entry durable before anything relies on it
+    util::sync_directory(options_.dir);
+
+    file_end_ = 0;
+    carry_ = 0;
+    dict_pending_ = !codec_.dictionary().empty();
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.file_seq = file_seq_;
+    stats_.pool_hits += hit;
+    stats_.pool_misses += options_.preallocate && !hit;
+}
+
+int WalManager::openFile(const std::string& path, bool create) {
+    int flags = O_WRONLY | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0);
+    int fd = ::open(path.c_str(), options_.direct_io ? flags | O_DIRECT : flags, 0644);
+    if (fd < 0 && errno == EINVAL && options_.direct_io && stats_.units == 0) {
+        // The filesystem has no O_DIRECT (tmpfs); decided before any write
+        LOG_WARN("WAL: O_DIRECT unsupported in {}, using buffered writes", options_.dir);
+        options_.direct_io = false;
+        fd = ::open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+        throw util::IOException("open " + path + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+void WalManager::closeFile() {
+    if (fd_ < 0) return;
+    try {
+        ring_.sync(fd_);
+    } catch (const std::exception& e) {
+        LOG_ERROR("WAL close: {}", e.what());
+    }
+    ring_.unregisterFile(fd_);
+    ::close(fd_);
+    fd_ = -1;
+}
+
+// Pick up the pool left by an earlier run; half-prepared spares and
+// spares of another size are zeroed again
+void WalManager::adoptSpares() {
+    std::vector<std::pair<uint64_t, std::string>> spares;
+    for (const auto& entry : std::filesystem::directory_iterator(options_.dir)) {
+        bool ready = false;
+        uint64_t n = spareNumber(entry.path().filename().string(), ready);
+        if (n == 0) continue;
+        next_spare_ = std::max(next_spare_, n + 1);
+        std::error_code ec;
+        ready = ready && entry.file_size(ec) == file_bytes_ && !ec;
+        spares.emplace_back(ready ? n : 0, entry.path().string());
+    }
+    std::sort(spares.begin(), spares.end(), std::greater<>());
+    for (auto& [n, path] : spares) {
+        if (n > 0 && ready_.size() < options_.pool_files) {
+            ready_.push_back(std::move(path));
+        } else {
+            dirty_.push_back(std::move(path));
+        }
+    }
+}
+
+std::string WalManager::sparePath(bool ready) {
+    char name[40];
+    std::snprintf(name, sizeof(name), "wal-spare-%016llu.%s",
+                  static_cast<unsigned long long>(next_spare_++), ready ? "log" : "tmp");
+    return options_.dir + "/" + name;
+}
+
+// Preparer thread: top the pool up to pool_files, reusing recycled files
+// first; recycled files beyond that are deleted
+void WalManager::preparePool() {
+    std::unique_lock<std::mutex> lock(pool_mutex_);
+    while (!pool_stop_.load(std::memory_order_relaxed)) {
+        if (ready_.size() >= options_.pool_files) {
+            if (dirty_.empty()) {
+                pool_cv_.wait(lock);
+                continue;
+            }
+            std::string path = std::move(dirty_.front());
+            dirty_.pop_front();
+            lock.unlock();
+            ::unlink(path.c_str());
+            lock.lock();
+            continue;
+        }
+
+        std::string dirty;
+        if (!dirty_.empty()) {
+            dirty = std::move(dirty_.front());
+            dirty_.pop_front();
+        } else {
+            dirty = sparePath(false);
+        }
+        std::string ready = sparePath(true);
+        lock.unlock();
+
+        bool ok = false;
+        try {
+            prepareSpare(dirty);
+            if (::rename(dirty.c_str(), ready.c_str()) != 0) {
+                throw util::IOException("rename " + dirty + ": " + std::strerror(errno));
+            }
+            ok = true;
+        } catch (const std::exception& e) {
+            if (!pool_stop_.load(std::memory_order_relaxed)) {
+                LOG_WARN("WAL pool: preparing a spare failed: {}", e.what());
+                ::unlink(dirty.c_str());
+            }
+        }
+
+        lock.lock();
+        if (ok) {
+            ready_.push_back(std::move(ready));
+        } else {
+            // Back off; rotation creates files meanwhile
+            pool_cv_.wait_for(lock, std::chrono::seconds(1),
+                              [&] { return pool_stop_.load(std::memory_order_relaxed); });
+        }
+    }
+}
+
+// Allocate `dirty` to file_bytes_ and overwrite it with zeros, so that its
+// extents are written (not unwritten) when the log reuses it
+void WalManager::prepareSpare(const std::string& dirty) {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (options_.direct_io ? O_DIRECT : 0);
+    int fd = ::open(dirty.c_str(), flags, 0644);
+    if (fd < 0) throw util::IOException("open " + dirty + ": " + std::strerror(errno));
+
+    auto fail = [&](const char* what) {
+        int err = errno;
+        ::close(fd);
+        throw util::IOException(std::string(what) + " " + dirty + ": " + std::strerror(err));
+    };
+    if (::ftruncate(fd, static_cast<off_t>(file_bytes_)) != 0) fail("truncate");
+    if (::fallocate(fd, 0, 0, static_cast<off_t>(file_bytes_)) != 0 && errno != EOPNOTSUPP) {
+        fail("fallocate");
+    }
+
+    auto zeros = io::BufferPool::global().acquire(kZeroChunk);
+    std::memset(zeros.data(), 0, kZeroChunk);
+    for (uint64_t off = 0; off < file_bytes_;) {
+        if (pool_stop_.load(std::memory_order_relaxed)) {
+            ::close(fd);
+            throw util::IOException("stopped");  // Left as .tmp, zeroed again next run
+        }
+        size_t len = static_cast<size_t>(std::min<uint64_t>(kZeroChunk, file_bytes_ - off));
+        ssize_t n = ::pwrite(fd, zeros.data(), len, static_cast<off_t>(off));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("zero");
+        }
+        off += static_cast<uint64_t>(n);
+    }
+    if (::fdatasync(fd) != 0) fail("sync");
+    ::close(fd);
+}
+
+} // namespace woved::storage
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "core/config.h"
+#include "io/rate-limiter.h"
+#include "io/uring-wrapper.h"
+#include "storage/wal/group-commit.h"
+#include "storage/wal/wal-codec.h"
+#include "storage/wal/wal-record.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+
+namespace woved::storage {
+
+// Write-ahead log with group commit. Writers claim space in the open unit
+// of a double-buffered, page-aligned log buffer (GroupCommitBuffer) and
+// build their frame there: a WALRecord is encoded in place from borrowed
+// request fields, so its vector is copied exactly once. One committer
+// thread seals the unit, opens the other, and submits the sealed unit as a
+// fixed-buffer write linked to fdatasync, then wakes the waiters. Under
+// load the next unit fills while the previous one syncs, so batching needs
+// no added delay.
+//
+// With compression on, each unit's frames are compressed together into one
+// outer frame (see WalCodec), unless that would not save space. Compressed
+// and O_DIRECT units are staged in the buffer's scratch area; the plain
+// buffered path writes straight from the unit.
+//
+// Files are wal-<seq>.log in the WAL directory, rotated at rotate_bytes.
+// A run never appends to an earlier file: a torn tail stays where it is
+// for recovery to stop at.
+//
+// With preallocation, a background thread keeps pool_files spare files
+// (wal-spare-<n>.log) fallocated and zero-filled to the full rotation size,
+// and rotation renames one into place. Appends then only overwrite blocks
+// that already exist, so fdatasync has no extent or size change to
+// journal. Logs that a checkpoint made obsolete (recycleBefore) are zeroed
+// and go back into the pool. Zeroed space reads as the end of the log.
+class WalManager {
+public:
+    struct Options {
+        std::string dir;
+        uint32_t group_commit_ms = 8;    // Max age of unsynced appends before a write
+        uint32_t fence_every_ms = 5;     // Zero-length fence frame cadence
+        uint32_t fsync_every_fences = 50;  // Sync at least this often without waiters
+        uint64_t rotate_bytes = 3221225472;  // 3 GiB
+        size_t unit_bytes = 4194304;     // Per group commit unit; caps one frame
+        bool direct_io = true;           // O_DIRECT; units are padded to whole blocks
+        unsigned ring_entries = 64;
+        // io.iouring (sqpoll, register_files, link_timeout_ms); its entries
+        // are ring_entries
+        io::UringWrapper::Options ring;
+        // Charged, never waited on, for every write (IOManager's WAL class)
+        std::shared_ptr<io::RateLimiter> limiter;
+        std::string compression = "none";  // Per-unit codec: none, lz4, zstd
+        int compression_level = 3;       // zstd
+        size_t dict_bytes = 65536;       // Trained zstd dictionary, 0 disables
+        bool preallocate = true;         // Rotate into preallocated, zeroed files
+        uint32_t pool_files = 2;         // Spare files kept ready
+
+        static Options fromConfig(const WALConfig& wal, const std::string& dir);
+        // Also takes the ring setup from io
+        static Options fromConfig(const Config& config, const std::string& dir);
+    };
+
+    struct Stats {
+        uint64_t units = 0;      // Group commit writes
+        uint64_t syncs = 0;
+        uint64_t frames = 0;
+        uint64_t fences = 0;
+        uint64_t bytes = 0;      // Bytes appended (excluding block padding)
+        uint64_t raw_bytes = 0;  // Frame bytes before compression
+        uint64_t compressed_units = 0;
+        uint64_t max_unit_frames = 0;
+        uint64_t file_seq = 0;
+        uint64_t pool_hits = 0;      // Rotations into a prepared spare
+        uint64_t pool_misses = 0;    // Rotations that had to create a file
+        uint64_t recycled_files = 0;
+    };
+
+    // A frame claimed in the open unit. Write the payload into payload(),
+    // then hand it to commit() or append() promptly: the committer waits
+    // for every claimed frame before writing the unit. A reservation
+    // destroyed unsubmitted is written as a padding frame.
+    class Reservation {
+    public:
+        Reservation(Reservation&& other) noexcept;
+        Reservation& operator=(Reservation&&) = delete;
+        ~Reservation();
+
+        std::span<std::byte> payload() const {
+            return {claim_.frame + sizeof(WalFrameHeader), size_};
+        }
+
+    private:
+        friend class WalManager;
+        Reservation(WalManager* wal, const GroupCommitBuffer::Claim& claim, size_t size)
+            : wal_(wal), claim_(claim), size_(size) {}
+
+        WalManager* wal_;
+        GroupCommitBuffer::Claim claim_;
+        size_t size_;
+    };
+
+    explicit WalManager(const Options& options);
+    ~WalManager();  // Commits what is claimed, then stops
+
+    WalManager(const WalManager&) = delete;
+    WalManager& operator=(const WalManager&) = delete;
+
+    // Claim room for a `payload_bytes` frame. Throws util::IOException if
+    // the log failed, util::InvalidArgumentException if it exceeds a unit.
+    Reservation reserve(size_t payload_bytes);
+
+    // Submit a filled reservation and block until it is durable. Throws
+    // util::IOException if the log failed.
+    void commit(Reservation&& reservation, Epoch epoch);
+
+    // Submit and return at once. It is written within group_commit_ms and
+    // synced with the next durable unit, or after at most
+    // fsync_every_fences fences.
+    void append(Reservation&& reservation, Epoch epoch);
+
+    // Encode `rec` straight into the log buffer (epoch from the record)
+    void commit(const WalRecordView& rec);
+    void append(const WalRecordView& rec);
+
+    // Already serialized payloads (copied into the log buffer)
+    void commit(std::span<const std::byte> payload, Epoch epoch);
+    void append(std::span<const std::byte> payload, Epoch epoch);
+
+    // Highest epoch of any synced frame
+    Epoch durableEpoch() const { return durable_epoch_.load(std::memory_order_acquire); }
+
+    // Highest epoch of any submitted frame; durable once durableEpoch()
+    // reaches it
+    Epoch submittedEpoch() const { return submitted_epoch_.load(std::memory_order_acquire); }
+
+    // Lowest epoch of a frame submitted but not yet synced, kLatestEpoch if
+    // none. Writers race into units, so a frame may wait behind synced
+    // frames of higher epochs. Covers every submit that returned before
+    // the call.
+    Epoch pendingEpoch() const;
+
+    // Checkpoint truncation: logs below `seq` (at most the open file, e.g.
+    // getStats().file_seq when the checkpoint began) are no longer needed
+    // for recovery. They are recycled into the pool, or deleted without
+    // preallocation. Returns the number of files released.
+    size_t recycleBefore(uint64_t seq);
+
+    Stats getStats() const;
+
+private:
+    static constexpr size_t kBlock = 4096;
+    static constexpr size_t kMinCompressBytes = 512;  // Smaller units are written raw
+    static constexpr unsigned kScratchIndex = 2;      // Registered buffer of the scratch
+
+    Options options_;
+    io::UringWrapper ring_;
+    WalCodec codec_;
+    GroupCommitBuffer buffer_;
+    std::thread committer_;
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> failed_{false};
+    std::atomic<Epoch> durable_epoch_{0};
+    std::atomic<Epoch> submitted_epoch_{0};
+    std::atomic<Epoch> unsynced_epoch_{kLatestEpoch};  // Lowest epoch written since the last sync
+
+    // Committer state
+    int fd_ = -1;
+    uint64_t file_seq_ = 0;
+    uint64_t file_end_ = 0;      // Logical end of the current file
+    size_t carry_ = 0;           // Partial tail block kept at the scratch start (direct I/O)
+    Epoch max_epoch_ = 0;        // Highest epoch written
+    Epoch fenced_epoch_ = 0;     // max_epoch_ at the last fence
+    uint32_t fences_since_sync_ = 0;
+    bool unsynced_ = false;      // Written since the last fdatasync
+    bool dict_pending_ = false;  // Current file lacks the dictionary frame
+    bool open_nonempty_ = false;
+    std::chrono::steady_clock::time_point last_fence_;
+    std::chrono::steady_clock::time_point open_since_;  // First claim in the open unit
+
+    // File pool (preallocation only)
+    uint64_t file_bytes_ = 0;       // Size of a preallocated file
+    std::thread preparer_;
+    std::mutex pool_mutex_;
+    std::condition_variable pool_cv_;
+    std::deque<std::string> ready_;  // Zeroed spares
+    std::deque<std::string> dirty_;  // Spares to zero, or to delete when the pool is full
+    uint64_t next_spare_ = 1;
+    std::atomic<bool> pool_stop_{false};
+
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+
+    static size_t scratchBytes(const Options& options, const WalCodec& codec);
+    static io::UringWrapper::Options ringOptions(const Options& options);
+    void submit(Reservation& reservation, Epoch epoch, bool durable);
+    void run();
+    void writeUnit(bool final, bool fence);
+    // Take a sealed unit's lowest epoch, pending until the next sync
+    void holdPending(CommitUnit& unit);
+    size_t compressUnit(const std::byte* data, size_t size, Epoch epoch);
+    void openNextFile();
+    int openFile(const std::string& path, bool create);
+    void closeFile();
+
+    void adoptSpares();
+    void preparePool();
+    void prepareSpare(const std::string& dirty);
+    std::string sparePath(bool ready);
+};
+
+} // namespace woved::storage
@@ -0,0 +1,467 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "util/intern-table.h"
+#include "util/vector-codec.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace woved::storage {
+
+// Operation values of schemas/wal-record.fbs
+enum class WalOp : uint8_t { UPSERT = 0, DELETE = 1, FENCE = 2 };
+
+// Borrowed fields of one WALRecord. Request handlers fill this with views
+// into the decoded request, so the vector goes from the request message
+// straight into the WAL buffer.
+struct WalRecordView {
+    WalOp op = WalOp::UPSERT;
+    std::string_view id;              // Omitted when empty (uuid collections)
+    VectorUuid uuid;                  // Omitted when nil
+    VectorIdHash id_hash = 0;
+    uint64_t tenant_ns_hash = 0;
+    uint64_t timestamp_nanos = 0;
+    std::span<const float> vector;    // fp32 at the API; encoded as element_type
+    ElementType element_type = ElementType::FP32;
+    std::span<const TagId> tags;
+    uint32_t flags = 0;
+    Epoch epoch = 0;
+    CentroidId centroid_id = 0;
+    std::string_view tenant;
+    std::string_view namespace_name;
+};
+
+// Writes a WALRecord as a FlatBuffer in place, front to back, with no
+// builder or intermediate buffer. The layout is fixed: root offset, a
+// vtable with every field, the table, then strings and vectors in field
+// order. Output is 4-byte aligned, 8-byte aligned at the start, and reads
+// with the generated WALRecord accessors.
+class WalRecordEncoder {
+public:
+    // Exact encoded size of `rec`
+    static size_t size(const WalRecordView& rec) {
+        size_t pos = kVarStart;
+        if (!rec.id.empty()) pos += stringBytes(rec.id.size());
+        if (hasVector(rec)) pos += vectorBytes(vectorDataBytes(rec));
+        pos += vectorBytes(rec.tags.size_bytes());
+        if (!rec.tenant.empty()) pos += stringBytes(rec.tenant.size());
+        if (!rec.namespace_name.empty()) pos += stringBytes(rec.namespace_name.size());
+        return pos;
+    }
+
+    // Encode into `out`, which holds at least size(rec) bytes and is
+    // 8-byte aligned. Returns the bytes written.
+    static size_t encode(const WalRecordView& rec, std::byte* out) {
+        std::memset(out, 0, kVarStart);
+        bool fp32 = rec.element_type == ElementType::FP32;
+        bool vec = hasVector(rec);
+
+        put<uint32_t>(out, 0, kTable);
+        uint16_t vtable[2 + kFields] = {
+            static_cast<uint16_t>(sizeof(vtable)),
+            kInlineBytes,
+            kOp,
+            rec.id.empty() ? uint16_t{0} : kId,
+            kIdHash,
+            kTenantNsHash,
+            kTimestamp,
+            kDim,
+            vec && fp32 ? kVector : uint16_t{0},
+            kTags,
+            kFlags,
+            kEpoch,
+            kCentroid,
+            rec.tenant.empty() ? uint16_t{0} : kTenant,
+            rec.namespace_name.empty() ? uint16_t{0} : kNamespace,
+            rec.uuid.isNil() ? uint16_t{0} : kUuid,
+            kElementType,
+            vec && !fp32 ? kVectorData : uint16_t{0},
+            kVectorScale,
+        };
+        std::memcpy(out + kVtable, vtable, sizeof(vtable));
+
+        put<int32_t>(out, kTable, static_cast<int32_t>(kTable - kVtable));
+        put<uint64_t>(out, kTable + kIdHash, rec.id_hash);
+        put<uint64_t>(out, kTable + kTenantNsHash, rec.tenant_ns_hash);
+        put<uint64_t>(out, kTable + kTimestamp, rec.timestamp_nanos);
+        put<uint64_t>(out, kTable + kEpoch, rec.epoch);
+        put<uint64_t>(out, kTable + kUuid, rec.uuid.hi);
+        put<uint64_t>(out, kTable + kUuid + 8, rec.uuid.lo);
+        put<uint32_t>(out, kTable + kFlags, rec.flags);
+        put<uint16_t>(out, kTable + kDim, static_cast<uint16_t>(rec.vector.size()));
+        put<uint16_t>(out, kTable + kCentroid, rec.centroid_id);
+        put<uint8_t>(out, kTable + kOp, static_cast<uint8_t>(rec.op));
+        put<uint8_t>(out, kTable + kElementType, static_cast<uint8_t>(rec.element_type));
+
+        size_t pos = kVarStart;
+        float scale = 1.0f;
+        if (!rec.id.empty()) pos = putString(out, pos, kId, rec.id);
+        if (vec) {
+            size_t field = fp32 ? kVector : kVectorData;
+            size_t count = fp32 ? rec.vector.size() : vectorDataBytes(rec);
+            linkField(out, field, pos);
+            put<uint32_t>(out, pos, static_cast<uint32_t>(count));
+            scale = util::encode_vector(rec.vector.data(), rec.vector.size(), rec.element_type,
+                                        out + pos + 4);
+            pos = pad(out, pos + 4 + vectorDataBytes(rec));
+        }
+        put<float>(out, kTable + kVectorScale, scale);
+
+        linkField(out, kTags, pos);
+        put<uint32_t>(out, pos, static_cast<uint32_t>(rec.tags.size()));
+        if (!rec.tags.empty()) std::memcpy(out + pos + 4, rec.tags.data(), rec.tags.size_bytes());
+        pos += 4 + rec.tags.size_bytes();
+
+        if (!rec.tenant.empty()) pos = putString(out, pos, kTenant, rec.tenant);
+        if (!rec.namespace_name.empty()) pos = putString(out, pos, kNamespace, rec.namespace_name);
+        return pos;
+    }
+
+private:
+    static constexpr size_t kFields = 17;
+    static constexpr uint32_t kVtable = 4;
+    static constexpr uint32_t kTable = 48;  // 8-aligned past the vtable
+
+    // Field offsets inside the table, widest first
+    static constexpr uint16_t kId = 4;
+    static constexpr uint16_t kIdHash = 8;
+    static constexpr uint16_t kTenantNsHash = 16;
+    static constexpr uint16_t kTimestamp = 24;
+    static constexpr uint16_t kEpoch = 32;
+    static constexpr uint16_t kUuid = 40;
+    static constexpr uint16_t kVector = 56;
+    static constexpr uint16_t kTags = 60;
+    static constexpr uint16_t kFlags = 64;
+    static constexpr uint16_t kTenant = 68;
+    static constexpr uint16_t kNamespace = 72;
+    static constexpr uint16_t kVectorData = 76;
+    static constexpr uint16_t kVectorScale = 80;
+    static constexpr uint16_t kDim = 84;
+    static constexpr uint16_t kCentroid = 86;
+    static constexpr uint16_t kOp = 88;
+    static constexpr uint16_t kElementType = 89;
+    static constexpr uint16_t kInlineBytes = 90;
+    static constexpr size_t kVarStart = (kTable + kInlineBytes + 3) & ~size_t{3};
+
+    static_assert(kVtable + 2 * (2 + kFields) <= kTable);
+
+    static bool hasVector(const WalRecordView& rec) {
+        return rec.op == WalOp::UPSERT && !rec.vector.empty();
+    }
+    static size_t vectorDataBytes(const WalRecordView& rec) {
+        return rec.vector.size() * util::element_size(rec.element_type);
+    }
+    static size_t stringBytes(size_t len) { return (4 + len + 1 + 3) & ~size_t{3}; }
+    static size_t vectorBytes(size_t bytes) { return (4 + bytes + 3) & ~size_t{3}; }
+
+    template <typename T>
+    static void put(std::byte* out, size_t pos, T value) {
+        std::memcpy(out + pos, &value, sizeof(T));
+    }
+
+    // uoffset from the field slot forward to `target`
+    static void linkField(std::byte* out, size_t field, size_t target) {
+        put<uint32_t>(out, kTable + field, static_cast<uint32_t>(target - (kTable + field)));
+    }
+
+    static size_t pad(std::byte* out, size_t pos) {
+        size_t end = (pos + 3) & ~size_t{3};
+        std::memset(out + pos, 0, end - pos);
+        return end;
+    }
+
+    static size_t putString(std::byte* out, size_t pos, size_t field, std::string_view s) {
+        linkField(out, field, pos);
+        put<uint32_t>(out, pos, static_cast<uint32_t>(s.size()));
+        std::memcpy(out + pos + 4, s.data(), s.size());
+        out[pos + 4 + s.size()] = std::byte{0};
+        return pad(out, pos + 4 + s.size() + 1);
+    }
+};
+
+// Bounds-checked reader for a WALRecord FlatBuffer, from WalRecordEncoder
+// or any FlatBuffers builder: fields are found through the vtable, and
+// absent fields read as their schema defaults.
+class WalRecordReader {
+public:
+    // Check the root offset, vtable and table bounds; false if malformed.
+    // Out-of-range strings and vectors read as empty.
+    bool parse(std::span<const std::byte> buf) {
+        buf_ = buf;
+        if (buf.size() < 8) return false;
+        return parseTable(buf, get<uint32_t>(0));
+    }
+
+    // The same for a record table at `root` inside a larger buffer (a
+    // WALBatch); its offsets may reach anywhere in `buf`
+    bool parseTable(std::span<const std::byte> buf, size_t root) {
+        buf_ = buf;
+        if (root % 4 != 0 || root + 4 > buf.size()) return false;
+        int64_t vtable = static_cast<int64_t>(root) - get<int32_t>(root);
+        if (vtable < 0 || vtable % 2 != 0 || static_cast<size_t>(vtable) + 4 > buf.size()) return false;
+        vtable_ = static_cast<size_t>(vtable);
+        vtable_size_ = get<uint16_t>(vtable_);
+        uint16_t table_size = get<uint16_t>(vtable_ + 2);
+        if (vtable_size_ < 4 || vtable_ + vtable_size_ > buf.size() || root + table_size > buf.size()) {
+            return false;
+        }
+        table_ = root;
+        table_size_ = table_size;
+        return true;
+    }
+
+    WalOp op() const { return static_cast<WalOp>(scalar<uint8_t>(kOp, 0)); }
+    std::string_view id() const { return string(kId); }
+    VectorIdHash idHash() const { return scalar<uint64_t>(kIdHash, 0); }
+    uint64_t tenantNsHash() const { return scalar<uint64_t>(kTenantNsHash, 0); }
+    uint64_t timestampNanos() const { return scalar<uint64_t>(kTimestamp, 0); }
+    size_t dim() const { return scalar<uint16_t>(kDim, 0); }
+    uint32_t flags() const { return scalar<uint32_t>(kFlags, 0); }
+    Epoch epoch() const { return scalar<uint64_t>(kEpoch, 0); }
+    CentroidId centroidId() const { return scalar<uint16_t>(kCentroid, 0); }
+    std::string_view tenant() const { return string(kTenant); }
+    std::string_view namespaceName() const { return string(kNamespace); }
+    ElementType elementType() const {
+        return static_cast<ElementType>(scalar<uint8_t>(kElementType, 0));
+    }
+    float vectorScale() const { return scalar<float>(kVectorScale, 1.0f); }
+
+    VectorUuid uuid() const {
+        size_t pos = field(kUuid, 16);
+        return pos ? VectorUuid{get<uint64_t>(pos), get<uint64_t>(pos + 8)} : VectorUuid{};
+    }
+
+    // Tags, copied out (the buffer need not be 4-byte aligned)
+    void tags(TagSet& out) const {
+        auto raw = vector(kTags, sizeof(TagId));
+        out.resize(raw.size() / sizeof(TagId));
+        if (!raw.empty()) std::memcpy(out.data(), raw.data(), raw.size());
+    }
+
+    // Vector as fp32, from `vector` or by decoding `vector_data`. False if
+    // the stored components do not cover dim().
+    bool decodeVector(Vector& out) const {
+        size_t d = dim();
+        auto fp32 = vector(kVector, sizeof(float));
+        if (!fp32.empty() || d == 0) {
+            if (fp32.size() != d * sizeof(float)) return false;
+            out.resize(d);
+            if (d > 0) std::memcpy(out.data(), fp32.data(), fp32.size());
+            return true;
+        }
+        ElementType type = elementType();
+        auto data = vector(kVectorData, 1);
+        if (data.size() != d * util::element_size(type)) return false;
+        out.resize(d);
+        util::decode_vector(data.data(), d, type, vectorScale(), out.data());
+        return true;
+    }
+
+    // An UPSERT or DELETE record as a buffer message, its tenant and
+    // namespace interned; false if the vector does not decode
+    bool decodeMessage(BTreeMessage& msg) const {
+        msg.op = op() == WalOp::DELETE ? OperationType::DELETE : OperationType::UPSERT;
+        msg.epoch = epoch();
+        msg.timestamp = std::chrono::duration_cast<Timestamp>(std::chrono::nanoseconds(timestampNanos()));
+
+        VectorEntry& entry = msg.entry;
+        entry.id.assign(id());
+        entry.uuid = uuid();
+        entry.id_hash = idHash();
+        entry.centroid_id = centroidId();
+        entry.created_at = entry.updated_at = msg.timestamp;
+        entry.deleted = msg.op == OperationType::DELETE;
+        if (entry.deleted) {
+            entry.vector.clear();
+        } else if (!decodeVector(entry.vector)) {
+            return false;
+        }
+        tags(entry.tags);
+        auto tenant_name = tenant();
+        auto ns = namespaceName();
+        entry.tenant = tenant_name.empty() ? 0 : util::InternTable::tenants().intern(tenant_name);
+        entry.namespace_id = ns.empty() ? 0 : util::InternTable::namespaces().intern(ns);
+        return true;
+    }
+
+private:
+    // vtable slots, in schema field order
+    enum Slot : size_t {
+        kOp, kId, kIdHash, kTenantNsHash, kTimestamp, kDim, kVector, kTags, kFlags, kEpoch,
+        kCentroid, kTenant, kNamespace, kUuid, kElementType, kVectorData, kVectorScale
+    };
+
+    std::span<const std::byte> buf_;
+    size_t vtable_ = 0;
+    size_t vtable_size_ = 0;
+    size_t table_ = 0;
+    size_t table_size_ = 0;
+
+    template <typename T>
+    T get(size_t pos) const {
+        T value;
+        std::memcpy(&value, buf_.data() + pos, sizeof(T));
+        return value;
+    }
+
+    // Absolute position of a `width`-byte field, 0 if absent or out of range
+    size_t field(size_t slot, size_t width) const {
+        size_t entry = 4 + 2 * slot;
+        if (entry + 2 > vtable_size_) return 0;
+        uint16_t offset = get<uint16_t>(vtable_ + entry);
+        if (offset == 0 || offset + width > table_size_) return 0;
+        return table_ + offset;
+    }
+
+    template <typename T>
+    T scalar(size_t slot, T def) const {
+        size_t pos = field(slot, sizeof(T));
+        return pos ? get<T>(pos) : def;
+    }
+
+    // Element bytes of a vector field (or string, without its terminator)
+    std::span<const std::byte> vector(size_t slot, size_t elem_size) const {
+        size_t pos = field(slot, 4);
+        if (!pos) return {};
+        size_t target = pos + get<uint32_t>(pos);
+        if (target + 4 > buf_.size()) return {};
+        size_t bytes = size_t{get<uint32_t>(target)} * elem_size;
+        if (bytes > buf_.size() - target - 4) return {};
+        return buf_.subspan(target + 4, bytes);
+    }
+
+    std::string_view string(size_t slot) const {
+        auto raw = vector(slot, 1);
+        return {reinterpret_cast<const char*>(raw.data()), raw.size()};
+    }
+};
+
+// Builds a WALBatch FlatBuffer (schemas/wal-record.fbs) from encoded
+// WALRecords. Each record is copied whole: it keeps its own vtable and
+// relative offsets, so the batch's records vector only points at each
+// record's table. The layout is fixed: root offset, vtable, the table
+// (records, fence_epoch), the offset vector, then the records, each
+// 8-byte aligned as WalRecordEncoder left it.
+class WalBatchEncoder {
+public:
+    // Copy one WALRecord buffer; false if it has no valid root offset
+    bool add(std::span<const std::byte> record) {
+        if (record.size() < 8) return false;
+        uint32_t root;
+        std::memcpy(&root, record.data(), sizeof(root));
+        if (root % 4 != 0 || root + 4 > record.size()) return false;
+        size_t at = body_.size();
+        roots_.push_back(at + root);
+        body_.resize(at + ((record.size() + 7) & ~size_t{7}));
+        std::memcpy(body_.data() + at, record.data(), record.size());
+        return true;
+    }
+
+    size_t size() const { return roots_.size(); }
+    bool empty() const { return roots_.empty(); }
+    // Size finish() will produce
+    size_t bytes() const { return bodyStart() + body_.size(); }
+
+    void clear() {
+        roots_.clear();
+        body_.clear();
+    }
+
+    // Write the batch into `out`, replacing its contents
+    void finish(Epoch fence_epoch, std::vector<std::byte>& out) const {
+        const size_t body = bodyStart();
+        out.assign(body + body_.size(), std::byte{0});
+        std::byte* p = out.data();
+        put<uint32_t>(p, 0, kTable);
+        const uint16_t vtable[4] = {8, 16, 4, 8};
+        std::memcpy(p + kVtable, vtable, sizeof(vtable));
+        put<int32_t>(p, kTable, static_cast<int32_t>(kTable - kVtable));
+        put<uint32_t>(p, kTable + 4, kVector - (kTable + 4));
+        put<uint64_t>(p, kTable + 8, fence_epoch);
+        put<uint32_t>(p, kVector, static_cast<uint32_t>(roots_.size()));
+        for (size_t i = 0; i < roots_.size(); ++i) {
+            const size_t slot = kVector + 4 + 4 * i;
+            put<uint32_t>(p, slot, static_cast<uint32_t>(body + roots_[i] - slot));
+        }
+        if (!body_.empty()) std::memcpy(p + body, body_.data(), body_.size());
+    }
+
+private:
+    static constexpr uint32_t kVtable = 4;
+    static constexpr uint32_t kTable = 16;
+    static constexpr uint32_t kVector = 32;
+
+    std::vector<size_t> roots_;  // Record tables, from the start of body_
+    std::vector<std::byte> body_;
+
+    size_t bodyStart() const { return (kVector + 4 + 4 * roots_.size() + 7) & ~size_t{7}; }
+
+    template <typename T>
+    static void put(std::byte* out, size_t pos, T value) {
+        std::memcpy(out + pos, &value, sizeof(T));
+    }
+};
+
+// Bounds-checked reader for a WALBatch FlatBuffer, from WalBatchEncoder or
+// any FlatBuffers builder
+class WalBatchReader {
+public:
+    bool parse(std::span<const std::byte> buf) {
+        buf_ = buf;
+        count_ = 0;
+        fence_epoch_ = 0;
+        if (buf.size() < 8) return false;
+        const uint32_t root = get<uint32_t>(0);
+        if (root % 4 != 0 || root + 4 > buf.size()) return false;
+        const int64_t vtable = static_cast<int64_t>(root) - get<int32_t>(root);
+        if (vtable < 0 || static_cast<size_t>(vtable) + 4 > buf.size()) return false;
+        const uint16_t vtable_size = get<uint16_t>(static_cast<size_t>(vtable));
+        const uint16_t table_size = get<uint16_t>(static_cast<size_t>(vtable) + 2);
+        if (static_cast<size_t>(vtable) + vtable_size > buf.size() || root + table_size > buf.size()) return false;
+        auto field = [&](size_t slot, size_t width) -> size_t {
+            const size_t entry = 4 + 2 * slot;
+            if (entry + 2 > vtable_size) return 0;
+            const uint16_t offset = get<uint16_t>(static_cast<size_t>(vtable) + entry);
+            return offset == 0 || offset + width > table_size ? 0 : root + offset;
+        };
+        if (size_t pos = field(1, 8)) fence_epoch_ = get<uint64_t>(pos);
+        if (size_t pos = field(0, 4)) {
+            const size_t vector = pos + get<uint32_t>(pos);
+            if (vector + 4 > buf.size()) return false;
+            const size_t count = get<uint32_t>(vector);
+            if (count > (buf.size() - vector - 4) / 4) return false;
+            vector_ = vector;
+            count_ = count;
+        }
+        return true;
+    }
+
+    size_t size() const { return count_; }
+    Epoch fenceEpoch() const { return fence_epoch_; }
+
+    // Point `out` at record `i`; false if it is malformed
+    bool record(size_t i, WalRecordReader& out) const {
+        const size_t slot = vector_ + 4 + 4 * i;
+        return out.parseTable(buf_, slot + get<uint32_t>(slot));
+    }
+
+private:
+    std::span<const std::byte> buf_;
+    size_t vector_ = 0;
+    size_t count_ = 0;
+    Epoch fence_epoch_ = 0;
+
+    template <typename T>
+    T get(size_t pos) const {
+        T value;
+        std::memcpy(&value, buf_.data() + pos, sizeof(T));
+        return value;
+    }
+};
+
+} // namespace woved::storage
@@ -0,0 +1,137 @@
+#include "wal-streams.h"
+#include "util/exceptions.h"
+#include "util/hash.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+namespace woved::storage {
+
+WalStreams::Options WalStreams::Options::fromConfig(const StorageConfig& storage) {
+    Options options;
+    options.dirs = directories(storage);
+    options.sharding = parseSharding(storage.wal.stream_sharding);
+    options.stream = WalManager::Options::fromConfig(storage.wal, options.dirs.front());
+    return options;
+}
+
+std::vector<std::string> WalStreams::directories(const StorageConfig& storage) {
+    if (storage.wal_dirs.empty()) return {storage.wal_dir};
+    return storage.wal_dirs;
+}
+
+std::vector<std::filesystem::path> WalStreams::logFiles(const std::string& dir) {
+    std::vector<std::pair<unsigned long long, std::filesystem::path>> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        unsigned long long seq = 0;
+        char tail = 0;
+        if (name.size() == 24 && std::sscanf(name.c_str(), "wal-%16llu.lo%c", &seq, &tail) == 2 &&
+            tail == 'g') {
+            files.emplace_back(seq, entry.path());
+        }
+    }
+    if (ec && ec != std::errc::no_such_file_or_directory) {
+        throw util::IOException("list WAL directory " + dir + ": " + ec.message());
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<std::filesystem::path> paths;
+    paths.reserve(files.size());
+    for (auto& [seq, path] : files) paths.push_back(std::move(path));
+    return paths;
+}
+
+WalStreams::Sharding WalStreams::parseSharding(const std::string& name) {
+    if (name == "id_hash") return Sharding::ID_HASH;
+    if (name == "tenant") return Sharding::TENANT;
+    throw util::ConfigException("Unknown WAL stream sharding: " + name);
+}
+
+WalStreams::WalStreams(const Options& options) : options_(options) {
+    if (options_.dirs.empty()) {
+        throw util::ConfigException("No WAL directories configured");
+    }
+    std::vector<std::string> normal;
+    for (const auto& dir : options_.dirs) {
+        auto path = std::filesystem::path(dir).lexically_normal();
+        normal.push_back((path.has_filename() ? path : path.parent_path()).string());
+    }
+    std::sort(normal.begin(), normal.end());
+    if (std::adjacent_find(normal.begin(), normal.end()) != normal.end()) {
+        throw util::ConfigException("WAL directories must be distinct");
+    }
+
+    streams_.reserve(options_.dirs.size());
+    for (const auto& dir : options_.dirs) {
+        WalManager::Options stream = options_.stream;
+        stream.dir = dir;
+        streams_.push_back(std::make_unique<WalManager>(stream));
+    }
+    if (streams_.size() > 1) {
+        LOG_INFO("WAL: {} streams, sharded by {}", streams_.size(),
+                 options_.sharding == Sharding::TENANT ? "tenant" : "id_hash");
+    }
+}
+
+size_t WalStreams::streamIndex(const WalRecordView& rec) const {
+    return streamIndex(rec.id_hash, rec.tenant);
+}
+
+size_t WalStreams::streamIndex(VectorIdHash id_hash, std::string_view tenant) const {
+    if (streams_.size() == 1) return 0;
+    // High bits: buffer shards and replay lanes use the low ones
+    uint64_t key = options_.sharding == Sharding::TENANT ? util::hash_id(tenant) : id_hash >> 32;
+    return static_cast<size_t>(key % streams_.size());
+}
+
+Epoch WalStreams::durableEpoch() const {
+    Epoch pending = kLatestEpoch;
+    Epoch durable = 0;
+    for (const auto& stream : streams_) {
+        // Pending first: anything it misses was synced before durableEpoch()
+        pending = std::min(pending, stream->pendingEpoch());
+        durable = std::max(durable, stream->durableEpoch());
+    }
+    return pending == kLatestEpoch ? durable : std::min(durable, pending - 1);
+}
+
+std::vector<uint64_t> WalStreams::fileSeqs() const {
+    std::vector<uint64_t> seqs;
+    seqs.reserve(streams_.size());
+    for (const auto& stream : streams_) seqs.push_back(stream->getStats().file_seq);
+    return seqs;
+}
+
+size_t WalStreams::recycleBefore(const std::vector<uint64_t>& seqs) {
+    if (seqs.size() != streams_.size()) {
+        throw util::InvalidArgumentException("recycleBefore: one file sequence per WAL stream");
+    }
+    size_t released = 0;
+    for (size_t i = 0; i < streams_.size(); ++i) released += streams_[i]->recycleBefore(seqs[i]);
+    return released;
+}
+
+WalManager::Stats WalStreams::getStats() const {
+    WalManager::Stats total;
+    for (const auto& stream : streams_) {
+        WalManager::Stats s = stream->getStats();
+        total.units += s.units;
+        total.syncs += s.syncs;
+        total.frames += s.frames;
+        total.fences += s.fences;
+        total.bytes += s.bytes;
+        total.raw_bytes += s.raw_bytes;
+        total.compressed_units += s.compressed_units;
+        total.max_unit_frames = std::max(total.max_unit_frames, s.max_unit_frames);
+        total.file_seq = std::max(total.file_seq, s.file_seq);
+        total.pool_hits += s.pool_hits;
+        total.pool_misses += s.pool_misses;
+        total.recycled_files += s.recycled_files;
+    }
+    return total;
+}
+
+} // namespace woved::storage
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "core/config.h"
+#include "storage/wal/wal-manager.h"
+#include "storage/wal/wal-record.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace woved::storage {
+
+// N independent WAL streams, one per directory (typically one per NVMe
+// device), so durable ingest scales with the number of devices. Each
+// stream is a full WalManager with its own group committer, fences, file
+// pool and rotation.
+//
+// Records are routed by id_hash (or by tenant), so every version of an id
+// lands in one stream in append order. Epochs stay global: the caller
+// assigns them before routing, and recovery merges the streams with
+// later-epoch-wins (see WalReplayer), whatever the interleaving.
+class WalStreams {
+public:
+    enum class Sharding { ID_HASH, TENANT };
+
+    struct Options {
+        std::vector<std::string> dirs;
+        Sharding sharding = Sharding::ID_HASH;
+        WalManager::Options stream;  // Per stream; dir comes from dirs
+
+        static Options fromConfig(const StorageConfig& storage);
+    };
+
+    // storage.wal_dirs, or storage.wal_dir alone when that is empty
+    static std::vector<std::string> directories(const StorageConfig& storage);
+
+    // wal-<seq>.log files of one stream directory, in sequence order (none
+    // if it does not exist). Throws util::IOException if it cannot be listed.
+    static std::vector<std::filesystem::path> logFiles(const std::string& dir);
+
+    // "id_hash" or "tenant"; throws util::ConfigException otherwise
+    static Sharding parseSharding(const std::string& name);
+
+    explicit WalStreams(const Options& options);
+
+    size_t size() const { return streams_.size(); }
+    WalManager& stream(size_t index) { return *streams_[index]; }
+    const WalManager& stream(size_t index) const { return *streams_[index]; }
+
+    // Stream of a record, and of an already serialized payload
+    size_t streamIndex(const WalRecordView& rec) const;
+    size_t streamIndex(VectorIdHash id_hash, std::string_view tenant) const;
+
+    void commit(const WalRecordView& rec) { streams_[streamIndex(rec)]->commit(rec); }
+    void append(const WalRecordView& rec) { streams_[streamIndex(rec)]->append(rec); }
+
+    // Every epoch at or below this that was submitted before the call is
+    // durable in its stream, whatever order the epochs reached the streams
+    // in: the lowest unsynced epoch of any stream holds it back. Streams
+    // with nothing unsynced do not.
+    Epoch durableEpoch() const;
+
+    // Open file of each stream; pass them back to recycleBefore() once a
+    // checkpoint that began at that point is complete
+    std::vector<uint64_t> fileSeqs() const;
+    size_t recycleBefore(const std::vector<uint64_t>& seqs);
+
+    // Summed over streams; file_seq is the highest
+    WalManager::Stats getStats() const;
+
+private:
+    Options options_;
+    std::vector<std::unique_ptr<WalManager>> streams_;
+};
+
+} // namespace woved::storage
@@ -0,0 +1,220 @@
+#include "wal-tailer.h"
+#include "storage/wal/group-commit.h"
+#include "storage/wal/wal-streams.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace woved::storage {
+
+namespace {
+
+// A frame of a full chunk is read again with a larger one, up to this
+constexpr size_t kMaxChunk = size_t{512} << 20;
+
+} // namespace
+
+WalTailer::WalTailer(const Options& options) : options_(options) {
+    options_.read_bytes = std::max<size_t>(options_.read_bytes, 65536);
+    for (const auto& dir : options_.dirs) {
+        auto stream = std::make_unique<Stream>();
+        stream->dir = dir;
+        streams_.push_back(std::move(stream));
+    }
+}
+
+WalTailer::~WalTailer() {
+    for (auto& stream : streams_) close(*stream);
+}
+
+WalTailer::Result WalTailer::read(WalBatchEncoder& batch, size_t max_bytes) {
+    Result result;
+    // A stream the batch fills before counts as behind
+    for (auto& stream : streams_) stream->at_end = false;
+    for (auto& stream : streams_) {
+        if (batch.bytes() >= max_bytes) break;
+        readStream(*stream, batch, max_bytes, result.records);
+    }
+
+    result.caught_up = true;
+    Epoch behind = kLatestEpoch;
+    Epoch seen = 0;
+    for (const auto& stream : streams_) {
+        seen = std::max(seen, stream->max_epoch);
+        if (!stream->at_end) {
+            result.caught_up = false;
+            behind = std::min(behind, stream->fence);
+        }
+    }
+    result.fence_epoch = std::max(options_.after, result.caught_up ? seen : behind);
+    return result;
+}
+
+void WalTailer::readStream(Stream& stream, WalBatchEncoder& batch, size_t max_bytes, size_t& added) {
+    bool last_look = false;  // A later file exists: this one is complete
+    while (batch.bytes() < max_bytes) {
+        if (stream.fd < 0 && !openNext(stream)) {
+            stream.at_end = true;
+            return;
+        }
+        if (stream.chunk.size() < options_.read_bytes) stream.chunk.resize(options_.read_bytes);
+
+        ssize_t n;
+        do {
+            n = ::pread(stream.fd, stream.chunk.data(), stream.chunk.size(), static_cast<off_t>(stream.offset));
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            throw util::IOException("read " + stream.path.string() + ": " + std::strerror(errno));
+        }
+
+        bool bad = false;
+        bool end = false;
+        const auto data = std::span<const std::byte>(stream.chunk.data(), static_cast<size_t>(n));
+        const size_t used = scanFrames(stream, data, true, batch, max_bytes, added, bad, end);
+        stream.offset += used;
+        stats_.bytes += used;
+        if (used > 0) {
+            last_look = false;
+            continue;
+        }
+        if (!bad && !end && static_cast<size_t>(n) == stream.chunk.size() && stream.chunk.size() < kMaxChunk) {
+            // One frame larger than the chunk
+            stream.chunk.resize(stream.chunk.size() * 2);
+            continue;
+        }
+
+        // At the end of what is written, or at a unit still landing
+        if (!last_look) {
+            if (!hasNext(stream)) {
+                stream.at_end = true;
+                return;
+            }
+            last_look = true;
+            continue;
+        }
+        if (!end) {
+            stats_.torn_files++;
+            LOG_WARN("WAL tail: {} ends in an invalid frame at offset {}, moving on", stream.path.string(),
+                     stream.offset);
+        }
+        close(stream);
+        last_look = false;
+    }
+}
+
+size_t WalTailer::scanFrames(Stream& stream, std::span<const std::byte> data, bool outer, WalBatchEncoder& batch,
+                             size_t max_bytes, size_t& added, bool& bad, bool& end) {
+    size_t pos = 0;
+    while (pos + sizeof(WalFrameHeader) <= data.size()) {
+        if (outer && batch.bytes() >= max_bytes) return pos;
+        WalFrameHeader hdr;
+        std::memcpy(&hdr, data.data() + pos, sizeof(hdr));
+        if (hdr.len == 0 && hdr.crc32c == 0 && hdr.epoch == 0) {
+            // Zeroed space after the last write
+            if (outer) {
+                end = true;
+            } else {
+                bad = true;
+            }
+            return pos;
+        }
+        if (hdr.size() > data.size() - pos - sizeof(hdr)) {
+            if (!outer) bad = true;
+            return pos;
+        }
+        auto payload = data.subspan(pos + sizeof(hdr), hdr.size());
+        if (hdr.codec() > WalCodec::PADDING ||
+            (options_.verify_checksums && WalFrameHeader::checksum(hdr.len, hdr.epoch, payload.data()) != hdr.crc32c)) {
+            bad = true;
+            return pos;
+        }
+
+        switch (hdr.codec()) {
+            case WalCodec::NONE:
+                if (hdr.size() == 0) {
+                    stream.fence = std::max(stream.fence, hdr.epoch);
+                } else if (hdr.epoch <= options_.after) {
+                    stats_.skipped++;
+                } else if (batch.add(payload)) {
+                    added++;
+                    stats_.records++;
+                }
+                stream.max_epoch = std::max(stream.max_epoch, hdr.epoch);
+                break;
+            case WalCodec::DICTIONARY:
+                stream.codec.loadDictionary(payload);
+                break;
+            case WalCodec::PADDING:
+                break;
+            default: {
+                // A compressed unit: its epoch is the newest inside it
+                if (!outer) {
+                    bad = true;
+                    return pos;
+                }
+                if (hdr.epoch <= options_.after) {
+                    stream.max_epoch = std::max(stream.max_epoch, hdr.epoch);
+                    break;
+                }
+                try {
+                    stream.codec.decompress(static_cast<WalCodec::Kind>(hdr.codec()), payload, stream.raw);
+                } catch (const util::IOException& e) {
+                    LOG_WARN("WAL tail: {}", e.what());
+                    bad = true;
+                    return pos;
+                }
+                bool inner_bad = false;
+                bool inner_end = false;
+                const size_t used =
+                    scanFrames(stream, stream.raw, false, batch, max_bytes, added, inner_bad, inner_end);
+                if (inner_bad || used < stream.raw.size()) {
+                    bad = true;
+                    return pos;
+                }
+                break;
+            }
+        }
+        // Writers fill whole strides, so padding cut off by the read is there
+        pos += WalFrameHeader::stride(hdr.size());
+    }
+    return pos;
+}
+
+bool WalTailer::openNext(Stream& stream) {
+    const std::string current = stream.path.filename().string();
+    for (const auto& path : WalStreams::logFiles(stream.dir)) {
+        // Names are fixed width, so they sort as their sequence numbers
+        if (!current.empty() && path.filename().string() <= current) continue;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT) continue;  // Recycled since it was listed
+            throw util::IOException("open " + path.string() + ": " + std::strerror(errno));
+        }
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        stream.fd = fd;
+        stream.path = path;
+        stream.offset = 0;
+        stats_.files++;
+        return true;
+    }
+    return false;
+}
+
+bool WalTailer::hasNext(const Stream& stream) const {
+    const std::string current = stream.path.filename().string();
+    for (const auto& path : WalStreams::logFiles(stream.dir)) {
+        if (path.filename().string() > current) return true;
+    }
+    return false;
+}
+
+void WalTailer::close(Stream& stream) {
+    if (stream.fd >= 0) ::close(stream.fd);
+    stream.fd = -1;
+}
+
+} // namespace woved::storage
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "include/woved/types.h"
+#include "storage/wal/wal-codec.h"
+#include "storage/wal/wal-record.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace woved::storage {
+
+// Follows the WAL as it is written, for shipping to follower replicas
+// (api::ReplicationServer). Each stream directory is read on its own, its
+// files in sequence order and its frames as they become readable, with
+// compressed units expanded and dictionary frames loaded as in
+// WalReplayer. A stream waits at zeroed space (the end of what is
+// written), at a frame cut short and at a frame whose checksum does not
+// match yet, since its unit may still be landing. Once a later file
+// exists the current one is complete: the stream reads it once more and
+// moves on, warning if it ended in an invalid frame.
+//
+// read() adds the records with epochs above `after` to a WALBatch and
+// returns its watermark: the lowest last fence of the streams still
+// behind, or once every stream has been read to its end, the highest
+// epoch seen. Every record at or below it that the log holds has been
+// shipped. Records of one stream keep their log order.
+//
+// Only what the group committer has written is read, so a follower never
+// sees a record the log does not hold, though it may see one before its
+// fdatasync. A new tailer starts from the oldest file there is; files a
+// checkpoint recycled (WalManager::recycleBefore) are gone, so a follower
+// that fell behind them resumes at the oldest file left.
+class WalTailer {
+public:
+    struct Options {
+        std::vector<std::string> dirs;  // WalStreams::directories
+        Epoch after = 0;                // Records at or below are not shipped
+        size_t read_bytes = 1048576;    // Per read of a stream
+        bool verify_checksums = true;
+    };
+
+    struct Result {
+        size_t records = 0;       // Added to the batch
+        Epoch fence_epoch = 0;    // Watermark, at least `after`
+        bool caught_up = false;   // Every stream read to its end
+    };
+
+    struct Stats {
+        uint64_t files = 0;
+        uint64_t torn_files = 0;  // Left behind at an invalid frame
+        uint64_t records = 0;     // Shipped
+        uint64_t skipped = 0;     // At or below `after`
+        uint64_t bytes = 0;       // Log bytes read
+    };
+
+    explicit WalTailer(const Options& options);
+    ~WalTailer();
+
+    WalTailer(const WalTailer&) = delete;
+    WalTailer& operator=(const WalTailer&) = delete;
+
+    // Add what the streams hold beyond the last read, until `batch` holds
+    // about max_bytes. Throws util::IOException if a file cannot be read.
+    Result read(WalBatchEncoder& batch, size_t max_bytes);
+
+    const Stats& getStats() const { return stats_; }
+
+private:
+    struct Stream {
+        std::string dir;
+        std::filesystem::path path;   // Current file; empty before the first
+        int fd = -1;
+        uint64_t offset = 0;          // Next frame of the current file
+        WalCodec codec{WalCodec::ZSTD, 0, 0};  // Decompression only
+        std::vector<std::byte> chunk;
+        std::vector<std::byte> raw;   // Expanded unit
+        Epoch fence = 0;              // Last fence frame
+        Epoch max_epoch = 0;          // Of any frame read
+        bool at_end = false;
+    };
+
+    Options options_;
+    std::vector<std::unique_ptr<Stream>> streams_;
+    Stats stats_;
+
+    // Read one stream until it waits or `batch` is full
+    void readStream(Stream& stream, WalBatchEncoder& batch, size_t max_bytes, size_t& added);
+    // Frames of `data` from its start, stopping (outer only) once `batch`
+    // holds max_bytes; returns the bytes of whole valid frames taken.
+    // `bad` is set at an invalid frame, `end` at zeroed space.
+    size_t scanFrames(Stream& stream, std::span<const std::byte> data, bool outer, WalBatchEncoder& batch,
+                      size_t max_bytes, size_t& added, bool& bad, bool& end);
+    // Open the file after the current one; false if there is none yet
+    bool openNext(Stream& stream);
+    bool hasNext(const Stream& stream) const;
+    void close(Stream& stream);
+};
+
+} // namespace woved::storage
@@ -0,0 +1,70 @@
+#ifndef WOVED_UTIL_CANCELLATION_H
+#define WOVED_UTIL_CANCELLATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace woved::util {
+
+/**
+ * @brief Cooperative cancellation of one request.
+ * * Tripped by cancel() (the client went away) or by its deadline passing
+ * * (query.timeout_ms). Work polls cancelled() at its natural boundaries,
+ * * such as a posting list or a read batch, and stops there with what it
+ * * has so far. Nothing is interrupted mid-step. Before the deadline a
+ * * poll costs one relaxed load and a clock read.
+ */
+class CancellationToken {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief No deadline; only cancel() trips it.
+     */
+    CancellationToken() = default;
+
+    explicit CancellationToken(Clock::time_point deadline) : deadline_(deadline) {}
+
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+
+    /**
+     * @brief A token whose deadline is `timeout` from now.
+     */
+    static CancellationToken after(std::chrono::milliseconds timeout) {
+        return CancellationToken(Clock::now() + timeout);
+    }
+
+    void cancel() noexcept { cancelled_.store(true, std::memory_order_relaxed); }
+
+    bool cancelled() const noexcept {
+        if (cancelled_.load(std::memory_order_relaxed)) return true;
+        if (deadline_ == Clock::time_point::max() || Clock::now() < deadline_) return false;
+        cancelled_.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool hasDeadline() const noexcept { return deadline_ != Clock::time_point::max(); }
+    Clock::time_point deadline() const noexcept { return deadline_; }
+
+    /**
+     * @brief Milliseconds left before the deadline, 0 once tripped;
+     * * UINT32_MAX without a deadline.
+     */
+    uint32_t remainingMs() const noexcept {
+        if (cancelled()) return 0;
+        if (!hasDeadline()) return UINT32_MAX;
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - Clock::now()).count();
+        return left <= 0 ? 0 : static_cast<uint32_t>(std::min<int64_t>(left, UINT32_MAX - 1));
+    }
+
+private:
+    Clock::time_point deadline_ = Clock::time_point::max();
+    mutable std::atomic<bool> cancelled_{false};
+};
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_CANCELLATION_H
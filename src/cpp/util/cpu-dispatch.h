@@ -0,0 +1,123 @@
+#ifndef WOVED_UTIL_CPU_DISPATCH_H
+#define WOVED_UTIL_CPU_DISPATCH_H
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace woved::util {
+
+/**
+ * @brief Instruction set levels that distance kernels are built for.
+ */
+enum class CpuLevel {
+    BASE,
+    AVX2,
+    AVX512,
+    NEON,
+    SVE
+};
+
+/**
+ * @brief CPU features relevant to kernel selection, detected once via CPUID
+ * * (HWCAP on ARM).
+ */
+struct CpuFeatures {
+    bool avx2 = false;
+    bool fma = false;
+    bool f16c = false;
+    bool avx512f = false;
+    bool avx512dq = false;
+    bool avx512bw = false;
+    bool avx512vl = false;
+    bool avx512vnni = false;  // vpdpbusd int8 dot products
+    bool avx512bf16 = false;  // vdpbf16ps
+    bool amx_tile = false;
+    bool amx_int8 = false;
+    bool amx_bf16 = false;
+    bool sse42 = false;    // crc32 instruction
+    bool pclmul = false;   // Carry-less multiply
+    bool clflushopt = false;  // Weakly ordered cache line flush
+    bool clwb = false;     // Cache line write-back without eviction
+    bool arm_crc = false;  // ARMv8 CRC32 extension
+    bool neon = false;     // AArch64 Advanced SIMD
+    bool sve = false;      // Scalable Vector Extension
+};
+
+/**
+ * @brief Returns the features of the host CPU.
+ * * Detection runs on first call and is cached for the process lifetime.
+ */
+inline const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = [] {
+        CpuFeatures f;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        f.avx2 = __builtin_cpu_supports("avx2");
+        f.fma = __builtin_cpu_supports("fma");
+        f.f16c = __builtin_cpu_supports("f16c");
+        f.avx512f = __builtin_cpu_supports("avx512f");
+        f.avx512dq = __builtin_cpu_supports("avx512dq");
+        f.avx512bw = __builtin_cpu_supports("avx512bw");
+        f.avx512vl = __builtin_cpu_supports("avx512vl");
+        f.avx512vnni = __builtin_cpu_supports("avx512vnni");
+        f.avx512bf16 = __builtin_cpu_supports("avx512bf16");
+        f.amx_tile = __builtin_cpu_supports("amx-tile");
+        f.amx_int8 = __builtin_cpu_supports("amx-int8");
+        f.amx_bf16 = __builtin_cpu_supports("amx-bf16");
+        f.sse42 = __builtin_cpu_supports("sse4.2");
+        f.pclmul = __builtin_cpu_supports("pclmul");
+        f.clflushopt = __builtin_cpu_supports("clflushopt");
+        f.clwb = __builtin_cpu_supports("clwb");
+#endif
+#if defined(__aarch64__) && defined(__linux__)
+        const unsigned long hwcap = getauxval(AT_HWCAP);
+        f.arm_crc = (hwcap & HWCAP_CRC32) != 0;
+        f.neon = (hwcap & HWCAP_ASIMD) != 0;
+        f.sve = (hwcap & HWCAP_SVE) != 0;
+#endif
+        return f;
+    }();
+    return features;
+}
+
+/**
+ * @brief Highest kernel level the host CPU can run.
+ */
+inline CpuLevel best_cpu_level() {
+    const auto& f = cpu_features();
+    if (f.avx512f && f.avx512dq) return CpuLevel::AVX512;
+    if (f.avx2 && f.fma && f.f16c) return CpuLevel::AVX2;
+    if (f.sve) return CpuLevel::SVE;
+    if (f.neon) return CpuLevel::NEON;
+    return CpuLevel::BASE;
+}
+
+/**
+ * @brief Asks the kernel for permission to use AMX tile data, which Linux
+ * * grants per process on request (arch_prctl ARCH_REQ_XCOMP_PERM); it
+ * * fails when the CPU or the OS does not enable the tile state.
+ * * Requested once; returns whether AMX kernels may run.
+ */
+inline bool request_amx() {
+    static const bool granted = [] {
+#if defined(__x86_64__) && defined(__linux__)
+        constexpr long kArchReqXcompPerm = 0x1023;
+        constexpr long kXfeatureXtiledata = 18;
+        if (!cpu_features().amx_tile) return false;
+        return syscall(SYS_arch_prctl, kArchReqXcompPerm, kXfeatureXtiledata) == 0;
+#else
+        return false;
+#endif
+    }();
+    return granted;
+}
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_CPU_DISPATCH_H
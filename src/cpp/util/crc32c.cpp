@@ -0,0 +1,238 @@
+#include "crc32c.h"
+#include "util/cpu-dispatch.h"
+#include <array>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#endif
+
+namespace woved::util {
+
+namespace {
+
+constexpr uint32_t kPoly = 0x82f63b78u;  // Reflected Castagnoli
+
+// GF(2) polynomial arithmetic modulo the CRC polynomial, in the reflected
+// bit order the register uses (bit 31 is x^0)
+constexpr uint32_t multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    while (true) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ kPoly : b >> 1;
+    }
+    return p;
+}
+
+// x^(2^k) mod p
+constexpr std::array<uint32_t, 64> make_x2n_table() {
+    std::array<uint32_t, 64> table{};
+    uint32_t p = 1u << 30;  // x^1
+    table[0] = p;
+    for (size_t k = 1; k < table.size(); ++k) table[k] = p = multmodp(p, p);
+    return table;
+}
+
+constexpr std::array<uint32_t, 64> kX2n = make_x2n_table();
+
+// x^n mod p
+constexpr uint32_t xpow(uint64_t n) {
+    uint32_t p = 1u << 31;  // x^0
+    for (size_t k = 0; n != 0; n >>= 1, ++k) {
+        if (n & 1) p = multmodp(kX2n[k], p);
+    }
+    return p;
+}
+
+// Register after `len` zero bytes: crc * x^(8 len) mod p
+uint32_t shift(uint32_t crc, size_t len) {
+    return multmodp(xpow(8 * static_cast<uint64_t>(len)), crc);
+}
+
+constexpr std::array<uint32_t, 256> make_table() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ kPoly : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> kTable = make_table();
+
+uint32_t update_table(uint32_t crc, const uint8_t* p, size_t len) {
+    for (size_t i = 0; i < len; ++i) crc = kTable[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+// The crc32 instruction has a latency of 3 cycles and a throughput of 1,
+// so one dependent chain runs at a third of its speed. Large inputs are
+// split into three streams checksummed in one loop, then merged by shifting
+// the first two past what follows them.
+//
+// With PCLMUL a shift costs one carry-less multiply, so short blocks pay
+// off. Without it, the shift is done in software and only long blocks are
+// interleaved.
+constexpr size_t kLongBlock = 8192;  // Per stream
+constexpr size_t kShortBlock = 256;
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint64_t crc_word(uint64_t crc, const uint8_t* p) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return _mm_crc32_u64(crc, word);
+}
+
+__attribute__((target("sse4.2")))
+uint32_t update_bytes_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) c = crc_word(c, p);
+    uint32_t c32 = static_cast<uint32_t>(c);
+    for (; len > 0; ++p, --len) c32 = _mm_crc32_u8(c32, *p);
+    return c32;
+}
+
+// Three `block`-byte streams at p; returns the register after all of them
+__attribute__((target("sse4.2")))
+inline void crc_streams(uint64_t& c0, uint64_t& c1, uint64_t& c2, const uint8_t* p, size_t block) {
+    for (size_t i = 0; i < block; i += 8) {
+        c0 = crc_word(c0, p + i);
+        c1 = crc_word(c1, p + block + i);
+        c2 = crc_word(c2, p + 2 * block + i);
+    }
+}
+
+// crc * x^(8 len) mod p for a fixed len: clmul by k = x^(8 len - 33), then
+// reduce the 64-bit product with one crc32 (which multiplies by x^32; the
+// reflected clmul adds the remaining x^1)
+struct ClmulShift {
+    uint64_t k;
+    explicit ClmulShift(size_t len) : k(xpow(8 * static_cast<uint64_t>(len) - 33)) {}
+
+    __attribute__((target("sse4.2,pclmul")))
+    uint32_t operator()(uint32_t crc) const {
+        __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)),
+                                               _mm_cvtsi64_si128(static_cast<long long>(k)), 0);
+        return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+    }
+};
+
+__attribute__((target("sse4.2")))
+uint32_t update_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t c0 = crc;
+    while (len >= 3 * kLongBlock) {
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        crc_streams(c0, c1, c2, p, kLongBlock);
+        c0 = shift(static_cast<uint32_t>(c0), 2 * kLongBlock) ^
+             shift(static_cast<uint32_t>(c1), kLongBlock) ^ c2;
+        p += 3 * kLongBlock;
+        len -= 3 * kLongBlock;
+    }
+    return update_bytes_sse42(static_cast<uint32_t>(c0), p, len);
+}
+
+__attribute__((target("sse4.2,pclmul")))
+uint32_t update_pclmul(uint32_t crc, const uint8_t* p, size_t len) {
+    static const ClmulShift long1(kLongBlock), long2(2 * kLongBlock);
+    static const ClmulShift short1(kShortBlock), short2(2 * kShortBlock);
+
+    uint64_t c0 = crc;
+    while (len >= 3 * kLongBlock) {
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        crc_streams(c0, c1, c2, p, kLongBlock);
+        c0 = long2(static_cast<uint32_t>(c0)) ^ long1(static_cast<uint32_t>(c1)) ^ c2;
+        p += 3 * kLongBlock;
+        len -= 3 * kLongBlock;
+    }
+    while (len >= 3 * kShortBlock) {
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        crc_streams(c0, c1, c2, p, kShortBlock);
+        c0 = short2(static_cast<uint32_t>(c0)) ^ short1(static_cast<uint32_t>(c1)) ^ c2;
+        p += 3 * kShortBlock;
+        len -= 3 * kShortBlock;
+    }
+    return update_bytes_sse42(static_cast<uint32_t>(c0), p, len);
+}
+#endif
+
+#if defined(__aarch64__)
+__attribute__((target("+crc")))
+uint32_t update_armv8(uint32_t crc, const uint8_t* p, size_t len) {
+    // crc32cx issues one per cycle; three streams hide its latency too
+    while (len >= 3 * kLongBlock) {
+        uint32_t c1 = 0;
+        uint32_t c2 = 0;
+        for (size_t i = 0; i < kLongBlock; i += 8) {
+            uint64_t w0, w1, w2;
+            std::memcpy(&w0, p + i, 8);
+            std::memcpy(&w1, p + kLongBlock + i, 8);
+            std::memcpy(&w2, p + 2 * kLongBlock + i, 8);
+            crc = __crc32cd(crc, w0);
+            c1 = __crc32cd(c1, w1);
+            c2 = __crc32cd(c2, w2);
+        }
+        crc = shift(crc, 2 * kLongBlock) ^ shift(c1, kLongBlock) ^ c2;
+        p += 3 * kLongBlock;
+        len -= 3 * kLongBlock;
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; len > 0; ++p, --len) crc = __crc32cb(crc, *p);
+    return crc;
+}
+#endif
+
+struct Impl {
+    const char* isa;
+    detail::Crc32cFn update;
+};
+
+const Impl& best_impl() {
+    static const Impl impl = [] {
+        [[maybe_unused]] const CpuFeatures& f = cpu_features();
+#if defined(__x86_64__)
+        if (f.sse42 && f.pclmul) return Impl{"sse4.2+pclmul", update_pclmul};
+        if (f.sse42) return Impl{"sse4.2", update_sse42};
+#endif
+#if defined(__aarch64__)
+        if (f.arm_crc) return Impl{"armv8-crc", update_armv8};
+#endif
+        return Impl{"table", update_table};
+    }();
+    return impl;
+}
+
+} // namespace
+
+namespace detail {
+
+Crc32cFn crc32c_update() {
+    return best_impl().update;
+}
+
+} // namespace detail
+
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b) {
+    return shift(crc_a, len_b) ^ crc_b;
+}
+
+const char* crc32c_isa() {
+    return best_impl().isa;
+}
+
+} // namespace woved::util
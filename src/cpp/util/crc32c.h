@@ -0,0 +1,50 @@
+#ifndef WOVED_UTIL_CRC32C_H
+#define WOVED_UTIL_CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace woved::util {
+
+namespace detail {
+
+/**
+ * @brief Raw CRC-32C register update (no pre/post inversion).
+ */
+using Crc32cFn = uint32_t (*)(uint32_t crc, const uint8_t* p, size_t len);
+
+/**
+ * @brief Fastest update function for the host, resolved on first use in
+ * * util/crc32c.cpp.
+ */
+Crc32cFn crc32c_update();
+
+} // namespace detail
+
+/**
+ * @brief CRC-32C (Castagnoli) of `len` bytes, as used by WAL frames and
+ * * segment chunks.
+ * * Runs on SSE4.2 crc32 with PCLMUL stream combining, SSE4.2 alone, the
+ * * ARMv8 CRC extension, or a table, picked once from cpu_features(). Pass
+ * * a previous result as `crc` to continue over several buffers.
+ */
+inline uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0) {
+    static const detail::Crc32cFn update = detail::crc32c_update();
+    return ~update(~crc, static_cast<const uint8_t*>(data), len);
+}
+
+/**
+ * @brief CRC-32C of A followed by B, from crc32c(A), crc32c(B) and the
+ * * length of B. Lets chunks be checksummed in parallel and verified as one.
+ */
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b);
+
+/**
+ * @brief Name of the implementation crc32c() uses ("sse4.2+pclmul",
+ * * "sse4.2", "armv8-crc" or "table"), for startup logs.
+ */
+const char* crc32c_isa();
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_CRC32C_H
@@ -0,0 +1,140 @@
+#ifndef WOVED_UTIL_EPOCH_RECLAIM_H
+#define WOVED_UTIL_EPOCH_RECLAIM_H
+
+#include "util/exceptions.h"
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <thread>
+
+namespace woved::util {
+
+/**
+ * @brief Grace periods for memory that lock-free readers may still touch.
+ * * Readers pin the current epoch in a per-thread, cache-line sized slot
+ * * (no shared writes on the read path). A writer that unlinked an object
+ * * calls synchronize(), which advances the epoch and waits until every
+ * * pinned reader has left or re-pinned, then frees it.
+ */
+class EpochDomain {
+public:
+    static constexpr size_t kMaxThreads = 4096;
+
+    class Guard {
+    public:
+        Guard() = default;
+        explicit Guard(std::atomic<uint64_t>* slot) : slot_(slot) {}
+        Guard(Guard&& other) noexcept : slot_(other.slot_) { other.slot_ = nullptr; }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        Guard& operator=(Guard&&) = delete;
+        ~Guard() {
+            if (slot_) slot_->store(kIdle, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<uint64_t>* slot_ = nullptr;
+    };
+
+    /**
+     * @brief Process-wide domain shared by lock-free structures.
+     */
+    static EpochDomain& global() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    /**
+     * @brief Enter a read-side section; nested pins are no-ops.
+     */
+    Guard pin() {
+        Slot& slot = localSlot();
+        if (slot.epoch.load(std::memory_order_relaxed) != kIdle) {
+            return Guard();
+        }
+        slot.epoch.store(epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        return Guard(&slot.epoch);
+    }
+
+    /**
+     * @brief Wait until no reader can still reference memory unlinked
+     * * before this call. Must not be called while pinned.
+     */
+    void synchronize() {
+        const uint64_t target = epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+        const size_t used = claimed_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < used; ++i) {
+            while (slots_[i].epoch.load(std::memory_order_seq_cst) < target) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /**
+     * @brief Grace ticket for memory unlinked now, for callers that must
+     * * not block in synchronize(). Keep the memory until passed() holds
+     * * for the ticket. Readers pinned after this call may hold it up too.
+     */
+    uint64_t defer() const { return epoch_.load(std::memory_order_seq_cst) + 1; }
+
+    /**
+     * @brief Whether every reader pinned before defer() returned `ticket`
+     * * has left. Advances the epoch to the ticket if needed; never waits.
+     * * Tickets grow with time, so a later ticket passing implies earlier
+     * * ones have.
+     */
+    bool passed(uint64_t ticket) {
+        uint64_t current = epoch_.load(std::memory_order_seq_cst);
+        while (current < ticket && !epoch_.compare_exchange_weak(current, ticket, std::memory_order_seq_cst)) {}
+        const size_t used = claimed_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < used; ++i) {
+            if (slots_[i].epoch.load(std::memory_order_seq_cst) < ticket) return false;
+        }
+        return true;
+    }
+
+private:
+    EpochDomain() : slots_(std::make_unique<Slot[]>(kMaxThreads)) {}
+
+    static constexpr uint64_t kIdle = std::numeric_limits<uint64_t>::max();
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{kIdle};
+        std::atomic<bool> owned{false};
+    };
+
+    // Claims a slot for the calling thread, handed back when it exits
+    Slot& localSlot() {
+        struct Registration {
+            Slot* slot = nullptr;
+            ~Registration() {
+                if (slot) slot->owned.store(false, std::memory_order_release);
+            }
+        };
+        thread_local Registration reg;
+        if (!reg.slot) reg.slot = claimSlot();
+        return *reg.slot;
+    }
+
+    Slot* claimSlot() {
+        for (size_t i = 0; i < kMaxThreads; ++i) {
+            bool expected = false;
+            if (slots_[i].owned.compare_exchange_strong(expected, true)) {
+                size_t used = claimed_.load(std::memory_order_relaxed);
+                while (used < i + 1 &&
+                       !claimed_.compare_exchange_weak(used, i + 1)) {}
+                return &slots_[i];
+            }
+        }
+        throw WovedException("epoch domain: too many reader threads");
+    }
+
+    std::atomic<uint64_t> epoch_{0};
+    std::atomic<size_t> claimed_{0};  // High-water mark of claimed slots
+    std::unique_ptr<Slot[]> slots_;
+};
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_EPOCH_RECLAIM_H
@@ -0,0 +1,58 @@
+#include "util/fault-point.h"
+#include "util/logging.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <signal.h>
+#include <unistd.h>
+
+namespace woved::util {
+
+namespace detail {
+std::atomic<bool> g_fault_armed{false};
+}
+
+namespace {
+
+// Set once before the handler is installed, read-only after
+char g_kill_at[64];
+
+void arm(int) {
+    detail::g_fault_armed.store(true, std::memory_order_relaxed);
+}
+
+} // namespace
+
+void detail::fault_point_slow(std::string_view name) {
+    if (name != g_kill_at) return;
+    // Async-signal-safe only from here: the process is going away
+    static constexpr char kMessage[] = "wovedd: fault point reached, killing\n";
+    (void)!::write(STDERR_FILENO, kMessage, sizeof(kMessage) - 1);
+    ::kill(::getpid(), SIGKILL);
+    ::_exit(137);
+}
+
+bool install_fault_points() {
+    const char* enabled = std::getenv("WOVED_FAULT_INJECTION");
+    const char* point = std::getenv("WOVED_KILL_AT");
+    if (!enabled || std::strcmp(enabled, "1") != 0 || !point || !*point) return false;
+    if (std::strlen(point) >= sizeof(g_kill_at)) {
+        LOG_WARN("fault injection: ignoring WOVED_KILL_AT of {} bytes", std::strlen(point));
+        return false;
+    }
+    std::strcpy(g_kill_at, point);
+
+    struct sigaction action {};
+    action.sa_handler = arm;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (::sigaction(SIGUSR1, &action, nullptr) != 0) {
+        LOG_WARN("fault injection: cannot install the SIGUSR1 handler: {}", std::strerror(errno));
+        return false;
+    }
+    LOG_WARN("fault injection: SIGUSR1 arms a kill at {}", g_kill_at);
+    return true;
+}
+
+} // namespace woved::util
@@ -0,0 +1,43 @@
+#ifndef WOVED_UTIL_FAULT_POINT_H
+#define WOVED_UTIL_FAULT_POINT_H
+
+#include <atomic>
+#include <string_view>
+
+namespace woved::util {
+
+namespace detail {
+extern std::atomic<bool> g_fault_armed;
+void fault_point_slow(std::string_view name);
+}
+
+/**
+ * @brief Named crash points for scripts/fault-inject.sh.
+ * * With WOVED_FAULT_INJECTION=1 and WOVED_KILL_AT=<name> in the
+ * * environment, install_fault_points() (called once at startup) arms on
+ * * SIGUSR1; the next thread to reach fault_point(<name>) then kills the
+ * * process with SIGKILL, mid-operation, leaving the data directory as a
+ * * power cut would. The points are wal_append (a group commit written,
+ * * not yet acknowledged), segment_flush (a delta segment written, not
+ * * yet sealed), compaction_merge (a merge output sealed, not yet
+ * * installed) and buffer_drain (a slice written by the flush sink, not
+ * * yet evicted from the buffer). The persistent allocator adds
+ * * pmem_logged (a redo log written, not committed), pmem_committed
+ * * (committed, not applied) and pmem_applied (applied, log not yet
+ * * retired). Unarmed, a point costs one relaxed load.
+ */
+inline void fault_point(std::string_view name) {
+    if (detail::g_fault_armed.load(std::memory_order_relaxed)) [[unlikely]] {
+        detail::fault_point_slow(name);
+    }
+}
+
+/**
+ * @brief Reads the environment and installs the SIGUSR1 handler; a no-op
+ * * unless WOVED_FAULT_INJECTION=1. Returns whether a point is set.
+ */
+bool install_fault_points();
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_FAULT_POINT_H
@@ -0,0 +1,61 @@
+#include "file-io.h"
+#include "util/exceptions.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace woved::util {
+
+void pwrite_all(int fd, const void* data, size_t len, uint64_t offset, const std::string& path) {
+    const auto* p = static_cast<const std::byte*>(data);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::pwrite(fd, p + done, len - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw IOException("write " + path + ": " + std::strerror(errno));
+        done += static_cast<size_t>(n);
+    }
+}
+
+void write_all(int fd, const void* data, size_t len, const std::string& path) {
+    const auto* p = static_cast<const std::byte*>(data);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::write(fd, p + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw IOException("write " + path + ": " + std::strerror(errno));
+        done += static_cast<size_t>(n);
+    }
+}
+
+void pread_all(int fd, void* data, size_t len, uint64_t offset, const std::string& path) {
+    auto* p = static_cast<std::byte*>(data);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::pread(fd, p + done, len - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw IOException("read " + path + ": " + (n < 0 ? std::strerror(errno) : "truncated"));
+        done += static_cast<size_t>(n);
+    }
+}
+
+void sync_directory(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) throw IOException("open directory " + dir + ": " + std::strerror(errno));
+    const int rc = ::fsync(fd);
+    const int err = errno;
+    ::close(fd);
+    if (rc != 0 && err != EINVAL) throw IOException("fsync directory " + dir + ": " + std::strerror(err));
+}
+
+void sync_parent_directory(const std::string& path) {
+    const auto slash = path.find_last_of('/');
+    if (slash == std::string::npos) {
+        sync_directory(".");
+    } else {
+        sync_directory(slash == 0 ? "/" : path.substr(0, slash));
+    }
+}
+
+} // namespace woved::util
@@ -0,0 +1,43 @@
+#ifndef WOVED_UTIL_FILE_IO_H
+#define WOVED_UTIL_FILE_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace woved::util {
+
+/**
+ * @brief Write all `len` bytes at `offset`, retrying short writes and
+ * * EINTR. Throws IOException ("write <path>: <error>") on failure;
+ * * `path` only names the file in the message.
+ */
+void pwrite_all(int fd, const void* data, size_t len, uint64_t offset, const std::string& path);
+
+/**
+ * @brief Write all `len` bytes at the file position, as pwrite_all().
+ */
+void write_all(int fd, const void* data, size_t len, const std::string& path);
+
+/**
+ * @brief Read exactly `len` bytes at `offset`, retrying short reads and
+ * * EINTR. Throws IOException on failure or if the file ends first.
+ */
+void pread_all(int fd, void* data, size_t len, uint64_t offset, const std::string& path);
+
+/**
+ * @brief Make entries created, renamed or removed in `dir` durable.
+ * * Throws IOException if it cannot be opened or synced; file systems
+ * * that cannot sync directories (EINVAL) are taken as already durable.
+ */
+void sync_directory(const std::string& dir);
+
+/**
+ * @brief sync_directory() of the directory holding `path`: "." for a
+ * * bare file name, "/" for an entry of the root.
+ */
+void sync_parent_directory(const std::string& path);
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_FILE_IO_H
@@ -0,0 +1,166 @@
+#include "hash.h"
+#include <array>
+#include <bit>
+#include <cstring>
+#include <utility>
+
+namespace woved::util {
+
+namespace {
+
+// XXH64 primes
+constexpr uint64_t kP1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kP2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kP3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t kP4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t kP5 = 0x27D4EB2F165667C5ULL;
+
+constexpr size_t kLanes = 4;
+
+// fn(0) .. fn(kLanes - 1), expanded at compile time so the lanes' state
+// stays in registers
+template <typename Fn, size_t... L>
+inline void each_lane(Fn&& fn, std::index_sequence<L...>) {
+    (fn(L), ...);
+}
+template <typename Fn>
+inline void each_lane(Fn&& fn) {
+    each_lane(fn, std::make_index_sequence<kLanes>{});
+}
+
+inline uint64_t read64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    if constexpr (std::endian::native == std::endian::big) v = __builtin_bswap64(v);
+    return v;
+}
+
+inline uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    if constexpr (std::endian::native == std::endian::big) v = __builtin_bswap32(v);
+    return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * kP2;
+    return std::rotl(acc, 31) * kP1;
+}
+
+inline uint64_t merge(uint64_t acc, uint64_t value) {
+    acc ^= round(0, value);
+    return acc * kP1 + kP4;
+}
+
+// XXH64 (seed 0) of kLanes inputs of `len` bytes each. Every step runs
+// across the lanes before the next, so the lanes' dependency chains
+// interleave.
+void xxh64_lanes(const std::array<const char*, kLanes>& in, size_t len, VectorIdHash* out) {
+    std::array<uint64_t, kLanes> h;
+    size_t at = 0;
+    if (len >= 32) {
+        std::array<uint64_t, kLanes> v1, v2, v3, v4;
+        each_lane([&](size_t l) {
+            v1[l] = kP1 + kP2;
+            v2[l] = kP2;
+            v3[l] = 0;
+            v4[l] = 0 - kP1;
+        });
+        for (; at + 32 <= len; at += 32) {
+            each_lane([&](size_t l) {
+                v1[l] = round(v1[l], read64(in[l] + at));
+                v2[l] = round(v2[l], read64(in[l] + at + 8));
+                v3[l] = round(v3[l], read64(in[l] + at + 16));
+                v4[l] = round(v4[l], read64(in[l] + at + 24));
+            });
+        }
+        each_lane([&](size_t l) {
+            uint64_t acc = std::rotl(v1[l], 1) + std::rotl(v2[l], 7) + std::rotl(v3[l], 12) +
+                           std::rotl(v4[l], 18);
+            acc = merge(acc, v1[l]);
+            acc = merge(acc, v2[l]);
+            acc = merge(acc, v3[l]);
+            h[l] = merge(acc, v4[l]);
+        });
+    } else {
+        h.fill(kP5);
+    }
+    each_lane([&](size_t l) { h[l] += len; });
+
+    for (; at + 8 <= len; at += 8) {
+        each_lane([&](size_t l) {
+            h[l] ^= round(0, read64(in[l] + at));
+            h[l] = std::rotl(h[l], 27) * kP1 + kP4;
+        });
+    }
+    if (at + 4 <= len) {
+        each_lane([&](size_t l) {
+            h[l] ^= uint64_t{read32(in[l] + at)} * kP1;
+            h[l] = std::rotl(h[l], 23) * kP2 + kP3;
+        });
+        at += 4;
+    }
+    for (; at < len; ++at) {
+        each_lane([&](size_t l) {
+            h[l] ^= uint64_t{static_cast<uint8_t>(in[l][at])} * kP5;
+            h[l] = std::rotl(h[l], 11) * kP1;
+        });
+    }
+    each_lane([&](size_t l) {
+        uint64_t x = h[l];
+        x ^= x >> 33;
+        x *= kP2;
+        x ^= x >> 29;
+        x *= kP3;
+        x ^= x >> 32;
+        out[l] = x;
+    });
+}
+
+} // namespace
+
+const char* id_hash_name(IdHashFunction function) {
+    switch (function) {
+        case IdHashFunction::kXxh64: return "xxh64";
+        case IdHashFunction::kXxh3: return "xxh3";
+    }
+    return "unknown";
+}
+
+void hash_ids(std::span<const VectorId> ids, std::span<VectorIdHash> out, IdHashFunction function) {
+    const size_t n = ids.size();
+    size_t i = 0;
+    if (function == IdHashFunction::kXxh64) {
+        while (i + kLanes <= n) {
+            const size_t len = ids[i].size();
+            if (ids[i + 1].size() != len || ids[i + 2].size() != len || ids[i + 3].size() != len) {
+                out[i] = hash_id(ids[i], function);
+                ++i;
+                continue;
+            }
+            xxh64_lanes({ids[i].data(), ids[i + 1].data(), ids[i + 2].data(), ids[i + 3].data()}, len,
+                        out.data() + i);
+            i += kLanes;
+        }
+    }
+    for (; i < n; ++i) out[i] = hash_id(ids[i], function);
+}
+
+void hash_uuids(std::span<const VectorUuid> uuids, std::span<VectorIdHash> out, IdHashFunction function) {
+    std::array<std::array<char, kUuidStringLength>, kLanes> text;
+    const size_t n = uuids.size();
+    size_t i = 0;
+    if (function == IdHashFunction::kXxh64) {
+        for (; i + kLanes <= n; i += kLanes) {
+            each_lane([&](size_t l) { format_uuid(uuids[i + l], text[l].data()); });
+            xxh64_lanes({text[0].data(), text[1].data(), text[2].data(), text[3].data()}, kUuidStringLength,
+                        out.data() + i);
+        }
+    }
+    for (; i < n; ++i) {
+        format_uuid(uuids[i], text[0].data());
+        out[i] = hash_id(std::string_view(text[0].data(), kUuidStringLength), function);
+    }
+}
+
+} // namespace woved::util
@@ -1,13 +1,37 @@
 #ifndef WOVED_UTIL_HASH_H
 #define WOVED_UTIL_HASH_H
 
+#include <span>
 #include <string_view>
 #include <cstdint>
 #include "core/types.h"
+#include "util/uuid-v7.h"
 #include "xxhash.h"
 
 namespace woved::util {
 
+/**
+ * @brief Hash functions an id can be routed by.
+ * * Id hashes are persisted (WAL records, segment row tables, restart
+ * * indexes), so files that store them record which function made them;
+ * * 0 in such a field means kXxh64, which every file written before the
+ * * field existed used.
+ */
+enum class IdHashFunction : uint16_t {
+    kXxh64 = 1,  // XXH64, seed 0
+    kXxh3 = 2,   // XXH3_64bits, seed 0
+};
+
+/**
+ * @brief The function hash_id() computes, and so the one routing uses.
+ */
+inline constexpr IdHashFunction kIdHashFunction = IdHashFunction::kXxh64;
+
+/**
+ * @brief Name of an id hash function ("xxh64", "xxh3"), for logs and errors.
+ */
+const char* id_hash_name(IdHashFunction function);
+
 /**
  * @brief Computes the 64-bit xxHash of a vector ID.
  * * This is the canonical hash function used for routing entries within the B-epsilon tree.
@@ -19,6 +43,64 @@ inline VectorIdHash hash_id(std::string_view id) {
     return XXH64(id.data(), id.length(), 0);
 }
 
+/**
+ * @brief Computes the hash of a vector ID with a given function.
+ * * @param id The vector ID to hash.
+ * @param function The hash function.
+ * @return The 64-bit hash value.
+ */
+inline VectorIdHash hash_id(std::string_view id, IdHashFunction function) {
+    return function == IdHashFunction::kXxh3 ? XXH3_64bits(id.data(), id.length())
+                                             : XXH64(id.data(), id.length(), 0);
+}
+
+/**
+ * @brief Hashes a batch of vector IDs: out[i] = hash_id(ids[i], function).
+ * * For kXxh64 the ids are hashed four at a time with their rounds
+ * * interleaved, so the multiply chains of different ids overlap instead
+ * * of running back to back; the values are bit-identical to XXH64. Runs
+ * * of equal-length ids, such as canonical UUID strings, take the
+ * * interleaved path; other lengths are hashed one at a time.
+ * * @param ids The vector IDs to hash.
+ * @param out Destination, at least ids.size() values.
+ * @param function The hash function.
+ */
+void hash_ids(std::span<const VectorId> ids, std::span<VectorIdHash> out,
+              IdHashFunction function = kIdHashFunction);
+
+/**
+ * @brief Computes the hash_id() of a binary UUID without allocating.
+ * * Equal to hash_id() of the canonical string, so binary and string forms
+ * * of the same id route identically.
+ * * @param uuid The vector UUID to hash.
+ * @return The 64-bit hash value.
+ */
+inline VectorIdHash hash_uuid(const VectorUuid& uuid) {
+    char text[kUuidStringLength];
+    format_uuid(uuid, text);
+    return hash_id(std::string_view(text, sizeof(text)));
+}
+
+/**
+ * @brief Hashes a batch of binary UUIDs: out[i] = hash_uuid(uuids[i]),
+ * * or the canonical string's hash under `function`.
+ * * @param uuids The vector UUIDs to hash.
+ * @param out Destination, at least uuids.size() values.
+ * @param function The hash function.
+ */
+void hash_uuids(std::span<const VectorUuid> uuids, std::span<VectorIdHash> out,
+                IdHashFunction function = kIdHashFunction);
+
+/**
+ * @brief Computes a second 64-bit hash of a vector ID, independent of hash_id().
+ * * Used to tell apart IDs whose hash_id() values collide.
+ * * @param id The vector ID to hash.
+ * @return The 64-bit hash value.
+ */
+inline uint64_t hash_id_secondary(std::string_view id) {
+    return XXH3_64bits_withSeed(id.data(), id.length(), 0x9E3779B97F4A7C15ULL);
+}
+
 } // namespace woved::util
 
 #endif // WOVED_UTIL_HASH_H
\ No newline at end of file
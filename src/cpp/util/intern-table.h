@@ -0,0 +1,153 @@
+#ifndef WOVED_UTIL_INTERN_TABLE_H
+#define WOVED_UTIL_INTERN_TABLE_H
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "util/exceptions.h"
+
+namespace woved::util {
+
+/**
+ * @brief Append-only dictionary of names to dense 32-bit ordinals.
+ * * Tenants, namespaces and tags are interned once at the API boundary; entries,
+ * * buffers and segments carry only the ordinal, so filters become integer
+ * * compares. Ordinal 0 is the empty name ("any" in filters). Ordinals are
+ * * never reused, and names() / restore() persist them across restarts.
+ */
+class InternTable {
+public:
+    using Ordinal = uint32_t;
+    static constexpr Ordinal kNone = 0;
+
+    InternTable() { names_.emplace_back(); }
+
+    InternTable(const InternTable&) = delete;
+    InternTable& operator=(const InternTable&) = delete;
+
+    /**
+     * @brief Process-wide tenant dictionary.
+     */
+    static InternTable& tenants() {
+        static InternTable table;
+        return table;
+    }
+
+    /**
+     * @brief Process-wide namespace dictionary.
+     */
+    static InternTable& namespaces() {
+        static InternTable table;
+        return table;
+    }
+
+    /**
+     * @brief Process-wide tag dictionary; ordinals are TagIds.
+     */
+    static InternTable& tags() {
+        static InternTable table;
+        return table;
+    }
+
+    /**
+     * @brief Ordinal of `name`, assigning the next one on first sight.
+     */
+    Ordinal intern(std::string_view name) {
+        if (name.empty()) return kNone;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = index_.find(name);
+            if (it != index_.end()) return it->second;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(name);
+        if (it != index_.end()) return it->second;
+        if (names_.size() > std::numeric_limits<Ordinal>::max()) {
+            throw WovedException("intern table full");
+        }
+        Ordinal ord = static_cast<Ordinal>(names_.size());
+        names_.emplace_back(name);
+        index_.emplace(names_.back(), ord);
+        return ord;
+    }
+
+    /**
+     * @brief Ordinal of an already interned name, without assigning one.
+     * * A query naming an unknown tenant can match nothing.
+     */
+    std::optional<Ordinal> find(std::string_view name) const {
+        if (name.empty()) return kNone;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(name);
+        if (it == index_.end()) return std::nullopt;
+        return it->second;
+    }
+
+    /**
+     * @brief Name of an ordinal (empty for kNone or unknown ordinals).
+     */
+    std::string name(Ordinal ord) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return ord < names_.size() ? names_[ord] : std::string();
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return names_.size() - 1;
+    }
+
+    /**
+     * @brief All names in ordinal order (index 0 is the empty name).
+     */
+    std::vector<std::string> names() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return {names_.begin(), names_.end()};
+    }
+
+    /**
+     * @brief Reload a names() snapshot so persisted ordinals resolve again.
+     * * Names already interned must match the start of the snapshot.
+     */
+    void restore(std::span<const std::string> names) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (names.empty() || !names[0].empty()) {
+            throw InvalidArgumentException("intern snapshot must start with the empty name");
+        }
+        for (size_t i = 1; i < names.size(); ++i) {
+            if (i < names_.size()) {
+                if (names_[i] != names[i]) {
+                    throw InvalidArgumentException("intern snapshot conflicts with '" +
+                                                   names_[i] + "'");
+                }
+                continue;
+            }
+            names_.push_back(names[i]);
+            index_.emplace(names_.back(), static_cast<Ordinal>(i));
+        }
+    }
+
+private:
+    struct Hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const {
+            return std::hash<std::string_view>{}(s);
+        }
+    };
+
+    mutable std::shared_mutex mutex_;
+    std::vector<std::string> names_;
+    // Keys are copies: names_ may reallocate
+    std::unordered_map<std::string, Ordinal, Hash, std::equal_to<>> index_;
+};
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_INTERN_TABLE_H
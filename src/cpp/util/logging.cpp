@@ -1,34 +1,335 @@
 #include "logging.h"
+#include "core/config.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
 #include "spdlog/sinks/basic_file_sink.h"
+#include "spdlog/sinks/rotating_file_sink.h"
+#include <fmt/args.h>
+#include <bit>
+#include <chrono>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace woved::util {
 
 static std::shared_ptr<spdlog::logger> global_logger;
 
+namespace {
+
+using detail::LogArg;
+using detail::LogEntry;
+
+// Per call site state of the rate limit, found by open addressing on the
+// format string pointer; a full table leaves new sites unlimited
+struct Site {
+    std::atomic<const char*> key{nullptr};
+    std::atomic<uint64_t> second{0};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> suppressed{0};
+};
+
+constexpr size_t kSites = 1024;
+constexpr size_t kProbes = 16;
+
+std::array<Site, kSites> g_sites;
+std::atomic<uint32_t> g_rate_limit{0};
+std::atomic<uint64_t> g_suppressed{0};
+
+Site* findSite(const char* key) {
+    size_t i = std::hash<const void*>{}(key) % kSites;
+    for (size_t n = 0; n < kProbes; ++n, i = (i + 1) % kSites) {
+        const char* seen = g_sites[i].key.load(std::memory_order_acquire);
+        if (seen == key) return &g_sites[i];
+        if (!seen && g_sites[i].key.compare_exchange_strong(seen, key)) return &g_sites[i];
+        if (seen == key) return &g_sites[i];
+    }
+    return nullptr;
+}
+
+// Multi-producer ring with one consumer (Vyukov's bounded queue): a slot
+// is free for position p when its seq is p, and ready when it is p + 1
+class AsyncWriter {
+public:
+    AsyncWriter(std::shared_ptr<spdlog::logger> logger, size_t entries)
+        : logger_(std::move(logger)),
+          mask_(std::bit_ceil(std::max<size_t>(entries, 2)) - 1),
+          ring_(std::make_unique<LogEntry[]>(mask_ + 1)) {
+        for (size_t i = 0; i <= mask_; ++i) ring_[i].seq.store(i, std::memory_order_relaxed);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    // Drains the ring and ends the writer thread. The ring itself stays:
+    // a producer that claimed a slot just before may still publish into it.
+    void stop() {
+        stopping_.store(true);
+        wake();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    LogEntry* claim(bool wait) {
+        uint64_t pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            LogEntry& entry = ring_[pos & mask_];
+            const uint64_t seq = entry.seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<int64_t>(seq - pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    entry.time = spdlog::log_clock::now();
+                    entry.thread = spdlog::details::os::thread_id();
+                    entry.used = 0;
+                    entry.nargs = 0;
+                    return &entry;
+                }
+            } else if (diff < 0 && !wait) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            } else if (diff < 0) {
+                wake();
+                std::this_thread::yield();
+                pos = tail_.load(std::memory_order_relaxed);
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void published() {
+        queued_.fetch_add(1, std::memory_order_relaxed);
+        wake();
+    }
+
+    // Until everything claimed so far is written and the sinks flushed
+    void flush() {
+        const uint64_t target = tail_.load();
+        flush_requested_.store(true);
+        wake();
+        for (uint64_t done = written_.load(); done < target; done = written_.load()) written_.wait(done);
+    }
+
+    uint64_t queued() const { return queued_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<spdlog::logger> logger_;
+    const size_t mask_;
+    std::unique_ptr<LogEntry[]> ring_;
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    alignas(64) std::atomic<uint64_t> signal_{0};
+    std::atomic<bool> waiting_{false};
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> flush_requested_{false};
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> queued_{0};
+    std::atomic<uint64_t> dropped_{0};
+    uint64_t head_ = 0;
+    uint64_t reported_drops_ = 0;
+    std::thread thread_;
+
+    // Producers pay for the wakeup only while the writer sleeps
+    void wake() {
+        signal_.fetch_add(1);
+        if (waiting_.load()) signal_.notify_one();
+    }
+
+    bool ready() const {
+        return ring_[head_ & mask_].seq.load(std::memory_order_acquire) == head_ + 1;
+    }
+
+    void run() {
+        while (true) {
+            bool urgent = false;
+            size_t batch = 0;
+            while (ready()) {
+                LogEntry& entry = ring_[head_ & mask_];
+                urgent |= entry.level >= logger_->flush_level();
+                write(entry);
+                entry.seq.store(head_ + mask_ + 1, std::memory_order_release);
+                ++head_;
+                ++batch;
+            }
+            reportDrops();
+            if (batch > 0 || flush_requested_.load()) {
+                if (urgent || flush_requested_.exchange(false)) {
+                    for (auto& sink : logger_->sinks()) sink->flush();
+                }
+                written_.store(head_);
+                written_.notify_all();
+                continue;
+            }
+            if (stopping_.load()) return;
+            const uint64_t seen = signal_.load();
+            waiting_.store(true);
+            if (!ready() && !stopping_.load() && !flush_requested_.load()) signal_.wait(seen);
+            waiting_.store(false);
+        }
+    }
+
+    void write(const LogEntry& entry) {
+        std::string text;
+        if (entry.format.empty()) {
+            text.assign(entry.data.data(), entry.used);
+        } else {
+            text = format(entry);
+        }
+        if (entry.suppressed) text += fmt::format(" [{} similar messages suppressed]", entry.suppressed);
+        sink(entry.level, entry.time, entry.thread, text);
+    }
+
+    void reportDrops() {
+        const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped == reported_drops_) return;
+        const std::string text = fmt::format("[{} log messages dropped: ring full]", dropped - reported_drops_);
+        reported_drops_ = dropped;
+        sink(spdlog::level::warn, spdlog::log_clock::now(), spdlog::details::os::thread_id(), text);
+    }
+
+    void sink(spdlog::level::level_enum level, spdlog::log_clock::time_point time, size_t thread,
+              std::string_view text) {
+        spdlog::details::log_msg msg(time, spdlog::source_loc{}, logger_->name(), level, text);
+        msg.thread_id = thread;
+        for (auto& sink : logger_->sinks()) {
+            if (!sink->should_log(level)) continue;
+            try {
+                sink->log(msg);
+            } catch (const std::exception&) {
+                // A failing sink must not stop the writer
+            }
+        }
+    }
+
+    static std::string format(const LogEntry& entry) {
+        fmt::dynamic_format_arg_store<fmt::format_context> store;
+        size_t at = 0;
+        auto next = [&](auto& value) {
+            at = (at + 7) & ~size_t{7};
+            std::memcpy(&value, entry.data.data() + at, sizeof(value));
+            at += sizeof(value);
+        };
+        for (size_t i = 0; i < entry.nargs; ++i) {
+            switch (entry.tags[i]) {
+                case LogArg::I64: { int64_t v; next(v); store.push_back(v); break; }
+                case LogArg::U64: { uint64_t v; next(v); store.push_back(v); break; }
+                case LogArg::F32: { float v; next(v); store.push_back(v); break; }
+                case LogArg::F64: { double v; next(v); store.push_back(v); break; }
+                case LogArg::Bool: { bool v; next(v); store.push_back(v); break; }
+                case LogArg::Char: { char v; next(v); store.push_back(v); break; }
+                case LogArg::Ptr: { const void* v; next(v); store.push_back(v); break; }
+                case LogArg::Str: {
+                    uint32_t len;
+                    next(len);
+                    store.push_back(std::string_view(entry.data.data() + at, len));
+                    at += len;
+                    break;
+                }
+            }
+        }
+        try {
+            return fmt::vformat(fmt::string_view(entry.format.data(), entry.format.size()), store);
+        } catch (const std::exception&) {
+            return "[log format error] " + std::string(entry.format);
+        }
+    }
+};
+
+std::mutex g_writer_mutex;           // init and shutdown
+std::atomic<AsyncWriter*> g_writer{nullptr};
+// Stopped writers are never freed, as logging threads may still hold
+// them; a message published to one after its stop is lost
+std::vector<std::unique_ptr<AsyncWriter>> g_writers;
+
+void stopWriter() {
+    std::lock_guard<std::mutex> lock(g_writer_mutex);
+    if (AsyncWriter* writer = g_writer.exchange(nullptr)) writer->stop();
+}
+
+spdlog::level::level_enum parseLevel(const std::string& level) {
+    auto parsed = spdlog::level::from_str(level);
+    // from_str maps unknown names to off
+    return parsed == spdlog::level::off && level != "off" ? spdlog::level::info : parsed;
+}
+
+} // namespace
+
+LogOptions LogOptions::fromConfig(const LoggingConfig& logging) {
+    LogOptions options;
+    options.level = parseLevel(logging.level);
+    options.console = logging.console;
+    options.file = logging.file;
+    options.max_file_bytes = static_cast<size_t>(logging.max_size_mb) << 20;
+    options.max_files = logging.max_files;
+    options.async = logging.async;
+    options.queue_entries = logging.async_queue;
+    options.rate_limit = logging.rate_limit_per_s;
+    return options;
+}
+
 void init_logging(spdlog::level::level_enum level, bool console_log, const std::string& file_path) {
+    LogOptions options;
+    options.level = level;
+    options.console = console_log;
+    options.file = file_path;
+    init_logging(options);
+}
+
+void init_logging(const LogOptions& options) {
+    stopWriter();
     std::vector<spdlog::sink_ptr> sinks;
-    
-    if (console_log) {
+
+    if (options.console) {
         sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
     }
-    
-    if (!file_path.empty()) {
-        sinks.push_back(std::make_shared<spdlog::sinks::basic_file_sink_mt>(file_path, true));
+
+    if (!options.file.empty() && options.max_file_bytes > 0) {
+        sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
+            options.file, options.max_file_bytes, std::max<size_t>(options.max_files, 1)));
+    } else if (!options.file.empty()) {
+        sinks.push_back(std::make_shared<spdlog::sinks::basic_file_sink_mt>(options.file, true));
     }
-    
+
     if (sinks.empty()) {
         // Default to console if no sinks are specified
         sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
     }
 
-    global_logger = std::make_shared<spdlog::logger>("woved", begin(sinks), end(sinks));
-    global_logger->set_level(level);
-    global_logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%^%l%$] [thread %t] %v");
-    
-    spdlog::register_logger(global_logger);
-    spdlog::set_default_logger(global_logger);
+    auto logger = std::make_shared<spdlog::logger>("woved", begin(sinks), end(sinks));
+    logger->set_level(options.level);
+    logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%^%l%$] [thread %t] %v");
+    logger->flush_on(spdlog::level::warn);
+
+    spdlog::drop("woved");
+    spdlog::register_logger(logger);
+    spdlog::set_default_logger(logger);
+    global_logger = logger;
+    g_rate_limit.store(options.rate_limit);
+
+    if (options.async) {
+        std::lock_guard<std::mutex> lock(g_writer_mutex);
+        g_writers.push_back(std::make_unique<AsyncWriter>(logger, options.queue_entries));
+        g_writer.store(g_writers.back().get());
+    }
+}
+
+void flush_logging() {
+    if (AsyncWriter* writer = g_writer.load(std::memory_order_acquire)) {
+        writer->flush();
+    } else if (global_logger) {
+        global_logger->flush();
+    }
+}
+
+void shutdown_logging() {
+    stopWriter();
+    if (global_logger) global_logger->flush();
+}
+
+LogStats log_stats() {
+    LogStats stats;
+    if (AsyncWriter* writer = g_writer.load(std::memory_order_acquire)) {
+        stats.queued = writer->queued();
+        stats.dropped = writer->dropped();
+    }
+    stats.suppressed = g_suppressed.load(std::memory_order_relaxed);
+    return stats;
 }
 
 std::shared_ptr<spdlog::logger>& get_logger() {
@@ -39,4 +340,44 @@ std::shared_ptr<spdlog::logger>& get_logger() {
     return global_logger;
 }
 
-} // namespace woved::util
\ No newline at end of file
+namespace detail {
+
+bool log_async() {
+    return g_writer.load(std::memory_order_acquire) != nullptr;
+}
+
+bool log_admit(const char* site, uint32_t& suppressed) {
+    const uint32_t limit = g_rate_limit.load(std::memory_order_relaxed);
+    if (limit == 0) return true;
+    Site* state = findSite(site);
+    if (!state) return true;
+    const auto now = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+    uint64_t second = state->second.load(std::memory_order_relaxed);
+    if (second != now && state->second.compare_exchange_strong(second, now, std::memory_order_relaxed)) {
+        state->count.store(0, std::memory_order_relaxed);
+    }
+    if (state->count.fetch_add(1, std::memory_order_relaxed) >= limit) {
+        state->suppressed.fetch_add(1, std::memory_order_relaxed);
+        g_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    suppressed = state->suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+LogEntry* log_claim(spdlog::level::level_enum level) {
+    AsyncWriter* writer = g_writer.load(std::memory_order_acquire);
+    return writer ? writer->claim(level >= spdlog::level::warn) : nullptr;
+}
+
+void log_publish(LogEntry* entry) {
+    // Its seq was the claimed position; one past it marks it ready
+    entry->seq.store(entry->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    if (AsyncWriter* writer = g_writer.load(std::memory_order_acquire)) writer->published();
+}
+
+} // namespace detail
+
+} // namespace woved::util
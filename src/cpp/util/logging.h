@@ -1,36 +1,228 @@
 #ifndef WOVED_UTIL_LOGGING_H
 #define WOVED_UTIL_LOGGING_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include "spdlog/spdlog.h"
 #include "spdlog/logger.h"
 
+namespace woved {
+struct LoggingConfig;
+}
+
 namespace woved::util {
 
+struct LogOptions {
+    spdlog::level::level_enum level = spdlog::level::info;
+    bool console = true;
+    std::string file;                // Empty: no log file
+    size_t max_file_bytes = 0;       // Rotate the file past this size; 0: never
+    size_t max_files = 10;           // Rotated files kept
+    bool async = false;              // Queue messages for a writer thread
+    size_t queue_entries = 8192;     // Ring slots, rounded up to a power of two
+    uint32_t rate_limit = 0;         // Messages per call site per second; 0: unlimited
+
+    /**
+     * @brief logging.level, file, max_size_mb, max_files, console, async,
+     * * async_queue and rate_limit_per_s.
+     */
+    static LogOptions fromConfig(const LoggingConfig& logging);
+};
+
+struct LogStats {
+    uint64_t queued = 0;      // Messages handed to the writer thread
+    uint64_t dropped = 0;     // Lost to a full ring
+    uint64_t suppressed = 0;  // Held back by the rate limit
+};
+
 /**
  * @brief Initializes the global logger for WOVeD.
  * * @param level The minimum log level to output.
  * @param console_log Whether to log to the console.
  * @param file_path Optional path to a log file.
  */
-void init_logging(spdlog::level::level_enum level = spdlog::level::info, 
-                  bool console_log = true, 
+void init_logging(spdlog::level::level_enum level = spdlog::level::info,
+                  bool console_log = true,
                   const std::string& file_path = "");
 
+/**
+ * @brief Initializes the global logger, optionally in async mode.
+ * * In async mode a logging thread only checks the level and the rate
+ * * limit, then copies the format string pointer and its arguments into a
+ * * preallocated slot of a lock-free ring; formatting and the sinks' I/O
+ * * happen on a background writer thread. Arguments other than numbers,
+ * * strings and void pointers are formatted at the call instead. When the
+ * * ring is full, debug and info messages are dropped rather than waiting,
+ * * and the writer reports how many were lost; warnings and errors wait
+ * * for a slot. Critical messages also wait until they are written.
+ * * The rate limit applies in both modes: past rate_limit messages in a
+ * * second, a call site's messages are counted and not written, and its
+ * * next written message says how many were held back.
+ */
+void init_logging(const LogOptions& options);
+
+/**
+ * @brief Write out every queued message and flush the sinks.
+ */
+void flush_logging();
+
+/**
+ * @brief Stop the async writer after draining it; later messages are
+ * * written synchronously.
+ */
+void shutdown_logging();
+
+LogStats log_stats();
+
 /**
  * @brief Retrieves the global logger instance.
  * * @return A shared pointer to the spdlog logger.
  */
 std::shared_ptr<spdlog::logger>& get_logger();
 
+namespace detail {
+
+enum class LogArg : uint8_t { I64, U64, F32, F64, Bool, Char, Str, Ptr };
+
+// One ring slot: a message as its format string and encoded arguments,
+// or as formatted text when `format` is empty
+struct LogEntry {
+    static constexpr size_t kMaxArgs = 12;
+    static constexpr size_t kDataBytes = 384;
+
+    std::atomic<uint64_t> seq{0};
+    spdlog::log_clock::time_point time;
+    size_t thread = 0;
+    std::string_view format;
+    spdlog::level::level_enum level = spdlog::level::info;
+    uint32_t suppressed = 0;
+    uint16_t used = 0;
+    uint8_t nargs = 0;
+    std::array<LogArg, kMaxArgs> tags{};
+    alignas(8) std::array<char, kDataBytes> data{};
+
+    bool put(LogArg tag, const void* value, size_t bytes) {
+        const size_t at = (used + 7) & ~size_t{7};
+        if (nargs == kMaxArgs || at + bytes > kDataBytes) return false;
+        std::memcpy(data.data() + at, value, bytes);
+        used = static_cast<uint16_t>(at + bytes);
+        tags[nargs++] = tag;
+        return true;
+    }
+    bool putString(std::string_view s) {
+        const auto len = static_cast<uint32_t>(s.size());
+        const size_t at = (used + 7) & ~size_t{7};
+        if (nargs == kMaxArgs || at + sizeof(len) + len > kDataBytes) return false;
+        std::memcpy(data.data() + at, &len, sizeof(len));
+        std::memcpy(data.data() + at + sizeof(len), s.data(), len);
+        used = static_cast<uint16_t>(at + sizeof(len) + len);
+        tags[nargs++] = LogArg::Str;
+        return true;
+    }
+};
+
+bool log_async();
+// Rate limit of the call site `site`; `suppressed` is set to the messages
+// it held back since the site last wrote one
+bool log_admit(const char* site, uint32_t& suppressed);
+// A free slot. When the ring is full, a warning or worse waits for one;
+// anything less gets null and is dropped.
+LogEntry* log_claim(spdlog::level::level_enum level);
+void log_publish(LogEntry* entry);
+
+template <typename T>
+bool encode(LogEntry& entry, const T& value) {
+    using U = std::remove_cv_t<std::remove_reference_t<T>>;
+    if constexpr (std::is_same_v<U, bool>) {
+        return entry.put(LogArg::Bool, &value, sizeof(bool));
+    } else if constexpr (std::is_same_v<U, char>) {
+        return entry.put(LogArg::Char, &value, sizeof(char));
+    } else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+        const auto v = static_cast<int64_t>(value);
+        return entry.put(LogArg::I64, &v, sizeof(v));
+    } else if constexpr (std::is_integral_v<U>) {
+        const auto v = static_cast<uint64_t>(value);
+        return entry.put(LogArg::U64, &v, sizeof(v));
+    } else if constexpr (std::is_same_v<U, float>) {
+        return entry.put(LogArg::F32, &value, sizeof(float));
+    } else if constexpr (std::is_same_v<U, double>) {
+        return entry.put(LogArg::F64, &value, sizeof(double));
+    } else if constexpr (std::is_same_v<U, void*> || std::is_same_v<U, const void*>) {
+        const void* v = value;
+        return entry.put(LogArg::Ptr, &v, sizeof(v));
+    } else if constexpr (std::is_same_v<U, const char*> || std::is_same_v<U, char*>) {
+        return value != nullptr && entry.putString(value);
+    } else if constexpr (std::is_convertible_v<const U&, std::string_view>) {
+        return entry.putString(std::string_view(value));
+    } else {
+        return false;
+    }
+}
+
+// `format` was checked against the arguments at compile time
+template <typename... Args>
+void log_deferred(LogEntry& entry, std::string_view format, const Args&... args) {
+    if ((encode(entry, args) && ...)) {
+        entry.format = format;
+        return;
+    }
+    // Something the writer cannot rebuild: format it here
+    entry.format = {};
+    entry.nargs = 0;
+    try {
+        const auto out = fmt::format_to_n(entry.data.data(), entry.data.size(), fmt::runtime(format), args...);
+        entry.used = static_cast<uint16_t>(std::min(out.size, entry.data.size()));
+    } catch (const std::exception&) {
+        static constexpr std::string_view kFailed = "[log format error]";
+        std::memcpy(entry.data.data(), kFailed.data(), kFailed.size());
+        entry.used = static_cast<uint16_t>(kFailed.size());
+    }
+}
+
+} // namespace detail
+
+template <typename... Args>
+void log(spdlog::level::level_enum level, spdlog::format_string_t<Args...> format, Args&&... args) {
+    auto& logger = get_logger();
+    if (!logger->should_log(level)) return;
+    const fmt::string_view text = format;
+    uint32_t suppressed = 0;
+    if (!detail::log_admit(text.data(), suppressed)) return;
+    if (detail::log_async()) {
+        if (detail::LogEntry* entry = detail::log_claim(level)) {
+            entry->level = level;
+            entry->suppressed = suppressed;
+            detail::log_deferred(*entry, std::string_view(text.data(), text.size()), args...);
+            detail::log_publish(entry);
+        }
+        if (level >= spdlog::level::critical) flush_logging();
+        return;
+    }
+    if (suppressed == 0) {
+        logger->log(level, format, std::forward<Args>(args)...);
+    } else {
+        logger->log(level, "{} [{} similar messages suppressed]", fmt::format(format, std::forward<Args>(args)...),
+                    suppressed);
+    }
+}
+
 } // namespace woved::util
 
 // Convenience macros for logging
-#define LOG_TRACE(...)    ::woved::util::get_logger()->trace(__VA_ARGS__)
-#define LOG_DEBUG(...)    ::woved::util::get_logger()->debug(__VA_ARGS__)
-#define LOG_INFO(...)     ::woved::util::get_logger()->info(__VA_ARGS__)
-#define LOG_WARN(...)     ::woved::util::get_logger()->warn(__VA_ARGS__)
-#define LOG_ERROR(...)    ::woved::util::get_logger()->error(__VA_ARGS__)
-#define LOG_CRITICAL(...) ::woved::util::get_logger()->critical(__VA_ARGS__)
-
-#endif // WOVED_UTIL_LOGGING_H
\ No newline at end of file
+#define LOG_TRACE(...)    ::woved::util::log(::spdlog::level::trace, __VA_ARGS__)
+#define LOG_DEBUG(...)    ::woved::util::log(::spdlog::level::debug, __VA_ARGS__)
+#define LOG_INFO(...)     ::woved::util::log(::spdlog::level::info, __VA_ARGS__)
+#define LOG_WARN(...)     ::woved::util::log(::spdlog::level::warn, __VA_ARGS__)
+#define LOG_ERROR(...)    ::woved::util::log(::spdlog::level::err, __VA_ARGS__)
+#define LOG_CRITICAL(...) ::woved::util::log(::spdlog::level::critical, __VA_ARGS__)
+
+#endif // WOVED_UTIL_LOGGING_H
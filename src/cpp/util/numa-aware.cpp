@@ -0,0 +1,242 @@
+#include "numa-aware.h"
+#include "util/exceptions.h"
+#include "util/logging.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <hwloc.h>
+#include <pthread.h>
+#include <sched.h>
+
+namespace woved::util {
+
+namespace {
+
+struct Topology {
+    std::vector<int> cpu_node;  // CPU -> node
+    size_t nodes = 1;
+};
+
+// Parse a sysfs cpulist such as "0-3,8,10-11"
+std::vector<int> parse_cpulist(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty()) continue;
+        auto dash = range.find('-');
+        int lo = std::stoi(range.substr(0, dash));
+        int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+        for (int cpu = lo; cpu <= hi; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+const Topology& topology() {
+    static const Topology topo = [] {
+        Topology t;
+        t.cpu_node.assign(std::max(1u, std::thread::hardware_concurrency()), 0);
+
+        for (int node = 0;; ++node) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!in) break;
+
+            std::string list;
+            std::getline(in, list);
+            for (int cpu : parse_cpulist(list)) {
+                if (static_cast<size_t>(cpu) >= t.cpu_node.size()) {
+                    t.cpu_node.resize(cpu + 1, 0);
+                }
+                t.cpu_node[cpu] = node;
+            }
+            t.nodes = node + 1;
+        }
+        return t;
+    }();
+    return topo;
+}
+
+// hwloc topology for memory binding, loaded once; null if hwloc fails
+hwloc_topology_t hwlocTopology() {
+    static hwloc_topology_t topo = [] () -> hwloc_topology_t {
+        hwloc_topology_t t;
+        if (hwloc_topology_init(&t) != 0) return nullptr;
+        if (hwloc_topology_load(t) != 0) {
+            hwloc_topology_destroy(t);
+            return nullptr;
+        }
+        return t;
+    }();
+    return topo;
+}
+
+hwloc_obj_t hwlocNode(hwloc_topology_t topo, int node) {
+    // NUMA node objects are numbered by hwloc; match the OS (sysfs) index
+    for (hwloc_obj_t obj = hwloc_get_next_obj_by_type(topo, HWLOC_OBJ_NUMANODE, nullptr); obj;
+         obj = hwloc_get_next_obj_by_type(topo, HWLOC_OBJ_NUMANODE, obj)) {
+        if (static_cast<int>(obj->os_index) == node) return obj;
+    }
+    return nullptr;
+}
+
+// "0-3,8,10-11"
+std::string format_cpulist(const std::vector<int>& cpus) {
+    std::string out;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) ++j;
+        if (!out.empty()) out += ',';
+        out += std::to_string(cpus[i]);
+        if (j > i) out += "-" + std::to_string(cpus[j]);
+        i = j + 1;
+    }
+    return out;
+}
+
+bool set_affinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    if (CPU_COUNT(&set) == 0) return false;
+    return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+}
+
+std::mutex g_placement_mutex;
+std::map<std::string, std::string> g_placements;
+
+} // namespace
+
+int current_cpu() {
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu;
+}
+
+size_t cpu_count() {
+    return topology().cpu_node.size();
+}
+
+size_t numa_node_count() {
+    return topology().nodes;
+}
+
+int numa_node_of_cpu(int cpu) {
+    const auto& t = topology();
+    return cpu >= 0 && static_cast<size_t>(cpu) < t.cpu_node.size() ? t.cpu_node[cpu] : 0;
+}
+
+void* numa_alloc_on_node(size_t bytes, int node) {
+    hwloc_topology_t topo = hwlocTopology();
+    if (!topo) return nullptr;
+    void* data = hwloc_alloc(topo, std::max<size_t>(bytes, 1));
+    if (!data) return nullptr;
+    if (hwloc_obj_t obj = hwlocNode(topo, node)) {
+        hwloc_set_area_membind(topo, data, std::max<size_t>(bytes, 1), obj->nodeset, HWLOC_MEMBIND_BIND,
+                               HWLOC_MEMBIND_BYNODESET);
+    }
+    return data;
+}
+
+void numa_free(void* data, size_t bytes) {
+    if (data) hwloc_free(hwlocTopology(), data, std::max<size_t>(bytes, 1));
+}
+
+MemoryPolicy parse_memory_policy(const std::string& name) {
+    if (name == "local" || name.empty()) return MemoryPolicy::Local;
+    if (name == "bind") return MemoryPolicy::Bind;
+    if (name == "interleave") return MemoryPolicy::Interleave;
+    if (name == "preferred") return MemoryPolicy::Preferred;
+    throw ConfigException("Unknown NUMA memory policy: " + name);
+}
+
+const char* memory_policy_name(MemoryPolicy policy) {
+    switch (policy) {
+        case MemoryPolicy::Local: return "local";
+        case MemoryPolicy::Bind: return "bind";
+        case MemoryPolicy::Interleave: return "interleave";
+        case MemoryPolicy::Preferred: return "preferred";
+    }
+    return "unknown";
+}
+
+bool numa_set_policy(void* data, size_t bytes, MemoryPolicy policy, int node) {
+    hwloc_topology_t topo = hwlocTopology();
+    if (!topo || !data || bytes == 0 || policy == MemoryPolicy::Local || numa_node_count() < 2) return false;
+    if (policy == MemoryPolicy::Interleave) {
+        return hwloc_set_area_membind(topo, data, bytes, hwloc_topology_get_topology_nodeset(topo),
+                                      HWLOC_MEMBIND_INTERLEAVE, HWLOC_MEMBIND_BYNODESET) == 0;
+    }
+    hwloc_obj_t obj = hwlocNode(topo, node < 0 ? current_numa_node() : node);
+    if (!obj) return false;
+    // Without STRICT, hwloc binds as the kernel's preferred policy
+    const int flags = HWLOC_MEMBIND_BYNODESET | (policy == MemoryPolicy::Bind ? HWLOC_MEMBIND_STRICT : 0);
+    return hwloc_set_area_membind(topo, data, bytes, obj->nodeset, HWLOC_MEMBIND_BIND, flags) == 0;
+}
+
+void* numa_alloc(size_t bytes, MemoryPolicy policy, int node) {
+    hwloc_topology_t topo = hwlocTopology();
+    if (!topo) return nullptr;
+    void* data = hwloc_alloc(topo, std::max<size_t>(bytes, 1));
+    if (data) numa_set_policy(data, std::max<size_t>(bytes, 1), policy, node);
+    return data;
+}
+
+std::vector<int> numa_node_cpus(int node) {
+    const auto& t = topology();
+    std::vector<int> cpus;
+    for (size_t cpu = 0; cpu < t.cpu_node.size(); ++cpu) {
+        if (t.cpu_node[cpu] == node) cpus.push_back(static_cast<int>(cpu));
+    }
+    return cpus;
+}
+
+bool bind_thread_to_node(int node) {
+    return set_affinity(numa_node_cpus(node));
+}
+
+bool bind_thread_to_cpu(int cpu) {
+    return set_affinity({cpu});
+}
+
+void numa_note_placement(const std::string& subsystem, const std::string& placement) {
+    std::lock_guard<std::mutex> lock(g_placement_mutex);
+    g_placements[subsystem] = placement;
+}
+
+std::string numa_placement_report() {
+    std::string out;
+    hwloc_topology_t topo = hwlocTopology();
+    const size_t nodes = numa_node_count();
+    out += std::to_string(nodes) + " NUMA node" + (nodes == 1 ? "" : "s");
+    if (topo) {
+        out += ", " + std::to_string(hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_PACKAGE)) + " packages, " +
+               std::to_string(hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_CORE)) + " cores";
+    }
+    out += ", " + std::to_string(cpu_count()) + " CPUs\n";
+    for (size_t n = 0; n < nodes; ++n) {
+        out += "  node " + std::to_string(n) + ": CPUs " + format_cpulist(numa_node_cpus(static_cast<int>(n)));
+        if (hwloc_obj_t obj = topo ? hwlocNode(topo, static_cast<int>(n)) : nullptr) {
+            out += ", " + std::to_string(obj->attr->numanode.local_memory >> 20) + " MiB";
+        }
+        out += "\n";
+    }
+    std::lock_guard<std::mutex> lock(g_placement_mutex);
+    for (const auto& [subsystem, placement] : g_placements) {
+        out += "  " + subsystem + ": " + placement + "\n";
+    }
+    return out;
+}
+
+void log_numa_placement() {
+    std::string report = numa_placement_report();
+    if (!report.empty() && report.back() == '\n') report.pop_back();
+    LOG_INFO("NUMA placement: {}", report);
+}
+
+} // namespace woved::util
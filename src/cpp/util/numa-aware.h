@@ -0,0 +1,115 @@
+#ifndef WOVED_UTIL_NUMA_AWARE_H
+#define WOVED_UTIL_NUMA_AWARE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace woved::util {
+
+/**
+ * @brief Returns the CPU the calling thread is running on (0 if unknown).
+ */
+int current_cpu();
+
+/**
+ * @brief Number of CPUs the topology covers.
+ */
+size_t cpu_count();
+
+/**
+ * @brief Number of NUMA nodes (1 on non-NUMA hosts).
+ */
+size_t numa_node_count();
+
+/**
+ * @brief NUMA node owning a CPU (0 if unknown).
+ * * The CPU-to-node table is read from sysfs on first use and cached.
+ */
+int numa_node_of_cpu(int cpu);
+
+/**
+ * @brief NUMA node of the calling thread's current CPU.
+ */
+inline int current_numa_node() {
+    return numa_node_of_cpu(current_cpu());
+}
+
+/**
+ * @brief Allocate `bytes` of page-aligned memory bound to a NUMA node.
+ * * Binding goes through hwloc and is best effort: where it is refused
+ * * (non-NUMA hosts, restricted cpusets) the memory is ordinary. Pages
+ * * are placed on first touch, so fill the memory after allocating it.
+ * * Returns nullptr if the allocation fails; release with numa_free().
+ */
+void* numa_alloc_on_node(size_t bytes, int node);
+
+/**
+ * @brief Release memory from numa_alloc_on_node() or numa_alloc().
+ */
+void numa_free(void* data, size_t bytes);
+
+/**
+ * @brief Where the pages of a memory range are placed.
+ * * Local leaves placement to first touch, the kernel default: pages land on
+ * * the node of the thread that first writes them. Bind and Preferred use
+ * * one node, strictly or with fallback. Interleave spreads pages
+ * * round-robin over all nodes, for memory every socket uses alike.
+ */
+enum class MemoryPolicy { Local, Bind, Interleave, Preferred };
+
+/**
+ * @brief Parse numa.memory_policy values: "local", "bind", "interleave",
+ * * "preferred". Throws util::ConfigException otherwise.
+ */
+MemoryPolicy parse_memory_policy(const std::string& name);
+
+const char* memory_policy_name(MemoryPolicy policy);
+
+/**
+ * @brief Apply `policy` to pages not yet touched in [data, data + bytes).
+ * * `node` < 0 means the calling thread's node (Bind, Preferred). Best
+ * * effort: returns false where the kernel or hwloc refuses it, and on
+ * * hosts with one node, where every policy is Local.
+ */
+bool numa_set_policy(void* data, size_t bytes, MemoryPolicy policy, int node = -1);
+
+/**
+ * @brief numa_alloc_on_node() under any policy; nullptr on failure.
+ */
+void* numa_alloc(size_t bytes, MemoryPolicy policy, int node = -1);
+
+/**
+ * @brief CPUs of a NUMA node, ascending.
+ */
+std::vector<int> numa_node_cpus(int node);
+
+/**
+ * @brief Restrict the calling thread to the CPUs of `node`, or to one CPU.
+ * * Returns false if the affinity cannot be set.
+ */
+bool bind_thread_to_node(int node);
+bool bind_thread_to_cpu(int cpu);
+
+/**
+ * @brief Record how a subsystem placed its threads or memory, for
+ * * numa_placement_report(). A later note for the same subsystem
+ * * replaces the earlier one.
+ */
+void numa_note_placement(const std::string& subsystem, const std::string& placement);
+
+/**
+ * @brief Topology (packages, cores, CPUs and memory per node) followed by
+ * * every recorded placement, one line each.
+ */
+std::string numa_placement_report();
+
+/**
+ * @brief Log numa_placement_report() at info level, once startup has
+ * * built the pools, buffers and indexes.
+ */
+void log_numa_placement();
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_NUMA_AWARE_H
@@ -0,0 +1,447 @@
+#ifndef WOVED_UTIL_SIMD_DISPATCH_H
+#define WOVED_UTIL_SIMD_DISPATCH_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include "include/woved/types.h"
+#include "util/cpu-dispatch.h"
+
+namespace woved::kernels {
+
+/**
+ * @brief Distance between two vectors of length `dim`.
+ */
+using PairFn = float (*)(const float* a, const float* b, size_t dim);
+
+/**
+ * @brief Distances from `count` queries (row-major, `dim` apart) to one
+ * * vector, written to out[0..count). The vector is loaded once per block
+ * * of queries instead of once per query.
+ */
+using BatchFn = void (*)(const float* queries, size_t count, const float* vec, size_t dim,
+                         float* out);
+
+/**
+ * @brief Distances from one query to `count` vectors (row-major, `dim`
+ * * apart), written to out[0..count). The query is loaded once per block
+ * * of vectors.
+ */
+using BlockFn = void (*)(const float* query, const float* vectors, size_t count, size_t dim,
+                         float* out);
+
+/**
+ * @brief Distances from `nq` queries to `count` vectors, both row-major,
+ * * written to out[q * count + i]. Computed in register tiles of several
+ * * queries by several vectors, so each load feeds more than one FMA.
+ */
+using MatrixFn = void (*)(const float* queries, size_t nq, const float* vectors, size_t count,
+                          size_t dim, float* out);
+
+/**
+ * @brief Distance between an fp32 query and an encoded vector of length `dim`.
+ * * `scale` multiplies every stored component (INT8; 1 for the float types).
+ */
+using EncodedPairFn = float (*)(const float* query, const void* vec, float scale, size_t dim);
+
+/**
+ * @brief Inner products of one fp32 query with `count` encoded vectors
+ * * (row-major, `dim` components apart), each times its scale (`scales`
+ * * may be null: all 1), written to out[0..count). If `sqr_norms` is not
+ * * null it receives each stored vector's squared norm, for L2 and cosine.
+ * * Extension kernels (VNNI, AVX512-BF16, AMX) quantize the query to the
+ * * storage type once per call, adding error on the order of the storage's.
+ */
+using EncodedBlockFn = void (*)(const float* query, const void* vectors, const float* scales, size_t count,
+                                size_t dim, float* out, float* sqr_norms);
+
+/**
+ * @brief EncodedBlockFn for `nq` queries (row-major), written to
+ * * out[q * count + i]; `sqr_norms` as for the block kernel.
+ */
+using EncodedMatrixFn = void (*)(const float* queries, size_t nq, const void* vectors, const float* scales,
+                                 size_t count, size_t dim, float* out, float* sqr_norms);
+
+/**
+ * @brief One candidate of a list scan: its score and row.
+ */
+struct ScanHit {
+    Score score;
+    uint64_t row;
+};
+
+/**
+ * @brief Bounded top-k for fused list scans, over caller-owned storage of
+ * * `k` hits: a min-heap on score whose front is the k-th best once full.
+ */
+struct ScanHeap {
+    ScanHit* hits;
+    size_t k;
+    size_t size = 0;
+
+    bool full() const { return size == k; }
+
+    // Score a candidate must beat to enter
+    Score threshold() const {
+        return full() ? (k ? hits[0].score : std::numeric_limits<Score>::max())
+                      : std::numeric_limits<Score>::lowest();
+    }
+
+    void push(Score score, uint64_t row) {
+        auto worse = [](const ScanHit& a, const ScanHit& b) { return a.score > b.score; };
+        if (size < k) {
+            hits[size++] = {score, row};
+            std::push_heap(hits, hits + size, worse);
+        } else if (k > 0 && score > hits[0].score) {
+            std::pop_heap(hits, hits + size, worse);
+            hits[size - 1] = {score, row};
+            std::push_heap(hits, hits + size, worse);
+        }
+    }
+};
+
+/**
+ * @brief Fused IVF-Flat list scan: scores `count` fp32 vectors (row-major,
+ * * `dim` apart) against one query and offers those that beat the heap's
+ * * threshold to it, as rows first_row + i. Scores are inner products, or
+ * * negated squared L2 distances when `l2`.
+ */
+using ListScanFn = void (*)(const float* query, const float* vectors, size_t count, size_t dim,
+                            bool l2, uint64_t first_row, ScanHeap& heap);
+
+/**
+ * @brief 4-bit PQ fast scan: sums byte lookup tables over blocks of 32
+ * * interleaved codes (index::packFastScanCodes()).
+ * * `lut` holds `pairs` x 32 bytes, the 16-entry tables of subquantizers
+ * * 2p and 2p + 1 back to back; each block is pairs x 32 code bytes in the
+ * * same order. Writes 32 uint16 sums per block, rows in order.
+ */
+using Pq4ScanFn = void (*)(const uint8_t* lut, const uint8_t* blocks, size_t nblocks, size_t pairs,
+                           uint16_t* out);
+
+/**
+ * @brief Kernels for one narrow element type.
+ */
+struct EncodedKernels {
+    EncodedPairFn inner_product;
+    EncodedPairFn l2_sqr;
+    EncodedBlockFn inner_product_block;
+    EncodedMatrixFn inner_product_matrix;
+};
+
+/**
+ * @brief Batched kernels for one narrow element type on an instruction
+ * * set extension, patched over the AVX-512 table's by the dispatcher.
+ */
+struct EncodedBatchKernels {
+    EncodedBlockFn inner_product_block;
+    EncodedMatrixFn inner_product_matrix;
+};
+
+/**
+ * @brief A set of distance kernels compiled for one instruction set.
+ */
+struct DistanceTable {
+    const char* isa;
+    PairFn inner_product;
+    PairFn l2_sqr;
+    BatchFn inner_product_batch;
+    BatchFn l2_sqr_batch;
+    BlockFn inner_product_block;
+    BlockFn l2_sqr_block;
+    MatrixFn inner_product_matrix;
+    MatrixFn l2_sqr_matrix;
+    ListScanFn scan_list;
+    Pq4ScanFn pq4_scan;
+    EncodedKernels fp16;
+    EncodedKernels bf16;
+    EncodedKernels int8;
+};
+
+/**
+ * @brief Vector lengths with fp32 kernels compiled for them: the default
+ * * collection dim and the other common embedding sizes.
+ */
+inline constexpr size_t kFixedDims[] = {384, 768, 1024, 1536};
+inline constexpr size_t kFixedDimCount = sizeof(kFixedDims) / sizeof(kFixedDims[0]);
+
+/**
+ * @brief A table's fp32 kernels instantiated for one vector length: loop
+ * * bounds are compile-time constants, so loops unroll with no tail. A
+ * * call with any other `dim` (PQ subvectors, say) runs the generic kernel.
+ */
+struct FixedDimKernels {
+    size_t dim;
+    PairFn inner_product;
+    PairFn l2_sqr;
+    BatchFn inner_product_batch;
+    BatchFn l2_sqr_batch;
+    BlockFn inner_product_block;
+    BlockFn l2_sqr_block;
+    MatrixFn inner_product_matrix;
+    MatrixFn l2_sqr_matrix;
+    ListScanFn scan_list;
+};
+
+// Per-ISA tables, defined in kernels/distance_*.cpp
+namespace base {
+extern const DistanceTable table;
+extern const FixedDimKernels fixed_dims[kFixedDimCount];
+}
+#ifdef WOVED_KERNELS_AVX2
+namespace avx2 {
+extern const DistanceTable table;
+extern const FixedDimKernels fixed_dims[kFixedDimCount];
+}
+#endif
+#ifdef WOVED_KERNELS_AVX512
+namespace avx512 {
+extern const DistanceTable table;
+extern const FixedDimKernels fixed_dims[kFixedDimCount];
+}
+#endif
+#ifdef WOVED_KERNELS_NEON
+namespace neon { extern const DistanceTable table; }
+#endif
+#ifdef WOVED_KERNELS_SVE
+namespace sve { extern const DistanceTable table; }
+#endif
+#ifdef WOVED_KERNELS_AMX
+// Sapphire Rapids and later, defined in kernels/distance_amx.cpp
+namespace amx {
+extern const EncodedBatchKernels int8_vnni;     // AVX512-VNNI
+extern const EncodedBatchKernels int8_tiles;    // AMX-INT8 matrix, VNNI block
+extern const EncodedBatchKernels bf16_dot;      // AVX512-BF16
+extern const EncodedBatchKernels bf16_tiles;    // AMX-BF16 matrix, BF16 block
+}
+#endif
+
+/**
+ * @brief Returns the best kernel table for the host CPU.
+ * * Resolved once on first call; after select_dimension(), the table with
+ * * that dim's fixed kernels, if it has them.
+ */
+const DistanceTable& distance_table();
+
+/**
+ * @brief Switches distance_table() to kernels specialized for vectors of
+ * * `dim` components; call once when a collection opens. A dim outside
+ * * kFixedDims, or an ISA without fixed kernels, keeps the generic ones.
+ * * Fixed kernels fall back for other lengths, so tables stay correct
+ * * for every caller; with several collections the last dim selected is
+ * * the fast one.
+ */
+void select_dimension(size_t dim);
+
+/**
+ * @brief Similarity score where higher is always better.
+ * * Inner product as-is, negated squared L2, and cosine computed from
+ * * inner products (vectors are not assumed to be normalized).
+ */
+inline Score score(Metric metric, const float* query, const float* vec, size_t dim) {
+    const auto& t = distance_table();
+    switch (metric) {
+        case Metric::INNER_PRODUCT:
+            return t.inner_product(query, vec, dim);
+        case Metric::L2:
+            return -t.l2_sqr(query, vec, dim);
+        case Metric::COSINE: {
+            float denom = t.inner_product(query, query, dim) * t.inner_product(vec, vec, dim);
+            return denom > 0.0f ? t.inner_product(query, vec, dim) / __builtin_sqrtf(denom) : 0.0f;
+        }
+    }
+    return 0.0f;
+}
+
+/**
+ * @brief score() of `count` queries against one fp32 vector.
+ * * `query_sqr_norms` (each query's inner product with itself) is only read
+ * * for cosine; compute it once per batch.
+ */
+inline void score_batch(Metric metric, const float* queries, const float* query_sqr_norms,
+                        size_t count, const float* vec, size_t dim, Score* out) {
+    const auto& t = distance_table();
+    switch (metric) {
+        case Metric::INNER_PRODUCT:
+            t.inner_product_batch(queries, count, vec, dim, out);
+            return;
+        case Metric::L2:
+            t.l2_sqr_batch(queries, count, vec, dim, out);
+            for (size_t q = 0; q < count; ++q) out[q] = -out[q];
+            return;
+        case Metric::COSINE: {
+            t.inner_product_batch(queries, count, vec, dim, out);
+            float vv = t.inner_product(vec, vec, dim);
+            for (size_t q = 0; q < count; ++q) {
+                float denom = query_sqr_norms[q] * vv;
+                out[q] = denom > 0.0f ? out[q] / __builtin_sqrtf(denom) : 0.0f;
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * @brief score() of one query against `count` fp32 vectors.
+ * * `query_sqr_norm` is only read for cosine, which takes each vector's
+ * * norm from its inner product and squared L2 distance to the query, as
+ * * the encoded score() does; `scratch` holds `count` floats for it.
+ */
+inline void score_block(Metric metric, const float* query, float query_sqr_norm, const float* vectors,
+                        size_t count, size_t dim, Score* out, float* scratch) {
+    const auto& t = distance_table();
+    switch (metric) {
+        case Metric::INNER_PRODUCT:
+            t.inner_product_block(query, vectors, count, dim, out);
+            return;
+        case Metric::L2:
+            t.l2_sqr_block(query, vectors, count, dim, out);
+            for (size_t i = 0; i < count; ++i) out[i] = -out[i];
+            return;
+        case Metric::COSINE:
+            t.inner_product_block(query, vectors, count, dim, out);
+            t.l2_sqr_block(query, vectors, count, dim, scratch);
+            for (size_t i = 0; i < count; ++i) {
+                float vv = scratch[i] - query_sqr_norm + 2.0f * out[i];
+                float denom = query_sqr_norm * vv;
+                out[i] = denom > 0.0f ? out[i] / __builtin_sqrtf(denom) : 0.0f;
+            }
+            return;
+    }
+}
+
+/**
+ * @brief score() of `nq` queries against `count` fp32 vectors, written to
+ * * out[q * count + i]. `query_sqr_norms` and `vec_sqr_norms` (inner
+ * * products with themselves) are only read for cosine.
+ */
+inline void score_matrix(Metric metric, const float* queries, const float* query_sqr_norms, size_t nq,
+                         const float* vectors, const float* vec_sqr_norms, size_t count, size_t dim,
+                         Score* out) {
+    const auto& t = distance_table();
+    switch (metric) {
+        case Metric::INNER_PRODUCT:
+            t.inner_product_matrix(queries, nq, vectors, count, dim, out);
+            return;
+        case Metric::L2:
+            t.l2_sqr_matrix(queries, nq, vectors, count, dim, out);
+            for (size_t i = 0; i < nq * count; ++i) out[i] = -out[i];
+            return;
+        case Metric::COSINE:
+            t.inner_product_matrix(queries, nq, vectors, count, dim, out);
+            for (size_t q = 0; q < nq; ++q) {
+                for (size_t i = 0; i < count; ++i) {
+                    float denom = query_sqr_norms[q] * vec_sqr_norms[i];
+                    Score& s = out[q * count + i];
+                    s = denom > 0.0f ? s / __builtin_sqrtf(denom) : 0.0f;
+                }
+            }
+            return;
+    }
+}
+
+/**
+ * @brief A table's kernels for a narrow element type; null for FP32.
+ */
+inline const EncodedKernels* encoded_kernels(const DistanceTable& t, ElementType type) {
+    switch (type) {
+        case ElementType::FP32: return nullptr;
+        case ElementType::FP16: return &t.fp16;
+        case ElementType::BF16: return &t.bf16;
+        case ElementType::INT8: return &t.int8;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Scores from inner products (in `out`) and stored squared norms.
+ */
+inline void finish_scores(Metric metric, const float* query_sqr_norms, size_t nq, const float* vec_sqr_norms,
+                          size_t count, Score* out) {
+    if (metric == Metric::INNER_PRODUCT) return;
+    for (size_t q = 0; q < nq; ++q) {
+        const float qq = query_sqr_norms[q];
+        for (size_t i = 0; i < count; ++i) {
+            Score& s = out[q * count + i];
+            if (metric == Metric::L2) {
+                s = -(qq - 2.0f * s + vec_sqr_norms[i]);
+            } else {
+                const float denom = qq * vec_sqr_norms[i];
+                s = denom > 0.0f ? s / __builtin_sqrtf(denom) : 0.0f;
+            }
+        }
+    }
+}
+
+/**
+ * @brief score_block() against `count` vectors stored as `type`, with
+ * * per-vector `scales` (null: all 1). L2 and cosine expand over the
+ * * stored norms, so `scratch` holds `count` floats for them.
+ */
+inline void score_block(Metric metric, const float* query, float query_sqr_norm, const void* vectors,
+                        ElementType type, const float* scales, size_t count, size_t dim, Score* out,
+                        float* scratch) {
+    const auto& t = distance_table();
+    const EncodedKernels* k = encoded_kernels(t, type);
+    if (!k) {
+        score_block(metric, query, query_sqr_norm, static_cast<const float*>(vectors), count, dim, out, scratch);
+        return;
+    }
+    k->inner_product_block(query, vectors, scales, count, dim, out,
+                           metric == Metric::INNER_PRODUCT ? nullptr : scratch);
+    finish_scores(metric, &query_sqr_norm, 1, scratch, count, out);
+}
+
+/**
+ * @brief score_matrix() against `count` vectors stored as `type`; the
+ * * stored norms land in `scratch` (`count` floats).
+ */
+inline void score_matrix(Metric metric, const float* queries, const float* query_sqr_norms, size_t nq,
+                         const void* vectors, ElementType type, const float* scales, size_t count, size_t dim,
+                         Score* out, float* scratch) {
+    const auto& t = distance_table();
+    const EncodedKernels* k = encoded_kernels(t, type);
+    if (!k) {
+        const auto* v = static_cast<const float*>(vectors);
+        if (metric == Metric::COSINE) {
+            for (size_t i = 0; i < count; ++i) scratch[i] = t.inner_product(v + i * dim, v + i * dim, dim);
+        }
+        score_matrix(metric, queries, query_sqr_norms, nq, v, scratch, count, dim, out);
+        return;
+    }
+    k->inner_product_matrix(queries, nq, vectors, scales, count, dim, out,
+                            metric == Metric::INNER_PRODUCT ? nullptr : scratch);
+    finish_scores(metric, query_sqr_norms, nq, scratch, count, out);
+}
+
+/**
+ * @brief score() against a vector stored as `type` (see util/vector-codec.h).
+ * * Cosine recovers the stored vector's norm from its inner product and
+ * * squared L2 distance to the query, so nothing is decoded.
+ */
+inline Score score(Metric metric, const float* query, const void* vec, ElementType type,
+                   float scale, size_t dim) {
+    if (type == ElementType::FP32) return score(metric, query, static_cast<const float*>(vec), dim);
+    const auto& t = distance_table();
+    const EncodedKernels* k = encoded_kernels(t, type);
+    if (!k) return 0.0f;
+    switch (metric) {
+        case Metric::INNER_PRODUCT:
+            return k->inner_product(query, vec, scale, dim);
+        case Metric::L2:
+            return -k->l2_sqr(query, vec, scale, dim);
+        case Metric::COSINE: {
+            float ip = k->inner_product(query, vec, scale, dim);
+            float qq = t.inner_product(query, query, dim);
+            float vv = k->l2_sqr(query, vec, scale, dim) - qq + 2.0f * ip;
+            float denom = qq * vv;
+            return denom > 0.0f ? ip / __builtin_sqrtf(denom) : 0.0f;
+        }
+    }
+    return 0.0f;
+}
+
+} // namespace woved::kernels
+
+#endif // WOVED_UTIL_SIMD_DISPATCH_H
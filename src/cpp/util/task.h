@@ -0,0 +1,219 @@
+#ifndef WOVED_UTIL_TASK_H
+#define WOVED_UTIL_TASK_H
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace woved::util {
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+// Resumes whoever awaited the task, or returns to resume()'s caller
+struct TaskFinal {
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        const std::coroutine_handle<> next = handle.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+    bool started = false;
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    TaskFinal final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+    template <typename U>
+    void return_value(U&& result) {
+        value.emplace(std::forward<U>(result));
+    }
+    T take() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+    void return_void() const noexcept {}
+    void take() const {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief A lazily started coroutine producing a T.
+ * * `co_await task` starts it and resumes the awaiting coroutine when it
+ * * returns, by symmetric transfer, so chains of awaits do not grow the
+ * * stack. Exceptions escaping the coroutine are rethrown at the await.
+ * * A task that is never awaited can be driven from outside: start() runs
+ * * it to its first suspension, and whatever resumes it later (an I/O
+ * * completion, io::IoLoop) carries it on until done(); awaiting it then
+ * * only waits for that. Destroying a task destroys its frame; it must not
+ * * be suspended on an I/O still in flight.
+ */
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task() = default;
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle_) handle_.destroy();
+    }
+
+    bool valid() const noexcept { return static_cast<bool>(handle_); }
+    bool done() const noexcept { return !handle_ || handle_.done(); }
+
+    /**
+     * @brief Run to the first suspension, for a task nobody awaits.
+     */
+    void start() {
+        handle_.promise().started = true;
+        handle_.resume();
+    }
+
+    /**
+     * @brief The value, or the exception, of a task that is done().
+     */
+    T result() { return handle_.promise().take(); }
+
+    struct Awaiter {
+        std::coroutine_handle<promise_type> handle;
+
+        bool await_ready() const noexcept { return !handle || handle.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            promise_type& promise = handle.promise();
+            promise.continuation = awaiting;
+            if (promise.started) return std::noop_coroutine();
+            promise.started = true;
+            return handle;
+        }
+        T await_resume() { return handle.promise().take(); }
+    };
+
+    // The task stays owned by its Task; awaiting a temporary keeps it
+    // alive to the end of the full expression
+    Awaiter operator co_await() const& noexcept { return {handle_}; }
+    Awaiter operator co_await() const&& noexcept { return {handle_}; }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+struct JoinState {
+    size_t remaining = 0;
+    std::coroutine_handle<> waiter;
+    std::exception_ptr error;
+};
+
+// One task of a whenAll(); the last to finish resumes the waiter
+struct JoinTask {
+    struct promise_type {
+        JoinState* state = nullptr;
+
+        JoinTask get_return_object() noexcept {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        struct Final {
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                JoinState& state = *handle.promise().state;
+                return --state.remaining == 0 && state.waiter ? state.waiter : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+        Final final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() noexcept {
+            if (!state->error) state->error = std::current_exception();
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+inline JoinTask joinOne(Task<void>& task) {
+    co_await task;
+}
+
+struct JoinWait {
+    JoinState& state;
+
+    bool await_ready() const noexcept { return state.remaining == 0; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept { state.waiter = handle; }
+    void await_resume() const noexcept {}
+};
+
+} // namespace detail
+
+/**
+ * @brief Run `tasks` at once and finish when all have.
+ * * Each task is started in turn and runs to its first suspension before
+ * * the next starts, so their I/O is in flight together. All of them run
+ * * on the thread driving the awaiting coroutine. The first exception any
+ * * of them threw is rethrown once every task is done.
+ */
+inline Task<void> whenAll(std::vector<Task<void>> tasks) {
+    detail::JoinState state;
+    state.remaining = tasks.size();
+    std::vector<detail::JoinTask> joins;
+    joins.reserve(tasks.size());
+    for (Task<void>& task : tasks) {
+        joins.push_back(detail::joinOne(task));
+        joins.back().handle.promise().state = &state;
+    }
+    // No waiter yet: a task finishing inside start must not resume us
+    for (detail::JoinTask& join : joins) join.handle.resume();
+    co_await detail::JoinWait{state};
+    for (detail::JoinTask& join : joins) join.handle.destroy();
+    if (state.error) std::rethrow_exception(state.error);
+}
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_TASK_H
@@ -0,0 +1,93 @@
+#include "telemetry.h"
+#include <bit>
+#include <cmath>
+
+namespace woved::util {
+
+namespace {
+
+constexpr size_t kSlots = PerThread<int>::kMaxThreads;
+constexpr uint64_t kLinear = uint64_t{1} << LatencyHistogram::kSubBits;
+
+struct SlotTable {
+    std::array<std::atomic<bool>, kSlots> owned{};
+};
+
+SlotTable& slotTable() {
+    static SlotTable table;
+    return table;
+}
+
+size_t claimSlot() {
+    auto& owned = slotTable().owned;
+    for (size_t i = 0; i + 1 < kSlots; ++i) {
+        bool expected = false;
+        if (owned[i].compare_exchange_strong(expected, true)) return i;
+    }
+    return kSlots - 1;  // Shared overflow slot
+}
+
+} // namespace
+
+size_t telemetry_thread_slot() {
+    struct Registration {
+        size_t slot = claimSlot();
+        ~Registration() {
+            if (slot + 1 < kSlots) slotTable().owned[slot].store(false, std::memory_order_release);
+        }
+    };
+    thread_local Registration reg;
+    return reg.slot;
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    shards_.forEach([&](const Shard& shard) { total += shard.value.load(std::memory_order_relaxed); });
+    return total;
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t ns) {
+    if (ns < kLinear) return static_cast<size_t>(ns);
+    const unsigned exponent = static_cast<unsigned>(std::bit_width(ns)) - 1;
+    if (exponent >= kMaxExponent) return kBuckets - 1;
+    const unsigned shift = exponent - kSubBits;
+    return static_cast<size_t>(kLinear + shift * kLinear + ((ns >> shift) - kLinear));
+}
+
+uint64_t LatencyHistogram::upperBound(size_t bucket) {
+    if (bucket < kLinear) return bucket;
+    const uint64_t shift = (bucket - kLinear) / kLinear;
+    const uint64_t mantissa = kLinear + (bucket - kLinear) % kLinear;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot out;
+    out.buckets.assign(kBuckets, 0);
+    shards_.forEach([&](const Shard& shard) {
+        out.sum_ns += shard.sum_ns.load(std::memory_order_relaxed);
+        for (size_t b = 0; b < kBuckets; ++b) out.buckets[b] += shard.buckets[b].load(std::memory_order_relaxed);
+    });
+    // Counted from the buckets so that quantiles agree with it
+    for (uint64_t n : out.buckets) out.count += n;
+    return out;
+}
+
+uint64_t LatencyHistogram::Snapshot::quantile(double q) const {
+    if (count == 0) return 0;
+    const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(count))));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < buckets.size(); ++b) {
+        seen += buckets[b];
+        if (seen >= rank) return upperBound(b);
+    }
+    return upperBound(buckets.size() - 1);
+}
+
+uint64_t LatencyHistogram::Snapshot::countAtMost(uint64_t ns) const {
+    uint64_t total = 0;
+    for (size_t b = 0; b < buckets.size() && upperBound(b) <= ns; ++b) total += buckets[b];
+    return total;
+}
+
+} // namespace woved::util
@@ -0,0 +1,157 @@
+#ifndef WOVED_UTIL_TELEMETRY_H
+#define WOVED_UTIL_TELEMETRY_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace woved::util {
+
+/**
+ * @brief Slot of the calling thread in every PerThread statistic, in
+ * * [0, PerThread::kMaxThreads).
+ */
+size_t telemetry_thread_slot();
+
+/**
+ * @brief Per-thread shards of a hot-path statistic, summed when read.
+ * * Each thread claims a slot on first use, handed back when it exits; the
+ * * shard of a slot is allocated by its first writer and lives as long as
+ * * the statistic, so counts of exited threads are kept. Writers touch only
+ * * their own shard, with relaxed atomics: no lock and no shared cache
+ * * line. Threads past kMaxThreads share the last slot, which stays
+ * * correct because every write is an atomic add.
+ */
+template <typename Shard>
+class PerThread {
+public:
+    static constexpr size_t kMaxThreads = 1024;
+
+    PerThread() : shards_(std::make_unique<std::atomic<Shard*>[]>(kMaxThreads)) {}
+    ~PerThread() {
+        for (size_t i = 0; i < kMaxThreads; ++i) delete shards_[i].load(std::memory_order_relaxed);
+    }
+
+    PerThread(const PerThread&) = delete;
+    PerThread& operator=(const PerThread&) = delete;
+
+    Shard& local() {
+        std::atomic<Shard*>& slot = shards_[telemetry_thread_slot()];
+        Shard* shard = slot.load(std::memory_order_acquire);
+        if (shard) return *shard;
+        // Only the shared overflow slot can race here
+        auto fresh = std::make_unique<Shard>();
+        if (slot.compare_exchange_strong(shard, fresh.get(), std::memory_order_acq_rel)) return *fresh.release();
+        return *shard;
+    }
+
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (size_t i = 0; i < kMaxThreads; ++i) {
+            if (const Shard* shard = shards_[i].load(std::memory_order_acquire)) fn(*shard);
+        }
+    }
+
+private:
+    std::unique_ptr<std::atomic<Shard*>[]> shards_;
+};
+
+/**
+ * @brief Monotonic counter.
+ */
+class Counter {
+public:
+    void add(uint64_t n = 1) { shards_.local().value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    PerThread<Shard> shards_;
+};
+
+/**
+ * @brief Latency distribution in log-linear (HDR-style) buckets.
+ * * Values below 2^kSubBits nanoseconds have a bucket each; above that,
+ * * every power of two is split into 2^kSubBits buckets, so a recorded
+ * * value is known to within 1/32 (about 3%) of itself. Values from
+ * * 2^kMaxExponent ns (about 18 minutes) land in the last bucket.
+ * * record() is two relaxed adds on the calling thread's shard; the shards
+ * * are summed only by snapshot(), at scrape time.
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned kSubBits = 5;
+    static constexpr unsigned kMaxExponent = 40;
+    static constexpr size_t kBuckets = (size_t{1} << kSubBits) * (kMaxExponent - kSubBits + 1);
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum_ns = 0;
+        std::vector<uint64_t> buckets;  // kBuckets counts
+
+        /**
+         * @brief Value in ns at quantile q (0..1), as the upper bound of the
+         * * bucket holding it; 0 when empty.
+         */
+        uint64_t quantile(double q) const;
+        /**
+         * @brief Number of values of at most `ns`, to bucket precision.
+         */
+        uint64_t countAtMost(uint64_t ns) const;
+    };
+
+    void record(uint64_t ns) {
+        Shard& shard = shards_.local();
+        shard.buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+    void record(std::chrono::nanoseconds elapsed) {
+        record(static_cast<uint64_t>(std::max<int64_t>(0, elapsed.count())));
+    }
+
+    Snapshot snapshot() const;
+
+    static size_t bucketOf(uint64_t ns);
+    // Largest value of `bucket`
+    static uint64_t upperBound(size_t bucket);
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> sum_ns{0};
+        std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+    };
+    PerThread<Shard> shards_;
+};
+
+/**
+ * @brief Records the time from construction to destruction into a histogram.
+ * * A null histogram records nothing.
+ */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(LatencyHistogram* histogram)
+        : histogram_(histogram), start_(histogram ? std::chrono::steady_clock::now()
+                                                  : std::chrono::steady_clock::time_point{}) {}
+    explicit ScopedTimer(LatencyHistogram& histogram) : ScopedTimer(&histogram) {}
+    ~ScopedTimer() {
+        if (histogram_) histogram_->record(std::chrono::steady_clock::now() - start_);
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    LatencyHistogram* histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_TELEMETRY_H
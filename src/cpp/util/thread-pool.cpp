@@ -0,0 +1,232 @@
+#include "thread-pool.h"
+#include "core/config.h"
+#include "util/logging.h"
+#include "util/numa-aware.h"
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <string>
+
+namespace woved::util {
+
+namespace {
+
+thread_local ThreadPool* t_pool = nullptr;
+thread_local size_t t_worker = SIZE_MAX;
+thread_local ThreadPool::Priority t_priority = ThreadPool::Priority::Foreground;
+
+constexpr size_t laneIndex(ThreadPool::Priority priority) {
+    return static_cast<size_t>(priority);
+}
+
+} // namespace
+
+ThreadPool::Options ThreadPool::Options::fromConfig(const Config& config) {
+    Options options;
+    options.threads = config.server.worker_threads;
+    options.numa = config.numa.enabled && config.numa.bind_threads;
+    return options;
+}
+
+ThreadPool::ThreadPool(size_t threads) : ThreadPool([threads] {
+          Options options;
+          options.threads = threads;
+          return options;
+      }()) {}
+
+ThreadPool::ThreadPool(const Options& options) : options_(options) {
+    size_t threads = options_.threads;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    const size_t nodes = options_.numa ? std::max<size_t>(1, numa_node_count()) : 1;
+    // At least one worker of each kind once there are two
+    const auto share = static_cast<size_t>(std::lround(threads * std::clamp(options_.foreground_reserve, 0.0f, 1.0f)));
+    const size_t reserve = threads < 2 ? 0 : std::clamp<size_t>(share, options_.foreground_reserve > 0 ? 1 : 0, threads - 1);
+
+    workers_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        auto worker = std::make_unique<Worker>();
+        worker->node = static_cast<int>(i % nodes);
+        worker->reserved = i < reserve;
+        workers_.push_back(std::move(worker));
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        Worker& worker = *workers_[i];
+        for (int pass = 0; pass < 2; ++pass) {
+            for (size_t k = 1; k < threads; ++k) {
+                const size_t v = (i + k) % threads;
+                if ((workers_[v]->node == worker.node) == (pass == 0)) worker.victims.push_back(v);
+            }
+        }
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers_[i]->thread = std::thread([this, i] { work(i); });
+    }
+    numa_note_placement(options_.name, std::to_string(threads) + " workers, " + std::to_string(reserve) + " foreground only" +
+                            (nodes > 1 ? ", bound round-robin to " + std::to_string(nodes) + " nodes" : ""));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    any_cv_.notify_all();
+    foreground_cv_.notify_all();
+    for (auto& worker : workers_) worker->thread.join();
+}
+
+ThreadPool::Priority ThreadPool::currentPriority() {
+    return t_priority;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    submit(std::move(task), t_priority);
+}
+
+void ThreadPool::submit(std::function<void()> task, Priority priority) {
+    const size_t l = laneIndex(priority);
+    Lane& lane = t_pool == this ? workers_[t_worker]->lanes[l] : shared_[l];
+    {
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        lane.tasks.push_back(std::move(task));
+    }
+    pending_[l].fetch_add(1);
+    // Sleepers test pending_ under mutex_: taking it orders the wakeup
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    if (priority == Priority::Foreground) foreground_cv_.notify_one();
+    any_cv_.notify_one();
+}
+
+bool ThreadPool::take(size_t self, bool background, Task& task, Priority& lane) {
+    auto popBack = [&](Lane& from) {
+        std::lock_guard<std::mutex> lock(from.mutex);
+        if (from.tasks.empty()) return false;
+        task = std::move(from.tasks.back());
+        from.tasks.pop_back();
+        return true;
+    };
+    auto popFront = [&](Lane& from) {
+        std::lock_guard<std::mutex> lock(from.mutex);
+        if (from.tasks.empty()) return false;
+        task = std::move(from.tasks.front());
+        from.tasks.pop_front();
+        return true;
+    };
+
+    for (size_t l = 0; l < (background ? kLanes : 1); ++l) {
+        if (pending_[l].load() == 0) continue;
+        bool found = false;
+        if (self != SIZE_MAX) {
+            found = popBack(workers_[self]->lanes[l]) || popFront(shared_[l]);
+            for (size_t i = 0; !found && i < workers_[self]->victims.size(); ++i) {
+                found = popFront(workers_[workers_[self]->victims[i]]->lanes[l]);
+            }
+        } else {
+            found = popFront(shared_[l]);
+            for (size_t v = 0; !found && v < workers_.size(); ++v) found = popFront(workers_[v]->lanes[l]);
+        }
+        if (found) {
+            pending_[l].fetch_sub(1);
+            lane = static_cast<Priority>(l);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(Task& task, Priority lane) {
+    const Priority outer = t_priority;
+    t_priority = lane;
+    try {
+        task();
+    } catch (const std::exception& e) {
+        LOG_ERROR("Thread pool task failed: {}", e.what());
+    }
+    t_priority = outer;
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)>& fn) {
+    parallelFor(n, fn, t_priority);
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)>& fn, Priority priority) {
+    if (n == 0) return;
+
+    struct Loop {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::exception_ptr error;
+    };
+    auto loop = std::make_shared<Loop>();
+
+    // Helpers that start after every index is claimed return without
+    // touching `fn`, so it may go out of scope once this call returns
+    auto run = [loop, n, &fn] {
+        for (size_t i; (i = loop->next.fetch_add(1)) < n; ) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(loop->mutex);
+                if (!loop->error) loop->error = std::current_exception();
+            }
+            if (loop->done.fetch_add(1) + 1 == n) {
+                std::lock_guard<std::mutex> lock(loop->mutex);
+                loop->finished.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min(n - 1, workers_.size());
+    for (size_t i = 0; i < helpers; ++i) submit(run, priority);
+    const Priority outer = t_priority;
+    t_priority = priority;
+    run();
+    t_priority = outer;
+
+    // A foreground caller never picks up background work while it waits
+    while (loop->done.load() < n) {
+        if (runOne(priority == Priority::Background)) continue;
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->finished.wait(lock, [&] { return loop->done.load() >= n; });
+    }
+    if (loop->error) std::rethrow_exception(loop->error);
+}
+
+void ThreadPool::work(size_t self) {
+    t_pool = this;
+    t_worker = self;
+    Worker& worker = *workers_[self];
+    if (options_.numa && numa_node_count() > 1 && !bind_thread_to_node(worker.node)) {
+        LOG_DEBUG("Thread pool: cannot bind a worker to node {}", worker.node);
+    }
+
+    const bool background = !worker.reserved;
+    std::condition_variable& cv = worker.reserved ? foreground_cv_ : any_cv_;
+    auto ready = [&] {
+        return pending_[laneIndex(Priority::Foreground)].load() > 0 ||
+               (background && pending_[laneIndex(Priority::Background)].load() > 0);
+    };
+    while (true) {
+        Task task;
+        Priority lane;
+        if (take(self, background, task, lane)) {
+            run(task, lane);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv.wait(lock, [&] { return stopping_ || ready(); });
+        if (stopping_ && !ready()) return;
+    }
+}
+
+bool ThreadPool::runOne(bool background) {
+    Task task;
+    Priority lane;
+    if (!take(t_pool == this ? t_worker : SIZE_MAX, background, task, lane)) return false;
+    run(task, lane);
+    return true;
+}
+
+} // namespace woved::util
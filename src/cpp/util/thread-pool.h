@@ -0,0 +1,125 @@
+#ifndef WOVED_UTIL_THREAD_POOL_H
+#define WOVED_UTIL_THREAD_POOL_H
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace woved {
+struct Config;
+}
+
+namespace woved::util {
+
+/**
+ * @brief Work-stealing worker threads with a foreground and a background lane.
+ * * Each worker keeps a deque per lane. Tasks a worker submits go on its
+ * * own deque, and it runs them newest first; idle workers steal the
+ * * oldest from the front. Tasks submitted from other threads go to a
+ * * shared queue per lane. A worker takes background work only when no
+ * * foreground task is queued anywhere, and a share of the workers
+ * * (foreground_reserve) never takes background work, so flushes and
+ * * merges cannot occupy every worker when queries arrive.
+ * * On NUMA hosts, workers are spread over the nodes and bound to their
+ * * node's CPUs. They steal from their own node before crossing to another.
+ * * parallelFor() lets the calling thread take part. While it waits, it
+ * * runs other queued tasks: foreground ones only, unless the loop is
+ * * background. A task may therefore call parallelFor() itself (a flush
+ * * fanning out to children that fan out again) without starving the pool.
+ * * A task that does not name a lane runs in the lane of the task that
+ * * submitted it; tasks from outside the pool default to the foreground.
+ */
+class ThreadPool {
+public:
+    enum class Priority { Foreground, Background };
+
+    struct Options {
+        size_t threads = 0;               // 0 = one per hardware thread (server.worker_threads)
+        float foreground_reserve = 0.25f; // Share of workers that never run background tasks
+        bool numa = true;                 // Bind workers to nodes; steal within a node first
+        std::string name = "worker pool"; // In the NUMA placement report
+
+        /**
+         * @brief server.worker_threads; numa when numa.enabled and numa.bind_threads.
+         */
+        static Options fromConfig(const Config& config);
+    };
+
+    /**
+     * @brief Start `threads` workers (0 = one per hardware thread).
+     */
+    explicit ThreadPool(size_t threads = 0);
+    explicit ThreadPool(const Options& options);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    /**
+     * @brief Queue a task. Exceptions escaping it are logged and dropped.
+     */
+    void submit(std::function<void()> task);
+    void submit(std::function<void()> task, Priority priority);
+
+    /**
+     * @brief Run fn(0) .. fn(n - 1) on the pool and the calling thread.
+     * * Returns once every call has finished; the first exception thrown by
+     * * any of them is rethrown here.
+     */
+    void parallelFor(size_t n, const std::function<void(size_t)>& fn);
+    void parallelFor(size_t n, const std::function<void(size_t)>& fn, Priority priority);
+
+    /**
+     * @brief Lane of the task running on the calling thread (foreground
+     * * outside the pool).
+     */
+    static Priority currentPriority();
+
+private:
+    static constexpr size_t kLanes = 2;
+
+    using Task = std::function<void()>;
+
+    struct Lane {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct Worker {
+        std::array<Lane, kLanes> lanes;
+        int node = 0;
+        bool reserved = false;        // Foreground only
+        std::vector<size_t> victims;  // Own node first
+        std::thread thread;
+    };
+
+    Options options_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::array<Lane, kLanes> shared_;
+    std::array<std::atomic<size_t>, kLanes> pending_{};
+    std::mutex mutex_;
+    std::condition_variable any_cv_;         // Workers that take either lane
+    std::condition_variable foreground_cv_;  // Reserved workers
+    bool stopping_ = false;
+
+    void work(size_t self);
+    // Pop a task for `self` (SIZE_MAX off the pool), foreground first
+    bool take(size_t self, bool background, Task& task, Priority& lane);
+    // Run one queued task on the calling thread, if any
+    bool runOne(bool background);
+    void run(Task& task, Priority lane);
+};
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_THREAD_POOL_H
@@ -1,71 +1,121 @@
 #include "uuid-v7.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <stdexcept>
-#include <array>
-#include <fmt/core.h>
 
 namespace woved::util {
 
+namespace {
+
+// UUIDv7 structure:
+// 48 bits: unix_ts_ms
+//  4 bits: version (0111)
+// 12 bits: rand_a (sequence counter for monotonicity)
+//  2 bits: variant (10)
+// 62 bits: rand_b
+//
+// The counter is unix_ts_ms << 12 | rand_a
+constexpr unsigned kSequenceBits = 12;
+
+// Next counter value not yet reserved by any generator
+std::atomic<uint64_t> g_next{0};
+
+uint64_t nowMs() {
+    using namespace std::chrono;
+    return static_cast<uint64_t>(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+// Reserves `n` consecutive counter values, none below the current
+// millisecond; returns the first
+uint64_t reserve(uint64_t n) {
+    const uint64_t floor = nowMs() << kSequenceBits;
+    uint64_t next = g_next.load(std::memory_order_relaxed);
+    uint64_t first;
+    do {
+        first = std::max(next, floor);
+    } while (!g_next.compare_exchange_weak(next, first + n, std::memory_order_relaxed));
+    return first;
+}
+
+} // namespace
+
 UuidV7Generator::UuidV7Generator() {
     std::random_device rd;
     std::seed_seq ss{rd(), rd(), rd(), rd(), rd(), rd(), rd(), rd()};
     rng_.seed(ss);
 }
 
-std::string UuidV7Generator::generate() {
-    using namespace std::chrono;
+UuidV7Generator& UuidV7Generator::local() {
+    thread_local UuidV7Generator generator;
+    return generator;
+}
 
-    const auto now = system_clock::now();
-    const auto epoch_ms = duration_cast<milliseconds>(now.time_since_epoch()).count();
+std::string UuidV7Generator::generate() {
+    return uuid_to_string(generateBinary());
+}
 
-    if (epoch_ms == last_ms_) {
-        sequence_++;
-    } else {
-        last_ms_ = epoch_ms;
-        sequence_ = 0;
+VectorUuid UuidV7Generator::generateBinary() {
+    // A run reserved in an earlier millisecond would carry a stale time
+    if (next_ == end_ || (next_ >> kSequenceBits) < nowMs()) {
+        next_ = reserve(kReserve);
+        end_ = next_ + kReserve;
     }
+    return make(next_++);
+}
 
-    // UUIDv7 structure:
-    // 48 bits: unix_ts_ms
-    //  4 bits: version (0111)
-    // 12 bits: rand_a (sequence counter for monotonicity)
-    //  2 bits: variant (10)
-    // 62 bits: rand_b
+void UuidV7Generator::generateBatch(std::span<VectorUuid> out) {
+    if (out.empty()) return;
+    uint64_t counter = reserve(out.size());
+    for (VectorUuid& uuid : out) uuid = make(counter++);
+    // Ids from the single path must stay above this batch
+    next_ = end_ = 0;
+}
 
-    uint64_t unix_ts_ms = last_ms_;
+VectorUuid UuidV7Generator::make(uint64_t counter) {
+    VectorUuid uuid;
+    uuid.hi = ((counter >> kSequenceBits) & 0xFFFFFFFFFFFFULL) << 16;
 
-    // rand_a contains the sequence for monotonicity within the same millisecond
-    uint16_t rand_a = sequence_;
+    // Version and rand_a
+    uuid.hi |= 0x7000 | (counter & 0x0FFF);
 
-    // rand_b is random
-    uint64_t rand_b = dist_(rng_);
+    // Variant and rand_b
+    uuid.lo = 0x8000000000000000ULL | (rng_() & 0x3FFFFFFFFFFFFFFFULL);
 
-    std::array<uint8_t, 16> bytes;
+    return uuid;
+}
 
-    bytes[0] = (unix_ts_ms >> 40) & 0xFF;
-    bytes[1] = (unix_ts_ms >> 32) & 0xFF;
-    bytes[2] = (unix_ts_ms >> 24) & 0xFF;
-    bytes[3] = (unix_ts_ms >> 16) & 0xFF;
-    bytes[4] = (unix_ts_ms >> 8) & 0xFF;
-    bytes[5] = unix_ts_ms & 0xFF;
+std::string uuid_to_string(const VectorUuid& uuid) {
+    std::string out(kUuidStringLength, '\0');
+    format_uuid(uuid, out.data());
+    return out;
+}
 
-    // Version and rand_a
-    bytes[6] = 0x70 | ((rand_a >> 8) & 0x0F);
-    bytes[7] = rand_a & 0xFF;
+std::optional<VectorUuid> parse_uuid(std::string_view text) {
+    if (text.size() != kUuidStringLength) {
+        return std::nullopt;
+    }
 
-    // Variant and rand_b
-    bytes[8] = 0x80 | ((rand_b >> 56) & 0x3F);
-    bytes[9] = (rand_b >> 48) & 0xFF;
-    bytes[10] = (rand_b >> 40) & 0xFF;
-    bytes[11] = (rand_b >> 32) & 0xFF;
-    bytes[12] = (rand_b >> 24) & 0xFF;
-    bytes[13] = (rand_b >> 16) & 0xFF;
-    bytes[14] = (rand_b >> 8) & 0xFF;
-    bytes[15] = rand_b & 0xFF;
-
-    return fmt::format("{:02x}{:02x}{:02x}{:02x}-{:02x}{:02x}-{:02x}{:02x}-{:02x}{:02x}-{:02x}{:02x}{:02x}{:02x}{:02x}{:02x}",
-        bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5], bytes[6], bytes[7],
-        bytes[8], bytes[9], bytes[10], bytes[11], bytes[12], bytes[13], bytes[14], bytes[15]);
+    VectorUuid uuid;
+    int nibbles = 0;
+    for (size_t pos = 0; pos < text.size(); ++pos) {
+        char c = text[pos];
+        if (pos == 8 || pos == 13 || pos == 18 || pos == 23) {
+            if (c != '-') return std::nullopt;
+            continue;
+        }
+
+        uint64_t v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else return std::nullopt;
+
+        uint64_t& half = nibbles < 16 ? uuid.hi : uuid.lo;
+        half = (half << 4) | v;
+        ++nibbles;
+    }
+    return uuid;
 }
 
 } // namespace woved::util
@@ -1,32 +1,100 @@
 #ifndef WOVED_UTIL_UUID_H
 #define WOVED_UTIL_UUID_H
 
+#include "include/woved/types.h"
 #include <string>
+#include <string_view>
 #include <cstdint>
+#include <optional>
 #include <random>
+#include <span>
 
 namespace woved::util {
 
 /**
  * @brief A class for generating version 7 UUIDs (time-ordered).
+ * * The 48-bit millisecond timestamp and the 12-bit rand_a field together
+ * * form one counter, taken from a process-wide clock that never runs
+ * * backwards: each id is above every id handed out before it, and when
+ * * the 4096 sequence values of a millisecond run out, the timestamp moves
+ * * on to the next millisecond ahead of the wall clock (RFC 9562, 6.2).
+ * * A generator reserves a run of counter values with one atomic update
+ * * and hands them out alone, so it must not be shared between threads:
+ * * use local(), or one per thread. A reserved run is dropped once the
+ * * wall clock passes its millisecond, so timestamps stay current.
+ * * Ids of one generator increase; ids of different generators are
+ * * distinct but may interleave within a millisecond. The other 62 bits
+ * * are random.
  */
 class UuidV7Generator {
 public:
     UuidV7Generator();
 
+    /**
+     * @brief The calling thread's generator.
+     */
+    static UuidV7Generator& local();
+
     /**
      * @brief Generates a new UUIDv7.
      * @return A string representation of the UUID.
      */
     std::string generate();
 
+    /**
+     * @brief Generates a new UUIDv7 without formatting it.
+     * @return The 128-bit UUID.
+     */
+    VectorUuid generateBinary();
+
+    /**
+     * @brief Fills `out` with increasing UUIDv7s, reserving them together.
+     */
+    void generateBatch(std::span<VectorUuid> out);
+
 private:
-    uint64_t last_ms_ = 0;
-    uint16_t sequence_ = 0;
+    static constexpr uint64_t kReserve = 64;  // Counter values taken at once by generateBinary()
+
+    uint64_t next_ = 0;   // Reserved counter values: [next_, end_)
+    uint64_t end_ = 0;
     std::mt19937_64 rng_;
-    std::uniform_int_distribution<uint64_t> dist_;
+
+    VectorUuid make(uint64_t counter);
 };
 
+/**
+ * @brief Length of the canonical 8-4-4-4-12 UUID string.
+ */
+constexpr size_t kUuidStringLength = 36;
+
+/**
+ * @brief Writes the canonical lower-case form of a UUID.
+ * @param uuid The UUID to format.
+ * @param out Destination of at least kUuidStringLength bytes (not terminated).
+ */
+inline void format_uuid(const VectorUuid& uuid, char* out) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    size_t pos = 0;
+    for (int i = 0; i < 16; ++i) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) out[pos++] = '-';
+        uint64_t half = i < 8 ? uuid.hi : uuid.lo;
+        auto byte = static_cast<uint8_t>(half >> (56 - 8 * (i % 8)));
+        out[pos++] = kHex[byte >> 4];
+        out[pos++] = kHex[byte & 0xF];
+    }
+}
+
+/**
+ * @brief Formats a UUID as its canonical string.
+ */
+std::string uuid_to_string(const VectorUuid& uuid);
+
+/**
+ * @brief Parses a canonical (hyphenated, any case) UUID string.
+ * @return The UUID, or std::nullopt if `text` is not a UUID.
+ */
+std::optional<VectorUuid> parse_uuid(std::string_view text);
+
 } // namespace woved::util
 
 #endif // WOVED_UTIL_UUID_H
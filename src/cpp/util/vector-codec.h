@@ -0,0 +1,174 @@
+#ifndef WOVED_UTIL_VECTOR_CODEC_H
+#define WOVED_UTIL_VECTOR_CODEC_H
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "include/woved/types.h"
+#include "util/exceptions.h"
+
+namespace woved::util {
+
+/**
+ * @brief Parses CollectionConfig::element_type ("fp32", "fp16", "bf16", "int8").
+ */
+inline ElementType parse_element_type(const std::string& name) {
+    if (name == "fp32") return ElementType::FP32;
+    if (name == "fp16") return ElementType::FP16;
+    if (name == "bf16") return ElementType::BF16;
+    if (name == "int8") return ElementType::INT8;
+    throw ConfigException("unknown element type: " + name);
+}
+
+/**
+ * @brief Parses CollectionConfig::metric ("inner_product", "l2", "cosine").
+ */
+inline Metric parse_metric(const std::string& name) {
+    if (name == "inner_product") return Metric::INNER_PRODUCT;
+    if (name == "l2") return Metric::L2;
+    if (name == "cosine") return Metric::COSINE;
+    throw ConfigException("unknown metric: " + name);
+}
+
+/**
+ * @brief Bytes per stored vector component.
+ */
+constexpr size_t element_size(ElementType type) {
+    switch (type) {
+        case ElementType::FP32: return 4;
+        case ElementType::FP16: return 2;
+        case ElementType::BF16: return 2;
+        case ElementType::INT8: return 1;
+    }
+    return 4;
+}
+
+/**
+ * @brief IEEE binary16 to float.
+ */
+inline float fp16_to_float(uint16_t h) {
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if (exp == 0x1f) {
+        return std::bit_cast<float>(sign | 0x7f800000 | (mant << 13));
+    }
+    if (exp == 0) {
+        // Zero or subnormal: mant * 2^-24
+        float v = static_cast<float>(mant) * 5.9604644775390625e-8f;
+        return sign ? -v : v;
+    }
+    return std::bit_cast<float>(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+/**
+ * @brief Float to IEEE binary16, round to nearest even.
+ * * Values beyond the half range become infinity.
+ */
+inline uint16_t float_to_fp16(float f) {
+    uint32_t x = std::bit_cast<uint32_t>(f);
+    uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+    uint32_t abs = x & 0x7fffffff;
+    if (abs >= 0x7f800000) {
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477ff000) {
+        return sign | 0x7c00;  // Rounds past 65504
+    }
+    if (abs < 0x38800000) {
+        // Subnormal half (or zero): let the FPU do the rounding
+        float v = std::bit_cast<float>(abs) * 16777216.0f;  // * 2^24
+        return sign | static_cast<uint16_t>(std::nearbyint(v));
+    }
+    uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1);
+    return sign | static_cast<uint16_t>((rounded - (112u << 23)) >> 13);
+}
+
+/**
+ * @brief bfloat16 to float.
+ */
+inline float bf16_to_float(uint16_t b) {
+    return std::bit_cast<float>(static_cast<uint32_t>(b) << 16);
+}
+
+/**
+ * @brief Float to bfloat16, round to nearest even (NaN stays NaN).
+ */
+inline uint16_t float_to_bf16(float f) {
+    uint32_t x = std::bit_cast<uint32_t>(f);
+    if ((x & 0x7fffffff) > 0x7f800000) {
+        return static_cast<uint16_t>((x >> 16) | 0x40);
+    }
+    return static_cast<uint16_t>((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+}
+
+/**
+ * @brief Encodes `dim` floats into `out` as `type`.
+ * * INT8 is symmetric per vector: component = scale * q with q in
+ * * [-127, 127] and scale = max|x| / 127.
+ * * @return The per-vector scale (1 for the floating point types).
+ */
+inline float encode_vector(const float* in, size_t dim, ElementType type, void* out) {
+    switch (type) {
+        case ElementType::FP32:
+            std::memcpy(out, in, dim * sizeof(float));
+            return 1.0f;
+        case ElementType::FP16: {
+            auto* o = static_cast<uint16_t*>(out);
+            for (size_t i = 0; i < dim; ++i) o[i] = float_to_fp16(in[i]);
+            return 1.0f;
+        }
+        case ElementType::BF16: {
+            auto* o = static_cast<uint16_t*>(out);
+            for (size_t i = 0; i < dim; ++i) o[i] = float_to_bf16(in[i]);
+            return 1.0f;
+        }
+        case ElementType::INT8: {
+            float max_abs = 0.0f;
+            for (size_t i = 0; i < dim; ++i) max_abs = std::max(max_abs, std::fabs(in[i]));
+            float scale = max_abs / 127.0f;
+            float inv = scale > 0.0f ? 1.0f / scale : 0.0f;
+            auto* o = static_cast<int8_t*>(out);
+            for (size_t i = 0; i < dim; ++i) {
+                float q = std::nearbyint(in[i] * inv);
+                o[i] = static_cast<int8_t>(std::clamp(q, -127.0f, 127.0f));
+            }
+            return scale;
+        }
+    }
+    return 1.0f;
+}
+
+/**
+ * @brief Decodes `dim` components written by encode_vector() back to floats.
+ */
+inline void decode_vector(const void* in, size_t dim, ElementType type, float scale, float* out) {
+    switch (type) {
+        case ElementType::FP32:
+            std::memcpy(out, in, dim * sizeof(float));
+            return;
+        case ElementType::FP16: {
+            auto* p = static_cast<const uint16_t*>(in);
+            for (size_t i = 0; i < dim; ++i) out[i] = fp16_to_float(p[i]);
+            return;
+        }
+        case ElementType::BF16: {
+            auto* p = static_cast<const uint16_t*>(in);
+            for (size_t i = 0; i < dim; ++i) out[i] = bf16_to_float(p[i]);
+            return;
+        }
+        case ElementType::INT8: {
+            auto* p = static_cast<const int8_t*>(in);
+            for (size_t i = 0; i < dim; ++i) out[i] = scale * static_cast<float>(p[i]);
+            return;
+        }
+    }
+}
+
+} // namespace woved::util
+
+#endif // WOVED_UTIL_VECTOR_CODEC_H
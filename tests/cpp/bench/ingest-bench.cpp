@@ -0,0 +1,451 @@
+// ingest-bench: sustained ingest throughput, commit latency and write
+// amplification per layer.
+//
+//   ingest-bench [--config=configs/woved-bench.yaml] [--mix=100:0:0,50:40:10]
+//                [--keys=10000000] [--theta=0.99] [--writers=8] [--batch=100]
+//                [--duration_s=60] [--window_ms=1000] [--workdir=DIR]
+//                [benchmark flags]
+//
+// Each mix (insert:overwrite:delete percentages) runs once, on a fresh data
+// directory, through the write path as the server puts it together:
+// WalManager, MessageBuffer, FlushScheduler into the B-epsilon tree, its
+// leaf sink writing delta segments, and SegmentManager compacting them.
+// Inserts take fresh ids; overwrites and deletes pick an id already
+// written, Zipfian over the keyspace with skew `theta`.
+//
+// Logical bytes are what the client asked to store (id and vector of an
+// upsert, id of a delete). Every layer's bytes are reported against them:
+// WAL appends, buffer flushes into the tree (in memory, so not counted as
+// device writes), delta segment writes and compaction output. write_amp is
+// WAL, segment and compaction bytes over logical bytes once everything is
+// drained; write_amp_p50/p95 are the same ratio over each window_ms window
+// of the run, checked against constants::MAX_WRITE_AMP_P50/P95, and
+// ops_per_s against constants::TARGET_INGEST_QPS.
+
+#include "core/config.h"
+#include "storage/betree/b-epsilon-tree.h"
+#include "storage/betree/flush-scheduler.h"
+#include "storage/buffer/msg-buf.h"
+#include "storage/latest-by-id.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-manager.h"
+#include "storage/wal/wal-manager.h"
+#include "storage/wal/wal-record.h"
+#include "util/hash.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace woved;
+
+struct Mix {
+    double insert = 100;
+    double overwrite = 0;
+    double remove = 0;
+    std::string name;
+};
+
+struct Args {
+    std::string config = "configs/woved-bench.yaml";
+    std::string workdir = "/tmp/woved-ingest-bench";
+    std::vector<Mix> mixes;
+    uint64_t keys = 10000000;
+    double theta = 0.99;
+    size_t writers = 8;
+    size_t batch = 100;
+    uint32_t duration_s = 60;
+    uint32_t window_ms = 1000;
+};
+
+[[noreturn]] void fail(const std::string& message) {
+    std::fprintf(stderr, "ingest-bench: %s\n", message.c_str());
+    std::exit(2);
+}
+
+std::vector<Mix> parseMixes(const std::string& value) {
+    std::vector<Mix> out;
+    size_t start = 0;
+    while (start < value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) end = value.size();
+        Mix mix;
+        mix.name = value.substr(start, end - start);
+        if (std::sscanf(mix.name.c_str(), "%lf:%lf:%lf", &mix.insert, &mix.overwrite, &mix.remove) != 3 ||
+            mix.insert <= 0 || mix.overwrite < 0 || mix.remove < 0) {
+            fail("mix " + mix.name + " is not insert:overwrite:delete with some inserts");
+        }
+        out.push_back(mix);
+        start = end + 1;
+    }
+    return out;
+}
+
+// Our flags, after benchmark::Initialize() has taken its own
+Args parseArgs(int argc, char** argv) {
+    Args args;
+    std::string mixes = "100:0:0,50:40:10,20:60:20";
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) fail("unknown argument " + arg);
+        const std::string name = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+        if (name == "config") args.config = value;
+        else if (name == "workdir") args.workdir = value;
+        else if (name == "mix") mixes = value;
+        else if (name == "keys") args.keys = std::strtoull(value.c_str(), nullptr, 10);
+        else if (name == "theta") args.theta = std::atof(value.c_str());
+        else if (name == "writers") args.writers = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "batch") args.batch = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "duration_s") args.duration_s = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        else if (name == "window_ms") args.window_ms = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        else fail("unknown argument " + arg);
+    }
+    args.mixes = parseMixes(mixes);
+    if (args.keys == 0 || args.writers == 0 || args.batch == 0 || args.window_ms == 0) fail("zero-sized run");
+    if (args.theta < 0 || args.theta >= 1) fail("--theta must be in [0, 1)");
+    return args;
+}
+
+// Zipfian ranks in [0, n), rank 0 the most frequent (Gray et al.,
+// "Quickly generating billion-record synthetic databases")
+class Zipfian {
+public:
+    Zipfian(uint64_t n, double theta) : n_(n), theta_(theta) {
+        for (uint64_t i = 1; i <= n; ++i) zetan_ += 1.0 / std::pow(double(i), theta);
+        const double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - std::pow(2.0 / double(n), 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+
+    uint64_t operator()(std::mt19937_64& rng) const {
+        const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        const double uz = u * zetan_;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta_)) return 1;
+        return std::min<uint64_t>(n_ - 1, static_cast<uint64_t>(double(n_) * std::pow(eta_ * u - eta_ + 1.0, alpha_)));
+    }
+
+private:
+    uint64_t n_;
+    double theta_;
+    double zetan_ = 0;
+    double alpha_ = 0;
+    double eta_ = 0;
+};
+
+// Bytes written by each layer so far
+struct Layers {
+    uint64_t logical = 0;
+    uint64_t wal = 0;
+    uint64_t flush = 0;
+    uint64_t segments = 0;
+    uint64_t compaction = 0;
+
+    uint64_t device() const { return wal + segments + compaction; }
+};
+
+storage::BTreeConfig treeConfig(const BTreeConfig& c) {
+    storage::BTreeConfig tree;
+    tree.node_size_bytes = c.node_size_kb * 1024;
+    tree.fanout = c.fanout;
+    tree.epsilon = c.epsilon;
+    tree.min_epsilon = c.min_epsilon;
+    tree.max_epsilon = c.max_epsilon;
+    tree.adaptive_epsilon = c.adaptive_epsilon;
+    tree.hot_partition_threshold = c.hot_partition_threshold;
+    tree.direct_flush_threshold = c.direct_flush_threshold;
+    tree.direct_flush_min_bytes = c.direct_flush_min_bytes;
+    tree.parallel_flush = c.parallel_flush;
+    tree.flush_threads = c.flush_threads;
+    tree.node_cache_bytes = size_t{c.node_cache_mb} << 20;
+    tree.node_cache_protected_level = c.node_cache_protected_level;
+    return tree;
+}
+
+uint64_t fileBytes(const std::string& path) {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+// One mix, from an empty data directory to a drained tree
+class IngestRun {
+public:
+    IngestRun(const Args& args, const Mix& mix, const std::string& dir)
+        : args_(args), mix_(mix), dir_(dir), zipf_(args.keys, args.theta) {
+        std::filesystem::remove_all(dir_);
+        std::filesystem::create_directories(dir_ + "/segments");
+        dim_ = g_config.collection.dim;
+
+        wal_ = std::make_unique<storage::WalManager>(storage::WalManager::Options::fromConfig(g_config, dir_ + "/wal"));
+
+        storage::MessageBuffer::Config buffer;
+        buffer.max_bytes = g_config.storage.buffer.size_bytes;
+        buffer.shard_count = g_config.storage.buffer.shard_count;
+        buffer.flush_threshold_bytes = g_config.storage.buffer.flush_threshold_bytes;
+        buffer.dedupe_enabled = g_config.storage.buffer.dedupe_enabled;
+        buffer.dim = dim_;
+        buffer.leaf_of = [this](const VectorEntry& entry) { return entry.id_hash % leaves_; };
+        latest_ = std::make_shared<storage::LatestByIdMap>();
+        buffer_ = std::make_unique<storage::MessageBuffer>(buffer, latest_);
+
+        auto delta = storage::DeltaSegmentWriter::Options::fromConfig(g_config);
+        segments_ = std::make_shared<storage::SegmentManager>(
+            storage::SegmentManager::Options::fromConfig(g_config),
+            [this](const storage::SegmentManager::Plan&) { return segmentPath(); },
+            [this](const storage::SegmentManager::Plan&, const SegmentDescriptor& merged) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                layers_.compaction += fileBytes(merged.file_path);
+            });
+
+        tree_ = std::make_unique<storage::BEpsilonTree>(treeConfig(g_config.storage.btree), segments_);
+        leaves_ = std::max<size_t>(1, tree_->leafCount());
+        tree_->setLeafSink([this, delta](size_t leaf, std::span<const storage::BEpsilonNode::Message> messages) {
+            std::vector<storage::DeltaRow> rows;
+            rows.reserve(messages.size());
+            for (const auto& m : messages) {
+                const VectorEntry& entry = m.msg.entry;
+                storage::DeltaRow row;
+                row.id_hash = m.id_hash;
+                row.epoch = m.msg.epoch;
+                row.tombstone = m.msg.op == OperationType::DELETE;
+                row.centroid_id = entry.centroid_id;
+                row.id = entry.id;
+                row.vector = entry.vector.data();
+                row.vector_len = static_cast<uint32_t>(entry.vector.size());
+                rows.push_back(row);
+            }
+            const std::string path = segmentPath();
+            auto descriptor = storage::DeltaSegmentWriter::write(path, delta, rows);
+            segments_->add(leaf, descriptor);
+            std::lock_guard<std::mutex> lock(mutex_);
+            layers_.segments += fileBytes(path);
+        });
+
+        scheduler_ = std::make_unique<storage::FlushScheduler>(
+            storage::FlushScheduler::Options::fromConfig(g_config.storage), *buffer_,
+            [this](const storage::LeafSlice& slice) {
+                uint64_t bytes = 0;
+                for (const auto& view : slice.messages()) {
+                    BTreeMessage msg = view.materialize();
+                    bytes += msg.entry.id.size() + msg.entry.vector.size() * sizeof(float);
+                    tree_->apply(std::move(msg));
+                }
+                tree_->flush(false);
+                std::lock_guard<std::mutex> lock(mutex_);
+                layers_.flush += bytes;
+            });
+    }
+
+    ~IngestRun() {
+        scheduler_->stop();
+        segments_->stop();
+    }
+
+    void run(benchmark::State& state) {
+        scheduler_->start();
+        segments_->start();
+
+        std::atomic<bool> stop{false};
+        std::vector<std::vector<double>> latencies(args_.writers);
+        std::vector<std::thread> writers;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t w = 0; w < args_.writers; ++w) {
+            writers.emplace_back([&, w] { write(w, stop, latencies[w]); });
+        }
+
+        // Per window write amplification, while the run goes on
+        std::vector<double> window_amp;
+        Layers last = snapshot();
+        const auto deadline = start + std::chrono::seconds(args_.duration_s);
+        while (std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(args_.window_ms));
+            const Layers now = snapshot();
+            if (now.logical > last.logical) {
+                window_amp.push_back(double(now.device() - last.device()) / double(now.logical - last.logical));
+            }
+            last = now;
+        }
+        stop.store(true);
+        for (auto& t : writers) t.join();
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const uint64_t ops = ops_.load();
+
+        // Drain, so every byte the run caused is counted
+        scheduler_->flushAll();
+        tree_->flush(true);
+        while (segments_->compactOnce()) {
+        }
+        const Layers total = snapshot();
+        state.SetIterationTime(elapsed);
+
+        std::vector<double> all;
+        for (const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+        const double logical = std::max<double>(1, double(total.logical));
+        const double amp = double(total.device()) / logical;
+        const double amp_p50 = percentile(window_amp, 0.50);
+        const double amp_p95 = percentile(window_amp, 0.95);
+        const double ops_per_s = double(ops) / elapsed;
+        state.counters["ops_per_s"] = ops_per_s;
+        state.counters["commit_p50_ms"] = percentile(all, 0.50);
+        state.counters["commit_p99_ms"] = percentile(all, 0.99);
+        state.counters["logical_mb"] = double(total.logical) / 1048576;
+        state.counters["wal_amp"] = double(total.wal) / logical;
+        state.counters["flush_amp"] = double(total.flush) / logical;
+        state.counters["segment_amp"] = double(total.segments) / logical;
+        state.counters["compaction_amp"] = double(total.compaction) / logical;
+        state.counters["write_amp"] = amp;
+        state.counters["write_amp_p50"] = amp_p50;
+        state.counters["write_amp_p95"] = amp_p95;
+        state.counters["meets_target"] = ops_per_s >= constants::TARGET_INGEST_QPS &&
+                                                 amp_p50 <= constants::MAX_WRITE_AMP_P50 &&
+                                                 amp_p95 <= constants::MAX_WRITE_AMP_P95
+                                             ? 1.0
+                                             : 0.0;
+    }
+
+private:
+    const Args& args_;
+    Mix mix_;
+    std::string dir_;
+    Zipfian zipf_;
+    uint32_t dim_ = 0;
+    size_t leaves_ = 1;
+
+    std::unique_ptr<storage::WalManager> wal_;
+    std::shared_ptr<storage::LatestByIdMap> latest_;
+    std::unique_ptr<storage::MessageBuffer> buffer_;
+    std::shared_ptr<storage::SegmentManager> segments_;
+    std::unique_ptr<storage::BEpsilonTree> tree_;
+    std::unique_ptr<storage::FlushScheduler> scheduler_;
+
+    std::atomic<Epoch> epoch_{0};
+    std::atomic<uint64_t> inserted_{0};
+    std::atomic<uint64_t> ops_{0};
+    std::atomic<uint64_t> segment_seq_{0};
+    std::atomic<uint64_t> logical_{0};
+    std::mutex mutex_;  // layers_
+    Layers layers_;
+
+    std::string segmentPath() {
+        return dir_ + "/segments/seg-" + std::to_string(segment_seq_.fetch_add(1)) + ".wvs";
+    }
+
+    Layers snapshot() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Layers l = layers_;
+        l.logical = logical_.load();
+        l.wal = wal_->getStats().bytes;
+        return l;
+    }
+
+    static double percentile(std::vector<double> values, double p) {
+        if (values.empty()) return 0;
+        const size_t i = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + i, values.end());
+        return values[i];
+    }
+
+    // An id already written, Zipfian by rank; ranks are scattered over the
+    // inserted ids so the hot ones are not all the oldest
+    uint64_t existing(std::mt19937_64& rng) const {
+        const uint64_t n = std::max<uint64_t>(1, inserted_.load(std::memory_order_relaxed));
+        return (zipf_(rng) * 0x9E3779B97F4A7C15ull) % n;
+    }
+
+    void write(size_t writer, const std::atomic<bool>& stop, std::vector<double>& latencies) {
+        std::mt19937_64 rng(writer + 1);
+        std::uniform_real_distribution<double> pick(0.0, mix_.insert + mix_.overwrite + mix_.remove);
+        std::normal_distribution<float> component;
+        std::vector<BTreeMessage> batch(args_.batch);
+        std::vector<storage::WalRecordView> views(args_.batch);
+        while (!stop.load(std::memory_order_relaxed)) {
+            uint64_t logical = 0;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                const double p = pick(rng);
+                const bool remove = p >= mix_.insert + mix_.overwrite;
+                const uint64_t key = p < mix_.insert ? inserted_.fetch_add(1) : existing(rng);
+
+                BTreeMessage& msg = batch[i];
+                VectorEntry& entry = msg.entry;
+                msg.op = remove ? OperationType::DELETE : OperationType::UPSERT;
+                msg.timestamp = std::chrono::duration_cast<Timestamp>(
+                    std::chrono::system_clock::now().time_since_epoch());
+                entry.id = std::to_string(key);
+                entry.id_hash = util::hash_id(entry.id);
+                entry.deleted = remove;
+                entry.created_at = entry.updated_at = msg.timestamp;
+                entry.vector.resize(remove ? 0 : dim_);
+                for (float& x : entry.vector) x = component(rng);
+                logical += entry.id.size() + entry.vector.size() * sizeof(float);
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            const Epoch first = epoch_.fetch_add(batch.size()) + 1;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                BTreeMessage& msg = batch[i];
+                msg.epoch = first + i;
+                storage::WalRecordView& rec = views[i];
+                rec.op = msg.entry.deleted ? storage::WalOp::DELETE : storage::WalOp::UPSERT;
+                rec.id = msg.entry.id;
+                rec.id_hash = msg.entry.id_hash;
+                rec.timestamp_nanos = static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(msg.timestamp).count());
+                rec.vector = msg.entry.vector;
+                rec.epoch = msg.epoch;
+                if (i + 1 < batch.size()) {
+                    wal_->append(rec);
+                } else {
+                    wal_->commit(rec);  // Durable, with everything before it
+                }
+            }
+            for (const auto& msg : batch) {
+                while (!buffer_->append(msg.entry.id_hash, msg).accepted()) {
+                    buffer_->waitForSpace(std::chrono::milliseconds(10));
+                }
+            }
+            latencies.push_back(
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            ops_.fetch_add(batch.size(), std::memory_order_relaxed);
+            logical_.fetch_add(logical, std::memory_order_relaxed);
+        }
+    }
+};
+
+void registerBenchmarks(const Args& args) {
+    for (const auto& mix : args.mixes) {
+        const std::string name = "ingest/mix:" + mix.name;
+        benchmark::RegisterBenchmark(name.c_str(), [&args, mix](benchmark::State& state) {
+            for (auto _ : state) {
+                IngestRun run(args, mix, args.workdir + "/run");
+                run.run(state);
+            }
+        })->Iterations(1)->UseManualTime()->Unit(benchmark::kSecond);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    static const Args args = parseArgs(argc, argv);
+    if (!loadConfig(args.config)) fail("cannot load " + args.config);
+    registerBenchmarks(args);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,256 @@
+// kernel-bench: distance kernel throughput per instruction set.
+//
+//   kernel-bench [benchmark flags]
+//
+// Runs every kernel table the build has and the host can run (base, AVX2,
+// AVX-512, NEON, SVE, and the AVX512-VNNI / AVX512-BF16 / AMX extension
+// kernels), not just the one distance_table() picks, for each dim and
+// element type, one vector at a time (pair) and batched (block: one query
+// by many vectors; matrix: kMatrixQueries queries by many vectors), and
+// the fixed-dim fp32 kernels where a table has them. Each runs over a
+// working set sized to stay in L1, in L2, or to stream from DRAM, and
+// reports GFLOP/s (2 * dim flops per distance) and bytes/cycle of vector
+// data read, at the cycle rate Google Benchmark measured.
+//
+// Names are <isa>/<type>/<op>/<mode>/dim:<d>/<L1|L2|DRAM>, so CI can pick
+// a host's kernels with --benchmark_filter and compare runs with
+// scripts/benchmark.sh.
+
+#include "util/cpu-dispatch.h"
+#include "util/simd-dispatch.h"
+#include "util/vector-codec.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using namespace woved;
+using namespace woved::kernels;
+
+constexpr size_t kDims[] = {96, 128, 384, 768, 1024, 1536};
+constexpr size_t kMatrixQueries = 8;
+
+struct WorkingSet {
+    const char* name;
+    size_t bytes;
+};
+
+// Data only: a little under each level, so the query and outputs fit too.
+// DRAM is well past the last-level cache of current server parts.
+constexpr WorkingSet kWorkingSets[] = {
+    {"L1", 24 * 1024},
+    {"L2", 768 * 1024},
+    {"DRAM", 512 * 1024 * 1024},
+};
+
+struct Isa {
+    std::string name;
+    const DistanceTable* table;
+    const FixedDimKernels* fixed;  // Null: no fixed-dim kernels
+};
+
+std::vector<Isa> hostIsas() {
+    const auto& f = util::cpu_features();
+    std::vector<Isa> isas = {{"base", &base::table, base::fixed_dims}};
+#ifdef WOVED_KERNELS_AVX2
+    if (f.avx2 && f.fma && f.f16c) isas.push_back({"avx2", &avx2::table, avx2::fixed_dims});
+#endif
+#ifdef WOVED_KERNELS_AVX512
+    if (f.avx512f && f.avx512dq) isas.push_back({"avx512", &avx512::table, avx512::fixed_dims});
+#endif
+#ifdef WOVED_KERNELS_NEON
+    if (f.neon) isas.push_back({"neon", &neon::table, nullptr});
+#endif
+#ifdef WOVED_KERNELS_SVE
+    if (f.sve) isas.push_back({"sve", &sve::table, nullptr});
+#endif
+    (void)f;
+    return isas;
+}
+
+// Rows of random data of one element type, shared by every benchmark of it
+struct Data {
+    std::vector<float> queries;     // kMatrixQueries x dim
+    std::vector<std::byte> rows;    // Encoded, dim apart
+    std::vector<float> scales;
+    size_t count = 0;
+};
+
+const Data& data(ElementType type, size_t dim, size_t bytes) {
+    static std::map<std::tuple<ElementType, size_t, size_t>, Data> cache;
+    auto [it, inserted] = cache.try_emplace({type, dim, bytes});
+    Data& d = it->second;
+    if (!inserted) return d;
+
+    std::mt19937 rng(42);
+    std::normal_distribution<float> component;
+    d.queries.resize(kMatrixQueries * dim);
+    for (float& x : d.queries) x = component(rng);
+    const size_t row_bytes = dim * util::element_size(type);
+    d.count = std::max<size_t>(kMatrixQueries, bytes / row_bytes);
+    d.rows.resize(d.count * row_bytes);
+    d.scales.resize(d.count);
+    std::vector<float> row(dim);
+    for (size_t r = 0; r < d.count; ++r) {
+        for (float& x : row) x = component(rng);
+        d.scales[r] = util::encode_vector(row.data(), dim, type, d.rows.data() + r * row_bytes);
+    }
+    return d;
+}
+
+// Pass over the working set: returns the distances computed
+using Pass = std::function<size_t(const Data& d, size_t dim, float* out)>;
+
+void run(benchmark::State& state, ElementType type, size_t dim, size_t bytes, const Pass& pass) {
+    const Data& d = data(type, dim, bytes);
+    std::vector<float> out(kMatrixQueries * d.count);
+    size_t distances = 0;
+    for (auto _ : state) {
+        distances += pass(d, dim, out.data());
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    // Vector data is read once per query row of a pass
+    const double read = double(distances) * double(dim * util::element_size(type));
+    const double hz = benchmark::CPUInfo::Get().cycles_per_second;
+    state.counters["GFLOP/s"] = benchmark::Counter(2.0 * double(distances) * double(dim) / 1e9,
+                                                   benchmark::Counter::kIsRate);
+    state.counters["bytes/cycle"] = benchmark::Counter(hz > 0 ? read / hz : 0, benchmark::Counter::kIsRate);
+    state.SetItemsProcessed(static_cast<int64_t>(distances));
+}
+
+const char* typeName(ElementType type) {
+    switch (type) {
+        case ElementType::FP32: return "fp32";
+        case ElementType::FP16: return "fp16";
+        case ElementType::BF16: return "bf16";
+        case ElementType::INT8: return "int8";
+    }
+    return "?";
+}
+
+void add(const std::string& name, ElementType type, size_t dim, size_t bytes, Pass pass) {
+    benchmark::RegisterBenchmark(name.c_str(), [=](benchmark::State& state) {
+        run(state, type, dim, bytes, pass);
+    })->UseRealTime();
+}
+
+// The three fp32 shapes of one pair of kernels
+void addFp32(const std::string& prefix, const char* op, PairFn pair, BlockFn block, MatrixFn matrix,
+             size_t dim, const WorkingSet& ws) {
+    const std::string suffix = "/dim:" + std::to_string(dim) + "/" + ws.name;
+    const auto f32 = [](const Data& d) { return reinterpret_cast<const float*>(d.rows.data()); };
+    add(prefix + "/fp32/" + op + "/pair" + suffix, ElementType::FP32, dim, ws.bytes,
+        [pair, f32](const Data& d, size_t dim, float* out) {
+            const float* rows = f32(d);
+            for (size_t r = 0; r < d.count; ++r) out[r] = pair(d.queries.data(), rows + r * dim, dim);
+            return d.count;
+        });
+    add(prefix + "/fp32/" + op + "/block" + suffix, ElementType::FP32, dim, ws.bytes,
+        [block, f32](const Data& d, size_t dim, float* out) {
+            block(d.queries.data(), f32(d), d.count, dim, out);
+            return d.count;
+        });
+    add(prefix + "/fp32/" + op + "/matrix" + suffix, ElementType::FP32, dim, ws.bytes,
+        [matrix, f32](const Data& d, size_t dim, float* out) {
+            matrix(d.queries.data(), kMatrixQueries, f32(d), d.count, dim, out);
+            return kMatrixQueries * d.count;
+        });
+}
+
+void addEncoded(const std::string& prefix, ElementType type, const EncodedKernels& k, size_t dim,
+                const WorkingSet& ws) {
+    const std::string head = prefix + "/" + typeName(type) + "/";
+    const std::string suffix = "/dim:" + std::to_string(dim) + "/" + ws.name;
+    const size_t row_bytes = dim * util::element_size(type);
+    for (auto [op, fn] : {std::pair{"ip", k.inner_product}, std::pair{"l2", k.l2_sqr}}) {
+        if (!fn) continue;
+        add(head + op + "/pair" + suffix, type, dim, ws.bytes,
+            [fn, row_bytes](const Data& d, size_t dim, float* out) {
+                for (size_t r = 0; r < d.count; ++r) {
+                    out[r] = fn(d.queries.data(), d.rows.data() + r * row_bytes, d.scales[r], dim);
+                }
+                return d.count;
+            });
+    }
+    if (k.inner_product_block) {
+        add(head + "ip/block" + suffix, type, dim, ws.bytes,
+            [fn = k.inner_product_block](const Data& d, size_t dim, float* out) {
+                fn(d.queries.data(), d.rows.data(), d.scales.data(), d.count, dim, out, nullptr);
+                return d.count;
+            });
+    }
+    if (k.inner_product_matrix) {
+        add(head + "ip/matrix" + suffix, type, dim, ws.bytes,
+            [fn = k.inner_product_matrix](const Data& d, size_t dim, float* out) {
+                fn(d.queries.data(), kMatrixQueries, d.rows.data(), d.scales.data(), d.count, dim, out,
+                   nullptr);
+                return kMatrixQueries * d.count;
+            });
+    }
+}
+
+void addExtension(const std::string& name, ElementType type, const EncodedBatchKernels& k, size_t dim,
+                  const WorkingSet& ws) {
+    addEncoded(name, type, {nullptr, nullptr, k.inner_product_block, k.inner_product_matrix}, dim, ws);
+}
+
+void registerBenchmarks() {
+    const auto& features = util::cpu_features();
+    (void)features;
+    for (const Isa& isa : hostIsas()) {
+        const DistanceTable& t = *isa.table;
+        for (size_t dim : kDims) {
+            for (const WorkingSet& ws : kWorkingSets) {
+                addFp32(isa.name, "ip", t.inner_product, t.inner_product_block, t.inner_product_matrix,
+                        dim, ws);
+                addFp32(isa.name, "l2", t.l2_sqr, t.l2_sqr_block, t.l2_sqr_matrix, dim, ws);
+                for (size_t i = 0; isa.fixed && i < kFixedDimCount; ++i) {
+                    const FixedDimKernels& f = isa.fixed[i];
+                    if (f.dim != dim) continue;
+                    addFp32(isa.name + "-fixed", "ip", f.inner_product, f.inner_product_block,
+                            f.inner_product_matrix, dim, ws);
+                    addFp32(isa.name + "-fixed", "l2", f.l2_sqr, f.l2_sqr_block, f.l2_sqr_matrix, dim, ws);
+                }
+                addEncoded(isa.name, ElementType::FP16, t.fp16, dim, ws);
+                addEncoded(isa.name, ElementType::BF16, t.bf16, dim, ws);
+                addEncoded(isa.name, ElementType::INT8, t.int8, dim, ws);
+            }
+        }
+    }
+
+#ifdef WOVED_KERNELS_AMX
+    for (size_t dim : kDims) {
+        for (const WorkingSet& ws : kWorkingSets) {
+            if (features.avx512vnni) addExtension("vnni", ElementType::INT8, amx::int8_vnni, dim, ws);
+            if (features.avx512bf16) addExtension("avx512bf16", ElementType::BF16, amx::bf16_dot, dim, ws);
+            if (features.amx_int8 && util::request_amx()) {
+                addExtension("amx", ElementType::INT8, amx::int8_tiles, dim, ws);
+            }
+            if (features.amx_bf16 && util::request_amx()) {
+                addExtension("amx", ElementType::BF16, amx::bf16_tiles, dim, ws);
+            }
+        }
+    }
+#endif
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    registerBenchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,463 @@
+// pgo-train: profile training workload for WOVED_ENABLE_PGO builds.
+//
+//   pgo-train [--config=configs/woved-bench.yaml] [--workdir=DIR]
+//             [--rows=200000] [--dim=128] [--clusters=256]
+//             [--ingest_s=30] [--writers=4] [--batch=100] [--readers=4]
+//             [--queries=20000] [--k=10]
+//
+// Runs the paths that matter for speed, in proportions like a serving
+// node's, so the instrumented build (WOVED_PGO_STAGE=generate) records
+// representative branch and call counts. On a synthetic Gaussian mixture
+// of `clusters` centres:
+//   import   BulkLoader builds a delta and a stable tier (training the
+//            global centroids and the IVF-PQ model on the way)
+//   ingest   writers run inserts, overwrites and deletes (70:25:5)
+//            through WalManager, MessageBuffer and FlushScheduler into the
+//            B-epsilon tree, whose leaf sink writes delta segments that
+//            SegmentManager compacts, while readers search both tiers
+//            with the live buffer as the buffer phase
+//   drain    the buffer and the tree are flushed, compaction runs dry
+//   query    a sweep over nprobe, sample_p and rerank_factor per tier
+// scripts/build.sh --pgo builds with instrumentation, runs this and
+// rebuilds with the profile. It measures nothing itself.
+
+#include "core/config.h"
+#include "index/centroids-manager.h"
+#include "index/two-phase-engine.h"
+#include "storage/betree/b-epsilon-tree.h"
+#include "storage/betree/flush-scheduler.h"
+#include "storage/buffer/msg-buf.h"
+#include "storage/latest-by-id.h"
+#include "storage/segment/seg-bulk.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-manager.h"
+#include "storage/segment/seg-placement.h"
+#include "storage/segment/seg-stable.h"
+#include "storage/wal/wal-manager.h"
+#include "storage/wal/wal-record.h"
+#include "util/hash.h"
+#include "util/simd-dispatch.h"
+#include "util/thread-pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace woved;
+using Clock = std::chrono::steady_clock;
+
+struct Args {
+    std::string config = "configs/woved-bench.yaml";
+    std::string workdir = "/tmp/woved-pgo-train";
+    uint64_t rows = 200000;
+    uint32_t dim = 128;
+    uint32_t clusters = 256;
+    uint32_t ingest_s = 30;
+    size_t writers = 4;
+    size_t batch = 100;
+    size_t readers = 4;
+    size_t queries = 20000;
+    size_t k = 10;
+};
+
+[[noreturn]] void fail(const std::string& message) {
+    std::fprintf(stderr, "pgo-train: %s\n", message.c_str());
+    std::exit(2);
+}
+
+Args parseArgs(int argc, char** argv) {
+    Args args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) fail("unknown argument " + arg);
+        const std::string name = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+        if (name == "config") args.config = value;
+        else if (name == "workdir") args.workdir = value;
+        else if (name == "rows") args.rows = std::strtoull(value.c_str(), nullptr, 10);
+        else if (name == "dim") args.dim = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        else if (name == "clusters") args.clusters = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        else if (name == "ingest_s") args.ingest_s = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        else if (name == "writers") args.writers = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "batch") args.batch = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "readers") args.readers = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "queries") args.queries = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "k") args.k = std::strtoul(value.c_str(), nullptr, 10);
+        else fail("unknown argument " + arg);
+    }
+    if (args.rows == 0 || args.dim == 0 || args.clusters == 0 || args.batch == 0 || args.k == 0) {
+        fail("zero-sized run");
+    }
+    return args;
+}
+
+void log(const char* phase, Clock::time_point start) {
+    std::fprintf(stderr, "pgo-train: %s done, %.1fs\n", phase,
+                 std::chrono::duration<double>(Clock::now() - start).count());
+}
+
+// Points scattered around fixed centres, so IVF lists are uneven the way
+// real embeddings make them
+class Mixture {
+public:
+    Mixture(uint32_t dim, uint32_t clusters) : dim_(dim), centres_(size_t{dim} * clusters) {
+        std::mt19937_64 rng(7);
+        std::normal_distribution<float> component(0.0f, 1.0f);
+        for (float& x : centres_) x = component(rng);
+    }
+
+    void sample(std::mt19937_64& rng, float* out) const {
+        const size_t clusters = centres_.size() / dim_;
+        const float* centre = centres_.data() + std::uniform_int_distribution<size_t>(0, clusters - 1)(rng) * dim_;
+        std::normal_distribution<float> noise(0.0f, 0.35f);
+        for (uint32_t d = 0; d < dim_; ++d) out[d] = centre[d] + noise(rng);
+    }
+
+private:
+    uint32_t dim_;
+    std::vector<float> centres_;
+};
+
+void normalize(float* v, uint32_t dim) {
+    float norm = 0;
+    for (uint32_t d = 0; d < dim; ++d) norm += v[d] * v[d];
+    norm = std::sqrt(norm);
+    if (norm > 0) {
+        for (uint32_t d = 0; d < dim; ++d) v[d] /= norm;
+    }
+}
+
+// The dataset as BulkLoader reads it; ids are r<row>
+void writeDataset(const Args& args, const Mixture& mixture, const std::string& base, const std::string& ids) {
+    std::ofstream vectors(base, std::ios::binary);
+    std::ofstream names(ids);
+    std::mt19937_64 rng(11);
+    std::vector<float> row(args.dim);
+    const int32_t dim = static_cast<int32_t>(args.dim);
+    for (uint64_t r = 0; r < args.rows; ++r) {
+        mixture.sample(rng, row.data());
+        vectors.write(reinterpret_cast<const char*>(&dim), sizeof(dim));
+        vectors.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+        names << 'r' << r << '\n';
+    }
+    if (!vectors || !names) fail("cannot write " + base);
+}
+
+struct Tier {
+    std::vector<std::unique_ptr<storage::DeltaSegment>> delta;
+    std::vector<std::unique_ptr<storage::StableSegment>> stable;
+    std::vector<const storage::DeltaSegment*> delta_ptrs;
+    std::vector<const storage::StableSegment*> stable_ptrs;
+};
+
+void import(const Args& args, index::CentroidsManager& centroids, util::ThreadPool& pool, const std::string& base,
+            const std::string& ids, bool stable, Tier& tier) {
+    const std::string dir = args.workdir + (stable ? "/stable" : "/delta");
+    storage::SegmentPlacement::Options placement_options;
+    placement_options.dirs = {dir};
+    placement_options.reserve_bytes = 0;
+    storage::SegmentPlacement placement(placement_options);
+
+    uint32_t next_ordinal = 1;
+    storage::BulkLoader loader(
+        storage::BulkLoader::Options::fromConfig(g_config), centroids, placement, pool,
+        std::make_shared<storage::LatestByIdMap>(), [] { return Epoch{1}; },
+        [&](const std::vector<SegmentDescriptor>& segments) {
+            std::vector<uint32_t> ordinals;
+            for (size_t i = 0; i < segments.size(); ++i) ordinals.push_back(next_ordinal++);
+            return ordinals;
+        });
+    storage::BulkLoader::Request request;
+    request.files = {base};
+    request.ids_file = ids;
+    request.stable = stable;
+    for (const auto& segment : loader.run(request).segments) {
+        const auto read = storage::SegmentReader::Options::fromConfig(g_config.io, segment.is_stable);
+        if (segment.is_stable) {
+            tier.stable.push_back(std::make_unique<storage::StableSegment>(segment.file_path, read));
+            tier.stable_ptrs.push_back(tier.stable.back().get());
+        } else {
+            tier.delta.push_back(std::make_unique<storage::DeltaSegment>(segment.file_path, read));
+            tier.delta_ptrs.push_back(tier.delta.back().get());
+        }
+    }
+}
+
+storage::BTreeConfig treeConfig(const BTreeConfig& c) {
+    storage::BTreeConfig tree;
+    tree.node_size_bytes = c.node_size_kb * 1024;
+    tree.fanout = c.fanout;
+    tree.epsilon = c.epsilon;
+    tree.min_epsilon = c.min_epsilon;
+    tree.max_epsilon = c.max_epsilon;
+    tree.adaptive_epsilon = c.adaptive_epsilon;
+    tree.hot_partition_threshold = c.hot_partition_threshold;
+    tree.direct_flush_threshold = c.direct_flush_threshold;
+    tree.direct_flush_min_bytes = c.direct_flush_min_bytes;
+    tree.parallel_flush = c.parallel_flush;
+    tree.flush_threads = c.flush_threads;
+    tree.node_cache_bytes = size_t{c.node_cache_mb} << 20;
+    tree.node_cache_protected_level = c.node_cache_protected_level;
+    return tree;
+}
+
+// The write path as the server puts it together, on its own directory
+class WritePath {
+public:
+    WritePath(const Args& args, const index::CentroidsManager& centroids)
+        : dir_(args.workdir + "/ingest"), centroids_(centroids) {
+        std::filesystem::create_directories(dir_ + "/segments");
+        wal_ = std::make_unique<storage::WalManager>(storage::WalManager::Options::fromConfig(g_config, dir_ + "/wal"));
+
+        storage::MessageBuffer::Config buffer;
+        buffer.max_bytes = g_config.storage.buffer.size_bytes;
+        buffer.shard_count = g_config.storage.buffer.shard_count;
+        buffer.flush_threshold_bytes = g_config.storage.buffer.flush_threshold_bytes;
+        buffer.dedupe_enabled = g_config.storage.buffer.dedupe_enabled;
+        buffer.dim = args.dim;
+        buffer.leaf_of = [this](const VectorEntry& entry) { return entry.id_hash % leaves_; };
+        buffer_ = std::make_unique<storage::MessageBuffer>(buffer, std::make_shared<storage::LatestByIdMap>());
+
+        const auto delta = storage::DeltaSegmentWriter::Options::fromConfig(g_config);
+        segments_ = std::make_shared<storage::SegmentManager>(
+            storage::SegmentManager::Options::fromConfig(g_config),
+            [this](const storage::SegmentManager::Plan&) { return segmentPath(); },
+            [](const storage::SegmentManager::Plan&, const SegmentDescriptor&) {});
+        tree_ = std::make_unique<storage::BEpsilonTree>(treeConfig(g_config.storage.btree), segments_);
+        leaves_ = std::max<size_t>(1, tree_->leafCount());
+        tree_->setLeafSink([this, delta](size_t leaf, std::span<const storage::BEpsilonNode::Message> messages) {
+            std::vector<storage::DeltaRow> rows;
+            rows.reserve(messages.size());
+            for (const auto& m : messages) {
+                const VectorEntry& entry = m.msg.entry;
+                storage::DeltaRow row;
+                row.id_hash = m.id_hash;
+                row.epoch = m.msg.epoch;
+                row.tombstone = m.msg.op == OperationType::DELETE;
+                row.centroid_id = entry.centroid_id;
+                row.id = entry.id;
+                row.vector = entry.vector.data();
+                row.vector_len = static_cast<uint32_t>(entry.vector.size());
+                rows.push_back(row);
+            }
+            segments_->add(leaf, storage::DeltaSegmentWriter::write(segmentPath(), delta, rows));
+        });
+        scheduler_ = std::make_unique<storage::FlushScheduler>(
+            storage::FlushScheduler::Options::fromConfig(g_config.storage), *buffer_,
+            [this](const storage::LeafSlice& slice) {
+                for (const auto& view : slice.messages()) tree_->apply(view.materialize());
+                tree_->flush(false);
+            });
+        scheduler_->start();
+        segments_->start();
+    }
+
+    ~WritePath() {
+        scheduler_->stop();
+        segments_->stop();
+    }
+
+    storage::MessageBuffer& buffer() { return *buffer_; }
+
+    // One batch: logged, committed and buffered, as an upsert request is
+    void write(std::mt19937_64& rng, const Mixture& mixture, size_t batch_size, uint32_t dim) {
+        std::uniform_int_distribution<int> pick(0, 99);
+        std::vector<BTreeMessage> batch(batch_size);
+        for (BTreeMessage& msg : batch) {
+            const int p = pick(rng);
+            const uint64_t written = inserted_.load(std::memory_order_relaxed);
+            const bool insert = p < 70 || written == 0;
+            const bool remove = !insert && p >= 95;
+            const uint64_t key = insert ? inserted_.fetch_add(1) : rng() % written;
+            VectorEntry& entry = msg.entry;
+            msg.op = remove ? OperationType::DELETE : OperationType::UPSERT;
+            msg.timestamp = std::chrono::duration_cast<Timestamp>(std::chrono::system_clock::now().time_since_epoch());
+            entry.id = "w" + std::to_string(key);
+            entry.id_hash = util::hash_id(entry.id);
+            entry.deleted = remove;
+            entry.created_at = entry.updated_at = msg.timestamp;
+            entry.vector.resize(remove ? 0 : dim);
+            if (!remove) {
+                mixture.sample(rng, entry.vector.data());
+                entry.centroid_id = centroids_.probe(entry.vector.data(), 1).front();
+            }
+        }
+        const Epoch first = epoch_.fetch_add(batch.size()) + 1;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            BTreeMessage& msg = batch[i];
+            msg.epoch = first + i;
+            storage::WalRecordView rec;
+            rec.op = msg.entry.deleted ? storage::WalOp::DELETE : storage::WalOp::UPSERT;
+            rec.id = msg.entry.id;
+            rec.id_hash = msg.entry.id_hash;
+            rec.timestamp_nanos = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(msg.timestamp).count());
+            rec.vector = msg.entry.vector;
+            rec.epoch = msg.epoch;
+            if (i + 1 < batch.size()) {
+                wal_->append(rec);
+            } else {
+                wal_->commit(rec);
+            }
+        }
+        for (const auto& msg : batch) {
+            while (!buffer_->append(msg.entry.id_hash, msg).accepted()) {
+                buffer_->waitForSpace(std::chrono::milliseconds(10));
+            }
+        }
+    }
+
+    void drain() {
+        scheduler_->flushAll();
+        tree_->flush(true);
+        while (segments_->compactOnce()) {
+        }
+    }
+
+private:
+    std::string dir_;
+    const index::CentroidsManager& centroids_;
+    size_t leaves_ = 1;
+    std::unique_ptr<storage::WalManager> wal_;
+    std::unique_ptr<storage::MessageBuffer> buffer_;
+    std::shared_ptr<storage::SegmentManager> segments_;
+    std::unique_ptr<storage::BEpsilonTree> tree_;
+    std::unique_ptr<storage::FlushScheduler> scheduler_;
+    std::atomic<Epoch> epoch_{1};  // Above the imported rows
+    std::atomic<uint64_t> inserted_{0};
+    std::atomic<uint64_t> segment_seq_{0};
+
+    std::string segmentPath() {
+        return dir_ + "/segments/seg-" + std::to_string(segment_seq_.fetch_add(1)) + ".wvs";
+    }
+};
+
+struct QueryShape {
+    uint32_t nprobe;
+    float sample_p;
+    uint32_t rerank_factor;
+};
+
+void search(const index::TwoPhaseEngine& engine, const index::CentroidsManager& centroids, const Tier& delta,
+            const Tier& stable, const std::vector<float>& query, Metric metric, size_t k, const QueryShape& shape,
+            storage::MessageBuffer* buffer) {
+    const auto probe = centroids.probe(query.data(), shape.nprobe);
+    index::TwoPhaseEngine::Query q;
+    q.vector = query;
+    q.metric = metric;
+    q.k = k;
+    q.probe = probe;
+    q.nprobe_delta = shape.nprobe;
+    q.nprobe_stable = shape.nprobe;
+    q.sample_p = shape.sample_p;
+    q.rerank_factor = shape.rerank_factor;
+    if (buffer) {
+        q.buffer = [&](size_t top_k) {
+            std::vector<index::TwoPhaseEngine::Hit> hits;
+            for (const auto& h : buffer->scanTopK(query, metric, 0, 0, {}, top_k, 10000, probe)) {
+                hits.push_back({h.id_hash, kLatestEpoch, h.score});
+            }
+            return hits;
+        };
+    }
+    engine.search(q, delta.delta_ptrs, stable.stable_ptrs);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const Args args = parseArgs(argc, argv);
+    if (!loadConfig(args.config)) fail("cannot load " + args.config);
+    g_config.collection.dim = args.dim;
+    g_config.collection.id_type = "custom";
+    const Metric metric = util::parse_metric(g_config.collection.metric);
+    std::filesystem::remove_all(args.workdir);
+    std::filesystem::create_directories(args.workdir);
+
+    auto start = Clock::now();
+    const Mixture mixture(args.dim, args.clusters);
+    const std::string base = args.workdir + "/base.fvecs";
+    const std::string ids = args.workdir + "/ids.txt";
+    writeDataset(args, mixture, base, ids);
+
+    util::ThreadPool pool;
+    index::CentroidsManager centroids(index::CentroidsManager::Options::fromConfig(g_config));
+    index::TwoPhaseEngine engine(index::TwoPhaseEngine::Options::fromConfig(g_config), &pool);
+    Tier delta, stable;
+    import(args, centroids, pool, base, ids, false, delta);
+    import(args, centroids, pool, base, ids, true, stable);
+    log("import", start);
+
+    const auto queryVector = [&](std::mt19937_64& rng, std::vector<float>& v) {
+        mixture.sample(rng, v.data());
+        if (metric == Metric::INNER_PRODUCT) normalize(v.data(), args.dim);
+    };
+    constexpr QueryShape kLiveShape{8, 0.0f, 0};  // 0: Options
+
+    start = Clock::now();
+    {
+        WritePath path(args, centroids);
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < args.writers; ++w) {
+            threads.emplace_back([&, w] {
+                std::mt19937_64 rng(100 + w);
+                while (!stop.load(std::memory_order_relaxed)) path.write(rng, mixture, args.batch, args.dim);
+            });
+        }
+        for (size_t r = 0; r < args.readers; ++r) {
+            threads.emplace_back([&, r] {
+                std::mt19937_64 rng(200 + r);
+                std::vector<float> query(args.dim);
+                while (!stop.load(std::memory_order_relaxed)) {
+                    queryVector(rng, query);
+                    search(engine, centroids, delta, stable, query, metric, args.k, kLiveShape, &path.buffer());
+                }
+            });
+        }
+        std::this_thread::sleep_until(start + std::chrono::seconds(args.ingest_s));
+        stop.store(true);
+        for (auto& t : threads) t.join();
+        log("ingest", start);
+
+        start = Clock::now();
+        path.drain();
+        log("drain", start);
+    }
+
+    start = Clock::now();
+    const QueryShape shapes[] = {
+        {4, 1.0f, 2}, {8, 1.0f, 4}, {16, 1.0f, 4}, {8, 0.5f, 2}, {16, 0.25f, 8},
+    };
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < std::max<size_t>(1, args.readers); ++r) {
+        readers.emplace_back([&, r] {
+            std::mt19937_64 rng(300 + r);
+            std::vector<float> query(args.dim);
+            for (size_t i = next.fetch_add(1); i < args.queries; i = next.fetch_add(1)) {
+                queryVector(rng, query);
+                search(engine, centroids, delta, stable, query, metric, args.k, shapes[i % std::size(shapes)],
+                       nullptr);
+            }
+        });
+    }
+    for (auto& t : readers) t.join();
+    log("query", start);
+
+    std::filesystem::remove_all(args.workdir);
+    return 0;
+}
@@ -0,0 +1,429 @@
+// query-bench: ANN recall and latency per tier on standard datasets.
+//
+//   query-bench --base=FILE --queries=FILE [--groundtruth=FILE.ivecs]
+//               [--metric=l2] [--k=10] [--nq=1000] [--nlist=1024]
+//               [--nprobe=1,4,8,16,32] [--sample_p=1,0.5,0.25]
+//               [--rerank=1,2,4,8] [--tiers=delta,stable]
+//               [--config=woved.yaml] [--workdir=DIR] [benchmark flags]
+//
+// The base file (.fvecs or .bvecs, e.g. SIFT1M, GloVe, a Deep1B subset) is
+// imported once per tier with BulkLoader: the delta tier as IVF-Flat
+// delta segments, the stable tier as IVF-PQ stable segments. Every
+// benchmark then runs the queries round robin through TwoPhaseEngine
+// against one tier: delta over nprobe x sample_p, stable over nprobe x
+// rerank_factor. Each reports recall@k against the ground truth (the
+// dataset's .ivecs, or an exact scan of the base when none is given),
+// QPS, p50 and p99 latency, and meets_target when recall reaches
+// constants::TARGET_RECALL with p99 within constants::TARGET_P99_MS.
+
+#include "core/config.h"
+#include "index/centroids-manager.h"
+#include "index/two-phase-engine.h"
+#include "storage/latest-by-id.h"
+#include "storage/segment/seg-bulk.h"
+#include "storage/segment/seg-delta.h"
+#include "storage/segment/seg-placement.h"
+#include "storage/segment/seg-stable.h"
+#include "util/hash.h"
+#include "util/simd-dispatch.h"
+#include "util/thread-pool.h"
+#include "util/vector-codec.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using namespace woved;
+
+struct Args {
+    std::string base;
+    std::string queries;
+    std::string groundtruth;
+    std::string metric = "l2";
+    std::string config;
+    std::string workdir = "/tmp/woved-query-bench";
+    size_t k = 10;
+    size_t nq = 1000;
+    uint32_t nlist = 1024;
+    std::vector<double> nprobe = {1, 4, 8, 16, 32};
+    std::vector<double> sample_p = {1, 0.5, 0.25};
+    std::vector<double> rerank = {1, 2, 4, 8};
+    std::vector<std::string> tiers = {"delta", "stable"};
+};
+
+std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == std::string::npos) end = s.size();
+        if (end > start) out.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return out;
+}
+
+std::vector<double> splitNumbers(const std::string& s) {
+    std::vector<double> out;
+    for (const auto& item : split(s)) out.push_back(std::atof(item.c_str()));
+    return out;
+}
+
+[[noreturn]] void fail(const std::string& message) {
+    std::fprintf(stderr, "query-bench: %s\n", message.c_str());
+    std::exit(2);
+}
+
+// Our flags, after benchmark::Initialize() has taken its own
+Args parseArgs(int argc, char** argv) {
+    Args args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) fail("unknown argument " + arg);
+        const std::string name = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+        if (name == "base") args.base = value;
+        else if (name == "queries") args.queries = value;
+        else if (name == "groundtruth") args.groundtruth = value;
+        else if (name == "metric") args.metric = value;
+        else if (name == "config") args.config = value;
+        else if (name == "workdir") args.workdir = value;
+        else if (name == "k") args.k = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "nq") args.nq = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "nlist") args.nlist = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        else if (name == "nprobe") args.nprobe = splitNumbers(value);
+        else if (name == "sample_p") args.sample_p = splitNumbers(value);
+        else if (name == "rerank") args.rerank = splitNumbers(value);
+        else if (name == "tiers") args.tiers = split(value);
+        else fail("unknown argument " + arg);
+    }
+    if (args.base.empty() || args.queries.empty()) fail("--base and --queries are required");
+    if (args.k == 0 || args.k > constants::MAX_TOP_K) fail("--k out of range");
+    return args;
+}
+
+// Rows of an .fvecs or .bvecs file as float, up to `limit`
+std::vector<float> readVectors(const std::string& path, size_t limit, uint32_t& dim) {
+    const bool bytes = path.ends_with(".bvecs");
+    if (!bytes && !path.ends_with(".fvecs")) fail(path + ": expected .fvecs or .bvecs");
+    std::ifstream in(path, std::ios::binary);
+    if (!in) fail("cannot open " + path);
+    std::vector<float> out;
+    std::vector<uint8_t> row;
+    int32_t d = 0;
+    for (size_t n = 0; n < limit && in.read(reinterpret_cast<char*>(&d), sizeof(d)); ++n) {
+        if (d <= 0 || (dim && static_cast<uint32_t>(d) != dim)) fail(path + ": inconsistent dimension");
+        dim = static_cast<uint32_t>(d);
+        const size_t first = out.size();
+        out.resize(first + dim);
+        if (bytes) {
+            row.resize(dim);
+            in.read(reinterpret_cast<char*>(row.data()), dim);
+            std::copy(row.begin(), row.end(), out.begin() + first);
+        } else {
+            in.read(reinterpret_cast<char*>(out.data() + first), dim * sizeof(float));
+        }
+        if (!in) fail(path + ": truncated");
+    }
+    return out;
+}
+
+// The first `k` neighbours of each of `nq` queries in an .ivecs file
+std::vector<std::vector<uint32_t>> readGroundTruth(const std::string& path, size_t nq, size_t k) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) fail("cannot open " + path);
+    std::vector<std::vector<uint32_t>> out;
+    int32_t d = 0;
+    while (out.size() < nq && in.read(reinterpret_cast<char*>(&d), sizeof(d))) {
+        if (d <= 0 || static_cast<size_t>(d) < k) fail(path + ": fewer than k neighbours per query");
+        std::vector<uint32_t> row(d);
+        in.read(reinterpret_cast<char*>(row.data()), d * sizeof(uint32_t));
+        if (!in) fail(path + ": truncated");
+        row.resize(k);
+        out.push_back(std::move(row));
+    }
+    if (out.size() < nq) fail(path + ": fewer rows than queries");
+    return out;
+}
+
+void normalize(std::vector<float>& vectors, uint32_t dim) {
+    for (size_t r = 0; r < vectors.size() / dim; ++r) {
+        float* v = vectors.data() + r * dim;
+        double sum = 0;
+        for (uint32_t i = 0; i < dim; ++i) sum += double(v[i]) * v[i];
+        const float inv = sum > 0 ? float(1.0 / std::sqrt(sum)) : 0.0f;
+        for (uint32_t i = 0; i < dim; ++i) v[i] *= inv;
+    }
+}
+
+// Exact top k of every query over the whole base file, streamed in blocks
+std::vector<std::vector<uint32_t>> exactTopK(const std::string& path, Metric metric, bool norm,
+                                             const std::vector<float>& queries, uint32_t dim, size_t k,
+                                             util::ThreadPool& pool) {
+    const size_t nq = queries.size() / dim;
+    std::vector<std::vector<std::pair<Score, uint32_t>>> best(nq);
+    const bool bytes = path.ends_with(".bvecs");
+    const size_t row_bytes = sizeof(int32_t) + dim * (bytes ? 1 : sizeof(float));
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> raw;
+    std::vector<float> block;
+    constexpr size_t kBlock = 65536;
+    for (uint32_t first = 0;; first += kBlock) {
+        raw.resize(kBlock * row_bytes);
+        in.read(raw.data(), raw.size());
+        const size_t rows = static_cast<size_t>(in.gcount()) / row_bytes;
+        if (rows == 0) break;
+        block.resize(rows * dim);
+        for (size_t r = 0; r < rows; ++r) {
+            const char* src = raw.data() + r * row_bytes + sizeof(int32_t);
+            float* dst = block.data() + r * dim;
+            if (bytes) {
+                for (uint32_t i = 0; i < dim; ++i) dst[i] = static_cast<uint8_t>(src[i]);
+            } else {
+                std::memcpy(dst, src, dim * sizeof(float));
+            }
+        }
+        if (norm) normalize(block, dim);
+        pool.parallelFor(nq, [&](size_t q) {
+            auto& heap = best[q];
+            auto worse = [](const auto& a, const auto& b) { return a.first > b.first; };
+            for (size_t r = 0; r < rows; ++r) {
+                const Score s = kernels::score(metric, queries.data() + q * dim, block.data() + r * dim, dim);
+                if (heap.size() < k) {
+                    heap.emplace_back(s, first + static_cast<uint32_t>(r));
+                    std::push_heap(heap.begin(), heap.end(), worse);
+                } else if (s > heap.front().first) {
+                    std::pop_heap(heap.begin(), heap.end(), worse);
+                    heap.back() = {s, first + static_cast<uint32_t>(r)};
+                    std::push_heap(heap.begin(), heap.end(), worse);
+                }
+            }
+        });
+        if (rows < kBlock) break;
+    }
+    std::vector<std::vector<uint32_t>> out(nq);
+    for (size_t q = 0; q < nq; ++q) {
+        std::sort_heap(best[q].begin(), best[q].end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        for (const auto& [score, row] : best[q]) out[q].push_back(row);
+    }
+    return out;
+}
+
+// One tier's segments, imported from the base file
+struct Tier {
+    std::vector<std::unique_ptr<storage::DeltaSegment>> delta;
+    std::vector<std::unique_ptr<storage::StableSegment>> stable;
+    std::vector<const storage::DeltaSegment*> delta_ptrs;
+    std::vector<const storage::StableSegment*> stable_ptrs;
+};
+
+struct Fixture {
+    Args args;
+    Metric metric = Metric::L2;
+    uint32_t dim = 0;
+    std::vector<float> queries;
+    std::vector<std::vector<uint32_t>> truth;
+    std::unordered_map<VectorIdHash, uint32_t> row_of;  // Id hash to base row
+    std::unique_ptr<util::ThreadPool> pool;
+    std::unique_ptr<index::CentroidsManager> centroids;
+    std::unique_ptr<index::TwoPhaseEngine> engine;
+    std::unordered_map<std::string, Tier> tiers;
+};
+
+Fixture& fixture() {
+    static Fixture f;
+    return f;
+}
+
+// Ids are the row numbers, so hits map back to ground truth rows
+std::string writeIds(const std::string& dir, uint64_t rows, std::unordered_map<VectorIdHash, uint32_t>& row_of) {
+    const std::string path = dir + "/ids.txt";
+    std::ofstream out(path);
+    for (uint32_t r = 0; r < rows; ++r) {
+        const std::string id = std::to_string(r);
+        out << id << '\n';
+        row_of.emplace(util::hash_id(id), r);
+    }
+    if (!out) fail("cannot write " + path);
+    return path;
+}
+
+void importTier(Fixture& f, const std::string& name, const std::string& ids) {
+    const std::string dir = f.args.workdir + "/" + name;
+    std::filesystem::remove_all(dir);
+    storage::SegmentPlacement::Options placement_options;
+    placement_options.dirs = {dir};
+    placement_options.reserve_bytes = 0;
+    storage::SegmentPlacement placement(placement_options);
+
+    auto options = storage::BulkLoader::Options::fromConfig(g_config);
+    uint32_t next_ordinal = 1;
+    storage::BulkLoader loader(
+        options, *f.centroids, placement, *f.pool, std::make_shared<storage::LatestByIdMap>(),
+        [] { return Epoch{1}; },
+        [&](const std::vector<SegmentDescriptor>& segments) {
+            std::vector<uint32_t> ordinals;
+            for (size_t i = 0; i < segments.size(); ++i) ordinals.push_back(next_ordinal++);
+            return ordinals;
+        });
+
+    storage::BulkLoader::Request request;
+    request.files = {f.args.base};
+    request.ids_file = ids;
+    request.stable = name == "stable";
+    const auto result = loader.run(request);
+    std::fprintf(stderr, "query-bench: %s tier: %llu rows in %zu segments, %.1fs\n", name.c_str(),
+                 static_cast<unsigned long long>(result.rows), result.segments.size(), result.elapsed_s);
+
+    Tier& tier = f.tiers[name];
+    for (const auto& segment : result.segments) {
+        const auto read = storage::SegmentReader::Options::fromConfig(g_config.io, segment.is_stable);
+        if (segment.is_stable) {
+            tier.stable.push_back(std::make_unique<storage::StableSegment>(segment.file_path, read));
+            tier.stable_ptrs.push_back(tier.stable.back().get());
+        } else {
+            tier.delta.push_back(std::make_unique<storage::DeltaSegment>(segment.file_path, read));
+            tier.delta_ptrs.push_back(tier.delta.back().get());
+        }
+    }
+}
+
+void setUp(Fixture& f) {
+    if (!f.args.config.empty() && !loadConfig(f.args.config)) fail("cannot load " + f.args.config);
+    f.metric = util::parse_metric(f.args.metric);
+    f.queries = readVectors(f.args.queries, f.args.nq, f.dim);
+    f.args.nq = f.queries.size() / f.dim;
+    const bool norm = f.metric == Metric::INNER_PRODUCT;  // Normalized at ingest
+    if (norm) normalize(f.queries, f.dim);
+
+    g_config.collection.dim = f.dim;
+    g_config.collection.metric = f.args.metric;
+    g_config.collection.id_type = "custom";
+    g_config.index.global.nlist = f.args.nlist;
+
+    std::filesystem::create_directories(f.args.workdir);
+    f.pool = std::make_unique<util::ThreadPool>();
+    f.centroids = std::make_unique<index::CentroidsManager>(index::CentroidsManager::Options::fromConfig(g_config));
+    f.engine = std::make_unique<index::TwoPhaseEngine>(index::TwoPhaseEngine::Options::fromConfig(g_config),
+                                                       f.pool.get());
+
+    uint32_t base_dim = 0;
+    std::ifstream probe(f.args.base, std::ios::binary);
+    probe.read(reinterpret_cast<char*>(&base_dim), sizeof(base_dim));
+    if (base_dim != f.dim) fail("base and query dimensions differ");
+    const uint64_t base_bytes = std::filesystem::file_size(f.args.base);
+    const uint64_t rows = base_bytes / (sizeof(int32_t) + f.dim * (f.args.base.ends_with(".bvecs") ? 1 : 4));
+    const std::string ids = writeIds(f.args.workdir, rows, f.row_of);
+    for (const auto& tier : f.args.tiers) {
+        if (tier != "delta" && tier != "stable") fail("unknown tier " + tier);
+        importTier(f, tier, ids);
+    }
+
+    if (!f.args.groundtruth.empty()) {
+        f.truth = readGroundTruth(f.args.groundtruth, f.args.nq, f.args.k);
+    } else {
+        std::fprintf(stderr, "query-bench: no --groundtruth, exact scan of %llu rows\n",
+                     static_cast<unsigned long long>(rows));
+        f.truth = exactTopK(f.args.base, f.metric, norm, f.queries, f.dim, f.args.k, *f.pool);
+    }
+}
+
+double percentile(std::vector<double>& values, double p) {
+    if (values.empty()) return 0;
+    const size_t i = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + i, values.end());
+    return values[i];
+}
+
+void runQueries(benchmark::State& state, const std::string& tier_name, uint32_t nprobe, float sample_p,
+                uint32_t rerank) {
+    Fixture& f = fixture();
+    const Tier& tier = f.tiers.at(tier_name);
+    std::vector<double> latencies_ms;
+    size_t q = 0;
+    size_t found = 0;
+    size_t asked = 0;
+    for (auto _ : state) {
+        const float* vector = f.queries.data() + q * f.dim;
+        const auto start = std::chrono::steady_clock::now();
+        const auto probe = f.centroids->probe(vector, nprobe);
+        index::TwoPhaseEngine::Query query;
+        query.vector = {vector, f.dim};
+        query.metric = f.metric;
+        query.k = f.args.k;
+        query.probe = probe;
+        query.nprobe_delta = nprobe;
+        query.nprobe_stable = nprobe;
+        query.sample_p = sample_p;
+        query.rerank_factor = rerank;
+        const auto hits = f.engine->search(query, tier.delta_ptrs, tier.stable_ptrs);
+        latencies_ms.push_back(
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        const auto& truth = f.truth[q];
+        for (const auto& hit : hits) {
+            auto it = f.row_of.find(hit.id_hash);
+            if (it != f.row_of.end() && std::find(truth.begin(), truth.end(), it->second) != truth.end()) found++;
+        }
+        asked += f.args.k;
+        q = (q + 1) % f.args.nq;
+    }
+
+    const double recall = asked ? double(found) / asked : 0;
+    const double p99 = percentile(latencies_ms, 0.99);
+    state.counters["recall@k"] = recall;
+    state.counters["QPS"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    state.counters["p50_ms"] = percentile(latencies_ms, 0.50);
+    state.counters["p99_ms"] = p99;
+    state.counters["meets_target"] =
+        recall >= constants::TARGET_RECALL && p99 <= constants::TARGET_P99_MS ? 1.0 : 0.0;
+}
+
+void registerBenchmarks(const Args& args) {
+    for (const auto& tier : args.tiers) {
+        for (double nprobe : args.nprobe) {
+            const auto np = static_cast<uint32_t>(nprobe);
+            if (tier == "delta") {
+                for (double p : args.sample_p) {
+                    const std::string name = "delta/nprobe:" + std::to_string(np) + "/sample_p:" + std::to_string(p);
+                    benchmark::RegisterBenchmark(name.c_str(), [np, p](benchmark::State& state) {
+                        runQueries(state, "delta", np, static_cast<float>(p), 0);
+                    })->UseRealTime()->Unit(benchmark::kMillisecond);
+                }
+            } else {
+                for (double r : args.rerank) {
+                    const auto rf = static_cast<uint32_t>(r);
+                    const std::string name = "stable/nprobe:" + std::to_string(np) + "/rerank:" + std::to_string(rf);
+                    benchmark::RegisterBenchmark(name.c_str(), [np, rf](benchmark::State& state) {
+                        runQueries(state, "stable", np, 0.0f, rf);
+                    })->UseRealTime()->Unit(benchmark::kMillisecond);
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    Fixture& f = fixture();
+    f.args = parseArgs(argc, argv);
+    setUp(f);
+    registerBenchmarks(f.args);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
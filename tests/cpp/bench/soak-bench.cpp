@@ -0,0 +1,489 @@
+// soak-bench: query tail latency under sustained ingest, against a running
+// wovedd.
+//
+//   soak-bench [--host=127.0.0.1] [--port=8080] [--metrics_port=9091]
+//              [--dim=768] [--query_threads=8] [--query_qps=0]
+//              [--upsert_threads=4] [--upsert_qps=0] [--batch=100]
+//              [--keys=10000000] [--top_k=10] [--duration_s=600]
+//              [--interval_ms=1000] [--load=0] [--out=-]
+//
+// Query and upsert workers each keep one request in flight on their own
+// keep-alive connection (closed loop). A non-zero rate paces a side's
+// workers to it; its latency is then timed from when a request was due,
+// not when it went out, so a stalled server shows in the tail instead of
+// quietly lowering the rate. Upserts overwrite ids drawn uniformly from
+// `keys`, so flushes and compaction keep finding work.
+//
+// With --load=N, ids k0 to k<N-1> are first inserted in `batch` sized
+// requests across the upsert workers (at least one), as fast as the
+// server takes them, retrying 429s; a {"load": true, ...} line reports
+// the rate. --duration_s=0 then stops there (scripts/fault-inject.sh
+// --bench preloads this way).
+//
+// Every interval_ms one JSON line goes to --out (- for stdout): the
+// interval's query and upsert rates (every answer, and _ok_qps: 2xx
+// only) and p50/p99/p999 in ms, errors and 429 rejections, and the server's woved_flush_lag_ms,
+// woved_delta_fraction and woved_compaction_debt scraped from
+// http://host:metrics_port/metrics (null when not exported). A last line
+// with "summary": true covers the whole run. scripts/benchmark.sh --soak
+// starts a server and runs this.
+
+#include "util/telemetry.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace woved;
+using Clock = std::chrono::steady_clock;
+
+struct Flags {
+    std::string host = "127.0.0.1";
+    uint16_t port = 8080;
+    uint16_t metrics_port = 9091;
+    uint32_t dim = 768;
+    uint32_t query_threads = 8;
+    double query_qps = 0;   // 0: as fast as the workers go
+    uint32_t upsert_threads = 4;
+    double upsert_qps = 0;  // Requests per second, of `batch` records each
+    uint32_t batch = 100;
+    uint64_t keys = 10000000;
+    uint32_t top_k = 10;
+    uint32_t duration_s = 600;
+    uint32_t interval_ms = 1000;
+    uint64_t load = 0;      // Ids inserted before the run
+    std::string out = "-";
+};
+
+bool parseFlag(std::string_view arg, std::string_view name, std::string& value) {
+    if (!arg.starts_with("--")) return false;
+    arg.remove_prefix(2);
+    if (!arg.starts_with(name) || arg.size() <= name.size() || arg[name.size()] != '=') return false;
+    value = std::string(arg.substr(name.size() + 1));
+    return true;
+}
+
+Flags parseFlags(int argc, char** argv) {
+    Flags f;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        std::string v;
+        if (parseFlag(arg, "host", v)) f.host = v;
+        else if (parseFlag(arg, "port", v)) f.port = static_cast<uint16_t>(std::stoul(v));
+        else if (parseFlag(arg, "metrics_port", v)) f.metrics_port = static_cast<uint16_t>(std::stoul(v));
+        else if (parseFlag(arg, "dim", v)) f.dim = static_cast<uint32_t>(std::stoul(v));
+        else if (parseFlag(arg, "query_threads", v)) f.query_threads = static_cast<uint32_t>(std::stoul(v));
+        else if (parseFlag(arg, "query_qps", v)) f.query_qps = std::stod(v);
+        else if (parseFlag(arg, "upsert_threads", v)) f.upsert_threads = static_cast<uint32_t>(std::stoul(v));
+        else if (parseFlag(arg, "upsert_qps", v)) f.upsert_qps = std::stod(v);
+        else if (parseFlag(arg, "batch", v)) f.batch = std::max<uint32_t>(1, static_cast<uint32_t>(std::stoul(v)));
+        else if (parseFlag(arg, "keys", v)) f.keys = std::max<uint64_t>(1, std::stoull(v));
+        else if (parseFlag(arg, "top_k", v)) f.top_k = static_cast<uint32_t>(std::stoul(v));
+        else if (parseFlag(arg, "duration_s", v)) f.duration_s = static_cast<uint32_t>(std::stoul(v));
+        else if (parseFlag(arg, "interval_ms", v)) f.interval_ms = std::max<uint32_t>(1, static_cast<uint32_t>(std::stoul(v)));
+        else if (parseFlag(arg, "load", v)) f.load = std::stoull(v);
+        else if (parseFlag(arg, "out", v)) f.out = v;
+        else {
+            std::fprintf(stderr, "soak-bench: unknown argument %s\n", argv[i]);
+            std::exit(2);
+        }
+    }
+    return f;
+}
+
+// One keep-alive HTTP/1.1 connection; reconnects after an error
+class Connection {
+public:
+    Connection(std::string host, uint16_t port) : host_(std::move(host)), port_(port) {}
+    ~Connection() { close(); }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // Status code, or 0 if the request could not be sent or answered
+    int request(std::string_view method, std::string_view target, std::string_view content_type,
+                std::string_view body, std::string* response_body = nullptr) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (fd_ < 0 && !connect()) return 0;
+            std::string head;
+            head.reserve(256);
+            head.append(method).append(" ").append(target).append(" HTTP/1.1\r\nHost: ").append(host_);
+            head.append("\r\nConnection: keep-alive\r\n");
+            if (!content_type.empty()) head.append("Content-Type: ").append(content_type).append("\r\n");
+            head.append("Content-Length: ").append(std::to_string(body.size())).append("\r\n\r\n");
+            if (sendAll(head) && sendAll(body)) {
+                if (int status = readResponse(response_body)) return status;
+            }
+            // A server-closed keep-alive connection fails the first attempt
+            close();
+        }
+        return 0;
+    }
+
+private:
+    std::string host_;
+    uint16_t port_;
+    int fd_ = -1;
+    std::string in_;  // Received, not yet consumed
+
+    bool connect() {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &found) != 0) return false;
+        for (addrinfo* a = found; a; a = a->ai_next) {
+            int fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0) continue;
+            if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                fd_ = fd;
+                break;
+            }
+            ::close(fd);
+        }
+        freeaddrinfo(found);
+        in_.clear();
+        return fd_ >= 0;
+    }
+
+    void close() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+    bool sendAll(std::string_view data) {
+        while (!data.empty()) {
+            ssize_t n = ::send(fd_, data.data(), data.size(), MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            data.remove_prefix(static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    bool fill() {
+        char chunk[16384];
+        ssize_t n = ::recv(fd_, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        in_.append(chunk, static_cast<size_t>(n));
+        return true;
+    }
+
+    int readResponse(std::string* body) {
+        size_t end;
+        while ((end = in_.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) return 0;
+        }
+        const std::string_view head(in_.data(), end);
+        if (head.size() < 12 || !head.starts_with("HTTP/1.")) return 0;
+        const int status = std::atoi(head.data() + 9);
+        size_t length = 0;
+        bool close_after = false;
+        size_t pos = head.find("\r\n");
+        while (pos != std::string_view::npos && pos < head.size()) {
+            size_t next = head.find("\r\n", pos + 2);
+            std::string line(head.substr(pos + 2, (next == std::string_view::npos ? head.size() : next) - pos - 2));
+            std::transform(line.begin(), line.end(), line.begin(), [](unsigned char c) { return std::tolower(c); });
+            if (line.starts_with("content-length:")) length = std::strtoull(line.c_str() + 15, nullptr, 10);
+            if (line.starts_with("connection:") && line.find("close") != std::string::npos) close_after = true;
+            pos = next;
+        }
+        while (in_.size() < end + 4 + length) {
+            if (!fill()) return 0;
+        }
+        if (body) body->assign(in_, end + 4, length);
+        in_.erase(0, end + 4 + length);
+        if (close_after) close();
+        return status;
+    }
+};
+
+// Requests of one side (queries or upserts), counted per interval
+struct Side {
+    util::LatencyHistogram latency;
+    std::atomic<uint64_t> ok{0};
+    std::atomic<uint64_t> rejected{0};  // 429
+    std::atomic<uint64_t> errors{0};
+};
+
+void record(Side& side, int status, Clock::time_point from) {
+    side.latency.record(Clock::now() - from);
+    if (status >= 200 && status < 300) side.ok.fetch_add(1, std::memory_order_relaxed);
+    else if (status == 429) side.rejected.fetch_add(1, std::memory_order_relaxed);
+    else side.errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string_view asBytes(const std::vector<float>& v) {
+    return {reinterpret_cast<const char*>(v.data()), v.size() * sizeof(float)};
+}
+
+// Runs `send` back to back, or paced to `qps` across `threads` workers
+template <typename Send>
+void worker(const std::atomic<bool>& stop, double qps, uint32_t threads, Side& side, Send send) {
+    const auto period = qps > 0 ? std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<double>(threads / qps))
+                                : Clock::duration::zero();
+    auto due = Clock::now();
+    while (!stop.load(std::memory_order_relaxed)) {
+        if (period > Clock::duration::zero()) {
+            std::this_thread::sleep_until(due);
+        } else {
+            due = Clock::now();
+        }
+        const int status = send();
+        record(side, status, due);
+        due += period;
+    }
+}
+
+// Gauges of interest from the Prometheus text format
+struct ServerGauges {
+    std::optional<double> flush_lag_ms;
+    std::optional<double> delta_fraction;
+    std::optional<double> compaction_debt;
+};
+
+ServerGauges scrape(Connection& metrics) {
+    ServerGauges g;
+    std::string text;
+    if (metrics.request("GET", "/metrics", {}, {}, &text) != 200) return g;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) end = text.size();
+        const std::string_view line(text.data() + pos, end - pos);
+        pos = end + 1;
+        if (line.empty() || line[0] == '#') continue;
+        const size_t space = line.rfind(' ');
+        if (space == std::string_view::npos) continue;
+        const std::string_view name = line.substr(0, line.find_first_of("{ "));
+        const double value = std::strtod(std::string(line.substr(space + 1)).c_str(), nullptr);
+        if (name == "woved_flush_lag_ms") g.flush_lag_ms = value;
+        else if (name == "woved_delta_fraction") g.delta_fraction = value;
+        else if (name == "woved_compaction_debt") g.compaction_debt = value;
+    }
+    return g;
+}
+
+// Quantiles and count of what was recorded between two snapshots
+struct Window {
+    uint64_t count = 0;
+    double p50_ms = 0;
+    double p99_ms = 0;
+    double p999_ms = 0;
+};
+
+Window window(const util::LatencyHistogram::Snapshot& now, const util::LatencyHistogram::Snapshot& before) {
+    util::LatencyHistogram::Snapshot diff;
+    diff.count = now.count - before.count;
+    diff.sum_ns = now.sum_ns - before.sum_ns;
+    diff.buckets.resize(now.buckets.size());
+    for (size_t i = 0; i < now.buckets.size(); ++i) {
+        diff.buckets[i] = now.buckets[i] - (i < before.buckets.size() ? before.buckets[i] : 0);
+    }
+    return {diff.count, diff.quantile(0.5) / 1e6, diff.quantile(0.99) / 1e6, diff.quantile(0.999) / 1e6};
+}
+
+void appendGauge(std::string& out, const char* name, const std::optional<double>& value) {
+    char buf[96];
+    if (value) std::snprintf(buf, sizeof(buf), ",\"%s\":%.6g", name, *value);
+    else std::snprintf(buf, sizeof(buf), ",\"%s\":null", name);
+    out += buf;
+}
+
+void appendSide(std::string& out, const char* name, const Window& w, double seconds, uint64_t ok,
+                uint64_t rejected, uint64_t errors) {
+    char buf[384];
+    std::snprintf(buf, sizeof(buf),
+                  ",\"%s_qps\":%.1f,\"%s_ok_qps\":%.1f,\"%s_p50_ms\":%.3f,\"%s_p99_ms\":%.3f"
+                  ",\"%s_p999_ms\":%.3f,\"%s_rejected\":%llu,\"%s_errors\":%llu",
+                  name, seconds > 0 ? w.count / seconds : 0.0, name, seconds > 0 ? ok / seconds : 0.0, name,
+                  w.p50_ms, name, w.p99_ms, name, w.p999_ms, name, static_cast<unsigned long long>(rejected), name,
+                  static_cast<unsigned long long>(errors));
+    out += buf;
+}
+
+// Inserts ids [0, count) in batches across `threads` connections; false
+// on an error other than 429
+bool load(const Flags& flags, uint64_t count, uint32_t threads, std::FILE* out) {
+    constexpr std::chrono::milliseconds kMaxBackoff(200);
+    std::atomic<uint64_t> next{0};
+    std::atomic<bool> failed{false};
+    const auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            Connection conn(flags.host, flags.port);
+            std::mt19937_64 rng(3000 + t);
+            std::normal_distribution<float> component;
+            std::vector<float> vecs;
+            std::string target;
+            while (!failed.load(std::memory_order_relaxed)) {
+                const uint64_t first = next.fetch_add(flags.batch, std::memory_order_relaxed);
+                if (first >= count) break;
+                const uint64_t n = std::min<uint64_t>(flags.batch, count - first);
+                target = "/v1/vectors?ids=";
+                for (uint64_t i = 0; i < n; ++i) {
+                    if (i) target += ",";
+                    target += "k" + std::to_string(first + i);
+                }
+                vecs.resize(n * flags.dim);
+                for (float& x : vecs) x = component(rng);
+                for (std::chrono::milliseconds backoff(1);; backoff = std::min(backoff * 2, kMaxBackoff)) {
+                    const int status = conn.request("POST", target, "application/octet-stream", asBytes(vecs));
+                    if (status >= 200 && status < 300) break;
+                    if (status != 429) {
+                        std::fprintf(stderr, "soak-bench: load failed at id %llu with status %d\n",
+                                     static_cast<unsigned long long>(first), status);
+                        failed.store(true);
+                        break;
+                    }
+                    std::this_thread::sleep_for(backoff);
+                }
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::fprintf(out, "{\"load\":true,\"rows\":%llu,\"duration_s\":%.3f,\"rows_per_s\":%.1f}\n",
+                 static_cast<unsigned long long>(count), seconds, seconds > 0 ? count / seconds : 0.0);
+    std::fflush(out);
+    return !failed.load();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const Flags flags = parseFlags(argc, argv);
+    std::FILE* out = flags.out == "-" ? stdout : std::fopen(flags.out.c_str(), "w");
+    if (!out) {
+        std::fprintf(stderr, "soak-bench: cannot open %s\n", flags.out.c_str());
+        return 1;
+    }
+
+    {
+        Connection probe(flags.host, flags.port);
+        if (probe.request("GET", "/health", {}, {}) != 200) {
+            std::fprintf(stderr, "soak-bench: no healthy wovedd at %s:%u\n", flags.host.c_str(), flags.port);
+            return 1;
+        }
+    }
+
+    if (flags.load > 0 && !load(flags, flags.load, std::max<uint32_t>(1, flags.upsert_threads), out)) return 1;
+    if (flags.duration_s == 0) {
+        if (out != stdout) std::fclose(out);
+        return 0;
+    }
+
+    Side queries;
+    Side upserts;
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    const std::string search_target = "/v1/search?top_k=" + std::to_string(flags.top_k);
+
+    for (uint32_t t = 0; t < flags.query_threads; ++t) {
+        threads.emplace_back([&, t] {
+            Connection conn(flags.host, flags.port);
+            std::mt19937_64 rng(1000 + t);
+            std::normal_distribution<float> component;
+            std::vector<float> vec(flags.dim);
+            worker(stop, flags.query_qps, flags.query_threads, queries, [&] {
+                for (float& x : vec) x = component(rng);
+                return conn.request("POST", search_target, "application/octet-stream", asBytes(vec));
+            });
+        });
+    }
+    for (uint32_t t = 0; t < flags.upsert_threads; ++t) {
+        threads.emplace_back([&, t] {
+            Connection conn(flags.host, flags.port);
+            std::mt19937_64 rng(2000 + t);
+            std::normal_distribution<float> component;
+            std::uniform_int_distribution<uint64_t> key(0, flags.keys - 1);
+            std::vector<float> vecs(size_t{flags.batch} * flags.dim);
+            std::string target;
+            worker(stop, flags.upsert_qps, flags.upsert_threads, upserts, [&] {
+                target = "/v1/vectors?ids=";
+                for (uint32_t i = 0; i < flags.batch; ++i) {
+                    if (i) target += ",";
+                    target += "k" + std::to_string(key(rng));
+                }
+                for (float& x : vecs) x = component(rng);
+                return conn.request("POST", target, "application/octet-stream", asBytes(vecs));
+            });
+        });
+    }
+
+    Connection metrics(flags.host, flags.metrics_port);
+    const auto start = Clock::now();
+    const auto end = start + std::chrono::seconds(flags.duration_s);
+    auto q_before = queries.latency.snapshot();
+    auto u_before = upserts.latency.snapshot();
+    uint64_t q_ok = 0, q_rejected = 0, q_errors = 0, u_ok = 0, u_rejected = 0, u_errors = 0;
+    auto tick = start;
+    std::string line;
+    while (tick < end) {
+        tick = std::min(end, tick + std::chrono::milliseconds(flags.interval_ms));
+        std::this_thread::sleep_until(tick);
+        const double seconds = flags.interval_ms / 1000.0;
+        const auto q_now = queries.latency.snapshot();
+        const auto u_now = upserts.latency.snapshot();
+        const uint64_t qo = queries.ok.load(), qr = queries.rejected.load(), qe = queries.errors.load();
+        const uint64_t uo = upserts.ok.load(), ur = upserts.rejected.load(), ue = upserts.errors.load();
+        const ServerGauges gauges = scrape(metrics);
+
+        char head[64];
+        std::snprintf(head, sizeof(head), "{\"t_s\":%.3f",
+                      std::chrono::duration<double>(Clock::now() - start).count());
+        line = head;
+        appendSide(line, "query", window(q_now, q_before), seconds, qo - q_ok, qr - q_rejected, qe - q_errors);
+        appendSide(line, "upsert", window(u_now, u_before), seconds, uo - u_ok, ur - u_rejected, ue - u_errors);
+        appendGauge(line, "flush_lag_ms", gauges.flush_lag_ms);
+        appendGauge(line, "delta_fraction", gauges.delta_fraction);
+        appendGauge(line, "compaction_debt", gauges.compaction_debt);
+        line += "}\n";
+        std::fputs(line.c_str(), out);
+        std::fflush(out);
+
+        q_before = q_now;
+        u_before = u_now;
+        q_ok = qo, q_rejected = qr, q_errors = qe, u_ok = uo, u_rejected = ur, u_errors = ue;
+    }
+
+    stop.store(true);
+    for (auto& t : threads) t.join();
+
+    const double total = std::chrono::duration<double>(Clock::now() - start).count();
+    const util::LatencyHistogram::Snapshot empty;
+    line = "{\"summary\":true";
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), ",\"duration_s\":%.3f", total);
+    line += buf;
+    appendSide(line, "query", window(queries.latency.snapshot(), empty), total, queries.ok.load(),
+               queries.rejected.load(), queries.errors.load());
+    appendSide(line, "upsert", window(upserts.latency.snapshot(), empty), total, upserts.ok.load(),
+               upserts.rejected.load(), upserts.errors.load());
+    line += "}\n";
+    std::fputs(line.c_str(), out);
+    if (out != stdout) std::fclose(out);
+    return 0;
+}
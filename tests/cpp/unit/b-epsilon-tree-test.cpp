@@ -0,0 +1,335 @@
+#include "storage/betree/b-epsilon-tree.h"
+#include "storage/betree/node.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace woved::storage {
+namespace {
+
+constexpr VectorIdHash kMaxHash = std::numeric_limits<VectorIdHash>::max();
+
+std::vector<VectorIdHash> randomPivots(size_t count, std::mt19937_64& rng) {
+    std::vector<VectorIdHash> pivots;
+    while (pivots.size() < count) {
+        pivots.push_back(rng());
+        std::sort(pivots.begin(), pivots.end());
+        pivots.erase(std::unique(pivots.begin(), pivots.end()), pivots.end());
+    }
+    return pivots;
+}
+
+// The pivots and their neighbours, both ends of the hash space and random
+// keys
+std::vector<VectorIdHash> probeKeys(const std::vector<VectorIdHash>& pivots, std::mt19937_64& rng) {
+    std::vector<VectorIdHash> keys = {0, 1, kMaxHash - 1, kMaxHash};
+    for (VectorIdHash p : pivots) {
+        keys.push_back(p);
+        keys.push_back(p - 1);
+        keys.push_back(p + 1);
+    }
+    for (size_t i = 0; i < 256; ++i) keys.push_back(rng());
+    return keys;
+}
+
+size_t upperBound(const std::vector<VectorIdHash>& pivots, VectorIdHash key) {
+    return static_cast<size_t>(std::upper_bound(pivots.begin(), pivots.end(), key) - pivots.begin());
+}
+
+BTreeMessage message(VectorIdHash hash, Epoch epoch) {
+    BTreeMessage msg{};
+    msg.op = OperationType::UPSERT;
+    msg.entry.id = std::to_string(hash);
+    msg.entry.id_hash = hash;
+    msg.entry.vector = {1.0f, 2.0f, 3.0f, 4.0f};
+    msg.epoch = epoch;
+    return msg;
+}
+
+// Pivot search
+
+TEST(BEpsilonNodeTest, FindChildMatchesUpperBound) {
+    std::mt19937_64 rng(7);
+    // Empty, inside one line, line boundaries, and a 256-way node whose
+    // heads span more than one line
+    for (size_t count : {0, 1, 2, 7, 8, 9, 15, 16, 17, 63, 64, 65, 200, 255}) {
+        BEpsilonNode node(1, 1, 255);
+        const auto pivots = randomPivots(count, rng);
+        node.setPivots(pivots);
+        ASSERT_EQ(node.childCount(), count + 1);
+        for (VectorIdHash key : probeKeys(pivots, rng)) {
+            ASSERT_EQ(node.findChild(key), upperBound(pivots, key))
+                << count << " pivots, key " << key << ", search " << BEpsilonNode::pivotSearchIsa();
+        }
+    }
+}
+
+TEST(BEpsilonNodeTest, FindChildrenMatchesUpperBound) {
+    std::mt19937_64 rng(11);
+    for (size_t count : {0, 3, 8, 100, 255}) {
+        BEpsilonNode node(1, 1, 255);
+        const auto pivots = randomPivots(count, rng);
+        node.setPivots(pivots);
+        const auto keys = probeKeys(pivots, rng);
+        std::vector<uint32_t> children(keys.size());
+        node.findChildren(keys, children.data());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            ASSERT_EQ(children[i], upperBound(pivots, keys[i])) << count << " pivots, key " << keys[i];
+        }
+    }
+}
+
+TEST(BEpsilonNodeTest, FindChildWithExtremePivots) {
+    // A pivot of UINT64_MAX is indistinguishable from padding; the clamp
+    // keeps the key at the last child
+    BEpsilonNode node(1, 1, 15);
+    const std::vector<VectorIdHash> pivots = {0, 1, kMaxHash - 1, kMaxHash};
+    node.setPivots(pivots);
+    for (VectorIdHash key : {VectorIdHash{0}, VectorIdHash{1}, VectorIdHash{2}, kMaxHash - 1, kMaxHash}) {
+        EXPECT_EQ(node.findChild(key), upperBound(pivots, key)) << "key " << key;
+    }
+}
+
+TEST(BEpsilonNodeTest, SetPivotsRejectsBadPivots) {
+    BEpsilonNode node(1, 1, 3);
+    const std::vector<VectorIdHash> unsorted = {5, 3};
+    const std::vector<VectorIdHash> repeated = {3, 3};
+    const std::vector<VectorIdHash> too_many = {1, 2, 3, 4};
+    EXPECT_THROW(node.setPivots(unsorted), std::invalid_argument);
+    EXPECT_THROW(node.setPivots(repeated), std::invalid_argument);
+    EXPECT_THROW(node.setPivots(too_many), std::invalid_argument);
+}
+
+// Buffer sort and dedupe
+
+TEST(BEpsilonNodeTest, SortBufferKeepsNewestVersionPerId) {
+    std::mt19937_64 rng(13);
+    BEpsilonNode node(1, 1, 63);
+    const auto pivots = randomPivots(63, rng);
+    node.setPivots(pivots);
+
+    // Three versions of every id, appended out of epoch order
+    std::vector<VectorIdHash> ids(500);
+    for (auto& id : ids) id = rng();
+    std::vector<BTreeMessage> messages;
+    Epoch epoch = 0;
+    for (int version = 0; version < 3; ++version) {
+        for (VectorIdHash id : ids) messages.push_back(message(id, ++epoch));
+    }
+    std::shuffle(messages.begin(), messages.end(), rng);
+    std::unordered_map<VectorIdHash, Epoch> newest;
+    for (auto& m : messages) {
+        newest[m.entry.id_hash] = std::max(newest[m.entry.id_hash], m.epoch);
+        node.append(std::move(m));
+    }
+
+    EXPECT_FALSE(node.bufferSorted());
+    EXPECT_EQ(node.sortBuffer(), 2 * ids.size());
+    EXPECT_TRUE(node.bufferSorted());
+    EXPECT_EQ(node.sortBuffer(), 0u);
+    ASSERT_EQ(node.bufferCount(), newest.size());
+
+    size_t bytes = 0;
+    const auto buffered = node.messages();
+    for (size_t i = 0; i < buffered.size(); ++i) {
+        const auto& m = buffered[i];
+        bytes += BEpsilonNode::messageBytes(m.msg);
+        EXPECT_EQ(m.child, upperBound(pivots, m.id_hash));
+        EXPECT_EQ(m.msg.epoch, newest[m.id_hash]) << "id " << m.id_hash;
+        if (i > 0) {
+            const auto& prev = buffered[i - 1];
+            EXPECT_TRUE(std::tie(prev.child, prev.id_hash) < std::tie(m.child, m.id_hash));
+        }
+    }
+    EXPECT_EQ(node.bufferBytes(), bytes);
+    for (const auto& [id, epoch] : newest) {
+        const auto* latest = node.findLatest(id);
+        ASSERT_NE(latest, nullptr);
+        EXPECT_EQ(latest->msg.epoch, epoch);
+    }
+}
+
+TEST(BEpsilonNodeTest, TakeChildRunsRoutesEveryMessage) {
+    std::mt19937_64 rng(17);
+    BEpsilonNode node(1, 1, 15);
+    const auto pivots = randomPivots(15, rng);
+    node.setPivots(pivots);
+    for (Epoch e = 1; e <= 1000; ++e) node.append(message(rng(), e));
+
+    const auto runs = node.takeChildRuns();
+    ASSERT_EQ(runs.size(), node.childCount());
+    size_t total = 0;
+    for (size_t child = 0; child < runs.size(); ++child) {
+        for (size_t i = 0; i < runs[child].size(); ++i) {
+            EXPECT_EQ(upperBound(pivots, runs[child][i].id_hash), child);
+            if (i > 0) {
+                EXPECT_LT(runs[child][i - 1].id_hash, runs[child][i].id_hash);
+            }
+        }
+        total += runs[child].size();
+    }
+    EXPECT_EQ(total, 1000u);
+    EXPECT_EQ(node.bufferCount(), 0u);
+    EXPECT_EQ(node.bufferBytes(), 0u);
+}
+
+TEST(BEpsilonNodeTest, AppendAfterSortUnsortsBuffer) {
+    BEpsilonNode node(1, 0, 0);
+    node.append(message(5, 1));
+    node.sortBuffer();
+    node.append(message(5, 2));
+    EXPECT_FALSE(node.bufferSorted());
+    EXPECT_EQ(node.findLatest(5)->msg.epoch, 2u);
+    EXPECT_EQ(node.sortBuffer(), 1u);
+    EXPECT_EQ(node.findLatest(5)->msg.epoch, 2u);
+}
+
+// Parallel latched flush
+
+class BEpsilonTreeFlushTest : public ::testing::Test {
+protected:
+    static constexpr size_t kFanout = 16;
+    static constexpr size_t kWriters = 4;
+    static constexpr size_t kIdsPerWriter = 1500;
+    static constexpr size_t kVersions = 3;
+
+    BEpsilonTreeFlushTest() : tree_(config(), nullptr) {
+        tree_.setLeafSink([this](size_t leaf, std::span<const BEpsilonNode::Message> messages) {
+            std::lock_guard<std::mutex> lock(sink_mutex_);
+            for (size_t i = 0; i < messages.size(); ++i) {
+                const auto& m = messages[i];
+                // One leaf per 2^56 of hash space, runs sorted and deduped
+                if (m.id_hash >> 56 != leaf) misrouted_++;
+                if (i > 0 && messages[i - 1].id_hash >= m.id_hash) unsorted_++;
+                Epoch& written = written_[m.id_hash];
+                written = std::max(written, m.msg.epoch);
+            }
+        });
+    }
+
+    static BTreeConfig config() {
+        BTreeConfig config;
+        config.fanout = kFanout;
+        config.height = 3;  // 16 x 16 leaves
+        config.node_size_bytes = 4096;  // Small buffers: frequent flushes
+        config.parallel_flush = true;
+        config.flush_threads = 4;
+        return config;
+    }
+
+    Epoch written(VectorIdHash id) {
+        std::lock_guard<std::mutex> lock(sink_mutex_);
+        auto it = written_.find(id);
+        return it == written_.end() ? 0 : it->second;
+    }
+
+    BEpsilonTree tree_;
+    std::mutex sink_mutex_;
+    std::unordered_map<VectorIdHash, Epoch> written_;
+    size_t misrouted_ = 0;
+    size_t unsorted_ = 0;
+};
+
+TEST_F(BEpsilonTreeFlushTest, LookupNeverMissesDuringParallelFlush) {
+    ASSERT_EQ(tree_.leafCount(), kFanout * kFanout);
+
+    std::mt19937_64 rng(19);
+    std::vector<VectorIdHash> ids(kWriters * kIdsPerWriter);
+    for (auto& id : ids) id = rng();
+    // Newest epoch applied per id; 0 before the first
+    std::vector<std::atomic<Epoch>> acked(ids.size());
+    std::atomic<Epoch> next_epoch{0};
+    std::atomic<size_t> writers_done{0};
+    std::atomic<size_t> missing{0};
+    std::atomic<size_t> stale{0};
+    std::atomic<size_t> checked{0};
+
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < kWriters; ++w) {
+        threads.emplace_back([&, w] {
+            for (size_t v = 0; v < kVersions; ++v) {
+                for (size_t i = w * kIdsPerWriter; i < (w + 1) * kIdsPerWriter; ++i) {
+                    const Epoch epoch = next_epoch.fetch_add(1) + 1;
+                    tree_.apply(message(ids[i], epoch));
+                    acked[i].store(epoch, std::memory_order_release);
+                }
+            }
+            writers_done.fetch_add(1);
+        });
+    }
+    // A message is in the tree or already written by the leaf sink, never
+    // out of both, and never older than the newest acknowledged write
+    for (size_t r = 0; r < 2; ++r) {
+        threads.emplace_back([&, r] {
+            std::mt19937_64 pick(23 + r);
+            while (writers_done.load() < kWriters) {
+                const size_t i = pick() % ids.size();
+                const Epoch expected = acked[i].load(std::memory_order_acquire);
+                if (expected == 0) continue;
+                const auto found = tree_.lookup(ids[i]);
+                const Epoch seen = std::max(found ? found->epoch : 0, written(ids[i]));
+                if (seen == 0) missing.fetch_add(1);
+                else if (seen < expected) stale.fetch_add(1);
+                checked.fetch_add(1);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    EXPECT_EQ(missing.load(), 0u);
+    EXPECT_EQ(stale.load(), 0u);
+    EXPECT_GT(checked.load(), 0u);
+    EXPECT_GT(tree_.getStats().flush_count, 0u);
+
+    // A forced flush drains every buffer to the sink
+    tree_.flush(true);
+    EXPECT_EQ(tree_.getStats().messages_buffered, 0u);
+    EXPECT_EQ(tree_.getStats().bytes_buffered, 0u);
+    EXPECT_EQ(misrouted_, 0u);
+    EXPECT_EQ(unsorted_, 0u);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        EXPECT_FALSE(tree_.lookup(ids[i]));
+        ASSERT_EQ(written(ids[i]), acked[i].load()) << "id " << ids[i];
+    }
+}
+
+TEST_F(BEpsilonTreeFlushTest, ConcurrentForcedFlushesLoseNothing) {
+    std::mt19937_64 rng(29);
+    std::vector<VectorIdHash> ids(kWriters * kIdsPerWriter);
+    for (auto& id : ids) id = rng();
+
+    std::atomic<Epoch> next_epoch{0};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> writers;
+    for (size_t w = 0; w < kWriters; ++w) {
+        writers.emplace_back([&, w] {
+            for (size_t i = w * kIdsPerWriter; i < (w + 1) * kIdsPerWriter; ++i) {
+                tree_.apply(message(ids[i], next_epoch.fetch_add(1) + 1));
+            }
+        });
+    }
+    // Forced flushes racing the writers' own flushes over the same nodes
+    std::thread flusher([&] {
+        while (!stop.load()) tree_.flush(true);
+    });
+    for (auto& t : writers) t.join();
+    stop.store(true);
+    flusher.join();
+    tree_.flush(true);
+
+    EXPECT_EQ(tree_.getStats().messages_buffered, 0u);
+    EXPECT_EQ(misrouted_, 0u);
+    EXPECT_EQ(unsorted_, 0u);
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    EXPECT_EQ(written_.size(), ids.size());
+}
+
+} // namespace
+} // namespace woved::storage
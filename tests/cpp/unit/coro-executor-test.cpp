@@ -0,0 +1,247 @@
+#include "io/coro-executor.h"
+#include "core/config.h"
+#include "io/io-loop.h"
+#include "util/exceptions.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace woved::io {
+namespace {
+
+CoroExecutor::Options executorOptions(uint32_t threads, uint32_t max_in_flight = 4096) {
+    CoroExecutor::Options options;
+    options.threads = threads;
+    options.max_in_flight = max_in_flight;
+    return options;
+}
+
+util::Task<int> twice(int value) { co_return value * 2; }
+
+util::Task<int> sumOfTwice(int value) {
+    const int a = co_await twice(value);
+    const int b = co_await twice(value + 1);
+    co_return a + b;
+}
+
+util::Task<void> fail() {
+    throw util::IOException("device gone");
+    co_return;
+}
+
+util::Task<void> count(std::atomic<int>& counter) {
+    counter.fetch_add(1);
+    co_return;
+}
+
+// `len` bytes of `fd` at `offset`, through the driver's loop
+util::Task<std::string> readAt(int fd, size_t len, uint64_t offset) {
+    std::string data(len, '\0');
+    co_await IoLoop::local().read(fd, data.data(), len, offset);
+    co_return data;
+}
+
+// The blocks of `fd` read in one batch, each `len` bytes apart
+util::Task<std::vector<std::string>> readBatch(int fd, size_t len, size_t blocks) {
+    std::vector<std::string> data(blocks, std::string(len, '\0'));
+    IoBatch batch;
+    for (size_t i = 0; i < blocks; ++i) batch.submitRead(fd, data[i].data(), len, i * len, i);
+    size_t landed = 0;
+    while (landed < blocks) {
+        for (const auto& read : co_await batch.next()) {
+            if (read.error) throw util::IOException("batch read failed");
+            landed++;
+        }
+    }
+    co_return data;
+}
+
+TEST(CoroExecutorTest, DisabledExecutorDoesNotStart) {
+    std::atomic<int> counter{0};
+    CoroExecutor executor(executorOptions(0));
+    EXPECT_FALSE(executor.enabled());
+    executor.start();
+    EXPECT_THROW(executor.spawn(count(counter)), util::InvalidArgumentException);
+    EXPECT_EQ(counter.load(), 0);
+}
+
+TEST(CoroExecutorTest, SpawnRequiresRunningExecutor) {
+    std::atomic<int> counter{0};
+    CoroExecutor executor(executorOptions(1));
+    EXPECT_THROW(executor.spawn(count(counter)), util::InvalidArgumentException);
+
+    executor.start();
+    executor.submit(count(counter)).get();
+    executor.stop();
+    EXPECT_THROW(executor.spawn(count(counter)), util::InvalidArgumentException);
+    EXPECT_EQ(counter.load(), 1);
+
+    // Restartable
+    executor.start();
+    executor.submit(count(counter)).get();
+    EXPECT_EQ(counter.load(), 2);
+}
+
+TEST(CoroExecutorTest, SubmitDeliversResults) {
+    CoroExecutor executor(executorOptions(2));
+    executor.start();
+    std::vector<std::future<int>> futures;
+    for (int i = 0; i < 100; ++i) futures.push_back(executor.submit(sumOfTwice(i)));
+    for (int i = 0; i < 100; ++i) EXPECT_EQ(futures[i].get(), 4 * i + 2);
+    executor.stop();
+
+    const auto stats = executor.getStats();
+    EXPECT_EQ(stats.spawned, 100u);
+    EXPECT_EQ(stats.completed, 100u);
+    EXPECT_EQ(stats.failed, 0u);
+    EXPECT_EQ(stats.running, 0u);
+    EXPECT_EQ(stats.queued, 0u);
+}
+
+TEST(CoroExecutorTest, SubmitDeliversExceptions) {
+    CoroExecutor executor(executorOptions(1));
+    executor.start();
+    auto future = executor.submit(fail());
+    EXPECT_THROW(future.get(), util::IOException);
+
+    // The error went to the future; the task itself returned
+    executor.stop();
+    EXPECT_EQ(executor.getStats().failed, 0u);
+}
+
+TEST(CoroExecutorTest, SpawnPassesErrorToDone) {
+    CoroExecutor executor(executorOptions(1));
+    executor.start();
+    std::promise<std::exception_ptr> failed;
+    std::promise<std::exception_ptr> returned;
+    std::atomic<int> counter{0};
+    executor.spawn(fail(), [&](std::exception_ptr error) { failed.set_value(error); });
+    executor.spawn(count(counter), [&](std::exception_ptr error) { returned.set_value(error); });
+
+    const std::exception_ptr error = failed.get_future().get();
+    ASSERT_TRUE(error);
+    EXPECT_THROW(std::rethrow_exception(error), util::IOException);
+    EXPECT_FALSE(returned.get_future().get());
+
+    executor.stop();
+    const auto stats = executor.getStats();
+    EXPECT_EQ(stats.completed, 2u);
+    EXPECT_EQ(stats.failed, 1u);
+}
+
+TEST(CoroExecutorTest, ThrowingDoneDoesNotStopTheDriver) {
+    CoroExecutor executor(executorOptions(1));
+    executor.start();
+    std::atomic<int> counter{0};
+    executor.spawn(count(counter), [](std::exception_ptr) { throw std::runtime_error("callback bug"); });
+    EXPECT_EQ(executor.submit(twice(21)).get(), 42);
+    executor.stop();
+    EXPECT_EQ(counter.load(), 1);
+}
+
+TEST(CoroExecutorTest, StopRunsQueuedTasks) {
+    // One task at a time: the rest wait in the queue
+    CoroExecutor executor(executorOptions(1, 1));
+    executor.start();
+    std::atomic<int> counter{0};
+    for (int i = 0; i < 500; ++i) executor.spawn(count(counter));
+    executor.stop();
+
+    EXPECT_EQ(counter.load(), 500);
+    const auto stats = executor.getStats();
+    EXPECT_EQ(stats.completed, 500u);
+    EXPECT_EQ(stats.queued, 0u);
+    EXPECT_EQ(stats.peak_running, 1u);
+}
+
+TEST(CoroExecutorTest, MetricsFollowStats) {
+    CoroExecutor executor(executorOptions(1));
+    executor.start();
+    executor.spawn(fail());
+    executor.submit(twice(1)).get();
+    executor.stop();
+
+    const auto metrics = executor.metrics();
+    const std::vector<std::pair<std::string_view, double>> expected{
+        {"woved_executor_running", 0.0},
+        {"woved_executor_queued", 0.0},
+        {"woved_executor_completed", 2.0},
+        {"woved_executor_failed", 1.0},
+    };
+    EXPECT_EQ(metrics, expected);
+}
+
+TEST(CoroExecutorTest, OptionsFromConfigKeepRoomForOneTask) {
+    Config config;
+    config.query.executor_threads = 3;
+    config.query.executor_max_in_flight = 0;
+    const auto options = CoroExecutor::Options::fromConfig(config);
+    EXPECT_EQ(options.threads, 3u);
+    EXPECT_EQ(options.max_in_flight, 1u);
+}
+
+class CoroExecutorReadTest : public ::testing::Test {
+protected:
+    static constexpr size_t kBlock = 512;
+    static constexpr size_t kBlocks = 8;
+
+    void SetUp() override {
+        char dir[] = "/tmp/coro-executor-test-XXXXXX";
+        ASSERT_NE(::mkdtemp(dir), nullptr);
+        dir_ = dir;
+        const std::string path = dir_ + "/data";
+        std::ofstream out(path, std::ios::binary);
+        for (size_t i = 0; i < kBlocks; ++i) out << block(i);
+        out.close();
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        ASSERT_GE(fd_, 0);
+    }
+
+    void TearDown() override {
+        if (fd_ >= 0) ::close(fd_);
+        std::filesystem::remove_all(dir_);
+    }
+
+    // Block `i` of the file, filled with one letter
+    static std::string block(size_t i) { return std::string(kBlock, static_cast<char>('a' + i)); }
+
+    std::string dir_;
+    int fd_ = -1;
+};
+
+TEST_F(CoroExecutorReadTest, TasksAwaitReadsOfTheirDriver) {
+    CoroExecutor executor(executorOptions(2, 4));
+    executor.start();
+    std::vector<std::future<std::string>> futures;
+    for (size_t i = 0; i < 64; ++i) futures.push_back(executor.submit(readAt(fd_, kBlock, (i % kBlocks) * kBlock)));
+    for (size_t i = 0; i < futures.size(); ++i) EXPECT_EQ(futures[i].get(), block(i % kBlocks));
+}
+
+TEST_F(CoroExecutorReadTest, BatchReadsLandInTheirBuffers) {
+    CoroExecutor executor(executorOptions(1));
+    executor.start();
+    const auto data = executor.submit(readBatch(fd_, kBlock, kBlocks)).get();
+    ASSERT_EQ(data.size(), kBlocks);
+    for (size_t i = 0; i < kBlocks; ++i) EXPECT_EQ(data[i], block(i));
+}
+
+TEST_F(CoroExecutorReadTest, FailedReadThrowsInTheTask) {
+    CoroExecutor executor(executorOptions(1));
+    executor.start();
+    auto future = executor.submit(readAt(-1, kBlock, 0));
+    EXPECT_THROW(future.get(), util::IOException);
+    EXPECT_EQ(executor.submit(readAt(fd_, kBlock, kBlock)).get(), block(1));
+}
+
+} // namespace
+} // namespace woved::io
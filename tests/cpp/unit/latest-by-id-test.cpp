@@ -0,0 +1,314 @@
+#include "storage/latest-by-id.h"
+#include "util/exceptions.h"
+#include "util/hash.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace woved::storage {
+namespace {
+
+VectorLocation buffered(Epoch epoch, bool tombstone = false) {
+    VectorLocation loc;
+    loc.type = VectorLocation::BUFFER;
+    loc.local_id = 0;
+    loc.timestamp = Timestamp(0);
+    loc.epoch = epoch;
+    loc.tombstone = tombstone;
+    return loc;
+}
+
+VectorLocation inSegment(const std::string& segment, uint32_t local_id, Epoch epoch) {
+    VectorLocation loc = buffered(epoch);
+    loc.type = VectorLocation::SEGMENT;
+    loc.segment_id = segment;
+    loc.local_id = local_id;
+    return loc;
+}
+
+std::string idOf(size_t i) { return "id-" + std::to_string(i); }
+
+TEST(LatestByIdMapTest, UpsertAndLookup) {
+    LatestByIdMap map(4, 16);
+    map.upsert("a", util::hash_id("a"), buffered(3));
+
+    auto loc = map.getLatest("a");
+    ASSERT_TRUE(loc);
+    EXPECT_EQ(loc->type, VectorLocation::BUFFER);
+    EXPECT_EQ(loc->epoch, 3u);
+    EXPECT_TRUE(map.exists("a"));
+    EXPECT_TRUE(map.existsByHash(util::hash_id("a")));
+    EXPECT_FALSE(map.getLatest("b"));
+    EXPECT_FALSE(map.exists("b"));
+
+    map.markDeleted("a", util::hash_id("a"), Timestamp(0), 4);
+    EXPECT_FALSE(map.exists("a"));
+    ASSERT_TRUE(map.getLatest("a"));
+    EXPECT_TRUE(map.getLatest("a")->tombstone);
+    EXPECT_EQ(map.getStats().total_entries, 1u);
+}
+
+TEST(LatestByIdMapTest, LaterEpochWins) {
+    LatestByIdMap map(4, 16);
+    const VectorIdHash hash = util::hash_id("a");
+    map.upsert("a", hash, buffered(5));
+    map.upsert("a", hash, buffered(3, true));
+    EXPECT_EQ(map.getPackedByHash(hash)->epoch(), 5u);
+    EXPECT_TRUE(map.exists("a"));
+
+    map.upsert("a", hash, inSegment("seg-1", 7, 5));
+    EXPECT_EQ(map.getPackedByHash(hash)->type(), VectorLocation::SEGMENT);
+
+    std::vector<LatestByIdMap::HashedLocation> batch{{hash, buffered(4), nullptr}, {hash, buffered(6), nullptr}};
+    map.upsertBatch(batch);
+    EXPECT_EQ(map.getPackedByHash(hash)->epoch(), 6u);
+}
+
+TEST(LatestByIdMapTest, GrowsPastInitialCapacity) {
+    LatestByIdMap map(2, 4);
+    constexpr size_t kIds = 20000;
+    for (size_t i = 0; i < kIds; ++i) {
+        map.upsert(idOf(i), util::hash_id(idOf(i)), buffered(i + 1));
+    }
+    for (size_t i = 0; i < kIds; ++i) {
+        auto loc = map.getLatest(idOf(i));
+        ASSERT_TRUE(loc) << idOf(i);
+        EXPECT_EQ(loc->epoch, i + 1);
+    }
+    const auto stats = map.getStats();
+    EXPECT_EQ(stats.total_entries, kIds);
+    EXPECT_EQ(stats.buffer_entries, kIds);
+}
+
+TEST(LatestByIdMapTest, RemovingSegmentKeepsProbeChainsIntact) {
+    // One shard of 64 slots: hashes equal mod 64 share a probe chain, so
+    // removals shift the survivors back
+    LatestByIdMap map(1, 64);
+    std::vector<VectorIdHash> hashes;
+    for (VectorIdHash i = 0; i < 12; ++i) hashes.push_back(5 + 64 * i);
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        const std::string segment = i % 2 ? "seg-odd" : "seg-even";
+        map.upsertBatch(std::vector<LatestByIdMap::HashedLocation>{
+            {hashes[i], inSegment(segment, static_cast<uint32_t>(i), 1), nullptr}});
+    }
+
+    map.removeSegmentEntries("seg-even");
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        auto loc = map.getLatestByHash(hashes[i]);
+        if (i % 2 == 0) {
+            EXPECT_FALSE(loc) << i;
+            continue;
+        }
+        ASSERT_TRUE(loc) << i;
+        EXPECT_EQ(loc->segment_id, "seg-odd");
+        EXPECT_EQ(loc->local_id, i);
+    }
+    EXPECT_EQ(map.getStats().segment_entries, hashes.size() / 2);
+}
+
+TEST(LatestByIdMapTest, RemovingSegmentSkipsRewrittenEntries) {
+    LatestByIdMap map(4, 16);
+    map.upsert("a", util::hash_id("a"), inSegment("seg-1", 0, 1));
+    map.upsert("b", util::hash_id("b"), inSegment("seg-1", 1, 1));
+    map.upsert("b", util::hash_id("b"), buffered(2));
+
+    map.removeSegmentEntries("seg-1");
+    EXPECT_FALSE(map.getLatest("a"));
+    ASSERT_TRUE(map.getLatest("b"));
+    EXPECT_EQ(map.getLatest("b")->type, VectorLocation::BUFFER);
+}
+
+TEST(LatestByIdMapTest, MoveToSegment) {
+    LatestByIdMap map(4, 16);
+    map.upsert("a", util::hash_id("a"), buffered(1));
+    map.upsert("b", util::hash_id("b"), buffered(2));
+
+    map.moveToSegment(std::vector<VectorId>{"a", "b"}, "seg-1", 2);
+    for (const char* id : {"a", "b"}) {
+        auto loc = map.getLatest(id);
+        ASSERT_TRUE(loc);
+        EXPECT_EQ(loc->type, VectorLocation::SEGMENT);
+        EXPECT_EQ(loc->segment_id, "seg-1");
+    }
+    EXPECT_EQ(map.getStats().buffer_entries, 0u);
+
+    map.removeSegmentEntries("seg-1");
+    EXPECT_EQ(map.getStats().total_entries, 0u);
+}
+
+TEST(LatestByIdMapTest, HashCollisionsWithoutIdIndex) {
+    LatestByIdMap map(4, 16, false);
+    // "b" forced onto the hash of "a", as a collision would: it is held
+    // in the side map
+    const VectorIdHash hash = util::hash_id("a");
+    map.upsert("a", hash, buffered(1));
+    map.upsert("b", hash, buffered(2, true));
+
+    ASSERT_TRUE(map.getLatest("a"));
+    EXPECT_EQ(map.getLatest("a")->epoch, 1u);
+    EXPECT_TRUE(map.exists("a"));
+    ASSERT_TRUE(map.getLatest("b"));
+    EXPECT_EQ(map.getLatest("b")->epoch, 2u);
+    EXPECT_FALSE(map.exists("b"));
+
+    // Later updates of the side-map id stay there
+    map.upsert("b", hash, buffered(3));
+    EXPECT_TRUE(map.exists("b"));
+    EXPECT_EQ(map.getLatest("a")->epoch, 1u);
+}
+
+TEST(LatestByIdMapTest, SnapshotRestoreRoundTrip) {
+    LatestByIdMap map(4, 16);
+    map.registerSegment(1, "seg-1");
+    for (size_t i = 0; i < 100; ++i) {
+        const VectorLocation loc = i % 3 ? buffered(i + 1) : inSegment("seg-1", static_cast<uint32_t>(i), i + 1);
+        map.upsert(idOf(i), util::hash_id(idOf(i)), loc);
+    }
+
+    LatestByIdMap restored(8, 16);
+    restored.registerSegment(1, "seg-1");
+    const auto entries = map.snapshot();
+    EXPECT_EQ(entries.size(), 100u);
+    restored.restore(entries, 2);
+    for (size_t i = 0; i < 100; ++i) {
+        auto loc = restored.getLatestByHash(util::hash_id(idOf(i)));
+        ASSERT_TRUE(loc) << i;
+        EXPECT_EQ(loc->epoch, i + 1);
+        EXPECT_EQ(loc->type, i % 3 ? VectorLocation::BUFFER : VectorLocation::SEGMENT);
+    }
+}
+
+TEST(LatestByIdMapTest, ReadersNeverSeeTornRecords) {
+    // Writers keep local_id equal to the epoch; a reader copying a record
+    // mid-update would see them disagree
+    LatestByIdMap map(2, 4);
+    constexpr size_t kIds = 256;
+    constexpr Epoch kRounds = 200;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> torn{0};
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 2; ++r) {
+        readers.emplace_back([&] {
+            while (!done.load(std::memory_order_acquire)) {
+                for (size_t i = 0; i < kIds; ++i) {
+                    auto loc = map.getPackedByHash(util::hash_id(idOf(i)));
+                    if (loc && loc->localId() != loc->epoch()) torn++;
+                }
+            }
+        });
+    }
+    std::vector<std::thread> writers;
+    for (size_t w = 0; w < 2; ++w) {
+        writers.emplace_back([&, w] {
+            for (Epoch epoch = 1; epoch <= kRounds; ++epoch) {
+                for (size_t i = w; i < kIds; i += 2) {
+                    VectorLocation loc = inSegment("seg-1", static_cast<uint32_t>(epoch), epoch);
+                    map.upsert(idOf(i), util::hash_id(idOf(i)), loc);
+                }
+            }
+        });
+    }
+    for (auto& writer : writers) writer.join();
+    done.store(true, std::memory_order_release);
+    for (auto& reader : readers) reader.join();
+
+    EXPECT_EQ(torn.load(), 0u);
+    for (size_t i = 0; i < kIds; ++i) {
+        EXPECT_EQ(map.getPackedByHash(util::hash_id(idOf(i)))->epoch(), kRounds);
+    }
+}
+
+// Hashes whose high bits put them in shards 0 and 1
+constexpr VectorIdHash kShard0 = 7;
+constexpr VectorIdHash kShard1 = (VectorIdHash{1} << 48) | 7;
+
+TEST(LatestByIdMapTest, VersionedReadValidatesUntilItsShardIsWritten) {
+    LatestByIdMap map(2, 16);
+    map.upsert("a", kShard0, buffered(1));
+
+    const auto read = map.readVersioned(kShard0);
+    ASSERT_TRUE(read.location);
+    EXPECT_EQ(read.location->epoch(), 1u);
+    EXPECT_EQ(read.version % 2, 0u) << "version taken mid-write";
+    EXPECT_TRUE(map.validateVersion(kShard0, read.version));
+
+    // Versions are per shard: a write elsewhere leaves the read valid
+    map.upsert("b", kShard1, buffered(2));
+    EXPECT_TRUE(map.validateVersion(kShard0, read.version));
+
+    map.upsert("c", kShard0 + 1, buffered(3));
+    EXPECT_FALSE(map.validateVersion(kShard0, read.version));
+}
+
+TEST(LatestByIdMapTest, VersionedReadOfMissingId) {
+    LatestByIdMap map(2, 16);
+    const auto read = map.readVersioned(kShard0);
+    EXPECT_FALSE(read.location);
+    EXPECT_TRUE(map.validateVersion(kShard0, read.version));
+
+    map.upsert("a", kShard0, buffered(1));
+    EXPECT_FALSE(map.validateVersion(kShard0, read.version));
+}
+
+TEST(LatestByIdMapTest, UpsertIfVersionRejectsStaleVersion) {
+    LatestByIdMap map(2, 16);
+    map.upsert("a", kShard0, buffered(1));
+    const uint64_t version = map.readVersioned(kShard0).version;
+
+    map.upsert("b", kShard0 + 1, buffered(2));
+    EXPECT_FALSE(map.upsertIfVersion("a", kShard0, buffered(5), version));
+    EXPECT_EQ(map.getPackedByHash(kShard0)->epoch(), 1u);
+
+    const uint64_t fresh = map.readVersioned(kShard0).version;
+    EXPECT_TRUE(map.upsertIfVersion("a", kShard0, buffered(5), fresh));
+    EXPECT_EQ(map.getPackedByHash(kShard0)->epoch(), 5u);
+    EXPECT_FALSE(map.validateVersion(kShard0, fresh));
+}
+
+TEST(LatestByIdMapTest, FilterExisting) {
+    LatestByIdMap map(2, 16);
+    map.upsert("a", kShard0, buffered(1));
+    map.upsert("b", kShard1, buffered(1));
+    map.markDeleted("b", kShard1, Timestamp(0), 2);
+
+    const std::vector<VectorIdHash> hashes{kShard0, kShard1, kShard0 + 1};
+    std::vector<uint8_t> live(hashes.size(), 2);
+    map.filterExisting(hashes, live);
+    EXPECT_EQ(live, (std::vector<uint8_t>{1, 0, 0}));
+
+    std::vector<uint8_t> small(1);
+    EXPECT_THROW(map.filterExisting(hashes, small), util::InvalidArgumentException);
+}
+
+TEST(LatestByIdMapTest, ValidatedReadsMatchWrittenLocations) {
+    // A reader whose version still validates after the read must have seen
+    // a location some writer stored whole: local_id tracks the epoch
+    LatestByIdMap map(1, 16);
+    constexpr Epoch kRounds = 20000;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> validated{0};
+    std::atomic<size_t> mismatched{0};
+
+    map.upsert("a", kShard0, inSegment("seg-1", 0, 0));
+    std::thread reader([&] {
+        while (!done.load(std::memory_order_acquire) || validated.load() == 0) {
+            const auto read = map.readVersioned(kShard0);
+            if (!read.location || !map.validateVersion(kShard0, read.version)) continue;
+            validated++;
+            if (read.location->localId() != read.location->epoch()) mismatched++;
+        }
+    });
+    for (Epoch epoch = 1; epoch <= kRounds; ++epoch) {
+        map.upsert("a", kShard0, inSegment("seg-1", static_cast<uint32_t>(epoch), epoch));
+    }
+    done.store(true, std::memory_order_release);
+    reader.join();
+
+    EXPECT_EQ(mismatched.load(), 0u);
+}
+
+} // namespace
+} // namespace woved::storage
@@ -0,0 +1,223 @@
+#include "storage/buffer/msg-buf.h"
+#include "util/epoch-reclaim.h"
+#include "util/hash.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace woved::storage {
+namespace {
+
+constexpr size_t kDim = 4;
+constexpr size_t kGraceBatch = 64;  // MessageBuffer::kGraceBatch
+
+class MessageBufferTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        config_.shard_count = 4;
+        config_.dim = kDim;
+        latest_ = std::make_shared<LatestByIdMap>(4, 64);
+    }
+
+    MessageBuffer& buffer() {
+        if (!buffer_) buffer_ = std::make_unique<MessageBuffer>(config_, latest_);
+        return *buffer_;
+    }
+
+    // Upsert of `id` at `epoch` whose vector is `value` in every lane
+    static BTreeMessage upsert(const std::string& id, Epoch epoch, float value = 1.0f) {
+        BTreeMessage msg;
+        msg.op = OperationType::UPSERT;
+        msg.entry.id = id;
+        msg.entry.id_hash = util::hash_id(id);
+        msg.entry.vector.assign(kDim, value);
+        msg.epoch = epoch;
+        msg.timestamp = Timestamp(static_cast<int64_t>(epoch));
+        return msg;
+    }
+
+    void append(const BTreeMessage& msg) {
+        ASSERT_EQ(buffer().append(msg.entry.id_hash, msg).status, AdmissionResult::ACCEPTED);
+    }
+
+    // (id, first vector lane) of what scanForQuery returns at `read_epoch`,
+    // sorted
+    std::vector<std::pair<std::string, float>> scan(Epoch read_epoch = kLatestEpoch) {
+        std::vector<std::pair<std::string, float>> seen;
+        for (const auto& entry : buffer().scanForQuery(Vector(kDim, 1.0f), 0, 0, {}, 10000, {}, read_epoch)) {
+            seen.emplace_back(entry.id, entry.vector.at(0));
+        }
+        std::sort(seen.begin(), seen.end());
+        return seen;
+    }
+
+    // Hashes returned by scanTopK at `read_epoch`, sorted
+    std::vector<VectorIdHash> topK(Epoch read_epoch = kLatestEpoch) {
+        std::vector<VectorIdHash> seen;
+        for (const auto& hit : buffer().scanTopK(Vector(kDim, 1.0f), Metric::INNER_PRODUCT, 0, 0, {}, 10,
+                                                 10000, {}, read_epoch)) {
+            seen.push_back(hit.id_hash);
+        }
+        std::sort(seen.begin(), seen.end());
+        return seen;
+    }
+
+    Epoch latestEpoch(const std::string& id) const {
+        auto loc = latest_->getPackedByHash(util::hash_id(id));
+        return loc ? loc->epoch() : 0;
+    }
+
+    static std::vector<VectorIdHash> hashes(const std::vector<std::string>& ids) {
+        std::vector<VectorIdHash> out;
+        for (const auto& id : ids) out.push_back(util::hash_id(id));
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+    MessageBuffer::Config config_;
+    std::shared_ptr<LatestByIdMap> latest_;
+    std::unique_ptr<MessageBuffer> buffer_;
+};
+
+using Seen = std::vector<std::pair<std::string, float>>;
+
+TEST_F(MessageBufferTest, ScanSeesLiveMessagesAtDefaultEpoch) {
+    append(upsert("a", 1));
+    append(upsert("b", 2));
+
+    EXPECT_EQ(scan(), (Seen{{"a", 1.0f}, {"b", 1.0f}}));
+    EXPECT_EQ(topK(), hashes({"a", "b"}));
+
+    const std::vector<Vector> queries(2, Vector(kDim, 1.0f));
+    const auto batch = buffer().scanTopKBatch(queries, Metric::INNER_PRODUCT, 0, 0, {}, 10);
+    ASSERT_EQ(batch.size(), 2u);
+    for (const auto& hits : batch) EXPECT_EQ(hits.size(), 2u);
+}
+
+TEST_F(MessageBufferTest, ScanAtExplicitEpochSkipsNewerMessages) {
+    append(upsert("a", 1));
+    append(upsert("b", 2));
+
+    EXPECT_EQ(scan(1), (Seen{{"a", 1.0f}}));
+    EXPECT_EQ(topK(1), hashes({"a"}));
+    EXPECT_EQ(scan(2), (Seen{{"a", 1.0f}, {"b", 1.0f}}));
+    EXPECT_TRUE(scan(0).empty());
+}
+
+TEST_F(MessageBufferTest, ScanReadsSupersededVersionBelowItsReplacement) {
+    append(upsert("a", 1, 1.0f));
+    append(upsert("a", 3, 2.0f));
+
+    EXPECT_EQ(scan(), (Seen{{"a", 2.0f}}));
+    EXPECT_EQ(scan(3), (Seen{{"a", 2.0f}}));
+    EXPECT_EQ(scan(2), (Seen{{"a", 1.0f}}));
+    EXPECT_EQ(topK(), hashes({"a"}));
+}
+
+TEST_F(MessageBufferTest, DedupeSupersedesOlderVersion) {
+    append(upsert("a", 1, 1.0f));
+    append(upsert("a", 2, 2.0f));
+    append(upsert("b", 3));
+
+    const auto stats = buffer().getStats();
+    EXPECT_EQ(stats.message_count, 2u);
+    EXPECT_EQ(stats.dedupe_count, 1u);
+    EXPECT_EQ(latestEpoch("a"), 2u);
+    EXPECT_EQ(scan(), (Seen{{"a", 2.0f}, {"b", 1.0f}}));
+}
+
+TEST_F(MessageBufferTest, EqualEpochLaterAppendWins) {
+    append(upsert("a", 4, 1.0f));
+    append(upsert("a", 4, 2.0f));
+
+    EXPECT_EQ(buffer().getStats().message_count, 1u);
+    EXPECT_EQ(scan(), (Seen{{"a", 2.0f}}));
+    EXPECT_EQ(scan(4), (Seen{{"a", 2.0f}}));
+}
+
+TEST_F(MessageBufferTest, LateOlderEpochDoesNotSupersedeNewer) {
+    append(upsert("a", 5, 5.0f));
+    append(upsert("a", 3, 3.0f));
+
+    const auto stats = buffer().getStats();
+    EXPECT_EQ(stats.message_count, 1u);
+    EXPECT_EQ(stats.dedupe_count, 1u);
+    EXPECT_EQ(latestEpoch("a"), 5u);
+    EXPECT_EQ(scan(), (Seen{{"a", 5.0f}}));
+    EXPECT_EQ(scan(4), (Seen{{"a", 3.0f}}));
+    EXPECT_TRUE(scan(2).empty());
+
+    // The late version is stored superseded and never sliced for a flush
+    LeafSlice slice = buffer().sliceOldest(100);
+    ASSERT_EQ(slice.size(), 1u);
+    EXPECT_EQ(slice.messages()[0].epoch(), 5u);
+}
+
+TEST_F(MessageBufferTest, LateVersionIsChainedBetweenItsNeighbours) {
+    append(upsert("a", 1, 1.0f));
+    append(upsert("a", 5, 5.0f));
+    append(upsert("a", 3, 3.0f));
+
+    EXPECT_EQ(scan(), (Seen{{"a", 5.0f}}));
+    EXPECT_EQ(scan(4), (Seen{{"a", 3.0f}}));
+    EXPECT_EQ(scan(2), (Seen{{"a", 1.0f}}));
+    EXPECT_EQ(buffer().getStats().message_count, 1u);
+    EXPECT_EQ(latestEpoch("a"), 5u);
+}
+
+TEST_F(MessageBufferTest, SupersededPayloadWaitsForPinnedReaders) {
+    append(upsert("a", 1, 1.0f));
+
+    // A reader pinned before the supersedes, on its own thread
+    std::promise<void> pinned;
+    std::promise<void> release;
+    std::thread reader([&] {
+        auto guard = util::EpochDomain::global().pin();
+        pinned.set_value();
+        release.get_future().wait();
+    });
+    pinned.get_future().wait();
+
+    Epoch epoch = 2;
+    for (size_t i = 0; i <= kGraceBatch; ++i) append(upsert("a", epoch++, 2.0f));
+    EXPECT_EQ(scan(1), (Seen{{"a", 1.0f}}));
+
+    release.set_value();
+    reader.join();
+    for (size_t i = 0; i < 2 * kGraceBatch; ++i) append(upsert("a", epoch++, 2.0f));
+    EXPECT_TRUE(scan(1).empty());
+    EXPECT_EQ(scan(), (Seen{{"a", 2.0f}}));
+}
+
+TEST_F(MessageBufferTest, StagedAppendPublishesOnScan) {
+    config_.staged_append = true;
+    config_.staging_batch = 16;
+    append(upsert("a", 1));
+    append(upsert("b", 6, 6.0f));
+    append(upsert("b", 4, 4.0f));
+    EXPECT_EQ(buffer().getStats().message_count, 0u);
+
+    EXPECT_EQ(scan(), (Seen{{"a", 1.0f}, {"b", 6.0f}}));
+    EXPECT_EQ(scan(5), (Seen{{"a", 1.0f}, {"b", 4.0f}}));
+    EXPECT_EQ(buffer().getStats().message_count, 2u);
+    EXPECT_EQ(latestEpoch("b"), 6u);
+}
+
+TEST_F(MessageBufferTest, StagedAppendPublishesFullBatch) {
+    // Batches fill per shard
+    config_.shard_count = 1;
+    config_.staged_append = true;
+    config_.staging_batch = 4;
+    for (Epoch epoch = 1; epoch <= 4; ++epoch) append(upsert("id-" + std::to_string(epoch), epoch));
+
+    EXPECT_EQ(buffer().getStats().message_count, 4u);
+    EXPECT_EQ(latestEpoch("id-4"), 4u);
+}
+
+} // namespace
+} // namespace woved::storage
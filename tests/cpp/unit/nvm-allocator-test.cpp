@@ -0,0 +1,253 @@
+#include "storage/pmem/nvm-allocator.h"
+#include "util/fault-point.h"
+#include <gtest/gtest.h>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace woved::storage {
+namespace {
+
+// Lane 0's redo log, the first one a fresh process commits through: it
+// follows the 4 KiB pool header and reads {commit u64, crc u32, count u32,
+// entries {target u64, value u64}[]}
+constexpr off_t kLog = 4096;
+constexpr off_t kLogCount = kLog + 12;
+constexpr off_t kLogEntries = kLog + 16;
+constexpr off_t kEntryBytes = 16;
+
+class NvmAllocatorTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char dir[] = "/tmp/nvm-allocator-test-XXXXXX";
+        ASSERT_NE(::mkdtemp(dir), nullptr);
+        dir_ = dir;
+        options_.path = dir_ + "/pool";
+        options_.pool_bytes = 4 << 20;
+        options_.chunk_bytes = 65536;
+    }
+
+    void TearDown() override { std::filesystem::remove_all(dir_); }
+
+    // Runs `body` against the pool in a child process armed to be killed
+    // at fault point `point`; returns the blocks it report()ed
+    std::vector<PmemPtr<void>> crashAt(const char* point, const std::function<void(NvmAllocator&)>& body) {
+        int fds[2];
+        EXPECT_EQ(::pipe(fds), 0);
+        const pid_t pid = ::fork();
+        if (pid == 0) {
+            ::close(fds[0]);
+            report_fd_ = fds[1];
+            ::setenv("WOVED_FAULT_INJECTION", "1", 1);
+            ::setenv("WOVED_KILL_AT", point, 1);
+            if (!util::install_fault_points() || ::raise(SIGUSR1) != 0) ::_exit(2);
+            try {
+                NvmAllocator allocator(options_);
+                body(allocator);
+            } catch (...) {
+                ::_exit(3);
+            }
+            ::_exit(0);  // Never reached the point
+        }
+        ::close(fds[1]);
+        int status = 0;
+        EXPECT_EQ(::waitpid(pid, &status, 0), pid);
+        EXPECT_TRUE(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL) << "child exit status " << status;
+
+        std::vector<PmemPtr<void>> reported;
+        uint64_t raw;
+        while (::read(fds[0], &raw, sizeof(raw)) == sizeof(raw)) reported.push_back(PmemPtr<void>::fromRaw(raw));
+        ::close(fds[0]);
+        return reported;
+    }
+
+    // From the child: hand a block back to the test
+    void report(PmemPtr<void> block) const {
+        const uint64_t raw = block.raw();
+        if (::write(report_fd_, &raw, sizeof(raw)) != sizeof(raw)) ::_exit(4);
+    }
+
+    // Overwrite bytes of the closed pool file, as a torn write would
+    void patch(off_t offset, const void* data, size_t len) const {
+        const int fd = ::open(options_.path.c_str(), O_RDWR);
+        ASSERT_GE(fd, 0);
+        EXPECT_EQ(::pwrite(fd, data, len, offset), static_cast<ssize_t>(len));
+        ::close(fd);
+    }
+
+    template <typename T>
+    T peek(off_t offset) const {
+        T value{};
+        const int fd = ::open(options_.path.c_str(), O_RDONLY);
+        EXPECT_GE(fd, 0);
+        EXPECT_EQ(::pread(fd, &value, sizeof(value), offset), static_cast<ssize_t>(sizeof(value)));
+        ::close(fd);
+        return value;
+    }
+
+    // Crash with a publish of a 256 B block into the root durably
+    // committed but not applied
+    PmemPtr<void> crashCommittedPublish() {
+        auto blocks = crashAt("pmem_committed", [this](NvmAllocator& allocator) {
+            PmemPtr<void> block = allocator.reserve(256);
+            report(block);
+            allocator.publish(block, allocator.root());
+        });
+        EXPECT_EQ(blocks.size(), 1u);
+        return blocks.empty() ? PmemPtr<void>() : blocks[0];
+    }
+
+    // The pool after a crash left nothing of `block` behind, having
+    // replayed `replayed` logs
+    void expectDropped(PmemPtr<void> block, uint64_t replayed = 0) {
+        NvmAllocator allocator(options_);
+        const auto stats = allocator.getStats();
+        EXPECT_EQ(stats.replayed, replayed);
+        EXPECT_EQ(stats.allocated_bytes, 0u);
+        EXPECT_EQ(stats.free_chunks, stats.chunks);
+        EXPECT_FALSE(*allocator.root());
+        EXPECT_FALSE(allocator.allocated(block));
+    }
+
+    std::string dir_;
+    NvmAllocator::Options options_;
+    int report_fd_ = -1;
+};
+
+TEST_F(NvmAllocatorTest, ReservedBlockIsFreeAfterCrash) {
+    auto blocks = crashAt("pmem_logged", [this](NvmAllocator& allocator) {
+        report(allocator.reserve(256));
+        ::raise(SIGKILL);
+    });
+    ASSERT_EQ(blocks.size(), 1u);
+    expectDropped(blocks[0]);
+}
+
+TEST_F(NvmAllocatorTest, CrashBeforeCommitWordDropsTransaction) {
+    auto blocks = crashAt("pmem_logged", [this](NvmAllocator& allocator) {
+        PmemPtr<void> block = allocator.reserve(256);
+        report(block);
+        allocator.publish(block, allocator.root());
+    });
+    ASSERT_EQ(blocks.size(), 1u);
+    expectDropped(blocks[0]);
+}
+
+TEST_F(NvmAllocatorTest, CrashAfterCommitWordReplays) {
+    const PmemPtr<void> block = crashCommittedPublish();
+    ASSERT_TRUE(block);
+
+    NvmAllocator allocator(options_);
+    const auto stats = allocator.getStats();
+    EXPECT_EQ(stats.replayed, 1u);
+    EXPECT_EQ(*allocator.root(), block);
+    EXPECT_TRUE(allocator.allocated(block));
+    EXPECT_EQ(stats.allocated_bytes, allocator.blockBytes(block));
+    EXPECT_EQ(peek<uint64_t>(kLog), 0u) << "replayed log not retired";
+}
+
+TEST_F(NvmAllocatorTest, CrashAfterApplyReplaysIdempotently) {
+    auto blocks = crashAt("pmem_applied", [this](NvmAllocator& allocator) {
+        PmemPtr<void> block = allocator.reserve(256);
+        report(block);
+        allocator.publish(block, allocator.root());
+    });
+    ASSERT_EQ(blocks.size(), 1u);
+
+    NvmAllocator allocator(options_);
+    EXPECT_EQ(allocator.getStats().replayed, 1u);
+    EXPECT_EQ(*allocator.root(), blocks[0]);
+    EXPECT_TRUE(allocator.allocated(blocks[0]));
+    EXPECT_EQ(allocator.getStats().allocated_bytes, allocator.blockBytes(blocks[0]));
+}
+
+TEST_F(NvmAllocatorTest, CrashDuringFreeReplays) {
+    PmemPtr<void> block;
+    {
+        NvmAllocator allocator(options_);
+        block = allocator.reserve(256);
+        allocator.publish(block, allocator.root());
+        ASSERT_TRUE(allocator.allocated(block));
+    }
+    crashAt("pmem_committed", [](NvmAllocator& allocator) { allocator.free(allocator.root()); });
+    expectDropped(block, 1);
+}
+
+TEST_F(NvmAllocatorTest, CrashKeepsPointersBetweenBlocks) {
+    // A 64 B parent in the root pointing at a 1 KiB child, in one
+    // transaction
+    auto blocks = crashAt("pmem_committed", [this](NvmAllocator& allocator) {
+        PmemPtr<PmemPtr<void>> parent = allocator.reserve<PmemPtr<void>>();
+        PmemPtr<void> child = allocator.reserve(1024);
+        report(parent);
+        report(child);
+        NvmAllocator::Transaction tx(allocator);
+        tx.publish(parent);
+        tx.publish(child);
+        tx.set(allocator.root(), PmemPtr<void>(parent));
+        tx.set(parent.get(), child);
+        tx.commit();
+    });
+    ASSERT_EQ(blocks.size(), 2u);
+
+    NvmAllocator allocator(options_);
+    EXPECT_EQ(allocator.getStats().replayed, 1u);
+    ASSERT_EQ(*allocator.root(), blocks[0]);
+    EXPECT_EQ(*blocks[0].cast<PmemPtr<void>>(), blocks[1]);
+    EXPECT_TRUE(allocator.allocated(blocks[0]));
+    EXPECT_TRUE(allocator.allocated(blocks[1]));
+    EXPECT_EQ(allocator.getStats().allocated_bytes,
+              allocator.blockBytes(blocks[0]) + allocator.blockBytes(blocks[1]));
+}
+
+TEST_F(NvmAllocatorTest, TornLogIsDropped) {
+    const PmemPtr<void> block = crashCommittedPublish();
+    ASSERT_TRUE(block);
+    // One byte of the second entry, the root store, never reached media
+    const off_t value = kLogEntries + kEntryBytes + 8;
+    const auto byte = static_cast<uint8_t>(peek<uint8_t>(value) ^ 0xff);
+    patch(value, &byte, sizeof(byte));
+    expectDropped(block);
+    EXPECT_EQ(peek<uint64_t>(kLog), 0u) << "torn log not retired";
+}
+
+TEST_F(NvmAllocatorTest, TruncatedLogIsDropped) {
+    const PmemPtr<void> block = crashCommittedPublish();
+    ASSERT_TRUE(block);
+    ASSERT_EQ(peek<uint32_t>(kLogCount), 2u);
+    const uint32_t count = 1;
+    patch(kLogCount, &count, sizeof(count));
+    expectDropped(block);
+}
+
+TEST_F(NvmAllocatorTest, OversizedLogCountIsDropped) {
+    const PmemPtr<void> block = crashCommittedPublish();
+    ASSERT_TRUE(block);
+    const uint32_t count = NvmAllocator::kLogEntries + 1;
+    patch(kLogCount, &count, sizeof(count));
+    expectDropped(block);
+}
+
+TEST_F(NvmAllocatorTest, ReplayedBlockIsNotReservedAgain) {
+    const PmemPtr<void> block = crashCommittedPublish();
+    ASSERT_TRUE(block);
+
+    NvmAllocator allocator(options_);
+    ASSERT_TRUE(allocator.allocated(block));
+    // Past the block's own chunk, so every free block of its class is seen
+    const size_t blocks = 2 * options_.chunk_bytes / 256;
+    for (size_t i = 0; i < blocks; ++i) {
+        const PmemPtr<void> other = allocator.reserve(256);
+        ASSERT_NE(other, block) << "reserve " << i << " returned the published block";
+        EXPECT_FALSE(allocator.allocated(other));
+    }
+}
+
+} // namespace
+} // namespace woved::storage
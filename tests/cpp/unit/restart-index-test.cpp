@@ -0,0 +1,148 @@
+#include "storage/restart-index/restart-index.h"
+#include "util/hash.h"
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace woved::storage {
+namespace {
+
+// Restart index header, followed by the segment names and block sums
+constexpr std::streamoff kHeaderBytes = 64;
+
+class RestartIndexTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char dir[] = "/tmp/restart-index-test-XXXXXX";
+        ASSERT_NE(::mkdtemp(dir), nullptr);
+        dir_ = dir;
+        path_ = dir_ + "/restart-index";
+        map_.registerSegment(1, "seg-1");
+        map_.registerSegment(2, "seg-2");
+    }
+
+    void TearDown() override { std::filesystem::remove_all(dir_); }
+
+    void put(const std::string& id, VectorLocation::LocationType type, uint32_t segment, Epoch epoch,
+             bool tombstone = false) {
+        VectorLocation loc;
+        loc.type = type;
+        loc.segment_ordinal = segment;
+        loc.local_id = static_cast<uint32_t>(epoch);
+        loc.timestamp = Timestamp(0);
+        loc.epoch = epoch;
+        loc.tombstone = tombstone;
+        map_.upsert(id, util::hash_id(id), loc);
+    }
+
+    // Flip one byte of the written file
+    void corrupt(std::streamoff offset) const {
+        std::fstream file(path_, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(offset);
+        char byte = 0;
+        file.get(byte);
+        file.seekp(offset);
+        file.put(static_cast<char>(byte ^ 0x5a));
+    }
+
+    std::string dir_;
+    std::string path_;
+    LatestByIdMap map_{4, 16};
+};
+
+TEST_F(RestartIndexTest, RoundTripsDurableEntries) {
+    put("a", VectorLocation::SEGMENT, 1, 3);
+    put("b", VectorLocation::SEGMENT, 2, 4);
+    put("c", VectorLocation::DELETED, 0, 5, true);
+
+    EXPECT_EQ(RestartIndex::write(path_, map_, 5), 3u);
+    RestartIndex index(path_);
+    EXPECT_EQ(index.checkpointEpoch(), 5u);
+    EXPECT_EQ(index.size(), 3u);
+    EXPECT_EQ(index.segments(), (std::vector<std::pair<uint32_t, std::string>>{{1, "seg-1"}, {2, "seg-2"}}));
+
+    auto a = index.lookup(util::hash_id("a"));
+    ASSERT_TRUE(a);
+    EXPECT_EQ(a->segment(), 1u);
+    EXPECT_EQ(a->epoch(), 3u);
+    ASSERT_TRUE(index.lookup(util::hash_id("c")));
+    EXPECT_TRUE(index.lookup(util::hash_id("c"))->tombstone());
+    EXPECT_FALSE(index.lookup(util::hash_id("missing")));
+
+    LatestByIdMap loaded(8, 16);
+    index.loadInto(loaded, 2);
+    EXPECT_EQ(loaded.getStats().total_entries, 3u);
+    ASSERT_TRUE(loaded.getLatestByHash(util::hash_id("b")));
+    EXPECT_EQ(loaded.getLatestByHash(util::hash_id("b"))->segment_id, "seg-2");
+    EXPECT_FALSE(loaded.existsByHash(util::hash_id("c")));
+}
+
+TEST_F(RestartIndexTest, LeavesNewerEntriesToReplay) {
+    put("a", VectorLocation::SEGMENT, 1, 3);
+    put("b", VectorLocation::SEGMENT, 1, 8);
+    put("c", VectorLocation::BUFFER, 0, 9);
+
+    EXPECT_EQ(RestartIndex::write(path_, map_, 5), 1u);
+    RestartIndex index(path_);
+    EXPECT_TRUE(index.lookup(util::hash_id("a")));
+    EXPECT_FALSE(index.lookup(util::hash_id("b")));
+    EXPECT_FALSE(index.lookup(util::hash_id("c")));
+}
+
+TEST_F(RestartIndexTest, RefusesEpochCoveringBufferedEntries) {
+    put("a", VectorLocation::SEGMENT, 1, 3);
+    put("b", VectorLocation::BUFFER, 0, 5);
+
+    // Replay would start after epoch 5 and never bring "b" back
+    EXPECT_THROW(RestartIndex::write(path_, map_, 5), util::InvalidArgumentException);
+    EXPECT_THROW(RestartIndex::write(path_, map_, 6), util::InvalidArgumentException);
+    EXPECT_FALSE(std::filesystem::exists(path_));
+    EXPECT_FALSE(std::filesystem::exists(path_ + ".tmp"));
+
+    EXPECT_EQ(RestartIndex::write(path_, map_, 4), 1u);
+    EXPECT_EQ(RestartIndex(path_).checkpointEpoch(), 4u);
+}
+
+TEST_F(RestartIndexTest, RejectsCorruptHeader) {
+    put("a", VectorLocation::SEGMENT, 1, 3);
+    RestartIndex::write(path_, map_, 3);
+    corrupt(24);  // Entry count
+    EXPECT_THROW(RestartIndex index(path_), util::IOException);
+}
+
+TEST_F(RestartIndexTest, RejectsTruncatedFile) {
+    put("a", VectorLocation::SEGMENT, 1, 3);
+    RestartIndex::write(path_, map_, 3);
+    std::filesystem::resize_file(path_, std::filesystem::file_size(path_) - 1);
+    EXPECT_THROW(RestartIndex index(path_), util::IOException);
+}
+
+TEST_F(RestartIndexTest, CorruptBlockFailsOnFirstUse) {
+    for (int i = 0; i < 10; ++i) put("id-" + std::to_string(i), VectorLocation::SEGMENT, 1, 3);
+    RestartIndex::write(path_, map_, 3);
+    corrupt(static_cast<std::streamoff>(std::filesystem::file_size(path_)) - 1);
+
+    // Opening checks metadata only
+    RestartIndex index(path_);
+    EXPECT_THROW(index.lookup(util::hash_id("id-0")), util::IOException);
+
+    LatestByIdMap loaded(4, 16);
+    EXPECT_THROW(index.loadInto(loaded), util::IOException);
+    EXPECT_EQ(loaded.getStats().total_entries, 0u) << "corrupt checkpoint half-loaded";
+
+    RestartIndex unchecked(path_, false);
+    EXPECT_NO_THROW(unchecked.lookup(util::hash_id("id-0")));
+}
+
+TEST_F(RestartIndexTest, RejectsCorruptSegmentNames) {
+    put("a", VectorLocation::SEGMENT, 1, 3);
+    RestartIndex::write(path_, map_, 3);
+    corrupt(kHeaderBytes + 8);  // First byte of the first name
+    EXPECT_THROW(RestartIndex index(path_), util::IOException);
+}
+
+} // namespace
+} // namespace woved::storage
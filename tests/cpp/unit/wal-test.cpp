@@ -0,0 +1,905 @@
+#include "storage/manifest/recovery.h"
+#include "storage/wal/wal-streams.h"
+#include "util/exceptions.h"
+#include "util/hash.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace woved::storage {
+namespace {
+
+constexpr size_t kDim = 4;
+
+class WalTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char dir[] = "/tmp/wal-test-XXXXXX";
+        ASSERT_NE(::mkdtemp(dir), nullptr);
+        dir_ = dir;
+        // Appends sit in the open unit until a commit or the destructor
+        // writes it
+        options_.dir = dir_ + "/wal";
+        options_.group_commit_ms = 60000;
+        options_.fence_every_ms = 0;
+        options_.unit_bytes = 65536;
+        options_.preallocate = false;
+    }
+
+    void TearDown() override { std::filesystem::remove_all(dir_); }
+
+    WalStreams::Options streamOptions(size_t count) const {
+        WalStreams::Options options;
+        for (size_t i = 0; i < count; ++i) options.dirs.push_back(dir_ + "/stream-" + std::to_string(i));
+        options.stream = options_;
+        return options;
+    }
+
+    // Opaque 64-byte payload
+    static std::vector<std::byte> payload(uint8_t fill = 0x5a) {
+        return std::vector<std::byte>(64, static_cast<std::byte>(fill));
+    }
+
+    // 256 bytes of record-like text that compresses well, distinct per `i`
+    static std::vector<std::byte> textPayload(size_t i) {
+        const std::string line = "id=doc-" + std::to_string(i) + " tenant=acme namespace=products tags=red,green ";
+        std::vector<std::byte> out(256);
+        for (size_t pos = 0; pos < out.size(); ++pos) out[pos] = static_cast<std::byte>(line[pos % line.size()]);
+        return out;
+    }
+
+    // Upsert of `id` at `epoch` borrowing `vector`; the id is hashed
+    static WalRecordView upsert(std::string_view id, Epoch epoch, std::span<const float> vector) {
+        WalRecordView rec;
+        rec.id = id;
+        rec.id_hash = util::hash_id(id);
+        rec.epoch = epoch;
+        rec.timestamp_nanos = epoch * 1000;
+        rec.vector = vector;
+        return rec;
+    }
+
+    static std::vector<std::byte> encode(const WalRecordView& rec) {
+        std::vector<std::byte> out(WalRecordEncoder::size(rec));
+        EXPECT_EQ(WalRecordEncoder::encode(rec, out.data()), out.size());
+        return out;
+    }
+
+    static std::vector<std::byte> randomBytes(size_t size, uint32_t seed) {
+        std::vector<std::byte> out(size);
+        for (auto& b : out) {
+            seed = seed * 1664525u + 1013904223u;
+            b = static_cast<std::byte>(seed >> 24);
+        }
+        return out;
+    }
+
+    static std::vector<std::byte> readFile(const std::filesystem::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<char> raw((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::vector<std::byte> bytes(raw.size());
+        if (!raw.empty()) std::memcpy(bytes.data(), raw.data(), raw.size());
+        return bytes;
+    }
+
+    // Calls fn(header, payload) for each frame of `data` up to its zeroed
+    // end, checking each against its CRC
+    template <typename Fn>
+    static void walk(std::span<const std::byte> data, Fn&& fn) {
+        for (size_t pos = 0; pos + sizeof(WalFrameHeader) <= data.size();) {
+            WalFrameHeader hdr;
+            std::memcpy(&hdr, data.data() + pos, sizeof(hdr));
+            if (hdr.len == 0 && hdr.crc32c == 0 && hdr.epoch == 0) break;
+            EXPECT_LE(pos + sizeof(hdr) + hdr.size(), data.size()) << "frame at " << pos << " cut short";
+            if (pos + sizeof(hdr) + hdr.size() > data.size()) break;
+            auto payload = data.subspan(pos + sizeof(hdr), hdr.size());
+            EXPECT_EQ(WalFrameHeader::checksum(hdr.len, hdr.epoch, payload.data()), hdr.crc32c)
+                << "frame at " << pos;
+            fn(hdr, payload);
+            pos += WalFrameHeader::stride(hdr.size());
+        }
+    }
+
+    // Outer frames of one log file
+    static std::vector<WalFrameHeader> frames(const std::filesystem::path& path) {
+        std::vector<WalFrameHeader> out;
+        walk(readFile(path), [&](const WalFrameHeader& hdr, std::span<const std::byte>) { out.push_back(hdr); });
+        return out;
+    }
+
+    struct Frame {
+        Epoch epoch;
+        std::vector<std::byte> payload;
+    };
+
+    // Data frames (not fences or padding) of every log file in `dir`.
+    // Compressed units are expanded with a fresh codec per file, as
+    // recovery does.
+    static std::vector<Frame> dataFrames(const std::string& dir) {
+        std::vector<Frame> out;
+        for (const auto& path : WalStreams::logFiles(dir)) {
+            WalCodec codec(WalCodec::ZSTD, 0, 0);
+            auto collect = [&](const WalFrameHeader& hdr, std::span<const std::byte> payload) {
+                if (hdr.codec() == WalCodec::NONE && hdr.size() > 0) {
+                    out.push_back({hdr.epoch, {payload.begin(), payload.end()}});
+                }
+            };
+            walk(readFile(path), [&](const WalFrameHeader& hdr, std::span<const std::byte> payload) {
+                if (hdr.codec() == WalCodec::DICTIONARY) {
+                    codec.loadDictionary(payload);
+                } else if (hdr.codec() == WalCodec::LZ4 || hdr.codec() == WalCodec::ZSTD) {
+                    std::vector<std::byte> raw;
+                    codec.decompress(static_cast<WalCodec::Kind>(hdr.codec()), payload, raw);
+                    walk(raw, collect);
+                } else {
+                    collect(hdr, payload);
+                }
+            });
+        }
+        return out;
+    }
+
+    static std::vector<Epoch> dataEpochs(const std::string& dir) {
+        std::vector<Epoch> epochs;
+        for (const auto& frame : dataFrames(dir)) epochs.push_back(frame.epoch);
+        return epochs;
+    }
+
+    // Prepared spares (wal-spare-*.log) in the log directory, and every
+    // spare counting those still to be zeroed
+    size_t spares(bool ready_only = true) const {
+        size_t count = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(options_.dir)) {
+            const std::string name = entry.path().filename().string();
+            if (name.starts_with("wal-spare-") && (!ready_only || name.ends_with(".log"))) ++count;
+        }
+        return count;
+    }
+
+    bool waitForSpares(size_t count) const {
+        for (int i = 0; i < 1000 && spares() < count; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return spares() >= count;
+    }
+
+    // Preallocated logs of rotate_bytes, where three 3000-byte commits
+    // fill a file; each batch waits for the pool first
+    void usePool() {
+        options_.preallocate = true;
+        options_.pool_files = 2;
+        options_.rotate_bytes = 8192;
+    }
+
+    void commitFiles(WalManager& wal, size_t files, Epoch& epoch) {
+        const std::vector<std::byte> bytes(3000, std::byte{0x33});
+        for (size_t f = 0; f < files; ++f) {
+            ASSERT_TRUE(waitForSpares(options_.pool_files));
+            const uint64_t seq = wal.getStats().file_seq;
+            for (int i = 0; i < 3; ++i) wal.commit(bytes, epoch++);
+            // The committer rotates after waking the last commit
+            for (int i = 0; i < 1000 && wal.getStats().file_seq == seq; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            ASSERT_EQ(wal.getStats().file_seq, seq + 1);
+        }
+    }
+
+    // Replay `dirs` into a fresh buffer and map (none with `use_map`
+    // false)
+    WalReplayer::Stats replay(WalReplayer::Options replay, bool use_map = true) {
+        MessageBuffer::Config config;
+        config.shard_count = 4;
+        config.dim = kDim;
+        latest_ = std::make_shared<LatestByIdMap>(4, 64);
+        buffer_ = std::make_unique<MessageBuffer>(config, latest_);
+        replay.buffer_shards = config.shard_count;
+        return WalReplayer(replay, *buffer_, use_map ? latest_ : nullptr).run();
+    }
+
+    WalReplayer::Options replayOptions() const {
+        WalReplayer::Options options;
+        options.dirs = {options_.dir};
+        return options;
+    }
+
+    Epoch latestEpoch(const std::string& id) const {
+        auto loc = latest_->getPackedByHash(util::hash_id(id));
+        return loc ? loc->epoch() : 0;
+    }
+
+    // Versions of ids doc-0..doc-<ids - 1>, newest last; each id's
+    // second version is logged before its first
+    struct Version {
+        std::string id;
+        Epoch epoch;
+    };
+    static std::vector<Version> versions(size_t ids) {
+        std::vector<Version> out;
+        Epoch epoch = 1;
+        for (size_t round = 0; round < 3; ++round) {
+            for (size_t i = 0; i < ids; ++i) out.push_back({"doc-" + std::to_string(i), epoch++});
+        }
+        for (size_t i = 0; i < ids; ++i) std::swap(out[i].epoch, out[ids + i].epoch);
+        return out;
+    }
+
+    void writeVersions(const std::vector<Version>& log) {
+        const std::vector<float> vector(kDim, 1.0f);
+        WalManager wal(options_);
+        for (const auto& version : log) wal.append(upsert(version.id, version.epoch, vector));
+    }
+
+    std::string dir_;
+    WalManager::Options options_;
+    std::shared_ptr<LatestByIdMap> latest_;
+    std::unique_ptr<MessageBuffer> buffer_;
+};
+
+TEST_F(WalTest, ConcurrentCommitsAreDurableInOneLog) {
+    constexpr size_t kThreads = 8;
+    constexpr size_t kCommits = 64;
+    std::atomic<Epoch> next{1};
+    {
+        WalManager wal(options_);
+        std::vector<std::thread> writers;
+        for (size_t t = 0; t < kThreads; ++t) {
+            writers.emplace_back([&] {
+                for (size_t i = 0; i < kCommits; ++i) wal.commit(payload(), next.fetch_add(1));
+            });
+        }
+        for (auto& writer : writers) writer.join();
+
+        // Stats are published after the waiters are woken, so only the
+        // epochs are checked here
+        EXPECT_EQ(wal.durableEpoch(), kThreads * kCommits);
+        EXPECT_EQ(wal.pendingEpoch(), kLatestEpoch);
+    }
+
+    std::vector<Epoch> epochs = dataEpochs(options_.dir);
+    std::sort(epochs.begin(), epochs.end());
+    ASSERT_EQ(epochs.size(), kThreads * kCommits);
+    for (size_t i = 0; i < epochs.size(); ++i) EXPECT_EQ(epochs[i], i + 1);
+}
+
+TEST_F(WalTest, AppendIsWrittenWithinWindowButNotSynced) {
+    options_.group_commit_ms = 5;
+    WalManager wal(options_);
+    wal.append(payload(), 3);
+    for (int i = 0; i < 1000 && wal.getStats().units == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_EQ(wal.getStats().units, 1u);
+    EXPECT_EQ(wal.getStats().syncs, 0u);
+    EXPECT_EQ(wal.durableEpoch(), 0u);
+    EXPECT_EQ(wal.pendingEpoch(), 3u);
+
+    // The next durable unit syncs it too
+    wal.commit(payload(), 4);
+    EXPECT_EQ(wal.durableEpoch(), 4u);
+    EXPECT_EQ(wal.pendingEpoch(), kLatestEpoch);
+}
+
+TEST_F(WalTest, ShutdownWritesAppends) {
+    {
+        WalManager wal(options_);
+        for (Epoch epoch = 1; epoch <= 3; ++epoch) wal.append(payload(), epoch);
+        EXPECT_EQ(wal.getStats().units, 0u);
+    }
+    EXPECT_EQ(dataEpochs(options_.dir), (std::vector<Epoch>{1, 2, 3}));
+}
+
+TEST_F(WalTest, AbandonedReservationIsWrittenAsPadding) {
+    {
+        WalManager wal(options_);
+        { WalManager::Reservation reservation = wal.reserve(32); }
+        EXPECT_EQ(wal.pendingEpoch(), kLatestEpoch);
+        wal.commit(payload(), 7);
+    }
+    const auto files = WalStreams::logFiles(options_.dir);
+    ASSERT_EQ(files.size(), 1u);
+    const auto hdrs = frames(files[0]);
+    ASSERT_EQ(hdrs.size(), 2u);
+    EXPECT_EQ(hdrs[0].codec(), WalCodec::PADDING);
+    EXPECT_EQ(hdrs[1].codec(), WalCodec::NONE);
+    EXPECT_EQ(hdrs[1].epoch, 7u);
+}
+
+TEST_F(WalTest, OversizedRecordIsRejected) {
+    WalManager wal(options_);
+    EXPECT_THROW(wal.reserve(options_.unit_bytes), util::InvalidArgumentException);
+    std::vector<std::byte> large(options_.unit_bytes);
+    EXPECT_THROW(wal.commit(large, 1), util::InvalidArgumentException);
+    wal.commit(payload(), 2);
+    EXPECT_EQ(wal.durableEpoch(), 2u);
+}
+
+TEST_F(WalTest, EachRunStartsANewFile) {
+    { WalManager(options_).commit(payload(), 1); }
+    { WalManager(options_).commit(payload(), 2); }
+    const auto files = WalStreams::logFiles(options_.dir);
+    ASSERT_EQ(files.size(), 2u);
+    EXPECT_EQ(files[0].filename(), "wal-0000000000000001.log");
+    EXPECT_EQ(files[1].filename(), "wal-0000000000000002.log");
+    EXPECT_EQ(dataEpochs(options_.dir), (std::vector<Epoch>{1, 2}));
+}
+
+TEST_F(WalTest, CodecRoundTrips) {
+    std::vector<std::byte> in;
+    for (size_t i = 0; i < 16; ++i) {
+        auto text = textPayload(i);
+        in.insert(in.end(), text.begin(), text.end());
+    }
+    for (auto kind : {WalCodec::LZ4, WalCodec::ZSTD}) {
+        WalCodec codec(kind, 3, 0);
+        std::vector<std::byte> packed(codec.bound(in.size()));
+        const size_t n = codec.compress(in, packed);
+        ASSERT_GT(n, 0u) << "codec " << int(kind);
+        EXPECT_LT(n, in.size() / 2);
+
+        std::vector<std::byte> out;
+        WalCodec reader(WalCodec::ZSTD, 0, 0);
+        reader.decompress(kind, {packed.data(), n}, out);
+        EXPECT_EQ(out, in);
+
+        // Cut short, as by a torn write
+        EXPECT_THROW(reader.decompress(kind, {packed.data(), n / 2}, out), util::IOException);
+    }
+}
+
+TEST_F(WalTest, CodecDeclinesIncompressibleInput) {
+    const auto in = randomBytes(4096, 7);
+    for (auto kind : {WalCodec::NONE, WalCodec::LZ4, WalCodec::ZSTD}) {
+        WalCodec codec(kind, 3, 0);
+        std::vector<std::byte> packed(kind == WalCodec::NONE ? in.size() : codec.bound(in.size()));
+        EXPECT_EQ(codec.compress(in, packed), 0u) << "codec " << int(kind);
+    }
+}
+
+TEST_F(WalTest, CodecNames) {
+    EXPECT_EQ(WalCodec::parse("none"), WalCodec::NONE);
+    EXPECT_EQ(WalCodec::parse("lz4"), WalCodec::LZ4);
+    EXPECT_EQ(WalCodec::parse("zstd"), WalCodec::ZSTD);
+    EXPECT_THROW(WalCodec::parse("gzip"), util::ConfigException);
+}
+
+TEST_F(WalTest, CompressedUnitsReadBack) {
+    for (const char* compression : {"lz4", "zstd"}) {
+        SCOPED_TRACE(compression);
+        options_.dir = dir_ + "/" + compression;
+        options_.compression = compression;
+        options_.dict_bytes = 0;
+        std::vector<std::vector<std::byte>> written;
+        WalManager::Stats stats;
+        {
+            WalManager wal(options_);
+            for (size_t i = 0; i < 32; ++i) {
+                written.push_back(textPayload(i));
+                wal.append(written.back(), i + 1);
+            }
+            // Below the size worth compressing
+            written.push_back(textPayload(32));
+            wal.commit(written.back(), 33);
+            written.push_back(payload());
+            wal.commit(written.back(), 34);
+            stats = wal.getStats();
+        }
+        EXPECT_GE(stats.compressed_units, 1u);
+        EXPECT_LT(stats.compressed_units, stats.units);
+        EXPECT_LT(stats.bytes, stats.raw_bytes);
+
+        const auto frames = dataFrames(options_.dir);
+        ASSERT_EQ(frames.size(), written.size());
+        for (size_t i = 0; i < frames.size(); ++i) {
+            EXPECT_EQ(frames[i].epoch, i + 1);
+            EXPECT_EQ(frames[i].payload, written[i]) << "frame " << i;
+        }
+    }
+}
+
+TEST_F(WalTest, ZstdDictionaryStartsEveryLaterFile) {
+    options_.compression = "zstd";
+    options_.dict_bytes = 1024;
+    options_.rotate_bytes = 4096;
+    std::vector<std::vector<std::byte>> written;
+    {
+        WalManager wal(options_);
+        // Enough samples to train on, then enough units to rotate a few
+        // times with the dictionary
+        for (size_t i = 0; i < 400; ++i) {
+            written.push_back(textPayload(i));
+            wal.append(written.back(), i + 1);
+            if (i % 16 == 15) wal.commit(payload(), 0);
+        }
+    }
+    const auto files = WalStreams::logFiles(options_.dir);
+    ASSERT_GT(files.size(), 2u);
+    size_t with_dictionary = 0;
+    for (const auto& path : files) {
+        const auto hdrs = frames(path);
+        ASSERT_FALSE(hdrs.empty());
+        if (hdrs[0].codec() == WalCodec::DICTIONARY) {
+            ++with_dictionary;
+        } else {
+            EXPECT_EQ(with_dictionary, 0u) << path << " lacks the dictionary";
+        }
+    }
+    EXPECT_GE(with_dictionary, 1u);
+
+    // Every file decodes on its own
+    std::vector<std::vector<std::byte>> read;
+    for (const auto& frame : dataFrames(options_.dir)) {
+        if (frame.epoch != 0) read.push_back(frame.payload);
+    }
+    EXPECT_EQ(read, written);
+}
+
+TEST_F(WalTest, EncodedRecordReadsBack) {
+    const std::vector<float> vector{0.5f, -1.25f, 3.0f, 8.0f};
+    const TagSet tags{3, 17, 400};
+    WalRecordView rec = upsert("doc-1", 42, vector);
+    rec.uuid = VectorUuid{0x0123456789abcdefull, 0xfedcba9876543210ull};
+    rec.tenant_ns_hash = 99;
+    rec.tags = tags;
+    rec.flags = 5;
+    rec.centroid_id = 12;
+    rec.tenant = "acme";
+    rec.namespace_name = "products";
+
+    const auto buf = encode(rec);
+    EXPECT_EQ(buf.size() % 4, 0u);
+    WalRecordReader reader;
+    ASSERT_TRUE(reader.parse(buf));
+    EXPECT_EQ(reader.op(), WalOp::UPSERT);
+    EXPECT_EQ(reader.id(), "doc-1");
+    EXPECT_EQ(reader.idHash(), util::hash_id("doc-1"));
+    EXPECT_EQ(reader.uuid().hi, rec.uuid.hi);
+    EXPECT_EQ(reader.uuid().lo, rec.uuid.lo);
+    EXPECT_EQ(reader.tenantNsHash(), 99u);
+    EXPECT_EQ(reader.timestampNanos(), 42000u);
+    EXPECT_EQ(reader.epoch(), 42u);
+    EXPECT_EQ(reader.flags(), 5u);
+    EXPECT_EQ(reader.centroidId(), 12u);
+    EXPECT_EQ(reader.tenant(), "acme");
+    EXPECT_EQ(reader.namespaceName(), "products");
+    EXPECT_EQ(reader.elementType(), ElementType::FP32);
+    TagSet read_tags;
+    reader.tags(read_tags);
+    EXPECT_EQ(read_tags, tags);
+    Vector read_vector;
+    ASSERT_TRUE(reader.decodeVector(read_vector));
+    EXPECT_EQ(read_vector, vector);
+
+    BTreeMessage msg;
+    ASSERT_TRUE(reader.decodeMessage(msg));
+    EXPECT_EQ(msg.op, OperationType::UPSERT);
+    EXPECT_EQ(msg.epoch, 42u);
+    EXPECT_EQ(msg.entry.id, "doc-1");
+    EXPECT_EQ(msg.entry.vector, vector);
+    EXPECT_EQ(msg.entry.tags, tags);
+    EXPECT_EQ(msg.entry.centroid_id, 12u);
+    EXPECT_NE(msg.entry.tenant, 0u);
+}
+
+TEST_F(WalTest, EncodedRecordOmitsEmptyFields) {
+    WalRecordView rec;
+    rec.op = WalOp::DELETE;
+    rec.id_hash = 7;
+    rec.epoch = 3;
+
+    const auto buf = encode(rec);
+    WalRecordReader reader;
+    ASSERT_TRUE(reader.parse(buf));
+    EXPECT_EQ(reader.op(), WalOp::DELETE);
+    EXPECT_TRUE(reader.id().empty());
+    EXPECT_TRUE(reader.tenant().empty());
+    EXPECT_EQ(reader.dim(), 0u);
+    BTreeMessage msg;
+    ASSERT_TRUE(reader.decodeMessage(msg));
+    EXPECT_EQ(msg.op, OperationType::DELETE);
+    EXPECT_TRUE(msg.entry.deleted);
+    EXPECT_TRUE(msg.entry.vector.empty());
+
+    // Larger records only add their strings and vectors
+    const std::vector<float> vector(16, 1.0f);
+    EXPECT_GT(WalRecordEncoder::size(upsert("doc-1", 3, vector)), buf.size() + vector.size() * sizeof(float));
+}
+
+TEST_F(WalTest, QuantizedVectorsReadBack) {
+    std::vector<float> vector(32);
+    for (size_t i = 0; i < vector.size(); ++i) vector[i] = static_cast<float>(i) / 8.0f - 2.0f;
+    for (auto type : {ElementType::FP16, ElementType::BF16, ElementType::INT8}) {
+        SCOPED_TRACE(static_cast<int>(type));
+        WalRecordView rec = upsert("doc-1", 1, vector);
+        rec.element_type = type;
+        const auto buf = encode(rec);
+        EXPECT_LT(buf.size(), encode(upsert("doc-1", 1, vector)).size());
+
+        WalRecordReader reader;
+        ASSERT_TRUE(reader.parse(buf));
+        EXPECT_EQ(reader.elementType(), type);
+        Vector read;
+        ASSERT_TRUE(reader.decodeVector(read));
+        ASSERT_EQ(read.size(), vector.size());
+        for (size_t i = 0; i < vector.size(); ++i) EXPECT_NEAR(read[i], vector[i], 0.02f) << "lane " << i;
+    }
+}
+
+TEST_F(WalTest, ReaderRejectsMalformedRecords) {
+    const std::vector<float> vector{1.0f, 2.0f};
+    const auto buf = encode(upsert("doc-1", 1, vector));
+    WalRecordReader reader;
+    EXPECT_FALSE(reader.parse(std::span(buf).first(4)));
+
+    // Root offset past the end
+    auto bad = buf;
+    const uint32_t root = static_cast<uint32_t>(bad.size());
+    std::memcpy(bad.data(), &root, sizeof(root));
+    EXPECT_FALSE(reader.parse(bad));
+
+    // Cut through the vector's last lane (the empty tag vector follows
+    // it): the table parses, the vector does not decode
+    const auto cut = std::span(buf).first(buf.size() - sizeof(uint32_t) - sizeof(float));
+    ASSERT_TRUE(reader.parse(cut));
+    Vector read;
+    EXPECT_FALSE(reader.decodeVector(read));
+    ASSERT_TRUE(reader.parse(buf));
+    EXPECT_TRUE(reader.decodeVector(read));
+}
+
+TEST_F(WalTest, RecordsAreEncodedIntoTheLog) {
+    std::vector<std::vector<float>> vectors;
+    for (size_t i = 0; i < 8; ++i) vectors.emplace_back(4, static_cast<float>(i));
+    {
+        WalManager wal(options_);
+        for (size_t i = 0; i < vectors.size(); ++i) {
+            const std::string id = "doc-" + std::to_string(i);
+            if (i % 2 == 0) {
+                wal.append(upsert(id, i + 1, vectors[i]));
+            } else {
+                wal.commit(upsert(id, i + 1, vectors[i]));
+            }
+        }
+    }
+
+    const auto frames = dataFrames(options_.dir);
+    ASSERT_EQ(frames.size(), vectors.size());
+    for (size_t i = 0; i < frames.size(); ++i) {
+        WalRecordReader reader;
+        ASSERT_TRUE(reader.parse(frames[i].payload));
+        EXPECT_EQ(frames[i].epoch, i + 1);
+        EXPECT_EQ(reader.epoch(), i + 1);
+        EXPECT_EQ(reader.id(), "doc-" + std::to_string(i));
+        Vector read;
+        ASSERT_TRUE(reader.decodeVector(read));
+        EXPECT_EQ(read, vectors[i]);
+    }
+}
+
+TEST_F(WalTest, ReplayKeepsLaterEpochPerId) {
+    constexpr size_t kIds = 50;
+    writeVersions(versions(kIds));
+
+    for (size_t threads : {1, 4}) {
+        SCOPED_TRACE(threads);
+        for (bool use_map : {true, false}) {
+            WalReplayer::Options options = replayOptions();
+            options.threads = threads;
+            options.batch_records = 7;
+            options.queue_batches = 1;
+            const auto stats = replay(options, use_map);
+            EXPECT_EQ(stats.files, 1u);
+            EXPECT_EQ(stats.torn_files, 0u);
+            EXPECT_EQ(stats.frames, 3 * kIds);
+            // Each id's late first version is stale
+            EXPECT_EQ(stats.applied, 2 * kIds);
+            EXPECT_EQ(stats.stale, kIds);
+            EXPECT_EQ(stats.malformed, 0u);
+            EXPECT_EQ(stats.max_epoch, 3 * kIds);
+            EXPECT_EQ(buffer_->getStats().message_count, kIds);
+            if (use_map) {
+                for (size_t i = 0; i < kIds; ++i) EXPECT_EQ(latestEpoch("doc-" + std::to_string(i)), 2 * kIds + 1 + i);
+            }
+        }
+    }
+}
+
+TEST_F(WalTest, ReplaySkipsRecordsAtOrBelowStartEpoch) {
+    writeVersions(versions(10));
+    WalReplayer::Options options = replayOptions();
+    options.start_epoch = 20;
+    const auto stats = replay(options);
+    EXPECT_EQ(stats.before_start, 20u);
+    EXPECT_EQ(stats.applied, 10u);
+    EXPECT_EQ(latestEpoch("doc-3"), 24u);
+}
+
+TEST_F(WalTest, ReplayReadsFramesAcrossChunks) {
+    options_.direct_io = false;
+    writeVersions(versions(20));
+    WalReplayer::Options options = replayOptions();
+    options.read_bytes = 100;  // Smaller than one frame
+    const auto stats = replay(options);
+    EXPECT_EQ(stats.torn_files, 0u);
+    EXPECT_EQ(stats.applied, 40u);
+    EXPECT_EQ(stats.bytes, std::filesystem::file_size(WalStreams::logFiles(options_.dir).at(0)));
+}
+
+TEST_F(WalTest, ReplayStopsAtTornTail) {
+    options_.direct_io = false;
+    writeVersions(versions(10));
+    const auto path = WalStreams::logFiles(options_.dir).at(0);
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+
+    const auto stats = replay(replayOptions());
+    EXPECT_EQ(stats.torn_files, 1u);
+    EXPECT_EQ(stats.frames, 29u);
+    EXPECT_EQ(latestEpoch("doc-9"), 20u);
+    EXPECT_EQ(latestEpoch("doc-8"), 29u);
+}
+
+TEST_F(WalTest, ReplayStopsAtChecksumMismatch) {
+    options_.direct_io = false;
+    writeVersions(versions(10));
+    const auto path = WalStreams::logFiles(options_.dir).at(0);
+
+    // Flip a byte of the eleventh frame's payload
+    const auto data = readFile(path);
+    size_t pos = 0;
+    for (int i = 0; i < 10; ++i) {
+        WalFrameHeader hdr;
+        std::memcpy(&hdr, data.data() + pos, sizeof(hdr));
+        pos += WalFrameHeader::stride(hdr.size());
+    }
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(static_cast<std::streamoff>(pos + sizeof(WalFrameHeader) + 40));
+        file.put(static_cast<char>(data[pos + sizeof(WalFrameHeader) + 40] ^ std::byte{0x5a}));
+    }
+
+    auto stats = replay(replayOptions());
+    EXPECT_EQ(stats.torn_files, 1u);
+    EXPECT_EQ(stats.frames, 10u);
+    EXPECT_EQ(latestEpoch("doc-0"), 11u);
+
+    WalReplayer::Options unchecked = replayOptions();
+    unchecked.verify_checksums = false;
+    stats = replay(unchecked);
+    EXPECT_EQ(stats.torn_files, 0u);
+    EXPECT_EQ(stats.frames, 30u);
+}
+
+TEST_F(WalTest, ReplayExpandsCompressedUnits) {
+    options_.compression = "zstd";
+    options_.dict_bytes = 1024;
+    options_.rotate_bytes = 8192;
+    writeVersions(versions(400));
+    ASSERT_GT(WalStreams::logFiles(options_.dir).size(), 1u);
+
+    const auto stats = replay(replayOptions());
+    EXPECT_EQ(stats.torn_files, 0u);
+    EXPECT_EQ(stats.frames, 1200u);
+    EXPECT_EQ(stats.applied, 800u);
+    EXPECT_EQ(latestEpoch("doc-399"), 1200u);
+}
+
+TEST_F(WalTest, RotationRenamesPreparedSpares) {
+    usePool();
+    Epoch epoch = 1;
+    WalManager::Stats stats;
+    {
+        WalManager wal(options_);
+        commitFiles(wal, 4, epoch);
+        stats = wal.getStats();
+    }
+    // Only the first file of an empty directory is created
+    EXPECT_EQ(stats.pool_misses, 1u);
+    EXPECT_EQ(stats.pool_hits, 4u);
+    EXPECT_EQ(stats.file_seq, 5u);
+
+    const auto files = WalStreams::logFiles(options_.dir);
+    ASSERT_EQ(files.size(), 5u);
+    const auto preallocated = std::filesystem::file_size(files[1]);
+    EXPECT_GT(preallocated, options_.rotate_bytes);
+    for (size_t i = 2; i < files.size(); ++i) EXPECT_EQ(std::filesystem::file_size(files[i]), preallocated);
+
+    // Zeroed space past the last write reads as the end of each log
+    std::vector<Epoch> expected(12);
+    std::iota(expected.begin(), expected.end(), 1);
+    EXPECT_EQ(dataEpochs(options_.dir), expected);
+    const auto replayed = replay(replayOptions());
+    EXPECT_EQ(replayed.torn_files, 0u);
+    EXPECT_EQ(replayed.frames, 12u);
+}
+
+TEST_F(WalTest, RecycledLogsAreZeroedBeforeReuse) {
+    usePool();
+    Epoch epoch = 1;
+    WalManager wal(options_);
+    commitFiles(wal, 3, epoch);
+    const uint64_t open_seq = wal.getStats().file_seq;
+    ASSERT_EQ(open_seq, 4u);
+
+    EXPECT_EQ(wal.recycleBefore(open_seq), 3u);
+    EXPECT_EQ(wal.getStats().recycled_files, 3u);
+    EXPECT_EQ(WalStreams::logFiles(options_.dir).size(), 1u);
+    EXPECT_EQ(wal.recycleBefore(open_seq), 0u);
+
+    // Rotate through the recycled files: none of their records come back
+    const Epoch first_kept = epoch;
+    commitFiles(wal, 4, epoch);
+    for (Epoch e : dataEpochs(options_.dir)) EXPECT_GE(e, first_kept);
+    EXPECT_GE(wal.getStats().pool_hits, 7u);
+
+    // Recycled files beyond pool_files are deleted
+    for (int i = 0; i < 1000 && spares(false) > options_.pool_files; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_LE(spares(false), options_.pool_files);
+}
+
+TEST_F(WalTest, NextRunAdoptsPreparedSpares) {
+    usePool();
+    {
+        WalManager wal(options_);
+        ASSERT_TRUE(waitForSpares(options_.pool_files));
+    }
+    WalManager wal(options_);
+    EXPECT_EQ(wal.getStats().pool_hits, 1u);
+    EXPECT_EQ(wal.getStats().pool_misses, 0u);
+}
+
+TEST_F(WalTest, RecycleWithoutPoolDeletesLogs) {
+    for (Epoch epoch = 1; epoch <= 3; ++epoch) WalManager(options_).commit(payload(), epoch);
+    WalManager wal(options_);
+    EXPECT_EQ(wal.recycleBefore(3), 2u);
+    EXPECT_EQ(WalStreams::logFiles(options_.dir).size(), 2u);
+    EXPECT_EQ(dataEpochs(options_.dir), (std::vector<Epoch>{3}));
+    EXPECT_EQ(spares(false), 0u);
+}
+
+TEST_F(WalTest, StreamDurableEpochWaitsForLateLowerEpoch) {
+    WalStreams streams(streamOptions(1));
+    WalManager& wal = streams.stream(0);
+    wal.commit(payload(), 10);
+    EXPECT_EQ(streams.durableEpoch(), 10u);
+
+    // Lost the race to the log: pending behind a synced higher epoch
+    wal.append(payload(), 5);
+    EXPECT_EQ(wal.durableEpoch(), 10u);
+    EXPECT_EQ(wal.pendingEpoch(), 5u);
+    EXPECT_EQ(streams.durableEpoch(), 4u);
+
+    wal.commit(payload(), 11);
+    EXPECT_EQ(wal.pendingEpoch(), kLatestEpoch);
+    EXPECT_EQ(streams.durableEpoch(), 11u);
+}
+
+TEST_F(WalTest, StreamDurableEpochIsHeldByLaggingStream) {
+    WalStreams streams(streamOptions(2));
+    streams.stream(0).commit(payload(), 3);
+    streams.stream(1).append(payload(), 2);
+    EXPECT_EQ(streams.durableEpoch(), 1u);
+
+    streams.stream(1).commit(payload(), 4);
+    EXPECT_EQ(streams.durableEpoch(), 4u);
+}
+
+TEST_F(WalTest, StreamsKeepEveryVersionOfAnIdTogether) {
+    const std::vector<float> vector(kDim, 1.0f);
+    const auto options = streamOptions(4);
+    std::map<std::string, size_t> stream_of;
+    std::map<std::string, std::vector<Epoch>> appended;
+    {
+        WalStreams streams(options);
+        Epoch epoch = 1;
+        for (int round = 0; round < 2; ++round) {
+            for (size_t i = 0; i < 40; ++i) {
+                const std::string id = "doc-" + std::to_string(i);
+                const WalRecordView rec = upsert(id, epoch++, vector);
+                stream_of[id] = streams.streamIndex(rec);
+                appended[id].push_back(rec.epoch);
+                streams.append(rec);
+            }
+        }
+    }
+
+    std::set<size_t> used;
+    std::map<std::string, std::vector<Epoch>> logged;
+    for (size_t s = 0; s < options.dirs.size(); ++s) {
+        for (const auto& frame : dataFrames(options.dirs[s])) {
+            WalRecordReader reader;
+            ASSERT_TRUE(reader.parse(frame.payload));
+            const std::string id(reader.id());
+            EXPECT_EQ(stream_of.at(id), s) << id;
+            logged[id].push_back(frame.epoch);
+            used.insert(s);
+        }
+    }
+    // In append order within their stream
+    EXPECT_EQ(logged, appended);
+    EXPECT_GT(used.size(), 1u);
+}
+
+TEST_F(WalTest, TenantShardingKeepsATenantInOneStream) {
+    auto options = streamOptions(4);
+    options.sharding = WalStreams::Sharding::TENANT;
+    WalStreams streams(options);
+    const std::vector<float> vector(kDim, 1.0f);
+    WalRecordView a = upsert("doc-1", 1, vector);
+    WalRecordView b = upsert("doc-2", 2, vector);
+    a.tenant = b.tenant = "acme";
+    EXPECT_EQ(streams.streamIndex(a), streams.streamIndex(b));
+    EXPECT_EQ(streams.streamIndex(a), streams.streamIndex(0, "acme"));
+    EXPECT_LT(streams.streamIndex(a), streams.size());
+}
+
+TEST_F(WalTest, ReplayMergesStreamsByEpoch) {
+    const std::vector<float> vector(kDim, 1.0f);
+    const auto options = streamOptions(2);
+    {
+        // As if the stream count changed between runs: the id's versions
+        // are split across streams in either order
+        WalStreams streams(options);
+        streams.stream(0).commit(upsert("a", 5, vector));
+        streams.stream(1).commit(upsert("a", 3, vector));
+        streams.stream(0).commit(upsert("b", 2, vector));
+        streams.stream(1).commit(upsert("b", 4, vector));
+    }
+
+    WalReplayer::Options replay_options;
+    replay_options.dirs = options.dirs;
+    const auto stats = replay(replay_options);
+    EXPECT_EQ(stats.streams, 2u);
+    EXPECT_EQ(stats.files, 2u);
+    EXPECT_EQ(stats.frames, 4u);
+    EXPECT_EQ(stats.max_epoch, 5u);
+    EXPECT_EQ(latestEpoch("a"), 5u);
+    EXPECT_EQ(latestEpoch("b"), 4u);
+}
+
+TEST_F(WalTest, StreamOptionsAreValidated) {
+    auto options = streamOptions(2);
+    options.dirs[1] = options.dirs[0] + "/";
+    EXPECT_THROW(WalStreams{options}, util::ConfigException);
+    options.dirs.clear();
+    EXPECT_THROW(WalStreams{options}, util::ConfigException);
+    EXPECT_EQ(WalStreams::parseSharding("id_hash"), WalStreams::Sharding::ID_HASH);
+    EXPECT_EQ(WalStreams::parseSharding("tenant"), WalStreams::Sharding::TENANT);
+    EXPECT_THROW(WalStreams::parseSharding("round_robin"), util::ConfigException);
+
+    WalStreams streams(streamOptions(2));
+    EXPECT_EQ(streams.fileSeqs().size(), 2u);
+    EXPECT_THROW(streams.recycleBefore({1}), util::InvalidArgumentException);
+}
+
+TEST_F(WalTest, LogFilesAreListedInSequenceOrder) {
+    std::filesystem::create_directories(options_.dir);
+    for (const char* name : {"wal-0000000000000010.log", "wal-0000000000000002.log", "wal-spare-0000000000000001.log",
+                             "wal-0000000000000003.tmp", "notes.txt"}) {
+        std::ofstream(options_.dir + "/" + name) << "x";
+    }
+    const auto files = WalStreams::logFiles(options_.dir);
+    ASSERT_EQ(files.size(), 2u);
+    EXPECT_EQ(files[0].filename(), "wal-0000000000000002.log");
+    EXPECT_EQ(files[1].filename(), "wal-0000000000000010.log");
+    EXPECT_TRUE(WalStreams::logFiles(dir_ + "/missing").empty());
+}
+
+} // namespace
+} // namespace woved::storage
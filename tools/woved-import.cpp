@@ -0,0 +1,95 @@
+// woved-import: load vector files into a collection through its BulkImport
+// RPC. The files are read by the server, from its own filesystem, and
+// written straight into sealed segments.
+//
+//   woved-import [--server host:port] [--ids FILE] [--tenant T]
+//                [--namespace N] [--stable] [--train] FILE...
+
+#include "proto/woved.grpc.pb.h"
+#include <grpcpp/grpcpp.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+namespace {
+
+void usage() {
+    std::fprintf(stderr,
+                 "usage: woved-import [--server host:port] [--ids FILE] [--tenant T] [--namespace N]\n"
+                 "                    [--stable] [--train] FILE...\n"
+                 "\n"
+                 "FILE is .fvecs, .bvecs or .npy (2-D <f4, <f2, <f8 or |u1), read as one sequence of rows.\n"
+                 "  --server     gRPC address (default localhost:9090)\n"
+                 "  --ids        one id per line, in row order; default: server-assigned UUIDv7s\n"
+                 "  --tenant     tenant of every row\n"
+                 "  --namespace  namespace of every row\n"
+                 "  --stable     build stable (IVF-PQ) segments instead of delta segments\n"
+                 "  --train      retrain the global centroids even if the collection has them\n");
+}
+
+// Paths go to the server as absolute paths
+std::string absolute(const char* path) {
+    std::error_code ec;
+    auto p = std::filesystem::absolute(path, ec);
+    return ec ? std::string(path) : p.string();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string server = "localhost:9090";
+    woved::v1::BulkImportRequest request;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                std::fprintf(stderr, "woved-import: %s needs a value\n", arg);
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (std::strcmp(arg, "--server") == 0) {
+            server = value();
+        } else if (std::strcmp(arg, "--ids") == 0) {
+            request.set_ids_file(absolute(value()));
+        } else if (std::strcmp(arg, "--tenant") == 0) {
+            request.set_tenant(value());
+        } else if (std::strcmp(arg, "--namespace") == 0) {
+            request.set_namespace_(value());
+        } else if (std::strcmp(arg, "--stable") == 0) {
+            request.set_stable(true);
+        } else if (std::strcmp(arg, "--train") == 0) {
+            request.set_train_centroids(true);
+        } else if (std::strcmp(arg, "-h") == 0 || std::strcmp(arg, "--help") == 0) {
+            usage();
+            return 0;
+        } else if (arg[0] == '-') {
+            std::fprintf(stderr, "woved-import: unknown option %s\n", arg);
+            usage();
+            return 2;
+        } else {
+            request.add_files(absolute(arg));
+        }
+    }
+    if (request.files_size() == 0) {
+        usage();
+        return 2;
+    }
+
+    auto stub = woved::v1::VectorService::NewStub(grpc::CreateChannel(server, grpc::InsecureChannelCredentials()));
+    grpc::ClientContext context;
+    woved::v1::BulkImportResponse response;
+    const grpc::Status status = stub->BulkImport(&context, request, &response);
+    if (!status.ok()) {
+        std::fprintf(stderr, "woved-import: %s\n", status.error_message().c_str());
+        return 1;
+    }
+    std::printf("imported %llu rows into %d %s segments at epoch %llu in %.1f s%s\n",
+                static_cast<unsigned long long>(response.rows()), response.segment_ids_size(),
+                request.stable() ? "stable" : "delta", static_cast<unsigned long long>(response.epoch()),
+                response.elapsed_s(), response.trained_centroids() ? " (centroids trained)" : "");
+    for (const auto& id : response.segment_ids()) std::printf("  %s\n", id.c_str());
+    return 0;
+}